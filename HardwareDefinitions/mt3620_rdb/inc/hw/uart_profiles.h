@@ -0,0 +1,36 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// This file defines the settings with which the samples open the UARTs which connect to external
+// MCUs, as initializers for arrays of UartTransport_Profile. The profiles are listed fastest
+// first; the UART transport falls back to the next profile if the link loses too many messages in
+// a row. Include <applibs/uart.h> before this file.
+//
+// By default only the baud rate which the MCU firmware uses is listed. Define
+// SAMPLE_UART_HIGH_BAUD to try faster rates first; the MCU firmware must then be configured to
+// use the fastest rate.
+
+#pragma once
+
+// MT3620 RDB: The nRF52 UART uses RTS/CTS flow control, using
+// header 2, pin 5 (CTS) and pin 7 (RTS).
+#ifdef SAMPLE_UART_HIGH_BAUD
+#define SAMPLE_NRF52_UART_PROFILES                                             \
+    {                                                                          \
+        {1000000, UART_FlowControl_RTSCTS}, {460800, UART_FlowControl_RTSCTS}, \
+        {115200, UART_FlowControl_RTSCTS}                                      \
+    }
+#else
+#define SAMPLE_NRF52_UART_PROFILES { {115200, UART_FlowControl_RTSCTS} }
+#endif
+
+// MT3620 RDB: The STM32 UART has no flow control lines, and the STM32 wakes from STOP mode on the
+// first byte of each message, so its fast rate is more conservative.
+#ifdef SAMPLE_UART_HIGH_BAUD
+#define SAMPLE_STM32_UART_PROFILES                                          \
+    {                                                                       \
+        {230400, UART_FlowControl_None}, {115200, UART_FlowControl_None}    \
+    }
+#else
+#define SAMPLE_STM32_UART_PROFILES { {115200, UART_FlowControl_None} }
+#endif
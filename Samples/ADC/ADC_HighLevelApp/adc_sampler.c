@@ -0,0 +1,118 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <string.h>
+
+#include <applibs/log.h>
+
+#include "adc_sampler.h"
+
+static uint32_t ToMicrovolts(const AdcSampler *sampler, uint64_t sum, uint32_t count);
+static void ResetInterval(AdcSampler_Channel *channel);
+
+int AdcSampler_Init(AdcSampler *sampler, int adcFd, const ADC_ChannelId *channels,
+                    size_t channelCount, int sampleBitCount, uint32_t referenceMicrovolts,
+                    unsigned int oversampling)
+{
+    if (channelCount == 0 || channelCount > ADC_SAMPLER_MAX_CHANNELS || sampleBitCount <= 0 ||
+        sampleBitCount > 31 || oversampling == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    memset(sampler, 0, sizeof(*sampler));
+    sampler->adcFd = adcFd;
+    sampler->maxSample = (1u << sampleBitCount) - 1;
+    sampler->referenceMicrovolts = referenceMicrovolts;
+    sampler->oversampling = oversampling;
+    sampler->channelCount = channelCount;
+
+    for (size_t i = 0; i < channelCount; ++i) {
+        sampler->channels[i].channel = channels[i];
+        ResetInterval(&sampler->channels[i]);
+    }
+
+    return 0;
+}
+
+static void ResetInterval(AdcSampler_Channel *channel)
+{
+    channel->count = 0;
+    channel->sum = 0;
+    channel->min = UINT32_MAX;
+    channel->max = 0;
+}
+
+int AdcSampler_Scan(AdcSampler *sampler)
+{
+    for (size_t i = 0; i < sampler->channelCount; ++i) {
+        AdcSampler_Channel *channel = &sampler->channels[i];
+
+        for (unsigned int n = 0; n < sampler->oversampling; ++n) {
+            uint32_t value;
+            if (ADC_Poll(sampler->adcFd, channel->channel, &value) == -1) {
+                Log_Debug("ADC_Poll failed with error: %s (%d)\n", strerror(errno), errno);
+                return -1;
+            }
+
+            ++channel->count;
+            channel->sum += value;
+            if (value < channel->min) {
+                channel->min = value;
+            }
+            if (value > channel->max) {
+                channel->max = value;
+            }
+
+            channel->history[channel->totalCount & (ADC_SAMPLER_HISTORY_LENGTH - 1)] = value;
+            ++channel->totalCount;
+        }
+    }
+
+    return 0;
+}
+
+// Converts the mean of a number of raw samples to microvolts, rounding to nearest.
+static uint32_t ToMicrovolts(const AdcSampler *sampler, uint64_t sum, uint32_t count)
+{
+    uint64_t divisor = (uint64_t)count * sampler->maxSample;
+    return (uint32_t)((sum * sampler->referenceMicrovolts + divisor / 2) / divisor);
+}
+
+void AdcSampler_TakeReport(AdcSampler *sampler, size_t index, AdcSampler_Report *report)
+{
+    AdcSampler_Channel *channel = &sampler->channels[index];
+
+    memset(report, 0, sizeof(*report));
+    report->channel = channel->channel;
+    report->count = channel->count;
+    if (channel->count > 0) {
+        report->meanMicrovolts = ToMicrovolts(sampler, channel->sum, channel->count);
+        report->minMicrovolts = ToMicrovolts(sampler, channel->min, 1);
+        report->maxMicrovolts = ToMicrovolts(sampler, channel->max, 1);
+    }
+
+    ResetInterval(channel);
+}
+
+size_t AdcSampler_GetHistory(const AdcSampler *sampler, size_t index, uint32_t *samples,
+                             size_t maxCount)
+{
+    const AdcSampler_Channel *channel = &sampler->channels[index];
+
+    size_t count = channel->totalCount;
+    if (count > ADC_SAMPLER_HISTORY_LENGTH) {
+        count = ADC_SAMPLER_HISTORY_LENGTH;
+    }
+    if (count > maxCount) {
+        count = maxCount;
+    }
+
+    uint32_t first = channel->totalCount - (uint32_t)count;
+    for (size_t i = 0; i < count; ++i) {
+        samples[i] = channel->history[(first + i) & (ADC_SAMPLER_HISTORY_LENGTH - 1)];
+    }
+
+    return count;
+}
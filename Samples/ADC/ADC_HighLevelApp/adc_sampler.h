@@ -0,0 +1,122 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <applibs/adc.h>
+
+/// <summary>Maximum number of channels which one sampler can scan.</summary>
+#define ADC_SAMPLER_MAX_CHANNELS 8
+
+/// <summary>
+///     Number of the most recent raw samples which are kept for each channel. This must be a
+///     power of two.
+/// </summary>
+#define ADC_SAMPLER_HISTORY_LENGTH 64
+
+_Static_assert((ADC_SAMPLER_HISTORY_LENGTH & (ADC_SAMPLER_HISTORY_LENGTH - 1)) == 0,
+               "ADC_SAMPLER_HISTORY_LENGTH must be a power of two");
+
+/// <summary>
+///     Samples of one channel. The client should not directly modify member variables.
+/// </summary>
+typedef struct {
+    /// <summary>Channel which is sampled.</summary>
+    ADC_ChannelId channel;
+    /// <summary>Number of samples since the last report.</summary>
+    uint32_t count;
+    /// <summary>Sum of the samples since the last report.</summary>
+    uint64_t sum;
+    /// <summary>Smallest sample since the last report.</summary>
+    uint32_t min;
+    /// <summary>Largest sample since the last report.</summary>
+    uint32_t max;
+    /// <summary>Total number of samples, which selects the next slot in history.</summary>
+    uint32_t totalCount;
+    /// <summary>The most recent raw samples, in a ring buffer.</summary>
+    uint32_t history[ADC_SAMPLER_HISTORY_LENGTH];
+} AdcSampler_Channel;
+
+/// <summary>
+///     Scans a set of channels on one ADC controller, and accumulates statistics about them
+///     between reports. The client should not directly modify member variables.
+/// </summary>
+typedef struct {
+    /// <summary>ADC controller, which is used but not closed by the sampler.</summary>
+    int adcFd;
+    /// <summary>Largest raw sample value, which corresponds to the reference voltage.</summary>
+    uint32_t maxSample;
+    /// <summary>Reference voltage in microvolts.</summary>
+    uint32_t referenceMicrovolts;
+    /// <summary>Number of samples which are taken of each channel on each scan.</summary>
+    unsigned int oversampling;
+    /// <summary>Number of channels in channels.</summary>
+    size_t channelCount;
+    /// <summary>State of each channel.</summary>
+    AdcSampler_Channel channels[ADC_SAMPLER_MAX_CHANNELS];
+} AdcSampler;
+
+/// <summary>
+///     Statistics about one channel over a reporting interval, in microvolts. Averaging four
+///     samples gives one more bit of resolution than a single sample, so the mean has a finer
+///     resolution than the ADC when oversampling is used.
+/// </summary>
+typedef struct {
+    /// <summary>Channel which was sampled.</summary>
+    ADC_ChannelId channel;
+    /// <summary>Number of samples in the interval. The other fields are zero if this
+    /// is zero.</summary>
+    uint32_t count;
+    /// <summary>Mean of the samples.</summary>
+    uint32_t meanMicrovolts;
+    /// <summary>Smallest sample.</summary>
+    uint32_t minMicrovolts;
+    /// <summary>Largest sample.</summary>
+    uint32_t maxMicrovolts;
+} AdcSampler_Report;
+
+/// <summary>
+///     <para>Initializes a sampler. The reference voltage must already have been set on each
+///     channel with ADC_SetReferenceVoltage.</para>
+///     <param name="sampler">Sampler to initialize.</param>
+///     <param name="adcFd">ADC controller returned by ADC_Open.</param>
+///     <param name="channels">Channels to scan, in order.</param>
+///     <param name="channelCount">Number of channels, at most ADC_SAMPLER_MAX_CHANNELS.</param>
+///     <param name="sampleBitCount">Value returned by ADC_GetSampleBitCount.</param>
+///     <param name="referenceMicrovolts">Reference voltage in microvolts.</param>
+///     <param name="oversampling">Number of samples of each channel per scan.</param>
+///     <returns>0 on success, or -1 if an argument was invalid.</returns>
+/// </summary>
+int AdcSampler_Init(AdcSampler *sampler, int adcFd, const ADC_ChannelId *channels,
+                    size_t channelCount, int sampleBitCount, uint32_t referenceMicrovolts,
+                    unsigned int oversampling);
+
+/// <summary>
+///     Samples each channel in turn, and adds the samples to its statistics and history. No
+///     conversion to voltage is done.
+///     <param name="sampler">Sampler initialized with AdcSampler_Init.</param>
+///     <returns>0 on success, or -1 if ADC_Poll failed, in which case errno is set.</returns>
+/// </summary>
+int AdcSampler_Scan(AdcSampler *sampler);
+
+/// <summary>
+///     Gets the statistics of a channel since its last report, and starts a new interval.
+///     <param name="sampler">Sampler initialized with AdcSampler_Init.</param>
+///     <param name="index">Index of the channel in the array passed to AdcSampler_Init.</param>
+///     <param name="report">Receives the statistics.</param>
+/// </summary>
+void AdcSampler_TakeReport(AdcSampler *sampler, size_t index, AdcSampler_Report *report);
+
+/// <summary>
+///     Copies the most recent raw samples of a channel, oldest first.
+///     <param name="sampler">Sampler initialized with AdcSampler_Init.</param>
+///     <param name="index">Index of the channel in the array passed to AdcSampler_Init.</param>
+///     <param name="samples">Receives the samples.</param>
+///     <param name="maxCount">Maximum number of samples to copy.</param>
+///     <returns>Number of samples which were copied.</returns>
+/// </summary>
+size_t AdcSampler_GetHistory(const AdcSampler *sampler, size_t index, uint32_t *samples,
+                             size_t maxCount);
@@ -12,6 +12,7 @@
 // - eventloop (system invokes handlers for timer events)
 
 #include <errno.h>
+#include <inttypes.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdlib.h>
@@ -38,6 +39,7 @@
 // See https://aka.ms/AzureSphereHardwareDefinitions for more details.
 #include <hw/sample_appliance.h>
 
+#include "adc_sampler.h"
 #include "eventloop_timer_utilities.h"
 
 /// <summary>
@@ -60,7 +62,9 @@ typedef enum {
     ExitCode_Init_SetRefVoltage = 8,
     ExitCode_Init_AdcPollTimer = 9,
 
-    ExitCode_Main_EventLoopFail = 10
+    ExitCode_Main_EventLoopFail = 10,
+
+    ExitCode_Init_AdcSampler = 11
 } ExitCode;
 
 // File descriptors - initialized to invalid value
@@ -75,6 +79,20 @@ static int sampleBitCount = -1;
 // The maximum voltage
 static float sampleMaxVoltage = 2.5f;
 
+// Channels which are scanned. Further channels on the same controller can be added here.
+static const ADC_ChannelId adcChannels[] = {SAMPLE_POTENTIOMETER_ADC_CHANNEL};
+static const size_t adcChannelCount = sizeof(adcChannels) / sizeof(adcChannels[0]);
+
+// Each channel is sampled this many times per scan. Averaging 4^n samples adds n bits of
+// resolution to the mean.
+static const unsigned int adcOversampling = 4;
+
+// The channels are scanned every 10ms, and a report is displayed every 100 scans.
+static const struct timespec adcScanPeriod = {.tv_sec = 0, .tv_nsec = 10 * 1000 * 1000};
+static const unsigned int adcScansPerReport = 100;
+
+static AdcSampler adcSampler;
+
 // Termination state
 static volatile sig_atomic_t exitCode = ExitCode_Success;
 
@@ -94,26 +112,38 @@ static void TerminationHandler(int signalNumber)
 }
 
 /// <summary>
-///     Handle polling timer event: takes a single reading from ADC channelId,
-///     every second, outputting the result.
+///     Handle polling timer event: scans each ADC channel, and once every reporting interval
+///     outputs the mean, minimum, and maximum voltage of each channel over the interval.
 /// </summary>
 static void AdcPollingEventHandler(EventLoopTimer *timer)
 {
+    static unsigned int scanCount = 0;
+
     if (ConsumeEventLoopTimerEvent(timer) != 0) {
         exitCode = ExitCode_AdcTimerHandler_Consume;
         return;
     }
 
-    uint32_t value;
-    int result = ADC_Poll(adcControllerFd, SAMPLE_POTENTIOMETER_ADC_CHANNEL, &value);
-    if (result == -1) {
-        Log_Debug("ADC_Poll failed with error: %s (%d)\n", strerror(errno), errno);
+    if (AdcSampler_Scan(&adcSampler) == -1) {
         exitCode = ExitCode_AdcTimerHandler_Poll;
         return;
     }
 
-    float voltage = ((float)value * sampleMaxVoltage) / (float)((1 << sampleBitCount) - 1);
-    Log_Debug("The out sample value is %.3f V\n", voltage);
+    if (++scanCount < adcScansPerReport) {
+        return;
+    }
+    scanCount = 0;
+
+    for (size_t i = 0; i < adcChannelCount; ++i) {
+        AdcSampler_Report report;
+        AdcSampler_TakeReport(&adcSampler, i, &report);
+        Log_Debug("The out sample value is %" PRIu32 ".%04" PRIu32 " V (min %" PRIu32
+                  ".%03" PRIu32 " V, max %" PRIu32 ".%03" PRIu32 " V, %" PRIu32 " samples)\n",
+                  report.meanMicrovolts / 1000000, (report.meanMicrovolts % 1000000) / 100,
+                  report.minMicrovolts / 1000000, (report.minMicrovolts % 1000000) / 1000,
+                  report.maxMicrovolts / 1000000, (report.maxMicrovolts % 1000000) / 1000,
+                  report.count);
+    }
 }
 
 /// <summary>
@@ -142,7 +172,8 @@ static ExitCode InitPeripheralsAndHandlers(void)
         return ExitCode_Init_AdcOpen;
     }
 
-    sampleBitCount = ADC_GetSampleBitCount(adcControllerFd, SAMPLE_POTENTIOMETER_ADC_CHANNEL);
+    // The channels are on the same controller, so they all have the same sample size.
+    sampleBitCount = ADC_GetSampleBitCount(adcControllerFd, adcChannels[0]);
     if (sampleBitCount == -1) {
         Log_Debug("ADC_GetSampleBitCount failed with error : %s (%d)\n", strerror(errno), errno);
         return ExitCode_Init_GetBitCount;
@@ -152,16 +183,23 @@ static ExitCode InitPeripheralsAndHandlers(void)
         return ExitCode_Init_UnexpectedBitCount;
     }
 
-    int result = ADC_SetReferenceVoltage(adcControllerFd, SAMPLE_POTENTIOMETER_ADC_CHANNEL,
-                                         sampleMaxVoltage);
-    if (result == -1) {
-        Log_Debug("ADC_SetReferenceVoltage failed with error : %s (%d)\n", strerror(errno), errno);
-        return ExitCode_Init_SetRefVoltage;
+    for (size_t i = 0; i < adcChannelCount; ++i) {
+        int result = ADC_SetReferenceVoltage(adcControllerFd, adcChannels[i], sampleMaxVoltage);
+        if (result == -1) {
+            Log_Debug("ADC_SetReferenceVoltage failed with error : %s (%d)\n", strerror(errno),
+                      errno);
+            return ExitCode_Init_SetRefVoltage;
+        }
+    }
+
+    uint32_t sampleMaxMicrovolts = (uint32_t)(sampleMaxVoltage * 1000000.0f + 0.5f);
+    if (AdcSampler_Init(&adcSampler, adcControllerFd, adcChannels, adcChannelCount,
+                        sampleBitCount, sampleMaxMicrovolts, adcOversampling) == -1) {
+        Log_Debug("AdcSampler_Init failed with error : %s (%d)\n", strerror(errno), errno);
+        return ExitCode_Init_AdcSampler;
     }
 
-    struct timespec adcCheckPeriod = {.tv_sec = 1, .tv_nsec = 0};
-    adcPollTimer =
-        CreateEventLoopPeriodicTimer(eventLoop, &AdcPollingEventHandler, &adcCheckPeriod);
+    adcPollTimer = CreateEventLoopPeriodicTimer(eventLoop, &AdcPollingEventHandler, &adcScanPeriod);
     if (adcPollTimer == NULL) {
         return ExitCode_Init_AdcPollTimer;
     }
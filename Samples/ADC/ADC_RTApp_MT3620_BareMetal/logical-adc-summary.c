@@ -0,0 +1,305 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <stdbool.h>
+
+#include "logical-adc-summary.h"
+#include "logical-dpc.h"
+#include "logical-timer.h"
+
+#include "mt3620-adc.h"
+#include "mt3620-timer.h"
+
+// Running aggregates of one channel. Each frequency bin is computed with the Goertzel algorithm,
+// which needs two state variables per bin, so the samples do not have to be buffered.
+typedef struct {
+    uint32_t count;
+    uint16_t min;
+    uint16_t max;
+    uint32_t sum;
+    uint64_t sumOfSquares;
+    int64_t binState1[ADC_SUMMARY_MAX_BINS];
+    int64_t binState2[ADC_SUMMARY_MAX_BINS];
+} ChannelAccumulator;
+
+static void HandleDrainTimerIrq(void);
+static void HandleDrainTimerDeferred(void);
+static void AddSample(ChannelAccumulator *acc, uint16_t sample);
+static void ResetWindow(void);
+static void SendSummary(void);
+static uint64_t BinMagnitude(int64_t state1, int64_t state2, int32_t coefficient);
+static int32_t CosineQ30(uint32_t turn);
+static uint32_t SquareRoot(uint64_t value);
+
+// The ADC's FIFO is drained this often. Samples arrive at the sample rate times the number of
+// channels, so if the summaries report overruns, this period should be shortened.
+static const uint32_t drainPeriodUs = 1000;
+
+// Goertzel coefficients are 2cos(w) in Q28 fixed point. Low frequencies need the precision, because
+// their coefficients are close to 2.
+#define COEFFICIENT_FRACTION_BITS 28
+
+// Samples are offset by half the ADC's range before they are fed to the frequency bins, so that
+// the bins' state stays small.
+#define SAMPLE_OFFSET ((MT3620_ADC_MAX_SAMPLE + 1) / 2)
+
+// The timer and DPC callbacks do not take an argument, so the summary state is held here.
+static IntercoreComm *summaryIcc = NULL;
+static const ComponentId *summaryDestAppId = NULL;
+static AdcSummarySettings summarySettings;
+static uint32_t actualSampleRateHz = 0;
+static int32_t binCoefficients[ADC_SUMMARY_MAX_BINS];
+static uint8_t channelCount = 0;
+static bool running = false;
+
+static SoftTimer drainTimer = {.next = NULL, .active = false, .cb = HandleDrainTimerIrq};
+static CallbackNode drainCbNode = {
+    .enqueued = false, .cb = HandleDrainTimerDeferred, .priority = DpcPriority_High};
+
+static ChannelAccumulator accumulators[MT3620_ADC_CHANNEL_COUNT];
+static uint8_t fullChannels = 0;
+static uint32_t windowStartUs = 0;
+static uint32_t lastSampleUs = 0;
+static uint32_t windowOverruns = 0;
+static uint32_t summarySequence = 0;
+static uint32_t droppedSummaries = 0;
+
+// Runs in IRQ context, and schedules HandleDrainTimerDeferred to read the FIFO, because the
+// summaries take too long to compute with other interrupts blocked.
+static void HandleDrainTimerIrq(void)
+{
+    EnqueueDeferredProc(&drainCbNode);
+}
+
+// Queued by HandleDrainTimerIrq. Reads every sample in the FIFO and adds it to the window.
+static void HandleDrainTimerDeferred(void)
+{
+    if (!running) {
+        return;
+    }
+
+    if (MT3620_Adc_TakeOverrun()) {
+        ++windowOverruns;
+    }
+
+    uint32_t nowUs = MT3620_Gpt_ReadMicroseconds();
+    uint8_t channel;
+    uint16_t sample;
+    while (MT3620_Adc_ReadSample(&channel, &sample)) {
+        uint8_t mask = (uint8_t)(1U << channel);
+        if ((summarySettings.channelMap & mask) == 0) {
+            continue;
+        }
+
+        // After an overrun, the channels can be out of step by one sample. A channel which has
+        // a full window ignores its samples until the others have caught up.
+        if ((fullChannels & mask) != 0) {
+            continue;
+        }
+
+        if (fullChannels == 0 && accumulators[channel].count == 0) {
+            windowStartUs = nowUs;
+        }
+        lastSampleUs = nowUs;
+
+        ChannelAccumulator *acc = &accumulators[channel];
+        AddSample(acc, sample);
+        if (acc->count == summarySettings.samplesPerWindow) {
+            fullChannels |= mask;
+        }
+
+        if (fullChannels == summarySettings.channelMap) {
+            SendSummary();
+            ResetWindow();
+        }
+    }
+}
+
+static void AddSample(ChannelAccumulator *acc, uint16_t sample)
+{
+    if (acc->count == 0 || sample < acc->min) {
+        acc->min = sample;
+    }
+    if (acc->count == 0 || sample > acc->max) {
+        acc->max = sample;
+    }
+    acc->sum += sample;
+    acc->sumOfSquares += (uint32_t)sample * sample;
+    ++acc->count;
+
+    int32_t x = (int32_t)sample - SAMPLE_OFFSET;
+    for (uint8_t bin = 0; bin < summarySettings.binCount; ++bin) {
+        int64_t state0 = x + ((binCoefficients[bin] * acc->binState1[bin]) >>
+                              COEFFICIENT_FRACTION_BITS) -
+                         acc->binState2[bin];
+        acc->binState2[bin] = acc->binState1[bin];
+        acc->binState1[bin] = state0;
+    }
+}
+
+static void ResetWindow(void)
+{
+    __builtin_memset(accumulators, 0, sizeof(accumulators));
+    fullChannels = 0;
+    windowOverruns = 0;
+}
+
+// Reduces the window to a summary and sends it. If the outbound buffer is full, the summary is
+// dropped and counted in the next one, rather than delaying sampling.
+static void SendSummary(void)
+{
+    AdcSummary summary = {.magic = ADC_SUMMARY_MAGIC,
+                          .version = ADC_SUMMARY_VERSION,
+                          .channelCount = channelCount,
+                          .channelMap = summarySettings.channelMap,
+                          .binCount = summarySettings.binCount,
+                          .reserved = 0,
+                          .sequence = summarySequence++,
+                          .windowStartUs = windowStartUs,
+                          .windowDurationUs = lastSampleUs - windowStartUs,
+                          .sampleRateHz = actualSampleRateHz,
+                          .sampleCount = summarySettings.samplesPerWindow,
+                          .overruns = windowOverruns,
+                          .droppedSummaries = droppedSummaries};
+
+    __builtin_memcpy(summary.binFrequenciesHz, summarySettings.binFrequenciesHz,
+                     sizeof(summary.binFrequenciesHz));
+
+    uint8_t index = 0;
+    for (uint8_t channel = 0; channel < MT3620_ADC_CHANNEL_COUNT; ++channel) {
+        if ((summarySettings.channelMap & (1U << channel)) == 0) {
+            continue;
+        }
+
+        const ChannelAccumulator *acc = &accumulators[channel];
+        AdcChannelSummary *out = &summary.channels[index++];
+        uint64_t n = acc->count;
+        uint16_t mean = (uint16_t)(acc->sum / n);
+
+        out->mean = mean;
+        out->min = acc->min;
+        out->max = acc->max;
+        out->peak = (acc->max - mean > mean - acc->min) ? acc->max - mean : mean - acc->min;
+
+        // The variance is (n * sum of squares - sum^2) / n^2, which is exact in integers.
+        uint64_t spread = n * acc->sumOfSquares - (uint64_t)acc->sum * acc->sum;
+        out->acRms = (uint16_t)SquareRoot(spread / (n * n));
+
+        for (uint8_t bin = 0; bin < summarySettings.binCount; ++bin) {
+            uint64_t magnitude =
+                BinMagnitude(acc->binState1[bin], acc->binState2[bin], binCoefficients[bin]);
+            // A sinusoid of amplitude A has a magnitude of A * n / 2.
+            out->bins[bin] = (uint16_t)(2 * magnitude / n);
+        }
+    }
+
+    IntercoreResult icr =
+        IntercoreSend(summaryIcc, summaryDestAppId, &summary, ADC_SUMMARY_SIZE(channelCount));
+    if (icr != Intercore_OK) {
+        ++droppedSummaries;
+    }
+}
+
+// Computes the magnitude of a Goertzel filter's output from its final state. The state is scaled
+// down before it is squared if that is needed to avoid overflow.
+static uint64_t BinMagnitude(int64_t state1, int64_t state2, int32_t coefficient)
+{
+    unsigned int shift = 0;
+    while ((state1 >> shift) >= (INT64_C(1) << 30) || (state1 >> shift) < -(INT64_C(1) << 30) ||
+           (state2 >> shift) >= (INT64_C(1) << 30) || (state2 >> shift) < -(INT64_C(1) << 30)) {
+        ++shift;
+    }
+    state1 >>= shift;
+    state2 >>= shift;
+
+    int64_t power = state1 * state1 + state2 * state2 -
+                    ((coefficient * state1) >> COEFFICIENT_FRACTION_BITS) * state2;
+    return (uint64_t)SquareRoot(power < 0 ? 0 : (uint64_t)power) << shift;
+}
+
+// Cosine of an angle which is measured in 2^32ths of a turn, in Q30 fixed point, so that the
+// coefficients do not need floating point. The angle is reduced to the first quadrant, where a
+// Taylor series is accurate to better than one part in 10^5.
+static int32_t CosineQ30(uint32_t turn)
+{
+    static const int64_t one = INT64_C(1) << 30;
+    static const int64_t halfPiQ30 = 1686629713; // pi/2 in Q30
+
+    uint32_t quadrant = turn >> 30;
+    int64_t fraction = turn & 0x3FFFFFFF; // of a quarter turn, in Q30
+    if ((quadrant & 1) != 0) {
+        fraction = one - fraction;
+    }
+
+    int64_t x = (fraction * halfPiQ30) >> 30;
+    int64_t x2 = (x * x) >> 30;
+
+    int64_t result = one - x2 / 90;
+    result = one - ((x2 * result) >> 30) / 56;
+    result = one - ((x2 * result) >> 30) / 30;
+    result = one - ((x2 * result) >> 30) / 12;
+    result = one - ((x2 * result) >> 30) / 2;
+
+    return (int32_t)((quadrant == 1 || quadrant == 2) ? -result : result);
+}
+
+// Integer square root, rounded down, so that the RMS does not need floating point.
+static uint32_t SquareRoot(uint64_t value)
+{
+    uint64_t root = 0;
+    uint64_t bit = UINT64_C(1) << 62;
+    while (bit > value) {
+        bit >>= 2;
+    }
+
+    while (bit != 0) {
+        if (value >= root + bit) {
+            value -= root + bit;
+            root = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+
+    return (uint32_t)root;
+}
+
+void StartAdcSummaries(IntercoreComm *icc, const ComponentId *destAppId,
+                       const AdcSummarySettings *settings)
+{
+    StopAdcSummaries();
+
+    summaryIcc = icc;
+    summaryDestAppId = destAppId;
+    summarySettings = *settings;
+    summarySequence = 0;
+    droppedSummaries = 0;
+
+    channelCount = 0;
+    for (uint8_t channel = 0; channel < MT3620_ADC_CHANNEL_COUNT; ++channel) {
+        if ((settings->channelMap & (1U << channel)) != 0) {
+            ++channelCount;
+        }
+    }
+
+    actualSampleRateHz = MT3620_Adc_StartPeriodic(settings->channelMap, settings->sampleRateHz);
+
+    // The coefficients use the actual rate, so that the bins are at the requested frequencies.
+    for (uint8_t bin = 0; bin < settings->binCount; ++bin) {
+        uint32_t turn = (uint32_t)(((uint64_t)settings->binFrequenciesHz[bin] << 32) /
+                                   actualSampleRateHz);
+        binCoefficients[bin] = CosineQ30(turn) >> (30 - 1 - COEFFICIENT_FRACTION_BITS);
+    }
+
+    running = true;
+    StartSoftTimer(&drainTimer, drainPeriodUs, drainPeriodUs);
+}
+
+void StopAdcSummaries(void)
+{
+    StopSoftTimer(&drainTimer);
+    running = false;
+    MT3620_Adc_Stop();
+    ResetWindow();
+}
@@ -0,0 +1,137 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "logical-intercore.h"
+#include "mt3620-adc.h"
+
+// ADC summaries. The ADC samples a set of channels at a fixed rate, with hardware timing, and
+// each window of samples is reduced on this core to a summary of each channel: its mean, peak
+// and AC RMS, and the amplitudes of a set of frequency bins, such as the harmonics of the mains
+// frequency. One message is sent to the high-level application per window, so it does not
+// handle every sample. A high-level application can include this header to parse the messages.
+
+/// <summary>
+///     Value of the magic field, which distinguishes ADC summaries from other messages.
+/// </summary>
+#define ADC_SUMMARY_MAGIC 0x5341 // "AS"
+
+/// <summary>Version of the summary layout.</summary>
+#define ADC_SUMMARY_VERSION 1
+
+/// <summary>Maximum number of frequency bins in each channel summary.</summary>
+#define ADC_SUMMARY_MAX_BINS 8
+
+/// <summary>Maximum number of samples of each channel in a window.</summary>
+#define ADC_SUMMARY_MAX_WINDOW 8192
+
+/// <summary>
+///     Summary of one channel over a window. All values are in raw ADC counts, from 0 to
+///     MT3620_ADC_MAX_SAMPLE, and all fields are little-endian.
+/// </summary>
+typedef struct {
+    /// <summary>Mean of the samples, which is the DC level, rounded down.</summary>
+    uint16_t mean;
+    /// <summary>Smallest sample.</summary>
+    uint16_t min;
+    /// <summary>Largest sample.</summary>
+    uint16_t max;
+    /// <summary>Largest difference between a sample and the mean.</summary>
+    uint16_t peak;
+    /// <summary>Root mean square of the samples less the mean, rounded down.</summary>
+    uint16_t acRms;
+    /// <summary>Amplitude of the sinusoid at each frequency bin, rounded down.</summary>
+    uint16_t bins[ADC_SUMMARY_MAX_BINS];
+} AdcChannelSummary;
+
+_Static_assert(sizeof(AdcChannelSummary) == 26, "AdcChannelSummary must be 26 bytes");
+
+/// <summary>
+///     Message which summarizes a window of samples. All fields are little-endian. Only the
+///     first channelCount entries of channels are sent, so the message size is
+///     ADC_SUMMARY_SIZE(channelCount).
+/// </summary>
+typedef struct {
+    /// <summary>ADC_SUMMARY_MAGIC.</summary>
+    uint16_t magic;
+    /// <summary>ADC_SUMMARY_VERSION.</summary>
+    uint8_t version;
+    /// <summary>Number of channels which are summarized.</summary>
+    uint8_t channelCount;
+    /// <summary>Bit n is set if channel n is sampled. The channels are summarized in order of
+    /// their numbers.</summary>
+    uint8_t channelMap;
+    /// <summary>Number of frequency bins in each channel summary.</summary>
+    uint8_t binCount;
+    /// <summary>Reserved; zero.</summary>
+    uint16_t reserved;
+    /// <summary>Incremented for each window, so that lost summaries can be detected.</summary>
+    uint32_t sequence;
+    /// <summary>Time at which the first sample in the window was read from the ADC, from the
+    /// microsecond counter.</summary>
+    uint32_t windowStartUs;
+    /// <summary>Time from reading the first sample to reading the last sample in
+    /// microseconds.</summary>
+    uint32_t windowDurationUs;
+    /// <summary>Number of samples of each channel per second.</summary>
+    uint32_t sampleRateHz;
+    /// <summary>Number of samples of each channel in the window.</summary>
+    uint32_t sampleCount;
+    /// <summary>Number of times in the window at which samples were lost because the ADC's
+    /// FIFO overflowed.</summary>
+    uint32_t overruns;
+    /// <summary>Number of earlier summaries which could not be sent because the outbound
+    /// buffer was full.</summary>
+    uint32_t droppedSummaries;
+    /// <summary>Frequency of each bin in Hz.</summary>
+    uint16_t binFrequenciesHz[ADC_SUMMARY_MAX_BINS];
+    /// <summary>Summary of each channel.</summary>
+    AdcChannelSummary channels[MT3620_ADC_CHANNEL_COUNT];
+} AdcSummary;
+
+_Static_assert(offsetof(AdcSummary, channels) == 52, "AdcSummary header must be 52 bytes");
+
+/// <summary>Size of a summary of the supplied number of channels, in bytes.</summary>
+#define ADC_SUMMARY_SIZE(channelCount_) \
+    (offsetof(AdcSummary, channels) + (channelCount_) * sizeof(AdcChannelSummary))
+
+/// <summary>Settings with which the ADC is sampled and summarized.</summary>
+typedef struct {
+    /// <summary>Bit n is set if channel n is sampled. Must be non-zero.</summary>
+    uint8_t channelMap;
+    /// <summary>Requested number of samples of each channel per second. The actual rate is
+    /// reported in each summary.</summary>
+    uint32_t sampleRateHz;
+    /// <summary>Number of samples of each channel in a window, from 1 to
+    /// ADC_SUMMARY_MAX_WINDOW.</summary>
+    uint32_t samplesPerWindow;
+    /// <summary>Number of entries in binFrequenciesHz, at most ADC_SUMMARY_MAX_BINS.</summary>
+    uint8_t binCount;
+    /// <summary>Frequency of each bin in Hz, from a thousandth of the sample rate to less than
+    /// half of it. A bin has no leakage from the DC level or from other bins if the window
+    /// holds a whole number of cycles of each frequency.</summary>
+    uint16_t binFrequenciesHz[ADC_SUMMARY_MAX_BINS];
+} AdcSummarySettings;
+
+/// <summary>
+///     <para>Starts the ADC, and sends a summary to the high-level application each time a
+///     window of samples has been collected. If summaries have already been started, they are
+///     restarted with the new settings.</para>
+///     <para>The application must call <see cref="InitSoftTimers" /> first, and must call
+///     <see cref="InvokeDeferredProcs" />, which reads the samples and sends the summaries.</para>
+/// </summary>
+/// <param name="icc">Handle which was initialized by <see cref="SetupIntercoreComm" />.</param>
+/// <param name="destAppId">Component ID of the application which receives the summaries. This
+/// object must exist while summaries are running.</param>
+/// <param name="settings">Settings, which are copied.</param>
+void StartAdcSummaries(IntercoreComm *icc, const ComponentId *destAppId,
+                       const AdcSummarySettings *settings);
+
+/// <summary>
+///     Stops the ADC. The partially filled window is discarded.
+/// </summary>
+void StopAdcSummaries(void);
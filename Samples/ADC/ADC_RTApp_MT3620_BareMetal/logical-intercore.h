@@ -0,0 +1,322 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "mt3620-baremetal.h" // for Callback
+#include "logical-timer.h"    // for SoftTimer
+
+/// <summary>
+///     When sending a message, this is the recipient HLApp's component ID.
+///     When receiving a message, this is the sender HLApp's component ID.
+/// </summary>
+typedef struct {
+    /// <summary>4-byte little-endian word</summary>
+    uint32_t data1;
+    /// <summary>2-byte little-endian half</summary>
+    uint16_t data2;
+    /// <summary>2-byte little-endian half</summary>
+    uint16_t data3;
+    /// <summary>2 bytes (big-endian) followed by 6 bytes (big-endian)</summary>
+    uint8_t data4[8];
+} ComponentId;
+
+/// <summary>
+///     Blocks inside the shared buffer have this alignment. The high-level side of the buffer is
+///     implemented by the OS, which requires this value, so it cannot be reduced for small
+///     messages.
+/// </summary>
+#define RINGBUFFER_ALIGNMENT 16
+
+/// <summary>
+///     Size of the cache line on the high-level core. Each buffer header fills one line.
+/// </summary>
+#define INTERCORE_CACHE_LINE_SIZE 64
+
+/// <summary>
+///     Bytes which each block uses in the shared buffer before its payload: the block size,
+///     the HLApp component ID, and a reserved word.
+/// </summary>
+#define INTERCORE_BLOCK_OVERHEAD (sizeof(uint32_t) + sizeof(ComponentId) + sizeof(uint32_t))
+
+/// <summary>
+///     Bytes which a message with a payload of <paramref name="payloadLen" /> bytes uses in the
+///     shared buffer. A 4-byte payload uses 32 bytes, so applications which send many small
+///     messages can fit more into the buffer by packing several into one payload, or by using
+///     <see cref="IntercoreSetBatching" />.
+/// </summary>
+#define INTERCORE_BLOCK_SIZE(payloadLen) \
+    (((INTERCORE_BLOCK_OVERHEAD + (payloadLen)) + RINGBUFFER_ALIGNMENT - 1) & \
+     ~(size_t)(RINGBUFFER_ALIGNMENT - 1))
+
+#ifndef INTERCORE_MAX_PAYLOAD_LEN
+/// <summary>
+///     Maximum payload size in bytes. This does not include a header which
+///     is prepended by <see cref="IntercoreSend" />. An application which only sends small
+///     messages can define a lower value when it is built, which shrinks the buffers which are
+///     sized by it, such as the RPC response buffer.
+/// </summary>
+#define INTERCORE_MAX_PAYLOAD_LEN 1040
+#endif
+
+_Static_assert(INTERCORE_MAX_PAYLOAD_LEN <= 1040,
+               "INTERCORE_MAX_PAYLOAD_LEN cannot exceed the OS limit of 1040 bytes");
+
+typedef struct BufferHeaderImpl BufferHeader;
+
+/// <summary>
+///     Counters which describe the traffic through an <see cref="IntercoreComm" /> since it was
+///     set up. They distinguish finding the inbound buffer empty from failing to send because
+///     the outbound buffer was full.
+/// </summary>
+typedef struct {
+    /// <summary>Number of messages returned by IntercorePeek or IntercoreRecv.</summary>
+    uint32_t messagesReceived;
+    /// <summary>Number of payload bytes in the received messages.</summary>
+    uint32_t bytesReceived;
+    /// <summary>Number of times there was no message to receive
+    /// (Intercore_Recv_NoBlockSize).</summary>
+    uint32_t recvNoBlockSize;
+    /// <summary>Number of messages committed to the outbound buffer.</summary>
+    uint32_t messagesSent;
+    /// <summary>Number of payload bytes in the sent messages.</summary>
+    uint32_t bytesSent;
+    /// <summary>Number of messages which could not be sent because the outbound buffer was full
+    /// (Intercore_Send_NotEnoughBufferSpace).</summary>
+    uint32_t sendNotEnoughBufferSpace;
+    /// <summary>Number of messages which could not be sent because they were too large
+    /// (Intercore_Send_MessageTooLarge).</summary>
+    uint32_t sendMessageTooLarge;
+} IntercoreStats;
+
+/// <summary>
+///     Encapsulates information which is used to send data to, and receive data from HLApps.
+///     This object is a handle, so the caller should not read or write the contained data.
+///     Initialize this object with <see cref="SetupIntercoreComm" />.
+/// </summary>
+typedef struct {
+    /// <summary>Buffer used to send data from the HLApp to the RTApp.</summary>
+    BufferHeader *inbound;
+    /// <summary>Buffer used to send data from the RTApp to the HLApp.</summary>
+    BufferHeader *outbound;
+    /// <summary>Inbound buffer size in bytes.</summary>
+    uint32_t inboundBufSize;
+    /// <summary>Outbound buffer size in bytes.</summary>
+    uint32_t outboundBufSize;
+    /// <summary>Whether IntercoreReserve has reserved a message which has not been committed.
+    /// </summary>
+    bool sendReserved;
+    /// <summary>Position of the reserved message in the outbound buffer.</summary>
+    uint32_t sendReservedPosition;
+    /// <summary>Payload size of the reserved message in bytes.</summary>
+    uint32_t sendReservedSize;
+    /// <summary>Whether IntercorePeek has returned a message which has not been released.</summary>
+    bool recvPeeked;
+    /// <summary>Read position after the message which IntercorePeek returned.</summary>
+    uint32_t recvNextPosition;
+    /// <summary>Number of committed messages which are published together; 0 or 1 if
+    /// each message is published when it is committed.</summary>
+    uint32_t batchThreshold;
+    /// <summary>Maximum time in microseconds for which a committed message is held back;
+    /// 0 if messages are held until the threshold is reached or the batch is flushed.</summary>
+    uint32_t batchLatencyUs;
+    /// <summary>Timer which flushes the batch when the latency deadline expires.</summary>
+    SoftTimer batchTimer;
+    /// <summary>Number of committed messages which have not been published.</summary>
+    uint32_t pendingCount;
+    /// <summary>Write position after the last committed message, if pendingCount is not
+    /// zero.</summary>
+    uint32_t pendingWritePosition;
+    /// <summary>Traffic counters.</summary>
+    IntercoreStats stats;
+} IntercoreComm;
+
+/// <summary>
+///     Describes a message payload in place in a shared buffer. The buffers are circular, so a
+///     payload which wraps around the end of a buffer occupies two spans: the first ends at the
+///     end of the buffer, and the second starts at the start of the buffer. Otherwise, the
+///     second span is empty.
+/// </summary>
+typedef struct {
+    /// <summary>Start of the first span.</summary>
+    uint8_t *first;
+    /// <summary>Size of the first span in bytes.</summary>
+    size_t firstSize;
+    /// <summary>Start of the second span.</summary>
+    uint8_t *second;
+    /// <summary>Size of the second span in bytes, which may be zero.</summary>
+    size_t secondSize;
+} IntercoreSpans;
+
+/// <summary>
+///     Error codes which can occur when using the intercore buffers.
+///     These are errors which can occur during normal use, for example
+///     no message available, or not enough space in buffer. The logical
+///     layer asserts for unexpected conditions such as a corrupt buffer.
+/// </summary>
+typedef enum {
+    /// <summary>Operation completed successfully.</summary>
+    Intercore_OK = 0,
+
+    /// <summary>
+    ///     The incoming buffer did not contain enough space for the next
+    ///     block size. In practical terms, this usually means the incoming buffer
+    ///     is empty, so there is no message to retrieve.
+    /// </summary>
+    Intercore_Recv_NoBlockSize = 0x10,
+
+    /// <summary>The supplied buffer size was too small to hold the incoming message.</summary>
+    Intercore_Recv_BufferTooSmall = 0x11,
+
+    /// <summary>
+    ///     The supplied message was too large. Even if there is enough space in
+    ///     the buffer, messages are limited to a 1040-byte payload.
+    /// </summary>
+    Intercore_Send_MessageTooLarge = 0x20,
+
+    /// <summary>There was not enough space in the buffer to send the supplied message.</summary>
+    Intercore_Send_NotEnoughBufferSpace = 0x21
+} IntercoreResult;
+
+/// <summary>
+///     Populates the supplied IntercoreComm object by getting buffer information
+///     from the high-level core.
+/// </summary>
+/// <param name="icc">Handle object to populate.</param>
+/// <param name="recvCallback">
+///     Function which is called in DPC context when an incoming message arrives.
+///     The application must call <see cref="InvokeDeferredProcs" /> to run the function.
+/// </param>
+/// <returns>Intercore_OK on success, another IntercoreResult value otherwise.</returns>
+IntercoreResult SetupIntercoreComm(IntercoreComm *icc, Callback recvCallback);
+
+/// <summary>
+///     Retrieves the next incoming message from the HLApp.
+/// </summary>
+/// <param name="icc">Handle which was initialized by <see cref="SetupIntercoreComm" /></param>
+/// <param name="sender">Component ID which will be populated with the sending HLApp's ID.</param>
+/// <param name="dest">Buffer which will store the payload sent by the HLApp.</param>
+/// <param name="size">
+///     On entry, contains the size of the destination buffer. On exit, set to
+///     the amount of payload data.
+/// </param>
+/// <returns>
+///     <see cref="Intercore_OK" /> if the message was retrieved successfully;
+///     <see cref="Intercore_Recv_NoBlockSize" /> if there was no message to retrieve; or
+///     <see cref="Intercore_Recv_BufferTooSmall" /> if the supplied buffer was not large
+///     enough to contain the message payload. In the last case, the input parameters are
+///     not modified, and the message is left in the buffer.
+/// </returns>
+IntercoreResult IntercoreRecv(IntercoreComm *icc, ComponentId *sender, void *dest, size_t *size);
+
+/// <summary>Sends a message to the HLApp.</summary>
+/// <param name="icc">Handle which was initialized by <see cref="SetupIntercoreComm" /></param>
+/// <param name="recipient">HLApp which should receive the message.</param>
+/// <param name="data">Data to send to the HLApp.</param>
+/// <param name="size">Amount of data in bytes.</param>
+/// <returns>
+///     <see cref="Intercore_OK" /> if the message was successfully placed
+///     into the outbound buffer; <see cref="Intercore_Send_MessageTooLarge"> if the message
+///     was greater than 1040 bytes, in which case nothing is sent; or
+///     <see cref="Intercore_Send_NotEnoughBufferSpace" /> if there was not enough space
+///     in the buffer to send the message.
+/// </returns>
+IntercoreResult IntercoreSend(IntercoreComm *icc, const ComponentId *recipient, const void *data,
+                              size_t size);
+
+/// <summary>
+///     <para>Gets the next incoming message from the HLApp without copying its payload. The
+///     payload remains in the inbound buffer, where the caller can parse it in place, until
+///     the caller calls <see cref="IntercoreRelease" />.</para>
+///     <para>Calling this function again before the message is released returns the same
+///     message.</para>
+/// </summary>
+/// <param name="icc">Handle which was initialized by <see cref="SetupIntercoreComm" /></param>
+/// <param name="sender">Component ID which will be populated with the sending HLApp's ID.</param>
+/// <param name="payload">On success, set to the spans which hold the message payload.</param>
+/// <returns>
+///     <see cref="Intercore_OK" /> if the message was retrieved successfully; or
+///     <see cref="Intercore_Recv_NoBlockSize" /> if there was no message to retrieve.
+/// </returns>
+IntercoreResult IntercorePeek(IntercoreComm *icc, ComponentId *sender, IntercoreSpans *payload);
+
+/// <summary>
+///     Removes the message which was returned by <see cref="IntercorePeek" /> from the inbound
+///     buffer, and tells the HLApp that it has been read. The payload spans must not be used
+///     after this function has been called.
+/// </summary>
+/// <param name="icc">Handle which was initialized by <see cref="SetupIntercoreComm" /></param>
+void IntercoreRelease(IntercoreComm *icc);
+
+/// <summary>
+///     <para>Reserves space for a message to the HLApp in the outbound buffer, so that the
+///     caller can write the payload in place, for example by DMA, rather than copy it. The
+///     message is sent when the caller calls <see cref="IntercoreCommit" />.</para>
+///     <para>Only one message can be reserved at a time, and no other message can be sent
+///     until it has been committed.</para>
+/// </summary>
+/// <param name="icc">Handle which was initialized by <see cref="SetupIntercoreComm" /></param>
+/// <param name="recipient">HLApp which should receive the message.</param>
+/// <param name="size">Maximum size of the payload in bytes.</param>
+/// <param name="payload">On success, set to the spans which the payload should be written to.
+/// </param>
+/// <returns>
+///     <see cref="Intercore_OK" /> if the space was reserved;
+///     <see cref="Intercore_Send_MessageTooLarge"> if the size was greater than 1040 bytes; or
+///     <see cref="Intercore_Send_NotEnoughBufferSpace" /> if there was not enough space
+///     in the buffer for the message.
+/// </returns>
+IntercoreResult IntercoreReserve(IntercoreComm *icc, const ComponentId *recipient, size_t size,
+                                 IntercoreSpans *payload);
+
+/// <summary>
+///     Sends the message which was reserved by <see cref="IntercoreReserve" />. The payload
+///     must have been written before this function is called.
+/// </summary>
+/// <param name="icc">Handle which was initialized by <see cref="SetupIntercoreComm" /></param>
+/// <param name="size">
+///     Amount of payload data in bytes, which must not exceed the reserved size. The payload
+///     occupies the start of the reserved spans.
+/// </param>
+void IntercoreCommit(IntercoreComm *icc, size_t size);
+
+/// <summary>
+///     <para>Configures how outbound messages are batched. Each message which is sent is placed
+///     in the outbound buffer, but the high-level core does not see it, and is not interrupted,
+///     until the batch is published. The batch is published when it holds
+///     <paramref name="flushThreshold" /> messages, when <paramref name="maxLatencyUs" />
+///     microseconds have passed since its first message was sent, or when the application calls
+///     <see cref="IntercoreFlush" />. A single interrupt is raised for the whole batch.</para>
+///     <para>The latency deadline uses a software timer, so the application should call
+///     <see cref="InitSoftTimers" /> first. The batch is published by a DPC, so the application
+///     must call <see cref="InvokeDeferredProcs" />. Messages must also be sent from DPCs or from
+///     the main application thread, rather than from interrupt context.</para>
+///     <para>Any messages which are held when this function is called are published.</para>
+/// </summary>
+/// <param name="icc">Handle which was initialized by <see cref="SetupIntercoreComm" /></param>
+/// <param name="flushThreshold">
+///     Number of messages in a batch. 0 or 1 publishes each message when it is sent, which is
+///     the default.
+/// </param>
+/// <param name="maxLatencyUs">
+///     Maximum time in microseconds for which a message is held, or 0 if there is no deadline.
+/// </param>
+void IntercoreSetBatching(IntercoreComm *icc, uint32_t flushThreshold, uint32_t maxLatencyUs);
+
+/// <summary>
+///     Publishes any messages which have been sent but are held in the current batch, and raises
+///     a single interrupt to tell the high-level core about them.
+/// </summary>
+/// <param name="icc">Handle which was initialized by <see cref="SetupIntercoreComm" /></param>
+void IntercoreFlush(IntercoreComm *icc);
+
+/// <summary>
+///     Gets the traffic counters for a handle.
+/// </summary>
+/// <param name="icc">Handle which was initialized by <see cref="SetupIntercoreComm" /></param>
+/// <returns>Counters which remain owned by the handle.</returns>
+const IntercoreStats *IntercoreGetStats(const IntercoreComm *icc);
@@ -0,0 +1,149 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// This sample C application for the real-time core samples the ADC at a fixed rate, with the
+// ADC's periodic mode timing the samples, and sends a summary of each window of samples to a
+// high-level application. Each summary holds the mean, peak and AC RMS of each channel, and the
+// amplitudes of the first harmonics of the mains frequency, as a power-quality monitor needs.
+//
+// It demonstrates the following hardware
+// - ADC (used to sample the channels in periodic mode)
+// - UART (used to write a message via the built-in UART)
+// - mailbox (used to report buffer sizes and send / receive events)
+// - timer (used to read the ADC's FIFO)
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "logical-adc-summary.h"
+#include "logical-dpc.h"
+#include "logical-intercore.h"
+#include "logical-timer.h"
+
+#include "mt3620-baremetal.h"
+#include "mt3620-uart.h"
+#include "mt3620-intercore.h"
+#include "mt3620-timer.h"
+
+extern uint32_t StackTop; // &StackTop == end of TCM
+
+static IntercoreComm icc;
+
+// The component ID for ADC_HighLevelApp. To receive the summaries in another application, set
+// its component ID here and in app_manifest.json, and add this application's component ID to
+// its AllowedApplicationConnections.
+static const ComponentId hlAppId = {.data1 = 0x274f308f,
+                                    .data2 = 0xef6d,
+                                    .data3 = 0x4686,
+                                    .data4 = {0xba, 0x77, 0xa5, 0x6c, 0x3a, 0x9d, 0x93, 0xf3}};
+
+// Channel 0 is sampled at 6.25kHz, which is an exact division of the ADC clock, and summarized
+// every 200ms. A window then holds a whole number of cycles of each harmonic of 50Hz or 60Hz
+// mains, so the bins do not leak into each other. For 60Hz mains, use multiples of 60Hz.
+static const AdcSummarySettings adcSettings = {
+    .channelMap = 1U << 0,
+    .sampleRateHz = 6250,
+    .samplesPerWindow = 1250,
+    .binCount = 8,
+    .binFrequenciesHz = {50, 100, 150, 200, 250, 300, 350, 400}};
+
+static _Noreturn void DefaultExceptionHandler(void);
+static void HandleReceivedMessageDeferred(void);
+static _Noreturn void RTCoreMain(void);
+
+// ARM DDI0403E.d SB1.5.2-3
+// From SB1.5.3, "The Vector table must be naturally aligned to a power of two whose alignment
+// value is greater than or equal to (Number of Exceptions supported x 4), with a minimum alignment
+// of 128 bytes.". The array is aligned in linker.ld, using the dedicated section ".vector_table".
+
+// The exception vector table contains a stack pointer, 15 exception handlers, and an entry for
+// each interrupt.
+#define INTERRUPT_COUNT 100 // from datasheet
+#define EXCEPTION_COUNT (16 + INTERRUPT_COUNT)
+#define INT_TO_EXC(i_) (16 + (i_))
+const uintptr_t ExceptionVectorTable[EXCEPTION_COUNT] __attribute__((section(".vector_table")))
+__attribute__((used)) = {
+    [0] = (uintptr_t)&StackTop,                // Main Stack Pointer (MSP)
+    [1] = (uintptr_t)RTCoreMain,               // Reset
+    [2] = (uintptr_t)DefaultExceptionHandler,  // NMI
+    [3] = (uintptr_t)DefaultExceptionHandler,  // HardFault
+    [4] = (uintptr_t)DefaultExceptionHandler,  // MPU Fault
+    [5] = (uintptr_t)DefaultExceptionHandler,  // Bus Fault
+    [6] = (uintptr_t)DefaultExceptionHandler,  // Usage Fault
+    [11] = (uintptr_t)DefaultExceptionHandler, // SVCall
+    [12] = (uintptr_t)DefaultExceptionHandler, // Debug monitor
+    [14] = (uintptr_t)DefaultExceptionHandler, // PendSV
+    [15] = (uintptr_t)DefaultExceptionHandler, // SysTick
+
+    [INT_TO_EXC(0)] = (uintptr_t)DefaultExceptionHandler,
+    [INT_TO_EXC(1)] = (uintptr_t)MT3620_Gpt_HandleIrq1,
+    [INT_TO_EXC(2)... INT_TO_EXC(3)] = (uintptr_t)DefaultExceptionHandler,
+    [INT_TO_EXC(4)] = (uintptr_t)Uart_HandleIrq4,
+    [INT_TO_EXC(5)... INT_TO_EXC(10)] = (uintptr_t)DefaultExceptionHandler,
+    [INT_TO_EXC(11)] = (uintptr_t)MT3620_HandleMailboxIrq11,
+    [INT_TO_EXC(12)... INT_TO_EXC(INTERRUPT_COUNT - 1)] = (uintptr_t)DefaultExceptionHandler};
+
+// If the applications end up in this function then an unexpected exception has occurred.
+static _Noreturn void DefaultExceptionHandler(void)
+{
+    for (;;) {
+        // empty.
+    }
+}
+
+// Runs with interrupts enabled. The high-level application does not send any messages to this
+// application, so any which arrive are discarded, to keep the inbound buffer from filling.
+static void HandleReceivedMessageDeferred(void)
+{
+    for (;;) {
+        ComponentId sender;
+        IntercoreSpans payload;
+
+        IntercoreResult icr = IntercorePeek(&icc, &sender, &payload);
+        if (icr != Intercore_OK) {
+            return;
+        }
+
+        IntercoreRelease(&icc);
+    }
+}
+
+static _Noreturn void RTCoreMain(void)
+{
+    // The debugger will not connect until shortly after the application has started running.
+    // To use the debugger with code which runs at application startup, change the initial value
+    // of b from true to false, run the app, break into the app with a debugger, and set b to true.
+    volatile bool b = true;
+    while (!b) {
+        // empty.
+    }
+
+    // SCB->VTOR = ExceptionVectorTable
+    WriteReg32(SCB_BASE, 0x08, (uint32_t)ExceptionVectorTable);
+
+    Uart_Init();
+    Uart_WriteString("--------------------------------\r\n");
+    Uart_WriteString("ADC_RTApp_MT3620_BareMetal\r\n");
+    Uart_WriteString("App built on: " __DATE__ ", " __TIME__ "\r\n");
+
+    MT3620_Gpt_Init();
+    InitSoftTimers(TimerGpt0);
+
+    IntercoreResult icr = SetupIntercoreComm(&icc, HandleReceivedMessageDeferred);
+    if (icr != Intercore_OK) {
+        Uart_WriteString("SetupIntercoreComm: ");
+        Uart_WriteInteger(icr);
+        Uart_WriteString("\r\n");
+    } else {
+        StartAdcSummaries(&icc, &hlAppId, &adcSettings);
+        Uart_WriteString("Sampling ADC at ");
+        Uart_WriteInteger((int)adcSettings.sampleRateHz);
+        Uart_WriteString("Hz\r\n");
+    }
+
+    for (;;) {
+        InvokeDeferredProcs();
+        WaitForDeferredProcs();
+    }
+}
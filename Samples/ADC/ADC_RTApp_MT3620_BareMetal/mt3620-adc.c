@@ -0,0 +1,86 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <stdbool.h>
+
+#include "mt3620-baremetal.h"
+#include "mt3620-adc.h"
+
+static const uintptr_t ADC_BASE = 0x38000000;
+
+// ADC_CTL0 enables the state machine and selects the channels and the mode.
+static const size_t ADC_CTL0 = 0x00;
+static const uint32_t ADC_CTL0_FSM_EN = UINT32_C(1) << 0;
+static const uint32_t ADC_CTL0_PMODE_EN = UINT32_C(1) << 8;
+static const unsigned int ADC_CTL0_CH_MAP_SHIFT = 16;
+
+// ADC_CTL1 holds the period of periodic mode, in ADC clock cycles less one.
+static const size_t ADC_CTL1 = 0x04;
+
+// The FIFO has a UART-like interface. Each entry in ADC_FIFO_RBR holds the channel in [3:0] and
+// the sample in [15:4]. ADC_FIFO_LSR[0] is set while the FIFO holds data, and ADC_FIFO_LSR[1]
+// is set when it has overflowed.
+static const size_t ADC_FIFO_RBR = 0x100;
+static const size_t ADC_FIFO_LSR = 0x114;
+static const uint32_t ADC_FIFO_LSR_DR = UINT32_C(1) << 0;
+static const uint32_t ADC_FIFO_LSR_OE = UINT32_C(1) << 1;
+
+// Set when the FIFO has overflowed since the last call to MT3620_Adc_TakeOverrun.
+static bool overrun = false;
+
+uint32_t MT3620_Adc_StartPeriodic(uint8_t channelMap, uint32_t scanRateHz)
+{
+    MT3620_Adc_Stop();
+
+    uint32_t period = MT3620_ADC_CLOCK_HZ / scanRateHz;
+    if (period == 0) {
+        period = 1;
+    }
+    WriteReg32(ADC_BASE, ADC_CTL1, period - 1);
+
+    WriteReg32(ADC_BASE, ADC_CTL0,
+               ((uint32_t)channelMap << ADC_CTL0_CH_MAP_SHIFT) | ADC_CTL0_PMODE_EN |
+                   ADC_CTL0_FSM_EN);
+
+    return MT3620_ADC_CLOCK_HZ / period;
+}
+
+void MT3620_Adc_Stop(void)
+{
+    ClearReg32(ADC_BASE, ADC_CTL0, ADC_CTL0_FSM_EN | ADC_CTL0_PMODE_EN);
+
+    uint8_t channel;
+    uint16_t sample;
+    while (MT3620_Adc_ReadSample(&channel, &sample)) {
+        // empty.
+    }
+    overrun = false;
+}
+
+bool MT3620_Adc_ReadSample(uint8_t *channel, uint16_t *sample)
+{
+    // Reading the LSR clears the overflow flag, so remember it until it is reported.
+    uint32_t lsr = ReadReg32(ADC_BASE, ADC_FIFO_LSR);
+    if ((lsr & ADC_FIFO_LSR_OE) != 0) {
+        overrun = true;
+    }
+    if ((lsr & ADC_FIFO_LSR_DR) == 0) {
+        return false;
+    }
+
+    uint32_t rbr = ReadReg32(ADC_BASE, ADC_FIFO_RBR);
+    *channel = (uint8_t)(rbr & 0xF);
+    *sample = (uint16_t)((rbr >> 4) & MT3620_ADC_MAX_SAMPLE);
+    return true;
+}
+
+bool MT3620_Adc_TakeOverrun(void)
+{
+    if ((ReadReg32(ADC_BASE, ADC_FIFO_LSR) & ADC_FIFO_LSR_OE) != 0) {
+        overrun = true;
+    }
+
+    bool result = overrun;
+    overrun = false;
+    return result;
+}
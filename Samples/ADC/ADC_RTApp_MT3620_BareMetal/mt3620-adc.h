@@ -0,0 +1,52 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/// <summary>Number of channels on the MT3620 ADC controller.</summary>
+#define MT3620_ADC_CHANNEL_COUNT 8
+
+/// <summary>Largest raw sample value. The ADC has a resolution of 12 bits.</summary>
+#define MT3620_ADC_MAX_SAMPLE 4095
+
+/// <summary>
+///     Frequency in Hz of the ADC clock, which times the scans in periodic mode.
+/// </summary>
+#define MT3620_ADC_CLOCK_HZ 2000000
+
+/// <summary>
+///     <para>Starts the ADC in periodic mode. The hardware scans each of the enabled channels
+///     once per period and writes the samples to its FIFO, so the sampling rate does not depend
+///     on how quickly the core responds. The application must read the FIFO with
+///     <see cref="MT3620_Adc_ReadSample" /> often enough that it does not overflow.</para>
+///     <para>If the ADC is already running, it is restarted with the new settings.</para>
+/// </summary>
+/// <param name="channelMap">Bit n is set if channel n is sampled. Must be non-zero.</param>
+/// <param name="scanRateHz">Requested number of scans per second, at least 1. The actual rate
+/// is returned, because the period is a whole number of ADC clock cycles.</param>
+/// <returns>The actual number of scans per second.</returns>
+uint32_t MT3620_Adc_StartPeriodic(uint8_t channelMap, uint32_t scanRateHz);
+
+/// <summary>
+///     Stops the ADC, and discards any samples in its FIFO.
+/// </summary>
+void MT3620_Adc_Stop(void);
+
+/// <summary>
+///     Reads the oldest sample from the ADC's FIFO, if there is one.
+/// </summary>
+/// <param name="channel">On success, receives the channel which was sampled.</param>
+/// <param name="sample">On success, receives the raw sample, from 0 to MT3620_ADC_MAX_SAMPLE.
+/// </param>
+/// <returns>true if a sample was read; false if the FIFO was empty.</returns>
+bool MT3620_Adc_ReadSample(uint8_t *channel, uint16_t *sample);
+
+/// <summary>
+///     Tests whether the FIFO has overflowed since this function was last called, which means
+///     that samples were lost because it was not read quickly enough.
+/// </summary>
+/// <returns>true if the FIFO overflowed; false otherwise.</returns>
+bool MT3620_Adc_TakeOverrun(void);
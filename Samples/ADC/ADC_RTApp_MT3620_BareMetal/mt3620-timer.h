@@ -0,0 +1,86 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "mt3620-baremetal.h"
+
+/// <summary>
+///     <para>
+///         An instance of this is passed to <see cref="Gpt_LaunchTimerMs" /> to register
+///         a callback.
+///     </para>
+///     <para>Only the interrupt-based timers GTP0 and GTP1 are supported.</para>
+/// </summary>
+typedef enum {
+    /// <summary>Identifier for GPT0.</summary>
+    TimerGpt0 = 0,
+    /// <summary>Identifier for GPT1.</summary>
+    TimerGpt1 = 1
+} TimerGpt;
+
+/// <summary>Total number of supported GPTs.</summary>
+#define TIMER_GPT_COUNT 2
+/// <summary>The GPT interrupts (and hence callbacks) run at this priority level.</summary>
+static const uint32_t GPT_PRIORITY = 2;
+
+/// <summary>
+///     Call this once before registering any callbacks with <see cref="Gpt_LaunchTimerMs" />.
+/// </summary>
+void MT3620_Gpt_Init(void);
+
+/// <summary>
+///     To use GPT0 or GPT1, install this function as the INT1 handler in the exception table.
+///     Applications should not call this function directly.
+/// </summary>
+void MT3620_Gpt_HandleIrq1(void);
+
+/// <summary>
+///     <para>
+///         Register a callback for the supplied timer. Only one callback can be registered
+///         at a time for each timer. If a callback is already registered, then the timer is
+///         cancelled, the new callback is installed, and the timer is restarted. The callback
+///         runs in interrupt context.
+///     </para>
+///     <para>
+///         The callback will be invoked once. The callback can re-register itself by calling
+///         this function.
+///     </para>
+///     <para>
+///         Only call this function from the main application thread or from a timer callback.
+///     </para>
+///     <para>
+///         The application should install the <see cref="Gpt_HandleIrq1" /> interrupt handler
+///         and call <see cref="Gpt_Init" /> before calling this function.
+///     </para>
+/// </summary>
+/// <param name="gpt">Which hardware timer to use.</param>
+/// <param name="periodMs">Period in milliseconds.</param>
+/// <param name="callback">Function to invoke in interrupt context when the timer expires.</param>
+void MT3620_Gpt_LaunchTimerMs(TimerGpt gpt, uint32_t periodMs, Callback callback);
+
+/// <summary>
+///     Frequency in Hz of the clock which is used by <see cref="Gpt_LaunchTimer32k" />.
+/// </summary>
+#define TIMER_GPT_32K_HZ 32768
+
+/// <summary>
+///     <para>
+///         Register a callback for the supplied timer, with a delay which is measured in ticks
+///         of the 32kHz clock rather than in milliseconds. This behaves in the same way as
+///         <see cref="Gpt_LaunchTimerMs" />, but has a resolution of about 30 microseconds.
+///     </para>
+/// </summary>
+/// <param name="gpt">Which hardware timer to use.</param>
+/// <param name="ticks">Delay in ticks of a TIMER_GPT_32K_HZ clock. Must be non-zero.</param>
+/// <param name="callback">Function to invoke in interrupt context when the timer expires.</param>
+void MT3620_Gpt_LaunchTimer32k(TimerGpt gpt, uint32_t ticks, Callback callback);
+
+/// <summary>
+///     Reads the free-running microsecond counter, which is started by
+///     <see cref="Gpt_Init" />. The counter wraps around after 2^32 microseconds.
+/// </summary>
+/// <returns>Number of microseconds since the counter was started, modulo 2^32.</returns>
+uint32_t MT3620_Gpt_ReadMicroseconds(void);
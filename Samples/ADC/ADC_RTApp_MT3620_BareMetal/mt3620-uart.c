@@ -0,0 +1,161 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <stdbool.h>
+
+#include "mt3620-baremetal.h"
+#include "mt3620-uart.h"
+
+static const uintptr_t UART_BASE = 0x21040000;
+
+// The IO CM4 debug UART interrupt.
+static const int UART_IRQ = 4;
+
+// Register offsets.
+static const size_t UART_THR = 0x00;
+static const size_t UART_IER = 0x04;
+static const size_t UART_IIR = 0x08; // read
+static const size_t UART_FCR = 0x08; // write
+static const size_t UART_LSR = 0x14;
+
+// IER[1] enables the interrupt which fires when the transmit FIFO is empty.
+static const uint32_t UART_IER_ETBEI = 1U << 1;
+// LSR[5] is set when the transmit FIFO is empty.
+static const uint32_t UART_LSR_THRE = 1U << 5;
+// Number of bytes which can be written to the empty transmit FIFO.
+static const uint32_t UART_TX_FIFO_DEPTH = 16;
+
+// Maximum number of bytes which are copied into the transmit buffer each time IRQs are blocked,
+// so that a long string does not delay other interrupts.
+static const uint32_t MAX_BYTES_PER_BLOCK = 32;
+
+_Static_assert((UART_TX_BUFFER_SIZE & (UART_TX_BUFFER_SIZE - 1)) == 0,
+               "UART_TX_BUFFER_SIZE must be a power of two");
+
+// The positions increase without bound and are reduced modulo the buffer size when used, so
+// the number of queued bytes is always txWritePosition - txReadPosition.
+static char txBuffer[UART_TX_BUFFER_SIZE];
+static volatile uint32_t txWritePosition = 0;
+static volatile uint32_t txReadPosition = 0;
+static volatile uint32_t droppedByteCount = 0;
+
+static void WriteBytes(const char *data, uint32_t size);
+
+void Uart_Init(void)
+{
+    // Configure UART to use 115200-8-N-1.
+    WriteReg32(UART_BASE, 0x0C, 0x80); // LCR (enable DLL, DLM)
+    WriteReg32(UART_BASE, 0x24, 0x3);  // HIGHSPEED
+    WriteReg32(UART_BASE, 0x04, 0);    // Divisor Latch (MS)
+    WriteReg32(UART_BASE, 0x00, 1);    // Divisor Latch (LS)
+    WriteReg32(UART_BASE, 0x28, 224);  // SAMPLE_COUNT
+    WriteReg32(UART_BASE, 0x2C, 110);  // SAMPLE_POINT
+    WriteReg32(UART_BASE, 0x58, 0);    // FRACDIV_M
+    WriteReg32(UART_BASE, 0x54, 223);  // FRACDIV_L
+    WriteReg32(UART_BASE, 0x0C, 0x03); // LCR (8-bit word length)
+
+    // Enable and clear the FIFOs, and leave the transmit interrupt disabled until there is
+    // something to send.
+    WriteReg32(UART_BASE, UART_FCR, 0x07);
+    WriteReg32(UART_BASE, UART_IER, 0);
+
+    txWritePosition = 0;
+    txReadPosition = 0;
+    droppedByteCount = 0;
+
+    SetNvicPriority(UART_IRQ, UART_PRIORITY);
+    EnableNvicInterrupt(UART_IRQ);
+}
+
+// Copies bytes into the transmit buffer, discarding the oldest queued bytes if it is full, and
+// enables the transmit interrupt so the UART drains the buffer.
+static void WriteBytes(const char *data, uint32_t size)
+{
+    while (size > 0) {
+        uint32_t blockSize = (size < MAX_BYTES_PER_BLOCK) ? size : MAX_BYTES_PER_BLOCK;
+
+        uint32_t prevBasePri = BlockIrqs();
+        uint32_t writePosition = txWritePosition;
+        uint32_t readPosition = txReadPosition;
+        for (uint32_t i = 0; i < blockSize; ++i) {
+            if (writePosition - readPosition == UART_TX_BUFFER_SIZE) {
+                ++readPosition;
+                ++droppedByteCount;
+            }
+            txBuffer[writePosition++ % UART_TX_BUFFER_SIZE] = data[i];
+        }
+        txWritePosition = writePosition;
+        txReadPosition = readPosition;
+        SetReg32(UART_BASE, UART_IER, UART_IER_ETBEI);
+        RestoreIrqs(prevBasePri);
+
+        data += blockSize;
+        size -= blockSize;
+    }
+}
+
+void Uart_WriteString(const char *msg)
+{
+    WriteBytes(msg, __builtin_strlen(msg));
+}
+
+void Uart_WriteInteger(int value)
+{
+    // Maximum decimal length is minus sign and ten digits. The digits are written from the end
+    // of the buffer so they do not have to be reversed.
+    char txt[1 + 10];
+    char *p = txt + sizeof(txt);
+
+    static const int base = 10;
+    static const char digits[] = "0123456789";
+    bool isNegative = value < 0;
+    do {
+        *--p = digits[__builtin_abs(value % base)];
+        value /= base;
+    } while (value);
+
+    if (isNegative) {
+        *--p = '-';
+    }
+
+    WriteBytes(p, (uint32_t)(txt + sizeof(txt) - p));
+}
+
+void Uart_WriteHexByte(uint8_t value)
+{
+    static const char digits[] = "0123456789abcdef";
+
+    char text[2];
+    text[0] = digits[value >> 4];
+    text[1] = digits[value & 0xF];
+
+    WriteBytes(text, sizeof(text));
+}
+
+uint32_t Uart_GetDroppedByteCount(void)
+{
+    return droppedByteCount;
+}
+
+void Uart_HandleIrq4(void)
+{
+    // Reading IIR acknowledges the interrupt. The transmit FIFO is refilled whenever it is
+    // empty, so there is no need to distinguish the cause.
+    (void)ReadReg32(UART_BASE, UART_IIR);
+
+    if (!(ReadReg32(UART_BASE, UART_LSR) & UART_LSR_THRE)) {
+        return;
+    }
+
+    uint32_t readPosition = txReadPosition;
+    uint32_t writePosition = txWritePosition;
+    for (uint32_t i = 0; i < UART_TX_FIFO_DEPTH && readPosition != writePosition; ++i) {
+        WriteReg32(UART_BASE, UART_THR, (uint8_t)txBuffer[readPosition++ % UART_TX_BUFFER_SIZE]);
+    }
+    txReadPosition = readPosition;
+
+    // Stop the interrupt when there is nothing left to send. It is enabled again by WriteBytes.
+    if (readPosition == writePosition) {
+        ClearReg32(UART_BASE, UART_IER, UART_IER_ETBEI);
+    }
+}
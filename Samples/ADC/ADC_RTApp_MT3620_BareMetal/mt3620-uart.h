@@ -0,0 +1,70 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdint.h>
+
+/// <summary>
+///     Number of bytes which can be waiting to be transmitted on the debug UART. When the
+///     buffer is full, the oldest bytes are discarded to make space for new ones.
+/// </summary>
+#define UART_TX_BUFFER_SIZE 1024
+
+/// <summary>The debug UART interrupt runs at this priority level.</summary>
+static const uint32_t UART_PRIORITY = 2;
+
+/// <summary>
+///     Initialize the IOM4 debug UART and enable its interrupt. This function must be called once
+///     before <see cref="Uart_WriteString" /> or the other write functions are called.
+/// </summary>
+void Uart_Init(void);
+
+/// <summary>
+///     <para>
+///         Queue a zero-terminated string to be written to the debug UART. The zero terminator
+///         is not written. This function does not wait for the string to be transmitted; the
+///         UART interrupt sends it in the background.
+///     </para>
+///     <para>
+///         If there is not enough space in the transmit buffer, the oldest queued bytes are
+///         discarded. See <see cref="Uart_GetDroppedByteCount" />.
+///     </para>
+///     <para>Call <see cref="Uart_Init" /> before calling this function.</para>
+/// </summary>
+/// <param name="msg">Null-terminated string to write to the debug UART.</param>
+void Uart_WriteString(const char *msg);
+
+/// <summary>
+///     <para>
+///         Queue the decimal text representation of an integer to be written to the debug UART.
+///         This function does not wait for the text to be transmitted.
+///     </para>
+///     <para>Call <see cref="Uart_Init" /> before calling this function.</para>
+/// </summary>
+/// <param name="value">Value to write to the UART.</param>
+void Uart_WriteInteger(int value);
+
+/// <summary>
+///     <para>
+///     Queue a two-character hexadecimal string ("%02x"-format) to be written to the debug UART
+///     which represents the supplied value. If the value is less than 0x10, then a leading '0'
+///     character is written to the UART. This function does not wait for the digits to be
+///     transmitted.
+///     </para>
+///     <para>Call <see cref="Uart_Init" /> before calling this function.</para>
+/// </summary>
+/// <param name="value">The value whose string representation is written to the UART.</param>
+void Uart_WriteHexByte(uint8_t value);
+
+/// <summary>
+///     Gets the number of bytes which have been discarded because the transmit buffer was full.
+/// </summary>
+/// <returns>Number of discarded bytes since <see cref="Uart_Init" /> was called.</returns>
+uint32_t Uart_GetDroppedByteCount(void);
+
+/// <summary>
+///     Handles the debug UART interrupt by refilling the transmit FIFO. The application should
+///     not call this function directly, but should use it in the vector table.
+/// </summary>
+void Uart_HandleIrq4(void);
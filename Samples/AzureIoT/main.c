@@ -45,11 +45,11 @@
 #include <applibs/gpio.h>
 #include <applibs/log.h>
 #include <applibs/networking.h>
+#include <applibs/wificonfig.h>
 #include <applibs/i2c.h>
 
 // Grove Temperature and Humidity Sensor
 #include "../MT3620_Grove_Shield/MT3620_Grove_Shield_Library/Grove.h"
-#include "../MT3620_Grove_Shield/MT3620_Grove_Shield_Library/Sensors/GroveTempHumiSHT31.h"
 
 
 // The following #include imports a "sample appliance" definition. This app comes with multiple
@@ -67,16 +67,36 @@
 #include <hw/sample_appliance.h>
 
 #include "eventloop_timer_utilities.h"
-#include "parson.h" // Used to parse Device Twin messages.
+#include "button_input.h" // Debounces the button without polling it every millisecond.
+#include "gpio_table.h" // Opens and closes each group of GPIOs in one pass.
+#include "sht31_async.h" // Measures temperature and humidity without blocking the event loop.
+#include "json_reader.h" // Used to parse Device Twin messages without copying them.
+#include "json_writer.h" // Used to serialize telemetry without allocating memory.
+#include "telemetry_pipeline.h" // Aggregates readings into batched telemetry messages.
+#include "cbor_writer.h" // Defines the content type of CBOR telemetry.
+#include "dps_cache.h" // Remembers the IoT hub which DPS assigned, to skip DPS after a restart.
+#include "mem_pool.h"         // Allocates the timers from a fixed-size pool.
+#include "memory_monitor.h"   // Reports the memory usage as telemetry.
+#include "metrics.h"          // Counts the application's work across restarts.
+#include "network_state.h"    // Polls the network interface on behalf of the whole application.
+#include "wifi_diagnostics.h" // Reports the quality of the Wi-Fi connection as telemetry.
+#include "staged_startup.h"   // Opens the resources which are not needed at once after startup.
+#include "direct_methods.h"   // Dispatches direct methods, which may respond asynchronously.
+#include "bulk_log.h"         // Compresses bulk sensor data and events into mutable storage.
+#include "reported_state.h"   // Reports only the device twin properties which have changed.
+#include "power_governor.h"   // Raises the power profile while connecting and uploading.
 
 // Azure IoT SDK
 #include <iothub_client_core_common.h>
 #include <iothub_device_client_ll.h>
+#include <iothub_client_ll.h>
 #include <iothub_client_options.h>
 #include <iothubtransportmqtt.h>
 #include <iothub.h>
-#include <azure_sphere_provisioning.h>
 #include <iothub_security_factory.h>
+#include <prov_device_ll_client.h>
+#include <prov_transport_mqtt_client.h>
+#include <prov_security_factory.h>
 
 /// <summary>
 /// Exit codes for this application. These are used for the
@@ -90,7 +110,7 @@ typedef enum {
 
     ExitCode_Main_EventLoopFail = 2,
 
-    ExitCode_ButtonTimer_Consume = 3,
+    ExitCode_Buttons_Timer = 3,
 
     ExitCode_AzureTimer_Consume = 4,
 
@@ -101,15 +121,37 @@ typedef enum {
     ExitCode_Init_TwinRLed = 21,
     ExitCode_Init_TwinGLed = 22,
     ExitCode_Init_TwinBLed = 23,
-    ExitCode_Init_ButtonPollTimer = 9,
+    ExitCode_Init_Buttons = 9,
     ExitCode_Init_AzureTimer = 10,
     ExitCode_Init_AccelTimer = 16,
     ExitCode_Init_OpenMaster = 17,
     ExitCode_Init_SetBusSpeed = 18,
     ExitCode_Init_SetTimeout = 19,
     ExitCode_Init_SetDefaultTarget = 20,
-
-    ExitCode_IsButtonPressed_GetValue = 11,
+    ExitCode_Init_TelemetryPipeline = 24,
+    ExitCode_Init_Sht31 = 25,
+    ExitCode_Init_AddMessageButton = 26,
+    ExitCode_Init_SensorTimer = 27,
+    ExitCode_SensorTimer_Consume = 28,
+    ExitCode_AzureTimer_Arm = 29,
+    ExitCode_Init_MemPool = 30,
+    ExitCode_Init_MemoryMonitor = 31,
+    ExitCode_Init_NetworkState = 32,
+    ExitCode_Init_WifiDiagnostics = 33,
+    ExitCode_Init_StagedStartup = 34,
+    ExitCode_StagedStartup_Schedule = 35,
+    ExitCode_Init_Metrics = 36,
+    ExitCode_Init_DirectMethods = 37,
+    ExitCode_Init_BulkLog = 38,
+    ExitCode_Init_BulkUploadTimer = 39,
+    ExitCode_BulkUploadTimer_Consume = 40,
+    ExitCode_Init_ReportedState = 41,
+    ExitCode_Init_PowerGovernor = 42,
+    ExitCode_Init_GpioSnapshotTimer = 43,
+    ExitCode_GpioSnapshotTimer_Consume = 44,
+    ExitCode_GpioSnapshot_GetValue = 45,
+
+    ExitCode_Buttons_GetValue = 11,
 
     ExitCode_Validate_ConnectionType = 12,
     ExitCode_Validate_ScopeId = 13,
@@ -166,37 +208,100 @@ static const int deviceIdForDaaCertUsage = 1; // A constant used to direct the I
                                               // the DAA cert under the hood.
 static const char NetworkInterface[] = "wlan0";
 
+// Device Provisioning Service (DPS) registration.
+static const char DpsGlobalEndpoint[] = "global.azure-devices-provisioning.net";
+static const int DpsRegistrationTimeoutMs = 10000; // Give up on DPS after this long.
+static const int DpsPollPeriodMs = 100;            // Call Prov_Device_LL_DoWork this often.
+
+// Set while the client has been created from a cached DPS assignment and has not yet been
+// authenticated by the IoT hub. If authentication fails, the cached assignment is removed, so that
+// the next attempt registers with DPS again.
+static bool usingCachedDpsAssignment = false;
+
+/// <summary>
+///     Progress of a DPS registration, which is updated by DpsRegisterDeviceCallback.
+/// </summary>
+typedef struct {
+    /// <summary>Whether DPS has responded.</summary>
+    bool completed;
+    /// <summary>Whether the device was assigned to an IoT hub.</summary>
+    bool succeeded;
+    /// <summary>Receives the IoT hub and device ID which DPS assigned.</summary>
+    DpsCache_Assignment *assignment;
+} DpsRegistration;
+
 // Function declarations
 static void SendEventCallback(IOTHUB_CLIENT_CONFIRMATION_RESULT result, void *context);
 static void DeviceTwinCallback(DEVICE_TWIN_UPDATE_STATE updateState, const unsigned char *payload,
                                size_t payloadSize, void *userContextCallback);
-static void TwinReportState(const char *jsonState);
+static bool SendReportedState(const char *report, size_t size, void *context);
 static void ReportedStateCallback(int result, void *context);
 static int DeviceMethodCallback(const char *methodName, const unsigned char *payload,
-                                size_t payloadSize, unsigned char **response, size_t *responseSize,
+                                size_t payloadSize, METHOD_HANDLE methodId,
                                 void *userContextCallback);
+static void SendDirectMethodResponse(void *methodId, int status, const unsigned char *response,
+                                     size_t responseSize);
+static void TriggerAlarmMethodHandler(DirectMethods_Call *call, const unsigned char *payload,
+                                      size_t payloadSize, void *context);
+static void ReadSensorMethodHandler(DirectMethods_Call *call, const unsigned char *payload,
+                                    size_t payloadSize, void *context);
+static void RespondToReadSensorCalls(bool valid, float temperature, float humidity);
 static const char *GetReasonString(IOTHUB_CLIENT_CONNECTION_STATUS_REASON reason);
-static const char *GetAzureSphereProvisioningResultString(
-    AZURE_SPHERE_PROV_RETURN_VALUE provisioningResult);
-static void SendTelemetry(const char *jsonMessage);
+static bool SendTelemetryMessage(const void *body, size_t size, const char *contentType,
+                                 const char *contentEncoding, void *callbackContext);
+static bool SendTelemetry(const char *jsonMessage, void *callbackContext);
+static bool SendPipelineTelemetry(const void *message, size_t size, void *context);
 static void SetUpAzureIoTHubClient(void);
 static void SendSimulatedTelemetry(void);
+static void SendMemoryTelemetry(const MemoryMonitor_Report *report, void *context);
+static void SendWifiTelemetry(const WifiDiagnostics_Report *report, void *context);
+static void SendMetricsTelemetry(void *context);
+#ifdef EVENTLOOP_STATS
+static void SendEventLoopStats(const EventLoopStats_Report *report, void *context);
+#endif
 static void SendTempTelemetry(void);
-static void SendGPIO1Telemetry(void);
-static void SendGPIO2Telemetry(void);
-static void SendGPIO3Telemetry(void);
-static void ButtonPollTimerEventHandler(EventLoopTimer *timer);
-static bool IsButtonPressed(int fd, GPIO_Value_Type *oldState);
+static void HandleSht31Measurement(bool valid, float temperature, float humidity, void *context);
+static void GpioSnapshotTimerEventHandler(EventLoopTimer *timer);
+static void SendGpioSnapshotTelemetry(void);
+static void SendMessageButtonHandler(int gpioFd, ButtonInput_Event event, unsigned int count,
+                                     void *context);
+static void ButtonsErrorHandler(int gpioFd, void *context);
+static void SensorTimerEventHandler(EventLoopTimer *timer);
 static void AzureTimerEventHandler(EventLoopTimer *timer);
+static void BulkUploadTimerEventHandler(EventLoopTimer *timer);
+static void UploadBulkLog(void);
+static void ArmAzureTimer(int delayMs);
+static void ScheduleAzureTimer(void);
+static void RequestAzureIoTWork(void);
+static void DestroyAzureIoTHubClient(void);
+#ifdef RADIO_DUTY_CYCLE
+static uint32_t MillisecondsSince(const struct timespec *start);
+static int GetRadioLeadSeconds(void);
+static void ConsiderRadioOff(void);
+static void CheckRadioWake(void);
+static void TurnRadioOn(void);
+static void RecordRadioReconnect(void);
+#endif
+static void NetworkStateChangedHandler(Networking_InterfaceConnectionStatus status, void *context);
+static void NetworkStateErrorHandler(void *context);
 static ExitCode ValidateUserConfiguration(void);
 static ExitCode ReadWhoAmI(void);
 static void ParseCommandLineArguments(int argc, char *argv[]);
-static bool SetUpAzureIoTHubClientWithDaa(void);
+static bool SetUpAzureIoTHubClientWithDaa(const char *iotHubHostName, const char *iotHubDeviceId);
 static bool SetUpAzureIoTHubClientWithDps(void);
-static bool IsConnectionReadyToSendTelemetry(void);
+static bool RegisterWithDps(DpsCache_Assignment *assignment);
+static void DpsRegisterDeviceCallback(PROV_DEVICE_RESULT registerResult, const char *iotHubUri,
+                                      const char *registeredDeviceId, void *context);
 static bool CheckTransferSize(const char *desc, size_t expectedBytes, ssize_t actualBytes);
 
 // Initialization/Cleanup
+static int OpenLeds(void *context);
+static int OpenButtons(void *context);
+static int OpenGpioInputs(void *context);
+static int StartDiagnostics(void *context);
+static void StagedStartupFailureHandler(size_t stageIndex, void *context);
+static ExitCode StartMetrics(void);
+static ExitCode RegisterDirectMethods(void);
 static ExitCode InitPeripheralsAndHandlers(void);
 static void CloseFdAndPrintError(int fd, const char *fdName);
 static void ClosePeripheralsAndHandlers(void);
@@ -204,40 +309,244 @@ static void ClosePeripheralsAndHandlers(void);
 // File descriptors - initialized to invalid value
 // Button
 static int sendMessageButtonGpioFd = -1;
-static int sendMessageGpio0Fd = -1;
-static int sendMessageGpio1Fd = -1;
-static int sendMessageGpio2Fd = -1;
-static int sendMessageGpio3Fd = -1;
 static int i2cFd = -1;
-void *sht31;
-
-// LED
-static int deviceTwinStatusLedGpioFd = -1;
-static int deviceTwinRLedGpioFd = -1;
-static int deviceTwinGLedGpioFd = -1;
-static int deviceTwinBLedGpioFd = -1;
+static Sht31Async sht31;
+
+// Response to a ReadSensor direct method call when the sensor cannot be read.
+static const char sensorErrorResponse[] = "\"Could not read the sensor\"";
+// ReadSensor direct method calls which are waiting for the measurement in progress.
+static DirectMethods_Call *readSensorCalls[DIRECT_METHODS_MAX_PENDING];
+static size_t readSensorCallCount = 0;
+
+// GPIO inputs which can be sent as telemetry
+typedef enum { GpioInput_0, GpioInput_1, GpioInput_2, GpioInput_3, GpioInput_Count } GpioInput;
+static const GpioTable_Pin gpioInputPins[GpioInput_Count] = {
+    [GpioInput_0] = GPIO_TABLE_INPUT(MT3620_GPIO11),
+    [GpioInput_1] = GPIO_TABLE_INPUT(MT3620_GPIO0),
+    [GpioInput_2] = GPIO_TABLE_INPUT(MT3620_GPIO1),
+    [GpioInput_3] = GPIO_TABLE_INPUT(MT3620_GPIO2)};
+static int gpioInputFds[GpioInput_Count] = {-1, -1, -1, -1};
+// The GPIO inputs are sampled every GpioSnapshotPeriodMs, which counts their edges, and sent
+// together with the sensor readings as one bitmask, only when any of them has changed. Set
+// GPIO_SNAPSHOT_EDGE_COUNTS to 0 to send the bitmask without the number of edges on each input.
+#ifndef GPIO_SNAPSHOT_EDGE_COUNTS
+#define GPIO_SNAPSHOT_EDGE_COUNTS 1
+#endif
+static const int GpioSnapshotPeriodMs = 100;
+static GpioTable_Snapshot gpioSnapshot;
+static EventLoopTimer *gpioSnapshotTimer = NULL;
+
+// LEDs, which show the Device Twin settings state. They are active low, and are left off when the
+// application exits. The RGB LED is not fitted to every board, so it is optional.
+typedef enum { Led_Status, Led_Red, Led_Green, Led_Blue, Led_Count } Led;
+static const GpioTable_Pin ledPins[Led_Count] = {
+    [Led_Status] = GPIO_TABLE_OUTPUT(SAMPLE_LED, GPIO_Value_High, GPIO_Value_High),
+    [Led_Red] = GPIO_TABLE_OPTIONAL_OUTPUT(SAMPLE_RGBLED_RED, GPIO_Value_Low, GPIO_Value_High),
+    [Led_Green] = GPIO_TABLE_OPTIONAL_OUTPUT(SAMPLE_RGBLED_GREEN, GPIO_Value_Low, GPIO_Value_High),
+    [Led_Blue] = GPIO_TABLE_OPTIONAL_OUTPUT(SAMPLE_RGBLED_BLUE, GPIO_Value_Low, GPIO_Value_High)};
+static int ledFds[Led_Count] = {-1, -1, -1, -1};
 
 // Timer / polling
 static EventLoop *eventLoop = NULL;
-static EventLoopTimer *buttonPollTimer = NULL;
+static ButtonInput *buttons = NULL;
+static EventLoopTimer *sensorTimer = NULL;
 static EventLoopTimer *azureTimer = NULL;
-
-// Azure IoT poll periods
-static const int AzureIoTDefaultPollPeriodSeconds = 2;        // poll azure iot every second
-static const int AzureIoTPollPeriodsPerTelemetry = 10;         // only send telemetry 1/5 of polls
+static EventLoopTimer *bulkUploadTimer = NULL;
+
+// Sensor period
+static const int SensorPeriodSeconds = 2;         // read the sensor every 2 seconds
+static const int ReadingsPerTelemetryWindow = 10; // aggregate 10 readings into each window
+
+// Azure IoT poll periods. IoTHubDeviceClient_LL_DoWork is called every AzureIoTMinDoWorkPeriodMs
+// while messages or reported properties are awaiting confirmation, or the client is
+// authenticating. Once the client is idle, the period doubles on each call up to
+// AzureIoTMaxDoWorkPeriodMs, which bounds how long a device twin update or direct method can wait.
+static const int AzureIoTMinDoWorkPeriodMs = 100;             // poll quickly while busy
+static const int AzureIoTMaxDoWorkPeriodMs = 8 * 1000;        // idle back off limit
 static const int AzureIoTMinReconnectPeriodSeconds = 60;      // back off when reconnecting
 static const int AzureIoTMaxReconnectPeriodSeconds = 10 * 60; // back off limit
 
-static int azureIoTPollPeriodSeconds = -1;
-static int telemetryCount = 0;
+static int azureIoTDoWorkPeriodMs = -1;
+static int azureIoTReconnectPeriodSeconds = 0; // non-zero while backing off after a failure
+
+// Number of telemetry messages and reported property updates which the client has accepted, but
+// whose confirmation callbacks have not yet been invoked.
+static unsigned int outstandingIoTHubRequests = 0;
+
+#ifdef RADIO_DUTY_CYCLE
+// With RADIO_DUTY_CYCLE defined, Wi-Fi is turned off between telemetry batches. Once every message
+// has been confirmed, and the client has been connected for RadioMinOnSeconds to receive device
+// twin updates and direct methods, the radio is turned off if the next batch is due in more than
+// RadioMinOffSeconds. It is turned on again shortly before the batch is due, or as soon as a window
+// changes by more than its deadband, and after RadioMaxOffSeconds at the latest, which bounds how
+// long a device twin update or direct method waits. While the radio is off, other telemetry is
+// not sent.
+//
+// The radio is turned on early by the average time it has taken to reconnect, plus
+// RadioLeadMarginSeconds, or RadioDefaultLeadSeconds until it has reconnected once. Only the
+// network which the device was last connected to is scanned for, as the WiFi_HighLevelApp sample's
+// fast reconnect does, until it connects. Each reconnection is logged with what it cost and how
+// long the radio was off, so that the duty cycle can be tuned.
+static const int RadioMinOnSeconds = 10;
+static const int RadioMinOffSeconds = 2 * 60;
+static const int RadioMaxOffSeconds = 30 * 60;
+static const int RadioDefaultLeadSeconds = 20;
+static const int RadioLeadMarginSeconds = 5;
+#define RADIO_MAX_STORED_NETWORKS 10
+
+static bool radioOff = false;
+static bool radioReconnecting = false;
+static int radioNetworkId = -1; // stored network which was connected when the radio turned off
+static struct timespec radioOffTime;
+static struct timespec radioOnTime;
+static struct timespec authenticatedTime;
+
+// Totals since the application started, to compare the cost of reconnecting with the savings.
+static unsigned int radioCycles = 0;
+static unsigned long totalRadioOffSeconds = 0;
+static unsigned long totalReconnectMs = 0;
+#endif
+
+// Temperature and humidity are read every SensorPeriodSeconds. Each ReadingsPerTelemetryWindow
+// readings are aggregated into a window holding their mean, minimum and maximum, and
+// TELEMETRY_BATCH_MAX_WINDOWS windows are sent in a single IoT Hub message, or fewer once the
+// oldest is TelemetryBatchWindowSeconds old. Each window of the two channels takes up to about
+// 130 bytes of JSON, so the default of 6 windows fits the pipeline's 1 KB message buffer with
+// room to spare; a batch which does not fit is dropped. At most TelemetryMaxMessagesInFlight
+// messages are awaiting confirmation at once; while the hub is unreachable, windows are buffered
+// and the oldest are dropped if the buffer fills. Batches are sent as JSON, or as CBOR, which is
+// about half the size, if TELEMETRY_ENCODING_CBOR is defined.
+//
+// A window is only reported if the temperature or humidity has moved by more than its deadband
+// since the last reported window, in which case it is sent at once, but not more often than
+// TelemetryMinReportSeconds; and otherwise every TelemetryHeartbeatSeconds. If
+// TELEMETRY_HEARTBEAT_ONLY is defined, only the heartbeats are reported.
+#ifndef TELEMETRY_BATCH_MAX_WINDOWS
+#define TELEMETRY_BATCH_MAX_WINDOWS 6
+#endif
+static const int TelemetryBatchWindowSeconds = 5 * 60;
+static const unsigned int TelemetryMaxMessagesInFlight = 2;
+static const int TelemetryMinReportSeconds = 60;
+static const int TelemetryHeartbeatSeconds = 30 * 60;
+
+static const TelemetryPipeline_Channel telemetryChannels[] = {
+    {.name = "Temperature",
+     .minName = "TemperatureMin",
+     .maxName = "TemperatureMax",
+     .precision = 2,
+     .deadband = 0.5f},
+    {.name = "Humidity",
+     .minName = "HumidityMin",
+     .maxName = "HumidityMax",
+     .precision = 2,
+     .deadband = 2.0f},
+};
+
+static TelemetryPipeline telemetryPipeline;
+
+// The timers are allocated from a fixed-size pool, whose usage is reported with the memory usage.
+static const MemPool_SizeClass memPoolClasses[] = {{64, 8}, {256, 2}};
+static uint64_t memPoolArena[(MEM_POOL_CLASS_SIZE(64, 8) + MEM_POOL_CLASS_SIZE(256, 2)) /
+                             sizeof(uint64_t)];
+
+// The memory usage is sampled every minute, and sent as telemetry every quarter of an hour, so
+// that its growth over the months that a device runs, and after each update, can be tracked.
+static const unsigned int MemorySamplePeriodSeconds = 60;
+static const unsigned int MemorySamplesPerReport = 15;
+
+// The telemetry which is sent and the connections to the IoT hub are counted, and the counts are
+// sent every quarter of an hour. They are kept in mutable storage, after the DPS cache, so they
+// cover the life of the device rather than one run of the application, and they are sent with the
+// number of times the application has started and the exit code of the previous run.
+static const unsigned int MetricsReportPeriodSeconds = 15 * 60;
+static const off_t MetricsStorageOffset = 1024;
+static const int64_t telemetrySizeBounds[] = {64, 128, 256, 512, 1024};
+static Metrics_Id telemetrySentMetric = -1;
+static Metrics_Id telemetryFailedMetric = -1;
+static Metrics_Id telemetrySizeMetric = -1;
+static Metrics_Id iotHubConnectionsMetric = -1;
+static Metrics_Id outstandingRequestsMetric = -1;
+
+// Each temperature and humidity reading, and each change in the IoT Hub connection, is also added
+// to the bulk log, which is kept in mutable storage after the metrics. The log is uploaded as a
+// blob with the IoT Hub's file upload feature, rather than being sent as telemetry, once it holds
+// BulkUploadThresholdBytes or once BulkUploadMaxAgeSeconds have passed since the last upload.
+// The upload blocks the event loop, so it only starts while no telemetry awaits confirmation.
+static const off_t BulkLogStorageOffset = 4096;
+static const size_t BulkLogStorageSize = 60 * 1024;
+static const size_t BulkUploadThresholdBytes = 16 * 1024;
+static const unsigned int BulkUploadMaxAgeSeconds = 60 * 60;
+static const unsigned int BulkUploadCheckPeriodSeconds = 60;
+static unsigned int secondsSinceBulkUpload = 0;
+
+// Reported properties which change within this period, such as the LEDs which one desired
+// properties update sets, are reported in one device twin update.
+static const unsigned int ReportCoalescePeriodMs = 500;
+
+// Channels of the bulk log.
+typedef enum {
+    // Temperature and humidity, in hundredths of a degree Celsius and of a percent.
+    BulkChannel_Environment = 0,
+    // Changes in the IoT Hub connection, as text.
+    BulkChannel_Connection = 1
+} BulkChannel;
+
+/// <summary>
+///     Progress of the upload of the bulk log, which is updated by BulkUploadGetDataCallback.
+/// </summary>
+typedef struct {
+    /// <summary>Offset of the next part of the stored data to upload.</summary>
+    size_t offset;
+    /// <summary>Whether the IoT hub reported that the upload succeeded.</summary>
+    bool succeeded;
+} BulkUpload;
+
+// The Wi-Fi connection is summarized every quarter of an hour as well, so that slow or failed
+// telemetry can be compared with the signal strength and connection failures of the device.
+static const unsigned int WifiReportPeriodSeconds = 15 * 60;
+
+// Only the sensor and the IoT Hub connection are set up before the event loop runs, so that the
+// first telemetry is sent as soon as possible after the device boots. The other resources are
+// opened once it has been sent, when they are first needed, or after the deadline, whichever is
+// first.
+typedef enum {
+    DeferredStage_Leds,
+    DeferredStage_Buttons,
+    DeferredStage_GpioInputs,
+    DeferredStage_Diagnostics,
+    DeferredStage_Count
+} DeferredStage;
+static const StagedStartup_Stage deferredStages[DeferredStage_Count] = {
+    [DeferredStage_Leds] = {"LEDs", OpenLeds, NULL},
+    [DeferredStage_Buttons] = {"buttons", OpenButtons, NULL},
+    [DeferredStage_GpioInputs] = {"GPIO inputs", OpenGpioInputs, NULL},
+    [DeferredStage_Diagnostics] = {"diagnostics", StartDiagnostics, NULL},
+};
+static const unsigned int StartupDeadlineSeconds = 30;
 
 // State variables
-static GPIO_Value_Type sendMessageButtonState = GPIO_Value_High;
 static bool statusLedOn = false;
 static bool RLedOn = false;
 static bool GLedOn = false;
 static bool BLedOn = false;
 
+// Desired properties which are read from the device twin, as indices into the arrays of paths.
+enum {
+    TwinProperty_StatusLed,
+    TwinProperty_RLed,
+    TwinProperty_GLed,
+    TwinProperty_BLed,
+    TwinProperty_Version,
+    TwinProperty_Count
+};
+static const char *const completeTwinPropertyPaths[TwinProperty_Count] = {
+    "desired.StatusLED", "desired.RLED", "desired.GLED", "desired.BLED", "desired.$version"};
+static const char *const partialTwinPropertyPaths[TwinProperty_Count] = {
+    "StatusLED", "RLED", "GLED", "BLED", "$version"};
+
+// Version of the most recently handled desired properties, or -1 if none have been handled.
+static int64_t desiredPropertiesVersion = -1;
+
 // Usage text for command line arguments in application manifest.
 static const char *cmdLineArgsUsageText =
     "DPS connection type: \" CmdArgs \": [\"--ConnectionType\", \"DPS\", \"--ScopeID\", "
@@ -284,6 +593,7 @@ int main(int argc, char *argv[])
         }
     }
 
+    Metrics_RecordExitCode(exitCode);
     ClosePeripheralsAndHandlers();
 
     Log_Debug("Application exiting.\n");
@@ -292,22 +602,49 @@ int main(int argc, char *argv[])
 }
 
 /// <summary>
-///     Button timer event:  Check the status of the button
+///     Button event:  Send a message when SAMPLE_BUTTON_1 is pressed
+/// </summary>
+static void SendMessageButtonHandler(int gpioFd, ButtonInput_Event event, unsigned int count,
+                                     void *context)
+{
+    if (event == ButtonInput_Event_Pressed) {
+        SendTelemetry("{\"ButtonPress\" : \"True\"}", NULL);
+    }
+}
+
+/// <summary>
+///     Handle a failure to sample the button.
 /// </summary>
-static void ButtonPollTimerEventHandler(EventLoopTimer *timer)
+static void ButtonsErrorHandler(int gpioFd, void *context)
+{
+    exitCode = (gpioFd == -1) ? ExitCode_Buttons_Timer : ExitCode_Buttons_GetValue;
+}
+
+/// <summary>
+///     Sensor timer event:  Take a reading and send any complete batches of telemetry
+/// </summary>
+static void SensorTimerEventHandler(EventLoopTimer *timer)
 {
     if (ConsumeEventLoopTimerEvent(timer) != 0) {
-        exitCode = ExitCode_ButtonTimer_Consume;
+        exitCode = ExitCode_SensorTimer_Consume;
         return;
     }
 
-    if (IsButtonPressed(sendMessageButtonGpioFd, &sendMessageButtonState)) {
-        SendTelemetry("{\"ButtonPress\" : \"True\"}");
-    }
+    //SendSimulatedTelemetry();
+    SendTempTelemetry();
+    SendGpioSnapshotTelemetry();
+    //ReadWhoAmI();
+
+    // Sends any complete batches once the hub is reachable.
+    TelemetryPipeline_Process(&telemetryPipeline);
+#ifdef RADIO_DUTY_CYCLE
+    CheckRadioWake();
+#endif
 }
 
 /// <summary>
-///     Azure timer event:  Check connection status and send telemetry
+///     Azure timer event:  Connect to the IoT Hub if necessary, let the client do its work, and
+///     schedule the next call according to how busy the client is
 /// </summary>
 static void AzureTimerEventHandler(EventLoopTimer *timer)
 {
@@ -316,40 +653,235 @@ static void AzureTimerEventHandler(EventLoopTimer *timer)
         return;
     }
 
-    // Check whether the device is connected to the internet.
-    Networking_InterfaceConnectionStatus status;
-    if (Networking_GetInterfaceConnectionStatus(NetworkInterface, &status) == 0) {
-        if ((status & Networking_InterfaceConnectionStatus_ConnectedToInternet) &&
-            (iotHubClientAuthenticationState == IoTHubClientAuthenticationState_NotAuthenticated)) {
-            SetUpAzureIoTHubClient();
-        }
-    } else {
-        if (errno != EAGAIN) {
-            Log_Debug("ERROR: Networking_GetInterfaceConnectionStatus: %d (%s)\n", errno,
-                      strerror(errno));
-            exitCode = ExitCode_InterfaceConnectionStatus_Failed;
-            return;
+    // The network only needs to be checked before connecting. Once the client has been set up,
+    // ConnectionStatusCallback reports when the connection is lost.
+    if (iotHubClientAuthenticationState == IoTHubClientAuthenticationState_NotAuthenticated &&
+        NetworkState_IsConnectedToInternet()) {
+        SetUpAzureIoTHubClient();
+    }
+
+    if (iothubClientHandle != NULL) {
+        IoTHubDeviceClient_LL_DoWork(iothubClientHandle);
+    }
+
+#ifdef RADIO_DUTY_CYCLE
+    ConsiderRadioOff();
+#endif
+    ScheduleAzureTimer();
+}
+
+/// <summary>
+///     Arm the Azure timer to fire once after a delay.
+/// </summary>
+static void ArmAzureTimer(int delayMs)
+{
+    struct timespec delay = {.tv_sec = delayMs / 1000, .tv_nsec = (delayMs % 1000) * 1000000};
+    if (SetEventLoopTimerOneShot(azureTimer, &delay) != 0) {
+        exitCode = ExitCode_AzureTimer_Arm;
+    }
+}
+
+/// <summary>
+///     Schedule the next call to IoTHubDeviceClient_LL_DoWork: after the reconnect period if the
+///     client could not be set up, soon if the client is busy, and otherwise after an interval
+///     which backs off exponentially while the client stays idle.
+/// </summary>
+static void ScheduleAzureTimer(void)
+{
+    if (azureIoTReconnectPeriodSeconds > 0) {
+        ArmAzureTimer(azureIoTReconnectPeriodSeconds * 1000);
+        return;
+    }
+
+    bool busy =
+        outstandingIoTHubRequests > 0 ||
+        iotHubClientAuthenticationState == IoTHubClientAuthenticationState_AuthenticationInitiated;
+    if (busy) {
+        azureIoTDoWorkPeriodMs = AzureIoTMinDoWorkPeriodMs;
+    } else if (azureIoTDoWorkPeriodMs < AzureIoTMaxDoWorkPeriodMs) {
+        azureIoTDoWorkPeriodMs *= 2;
+        if (azureIoTDoWorkPeriodMs > AzureIoTMaxDoWorkPeriodMs) {
+            azureIoTDoWorkPeriodMs = AzureIoTMaxDoWorkPeriodMs;
         }
     }
 
-    if (iotHubClientAuthenticationState == IoTHubClientAuthenticationState_Authenticated) {
-        telemetryCount++;
-        if (telemetryCount == AzureIoTPollPeriodsPerTelemetry) {
-            telemetryCount = 0;
-            //SendSimulatedTelemetry();
-            SendTempTelemetry();   
-            //SendGPIO1Telemetry(); 
-            //SendGPIO2Telemetry(); 
-            //SendGPIO3Telemetry(); 
-            //ReadWhoAmI();
+    ArmAzureTimer(azureIoTDoWorkPeriodMs);
+}
+
+/// <summary>
+///     Called when the connection status of the network interface changes. When the interface
+///     connects to the internet, the client connects at once, rather than when the Azure timer
+///     next fires.
+/// </summary>
+static void NetworkStateChangedHandler(Networking_InterfaceConnectionStatus status, void *context)
+{
+    if ((status & Networking_InterfaceConnectionStatus_ConnectedToInternet) != 0 &&
+        iotHubClientAuthenticationState == IoTHubClientAuthenticationState_NotAuthenticated) {
+        azureIoTDoWorkPeriodMs = AzureIoTMinDoWorkPeriodMs;
+        ArmAzureTimer(azureIoTDoWorkPeriodMs);
+    }
+}
 
+/// <summary>
+///     Called when the connection status of the network interface cannot be read.
+/// </summary>
+static void NetworkStateErrorHandler(void *context)
+{
+    exitCode = ExitCode_InterfaceConnectionStatus_Failed;
+}
+
+/// <summary>
+///     Called when a request has been queued on the client, so that it is sent promptly even if
+///     the client has been idle.
+/// </summary>
+static void RequestAzureIoTWork(void)
+{
+    if (azureIoTDoWorkPeriodMs > AzureIoTMinDoWorkPeriodMs) {
+        azureIoTDoWorkPeriodMs = AzureIoTMinDoWorkPeriodMs;
+        ArmAzureTimer(azureIoTDoWorkPeriodMs);
+    }
+}
+
+#ifdef RADIO_DUTY_CYCLE
+/// <summary>
+///     Gets the number of milliseconds since a time from CLOCK_MONOTONIC.
+/// </summary>
+static uint32_t MillisecondsSince(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t)((now.tv_sec - start->tv_sec) * 1000 +
+                      (now.tv_nsec - start->tv_nsec) / 1000000);
+}
+
+/// <summary>
+///     Gets how long before a batch is due the radio is turned on.
+/// </summary>
+static int GetRadioLeadSeconds(void)
+{
+    if (radioCycles == 0) {
+        return RadioDefaultLeadSeconds;
+    }
+    return (int)(totalReconnectMs / radioCycles / 1000) + RadioLeadMarginSeconds;
+}
+
+/// <summary>
+///     Turns the radio off if the client is idle and the next batch is far enough away that
+///     turning it off saves more than reconnecting costs.
+/// </summary>
+static void ConsiderRadioOff(void)
+{
+    if (radioOff ||
+        iotHubClientAuthenticationState != IoTHubClientAuthenticationState_Authenticated ||
+        outstandingIoTHubRequests > 0 ||
+        MillisecondsSince(&authenticatedTime) < (uint32_t)RadioMinOnSeconds * 1000) {
+        return;
+    }
+
+    time_t secondsUntilBatch;
+    if (!TelemetryPipeline_GetSecondsUntilBatch(&telemetryPipeline, &secondsUntilBatch) ||
+        secondsUntilBatch > RadioMaxOffSeconds) {
+        secondsUntilBatch = RadioMaxOffSeconds;
+    }
+    if (secondsUntilBatch - GetRadioLeadSeconds() < RadioMinOffSeconds) {
+        return;
+    }
+
+    // Remember the network, so that only it is scanned for when the radio is turned on.
+    WifiConfig_StoredNetwork storedNetworks[RADIO_MAX_STORED_NETWORKS];
+    ssize_t storedNetworkCount = WifiConfig_GetStoredNetworks(
+        storedNetworks, sizeof(storedNetworks) / sizeof(storedNetworks[0]));
+    radioNetworkId = -1;
+    for (ssize_t i = 0; i < storedNetworkCount; ++i) {
+        if (storedNetworks[i].isConnected) {
+            radioNetworkId = (int)i;
+            break;
         }
     }
 
-    if (iothubClientHandle != NULL) {
-        IoTHubDeviceClient_LL_DoWork(iothubClientHandle);
+    if (Networking_SetInterfaceState(NetworkInterface, false) == -1) {
+        Log_Debug("ERROR: Could not turn off %s: %s (%d).\n", NetworkInterface, strerror(errno),
+                  errno);
+        return;
+    }
+
+    // The connection has gone with the radio, so the client is set up again once it returns.
+    DestroyAzureIoTHubClient();
+    radioOff = true;
+    clock_gettime(CLOCK_MONOTONIC, &radioOffTime);
+    Log_Debug("INFO: Radio off; the next batch is due in %ld s.\n", (long)secondsUntilBatch);
+}
+
+/// <summary>
+///     Turns the radio on again if a batch will be due by the time it has reconnected, or if it
+///     has been off for as long as it may be.
+/// </summary>
+static void CheckRadioWake(void)
+{
+    if (!radioOff) {
+        return;
+    }
+
+    time_t secondsUntilBatch;
+    int leadSeconds = GetRadioLeadSeconds();
+    if ((TelemetryPipeline_GetSecondsUntilBatch(&telemetryPipeline, &secondsUntilBatch) &&
+         secondsUntilBatch <= leadSeconds) ||
+        MillisecondsSince(&radioOffTime) >= (uint32_t)(RadioMaxOffSeconds - leadSeconds) * 1000) {
+        TurnRadioOn();
+    }
+}
+
+/// <summary>
+///     Turns the radio on, scanning only for the network which the device was last connected to.
+///     If the radio cannot be turned on, it is tried again when the sensor is next read.
+/// </summary>
+static void TurnRadioOn(void)
+{
+    if (radioNetworkId >= 0 && WifiConfig_SetTargetedScanEnabled(radioNetworkId, true) == -1) {
+        Log_Debug("WARNING: Could not enable targeted scanning for network %d: %s (%d).\n",
+                  radioNetworkId, strerror(errno), errno);
+        radioNetworkId = -1;
+    }
+
+    if (Networking_SetInterfaceState(NetworkInterface, true) == -1) {
+        Log_Debug("ERROR: Could not turn on %s: %s (%d).\n", NetworkInterface, strerror(errno),
+                  errno);
+        return;
+    }
+
+    totalRadioOffSeconds += MillisecondsSince(&radioOffTime) / 1000;
+    radioOff = false;
+    radioReconnecting = true;
+    clock_gettime(CLOCK_MONOTONIC, &radioOnTime);
+    NetworkState_Refresh();
+}
+
+/// <summary>
+///     Called when the client has authenticated. If the radio has just been turned on again,
+///     logs how long it took to reconnect, against how long the radio was off.
+/// </summary>
+static void RecordRadioReconnect(void)
+{
+    clock_gettime(CLOCK_MONOTONIC, &authenticatedTime);
+    if (!radioReconnecting) {
+        return;
+    }
+
+    radioReconnecting = false;
+    if (radioNetworkId >= 0 && WifiConfig_SetTargetedScanEnabled(radioNetworkId, false) == -1) {
+        Log_Debug("WARNING: Could not disable targeted scanning for network %d: %s (%d).\n",
+                  radioNetworkId, strerror(errno), errno);
     }
+
+    uint32_t reconnectMs = MillisecondsSince(&radioOnTime);
+    ++radioCycles;
+    totalReconnectMs += reconnectMs;
+    Log_Debug("INFO: Reconnected in %lu ms after a radio-off period of %ld s.\n",
+              (unsigned long)reconnectMs, (long)(radioOnTime.tv_sec - radioOffTime.tv_sec));
+    Log_Debug("INFO: Over %u cycles the radio was off for %lu s, and reconnecting took %lu s.\n",
+              radioCycles, totalRadioOffSeconds, totalReconnectMs / 1000);
 }
+#endif
 
 /// <summary>
 ///     Parse the command line arguments given in the application manifest.
@@ -472,7 +1004,155 @@ static ExitCode ValidateUserConfiguration(void)
 }
 
 /// <summary>
-///     Set up SIGTERM termination handler, initialize peripherals, and set up event handlers.
+///     Open the status and RGB LEDs, which show the Device Twin settings state.
+/// </summary>
+/// <returns>0 on success, or -1 on failure, in which case exitCode is set.</returns>
+static int OpenLeds(void *context)
+{
+    if (GpioTable_Open(ledPins, Led_Count, ledFds, NULL) != 0) {
+        exitCode = ExitCode_Init_TwinStatusLed;
+        return -1;
+    }
+    return 0;
+}
+
+/// <summary>
+///     Open SAMPLE_BUTTON_1, which sends a message when it is pressed.
+/// </summary>
+/// <returns>0 on success, or -1 on failure, in which case exitCode is set.</returns>
+static int OpenButtons(void *context)
+{
+    // Open SAMPLE_BUTTON_1 GPIO as input
+    Log_Debug("Opening SAMPLE_BUTTON_1 as input.\n");
+    sendMessageButtonGpioFd = GPIO_OpenAsInput(SAMPLE_BUTTON_1);
+    if (sendMessageButtonGpioFd == -1) {
+        Log_Debug("ERROR: Could not open SAMPLE_BUTTON_1: %s (%d).\n", strerror(errno), errno);
+        exitCode = ExitCode_Init_MessageButton;
+        return -1;
+    }
+
+    // Sample the button from a timer which only runs quickly while the button changes.
+    buttons = ButtonInput_Create(eventLoop, NULL, ButtonsErrorHandler, NULL);
+    if (buttons == NULL) {
+        exitCode = ExitCode_Init_Buttons;
+        return -1;
+    }
+
+    if (ButtonInput_Add(buttons, sendMessageButtonGpioFd, SendMessageButtonHandler, NULL) != 0) {
+        exitCode = ExitCode_Init_AddMessageButton;
+        return -1;
+    }
+
+    return 0;
+}
+
+/// <summary>
+///     Open the GPIO inputs which can be sent as telemetry.
+/// </summary>
+/// <returns>0 on success, or -1 on failure, in which case exitCode is set.</returns>
+static int OpenGpioInputs(void *context)
+{
+    if (GpioTable_Open(gpioInputPins, GpioInput_Count, gpioInputFds, NULL) != 0) {
+        exitCode = ExitCode_Init_MessageButton;
+        return -1;
+    }
+
+    GpioTable_InitSnapshot(&gpioSnapshot);
+    const struct timespec gpioSnapshotPeriod = {.tv_sec = 0,
+                                                .tv_nsec = GpioSnapshotPeriodMs * 1000000};
+    gpioSnapshotTimer = CreateEventLoopPeriodicTimer(eventLoop, &GpioSnapshotTimerEventHandler,
+                                                     &gpioSnapshotPeriod);
+    if (gpioSnapshotTimer == NULL) {
+        exitCode = ExitCode_Init_GpioSnapshotTimer;
+        return -1;
+    }
+    return 0;
+}
+
+/// <summary>
+///     Start reporting the memory usage, the Wi-Fi connection and, if it is instrumented, the
+///     event loop.
+/// </summary>
+/// <returns>0 on success, or -1 on failure, in which case exitCode is set.</returns>
+static int StartDiagnostics(void *context)
+{
+    if (MemoryMonitor_Start(eventLoop, MemorySamplePeriodSeconds, MemorySamplesPerReport,
+                            SendMemoryTelemetry, NULL) != 0) {
+        exitCode = ExitCode_Init_MemoryMonitor;
+        return -1;
+    }
+
+    if (WifiDiagnostics_Start(eventLoop, WifiReportPeriodSeconds, SendWifiTelemetry, NULL) != 0) {
+        exitCode = ExitCode_Init_WifiDiagnostics;
+        return -1;
+    }
+
+#ifdef EVENTLOOP_STATS
+    EventLoopStats_SetReportHandler(SendEventLoopStats, NULL,
+                                    EVENTLOOP_STATS_REPORT_PERIOD_SECONDS);
+#endif
+
+    return 0;
+}
+
+/// <summary>
+///     Register the application's metrics, and start the registry, which counts this start.
+/// </summary>
+/// <returns>ExitCode_Success on success; otherwise ExitCode_Init_Metrics.</returns>
+static ExitCode StartMetrics(void)
+{
+    telemetrySentMetric = Metrics_RegisterCounter("TelemetryMessagesSent");
+    telemetryFailedMetric = Metrics_RegisterCounter("TelemetryMessagesFailed");
+    telemetrySizeMetric = Metrics_RegisterHistogram(
+        "TelemetryMessageBytes", telemetrySizeBounds,
+        sizeof(telemetrySizeBounds) / sizeof(telemetrySizeBounds[0]));
+    iotHubConnectionsMetric = Metrics_RegisterCounter("IoTHubConnections");
+    outstandingRequestsMetric = Metrics_RegisterGauge("OutstandingIoTHubRequests");
+    if (telemetrySentMetric < 0 || telemetryFailedMetric < 0 || telemetrySizeMetric < 0 ||
+        iotHubConnectionsMetric < 0 || outstandingRequestsMetric < 0) {
+        Log_Debug("ERROR: Could not register the metrics: %s (%d).\n", strerror(errno), errno);
+        return ExitCode_Init_Metrics;
+    }
+
+    if (Metrics_Start(eventLoop, MetricsStorageOffset, MetricsReportPeriodSeconds,
+                      SendMetricsTelemetry, NULL) != 0) {
+        Log_Debug("ERROR: Could not start the metrics: %s (%d).\n", strerror(errno), errno);
+        return ExitCode_Init_Metrics;
+    }
+
+    return ExitCode_Success;
+}
+
+/// <summary>
+///     Register the handlers of the direct methods which the sample supports.
+/// </summary>
+/// <returns>ExitCode_Success on success; otherwise ExitCode_Init_DirectMethods.</returns>
+static ExitCode RegisterDirectMethods(void)
+{
+    DirectMethods_Initialize(SendDirectMethodResponse);
+    if (DirectMethods_Register("TriggerAlarm", TriggerAlarmMethodHandler, NULL) != 0 ||
+        DirectMethods_Register("ReadSensor", ReadSensorMethodHandler, NULL) != 0) {
+        Log_Debug("ERROR: Could not register the direct methods: %s (%d).\n", strerror(errno),
+                  errno);
+        return ExitCode_Init_DirectMethods;
+    }
+    return ExitCode_Success;
+}
+
+/// <summary>
+///     Called when the deferred startup stages could not be scheduled. A stage which fails sets
+///     exitCode itself.
+/// </summary>
+static void StagedStartupFailureHandler(size_t stageIndex, void *context)
+{
+    if (stageIndex == DeferredStage_Count) {
+        exitCode = ExitCode_StagedStartup_Schedule;
+    }
+}
+
+/// <summary>
+///     Set up SIGTERM termination handler, initialize the sensor and the IoT Hub connection, and
+///     defer the other peripherals and handlers.
 /// </summary>
 /// <returns>
 ///     ExitCode_Success if all resources were allocated successfully; otherwise another
@@ -485,56 +1165,61 @@ static ExitCode InitPeripheralsAndHandlers(void)
     action.sa_handler = TerminationHandler;
     sigaction(SIGTERM, &action, NULL);
 
+    if (MemPool_Initialize(memPoolArena, sizeof(memPoolArena), memPoolClasses,
+                           sizeof(memPoolClasses) / sizeof(memPoolClasses[0])) != 0) {
+        Log_Debug("ERROR: Could not initialize the memory pool: %s (%d).\n", strerror(errno),
+                  errno);
+        return ExitCode_Init_MemPool;
+    }
+
     eventLoop = EventLoop_Create();
     if (eventLoop == NULL) {
         Log_Debug("Could not create event loop.\n");
         return ExitCode_Init_EventLoop;
     }
 
-    // Open SAMPLE_BUTTON_1 GPIO as input
-    Log_Debug("Opening SAMPLE_BUTTON_1 as input.\n");
-    sendMessageButtonGpioFd = GPIO_OpenAsInput(SAMPLE_BUTTON_1);
-    if (sendMessageButtonGpioFd == -1) {
-        Log_Debug("ERROR: Could not open SAMPLE_BUTTON_1: %s (%d).\n", strerror(errno), errno);
-        return ExitCode_Init_MessageButton;
+    // The device runs at the power-saver profile except while it connects to the IoT hub and
+    // uploads the bulk log.
+    if (PowerGovernor_Start(eventLoop) != 0) {
+        return ExitCode_Init_PowerGovernor;
     }
 
-    // Open GPIO0 GPIO as input
-    Log_Debug("Opening GPIO11 as input.\n");
-    sendMessageGpio0Fd = GPIO_OpenAsInput(MT3620_GPIO11);
-    if (sendMessageGpio0Fd == -1) {
-        Log_Debug("ERROR: Could not open SAMPLE_BUTTON_1: %s (%d).\n", strerror(errno), errno);
-        return ExitCode_Init_MessageButton;
+    ExitCode metricsExitCode = StartMetrics();
+    if (metricsExitCode != ExitCode_Success) {
+        return metricsExitCode;
     }
 
-    // Open GPIO1 GPIO as input
-    Log_Debug("Opening GPIO1 as input.\n");
-    sendMessageGpio1Fd = GPIO_OpenAsInput(MT3620_GPIO0);
-    if (sendMessageGpio0Fd == -1) {
-        Log_Debug("ERROR: Could not open SAMPLE_BUTTON_1: %s (%d).\n", strerror(errno), errno);
-        return ExitCode_Init_MessageButton;
+    ExitCode directMethodsExitCode = RegisterDirectMethods();
+    if (directMethodsExitCode != ExitCode_Success) {
+        return directMethodsExitCode;
     }
 
-    // Open GPIO2 GPIO as input
-    Log_Debug("Opening GPIO2 as input.\n");
-    sendMessageGpio2Fd = GPIO_OpenAsInput(MT3620_GPIO1);
-    if (sendMessageGpio0Fd == -1) {
-        Log_Debug("ERROR: Could not open SAMPLE_BUTTON_1: %s (%d).\n", strerror(errno), errno);
-        return ExitCode_Init_MessageButton;
+    if (BulkLog_Open(BulkLogStorageOffset, BulkLogStorageSize) != 0) {
+        Log_Debug("ERROR: Could not open the bulk log: %s (%d).\n", strerror(errno), errno);
+        return ExitCode_Init_BulkLog;
     }
 
-    // Open GPIO3 GPIO as input
-    Log_Debug("Opening GPIO3 as input.\n");
-    sendMessageGpio3Fd = GPIO_OpenAsInput(MT3620_GPIO2);
-    if (sendMessageGpio0Fd == -1) {
-        Log_Debug("ERROR: Could not open SAMPLE_BUTTON_1: %s (%d).\n", strerror(errno), errno);
-        return ExitCode_Init_MessageButton;
+    if (ReportedState_Start(eventLoop, ReportCoalescePeriodMs, SendReportedState, NULL) != 0) {
+        Log_Debug("ERROR: Could not start the reported state: %s (%d).\n", strerror(errno),
+                  errno);
+        return ExitCode_Init_ReportedState;
+    }
+    // The static device twin properties are reported once the client connects.
+    ReportedState_SetString("manufacturer", "Microsoft");
+    ReportedState_SetString("model", "Azure Sphere Sample Device");
+
+    if (StagedStartup_Start(eventLoop, deferredStages, DeferredStage_Count,
+                            StartupDeadlineSeconds, StagedStartupFailureHandler, NULL) != 0) {
+        return ExitCode_Init_StagedStartup;
     }
 
      // Open I2Cs
     Log_Debug("Opening I2C as input.\n");
     GroveShield_Initialize(&i2cFd, 115200);
-    sht31 = GroveTempHumiSHT31_Open(i2cFd);
+    if (Sht31Async_Init(&sht31, eventLoop, i2cFd, HandleSht31Measurement, NULL) != 0) {
+        Log_Debug("ERROR: Could not initialize SHT31: %s (%d).\n", strerror(errno), errno);
+        return ExitCode_Init_Sht31;
+    }
 
     //int result = I2CMaster_SetBusSpeed(i2cFd, I2C_BUS_SPEED_STANDARD);
     //if (result != 0) {
@@ -548,51 +1233,56 @@ static ExitCode InitPeripheralsAndHandlers(void)
     //    return ExitCode_Init_SetTimeout;
     //}
 
-    // SAMPLE_LED is used to show Device Twin settings state
-    Log_Debug("Opening SAMPLE_LED as output.\n");
-    deviceTwinStatusLedGpioFd =
-        GPIO_OpenAsOutput(SAMPLE_LED, GPIO_OutputMode_PushPull, GPIO_Value_High);
-    if (deviceTwinStatusLedGpioFd == -1) {
-        Log_Debug("ERROR: Could not open SAMPLE_LED: %s (%d).\n", strerror(errno), errno);
-        return ExitCode_Init_TwinStatusLed;
-    }
-
-    // RGB_LED is used to show Device Twin settings state
-    Log_Debug("Opening RGB_LED as output.\n");
-    deviceTwinRLedGpioFd =
-        GPIO_OpenAsOutput(MT3620_RDB_LED2_RED, GPIO_OutputMode_PushPull, GPIO_Value_Low);
-    deviceTwinGLedGpioFd =
-        GPIO_OpenAsOutput(MT3620_RDB_LED2_GREEN, GPIO_OutputMode_PushPull, GPIO_Value_Low);
-    deviceTwinBLedGpioFd =
-        GPIO_OpenAsOutput(MT3620_RDB_LED2_BLUE, GPIO_OutputMode_PushPull, GPIO_Value_Low);
-    //if (deviceTwinRLedGpioFd == -1) {
-    //    Log_Debug("ERROR: Could not open R_LED: %s (%d).\n", strerror(errno), errno);
-    //    return ExitCode_Init_TwinRLed;
-    //}
-    //if (deviceTwinGLedGpioFd == -1) {
-    //    Log_Debug("ERROR: Could not open G_LED: %s (%d).\n", strerror(errno), errno);
-    //    return ExitCode_Init_TwinGLed;
-    //}
-    //if (deviceTwinBLedGpioFd == -1) {
-    //    Log_Debug("ERROR: Could not open B_LED: %s (%d).\n", strerror(errno), errno);
-    //    return ExitCode_Init_TwinBLed;
-    //}
-
-    // Set up a timer to poll for button events.
-    static const struct timespec buttonPressCheckPeriod = {.tv_sec = 0, .tv_nsec = 1000 * 1000};
-    buttonPollTimer = CreateEventLoopPeriodicTimer(eventLoop, &ButtonPollTimerEventHandler,
-                                                   &buttonPressCheckPeriod);
-    if (buttonPollTimer == NULL) {
-        return ExitCode_Init_ButtonPollTimer;
+    static const struct timespec sensorPeriod = {.tv_sec = SensorPeriodSeconds, .tv_nsec = 0};
+    sensorTimer = CreateEventLoopPeriodicTimer(eventLoop, &SensorTimerEventHandler, &sensorPeriod);
+    if (sensorTimer == NULL) {
+        return ExitCode_Init_SensorTimer;
     }
 
-    azureIoTPollPeriodSeconds = AzureIoTDefaultPollPeriodSeconds;
-    struct timespec azureTelemetryPeriod = {.tv_sec = azureIoTPollPeriodSeconds, .tv_nsec = 0};
-    azureTimer =
-        CreateEventLoopPeriodicTimer(eventLoop, &AzureTimerEventHandler, &azureTelemetryPeriod);
+    // Connect as soon as the network is up. The timer is rearmed each time it fires.
+    azureTimer = CreateEventLoopDisarmedTimer(eventLoop, &AzureTimerEventHandler);
     if (azureTimer == NULL) {
         return ExitCode_Init_AzureTimer;
     }
+    azureIoTDoWorkPeriodMs = AzureIoTMinDoWorkPeriodMs;
+    ArmAzureTimer(azureIoTDoWorkPeriodMs);
+
+    static const struct timespec bulkUploadCheckPeriod = {.tv_sec = BulkUploadCheckPeriodSeconds,
+                                                          .tv_nsec = 0};
+    bulkUploadTimer = CreateEventLoopPeriodicTimer(eventLoop, &BulkUploadTimerEventHandler,
+                                                   &bulkUploadCheckPeriod);
+    if (bulkUploadTimer == NULL) {
+        return ExitCode_Init_BulkUploadTimer;
+    }
+
+    if (NetworkState_Start(eventLoop, NetworkInterface, NetworkStateErrorHandler, NULL) != 0 ||
+        NetworkState_Subscribe(NetworkStateChangedHandler, NULL) != 0) {
+        return ExitCode_Init_NetworkState;
+    }
+
+    if (TelemetryPipeline_Init(&telemetryPipeline, telemetryChannels,
+                               sizeof(telemetryChannels) / sizeof(telemetryChannels[0]),
+                               (uint32_t)ReadingsPerTelemetryWindow,
+                               TELEMETRY_BATCH_MAX_WINDOWS, TelemetryBatchWindowSeconds,
+                               TelemetryMaxMessagesInFlight, SendPipelineTelemetry,
+                               &telemetryPipeline) != 0) {
+        return ExitCode_Init_TelemetryPipeline;
+    }
+#ifdef TELEMETRY_ENCODING_CBOR
+    TelemetryPipeline_SetEncoding(&telemetryPipeline, TelemetryPipeline_Encoding_Cbor);
+#endif
+#ifdef TELEMETRY_HEARTBEAT_ONLY
+    static const bool heartbeatOnly = true;
+#else
+    static const bool heartbeatOnly = false;
+#endif
+    const TelemetryPipeline_ReportingPolicy reportingPolicy = {
+        .minIntervalSeconds = TelemetryMinReportSeconds,
+        .maxIntervalSeconds = TelemetryHeartbeatSeconds,
+        .heartbeatOnly = heartbeatOnly};
+    if (TelemetryPipeline_SetReportingPolicy(&telemetryPipeline, &reportingPolicy) != 0) {
+        return ExitCode_Init_TelemetryPipeline;
+    }
 
     return ExitCode_Success;
 }
@@ -617,19 +1307,35 @@ static void CloseFdAndPrintError(int fd, const char *fdName)
 /// </summary>
 static void ClosePeripheralsAndHandlers(void)
 {
-    DisposeEventLoopTimer(buttonPollTimer);
+    StagedStartup_Stop();
+    ButtonInput_Dispose(buttons);
+    DisposeEventLoopTimer(sensorTimer);
+    DisposeEventLoopTimer(gpioSnapshotTimer);
     DisposeEventLoopTimer(azureTimer);
+    DisposeEventLoopTimer(bulkUploadTimer);
+    BulkLog_Flush();
+    ReportedState_Stop();
+    Sht31Async_Dispose(&sht31);
+    MemoryMonitor_Stop();
+    WifiDiagnostics_Stop();
+    NetworkState_Stop();
+    PowerGovernor_Stop();
+#ifdef RADIO_DUTY_CYCLE
+    // The interface stays as it was left after the application exits.
+    if (radioOff) {
+        Networking_SetInterfaceState(NetworkInterface, true);
+    }
+#endif
+    Metrics_Stop();
     EventLoop_Close(eventLoop);
 
     Log_Debug("Closing file descriptors\n");
 
     // Leave the LEDs off
-    if (deviceTwinStatusLedGpioFd >= 0) {
-        GPIO_SetValue(deviceTwinStatusLedGpioFd, GPIO_Value_High);
-    }
+    GpioTable_Close(ledPins, Led_Count, ledFds);
+    GpioTable_Close(gpioInputPins, GpioInput_Count, gpioInputFds);
 
     CloseFdAndPrintError(sendMessageButtonGpioFd, "SendMessageButton");
-    CloseFdAndPrintError(deviceTwinStatusLedGpioFd, "StatusLed");
 }
 
 /// <summary>
@@ -642,16 +1348,114 @@ static void ConnectionStatusCallback(IOTHUB_CLIENT_CONNECTION_STATUS result,
                                      void *userContextCallback)
 {
     Log_Debug("Azure IoT connection status: %s\n", GetReasonString(reason));
+    BulkLog_AddText(BulkChannel_Connection, GetReasonString(reason));
+    PowerGovernor_EndPhase(PowerGovernor_Phase_Handshake);
 
     if (result != IOTHUB_CLIENT_CONNECTION_AUTHENTICATED) {
         iotHubClientAuthenticationState = IoTHubClientAuthenticationState_NotAuthenticated;
+        // The device may have been moved to another hub, or removed from this one, if the hub
+        // rejects it. A network or transport failure says nothing about the assignment, so the
+        // cache is kept, and the connection is retried without registering with DPS again.
+        bool assignmentRejected = reason == IOTHUB_CLIENT_CONNECTION_BAD_CREDENTIAL ||
+                                  reason == IOTHUB_CLIENT_CONNECTION_EXPIRED_SAS_TOKEN ||
+                                  reason == IOTHUB_CLIENT_CONNECTION_DEVICE_DISABLED;
+        if (usingCachedDpsAssignment && assignmentRejected) {
+            Log_Debug("INFO: The cached DPS assignment failed; registering with DPS again.\n");
+            DpsCache_Remove();
+            usingCachedDpsAssignment = false;
+        }
         return;
     }
 
     iotHubClientAuthenticationState = IoTHubClientAuthenticationState_Authenticated;
+    usingCachedDpsAssignment = false;
+    Metrics_Add(iotHubConnectionsMetric, 1);
+#ifdef RADIO_DUTY_CYCLE
+    RecordRadioReconnect();
+#endif
+
+    // Report the properties which changed, or whose report failed, while disconnected. The IoT
+    // Hub keeps the properties which it acknowledged before.
+    ReportedState_Flush();
+}
+
+/// <summary>
+///     Bulk upload timer event: upload the bulk log once it is large or old enough, unless the
+///     client is not connected or telemetry is awaiting confirmation.
+/// </summary>
+static void BulkUploadTimerEventHandler(EventLoopTimer *timer)
+{
+    if (ConsumeEventLoopTimerEvent(timer) != 0) {
+        exitCode = ExitCode_BulkUploadTimer_Consume;
+        return;
+    }
+
+    secondsSinceBulkUpload += BulkUploadCheckPeriodSeconds;
+    size_t storedSize = BulkLog_GetStoredSize();
+    bool due = storedSize >= BulkUploadThresholdBytes ||
+               (storedSize > 0 && secondsSinceBulkUpload >= BulkUploadMaxAgeSeconds);
+    if (due && iotHubClientAuthenticationState == IoTHubClientAuthenticationState_Authenticated &&
+        outstandingIoTHubRequests == 0) {
+        UploadBulkLog();
+    }
+}
+
+/// <summary>
+///     Called by the IoT Hub client for each block of the bulk log which it uploads, and then to
+///     report the result of the upload.
+/// </summary>
+static IOTHUB_CLIENT_FILE_UPLOAD_GET_DATA_RESULT BulkUploadGetDataCallback(
+    IOTHUB_CLIENT_FILE_UPLOAD_RESULT result, unsigned char const **data, size_t *size,
+    void *context)
+{
+    BulkUpload *upload = context;
+    if (data == NULL || size == NULL) {
+        upload->succeeded = result == FILE_UPLOAD_OK;
+        return IOTHUB_CLIENT_FILE_UPLOAD_GET_DATA_OK;
+    }
+
+    // An empty block ends the upload.
+    const uint8_t *part;
+    size_t partSize;
+    if (result != FILE_UPLOAD_OK || BulkLog_Read(upload->offset, &part, &partSize) != 0) {
+        return IOTHUB_CLIENT_FILE_UPLOAD_GET_DATA_ABORT;
+    }
+    *data = partSize > 0 ? part : NULL;
+    *size = partSize;
+    upload->offset += partSize;
+    return IOTHUB_CLIENT_FILE_UPLOAD_GET_DATA_OK;
+}
 
-    // Send static device twin properties when connection is established.
-    TwinReportState("{\"manufacturer\":\"Microsoft\",\"model\":\"Azure Sphere Sample Device\"}");
+/// <summary>
+///     Upload the bulk log to a blob in the storage account which is linked to the IoT hub,
+///     streaming it from mutable storage a chunk at a time, and clear it once it has been
+///     uploaded.
+/// </summary>
+static void UploadBulkLog(void)
+{
+    if (BulkLog_Flush() != 0) {
+        return;
+    }
+
+    // The IoT hub stores the blob under the device ID.
+    char blobName[32];
+    snprintf(blobName, sizeof(blobName), "bulk-%lld.bin", (long long)time(NULL));
+
+    Log_Debug("INFO: Uploading %zu bytes of bulk data to %s.\n", BulkLog_GetStoredSize(),
+              blobName);
+    BulkUpload upload = {.offset = 0, .succeeded = false};
+    PowerGovernor_BeginPhase(PowerGovernor_Phase_Upload);
+    IOTHUB_CLIENT_RESULT result = IoTHubDeviceClient_LL_UploadMultipleBlocksToBlob(
+        iothubClientHandle, blobName, BulkUploadGetDataCallback, &upload);
+    PowerGovernor_EndPhase(PowerGovernor_Phase_Upload);
+    if (result != IOTHUB_CLIENT_OK || !upload.succeeded) {
+        Log_Debug("ERROR: Could not upload the bulk data; it is kept for the next upload.\n");
+        return;
+    }
+
+    Log_Debug("INFO: Bulk data uploaded.\n");
+    secondsSinceBulkUpload = 0;
+    BulkLog_Clear();
 }
 
 /// <summary>
@@ -663,41 +1467,40 @@ static void SetUpAzureIoTHubClient(void)
 {
     bool isClientSetupSuccessful = false;
 
-    if (iothubClientHandle != NULL) {
-        IoTHubDeviceClient_LL_Destroy(iothubClientHandle);
-    }
+    DestroyAzureIoTHubClient();
+
+    // The DPS registration and the TLS handshake run at the high-performance profile, until
+    // ConnectionStatusCallback reports the result.
+    PowerGovernor_BeginPhase(PowerGovernor_Phase_Handshake);
 
     if (connectionType == ConnectionType_Direct) {
-        isClientSetupSuccessful = SetUpAzureIoTHubClientWithDaa();
+        isClientSetupSuccessful = SetUpAzureIoTHubClientWithDaa(hubHostName, deviceId);
     } else if (connectionType == ConnectionType_DPS) {
         isClientSetupSuccessful = SetUpAzureIoTHubClientWithDps();
     }
 
     if (!isClientSetupSuccessful) {
-        // If we fail to connect, reduce the polling frequency, starting at
+        // If we fail to connect, retry less often, starting at
         // AzureIoTMinReconnectPeriodSeconds and with a backoff up to
-        // AzureIoTMaxReconnectPeriodSeconds
-        if (azureIoTPollPeriodSeconds == AzureIoTDefaultPollPeriodSeconds) {
-            azureIoTPollPeriodSeconds = AzureIoTMinReconnectPeriodSeconds;
+        // AzureIoTMaxReconnectPeriodSeconds. AzureTimerEventHandler schedules the retry.
+        if (azureIoTReconnectPeriodSeconds == 0) {
+            azureIoTReconnectPeriodSeconds = AzureIoTMinReconnectPeriodSeconds;
         } else {
-            azureIoTPollPeriodSeconds *= 2;
-            if (azureIoTPollPeriodSeconds > AzureIoTMaxReconnectPeriodSeconds) {
-                azureIoTPollPeriodSeconds = AzureIoTMaxReconnectPeriodSeconds;
+            azureIoTReconnectPeriodSeconds *= 2;
+            if (azureIoTReconnectPeriodSeconds > AzureIoTMaxReconnectPeriodSeconds) {
+                azureIoTReconnectPeriodSeconds = AzureIoTMaxReconnectPeriodSeconds;
             }
         }
 
-        struct timespec azureTelemetryPeriod = {azureIoTPollPeriodSeconds, 0};
-        SetEventLoopTimerPeriod(azureTimer, &azureTelemetryPeriod);
-
         Log_Debug("ERROR: Failed to create IoTHub Handle - will retry in %i seconds.\n",
-                  azureIoTPollPeriodSeconds);
+                  azureIoTReconnectPeriodSeconds);
+        PowerGovernor_EndPhase(PowerGovernor_Phase_Handshake);
         return;
     }
 
-    // Successfully connected, so make sure the polling frequency is back to the default
-    azureIoTPollPeriodSeconds = AzureIoTDefaultPollPeriodSeconds;
-    struct timespec azureTelemetryPeriod = {.tv_sec = azureIoTPollPeriodSeconds, .tv_nsec = 0};
-    SetEventLoopTimerPeriod(azureTimer, &azureTelemetryPeriod);
+    // Successfully connected, so poll quickly while the client authenticates
+    azureIoTReconnectPeriodSeconds = 0;
+    azureIoTDoWorkPeriodMs = AzureIoTMinDoWorkPeriodMs;
 
     // Set client authentication state to initiated. This is done to indicate that
     // SetUpAzureIoTHubClient() has been called (and so should not be called again) while the
@@ -705,16 +1508,36 @@ static void SetUpAzureIoTHubClient(void)
     iotHubClientAuthenticationState = IoTHubClientAuthenticationState_AuthenticationInitiated;
 
     IoTHubDeviceClient_LL_SetDeviceTwinCallback(iothubClientHandle, DeviceTwinCallback, NULL);
-    IoTHubDeviceClient_LL_SetDeviceMethodCallback(iothubClientHandle, DeviceMethodCallback, NULL);
+    // The inbound callback lets a method respond after the callback has returned.
+    IoTHubClient_LL_SetDeviceMethodCallback_Ex(iothubClientHandle, DeviceMethodCallback, NULL);
     IoTHubDeviceClient_LL_SetConnectionStatusCallback(iothubClientHandle, ConnectionStatusCallback,
                                                       NULL);
 }
 
+/// <summary>
+///     Destroys the IoT Hub client, if there is one, and abandons its outstanding requests.
+/// </summary>
+static void DestroyAzureIoTHubClient(void)
+{
+    if (iothubClientHandle == NULL) {
+        return;
+    }
+
+    IoTHubDeviceClient_LL_Destroy(iothubClientHandle);
+    iothubClientHandle = NULL;
+    iotHubClientAuthenticationState = IoTHubClientAuthenticationState_NotAuthenticated;
+    outstandingIoTHubRequests = 0;
+    DirectMethods_CancelAll();
+    ReportedState_OnReportComplete(false);
+}
+
 /// <summary>
 ///     Sets up the Azure IoT Hub connection (creates the iothubClientHandle)
 ///     with DAA
 /// </summary>
-static bool SetUpAzureIoTHubClientWithDaa(void)
+/// <param name="iotHubHostName">The hostname of the IoT hub.</param>
+/// <param name="iotHubDeviceId">The ID of the device in the IoT hub, in lowercase.</param>
+static bool SetUpAzureIoTHubClientWithDaa(const char *iotHubHostName, const char *iotHubDeviceId)
 {
     // Set up auth type
     int retError = iothub_security_init(IOTHUB_SECURITY_TYPE_X509);
@@ -725,7 +1548,7 @@ static bool SetUpAzureIoTHubClientWithDaa(void)
 
     // Create Azure Iot Hub client handle
     iothubClientHandle =
-        IoTHubDeviceClient_LL_CreateFromDeviceAuth(hubHostName, deviceId, MQTT_Protocol);
+        IoTHubDeviceClient_LL_CreateFromDeviceAuth(iotHubHostName, iotHubDeviceId, MQTT_Protocol);
 
     if (iothubClientHandle == NULL) {
         Log_Debug("IoTHubDeviceClient_LL_CreateFromDeviceAuth returned NULL.\n");
@@ -744,137 +1567,274 @@ static bool SetUpAzureIoTHubClientWithDaa(void)
 
 /// <summary>
 ///     Sets up the Azure IoT Hub connection (creates the iothubClientHandle)
-///     with DPS
+///     with DPS. The IoT hub which DPS assigned is cached, and is connected to directly while the
+///     cached assignment remains valid.
 /// </summary>
 static bool SetUpAzureIoTHubClientWithDps(void)
 {
-    AZURE_SPHERE_PROV_RETURN_VALUE provResult =
-        IoTHubDeviceClient_LL_CreateWithAzureSphereDeviceAuthProvisioning(scopeId, 10000,
-                                                                          &iothubClientHandle);
-    Log_Debug("IoTHubDeviceClient_LL_CreateWithAzureSphereDeviceAuthProvisioning returned '%s'.\n",
-              GetAzureSphereProvisioningResultString(provResult));
+    DpsCache_Assignment assignment;
+    if (DpsCache_Load(scopeId, &assignment)) {
+        Log_Debug("INFO: Connecting to cached DPS assignment %s.\n", assignment.hubHostName);
+        if (SetUpAzureIoTHubClientWithDaa(assignment.hubHostName, assignment.deviceId)) {
+            usingCachedDpsAssignment = true;
+            return true;
+        }
 
-    if (provResult.result != AZURE_SPHERE_PROV_RESULT_OK) {
+        DpsCache_Remove();
+        if (iothubClientHandle != NULL) {
+            IoTHubDeviceClient_LL_Destroy(iothubClientHandle);
+            iothubClientHandle = NULL;
+            DirectMethods_CancelAll();
+            ReportedState_OnReportComplete(false);
+        }
+    }
+
+    usingCachedDpsAssignment = false;
+    if (!RegisterWithDps(&assignment)) {
         return false;
     }
 
-    return true;
+    Log_Debug("INFO: DPS assigned the device to %s.\n", assignment.hubHostName);
+    // The hub may not be the one to which the properties were reported.
+    ReportedState_Invalidate();
+    DpsCache_Store(scopeId, &assignment);
+    return SetUpAzureIoTHubClientWithDaa(assignment.hubHostName, assignment.deviceId);
 }
 
 /// <summary>
-///     Callback invoked when a Direct Method is received from Azure IoT Hub.
+///     Registers the device with DPS, using the DAA certificate, and waits until DPS has assigned
+///     it to an IoT hub or DpsRegistrationTimeoutMs has elapsed.
+/// </summary>
+/// <param name="assignment">Receives the IoT hub and device ID which DPS assigned.</param>
+/// <returns>true if the device was assigned to an IoT hub; false otherwise.</returns>
+static bool RegisterWithDps(DpsCache_Assignment *assignment)
+{
+    DpsRegistration registration = {.completed = false, .succeeded = false,
+                                    .assignment = assignment};
+    PROV_DEVICE_LL_HANDLE provHandle = NULL;
+
+    int retError = prov_dev_security_init(SECURE_DEVICE_TYPE_X509);
+    if (retError != 0) {
+        Log_Debug("ERROR: prov_dev_security_init failed with error %d.\n", retError);
+        return false;
+    }
+
+    provHandle = Prov_Device_LL_Create(DpsGlobalEndpoint, scopeId, Prov_Device_MQTT_Protocol);
+    if (provHandle == NULL) {
+        Log_Debug("ERROR: Prov_Device_LL_Create returned NULL.\n");
+        goto cleanup;
+    }
+
+    // Enable DAA cert usage when x509 is invoked
+    if (Prov_Device_LL_SetOption(provHandle, "SetDeviceId", &deviceIdForDaaCertUsage) !=
+        PROV_DEVICE_RESULT_OK) {
+        Log_Debug("ERROR: Failure setting DPS client option \"SetDeviceId\".\n");
+        goto cleanup;
+    }
+
+    if (Prov_Device_LL_Register_Device(provHandle, DpsRegisterDeviceCallback, &registration, NULL,
+                                       NULL) != PROV_DEVICE_RESULT_OK) {
+        Log_Debug("ERROR: Prov_Device_LL_Register_Device failed.\n");
+        goto cleanup;
+    }
+
+    const struct timespec pollPeriod = {.tv_sec = 0, .tv_nsec = DpsPollPeriodMs * 1000000};
+    for (int elapsedMs = 0; !registration.completed && elapsedMs < DpsRegistrationTimeoutMs;
+         elapsedMs += DpsPollPeriodMs) {
+        Prov_Device_LL_DoWork(provHandle);
+        nanosleep(&pollPeriod, NULL);
+    }
+
+    if (!registration.completed) {
+        Log_Debug("ERROR: DPS registration timed out.\n");
+    }
+
+cleanup:
+    if (provHandle != NULL) {
+        Prov_Device_LL_Destroy(provHandle);
+    }
+    prov_dev_security_deinit();
+    return registration.succeeded;
+}
+
+/// <summary>
+///     Callback invoked when DPS has processed the registration request.
+/// </summary>
+static void DpsRegisterDeviceCallback(PROV_DEVICE_RESULT registerResult, const char *iotHubUri,
+                                      const char *registeredDeviceId, void *context)
+{
+    DpsRegistration *registration = context;
+    registration->completed = true;
+
+    if (registerResult != PROV_DEVICE_RESULT_OK || iotHubUri == NULL ||
+        registeredDeviceId == NULL) {
+        Log_Debug("ERROR: DPS registration failed with result %d.\n", registerResult);
+        return;
+    }
+
+    if (strlen(iotHubUri) > DPS_CACHE_MAX_HUB_HOSTNAME_LENGTH ||
+        strlen(registeredDeviceId) > DPS_CACHE_MAX_DEVICE_ID_LENGTH) {
+        Log_Debug("ERROR: DPS returned an IoT hub hostname or device ID which is too long.\n");
+        return;
+    }
+
+    strcpy(registration->assignment->hubHostName, iotHubUri);
+    strcpy(registration->assignment->deviceId, registeredDeviceId);
+    registration->succeeded = true;
+}
+
+/// <summary>
+///     Callback invoked when a Direct Method is received from Azure IoT Hub. The method's handler
+///     responds through SendDirectMethodResponse, now or once its work has completed.
 /// </summary>
 static int DeviceMethodCallback(const char *methodName, const unsigned char *payload,
-                                size_t payloadSize, unsigned char **response, size_t *responseSize,
+                                size_t payloadSize, METHOD_HANDLE methodId,
                                 void *userContextCallback)
 {
-    int result;
-    char *responseString;
-
     Log_Debug("Received Device Method callback: Method name %s.\n", methodName);
+    DirectMethods_Dispatch(methodName, payload, payloadSize, (void *)methodId);
+    return 0;
+}
 
-    if (strcmp("TriggerAlarm", methodName) == 0) {
-        // Output alarm using Log_Debug
-        Log_Debug("  ----- ALARM TRIGGERED! -----\n");
-        responseString = "\"Alarm Triggered\""; // must be a JSON string (in quotes)
-        result = 200;
-    } else {
-        // All other method names are ignored
-        responseString = "{}";
-        result = -1;
+/// <summary>
+///     Sends the response to a direct method call to the IoT hub.
+/// </summary>
+static void SendDirectMethodResponse(void *methodId, int status, const unsigned char *response,
+                                     size_t responseSize)
+{
+    if (iothubClientHandle == NULL) {
+        return;
     }
 
-    // if 'response' is non-NULL, the Azure IoT library frees it after use, so copy it to heap
-    *responseSize = strlen(responseString);
-    *response = malloc(*responseSize);
-    memcpy(*response, responseString, *responseSize);
-    return result;
+    if (IoTHubClient_LL_DeviceMethodResponse(iothubClientHandle, (METHOD_HANDLE)methodId,
+                                             response, responseSize,
+                                             status) != IOTHUB_CLIENT_OK) {
+        Log_Debug("ERROR: Could not send the response to a direct method.\n");
+        return;
+    }
+    RequestAzureIoTWork();
 }
 
 /// <summary>
-///     Callback invoked when a Device Twin update is received from Azure IoT Hub.
+///     Handles the TriggerAlarm direct method, which logs an alarm.
 /// </summary>
-static void DeviceTwinCallback(DEVICE_TWIN_UPDATE_STATE updateState, const unsigned char *payload,
-                               size_t payloadSize, void *userContextCallback)
+static void TriggerAlarmMethodHandler(DirectMethods_Call *call, const unsigned char *payload,
+                                      size_t payloadSize, void *context)
+{
+    // Output alarm using Log_Debug
+    Log_Debug("  ----- ALARM TRIGGERED! -----\n");
+    // must be a JSON string (in quotes)
+    DirectMethods_RespondJson(call, DIRECT_METHODS_STATUS_OK, "\"Alarm Triggered\"");
+}
+
+/// <summary>
+///     Handles the ReadSensor direct method, which responds with a new temperature and humidity
+///     measurement. The call is answered by HandleSht31Measurement once the conversion has
+///     completed, so the IoT Hub client is not blocked while the sensor converts.
+/// </summary>
+static void ReadSensorMethodHandler(DirectMethods_Call *call, const unsigned char *payload,
+                                    size_t payloadSize, void *context)
 {
-    size_t nullTerminatedJsonSize = payloadSize + 1;
-    char *nullTerminatedJsonString = (char *)malloc(nullTerminatedJsonSize);
-    if (nullTerminatedJsonString == NULL) {
-        Log_Debug("ERROR: Could not allocate buffer for twin update payload.\n");
-        abort();
+    if (Sht31Async_StartMeasurement(&sht31) != 0) {
+        Log_Debug("ERROR: Could not start temperature measurement: %s (%d).\n", strerror(errno),
+                  errno);
+        DirectMethods_RespondJson(call, DIRECT_METHODS_STATUS_ERROR, sensorErrorResponse);
+        return;
     }
 
-    // Copy the provided buffer to a null terminated buffer.
-    memcpy(nullTerminatedJsonString, payload, payloadSize);
-    // Add the null terminator at the end.
-    nullTerminatedJsonString[nullTerminatedJsonSize - 1] = 0;
+    // A measurement which is already in progress answers this call too.
+    readSensorCalls[readSensorCallCount++] = call;
+}
+
+/// <summary>
+///     Answers each ReadSensor call which is waiting for the measurement which has completed.
+/// </summary>
+static void RespondToReadSensorCalls(bool valid, float temperature, float humidity)
+{
+    for (size_t i = 0; i < readSensorCallCount; ++i) {
+        DirectMethods_Call *call = readSensorCalls[i];
+        if (!valid) {
+            DirectMethods_RespondJson(call, DIRECT_METHODS_STATUS_ERROR, sensorErrorResponse);
+            continue;
+        }
+
+        size_t size;
+        char *buffer = DirectMethods_GetResponseBuffer(call, &size);
+        JsonWriter writer;
+        JsonWriter_Init(&writer, buffer, size);
+        JsonWriter_BeginObject(&writer, NULL);
+        JsonWriter_AddFloat(&writer, "Temperature", temperature, 2);
+        JsonWriter_AddFloat(&writer, "Humidity", humidity, 2);
+        JsonWriter_EndObject(&writer);
+        const char *response = JsonWriter_Finish(&writer);
+        DirectMethods_Respond(call, DIRECT_METHODS_STATUS_OK,
+                              response != NULL ? strlen(response) : 0);
+    }
+    readSensorCallCount = 0;
+}
 
-    JSON_Value *rootProperties = NULL;
-    rootProperties = json_parse_string(nullTerminatedJsonString);
-    if (rootProperties == NULL) {
+/// <summary>
+///     Callback invoked when a Device Twin update is received from Azure IoT Hub.
+/// </summary>
+static void DeviceTwinCallback(DEVICE_TWIN_UPDATE_STATE updateState, const unsigned char *payload,
+                               size_t payloadSize, void *userContextCallback)
+{
+    // The complete twin holds the desired properties in a "desired" object; partial updates hold
+    // only the desired properties which have changed. The payload is read in place.
+    const char *const *paths = updateState == DEVICE_TWIN_UPDATE_COMPLETE
+                                   ? completeTwinPropertyPaths
+                                   : partialTwinPropertyPaths;
+    JsonReader_Value values[TwinProperty_Count];
+    if (!JsonReader_FindProperties((const char *)payload, payloadSize, paths, TwinProperty_Count,
+                                   values)) {
         Log_Debug("WARNING: Cannot parse the string as JSON content.\n");
-        goto cleanup;
+        return;
     }
 
-    JSON_Object *rootObject = json_value_get_object(rootProperties);
-    JSON_Object *desiredProperties = json_object_dotget_object(rootObject, "desired");
-    if (desiredProperties == NULL) {
-        desiredProperties = rootObject;
+    // The complete twin is sent again each time the connection is re-established; skip the desired
+    // properties if they have already been handled.
+    int64_t version;
+    if (JsonReader_GetInt64(&values[TwinProperty_Version], &version)) {
+        if (version == desiredPropertiesVersion) {
+            Log_Debug("INFO: Desired properties version %lld already handled.\n",
+                      (long long)version);
+            return;
+        }
+        desiredPropertiesVersion = version;
     }
 
+    // The LEDs may not have been opened yet.
+    StagedStartup_Require(DeferredStage_Leds);
+
     // The desired properties should have a "StatusLED" object
-    int statusLedValue = json_object_dotget_boolean(desiredProperties, "StatusLED");
-    if (statusLedValue != -1) {
-        statusLedOn = statusLedValue == 1;
-        GPIO_SetValue(deviceTwinStatusLedGpioFd, statusLedOn ? GPIO_Value_Low : GPIO_Value_High);
+    bool statusLedValue;
+    if (JsonReader_GetBool(&values[TwinProperty_StatusLed], &statusLedValue)) {
+        statusLedOn = statusLedValue;
+        GPIO_SetValue(ledFds[Led_Status], statusLedOn ? GPIO_Value_Low : GPIO_Value_High);
     }
 
     // Report current status LED state
-    if (statusLedOn) {
-        TwinReportState("{\"StatusLED\":true}");
-    } else {
-        TwinReportState("{\"StatusLED\":false}");
-    }
+    ReportedState_SetBool("StatusLED", statusLedOn);
 
     // The desired properties should have a "RGBLED" object
-    int RLedValue = json_object_dotget_boolean(desiredProperties, "RLED");
-    int GLedValue = json_object_dotget_boolean(desiredProperties, "GLED");
-    int BLedValue = json_object_dotget_boolean(desiredProperties, "BLED");
-    if (RLedValue != -1) {
-        RLedOn = RLedValue == 1;
-        GPIO_SetValue(deviceTwinRLedGpioFd, RLedOn ? GPIO_Value_Low : GPIO_Value_High);
-    }
-    if (GLedValue != -1) {
-        GLedOn = GLedValue == 1;
-        GPIO_SetValue(deviceTwinGLedGpioFd, GLedOn ? GPIO_Value_Low : GPIO_Value_High);
-    }
-    if (BLedValue != -1) {
-        BLedOn = BLedValue == 1;
-        GPIO_SetValue(deviceTwinBLedGpioFd, BLedOn ? GPIO_Value_Low : GPIO_Value_High);
-    }
-    // Report current status LED state
-    if (RLedOn) {
-        TwinReportState("{\"RLED\":true}");
-    } else {
-        TwinReportState("{\"RLED\":false}");
+    bool RLedValue, GLedValue, BLedValue;
+    if (JsonReader_GetBool(&values[TwinProperty_RLed], &RLedValue)) {
+        RLedOn = RLedValue;
+        GPIO_SetValue(ledFds[Led_Red], RLedOn ? GPIO_Value_Low : GPIO_Value_High);
     }
-    // Report current status LED state
-    if (GLedOn) {
-        TwinReportState("{\"GLED\":true}");
-    } else {
-        TwinReportState("{\"GLED\":false}");
+    if (JsonReader_GetBool(&values[TwinProperty_GLed], &GLedValue)) {
+        GLedOn = GLedValue;
+        GPIO_SetValue(ledFds[Led_Green], GLedOn ? GPIO_Value_Low : GPIO_Value_High);
     }
-    // Report current status LED state
-    if (BLedOn) {
-        TwinReportState("{\"BLED\":true}");
-    } else {
-        TwinReportState("{\"BLED\":false}");
+    if (JsonReader_GetBool(&values[TwinProperty_BLed], &BLedValue)) {
+        BLedOn = BLedValue;
+        GPIO_SetValue(ledFds[Led_Blue], BLedOn ? GPIO_Value_Low : GPIO_Value_High);
     }
-
-cleanup:
-    // Release the allocated memory.
-    json_value_free(rootProperties);
-    free(nullTerminatedJsonString);
+    // Report current RGB LED state. The LEDs are reported in one update with the status LED, and
+    // only if they have changed.
+    ReportedState_SetBool("RLED", RLedOn);
+    ReportedState_SetBool("GLED", GLedOn);
+    ReportedState_SetBool("BLED", BLedOn);
 }
 
 /// <summary>
@@ -913,91 +1873,87 @@ static const char *GetReasonString(IOTHUB_CLIENT_CONNECTION_STATUS_REASON reason
 }
 
 /// <summary>
-///     Converts AZURE_SPHERE_PROV_RETURN_VALUE to a string.
-/// </summary>
-static const char *GetAzureSphereProvisioningResultString(
-    AZURE_SPHERE_PROV_RETURN_VALUE provisioningResult)
-{
-    switch (provisioningResult.result) {
-    case AZURE_SPHERE_PROV_RESULT_OK:
-        return "AZURE_SPHERE_PROV_RESULT_OK";
-    case AZURE_SPHERE_PROV_RESULT_INVALID_PARAM:
-        return "AZURE_SPHERE_PROV_RESULT_INVALID_PARAM";
-    case AZURE_SPHERE_PROV_RESULT_NETWORK_NOT_READY:
-        return "AZURE_SPHERE_PROV_RESULT_NETWORK_NOT_READY";
-    case AZURE_SPHERE_PROV_RESULT_DEVICEAUTH_NOT_READY:
-        return "AZURE_SPHERE_PROV_RESULT_DEVICEAUTH_NOT_READY";
-    case AZURE_SPHERE_PROV_RESULT_PROV_DEVICE_ERROR:
-        return "AZURE_SPHERE_PROV_RESULT_PROV_DEVICE_ERROR";
-    case AZURE_SPHERE_PROV_RESULT_GENERIC_ERROR:
-        return "AZURE_SPHERE_PROV_RESULT_GENERIC_ERROR";
-    default:
-        return "UNKNOWN_RETURN_VALUE";
-    }
-}
-
-/// <summary>
-///     Check the network status.
-/// </summary>
-static bool IsConnectionReadyToSendTelemetry(void)
-{
-    Networking_InterfaceConnectionStatus status;
-    if (Networking_GetInterfaceConnectionStatus(NetworkInterface, &status) != 0) {
-        if (errno != EAGAIN) {
-            Log_Debug("ERROR: Networking_GetInterfaceConnectionStatus: %d (%s)\n", errno,
-                      strerror(errno));
-            exitCode = ExitCode_InterfaceConnectionStatus_Failed;
-            return false;
-        }
-        Log_Debug(
-            "WARNING: Cannot send Azure IoT Hub telemetry because the networking stack isn't ready "
-            "yet.\n");
-        return false;
-    }
-
-    if ((status & Networking_InterfaceConnectionStatus_ConnectedToInternet) == 0) {
-        Log_Debug(
-            "WARNING: Cannot send Azure IoT Hub telemetry because the device is not connected to "
-            "the internet.\n");
-        return false;
-    }
-
-    return true;
-}
-
-/// <summary>
-///     Sends telemetry to Azure IoT Hub
+///     Sends telemetry to Azure IoT Hub, with the content type and encoding system properties set
+///     so that message routing and downstream consumers can decode it.
 /// </summary>
-static void SendTelemetry(const char *jsonMessage)
+/// <param name="body">The message to send.</param>
+/// <param name="size">Size of the message in bytes.</param>
+/// <param name="contentType">MIME type of the message.</param>
+/// <param name="contentEncoding">Character encoding of a text message, or NULL.</param>
+/// <param name="callbackContext">
+///     The telemetry pipeline which produced the message, which is told when it has been
+///     delivered; or NULL.
+/// </param>
+/// <returns>true if the client accepted the message for delivery; false otherwise.</returns>
+static bool SendTelemetryMessage(const void *body, size_t size, const char *contentType,
+                                 const char *contentEncoding, void *callbackContext)
 {
     if (iotHubClientAuthenticationState != IoTHubClientAuthenticationState_Authenticated) {
         // AzureIoT client is not authenticated. Log a warning and return.
         Log_Debug("WARNING: Azure IoT Hub is not authenticated. Not sending telemetry.\n");
-        return;
+        return false;
     }
 
-    Log_Debug("Sending Azure IoT Hub telemetry: %s.\n", jsonMessage);
+    Log_Debug("Sending Azure IoT Hub telemetry: %zu bytes of %s.\n", size, contentType);
 
-    // Check whether the device is connected to the internet.
-    if (IsConnectionReadyToSendTelemetry() == false) {
-        return;
-    }
-
-    IOTHUB_MESSAGE_HANDLE messageHandle = IoTHubMessage_CreateFromString(jsonMessage);
+    IOTHUB_MESSAGE_HANDLE messageHandle = IoTHubMessage_CreateFromByteArray(body, size);
 
     if (messageHandle == 0) {
         Log_Debug("ERROR: unable to create a new IoTHubMessage.\n");
-        return;
+        return false;
+    }
+
+    if (IoTHubMessage_SetContentTypeSystemProperty(messageHandle, contentType) !=
+            IOTHUB_MESSAGE_OK ||
+        (contentEncoding != NULL &&
+         IoTHubMessage_SetContentEncodingSystemProperty(messageHandle, contentEncoding) !=
+             IOTHUB_MESSAGE_OK)) {
+        Log_Debug("ERROR: unable to set the content type of the IoTHubMessage.\n");
+        IoTHubMessage_Destroy(messageHandle);
+        return false;
     }
 
-    if (IoTHubDeviceClient_LL_SendEventAsync(iothubClientHandle, messageHandle, SendEventCallback,
-                                             /*&callback_param*/ NULL) != IOTHUB_CLIENT_OK) {
+    bool accepted = IoTHubDeviceClient_LL_SendEventAsync(iothubClientHandle, messageHandle,
+                                                         SendEventCallback,
+                                                         callbackContext) == IOTHUB_CLIENT_OK;
+    if (!accepted) {
         Log_Debug("ERROR: failure requesting IoTHubClient to send telemetry event.\n");
+        Metrics_Add(telemetryFailedMetric, 1);
     } else {
         Log_Debug("INFO: IoTHubClient accepted the telemetry event for delivery.\n");
+        ++outstandingIoTHubRequests;
+        Metrics_Set(outstandingRequestsMetric, outstandingIoTHubRequests);
+        Metrics_Observe(telemetrySizeMetric, (int64_t)size);
+        RequestAzureIoTWork();
     }
 
     IoTHubMessage_Destroy(messageHandle);
+    return accepted;
+}
+
+/// <summary>
+///     Sends JSON telemetry to Azure IoT Hub.
+/// </summary>
+/// <param name="jsonMessage">The null-terminated message to send.</param>
+/// <param name="callbackContext">Passed to SendTelemetryMessage.</param>
+/// <returns>true if the client accepted the message for delivery; false otherwise.</returns>
+static bool SendTelemetry(const char *jsonMessage, void *callbackContext)
+{
+    Log_Debug("Telemetry: %s\n", jsonMessage);
+    return SendTelemetryMessage(jsonMessage, strlen(jsonMessage), "application/json", "utf-8",
+                                callbackContext);
+}
+
+/// <summary>
+///     Sends a batch which the telemetry pipeline has encoded.
+/// </summary>
+static bool SendPipelineTelemetry(const void *message, size_t size, void *context)
+{
+#ifdef TELEMETRY_ENCODING_CBOR
+    return SendTelemetryMessage(message, size, CBOR_WRITER_CONTENT_TYPE, NULL, context);
+#else
+    return SendTelemetry(message, context);
+#endif
 }
 
 /// <summary>
@@ -1006,26 +1962,50 @@ static void SendTelemetry(const char *jsonMessage)
 static void SendEventCallback(IOTHUB_CLIENT_CONFIRMATION_RESULT result, void *context)
 {
     Log_Debug("INFO: Azure IoT Hub send telemetry event callback: status code %d.\n", result);
+
+    if (outstandingIoTHubRequests > 0) {
+        --outstandingIoTHubRequests;
+    }
+    Metrics_Set(outstandingRequestsMetric, outstandingIoTHubRequests);
+    Metrics_Add(result == IOTHUB_CLIENT_CONFIRMATION_OK ? telemetrySentMetric
+                                                        : telemetryFailedMetric,
+                1);
+
+    if (context != NULL) {
+        TelemetryPipeline_OnSendComplete(context, result == IOTHUB_CLIENT_CONFIRMATION_OK);
+    }
+
+    // The first telemetry has been sent, so open the resources which were deferred.
+    if (result == IOTHUB_CLIENT_CONFIRMATION_OK) {
+        StagedStartup_MarkFirstEvent("telemetry message sent");
+        StagedStartup_Complete();
+    }
 }
 
 /// <summary>
-///     Enqueues a report containing Device Twin reported properties. The report is not sent
-///     immediately, but it is sent on the next invocation of IoTHubDeviceClient_LL_DoWork().
+///     Enqueues a report containing the Device Twin reported properties which have changed. The
+///     report is not sent immediately, but it is sent on the next invocation of
+///     IoTHubDeviceClient_LL_DoWork(). While the client is not authenticated, the report is left
+///     to the reported state cache, which reports the properties again once it connects.
 /// </summary>
-static void TwinReportState(const char *jsonState)
+static bool SendReportedState(const char *report, size_t size, void *context)
 {
-    if (iothubClientHandle == NULL) {
-        Log_Debug("ERROR: Azure IoT Hub client not initialized.\n");
-    } else {
-        if (IoTHubDeviceClient_LL_SendReportedState(
-                iothubClientHandle, (const unsigned char *)jsonState, strlen(jsonState),
-                ReportedStateCallback, NULL) != IOTHUB_CLIENT_OK) {
-            Log_Debug("ERROR: Azure IoT Hub client error when reporting state '%s'.\n", jsonState);
-        } else {
-            Log_Debug("INFO: Azure IoT Hub client accepted request to report state '%s'.\n",
-                      jsonState);
-        }
+    if (iothubClientHandle == NULL ||
+        iotHubClientAuthenticationState != IoTHubClientAuthenticationState_Authenticated) {
+        return false;
+    }
+
+    if (IoTHubDeviceClient_LL_SendReportedState(iothubClientHandle, (const unsigned char *)report,
+                                                size, ReportedStateCallback,
+                                                NULL) != IOTHUB_CLIENT_OK) {
+        Log_Debug("ERROR: Azure IoT Hub client error when reporting state '%s'.\n", report);
+        return false;
     }
+
+    Log_Debug("INFO: Azure IoT Hub client accepted request to report state '%s'.\n", report);
+    ++outstandingIoTHubRequests;
+    RequestAzureIoTWork();
+    return true;
 }
 
 /// <summary>
@@ -1035,6 +2015,11 @@ static void TwinReportState(const char *jsonState)
 static void ReportedStateCallback(int result, void *context)
 {
     Log_Debug("INFO: Azure IoT Hub Device Twin reported state callback: status code %d.\n", result);
+
+    if (outstandingIoTHubRequests > 0) {
+        --outstandingIoTHubRequests;
+    }
+    ReportedState_OnReportComplete(result >= 200 && result < 300);
 }
 
 #define TELEMETRY_BUFFER_SIZE 100
@@ -1050,77 +2035,166 @@ void SendSimulatedTelemetry(void)
     temperature += delta;
 
     char telemetryBuffer[TELEMETRY_BUFFER_SIZE];
-    int len =
-        snprintf(telemetryBuffer, TELEMETRY_BUFFER_SIZE, "{\"Temperature\":%3.2f}", temperature);
-    if (len < 0 || len >= TELEMETRY_BUFFER_SIZE) {
+    JsonWriter writer;
+    JsonWriter_Init(&writer, telemetryBuffer, sizeof(telemetryBuffer));
+    JsonWriter_BeginObject(&writer, NULL);
+    JsonWriter_AddFloat(&writer, "Temperature", temperature, 2);
+    JsonWriter_EndObject(&writer);
+
+    const char *telemetry = JsonWriter_Finish(&writer);
+    if (telemetry == NULL) {
         Log_Debug("ERROR: Cannot write telemetry to buffer.\n");
         return;
     }
-    SendTelemetry(telemetryBuffer);
+    SendTelemetry(telemetry, NULL);
 }
 
 /// <summary>
-///     Check whether a given button has just been pressed.
+///     Logs the memory usage, and sends it to Azure IoT Hub, together with the usage of the
+///     memory pool by each subsystem.
 /// </summary>
-/// <param name="fd">The button file descriptor</param>
-/// <param name="oldState">Old state of the button (pressed or released)</param>
-/// <returns>true if pressed, false otherwise</returns>
-static bool IsButtonPressed(int fd, GPIO_Value_Type *oldState)
+static void SendMemoryTelemetry(const MemoryMonitor_Report *report, void *context)
 {
-    bool isButtonPressed = false;
-    GPIO_Value_Type newState;
-    int result = GPIO_GetValue(fd, &newState);
-    if (result != 0) {
-        Log_Debug("ERROR: Could not read button GPIO: %s (%d).\n", strerror(errno), errno);
-        exitCode = ExitCode_IsButtonPressed_GetValue;
-    } else {
-        // Button is pressed if it is low and different than last known state.
-        isButtonPressed = (newState != *oldState) && (newState == GPIO_Value_Low);
-        *oldState = newState;
+    MemoryMonitor_LogReport(report);
+
+    char telemetryBuffer[TELEMETRY_BUFFER_SIZE * 4];
+    JsonWriter writer;
+    JsonWriter_Init(&writer, telemetryBuffer, sizeof(telemetryBuffer));
+    JsonWriter_BeginObject(&writer, NULL);
+    MemoryMonitor_WriteJson(report, &writer);
+    JsonWriter_EndObject(&writer);
+
+    const char *telemetry = JsonWriter_Finish(&writer);
+    if (telemetry == NULL) {
+        Log_Debug("ERROR: Cannot write memory usage to buffer.\n");
+        return;
     }
+    SendTelemetry(telemetry, NULL);
+}
 
-    return isButtonPressed;
+/// <summary>
+///     Logs the summary of the Wi-Fi connection, and sends it to Azure IoT Hub.
+/// </summary>
+static void SendWifiTelemetry(const WifiDiagnostics_Report *report, void *context)
+{
+    WifiDiagnostics_LogReport(report);
+
+    char telemetryBuffer[TELEMETRY_BUFFER_SIZE * 4];
+    JsonWriter writer;
+    JsonWriter_Init(&writer, telemetryBuffer, sizeof(telemetryBuffer));
+    JsonWriter_BeginObject(&writer, NULL);
+    WifiDiagnostics_WriteJson(report, &writer);
+    JsonWriter_EndObject(&writer);
+
+    const char *telemetry = JsonWriter_Finish(&writer);
+    if (telemetry == NULL) {
+        Log_Debug("ERROR: Cannot write the Wi-Fi summary to buffer.\n");
+        return;
+    }
+    SendTelemetry(telemetry, NULL);
 }
 
+/// <summary>
+///     Logs the metrics, and sends them to Azure IoT Hub.
+///     This satisfies the Metrics_ReportHandler signature.
+/// </summary>
+static void SendMetricsTelemetry(void *context)
+{
+    Metrics_Log();
+
+    char telemetryBuffer[TELEMETRY_BUFFER_SIZE * 4];
+    JsonWriter writer;
+    JsonWriter_Init(&writer, telemetryBuffer, sizeof(telemetryBuffer));
+    JsonWriter_BeginObject(&writer, NULL);
+    Metrics_WriteJson(&writer);
+    JsonWriter_EndObject(&writer);
+
+    const char *telemetry = JsonWriter_Finish(&writer);
+    if (telemetry == NULL) {
+        Log_Debug("ERROR: Cannot write the metrics to buffer.\n");
+        return;
+    }
+    SendTelemetry(telemetry, NULL);
+}
+
+#ifdef EVENTLOOP_STATS
+/// <summary>
+///     Logs the event loop statistics, and sends a summary of them to Azure IoT Hub, so that
+///     what keeps devices in the field awake can be compared.
+/// </summary>
+static void SendEventLoopStats(const EventLoopStats_Report *report, void *context)
+{
+    EventLoopStats_LogReport(report);
+
+    const EventLoopStats_Handler *busiest = NULL;
+    for (size_t i = 0; i < report->handlerCount; ++i) {
+        if (busiest == NULL || report->handlers[i].totalUs > busiest->totalUs) {
+            busiest = &report->handlers[i];
+        }
+    }
+
+    char telemetryBuffer[TELEMETRY_BUFFER_SIZE + 100];
+    JsonWriter writer;
+    JsonWriter_Init(&writer, telemetryBuffer, sizeof(telemetryBuffer));
+    JsonWriter_BeginObject(&writer, NULL);
+    JsonWriter_AddFloat(&writer, "WakeupsPerSecond", report->wakeupsPerSecondX100 / 100.0, 2);
+    JsonWriter_AddInt(&writer, "HandlerUs", (int64_t)report->handlerUs);
+    if (busiest != NULL && busiest->invocations > 0) {
+        JsonWriter_AddString(&writer, "BusiestHandler", busiest->name);
+        JsonWriter_AddInt(&writer, "BusiestHandlerUs", (int64_t)busiest->totalUs);
+        JsonWriter_AddInt(&writer, "BusiestHandlerMaxUs", busiest->maxUs);
+    }
+    JsonWriter_EndObject(&writer);
+
+    const char *telemetry = JsonWriter_Finish(&writer);
+    if (telemetry == NULL) {
+        Log_Debug("ERROR: Cannot write event loop statistics to buffer.\n");
+        return;
+    }
+    SendTelemetry(telemetry, NULL);
+}
+#endif
 
 
 
 
+
+
+/// <summary>
+///     Start measuring the temperature and humidity. The reading is added to the telemetry
+///     pipeline by HandleSht31Measurement once the conversion has completed.
+/// </summary>
 void SendTempTelemetry(void)
 {
-    const struct timespec sleepTime = {1, 0};
-    char telemetryBufferTemp[TELEMETRY_BUFFER_SIZE];
-    char telemetryBufferHum[TELEMETRY_BUFFER_SIZE];
-    //void* sht31 = GroveTempHumiSHT31_Open(i2cFd);
-    GroveTempHumiSHT31_Read(sht31);
-    float temp = GroveTempHumiSHT31_GetTemperature(sht31);
-    float humi = GroveTempHumiSHT31_GetHumidity(sht31);
-    Log_Debug("Temperature: %.1fC\n", temp);
-    Log_Debug("Humidity: %.1f\%c\n", humi, 0x25);
-
-    //GPIO_SetValue(deviceTwinStatusLedGpioFd, GPIO_Value_Low);
-    //nanosleep(&sleepTime, NULL);
-
-    //GPIO_SetValue(deviceTwinStatusLedGpioFd, GPIO_Value_High);
-    //nanosleep(&sleepTime, NULL);
-
-    int len0 = snprintf(telemetryBufferTemp, TELEMETRY_BUFFER_SIZE, "{\"Temperature\":%3.2f}", temp);
-    if (len0 < 0 || len0 >= TELEMETRY_BUFFER_SIZE) {
-        Log_Debug("ERROR: Cannot write temp telemetry to buffer.\n");
-        return;
+    if (Sht31Async_StartMeasurement(&sht31) != 0) {
+        Log_Debug("ERROR: Could not start temperature measurement: %s (%d).\n", strerror(errno),
+                  errno);
     }
+}
 
-    int len1 =
-        snprintf(telemetryBufferHum, TELEMETRY_BUFFER_SIZE, "{\"Humidity\":%3.2f}", humi);
-    if (len1 < 0 || len1 >= TELEMETRY_BUFFER_SIZE) {
-        Log_Debug("ERROR: Cannot write hum telemetry to buffer.\n");
+/// <summary>
+///     Add a completed temperature and humidity measurement to the telemetry pipeline.
+/// </summary>
+static void HandleSht31Measurement(bool valid, float temperature, float humidity, void *context)
+{
+    RespondToReadSensorCalls(valid, temperature, humidity);
+    if (!valid) {
         return;
     }
 
-    SendTelemetry(telemetryBufferTemp);
-    SendTelemetry(telemetryBufferHum);
+    Log_Debug("Temperature: %.1fC\n", temperature);
+    Log_Debug("Humidity: %.1f\%c\n", humidity, 0x25);
+
+    const int32_t samples[] = {(int32_t)lroundf(temperature * 100.0f),
+                               (int32_t)lroundf(humidity * 100.0f)};
+    BulkLog_AddSamples(BulkChannel_Environment, samples, sizeof(samples) / sizeof(samples[0]));
+
+    const float reading[] = {temperature, humidity};
+    TelemetryPipeline_AddReading(&telemetryPipeline, reading);
+    TelemetryPipeline_Process(&telemetryPipeline);
 }
 
+
 //
 //void SendTempTelemetry(void)
 //{
@@ -1182,44 +2256,53 @@ void SendTempTelemetry(void)
 //}
 
 
-void SendGPIO3Telemetry(void)
+/// <summary>
+///     GPIO snapshot timer event: sample the GPIO inputs, and count their edges
+/// </summary>
+static void GpioSnapshotTimerEventHandler(EventLoopTimer *timer)
 {
-    //    GPIO_Value_Type newState3;
-    //    int result3 = GPIO_GetValue(sendMessageGpio3Fd, &newState3);
-    //    char telemetryBuffer3[TELEMETRY_BUFFER_SIZE];
-    //    int len3 =
-    //        snprintf(telemetryBuffer3, TELEMETRY_BUFFER_SIZE, "{\"GPIO3\":%d}", result3);
-    //    if (len3 < 0 || len3 >= TELEMETRY_BUFFER_SIZE) {
-    //        Log_Debug("ERROR: Cannot write telemetry to buffer.\n");
-    //        return;
-    //    }
-    //    SendTelemetry(telemetryBuffer3);
-}
+    if (ConsumeEventLoopTimerEvent(timer) != 0) {
+        exitCode = ExitCode_GpioSnapshotTimer_Consume;
+        return;
+    }
 
-void SendGPIO2Telemetry(void)
-{
-    // GPIO_Value_Type newState2;
-    // int result2 = GPIO_GetValue(sendMessageGpio2Fd, &newState2);
-    // char telemetryBuffer2[TELEMETRY_BUFFER_SIZE];
-    // int len2 = snprintf(telemetryBuffer2, TELEMETRY_BUFFER_SIZE, "{\"GPIO2\":%d}", result2);
-    // if (len2 < 0 || len2 >= TELEMETRY_BUFFER_SIZE) {
-    //    Log_Debug("ERROR: Cannot write telemetry to buffer.\n");
-    //    return;
-    //}
-    // SendTelemetry(telemetryBuffer2);
+    if (GpioTable_SampleSnapshot(&gpioSnapshot, gpioInputPins, GpioInput_Count, gpioInputFds) !=
+        0) {
+        exitCode = ExitCode_GpioSnapshot_GetValue;
+    }
 }
 
-void SendGPIO1Telemetry(void)
+/// <summary>
+///     Send the values of the GPIO inputs to Azure IoT Hub as one bitmask, in which bit n is
+///     GpioInput_n, if any of them has changed since they were last sent.
+/// </summary>
+static void SendGpioSnapshotTelemetry(void)
 {
-    // GPIO_Value_Type newState1;
-    // int result1 = GPIO_GetValue(sendMessageGpio1Fd, &newState1);
-    // char telemetryBuffer1[TELEMETRY_BUFFER_SIZE];
-    // int len1 = snprintf(telemetryBuffer1, TELEMETRY_BUFFER_SIZE, "{\"GPIO1\":%d}", result1);
-    // if (len1 < 0 || len1 >= TELEMETRY_BUFFER_SIZE) {
-    //    Log_Debug("ERROR: Cannot write telemetry to buffer.\n");
-    //    return;
-    //}
-    // SendTelemetry(telemetryBuffer1);
+    if (!GpioTable_IsSnapshotChanged(&gpioSnapshot)) {
+        return;
+    }
+
+    char telemetryBuffer[TELEMETRY_BUFFER_SIZE];
+    JsonWriter writer;
+    JsonWriter_Init(&writer, telemetryBuffer, sizeof(telemetryBuffer));
+    JsonWriter_BeginObject(&writer, NULL);
+    JsonWriter_AddInt(&writer, "Gpio", gpioSnapshot.values);
+#if GPIO_SNAPSHOT_EDGE_COUNTS
+    JsonWriter_BeginArray(&writer, "GpioEdges");
+    for (size_t i = 0; i < GpioInput_Count; ++i) {
+        JsonWriter_AddInt(&writer, NULL, gpioSnapshot.edgeCounts[i]);
+    }
+    JsonWriter_EndArray(&writer);
+#endif
+    JsonWriter_EndObject(&writer);
+
+    const char *telemetry = JsonWriter_Finish(&writer);
+    if (telemetry == NULL) {
+        Log_Debug("ERROR: Cannot write GPIO telemetry to buffer.\n");
+        return;
+    }
+    SendTelemetry(telemetry, NULL);
+    GpioTable_MarkSnapshotReported(&gpioSnapshot);
 }
 
 // void SendTempTelemetry(void)
@@ -0,0 +1,134 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+
+#include <applibs/log.h>
+
+#include "../MT3620_Grove_Shield/MT3620_Grove_Shield_Library/HAL/GroveI2C.h"
+
+#include "sht31_async.h"
+
+// The Grove shield's I2C bridge takes 8-bit addresses; the SHT31's 7-bit address is 0x44 when
+// ADDR is tied low. Sensirion SHT3x-DIS datasheet, S3.3, I2C address.
+#define SHT31_ADDRESS (0x44 << 1)
+
+// Single shot measurement, high repeatability, clock stretching disabled. S4.3, Table 9.
+static const uint8_t singleShotHighCommand[] = {0x24, 0x00};
+
+// Maximum duration of a high-repeatability measurement is 15ms. S2.2, Table 4.
+static const struct timespec conversionTime = {.tv_sec = 0, .tv_nsec = 16 * 1000 * 1000};
+
+// Timer handlers receive no context, so the driver supports one sensor, which is recorded here.
+static Sht31Async *activeSensor = NULL;
+
+static void ConversionTimerEventHandler(EventLoopTimer *timer);
+static uint8_t CalcCrc8(const uint8_t *data, size_t length);
+static float ParseValue(const uint8_t *word, float scale, float offset, bool *valid);
+
+int Sht31Async_Init(Sht31Async *sensor, EventLoop *eventLoop, int i2cFd,
+                    Sht31Async_MeasurementHandler handler, void *context)
+{
+    if (activeSensor != NULL) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    memset(sensor, 0, sizeof(*sensor));
+    sensor->i2cFd = i2cFd;
+    sensor->handler = handler;
+    sensor->context = context;
+
+    sensor->conversionTimer = CreateEventLoopDisarmedTimer(eventLoop, ConversionTimerEventHandler);
+    if (sensor->conversionTimer == NULL) {
+        return -1;
+    }
+
+    activeSensor = sensor;
+    return 0;
+}
+
+int Sht31Async_StartMeasurement(Sht31Async *sensor)
+{
+    if (sensor->busy) {
+        return 0;
+    }
+
+    if (!GroveI2C_WriteBytes(sensor->i2cFd, SHT31_ADDRESS, singleShotHighCommand,
+                             sizeof(singleShotHighCommand))) {
+        Log_Debug("ERROR: Could not start SHT31 measurement.\n");
+        errno = EIO;
+        return -1;
+    }
+
+    if (SetEventLoopTimerOneShot(sensor->conversionTimer, &conversionTime) != 0) {
+        return -1;
+    }
+
+    sensor->busy = true;
+    return 0;
+}
+
+// CRC-8 with polynomial 0x31 and initial value 0xFF, which protects each 16-bit word.
+// S4.12, Checksum Calculation.
+static uint8_t CalcCrc8(const uint8_t *data, size_t length)
+{
+    uint8_t crc = 0xFF;
+    for (size_t i = 0; i < length; ++i) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (uint8_t)((crc & 0x80) ? (crc << 1) ^ 0x31 : crc << 1);
+        }
+    }
+    return crc;
+}
+
+// Converts a raw word which is followed by its checksum. S4.13, Conversion of Signal Output.
+static float ParseValue(const uint8_t *word, float scale, float offset, bool *valid)
+{
+    if (word[2] != CalcCrc8(word, 2)) {
+        *valid = false;
+        return NAN;
+    }
+
+    uint16_t raw = (uint16_t)((word[0] << 8) | word[1]);
+    return (float)raw * scale / 0xFFFF + offset;
+}
+
+static void ConversionTimerEventHandler(EventLoopTimer *timer)
+{
+    Sht31Async *sensor = activeSensor;
+    if (ConsumeEventLoopTimerEvent(timer) != 0 || sensor == NULL) {
+        return;
+    }
+    sensor->busy = false;
+
+    // Temperature word and checksum, followed by humidity word and checksum.
+    uint8_t data[6];
+    bool valid = GroveI2C_ReadBytes(sensor->i2cFd, SHT31_ADDRESS, data, sizeof(data));
+    float temperature = NAN;
+    float humidity = NAN;
+    if (valid) {
+        temperature = ParseValue(&data[0], 175.0f, -45.0f, &valid);
+        humidity = ParseValue(&data[3], 100.0f, 0.0f, &valid);
+    }
+    if (!valid) {
+        Log_Debug("ERROR: Could not read SHT31 measurement.\n");
+        temperature = NAN;
+        humidity = NAN;
+    }
+
+    sensor->handler(valid, temperature, humidity, sensor->context);
+}
+
+void Sht31Async_Dispose(Sht31Async *sensor)
+{
+    DisposeEventLoopTimer(sensor->conversionTimer);
+    sensor->conversionTimer = NULL;
+    sensor->busy = false;
+    if (activeSensor == sensor) {
+        activeSensor = NULL;
+    }
+}
@@ -0,0 +1,70 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <applibs/eventloop.h>
+
+#include "eventloop_timer_utilities.h"
+
+// The SHT31 takes up to 15ms to convert a high-repeatability measurement. Rather than waiting for
+// the conversion inside an event handler, this driver sends the measurement command, arms a
+// one-shot timer for the conversion time, and reads the result when the timer fires, so the event
+// loop keeps servicing the IoT Hub client and the buttons in the meantime.
+
+/// <summary>
+///     <para>Invoked when a measurement has completed.</para>
+///     <param name="valid">Whether the sensor was read and its checksums matched. If not, the
+///     other values are NaN.</param>
+///     <param name="temperature">Temperature in degrees Celsius.</param>
+///     <param name="humidity">Relative humidity in percent.</param>
+///     <param name="context">Context which was supplied to Sht31Async_Init.</param>
+/// </summary>
+typedef void (*Sht31Async_MeasurementHandler)(bool valid, float temperature, float humidity,
+                                              void *context);
+
+/// <summary>
+///     State of the driver. The client should not directly modify member variables.
+/// </summary>
+typedef struct {
+    /// <summary>Grove shield I2C interface on which the sensor is attached. Not owned.</summary>
+    int i2cFd;
+    /// <summary>Fires when the current conversion has completed.</summary>
+    EventLoopTimer *conversionTimer;
+    /// <summary>Whether a conversion is in progress.</summary>
+    bool busy;
+    /// <summary>Invoked when each measurement has completed.</summary>
+    Sht31Async_MeasurementHandler handler;
+    /// <summary>Context which is passed to the handler.</summary>
+    void *context;
+} Sht31Async;
+
+/// <summary>
+///     Initializes the driver.
+/// </summary>
+/// <param name="sensor">The driver state to initialize.</param>
+/// <param name="eventLoop">Event loop which runs the conversion timer.</param>
+/// <param name="i2cFd">Grove shield I2C interface returned by GroveShield_Initialize.</param>
+/// <param name="handler">Function to invoke when each measurement has completed.</param>
+/// <param name="context">Context which is passed to the handler.</param>
+/// <returns>0 on success, or -1 on failure, in which case errno is set.</returns>
+int Sht31Async_Init(Sht31Async *sensor, EventLoop *eventLoop, int i2cFd,
+                    Sht31Async_MeasurementHandler handler, void *context);
+
+/// <summary>
+///     Starts a measurement, and returns without waiting for it. The handler is invoked from the
+///     event loop once the conversion has completed. If a measurement is already in progress,
+///     this does nothing.
+/// </summary>
+/// <param name="sensor">Driver initialized with Sht31Async_Init.</param>
+/// <returns>0 if a measurement is in progress; or -1 if the command could not be sent.</returns>
+int Sht31Async_StartMeasurement(Sht31Async *sensor);
+
+/// <summary>
+///     Cancels any measurement in progress, and frees the conversion timer.
+/// </summary>
+/// <param name="sensor">Driver initialized with Sht31Async_Init.</param>
+void Sht31Async_Dispose(Sht31Async *sensor);
@@ -0,0 +1,196 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "json_reader.h"
+#include "json_writer.h"
+#include "mem_buf.h"
+#include "message_protocol_utilities.h"
+#include "nordic/crc.h"
+#include "nordic/slip.h"
+
+#include "kernels.h"
+
+// Size of the data which the CRC, SLIP and memory buffer kernels process. A firmware image is
+// sent to the nRF52 in packets of about this size.
+#define PAYLOAD_SIZE 4096
+
+static uint8_t payload[PAYLOAD_SIZE];
+
+// Fills the payload with pseudo-random bytes, about one in 128 of which SLIP must escape.
+static void FillPayload(void)
+{
+    uint32_t state = 0x12345678u;
+    for (size_t i = 0; i < sizeof(payload); ++i) {
+        state = state * 1664525u + 1013904223u;
+        payload[i] = (uint8_t)(state >> 24);
+    }
+}
+
+static int SetUpPayload(void *context)
+{
+    FillPayload();
+    return 0;
+}
+
+// CRC-32, which checks each firmware image which is sent to the nRF52.
+static void RunCrc32(void *context)
+{
+    Benchmark_Consume(CalcCrc32(payload, sizeof(payload)));
+}
+
+static void RunCrc32Bytewise(void *context)
+{
+    Benchmark_Consume(CalcCrc32WithSeedBytewise(payload, sizeof(payload), 0));
+}
+
+// SLIP, which frames the DFU packets which are sent to the nRF52. The buffers are supplied by
+// the kernel, so the runs don't allocate memory.
+static uint8_t slipEncodedStorage[2 * PAYLOAD_SIZE + 1];
+static uint8_t slipDecodedStorage[PAYLOAD_SIZE];
+static MemBuf slipEncoded;
+static MemBuf slipDecoded;
+
+static void RunSlipEncode(void *context)
+{
+    MemBufReset(&slipEncoded);
+    SlipEncodeAppend(&slipEncoded, payload, sizeof(payload));
+    SlipEncodeAddEndMarker(&slipEncoded);
+    Benchmark_Consume(MemBufCurSize(&slipEncoded));
+}
+
+static int SetUpSlip(void *context)
+{
+    FillPayload();
+    InitMemBuf(&slipEncoded, slipEncodedStorage, sizeof(slipEncodedStorage), false);
+    InitMemBuf(&slipDecoded, slipDecodedStorage, sizeof(slipDecodedStorage), false);
+    RunSlipEncode(context);
+    return 0;
+}
+
+static void RunSlipDecode(void *context)
+{
+    const uint8_t *encoded;
+    size_t encodedSize;
+    MemBufData(&slipEncoded, &encoded, &encodedSize);
+
+    MemBufReset(&slipDecoded);
+    NrfSlipDecodeState state = NRF_SLIP_STATE_DECODING;
+    bool finished;
+    SlipDecodeAppend(encoded, encodedSize, &slipDecoded, &state, &finished);
+    Benchmark_Consume(MemBufCurSize(&slipDecoded) + finished);
+}
+
+// Circular memory buffer, which queues the data which is read from the UART: packets are
+// appended, and consumed from the start.
+static uint8_t ringStorage[1024];
+static MemBuf ring;
+
+static int SetUpRing(void *context)
+{
+    FillPayload();
+    InitMemBuf(&ring, ringStorage, sizeof(ringStorage), true);
+    return 0;
+}
+
+static void RunRing(void *context)
+{
+    for (size_t offset = 0; offset < sizeof(payload); offset += 64) {
+        MemBufAppend(&ring, &payload[offset], 64);
+        if (MemBufCurSize(&ring) > sizeof(ringStorage) / 2) {
+            Benchmark_Consume(MemBufReadLe32(&ring, 0));
+            MemBufShiftLeft(&ring, 96);
+        }
+    }
+    MemBufReset(&ring);
+}
+
+// JSON reader and writer, which handle the device twin and the telemetry of the IoT samples.
+static const char twinDocument[] =
+    "{\"desired\":{\"StatusLED\":true,\"RLED\":false,\"GLED\":true,\"BLED\":false,"
+    "\"NextFlavor\":{\"Name\":\"Grape\",\"Color\":{\"Red\":111,\"Green\":45,\"Blue\":168}},"
+    "\"$version\":42},"
+    "\"reported\":{\"manufacturer\":\"Microsoft\",\"model\":\"Azure Sphere Sample Device\","
+    "\"StatusLED\":true,\"$version\":17}}";
+static const char *const twinPaths[] = {"desired.StatusLED", "desired.NextFlavor.Name",
+                                        "desired.NextFlavor.Color.Red", "desired.$version"};
+
+static void RunJsonRead(void *context)
+{
+    JsonReader_Value values[sizeof(twinPaths) / sizeof(twinPaths[0])];
+    bool read = JsonReader_FindProperties(twinDocument, sizeof(twinDocument) - 1, twinPaths,
+                                          sizeof(twinPaths) / sizeof(twinPaths[0]), values);
+    int64_t version = 0;
+    JsonReader_GetInt64(&values[3], &version);
+    Benchmark_Consume((uintptr_t)version + read);
+}
+
+static void RunJsonWrite(void *context)
+{
+    char buffer[256];
+    JsonWriter writer;
+    JsonWriter_Init(&writer, buffer, sizeof(buffer));
+    JsonWriter_BeginObject(&writer, NULL);
+    JsonWriter_AddFloat(&writer, "Temperature", 23.25, 2);
+    JsonWriter_AddFloat(&writer, "TemperatureMin", 22.5, 2);
+    JsonWriter_AddFloat(&writer, "TemperatureMax", 24.0, 2);
+    JsonWriter_AddFloat(&writer, "Humidity", 41.75, 2);
+    JsonWriter_AddInt(&writer, "Sequence", 123456);
+    JsonWriter_AddBool(&writer, "ButtonPress", false);
+    JsonWriter_AddString(&writer, "Flavor", "Grape");
+    JsonWriter_EndObject(&writer);
+    Benchmark_Consume((uintptr_t)JsonWriter_Finish(&writer));
+}
+
+// Message protocol framing: finding each complete message in the data received from the MCU.
+#define FRAMED_MESSAGE_SIZE 24
+#define FRAMED_MESSAGE_COUNT (PAYLOAD_SIZE / FRAMED_MESSAGE_SIZE)
+
+static uint8_t framedStream[FRAMED_MESSAGE_COUNT * FRAMED_MESSAGE_SIZE];
+
+static int SetUpFraming(void *context)
+{
+    FillPayload();
+    for (size_t i = 0; i < FRAMED_MESSAGE_COUNT; ++i) {
+        uint8_t *message = &framedStream[i * FRAMED_MESSAGE_SIZE];
+        MessageProtocol_MessageHeader header;
+        memcpy(header.preamble, MessageProtocol_MessagePreamble, sizeof(header.preamble));
+        header.length = FRAMED_MESSAGE_SIZE - sizeof(header);
+        memcpy(message, &header, sizeof(header));
+        memcpy(message + sizeof(header), &payload[i * FRAMED_MESSAGE_SIZE],
+               FRAMED_MESSAGE_SIZE - sizeof(header));
+    }
+    return 0;
+}
+
+static void RunFraming(void *context)
+{
+    size_t complete = 0;
+    for (size_t offset = 0; offset + FRAMED_MESSAGE_SIZE <= sizeof(framedStream);
+         offset += FRAMED_MESSAGE_SIZE) {
+        complete += MessageProtocol_IsMessageComplete(&framedStream[offset], FRAMED_MESSAGE_SIZE);
+    }
+    Benchmark_Consume(complete);
+}
+
+const Benchmark_Kernel Kernels[] = {
+    {.name = "CalcCrc32", .setUp = SetUpPayload, .run = RunCrc32, .bytesPerRun = PAYLOAD_SIZE},
+    {.name = "CalcCrc32 bytewise",
+     .setUp = SetUpPayload,
+     .run = RunCrc32Bytewise,
+     .bytesPerRun = PAYLOAD_SIZE},
+    {.name = "SLIP encode", .setUp = SetUpSlip, .run = RunSlipEncode, .bytesPerRun = PAYLOAD_SIZE},
+    {.name = "SLIP decode", .setUp = SetUpSlip, .run = RunSlipDecode, .bytesPerRun = PAYLOAD_SIZE},
+    {.name = "MemBuf ring", .setUp = SetUpRing, .run = RunRing, .bytesPerRun = PAYLOAD_SIZE},
+    {.name = "JSON read twin", .run = RunJsonRead, .bytesPerRun = sizeof(twinDocument) - 1},
+    {.name = "JSON write telemetry", .run = RunJsonWrite},
+    {.name = "Message framing",
+     .setUp = SetUpFraming,
+     .run = RunFraming,
+     .bytesPerRun = sizeof(framedStream)},
+};
+
+const size_t KernelCount = sizeof(Kernels) / sizeof(Kernels[0]);
@@ -0,0 +1,16 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stddef.h>
+
+#include "benchmark.h"
+
+/// <summary>
+///     The kernels which exercise code that is shared between the samples.
+/// </summary>
+extern const Benchmark_Kernel Kernels[];
+
+/// <summary>Number of entries in <see cref="Kernels" />.</summary>
+extern const size_t KernelCount;
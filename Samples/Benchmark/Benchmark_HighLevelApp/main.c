@@ -0,0 +1,44 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// This sample C application times the code which the other samples share, such as the CRC-32 and
+// SLIP framing of the external MCU update, the JSON reader and writer, and the message protocol
+// framing, so that a change to it can be measured on the device. It runs each kernel with the
+// Benchmark library, logs a line of statistics for each one, and exits.
+//
+// It uses the API for the following Azure Sphere application libraries:
+// - log (displays messages in the Device Output window during debugging)
+
+#include <stdlib.h>
+
+#include <applibs/log.h>
+
+#include "benchmark.h"
+#include "kernels.h"
+
+/// <summary>
+/// Exit codes for this application. These are used for the
+/// application exit code. They must all be between zero and 255,
+/// where zero is reserved for successful termination.
+/// </summary>
+typedef enum {
+    ExitCode_Success = 0,
+
+    ExitCode_Main_KernelFailed = 1
+} ExitCode;
+
+// Each kernel is warmed up, and then timed over 25 repetitions of 1000 runs.
+static const Benchmark_Config benchmarkConfig = BENCHMARK_DEFAULT_CONFIG;
+
+/// <summary>
+///     Main entry point for this sample.
+/// </summary>
+int main(int argc, char *argv[])
+{
+    Log_Debug("Benchmark application starting: %zu kernels.\n", KernelCount);
+
+    size_t failures = Benchmark_RunAll(Kernels, KernelCount, &benchmarkConfig);
+
+    Log_Debug("Benchmark application exiting.\n");
+    return failures == 0 ? ExitCode_Success : ExitCode_Main_KernelFailed;
+}
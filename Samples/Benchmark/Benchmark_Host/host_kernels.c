@@ -0,0 +1,204 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <applibs/eventloop.h>
+
+#include "dns-sd.h"
+#include "message_protocol.h"
+
+#include "host_kernels.h"
+#include "loopback_transport.h"
+
+// Message protocol round trip: one request is sent through the loopback transport, and its
+// response is read and passed to the response handler.
+static EventLoop *protocolEventLoop = NULL;
+static const uint8_t requestBody[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+static bool responseReceived = false;
+
+static void ProtocolResponseHandler(MessageProtocol_CategoryId categoryId,
+                                    MessageProtocol_RequestId requestId, const uint8_t *data,
+                                    size_t dataSize, MessageProtocol_ResponseResult result,
+                                    bool timedOut)
+{
+    responseReceived = !timedOut && dataSize == sizeof(requestBody);
+}
+
+static int SetUpProtocol(void *context)
+{
+    protocolEventLoop = EventLoop_Create();
+    if (protocolEventLoop == NULL) {
+        return -1;
+    }
+
+    static const LoopbackTransport_Config loopbackConfig = {0};
+    LoopbackTransport_Reset(&loopbackConfig);
+    if (MessageProtocol_Initialize(protocolEventLoop, LoopbackTransport_Read,
+                                   LoopbackTransport_Write) != 0) {
+        EventLoop_Close(protocolEventLoop);
+        protocolEventLoop = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+static void RunProtocol(void *context)
+{
+    responseReceived = false;
+    MessageProtocol_SendRequest(1, 2, requestBody, sizeof(requestBody), ProtocolResponseHandler);
+    while (LoopbackTransport_HasData()) {
+        MessageProtocol_HandleReceivedMessage();
+    }
+    Benchmark_Consume(responseReceived);
+}
+
+static void TearDownProtocol(void *context)
+{
+    MessageProtocol_Cleanup();
+    EventLoop_Close(protocolEventLoop);
+    protocolEventLoop = NULL;
+}
+
+// DNS service discovery: a response which describes four instances, with their PTR, SRV, TXT and
+// A records, is sent over a socket pair, received and parsed.
+#define DNS_INSTANCE_COUNT 4
+static uint8_t dnsResponse[1024];
+static size_t dnsResponseSize = 0;
+static int dnsSockets[2] = {-1, -1};
+
+static void AppendBytes(const void *data, size_t size)
+{
+    memcpy(dnsResponse + dnsResponseSize, data, size);
+    dnsResponseSize += size;
+}
+
+static void AppendUint16(uint16_t value)
+{
+    uint8_t bytes[] = {(uint8_t)(value >> 8), (uint8_t)value};
+    AppendBytes(bytes, sizeof(bytes));
+}
+
+static void AppendUint32(uint32_t value)
+{
+    AppendUint16((uint16_t)(value >> 16));
+    AppendUint16((uint16_t)value);
+}
+
+// Appends a domain name as a sequence of labels, without compression.
+static void AppendName(const char *name)
+{
+    while (*name != '\0') {
+        size_t length = strcspn(name, ".");
+        uint8_t labelLength = (uint8_t)length;
+        AppendBytes(&labelLength, 1);
+        AppendBytes(name, length);
+        name += length;
+        if (*name == '.') {
+            ++name;
+        }
+    }
+    AppendBytes("", 1);
+}
+
+// Appends the fields of a record which precede its RDATA, and returns the offset of the RDATA
+// length, which is filled in once the RDATA has been appended.
+static size_t AppendRecordHeader(const char *name, uint16_t type)
+{
+    AppendName(name);
+    AppendUint16(type);
+    AppendUint16(1); // Class IN
+    AppendUint32(120);
+    size_t lengthOffset = dnsResponseSize;
+    AppendUint16(0);
+    return lengthOffset;
+}
+
+static void EndRecord(size_t lengthOffset)
+{
+    size_t rdLength = dnsResponseSize - lengthOffset - sizeof(uint16_t);
+    dnsResponse[lengthOffset] = (uint8_t)(rdLength >> 8);
+    dnsResponse[lengthOffset + 1] = (uint8_t)rdLength;
+}
+
+static void BuildDnsResponse(void)
+{
+    static const char serviceName[] = "_sample-service._tcp.local";
+    dnsResponseSize = 0;
+
+    // Header: ID 0 and an authoritative response, as mDNS responders send; a PTR answer for each
+    // instance, and its SRV, TXT and A records as additional records.
+    AppendUint16(0);
+    AppendUint16(0x8400);
+    AppendUint16(0);
+    AppendUint16(DNS_INSTANCE_COUNT);
+    AppendUint16(0);
+    AppendUint16(3 * DNS_INSTANCE_COUNT);
+
+    char instance[64];
+    char host[32];
+    for (int i = 0; i < DNS_INSTANCE_COUNT; ++i) {
+        snprintf(instance, sizeof(instance), "Device%d.%s", i, serviceName);
+        size_t lengthOffset = AppendRecordHeader(serviceName, 12); // PTR
+        AppendName(instance);
+        EndRecord(lengthOffset);
+    }
+    for (int i = 0; i < DNS_INSTANCE_COUNT; ++i) {
+        snprintf(instance, sizeof(instance), "Device%d.%s", i, serviceName);
+        snprintf(host, sizeof(host), "device%d.local", i);
+
+        size_t lengthOffset = AppendRecordHeader(instance, 33); // SRV
+        AppendUint16(0);
+        AppendUint16(0);
+        AppendUint16(8080);
+        AppendName(host);
+        EndRecord(lengthOffset);
+
+        static const char txt[] = "\x09" "version=1" "\x0C" "features=abc";
+        lengthOffset = AppendRecordHeader(instance, 16); // TXT
+        AppendBytes(txt, sizeof(txt) - 1);
+        EndRecord(lengthOffset);
+
+        const uint8_t address[] = {192, 168, 0, (uint8_t)(10 + i)};
+        lengthOffset = AppendRecordHeader(host, 1); // A
+        AppendBytes(address, sizeof(address));
+        EndRecord(lengthOffset);
+    }
+}
+
+static int SetUpDns(void *context)
+{
+    BuildDnsResponse();
+    return socketpair(AF_UNIX, SOCK_DGRAM, 0, dnsSockets);
+}
+
+static void RunDns(void *context)
+{
+    ServiceInstanceDetails instances[DNS_INSTANCE_COUNT];
+    size_t count = 0;
+    send(dnsSockets[0], dnsResponse, dnsResponseSize, 0);
+    ProcessDnsResponse(dnsSockets[1], instances, DNS_INSTANCE_COUNT, &count);
+    Benchmark_Consume(count);
+}
+
+static void TearDownDns(void *context)
+{
+    close(dnsSockets[0]);
+    close(dnsSockets[1]);
+    dnsSockets[0] = dnsSockets[1] = -1;
+}
+
+const Benchmark_Kernel HostKernels[] = {
+    {.name = "Protocol round trip",
+     .setUp = SetUpProtocol,
+     .run = RunProtocol,
+     .tearDown = TearDownProtocol},
+    {.name = "DNS-SD response", .setUp = SetUpDns, .run = RunDns, .tearDown = TearDownDns},
+};
+
+const size_t HostKernelCount = sizeof(HostKernels) / sizeof(HostKernels[0]);
@@ -0,0 +1,17 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stddef.h>
+
+#include "benchmark.h"
+
+/// <summary>
+///     The kernels which are only run on the host, because they need the loopback transport or
+///     a socket pair in place of the device's peripherals and network.
+/// </summary>
+extern const Benchmark_Kernel HostKernels[];
+
+/// <summary>Number of elements in HostKernels.</summary>
+extern const size_t HostKernelCount;
@@ -0,0 +1,153 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include "message_protocol_private.h"
+#include "message_protocol_utilities.h"
+
+#include "loopback_transport.h"
+
+// Responses which have been queued and not yet read. Unread data starts at queueHead; the queue
+// is compacted when it fills, rather than wrapping, so that each response is written contiguously.
+#define QUEUE_SIZE 8192
+static uint8_t queue[QUEUE_SIZE];
+static size_t queueHead = 0;
+static size_t queueTail = 0;
+
+static LoopbackTransport_Config config;
+static LoopbackTransport_Stats stats;
+
+// Run of bytes which the protocol must discard. It ends with the first part of a preamble, so
+// that the protocol must reject a partial match before it finds the response.
+static const uint8_t noise[] = {0x00, 0xFF, 0x55, 0xAA, 0x22, 0xB5};
+
+void LoopbackTransport_Reset(const LoopbackTransport_Config *newConfig)
+{
+    config = *newConfig;
+    memset(&stats, 0, sizeof(stats));
+    queueHead = 0;
+    queueTail = 0;
+}
+
+static bool Reserve(size_t size)
+{
+    if (QUEUE_SIZE - queueTail >= size) {
+        return true;
+    }
+
+    memmove(queue, queue + queueHead, queueTail - queueHead);
+    queueTail -= queueHead;
+    queueHead = 0;
+    return QUEUE_SIZE - queueTail >= size;
+}
+
+ssize_t LoopbackTransport_Read(char *buffer, size_t amount)
+{
+    size_t available = queueTail - queueHead;
+    if (config.maxReadSize > 0 && amount > config.maxReadSize) {
+        amount = config.maxReadSize;
+    }
+    if (amount > available) {
+        amount = available;
+    }
+
+    memcpy(buffer, queue + queueHead, amount);
+    queueHead += amount;
+    if (queueHead == queueTail) {
+        queueHead = 0;
+        queueTail = 0;
+    }
+    stats.bytes += amount;
+    return (ssize_t)amount;
+}
+
+ssize_t LoopbackTransport_Write(const struct iovec *iov, int iovcnt)
+{
+    // Gather the request, as the UART would send it.
+    MessageProtocol_RequestMessage request;
+    size_t requestSize = 0;
+    for (int i = 0; i < iovcnt; ++i) {
+        if (iov[i].iov_len > sizeof(request) - requestSize) {
+            errno = EMSGSIZE;
+            return -1;
+        }
+        memcpy((uint8_t *)&request + requestSize, iov[i].iov_base, iov[i].iov_len);
+        requestSize += iov[i].iov_len;
+    }
+    if (requestSize < sizeof(MessageProtocol_RequestHeader)) {
+        errno = EINVAL;
+        return -1;
+    }
+    ++stats.requests;
+    stats.bytes += requestSize;
+
+    // Check the CRC, after corrupting the last byte of the body, or of the header if there is no
+    // body, which is what the MCU answers with a CRC error.
+    bool hasCrc = (request.requestHeader.flags & MessageProtocol_Flag_Crc) != 0;
+    size_t trailerSize = hasCrc ? MESSAGE_PROTOCOL_CRC_SIZE : 0;
+    if (requestSize < sizeof(MessageProtocol_RequestHeader) + trailerSize) {
+        errno = EINVAL;
+        return -1;
+    }
+    MessageProtocol_ResponseResult result = 0;
+    if (hasCrc) {
+        if (config.corruptInterval > 0 && (stats.requests % config.corruptInterval) == 0) {
+            ((uint8_t *)&request)[requestSize - trailerSize - 1] ^= 0x10;
+        }
+        if (!MessageProtocol_IsCrcValid((const uint8_t *)&request)) {
+            result = MessageProtocol_ResponseResult_CrcError;
+            ++stats.corruptedRequests;
+        }
+    }
+
+    // Answer it, echoing the body as the response data.
+    size_t bodySize =
+        result == 0 ? requestSize - sizeof(MessageProtocol_RequestHeader) - trailerSize : 0;
+    size_t responseSize = sizeof(MessageProtocol_ResponseHeader) + bodySize + trailerSize;
+    bool addNoise = config.noiseInterval > 0 && (stats.requests % config.noiseInterval) == 0;
+    if (!Reserve(responseSize + (addNoise ? sizeof(noise) : 0))) {
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    if (addNoise) {
+        memcpy(queue + queueTail, noise, sizeof(noise));
+        queueTail += sizeof(noise);
+        ++stats.noiseRuns;
+    }
+
+    MessageProtocol_ResponseHeader response;
+    memcpy(response.messageHeaderWithType.messageHeader.preamble, MessageProtocol_MessagePreamble,
+           sizeof(MessageProtocol_MessagePreamble));
+    response.messageHeaderWithType.messageHeader.length =
+        (uint16_t)(responseSize - trailerSize - sizeof(MessageProtocol_MessageHeader));
+    response.messageHeaderWithType.type = MessageProtocol_ResponseMessageType;
+    response.messageHeaderWithType.address = request.requestHeader.messageHeaderWithType.address;
+    response.categoryId = request.requestHeader.categoryId;
+    response.requestId = request.requestHeader.requestId;
+    response.sequenceNumber = request.requestHeader.sequenceNumber;
+    response.responseResult = result;
+    response.flags = hasCrc ? MessageProtocol_Flag_Crc : 0;
+
+    memcpy(queue + queueTail, &response, sizeof(response));
+    memcpy(queue + queueTail + sizeof(response), request.data, bodySize);
+    if (hasCrc) {
+        MessageProtocol_AppendCrc(queue + queueTail);
+    }
+    queueTail += responseSize;
+    ++stats.responses;
+    return (ssize_t)requestSize;
+}
+
+bool LoopbackTransport_HasData(void)
+{
+    return queueTail > queueHead;
+}
+
+const LoopbackTransport_Stats *LoopbackTransport_GetStats(void)
+{
+    return &stats;
+}
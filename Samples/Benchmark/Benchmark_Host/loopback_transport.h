@@ -0,0 +1,77 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+// A back-to-back transport for the message protocol, which stands in for the UART and the MCU at
+// its far end. Each request which the protocol writes is answered at once by a response with the
+// same category, request ID and sequence number, whose data echoes the request's body; the
+// responses are queued until the protocol reads them. The read size can be limited, to model the
+// way in which the UART splits up the data, and noise can be inserted between responses, which
+// the protocol must discard to find the next message. A request which has a CRC trailer is
+// checked, and answered with a response which has one; requests can be corrupted on their way in,
+// and are then answered with MessageProtocol_ResponseResult_CrcError, as the MCU firmware does.
+
+/// <summary>
+///     Settings of the loopback transport.
+/// </summary>
+typedef struct {
+    /// <summary>Maximum number of bytes which each read returns; 0 for no limit.</summary>
+    size_t maxReadSize;
+    /// <summary>Insert noise before every Nth response; 0 for none.</summary>
+    unsigned int noiseInterval;
+    /// <summary>Corrupt every Nth request which has a CRC trailer; 0 for none.</summary>
+    unsigned int corruptInterval;
+} LoopbackTransport_Config;
+
+/// <summary>
+///     Counts of the data which has passed through the loopback transport.
+/// </summary>
+typedef struct {
+    /// <summary>Requests which have been written.</summary>
+    unsigned long long requests;
+    /// <summary>Responses which have been queued.</summary>
+    unsigned long long responses;
+    /// <summary>Bytes which have been written and read, including noise.</summary>
+    unsigned long long bytes;
+    /// <summary>Runs of noise which have been inserted.</summary>
+    unsigned long long noiseRuns;
+    /// <summary>Requests which have been corrupted, and answered with a CRC error.</summary>
+    unsigned long long corruptedRequests;
+} LoopbackTransport_Stats;
+
+/// <summary>
+///     Empties the queue and resets the statistics.
+/// </summary>
+/// <param name="config">The settings, which are copied.</param>
+void LoopbackTransport_Reset(const LoopbackTransport_Config *config);
+
+/// <summary>
+///     Transport read function, which reads the queued responses.
+/// </summary>
+/// <returns>The number of bytes read, which is 0 if none are queued.</returns>
+ssize_t LoopbackTransport_Read(char *buffer, size_t amount);
+
+/// <summary>
+///     Transport write function, which answers a request.
+/// </summary>
+/// <returns>The number of bytes written, or -1 if the request is malformed or the queue is full,
+/// in which case errno is set.</returns>
+ssize_t LoopbackTransport_Write(const struct iovec *iov, int iovcnt);
+
+/// <summary>
+///     Checks whether any responses are queued.
+/// </summary>
+/// <returns>true if data is waiting to be read.</returns>
+bool LoopbackTransport_HasData(void);
+
+/// <summary>
+///     Gets the counts of the data which has passed through the transport.
+/// </summary>
+/// <returns>The counts since the transport was last reset.</returns>
+const LoopbackTransport_Stats *LoopbackTransport_GetStats(void);
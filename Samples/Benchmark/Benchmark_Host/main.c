@@ -0,0 +1,237 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// This application builds the samples' portable modules, such as the message protocol, the
+// CRC-32, SLIP and memory buffer code of the external MCU update, the JSON reader and writer and
+// DNS service discovery, for a Linux development computer, with shims in place of the Azure
+// Sphere log and event loop libraries. It runs the same kernels as Benchmark_HighLevelApp, and
+// those which need a loopback transport or a socket pair, and can load-test the message protocol
+// against a back-to-back fake MCU.
+//
+// Usage: Benchmark_Host [--messages N [--read-size BYTES] [--noise INTERVAL]
+//                        [--crc [--corrupt INTERVAL]] [--adaptive]]
+//        Benchmark_Host --fuzz ITERATIONS [--seed SEED]
+// Without options, each kernel is timed. With --messages, N requests are sent through the
+// loopback transport, and the protocol's throughput is reported; with --crc, the requests and
+// responses have CRC trailers, and with --corrupt, every Nth request is corrupted and has to be
+// retransmitted; with --adaptive, the protocol's adaptive timeout is enabled. With --fuzz,
+// corrupted streams are fed to the protocol's parser, which must resynchronize after each one.
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <applibs/eventloop.h>
+#include <applibs/log.h>
+
+#include "benchmark.h"
+#include "message_protocol.h"
+
+#include "host_kernels.h"
+#include "kernels.h"
+#include "loopback_transport.h"
+#include "protocol_fuzz.h"
+
+/// <summary>
+/// Exit codes for this application. These are used for the
+/// application exit code. They must all be between zero and 255,
+/// where zero is reserved for successful termination.
+/// </summary>
+typedef enum {
+    ExitCode_Success = 0,
+
+    ExitCode_Main_KernelFailed = 1,
+
+    ExitCode_LoadTest_EventLoop = 2,
+    ExitCode_LoadTest_Init = 3,
+    ExitCode_LoadTest_Stalled = 4,
+    ExitCode_LoadTest_BadResponse = 5,
+
+    ExitCode_Fuzz_Failed = 6
+} ExitCode;
+
+static unsigned long long loadTestMessages = 0;
+static unsigned long fuzzIterations = 0;
+static uint32_t fuzzSeed = 1;
+static LoopbackTransport_Config loopbackConfig = {0};
+static bool loadTestCrc = false;
+static bool loadTestAdaptive = false;
+
+// Load test state
+static unsigned long long requestsSent = 0;
+static unsigned long long responsesReceived = 0;
+static unsigned long long badResponses = 0;
+static unsigned long long invalidMessages = 0;
+
+static void ParseCommandLineArguments(int argc, char *argv[])
+{
+    int option = 0;
+    static const struct option cmdLineOptions[] = {{"messages", required_argument, NULL, 'm'},
+                                                   {"read-size", required_argument, NULL, 'r'},
+                                                   {"noise", required_argument, NULL, 'n'},
+                                                   {"crc", no_argument, NULL, 'c'},
+                                                   {"corrupt", required_argument, NULL, 'x'},
+                                                   {"adaptive", no_argument, NULL, 'a'},
+                                                   {"fuzz", required_argument, NULL, 'f'},
+                                                   {"seed", required_argument, NULL, 's'},
+                                                   {NULL, 0, NULL, 0}};
+
+    // Loop over all of the options.
+    while ((option = getopt_long(argc, argv, "m:r:n:cx:af:s:", cmdLineOptions, NULL)) != -1) {
+        switch (option) {
+        case 'm':
+            loadTestMessages = strtoull(optarg, NULL, 10);
+            break;
+        case 'r':
+            loopbackConfig.maxReadSize = strtoul(optarg, NULL, 10);
+            break;
+        case 'n':
+            loopbackConfig.noiseInterval = (unsigned int)strtoul(optarg, NULL, 10);
+            break;
+        case 'c':
+            loadTestCrc = true;
+            break;
+        case 'x':
+            loopbackConfig.corruptInterval = (unsigned int)strtoul(optarg, NULL, 10);
+            break;
+        case 'a':
+            loadTestAdaptive = true;
+            break;
+        case 'f':
+            fuzzIterations = strtoul(optarg, NULL, 10);
+            break;
+        case 's':
+            fuzzSeed = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        default:
+            // Unknown options are ignored.
+            break;
+        }
+    }
+}
+
+static void LoadTestResponseHandler(MessageProtocol_CategoryId categoryId,
+                                    MessageProtocol_RequestId requestId, const uint8_t *data,
+                                    size_t dataSize, MessageProtocol_ResponseResult result,
+                                    bool timedOut)
+{
+    ++responsesReceived;
+    // The loopback transport echoes the request's body, which holds the request's count.
+    unsigned long long echoed;
+    if (timedOut || dataSize != sizeof(echoed)) {
+        ++badResponses;
+        return;
+    }
+    memcpy(&echoed, data, sizeof(echoed));
+    if (echoed >= requestsSent) {
+        ++badResponses;
+    }
+}
+
+static void LoadTestIdleHandler(void)
+{
+    while (requestsSent < loadTestMessages && MessageProtocol_CanSendRequest()) {
+        unsigned long long body = requestsSent++;
+        MessageProtocol_SendRequest(1, 2, (const uint8_t *)&body, sizeof(body),
+                                    LoadTestResponseHandler);
+    }
+}
+
+static void LoadTestLinkQualityHandler(bool messageValid)
+{
+    if (!messageValid) {
+        ++invalidMessages;
+    }
+}
+
+/// <summary>
+///     Sends loadTestMessages requests through the loopback transport, keeping the protocol's
+///     pipeline full, and reports the time which they took.
+/// </summary>
+static ExitCode RunLoadTest(void)
+{
+    ExitCode exitCode = ExitCode_Success;
+    EventLoop *eventLoop = EventLoop_Create();
+    if (eventLoop == NULL) {
+        Log_Debug("ERROR: Could not create event loop.\n");
+        return ExitCode_LoadTest_EventLoop;
+    }
+
+    LoopbackTransport_Reset(&loopbackConfig);
+    if (MessageProtocol_Initialize(eventLoop, LoopbackTransport_Read, LoopbackTransport_Write) !=
+        0) {
+        exitCode = ExitCode_LoadTest_Init;
+        goto cleanup;
+    }
+    MessageProtocol_RegisterIdleHandler(LoadTestIdleHandler);
+    MessageProtocol_RegisterLinkQualityHandler(LoadTestLinkQualityHandler);
+    MessageProtocol_EnableCrc(loadTestCrc);
+    MessageProtocol_EnableAdaptiveTimeout(loadTestAdaptive);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // Responses are queued as soon as each request is written, so the protocol never waits; if
+    // the queue empties before every response has arrived, a message was lost.
+    LoadTestIdleHandler();
+    while (responsesReceived + badResponses < loadTestMessages && LoopbackTransport_HasData()) {
+        MessageProtocol_HandleReceivedMessage();
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (double)(end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    const LoopbackTransport_Stats *stats = LoopbackTransport_GetStats();
+
+    printf("Messages: %llu sent, %llu received, %llu bad\n", requestsSent, responsesReceived,
+           badResponses);
+    printf("Noise: %llu runs inserted, %llu reported as invalid\n", stats->noiseRuns,
+           invalidMessages);
+    if (loadTestCrc) {
+        printf("CRC: %llu requests corrupted and retransmitted\n", stats->corruptedRequests);
+    }
+    printf("Time: %.3f s, %.0f round trips/s, %.1f MiB/s\n", seconds,
+           (double)responsesReceived / seconds, (double)stats->bytes / seconds / (1024 * 1024));
+
+    MessageProtocol_LatencyStats latency;
+    MessageProtocol_GetLatencyStats(&latency);
+    printf("Latency: %u round trips measured, min %u us, smoothed %u us +/- %u us, max %u us\n",
+           latency.samples, latency.minRttUs, latency.smoothedRttUs, latency.rttVariationUs,
+           latency.maxRttUs);
+    if (loadTestAdaptive) {
+        printf("Adaptive timeout: %u ms, %u timeouts\n", latency.adaptiveTimeoutMs,
+               latency.timeouts);
+    }
+
+    if (responsesReceived < loadTestMessages) {
+        Log_Debug("ERROR: %llu responses were not received.\n",
+                  loadTestMessages - responsesReceived);
+        exitCode = ExitCode_LoadTest_Stalled;
+    } else if (badResponses > 0) {
+        exitCode = ExitCode_LoadTest_BadResponse;
+    }
+
+    MessageProtocol_Cleanup();
+cleanup:
+    EventLoop_Close(eventLoop);
+    return exitCode;
+}
+
+int main(int argc, char *argv[])
+{
+    ParseCommandLineArguments(argc, argv);
+    if (loadTestMessages > 0) {
+        return RunLoadTest();
+    }
+    if (fuzzIterations > 0) {
+        return ProtocolFuzz_Run(fuzzIterations, fuzzSeed) == 0 ? ExitCode_Success
+                                                               : ExitCode_Fuzz_Failed;
+    }
+
+    static const Benchmark_Config benchmarkConfig = BENCHMARK_DEFAULT_CONFIG;
+    size_t failures = Benchmark_RunAll(Kernels, KernelCount, &benchmarkConfig);
+    failures += Benchmark_RunAll(HostKernels, HostKernelCount, &benchmarkConfig);
+    return failures == 0 ? ExitCode_Success : ExitCode_Main_KernelFailed;
+}
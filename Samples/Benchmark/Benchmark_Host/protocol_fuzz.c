@@ -0,0 +1,387 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/uio.h>
+
+#include <applibs/eventloop.h>
+#include <applibs/log.h>
+
+#include "message_protocol.h"
+#include "message_protocol_private.h"
+
+#include "protocol_fuzz.h"
+
+// Messages in the stream. The prefix precedes the corrupted message and the tail follows it; the
+// tail is long enough that the protocol must deliver some of it however much the corruption
+// causes it to discard.
+#define MAX_PREFIX_MESSAGES 8
+#define TAIL_MESSAGES 32
+#define EVENT_MESSAGE_SIZE sizeof(MessageProtocol_EventMessage)
+#define MAX_MESSAGE_SIZE (sizeof(MessageProtocol_ResponseHeader) + MAX_RESPONSE_DATA_SIZE)
+#define MAX_DISCARDED_TAIL_MESSAGES \
+    ((MAX_MESSAGE_SIZE + EVENT_MESSAGE_SIZE - 1) / EVENT_MESSAGE_SIZE)
+#define MAX_GARBAGE_SIZE 300
+#define MAX_READ_SIZE 128
+
+_Static_assert(TAIL_MESSAGES > MAX_DISCARDED_TAIL_MESSAGES,
+               "TAIL_MESSAGES must exceed the messages which a corruption can discard");
+
+static const MessageProtocol_CategoryId PrefixCategory = 1;
+static const MessageProtocol_CategoryId TailCategory = 2;
+static const MessageProtocol_CategoryId CorruptedCategory = 4;
+static const MessageProtocol_EventId FuzzEvent = 1;
+static const MessageProtocol_CategoryId RequestCategory = 3;
+static const MessageProtocol_RequestId FuzzRequest = 1;
+
+typedef enum {
+    Mutation_None,
+    Mutation_BitFlip,
+    Mutation_Truncate,
+    Mutation_Garbage,
+    Mutation_Length,
+    Mutation_PreambleBurst,
+    Mutation_Count
+} Mutation;
+
+static const char *const mutationNames[Mutation_Count] = {
+    "None", "Bit flips", "Truncation", "Garbage", "Bad length", "Preamble burst"};
+
+typedef struct {
+    unsigned long iterations;
+    unsigned long failures;
+    unsigned long long resyncBytes;
+    unsigned long long maxResyncBytes;
+    unsigned long long resyncNs;
+} MutationStats;
+
+static uint32_t randomState;
+
+// xorshift32, which is fast, and reproducible from the seed.
+static uint32_t Random(void)
+{
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 17;
+    randomState ^= randomState << 5;
+    return randomState;
+}
+
+static uint32_t RandomBelow(uint32_t limit)
+{
+    return Random() % limit;
+}
+
+static uint64_t NowNs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+// The stream which is being fed to the protocol, and the position up to which it has been read.
+static uint8_t stream[(MAX_PREFIX_MESSAGES + 1 + TAIL_MESSAGES) * MAX_MESSAGE_SIZE +
+                      MAX_GARBAGE_SIZE];
+static size_t streamSize;
+static size_t streamPosition;
+static size_t corruptionStart;
+static size_t tailStart;
+static uint64_t corruptionReadNs;
+
+// What the protocol has delivered from the stream.
+static unsigned int prefixDelivered;
+static unsigned int tailDelivered;
+static unsigned int corruptedDelivered;
+static unsigned int responsesDelivered;
+static unsigned int invalidMessages;
+static bool oversizedResponse;
+static size_t firstTailPosition;
+static uint64_t firstTailNs;
+
+// Sequence number of the request which the stream's response answers.
+static MessageProtocol_SequenceNumber requestSequenceNumber;
+
+static ssize_t FuzzRead(char *buffer, size_t amount)
+{
+    size_t readSize = 1 + RandomBelow(MAX_READ_SIZE);
+    if (readSize > amount) {
+        readSize = amount;
+    }
+    if (readSize > streamSize - streamPosition) {
+        readSize = streamSize - streamPosition;
+    }
+
+    memcpy(buffer, stream + streamPosition, readSize);
+    if (streamPosition <= corruptionStart && streamPosition + readSize > corruptionStart) {
+        corruptionReadNs = NowNs();
+    }
+    streamPosition += readSize;
+    return (ssize_t)readSize;
+}
+
+static ssize_t FuzzWrite(const struct iovec *iov, int iovcnt)
+{
+    // The request header is always the first buffer; the request itself is discarded.
+    const MessageProtocol_RequestHeader *header = iov[0].iov_base;
+    requestSequenceNumber = header->sequenceNumber;
+    ssize_t size = 0;
+    for (int i = 0; i < iovcnt; ++i) {
+        size += (ssize_t)iov[i].iov_len;
+    }
+    return size;
+}
+
+static void FuzzEventHandler(MessageProtocol_CategoryId categoryId,
+                             MessageProtocol_EventId eventId)
+{
+    if (categoryId == PrefixCategory) {
+        ++prefixDelivered;
+    } else if (categoryId == CorruptedCategory) {
+        ++corruptedDelivered;
+    } else if (tailDelivered++ == 0) {
+        firstTailPosition = streamPosition;
+        firstTailNs = NowNs();
+    }
+}
+
+static void FuzzResponseHandler(MessageProtocol_CategoryId categoryId,
+                                MessageProtocol_RequestId requestId, const uint8_t *data,
+                                size_t dataSize, MessageProtocol_ResponseResult result,
+                                bool timedOut)
+{
+    ++responsesDelivered;
+    if (dataSize > MAX_RESPONSE_DATA_SIZE) {
+        oversizedResponse = true;
+    }
+}
+
+static void FuzzLinkQualityHandler(bool messageValid)
+{
+    if (!messageValid) {
+        ++invalidMessages;
+    }
+}
+
+static size_t AppendEvent(MessageProtocol_CategoryId categoryId)
+{
+    MessageProtocol_EventMessage message;
+    memcpy(message.messageHeaderWithType.messageHeader.preamble, MessageProtocol_MessagePreamble,
+           sizeof(MessageProtocol_MessagePreamble));
+    message.messageHeaderWithType.messageHeader.length =
+        sizeof(message) - sizeof(MessageProtocol_MessageHeader);
+    message.messageHeaderWithType.type = MessageProtocol_EventMessageType;
+    message.messageHeaderWithType.address = MessageProtocol_DefaultAddress;
+    message.eventInfo.categoryId = categoryId;
+    message.eventInfo.eventId = FuzzEvent;
+    memcpy(stream + streamSize, &message, sizeof(message));
+    streamSize += sizeof(message);
+    return sizeof(message);
+}
+
+static size_t AppendResponse(void)
+{
+    size_t dataSize = RandomBelow(MAX_RESPONSE_DATA_SIZE + 1);
+    MessageProtocol_ResponseHeader header;
+    memcpy(header.messageHeaderWithType.messageHeader.preamble, MessageProtocol_MessagePreamble,
+           sizeof(MessageProtocol_MessagePreamble));
+    header.messageHeaderWithType.messageHeader.length =
+        (uint16_t)(sizeof(header) - sizeof(MessageProtocol_MessageHeader) + dataSize);
+    header.messageHeaderWithType.type = MessageProtocol_ResponseMessageType;
+    header.messageHeaderWithType.address = MessageProtocol_DefaultAddress;
+    header.categoryId = RequestCategory;
+    header.requestId = FuzzRequest;
+    header.sequenceNumber = requestSequenceNumber;
+    header.responseResult = 0;
+    header.flags = 0;
+    memcpy(stream + streamSize, &header, sizeof(header));
+    for (size_t i = 0; i < dataSize; ++i) {
+        stream[streamSize + sizeof(header) + i] = (uint8_t)Random();
+    }
+    streamSize += sizeof(header) + dataSize;
+    return sizeof(header) + dataSize;
+}
+
+static void AppendGarbage(size_t size)
+{
+    for (size_t i = 0; i < size; ++i) {
+        stream[streamSize++] = (uint8_t)Random();
+    }
+}
+
+// Appends a message, corrupted as the mutation specifies.
+static void AppendCorruptedMessage(Mutation mutation, bool response)
+{
+    if (mutation == Mutation_Garbage) {
+        // Garbage before the message, which is intact.
+        AppendGarbage(1 + RandomBelow(MAX_GARBAGE_SIZE));
+    }
+
+    size_t messageStart = streamSize;
+    size_t messageSize = response ? AppendResponse() : AppendEvent(CorruptedCategory);
+    uint8_t *message = stream + messageStart;
+
+    switch (mutation) {
+    case Mutation_None:
+    case Mutation_Garbage:
+        break;
+    case Mutation_BitFlip:
+        for (uint32_t flips = 1 + RandomBelow(8); flips > 0; --flips) {
+            message[RandomBelow((uint32_t)messageSize)] ^= (uint8_t)(1u << RandomBelow(8));
+        }
+        break;
+    case Mutation_Truncate:
+        streamSize = messageStart + 1 + RandomBelow((uint32_t)messageSize - 1);
+        break;
+    case Mutation_Length: {
+        uint16_t length = (uint16_t)Random();
+        memcpy(message + offsetof(MessageProtocol_MessageHeader, length), &length, sizeof(length));
+        break;
+    }
+    case Mutation_PreambleBurst:
+        // Repeated partial preambles, each of which must be rejected, in place of the message.
+        streamSize = messageStart;
+        for (uint32_t bursts = 1 + RandomBelow(32); bursts > 0; --bursts) {
+            memcpy(stream + streamSize, MessageProtocol_MessagePreamble,
+                   sizeof(MessageProtocol_MessagePreamble) - 1);
+            streamSize += sizeof(MessageProtocol_MessagePreamble) - 1;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+/// <summary>
+///     Builds a stream, feeds it to the protocol, and checks what was delivered.
+/// </summary>
+/// <returns>true if the checks passed.</returns>
+static bool RunIteration(EventLoop *eventLoop, Mutation mutation, MutationStats *stats,
+                         uint64_t *parseNs, unsigned long long *parsedBytes)
+{
+    if (MessageProtocol_Initialize(eventLoop, FuzzRead, FuzzWrite) != 0) {
+        return false;
+    }
+    MessageProtocol_RegisterEventHandler(PrefixCategory, FuzzEvent, FuzzEventHandler);
+    MessageProtocol_RegisterEventHandler(TailCategory, FuzzEvent, FuzzEventHandler);
+    MessageProtocol_RegisterEventHandler(CorruptedCategory, FuzzEvent, FuzzEventHandler);
+    MessageProtocol_RegisterLinkQualityHandler(FuzzLinkQualityHandler);
+    MessageProtocol_SendRequest(RequestCategory, FuzzRequest, NULL, 0, FuzzResponseHandler);
+
+    // The response is either one of the prefix messages, or the corrupted message.
+    unsigned int prefixMessages = RandomBelow(MAX_PREFIX_MESSAGES + 1);
+    bool corruptResponse = RandomBelow(2) == 0;
+    unsigned int responseIndex = corruptResponse ? prefixMessages : RandomBelow(prefixMessages + 1);
+    streamSize = 0;
+    for (unsigned int i = 0; i <= prefixMessages; ++i) {
+        if (i == responseIndex && !corruptResponse) {
+            AppendResponse();
+        }
+        if (i < prefixMessages) {
+            AppendEvent(PrefixCategory);
+        }
+    }
+    corruptionStart = streamSize;
+    AppendCorruptedMessage(mutation, corruptResponse);
+    tailStart = streamSize;
+    for (unsigned int i = 0; i < TAIL_MESSAGES; ++i) {
+        AppendEvent(TailCategory);
+    }
+
+    streamPosition = 0;
+    prefixDelivered = 0;
+    tailDelivered = 0;
+    corruptedDelivered = 0;
+    responsesDelivered = 0;
+    invalidMessages = 0;
+    oversizedResponse = false;
+
+    uint64_t start = NowNs();
+    while (streamPosition < streamSize) {
+        MessageProtocol_HandleReceivedMessage();
+    }
+    *parseNs += NowNs() - start;
+    *parsedBytes += streamSize;
+    MessageProtocol_Cleanup();
+
+    // The protocol has no checksum, so a corrupted message may still be delivered, possibly as a
+    // different message; but it must not be delivered more than once.
+    unsigned int expectedResponses = corruptResponse ? 0 : 1;
+    unsigned int extraDeliveries = 0;
+    if (prefixDelivered > prefixMessages) {
+        extraDeliveries += prefixDelivered - prefixMessages;
+    }
+    if (tailDelivered > TAIL_MESSAGES) {
+        extraDeliveries += tailDelivered - TAIL_MESSAGES;
+    }
+    if (responsesDelivered > expectedResponses) {
+        extraDeliveries += responsesDelivered - expectedResponses;
+    }
+    extraDeliveries += corruptedDelivered;
+    bool passed = prefixDelivered >= prefixMessages && responsesDelivered >= expectedResponses &&
+                  extraDeliveries <= 1 && !oversizedResponse &&
+                  tailDelivered >= TAIL_MESSAGES - MAX_DISCARDED_TAIL_MESSAGES;
+    if (mutation == Mutation_None) {
+        passed = passed && tailDelivered == TAIL_MESSAGES && responsesDelivered == 1 &&
+                 corruptedDelivered == (corruptResponse ? 0 : 1) && invalidMessages == 0;
+    }
+
+    if (tailDelivered > 0) {
+        unsigned long long resyncBytes = firstTailPosition - tailStart;
+        stats->resyncBytes += resyncBytes;
+        if (resyncBytes > stats->maxResyncBytes) {
+            stats->maxResyncBytes = resyncBytes;
+        }
+        stats->resyncNs += firstTailNs - corruptionReadNs;
+    }
+    return passed;
+}
+
+long ProtocolFuzz_Run(unsigned long iterations, uint32_t seed)
+{
+    EventLoop *eventLoop = EventLoop_Create();
+    if (eventLoop == NULL) {
+        Log_Debug("ERROR: Could not create event loop.\n");
+        return -1;
+    }
+
+    randomState = seed != 0 ? seed : 1;
+    MutationStats stats[Mutation_Count];
+    memset(stats, 0, sizeof(stats));
+    uint64_t parseNs = 0;
+    unsigned long long parsedBytes = 0;
+    long failures = 0;
+
+    // The protocol logs each error which the corruption causes; don't let that dominate the time.
+    Log_SetEnabled(false);
+    for (unsigned long i = 0; i < iterations; ++i) {
+        Mutation mutation = (Mutation)(i % Mutation_Count);
+        ++stats[mutation].iterations;
+        if (!RunIteration(eventLoop, mutation, &stats[mutation], &parseNs, &parsedBytes)) {
+            ++stats[mutation].failures;
+            if (failures++ == 0) {
+                Log_SetEnabled(true);
+                Log_Debug("ERROR: Iteration %lu (%s) failed: prefix %u, tail %u, responses %u.\n",
+                          i, mutationNames[mutation], prefixDelivered, tailDelivered,
+                          responsesDelivered);
+                Log_SetEnabled(false);
+            }
+        }
+    }
+    Log_SetEnabled(true);
+    EventLoop_Close(eventLoop);
+
+    printf("%-16s %10s %10s %14s %14s %14s\n", "Mutation", "Iterations", "Failures",
+           "Resync bytes", "Max resync", "Resync ns");
+    for (int m = 0; m < Mutation_Count; ++m) {
+        unsigned long n = stats[m].iterations > 0 ? stats[m].iterations : 1;
+        printf("%-16s %10lu %10lu %14llu %14llu %14llu\n", mutationNames[m], stats[m].iterations,
+               stats[m].failures, stats[m].resyncBytes / n, stats[m].maxResyncBytes,
+               stats[m].resyncNs / n);
+    }
+    printf("Parsed %llu bytes in %.3f s: %.1f MiB/s\n", parsedBytes, (double)parseNs / 1e9,
+           (double)parsedBytes / ((double)parseNs / 1e9) / (1024 * 1024));
+    return failures;
+}
@@ -0,0 +1,28 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdint.h>
+
+// Fuzz-and-throughput harness for the message protocol's receive path. Each iteration feeds the
+// protocol a byte stream of valid event and response messages, in which one message has been
+// corrupted, in reads of random size, and checks that:
+//
+// - the messages before the corruption are all delivered;
+// - the protocol resynchronizes, delivering the messages which follow the corruption once it
+//   has discarded at most one maximum-size message's worth of them;
+// - a response handler is never given more data than a response can hold;
+// - a stream which has not been corrupted is delivered without any error.
+//
+// The harness reports the protocol's parse throughput, and for each kind of corruption, the number
+// of bytes and the time which the protocol took to deliver a message after the corruption.
+
+/// <summary>
+///     Runs the harness, and prints the results.
+/// </summary>
+/// <param name="iterations">Number of streams to feed the protocol.</param>
+/// <param name="seed">Seed of the random numbers, so that a failure can be reproduced.</param>
+/// <returns>The number of iterations in which a check failed, or -1 if the harness could not
+/// be run.</returns>
+long ProtocolFuzz_Run(unsigned long iterations, uint32_t seed);
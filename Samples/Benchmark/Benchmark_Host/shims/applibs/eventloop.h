@@ -0,0 +1,107 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Host shim of the Azure Sphere event loop library, implemented with epoll, for building the
+// samples' portable modules on a development computer. It dispatches one event for each call to
+// epoll_wait, so that a callback can unregister any event source.
+
+/// <summary>An event loop.</summary>
+typedef struct EventLoop EventLoop;
+
+/// <summary>A file descriptor which is registered with an event loop.</summary>
+typedef struct EventRegistration EventRegistration;
+
+/// <summary>Bitmask of I/O events, which have the same values as the epoll events.</summary>
+typedef uint32_t EventLoop_IoEvents;
+
+enum {
+    EventLoop_None = 0x00,
+    EventLoop_Input = 0x01,
+    EventLoop_Output = 0x04,
+    EventLoop_Error = 0x08
+};
+
+/// <summary>Result of <see cref="EventLoop_Run" />.</summary>
+typedef enum {
+    EventLoop_Run_Failed = -1,
+    EventLoop_Run_FinishedEmpty = 0,
+    EventLoop_Run_Finished = 1
+} EventLoop_Run_Result;
+
+/// <summary>
+///     Invoked when a registered file descriptor has an event.
+/// </summary>
+typedef void EventLoopIoCallback(EventLoop *el, int fd, EventLoop_IoEvents events, void *context);
+
+/// <summary>
+///     Creates an event loop.
+/// </summary>
+/// <returns>The event loop, or NULL on failure, in which case errno is set.</returns>
+EventLoop *EventLoop_Create(void);
+
+/// <summary>
+///     Closes an event loop. Registrations which remain are released.
+/// </summary>
+/// <param name="el">The event loop, or NULL.</param>
+void EventLoop_Close(EventLoop *el);
+
+/// <summary>
+///     Runs an event loop until the duration elapses, EventLoop_Stop is called, or, if
+///     process_one_event is true, one event has been dispatched.
+/// </summary>
+/// <param name="el">The event loop.</param>
+/// <param name="duration_in_milliseconds">Time to run for; -1 to run until stopped.</param>
+/// <param name="process_one_event">true to return after one event has been dispatched.</param>
+/// <returns>EventLoop_Run_Finished if any events were dispatched, EventLoop_Run_FinishedEmpty if
+/// none were, or EventLoop_Run_Failed on failure, in which case errno is set.</returns>
+EventLoop_Run_Result EventLoop_Run(EventLoop *el, int duration_in_milliseconds,
+                                   bool process_one_event);
+
+/// <summary>
+///     Causes EventLoop_Run to return once the current event has been dispatched.
+/// </summary>
+/// <param name="el">The event loop.</param>
+/// <returns>0 on success, or -1 on failure, in which case errno is set.</returns>
+int EventLoop_Stop(EventLoop *el);
+
+/// <summary>
+///     Gets the epoll file descriptor of an event loop.
+/// </summary>
+/// <param name="el">The event loop.</param>
+/// <returns>The file descriptor.</returns>
+int EventLoop_GetWaitDescriptor(EventLoop *el);
+
+/// <summary>
+///     Registers a file descriptor with an event loop.
+/// </summary>
+/// <param name="el">The event loop.</param>
+/// <param name="fd">The file descriptor.</param>
+/// <param name="eventBitmask">The events to wait for.</param>
+/// <param name="callback">Function which is invoked when an event occurs.</param>
+/// <param name="context">Context which is passed to the callback.</param>
+/// <returns>The registration, or NULL on failure, in which case errno is set.</returns>
+EventRegistration *EventLoop_RegisterIo(EventLoop *el, int fd, EventLoop_IoEvents eventBitmask,
+                                        EventLoopIoCallback *callback, void *context);
+
+/// <summary>
+///     Changes the events which a registration waits for.
+/// </summary>
+/// <param name="el">The event loop.</param>
+/// <param name="reg">The registration.</param>
+/// <param name="eventBitmask">The events to wait for.</param>
+/// <returns>0 on success, or -1 on failure, in which case errno is set.</returns>
+int EventLoop_ModifyIoEvents(EventLoop *el, EventRegistration *reg,
+                             EventLoop_IoEvents eventBitmask);
+
+/// <summary>
+///     Unregisters a file descriptor, and releases the registration.
+/// </summary>
+/// <param name="el">The event loop.</param>
+/// <param name="reg">The registration.</param>
+/// <returns>0 on success, or -1 on failure, in which case errno is set.</returns>
+int EventLoop_UnregisterIo(EventLoop *el, EventRegistration *reg);
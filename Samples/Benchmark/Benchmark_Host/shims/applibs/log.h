@@ -0,0 +1,36 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdarg.h>
+#include <stdbool.h>
+
+// Host shim of the Azure Sphere log library, for building the samples' portable modules on a
+// development computer. Messages are written to stdout.
+//
+// Unlike the device header, the functions are not declared with the printf format attribute: the
+// samples log size_t values with %u, which is correct on the 32-bit device but not on a 64-bit
+// host.
+
+/// <summary>
+///     Logs a debug message.
+/// </summary>
+/// <param name="fmt">The printf format string.</param>
+/// <returns>0 on success, or -1 on failure, in which case errno is set.</returns>
+int Log_Debug(const char *fmt, ...);
+
+/// <summary>
+///     Logs a debug message with a va_list of arguments.
+/// </summary>
+/// <param name="fmt">The printf format string.</param>
+/// <param name="args">The arguments.</param>
+/// <returns>0 on success, or -1 on failure, in which case errno is set.</returns>
+int Log_DebugVarArgs(const char *fmt, va_list args);
+
+/// <summary>
+///     Turns logging on or off. This function is only provided by the host shim, so that a test
+///     which provokes errors on purpose is not slowed down by logging each one.
+/// </summary>
+/// <param name="enabled">false to discard messages; true, the default, to write them.</param>
+void Log_SetEnabled(bool enabled);
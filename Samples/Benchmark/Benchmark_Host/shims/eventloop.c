@@ -0,0 +1,153 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include <applibs/eventloop.h>
+
+struct EventRegistration {
+    int fd;
+    EventLoopIoCallback *callback;
+    void *context;
+    // Registrations are kept in a list, so that those which remain can be released on close.
+    EventRegistration *next;
+};
+
+struct EventLoop {
+    int epollFd;
+    bool stopped;
+    EventRegistration *registrations;
+};
+
+EventLoop *EventLoop_Create(void)
+{
+    EventLoop *el = calloc(1, sizeof(*el));
+    if (el == NULL) {
+        return NULL;
+    }
+
+    el->epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (el->epollFd == -1) {
+        free(el);
+        return NULL;
+    }
+    return el;
+}
+
+void EventLoop_Close(EventLoop *el)
+{
+    if (el == NULL) {
+        return;
+    }
+
+    while (el->registrations != NULL) {
+        EventRegistration *reg = el->registrations;
+        el->registrations = reg->next;
+        free(reg);
+    }
+    close(el->epollFd);
+    free(el);
+}
+
+static int64_t NowMs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+EventLoop_Run_Result EventLoop_Run(EventLoop *el, int duration_in_milliseconds,
+                                   bool process_one_event)
+{
+    int64_t deadline = NowMs() + duration_in_milliseconds;
+    bool dispatched = false;
+    el->stopped = false;
+
+    while (!el->stopped) {
+        int timeout = -1;
+        if (duration_in_milliseconds >= 0) {
+            int64_t remaining = deadline - NowMs();
+            timeout = remaining > 0 ? (int)remaining : 0;
+        }
+
+        // Wait for one event at a time, so that a callback may unregister any registration.
+        struct epoll_event event;
+        int count = epoll_wait(el->epollFd, &event, 1, timeout);
+        if (count == -1) {
+            return EventLoop_Run_Failed;
+        }
+        if (count == 0) {
+            break;
+        }
+
+        EventRegistration *reg = event.data.ptr;
+        reg->callback(el, reg->fd, event.events, reg->context);
+        dispatched = true;
+        if (process_one_event) {
+            break;
+        }
+    }
+
+    return dispatched ? EventLoop_Run_Finished : EventLoop_Run_FinishedEmpty;
+}
+
+int EventLoop_Stop(EventLoop *el)
+{
+    el->stopped = true;
+    return 0;
+}
+
+int EventLoop_GetWaitDescriptor(EventLoop *el)
+{
+    return el->epollFd;
+}
+
+EventRegistration *EventLoop_RegisterIo(EventLoop *el, int fd, EventLoop_IoEvents eventBitmask,
+                                        EventLoopIoCallback *callback, void *context)
+{
+    EventRegistration *reg = malloc(sizeof(*reg));
+    if (reg == NULL) {
+        return NULL;
+    }
+    reg->fd = fd;
+    reg->callback = callback;
+    reg->context = context;
+
+    struct epoll_event event = {.events = eventBitmask, .data.ptr = reg};
+    if (epoll_ctl(el->epollFd, EPOLL_CTL_ADD, fd, &event) == -1) {
+        free(reg);
+        return NULL;
+    }
+
+    reg->next = el->registrations;
+    el->registrations = reg;
+    return reg;
+}
+
+int EventLoop_ModifyIoEvents(EventLoop *el, EventRegistration *reg,
+                             EventLoop_IoEvents eventBitmask)
+{
+    struct epoll_event event = {.events = eventBitmask, .data.ptr = reg};
+    return epoll_ctl(el->epollFd, EPOLL_CTL_MOD, reg->fd, &event);
+}
+
+int EventLoop_UnregisterIo(EventLoop *el, EventRegistration *reg)
+{
+    EventRegistration **link = &el->registrations;
+    while (*link != NULL && *link != reg) {
+        link = &(*link)->next;
+    }
+    if (*link == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    *link = reg->next;
+    int result = epoll_ctl(el->epollFd, EPOLL_CTL_DEL, reg->fd, NULL);
+    free(reg);
+    return result;
+}
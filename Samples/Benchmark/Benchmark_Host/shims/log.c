@@ -0,0 +1,32 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include <applibs/log.h>
+
+static bool logEnabled = true;
+
+void Log_SetEnabled(bool enabled)
+{
+    logEnabled = enabled;
+}
+
+int Log_DebugVarArgs(const char *fmt, va_list args)
+{
+    if (!logEnabled) {
+        return 0;
+    }
+    return vprintf(fmt, args) < 0 ? -1 : 0;
+}
+
+int Log_Debug(const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    int result = Log_DebugVarArgs(fmt, args);
+    va_end(args);
+    return result;
+}
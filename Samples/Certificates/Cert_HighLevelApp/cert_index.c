@@ -0,0 +1,276 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <applibs/log.h>
+
+#include "cert_index.h"
+#include "eventloop_timer_utilities.h"
+
+// Number of slots in the identifier hash table, which must be a power of two. Keeping it at least
+// twice the number of certificates keeps the probe sequences short.
+#define HASH_TABLE_SIZE 32
+#define EMPTY_SLOT UINT8_MAX
+
+// Longest time between expiry checks, so that a rotation which failed is retried, and a change to
+// the system time is noticed.
+#define MAX_CHECK_INTERVAL_SECONDS (24 * 60 * 60)
+// Time after a failure to enumerate the store before it is tried again.
+#define RETRY_INTERVAL_SECONDS 60
+
+static CertIndex_Certificate certificates[CERT_INDEX_MAX_CERTIFICATES];
+static size_t certificateCount = 0;
+static uint8_t hashTable[HASH_TABLE_SIZE];
+static ssize_t availableSpace = -1;
+static bool indexValid = false;
+
+// When each expiring certificate was last notified, so that a handler which changes the store
+// without rotating a certificate is not notified of it again until the next daily check.
+static struct {
+    CertStore_Identifier identifier;
+    time_t expiry;
+    time_t notifiedTime;
+} notifications[CERT_INDEX_MAX_CERTIFICATES];
+
+static EventLoopTimer *expiryTimer = NULL;
+static time_t expiryLeadTime = 0;
+static CertIndex_ExpiryHandler expiryHandler = NULL;
+static void *expiryHandlerContext = NULL;
+
+static uint32_t HashIdentifier(const char *identifier)
+{
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (const char *c = identifier; *c != '\0'; ++c) {
+        hash = (hash ^ (uint8_t)*c) * 16777619u;
+    }
+    return hash;
+}
+
+static void ScheduleCheck(time_t delaySeconds)
+{
+    // A zero delay would disarm the timer, so check as soon as possible instead.
+    struct timespec delay = {.tv_sec = delaySeconds, .tv_nsec = delaySeconds > 0 ? 0 : 1};
+    SetEventLoopTimerOneShot(expiryTimer, &delay);
+}
+
+void CertIndex_Invalidate(void)
+{
+    indexValid = false;
+
+    // Check the changed store for expiring certificates once the caller has returned to the event
+    // loop.
+    if (expiryTimer != NULL) {
+        ScheduleCheck(0);
+    }
+}
+
+int CertIndex_Refresh(void)
+{
+    if (indexValid) {
+        return 0;
+    }
+
+    certificateCount = 0;
+    memset(hashTable, EMPTY_SLOT, sizeof(hashTable));
+
+    availableSpace = CertStore_GetAvailableSpace();
+    if (availableSpace == -1) {
+        Log_Debug("ERROR: CertStore_GetAvailableSpace has failed: errno = %s (%d).\n",
+                  strerror(errno), errno);
+        return -1;
+    }
+
+    ssize_t storeCount = CertStore_GetCertificateCount();
+    if (storeCount == -1) {
+        Log_Debug("ERROR: CertStore_GetCertificateCount has failed: errno = %s (%d).\n",
+                  strerror(errno), errno);
+        return -1;
+    }
+    if (storeCount > CERT_INDEX_MAX_CERTIFICATES) {
+        Log_Debug("WARNING: Only indexing %d of the %zd installed certificates.\n",
+                  CERT_INDEX_MAX_CERTIFICATES, storeCount);
+        storeCount = CERT_INDEX_MAX_CERTIFICATES;
+    }
+
+    for (size_t i = 0; i < (size_t)storeCount; ++i) {
+        CertIndex_Certificate *certificate = &certificates[i];
+        const char *failedCall = NULL;
+        if (CertStore_GetCertificateIdentifierAt(i, &certificate->identifier) == -1) {
+            failedCall = "CertStore_GetCertificateIdentifierAt";
+        } else if (CertStore_GetCertificateSubjectName(certificate->identifier.identifier,
+                                                       &certificate->subjectName) == -1) {
+            failedCall = "CertStore_GetCertificateSubjectName";
+        } else if (CertStore_GetCertificateIssuerName(certificate->identifier.identifier,
+                                                      &certificate->issuerName) == -1) {
+            failedCall = "CertStore_GetCertificateIssuerName";
+        } else if (CertStore_GetCertificateNotBefore(certificate->identifier.identifier,
+                                                     &certificate->notBefore) == -1) {
+            failedCall = "CertStore_GetCertificateNotBefore";
+        } else if (CertStore_GetCertificateNotAfter(certificate->identifier.identifier,
+                                                    &certificate->notAfter) == -1) {
+            failedCall = "CertStore_GetCertificateNotAfter";
+        }
+        if (failedCall != NULL) {
+            int error = errno;
+            Log_Debug("ERROR: %s has failed: errno = %s (%d).\n", failedCall, strerror(error),
+                      error);
+            certificateCount = 0;
+            memset(hashTable, EMPTY_SLOT, sizeof(hashTable));
+            errno = error;
+            return -1;
+        }
+
+        // The validity dates are in UTC.
+        struct tm notAfter = certificate->notAfter;
+        certificate->expiry = timegm(&notAfter);
+
+        uint32_t slot = HashIdentifier(certificate->identifier.identifier);
+        while (hashTable[slot & (HASH_TABLE_SIZE - 1)] != EMPTY_SLOT) {
+            ++slot;
+        }
+        hashTable[slot & (HASH_TABLE_SIZE - 1)] = (uint8_t)i;
+        ++certificateCount;
+    }
+
+    indexValid = true;
+    return 0;
+}
+
+ssize_t CertIndex_GetAvailableSpace(void)
+{
+    if (CertIndex_Refresh() != 0) {
+        return -1;
+    }
+    return availableSpace;
+}
+
+ssize_t CertIndex_GetCount(void)
+{
+    if (CertIndex_Refresh() != 0) {
+        return -1;
+    }
+    return (ssize_t)certificateCount;
+}
+
+const CertIndex_Certificate *CertIndex_GetAt(size_t index)
+{
+    if (CertIndex_Refresh() != 0) {
+        return NULL;
+    }
+    if (index >= certificateCount) {
+        errno = EINVAL;
+        return NULL;
+    }
+    return &certificates[index];
+}
+
+const CertIndex_Certificate *CertIndex_Find(const char *identifier)
+{
+    if (CertIndex_Refresh() != 0) {
+        return NULL;
+    }
+
+    for (uint32_t slot = HashIdentifier(identifier);; ++slot) {
+        uint8_t index = hashTable[slot & (HASH_TABLE_SIZE - 1)];
+        if (index == EMPTY_SLOT) {
+            errno = ENOENT;
+            return NULL;
+        }
+        if (strcmp(certificates[index].identifier.identifier, identifier) == 0) {
+            return &certificates[index];
+        }
+    }
+}
+
+// Returns whether an expiring certificate should be notified, and records that it has been.
+static bool ShouldNotify(const CertIndex_Certificate *certificate, time_t now)
+{
+    size_t oldest = 0;
+    for (size_t i = 0; i < CERT_INDEX_MAX_CERTIFICATES; ++i) {
+        bool sameCertificate = notifications[i].expiry == certificate->expiry &&
+                               strcmp(notifications[i].identifier.identifier,
+                                      certificate->identifier.identifier) == 0;
+        if (sameCertificate) {
+            if (now - notifications[i].notifiedTime < MAX_CHECK_INTERVAL_SECONDS) {
+                return false;
+            }
+            oldest = i;
+            break;
+        }
+        if (notifications[i].notifiedTime < notifications[oldest].notifiedTime) {
+            oldest = i;
+        }
+    }
+
+    notifications[oldest].identifier = certificate->identifier;
+    notifications[oldest].expiry = certificate->expiry;
+    notifications[oldest].notifiedTime = now;
+    return true;
+}
+
+static void ExpiryTimerEventHandler(EventLoopTimer *timer)
+{
+    if (ConsumeEventLoopTimerEvent(timer) != 0) {
+        return;
+    }
+
+    if (CertIndex_Refresh() != 0) {
+        ScheduleCheck(RETRY_INTERVAL_SECONDS);
+        return;
+    }
+
+    time_t now = time(NULL);
+    time_t nextCheck = now + MAX_CHECK_INTERVAL_SECONDS;
+    for (size_t i = 0; i < certificateCount; ++i) {
+        time_t rotationTime = certificates[i].expiry - expiryLeadTime;
+        if (rotationTime > now) {
+            if (rotationTime < nextCheck) {
+                nextCheck = rotationTime;
+            }
+            continue;
+        }
+
+        if (!ShouldNotify(&certificates[i], now)) {
+            continue;
+        }
+
+        // The handler may change the store, which invalidates the index and schedules another
+        // check, so it is passed a copy.
+        CertIndex_Certificate certificate = certificates[i];
+        Log_Debug("INFO: Certificate '%s' expires in %lld s.\n",
+                  certificate.identifier.identifier, (long long)(certificate.expiry - now));
+        expiryHandler(&certificate, expiryHandlerContext);
+        if (!indexValid) {
+            return;
+        }
+    }
+
+    ScheduleCheck(nextCheck - now);
+}
+
+int CertIndex_StartExpiryMonitor(EventLoop *eventLoop, time_t leadTimeSeconds,
+                                 CertIndex_ExpiryHandler handler, void *context)
+{
+    expiryLeadTime = leadTimeSeconds;
+    expiryHandler = handler;
+    expiryHandlerContext = context;
+    memset(notifications, 0, sizeof(notifications));
+
+    expiryTimer = CreateEventLoopDisarmedTimer(eventLoop, ExpiryTimerEventHandler);
+    if (expiryTimer == NULL) {
+        return -1;
+    }
+
+    ScheduleCheck(0);
+    return 0;
+}
+
+void CertIndex_Cleanup(void)
+{
+    DisposeEventLoopTimer(expiryTimer);
+    expiryTimer = NULL;
+}
@@ -0,0 +1,111 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include <applibs/certstore.h>
+#include <applibs/eventloop.h>
+
+// The certificate index keeps the identifier, subject, issuer and validity dates of each
+// certificate in the device certificate store, so that they can be listed, and a certificate can be
+// found by its identifier in constant time, without enumerating the store. The store is only
+// enumerated again after CertIndex_Invalidate is called, which the application should do after
+// it installs, moves or deletes a certificate.
+//
+// The index also schedules a check for certificates which are about to expire, and notifies the
+// application of each one so that it can rotate the certificate before it expires.
+//
+// The index is not thread-safe; it should only be used from the event loop's thread.
+
+/// <summary>
+///     Maximum number of certificates in the index. Further certificates in the store are
+///     ignored.
+/// </summary>
+#define CERT_INDEX_MAX_CERTIFICATES 16
+
+/// <summary>
+///     A certificate in the index.
+/// </summary>
+typedef struct {
+    CertStore_Identifier identifier;
+    CertStore_SubjectName subjectName;
+    CertStore_IssuerName issuerName;
+    struct tm notBefore;
+    struct tm notAfter;
+    /// <summary>notAfter as seconds since the epoch.</summary>
+    time_t expiry;
+} CertIndex_Certificate;
+
+/// <summary>
+///     Invoked when a certificate will expire within the lead time which was passed to
+///     CertIndex_StartExpiryMonitor. It is invoked once for each certificate each time the index
+///     is refreshed, and may install, move or delete certificates.
+/// </summary>
+/// <param name="certificate">The certificate, which is only valid until the handler
+/// returns.</param>
+/// <param name="context">Context which was supplied to CertIndex_StartExpiryMonitor.</param>
+typedef void (*CertIndex_ExpiryHandler)(const CertIndex_Certificate *certificate, void *context);
+
+/// <summary>
+///     Marks the index as out of date, so that the store is enumerated again when it is next
+///     used.
+/// </summary>
+void CertIndex_Invalidate(void);
+
+/// <summary>
+///     Enumerates the store into the index, if the index is out of date.
+/// </summary>
+/// <returns>0 on success, or -1 on failure, in which case errno is set.</returns>
+int CertIndex_Refresh(void);
+
+/// <summary>
+///     Gets the space which is available in the store, as of when the index was refreshed.
+/// </summary>
+/// <returns>The available space in bytes, or -1 on failure, in which case errno is set.</returns>
+ssize_t CertIndex_GetAvailableSpace(void);
+
+/// <summary>
+///     Gets the number of certificates in the index.
+/// </summary>
+/// <returns>The number of certificates, or -1 on failure, in which case errno is set.</returns>
+ssize_t CertIndex_GetCount(void);
+
+/// <summary>
+///     Gets a certificate by its position in the index.
+/// </summary>
+/// <param name="index">The position, which must be less than CertIndex_GetCount().</param>
+/// <returns>The certificate, which is valid until the index is next refreshed, or NULL on
+/// failure.</returns>
+const CertIndex_Certificate *CertIndex_GetAt(size_t index);
+
+/// <summary>
+///     Finds a certificate by its identifier.
+/// </summary>
+/// <param name="identifier">The certificate identifier.</param>
+/// <returns>The certificate, which is valid until the index is next refreshed, or NULL if it is
+/// not in the store.</returns>
+const CertIndex_Certificate *CertIndex_Find(const char *identifier);
+
+/// <summary>
+///     Starts checking for certificates which will expire within a lead time. The check is made
+///     now, whenever the index is refreshed, and when the next certificate enters the lead time.
+/// </summary>
+/// <param name="eventLoop">Event loop which runs the check's timer.</param>
+/// <param name="leadTimeSeconds">How long before its expiry a certificate should be
+/// rotated.</param>
+/// <param name="handler">Function which is notified of each expiring certificate.</param>
+/// <param name="context">Context which is passed to the handler.</param>
+/// <returns>0 on success, or -1 on failure, in which case errno is set.</returns>
+int CertIndex_StartExpiryMonitor(EventLoop *eventLoop, time_t leadTimeSeconds,
+                                 CertIndex_ExpiryHandler handler, void *context);
+
+/// <summary>
+///     Stops checking for expiring certificates, and frees the index's resources. This should be
+///     called before the event loop is closed.
+/// </summary>
+void CertIndex_Cleanup(void);
@@ -0,0 +1,327 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "applibs_versions.h"
+#include <applibs/certstore.h>
+#include <applibs/log.h>
+#include <applibs/wificonfig.h>
+
+#include "cert_index.h"
+#include "cert_rotation.h"
+#include "eventloop_timer_utilities.h"
+
+// Maximum number of certificates which can be rotated together.
+#define MAX_SLOTS 4
+
+// Longest wait for a scheduled rotation before the time is checked again, so that a change to the
+// system time, such as when it is first synchronized, moves the rotation accordingly.
+#define MAX_SCHEDULE_WAIT_SECONDS (60 * 60)
+
+// Interval at which the connection to the network is checked after the Wi-Fi configuration has
+// been reloaded. The first check is made after one interval, so that the connection which was
+// made with the previous certificates has had time to be dropped.
+#define RECONNECT_CHECK_INTERVAL_SECONDS 5
+
+typedef enum { State_Idle, State_Scheduled, State_Verifying } State;
+
+static EventLoop *eventLoop = NULL;
+static EventLoopTimer *rotationTimer = NULL;
+static const CertRotation_Slot *rotationSlots = NULL;
+static size_t rotationSlotCount = 0;
+static CertRotation_OutcomeHandler outcomeHandler = NULL;
+static void *outcomeHandlerContext = NULL;
+
+static State state = State_Idle;
+static time_t scheduledTime = 0;
+static time_t reconnectDeadline = 0;
+static unsigned int randomSeed = 0;
+static CertRotation_Statistics statistics;
+
+// Which slots have been switched in the current rotation, and whether each had a certificate in
+// use which was moved to its backup identifier.
+static bool slotSwitched[MAX_SLOTS];
+static bool slotHadActive[MAX_SLOTS];
+
+static time_t MonotonicSeconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec;
+}
+
+static void ArmTimer(time_t delaySeconds)
+{
+    // A zero delay would disarm the timer, so fire as soon as possible instead.
+    struct timespec delay = {.tv_sec = delaySeconds, .tv_nsec = delaySeconds > 0 ? 0 : 1};
+    SetEventLoopTimerOneShot(rotationTimer, &delay);
+}
+
+static int MoveCertificate(const char *source, const char *destination)
+{
+    int result = CertStore_MoveCertificate(source, destination);
+    CertIndex_Invalidate();
+    if (result == -1) {
+        Log_Debug("ERROR: CertStore_MoveCertificate '%s' to '%s' has failed: errno = %s (%d).\n",
+                  source, destination, strerror(errno), errno);
+    }
+    return result;
+}
+
+// Puts the previous certificates back in use, and stages the new ones again.
+static void RestoreSlots(void)
+{
+    for (size_t i = 0; i < rotationSlotCount; ++i) {
+        if (!slotSwitched[i]) {
+            continue;
+        }
+        const CertRotation_Slot *slot = &rotationSlots[i];
+        MoveCertificate(slot->activeIdentifier, slot->stagedIdentifier);
+        if (slotHadActive[i]) {
+            MoveCertificate(slot->backupIdentifier, slot->activeIdentifier);
+        }
+        slotSwitched[i] = false;
+    }
+}
+
+// Deletes the previous certificates once the new ones have been shown to work.
+static void CommitSlots(void)
+{
+    for (size_t i = 0; i < rotationSlotCount; ++i) {
+        if (slotSwitched[i] && slotHadActive[i]) {
+            if (CertStore_DeleteCertificate(rotationSlots[i].backupIdentifier) == -1) {
+                Log_Debug("ERROR: CertStore_DeleteCertificate has failed: errno = %s (%d).\n",
+                          strerror(errno), errno);
+            }
+            CertIndex_Invalidate();
+        }
+        slotSwitched[i] = false;
+    }
+}
+
+static void Finish(CertRotation_Outcome outcome)
+{
+    static const char *const outcomeNames[] = {"succeeded", "rolled back", "failed"};
+
+    state = State_Idle;
+    switch (outcome) {
+    case CertRotation_Outcome_Succeeded:
+        ++statistics.succeeded;
+        break;
+    case CertRotation_Outcome_RolledBack:
+        ++statistics.rolledBack;
+        break;
+    case CertRotation_Outcome_Failed:
+        ++statistics.failed;
+        break;
+    }
+
+    Log_Debug("INFO: Certificate rotation %s (%u attempted, %u succeeded, %u rolled back, %u "
+              "failed).\n",
+              outcomeNames[outcome], statistics.attempts, statistics.succeeded,
+              statistics.rolledBack, statistics.failed);
+    outcomeHandler(outcome, outcomeHandlerContext);
+}
+
+static void Rotate(void)
+{
+    ++statistics.attempts;
+
+    // Only require the device to reconnect if it was connected before the switch; otherwise, the
+    // new certificates can't be shown to be worse than the previous ones.
+    WifiConfig_ConnectedNetwork network;
+    bool wasConnected = WifiConfig_GetCurrentNetwork(&network) == 0;
+
+    size_t switchedCount = 0;
+    for (size_t i = 0; i < rotationSlotCount; ++i) {
+        const CertRotation_Slot *slot = &rotationSlots[i];
+        slotSwitched[i] = false;
+        if (CertIndex_Find(slot->stagedIdentifier) == NULL) {
+            continue;
+        }
+
+        slotHadActive[i] = CertIndex_Find(slot->activeIdentifier) != NULL;
+        if (slotHadActive[i] &&
+            MoveCertificate(slot->activeIdentifier, slot->backupIdentifier) == -1) {
+            goto fail;
+        }
+        if (MoveCertificate(slot->stagedIdentifier, slot->activeIdentifier) == -1) {
+            if (slotHadActive[i]) {
+                MoveCertificate(slot->backupIdentifier, slot->activeIdentifier);
+            }
+            goto fail;
+        }
+        slotSwitched[i] = true;
+        ++switchedCount;
+    }
+
+    if (switchedCount == 0) {
+        Log_Debug("ERROR: No certificates are staged for rotation.\n");
+        Finish(CertRotation_Outcome_Failed);
+        return;
+    }
+
+    // One reload makes all the new certificates available to the network at once.
+    if (WifiConfig_ReloadConfig() == -1) {
+        Log_Debug("ERROR: WifiConfig_ReloadConfig has failed: errno = %s (%d).\n", strerror(errno),
+                  errno);
+        goto fail;
+    }
+
+    if (!wasConnected) {
+        Log_Debug("INFO: Not connected before the rotation, so the connection isn't verified.\n");
+        CommitSlots();
+        Finish(CertRotation_Outcome_Succeeded);
+        return;
+    }
+
+    state = State_Verifying;
+    reconnectDeadline = MonotonicSeconds() + CERT_ROTATION_RECONNECT_TIMEOUT_SECONDS;
+    ArmTimer(RECONNECT_CHECK_INTERVAL_SECONDS);
+    return;
+
+fail:
+    RestoreSlots();
+    Finish(CertRotation_Outcome_Failed);
+}
+
+static void CheckReconnected(void)
+{
+    WifiConfig_ConnectedNetwork network;
+    if (WifiConfig_GetCurrentNetwork(&network) == 0) {
+        CommitSlots();
+        Finish(CertRotation_Outcome_Succeeded);
+        return;
+    }
+
+    if (MonotonicSeconds() < reconnectDeadline) {
+        ArmTimer(RECONNECT_CHECK_INTERVAL_SECONDS);
+        return;
+    }
+
+    Log_Debug("ERROR: Not reconnected with the new certificates; restoring the previous ones.\n");
+    RestoreSlots();
+    if (WifiConfig_ReloadConfig() == -1) {
+        Log_Debug("ERROR: WifiConfig_ReloadConfig has failed: errno = %s (%d).\n", strerror(errno),
+                  errno);
+    }
+    Finish(CertRotation_Outcome_RolledBack);
+}
+
+static void RotationTimerEventHandler(EventLoopTimer *timer)
+{
+    if (ConsumeEventLoopTimerEvent(timer) != 0) {
+        return;
+    }
+
+    if (state == State_Verifying) {
+        CheckReconnected();
+        return;
+    }
+
+    if (state != State_Scheduled) {
+        return;
+    }
+
+    time_t now = time(NULL);
+    if (now < scheduledTime) {
+        time_t wait = scheduledTime - now;
+        ArmTimer(wait < MAX_SCHEDULE_WAIT_SECONDS ? wait : MAX_SCHEDULE_WAIT_SECONDS);
+        return;
+    }
+
+    Rotate();
+}
+
+int CertRotation_Init(EventLoop *el, const CertRotation_Slot *slots, size_t slotCount,
+                      CertRotation_OutcomeHandler handler, void *context)
+{
+    if (slotCount > MAX_SLOTS) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    eventLoop = el;
+    rotationSlots = slots;
+    rotationSlotCount = slotCount;
+    outcomeHandler = handler;
+    outcomeHandlerContext = context;
+    memset(&statistics, 0, sizeof(statistics));
+
+    // Each device picks its own time in the window.
+    randomSeed = (unsigned int)time(NULL) ^ (unsigned int)MonotonicSeconds() ^
+                 ((unsigned int)getpid() << 16);
+
+    rotationTimer = CreateEventLoopDisarmedTimer(eventLoop, RotationTimerEventHandler);
+    if (rotationTimer == NULL) {
+        return -1;
+    }
+
+    return 0;
+}
+
+time_t CertRotation_Schedule(void)
+{
+    if (state == State_Verifying) {
+        return -1;
+    }
+    if (state == State_Scheduled) {
+        return scheduledTime;
+    }
+
+    time_t now = time(NULL);
+    struct tm utc;
+    gmtime_r(&now, &utc);
+    utc.tm_hour = CERT_ROTATION_WINDOW_START_HOUR;
+    utc.tm_min = 0;
+    utc.tm_sec = 0;
+    time_t windowStart = timegm(&utc);
+    if (now >= windowStart + CERT_ROTATION_WINDOW_LENGTH_SECONDS) {
+        windowStart += 24 * 60 * 60;
+    }
+
+    // If the window has already started, pick a time in what remains of it.
+    time_t earliest = now > windowStart ? now : windowStart;
+    time_t remaining = windowStart + CERT_ROTATION_WINDOW_LENGTH_SECONDS - earliest;
+    unsigned long offset = (unsigned long)rand_r(&randomSeed) % (unsigned long)remaining;
+    scheduledTime = earliest + (time_t)offset;
+    state = State_Scheduled;
+
+    time_t wait = scheduledTime - now;
+    ArmTimer(wait < MAX_SCHEDULE_WAIT_SECONDS ? wait : MAX_SCHEDULE_WAIT_SECONDS);
+    return scheduledTime;
+}
+
+int CertRotation_RotateNow(void)
+{
+    if (state == State_Verifying) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    state = State_Scheduled;
+    scheduledTime = 0;
+    ArmTimer(0);
+    return 0;
+}
+
+bool CertRotation_IsPending(void)
+{
+    return state != State_Idle;
+}
+
+const CertRotation_Statistics *CertRotation_GetStatistics(void)
+{
+    return &statistics;
+}
+
+void CertRotation_Cleanup(void)
+{
+    state = State_Idle;
+    DisposeEventLoopTimer(rotationTimer);
+    rotationTimer = NULL;
+}
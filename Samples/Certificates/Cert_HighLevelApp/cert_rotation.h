@@ -0,0 +1,128 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+#include <applibs/eventloop.h>
+
+// Certificate rotation replaces the certificates which a device uses with new certificates which
+// have been staged under other identifiers, and reloads the Wi-Fi configuration once for all of
+// them, so that an EAP-TLS network is only reconnected to once.
+//
+// The switch is made at a random time within a daily low-traffic window, chosen independently by
+// each device, so that a fleet of devices which are given new certificates at the same time do
+// not all reconnect at the same time. Each certificate which is replaced is kept under a backup
+// identifier until the device has reconnected to the network; if it does not reconnect, the
+// previous certificates are restored and the new ones are staged again, so that the rotation can
+// be retried. The outcome of each rotation is counted, and reported to the application.
+//
+// Rotation is not thread-safe; it should only be used from the event loop's thread.
+
+/// <summary>
+///     Hour of the day, in UTC, at which the rotation window starts.
+/// </summary>
+#define CERT_ROTATION_WINDOW_START_HOUR 2
+
+/// <summary>
+///     Length of the rotation window, in seconds.
+/// </summary>
+#define CERT_ROTATION_WINDOW_LENGTH_SECONDS (4 * 60 * 60)
+
+/// <summary>
+///     Time after the Wi-Fi configuration is reloaded within which the device must reconnect to
+///     its network for a rotation to succeed, in seconds.
+/// </summary>
+#define CERT_ROTATION_RECONNECT_TIMEOUT_SECONDS 60
+
+/// <summary>
+///     A certificate which can be rotated.
+/// </summary>
+typedef struct {
+    /// <summary>Identifier of the certificate which is in use.</summary>
+    const char *activeIdentifier;
+    /// <summary>Identifier under which its replacement is installed.</summary>
+    const char *stagedIdentifier;
+    /// <summary>Identifier under which the replaced certificate is kept until the rotation has
+    /// succeeded.</summary>
+    const char *backupIdentifier;
+} CertRotation_Slot;
+
+/// <summary>
+///     The outcome of a rotation.
+/// </summary>
+typedef enum {
+    /// <summary>The staged certificates are in use.</summary>
+    CertRotation_Outcome_Succeeded,
+    /// <summary>The device did not reconnect with the staged certificates, so the previous
+    /// certificates were restored, and the new certificates were staged again.</summary>
+    CertRotation_Outcome_RolledBack,
+    /// <summary>The certificates could not be switched; the previous certificates are still in
+    /// use.</summary>
+    CertRotation_Outcome_Failed
+} CertRotation_Outcome;
+
+/// <summary>
+///     Counts of the outcomes of the rotations which have been made since the application started.
+/// </summary>
+typedef struct {
+    unsigned int attempts;
+    unsigned int succeeded;
+    unsigned int rolledBack;
+    unsigned int failed;
+} CertRotation_Statistics;
+
+/// <summary>
+///     Invoked when a rotation has finished.
+/// </summary>
+/// <param name="outcome">The outcome of the rotation.</param>
+/// <param name="context">Context which was supplied to CertRotation_Init.</param>
+typedef void (*CertRotation_OutcomeHandler)(CertRotation_Outcome outcome, void *context);
+
+/// <summary>
+///     Initializes certificate rotation.
+/// </summary>
+/// <param name="eventLoop">Event loop which runs the rotation's timer.</param>
+/// <param name="slots">The certificates which can be rotated, which must remain valid until
+/// CertRotation_Cleanup is called.</param>
+/// <param name="slotCount">The number of slots.</param>
+/// <param name="handler">Function which is notified of the outcome of each rotation.</param>
+/// <param name="context">Context which is passed to the handler.</param>
+/// <returns>0 on success, or -1 on failure, in which case errno is set.</returns>
+int CertRotation_Init(EventLoop *eventLoop, const CertRotation_Slot *slots, size_t slotCount,
+                      CertRotation_OutcomeHandler handler, void *context);
+
+/// <summary>
+///     Schedules a rotation of the staged certificates at a random time in the next rotation
+///     window. If a rotation is already scheduled, it is left unchanged.
+/// </summary>
+/// <returns>The time at which the rotation is scheduled, or -1 if a rotation is in
+/// progress.</returns>
+time_t CertRotation_Schedule(void);
+
+/// <summary>
+///     Rotates the staged certificates now, rather than in the rotation window. The outcome is
+///     reported to the handler, from the event loop.
+/// </summary>
+/// <returns>0 if the rotation was started, or -1 if a rotation is in progress, in which case
+/// errno is set to EBUSY.</returns>
+int CertRotation_RotateNow(void);
+
+/// <summary>
+///     Whether a rotation is scheduled or in progress.
+/// </summary>
+bool CertRotation_IsPending(void);
+
+/// <summary>
+///     Gets the counts of the outcomes of the rotations.
+/// </summary>
+const CertRotation_Statistics *CertRotation_GetStatistics(void);
+
+/// <summary>
+///     Cancels any scheduled rotation, and frees the rotation's resources. This should be called
+///     before the event loop is closed.
+/// </summary>
+void CertRotation_Cleanup(void);
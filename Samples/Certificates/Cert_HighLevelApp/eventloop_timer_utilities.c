@@ -2,6 +2,7 @@
    Licensed under the MIT License. */
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 
 #include <errno.h>
@@ -12,128 +13,422 @@
 #include <applibs/log.h>
 #include <applibs/eventloop.h>
 
+#ifdef EVENTLOOP_STATS
+// The timer manager's own registration is not instrumented; each timer's handler is timed instead.
+#define EVENTLOOP_STATS_NO_REDIRECT
+#include "eventloop_stats.h"
+#endif
+
+#ifdef MEM_POOL
+// Allocate the timers and their managers from the application's fixed-size memory pool.
+#include "mem_pool.h"
+static MemPool_Subsystem timerMemory = MEM_POOL_SUBSYSTEM("Timers");
+#define malloc(size) MemPool_AllocFor(&timerMemory, (size))
+#define calloc(count, size) MemPool_CallocFor(&timerMemory, (count), (size))
+#define realloc(ptr, size) MemPool_ReallocFor(&timerMemory, (ptr), (size))
+#define free(ptr) MemPool_Free(ptr)
+#endif
+
 #include "eventloop_timer_utilities.h"
 
-static int SetTimerPeriod(int timerFd, const struct timespec *initial,
-                          const struct timespec *repeat);
+// All the timers on an event loop share one timerfd, which is owned by a timer manager. The
+// manager keeps the armed timers in a binary min-heap ordered by deadline, and arms the timerfd
+// for the earliest of them. When it fires, every timer which has expired is dispatched in the same
+// wakeup. The manager is created with the first timer on its event loop, and freed with the last.
+
+#define NS_PER_SEC 1000000000ULL
+
+struct TimerManager;
+
+struct EventLoopTimer {
+    struct TimerManager *manager;
+    EventLoopTimerHandler handler;
+#ifdef EVENTLOOP_STATS
+    EventLoopStats_Handler *stats;
+#endif
+    // Absolute CLOCK_MONOTONIC time at which the timer next expires, in nanoseconds.
+    uint64_t deadlineNs;
+    // Interval between expiries, or zero for a one-shot timer.
+    uint64_t periodNs;
+    // Position in the manager's heap, or -1 if the timer is disarmed.
+    ssize_t heapIndex;
+};
+
+struct TimerManager {
+    EventLoop *eventLoop;
+    int fd;
+    EventRegistration *registration;
+    // Number of timers which use this manager, whether or not they are armed.
+    size_t timerCount;
+    // Armed timers; heap[0] has the earliest deadline.
+    EventLoopTimer **heap;
+    size_t heapCount;
+    size_t heapCapacity;
+    // Deadline for which the timerfd is armed, or zero if it is disarmed.
+    uint64_t armedDeadlineNs;
+    // Set while expired timers are being dispatched, so that the timerfd is only rearmed, and
+    // the manager only freed, once they have all been handled.
+    bool dispatching;
+    struct TimerManager *next;
+};
+
+// Timer managers, one for each event loop which has timers.
+static struct TimerManager *managers = NULL;
+
+static uint64_t NowNs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * NS_PER_SEC + (uint64_t)now.tv_nsec;
+}
 
-static int SetTimerPeriod(int timerFd, const struct timespec *initial,
-                          const struct timespec *repeat)
+// Converts a relative time to nanoseconds. A NULL or zero time converts to zero.
+static int TimespecToNs(const struct timespec *ts, uint64_t *ns)
 {
-    static const struct timespec nullTimeSpec = {.tv_sec = 0, .tv_nsec = 0};
-    struct itimerspec newValue = {.it_value = initial ? *initial : nullTimeSpec,
-                                  .it_interval = repeat ? *repeat : nullTimeSpec};
+    *ns = 0;
+    if (ts == NULL) {
+        return 0;
+    }
 
-    if (timerfd_settime(timerFd, /* flags */ 0, &newValue, /* old_value */ NULL) == -1) {
+    if (ts->tv_sec < 0 || ts->tv_nsec < 0 || ts->tv_nsec >= (long)NS_PER_SEC) {
+        errno = EINVAL;
         Log_Debug("ERROR: Could not set timer period: %s (%d).\n", strerror(errno), errno);
         return -1;
     }
 
+    *ns = (uint64_t)ts->tv_sec * NS_PER_SEC + (uint64_t)ts->tv_nsec;
     return 0;
 }
 
-struct EventLoopTimer {
-    EventLoop *eventLoop;
-    EventLoopTimerHandler handler;
-    int fd;
-    EventRegistration *registration;
-};
+static void HeapSwap(struct TimerManager *manager, size_t a, size_t b)
+{
+    EventLoopTimer *timerA = manager->heap[a];
+    manager->heap[a] = manager->heap[b];
+    manager->heap[b] = timerA;
+    manager->heap[a]->heapIndex = (ssize_t)a;
+    manager->heap[b]->heapIndex = (ssize_t)b;
+}
+
+static void HeapSiftUp(struct TimerManager *manager, size_t index)
+{
+    while (index > 0) {
+        size_t parent = (index - 1) / 2;
+        if (manager->heap[parent]->deadlineNs <= manager->heap[index]->deadlineNs) {
+            break;
+        }
+        HeapSwap(manager, parent, index);
+        index = parent;
+    }
+}
+
+static void HeapSiftDown(struct TimerManager *manager, size_t index)
+{
+    for (;;) {
+        size_t smallest = index;
+        size_t left = 2 * index + 1;
+        size_t right = left + 1;
+        if (left < manager->heapCount &&
+            manager->heap[left]->deadlineNs < manager->heap[smallest]->deadlineNs) {
+            smallest = left;
+        }
+        if (right < manager->heapCount &&
+            manager->heap[right]->deadlineNs < manager->heap[smallest]->deadlineNs) {
+            smallest = right;
+        }
+        if (smallest == index) {
+            break;
+        }
+        HeapSwap(manager, index, smallest);
+        index = smallest;
+    }
+}
+
+static int HeapPush(struct TimerManager *manager, EventLoopTimer *timer)
+{
+    if (manager->heapCount == manager->heapCapacity) {
+        size_t newCapacity = (manager->heapCapacity == 0) ? 8 : manager->heapCapacity * 2;
+        EventLoopTimer **newHeap = realloc(manager->heap, newCapacity * sizeof(*newHeap));
+        if (newHeap == NULL) {
+            return -1;
+        }
+        manager->heap = newHeap;
+        manager->heapCapacity = newCapacity;
+    }
+
+    size_t index = manager->heapCount++;
+    manager->heap[index] = timer;
+    timer->heapIndex = (ssize_t)index;
+    HeapSiftUp(manager, index);
+    return 0;
+}
+
+static void HeapRemove(struct TimerManager *manager, EventLoopTimer *timer)
+{
+    size_t index = (size_t)timer->heapIndex;
+    size_t last = --manager->heapCount;
+    timer->heapIndex = -1;
+
+    if (index != last) {
+        manager->heap[index] = manager->heap[last];
+        manager->heap[index]->heapIndex = (ssize_t)index;
+        HeapSiftUp(manager, index);
+        HeapSiftDown(manager, (size_t)manager->heap[index]->heapIndex);
+    }
+}
+
+// Arms the shared timerfd for the earliest deadline, or disarms it if no timers are armed.
+static int RearmManager(struct TimerManager *manager)
+{
+    if (manager->dispatching) {
+        return 0;
+    }
+
+    uint64_t deadlineNs = (manager->heapCount > 0) ? manager->heap[0]->deadlineNs : 0;
+    if (deadlineNs == manager->armedDeadlineNs) {
+        return 0;
+    }
+
+    struct itimerspec newValue = {.it_value = {.tv_sec = (time_t)(deadlineNs / NS_PER_SEC),
+                                               .tv_nsec = (long)(deadlineNs % NS_PER_SEC)},
+                                  .it_interval = {.tv_sec = 0, .tv_nsec = 0}};
+    if (timerfd_settime(manager->fd, TFD_TIMER_ABSTIME, &newValue, /* old_value */ NULL) == -1) {
+        Log_Debug("ERROR: Could not set timer period: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+
+    manager->armedDeadlineNs = deadlineNs;
+    return 0;
+}
+
+static void FreeManager(struct TimerManager *manager)
+{
+    for (struct TimerManager **link = &managers; *link != NULL; link = &(*link)->next) {
+        if (*link == manager) {
+            *link = manager->next;
+            break;
+        }
+    }
+
+    EventLoop_UnregisterIo(manager->eventLoop, manager->registration);
+
+    if (manager->fd != -1) {
+        close(manager->fd);
+    }
+
+    free(manager->heap);
+    free(manager);
+}
 
 // This satisfies the EventLoopIoCallback signature.
 static void TimerCallback(EventLoop *el, int fd, EventLoop_IoEvents events, void *context)
 {
-    EventLoopTimer *timer = (EventLoopTimer *)context;
+    struct TimerManager *manager = (struct TimerManager *)context;
 
-    timer->handler(timer);
+    uint64_t timerData = 0;
+    if (read(manager->fd, &timerData, sizeof(timerData)) == -1 && errno != EAGAIN) {
+        Log_Debug("ERROR: Could not read timerfd %s (%d).\n", strerror(errno), errno);
+    }
+    manager->armedDeadlineNs = 0;
+
+    // Dispatch every timer which expired by now. A periodic timer is rescheduled before its
+    // handler runs, at its next deadline after now, so it cannot be dispatched twice here.
+    uint64_t nowNs = NowNs();
+    manager->dispatching = true;
+    while (manager->heapCount > 0 && manager->heap[0]->deadlineNs <= nowNs) {
+        EventLoopTimer *timer = manager->heap[0];
+        if (timer->periodNs > 0) {
+            uint64_t missed = (nowNs - timer->deadlineNs) / timer->periodNs;
+            timer->deadlineNs += (missed + 1) * timer->periodNs;
+            HeapSiftDown(manager, 0);
+        } else {
+            HeapRemove(manager, timer);
+        }
+
+#ifdef EVENTLOOP_STATS
+        // The handler may dispose of the timer.
+        EventLoopStats_Handler *stats = timer->stats;
+        uint64_t startUs = EventLoopStats_BeginHandler();
+        timer->handler(timer);
+        EventLoopStats_EndHandler(stats, startUs);
+#else
+        timer->handler(timer);
+#endif
+    }
+    manager->dispatching = false;
+
+    if (manager->timerCount == 0) {
+        FreeManager(manager);
+        return;
+    }
+
+    RearmManager(manager);
 }
 
-EventLoopTimer *CreateEventLoopPeriodicTimer(EventLoop *eventLoop, EventLoopTimerHandler handler,
-                                             const struct timespec *period)
+static struct TimerManager *AcquireManager(EventLoop *eventLoop)
 {
-    if (handler == NULL) {
-        errno = EINVAL;
-        return NULL;
+    for (struct TimerManager *manager = managers; manager != NULL; manager = manager->next) {
+        if (manager->eventLoop == eventLoop) {
+            ++manager->timerCount;
+            return manager;
+        }
     }
 
-    EventLoopTimer *timer = malloc(sizeof(EventLoopTimer));
-    if (timer == NULL) {
+    struct TimerManager *manager = calloc(1, sizeof(struct TimerManager));
+    if (manager == NULL) {
         return NULL;
     }
 
-    timer->eventLoop = eventLoop;
-    timer->handler = handler;
-
-    // Initialize to unused values in case have to clean up partially initialized object.
-    timer->fd = -1;
-    timer->registration = NULL;
+    manager->eventLoop = eventLoop;
+    manager->timerCount = 1;
 
-    timer->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
-    if (timer->fd == -1) {
+    manager->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (manager->fd == -1) {
         Log_Debug("ERROR: Unable to create timer: %s (%d).\n", strerror(errno), errno);
         goto failed;
     }
 
-    if (SetTimerPeriod(timer->fd, /* initial */ period, /* repeat */ period) == -1) {
-        goto failed;
-    }
-
-    timer->registration =
-        EventLoop_RegisterIo(eventLoop, timer->fd, EventLoop_Input, TimerCallback, timer);
-    if (timer->registration == NULL) {
+    manager->registration =
+        EventLoop_RegisterIo(eventLoop, manager->fd, EventLoop_Input, TimerCallback, manager);
+    if (manager->registration == NULL) {
         Log_Debug("ERROR: Unable to register timer event: %s (%d).\n", strerror(errno), errno);
         goto failed;
     }
 
-    return timer;
+    manager->next = managers;
+    managers = manager;
+    return manager;
 
 failed:
-    DisposeEventLoopTimer(timer);
+    if (manager->fd != -1) {
+        close(manager->fd);
+    }
+    free(manager);
     return NULL;
 }
 
-EventLoopTimer *CreateEventLoopDisarmedTimer(EventLoop *eventLoop, EventLoopTimerHandler handler)
+// Schedules a timer to expire after a delay, and then every period. A zero delay disarms the
+// timer, as it does for timerfd_settime.
+static int ArmTimer(EventLoopTimer *timer, const struct timespec *delay,
+                    const struct timespec *period)
 {
-    return CreateEventLoopPeriodicTimer(eventLoop, handler, NULL);
+    uint64_t delayNs, periodNs;
+    if (TimespecToNs(delay, &delayNs) == -1 || TimespecToNs(period, &periodNs) == -1) {
+        return -1;
+    }
+
+    struct TimerManager *manager = timer->manager;
+    if (delayNs == 0) {
+        if (timer->heapIndex != -1) {
+            HeapRemove(manager, timer);
+        }
+        return RearmManager(manager);
+    }
+
+    timer->deadlineNs = NowNs() + delayNs;
+    timer->periodNs = periodNs;
+    if (timer->heapIndex == -1) {
+        if (HeapPush(manager, timer) == -1) {
+            Log_Debug("ERROR: Could not set timer period: %s (%d).\n", strerror(errno), errno);
+            return -1;
+        }
+    } else {
+        HeapSiftUp(manager, (size_t)timer->heapIndex);
+        HeapSiftDown(manager, (size_t)timer->heapIndex);
+    }
+
+    return RearmManager(manager);
 }
 
-void DisposeEventLoopTimer(EventLoopTimer *timer)
+// The creation functions' names are in parentheses, as they are macros when EVENTLOOP_STATS is
+// defined.
+EventLoopTimer *(CreateEventLoopPeriodicTimer)(EventLoop *eventLoop, EventLoopTimerHandler handler,
+                                               const struct timespec *period)
 {
+    if (handler == NULL) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    EventLoopTimer *timer = malloc(sizeof(EventLoopTimer));
     if (timer == NULL) {
-        return;
+        return NULL;
     }
 
-    EventLoop_UnregisterIo(timer->eventLoop, timer->registration);
+    timer->handler = handler;
+    timer->heapIndex = -1;
+#ifdef EVENTLOOP_STATS
+    timer->stats = NULL;
+#endif
 
-    if (timer->fd != -1) {
-        close(timer->fd);
+    timer->manager = AcquireManager(eventLoop);
+    if (timer->manager == NULL) {
+        free(timer);
+        return NULL;
     }
 
-    free(timer);
+    if (ArmTimer(timer, /* delay */ period, /* period */ period) == -1) {
+        DisposeEventLoopTimer(timer);
+        return NULL;
+    }
+
+    return timer;
 }
 
-int ConsumeEventLoopTimerEvent(EventLoopTimer *timer)
+EventLoopTimer *(CreateEventLoopDisarmedTimer)(EventLoop *eventLoop, EventLoopTimerHandler handler)
 {
-    uint64_t timerData = 0;
+    return (CreateEventLoopPeriodicTimer)(eventLoop, handler, NULL);
+}
 
-    if (read(timer->fd, &timerData, sizeof(timerData)) == -1) {
-        Log_Debug("ERROR: Could not read timerfd %s (%d).\n", strerror(errno), errno);
-        return -1;
+#ifdef EVENTLOOP_STATS
+EventLoopTimer *CreateNamedEventLoopTimer(EventLoop *eventLoop, EventLoopTimerHandler handler,
+                                          const struct timespec *period, const char *name)
+{
+    EventLoopTimer *timer = (CreateEventLoopPeriodicTimer)(eventLoop, handler, period);
+    if (timer != NULL) {
+        timer->stats = EventLoopStats_GetHandler(name);
+    }
+    return timer;
+}
+#endif
+
+void DisposeEventLoopTimer(EventLoopTimer *timer)
+{
+    if (timer == NULL) {
+        return;
     }
 
+    struct TimerManager *manager = timer->manager;
+    if (timer->heapIndex != -1) {
+        HeapRemove(manager, timer);
+    }
+    free(timer);
+
+    // If this is called from a timer handler, the dispatch loop frees the manager.
+    if (--manager->timerCount == 0 && !manager->dispatching) {
+        FreeManager(manager);
+    } else {
+        RearmManager(manager);
+    }
+}
+
+int ConsumeEventLoopTimerEvent(EventLoopTimer *timer)
+{
+    // The timer manager consumes the shared timerfd's event before it invokes the handlers, so
+    // there is nothing left to do.
     return 0;
 }
 
 int SetEventLoopTimerPeriod(EventLoopTimer *timer, const struct timespec *period)
 {
-    return SetTimerPeriod(timer->fd, /* initial */ period, /* repeat */ period);
+    return ArmTimer(timer, /* delay */ period, /* period */ period);
 }
 
 int SetEventLoopTimerOneShot(EventLoopTimer *timer, const struct timespec *delay)
 {
-    return SetTimerPeriod(timer->fd, /* initial */ delay, /* repeat */ NULL);
+    return ArmTimer(timer, /* delay */ delay, /* period */ NULL);
 }
 
 int DisarmEventLoopTimer(EventLoopTimer *timer)
 {
-    return SetTimerPeriod(timer->fd, /* initial */ NULL, /* repeat */ NULL);
+    return ArmTimer(timer, /* delay */ NULL, /* period */ NULL);
 }
@@ -2,10 +2,11 @@
    Licensed under the MIT License. */
 
 // This sample C application for Azure Sphere demonstrates how to use the certificate
-// store APIs. Each press of SAMPLE_BUTTON_1 will advance through a cycle that installs,
-// moves certificates, reloads the Wi-Fi network (step required for an EAP-TLS network)
-// and deletes the certificates. SAMPLE_BUTTON_2 displays the available space on the divice,
-// lists the installed certificates, and displays specific information about each certificate.
+// store APIs. Each press of SAMPLE_BUTTON_1 will advance through a cycle that installs
+// certificates, stages new certificates, rotates them into use with a single reload of the Wi-Fi
+// network (step required for an EAP-TLS network) and deletes the certificates. SAMPLE_BUTTON_2
+// displays the available space on the divice, lists the installed certificates, and displays
+// specific information about each certificate.
 //
 // It uses the API for the following Azure Sphere application libraries:
 // - gpio (digital input for button)
@@ -42,7 +43,9 @@
 #include <hw/sample_appliance.h>
 
 // This sample uses a single-thread event loop pattern.
-#include "eventloop_timer_utilities.h"
+#include "button_input.h"
+#include "cert_index.h"
+#include "cert_rotation.h"
 
 /// <summary>
 /// Exit codes for this application. These are used for the
@@ -54,9 +57,9 @@ typedef enum {
 
     ExitCode_TermHandler_SigTerm = 1,
 
-    ExitCode_IsButtonPressed_GetValue = 2,
+    ExitCode_Buttons_GetValue = 2,
 
-    ExitCode_ButtonTimerHandler_Consume = 3,
+    ExitCode_Buttons_Timer = 3,
 
     ExitCode_Validate_RootCACertificate = 4,
     ExitCode_Validate_ClientCertificate = 5,
@@ -68,26 +71,23 @@ typedef enum {
     ExitCode_InstallState_InstallRootCACertificate = 9,
 
     ExitCode_InstallNewState_InstallSecondRootCACertificate = 10,
+    ExitCode_InstallNewState_InstallNewClientCertificate = 27,
 
     ExitCode_DisplayCertInformation_GetAvailableSpace = 11,
     ExitCode_DisplayCertInformation_GetCertificateCount = 12,
-    ExitCode_DisplayCertInformation_GetCertificateIdentifierAt = 13,
-    ExitCode_DisplayCertInformation_GetCertificateSubjectName = 14,
-    ExitCode_DisplayCertInformation_GetCertificateIssuerName = 15,
-    ExitCode_DisplayCertInformation_GetCertificateNotBefore = 16,
-    ExitCode_DisplayCertInformation_GetCertificateNotAfter = 17,
-
-    ExitCode_RootCACertMoveState_MoveCertificate = 18,
-
-    ExitCode_WifiReloadConfigState_ReloadConfig = 19,
+    ExitCode_DisplayCertInformation_GetCertificateAt = 13,
 
     ExitCode_CertDeleteState_DeleteCertificate = 20,
 
     ExitCode_Init_SampleButton = 21,
     ExitCode_Init_EventLoop = 22,
-    ExitCode_Init_ButtonTimer = 23,
+    ExitCode_Init_Buttons = 23,
 
-    ExitCode_Main_EventLoopFail = 24
+    ExitCode_Main_EventLoopFail = 24,
+
+    ExitCode_Init_AddButtons = 25,
+    ExitCode_Init_CertIndex = 26,
+    ExitCode_Init_CertRotation = 28
 } ExitCode;
 
 // Termination state
@@ -98,6 +98,9 @@ static void TerminationHandler(int signalNumber);
 static const char *rootCACertIdentifier = "SmplRootCACertId";
 static const char *newRootCACertIdentifier = "NewRootCACertId";
 static const char *clientCertIdentifier = "SmplClientCertId";
+static const char *newClientCertIdentifier = "NewClientCertId";
+static const char *oldRootCACertIdentifier = "OldRootCACertId";
+static const char *oldClientCertIdentifier = "OldClientCertId";
 
 // Configure the variable with the content of the root CA certificate
 static const char *rootCACertContent = "root_ca_cert_content";
@@ -114,19 +117,32 @@ static const char *clientPrivateKeyContent = "client_private_key_content";
 // Configure the variable with the password of the client private key
 static const char *clientPrivateKeyPassword = "client_private_key_password";
 
+// Optionally configure these variables with a new client certificate, private key and password,
+// to rotate the client certificate together with the root CA certificate. If the certificate is
+// NULL, only the root CA certificate is rotated.
+static const char *newClientCertContent = NULL;
+static const char *newClientPrivateKeyContent = NULL;
+static const char *newClientPrivateKeyPassword = NULL;
+
+// The certificates which are rotated: each new certificate is staged under its own identifier,
+// and the certificate which it replaces is kept under a backup identifier until the device has
+// reconnected with the new certificates.
+static CertRotation_Slot rotationSlots[2];
+
+// How long before the root CA certificate expires it is replaced by the new root CA certificate,
+// if that is staged.
+static const time_t rootCACertRotationLeadTimeSeconds = 30 * 24 * 60 * 60;
+
 // File descriptors - initialized to invalid value
 static int advanceCertSampleStateButtonGpioFd = -1;
 static int showCertStatusButtonGpioFd = -1;
 
-// Button state variables
-static GPIO_Value_Type advanceCertSampleStateButtonState = GPIO_Value_High;
-static GPIO_Value_Type showCertStatusButtonState = GPIO_Value_High;
-
-static bool IsButtonPressed(int fd, GPIO_Value_Type *buttonState);
-static void ButtonEventTimeHandler(EventLoopTimer *timer);
+static void ButtonEventHandler(int gpioFd, ButtonInput_Event event, unsigned int count,
+                               void *context);
+static void ButtonsErrorHandler(int gpioFd, void *context);
 
 static EventLoop *eventLoop = NULL;
-static EventLoopTimer *buttonPollTimer = NULL;
+static ButtonInput *buttons = NULL;
 
 static ExitCode InitPeripheralsAndHandlers(void);
 static void CloseFdAndPrintError(int fd, const char *fdName);
@@ -134,14 +150,17 @@ static void ClosePeripheralsAndHandlers(void);
 
 // Available states
 static void CertInstallState(void);
-static void InstallNewRootCACertificateState(void);
-static void RootCACertMoveState(void);
-static void WifiReloadConfigState(void);
+static void StageNewCertificatesState(void);
+static void RotateCertificatesState(void);
+static void WaitForRotationState(void);
 static void CertDeleteState(void);
 
 // Helper functions
 static bool CheckDeviceSpaceForInstallation(size_t certificateSize);
 static void DisplayCertInformation(void);
+static void CertificateExpiringHandler(const CertIndex_Certificate *certificate, void *context);
+static void RotationOutcomeHandler(CertRotation_Outcome outcome, void *context);
+static void DeleteCertificateIfInstalled(const char *identifier);
 
 // Pointer to the next state
 typedef void (*NextStateFunctionPtr)(void);
@@ -159,55 +178,36 @@ static void TerminationHandler(int signalNumber)
 }
 
 /// <summary>
-///     Check whether a given button has just been pressed.
+/// Button event: SAMPLE_BUTTON_1 advances the state, and SAMPLE_BUTTON_2 shows the certificates.
 /// </summary>
-/// <param name="fd">The button file descriptor</param>
-/// <param name="buttonState">Old state of the button (pressed or released)
-/// which will be updated to the current button state.
-/// </param>
-/// <returns>True if pressed, false otherwise</returns>
-static bool IsButtonPressed(int fd, GPIO_Value_Type *buttonState)
+/// <param name="gpioFd">The button which was pressed.</param>
+/// <param name="event">What happened to the button.</param>
+/// <param name="count">Number of presses in the current run.</param>
+/// <param name="context">Unused.</param>
+static void ButtonEventHandler(int gpioFd, ButtonInput_Event event, unsigned int count,
+                               void *context)
 {
-    bool isButtonPressed = false;
-    GPIO_Value_Type newState;
-    int result = GPIO_GetValue(fd, &newState);
-    if (result != 0) {
-        Log_Debug("ERROR: Could not read button GPIO: %s (%d).\n", strerror(errno), errno);
-        exitCode = ExitCode_IsButtonPressed_GetValue;
-    } else {
-        // Button is pressed if it is low and different than last known state.
-        isButtonPressed = (newState != *buttonState) && (newState == GPIO_Value_Low);
-        *buttonState = newState;
-    }
-
-    return isButtonPressed;
-}
-
-/// <summary>
-/// Button timer event:  Check the status of the buttons.
-/// </summary>
-/// <param name="timer">Timer which has fired.</param>
-static void ButtonEventTimeHandler(EventLoopTimer *timer)
-{
-    if (ConsumeEventLoopTimerEvent(timer) != 0) {
-        exitCode = ExitCode_ButtonTimerHandler_Consume;
+    if (event != ButtonInput_Event_Pressed) {
         return;
     }
 
-    // Check if BUTTON_1 was pressed
-    bool isButtonPressed =
-        IsButtonPressed(advanceCertSampleStateButtonGpioFd, &advanceCertSampleStateButtonState);
-    if (isButtonPressed) {
+    if (gpioFd == advanceCertSampleStateButtonGpioFd) {
         nextStateFunction();
-    }
-
-    // Check if BUTTON_2 was pressed
-    isButtonPressed = IsButtonPressed(showCertStatusButtonGpioFd, &showCertStatusButtonState);
-    if (isButtonPressed) {
+    } else if (gpioFd == showCertStatusButtonGpioFd) {
         DisplayCertInformation();
     }
 }
 
+/// <summary>
+/// Handle a failure to sample the buttons.
+/// </summary>
+/// <param name="gpioFd">The button which could not be read, or -1 if the timer failed.</param>
+/// <param name="context">Unused.</param>
+static void ButtonsErrorHandler(int gpioFd, void *context)
+{
+    exitCode = (gpioFd == -1) ? ExitCode_Buttons_Timer : ExitCode_Buttons_GetValue;
+}
+
 /// <summary>
 ///     Checks whether there is enough available space to install a certificate.
 /// </summary>
@@ -216,10 +216,8 @@ static void ButtonEventTimeHandler(EventLoopTimer *timer)
 /// false otherwise</returns>
 static bool CheckDeviceSpaceForInstallation(size_t certificateSize)
 {
-    ssize_t availableSpace = CertStore_GetAvailableSpace();
+    ssize_t availableSpace = CertIndex_GetAvailableSpace();
     if (availableSpace == -1) {
-        Log_Debug("ERROR: CertStore_GetAvailableSpace has failed: errno = %s (%d).\n",
-                  strerror(errno), errno);
         exitCode = ExitCode_CheckAvailableSpace_GetAvailableSpace;
         return false;
     } else if (((size_t)availableSpace) < certificateSize) {
@@ -233,23 +231,20 @@ static bool CheckDeviceSpaceForInstallation(size_t certificateSize)
 }
 
 /// <summary>
-///     Displays information about the installed certificates.
+///     Displays information about the installed certificates. The information is read from the
+///     certificate index, which only enumerates the store again after it has changed.
 /// </summary>
 static void DisplayCertInformation(void)
 {
-    ssize_t availableSpace = CertStore_GetAvailableSpace();
+    ssize_t availableSpace = CertIndex_GetAvailableSpace();
     if (availableSpace == -1) {
-        Log_Debug("ERROR: CertStore_GetAvailableSpace has failed: errno = %s (%d).\n",
-                  strerror(errno), errno);
         exitCode = ExitCode_DisplayCertInformation_GetAvailableSpace;
         return;
     }
     Log_Debug("INFO: Available space in device certificate store: %zu B.\n", availableSpace);
 
-    ssize_t certCount = CertStore_GetCertificateCount();
+    ssize_t certCount = CertIndex_GetCount();
     if (certCount == -1) {
-        Log_Debug("ERROR: CertStore_GetCertificateCount has failed: errno = %s (%d).\n",
-                  strerror(errno), errno);
         exitCode = ExitCode_DisplayCertInformation_GetCertificateCount;
         return;
     }
@@ -261,63 +256,78 @@ static void DisplayCertInformation(void)
     Log_Debug("INFO: There are %d certificate(s) installed on this device.\n", certCount);
 
     for (size_t i = 0; i < certCount; ++i) {
-        CertStore_Identifier certIdentifier;
-        int result = CertStore_GetCertificateIdentifierAt(i, &certIdentifier);
-        if (result == -1) {
-            Log_Debug("ERROR: CertStore_GetCertificateIdentifierAt has failed: errno = %s (%d).\n",
-                      strerror(errno), errno);
-            exitCode = ExitCode_DisplayCertInformation_GetCertificateIdentifierAt;
+        const CertIndex_Certificate *certificate = CertIndex_GetAt(i);
+        if (certificate == NULL) {
+            exitCode = ExitCode_DisplayCertInformation_GetCertificateAt;
             return;
         }
-        Log_Debug("INFO: Certificate %d has identifier: '%s'.\n", i, certIdentifier.identifier);
+        Log_Debug("INFO: Certificate %d has identifier: '%s'.\n", i,
+                  certificate->identifier.identifier);
+        Log_Debug("\tINFO: Certificate subject name: '%s'.\n", certificate->subjectName.name);
+        Log_Debug("\tINFO: Certificate issuer name: '%s'.\n", certificate->issuerName.name);
 
-        CertStore_SubjectName outSubjectName;
-        result = CertStore_GetCertificateSubjectName(certIdentifier.identifier, &outSubjectName);
-        if (result == -1) {
-            Log_Debug("\tERROR: CertStore_GetCertificateSubjectName has failed: errno = %s (%d).\n",
-                      strerror(errno), errno);
-            exitCode = ExitCode_DisplayCertInformation_GetCertificateSubjectName;
-            return;
-        }
-        Log_Debug("\tINFO: Certificate subject name: '%s'.\n", outSubjectName.name);
-
-        CertStore_IssuerName outIssuerName;
-        result = CertStore_GetCertificateIssuerName(certIdentifier.identifier, &outIssuerName);
-        if (result == -1) {
-            Log_Debug("\tERROR: CertStore_GetCertificateIssuerName has failed: errno = %s (%d).\n",
-                      strerror(errno), errno);
-            exitCode = ExitCode_DisplayCertInformation_GetCertificateIssuerName;
-            return;
-        }
-        Log_Debug("\tINFO: Certificate issuer name: '%s'.\n", outIssuerName.name);
-
-        struct tm outNotBefore;
-        result = CertStore_GetCertificateNotBefore(certIdentifier.identifier, &outNotBefore);
-        if (result == -1) {
-            Log_Debug("\tERROR: CertStore_GetCertificateNotBefore has failed: errno = %s (%d).\n",
-                      strerror(errno), errno);
-            exitCode = ExitCode_DisplayCertInformation_GetCertificateNotBefore;
-            return;
-        }
         char timeBuf[64];
-        if (strftime(timeBuf, sizeof(timeBuf), "%Y-%m-%d %T", &outNotBefore) != 0) {
+        if (strftime(timeBuf, sizeof(timeBuf), "%Y-%m-%d %T", &certificate->notBefore) != 0) {
             Log_Debug("\tINFO: Certificate not before validity date: %s\n", timeBuf);
         }
-
-        struct tm outNotAfter;
-        result = CertStore_GetCertificateNotAfter(certIdentifier.identifier, &outNotAfter);
-        if (result == -1) {
-            Log_Debug("ERROR: CertStore_GetCertificateNotAfter has failed: errno = %s (%d).\n",
-                      strerror(errno), errno);
-            exitCode = ExitCode_DisplayCertInformation_GetCertificateNotAfter;
-            return;
-        }
-        if (strftime(timeBuf, sizeof(timeBuf), "%Y-%m-%d %T", &outNotAfter) != 0) {
+        if (strftime(timeBuf, sizeof(timeBuf), "%Y-%m-%d %T", &certificate->notAfter) != 0) {
             Log_Debug("\tINFO: Certificate not after validity date: %s\n", timeBuf);
         }
     }
 }
 
+/// <summary>
+///     Called when an installed certificate will expire within its rotation lead time. If the
+///     root CA certificate is expiring and a newer root CA certificate is staged, schedules a
+///     rotation in the next rotation window.
+/// </summary>
+/// <param name="certificate">The expiring certificate.</param>
+/// <param name="context">Unused.</param>
+static void CertificateExpiringHandler(const CertIndex_Certificate *certificate, void *context)
+{
+    if (strcmp(certificate->identifier.identifier, rootCACertIdentifier) != 0) {
+        Log_Debug("WARNING: Certificate '%s' will expire soon.\n",
+                  certificate->identifier.identifier);
+        return;
+    }
+
+    const CertIndex_Certificate *replacement = CertIndex_Find(newRootCACertIdentifier);
+    if (replacement == NULL || replacement->expiry <= certificate->expiry) {
+        Log_Debug("WARNING: The root CA certificate will expire soon, and no newer root CA "
+                  "certificate is staged.\n");
+        return;
+    }
+
+    time_t rotationTime = CertRotation_Schedule();
+    if (rotationTime != -1) {
+        Log_Debug("INFO: The root CA certificate will be rotated at %lld.\n",
+                  (long long)rotationTime);
+    }
+}
+
+/// <summary>
+///     Called when a rotation of the staged certificates has finished.
+/// </summary>
+/// <param name="outcome">The outcome of the rotation.</param>
+/// <param name="context">Unused.</param>
+static void RotationOutcomeHandler(CertRotation_Outcome outcome, void *context)
+{
+    if (outcome == CertRotation_Outcome_Succeeded) {
+        nextStateFunction = CertDeleteState;
+        Log_Debug(
+            "Finished rotating the certificates with status: SUCCESS. By pressing BUTTON_1 the "
+            "root CA and client certificates will be deleted.\n");
+        return;
+    }
+
+    // The new certificates are still staged if the rotation was rolled back, or if it failed
+    // before they were moved.
+    nextStateFunction = RotateCertificatesState;
+    Log_Debug(
+        "Finished rotating the certificates with status: FAILURE. The previous certificates are "
+        "still in use. By pressing BUTTON_1 the rotation will be retried.\n");
+}
+
 /// <summary>
 ///     Installs the certificates.
 /// </summary>
@@ -336,6 +346,7 @@ static void CertInstallState(void)
     }
     int result = CertStore_InstallRootCACertificate(rootCACertIdentifier, rootCACertContent,
                                                     rootCACertContentSize);
+    CertIndex_Invalidate();
     if (result == -1) {
         Log_Debug("ERROR: CertStore_InstallRootCACertificate has failed: errno = %s (%d).\n",
                   strerror(errno), errno);
@@ -362,6 +373,7 @@ static void CertInstallState(void)
     result = CertStore_InstallClientCertificate(clientCertIdentifier, clientCertContent,
                                                 clientCertContentSize, clientPrivateKeyContent,
                                                 privateKeyContentSize, clientPrivateKeyPassword);
+    CertIndex_Invalidate();
     if (result == -1) {
         Log_Debug("ERROR: CertStore_InstallClientCertificate has failed: errno = %s (%d).\n",
                   strerror(errno), errno);
@@ -370,16 +382,17 @@ static void CertInstallState(void)
     }
 
     // set the next state
-    nextStateFunction = InstallNewRootCACertificateState;
+    nextStateFunction = StageNewCertificatesState;
     Log_Debug(
         "Finished installing the root CA and the client certificates with status: SUCCESS. By "
-        "pressing BUTTON_1 the new root CA certificate will be installed.\n");
+        "pressing BUTTON_1 the new certificates will be staged.\n");
 }
 
 /// <summary>
-///    Installs an additional root CA certificate.
+///    Stages the new root CA certificate, and the new client certificate if one is configured,
+///    under their own identifiers, then schedules their rotation into use.
 /// </summary>
-static void InstallNewRootCACertificateState(void)
+static void StageNewCertificatesState(void)
 {
     size_t newRootCACertContentSize = 0;
     if (newRootCACertContent != NULL) {
@@ -394,6 +407,7 @@ static void InstallNewRootCACertificateState(void)
     }
     int result = CertStore_InstallRootCACertificate(newRootCACertIdentifier, newRootCACertContent,
                                                     newRootCACertContentSize);
+    CertIndex_Invalidate();
     if (result == -1) {
         Log_Debug("ERROR: CertStore_InstallClientCertificate has failed: errno = %s (%d).\n",
                   strerror(errno), errno);
@@ -401,56 +415,96 @@ static void InstallNewRootCACertificateState(void)
         return;
     }
 
+    if (newClientCertContent != NULL) {
+        size_t newClientCertContentSize = strlen(newClientCertContent);
+        if (!CheckDeviceSpaceForInstallation(newClientCertContentSize)) {
+            Log_Debug(
+                "ERROR: Failed to install the new client certificate because there isn't enough "
+                "space on the device.\n");
+            exitCode = ExitCode_InstallNewState_InstallNewClientCertificate;
+            return;
+        }
+
+        size_t newPrivateKeyContentSize = 0;
+        if (newClientPrivateKeyContent != NULL) {
+            newPrivateKeyContentSize = strlen(newClientPrivateKeyContent);
+        }
+        result = CertStore_InstallClientCertificate(
+            newClientCertIdentifier, newClientCertContent, newClientCertContentSize,
+            newClientPrivateKeyContent, newPrivateKeyContentSize, newClientPrivateKeyPassword);
+        CertIndex_Invalidate();
+        if (result == -1) {
+            Log_Debug("ERROR: CertStore_InstallClientCertificate has failed: errno = %s (%d).\n",
+                      strerror(errno), errno);
+            exitCode = ExitCode_InstallNewState_InstallNewClientCertificate;
+            return;
+        }
+    }
+
+    // The new certificates will be switched to at a random time in the next rotation window, so
+    // that devices which are given new certificates together don't all reconnect together.
+    time_t rotationTime = CertRotation_Schedule();
+    char timeBuf[64];
+    struct tm utc;
+    if (rotationTime != -1 && gmtime_r(&rotationTime, &utc) != NULL &&
+        strftime(timeBuf, sizeof(timeBuf), "%Y-%m-%d %T", &utc) != 0) {
+        Log_Debug("INFO: The new certificates will be rotated into use at %s UTC.\n", timeBuf);
+    }
+
     // set the next state
-    nextStateFunction = RootCACertMoveState;
+    nextStateFunction = RotateCertificatesState;
     Log_Debug(
-        "Finished installing the new root CA certificate with status: SUCCESS. By pressing "
-        "BUTTON_1 the root CA certificate will be replaced by the new root CA certificate.\n");
+        "Finished staging the new certificates with status: SUCCESS. By pressing BUTTON_1 the "
+        "certificates will be rotated now, instead of in the rotation window.\n");
 }
 
 /// <summary>
-///     Replace the certificate identified by rootCACertIdentifier with the certificate identified
-///     by newRootCACertIdentifier. The certificate data previously identified by
-///     rootCACertIdentifier will be deleted, and the the identifier newRootCACertIdentifier will no
-///     longer be valid.
+///     Replace the certificates which are in use with the staged certificates: the certificate
+///     identified by rootCACertIdentifier is replaced with the certificate identified by
+///     newRootCACertIdentifier, and the client certificate is replaced with the new client
+///     certificate, if one was staged. The Wi-Fi configuration is reloaded once, after all the
+///     certificates have been replaced, which is necessary to make the changes available for
+///     configuring an EAP-TLS network. If the device doesn't reconnect, the previous certificates
+///     are restored.
 /// </summary>
-static void RootCACertMoveState(void)
+static void RotateCertificatesState(void)
 {
-    int result = CertStore_MoveCertificate(newRootCACertIdentifier, rootCACertIdentifier);
-    if (result == -1) {
-        Log_Debug("ERROR: CertStore_MoveCertificate has failed: errno = %s (%d).\n",
-                  strerror(errno), errno);
-        exitCode = ExitCode_RootCACertMoveState_MoveCertificate;
+    if (CertRotation_RotateNow() == -1) {
+        Log_Debug("INFO: A certificate rotation is already in progress.\n");
         return;
     }
 
     // set the next state
-    nextStateFunction = WifiReloadConfigState;
-    Log_Debug(
-        "Finished replacing the root CA certificate with the new root CA certificate with status: "
-        "SUCCESS. By pressing BUTTON_1 the device Wi-Fi configuration will be reloaded.\n");
+    nextStateFunction = WaitForRotationState;
+    Log_Debug("INFO: Rotating the certificates.\n");
 }
 
 /// <summary>
-///    Reload the device Wi-Fi configuration following changes to the certificate store.
-///    It is necessary to reload the Wi-Fi config after making any change to the certificate store,
-///    in order to make the changes available for configuring an EAP-TLS network.
+///     Waits for the rotation of the certificates to finish.
 /// </summary>
-static void WifiReloadConfigState(void)
+static void WaitForRotationState(void)
 {
-    int result = WifiConfig_ReloadConfig();
-    if (result == -1) {
-        Log_Debug("ERROR: WifiConfig_ReloadConfig has failed: errno = %s (%d).\n", strerror(errno),
-                  errno);
-        exitCode = ExitCode_WifiReloadConfigState_ReloadConfig;
+    Log_Debug("INFO: Waiting for the certificate rotation to finish.\n");
+}
+
+/// <summary>
+///     Deletes a certificate if it is installed, and logs an error if it can't be deleted.
+/// </summary>
+/// <param name="identifier">The certificate identifier.</param>
+static void DeleteCertificateIfInstalled(const char *identifier)
+{
+    if (CertIndex_Find(identifier) == NULL) {
         return;
     }
 
-    // set the next state
-    nextStateFunction = CertDeleteState;
-    Log_Debug(
-        "Finished reloading the Wi-Fi configuration with status: SUCCESS. By pressing BUTTON_1 the "
-        "new root CA and client certificates will be deleted.\n");
+    int result = CertStore_DeleteCertificate(identifier);
+    CertIndex_Invalidate();
+    if (result == -1) {
+        Log_Debug("ERROR: CertStore_DeleteCertificate has failed: errno = %s (%d).\n",
+                  strerror(errno), errno);
+        return;
+    }
+    Log_Debug("INFO: Erased certificate with identifier: %s.\n", identifier);
 }
 
 /// <summary>
@@ -459,6 +513,7 @@ static void WifiReloadConfigState(void)
 static void CertDeleteState(void)
 {
     int result = CertStore_DeleteCertificate(rootCACertIdentifier);
+    CertIndex_Invalidate();
     if (result == -1) {
         Log_Debug("ERROR: CertStore_DeleteCertificate has failed: errno = %s (%d).\n",
                   strerror(errno), errno);
@@ -468,6 +523,7 @@ static void CertDeleteState(void)
     Log_Debug("INFO: Erased certificate with identifier: %s.\n", rootCACertIdentifier);
 
     result = CertStore_DeleteCertificate(clientCertIdentifier);
+    CertIndex_Invalidate();
     if (result == -1) {
         Log_Debug("ERROR: CertStore_DeleteCertificate has failed: errno = %s (%d).\n",
                   strerror(errno), errno);
@@ -476,6 +532,12 @@ static void CertDeleteState(void)
     }
     Log_Debug("INFO: Erased certificate with identifier: %s.\n", clientCertIdentifier);
 
+    // Certificates which are left over from a rotation which didn't finish.
+    DeleteCertificateIfInstalled(newRootCACertIdentifier);
+    DeleteCertificateIfInstalled(newClientCertIdentifier);
+    DeleteCertificateIfInstalled(oldRootCACertIdentifier);
+    DeleteCertificateIfInstalled(oldClientCertIdentifier);
+
     // set the next state
     nextStateFunction = CertInstallState;
     Log_Debug(
@@ -556,7 +618,7 @@ static ExitCode InitPeripheralsAndHandlers(void)
         return ExitCode_Init_EventLoop;
     }
 
-    // Open SAMPLE_BUTTON_1 GPIO as input, and set up a timer to poll it
+    // Open SAMPLE_BUTTON_1 GPIO as input
     Log_Debug("Opening SAMPLE_BUTTON_1 as input.\n");
     advanceCertSampleStateButtonGpioFd = GPIO_OpenAsInput(SAMPLE_BUTTON_1);
     if (advanceCertSampleStateButtonGpioFd < 0) {
@@ -564,7 +626,7 @@ static ExitCode InitPeripheralsAndHandlers(void)
         return ExitCode_Init_SampleButton;
     }
 
-    // Open SAMPLE_BUTTON_2 GPIO as input, and set up a timer to poll it
+    // Open SAMPLE_BUTTON_2 GPIO as input
     Log_Debug("Opening SAMPLE_BUTTON_2 as input.\n");
     showCertStatusButtonGpioFd = GPIO_OpenAsInput(SAMPLE_BUTTON_2);
     if (showCertStatusButtonGpioFd < 0) {
@@ -575,12 +637,39 @@ static ExitCode InitPeripheralsAndHandlers(void)
     // By pressing BUTTON_1 the CertConfigureState will be called
     nextStateFunction = CertInstallState;
 
-    static const struct timespec buttonPressCheckPeriod100Ms = {.tv_sec = 0,
-                                                                .tv_nsec = 100 * 1000 * 1000};
-    buttonPollTimer = CreateEventLoopPeriodicTimer(eventLoop, &ButtonEventTimeHandler,
-                                                   &buttonPressCheckPeriod100Ms);
-    if (buttonPollTimer == NULL) {
-        return ExitCode_Init_ButtonTimer;
+    // Both buttons are sampled from one timer, which runs quickly only while a button changes
+    buttons = ButtonInput_Create(eventLoop, NULL, ButtonsErrorHandler, NULL);
+    if (buttons == NULL) {
+        return ExitCode_Init_Buttons;
+    }
+
+    if (ButtonInput_Add(buttons, advanceCertSampleStateButtonGpioFd, ButtonEventHandler, NULL) !=
+        0) {
+        return ExitCode_Init_AddButtons;
+    }
+
+    if (ButtonInput_Add(buttons, showCertStatusButtonGpioFd, ButtonEventHandler, NULL) != 0) {
+        return ExitCode_Init_AddButtons;
+    }
+
+    // Index the certificate store, and rotate the root CA certificate before it expires
+    if (CertIndex_StartExpiryMonitor(eventLoop, rootCACertRotationLeadTimeSeconds,
+                                     CertificateExpiringHandler, NULL) != 0) {
+        Log_Debug("ERROR: Could not start the certificate expiry monitor: %s (%d).\n",
+                  strerror(errno), errno);
+        return ExitCode_Init_CertIndex;
+    }
+
+    rotationSlots[0] = (CertRotation_Slot){.activeIdentifier = rootCACertIdentifier,
+                                           .stagedIdentifier = newRootCACertIdentifier,
+                                           .backupIdentifier = oldRootCACertIdentifier};
+    rotationSlots[1] = (CertRotation_Slot){.activeIdentifier = clientCertIdentifier,
+                                           .stagedIdentifier = newClientCertIdentifier,
+                                           .backupIdentifier = oldClientCertIdentifier};
+    if (CertRotation_Init(eventLoop, rotationSlots, 2, RotationOutcomeHandler, NULL) != 0) {
+        Log_Debug("ERROR: Could not initialize certificate rotation: %s (%d).\n", strerror(errno),
+                  errno);
+        return ExitCode_Init_CertRotation;
     }
 
     return ExitCode_Success;
@@ -606,7 +695,9 @@ static void CloseFdAndPrintError(int fd, const char *fdName)
 /// </summary>
 static void ClosePeripheralsAndHandlers(void)
 {
-    DisposeEventLoopTimer(buttonPollTimer);
+    ButtonInput_Dispose(buttons);
+    CertRotation_Cleanup();
+    CertIndex_Cleanup();
     EventLoop_Close(eventLoop);
 
     Log_Debug("\nClosing file descriptors.\n");
@@ -617,8 +708,8 @@ int main(void)
 {
     Log_Debug("Cert application starting.\n");
     Log_Debug(
-        "Each press of BUTTON_1 will advance through a cycle that installs, moves certificates, "
-        "reloads the Wi-Fi network and deletes the certificates.\n");
+        "Each press of BUTTON_1 will advance through a cycle that installs certificates, stages "
+        "new certificates, rotates them into use and deletes the certificates.\n");
     Log_Debug(
         "BUTTON_2 displays the available space on the device, lists the installed certificates, "
         "and displays specific information about each certificate.\n");
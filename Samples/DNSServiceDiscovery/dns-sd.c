@@ -6,15 +6,94 @@
 #include <errno.h>
 #include <resolv.h>
 #include <stdbool.h>
-#include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <time.h>
 
 #define DNS_SERVER_PORT 53
 #define QUERY_BUF_SIZE 2048u
 #define ANSWER_BUF_SIZE 2048u
-#define DISPLAY_BUF_SIZE 256u
+#define NAME_BUF_SIZE (DNS_SD_MAX_NAME_LENGTH + 1)
 
-int SendDnsQuery(const char *dName, int class, int type, int fd)
+// Size of the DNS message header, and of the type, class, TTL and RDATA length fields which follow
+// the name of a resource record.
+#define HEADER_SIZE 12
+#define RECORD_FIXED_SIZE 10
+#define QUESTION_FIXED_SIZE 4
+
+// Maximum number of queries which are tracked while waiting for their answers.
+#define MAX_PENDING_QUERIES 16
+// Time after which an unanswered query may be sent again, in seconds.
+#define QUERY_TIMEOUT_SECONDS 2
+
+// A query which has been sent and not yet answered. A query for the address of a host records the
+// instance whose SRV record named the host, so that the answer can be added to its details.
+typedef struct {
+    bool used;
+    uint16_t id;
+    int type;
+    time_t sentTime;
+    char name[NAME_BUF_SIZE];
+    char instanceName[NAME_BUF_SIZE];
+} PendingQuery;
+
+static PendingQuery pendingQueries[MAX_PENDING_QUERIES];
+static uint16_t lastQueryId = 0;
+static bool resolverInitialized = false;
+
+static time_t MonotonicSeconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec;
+}
+
+static PendingQuery *FindPendingQuery(int type, const char *name)
+{
+    for (size_t i = 0; i < MAX_PENDING_QUERIES; ++i) {
+        if (pendingQueries[i].used && pendingQueries[i].type == type &&
+            strcasecmp(pendingQueries[i].name, name) == 0) {
+            return &pendingQueries[i];
+        }
+    }
+    return NULL;
+}
+
+static PendingQuery *AllocatePendingQuery(void)
+{
+    // If every entry is in use, reuse the oldest. Answers are also matched by name, so the answer
+    // to its query is still processed.
+    time_t now = MonotonicSeconds();
+    PendingQuery *oldest = &pendingQueries[0];
+    for (size_t i = 0; i < MAX_PENDING_QUERIES; ++i) {
+        if (!pendingQueries[i].used || now - pendingQueries[i].sentTime >= QUERY_TIMEOUT_SECONDS) {
+            return &pendingQueries[i];
+        }
+        if (pendingQueries[i].sentTime < oldest->sentTime) {
+            oldest = &pendingQueries[i];
+        }
+    }
+    return oldest;
+}
+
+static void RetirePendingQuery(int type, const char *name)
+{
+    PendingQuery *pending = FindPendingQuery(type, name);
+    if (pending) {
+        pending->used = false;
+    }
+}
+
+static void RetirePendingQueryById(uint16_t id)
+{
+    for (size_t i = 0; i < MAX_PENDING_QUERIES; ++i) {
+        if (pendingQueries[i].used && pendingQueries[i].id == id) {
+            pendingQueries[i].used = false;
+        }
+    }
+}
+
+static int SendDnsQuery(const char *dName, int class, int type, const char *instanceName, int fd)
 {
     char queryBuf[QUERY_BUF_SIZE];
     if (!dName) {
@@ -22,13 +101,28 @@ int SendDnsQuery(const char *dName, int class, int type, int fd)
         errno = EINVAL;
         return -1;
     }
-
-    // Construct the DNS query to send
-    int ret = res_init();
-    if (ret) {
-        Log_Debug("ERROR: res_init: %d (%s)\n", errno, strerror(errno));
+    if (strlen(dName) >= NAME_BUF_SIZE ||
+        (instanceName && strlen(instanceName) >= NAME_BUF_SIZE)) {
+        Log_Debug("ERROR: Can't send DNS query as the domain name is too long.\n");
+        errno = ENAMETOOLONG;
         return -1;
     }
+
+    // Don't send a query again while it is waiting for its answer.
+    PendingQuery *pending = FindPendingQuery(type, dName);
+    if (pending && MonotonicSeconds() - pending->sentTime < QUERY_TIMEOUT_SECONDS) {
+        return 0;
+    }
+
+    // Construct the DNS query to send. The resolver only needs to be initialized once.
+    if (!resolverInitialized) {
+        int ret = res_init();
+        if (ret) {
+            Log_Debug("ERROR: res_init: %d (%s)\n", errno, strerror(errno));
+            return -1;
+        }
+        resolverInitialized = true;
+    }
     int messageSize =
         res_mkquery(ns_o_query, dName, class, type, NULL, 0, NULL, queryBuf, QUERY_BUF_SIZE);
     if (messageSize <= 0) {
@@ -36,6 +130,12 @@ int SendDnsQuery(const char *dName, int class, int type, int fd)
         return -1;
     }
 
+    // Give each query its own ID, so that the response which answers it can be identified.
+    if (++lastQueryId == 0) {
+        lastQueryId = 1;
+    }
+    ns_put16(lastQueryId, (unsigned char *)queryBuf);
+
     // Send the constructed DNS query
     struct sockaddr_in si;
     memset(&si, 0, sizeof(si));
@@ -45,162 +145,293 @@ int SendDnsQuery(const char *dName, int class, int type, int fd)
     // This will most likely be replaced in a future release, causing a breaking change for
     // applications that rely on it.
     si.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
-    ret = sendto(fd, queryBuf, (size_t)messageSize, 0, (struct sockaddr *)&si, sizeof(si));
+    ssize_t ret = sendto(fd, queryBuf, (size_t)messageSize, 0, (struct sockaddr *)&si, sizeof(si));
     if (ret == -1) {
         Log_Debug("ERROR: sendto: %d (%s)\n", errno, strerror(errno));
         return -1;
     }
 
+    if (!pending) {
+        pending = AllocatePendingQuery();
+    }
+    pending->used = true;
+    pending->id = lastQueryId;
+    pending->type = type;
+    pending->sentTime = MonotonicSeconds();
+    strcpy(pending->name, dName);
+    strcpy(pending->instanceName, instanceName ? instanceName : "");
     return 0;
 }
 
 int SendServiceDiscoveryQuery(const char *dName, int fd)
 {
-    return SendDnsQuery(dName, ns_c_in, ns_t_ptr, fd);
+    return SendDnsQuery(dName, ns_c_in, ns_t_ptr, NULL, fd);
 }
 
 int SendServiceInstanceDetailsQuery(const char *instanceName, int fd)
 {
-    return SendDnsQuery(instanceName, ns_c_in, ns_t_any, fd);
+    return SendServiceInstanceDetailsQueries(&instanceName, 1, fd);
 }
 
-int ProcessMessageBySection(char *buf, ssize_t len, ns_msg msg, ns_sect section,
-                            ServiceInstanceDetails **instanceDetails)
+int SendServiceInstanceDetailsQueries(const char *const *instanceNames, size_t count, int fd)
 {
-    char displayBuf[DISPLAY_BUF_SIZE];
-    ns_rr rr;
-    int messageCount = ns_msg_count(msg, section);
+    // Send all the queries without waiting for any answers, so that they are answered in the same
+    // round trip. The address of each host is queried when its SRV record arrives, if the record
+    // is not accompanied by an A record.
+    int result = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (SendDnsQuery(instanceNames[i], ns_c_in, ns_t_srv, instanceNames[i], fd) != 0) {
+            result = -1;
+        }
+        if (SendDnsQuery(instanceNames[i], ns_c_in, ns_t_txt, instanceNames[i], fd) != 0) {
+            result = -1;
+        }
+    }
+    return result;
+}
+
+// A resource record which has been parsed in place from a response; rdata points into the
+// response.
+typedef struct {
+    char name[NAME_BUF_SIZE];
+    uint16_t type;
+    uint32_t ttl;
+    uint16_t rdLength;
+    const unsigned char *rdata;
+} Record;
 
-    if (!(*instanceDetails)) {
-        // Allocate for ServiceInstanceDetails and initialize its members.
-        *instanceDetails = malloc(sizeof(ServiceInstanceDetails));
-        if (!(*instanceDetails)) {
-            Log_Debug("ERROR: recvfrom: %d (%s)\n", errno, strerror(errno));
+// The instances which are found in a response, in storage provided by the caller.
+typedef struct {
+    const unsigned char *message;
+    const unsigned char *end;
+    ServiceInstanceDetails *instances;
+    size_t maxInstances;
+    size_t count;
+} Response;
+
+// Reads the record at *cursor, and advances *cursor past it. If the owner name is too long to be
+// expanded, the record is skipped and its name is left empty.
+static int ParseRecord(const Response *response, const unsigned char **cursor, Record *record)
+{
+    int nameLength =
+        dn_expand(response->message, response->end, *cursor, record->name, sizeof(record->name));
+    if (nameLength < 0) {
+        nameLength = dn_skipname(*cursor, response->end);
+        if (nameLength < 0) {
             return -1;
         }
-        (*instanceDetails)->name = NULL;
-        (*instanceDetails)->host = NULL;
-        (*instanceDetails)->ipv4Address.s_addr = INADDR_NONE;
-        (*instanceDetails)->txtData = NULL;
-        (*instanceDetails)->txtDataLength = 0;
+        record->name[0] = '\0';
     }
 
-    // Parse each message
-    for (int i = 0; i < messageCount; ++i) {
-        if (ns_parserr(&msg, section, i, &rr)) {
-            Log_Debug("ERROR: ns_parserr: %d (%s)\n", errno, strerror(errno));
-            return -1;
+    const unsigned char *fields = *cursor + nameLength;
+    if (response->end - fields < RECORD_FIXED_SIZE) {
+        return -1;
+    }
+    record->type = (uint16_t)ns_get16(fields);
+    record->ttl = (uint32_t)ns_get32(fields + 4);
+    record->rdLength = (uint16_t)ns_get16(fields + 8);
+    record->rdata = fields + RECORD_FIXED_SIZE;
+    if (response->end - record->rdata < record->rdLength) {
+        return -1;
+    }
+
+    *cursor = record->rdata + record->rdLength;
+    return 0;
+}
+
+// Expands a domain name which is in the RDATA of a record. Returns false if it is malformed, does
+// not fit in the record, or is too long.
+static bool ExpandRdataName(const Response *response, const Record *record,
+                            const unsigned char *name, char *buf)
+{
+    int length = dn_expand(response->message, response->end, name, buf, NAME_BUF_SIZE);
+    return length > 0 && name + length <= record->rdata + record->rdLength;
+}
+
+// Finds the details of an instance in the response, or adds them if there is room.
+static ServiceInstanceDetails *GetInstanceDetails(Response *response, const char *name)
+{
+    for (size_t i = 0; i < response->count; ++i) {
+        if (strcasecmp(response->instances[i].name, name) == 0) {
+            return &response->instances[i];
         }
-        switch (ns_rr_type(rr)) {
-        case ns_t_ptr: {
-            int compressedNameLength =
-                dn_expand(buf, buf + len, ns_rr_rdata(rr), displayBuf, sizeof(displayBuf));
-            if (compressedNameLength > 0 && !(*instanceDetails)->name) {
-                (*instanceDetails)->name = strdup(displayBuf);
-                if (!(*instanceDetails)->name) {
-                    Log_Debug("ERROR: strdup for instance name failed: %d (%s)\n", errno,
-                              strerror(errno));
-                    return -1;
-                }
-            }
-            break;
-        }
-        case ns_t_srv: {
-            // Parse the SRV record and populate the port and host fields in instance details as per
-            // DNS SRV record specification: https://tools.ietf.org/rfc/rfc2782.txt
-            // SRV record format: Priority|  Weight |   Port  |     Target
-            //                   (2 Bytes)|(2 Bytes)|(2 Bytes)|(Remaining Bytes)
-            const char *data = ns_rr_rdata(rr);
-            (*instanceDetails)->port =
-                (uint16_t)ns_get16(data + sizeof(uint16_t) + sizeof(uint16_t));
-            int compressedTargetDomainNameLength = dn_expand(
-                buf, buf + len, data + sizeof(uint16_t) + sizeof(uint16_t) + sizeof(uint16_t),
-                displayBuf, sizeof(displayBuf));
-            if (compressedTargetDomainNameLength > 0 && !(*instanceDetails)->host) {
-                (*instanceDetails)->host = strdup(displayBuf);
-                if (!(*instanceDetails)->host) {
-                    Log_Debug("ERROR: strdup: %d (%s)\n", errno, strerror(errno));
-                    return -1;
-                }
-            }
-            break;
-        }
-        case ns_t_txt: {
-            // Populate name field in instance details if it hasn't been set
-            if (!(*instanceDetails)->name) {
-                (*instanceDetails)->name = strdup(ns_rr_name(rr));
-                if (!(*instanceDetails)->name) {
-                    Log_Debug("ERROR: strdup(ns_rr_name(rr)): %d (%s)\n", errno, strerror(errno));
-                    return -1;
-                }
-            }
+    }
+
+    if (response->count == response->maxInstances) {
+        Log_Debug("INFO: Ignoring instance %s; the response has too many instances.\n", name);
+        return NULL;
+    }
+
+    ServiceInstanceDetails *details = &response->instances[response->count++];
+    memset(details, 0, sizeof(ServiceInstanceDetails));
+    details->ipv4Address.s_addr = INADDR_NONE;
+    strcpy(details->name, name);
+    return details;
+}
+
+static void ProcessAddressRecord(Response *response, const Record *record)
+{
+    if (record->rdLength != sizeof(struct in_addr)) {
+        Log_Debug("ERROR: Invalid DNS A record length: %d\n", record->rdLength);
+        return;
+    }
+
+    // Add the address to each instance on the host. If none is in this response, the address
+    // answers a query which was sent for an instance's host.
+    bool found = false;
+    for (size_t i = 0; i < response->count; ++i) {
+        ServiceInstanceDetails *details = &response->instances[i];
+        if (details->hasSrv && strcasecmp(details->host, record->name) == 0) {
+            memcpy(&details->ipv4Address.s_addr, record->rdata, record->rdLength);
+            details->aTtl = record->ttl;
+            found = true;
+        }
+    }
+
+    PendingQuery *pending = FindPendingQuery(ns_t_a, record->name);
+    if (!found && pending && pending->instanceName[0]) {
+        ServiceInstanceDetails *details = GetInstanceDetails(response, pending->instanceName);
+        if (details) {
+            memcpy(&details->ipv4Address.s_addr, record->rdata, record->rdLength);
+            details->aTtl = record->ttl;
+        }
+    }
+    RetirePendingQuery(ns_t_a, record->name);
+}
+
+static void ProcessRecord(Response *response, const Record *record)
+{
+    char nameBuf[NAME_BUF_SIZE];
+    ServiceInstanceDetails *details;
 
-            // Get TXT record, populate txtData and txtDataLength fields in instance details
-            if (!(*instanceDetails)->txtData) {
-                (*instanceDetails)->txtData =
-                    malloc(sizeof(unsigned char) * (size_t)(ns_rr_rdlen(rr)));
-                if (!(*instanceDetails)->txtData) {
-                    Log_Debug("ERROR: malloc: %d (%s)\n", errno, strerror(errno));
-                    return -1;
-                }
-                memcpy((*instanceDetails)->txtData, ns_rr_rdata(rr), ns_rr_rdlen(rr));
-                (*instanceDetails)->txtDataLength = ns_rr_rdlen(rr);
+    switch (record->type) {
+    case ns_t_ptr:
+        // The RDATA of a PTR record is the instance name.
+        if (ExpandRdataName(response, record, record->rdata, nameBuf)) {
+            details = GetInstanceDetails(response, nameBuf);
+            if (details) {
+                details->hasPtr = true;
+                details->ptrTtl = record->ttl;
             }
-            break;
-        }
-        case ns_t_a: {
-            // Get A record (host address), populate ipv4Address field in instance details
-            if (ns_rr_rdlen(rr) == sizeof((*instanceDetails)->ipv4Address)) {
-                memcpy(&(*instanceDetails)->ipv4Address.s_addr, ns_rr_rdata(rr), ns_rr_rdlen(rr));
-            } else {
-                Log_Debug("ERROR: Invalid DNS A record length: %d\n", ns_rr_rdlen(rr));
+        }
+        RetirePendingQuery(ns_t_ptr, record->name);
+        break;
+    case ns_t_srv:
+        // Parse the SRV record and populate the port and host fields in instance details as per
+        // DNS SRV record specification: https://tools.ietf.org/rfc/rfc2782.txt
+        // SRV record format: Priority|  Weight |   Port  |     Target
+        //                   (2 Bytes)|(2 Bytes)|(2 Bytes)|(Remaining Bytes)
+        if (record->rdLength > 3 * sizeof(uint16_t) &&
+            ExpandRdataName(response, record, record->rdata + 3 * sizeof(uint16_t), nameBuf)) {
+            details = GetInstanceDetails(response, record->name);
+            if (details && !details->hasSrv) {
+                details->hasSrv = true;
+                details->port = (uint16_t)ns_get16(record->rdata + 2 * sizeof(uint16_t));
+                strcpy(details->host, nameBuf);
+                details->srvTtl = record->ttl;
             }
-            break;
         }
-        default:
-            break;
+        RetirePendingQuery(ns_t_srv, record->name);
+        break;
+    case ns_t_txt:
+        // Get TXT record, populate txtData and txtDataLength fields in instance details. Data
+        // which does not fit is truncated.
+        details = GetInstanceDetails(response, record->name);
+        if (details && !details->hasTxt) {
+            details->hasTxt = true;
+            details->txtDataLength = record->rdLength < DNS_SD_MAX_TXT_LENGTH
+                                         ? record->rdLength
+                                         : DNS_SD_MAX_TXT_LENGTH;
+            memcpy(details->txtData, record->rdata, details->txtDataLength);
+            details->txtTtl = record->ttl;
         }
+        RetirePendingQuery(ns_t_txt, record->name);
+        break;
+    case ns_t_a:
+        // Get A record (host address), populate ipv4Address field in instance details
+        ProcessAddressRecord(response, record);
+        break;
+    default:
+        break;
+    }
+}
+
+// Processes the records in the answer and additional sections. If addresses is true, only A
+// records are processed; otherwise, only other records are.
+static int ProcessRecords(Response *response, bool addresses)
+{
+    const unsigned char *cursor = response->message + HEADER_SIZE;
+    unsigned int questionCount = ns_get16(response->message + 4);
+    unsigned int answerCount = ns_get16(response->message + 6);
+    unsigned int authorityCount = ns_get16(response->message + 8);
+    unsigned int additionalCount = ns_get16(response->message + 10);
+
+    for (unsigned int i = 0; i < questionCount; ++i) {
+        int nameLength = dn_skipname(cursor, response->end);
+        if (nameLength < 0 || response->end - (cursor + nameLength) < QUESTION_FIXED_SIZE) {
+            return -1;
+        }
+        cursor += nameLength + QUESTION_FIXED_SIZE;
+    }
+
+    Record record;
+    for (unsigned int i = 0; i < answerCount + authorityCount + additionalCount; ++i) {
+        if (ParseRecord(response, &cursor, &record) != 0) {
+            Log_Debug("ERROR: Malformed DNS record in response.\n");
+            return -1;
+        }
+        bool authority = i >= answerCount && i < answerCount + authorityCount;
+        if (authority || record.name[0] == '\0' || addresses != (record.type == ns_t_a)) {
+            continue;
+        }
+        ProcessRecord(response, &record);
     }
     return 0;
 }
 
-int ProcessDnsResponse(int fd, ServiceInstanceDetails **instanceDetails)
+int ProcessDnsResponse(int fd, ServiceInstanceDetails *instances, size_t maxInstances,
+                       size_t *count)
 {
-    char answerBuf[ANSWER_BUF_SIZE];
-    ns_msg msg;
+    unsigned char answerBuf[ANSWER_BUF_SIZE];
     struct sockaddr_in socketAddress;
     socklen_t addrLength = sizeof(socketAddress);
+    *count = 0;
     ssize_t len =
         recvfrom(fd, answerBuf, ANSWER_BUF_SIZE, 0, (struct sockaddr *)&socketAddress, &addrLength);
     if (len == -1) {
         Log_Debug("ERROR: recvfrom: %d (%s)\n", errno, strerror(errno));
         return -1;
     }
+    if (len < HEADER_SIZE) {
+        Log_Debug("ERROR: DNS response is too short: %zd bytes\n", len);
+        return -1;
+    }
 
-    // Decode received response
-    if (ns_initparse(answerBuf, len, &msg) != 0) {
-        goto fail;
+    // Decode received response in place. Addresses are processed once the SRV records, which name
+    // the hosts, have been.
+    Response response = {.message = answerBuf,
+                         .end = answerBuf + len,
+                         .instances = instances,
+                         .maxInstances = maxInstances,
+                         .count = 0};
+    if (ProcessRecords(&response, false) != 0 || ProcessRecords(&response, true) != 0) {
+        return -1;
     }
-    if (ProcessMessageBySection(answerBuf, len, msg, ns_s_an, instanceDetails) != 0) {
-        goto fail;
+
+    // mDNS responders may set the ID of a response to 0, in which case the answers identify the
+    // queries which it answers.
+    uint16_t id = (uint16_t)ns_get16(answerBuf);
+    if (id != 0) {
+        RetirePendingQueryById(id);
     }
-    if (ProcessMessageBySection(answerBuf, len, msg, ns_s_ar, instanceDetails) != 0) {
-        goto fail;
+
+    // Query for the address of each host which the response named without giving its address.
+    for (size_t i = 0; i < response.count; ++i) {
+        if (instances[i].hasSrv && instances[i].ipv4Address.s_addr == INADDR_NONE) {
+            SendDnsQuery(instances[i].host, ns_c_in, ns_t_a, instances[i].name, fd);
+        }
     }
-    return 0;
 
-fail:
-    FreeServiceInstanceDetails(*instanceDetails);
-    *instanceDetails = NULL;
-    return -1;
+    *count = response.count;
+    return 0;
 }
-
-void FreeServiceInstanceDetails(const ServiceInstanceDetails *details)
-{
-    if (details) {
-        free(details->name);
-        free(details->host);
-        free(details->txtData);
-        free((void *)details);
-    }
-}
\ No newline at end of file
@@ -2,28 +2,50 @@
    Licensed under the MIT License. */
 
 #pragma once
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <netinet/in.h>
 
+/// <summary>Maximum length of an instance name or host name, excluding the null
+/// terminator.</summary>
+#define DNS_SD_MAX_NAME_LENGTH 255
+
+/// <summary>Maximum length of the TXT data of an instance which is kept; longer data is
+/// truncated.</summary>
+#define DNS_SD_MAX_TXT_LENGTH 256
+
 /// <summary>
 /// Data structure for a DNS instance details.
-/// This should be created with <see cref="ProcessServiceInstanceDetailsResponse"/> and freed with
-/// <see cref="FreeServiceInstanceDetails"/>.
+/// This is filled in by <see cref="ProcessDnsResponse"/>, in storage which the caller provides.
 /// </summary>
 typedef struct {
     /// <summary>Service instance name</summary>
-    char *name;
+    char name[DNS_SD_MAX_NAME_LENGTH + 1];
+    /// <summary>Whether the response contained an SRV record, which sets host and port</summary>
+    bool hasSrv;
     /// <summary>Service host name</summary>
-    char *host;
-    /// <summary>IPv4 address</summary>
+    char host[DNS_SD_MAX_NAME_LENGTH + 1];
+    /// <summary>IPv4 address, or INADDR_NONE if the response did not contain it</summary>
     struct in_addr ipv4Address;
     /// <summary>Network port</summary>
     uint16_t port;
+    /// <summary>Whether the response contained a TXT record, which sets txtData</summary>
+    bool hasTxt;
     /// <summary>DNS TXT data</summary>
-    char *txtData;
+    char txtData[DNS_SD_MAX_TXT_LENGTH];
     /// <summary>DNS TXT data length</summary>
     uint16_t txtDataLength;
+    /// <summary>Whether the response contained a PTR record for the instance</summary>
+    bool hasPtr;
+    /// <summary>TTL of the PTR record in seconds; 0 means that the instance has gone</summary>
+    uint32_t ptrTtl;
+    /// <summary>TTL of the SRV record in seconds, if hasSrv is set</summary>
+    uint32_t srvTtl;
+    /// <summary>TTL of the TXT record in seconds, if hasTxt is set</summary>
+    uint32_t txtTtl;
+    /// <summary>TTL of the A record in seconds, if ipv4Address is set</summary>
+    uint32_t aTtl;
 } ServiceInstanceDetails;
 
 /// <summary>
@@ -43,15 +65,25 @@ int SendServiceDiscoveryQuery(const char *svcName, int fd);
 int SendServiceInstanceDetailsQuery(const char *instanceName, int fd);
 
 /// <summary>
-/// Process pending data from a service discovery request
+/// Send SRV and TXT queries for several service instances at once, without waiting for the
+/// answers. Queries which are still waiting for their answers are not sent again.
 /// </summary>
-/// <param name="fd">The socket file descriptor to receive the DNS response from</param>
-/// <param name="instanceDetails">The instance details if it is available in the response</param>
-/// <returns>0 if succeeded, -1 if an error occurred.</returns>
-int ProcessDnsResponse(int fd, ServiceInstanceDetails **instanceDetails);
+/// <param name="instanceNames">The instance names to query details for</param>
+/// <param name="count">The number of instance names</param>
+/// <param name="fd">The socket file descriptor to send the DNS queries to</param>
+/// <returns>0 if succeeded, -1 if an error occurred for any of the queries.</returns>
+int SendServiceInstanceDetailsQueries(const char *const *instanceNames, size_t count, int fd);
 
 /// <summary>
-/// Free memory used by a ServiceInstanceDetails
+/// Process pending data from a service discovery request. The response is parsed in place, without
+/// allocating memory. If the response gives the host of an instance but not its address, an A
+/// query for the host is sent, and its answer is returned as details of the instance.
 /// </summary>
-/// <param name="instance">The ServiceInstanceDetails struct to free</param>
-void FreeServiceInstanceDetails(const ServiceInstanceDetails *instance);
\ No newline at end of file
+/// <param name="fd">The socket file descriptor to receive the DNS response from</param>
+/// <param name="instances">Storage for the details of each instance in the response</param>
+/// <param name="maxInstances">The number of elements in instances; further instances in the
+/// response are ignored</param>
+/// <param name="count">Receives the number of instances in the response</param>
+/// <returns>0 if succeeded, -1 if an error occurred.</returns>
+int ProcessDnsResponse(int fd, ServiceInstanceDetails *instances, size_t maxInstances,
+                       size_t *count);
\ No newline at end of file
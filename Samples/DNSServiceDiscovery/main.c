@@ -7,7 +7,7 @@
 // It uses the API for the following Azure Sphere application libraries:
 // - log (messages shown in Visual Studio's Device Output window during debugging)
 // - networking (get network interface connection status)
-// - eventloop (system invokes handlers for timer events)
+// - eventloop (system invokes handlers for timer events and IO callbacks)
 
 #include <errno.h>
 #include <signal.h>
@@ -19,6 +19,8 @@
 
 #include "dns-sd.h"
 #include "eventloop_timer_utilities.h"
+#include "network_state.h"
+#include "service_cache.h"
 
 /// <summary>
 /// Exit codes for this application. These are used for the
@@ -30,23 +32,22 @@ typedef enum {
 
     ExitCode_TermHandler_SigTerm = 1,
 
-    ExitCode_ConnectionTimer_Consume = 2,
-    ExitCode_ConnectionTimer_ConnectionReady = 3,
-    ExitCode_ConnectionTimer_Disarm = 4,
+    ExitCode_NetworkState_Status = 3,
+    ExitCode_NetworkState_RegisterIo = 4,
 
     ExitCode_Init_EventLoop = 5,
     ExitCode_Init_Socket = 6,
-    ExitCode_Init_ConnectionTimer = 7,
+    ExitCode_Init_NetworkState = 7,
 
-    ExitCode_Main_EventLoopFail = 8
+    ExitCode_Main_EventLoopFail = 8,
+
+    ExitCode_Init_ServiceCache = 9
 } ExitCode;
 
 // File descriptors - initialized to invalid value
 static int dnsSocketFd = -1;
-static bool isNetworkStackReady = false;
 
 static EventLoop *eventLoop = NULL;
-static EventLoopTimer *connectionTimer = NULL;
 static EventRegistration *dnsEventReg = NULL;
 
 // If using DNS in an internet-connected network, consider setting the desired status to be
@@ -56,13 +57,20 @@ static const Networking_InterfaceConnectionStatus RequiredNetworkStatus =
 static const char NetworkInterface[] = "wlan0";
 static const char DnsServiceDiscoveryServer[] = "_sample-service._tcp.local";
 
+// Storage for the instances in a DNS response, which is reused for each response.
+#define MAX_INSTANCES_PER_RESPONSE 8
+static ServiceInstanceDetails responseInstances[MAX_INSTANCES_PER_RESPONSE];
+
 // Termination state
 static volatile sig_atomic_t exitCode = ExitCode_Success;
 
 static void TerminationHandler(int signalNumber);
 static void HandleReceivedDnsDiscoveryResponse(EventLoop *el, int fd, EventLoop_IoEvents events,
                                                void *context);
-static void ConnectionTimerEventHandler(EventLoopTimer *timer);
+static void ServiceInstanceChangedHandler(ServiceCache_Change change,
+                                          const ServiceCache_Instance *instance, void *context);
+static void NetworkStateChangedHandler(Networking_InterfaceConnectionStatus status, void *context);
+static void NetworkStateErrorHandler(void *context);
 static ExitCode InitializeAndStartDnsServiceDiscovery(void);
 static void CloseFdAndPrintError(int fd, const char *fdName);
 static void Cleanup(void);
@@ -87,91 +95,70 @@ static void TerminationHandler(int signalNumber)
 static void HandleReceivedDnsDiscoveryResponse(EventLoop *el, int fd, EventLoop_IoEvents events,
                                                void *context)
 {
-    // Read received DNS response over socket.
-    // Process received response, if it contains PRT message, but no SRV or TXT message, send
-    // instance details request for each PTR instance. Otherwise, get the instance details.
-    ServiceInstanceDetails *details = NULL;
-    int result = ProcessDnsResponse(dnsSocketFd, &details);
+    // Read received DNS response over socket, and add its records to the service cache. For the
+    // instances in PTR records whose SRV and TXT records aren't known, the cache sends one batch of
+    // instance details requests, and it notifies ServiceInstanceChangedHandler as the details
+    // arrive.
+    size_t count;
+    int result =
+        ProcessDnsResponse(dnsSocketFd, responseInstances, MAX_INSTANCES_PER_RESPONSE, &count);
     if (result != 0) {
-        goto fail;
-    }
-
-    if (details && details->name) {
-        Log_Debug("INFO: DNS Service Discovery has found a instance: %s.\n", details->name);
-        if (!details->host) {
-            Log_Debug("INFO: Requesting SRV and TXT details for the instance.\n");
-            SendServiceInstanceDetailsQuery(details->name, dnsSocketFd);
-        } else {
-            // NOTE: The TXT data is simply treated as a string and isn't parsed here. You should
-            // replace this with your own production logic.
-            Log_Debug("\tName: %s\n\tHost: %s\n\tIPv4 Address: %s\n\tPort: %hd\n\tTXT Data: %.*s\n",
-                      details->name, details->host, inet_ntoa(details->ipv4Address), details->port,
-                      details->txtDataLength, details->txtData);
-        }
+        return;
     }
 
-fail:
-    FreeServiceInstanceDetails(details);
+    ServiceCache_Update(responseInstances, count);
 }
 
 /// <summary>
-///     Check whether the required network connection status has been met.
+///     Called when the service cache finds a service instance, when the details of an instance
+///     change, or when an instance is removed because it has gone or its records have expired.
 /// </summary>
-/// <param name="interface">The network interface to perform the check on.</param>
-/// <param name="ipAddressAvailable">The result of the connection status check.</param>
-/// <returns>0 on success, or -1 on failure.</returns>
-int IsConnectionReady(const char *interface, bool *ipAddressAvailable)
+static void ServiceInstanceChangedHandler(ServiceCache_Change change,
+                                          const ServiceCache_Instance *instance, void *context)
 {
-    Networking_InterfaceConnectionStatus status;
-    if (Networking_GetInterfaceConnectionStatus(interface, &status) == 0) {
-        Log_Debug("INFO: Network interface %s status: 0x%02x\n", interface, status);
-        isNetworkStackReady = true;
-    } else {
-        if (errno == EAGAIN) {
-            Log_Debug("INFO: The networking stack isn't ready yet, will try again later.\n");
-            return 0;
-        } else {
-            Log_Debug("ERROR: Networking_GetInterfaceConnectionStatus: %d (%s)\n", errno,
-                      strerror(errno));
-            return -1;
-        }
+    if (change == ServiceCache_Change_Removed) {
+        Log_Debug("INFO: DNS Service Discovery has lost an instance: %s.\n", instance->name);
+        return;
+    }
+
+    if (change == ServiceCache_Change_Added) {
+        Log_Debug("INFO: DNS Service Discovery has found an instance: %s.\n", instance->name);
+    }
+
+    if (instance->resolved) {
+        // NOTE: The TXT data is simply treated as a string and isn't parsed here. You should
+        // replace this with your own production logic.
+        Log_Debug("\tName: %s\n\tHost: %s\n\tIPv4 Address: %s\n\tPort: %hd\n\tTXT Data: %.*s\n",
+                  instance->name, instance->host, inet_ntoa(instance->ipv4Address), instance->port,
+                  instance->txtDataLength, instance->txtData);
     }
-    *ipAddressAvailable = (status & RequiredNetworkStatus) != 0;
-    return 0;
 }
 
 /// <summary>
-///     The timer event handler to check whether network connection is ready.
+///     Called when the connection status of the interface changes. Once the required status has
+///     been met, registers the DNS response handler, then starts browsing for the service.
 /// </summary>
-static void ConnectionTimerEventHandler(EventLoopTimer *timer)
+static void NetworkStateChangedHandler(Networking_InterfaceConnectionStatus status, void *context)
 {
-    if (ConsumeEventLoopTimerEvent(timer) != 0) {
-        exitCode = ExitCode_ConnectionTimer_Consume;
+    if ((status & RequiredNetworkStatus) == 0 || dnsEventReg != NULL) {
         return;
     }
 
-    // Check whether the network connection is ready.
-    bool isConnectionReady = false;
-    if (IsConnectionReady(NetworkInterface, &isConnectionReady) != 0) {
-        exitCode = ExitCode_ConnectionTimer_ConnectionReady;
-    } else if (isConnectionReady) {
-        // Connection is ready, unregister the connection event handler. Register DNS response
-        // handler, then start DNS service discovery.
-        bool success = false;
-        if (DisarmEventLoopTimer(connectionTimer) == 0) {
-            dnsEventReg = EventLoop_RegisterIo(eventLoop, dnsSocketFd, EventLoop_Input,
-                                               &HandleReceivedDnsDiscoveryResponse,
-                                               /* context */ NULL);
-
-            success = (dnsEventReg != NULL);
-        }
-
-        if (!success) {
-            exitCode = ExitCode_ConnectionTimer_Disarm;
-            return;
-        }
-        SendServiceDiscoveryQuery(DnsServiceDiscoveryServer, dnsSocketFd);
+    dnsEventReg = EventLoop_RegisterIo(eventLoop, dnsSocketFd, EventLoop_Input,
+                                       &HandleReceivedDnsDiscoveryResponse, /* context */ NULL);
+    if (dnsEventReg == NULL) {
+        exitCode = ExitCode_NetworkState_RegisterIo;
+        return;
     }
+    ServiceCache_StartBrowsing();
+}
+
+/// <summary>
+///     Called when the connection status of the interface cannot be read.
+/// </summary>
+static void NetworkStateErrorHandler(void *context)
+{
+    exitCode = ExitCode_NetworkState_Status;
 }
 
 /// <summary>
@@ -200,12 +187,16 @@ static ExitCode InitializeAndStartDnsServiceDiscovery(void)
         return ExitCode_Init_Socket;
     }
 
-    // Check network interface status at the specified period until it is ready.
-    static const struct timespec checkInterval = {.tv_sec = 1, .tv_nsec = 0};
-    connectionTimer =
-        CreateEventLoopPeriodicTimer(eventLoop, &ConnectionTimerEventHandler, &checkInterval);
-    if (connectionTimer == NULL) {
-        return ExitCode_Init_ConnectionTimer;
+    if (ServiceCache_Init(eventLoop, dnsSocketFd, DnsServiceDiscoveryServer,
+                          ServiceInstanceChangedHandler, NULL) != 0) {
+        Log_Debug("ERROR: Could not initialize service cache: %s (%d)\n", strerror(errno), errno);
+        return ExitCode_Init_ServiceCache;
+    }
+
+    // Start the discovery as soon as the network interface is ready.
+    if (NetworkState_Start(eventLoop, NetworkInterface, NetworkStateErrorHandler, NULL) != 0 ||
+        NetworkState_Subscribe(NetworkStateChangedHandler, NULL) != 0) {
+        return ExitCode_Init_NetworkState;
     }
 
     return ExitCode_Success;
@@ -231,7 +222,8 @@ static void CloseFdAndPrintError(int fd, const char *fdName)
 /// </summary>
 static void Cleanup(void)
 {
-    DisposeEventLoopTimer(connectionTimer);
+    NetworkState_Stop();
+    ServiceCache_Cleanup();
     EventLoop_UnregisterIo(eventLoop, dnsEventReg);
     EventLoop_Close(eventLoop);
 
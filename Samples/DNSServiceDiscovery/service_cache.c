@@ -0,0 +1,379 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#include <applibs/log.h>
+
+#include "eventloop_timer_utilities.h"
+#include "service_cache.h"
+
+// Number of queries which are sent for a record before it expires, at 80% and 90% of its TTL.
+#define REFRESH_QUERIES 2
+
+// When a set of records was received, and how many refresh queries have been sent for it.
+typedef struct {
+    bool valid;
+    int64_t receivedMs;
+    uint32_t ttlSeconds;
+    unsigned int refreshesSent;
+} Lifetime;
+
+typedef struct {
+    bool used;
+    ServiceCache_Instance instance;
+    // The PTR record, which says that the instance exists.
+    Lifetime ptr;
+    // The SRV, TXT and A records, which expire with the shortest of their TTLs.
+    Lifetime details;
+    // Whether the details should be queried once the current response or timer event has been
+    // processed, together with those of the other instances.
+    bool queryDetails;
+} Entry;
+
+static Entry entries[SERVICE_CACHE_MAX_INSTANCES];
+
+static EventLoop *eventLoop = NULL;
+static EventLoopTimer *timer = NULL;
+static int dnsFd = -1;
+static const char *browsedServiceName = NULL;
+static ServiceCache_ChangeHandler changeHandler = NULL;
+static void *changeHandlerContext = NULL;
+
+static bool browsing = false;
+static int64_t nextBrowseMs = 0;
+static uint32_t browseIntervalSeconds = 1;
+
+static int64_t NowMs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static void SetLifetime(Lifetime *lifetime, int64_t nowMs, uint32_t ttlSeconds)
+{
+    lifetime->valid = true;
+    lifetime->receivedMs = nowMs;
+    lifetime->ttlSeconds = ttlSeconds;
+    lifetime->refreshesSent = 0;
+}
+
+// Time at which the next refresh query for a record should be sent, or, once they have all been
+// sent, at which it expires.
+static int64_t Deadline(const Lifetime *lifetime)
+{
+    static const unsigned int percentages[REFRESH_QUERIES + 1] = {80, 90, 100};
+    return lifetime->receivedMs +
+           (int64_t)lifetime->ttlSeconds * 10 * percentages[lifetime->refreshesSent];
+}
+
+static Entry *FindEntry(const char *name)
+{
+    for (size_t i = 0; i < SERVICE_CACHE_MAX_INSTANCES; ++i) {
+        if (entries[i].used && strcmp(entries[i].instance.name, name) == 0) {
+            return &entries[i];
+        }
+    }
+    return NULL;
+}
+
+static Entry *AddEntry(const char *name)
+{
+    if (strnlen(name, SERVICE_CACHE_MAX_NAME_LENGTH + 1) > SERVICE_CACHE_MAX_NAME_LENGTH) {
+        Log_Debug("ERROR: Service instance name is too long to cache.\n");
+        return NULL;
+    }
+
+    // If the cache is full, replace the instance whose PTR record expires soonest.
+    Entry *entry = NULL;
+    for (size_t i = 0; i < SERVICE_CACHE_MAX_INSTANCES; ++i) {
+        if (!entries[i].used) {
+            entry = &entries[i];
+            break;
+        }
+        if (entry == NULL || Deadline(&entries[i].ptr) < Deadline(&entry->ptr)) {
+            entry = &entries[i];
+        }
+    }
+
+    if (entry->used) {
+        Log_Debug("INFO: Service cache is full; forgetting %s.\n", entry->instance.name);
+        changeHandler(ServiceCache_Change_Removed, &entry->instance, changeHandlerContext);
+    }
+
+    memset(entry, 0, sizeof(*entry));
+    entry->used = true;
+    strcpy(entry->instance.name, name);
+    entry->instance.ipv4Address.s_addr = INADDR_NONE;
+    return entry;
+}
+
+static void RemoveEntry(Entry *entry)
+{
+    entry->used = false;
+    changeHandler(ServiceCache_Change_Removed, &entry->instance, changeHandlerContext);
+}
+
+// Copies the details from a response into an instance, and returns whether they changed.
+static bool MergeDetails(ServiceCache_Instance *instance, const ServiceInstanceDetails *details)
+{
+    bool changed = false;
+
+    if (details->hasSrv) {
+        if (!instance->resolved || instance->port != details->port ||
+            strcmp(instance->host, details->host) != 0) {
+            instance->resolved = true;
+            instance->port = details->port;
+            strcpy(instance->host, details->host);
+            changed = true;
+        }
+    }
+
+    if (details->ipv4Address.s_addr != INADDR_NONE &&
+        instance->ipv4Address.s_addr != details->ipv4Address.s_addr) {
+        instance->ipv4Address = details->ipv4Address;
+        changed = true;
+    }
+
+    if (details->hasTxt) {
+        if (instance->txtDataLength != details->txtDataLength ||
+            memcmp(instance->txtData, details->txtData, details->txtDataLength) != 0) {
+            instance->txtDataLength = details->txtDataLength;
+            memcpy(instance->txtData, details->txtData, details->txtDataLength);
+            changed = true;
+        }
+    }
+
+    return changed;
+}
+
+// Shortest TTL of the details in a response, or UINT32_MAX if it has none.
+static uint32_t DetailsTtl(const ServiceInstanceDetails *details)
+{
+    uint32_t ttl = UINT32_MAX;
+    if (details->hasSrv && details->srvTtl < ttl) {
+        ttl = details->srvTtl;
+    }
+    if (details->hasTxt && details->txtTtl < ttl) {
+        ttl = details->txtTtl;
+    }
+    if (details->ipv4Address.s_addr != INADDR_NONE && details->aTtl < ttl) {
+        ttl = details->aTtl;
+    }
+    return ttl;
+}
+
+// Sends the details queries for every instance which needs them in one batch, so that they are
+// answered in the same round trip.
+static void SendDetailsQueries(void)
+{
+    const char *names[SERVICE_CACHE_MAX_INSTANCES];
+    size_t count = 0;
+    for (size_t i = 0; i < SERVICE_CACHE_MAX_INSTANCES; ++i) {
+        if (entries[i].used && entries[i].queryDetails) {
+            entries[i].queryDetails = false;
+            names[count++] = entries[i].instance.name;
+        }
+    }
+
+    if (count > 0) {
+        Log_Debug("INFO: Requesting SRV and TXT details for %zu instance(s).\n", count);
+        SendServiceInstanceDetailsQueries(names, count, dnsFd);
+    }
+}
+
+static void Reschedule(void)
+{
+    int64_t next = browsing ? nextBrowseMs : INT64_MAX;
+    for (size_t i = 0; i < SERVICE_CACHE_MAX_INSTANCES; ++i) {
+        if (!entries[i].used) {
+            continue;
+        }
+        if (entries[i].ptr.valid && Deadline(&entries[i].ptr) < next) {
+            next = Deadline(&entries[i].ptr);
+        }
+        if (entries[i].details.valid && Deadline(&entries[i].details) < next) {
+            next = Deadline(&entries[i].details);
+        }
+    }
+
+    if (next == INT64_MAX) {
+        DisarmEventLoopTimer(timer);
+        return;
+    }
+
+    int64_t delayMs = next - NowMs();
+    if (delayMs < 1) {
+        delayMs = 1;
+    }
+    struct timespec delay = {.tv_sec = (time_t)(delayMs / 1000),
+                             .tv_nsec = (long)(delayMs % 1000) * 1000000};
+    SetEventLoopTimerOneShot(timer, &delay);
+}
+
+static void TimerEventHandler(EventLoopTimer *eventLoopTimer)
+{
+    if (ConsumeEventLoopTimerEvent(eventLoopTimer) != 0) {
+        return;
+    }
+
+    int64_t now = NowMs();
+    bool sendBrowseQuery = false;
+
+    if (browsing && now >= nextBrowseMs) {
+        sendBrowseQuery = true;
+        if (browseIntervalSeconds < SERVICE_CACHE_MAX_BROWSE_INTERVAL_SECONDS) {
+            browseIntervalSeconds *= 2;
+        }
+        nextBrowseMs = now + (int64_t)browseIntervalSeconds * 1000;
+    }
+
+    for (size_t i = 0; i < SERVICE_CACHE_MAX_INSTANCES; ++i) {
+        Entry *entry = &entries[i];
+        if (!entry->used) {
+            continue;
+        }
+
+        if (entry->ptr.valid && now >= Deadline(&entry->ptr)) {
+            if (entry->ptr.refreshesSent == REFRESH_QUERIES) {
+                Log_Debug("INFO: Service instance %s has expired.\n", entry->instance.name);
+                RemoveEntry(entry);
+                continue;
+            }
+            ++entry->ptr.refreshesSent;
+            sendBrowseQuery = true;
+        }
+
+        if (entry->details.valid && now >= Deadline(&entry->details)) {
+            if (entry->details.refreshesSent == REFRESH_QUERIES) {
+                entry->details.valid = false;
+                entry->instance.resolved = false;
+                entry->instance.ipv4Address.s_addr = INADDR_NONE;
+                entry->instance.txtDataLength = 0;
+                changeHandler(ServiceCache_Change_Updated, &entry->instance, changeHandlerContext);
+            } else {
+                ++entry->details.refreshesSent;
+            }
+            entry->queryDetails = true;
+        }
+    }
+
+    SendDetailsQueries();
+
+    // One browse query refreshes the PTR records of all the instances.
+    if (sendBrowseQuery) {
+        SendServiceDiscoveryQuery(browsedServiceName, dnsFd);
+    }
+
+    Reschedule();
+}
+
+int ServiceCache_Init(EventLoop *el, int fd, const char *serviceName,
+                      ServiceCache_ChangeHandler handler, void *context)
+{
+    eventLoop = el;
+    dnsFd = fd;
+    browsedServiceName = serviceName;
+    changeHandler = handler;
+    changeHandlerContext = context;
+    memset(entries, 0, sizeof(entries));
+
+    timer = CreateEventLoopDisarmedTimer(eventLoop, TimerEventHandler);
+    if (timer == NULL) {
+        return -1;
+    }
+
+    return 0;
+}
+
+void ServiceCache_StartBrowsing(void)
+{
+    browsing = true;
+    browseIntervalSeconds = 1;
+    nextBrowseMs = NowMs() + (int64_t)browseIntervalSeconds * 1000;
+    SendServiceDiscoveryQuery(browsedServiceName, dnsFd);
+    Reschedule();
+}
+
+static void UpdateInstance(const ServiceInstanceDetails *details)
+{
+    int64_t now = NowMs();
+    Entry *entry = FindEntry(details->name);
+
+    // A PTR record with a TTL of 0 says that the instance has gone.
+    if (details->hasPtr && details->ptrTtl == 0) {
+        if (entry != NULL) {
+            RemoveEntry(entry);
+        }
+        return;
+    }
+
+    bool added = false;
+    if (entry == NULL) {
+        // Only cache instances which have been found by browsing.
+        if (!details->hasPtr) {
+            return;
+        }
+        entry = AddEntry(details->name);
+        if (entry == NULL) {
+            return;
+        }
+        added = true;
+    }
+
+    if (details->hasPtr) {
+        SetLifetime(&entry->ptr, now, details->ptrTtl);
+    }
+
+    bool changed = false;
+    uint32_t detailsTtl = DetailsTtl(details);
+    if (detailsTtl == 0) {
+        // The details have gone; forget them, and ask for them again.
+        changed = entry->details.valid;
+        entry->details.valid = false;
+        entry->instance.resolved = false;
+        entry->instance.ipv4Address.s_addr = INADDR_NONE;
+        entry->instance.txtDataLength = 0;
+    } else if (detailsTtl != UINT32_MAX) {
+        changed = MergeDetails(&entry->instance, details);
+        if (entry->instance.resolved) {
+            SetLifetime(&entry->details, now, detailsTtl);
+        }
+    }
+
+    if (added) {
+        changeHandler(ServiceCache_Change_Added, &entry->instance, changeHandlerContext);
+    } else if (changed) {
+        changeHandler(ServiceCache_Change_Updated, &entry->instance, changeHandlerContext);
+    }
+
+    if (!entry->instance.resolved) {
+        entry->queryDetails = true;
+    }
+}
+
+void ServiceCache_Update(const ServiceInstanceDetails *instances, size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        UpdateInstance(&instances[i]);
+    }
+
+    SendDetailsQueries();
+    Reschedule();
+}
+
+const ServiceCache_Instance *ServiceCache_Find(const char *name)
+{
+    Entry *entry = FindEntry(name);
+    return entry == NULL ? NULL : &entry->instance;
+}
+
+void ServiceCache_Cleanup(void)
+{
+    browsing = false;
+    DisposeEventLoopTimer(timer);
+    timer = NULL;
+}
@@ -0,0 +1,117 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <netinet/in.h>
+
+#include <applibs/eventloop.h>
+
+#include "dns-sd.h"
+
+// The service cache keeps the instances of a service which DNS service discovery has found, keyed
+// by instance name, for as long as the TTLs of their records allow, so that an application can
+// resolve an instance from the cache instead of querying the network each time it needs it.
+//
+// The cache browses for the service continuously: it sends the PTR query again after 1 second,
+// then at intervals which double up to SERVICE_CACHE_MAX_BROWSE_INTERVAL_SECONDS, so that
+// instances which appear later are found. As RFC 6762 recommends, it queries for a record again
+// when 80% and 90% of its TTL have elapsed, and removes it when its TTL has elapsed without an
+// answer; a record with a TTL of 0 (a "goodbye" packet) is removed at once. The application is
+// notified when an instance is added, when its details change, and when it is removed.
+//
+// The cache is not thread-safe; it should only be used from the event loop's thread.
+
+/// <summary>Maximum number of instances in the cache.</summary>
+#define SERVICE_CACHE_MAX_INSTANCES 8
+
+/// <summary>Maximum length of an instance name or host name, excluding the null
+/// terminator.</summary>
+#define SERVICE_CACHE_MAX_NAME_LENGTH DNS_SD_MAX_NAME_LENGTH
+
+/// <summary>Maximum length of the TXT data of an instance which is kept; longer data is
+/// truncated.</summary>
+#define SERVICE_CACHE_MAX_TXT_LENGTH DNS_SD_MAX_TXT_LENGTH
+
+/// <summary>Longest interval between browse queries, in seconds.</summary>
+#define SERVICE_CACHE_MAX_BROWSE_INTERVAL_SECONDS (60 * 60)
+
+/// <summary>A service instance in the cache.</summary>
+typedef struct {
+    /// <summary>Service instance name</summary>
+    char name[SERVICE_CACHE_MAX_NAME_LENGTH + 1];
+    /// <summary>Whether the SRV record has been received, so that host and port are
+    /// set</summary>
+    bool resolved;
+    /// <summary>Service host name</summary>
+    char host[SERVICE_CACHE_MAX_NAME_LENGTH + 1];
+    /// <summary>IPv4 address, or INADDR_NONE if it is not known</summary>
+    struct in_addr ipv4Address;
+    /// <summary>Network port</summary>
+    uint16_t port;
+    /// <summary>DNS TXT data length</summary>
+    uint16_t txtDataLength;
+    /// <summary>DNS TXT data</summary>
+    char txtData[SERVICE_CACHE_MAX_TXT_LENGTH];
+} ServiceCache_Instance;
+
+/// <summary>How an instance has changed.</summary>
+typedef enum {
+    /// <summary>The instance has been found.</summary>
+    ServiceCache_Change_Added,
+    /// <summary>The details of the instance have changed, or have expired.</summary>
+    ServiceCache_Change_Updated,
+    /// <summary>The instance has gone, or its PTR record has expired.</summary>
+    ServiceCache_Change_Removed
+} ServiceCache_Change;
+
+/// <summary>
+///     Invoked when an instance in the cache changes.
+/// </summary>
+/// <param name="change">How the instance has changed.</param>
+/// <param name="instance">The instance, which is only valid until the handler returns.</param>
+/// <param name="context">Context which was supplied to ServiceCache_Init.</param>
+typedef void (*ServiceCache_ChangeHandler)(ServiceCache_Change change,
+                                           const ServiceCache_Instance *instance, void *context);
+
+/// <summary>
+///     Initializes the cache.
+/// </summary>
+/// <param name="eventLoop">Event loop which runs the cache's timer.</param>
+/// <param name="fd">The socket on which DNS queries are sent.</param>
+/// <param name="serviceName">The service to browse for, such as "_sample-service._tcp.local".
+/// It must remain valid until ServiceCache_Cleanup is called.</param>
+/// <param name="handler">Function which is notified of changes.</param>
+/// <param name="context">Context which is passed to the handler.</param>
+/// <returns>0 on success, or -1 on failure, in which case errno is set.</returns>
+int ServiceCache_Init(EventLoop *eventLoop, int fd, const char *serviceName,
+                      ServiceCache_ChangeHandler handler, void *context);
+
+/// <summary>
+///     Starts browsing for the service.
+/// </summary>
+void ServiceCache_StartBrowsing(void);
+
+/// <summary>
+///     Adds the records of a DNS response to the cache, and queries for the details of the
+///     instances whose details are not known, in one batch.
+/// </summary>
+/// <param name="instances">The instances which were parsed from the response.</param>
+/// <param name="count">The number of instances.</param>
+void ServiceCache_Update(const ServiceInstanceDetails *instances, size_t count);
+
+/// <summary>
+///     Gets an instance from the cache.
+/// </summary>
+/// <param name="name">The instance name.</param>
+/// <returns>The instance, which is valid until the cache next changes, or NULL if it is not in
+/// the cache.</returns>
+const ServiceCache_Instance *ServiceCache_Find(const char *name);
+
+/// <summary>
+///     Stops browsing and frees the cache's resources. This should be called before the event loop
+///     is closed.
+/// </summary>
+void ServiceCache_Cleanup(void);
@@ -5,7 +5,8 @@
 // notifications for a pending application update, and then deferring that update.
 // On the MT3620 RDB,
 // LED 2 is green when the update should be deferred, and yellow when it should be applied.
-// Press SAMPLE_BUTTON_1 to toggle between these modes.
+// Press SAMPLE_BUTTON_1 to toggle between these modes. The mode is an activity source for the
+// update policy, which lets a pending update install once it has been quiet for 10 seconds.
 // LED 3 is lit up blue when an OTA update is available.
 //
 // It uses the API for the following Azure Sphere application libraries:
@@ -42,7 +43,8 @@
 // See https://aka.ms/AzureSphereHardwareDefinitions for more details.
 #include <hw/sample_appliance.h>
 
-#include "eventloop_timer_utilities.h"
+#include "button_input.h"
+#include "update_policy.h"
 
 /// <summary>
 /// Exit codes for this application. These are used for the
@@ -54,8 +56,8 @@ typedef enum {
 
     ExitCode_TermHandler_SigTerm = 1,
 
-    ExitCode_ButtonTimer_Consume = 2,
-    ExitCode_ButtonTimer_GetValue = 3,
+    ExitCode_Buttons_Timer = 2,
+    ExitCode_Buttons_GetValue = 3,
 
     ExitCode_UpdateCallback_UnexpectedEvent = 4,
     ExitCode_UpdateCallback_GetUpdateEvent = 5,
@@ -64,7 +66,7 @@ typedef enum {
     ExitCode_UpdateCallback_UnexpectedStatus = 8,
     ExitCode_SetUpSysEvent_EventLoop = 9,
     ExitCode_SetUpSysEvent_RegisterEvent = 10,
-    ExitCode_SetUpSysEvent_ButtonTimer = 11,
+    ExitCode_SetUpSysEvent_Buttons = 11,
 
     ExitCode_Init_OpenRedLed = 12,
     ExitCode_Init_OpenGreenLed = 13,
@@ -72,7 +74,10 @@ typedef enum {
     ExitCode_Init_OpenPendingLed = 15,
     ExitCode_Init_OpenButton = 16,
 
-    ExitCode_Main_EventLoopFail = 17
+    ExitCode_Main_EventLoopFail = 17,
+
+    ExitCode_SetUpSysEvent_AddButton = 18,
+    ExitCode_SetUpSysEvent_UpdatePolicy = 19
 } ExitCode;
 
 static volatile sig_atomic_t exitCode = ExitCode_Success;
@@ -86,13 +91,15 @@ static int acceptLedGreenFd = -1;
 static int acceptLedBlueFd = -1;
 
 // Press the button to toggle between accept or defer updates.
-static EventLoopTimer *buttonPollTimer = NULL;
+static ButtonInput *buttons = NULL;
 static int buttonFd = -1;
 static bool acceptUpdate = false;
 
 static void UpdateAcceptModeLed(void);
 static void SwitchOffAcceptModeLed(void);
-static void ButtonTimerEventHandler(EventLoopTimer *timer);
+static void ButtonEventHandler(int gpioFd, ButtonInput_Event event, unsigned int count,
+                               void *context);
+static void ButtonsErrorHandler(int gpioFd, void *context);
 
 // The pending update LED lights up the application is notified of a pending update.
 static int pendingUpdateLedFd = -1;
@@ -104,6 +111,15 @@ static void UpdatePendingStatusLed(void);
 static EventRegistration *updateEventReg = NULL;
 static bool pendingUpdate = false;
 
+static unsigned int GetUserHold(void *context);
+
+// The update policy defers a pending update while the user holds it with the button, and lets
+// it install once the hold has been released for the quiet period.
+static const UpdatePolicy_Config updatePolicyConfig = {
+    .samplePeriodSeconds = 1, .quietPeriodSeconds = 10, .deferMinutes = 1, .marginMinutes = 1};
+static const UpdatePolicy_Source updatePolicySources[] = {
+    {.name = "user holding updates", .getActivity = GetUserHold, .idleLevel = 0}};
+
 static void UpdateCallback(SysEvent_Events event, SysEvent_Status status, const SysEvent_Info *info,
                            void *context);
 static const char *EventStatusToString(SysEvent_Status status);
@@ -171,42 +187,43 @@ static void SwitchOffAcceptModeLed(void)
 }
 
 /// <summary>
-///     Handle button timer event by toggling the accept mode.
+///     Handle button events by toggling the accept mode when the button is pressed.
 /// </summary>
-/// <param name="timer">Event loop timer.</param>
-static void ButtonTimerEventHandler(EventLoopTimer *timer)
+/// <param name="gpioFd">The button.</param>
+/// <param name="event">What happened to the button.</param>
+/// <param name="count">Number of presses in the current run.</param>
+/// <param name="context">Unused.</param>
+static void ButtonEventHandler(int gpioFd, ButtonInput_Event event, unsigned int count,
+                               void *context)
 {
-    if (ConsumeEventLoopTimerEvent(timer) != 0) {
-        exitCode = ExitCode_ButtonTimer_Consume;
-        return;
-    }
-
-    static GPIO_Value_Type buttonState = GPIO_Value_High;
-
-    GPIO_Value_Type newButtonState;
-    int result = GPIO_GetValue(buttonFd, &newButtonState);
-    if (result != 0) {
-        Log_Debug("ERROR: Could not read button GPIO: %s (%d).\n", strerror(errno), errno);
-        exitCode = ExitCode_ButtonTimer_GetValue;
+    if (event != ButtonInput_Event_Pressed) {
         return;
     }
 
-    // If the button has just been pressed, then change update mode from
-    // updates accepted to updates deferred or vice-versa.
-    if (newButtonState != buttonState) {
-        if (newButtonState == GPIO_Value_Low) {
-            acceptUpdate = !acceptUpdate;
-            UpdateAcceptModeLed();
-        }
+    // Change update mode from updates accepted to updates deferred or vice-versa. If there is
+    // already a pending update, the update policy lets it install after the quiet period.
+    acceptUpdate = !acceptUpdate;
+    UpdateAcceptModeLed();
+    UpdatePolicy_Evaluate();
+}
 
-        buttonState = newButtonState;
-    }
+/// <summary>
+///     Activity source for the update policy, which is busy while the user defers updates.
+///     This satisfies the UpdatePolicy_ActivityCallback signature.
+/// </summary>
+static unsigned int GetUserHold(void *context)
+{
+    return acceptUpdate ? 0 : 1;
+}
 
-    // If user has accepted updates and there is already a pending update then]
-    // apply it immediately.
-    if (acceptUpdate && pendingUpdate) {
-        SysEvent_ResumeEvent(SysEvent_Events_UpdateReadyForInstall);
-    }
+/// <summary>
+///     Handle a failure to sample the button.
+/// </summary>
+/// <param name="gpioFd">The button which could not be read, or -1 if the timer failed.</param>
+/// <param name="context">Unused.</param>
+static void ButtonsErrorHandler(int gpioFd, void *context)
+{
+    exitCode = (gpioFd == -1) ? ExitCode_Buttons_Timer : ExitCode_Buttons_GetValue;
 }
 
 /// <summary>
@@ -263,23 +280,15 @@ static void UpdateCallback(SysEvent_Events event, SysEvent_Status status, const
         return;
     }
 
-    Log_Debug("INFO: Max deferral time: %u minutes\n", data.max_deferral_time_in_minutes);
     Log_Debug("INFO: Update Type: %s (%u).\n", UpdateTypeToString(data.update_type),
               data.update_type);
 
     switch (status) {
-        // If an update is pending, and the user has not allowed updates, then defer the update.
+        // If an update is pending, the update policy either allows it, or defers it until the
+        // user has released the hold for long enough.
     case SysEvent_Status_Pending:
         pendingUpdate = true;
-        if (acceptUpdate) {
-            Log_Debug("INFO: Allowing update.\n");
-        } else {
-            Log_Debug("INFO: Deferring update for 1 minute.\n");
-            result = SysEvent_DeferEvent(SysEvent_Events_UpdateReadyForInstall, 1);
-        }
-
-        if (result == -1) {
-            Log_Debug("ERROR: SysEvent_DeferEvent: %s (%d).\n", strerror(errno), errno);
+        if (UpdatePolicy_HandlePendingUpdate(info) == -1) {
             exitCode = ExitCode_UpdateCallback_DeferEvent;
         }
         break;
@@ -374,12 +383,20 @@ static ExitCode SetUpSysEventHandler(void)
         return ExitCode_SetUpSysEvent_RegisterEvent;
     }
 
-    static const struct timespec buttonPollInterval100Ms = {.tv_sec = 0,
-                                                            .tv_nsec = 100 * 1000 * 1000};
-    buttonPollTimer =
-        CreateEventLoopPeriodicTimer(eventLoop, &ButtonTimerEventHandler, &buttonPollInterval100Ms);
-    if (buttonPollTimer == NULL) {
-        return ExitCode_SetUpSysEvent_ButtonTimer;
+    buttons = ButtonInput_Create(eventLoop, NULL, ButtonsErrorHandler, NULL);
+    if (buttons == NULL) {
+        return ExitCode_SetUpSysEvent_Buttons;
+    }
+
+    if (ButtonInput_Add(buttons, buttonFd, ButtonEventHandler, NULL) != 0) {
+        return ExitCode_SetUpSysEvent_AddButton;
+    }
+
+    if (UpdatePolicy_Start(eventLoop, &updatePolicyConfig, updatePolicySources,
+                           sizeof(updatePolicySources) / sizeof(updatePolicySources[0]),
+                           /* handler */ NULL, /* context */ NULL) != 0) {
+        Log_Debug("ERROR: could not start update policy: %s (%d).\n", strerror(errno), errno);
+        return ExitCode_SetUpSysEvent_UpdatePolicy;
     }
 
     return ExitCode_Success;
@@ -391,7 +408,8 @@ static ExitCode SetUpSysEventHandler(void)
 /// </summary>
 static void FreeSysEventHandler(void)
 {
-    DisposeEventLoopTimer(buttonPollTimer);
+    UpdatePolicy_Stop();
+    ButtonInput_Dispose(buttons);
     SysEvent_UnregisterForEventNotifications(updateEventReg);
     EventLoop_Close(eventLoop);
 }
@@ -446,7 +464,7 @@ static ExitCode InitPeripheralsAndHandlers(void)
 
     UpdatePendingStatusLed();
 
-    // Open SAMPLE_BUTTON_1 GPIO and timer to check for button press.
+    // Open SAMPLE_BUTTON_1 GPIO to check for button presses.
     buttonFd = GPIO_OpenAsInput(SAMPLE_BUTTON_1);
     if (buttonFd == -1) {
         Log_Debug("ERROR: Could not open SAMPLE_BUTTON_1: %s (%d).\n", strerror(errno), errno);
@@ -2,6 +2,8 @@
    Licensed under the MIT License. */
 #include <stdlib.h>
 #include <errno.h>
+#include <string.h>
+#include <time.h>
 
 #include "applibs_versions.h"
 #include <applibs/networking.h>
@@ -13,14 +15,22 @@
 // Azure IoT SDK
 #include <azureiot/iothub_client_core_common.h>
 #include <azureiot/iothub_device_client_ll.h>
+#include <azureiot/iothub_client_ll.h>
 #include <azureiot/iothub_client_options.h>
 #include <azureiot/iothubtransportmqtt.h>
 #include <azureiot/iothub.h>
-#include <azureiot/azure_sphere_provisioning.h>
 #include <azure_prov_client/iothub_security_factory.h>
+#include <azure_prov_client/prov_device_ll_client.h>
+#include <azure_prov_client/prov_transport_mqtt_client.h>
+#include <azure_prov_client/prov_security_factory.h>
 
 #include "exitcode.h"
 #include "azure_iot.h"
+#include "telemetry_queue.h"
+#include "direct_methods.h"
+#include "dps_cache.h"
+#include "priority_dispatch.h"
+#include "wake_trace.h"
 
 // Azure IoT definitions.
 static const size_t MAX_SCOPEID_LENGTH = 16;
@@ -30,6 +40,30 @@ static IOTHUB_DEVICE_CLIENT_LL_HANDLE iothubClientHandle = NULL;
 static const int keepalivePeriodSeconds = 20;
 static bool iothubAuthenticated = false;
 static const char NetworkInterface[] = "wlan0";
+static const int deviceIdForDaaCertUsage = 1; // A constant used to direct the IoT SDK to use
+                                              // the DAA cert under the hood.
+
+// Device Provisioning Service (DPS) registration.
+static const char DpsGlobalEndpoint[] = "global.azure-devices-provisioning.net";
+static const int DpsRegistrationTimeoutMs = 10000; // Give up on DPS after this long.
+static const int DpsPollPeriodMs = 100;            // Call Prov_Device_LL_DoWork this often.
+
+// Set while the client has been created from a cached DPS assignment and has not yet been
+// authenticated by the IoT hub. If authentication fails, the cached assignment is removed, so that
+// the next attempt registers with DPS again.
+static bool usingCachedDpsAssignment = false;
+
+/// <summary>
+///     Progress of a DPS registration, which is updated by DpsRegisterDeviceCallback.
+/// </summary>
+typedef struct {
+    /// <summary>Whether DPS has responded.</summary>
+    bool completed;
+    /// <summary>Whether the device was assigned to an IoT hub.</summary>
+    bool succeeded;
+    /// <summary>Receives the IoT hub and device ID which DPS assigned.</summary>
+    DpsCache_Assignment *assignment;
+} DpsRegistration;
 
 // Function declarations
 static void SendEventCallback(IOTHUB_CLIENT_CONFIRMATION_RESULT result, void *context);
@@ -40,26 +74,73 @@ static void ConnectionStatusCallback(IOTHUB_CLIENT_CONNECTION_STATUS result,
                                      void *userContextCallback);
 static void ReportedStateCallback(int result, void *context);
 static int DeviceMethodCallback(const char *methodName, const unsigned char *payload,
-                                size_t payloadSize, unsigned char **response, size_t *responseSize,
+                                size_t payloadSize, METHOD_HANDLE methodId,
                                 void *userContextCallback);
+static void SendDirectMethodResponse(void *methodId, int status, const unsigned char *response,
+                                     size_t responseSize);
 static const char *GetReasonString(IOTHUB_CLIENT_CONNECTION_STATUS_REASON reason);
-static const char *GetAzureSphereProvisioningResultString(
-    AZURE_SPHERE_PROV_RETURN_VALUE provisioningResult);
 static void SetupAzureClient(void);
 static void AzureTimerEventHandler(EventLoopTimer *timer);
+static bool AzureWorkSlice(void *context);
+static void ArmAzureTimer(int delayMs);
+static void ScheduleAzureTimer(void);
+static void BackOffReconnect(void);
+static void RequestAzureIoTWork(void);
 static bool SetupAzureIoTHubClientWithDps(void);
-static bool IsConnectionReadyToSendTelemetry(void);
+static bool SetupAzureIoTHubClientWithDaa(const char *iotHubHostName, const char *iotHubDeviceId);
+static bool RegisterWithDps(DpsCache_Assignment *assignment);
+static void DpsRegisterDeviceCallback(PROV_DEVICE_RESULT registerResult, const char *iotHubUri,
+                                      const char *registeredDeviceId, void *context);
+static IOTHUB_MESSAGE_HANDLE CreateTelemetryMessage(const void *message, size_t size);
+static bool StoreTelemetryForLater(const void *message, size_t size, void *context);
+static void DrainTelemetryQueue(void);
 
 // Timer / polling
 static EventLoop *eventLoop = NULL;
 static EventLoopTimer *azureTimer = NULL;
 
-// Azure IoT poll periods
-static const int AzureIoTDefaultPollPeriodSeconds = 1;        // poll azure iot every second
+// The work which the Azure timer starts runs as low-priority slices, so that the MCU's messages,
+// which have tight timeouts, are handled between connecting, formatting the queued telemetry and
+// calling IoTHubDeviceClient_LL_DoWork.
+typedef enum {
+    AzureWorkStep_Idle,
+    AzureWorkStep_Connect,
+    AzureWorkStep_DrainTelemetry,
+    AzureWorkStep_DoWork
+} AzureWorkStep;
+
+static AzureWorkStep azureWorkStep = AzureWorkStep_Idle;
+static PriorityDispatch_Work azureWork = {.work = AzureWorkSlice, .context = NULL};
+
+// Azure IoT poll periods. IoTHubDeviceClient_LL_DoWork is called every AzureIoTMinDoWorkPeriodMs
+// while telemetry or reported properties are awaiting confirmation, queued telemetry is waiting
+// to be sent, or the connection has not yet been confirmed. Once the client is idle, the period
+// doubles on each call up to AzureIoTMaxDoWorkPeriodMs, which is shorter than the keepalive period.
+static const int AzureIoTMinDoWorkPeriodMs = 100;             // poll quickly while busy
+static const int AzureIoTMaxDoWorkPeriodMs = 8 * 1000;        // idle back off limit
 static const int AzureIoTMinReconnectPeriodSeconds = 10;      // back off when reconnecting
 static const int AzureIoTMaxReconnectPeriodSeconds = 10 * 60; // back off limit
 
-static int azureIoTPollPeriodSeconds = -1;
+static int azureIoTDoWorkPeriodMs = -1;
+// Reconnect back off, which is non-zero after a failure until the IoT hub authenticates the device.
+static int azureIoTReconnectPeriodSeconds = 0;
+// Delay before the next attempt to connect, which is non-zero while waiting to retry.
+static int azureIoTReconnectDelayMs = 0;
+
+// Each reconnect delay is shortened by a random amount of up to this percentage of the back off
+// period, so that a fleet of devices which lose the connection together do not all retry
+// together. Set with AzureIoT_SetReconnectJitter.
+static unsigned int reconnectJitterPercent = 0;
+static unsigned int reconnectJitterSeed = 0;
+
+// ID of the device in the IoT hub, which is empty until a client has been created.
+static char deviceId[DPS_CACHE_MAX_DEVICE_ID_LENGTH + 1];
+
+// Number of telemetry messages and reported property updates which the client has accepted, but
+// whose confirmation callbacks have not yet been invoked.
+static unsigned int outstandingIoTHubRequests = 0;
+// Set from when the client is set up until ConnectionStatusCallback is first invoked.
+static bool awaitingConnectionStatus = false;
 
 static ExitCodeCallbackType exitCodeCallbackFunction = NULL;
 static AzureIoT_ConnectionStatusCallbackType connectionStatusCallbackFunc = NULL;
@@ -67,6 +148,22 @@ static AzureIoT_DeviceTwinReceivedCallbackType deviceTwinReceivedCallbackFunc =
 static AzureIoT_SendTelemetryCallbackType sendTelemetryCallbackFunc = NULL;
 static AzureIoT_DeviceTwinReportStateAckCallbackType deviceTwinReportStateAckCallbackFunc = NULL;
 
+// System properties which are set on each telemetry message, so that the IoT Hub and its
+// consumers can decode the body.
+static const char *telemetryContentType = "application/json";
+static const char *telemetryContentEncoding = "utf-8";
+
+// Telemetry which could not be sent is stored in the telemetry queue, and is sent in batches of up
+// to this many messages once the connection returns.
+#define TELEMETRY_DRAIN_BATCH_SIZE 8u
+
+// Sequence numbers of queued messages which have been handed to the IoT Hub client; the address
+// of each entry is used as the send context, so the callback can tell these messages apart.
+static uint32_t drainSequenceNumbers[TELEMETRY_DRAIN_BATCH_SIZE];
+static size_t drainInFlight = 0;
+// Set if any message in the current batch fails, after which no more of the batch is acknowledged.
+static bool drainFailed = false;
+
 ExitCode AzureIoT_Initialize(
     EventLoop *el, const char *scopeId, ExitCodeCallbackType failureCallback,
     AzureIoT_ConnectionStatusCallbackType connectionStatusCallback,
@@ -85,30 +182,43 @@ ExitCode AzureIoT_Initialize(
         return ExitCode_Init_CopyScopeId;
     }
 
-    azureIoTPollPeriodSeconds = AzureIoTDefaultPollPeriodSeconds;
-    struct timespec azureTelemetryPeriod = {.tv_sec = azureIoTPollPeriodSeconds, .tv_nsec = 0};
-    azureTimer =
-        CreateEventLoopPeriodicTimer(eventLoop, &AzureTimerEventHandler, &azureTelemetryPeriod);
+    // Devices which wake at the same time read the clock at different nanoseconds.
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    reconnectJitterSeed = (unsigned int)now.tv_sec ^ (unsigned int)now.tv_nsec;
+
+    // Connect as soon as the network is up. The timer is rearmed each time it fires.
+    azureTimer = CreateEventLoopDisarmedTimer(eventLoop, &AzureTimerEventHandler);
     if (azureTimer == NULL) {
         return ExitCode_Init_AzureTimer;
     }
+    azureIoTDoWorkPeriodMs = AzureIoTMinDoWorkPeriodMs;
+    ArmAzureTimer(azureIoTDoWorkPeriodMs);
 
     connectionStatusCallbackFunc = connectionStatusCallback;
     deviceTwinReceivedCallbackFunc = deviceTwinReceivedCallback;
     deviceTwinReportStateAckCallbackFunc = deviceTwinReportStateAckCallback;
     sendTelemetryCallbackFunc = sendTelemetryCallback;
 
+    // Direct methods which are registered with DirectMethods_Register are dispatched to their
+    // handlers; calls of any other method are answered as not found.
+    DirectMethods_Initialize(SendDirectMethodResponse);
+
+    TelemetryQueue_Initialize();
+
     return ExitCode_Success;
 }
 
 void AzureIoT_Cleanup(void)
 {
+    PriorityDispatch_CancelWork(&azureWork);
+    azureWorkStep = AzureWorkStep_Idle;
     free(idScope);
     DisposeEventLoopTimer(azureTimer);
 }
 
 /// <summary>
-///     Azure timer event: Connect if necessary, do Azure IoT work
+///     Azure timer event: start the Azure IoT work, unless it is still running.
 /// </summary>
 static void AzureTimerEventHandler(EventLoopTimer *timer)
 {
@@ -120,26 +230,112 @@ static void AzureTimerEventHandler(EventLoopTimer *timer)
         return;
     }
 
-    // Check whether the device is connected to the internet.
-    Networking_InterfaceConnectionStatus status;
-    if (Networking_GetInterfaceConnectionStatus(NetworkInterface, &status) == 0) {
-        if ((status & Networking_InterfaceConnectionStatus_ConnectedToInternet) &&
-            !iothubAuthenticated) {
-            SetupAzureClient();
-        }
-    } else {
-        if (errno != EAGAIN) {
-            Log_Debug("ERROR: Networking_GetInterfaceConnectionStatus: %d (%s)\n", errno,
-                      strerror(errno));
-            if (exitCodeCallbackFunction != NULL) {
-                exitCodeCallbackFunction(ExitCode_InterfaceConnectionStatus_Failed);
+    if (azureWorkStep == AzureWorkStep_Idle) {
+        azureWorkStep = AzureWorkStep_Connect;
+        PriorityDispatch_PostWork(&azureWork);
+    }
+}
+
+/// <summary>
+///     One slice of the Azure IoT work: connect if necessary, send the queued telemetry, do
+///     Azure IoT work, and schedule the next call according to how busy the client is.
+/// </summary>
+/// <returns>true if another step remains.</returns>
+static bool AzureWorkSlice(void *context)
+{
+    switch (azureWorkStep) {
+    case AzureWorkStep_Connect:
+        // The network only needs to be checked before connecting. Once the client has been set
+        // up, ConnectionStatusCallback reports when the connection is lost.
+        if (!iothubAuthenticated) {
+            Networking_InterfaceConnectionStatus status;
+            if (Networking_GetInterfaceConnectionStatus(NetworkInterface, &status) == 0) {
+                if (status & Networking_InterfaceConnectionStatus_ConnectedToInternet) {
+                    WakeTrace_Mark(WakeTrace_Phase_NetworkReady);
+                    SetupAzureClient();
+                }
+            } else if (errno != EAGAIN) {
+                Log_Debug("ERROR: Networking_GetInterfaceConnectionStatus: %d (%s)\n", errno,
+                          strerror(errno));
+                azureWorkStep = AzureWorkStep_Idle;
+                if (exitCodeCallbackFunction != NULL) {
+                    exitCodeCallbackFunction(ExitCode_InterfaceConnectionStatus_Failed);
+                }
+                return false;
             }
-            return;
         }
+        azureWorkStep = AzureWorkStep_DrainTelemetry;
+        return true;
+
+    case AzureWorkStep_DrainTelemetry:
+        if (iothubAuthenticated) {
+            DrainTelemetryQueue();
+        }
+        azureWorkStep = AzureWorkStep_DoWork;
+        return true;
+
+    case AzureWorkStep_DoWork:
+        if (iothubAuthenticated) {
+            IoTHubDeviceClient_LL_DoWork(iothubClientHandle);
+        }
+        azureWorkStep = AzureWorkStep_Idle;
+        ScheduleAzureTimer();
+        return false;
+
+    default:
+        azureWorkStep = AzureWorkStep_Idle;
+        return false;
     }
+}
 
-    if (iothubAuthenticated) {
-        IoTHubDeviceClient_LL_DoWork(iothubClientHandle);
+/// <summary>
+///     Arm the Azure timer to fire once after a delay.
+/// </summary>
+static void ArmAzureTimer(int delayMs)
+{
+    struct timespec delay = {.tv_sec = delayMs / 1000, .tv_nsec = (delayMs % 1000) * 1000000};
+    if (SetEventLoopTimerOneShot(azureTimer, &delay) != 0 && exitCodeCallbackFunction != NULL) {
+        exitCodeCallbackFunction(ExitCode_AzureTimer_Arm);
+    }
+}
+
+/// <summary>
+///     Schedule the next call to IoTHubDeviceClient_LL_DoWork: after the reconnect period if the
+///     client could not be set up, soon if the client is busy, and otherwise after an interval
+///     which backs off exponentially while the client stays idle.
+/// </summary>
+static void ScheduleAzureTimer(void)
+{
+    if (azureIoTReconnectDelayMs > 0) {
+        ArmAzureTimer(azureIoTReconnectDelayMs);
+        return;
+    }
+
+    // Until the network is up, keep checking for it quickly, so that the connection is made as
+    // soon as possible after waking from power-down.
+    bool busy = outstandingIoTHubRequests > 0 || awaitingConnectionStatus || !iothubAuthenticated ||
+                TelemetryQueue_GetCount() > 0;
+    if (busy) {
+        azureIoTDoWorkPeriodMs = AzureIoTMinDoWorkPeriodMs;
+    } else if (azureIoTDoWorkPeriodMs < AzureIoTMaxDoWorkPeriodMs) {
+        azureIoTDoWorkPeriodMs *= 2;
+        if (azureIoTDoWorkPeriodMs > AzureIoTMaxDoWorkPeriodMs) {
+            azureIoTDoWorkPeriodMs = AzureIoTMaxDoWorkPeriodMs;
+        }
+    }
+
+    ArmAzureTimer(azureIoTDoWorkPeriodMs);
+}
+
+/// <summary>
+///     Called when a request has been queued on the client, so that it is sent promptly even if
+///     the client has been idle.
+/// </summary>
+static void RequestAzureIoTWork(void)
+{
+    if (azureIoTDoWorkPeriodMs > AzureIoTMinDoWorkPeriodMs) {
+        azureIoTDoWorkPeriodMs = AzureIoTMinDoWorkPeriodMs;
+        ArmAzureTimer(azureIoTDoWorkPeriodMs);
     }
 }
 
@@ -154,35 +350,24 @@ static void SetupAzureClient(void)
 
     if (iothubClientHandle != NULL) {
         IoTHubDeviceClient_LL_Destroy(iothubClientHandle);
+        outstandingIoTHubRequests = 0;
+        DirectMethods_CancelAll();
     }
 
     isAzureClientSetupSuccessful = SetupAzureIoTHubClientWithDps();
 
     if (!isAzureClientSetupSuccessful) {
-        // If we fail to connect, reduce the polling frequency, starting at
-        // AzureIoTMinReconnectPeriodSeconds and with a backoff up to
-        // AzureIoTMaxReconnectPeriodSeconds
-        if (azureIoTPollPeriodSeconds == AzureIoTDefaultPollPeriodSeconds) {
-            azureIoTPollPeriodSeconds = AzureIoTMinReconnectPeriodSeconds;
-        } else {
-            azureIoTPollPeriodSeconds *= 2;
-            if (azureIoTPollPeriodSeconds > AzureIoTMaxReconnectPeriodSeconds) {
-                azureIoTPollPeriodSeconds = AzureIoTMaxReconnectPeriodSeconds;
-            }
-        }
-
-        struct timespec azureTelemetryPeriod = {.tv_sec = azureIoTPollPeriodSeconds, .tv_nsec = 0};
-        SetEventLoopTimerPeriod(azureTimer, &azureTelemetryPeriod);
-
-        Log_Debug("ERROR: Failed to create IoTHub Handle - will retry in %i seconds.\n",
-                  azureIoTPollPeriodSeconds);
+        BackOffReconnect();
+        Log_Debug("ERROR: Failed to create IoTHub Handle - will retry in %i ms.\n",
+                  azureIoTReconnectDelayMs);
         return;
     }
 
-    // Successfully connected, so make sure the polling frequency is back to the default
-    azureIoTPollPeriodSeconds = AzureIoTDefaultPollPeriodSeconds;
-    struct timespec azureTelemetryPeriod = {.tv_sec = azureIoTPollPeriodSeconds, .tv_nsec = 0};
-    SetEventLoopTimerPeriod(azureTimer, &azureTelemetryPeriod);
+    // Successfully connected, so poll quickly until the connection is confirmed. The back off
+    // period is kept until the IoT hub authenticates the device.
+    azureIoTReconnectDelayMs = 0;
+    azureIoTDoWorkPeriodMs = AzureIoTMinDoWorkPeriodMs;
+    awaitingConnectionStatus = true;
 
     iothubAuthenticated = true;
 
@@ -194,30 +379,190 @@ static void SetupAzureClient(void)
     }
 
     IoTHubDeviceClient_LL_SetDeviceTwinCallback(iothubClientHandle, DeviceTwinCallback, NULL);
-    IoTHubDeviceClient_LL_SetDeviceMethodCallback(iothubClientHandle, DeviceMethodCallback, NULL);
+    // The inbound callback lets a method respond after the callback has returned.
+    IoTHubClient_LL_SetDeviceMethodCallback_Ex(iothubClientHandle, DeviceMethodCallback, NULL);
     IoTHubDeviceClient_LL_SetConnectionStatusCallback(iothubClientHandle, ConnectionStatusCallback,
                                                       NULL);
 }
 
+/// <summary>
+///     Retry the connection less often after each failure, starting at
+///     AzureIoTMinReconnectPeriodSeconds and with a backoff up to
+///     AzureIoTMaxReconnectPeriodSeconds. The delay is shortened by a random part of
+///     reconnectJitterPercent of the period. AzureTimerEventHandler schedules the retry.
+/// </summary>
+static void BackOffReconnect(void)
+{
+    if (azureIoTReconnectPeriodSeconds == 0) {
+        azureIoTReconnectPeriodSeconds = AzureIoTMinReconnectPeriodSeconds;
+    } else {
+        azureIoTReconnectPeriodSeconds *= 2;
+        if (azureIoTReconnectPeriodSeconds > AzureIoTMaxReconnectPeriodSeconds) {
+            azureIoTReconnectPeriodSeconds = AzureIoTMaxReconnectPeriodSeconds;
+        }
+    }
+
+    int periodMs = azureIoTReconnectPeriodSeconds * 1000;
+    int jitterRangeMs = periodMs / 100 * (int)reconnectJitterPercent;
+    azureIoTReconnectDelayMs = periodMs;
+    if (jitterRangeMs > 0) {
+        azureIoTReconnectDelayMs -= rand_r(&reconnectJitterSeed) % (jitterRangeMs + 1);
+    }
+    if (azureIoTReconnectDelayMs < AzureIoTMinDoWorkPeriodMs) {
+        azureIoTReconnectDelayMs = AzureIoTMinDoWorkPeriodMs;
+    }
+}
+
 /// <summary>
 ///     Sets up the Azure IoT Hub connection (creates the iothubClientHandle)
-///     with DPS
+///     with DPS. The IoT hub which DPS assigned is cached, and is connected to directly while the
+///     cached assignment remains valid, so that waking from power down does not wait for DPS.
 /// </summary>
 static bool SetupAzureIoTHubClientWithDps(void)
 {
-    AZURE_SPHERE_PROV_RETURN_VALUE provResult =
-        IoTHubDeviceClient_LL_CreateWithAzureSphereDeviceAuthProvisioning(idScope, 10000,
-                                                                          &iothubClientHandle);
-    Log_Debug("IoTHubDeviceClient_LL_CreateWithAzureSphereDeviceAuthProvisioning returned '%s'.\n",
-              GetAzureSphereProvisioningResultString(provResult));
+    DpsCache_Assignment assignment;
+    if (DpsCache_Load(idScope, &assignment)) {
+        Log_Debug("INFO: Connecting to cached DPS assignment %s.\n", assignment.hubHostName);
+        if (SetupAzureIoTHubClientWithDaa(assignment.hubHostName, assignment.deviceId)) {
+            usingCachedDpsAssignment = true;
+            return true;
+        }
+
+        DpsCache_Remove();
+        if (iothubClientHandle != NULL) {
+            IoTHubDeviceClient_LL_Destroy(iothubClientHandle);
+            iothubClientHandle = NULL;
+            DirectMethods_CancelAll();
+        }
+    }
+
+    usingCachedDpsAssignment = false;
+    if (!RegisterWithDps(&assignment)) {
+        return false;
+    }
+
+    Log_Debug("INFO: DPS assigned the device to %s.\n", assignment.hubHostName);
+    DpsCache_Store(idScope, &assignment);
+    return SetupAzureIoTHubClientWithDaa(assignment.hubHostName, assignment.deviceId);
+}
+
+/// <summary>
+///     Sets up the Azure IoT Hub connection (creates the iothubClientHandle) to a known IoT hub,
+///     authenticating with the DAA certificate.
+/// </summary>
+/// <param name="iotHubHostName">The hostname of the IoT hub.</param>
+/// <param name="iotHubDeviceId">The ID of the device in the IoT hub, in lowercase.</param>
+static bool SetupAzureIoTHubClientWithDaa(const char *iotHubHostName, const char *iotHubDeviceId)
+{
+    // Set up auth type
+    int retError = iothub_security_init(IOTHUB_SECURITY_TYPE_X509);
+    if (retError != 0) {
+        Log_Debug("ERROR: iothub_security_init failed with error %d.\n", retError);
+        return false;
+    }
+
+    // Create Azure Iot Hub client handle
+    iothubClientHandle =
+        IoTHubDeviceClient_LL_CreateFromDeviceAuth(iotHubHostName, iotHubDeviceId, MQTT_Protocol);
 
-    if (provResult.result != AZURE_SPHERE_PROV_RESULT_OK) {
+    if (iothubClientHandle == NULL) {
+        Log_Debug("IoTHubDeviceClient_LL_CreateFromDeviceAuth returned NULL.\n");
+        return false;
+    }
+
+    // Enable DAA cert usage when x509 is invoked
+    if (IoTHubDeviceClient_LL_SetOption(iothubClientHandle, "SetDeviceId",
+                                        &deviceIdForDaaCertUsage) != IOTHUB_CLIENT_OK) {
+        Log_Debug("ERROR: Failure setting Azure IoT Hub client option \"SetDeviceId\".\n");
         return false;
     }
 
+    strncpy(deviceId, iotHubDeviceId, sizeof(deviceId) - 1);
     return true;
 }
 
+/// <summary>
+///     Registers the device with DPS, using the DAA certificate, and waits until DPS has assigned
+///     it to an IoT hub or DpsRegistrationTimeoutMs has elapsed.
+/// </summary>
+/// <param name="assignment">Receives the IoT hub and device ID which DPS assigned.</param>
+/// <returns>true if the device was assigned to an IoT hub; false otherwise.</returns>
+static bool RegisterWithDps(DpsCache_Assignment *assignment)
+{
+    DpsRegistration registration = {.completed = false, .succeeded = false,
+                                    .assignment = assignment};
+    PROV_DEVICE_LL_HANDLE provHandle = NULL;
+
+    int retError = prov_dev_security_init(SECURE_DEVICE_TYPE_X509);
+    if (retError != 0) {
+        Log_Debug("ERROR: prov_dev_security_init failed with error %d.\n", retError);
+        return false;
+    }
+
+    provHandle = Prov_Device_LL_Create(DpsGlobalEndpoint, idScope, Prov_Device_MQTT_Protocol);
+    if (provHandle == NULL) {
+        Log_Debug("ERROR: Prov_Device_LL_Create returned NULL.\n");
+        goto cleanup;
+    }
+
+    // Enable DAA cert usage when x509 is invoked
+    if (Prov_Device_LL_SetOption(provHandle, "SetDeviceId", &deviceIdForDaaCertUsage) !=
+        PROV_DEVICE_RESULT_OK) {
+        Log_Debug("ERROR: Failure setting DPS client option \"SetDeviceId\".\n");
+        goto cleanup;
+    }
+
+    if (Prov_Device_LL_Register_Device(provHandle, DpsRegisterDeviceCallback, &registration, NULL,
+                                       NULL) != PROV_DEVICE_RESULT_OK) {
+        Log_Debug("ERROR: Prov_Device_LL_Register_Device failed.\n");
+        goto cleanup;
+    }
+
+    const struct timespec pollPeriod = {.tv_sec = 0, .tv_nsec = DpsPollPeriodMs * 1000000};
+    for (int elapsedMs = 0; !registration.completed && elapsedMs < DpsRegistrationTimeoutMs;
+         elapsedMs += DpsPollPeriodMs) {
+        Prov_Device_LL_DoWork(provHandle);
+        nanosleep(&pollPeriod, NULL);
+    }
+
+    if (!registration.completed) {
+        Log_Debug("ERROR: DPS registration timed out.\n");
+    }
+
+cleanup:
+    if (provHandle != NULL) {
+        Prov_Device_LL_Destroy(provHandle);
+    }
+    prov_dev_security_deinit();
+    return registration.succeeded;
+}
+
+/// <summary>
+///     Callback invoked when DPS has processed the registration request.
+/// </summary>
+static void DpsRegisterDeviceCallback(PROV_DEVICE_RESULT registerResult, const char *iotHubUri,
+                                      const char *registeredDeviceId, void *context)
+{
+    DpsRegistration *registration = context;
+    registration->completed = true;
+
+    if (registerResult != PROV_DEVICE_RESULT_OK || iotHubUri == NULL ||
+        registeredDeviceId == NULL) {
+        Log_Debug("ERROR: DPS registration failed with result %d.\n", registerResult);
+        return;
+    }
+
+    if (strlen(iotHubUri) > DPS_CACHE_MAX_HUB_HOSTNAME_LENGTH ||
+        strlen(registeredDeviceId) > DPS_CACHE_MAX_DEVICE_ID_LENGTH) {
+        Log_Debug("ERROR: DPS returned an IoT hub hostname or device ID which is too long.\n");
+        return;
+    }
+
+    strcpy(registration->assignment->hubHostName, iotHubUri);
+    strcpy(registration->assignment->deviceId, registeredDeviceId);
+    registration->succeeded = true;
+}
+
 /// <summary>
 ///     Callback when the Azure IoT connection state changes.
 ///     This can indicate that a new connection attempt has succeeded or failed.
@@ -228,8 +573,26 @@ static void ConnectionStatusCallback(IOTHUB_CLIENT_CONNECTION_STATUS result,
                                      void *userContextCallback)
 {
     iothubAuthenticated = (result == IOTHUB_CLIENT_CONNECTION_AUTHENTICATED);
+    awaitingConnectionStatus = false;
     Log_Debug("Azure IoT connection status: %s\n", GetReasonString(reason));
 
+    if (iothubAuthenticated) {
+        WakeTrace_Mark(WakeTrace_Phase_IoTConnected);
+        azureIoTReconnectPeriodSeconds = 0;
+    } else {
+        // The client is recreated once the delay has passed. Backing off here too keeps a fleet
+        // which loses the IoT hub from reconnecting in step.
+        BackOffReconnect();
+        Log_Debug("INFO: Azure IoT - will reconnect in %i ms.\n", azureIoTReconnectDelayMs);
+    }
+
+    if (usingCachedDpsAssignment && !iothubAuthenticated) {
+        // The device may have been moved to another hub, or removed from this one.
+        Log_Debug("INFO: The cached DPS assignment failed; registering with DPS again.\n");
+        DpsCache_Remove();
+    }
+    usingCachedDpsAssignment = false;
+
     if (connectionStatusCallbackFunc != NULL) {
         connectionStatusCallbackFunc(iothubAuthenticated);
     } else {
@@ -238,23 +601,35 @@ static void ConnectionStatusCallback(IOTHUB_CLIENT_CONNECTION_STATUS result,
 }
 
 /// <summary>
-///     Callback invoked when a Direct Method is received from Azure IoT Hub.
+///     Callback invoked when a Direct Method is received from Azure IoT Hub. The method's handler
+///     responds through SendDirectMethodResponse, now or once its work has completed.
 /// </summary>
 static int DeviceMethodCallback(const char *methodName, const unsigned char *payload,
-                                size_t payloadSize, unsigned char **response, size_t *responseSize,
+                                size_t payloadSize, METHOD_HANDLE methodId,
                                 void *userContextCallback)
 {
-    // All methods are ignored
-    int result = -1;
-    char *responseString = "{}";
-
     Log_Debug("Received Device Method callback: Method name %s.\n", methodName);
+    DirectMethods_Dispatch(methodName, payload, payloadSize, (void *)methodId);
+    return 0;
+}
 
-    // if 'response' is non-NULL, the Azure IoT library frees it after use, so copy it to heap
-    *responseSize = strlen(responseString);
-    *response = malloc(*responseSize);
-    memcpy(*response, responseString, *responseSize);
-    return result;
+/// <summary>
+///     Sends the response to a direct method call to the IoT hub.
+/// </summary>
+static void SendDirectMethodResponse(void *methodId, int status, const unsigned char *response,
+                                     size_t responseSize)
+{
+    if (iothubClientHandle == NULL) {
+        return;
+    }
+
+    if (IoTHubClient_LL_DeviceMethodResponse(iothubClientHandle, (METHOD_HANDLE)methodId,
+                                             response, responseSize,
+                                             status) != IOTHUB_CLIENT_OK) {
+        Log_Debug("ERROR: Could not send the response to a direct method.\n");
+        return;
+    }
+    RequestAzureIoTWork();
 }
 
 /// <summary>
@@ -263,26 +638,13 @@ static int DeviceMethodCallback(const char *methodName, const unsigned char *pay
 static void DeviceTwinCallback(DEVICE_TWIN_UPDATE_STATE updateState, const unsigned char *payload,
                                size_t payloadSize, void *userContextCallback)
 {
-    size_t nullTerminatedJsonSize = payloadSize + 1;
-    char *nullTerminatedJsonString = (char *)malloc(nullTerminatedJsonSize);
-    if (nullTerminatedJsonString == NULL) {
-        Log_Debug("ERROR: Could not allocate buffer for twin update payload.\n");
-        abort();
-    }
-
-    // Copy the provided buffer to a null terminated buffer.
-    memcpy(nullTerminatedJsonString, payload, payloadSize);
-    // Add the null terminator at the end.
-    nullTerminatedJsonString[nullTerminatedJsonSize - 1] = 0;
-
-    Log_Debug(nullTerminatedJsonString);
-    Log_Debug("\n");
+    // The payload is passed on in place; it is neither copied nor null-terminated.
+    Log_Debug("%.*s\n", (int)payloadSize, (const char *)payload);
 
     if (deviceTwinReceivedCallbackFunc != NULL) {
-        deviceTwinReceivedCallbackFunc(nullTerminatedJsonString);
+        deviceTwinReceivedCallbackFunc((const char *)payload, payloadSize,
+                                       updateState == DEVICE_TWIN_UPDATE_COMPLETE);
     }
-
-    free(nullTerminatedJsonString);
 }
 
 /// <summary>
@@ -320,94 +682,179 @@ static const char *GetReasonString(IOTHUB_CLIENT_CONNECTION_STATUS_REASON reason
     return reasonString;
 }
 
+void AzureIoT_SetTelemetryContentType(const char *contentType, const char *contentEncoding)
+{
+    telemetryContentType = contentType;
+    telemetryContentEncoding = contentEncoding;
+}
+
+void AzureIoT_SetReconnectJitter(unsigned int percent)
+{
+    reconnectJitterPercent = percent > 100 ? 100 : percent;
+}
+
+const char *AzureIoT_GetDeviceId(void)
+{
+    return deviceId[0] != '\0' ? deviceId : NULL;
+}
+
 /// <summary>
-///     Converts AZURE_SPHERE_PROV_RETURN_VALUE to a string.
+///     Create an IoT Hub message which holds telemetry, with its content type and encoding set.
 /// </summary>
-static const char *GetAzureSphereProvisioningResultString(
-    AZURE_SPHERE_PROV_RETURN_VALUE provisioningResult)
+static IOTHUB_MESSAGE_HANDLE CreateTelemetryMessage(const void *message, size_t size)
 {
-    switch (provisioningResult.result) {
-    case AZURE_SPHERE_PROV_RESULT_OK:
-        return "AZURE_SPHERE_PROV_RESULT_OK";
-    case AZURE_SPHERE_PROV_RESULT_INVALID_PARAM:
-        return "AZURE_SPHERE_PROV_RESULT_INVALID_PARAM";
-    case AZURE_SPHERE_PROV_RESULT_NETWORK_NOT_READY:
-        return "AZURE_SPHERE_PROV_RESULT_NETWORK_NOT_READY";
-    case AZURE_SPHERE_PROV_RESULT_DEVICEAUTH_NOT_READY:
-        return "AZURE_SPHERE_PROV_RESULT_DEVICEAUTH_NOT_READY";
-    case AZURE_SPHERE_PROV_RESULT_PROV_DEVICE_ERROR:
-        return "AZURE_SPHERE_PROV_RESULT_PROV_DEVICE_ERROR";
-    case AZURE_SPHERE_PROV_RESULT_GENERIC_ERROR:
-        return "AZURE_SPHERE_PROV_RESULT_GENERIC_ERROR";
-    default:
-        return "UNKNOWN_RETURN_VALUE";
+    IOTHUB_MESSAGE_HANDLE messageHandle = IoTHubMessage_CreateFromByteArray(message, size);
+    if (messageHandle == 0) {
+        Log_Debug("ERROR: unable to create a new IoTHubMessage.\n");
+        return 0;
     }
+
+    if (IoTHubMessage_SetContentTypeSystemProperty(messageHandle, telemetryContentType) !=
+            IOTHUB_MESSAGE_OK ||
+        (telemetryContentEncoding != NULL &&
+         IoTHubMessage_SetContentEncodingSystemProperty(messageHandle, telemetryContentEncoding) !=
+             IOTHUB_MESSAGE_OK)) {
+        Log_Debug("ERROR: unable to set the content type of an IoTHubMessage.\n");
+        IoTHubMessage_Destroy(messageHandle);
+        return 0;
+    }
+
+    return messageHandle;
 }
 
-void AzureIoT_SendTelemetry(const char *jsonMessage, void *context)
+bool AzureIoT_SendTelemetry(const void *message, size_t size, void *context)
 {
-    Log_Debug("Sending Azure IoT Hub telemetry: %s.\n", jsonMessage);
+    Log_Debug("Sending Azure IoT Hub telemetry: %zu bytes of %s.\n", size, telemetryContentType);
 
-    // Check whether the device is connected to the internet.
-    if (IsConnectionReadyToSendTelemetry() == false) {
-        return;
+    // If the client is not connected, keep the telemetry to send once it is.
+    if (!iothubAuthenticated) {
+        return StoreTelemetryForLater(message, size, context);
     }
 
-    IOTHUB_MESSAGE_HANDLE messageHandle = IoTHubMessage_CreateFromString(jsonMessage);
-
+    IOTHUB_MESSAGE_HANDLE messageHandle = CreateTelemetryMessage(message, size);
     if (messageHandle == 0) {
-        Log_Debug("ERROR: unable to create a new IoTHubMessage.\n");
-        return;
+        return false;
     }
 
+    bool accepted;
     if (IoTHubDeviceClient_LL_SendEventAsync(iothubClientHandle, messageHandle, SendEventCallback,
                                              context) != IOTHUB_CLIENT_OK) {
         Log_Debug("ERROR: failure requesting IoTHubClient to send telemetry event.\n");
+        accepted = StoreTelemetryForLater(message, size, context);
     } else {
         Log_Debug("INFO: IoTHubClient accepted the telemetry event for delivery.\n");
+        ++outstandingIoTHubRequests;
+        RequestAzureIoTWork();
+        accepted = true;
     }
 
     IoTHubMessage_Destroy(messageHandle);
+    return accepted;
 }
 
 /// <summary>
-///     Check the network status.
+///     Store telemetry which cannot be sent now in the telemetry queue. Once it is stored, the
+///     telemetry is reported as sent, as it will be delivered when the connection returns.
 /// </summary>
-static bool IsConnectionReadyToSendTelemetry(void)
+static bool StoreTelemetryForLater(const void *message, size_t size, void *context)
 {
-    Networking_InterfaceConnectionStatus status;
-    if (Networking_GetInterfaceConnectionStatus(NetworkInterface, &status) != 0) {
-        if (errno != EAGAIN) {
-            Log_Debug("ERROR: Networking_GetInterfaceConnectionStatus: %d (%s)\n", errno,
-                      strerror(errno));
-
-            if (exitCodeCallbackFunction != NULL) {
-                exitCodeCallbackFunction(ExitCode_InterfaceConnectionStatus_Failed);
-            }
-            return false;
-        }
-        Log_Debug(
-            "WARNING: Cannot send Azure IoT Hub telemetry because the networking stack isn't ready "
-            "yet.\n");
+    if (!TelemetryQueue_Append(message, size)) {
         return false;
     }
 
-    if ((status & Networking_InterfaceConnectionStatus_ConnectedToInternet) == 0) {
-        Log_Debug(
-            "WARNING: Cannot send Azure IoT Hub telemetry because the device is not connected to "
-            "the internet.\n");
-        return false;
+    Log_Debug("INFO: Telemetry stored for sending later (%u message(s) queued).\n",
+              TelemetryQueue_GetCount());
+    if (sendTelemetryCallbackFunc != NULL) {
+        sendTelemetryCallbackFunc(true, context);
     }
-
     return true;
 }
 
+/// <summary>
+///     Send a batch of queued telemetry, if there is any and the previous batch has completed.
+///     Each message is removed from the queue when the IoT Hub confirms its receipt.
+/// </summary>
+static void DrainTelemetryQueue(void)
+{
+    if (drainInFlight != 0) {
+        return;
+    }
+    drainFailed = false;
+
+    char message[TELEMETRY_QUEUE_MAX_MESSAGE_LENGTH + 1];
+    size_t size;
+    uint32_t sequenceNumber;
+
+    // Skip any corrupt messages at the head of the queue. If storage cannot be read, the queue is
+    // left as it is, and drained again later.
+    TelemetryQueue_ReadResult readResult;
+    while ((readResult = TelemetryQueue_Read(0, message, &size, &sequenceNumber)) ==
+           TelemetryQueue_ReadResult_Corrupt) {
+        TelemetryQueue_Acknowledge(sequenceNumber);
+    }
+    if (readResult != TelemetryQueue_ReadResult_Ok) {
+        return;
+    }
+
+    size_t count = TelemetryQueue_GetCount();
+    for (size_t i = 0; i < count && drainInFlight < TELEMETRY_DRAIN_BATCH_SIZE; ++i) {
+        // A message which cannot be read ends the batch; a corrupt one is skipped once it reaches
+        // the head of the queue.
+        if (i > 0 && TelemetryQueue_Read(i, message, &size, &sequenceNumber) !=
+                         TelemetryQueue_ReadResult_Ok) {
+            break;
+        }
+
+        IOTHUB_MESSAGE_HANDLE messageHandle = CreateTelemetryMessage(message, size);
+        if (messageHandle == 0) {
+            break;
+        }
+
+        drainSequenceNumbers[drainInFlight] = sequenceNumber;
+        IOTHUB_CLIENT_RESULT result =
+            IoTHubDeviceClient_LL_SendEventAsync(iothubClientHandle, messageHandle,
+                                                 SendEventCallback,
+                                                 &drainSequenceNumbers[drainInFlight]);
+        IoTHubMessage_Destroy(messageHandle);
+
+        if (result != IOTHUB_CLIENT_OK) {
+            Log_Debug("ERROR: failure requesting IoTHubClient to send queued telemetry.\n");
+            break;
+        }
+        ++drainInFlight;
+        ++outstandingIoTHubRequests;
+    }
+
+    if (drainInFlight > 0) {
+        Log_Debug("INFO: Sending %u queued telemetry message(s).\n", drainInFlight);
+    }
+}
+
 /// <summary>
 ///     Callback invoked when the Azure IoT Hub send event request is processed.
 /// </summary>
 static void SendEventCallback(IOTHUB_CLIENT_CONFIRMATION_RESULT result, void *context)
 {
     Log_Debug("INFO: Azure IoT Hub send telemetry event callback: status code %d.\n", result);
+
+    if (outstandingIoTHubRequests > 0) {
+        --outstandingIoTHubRequests;
+    }
+
+    uint32_t *drainSequenceNumber = context;
+    if (drainSequenceNumber >= &drainSequenceNumbers[0] &&
+        drainSequenceNumber < &drainSequenceNumbers[TELEMETRY_DRAIN_BATCH_SIZE]) {
+        // Confirmations arrive in the order the messages were sent, so a successful confirmation
+        // means every earlier message in the batch has been delivered too.
+        if (result != IOTHUB_CLIENT_CONFIRMATION_OK) {
+            drainFailed = true;
+        } else if (!drainFailed) {
+            TelemetryQueue_Acknowledge(*drainSequenceNumber);
+        }
+        --drainInFlight;
+        return;
+    }
+
     if (sendTelemetryCallbackFunc != NULL) {
         sendTelemetryCallbackFunc(result == IOTHUB_CLIENT_CONFIRMATION_OK, context);
     } else {
@@ -415,20 +862,25 @@ static void SendEventCallback(IOTHUB_CLIENT_CONFIRMATION_RESULT result, void *co
     }
 }
 
-void AzureIoT_DeviceTwinReportState(const char *jsonState, void *context)
+bool AzureIoT_DeviceTwinReportState(const char *jsonState, void *context)
 {
     if (iothubClientHandle == NULL) {
         Log_Debug("ERROR: Azure IoT Hub client not initialized.\n");
-    } else {
-        if (IoTHubDeviceClient_LL_SendReportedState(
-                iothubClientHandle, (const unsigned char *)jsonState, strlen(jsonState),
-                ReportedStateCallback, context) != IOTHUB_CLIENT_OK) {
-            Log_Debug("ERROR: Azure IoT Hub client error when reporting state '%s'.\n", jsonState);
-        } else {
-            Log_Debug("INFO: Azure IoT Hub client accepted request to report state '%s'.\n",
-                      jsonState);
-        }
+        return false;
+    }
+
+    if (IoTHubDeviceClient_LL_SendReportedState(iothubClientHandle,
+                                                (const unsigned char *)jsonState,
+                                                strlen(jsonState), ReportedStateCallback,
+                                                context) != IOTHUB_CLIENT_OK) {
+        Log_Debug("ERROR: Azure IoT Hub client error when reporting state '%s'.\n", jsonState);
+        return false;
     }
+
+    Log_Debug("INFO: Azure IoT Hub client accepted request to report state '%s'.\n", jsonState);
+    ++outstandingIoTHubRequests;
+    RequestAzureIoTWork();
+    return true;
 }
 
 /// <summary>
@@ -438,8 +890,12 @@ void AzureIoT_DeviceTwinReportState(const char *jsonState, void *context)
 static void ReportedStateCallback(int result, void *context)
 {
     Log_Debug("INFO: Azure IoT Hub device twin reported state: %d\n", result);
+
+    if (outstandingIoTHubRequests > 0) {
+        --outstandingIoTHubRequests;
+    }
     if (deviceTwinReportStateAckCallbackFunc != NULL) {
-        deviceTwinReportStateAckCallbackFunc(true, context);
+        deviceTwinReportStateAckCallbackFunc(result >= 200 && result < 300, context);
     } else {
         Log_Debug("WARNING: No callback handler for a device twin ack.\n");
     }
@@ -3,10 +3,27 @@
 
 #pragma once
 
+#include <stdbool.h>
+#include <stddef.h>
+
 #include <applibs/eventloop.h>
 #include "exitcode.h"
 
-typedef void (*AzureIoT_DeviceTwinReceivedCallbackType)(const char *deviceTwinContent);
+/// <summary>
+///     Function called when a device twin update is received.
+/// </summary>
+/// <param name="deviceTwinContent">
+///     The JSON payload. This is not null-terminated, and is only valid for the duration of the
+///     call.
+/// </param>
+/// <param name="deviceTwinContentSize">Size of the payload in bytes.</param>
+/// <param name="isCompleteTwin">
+///     true if the payload is the complete twin, holding "desired" and "reported" objects; false if
+///     it holds only the desired properties which have changed.
+/// </param>
+typedef void (*AzureIoT_DeviceTwinReceivedCallbackType)(const char *deviceTwinContent,
+                                                        size_t deviceTwinContentSize,
+                                                        bool isCompleteTwin);
 typedef void (*AzureIoT_ConnectionStatusCallbackType)(bool connected);
 typedef void (*AzureIoT_SendTelemetryCallbackType)(bool success, void *context);
 typedef void (*AzureIoT_DeviceTwinReportStateAckCallbackType)(bool success, void *context);
@@ -45,11 +62,48 @@ void AzureIoT_Cleanup(void);
 ///     Enqueue telemetry to send to the Azure IoT Hub. The telemetry is not sent immediately; the
 ///     function will return immediately, and then call the
 ///     <see cref="AzureIoT_SendTelemetryCallbackType" /> (passed to
-///     <see cref="AzureIoT_Initialize" />) to indicate success or failure.
+///     <see cref="AzureIoT_Initialize" />) to indicate success or failure. If the device is not
+///     connected, the telemetry is instead stored in mutable storage and reported as successfully
+///     sent; stored telemetry is sent once the connection returns.
 /// </summary>
-/// <param name="jsonMessage">The telemetry to send, as a JSON string.</param>
+/// <param name="message">
+///     The telemetry to send, encoded as set by <see cref="AzureIoT_SetTelemetryContentType" />.
+/// </param>
+/// <param name="size">Size of the telemetry in bytes.</param>
 /// <param name="context">An optional context, which will be passed to the callback.</param>
-void AzureIoT_SendTelemetry(const char *jsonMessage, void *context);
+/// <returns>
+///     true if the telemetry was sent or stored, in which case the callback will be invoked;
+///     false otherwise.
+/// </returns>
+bool AzureIoT_SendTelemetry(const void *message, size_t size, void *context);
+
+/// <summary>
+///     Set the content type and content encoding system properties of telemetry messages, so
+///     that the IoT Hub and its consumers can decode them. By default, telemetry is sent as JSON
+///     ("application/json", "utf-8"). The strings are not copied.
+/// </summary>
+/// <param name="contentType">MIME type of the telemetry, such as "application/cbor".</param>
+/// <param name="contentEncoding">
+///     Character encoding of textual telemetry, such as "utf-8"; or NULL for binary telemetry.
+/// </param>
+void AzureIoT_SetTelemetryContentType(const char *contentType, const char *contentEncoding);
+
+/// <summary>
+///     Set how much of each reconnect delay is random. After each failure to connect, the delay
+///     before the next attempt doubles, from 10 seconds up to 10 minutes; it is then shortened by
+///     a random amount of up to this percentage of it, so that devices which lose the connection
+///     together spread their attempts out. By default, the delay is not randomized.
+/// </summary>
+/// <param name="percent">Percentage of the delay which is random, from 0 to 100.</param>
+void AzureIoT_SetReconnectJitter(unsigned int percent);
+
+/// <summary>
+///     Get the ID of the device in the IoT hub.
+/// </summary>
+/// <returns>
+///     The device ID, or NULL if the IoT hub client has not yet been created.
+/// </returns>
+const char *AzureIoT_GetDeviceId(void);
 
 /// <summary>
 ///     Enqueue a report containing Device Twin properties to send to the Azure IoT Hub. The report
@@ -59,4 +113,8 @@ void AzureIoT_SendTelemetry(const char *jsonMessage, void *context);
 /// </summary>
 /// <param name="jsonState">A JSON string representing the device twin properties to report.</param>
 /// <param name="context">An optional context, which will be passed to the callback.</param>
-void AzureIoT_DeviceTwinReportState(const char *jsonState, void *context);
+/// <returns>
+///     true if the report was accepted, in which case the callback will be invoked; false
+///     otherwise.
+/// </returns>
+bool AzureIoT_DeviceTwinReportState(const char *jsonState, void *context);
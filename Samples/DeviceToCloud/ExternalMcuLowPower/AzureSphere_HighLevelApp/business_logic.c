@@ -5,6 +5,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <time.h>
 
 #include <applibs/log.h>
 
@@ -13,27 +14,45 @@
 #include "business_logic.h"
 #include "color.h"
 #include "cloud.h"
+#include "dispense_stats.h"
 #include "eventloop_timer_utilities.h"
 #include "exitcode.h"
+#include "latency_trace.h"
 #include "mcu_messaging.h"
+#include "message_protocol.h"
 #include "persistent_storage.h"
 #include "power.h"
 #include "telemetry.h"
 #include "update.h"
+#include "wake_trace.h"
 
 static void Initialize(void);
+static bool CalculateTelemetry(CloudTelemetry *cloudTelemetry);
 static void CalculateAndSendTelemetry(void);
+static void StoreTelemetry(void);
+static ExitCode StartCloudCycle(void);
 static void LogTelemetry(const DeviceTelemetry *const telemetry);
 
 static void HandleMcuMessageFailure(void);
 static void HandleInitResponseReceived(void);
-static void HandleTelemetryResponseReceived(const DeviceTelemetry *telemetry);
+static void HandleTelemetryResponseReceived(const DeviceTelemetryBatch *batch);
 static void HandleSetLedResponseReceived(const LedColor *color);
 
 static void HandleCloudSendTelemetryAck(bool success);
 static void HandleCloudFlavorAckReceived(bool success);
+static void HandleCloudWakeTraceAck(bool success);
+static void HandleCloudLatencyTraceAck(bool success);
 
 static void HandleTimeout(EventLoopTimer *timer);
+static void SetFlavor(void);
+static bool IsFlavorUnchanged(void);
+static void PersistCycleState(void);
+static uint32_t HashDeviceId(const char *deviceId);
+static int32_t GetTelemetrySlotOffset(void);
+static bool IsUpdateCheckDue(void);
+static void RecordUpdateCheck(void);
+static void SendWakeTraces(void);
+static void SendLatencyTrace(void);
 
 // Application state
 typedef enum {
@@ -56,17 +75,78 @@ typedef enum {
     State_Invalid = -1
 } State;
 
+// The MCUs of the machines which this device serves, from the MCU_MACHINE_ADDRESSES build option.
+// A machine which is alone on its UART has MessageProtocol_DefaultAddress. Several machines share
+// one bus, such as RS-485, on which their responses would collide, so only one request is sent to
+// them at a time: they are initialized, asked for their telemetry and sent the flavor one after
+// another. Their telemetry is sent to the cloud together, in one message.
+#ifndef MCU_MACHINE_ADDRESSES
+#define MCU_MACHINE_ADDRESSES 0
+#endif
+static const uint8_t machineAddresses[] = {MCU_MACHINE_ADDRESSES};
+#define MACHINE_COUNT (sizeof(machineAddresses) / sizeof(machineAddresses[0]))
+_Static_assert(MACHINE_COUNT <= MAX_MACHINES, "MCU_MACHINE_ADDRESSES lists too many machines");
+
 static State applicationState = State_Invalid;
 static bool mcuReady;
 static bool cloudReady;
+static bool telemetryRequested;
 static bool haveTelemetry;
-static DeviceTelemetry telemetry;
+static DeviceTelemetry telemetry[MAX_MACHINES];
+// Sequence number which each machine's MCU stamped on its batch, which the telemetry carries.
+static uint32_t batchSequences[MAX_MACHINES];
 static bool telemetryReceivedByCloud;
 static bool haveFlavor;
 static char *receivedFlavorName;
+static LedColor receivedFlavorColor;
+static bool flavorPending;
+// Indices into machineAddresses of the machines which are being initialized, asked for their
+// telemetry and sent the flavor.
+static size_t initMachine;
+static size_t telemetryMachine;
+static size_t flavorMachine;
 static bool flavorAckByCloud;
 static bool updateCheckComplete;
 static bool rebootNeededForUpdates;
+// Set if the MCU reports that telemetry is ready after this cycle collected it, so that the device
+// wakes again soon to collect the rest.
+static bool telemetryReadyAgain;
+
+// Most wake cycles are fast cycles, which power down as soon as the telemetry has been delivered
+// and any flavor change has been applied: they leave the flavor alone if the desired properties
+// have not changed since it was last applied. Every fastCyclesPerFullCycle fast cycles are
+// followed by a full cycle, which sends the flavor to the MCU again. A cycle is also full if there
+// is no cycle state.
+static const uint32_t fastCyclesPerFullCycle = 9;
+
+// Waiting for the OS to report its check for updates keeps the device awake for up to two
+// minutes, so a cycle only waits for it once UPDATE_CHECK_INTERVAL_SECONDS have passed since the
+// OS last reported one. Other cycles power down without waiting; an update which has started to
+// download is still waited for.
+#ifndef UPDATE_CHECK_INTERVAL_SECONDS
+#define UPDATE_CHECK_INTERVAL_SECONDS (24 * 60 * 60)
+#endif
+static bool fastCycle;
+static CycleState cycleState;
+
+// Bringing up the network and the IoT Hub connection takes far more energy than the rest of a
+// cycle, so a wake which only collects telemetry need not connect. Of every CLOUD_CYCLE_INTERVAL
+// cycles, all but one are local cycles, which store the telemetry in the telemetry queue and power
+// down without connecting. The other is a cloud cycle, which connects, sends the stored telemetry
+// with its own, and applies any flavor change. A local cycle becomes a cloud cycle if a machine is
+// low on soda, or if its telemetry cannot be stored.
+#ifndef CLOUD_CYCLE_INTERVAL
+#define CLOUD_CYCLE_INTERVAL 1
+#endif
+static const uint32_t cloudCycleInterval = CLOUD_CYCLE_INTERVAL;
+static bool localCycle;
+static EventLoop *eventLoop;
+static void *cloudBackendConfiguration;
+
+// The traces of earlier wake cycles are sent once the cloud is connected, and removed from mutable
+// storage once every one has been received by the cloud, or stored to be sent later.
+static size_t wakeTracesOutstanding;
+static bool wakeTraceSendFailed;
 
 static ExitCode businessLogicExitCode;
 
@@ -74,20 +154,58 @@ static EventLoopTimer *timeoutTimer = NULL;
 
 static const long timeoutPeriodInSeconds = 120;
 
-ExitCode BusinessLogic_Initialize(EventLoop *el)
+ExitCode BusinessLogic_Initialize(EventLoop *el, void *backendConfiguration)
 {
+    eventLoop = el;
+    cloudBackendConfiguration = backendConfiguration;
     applicationState = State_Initializing;
     mcuReady = false;
     cloudReady = false;
+    telemetryRequested = false;
     haveTelemetry = false;
     telemetryReceivedByCloud = false;
     haveFlavor = false;
     receivedFlavorName = NULL;
+    flavorPending = false;
+    initMachine = 0;
+    telemetryMachine = 0;
+    flavorMachine = 0;
     flavorAckByCloud = false;
     updateCheckComplete = false;
     rebootNeededForUpdates = false;
+    wakeTracesOutstanding = 0;
+    wakeTraceSendFailed = false;
     businessLogicExitCode = ExitCode_Success;
 
+    // A cycle with no cycle state connects, so that the device is seen by the cloud as soon as
+    // it is first started.
+    bool haveCycleState = PersistentStorage_RetrieveCycleState(&cycleState);
+    if (!haveCycleState) {
+        memset(&cycleState, 0, sizeof(cycleState));
+        cycleState.desiredPropertiesVersion = -1;
+        cycleState.telemetrySlotOffsetSeconds = -1;
+        cycleState.reconnectJitterPercent = CLOUD_DEFAULT_RECONNECT_JITTER_PERCENT;
+    }
+    Cloud_Schedule schedule = {.telemetrySlotOffsetSeconds = cycleState.telemetrySlotOffsetSeconds,
+                               .reconnectJitterPercent = cycleState.reconnectJitterPercent};
+    Cloud_SetSchedule(&schedule);
+    localCycle = haveCycleState && cycleState.localCyclesSinceCloudCycle + 1 < cloudCycleInterval;
+    fastCycle = haveCycleState && cycleState.fastCyclesSinceFullCycle < fastCyclesPerFullCycle;
+    if (fastCycle) {
+        Cloud_SetAppliedDesiredPropertiesVersion(cycleState.desiredPropertiesVersion);
+    }
+
+    if (localCycle) {
+        Log_Debug("INFO: Starting local cycle %u of %u.\n",
+                  cycleState.localCyclesSinceCloudCycle + 1, cloudCycleInterval - 1);
+        Cloud_InitializeLocal();
+    } else {
+        ExitCode ec = StartCloudCycle();
+        if (ec != ExitCode_Success) {
+            return ec;
+        }
+    }
+
     timeoutTimer = CreateEventLoopDisarmedTimer(el, HandleTimeout);
     if (timeoutTimer == NULL) {
         return ExitCode_BusinessLogic_TimeoutTimerCreate;
@@ -122,14 +240,25 @@ bool BusinessLogic_Run(ExitCode *ec)
             }
             break;
         case State_WaitForCloud:
-            if (cloudReady) {
+            // A local cycle does not connect, so it goes on at once.
+            if (cloudReady || localCycle) {
+                if (!localCycle) {
+                    SendWakeTraces();
+                    SendLatencyTrace();
+                }
                 applicationState = State_GatherTelemetry;
                 finished = false;
             }
             break;
         case State_GatherTelemetry:
-            McuMessaging_RequestTelemetry(HandleTelemetryResponseReceived, HandleMcuMessageFailure);
+            if (!telemetryRequested) {
+                McuMessaging_RequestTelemetryBatch(machineAddresses[telemetryMachine],
+                                                   HandleTelemetryResponseReceived,
+                                                   HandleMcuMessageFailure);
+                telemetryRequested = true;
+            }
             applicationState = State_WaitForTelemetry;
+            finished = false;
             break;
         case State_WaitForTelemetry:
             if (haveTelemetry) {
@@ -138,6 +267,11 @@ bool BusinessLogic_Run(ExitCode *ec)
             }
             break;
         case State_SendTelemetry:
+            if (localCycle) {
+                StoreTelemetry();
+                finished = false;
+                break;
+            }
             CalculateAndSendTelemetry();
             applicationState = State_WaitForTelemetryAck;
             break;
@@ -148,20 +282,22 @@ bool BusinessLogic_Run(ExitCode *ec)
             }
             break;
         case State_PersistTelemetry:
-            PersistentStorage_PersistTelemetry(&telemetry);
+            PersistentStorage_PersistTelemetry(machineAddresses, telemetry, MACHINE_COUNT);
             applicationState = State_WaitForFlavor;
             finished = false;
             break;
         case State_WaitForFlavor:
-            if (haveFlavor && flavorAckByCloud) {
+            if ((haveFlavor && flavorAckByCloud) || IsFlavorUnchanged()) {
                 applicationState = State_WaitForUpdate;
-                Update_NotifyBusinessLogicComplete();
+                PersistCycleState();
+                Update_NotifyBusinessLogicComplete(IsUpdateCheckDue());
                 DisarmEventLoopTimer(timeoutTimer);
                 finished = false;
             }
             break;
         case State_WaitForUpdate:
             if (updateCheckComplete) {
+                RecordUpdateCheck();
                 if (rebootNeededForUpdates) {
                     applicationState = State_Reboot;
                 } else {
@@ -198,7 +334,7 @@ bool BusinessLogic_Run(ExitCode *ec)
             break;
         case State_Sleep:
             Log_Debug("INFO: Requesting device power-down.\n");
-            Power_RequestPowerdown();
+            Power_RequestPowerdown(telemetryReadyAgain, GetTelemetrySlotOffset());
             applicationState =
                 (businessLogicExitCode == ExitCode_Success) ? State_Success : State_Failure;
             finished = false;
@@ -219,6 +355,14 @@ bool BusinessLogic_Run(ExitCode *ec)
     return logicComplete;
 }
 
+void BusinessLogic_NotifyTelemetryReady(void)
+{
+    // Before the telemetry is collected, the event needs no action: this cycle collects it anyway.
+    if (haveTelemetry) {
+        telemetryReadyAgain = true;
+    }
+}
+
 void BusinessLogic_NotifyCloudConnectionChange(bool connected)
 {
     Log_Debug("INFO: Cloud connection: %s\n", connected ? "established" : "disconnected");
@@ -230,18 +374,27 @@ void BusinessLogic_NotifyCloudFlavorChange(const LedColor *color, const char *fl
     if (color != NULL) {
         Log_Debug("INFO: Sending SetLed RGB (%d, %d, %d)\n", color->red ? 1 : 0,
                   color->green ? 1 : 0, color->blue ? 1 : 0);
-        McuMessaging_SetLed(color, HandleSetLedResponseReceived, HandleMcuMessageFailure);
         if (flavorName != NULL) {
             receivedFlavorName = strdup(flavorName);
         }
+        receivedFlavorColor = *color;
+        flavorPending = true;
+
+        // A single MCU can be sent the flavor while it is asked for its telemetry. On a shared
+        // bus, the flavor is sent once the telemetry has been gathered.
+        if (MACHINE_COUNT == 1 || haveTelemetry) {
+            SetFlavor();
+        }
     } else {
         Log_Debug("INFO: No color change - sending flavor change acknowledgement.\n");
+        haveFlavor = true;
         Cloud_SendFlavorAcknowledgement(color, flavorName, HandleCloudFlavorAckReceived);
     }
 }
 
 void BusinessLogic_NotifyUpdateCheckComplete(bool rebootRequired)
 {
+    WakeTrace_Mark(WakeTrace_Phase_UpdateCheckDone);
     updateCheckComplete = true;
     rebootNeededForUpdates = rebootRequired;
     Log_Debug("INFO: Update complete - reboot %s.\n", rebootRequired ? "required" : "not required");
@@ -253,6 +406,7 @@ void BusinessLogic_NotifyUpdateCheckFailed(ExitCode exitCode)
 
     // Flag the update check as complete, but allow the business logic to continue.
     // Save the ExitCode to return on completion.
+    WakeTrace_Mark(WakeTrace_Phase_UpdateCheckDone);
     updateCheckComplete = true;
     businessLogicExitCode = exitCode;
 }
@@ -270,30 +424,112 @@ void BusinessLogic_NotifyFatalError(ExitCode exitCode)
 
 static void Initialize(void)
 {
-    McuMessaging_Init(HandleInitResponseReceived, HandleMcuMessageFailure);
+    McuMessaging_Init(machineAddresses[0], HandleInitResponseReceived, HandleMcuMessageFailure);
+
+    // The message protocol allows several requests to be outstanding at once, so request the
+    // telemetry of a single MCU straight away rather than waiting for the MCU and cloud to become
+    // ready. The response is collected in State_WaitForTelemetry.
+    if (MACHINE_COUNT == 1 && MessageProtocol_CanSendRequest()) {
+        McuMessaging_RequestTelemetryBatch(machineAddresses[0], HandleTelemetryResponseReceived,
+                                           HandleMcuMessageFailure);
+        telemetryRequested = true;
+    }
 }
 
-static void CalculateAndSendTelemetry()
+/// <summary>
+///     Calculate the telemetry of each machine to send to the cloud, from the telemetry which was
+///     collected and the telemetry which was last persisted.
+/// </summary>
+/// <returns>
+///     true if any machine has run low on soda since its telemetry was last persisted.
+/// </returns>
+static bool CalculateTelemetry(CloudTelemetry *cloudTelemetry)
 {
-    CloudTelemetry cloudTelemetry;
-    DeviceTelemetry previousTelemetry;
-    bool retrievedTelemetry = PersistentStorage_RetrieveTelemetry(&previousTelemetry);
+    bool ranLow = false;
+    for (size_t i = 0; i < MACHINE_COUNT; ++i) {
+        CloudTelemetry *machine = &cloudTelemetry[i];
+        DeviceTelemetry previousTelemetry;
+        bool retrievedTelemetry =
+            PersistentStorage_RetrieveTelemetry(machineAddresses[i], &previousTelemetry);
+
+        if (retrievedTelemetry) {
+            Log_Debug("INFO: Previous telemetry of MCU %u found in persistent storage: \n",
+                      machineAddresses[i]);
+            LogTelemetry(&previousTelemetry);
+            machine->dispensesSinceLastSync =
+                telemetry[i].lifetimeTotalDispenses - previousTelemetry.lifetimeTotalDispenses;
+        } else {
+            machine->dispensesSinceLastSync = telemetry[i].lifetimeTotalDispenses;
+        }
 
-    if (retrievedTelemetry) {
-        Log_Debug("INFO: Previous telemetry found in persistent storage: \n");
-        LogTelemetry(&previousTelemetry);
-        cloudTelemetry.dispensesSinceLastSync =
-            telemetry.lifetimeTotalDispenses - previousTelemetry.lifetimeTotalDispenses;
-    } else {
-        cloudTelemetry.dispensesSinceLastSync = telemetry.lifetimeTotalDispenses;
+        machine->machineAddress = machineAddresses[i];
+        machine->lifetimeTotalDispenses = telemetry[i].lifetimeTotalDispenses;
+        machine->remainingDispenses =
+            telemetry[i].lifetimeTotalStockedDispenses - telemetry[i].lifetimeTotalDispenses;
+        machine->lowSoda = machine->remainingDispenses <= LowDispenseAlertThreshold;
+        machine->batchSequence = batchSequences[i];
+
+        DispenseStats_Summary stats;
+        machine->haveDispenseStats =
+            DispenseStats_GetSummary(machineAddresses[i], machine->remainingDispenses, &stats);
+        if (machine->haveDispenseStats) {
+            machine->dispensesPerHour = stats.dispensesPerHour;
+            machine->hoursToEmpty = stats.hoursToEmpty;
+            machine->peakHour = stats.peakHour;
+        }
+
+        uint32_t previousRemaining = previousTelemetry.lifetimeTotalStockedDispenses -
+                                     previousTelemetry.lifetimeTotalDispenses;
+        bool wasLow = retrievedTelemetry && previousRemaining <= LowDispenseAlertThreshold;
+        ranLow |= machine->lowSoda && !wasLow;
+    }
+
+    return ranLow;
+}
+
+static void CalculateAndSendTelemetry(void)
+{
+    CloudTelemetry cloudTelemetry[MAX_MACHINES];
+    CalculateTelemetry(cloudTelemetry);
+    Cloud_SendTelemetry(cloudTelemetry, MACHINE_COUNT, HandleCloudSendTelemetryAck);
+}
+
+/// <summary>
+///     On a local cycle, store the telemetry for the next cloud cycle to send, and finish the
+///     cycle without waiting for an update check. A machine which has run low on soda needs
+///     attention now, so the cycle connects to send it instead, as it does if the telemetry
+///     cannot be stored. A machine which stays low does not make later local cycles connect.
+/// </summary>
+static void StoreTelemetry(void)
+{
+    CloudTelemetry cloudTelemetry[MAX_MACHINES];
+    bool ranLow = CalculateTelemetry(cloudTelemetry);
+    if (!ranLow && Cloud_StoreTelemetry(cloudTelemetry, MACHINE_COUNT)) {
+        PersistentStorage_PersistTelemetry(machineAddresses, telemetry, MACHINE_COUNT);
+        ++cycleState.localCyclesSinceCloudCycle;
+        PersistentStorage_PersistCycleState(&cycleState);
+        Update_NotifyBusinessLogicComplete(false);
+        DisarmEventLoopTimer(timeoutTimer);
+        applicationState = State_WaitForUpdate;
+        return;
     }
 
-    cloudTelemetry.lifetimeTotalDispenses = telemetry.lifetimeTotalDispenses;
-    cloudTelemetry.remainingDispenses =
-        telemetry.lifetimeTotalStockedDispenses - telemetry.lifetimeTotalDispenses;
-    cloudTelemetry.lowSoda = cloudTelemetry.remainingDispenses <= LowDispenseAlertThreshold;
+    Log_Debug("INFO: %s - connecting to the cloud.\n",
+              ranLow ? "Soda has run low" : "Cannot store telemetry");
+    applicationState = State_WaitForCloud;
+    ExitCode ec = StartCloudCycle();
+    if (ec != ExitCode_Success) {
+        BusinessLogic_NotifyFatalError(ec);
+    }
+}
 
-    Cloud_SendTelemetry(&cloudTelemetry, HandleCloudSendTelemetryAck);
+static ExitCode StartCloudCycle(void)
+{
+    localCycle = false;
+    Log_Debug("INFO: Starting %s cloud cycle.\n", fastCycle ? "fast" : "full");
+    return Cloud_Initialize(eventLoop, cloudBackendConfiguration, BusinessLogic_NotifyFatalError,
+                            BusinessLogic_NotifyCloudConnectionChange,
+                            BusinessLogic_NotifyCloudFlavorChange);
 }
 
 static void HandleMcuMessageFailure(void)
@@ -306,7 +542,13 @@ static void HandleMcuMessageFailure(void)
 
 static void HandleInitResponseReceived(void)
 {
-    Log_Debug("INFO: Init sent to MCU and response received.\n");
+    Log_Debug("INFO: Init sent to MCU %u and response received.\n",
+              machineAddresses[initMachine]);
+    if (++initMachine < MACHINE_COUNT) {
+        McuMessaging_Init(machineAddresses[initMachine], HandleInitResponseReceived,
+                          HandleMcuMessageFailure);
+        return;
+    }
     mcuReady = true;
 }
 
@@ -317,19 +559,73 @@ static void LogTelemetry(const DeviceTelemetry *const telemetry)
     Log_Debug("INFO: Capacity: %u\n", telemetry->capacity);
 }
 
-static void HandleTelemetryResponseReceived(const DeviceTelemetry *receivedTelemetry)
+static void LogTelemetryEvent(const DeviceTelemetryEvent *event)
 {
-    Log_Debug("INFO: Telemetry received from MCU: \n");
-    LogTelemetry(receivedTelemetry);
+    switch (event->type) {
+    case DeviceTelemetryEvent_Dispense:
+        Log_Debug("INFO: %u ms ago: dispense\n", event->millisecondsBeforeBatch);
+        break;
+    case DeviceTelemetryEvent_ButtonPress:
+        Log_Debug("INFO: %u ms ago: %s button pressed\n", event->millisecondsBeforeBatch,
+                  event->button == DeviceTelemetryButton_Restock ? "restock" : "dispense");
+        break;
+    case DeviceTelemetryEvent_Flavor:
+        Log_Debug("INFO: %u ms ago: flavor LED set to (%d, %d, %d)\n",
+                  event->millisecondsBeforeBatch, event->flavorColor.red ? 1 : 0,
+                  event->flavorColor.green ? 1 : 0, event->flavorColor.blue ? 1 : 0);
+        break;
+    }
+}
 
-    telemetry = *receivedTelemetry;
+static void HandleTelemetryResponseReceived(const DeviceTelemetryBatch *batch)
+{
+    Log_Debug("INFO: Telemetry received from MCU %u: \n", machineAddresses[telemetryMachine]);
+    LogTelemetry(&batch->counters);
+
+    Log_Debug("INFO: %u events since last telemetry (%u dropped):\n", batch->eventCount,
+              batch->droppedEvents);
+    for (size_t i = 0; i < batch->eventCount; ++i) {
+        LogTelemetryEvent(&batch->events[i]);
+    }
+
+    // The MCU starts a new log once it has sent the batch, so its events are added to the
+    // statistics now, whether or not the telemetry reaches the cloud.
+    telemetry[telemetryMachine] = batch->counters;
+    batchSequences[telemetryMachine] = batch->batchSequence;
+    LatencyTrace_AddBatch(machineAddresses[telemetryMachine], batch);
+    DispenseStats_Update(machineAddresses[telemetryMachine], batch, time(NULL));
+    if (++telemetryMachine < MACHINE_COUNT) {
+        McuMessaging_RequestTelemetryBatch(machineAddresses[telemetryMachine],
+                                           HandleTelemetryResponseReceived,
+                                           HandleMcuMessageFailure);
+        return;
+    }
     haveTelemetry = true;
+    DispenseStats_Persist();
+
+    if (flavorPending) {
+        SetFlavor();
+    }
+}
+
+static void SetFlavor(void)
+{
+    flavorPending = false;
+    flavorMachine = 0;
+    McuMessaging_SetLed(machineAddresses[0], &receivedFlavorColor, HandleSetLedResponseReceived,
+                        HandleMcuMessageFailure);
 }
 
 static void HandleSetLedResponseReceived(const LedColor *color)
 {
-    Log_Debug("INFO: SetLed sent to device and response received: RGB (%d, %d, %d).\n",
-              color->red ? 1 : 0, color->green ? 1 : 0, color->blue ? 1 : 0);
+    Log_Debug("INFO: SetLed sent to MCU %u and response received: RGB (%d, %d, %d).\n",
+              machineAddresses[flavorMachine], color->red ? 1 : 0, color->green ? 1 : 0,
+              color->blue ? 1 : 0);
+    if (++flavorMachine < MACHINE_COUNT) {
+        McuMessaging_SetLed(machineAddresses[flavorMachine], &receivedFlavorColor,
+                            HandleSetLedResponseReceived, HandleMcuMessageFailure);
+        return;
+    }
     haveFlavor = true;
 
     if (Cloud_SendFlavorAcknowledgement(color, receivedFlavorName, HandleCloudFlavorAckReceived)) {
@@ -341,15 +637,151 @@ static void HandleSetLedResponseReceived(const LedColor *color)
 static void HandleCloudSendTelemetryAck(bool success)
 {
     Log_Debug("INFO: Telemetry received by cloud\n");
+    if (success) {
+        WakeTrace_Mark(WakeTrace_Phase_TelemetryAcked);
+    }
     telemetryReceivedByCloud = success;
 }
 
+static void HandleCloudWakeTraceAck(bool success)
+{
+    if (wakeTracesOutstanding == 0) {
+        return;
+    }
+
+    wakeTraceSendFailed |= !success;
+    if (--wakeTracesOutstanding == 0 && !wakeTraceSendFailed) {
+        Log_Debug("INFO: Wake traces received by cloud\n");
+        WakeTrace_ClearStored();
+    }
+}
+
+static void SendWakeTraces(void)
+{
+    const WakeTrace_Record *records;
+    size_t count = WakeTrace_GetStored(&records);
+    wakeTracesOutstanding = 0;
+    for (size_t i = 0; i < count; ++i) {
+        WakeTrace_Log(&records[i]);
+        if (Cloud_SendWakeTrace(&records[i], HandleCloudWakeTraceAck)) {
+            ++wakeTracesOutstanding;
+        } else {
+            wakeTraceSendFailed = true;
+        }
+    }
+}
+
+static void HandleCloudLatencyTraceAck(bool success)
+{
+    if (success) {
+        Log_Debug("INFO: Latency trace received by cloud\n");
+        LatencyTrace_ClearStored();
+    }
+}
+
+// The trace of the telemetry of an earlier cycle is sent once the cloud is connected, and removed
+// from mutable storage once it has been received by the cloud, or stored to be sent later.
+static void SendLatencyTrace(void)
+{
+    const LatencyTrace_Record *record;
+    if (LatencyTrace_GetStored(&record)) {
+        LatencyTrace_Log(record);
+        Cloud_SendLatencyTrace(record, HandleCloudLatencyTraceAck);
+    }
+}
+
 static void HandleCloudFlavorAckReceived(bool success)
 {
     Log_Debug("INFO: Flavor ack received by cloud\n");
     flavorAckByCloud = success;
 }
 
+// On a fast cycle, the flavor needs no attention if the desired properties have the version which
+// was applied on an earlier cycle, in which case the cloud does not report them.
+static bool IsFlavorUnchanged(void)
+{
+    int64_t version;
+    return fastCycle && !haveFlavor && Cloud_GetDesiredPropertiesVersion(&version) &&
+           version == cycleState.desiredPropertiesVersion;
+}
+
+static void PersistCycleState(void)
+{
+    int64_t version;
+    if (!Cloud_GetDesiredPropertiesVersion(&version)) {
+        version = -1;
+    }
+
+    Cloud_Schedule schedule;
+    Cloud_GetSchedule(&schedule);
+    const char *deviceId = Cloud_GetDeviceId();
+
+    cycleState.desiredPropertiesVersion = version;
+    cycleState.localCyclesSinceCloudCycle = 0;
+    cycleState.fastCyclesSinceFullCycle = fastCycle ? cycleState.fastCyclesSinceFullCycle + 1 : 0;
+    cycleState.telemetrySlotOffsetSeconds = schedule.telemetrySlotOffsetSeconds;
+    cycleState.reconnectJitterPercent = schedule.reconnectJitterPercent;
+    if (deviceId != NULL) {
+        cycleState.deviceIdHash = HashDeviceId(deviceId);
+    }
+    PersistentStorage_PersistCycleState(&cycleState);
+}
+
+/// <summary>
+///     Hash the device ID with 32-bit FNV-1a, which spreads similar IDs, such as those which
+///     differ only in their last characters, across the whole range. The hash is never 0, which
+///     means that the device ID is not known.
+/// </summary>
+static uint32_t HashDeviceId(const char *deviceId)
+{
+    uint32_t hash = 2166136261u;
+    for (const char *c = deviceId; *c != '\0'; ++c) {
+        hash ^= (uint8_t)*c;
+        hash *= 16777619u;
+    }
+    return hash != 0 ? hash : 1;
+}
+
+// Devices which were installed together, or which all lost power together, would otherwise wake
+// and connect in step. Each device wakes in its own slot of the power-down period instead: the
+// offset which the device twin set, or one derived from the device ID, which is spread evenly over
+// the fleet. Until the device has connected once, it has no slot.
+static int32_t GetTelemetrySlotOffset(void)
+{
+    if (cycleState.telemetrySlotOffsetSeconds >= 0) {
+        return cycleState.telemetrySlotOffsetSeconds;
+    }
+    if (cycleState.deviceIdHash != 0) {
+        return (int32_t)(cycleState.deviceIdHash & INT32_MAX);
+    }
+    return -1;
+}
+
+// The clock may have been reset since the last check was recorded, in which case it is earlier
+// than the recorded time, and the check is treated as due.
+static bool IsUpdateCheckDue(void)
+{
+    if (cycleState.lastUpdateCheckTime == 0) {
+        return true;
+    }
+
+    int64_t elapsed = (int64_t)time(NULL) - cycleState.lastUpdateCheckTime;
+    bool due = elapsed < 0 || elapsed >= UPDATE_CHECK_INTERVAL_SECONDS;
+    Log_Debug("INFO: Last update check was %lld seconds ago; %s.\n", (long long)elapsed,
+              due ? "waiting for the check" : "not waiting");
+    return due;
+}
+
+static void RecordUpdateCheck(void)
+{
+    if (!Update_IsUpdateCheckReported()) {
+        return;
+    }
+
+    cycleState.lastUpdateCheckTime = (int64_t)time(NULL);
+    PersistentStorage_PersistCycleState(&cycleState);
+}
+
 static void HandleTimeout(EventLoopTimer *timer)
 {
     Log_Debug("ERROR: Timed out before business logic could complete.\n");
@@ -358,5 +790,15 @@ static void HandleTimeout(EventLoopTimer *timer)
         Log_Debug("ERROR: Could not consume timeout timer event\n");
     }
 
+    // If the telemetry was gathered but could not be sent because the cloud was unavailable, send
+    // it now so that it is stored on the device and forwarded once the connection returns.
+    if (haveTelemetry && applicationState < State_SendTelemetry && !localCycle) {
+        Log_Debug("INFO: Cloud unavailable - storing telemetry to send later.\n");
+        CalculateAndSendTelemetry();
+        if (telemetryReceivedByCloud) {
+            PersistentStorage_PersistTelemetry(machineAddresses, telemetry, MACHINE_COUNT);
+        }
+    }
+
     applicationState = State_TimedOut;
 }
@@ -11,9 +11,15 @@
 #include "exitcode.h"
 
 /// <summary>
-///     Initialize the business logic for the application
+///     Initialize the business logic for the application, and the cloud connection if this cycle
+///     connects.
 /// </summary>
-ExitCode BusinessLogic_Initialize(EventLoop *el);
+/// <param name="el">The application EventLoop, for registering timers and events.</param>
+/// <param name="backendConfiguration">
+///     Backend-specific data which is passed to <see cref="Cloud_Initialize" />.
+/// </param>
+/// <returns>An <see cref="ExitCode" /> indicating success or failure.</returns>
+ExitCode BusinessLogic_Initialize(EventLoop *el, void *backendConfiguration);
 
 /// <summary>
 ///     Run the business logic for the application - this should be regularly polled until the
@@ -63,6 +69,13 @@ void BusinessLogic_NotifyCloudConnectionChange(bool connected);
 /// <param name="flavorName">Flavor name.</param>
 void BusinessLogic_NotifyCloudFlavorChange(const LedColor *color, const char *flavorName);
 
+/// <summary>
+///     Notify the business logic that the MCU has logged enough telemetry since it was last
+///     collected to be worth sending. If this cycle has already collected the telemetry, the
+///     device wakes again soon after it powers down, to collect the rest.
+/// </summary>
+void BusinessLogic_NotifyTelemetryReady(void);
+
 /// <summary>
 ///     Notify the business logic that an unrecoverable error has occurred. This will cause the
 ///     business logic to halt, but wait for any pending update check to complete, before shutting
@@ -4,31 +4,109 @@
 // This contains an implementation of the cloud.h header specialised for the Azure IoT Central
 // cloud backend
 
+#include <errno.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <string.h>
 #include <applibs/log.h>
 
 #include "azure_iot.h"
 #include "cloud.h"
 #include "exitcode.h"
+#include "latency_trace.h"
+#include "send_scheduler.h"
 #include "telemetry.h"
+#include "telemetry_queue.h"
 
-#include "parson.h"
+#include "json_reader.h"
+#include "json_writer.h"
+#include "message_protocol_public.h"
+#include "reported_state.h"
+#ifdef TELEMETRY_ENCODING_CBOR
+#include "cbor_writer.h"
+#endif
 
 static const int sendTelemetryMessageIdentifier = 0x01;
 static const int acknowledgeFlavorMessageIdentifier = 0x02;
+static const int sendWakeTraceMessageIdentifier = 0x03;
+static const int sendLatencyTraceMessageIdentifier = 0x04;
+
+// Coalescing key of the reported properties; a newer report supersedes one which has not yet been
+// sent.
+static const char reportedPropertiesKey[] = "ReportedProperties";
+
+// Reported properties of the flavor. Each is only reported if it differs from the value which the
+// IoT Hub last acknowledged.
+static const char nextFlavorNameProperty[] = "NextFlavor.Name";
+static const char nextFlavorColorProperty[] = "NextFlavor.Color";
+
+// The name and color of a flavor are set together, so a short period suffices to report them in
+// one update without delaying the end of the wake cycle.
+static const unsigned int reportCoalescePeriodMs = 50;
+
+// Size of the buffers into which telemetry and reported properties are serialized. Telemetry must
+// also fit into the telemetry queue, in case it has to be stored until the connection returns.
+#define JSON_BUFFER_SIZE (TELEMETRY_QUEUE_MAX_MESSAGE_LENGTH + 1)
+
+// Maximum length of the flavor name and color name in the device twin, excluding the null
+// terminator.
+#define MAX_TWIN_STRING_LENGTH 63
+
+// Desired properties which are read from the device twin, as indices into the arrays of paths.
+enum {
+    TwinProperty_NextFlavor,
+    TwinProperty_FlavorName,
+    TwinProperty_FlavorColor,
+    TwinProperty_Version,
+    TwinProperty_TelemetrySlotOffset,
+    TwinProperty_ReconnectJitter,
+    TwinProperty_Count
+};
+
+// The complete twin holds the desired properties in a "desired" object; partial updates hold only
+// the desired properties which have changed.
+static const char *const completeTwinPropertyPaths[TwinProperty_Count] = {
+    "desired.NextFlavor", "desired.NextFlavor.Name", "desired.NextFlavor.Color",
+    "desired.$version", "desired.TelemetrySlotOffsetSeconds", "desired.ReconnectJitterPercent"};
+static const char *const partialTwinPropertyPaths[TwinProperty_Count] = {
+    "NextFlavor", "NextFlavor.Name", "NextFlavor.Color", "$version", "TelemetrySlotOffsetSeconds",
+    "ReconnectJitterPercent"};
+
+// Version of the most recently handled desired properties, or -1 if none have been handled.
+static int64_t desiredPropertiesVersion = -1;
+// Whether desired properties with a version have been received since initialization.
+static bool desiredPropertiesReceived = false;
+
+static Cloud_Schedule schedule = {.telemetrySlotOffsetSeconds = -1,
+                                  .reconnectJitterPercent = CLOUD_DEFAULT_RECONNECT_JITTER_PERCENT};
 
 static bool isConnected = false;
+// Whether Cloud_Initialize has been called, rather than only Cloud_InitializeLocal.
+static bool isInitialized = false;
 
 static Cloud_FlavorReceivedCallbackType flavorReceivedCallbackFunc;
 static Cloud_ConnectionStatusCallbackType connectionStatusCallbackFunc;
 static Cloud_SendTelemetryCallbackType sendTelemetryCallbackFunc = NULL;
 static Cloud_FlavorAcknowledgementCallbackType flavorAckCallbackFunc = NULL;
+static Cloud_SendTelemetryCallbackType sendWakeTraceCallbackFunc = NULL;
+static Cloud_SendTelemetryCallbackType sendLatencyTraceCallbackFunc = NULL;
+// Set while telemetry is handed to the Azure IoT layer. Telemetry which that layer stores to send
+// later is reported as sent before it returns, whereas the IoT Hub acknowledges telemetry later.
+static bool dispatchingTelemetry = false;
 
 static void HandleConnectionStatusChange(bool connected);
-static void HandleDeviceTwinCallback(const char *content);
+static void HandleDeviceTwinCallback(const char *content, size_t contentSize,
+                                     bool isCompleteTwin);
 static void HandleDeviceTwinUpdateAckCallback(bool success, void *context);
 static void HandleSendTelemetryCallback(bool success, void *context);
-static void SendDeviceTwinUpdate(const char *flavorName, const char *flavorColor);
+static void NotifyTelemetrySent(bool success, void *context);
+static bool SendScheduledTelemetry(const void *message, size_t size, void *context);
+static bool SendScheduledReport(const void *message, size_t size, void *context);
+static bool SendReportedProperties(const char *report, size_t size, void *context);
+static bool SendDeviceTwinUpdate(const char *flavorName, const char *flavorColor);
+static void UpdateScheduleProperty(const JsonReader_Value *value, bool isCompleteTwin,
+                                   const char *name, int64_t maximum, int64_t defaultValue,
+                                   int64_t *result);
 
 ExitCode Cloud_Initialize(EventLoop *el, void *backendConfiguration,
                           ExitCodeCallbackType failureCallback,
@@ -36,51 +114,473 @@ ExitCode Cloud_Initialize(EventLoop *el, void *backendConfiguration,
                           Cloud_FlavorReceivedCallbackType flavorReceivedCallback)
 {
     isConnected = false;
+    isInitialized = true;
+    desiredPropertiesReceived = false;
     connectionStatusCallbackFunc = connectionStatusCallback;
     flavorReceivedCallbackFunc = flavorReceivedCallback;
 
-    return AzureIoT_Initialize(el, (const char *)backendConfiguration, failureCallback,
-                               HandleConnectionStatusChange, HandleDeviceTwinCallback,
-                               HandleSendTelemetryCallback, HandleDeviceTwinUpdateAckCallback);
+    ExitCode exitCode = SendScheduler_Initialize(el);
+    if (exitCode != ExitCode_Success) {
+        return exitCode;
+    }
+
+    if (ReportedState_Start(el, reportCoalescePeriodMs, SendReportedProperties, NULL) != 0) {
+        return ExitCode_Cloud_Init_ReportedState;
+    }
+
+#ifdef TELEMETRY_ENCODING_CBOR
+    AzureIoT_SetTelemetryContentType(CBOR_WRITER_CONTENT_TYPE, NULL);
+#endif
+
+    exitCode = AzureIoT_Initialize(el, (const char *)backendConfiguration, failureCallback,
+                                   HandleConnectionStatusChange, HandleDeviceTwinCallback,
+                                   HandleSendTelemetryCallback, HandleDeviceTwinUpdateAckCallback);
+    AzureIoT_SetReconnectJitter(schedule.reconnectJitterPercent);
+    return exitCode;
+}
+
+void Cloud_InitializeLocal(void)
+{
+    TelemetryQueue_Initialize();
 }
 
 void Cloud_Cleanup(void)
 {
+    if (!isInitialized) {
+        return;
+    }
+
+    isInitialized = false;
+    ReportedState_Stop();
+    SendScheduler_Cleanup();
     AzureIoT_Cleanup();
 }
 
-bool Cloud_SendTelemetry(const CloudTelemetry *telemetry,
+/// <summary>
+///     Serialize the telemetry of each machine into a message, in the encoding which is sent to
+///     the cloud.
+/// </summary>
+/// <param name="buffer">Buffer of JSON_BUFFER_SIZE bytes which receives the message.</param>
+/// <param name="size">Receives the size of the message in bytes.</param>
+/// <param name="lowSoda">Receives whether any machine is low on soda.</param>
+/// <param name="includeStats">Whether to include the dispense statistics.</param>
+/// <param name="includeBatchSequence">Whether to include the batch sequence numbers.</param>
+/// <returns>The message, or NULL if it does not fit.</returns>
+static const void *SerializeTelemetryProperties(const CloudTelemetry *telemetry, size_t count,
+                                                void *buffer, size_t *size, bool *lowSoda,
+                                                bool includeStats, bool includeBatchSequence)
+{
+    // The telemetry of several machines is written as a list of values for each property, in the
+    // order of the machines in "Machines", which takes less space than an object for each
+    // machine.
+    bool singleMcu = count == 1 && telemetry[0].machineAddress == MessageProtocol_DefaultAddress;
+    *lowSoda = false;
+    for (size_t i = 0; i < count; ++i) {
+        *lowSoda |= telemetry[i].lowSoda;
+    }
+
+#ifdef TELEMETRY_ENCODING_CBOR
+    CborWriter writer;
+    CborWriter_Init(&writer, buffer, TELEMETRY_QUEUE_MAX_MESSAGE_LENGTH);
+
+    CborWriter_BeginObject(&writer, NULL);
+    if (singleMcu) {
+        CborWriter_AddInt(&writer, "DispensesSinceLastUpdate", telemetry->dispensesSinceLastSync);
+        CborWriter_AddInt(&writer, "RemainingDispenses", telemetry->remainingDispenses);
+        CborWriter_AddBool(&writer, "LowSoda", telemetry->lowSoda);
+        CborWriter_AddInt(&writer, "LifetimeTotalDispenses", telemetry->lifetimeTotalDispenses);
+        if (includeBatchSequence) {
+            CborWriter_AddInt(&writer, "BatchSequence", telemetry->batchSequence);
+        }
+        if (includeStats) {
+            CborWriter_AddFloat(&writer, "DispenseRate", telemetry->dispensesPerHour, 1);
+            CborWriter_AddInt(&writer, "HoursToEmpty", telemetry->hoursToEmpty);
+            CborWriter_AddInt(&writer, "PeakHour", telemetry->peakHour);
+        }
+    } else {
+        CborWriter_BeginArray(&writer, "Machines");
+        for (size_t i = 0; i < count; ++i) {
+            CborWriter_AddInt(&writer, NULL, telemetry[i].machineAddress);
+        }
+        CborWriter_EndArray(&writer);
+        CborWriter_BeginArray(&writer, "DispensesSinceLastUpdate");
+        for (size_t i = 0; i < count; ++i) {
+            CborWriter_AddInt(&writer, NULL, telemetry[i].dispensesSinceLastSync);
+        }
+        CborWriter_EndArray(&writer);
+        CborWriter_BeginArray(&writer, "RemainingDispenses");
+        for (size_t i = 0; i < count; ++i) {
+            CborWriter_AddInt(&writer, NULL, telemetry[i].remainingDispenses);
+        }
+        CborWriter_EndArray(&writer);
+        CborWriter_BeginArray(&writer, "LowSoda");
+        for (size_t i = 0; i < count; ++i) {
+            CborWriter_AddBool(&writer, NULL, telemetry[i].lowSoda);
+        }
+        CborWriter_EndArray(&writer);
+        CborWriter_BeginArray(&writer, "LifetimeTotalDispenses");
+        for (size_t i = 0; i < count; ++i) {
+            CborWriter_AddInt(&writer, NULL, telemetry[i].lifetimeTotalDispenses);
+        }
+        CborWriter_EndArray(&writer);
+        if (includeBatchSequence) {
+            CborWriter_BeginArray(&writer, "BatchSequence");
+            for (size_t i = 0; i < count; ++i) {
+                CborWriter_AddInt(&writer, NULL, telemetry[i].batchSequence);
+            }
+            CborWriter_EndArray(&writer);
+        }
+        if (includeStats) {
+            CborWriter_BeginArray(&writer, "DispenseRate");
+            for (size_t i = 0; i < count; ++i) {
+                CborWriter_AddFloat(&writer, NULL, telemetry[i].dispensesPerHour, 1);
+            }
+            CborWriter_EndArray(&writer);
+            CborWriter_BeginArray(&writer, "HoursToEmpty");
+            for (size_t i = 0; i < count; ++i) {
+                CborWriter_AddInt(&writer, NULL, telemetry[i].hoursToEmpty);
+            }
+            CborWriter_EndArray(&writer);
+            CborWriter_BeginArray(&writer, "PeakHour");
+            for (size_t i = 0; i < count; ++i) {
+                CborWriter_AddInt(&writer, NULL, telemetry[i].peakHour);
+            }
+            CborWriter_EndArray(&writer);
+        }
+    }
+    CborWriter_EndObject(&writer);
+
+    return CborWriter_Finish(&writer, size);
+#else
+    JsonWriter writer;
+    JsonWriter_Init(&writer, buffer, JSON_BUFFER_SIZE);
+
+    JsonWriter_BeginObject(&writer, NULL);
+    if (singleMcu) {
+        JsonWriter_AddInt(&writer, "DispensesSinceLastUpdate", telemetry->dispensesSinceLastSync);
+        JsonWriter_AddInt(&writer, "RemainingDispenses", telemetry->remainingDispenses);
+        JsonWriter_AddBool(&writer, "LowSoda", telemetry->lowSoda);
+        JsonWriter_AddInt(&writer, "LifetimeTotalDispenses", telemetry->lifetimeTotalDispenses);
+        if (includeBatchSequence) {
+            JsonWriter_AddInt(&writer, "BatchSequence", telemetry->batchSequence);
+        }
+        if (includeStats) {
+            JsonWriter_AddFloat(&writer, "DispenseRate", telemetry->dispensesPerHour, 1);
+            JsonWriter_AddInt(&writer, "HoursToEmpty", telemetry->hoursToEmpty);
+            JsonWriter_AddInt(&writer, "PeakHour", telemetry->peakHour);
+        }
+    } else {
+        JsonWriter_BeginArray(&writer, "Machines");
+        for (size_t i = 0; i < count; ++i) {
+            JsonWriter_AddInt(&writer, NULL, telemetry[i].machineAddress);
+        }
+        JsonWriter_EndArray(&writer);
+        JsonWriter_BeginArray(&writer, "DispensesSinceLastUpdate");
+        for (size_t i = 0; i < count; ++i) {
+            JsonWriter_AddInt(&writer, NULL, telemetry[i].dispensesSinceLastSync);
+        }
+        JsonWriter_EndArray(&writer);
+        JsonWriter_BeginArray(&writer, "RemainingDispenses");
+        for (size_t i = 0; i < count; ++i) {
+            JsonWriter_AddInt(&writer, NULL, telemetry[i].remainingDispenses);
+        }
+        JsonWriter_EndArray(&writer);
+        JsonWriter_BeginArray(&writer, "LowSoda");
+        for (size_t i = 0; i < count; ++i) {
+            JsonWriter_AddBool(&writer, NULL, telemetry[i].lowSoda);
+        }
+        JsonWriter_EndArray(&writer);
+        JsonWriter_BeginArray(&writer, "LifetimeTotalDispenses");
+        for (size_t i = 0; i < count; ++i) {
+            JsonWriter_AddInt(&writer, NULL, telemetry[i].lifetimeTotalDispenses);
+        }
+        JsonWriter_EndArray(&writer);
+        if (includeBatchSequence) {
+            JsonWriter_BeginArray(&writer, "BatchSequence");
+            for (size_t i = 0; i < count; ++i) {
+                JsonWriter_AddInt(&writer, NULL, telemetry[i].batchSequence);
+            }
+            JsonWriter_EndArray(&writer);
+        }
+        if (includeStats) {
+            JsonWriter_BeginArray(&writer, "DispenseRate");
+            for (size_t i = 0; i < count; ++i) {
+                JsonWriter_AddFloat(&writer, NULL, telemetry[i].dispensesPerHour, 1);
+            }
+            JsonWriter_EndArray(&writer);
+            JsonWriter_BeginArray(&writer, "HoursToEmpty");
+            for (size_t i = 0; i < count; ++i) {
+                JsonWriter_AddInt(&writer, NULL, telemetry[i].hoursToEmpty);
+            }
+            JsonWriter_EndArray(&writer);
+            JsonWriter_BeginArray(&writer, "PeakHour");
+            for (size_t i = 0; i < count; ++i) {
+                JsonWriter_AddInt(&writer, NULL, telemetry[i].peakHour);
+            }
+            JsonWriter_EndArray(&writer);
+        }
+    }
+    JsonWriter_EndObject(&writer);
+
+    const char *serializedTelemetry = JsonWriter_Finish(&writer);
+    *size = serializedTelemetry != NULL ? strlen(serializedTelemetry) : 0;
+    return serializedTelemetry;
+#endif
+}
+
+/// <summary>
+///     Serialize the telemetry of each machine into a message, with the dispense statistics if
+///     every machine has them, and the batch sequence numbers if every machine's MCU sends them.
+///     The statistics are a summary which the cloud could derive, so if they would make the
+///     message too long to store in the telemetry queue, they are left out, and then so are the
+///     batch sequence numbers, which only serve to find the message's latency trace.
+/// </summary>
+/// <param name="buffer">Buffer of JSON_BUFFER_SIZE bytes which receives the message.</param>
+/// <param name="size">Receives the size of the message in bytes.</param>
+/// <param name="lowSoda">Receives whether any machine is low on soda.</param>
+/// <returns>The message, or NULL if it does not fit.</returns>
+static const void *SerializeTelemetry(const CloudTelemetry *telemetry, size_t count, void *buffer,
+                                      size_t *size, bool *lowSoda)
+{
+    bool haveStats = true;
+    bool haveBatchSequences = true;
+    for (size_t i = 0; i < count; ++i) {
+        haveStats &= telemetry[i].haveDispenseStats;
+        haveBatchSequences &= telemetry[i].batchSequence != 0;
+    }
+
+    const void *serializedTelemetry;
+    if (haveStats) {
+        serializedTelemetry = SerializeTelemetryProperties(telemetry, count, buffer, size, lowSoda,
+                                                           true, haveBatchSequences);
+        if (serializedTelemetry != NULL) {
+            return serializedTelemetry;
+        }
+        Log_Debug("WARNING: Dispense statistics do not fit in the telemetry; leaving them out.\n");
+    }
+
+    if (haveBatchSequences) {
+        serializedTelemetry =
+            SerializeTelemetryProperties(telemetry, count, buffer, size, lowSoda, false, true);
+        if (serializedTelemetry != NULL) {
+            return serializedTelemetry;
+        }
+        Log_Debug("WARNING: Batch sequences do not fit in the telemetry; leaving them out.\n");
+    }
+
+    return SerializeTelemetryProperties(telemetry, count, buffer, size, lowSoda, false, false);
+}
+
+bool Cloud_SendTelemetry(const CloudTelemetry *telemetry, size_t count,
                          Cloud_SendTelemetryCallbackType sendTelemetryCallback)
 {
-    if (!isConnected) {
+    if (count == 0 || count > MAX_MACHINES) {
+        Log_Debug("ERROR: Cannot send telemetry of %zu machines.\n", count);
         return false;
     }
 
-    JSON_Value *telemetryRootValue = json_value_init_object();
-
-    if (telemetryRootValue == NULL) {
+    // Telemetry is accepted even when not connected; the Azure IoT layer stores it and sends it
+    // once the connection returns.
+    char telemetryBuffer[JSON_BUFFER_SIZE];
+    size_t serializedSize;
+    bool lowSoda;
+    const void *serializedTelemetry =
+        SerializeTelemetry(telemetry, count, telemetryBuffer, &serializedSize, &lowSoda);
+    if (serializedTelemetry == NULL) {
+        Log_Debug("ERROR: Cannot write telemetry to buffer.\n");
         return false;
     }
 
+    // Low soda needs attention, so it is not held behind routine telemetry.
+    LatencyTrace_Mark(LatencyTrace_Hop_Submitted);
     sendTelemetryCallbackFunc = sendTelemetryCallback;
+    return SendScheduler_Enqueue(
+        lowSoda ? SendScheduler_Class_Alarm : SendScheduler_Class_Routine, NULL,
+        SendScheduledTelemetry, serializedTelemetry, serializedSize,
+        (void *)&sendTelemetryMessageIdentifier);
+}
 
-    JSON_Object *telemetryRootObject = json_value_get_object(telemetryRootValue);
+bool Cloud_StoreTelemetry(const CloudTelemetry *telemetry, size_t count)
+{
+    if (count == 0 || count > MAX_MACHINES) {
+        Log_Debug("ERROR: Cannot store telemetry of %zu machines.\n", count);
+        return false;
+    }
+
+    char telemetryBuffer[JSON_BUFFER_SIZE];
+    size_t serializedSize;
+    bool lowSoda;
+    const void *serializedTelemetry =
+        SerializeTelemetry(telemetry, count, telemetryBuffer, &serializedSize, &lowSoda);
+    if (serializedTelemetry == NULL ||
+        !TelemetryQueue_Append(serializedTelemetry, serializedSize)) {
+        Log_Debug("ERROR: Cannot store telemetry.\n");
+        return false;
+    }
 
-    json_object_dotset_number(telemetryRootObject, "DispensesSinceLastUpdate",
-                              telemetry->dispensesSinceLastSync);
-    json_object_dotset_number(telemetryRootObject, "RemainingDispenses",
-                              telemetry->remainingDispenses);
-    json_object_dotset_boolean(telemetryRootObject, "LowSoda", telemetry->lowSoda);
-    json_object_dotset_number(telemetryRootObject, "LifetimeTotalDispenses",
-                              telemetry->lifetimeTotalDispenses);
+    Log_Debug("INFO: Telemetry stored for the next cloud cycle (%zu message(s) queued).\n",
+              TelemetryQueue_GetCount());
+    return true;
+}
+
+bool Cloud_SendWakeTrace(const WakeTrace_Record *record,
+                         Cloud_SendTelemetryCallbackType sendWakeTraceCallback)
+{
+    // The trace is encoded like the telemetry, as the content type applies to every message.
+#ifdef TELEMETRY_ENCODING_CBOR
+    uint8_t traceBuffer[TELEMETRY_QUEUE_MAX_MESSAGE_LENGTH];
+    CborWriter writer;
+    CborWriter_Init(&writer, traceBuffer, sizeof(traceBuffer));
+
+    CborWriter_BeginObject(&writer, NULL);
+    CborWriter_AddInt(&writer, "WakeCycle", (int64_t)record->cycle);
+    for (size_t i = 0; i < WakeTrace_Phase_Count; ++i) {
+        if (record->phaseMs[i] != WAKE_TRACE_NOT_REACHED) {
+            CborWriter_AddInt(&writer, WakeTrace_GetPhaseName(i), record->phaseMs[i]);
+        }
+    }
+    CborWriter_EndObject(&writer);
+
+    size_t serializedSize = 0;
+    const uint8_t *serializedTrace = CborWriter_Finish(&writer, &serializedSize);
+#else
+    char traceBuffer[JSON_BUFFER_SIZE];
+    JsonWriter writer;
+    JsonWriter_Init(&writer, traceBuffer, sizeof(traceBuffer));
+
+    JsonWriter_BeginObject(&writer, NULL);
+    JsonWriter_AddInt(&writer, "WakeCycle", (int64_t)record->cycle);
+    for (size_t i = 0; i < WakeTrace_Phase_Count; ++i) {
+        if (record->phaseMs[i] != WAKE_TRACE_NOT_REACHED) {
+            JsonWriter_AddInt(&writer, WakeTrace_GetPhaseName(i), record->phaseMs[i]);
+        }
+    }
+    JsonWriter_EndObject(&writer);
 
-    char *serializedTelemetry = json_serialize_to_string(telemetryRootValue);
-    AzureIoT_SendTelemetry(serializedTelemetry, (void *)&sendTelemetryMessageIdentifier);
-    json_free_serialized_string(serializedTelemetry);
+    const char *serializedTrace = JsonWriter_Finish(&writer);
+    size_t serializedSize = serializedTrace != NULL ? strlen(serializedTrace) : 0;
+#endif
 
-    json_value_free(telemetryRootValue);
+    if (serializedTrace == NULL) {
+        Log_Debug("ERROR: Cannot write wake trace to buffer.\n");
+        return false;
+    }
 
-    return true;
+    sendWakeTraceCallbackFunc = sendWakeTraceCallback;
+    return SendScheduler_Enqueue(SendScheduler_Class_Routine, NULL, SendScheduledTelemetry,
+                                 serializedTrace, serializedSize,
+                                 (void *)&sendWakeTraceMessageIdentifier);
+}
+
+bool Cloud_SendLatencyTrace(const LatencyTrace_Record *record,
+                            Cloud_SendTelemetryCallbackType sendLatencyTraceCallback)
+{
+    // As with the telemetry, a single MCU on the default address reports scalar values, and
+    // several report an array of each value, one entry per machine.
+    bool singleMcu =
+        record->machineCount == 1 && record->machines[0].address == MessageProtocol_DefaultAddress;
+
+#ifdef TELEMETRY_ENCODING_CBOR
+    uint8_t traceBuffer[TELEMETRY_QUEUE_MAX_MESSAGE_LENGTH];
+    CborWriter writer;
+    CborWriter_Init(&writer, traceBuffer, sizeof(traceBuffer));
+
+    CborWriter_BeginObject(&writer, NULL);
+    if (singleMcu) {
+        const LatencyTrace_Machine *machine = &record->machines[0];
+        CborWriter_AddInt(&writer, "BatchSequence", machine->batchSequence);
+        CborWriter_AddInt(&writer, "McuWaitMs", machine->mcuWaitMs);
+        CborWriter_AddInt(&writer, "UartMs", machine->uartMs);
+        CborWriter_AddInt(&writer, "AppMs", machine->appMs);
+    } else {
+        CborWriter_BeginArray(&writer, "Machines");
+        for (size_t i = 0; i < record->machineCount; ++i) {
+            CborWriter_AddInt(&writer, NULL, record->machines[i].address);
+        }
+        CborWriter_EndArray(&writer);
+        CborWriter_BeginArray(&writer, "BatchSequence");
+        for (size_t i = 0; i < record->machineCount; ++i) {
+            CborWriter_AddInt(&writer, NULL, record->machines[i].batchSequence);
+        }
+        CborWriter_EndArray(&writer);
+        CborWriter_BeginArray(&writer, "McuWaitMs");
+        for (size_t i = 0; i < record->machineCount; ++i) {
+            CborWriter_AddInt(&writer, NULL, record->machines[i].mcuWaitMs);
+        }
+        CborWriter_EndArray(&writer);
+        CborWriter_BeginArray(&writer, "UartMs");
+        for (size_t i = 0; i < record->machineCount; ++i) {
+            CborWriter_AddInt(&writer, NULL, record->machines[i].uartMs);
+        }
+        CborWriter_EndArray(&writer);
+        CborWriter_BeginArray(&writer, "AppMs");
+        for (size_t i = 0; i < record->machineCount; ++i) {
+            CborWriter_AddInt(&writer, NULL, record->machines[i].appMs);
+        }
+        CborWriter_EndArray(&writer);
+    }
+    CborWriter_AddInt(&writer, "SchedulerMs", record->schedulerMs);
+    CborWriter_AddInt(&writer, "IoTHubMs", record->iotHubMs);
+    CborWriter_EndObject(&writer);
+
+    size_t serializedSize = 0;
+    const uint8_t *serializedTrace = CborWriter_Finish(&writer, &serializedSize);
+#else
+    char traceBuffer[JSON_BUFFER_SIZE];
+    JsonWriter writer;
+    JsonWriter_Init(&writer, traceBuffer, sizeof(traceBuffer));
+
+    JsonWriter_BeginObject(&writer, NULL);
+    if (singleMcu) {
+        const LatencyTrace_Machine *machine = &record->machines[0];
+        JsonWriter_AddInt(&writer, "BatchSequence", machine->batchSequence);
+        JsonWriter_AddInt(&writer, "McuWaitMs", machine->mcuWaitMs);
+        JsonWriter_AddInt(&writer, "UartMs", machine->uartMs);
+        JsonWriter_AddInt(&writer, "AppMs", machine->appMs);
+    } else {
+        JsonWriter_BeginArray(&writer, "Machines");
+        for (size_t i = 0; i < record->machineCount; ++i) {
+            JsonWriter_AddInt(&writer, NULL, record->machines[i].address);
+        }
+        JsonWriter_EndArray(&writer);
+        JsonWriter_BeginArray(&writer, "BatchSequence");
+        for (size_t i = 0; i < record->machineCount; ++i) {
+            JsonWriter_AddInt(&writer, NULL, record->machines[i].batchSequence);
+        }
+        JsonWriter_EndArray(&writer);
+        JsonWriter_BeginArray(&writer, "McuWaitMs");
+        for (size_t i = 0; i < record->machineCount; ++i) {
+            JsonWriter_AddInt(&writer, NULL, record->machines[i].mcuWaitMs);
+        }
+        JsonWriter_EndArray(&writer);
+        JsonWriter_BeginArray(&writer, "UartMs");
+        for (size_t i = 0; i < record->machineCount; ++i) {
+            JsonWriter_AddInt(&writer, NULL, record->machines[i].uartMs);
+        }
+        JsonWriter_EndArray(&writer);
+        JsonWriter_BeginArray(&writer, "AppMs");
+        for (size_t i = 0; i < record->machineCount; ++i) {
+            JsonWriter_AddInt(&writer, NULL, record->machines[i].appMs);
+        }
+        JsonWriter_EndArray(&writer);
+    }
+    JsonWriter_AddInt(&writer, "SchedulerMs", record->schedulerMs);
+    JsonWriter_AddInt(&writer, "IoTHubMs", record->iotHubMs);
+    JsonWriter_EndObject(&writer);
+
+    const char *serializedTrace = JsonWriter_Finish(&writer);
+    size_t serializedSize = serializedTrace != NULL ? strlen(serializedTrace) : 0;
+#endif
+
+    if (serializedTrace == NULL) {
+        Log_Debug("ERROR: Cannot write latency trace to buffer.\n");
+        return false;
+    }
+
+    sendLatencyTraceCallbackFunc = sendLatencyTraceCallback;
+    return SendScheduler_Enqueue(SendScheduler_Class_Routine, NULL, SendScheduledTelemetry,
+                                 serializedTrace, serializedSize,
+                                 (void *)&sendLatencyTraceMessageIdentifier);
 }
 
 bool Cloud_SendFlavorAcknowledgement(const LedColor *color, const char *flavorName,
@@ -101,8 +601,61 @@ bool Cloud_SendFlavorAcknowledgement(const LedColor *color, const char *flavorNa
     }
 
     flavorAckCallbackFunc = callback;
-    SendDeviceTwinUpdate(flavorName, flavorColorName);
-    return true;
+    return SendDeviceTwinUpdate(flavorName, flavorColorName);
+}
+
+void Cloud_SetAppliedDesiredPropertiesVersion(int64_t version)
+{
+    desiredPropertiesVersion = version;
+}
+
+bool Cloud_GetDesiredPropertiesVersion(int64_t *version)
+{
+    *version = desiredPropertiesVersion;
+    return desiredPropertiesReceived;
+}
+
+void Cloud_SetSchedule(const Cloud_Schedule *newSchedule)
+{
+    schedule = *newSchedule;
+    AzureIoT_SetReconnectJitter(schedule.reconnectJitterPercent);
+}
+
+void Cloud_GetSchedule(Cloud_Schedule *result)
+{
+    *result = schedule;
+}
+
+const char *Cloud_GetDeviceId(void)
+{
+    return AzureIoT_GetDeviceId();
+}
+
+/// <summary>
+///     Update a property of the schedule from the device twin. A partial update which omits the
+///     property leaves it unchanged; a complete twin which omits it, or an update which sets it to
+///     null, returns it to its default. A value out of range is ignored.
+/// </summary>
+static void UpdateScheduleProperty(const JsonReader_Value *value, bool isCompleteTwin,
+                                   const char *name, int64_t maximum, int64_t defaultValue,
+                                   int64_t *result)
+{
+    if (value->type == JsonReader_Type_Null ||
+        (value->type == JsonReader_Type_Missing && isCompleteTwin)) {
+        *result = defaultValue;
+        return;
+    }
+    if (value->type == JsonReader_Type_Missing) {
+        return;
+    }
+
+    int64_t number;
+    if (!JsonReader_GetInt64(value, &number) || number < 0 || number > maximum) {
+        Log_Debug("WARNING: Cloud interface - ignoring invalid %s in device twin\n", name);
+        return;
+    }
+    Log_Debug("INFO: Requested %s: %lld\n", name, (long long)number);
+    *result = number;
 }
 
 static void HandleConnectionStatusChange(bool connected)
@@ -114,41 +667,94 @@ static void HandleConnectionStatusChange(bool connected)
     }
 
     isConnected = connected;
+    if (connected) {
+        // Report the properties whose report failed while disconnected.
+        ReportedState_Flush();
+    }
 }
 
 static void HandleSendTelemetryCallback(bool success, void *context)
+{
+    SendScheduler_Complete();
+    NotifyTelemetrySent(success, context);
+}
+
+static void NotifyTelemetrySent(bool success, void *context)
 {
     if (context == (void *)&sendTelemetryMessageIdentifier) {
+        if (success && !dispatchingTelemetry) {
+            LatencyTrace_Mark(LatencyTrace_Hop_Acknowledged);
+        } else {
+            LatencyTrace_Discard();
+        }
         if (sendTelemetryCallbackFunc != NULL) {
             sendTelemetryCallbackFunc(success);
         } else {
             Log_Debug(
                 "WARNING: Cloud interface - no callback registered for send telemetry response");
         }
+    } else if (context == (void *)&sendWakeTraceMessageIdentifier) {
+        if (sendWakeTraceCallbackFunc != NULL) {
+            sendWakeTraceCallbackFunc(success);
+        }
+    } else if (context == (void *)&sendLatencyTraceMessageIdentifier) {
+        if (sendLatencyTraceCallbackFunc != NULL) {
+            sendLatencyTraceCallbackFunc(success);
+        }
     }
 }
 
-static void HandleDeviceTwinCallback(const char *content)
+static void HandleDeviceTwinCallback(const char *content, size_t contentSize,
+                                     bool isCompleteTwin)
 {
-    JSON_Value *rootProperties = NULL;
-    rootProperties = json_parse_string(content);
-    if (rootProperties == NULL) {
+    JsonReader_Value values[TwinProperty_Count];
+    if (!JsonReader_FindProperties(
+            content, contentSize,
+            isCompleteTwin ? completeTwinPropertyPaths : partialTwinPropertyPaths,
+            TwinProperty_Count, values)) {
         Log_Debug("WARNING: Cannot parse the string as JSON content.\n");
-        goto cleanup;
+        return;
     }
 
-    JSON_Object *rootObject = json_value_get_object(rootProperties);
-    JSON_Object *desiredProperties = json_object_get_object(rootObject, "desired");
-    if (desiredProperties == NULL) {
-        desiredProperties = rootObject;
+    // The complete twin is sent again each time the connection is re-established; skip the desired
+    // properties if they have already been handled.
+    int64_t version;
+    if (JsonReader_GetInt64(&values[TwinProperty_Version], &version)) {
+        desiredPropertiesReceived = true;
+        if (version == desiredPropertiesVersion) {
+            Log_Debug("INFO: Cloud interface - desired properties version %lld already handled\n",
+                      (long long)version);
+            return;
+        }
+        desiredPropertiesVersion = version;
     }
 
-    // The desired properties should have a "NextFlavor" object
-    JSON_Object *nextFlavor = json_object_get_object(desiredProperties, "NextFlavor");
-    if (nextFlavor != NULL) {
+    int64_t slotOffset = schedule.telemetrySlotOffsetSeconds;
+    int64_t jitter = schedule.reconnectJitterPercent;
+    UpdateScheduleProperty(&values[TwinProperty_TelemetrySlotOffset], isCompleteTwin,
+                           "TelemetrySlotOffsetSeconds", INT32_MAX, -1, &slotOffset);
+    UpdateScheduleProperty(&values[TwinProperty_ReconnectJitter], isCompleteTwin,
+                           "ReconnectJitterPercent", 100, CLOUD_DEFAULT_RECONNECT_JITTER_PERCENT,
+                           &jitter);
+    Cloud_Schedule newSchedule = {.telemetrySlotOffsetSeconds = (int32_t)slotOffset,
+                                  .reconnectJitterPercent = (uint32_t)jitter};
+    Cloud_SetSchedule(&newSchedule);
 
-        const char *flavorName = json_object_dotget_string(nextFlavor, "Name");
-        const char *flavorColor = json_object_dotget_string(nextFlavor, "Color");
+    // The desired properties should have a "NextFlavor" object
+    if (values[TwinProperty_NextFlavor].type == JsonReader_Type_Object) {
+
+        char flavorNameBuffer[MAX_TWIN_STRING_LENGTH + 1];
+        char flavorColorBuffer[MAX_TWIN_STRING_LENGTH + 1];
+        const char *flavorName = NULL;
+        const char *flavorColor = NULL;
+        if (JsonReader_GetString(&values[TwinProperty_FlavorName], flavorNameBuffer,
+                                 sizeof(flavorNameBuffer))) {
+            flavorName = flavorNameBuffer;
+        }
+        if (JsonReader_GetString(&values[TwinProperty_FlavorColor], flavorColorBuffer,
+                                 sizeof(flavorColorBuffer))) {
+            flavorColor = flavorColorBuffer;
+        }
 
         if (flavorColor != NULL) {
             if (flavorName == NULL) {
@@ -186,38 +792,93 @@ static void HandleDeviceTwinCallback(const char *content)
             "WARNING: Cloud interface - reported device twin did not contain a NextFlavor desired "
             "property\n");
     }
+}
 
-cleanup:
-    // Release the allocated memory.
-    if (rootProperties != NULL) {
-        json_value_free(rootProperties);
+/// <summary>
+///     Send telemetry which the scheduler has dispatched. If it cannot be sent, its callback is
+///     invoked to report the failure.
+/// </summary>
+static bool SendScheduledTelemetry(const void *message, size_t size, void *context)
+{
+    bool isTelemetry = context == (void *)&sendTelemetryMessageIdentifier;
+    if (isTelemetry) {
+        LatencyTrace_Mark(LatencyTrace_Hop_Dispatched);
     }
+
+    dispatchingTelemetry = isTelemetry;
+    bool sent = AzureIoT_SendTelemetry(message, size, context);
+    dispatchingTelemetry = false;
+
+    if (!sent) {
+        NotifyTelemetrySent(false, context);
+        return false;
+    }
+    return true;
 }
 
-static void SendDeviceTwinUpdate(const char *flavorName, const char *flavorColor)
+/// <summary>
+///     Send a device twin report which the scheduler has dispatched; the message is the
+///     null-terminated JSON state. If it cannot be sent, the acknowledgement callback is invoked
+///     to report the failure.
+/// </summary>
+static bool SendScheduledReport(const void *message, size_t size, void *context)
 {
-    JSON_Value *twinStateValue = NULL;
-    twinStateValue = json_value_init_object();
-    JSON_Object *twinStateRoot = json_value_get_object(twinStateValue);
-    if (flavorName != NULL) {
-        json_object_dotset_string(twinStateRoot, "NextFlavor.Name", flavorName);
+    if (!AzureIoT_DeviceTwinReportState(message, context)) {
+        ReportedState_OnReportComplete(false);
+        if (context == &acknowledgeFlavorMessageIdentifier && flavorAckCallbackFunc != NULL) {
+            flavorAckCallbackFunc(false);
+        }
+        return false;
     }
-    if (flavorColor != NULL) {
-        json_object_dotset_string(twinStateRoot, "NextFlavor.Color", flavorColor);
+    return true;
+}
+
+/// <summary>
+///     Queue the reported properties which the cache has collected; the report supersedes any
+///     report which has not yet been sent. If it cannot be queued, the acknowledgement callback is
+///     invoked to report the failure.
+/// </summary>
+static bool SendReportedProperties(const char *report, size_t size, void *context)
+{
+    if (!SendScheduler_Enqueue(SendScheduler_Class_Ack, reportedPropertiesKey,
+                               SendScheduledReport, report, size + 1,
+                               (void *)&acknowledgeFlavorMessageIdentifier)) {
+        if (flavorAckCallbackFunc != NULL) {
+            flavorAckCallbackFunc(false);
+        }
+        return false;
     }
+    return true;
+}
 
-    char *serializedTwinState = json_serialize_to_string(twinStateValue);
-    AzureIoT_DeviceTwinReportState(serializedTwinState,
-                                   (void *)&acknowledgeFlavorMessageIdentifier);
-    json_free_serialized_string(serializedTwinState);
+/// <summary>
+///     Report the flavor. Only the name and color which differ from those the IoT Hub has
+///     acknowledged are reported; if neither does, the acknowledgement callback is invoked at once.
+/// </summary>
+static bool SendDeviceTwinUpdate(const char *flavorName, const char *flavorColor)
+{
+    int nameResult =
+        flavorName != NULL ? ReportedState_SetString(nextFlavorNameProperty, flavorName) : 0;
+    int colorResult =
+        flavorColor != NULL ? ReportedState_SetString(nextFlavorColorProperty, flavorColor) : 0;
+    if (nameResult < 0 || colorResult < 0) {
+        Log_Debug("ERROR: Cannot set the reported flavor: %s (%d).\n", strerror(errno), errno);
+        return false;
+    }
 
-    if (twinStateValue != NULL) {
-        json_value_free(twinStateValue);
+    if (nameResult == 0 && colorResult == 0 && !ReportedState_IsReportPending()) {
+        Log_Debug("INFO: Flavor already reported.\n");
+        if (flavorAckCallbackFunc != NULL) {
+            flavorAckCallbackFunc(true);
+        }
     }
+    return true;
 }
 
 static void HandleDeviceTwinUpdateAckCallback(bool success, void *context)
 {
+    SendScheduler_Complete();
+    ReportedState_OnReportComplete(success);
 
     if (context == &acknowledgeFlavorMessageIdentifier) {
         if (flavorAckCallbackFunc != NULL) {
@@ -7,17 +7,39 @@
 // state from a cloud service. The implementation of this interface will be specific for a
 // particular cloud service (for the purposes of this reference solution, this is Azure IoT Central)
 
+#include <stdint.h>
+
 #include <applibs/eventloop.h>
 
 #include "color.h"
 #include "exitcode.h"
+#include "latency_trace.h"
 #include "telemetry.h"
+#include "wake_trace.h"
 
 typedef void (*Cloud_FlavorReceivedCallbackType)(const LedColor *color, const char *flavorName);
 typedef void (*Cloud_SendTelemetryCallbackType)(bool success);
 typedef void (*Cloud_FlavorAcknowledgementCallbackType)(bool success);
 typedef void (*Cloud_ConnectionStatusCallbackType)(bool connected);
 
+/// <summary>Percentage of each reconnect delay which is random, unless the twin sets it.</summary>
+#define CLOUD_DEFAULT_RECONNECT_JITTER_PERCENT 50
+
+/// <summary>
+///     When the device wakes and reconnects, which the device twin can set with the
+///     "TelemetrySlotOffsetSeconds" and "ReconnectJitterPercent" desired properties, so that a
+///     fleet of devices does not send its telemetry or reconnect all at once.
+/// </summary>
+typedef struct {
+    /// <summary>
+    ///     Offset of the device's telemetry slot from the start of each power-down period, in
+    ///     seconds, or -1 to derive it from the device ID.
+    /// </summary>
+    int32_t telemetrySlotOffsetSeconds;
+    /// <summary>Percentage of each reconnect delay which is random, from 0 to 100.</summary>
+    uint32_t reconnectJitterPercent;
+} Cloud_Schedule;
+
 /// <summary>
 ///     Initialise the cloud connection.
 /// </summary>
@@ -39,7 +61,14 @@ ExitCode Cloud_Initialize(EventLoop *el, void *backendConfiguration,
                           Cloud_FlavorReceivedCallbackType flavorReceivedCallback);
 
 /// <summary>
-///     Close and cleanup the cloud connection.
+///     Prepare to store telemetry with <see cref="Cloud_StoreTelemetry" /> on a cycle which does
+///     not connect to the cloud. <see cref="Cloud_Initialize" /> may still be called afterwards,
+///     if the cycle needs to connect after all.
+/// </summary>
+void Cloud_InitializeLocal(void);
+
+/// <summary>
+///     Close and cleanup the cloud connection, if it was initialized.
 /// </summary>
 void Cloud_Cleanup(void);
 
@@ -47,9 +76,14 @@ void Cloud_Cleanup(void);
 ///     Queue telemetry for sending to the cloud; returns a Boolean indicating whether the telemetry
 ///     could be queued for sending. If the telemetry was successfully queued,
 ///     <paramref name="callback" /> will be invoked asynchronously to indicate successful receipt
-///     (or otherwise) by the cloud.
+///     (or otherwise) by the cloud. If the cloud is not connected, the telemetry is stored on the
+///     device and <paramref name="callback" /> reports success once it has been stored. The
+///     telemetry of several machines is sent in one message, with a list of values for each
+///     property; the telemetry of a single MCU at MessageProtocol_DefaultAddress is sent as one
+///     value for each property.
 /// </summary>
-/// <param name="telemetry">Pointer to telemetry to send.</param>
+/// <param name="telemetry">Pointer to the telemetry of each machine.</param>
+/// <param name="count">Number of machines, up to MAX_MACHINES.</param>
 /// <param name="callback">
 ///     A <see cref="Cloud_SendTelemetryCallbackType" /> to be invoked, to indicate whether the
 ///     telemetry was successfully received by the cloud backend.
@@ -57,7 +91,51 @@ void Cloud_Cleanup(void);
 /// <returns>
 ///     A Boolean indicating whether the telemetry was successfuly queued for sending.
 /// </returns>
-bool Cloud_SendTelemetry(const CloudTelemetry *telemetry, Cloud_SendTelemetryCallbackType callback);
+bool Cloud_SendTelemetry(const CloudTelemetry *telemetry, size_t count,
+                         Cloud_SendTelemetryCallbackType callback);
+
+/// <summary>
+///     Store telemetry on the device without connecting, to be sent with any other stored
+///     telemetry once a later cycle connects. It is encoded as <see cref="Cloud_SendTelemetry" />
+///     would send it.
+/// </summary>
+/// <param name="telemetry">Pointer to the telemetry of each machine.</param>
+/// <param name="count">Number of machines, up to MAX_MACHINES.</param>
+/// <returns>A Boolean indicating whether the telemetry was stored.</returns>
+bool Cloud_StoreTelemetry(const CloudTelemetry *telemetry, size_t count);
+
+/// <summary>
+///     Queue the trace of a wake cycle for sending to the cloud as telemetry, which reports when
+///     the cycle reached each phase. Phases which were not reached are omitted. Like
+///     <see cref="Cloud_SendTelemetry" />, the trace is stored on the device if the cloud is not
+///     connected.
+/// </summary>
+/// <param name="record">The trace to send.</param>
+/// <param name="callback">
+///     A <see cref="Cloud_SendTelemetryCallbackType" /> to be invoked, to indicate whether the
+///     trace was successfully received by the cloud backend, or stored.
+/// </param>
+/// <returns>
+///     A Boolean indicating whether the trace was successfuly queued for sending.
+/// </returns>
+bool Cloud_SendWakeTrace(const WakeTrace_Record *record, Cloud_SendTelemetryCallbackType callback);
+
+/// <summary>
+///     Queue the latency trace of an earlier cycle's telemetry for sending to the cloud as
+///     telemetry, which reports the time taken by each stage, with the batch sequence number of
+///     each machine's telemetry. Like <see cref="Cloud_SendTelemetry" />, the trace is stored on
+///     the device if the cloud is not connected.
+/// </summary>
+/// <param name="record">The trace to send.</param>
+/// <param name="callback">
+///     A <see cref="Cloud_SendTelemetryCallbackType" /> to be invoked, to indicate whether the
+///     trace was successfully received by the cloud backend, or stored.
+/// </param>
+/// <returns>
+///     A Boolean indicating whether the trace was successfuly queued for sending.
+/// </returns>
+bool Cloud_SendLatencyTrace(const LatencyTrace_Record *record,
+                            Cloud_SendTelemetryCallbackType callback);
 
 /// <summary>
 ///     Queue a message to the cloud acknowledging the new flavor sent to the device. Should be
@@ -77,3 +155,45 @@ bool Cloud_SendTelemetry(const CloudTelemetry *telemetry, Cloud_SendTelemetryCal
 /// </returns>
 bool Cloud_SendFlavorAcknowledgement(const LedColor *color, const char *flavorName,
                                      Cloud_FlavorAcknowledgementCallbackType callback);
+
+/// <summary>
+///     Set the version of the desired properties which were applied before the device last powered
+///     down. If the desired properties which are received from the cloud have this version, they
+///     are not handled again, and <see cref="Cloud_FlavorReceivedCallbackType" /> is not invoked.
+///     Should be called before the connection is established.
+/// </summary>
+/// <param name="version">Version of the desired properties which have been applied.</param>
+void Cloud_SetAppliedDesiredPropertiesVersion(int64_t version);
+
+/// <summary>
+///     Get the version of the desired properties which were most recently received from the
+///     cloud.
+/// </summary>
+/// <param name="version">Receives the version.</param>
+/// <returns>
+///     A Boolean indicating whether versioned desired properties have been received since the
+///     cloud connection was initialized.
+/// </returns>
+bool Cloud_GetDesiredPropertiesVersion(int64_t *version);
+
+/// <summary>
+///     Set the schedule which was applied before the device last powered down. The desired
+///     properties which are received from the cloud update it; a property which is removed from
+///     the twin returns to its default. May be called before or after
+///     <see cref="Cloud_Initialize" />.
+/// </summary>
+/// <param name="schedule">The schedule.</param>
+void Cloud_SetSchedule(const Cloud_Schedule *schedule);
+
+/// <summary>
+///     Get the schedule, as most recently set by <see cref="Cloud_SetSchedule" /> or the desired
+///     properties.
+/// </summary>
+/// <param name="schedule">Receives the schedule.</param>
+void Cloud_GetSchedule(Cloud_Schedule *schedule);
+
+/// <summary>
+///     Get the ID of the device in the cloud.
+/// </summary>
+/// <returns>The device ID, or NULL if it is not yet known.</returns>
+const char *Cloud_GetDeviceId(void);
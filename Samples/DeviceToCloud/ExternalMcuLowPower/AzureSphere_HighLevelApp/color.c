@@ -4,6 +4,8 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <applibs/log.h>
+
 #include "color.h"
 
 typedef struct NamedColor {
@@ -14,33 +16,87 @@ typedef struct NamedColor {
 /// <summary>
 /// Defines the mappings of color names to LedColor values. Note that the names must match the
 /// values defined for the "Color" value of "NextFlavour" property in the Azure IoT Central app.
+/// The names are found by binary search, so they must be sorted in strcmp() order. Several names
+/// may map to one color; the first of them is the name which is reported for the color.
 /// </summary>
-static NamedColor availableColors[] = {
+static const NamedColor availableColors[] = {
     {.name = "black", .color = {.red = false, .green = false, .blue = false}},
-    {.name = "red", .color = {.red = true, .green = false, .blue = false}},
-    {.name = "green", .color = {.red = false, .green = true, .blue = false}},
     {.name = "blue", .color = {.red = false, .green = false, .blue = true}},
-    {.name = "yellow", .color = {.red = true, .green = true, .blue = false}},
     {.name = "cyan", .color = {.red = false, .green = true, .blue = true}},
+    {.name = "green", .color = {.red = false, .green = true, .blue = false}},
     {.name = "magenta", .color = {.red = true, .green = false, .blue = true}},
-    {.name = "white", .color = {.red = true, .green = true, .blue = true}}};
+    {.name = "red", .color = {.red = true, .green = false, .blue = false}},
+    {.name = "white", .color = {.red = true, .green = true, .blue = true}},
+    {.name = "yellow", .color = {.red = true, .green = true, .blue = false}}};
 
 static const size_t numColors = sizeof(availableColors) / sizeof(NamedColor);
 
+// An LedColor has three components, so there are eight distinct colors.
+#define NUM_LED_COLORS 8
+
+// Name which is reported for each color, indexed by ColorIndex(), or NULL if no name maps to it.
+static const char *namesByColor[NUM_LED_COLORS];
+static bool indexed = false;
+// Set if the names are not sorted, in which case they are searched one by one.
+static bool unsorted = false;
+
+static size_t ColorIndex(const LedColor *color)
+{
+    return (color->red ? 4u : 0u) | (color->green ? 2u : 0u) | (color->blue ? 1u : 0u);
+}
+
+/// <summary>
+///     Build the reverse lookup table, and check that the names are sorted, on first use.
+/// </summary>
+static void EnsureIndexed(void)
+{
+    if (indexed) {
+        return;
+    }
+
+    for (size_t i = 0; i < numColors; i++) {
+        size_t index = ColorIndex(&availableColors[i].color);
+        if (namesByColor[index] == NULL) {
+            namesByColor[index] = availableColors[i].name;
+        }
+        if (i > 0 && strcmp(availableColors[i - 1].name, availableColors[i].name) >= 0) {
+            Log_Debug("ERROR: Color name '%s' is out of order; searching colors one by one.\n",
+                      availableColors[i].name);
+            unsorted = true;
+        }
+    }
+    indexed = true;
+}
+
+static int CompareName(const void *key, const void *element)
+{
+    return strcmp((const char *)key, ((const NamedColor *)element)->name);
+}
+
 bool Color_TryGetColorByName(const char *colorName, LedColor *color)
 {
     if (colorName == NULL) {
         return false;
     }
 
-    for (int i = 0; i < numColors; i++) {
-        if (strcmp(availableColors[i].name, colorName) == 0) {
-            *color = availableColors[i].color;
-            return true;
+    EnsureIndexed();
+
+    const NamedColor *found = NULL;
+    if (!unsorted) {
+        found = bsearch(colorName, availableColors, numColors, sizeof(NamedColor), CompareName);
+    } else {
+        for (size_t i = 0; i < numColors && found == NULL; i++) {
+            if (strcmp(availableColors[i].name, colorName) == 0) {
+                found = &availableColors[i];
+            }
         }
     }
 
-    return false;
+    if (found == NULL) {
+        return false;
+    }
+    *color = found->color;
+    return true;
 }
 
 bool Color_TryGetNameForColor(const LedColor *color, const char **colorName)
@@ -49,14 +105,12 @@ bool Color_TryGetNameForColor(const LedColor *color, const char **colorName)
         return false;
     }
 
-    for (int i = 0; i < numColors; i++) {
-        if (availableColors[i].color.red == color->red &&
-            availableColors[i].color.green == color->green &&
-            availableColors[i].color.blue == color->blue) {
-            *colorName = availableColors[i].name;
-            return true;
-        }
-    }
+    EnsureIndexed();
 
-    return false;
+    const char *name = namesByColor[ColorIndex(color)];
+    if (name == NULL) {
+        return false;
+    }
+    *colorName = name;
+    return true;
 }
@@ -15,7 +15,7 @@ typedef struct LedColor {
 } LedColor;
 
 /// <summary>
-///     Try to get the LedColor by a particular color name.
+///     Try to get the LedColor by a particular color name. The names are found by binary search.
 /// </summary>
 /// <param name="colorName">Name of the color.</param>
 /// <param name="color">Pointer to receive the LedColor.</param>
@@ -25,7 +25,7 @@ typedef struct LedColor {
 bool Color_TryGetColorByName(const char *colorName, LedColor *color);
 
 /// <summary>
-///     Try to get the name for a particular LedColor
+///     Try to get the name for a particular LedColor, from a table indexed by the color.
 /// </summary>
 /// <param name="color">LedColor</param>
 /// <param name="colorName">Pointer to receive the name</param>
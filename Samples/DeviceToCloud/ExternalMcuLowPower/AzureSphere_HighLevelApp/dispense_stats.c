@@ -0,0 +1,249 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <applibs/log.h>
+#include <applibs/storage.h>
+
+#include "dispense_stats.h"
+#include "telemetry.h"
+
+// Offset of the record within the mutable storage file. It follows the telemetry queue's control
+// block, within the space which is reserved for the control block (see telemetry_queue.c).
+#define STATS_OFFSET 320
+#define STATS_END_OFFSET 512
+
+#define HOURS_PER_DAY 24
+#define SECONDS_PER_HOUR (60 * 60)
+
+static const uint32_t statsMagic = ('D' << 24) | ('S' << 16) | ('T' << 8) | 'A';
+
+// A clock which reads earlier than this has not been set since a cold start.
+static const time_t earliestValidTime = 1577836800; // 2020-01-01
+
+// A batch which follows the last one more closely than this leaves the interval open, because the
+// rate over a short interval is dominated by the rounding of the dispenses.
+static const int64_t minRateIntervalSeconds = 60;
+
+// The statistics of one machine.
+typedef struct {
+    uint8_t used;
+    uint8_t address;
+    uint8_t hasRate;
+    // Dispense events in each UTC hour of the day, relative to one another.
+    uint8_t hourlyDispenses[HOURS_PER_DAY];
+    // Lifetime total dispenses and time, in seconds since the epoch, at the start of the interval
+    // over which the next rate is measured. The time is 0 if the interval has not started.
+    uint32_t lastLifetimeTotalDispenses;
+    int64_t lastUpdateTime;
+    float dispensesPerHour;
+} MachineStats;
+
+// The CRC covers the statistics of every machine.
+typedef struct {
+    uint32_t magic;
+    uint32_t crc;
+    MachineStats machines[MAX_MACHINES];
+} StatsRecord;
+
+_Static_assert(STATS_OFFSET + sizeof(StatsRecord) <= STATS_END_OFFSET,
+               "StatsRecord overlaps the telemetry queue's records");
+
+static StatsRecord record;
+static bool recordLoaded = false;
+
+static uint32_t Crc32(const void *data, size_t size)
+{
+    const uint8_t *bytes = (const uint8_t *)data;
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < size; ++i) {
+        crc ^= bytes[i];
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc >> 1) ^ (0xEDB88320u & -(crc & 1u));
+        }
+    }
+    return ~crc;
+}
+
+// Reads the record from storage, or starts a new one if there is no valid record.
+static void LoadRecord(void)
+{
+    recordLoaded = true;
+
+    int storageFd = Storage_OpenMutableFile();
+    if (storageFd == -1) {
+        Log_Debug("ERROR: Failed to open mutable storage - %s (%d)\n", strerror(errno), errno);
+        memset(&record, 0, sizeof(record));
+        return;
+    }
+
+    bool found = lseek(storageFd, STATS_OFFSET, SEEK_SET) != -1 &&
+                 read(storageFd, &record, sizeof(record)) == sizeof(record) &&
+                 record.magic == statsMagic &&
+                 record.crc == Crc32(&record.machines, sizeof(record.machines));
+    close(storageFd);
+
+    if (!found) {
+        memset(&record, 0, sizeof(record));
+    }
+}
+
+// Finds the statistics of a machine, or NULL if there are none.
+static MachineStats *FindMachine(uint8_t address)
+{
+    if (!recordLoaded) {
+        LoadRecord();
+    }
+
+    for (size_t i = 0; i < MAX_MACHINES; ++i) {
+        if (record.machines[i].used && record.machines[i].address == address) {
+            return &record.machines[i];
+        }
+    }
+    return NULL;
+}
+
+// Finds the statistics of a machine, starting new statistics for it if there are none. A machine
+// which is no longer served gives up its statistics to a new one, oldest first.
+static MachineStats *FindOrAddMachine(uint8_t address)
+{
+    MachineStats *machine = FindMachine(address);
+    if (machine != NULL) {
+        return machine;
+    }
+
+    machine = &record.machines[0];
+    for (size_t i = 0; i < MAX_MACHINES; ++i) {
+        if (!record.machines[i].used) {
+            machine = &record.machines[i];
+            break;
+        }
+        if (record.machines[i].lastUpdateTime < machine->lastUpdateTime) {
+            machine = &record.machines[i];
+        }
+    }
+
+    memset(machine, 0, sizeof(*machine));
+    machine->used = 1;
+    machine->address = address;
+    return machine;
+}
+
+// Adds a dispense to its hour's bucket. Once the bucket is full, every bucket is halved, which
+// keeps their proportions and lets older dispenses fade.
+static void AddToHistogram(MachineStats *machine, time_t dispenseTime)
+{
+    size_t hour = (size_t)((dispenseTime / SECONDS_PER_HOUR) % HOURS_PER_DAY);
+    if (machine->hourlyDispenses[hour] == UINT8_MAX) {
+        for (size_t i = 0; i < HOURS_PER_DAY; ++i) {
+            machine->hourlyDispenses[i] /= 2;
+        }
+    }
+    ++machine->hourlyDispenses[hour];
+}
+
+// Moves the average towards the rate over the interval since the last batch. The weight of the
+// new rate grows with the length of the interval, so that the intervals between wake cycles need
+// not be regular.
+static void UpdateRate(MachineStats *machine, uint32_t dispenses, int64_t elapsedSeconds)
+{
+    float elapsedHours = (float)elapsedSeconds / SECONDS_PER_HOUR;
+    float rate = (float)dispenses / elapsedHours;
+    if (!machine->hasRate) {
+        machine->dispensesPerHour = rate;
+        machine->hasRate = 1;
+        return;
+    }
+
+    float weight = elapsedHours / (DISPENSE_STATS_RATE_TIME_CONSTANT_HOURS + elapsedHours);
+    machine->dispensesPerHour += weight * (rate - machine->dispensesPerHour);
+}
+
+void DispenseStats_Update(uint8_t address, const DeviceTelemetryBatch *batch, time_t now)
+{
+    MachineStats *machine = FindOrAddMachine(address);
+    uint32_t lifetimeTotalDispenses = batch->counters.lifetimeTotalDispenses;
+
+    // Dispenses which the MCU could not log have no time, so only the logged events are added.
+    bool clockValid = now >= earliestValidTime;
+    if (clockValid) {
+        for (size_t i = 0; i < batch->eventCount; ++i) {
+            const DeviceTelemetryEvent *event = &batch->events[i];
+            if (event->type == DeviceTelemetryEvent_Dispense) {
+                AddToHistogram(machine, now - (time_t)(event->millisecondsBeforeBatch / 1000));
+            }
+        }
+    }
+
+    // If the clock is not set, or has moved backwards, or the MCU's counters were reset, the
+    // length of the interval, or the dispenses in it, are unknown, so start a new one.
+    int64_t elapsedSeconds = (int64_t)now - machine->lastUpdateTime;
+    if (clockValid && machine->lastUpdateTime != 0 && elapsedSeconds > 0 &&
+        lifetimeTotalDispenses >= machine->lastLifetimeTotalDispenses) {
+        if (elapsedSeconds < minRateIntervalSeconds) {
+            return;
+        }
+        UpdateRate(machine, lifetimeTotalDispenses - machine->lastLifetimeTotalDispenses,
+                   elapsedSeconds);
+    }
+
+    machine->lastLifetimeTotalDispenses = lifetimeTotalDispenses;
+    machine->lastUpdateTime = clockValid ? (int64_t)now : 0;
+}
+
+bool DispenseStats_GetSummary(uint8_t address, uint32_t remainingDispenses,
+                              DispenseStats_Summary *summary)
+{
+    const MachineStats *machine = FindMachine(address);
+    if (machine == NULL || !machine->hasRate) {
+        return false;
+    }
+
+    summary->dispensesPerHour = machine->dispensesPerHour;
+    summary->hoursToEmpty = -1;
+    if (machine->dispensesPerHour > 0) {
+        float hours = (float)remainingDispenses / machine->dispensesPerHour;
+        summary->hoursToEmpty = hours < INT32_MAX ? (int32_t)hours : INT32_MAX;
+    }
+
+    summary->peakHour = -1;
+    uint8_t peakDispenses = 0;
+    for (size_t i = 0; i < HOURS_PER_DAY; ++i) {
+        if (machine->hourlyDispenses[i] > peakDispenses) {
+            peakDispenses = machine->hourlyDispenses[i];
+            summary->peakHour = (int32_t)i;
+        }
+    }
+
+    return true;
+}
+
+void DispenseStats_Persist(void)
+{
+    if (!recordLoaded) {
+        return;
+    }
+
+    int storageFd = Storage_OpenMutableFile();
+    if (storageFd == -1) {
+        Log_Debug("ERROR: Failed to open mutable storage - %s (%d)\n", strerror(errno), errno);
+        return;
+    }
+
+    record.magic = statsMagic;
+    record.crc = Crc32(&record.machines, sizeof(record.machines));
+    if (lseek(storageFd, STATS_OFFSET, SEEK_SET) == -1 ||
+        write(storageFd, &record, sizeof(record)) != sizeof(record)) {
+        Log_Debug("ERROR: Failed to write dispense statistics to persistent storage - %s (%d)\n",
+                  strerror(errno), errno);
+    }
+
+    close(storageFd);
+}
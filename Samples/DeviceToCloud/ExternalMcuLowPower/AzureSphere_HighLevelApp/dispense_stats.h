@@ -0,0 +1,68 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "telemetry.h"
+
+// The dispense statistics summarize each machine's dispenses across wake cycles, so that the cloud
+// receives the rate of dispensing, a forecast of when the machine will be empty and its busiest
+// hour of the day, instead of having to derive them from every event. They are updated from each
+// telemetry batch, and kept in the application's mutable storage between cycles:
+//
+// - an exponential moving average of the dispenses per hour, whose time constant is
+//   DISPENSE_STATS_RATE_TIME_CONSTANT_HOURS; and
+// - a histogram of the dispense events by UTC hour of the day, whose buckets are halved when one
+//   of them fills, so that it follows the recent pattern.
+//
+// Times are taken from the system clock; a batch which is received while the clock is not set, or
+// after the clock has moved backwards, updates no statistics, and restarts the rate's interval.
+
+/// <summary>Time constant of the moving average of the dispense rate, in hours.</summary>
+#ifndef DISPENSE_STATS_RATE_TIME_CONSTANT_HOURS
+#define DISPENSE_STATS_RATE_TIME_CONSTANT_HOURS 24
+#endif
+
+/// <summary>
+///     Summary of a machine's dispense statistics, for sending to the cloud.
+/// </summary>
+typedef struct {
+    /// <summary>Moving average of the dispenses per hour.</summary>
+    float dispensesPerHour;
+    /// <summary>
+    ///     Hours until the remaining dispenses run out at that rate, or -1 if the rate is 0.
+    /// </summary>
+    int32_t hoursToEmpty;
+    /// <summary>UTC hour of the day with the most dispenses, or -1 if none are recorded.</summary>
+    int32_t peakHour;
+} DispenseStats_Summary;
+
+/// <summary>
+///     Update the statistics of a machine from a telemetry batch which it sent. The statistics are
+///     read from storage the first time they are needed.
+/// </summary>
+/// <param name="address">Address of the machine's MCU.</param>
+/// <param name="batch">The batch, whose dispense events are added to the histogram.</param>
+/// <param name="now">Time at which the batch was received, from time().</param>
+void DispenseStats_Update(uint8_t address, const DeviceTelemetryBatch *batch, time_t now);
+
+/// <summary>
+///     Get the summary of a machine's statistics. A machine has no summary until two batches have
+///     been received from it, which measure its first rate.
+/// </summary>
+/// <param name="address">Address of the machine's MCU.</param>
+/// <param name="remainingDispenses">Dispenses remaining in the machine, for the forecast.</param>
+/// <param name="summary">Receives the summary.</param>
+/// <returns>true if the machine has a summary; false if not.</returns>
+bool DispenseStats_GetSummary(uint8_t address, uint32_t remainingDispenses,
+                              DispenseStats_Summary *summary);
+
+/// <summary>
+///     Write the statistics to storage, for the next wake cycle. Should be called once the batches
+///     of every machine have been added.
+/// </summary>
+void DispenseStats_Persist(void);
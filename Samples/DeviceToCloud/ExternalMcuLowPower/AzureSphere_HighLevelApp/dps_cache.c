@@ -0,0 +1,151 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// applibs_versions.h defines the API struct versions to use for applibs APIs.
+#include "applibs_versions.h"
+#include <applibs/log.h>
+#include <applibs/storage.h>
+
+#include "dps_cache.h"
+
+// Offset of the entry within the mutable storage file. The entry follows the telemetry queue's
+// record area (see telemetry_queue.c), and must fit within the MutableStorage size declared in
+// app_manifest.json.
+#define ENTRY_OFFSET 65024
+
+static const uint32_t entryMagic = ('D' << 24) | ('P' << 16) | ('S' << 8) | 'C';
+
+// The entry is written in one operation, and its CRC covers all its other fields, so that an entry
+// which was only partly written is ignored.
+typedef struct {
+    uint32_t magic;
+    int64_t storedTime; // Seconds since the epoch when the entry was stored.
+    char scopeId[DPS_CACHE_MAX_SCOPE_ID_LENGTH + 1];
+    DpsCache_Assignment assignment;
+    uint32_t crc;
+} Entry;
+
+static uint32_t Crc32(const void *data, size_t length)
+{
+    const uint8_t *bytes = data;
+    uint32_t crc = 0xFFFFFFFFu;
+    while (length-- > 0) {
+        crc ^= *bytes++;
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc >> 1) ^ (0xEDB88320u & -(crc & 1u));
+        }
+    }
+    return ~crc;
+}
+
+static uint32_t EntryCrc(const Entry *entry)
+{
+    return Crc32(entry, offsetof(Entry, crc));
+}
+
+static int OpenStorage(void)
+{
+    int fd = Storage_OpenMutableFile();
+    if (fd == -1) {
+        Log_Debug("ERROR: Could not open mutable storage: errno=%d (%s)\n", errno,
+                  strerror(errno));
+    }
+    return fd;
+}
+
+static void CloseStorage(int fd)
+{
+    if (close(fd) != 0) {
+        Log_Debug("ERROR: Could not close mutable storage: errno=%d (%s)\n", errno,
+                  strerror(errno));
+    }
+}
+
+static bool WriteEntry(const Entry *entry)
+{
+    int fd = OpenStorage();
+    if (fd == -1) {
+        return false;
+    }
+
+    bool written = lseek(fd, ENTRY_OFFSET, SEEK_SET) != -1 &&
+                   write(fd, entry, sizeof(*entry)) == (ssize_t)sizeof(*entry);
+    if (!written) {
+        Log_Debug("ERROR: Could not write the DPS cache: errno=%d (%s)\n", errno, strerror(errno));
+    }
+
+    CloseStorage(fd);
+    return written;
+}
+
+bool DpsCache_Load(const char *scopeId, DpsCache_Assignment *assignment)
+{
+    int fd = OpenStorage();
+    if (fd == -1) {
+        return false;
+    }
+
+    Entry entry;
+    bool valid = lseek(fd, ENTRY_OFFSET, SEEK_SET) != -1 &&
+                 read(fd, &entry, sizeof(entry)) == (ssize_t)sizeof(entry) &&
+                 entry.magic == entryMagic && entry.crc == EntryCrc(&entry) &&
+                 entry.scopeId[DPS_CACHE_MAX_SCOPE_ID_LENGTH] == '\0' &&
+                 entry.assignment.hubHostName[DPS_CACHE_MAX_HUB_HOSTNAME_LENGTH] == '\0' &&
+                 entry.assignment.deviceId[DPS_CACHE_MAX_DEVICE_ID_LENGTH] == '\0' &&
+                 strcmp(entry.scopeId, scopeId) == 0;
+    CloseStorage(fd);
+
+    if (!valid) {
+        return false;
+    }
+
+    // The clock may not have been set yet after a cold start, in which case it is earlier than
+    // when the entry was stored. The entry is still used; if the assignment has changed, the hub
+    // rejects the device, and the application removes the entry.
+    int64_t age = (int64_t)time(NULL) - entry.storedTime;
+    if (age > DPS_CACHE_VALIDITY_SECONDS) {
+        Log_Debug("INFO: The cached DPS assignment has expired\n");
+        return false;
+    }
+
+    *assignment = entry.assignment;
+    return true;
+}
+
+bool DpsCache_Store(const char *scopeId, const DpsCache_Assignment *assignment)
+{
+    if (strnlen(scopeId, DPS_CACHE_MAX_SCOPE_ID_LENGTH + 1) > DPS_CACHE_MAX_SCOPE_ID_LENGTH ||
+        strnlen(assignment->hubHostName, sizeof(assignment->hubHostName)) >
+            DPS_CACHE_MAX_HUB_HOSTNAME_LENGTH ||
+        strnlen(assignment->deviceId, sizeof(assignment->deviceId)) >
+            DPS_CACHE_MAX_DEVICE_ID_LENGTH) {
+        Log_Debug("INFO: DPS assignment too long to cache\n");
+        return false;
+    }
+
+    // Zero the entry so that the CRC does not depend on padding or on bytes after the strings.
+    Entry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.magic = entryMagic;
+    entry.storedTime = (int64_t)time(NULL);
+    strcpy(entry.scopeId, scopeId);
+    strcpy(entry.assignment.hubHostName, assignment->hubHostName);
+    strcpy(entry.assignment.deviceId, assignment->deviceId);
+    entry.crc = EntryCrc(&entry);
+
+    return WriteEntry(&entry);
+}
+
+void DpsCache_Remove(void)
+{
+    Entry entry;
+    memset(&entry, 0, sizeof(entry));
+    WriteEntry(&entry);
+}
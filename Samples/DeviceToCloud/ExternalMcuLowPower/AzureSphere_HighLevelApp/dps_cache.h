@@ -0,0 +1,67 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+
+// The DPS cache stores in the application's mutable storage the IoT hub and device ID which the
+// Device Provisioning Service assigned to the device, so that after a restart the device can
+// connect to its hub directly instead of registering with DPS again. An entry is bound to the
+// scope ID it was assigned under, and is used for DPS_CACHE_VALIDITY_SECONDS after it was stored.
+// The application should remove the entry if the hub rejects the device, so that the next
+// connection attempt registers with DPS again.
+
+/// <summary>
+///     Maximum length of a DPS scope ID, excluding the null terminator.
+/// </summary>
+#define DPS_CACHE_MAX_SCOPE_ID_LENGTH 63
+
+/// <summary>
+///     Maximum length of an IoT hub hostname, excluding the null terminator.
+/// </summary>
+#define DPS_CACHE_MAX_HUB_HOSTNAME_LENGTH 127
+
+/// <summary>
+///     Maximum length of a device ID, excluding the null terminator. Azure Sphere device IDs are
+///     128 hexadecimal digits.
+/// </summary>
+#define DPS_CACHE_MAX_DEVICE_ID_LENGTH 128
+
+/// <summary>
+///     How long after it was stored an entry is used, in seconds.
+/// </summary>
+#define DPS_CACHE_VALIDITY_SECONDS (7 * 24 * 60 * 60)
+
+/// <summary>
+///     The result of a DPS registration.
+/// </summary>
+typedef struct {
+    /// <summary>The hostname of the IoT hub to which the device was assigned.</summary>
+    char hubHostName[DPS_CACHE_MAX_HUB_HOSTNAME_LENGTH + 1];
+    /// <summary>The ID of the device in the IoT hub.</summary>
+    char deviceId[DPS_CACHE_MAX_DEVICE_ID_LENGTH + 1];
+} DpsCache_Assignment;
+
+/// <summary>
+///     Gets the cached assignment for a scope ID, if it is still valid.
+/// </summary>
+/// <param name="scopeId">The DPS scope ID.</param>
+/// <param name="assignment">Receives the assignment.</param>
+/// <returns>
+///     true if a valid assignment for the scope ID is cached; false otherwise.
+/// </returns>
+bool DpsCache_Load(const char *scopeId, DpsCache_Assignment *assignment);
+
+/// <summary>
+///     Stores the assignment which DPS returned for a scope ID, replacing any cached assignment.
+/// </summary>
+/// <param name="scopeId">The DPS scope ID.</param>
+/// <param name="assignment">The assignment.</param>
+/// <returns>true on success; false if the assignment is too long or could not be stored.</returns>
+bool DpsCache_Store(const char *scopeId, const DpsCache_Assignment *assignment);
+
+/// <summary>
+///     Removes the cached assignment, if there is one.
+/// </summary>
+void DpsCache_Remove(void);
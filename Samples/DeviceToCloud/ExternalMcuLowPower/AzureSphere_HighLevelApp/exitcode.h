@@ -20,10 +20,9 @@ typedef enum {
     ExitCode_BusinessLogic_TimeoutTimerCreate,
     ExitCode_BusinessLogic_SetTimeoutTimer,
 
-    ExitCode_Uart_Init_OpenFail,
-    ExitCode_Uart_Init_EventRegisterFail,
+    ExitCode_Uart_Init,
 
-    ExitCode_MsgProtoInit_Timer,
+    ExitCode_MsgProtoInit,
 
     ExitCode_Main_EventLoopFail,
 
@@ -40,11 +39,18 @@ typedef enum {
     ExitCode_Update_Init_CreateWaitForUpdatesCheckTimer,
     ExitCode_Update_Init_SetWaitForUpdatesCheckTimer,
     ExitCode_Update_Init_CreateWaitForUpdatesDownloadTimer,
+    ExitCode_Update_Init_UpdatePolicy,
     ExitCode_Update_UpdatesStarted_SetWaitForUpdatesDownloadTimer,
 
     ExitCode_Update_UpdateCallback_GetUpdateData,
     ExitCode_Update_UpdateCallback_DeferEvent,
-    ExitCode_Update_UpdateCallback_UnexpectedStatus
+    ExitCode_Update_UpdateCallback_UnexpectedStatus,
+
+    ExitCode_AzureTimer_Arm,
+
+    ExitCode_SendScheduler_Init_Timer,
+
+    ExitCode_Cloud_Init_ReportedState
 } ExitCode;
 
 typedef void (*ExitCodeCallbackType)(ExitCode);
@@ -0,0 +1,220 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <applibs/log.h>
+#include <applibs/storage.h>
+
+#include "latency_trace.h"
+#include "telemetry.h"
+
+// Offset of the record within the mutable storage file. It follows the cycle state, and precedes
+// the telemetry queue's control block (see persistent_storage.c and telemetry_queue.c).
+#define TRACE_OFFSET 176
+#define TRACE_END_OFFSET 256
+
+// Time of a hop which has not been reached.
+#define NOT_REACHED UINT32_MAX
+
+static const uint32_t traceMagic = ('L' << 24) | ('A' << 16) | ('T' << 8) | 'T';
+
+// The CRC covers the trace.
+typedef struct {
+    uint32_t magic;
+    uint32_t crc;
+    LatencyTrace_Record trace;
+} TraceRecord;
+
+_Static_assert(TRACE_OFFSET + sizeof(TraceRecord) <= TRACE_END_OFFSET,
+               "TraceRecord overlaps the telemetry queue's control block");
+
+// The batches of this cycle, and when the telemetry reached each hop after them.
+typedef struct {
+    size_t machineCount;
+    uint8_t addresses[MAX_MACHINES];
+    uint32_t batchSequences[MAX_MACHINES];
+    uint32_t mcuWaitMs[MAX_MACHINES];
+    uint32_t requestSentMs[MAX_MACHINES];
+    uint32_t responseReceivedMs[MAX_MACHINES];
+    uint32_t hopMs[LatencyTrace_Hop_Count];
+} CurrentTrace;
+
+static CurrentTrace current = {.hopMs = {NOT_REACHED, NOT_REACHED, NOT_REACHED}};
+static bool currentPersisted = false;
+
+static LatencyTrace_Record stored;
+static bool storedLoaded = false;
+static bool haveStored = false;
+
+static uint32_t Crc32(const void *data, size_t size)
+{
+    const uint8_t *bytes = (const uint8_t *)data;
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < size; ++i) {
+        crc ^= bytes[i];
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc >> 1) ^ (0xEDB88320u & -(crc & 1u));
+        }
+    }
+    return ~crc;
+}
+
+// Writes a record to storage; a record whose magic is 0 removes the trace.
+static void WriteRecord(const TraceRecord *record)
+{
+    int storageFd = Storage_OpenMutableFile();
+    if (storageFd == -1) {
+        Log_Debug("ERROR: Failed to open mutable storage - %s (%d)\n", strerror(errno), errno);
+        return;
+    }
+
+    if (lseek(storageFd, TRACE_OFFSET, SEEK_SET) == -1 ||
+        write(storageFd, record, sizeof(*record)) != sizeof(*record)) {
+        Log_Debug("ERROR: Failed to write latency trace to persistent storage - %s (%d)\n",
+                  strerror(errno), errno);
+    }
+
+    close(storageFd);
+}
+
+static void LoadStored(void)
+{
+    storedLoaded = true;
+
+    int storageFd = Storage_OpenMutableFile();
+    if (storageFd == -1) {
+        Log_Debug("ERROR: Failed to open mutable storage - %s (%d)\n", strerror(errno), errno);
+        return;
+    }
+
+    TraceRecord record;
+    haveStored = lseek(storageFd, TRACE_OFFSET, SEEK_SET) != -1 &&
+                 read(storageFd, &record, sizeof(record)) == sizeof(record) &&
+                 record.magic == traceMagic &&
+                 record.crc == Crc32(&record.trace, sizeof(record.trace)) &&
+                 record.trace.machineCount <= MAX_MACHINES;
+    close(storageFd);
+
+    if (haveStored) {
+        stored = record.trace;
+    }
+}
+
+// Once the telemetry has been acknowledged, the time taken by each stage is stored.
+static void PersistCurrent(void)
+{
+    TraceRecord record;
+    memset(&record, 0, sizeof(record));
+    record.magic = traceMagic;
+
+    LatencyTrace_Record *trace = &record.trace;
+    uint32_t submittedMs = current.hopMs[LatencyTrace_Hop_Submitted];
+    trace->machineCount = (uint32_t)current.machineCount;
+    for (size_t i = 0; i < current.machineCount; ++i) {
+        trace->machines[i].address = current.addresses[i];
+        trace->machines[i].batchSequence = current.batchSequences[i];
+        trace->machines[i].mcuWaitMs = current.mcuWaitMs[i];
+        trace->machines[i].uartMs = current.responseReceivedMs[i] - current.requestSentMs[i];
+        trace->machines[i].appMs = submittedMs - current.responseReceivedMs[i];
+    }
+    trace->schedulerMs = current.hopMs[LatencyTrace_Hop_Dispatched] - submittedMs;
+    trace->iotHubMs = current.hopMs[LatencyTrace_Hop_Acknowledged] -
+                      current.hopMs[LatencyTrace_Hop_Dispatched];
+    record.crc = Crc32(&record.trace, sizeof(record.trace));
+
+    LatencyTrace_Log(trace);
+    WriteRecord(&record);
+    currentPersisted = true;
+}
+
+uint32_t LatencyTrace_NowMs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t)((uint64_t)now.tv_sec * 1000 + (uint64_t)now.tv_nsec / 1000000);
+}
+
+void LatencyTrace_AddBatch(uint8_t address, const DeviceTelemetryBatch *batch)
+{
+    if (current.machineCount == MAX_MACHINES ||
+        current.hopMs[LatencyTrace_Hop_Submitted] != NOT_REACHED) {
+        return;
+    }
+
+    // The events are oldest first.
+    size_t i = current.machineCount++;
+    current.addresses[i] = address;
+    current.batchSequences[i] = batch->batchSequence;
+    current.mcuWaitMs[i] = batch->eventCount > 0 ? batch->events[0].millisecondsBeforeBatch : 0;
+    current.requestSentMs[i] = batch->requestSentMs;
+    current.responseReceivedMs[i] = batch->responseReceivedMs;
+}
+
+void LatencyTrace_Mark(LatencyTrace_Hop hop)
+{
+    // Each hop follows the one before it, so one which is reached out of order, such as the
+    // acknowledgement of a trace which was discarded, is ignored.
+    if (current.machineCount == 0 || current.hopMs[hop] != NOT_REACHED ||
+        (hop > 0 && current.hopMs[hop - 1] == NOT_REACHED)) {
+        return;
+    }
+
+    current.hopMs[hop] = LatencyTrace_NowMs();
+    if (hop == LatencyTrace_Hop_Acknowledged) {
+        PersistCurrent();
+    }
+}
+
+void LatencyTrace_Discard(void)
+{
+    // A trace without batches ignores the later hops of this cycle.
+    for (size_t i = 0; i < LatencyTrace_Hop_Count; ++i) {
+        current.hopMs[i] = NOT_REACHED;
+    }
+    current.machineCount = 0;
+}
+
+bool LatencyTrace_GetStored(const LatencyTrace_Record **record)
+{
+    if (!storedLoaded) {
+        LoadStored();
+    }
+
+    *record = &stored;
+    return haveStored;
+}
+
+void LatencyTrace_ClearStored(void)
+{
+    if (!haveStored) {
+        return;
+    }
+
+    haveStored = false;
+    if (!currentPersisted) {
+        TraceRecord record;
+        memset(&record, 0, sizeof(record));
+        WriteRecord(&record);
+    }
+}
+
+void LatencyTrace_Log(const LatencyTrace_Record *record)
+{
+    for (size_t i = 0; i < record->machineCount; ++i) {
+        const LatencyTrace_Machine *machine = &record->machines[i];
+        Log_Debug("INFO: Latency of batch %u from MCU %u: %u ms on the MCU, %u ms over the UART, "
+                  "%u ms in the app.\n",
+                  machine->batchSequence, machine->address, machine->mcuWaitMs, machine->uartMs,
+                  machine->appMs);
+    }
+    Log_Debug("INFO: Latency of the telemetry: %u ms in the send scheduler, %u ms to the IoT Hub's "
+              "acknowledgement.\n",
+              record->schedulerMs, record->iotHubMs);
+}
@@ -0,0 +1,114 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "telemetry.h"
+
+// The latency trace follows the telemetry of a wake cycle from the MCUs to the IoT Hub, so that
+// the stage which dominates the time from an event on a machine to its delivery to the cloud can
+// be seen, and followed across firmware versions. Each MCU stamps its telemetry batch with a
+// sequence number, which identifies the batch in the trace, and in the telemetry which is
+// calculated from it as "BatchSequence". The trace records these hops:
+//
+// - the MCU logged the oldest event in the batch, by the MCU's clock, which pauses while the MCU
+//   sleeps, so the wait on the MCU is a lower bound;
+// - the MT3620 requested the batch from the MCU, and received it (mcu_messaging.c);
+// - the business logic submitted the telemetry to the cloud interface (Cloud_SendTelemetry);
+// - the send scheduler dispatched it to the IoT Hub client (AzureIoT_SendTelemetry); and
+// - the IoT Hub acknowledged it (SendEventCallback).
+//
+// Times on the MT3620 are CLOCK_MONOTONIC milliseconds, as in the wake trace. Once the telemetry
+// has been acknowledged, the time taken by each stage is kept in mutable storage, and sent to the
+// cloud on the next cycle which connects. Telemetry which is stored on the device to be sent by a
+// later cycle is not traced, because its latency is set by the schedule of cloud cycles.
+
+/// <summary>Hops of the telemetry after it has been gathered from the MCUs.</summary>
+typedef enum {
+    /// <summary>The telemetry was submitted to the cloud interface.</summary>
+    LatencyTrace_Hop_Submitted,
+    /// <summary>The telemetry was dispatched to the IoT Hub client.</summary>
+    LatencyTrace_Hop_Dispatched,
+    /// <summary>The IoT Hub acknowledged the telemetry.</summary>
+    LatencyTrace_Hop_Acknowledged,
+    /// <summary>Number of hops.</summary>
+    LatencyTrace_Hop_Count
+} LatencyTrace_Hop;
+
+/// <summary>The time which one machine's batch took to reach the cloud interface.</summary>
+typedef struct {
+    /// <summary>Address of the machine's MCU.</summary>
+    uint8_t address;
+    /// <summary>Sequence number which the MCU stamped on the batch.</summary>
+    uint32_t batchSequence;
+    /// <summary>Time from the oldest event in the batch to the MCU's response, by the MCU's
+    /// clock; 0 if the batch had no events.</summary>
+    uint32_t mcuWaitMs;
+    /// <summary>Time from the request for the batch to its response, on the MT3620.</summary>
+    uint32_t uartMs;
+    /// <summary>Time from the response to the submission of the telemetry.</summary>
+    uint32_t appMs;
+} LatencyTrace_Machine;
+
+/// <summary>The trace of the telemetry of one wake cycle.</summary>
+typedef struct {
+    /// <summary>Number of valid entries in machines.</summary>
+    uint32_t machineCount;
+    /// <summary>Each machine whose telemetry was sent, in the order of the telemetry.</summary>
+    LatencyTrace_Machine machines[MAX_MACHINES];
+    /// <summary>Time from the submission of the telemetry to its dispatch.</summary>
+    uint32_t schedulerMs;
+    /// <summary>Time from the dispatch of the telemetry to its acknowledgement.</summary>
+    uint32_t iotHubMs;
+} LatencyTrace_Record;
+
+/// <summary>
+///     Gets the time of a hop.
+/// </summary>
+/// <returns>The CLOCK_MONOTONIC time in milliseconds.</returns>
+uint32_t LatencyTrace_NowMs(void);
+
+/// <summary>
+///     Adds a machine's batch to the trace of this cycle. Should be called for each machine
+///     whose telemetry is sent, in the order of the telemetry.
+/// </summary>
+/// <param name="address">Address of the machine's MCU.</param>
+/// <param name="batch">The batch, with the times at which it was requested and received.</param>
+void LatencyTrace_AddBatch(uint8_t address, const DeviceTelemetryBatch *batch);
+
+/// <summary>
+///     Records that the telemetry has reached a hop. Only the first time it is reached is
+///     recorded. Once the telemetry has been acknowledged, the trace is written to mutable
+///     storage.
+/// </summary>
+/// <param name="hop">The hop.</param>
+void LatencyTrace_Mark(LatencyTrace_Hop hop);
+
+/// <summary>
+///     Abandons the trace of this cycle, because its telemetry was stored on the device rather
+///     than sent, or could not be sent.
+/// </summary>
+void LatencyTrace_Discard(void);
+
+/// <summary>
+///     Gets the trace which was in mutable storage when it was first read, which is that of an
+///     earlier cycle, unless it has been cleared.
+/// </summary>
+/// <param name="record">Receives the trace, which remains owned by the tracer.</param>
+/// <returns>true if there is a stored trace; false if not.</returns>
+bool LatencyTrace_GetStored(const LatencyTrace_Record **record);
+
+/// <summary>
+///     Removes the trace returned by LatencyTrace_GetStored from mutable storage, once it has
+///     been sent. A trace of this cycle which has since been stored is kept.
+/// </summary>
+void LatencyTrace_ClearStored(void);
+
+/// <summary>
+///     Logs a trace, with the time taken by each stage.
+/// </summary>
+/// <param name="record">The trace.</param>
+void LatencyTrace_Log(const LatencyTrace_Record *record);
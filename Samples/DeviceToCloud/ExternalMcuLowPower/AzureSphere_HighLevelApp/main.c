@@ -28,6 +28,7 @@
 //
 // See https://aka.ms/AzureSphereHardwareDefinitions for more details.
 #include <hw/sample_appliance.h>
+#include <hw/uart_profiles.h>
 
 #include "business_logic.h"
 #include "cloud.h"
@@ -36,12 +37,24 @@
 #include "exitcode.h"
 #include "message_protocol.h"
 #include "mcu_messaging.h"
+#include "priority_dispatch.h"
 #include "uart_transport.h"
 #include "update.h"
+#include "wake_trace.h"
+
+#ifdef EVENT_TRACE
+#include "event_trace.h"
+#endif
 
 static EventLoop *eventLoop = NULL;
 static const char *scopeId = NULL;
 
+// The wake traces are kept in the last 128 bytes of mutable storage, after the DPS cache.
+static const off_t wakeTraceStorageOffset = 64 * 1024 - WAKE_TRACE_STORAGE_SIZE;
+
+// Settings for the UART which connects to the MCU, fastest first.
+static const UartTransport_Profile mcuUartProfiles[] = SAMPLE_STM32_UART_PROFILES;
+
 // Termination state
 static volatile sig_atomic_t businessLogicExitCode = ExitCode_Success;
 
@@ -75,6 +88,7 @@ static void TerminationHandler(int signalNumber)
 /// </returns>
 static ExitCode InitPeripheralsAndHandlers(void)
 {
+    WakeTrace_Initialize(wakeTraceStorageOffset);
     DebugUart_Init();
 
     struct sigaction action;
@@ -93,24 +107,25 @@ static ExitCode InitPeripheralsAndHandlers(void)
         return ExitCode_Init_EventLoop;
     }
 
-    // Initialize message protocol, UART transport and cloud connection
-    ec = MessageProtocol_Initialize(eventLoop, UartTransport_Read, UartTransport_Send);
-    if (ec != ExitCode_Success) {
-        return ec;
-    }
+    // The UART transport and the message protocol's timers run as soon as the event loop reports
+    // them, while the cloud work runs in low-priority slices between them.
+    PriorityDispatch_Initialize(eventLoop, PRIORITY_DISPATCH_DEFAULT_LOW_BUDGET_US);
 
-    ec = UartTransport_Initialize(eventLoop, SAMPLE_STM32_UART,
-                                  MessageProtocol_HandleReceivedMessage);
-    if (ec != ExitCode_Success) {
-        return ec;
+    // Initialize message protocol and UART transport
+    if (MessageProtocol_Initialize(eventLoop, UartTransport_Read, UartTransport_SendV) != 0) {
+        return ExitCode_MsgProtoInit;
     }
 
-    ec = Cloud_Initialize(eventLoop, (void *)scopeId, BusinessLogic_NotifyFatalError,
-                          BusinessLogic_NotifyCloudConnectionChange,
-                          BusinessLogic_NotifyCloudFlavorChange);
-    if (ec != ExitCode_Success) {
-        return ec;
+    if (UartTransport_InitializeWithProfiles(
+            eventLoop, SAMPLE_STM32_UART, mcuUartProfiles,
+            sizeof(mcuUartProfiles) / sizeof(mcuUartProfiles[0]),
+            MessageProtocol_HandleReceivedMessage) != 0) {
+        return ExitCode_Uart_Init;
     }
+    MessageProtocol_RegisterLinkQualityHandler(UartTransport_NotifyLinkQuality);
+    // The MCU firmware checks the CRC of each request, so that a corrupted request is retransmitted
+    // at once rather than after it has timed out.
+    MessageProtocol_EnableCrc(true);
 
     ec = Update_Initialize(eventLoop, BusinessLogic_NotifyUpdateCheckComplete,
                            BusinessLogic_NotifyUpdateCheckFailed);
@@ -118,12 +133,13 @@ static ExitCode InitPeripheralsAndHandlers(void)
         return ec;
     }
 
-    ec = BusinessLogic_Initialize(eventLoop);
+    // The business logic initializes the cloud connection, unless this cycle does not connect.
+    ec = BusinessLogic_Initialize(eventLoop, (void *)scopeId);
     if (ec != ExitCode_Success) {
         return ec;
     }
 
-    McuMessaging_Initialize();
+    McuMessaging_Initialize(BusinessLogic_NotifyTelemetryReady);
 
     return ExitCode_Success;
 }
@@ -137,6 +153,7 @@ static void ClosePeripheralsAndHandlers(void)
     UartTransport_Cleanup();
     Cloud_Cleanup();
     DebugUart_Cleanup();
+    PriorityDispatch_Cleanup();
 
     EventLoop_Close(eventLoop);
 }
@@ -205,7 +222,7 @@ int main(int argc, char *argv[])
 
     // Use event loop to wait for events and trigger handlers, until an error or SIGTERM happens
     while (businessLogicExitCode == ExitCode_Success) {
-        EventLoop_Run_Result result = EventLoop_Run(eventLoop, -1, true);
+        EventLoop_Run_Result result = PriorityDispatch_Run(-1);
         // Continue if interrupted by signal, e.g. due to breakpoint being set.
         if (result == EventLoop_Run_Failed && errno != EINTR) {
             businessLogicExitCode = ExitCode_Main_EventLoopFail;
@@ -218,6 +235,11 @@ int main(int argc, char *argv[])
         }
     }
 
+#ifdef EVENT_TRACE
+    // Log the timeline of the MCU's messages and the event handlers during this wake cycle.
+    EventTrace_Log();
+#endif
+
     ClosePeripheralsAndHandlers();
     Log_Debug("Application exiting.\n");
     return businessLogicExitCode;
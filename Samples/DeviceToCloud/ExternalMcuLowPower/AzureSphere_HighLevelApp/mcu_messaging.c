@@ -7,22 +7,43 @@
 #include <applibs/log.h>
 
 #include "eventloop_timer_utilities.h"
+#include "latency_trace.h"
 #include "message_protocol.h"
 #include "messages.h"
+#include "messages_codec.h"
 
 #include "mcu_messaging.h"
 
 static McuMessagingInitCallbackType initCallback = NULL;
 static McuMessagingRequestTelemetryCallbackType requestTelemetryCallback = NULL;
+static McuMessagingRequestTelemetryBatchCallbackType requestTelemetryBatchCallback = NULL;
 static McuMessagingSetLedCallbackType setLedCallback = NULL;
 static McuMessagingFailureCallbackType failCallback = NULL;
+static McuMessagingTelemetryReadyCallbackType telemetryReadyCallback = NULL;
+// When the outstanding RequestTelemetryBatch was sent, for the latency trace.
+static uint32_t telemetryBatchRequestSentMs = 0;
 
-void McuMessaging_Initialize(void) {}
+static void TelemetryReadyEventHandler(MessageProtocol_CategoryId categoryId,
+                                       MessageProtocol_EventId eventId)
+{
+    Log_Debug("INFO: MCU reports that telemetry is ready\n");
+    if (telemetryReadyCallback != NULL) {
+        telemetryReadyCallback();
+    }
+}
+
+void McuMessaging_Initialize(McuMessagingTelemetryReadyCallbackType callback)
+{
+    telemetryReadyCallback = callback;
+    MessageProtocol_RegisterEventHandler(MessageProtocol_McuToCloud_CategoryId,
+                                         MessageProtocol_McuToCloud_TelemetryReady,
+                                         TelemetryReadyEventHandler);
+}
 
 static bool CheckResponse(const char *responseName, MessageProtocol_CategoryId expectedCategory,
                           MessageProtocol_CategoryId actualCategory,
                           MessageProtocol_RequestId expectedRequest,
-                          MessageProtocol_RequestId actualRequest, size_t expectedSize,
+                          MessageProtocol_RequestId actualRequest, size_t minimumSize,
                           size_t actualSize, bool timedOut)
 {
     bool failed = false;
@@ -43,9 +64,10 @@ static bool CheckResponse(const char *responseName, MessageProtocol_CategoryId e
             failed = true;
         }
 
-        if (expectedSize != actualSize) {
+        // MCU firmware with a newer version of a message may append fields to it.
+        if (actualSize < minimumSize) {
             Log_Debug("ERROR: %s response - invalid body size %u bytes (expected %u bytes)",
-                      responseName, expectedSize, actualSize);
+                      responseName, actualSize, minimumSize);
             failed = true;
         }
     }
@@ -76,14 +98,15 @@ static void InitResponseHandler(MessageProtocol_CategoryId categoryId,
     }
 }
 
-void McuMessaging_Init(McuMessagingInitCallbackType successCallback,
+void McuMessaging_Init(MessageProtocol_Address address,
+                       McuMessagingInitCallbackType successCallback,
                        McuMessagingFailureCallbackType failureCallback)
 {
     initCallback = successCallback;
     failCallback = failureCallback;
 
-    MessageProtocol_SendRequest(MessageProtocol_McuToCloud_CategoryId,
-                                MessageProtocol_McuToCloud_Init, NULL, 0, InitResponseHandler);
+    MessageProtocol_SendRequestTo(address, MessageProtocol_McuToCloud_CategoryId,
+                                  MessageProtocol_McuToCloud_Init, NULL, 0, InitResponseHandler);
 }
 
 static void TelemetryResponseHandler(MessageProtocol_CategoryId categoryId,
@@ -94,7 +117,7 @@ static void TelemetryResponseHandler(MessageProtocol_CategoryId categoryId,
     bool failed =
         CheckResponse("RequestTelemtry", MessageProtocol_McuToCloud_CategoryId, categoryId,
                       MessageProtocol_McuToCloud_RequestTelemetry, requestId,
-                      sizeof(MessageProtocol_McuToCloud_TelemetryStruct), dataSize, timedOut);
+                      McuToCloud_Telemetry_EncodedSize, dataSize, timedOut);
 
     if (failed) {
         if (failCallback != NULL) {
@@ -104,13 +127,13 @@ static void TelemetryResponseHandler(MessageProtocol_CategoryId categoryId,
         }
     } else {
         if (requestTelemetryCallback != NULL) {
-            MessageProtocol_McuToCloud_TelemetryStruct *receivedTelemetry =
-                (MessageProtocol_McuToCloud_TelemetryStruct *)data;
+            MessageProtocol_McuToCloud_TelemetryStruct receivedTelemetry;
+            McuToCloud_Telemetry_Decode(&receivedTelemetry, data, dataSize);
 
             DeviceTelemetry telemetry = {
-                .lifetimeTotalDispenses = receivedTelemetry->lifetimeTotalDispenses,
-                .lifetimeTotalStockedDispenses = receivedTelemetry->lifetimeTotalStockedDispenses,
-                .capacity = receivedTelemetry->capacity};
+                .lifetimeTotalDispenses = receivedTelemetry.lifetimeTotalDispenses,
+                .lifetimeTotalStockedDispenses = receivedTelemetry.lifetimeTotalStockedDispenses,
+                .capacity = receivedTelemetry.capacity};
 
             requestTelemetryCallback(&telemetry);
 
@@ -120,15 +143,149 @@ static void TelemetryResponseHandler(MessageProtocol_CategoryId categoryId,
     }
 }
 
-void McuMessaging_RequestTelemetry(McuMessagingRequestTelemetryCallbackType successCallback,
+void McuMessaging_RequestTelemetry(MessageProtocol_Address address,
+                                   McuMessagingRequestTelemetryCallbackType successCallback,
                                    McuMessagingFailureCallbackType failureCallback)
 {
     requestTelemetryCallback = successCallback;
     failCallback = failureCallback;
 
-    MessageProtocol_SendRequest(MessageProtocol_McuToCloud_CategoryId,
-                                MessageProtocol_McuToCloud_RequestTelemetry, NULL, 0,
-                                TelemetryResponseHandler);
+    MessageProtocol_SendRequestTo(address, MessageProtocol_McuToCloud_CategoryId,
+                                  MessageProtocol_McuToCloud_RequestTelemetry, NULL, 0,
+                                  TelemetryResponseHandler);
+}
+
+// Every event record is at least as large as a dispense record, so this bounds the number of events
+// in a response.
+static_assert(MAX_RESPONSE_DATA_SIZE / (McuToCloud_TlvHeader_EncodedSize +
+                                        McuToCloud_TlvDispense_EncodedSize) <=
+                  MAX_TELEMETRY_BATCH_EVENTS,
+              "MAX_TELEMETRY_BATCH_EVENTS is too small for the largest batch");
+
+static bool ParseTelemetryBatch(const uint8_t *data, size_t dataSize, DeviceTelemetryBatch *batch)
+{
+    MessageProtocol_McuToCloud_TlvHeader header;
+    MessageProtocol_McuToCloud_TlvCountersStruct counters;
+
+    // The counters record comes first; it supplies the tick against which events are timed.
+    if (!McuToCloud_TlvHeader_Decode(&header, data, dataSize)) {
+        Log_Debug("ERROR: RequestTelemetryBatch response - body too short (%u bytes)\n",
+                  dataSize);
+        return false;
+    }
+    size_t offset = McuToCloud_TlvHeader_EncodedSize;
+    if (header.type != MessageProtocol_McuToCloud_TlvCounters ||
+        dataSize - offset < header.length ||
+        !McuToCloud_TlvCounters_Decode(&counters, data + offset, header.length)) {
+        Log_Debug("ERROR: RequestTelemetryBatch response - missing counters record\n");
+        return false;
+    }
+    offset += header.length;
+
+    batch->counters.lifetimeTotalDispenses = counters.counters.lifetimeTotalDispenses;
+    batch->counters.lifetimeTotalStockedDispenses =
+        counters.counters.lifetimeTotalStockedDispenses;
+    batch->counters.capacity = counters.counters.capacity;
+    batch->droppedEvents = counters.droppedEvents;
+    batch->batchSequence = counters.batchSequence;
+    batch->requestSentMs = telemetryBatchRequestSentMs;
+    batch->responseReceivedMs = LatencyTrace_NowMs();
+    batch->eventCount = 0;
+
+    while (offset < dataSize) {
+        if (!McuToCloud_TlvHeader_Decode(&header, data + offset, dataSize - offset)) {
+            Log_Debug("ERROR: RequestTelemetryBatch response - truncated record header\n");
+            return false;
+        }
+        offset += McuToCloud_TlvHeader_EncodedSize;
+        if (dataSize - offset < header.length) {
+            Log_Debug("ERROR: RequestTelemetryBatch response - truncated record (type %u)\n",
+                      header.type);
+            return false;
+        }
+        const uint8_t *value = data + offset;
+        offset += header.length;
+
+        DeviceTelemetryEvent *event = &batch->events[batch->eventCount];
+        uint32_t tick;
+
+        // A record which is too short to decode is skipped, as is a record of unknown type.
+        MessageProtocol_McuToCloud_TlvDispenseStruct d;
+        MessageProtocol_McuToCloud_TlvButtonPressStruct b;
+        MessageProtocol_McuToCloud_TlvFlavorStruct f;
+        if (header.type == MessageProtocol_McuToCloud_TlvDispense &&
+            McuToCloud_TlvDispense_Decode(&d, value, header.length)) {
+            event->type = DeviceTelemetryEvent_Dispense;
+            tick = d.tick;
+        } else if (header.type == MessageProtocol_McuToCloud_TlvButtonPress &&
+                   McuToCloud_TlvButtonPress_Decode(&b, value, header.length)) {
+            event->type = DeviceTelemetryEvent_ButtonPress;
+            event->button = (b.button == MessageProtocol_McuToCloud_RestockButton)
+                                ? DeviceTelemetryButton_Restock
+                                : DeviceTelemetryButton_Dispense;
+            tick = b.tick;
+        } else if (header.type == MessageProtocol_McuToCloud_TlvFlavor &&
+                   McuToCloud_TlvFlavor_Decode(&f, value, header.length)) {
+            event->type = DeviceTelemetryEvent_Flavor;
+            event->flavorColor.red = f.color.red != 0;
+            event->flavorColor.green = f.color.green != 0;
+            event->flavorColor.blue = f.color.blue != 0;
+            tick = f.tick;
+        } else {
+            // Skip records this version does not understand.
+            continue;
+        }
+
+        // Unsigned subtraction gives the right answer even if the tick has wrapped.
+        event->millisecondsBeforeBatch = counters.currentTick - tick;
+        ++batch->eventCount;
+    }
+
+    return true;
+}
+
+static void TelemetryBatchResponseHandler(MessageProtocol_CategoryId categoryId,
+                                          MessageProtocol_RequestId requestId, const uint8_t *data,
+                                          size_t dataSize, MessageProtocol_ResponseResult result,
+                                          bool timedOut)
+{
+    static DeviceTelemetryBatch batch;
+
+    // The body is variable length, so its size is validated while parsing.
+    bool failed = CheckResponse("RequestTelemetryBatch", MessageProtocol_McuToCloud_CategoryId,
+                                categoryId, MessageProtocol_McuToCloud_RequestTelemetryBatch,
+                                requestId, dataSize, dataSize, timedOut);
+
+    if (!failed) {
+        failed = !ParseTelemetryBatch(data, dataSize, &batch);
+    }
+
+    if (failed) {
+        if (failCallback != NULL) {
+            failCallback();
+        } else {
+            Log_Debug("ERROR: No failure handler registered.");
+        }
+    } else {
+        if (requestTelemetryBatchCallback != NULL) {
+            requestTelemetryBatchCallback(&batch);
+        } else {
+            Log_Debug("WARNING: RequestTelemetryBatch response - no handler registered.");
+        }
+    }
+}
+
+void McuMessaging_RequestTelemetryBatch(
+    MessageProtocol_Address address, McuMessagingRequestTelemetryBatchCallbackType successCallback,
+    McuMessagingFailureCallbackType failureCallback)
+{
+    requestTelemetryBatchCallback = successCallback;
+    failCallback = failureCallback;
+
+    telemetryBatchRequestSentMs = LatencyTrace_NowMs();
+    MessageProtocol_SendRequestTo(address, MessageProtocol_McuToCloud_CategoryId,
+                                  MessageProtocol_McuToCloud_RequestTelemetryBatch, NULL, 0,
+                                  TelemetryBatchResponseHandler);
 }
 
 static void SetLedResponseHandler(MessageProtocol_CategoryId categoryId,
@@ -138,8 +295,8 @@ static void SetLedResponseHandler(MessageProtocol_CategoryId categoryId,
 {
     bool failed =
         CheckResponse("SetLed", MessageProtocol_McuToCloud_CategoryId, categoryId,
-                      MessageProtocol_McuToCloud_SetLed, requestId,
-                      sizeof(MessageProtocol_McuToCloud_SetLedStruct), dataSize, timedOut);
+                      MessageProtocol_McuToCloud_SetLed, requestId, McuToCloud_SetLed_EncodedSize,
+                      dataSize, timedOut);
 
     if (failed) {
         if (failCallback != NULL) {
@@ -149,9 +306,9 @@ static void SetLedResponseHandler(MessageProtocol_CategoryId categoryId,
         }
     } else {
         if (setLedCallback != NULL) {
-            MessageProtocol_McuToCloud_SetLedStruct *setLed =
-                (MessageProtocol_McuToCloud_SetLedStruct *)data;
-            LedColor color = {setLed->red != 0, setLed->green != 0, setLed->blue != 0};
+            MessageProtocol_McuToCloud_SetLedStruct setLed;
+            McuToCloud_SetLed_Decode(&setLed, data, dataSize);
+            LedColor color = {setLed.red != 0, setLed.green != 0, setLed.blue != 0};
 
             setLedCallback(&color);
         } else {
@@ -160,18 +317,21 @@ static void SetLedResponseHandler(MessageProtocol_CategoryId categoryId,
     }
 }
 
-void McuMessaging_SetLed(const LedColor *color, McuMessagingSetLedCallbackType successCallback,
+void McuMessaging_SetLed(MessageProtocol_Address address, const LedColor *color,
+                         McuMessagingSetLedCallbackType successCallback,
                          McuMessagingFailureCallbackType failureCallback)
 {
     MessageProtocol_McuToCloud_SetLedStruct leds = {.red = color->red ? 0xff : 0x00,
                                                     .green = color->green ? 0xff : 0x00,
                                                     .blue = color->blue ? 0xff : 0x00,
                                                     .reserved = 0};
+    uint8_t body[McuToCloud_SetLed_EncodedSize];
+    size_t bodySize = McuToCloud_SetLed_Encode(&leds, body);
 
     setLedCallback = successCallback;
     failCallback = failureCallback;
 
-    MessageProtocol_SendRequest(MessageProtocol_McuToCloud_CategoryId,
-                                MessageProtocol_McuToCloud_SetLed, (const uint8_t *)&leds,
-                                sizeof(leds), SetLedResponseHandler);
+    MessageProtocol_SendRequestTo(address, MessageProtocol_McuToCloud_CategoryId,
+                                  MessageProtocol_McuToCloud_SetLed, body, bodySize,
+                                  SetLedResponseHandler);
 }
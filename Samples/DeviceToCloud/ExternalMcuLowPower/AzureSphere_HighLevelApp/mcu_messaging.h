@@ -3,15 +3,27 @@
 
 #pragma once
 
+#include "message_protocol_public.h"
 #include "telemetry.h"
 #include "color.h"
 
+// Each request is sent to the MCU with the given address. An MCU which is alone on its UART has
+// address MessageProtocol_DefaultAddress; several MCUs may share one bus, such as RS-485, each
+// with its own address. The success and failure callbacks are shared by all MCUs, so when several
+// MCUs share a bus, the caller should wait for each response before sending the next request.
+
 typedef void (*McuMessagingFailureCallbackType)(void);
 
+typedef void (*McuMessagingTelemetryReadyCallbackType)(void);
+
 /// <summary>
 ///     Initialize comms with the external MCU.
 /// </summary>
-void McuMessaging_Initialize(void);
+/// <param name="telemetryReadyCallback">
+///     Called when an MCU reports, unsolicited, that it has logged enough telemetry to be worth
+///     collecting with McuMessaging_RequestTelemetryBatch.
+/// </param>
+void McuMessaging_Initialize(McuMessagingTelemetryReadyCallbackType telemetryReadyCallback);
 
 typedef void (*McuMessagingInitCallbackType)(void);
 
@@ -19,9 +31,11 @@ typedef void (*McuMessagingInitCallbackType)(void);
 ///     Send an init message to the MCU. On receipt of a successful response, call
 ///     <paramref="successCallback" />; on failure, call <paramref="failureCallback" />.
 /// </summary>
+/// <param name="address">Address of the MCU.</param>
 /// <param name="successCallback">Function to call on receipt of a successful response.</param>
 /// <param name="failCallback">Function to call if no response is received.</param>
-void McuMessaging_Init(McuMessagingInitCallbackType successCallback,
+void McuMessaging_Init(MessageProtocol_Address address,
+                       McuMessagingInitCallbackType successCallback,
                        McuMessagingFailureCallbackType failureCallback);
 
 typedef void (*McuMessagingRequestTelemetryCallbackType)(const DeviceTelemetry *telemetry);
@@ -31,19 +45,37 @@ typedef void (*McuMessagingRequestTelemetryCallbackType)(const DeviceTelemetry *
 ///     <paramref="successCallback" /> with the telemetry data; on failure, call
 ///     <paramref="failureCallback" />.
 /// </summary>
+/// <param name="address">Address of the MCU.</param>
 /// <param name="successCallback">Function to call on successful receipt of telemetry.</param>
 /// <param name="failCallback">Function to call if no response is received.</param>
-void McuMessaging_RequestTelemetry(McuMessagingRequestTelemetryCallbackType successCallback,
+void McuMessaging_RequestTelemetry(MessageProtocol_Address address,
+                                   McuMessagingRequestTelemetryCallbackType successCallback,
                                    McuMessagingFailureCallbackType failureCallback);
 
+typedef void (*McuMessagingRequestTelemetryBatchCallbackType)(const DeviceTelemetryBatch *batch);
+
+/// <summary>
+///     Send a request to the MCU for its counters and all of the events it has recorded since the
+///     previous batch. On receipt of a successful response, call <paramref="successCallback" />
+///     with the batch; on failure, call <paramref="failureCallback" />.
+/// </summary>
+/// <param name="address">Address of the MCU.</param>
+/// <param name="successCallback">Function to call on successful receipt of the batch.</param>
+/// <param name="failCallback">Function to call if no valid response is received.</param>
+void McuMessaging_RequestTelemetryBatch(
+    MessageProtocol_Address address, McuMessagingRequestTelemetryBatchCallbackType successCallback,
+    McuMessagingFailureCallbackType failureCallback);
+
 typedef void (*McuMessagingSetLedCallbackType)(const LedColor *color);
 
 /// <summary>
 ///     Send a request to set the LED color to the MCU. On receipt of a successful response, call
 ///     <paramref="successCallback" />; on failure, call <paramref="failureCallback" />.
 /// </summary>
+/// <param name="address">Address of the MCU.</param>
 /// <param name="color">LED color to set</param>
 /// <param name="successCallback">Function to call on successful receipt of SetLed response.</param>
 /// <param name="failCallback">Function to call if no response is received.</param>
-void McuMessaging_SetLed(const LedColor *color, McuMessagingSetLedCallbackType successCallback,
+void McuMessaging_SetLed(MessageProtocol_Address address, const LedColor *color,
+                         McuMessagingSetLedCallbackType successCallback,
                          McuMessagingFailureCallbackType failureCallback);
@@ -1,6 +1,7 @@
 /* Copyright (c) Microsoft Corporation. All rights reserved.
    Licensed under the MIT License. */
 
+#include <stddef.h>
 #include <stdint.h>
 #include <errno.h>
 #include <string.h>
@@ -10,133 +11,296 @@
 #include <applibs/storage.h>
 #include <applibs/log.h>
 
+#include "message_protocol_public.h"
 #include "telemetry.h"
 #include "persistent_storage.h"
 
+// Telemetry used to be stored in a single record at offset 0, which starts with these words.
 static const uint32_t magicWord0 = ('M' << 24) | ('S' << 16) | ('A' << 8) | 'S';
 static const uint32_t magicWord1 = ('S' << 24) | ('O' << 16) | ('D' << 8) | 'A';
+static const uint32_t singleMachineSlotMagicWord = ('T' << 24) | ('L' << 16) | ('M' << 8) | 'S';
+static const uint32_t telemetrySlotMagicWord = ('T' << 24) | ('L' << 16) | ('M' << 8) | 'M';
+static const uint32_t cycleStateMagicWord = ('C' << 24) | ('Y' << 16) | ('C' << 8) | 'L';
 
-bool PersistentStorage_RetrieveTelemetry(DeviceTelemetry *telemetry)
-{
-    int storageFd = -1;
+// Telemetry is written alternately to two slots, so that a power loss while one is being written
+// leaves the other intact. Reading takes the valid slot with the higher sequence number.
+#define TELEMETRY_SLOT_COUNT 2
+#define TELEMETRY_SLOT_SIZE 64
 
-    if (telemetry == NULL) {
-        Log_Debug("ERROR: Telemetry pointer cannot be NULL\n");
-        goto fail;
-    }
+// The cycle state follows the telemetry, and precedes the latency trace, which starts at offset
+// 176 (see latency_trace.c), and the telemetry queue's control block, which starts at offset 256
+// (see telemetry_queue.c).
+#define CYCLE_STATE_OFFSET 128
 
-    memset(telemetry, 0, sizeof(DeviceTelemetry));
+// Each slot holds the telemetry of every machine, with the address of its MCU.
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t sequence;
+    uint32_t crc;
+    uint32_t machineCount;
+    uint8_t addresses[MAX_MACHINES];
+    DeviceTelemetry telemetry[MAX_MACHINES];
+} TelemetrySlot;
 
-    storageFd = Storage_OpenMutableFile();
-    if (storageFd == -1) {
-        Log_Debug("ERROR: Failed to open mutable storage - %s (%d)\n", strerror(errno), errno);
-        goto fail;
-    }
+// Slots written before telemetry was gathered from several machines hold the telemetry of the
+// machine at MessageProtocol_DefaultAddress. Their header is the same.
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t sequence;
+    uint32_t crc;
+    DeviceTelemetry telemetry;
+} SingleMachineSlot;
 
-    uint32_t header[3];
-    ssize_t bytesRead = read(storageFd, &header[0], sizeof(header));
-    if (bytesRead == -1) {
-        Log_Debug("ERROR: Failed to read telemetry header from mutable storage - %s (%d)\n",
-                  strerror(errno), errno);
-        goto fail;
+typedef struct {
+    uint32_t magic;
+    uint32_t crc;
+    CycleState state;
+} CycleStateRecord;
+
+_Static_assert(sizeof(TelemetrySlot) <= TELEMETRY_SLOT_SIZE, "TelemetrySlot overlaps next slot");
+_Static_assert(TELEMETRY_SLOT_COUNT * TELEMETRY_SLOT_SIZE <= CYCLE_STATE_OFFSET,
+               "TelemetrySlot overlaps the cycle state");
+_Static_assert(CYCLE_STATE_OFFSET + sizeof(CycleStateRecord) <= 176,
+               "CycleStateRecord overlaps the latency trace");
+
+// Sequence number of the latest telemetry slot, or 0 if no slot is valid; valid once
+// latestTelemetrySequenceKnown is set.
+static uint32_t latestTelemetrySequence = 0;
+static bool latestTelemetrySequenceKnown = false;
+
+static uint32_t Crc32(const void *data, size_t size)
+{
+    const uint8_t *bytes = (const uint8_t *)data;
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < size; ++i) {
+        crc ^= bytes[i];
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc >> 1) ^ (0xEDB88320u & -(crc & 1u));
+        }
     }
+    return ~crc;
+}
 
-    if (bytesRead < sizeof(header)) {
-        Log_Debug(
-            "Failed to read telemetry header from mutable storage: incomplete header (%d bytes "
-            "when %u were expected)\n",
-            bytesRead, sizeof(header));
-        goto fail;
+// The CRC covers the whole slot, with the crc field set to zero.
+static uint32_t TelemetrySlotCrc(const void *slot, size_t size)
+{
+    uint8_t copy[TELEMETRY_SLOT_SIZE];
+    memcpy(copy, slot, size);
+    memset(copy + offsetof(TelemetrySlot, crc), 0, sizeof(uint32_t));
+    return Crc32(copy, size);
+}
+
+static bool ReadTelemetrySlot(int storageFd, uint32_t index, TelemetrySlot *slot)
+{
+    union {
+        TelemetrySlot machines;
+        SingleMachineSlot single;
+    } buffer;
+    if (lseek(storageFd, (off_t)index * TELEMETRY_SLOT_SIZE, SEEK_SET) == -1 ||
+        read(storageFd, &buffer, sizeof(buffer)) != sizeof(buffer) ||
+        buffer.single.version != telemetryStructVersion || buffer.single.sequence == 0) {
+        return false;
     }
 
-    if (header[0] != magicWord0 || header[1] != magicWord1) {
-        Log_Debug(
-            "Mutable storage does not contain header bytes; no stored telemetry available.\n");
-        goto fail;
+    if (buffer.single.magic == singleMachineSlotMagicWord &&
+        buffer.single.crc == TelemetrySlotCrc(&buffer.single, sizeof(buffer.single))) {
+        memset(slot, 0, sizeof(*slot));
+        slot->sequence = buffer.single.sequence;
+        slot->machineCount = 1;
+        slot->addresses[0] = MessageProtocol_DefaultAddress;
+        slot->telemetry[0] = buffer.single.telemetry;
+        return true;
     }
 
-    uint32_t persistedTelemetryVersion = header[2];
-    if (persistedTelemetryVersion != telemetryStructVersion) {
-        Log_Debug(
-            "Persisted telemetry struct version (%d) differs from expected version (%d); no stored "
-            "telemetry available",
-            persistedTelemetryVersion, telemetryStructVersion);
-        goto fail;
+    *slot = buffer.machines;
+    return slot->magic == telemetrySlotMagicWord && slot->machineCount <= MAX_MACHINES &&
+           slot->crc == TelemetrySlotCrc(slot, sizeof(*slot));
+}
+
+// Reads the telemetry record which was written before telemetry was split into slots.
+static bool ReadLegacyTelemetry(int storageFd, DeviceTelemetry *telemetry)
+{
+    uint32_t header[3];
+    if (lseek(storageFd, 0, SEEK_SET) == -1 ||
+        read(storageFd, &header[0], sizeof(header)) != sizeof(header) ||
+        header[0] != magicWord0 || header[1] != magicWord1 ||
+        header[2] != telemetryStructVersion) {
+        return false;
     }
 
-    bytesRead = read(storageFd, telemetry, sizeof(DeviceTelemetry));
+    return read(storageFd, telemetry, sizeof(*telemetry)) == sizeof(*telemetry);
+}
 
-    if (bytesRead == -1) {
-        Log_Debug("ERROR: Failed to read telemetry from mutable storage - %s (%d)", strerror(errno),
-                  errno);
-        goto fail;
+// Reads the latest valid slot, or the legacy record if no slot is valid, and records the sequence
+// number of the latest slot.
+static bool ReadLatestTelemetry(TelemetrySlot *latest)
+{
+    memset(latest, 0, sizeof(*latest));
+
+    int storageFd = Storage_OpenMutableFile();
+    if (storageFd == -1) {
+        Log_Debug("ERROR: Failed to open mutable storage - %s (%d)\n", strerror(errno), errno);
+        return false;
     }
 
-    if (bytesRead < sizeof(DeviceTelemetry)) {
-        Log_Debug(
-            "ERROR: Failed to read full telemetry struct from mutable storage; no stored telemetry "
-            "available");
-        goto fail;
+    bool found = false;
+    latestTelemetrySequence = 0;
+    for (uint32_t i = 0; i < TELEMETRY_SLOT_COUNT; ++i) {
+        TelemetrySlot slot;
+        // Compare sequence numbers so that they can wrap around.
+        if (ReadTelemetrySlot(storageFd, i, &slot) &&
+            (!found || (int32_t)(slot.sequence - latestTelemetrySequence) > 0)) {
+            *latest = slot;
+            latestTelemetrySequence = slot.sequence;
+            found = true;
+        }
     }
+    latestTelemetrySequenceKnown = true;
 
-    return true;
+    if (!found && ReadLegacyTelemetry(storageFd, &latest->telemetry[0])) {
+        latest->machineCount = 1;
+        latest->addresses[0] = MessageProtocol_DefaultAddress;
+        found = true;
+    }
 
-fail:
+    close(storageFd);
+    return found;
+}
 
-    if (storageFd != 0) {
-        close(storageFd);
+bool PersistentStorage_RetrieveTelemetry(uint8_t address, DeviceTelemetry *telemetry)
+{
+    if (telemetry == NULL) {
+        Log_Debug("ERROR: Telemetry pointer cannot be NULL\n");
+        return false;
     }
+
+    memset(telemetry, 0, sizeof(DeviceTelemetry));
+
+    TelemetrySlot latest;
+    if (ReadLatestTelemetry(&latest)) {
+        for (uint32_t i = 0; i < latest.machineCount; ++i) {
+            if (latest.addresses[i] == address) {
+                *telemetry = latest.telemetry[i];
+                return true;
+            }
+        }
+    }
+
+    Log_Debug("Mutable storage does not contain valid telemetry for machine %u; no stored "
+              "telemetry available.\n",
+              address);
     return false;
 }
 
-void PersistentStorage_PersistTelemetry(const DeviceTelemetry *telemetry)
+void PersistentStorage_PersistTelemetry(const uint8_t *addresses, const DeviceTelemetry *telemetry,
+                                        size_t count)
 {
-    int storageFd = -1;
+    if (telemetry == NULL || addresses == NULL || count > MAX_MACHINES) {
+        Log_Debug("ERROR: Invalid telemetry to persist\n");
+        return;
+    }
 
-    if (telemetry == NULL) {
-        Log_Debug("ERROR: Telemetry pointer cannot be NULL\n");
-        goto cleanup;
+    // Find the latest slot, unless telemetry has already been retrieved or persisted by this
+    // run, so that the new telemetry does not overwrite it.
+    if (!latestTelemetrySequenceKnown) {
+        TelemetrySlot latest;
+        ReadLatestTelemetry(&latest);
     }
 
-    storageFd = Storage_OpenMutableFile();
+    int storageFd = Storage_OpenMutableFile();
     if (storageFd == -1) {
         Log_Debug("ERROR: Failed to open mutable storage - %s (%d)\n", strerror(errno), errno);
-        goto cleanup;
+        return;
     }
 
-    uint32_t header[] = {magicWord0, magicWord1, telemetryStructVersion};
-    ssize_t bytesWritten = write(storageFd, &header, sizeof(header));
-    if (bytesWritten == -1) {
-        Log_Debug("ERROR: Failed to write telemetry header to persistent storage - %s (%d)\n",
-                  strerror(errno), errno);
-        goto cleanup;
+    // Zero the slot so that the CRC does not depend on padding. Sequence number 0 means that no
+    // slot is valid, so skip to 2 when the sequence number wraps around, which keeps the
+    // alternation between slots.
+    TelemetrySlot slot;
+    memset(&slot, 0, sizeof(slot));
+    slot.magic = telemetrySlotMagicWord;
+    slot.version = telemetryStructVersion;
+    slot.sequence = latestTelemetrySequence + 1;
+    if (slot.sequence == 0) {
+        slot.sequence = 2;
     }
+    slot.machineCount = (uint32_t)count;
+    memcpy(slot.addresses, addresses, count * sizeof(addresses[0]));
+    memcpy(slot.telemetry, telemetry, count * sizeof(telemetry[0]));
+    slot.crc = TelemetrySlotCrc(&slot, sizeof(slot));
 
-    if (bytesWritten < sizeof(header)) {
-        Log_Debug(
-            "ERROR: Failed to write full telemetry header to persistent storage - only wrote %d of "
-            "%u bytes\n",
-            bytesWritten, sizeof(header));
-        goto cleanup;
+    // Write the slot which does not hold the latest telemetry. The first slot is written second,
+    // so that telemetry in the legacy record, which it overlaps, survives the first write.
+    uint32_t index = slot.sequence % TELEMETRY_SLOT_COUNT;
+    ssize_t bytesWritten = -1;
+    if (lseek(storageFd, (off_t)index * TELEMETRY_SLOT_SIZE, SEEK_SET) != -1) {
+        bytesWritten = write(storageFd, &slot, sizeof(slot));
     }
 
-    bytesWritten = write(storageFd, telemetry, sizeof(DeviceTelemetry));
     if (bytesWritten == -1) {
         Log_Debug("ERROR: Failed to write telemetry to persistent storage - %s (%d)\n",
                   strerror(errno), errno);
-        goto cleanup;
-    }
-
-    if (bytesWritten < sizeof(DeviceTelemetry)) {
+    } else if (bytesWritten < sizeof(slot)) {
         Log_Debug(
             "ERROR: Failed to write full telemetry to persistent storage - only wrote %d of %u "
             "bytes\n",
-            bytesWritten, sizeof(DeviceTelemetry));
-        goto cleanup;
+            bytesWritten, sizeof(slot));
+    } else {
+        latestTelemetrySequence = slot.sequence;
+    }
+
+    close(storageFd);
+}
+
+void PersistentStorage_PersistCycleState(const CycleState *state)
+{
+    int storageFd = Storage_OpenMutableFile();
+    if (storageFd == -1) {
+        Log_Debug("ERROR: Failed to open mutable storage - %s (%d)\n", strerror(errno), errno);
+        return;
+    }
+
+    // Zero the record so that the CRC does not depend on padding.
+    CycleStateRecord record;
+    memset(&record, 0, sizeof(record));
+    record.magic = cycleStateMagicWord;
+    record.state.fastCyclesSinceFullCycle = state->fastCyclesSinceFullCycle;
+    record.state.localCyclesSinceCloudCycle = state->localCyclesSinceCloudCycle;
+    record.state.desiredPropertiesVersion = state->desiredPropertiesVersion;
+    record.state.lastUpdateCheckTime = state->lastUpdateCheckTime;
+    record.state.telemetrySlotOffsetSeconds = state->telemetrySlotOffsetSeconds;
+    record.state.reconnectJitterPercent = state->reconnectJitterPercent;
+    record.state.deviceIdHash = state->deviceIdHash;
+    record.crc = Crc32(&record.state, sizeof(record.state));
+
+    if (lseek(storageFd, CYCLE_STATE_OFFSET, SEEK_SET) == -1 ||
+        write(storageFd, &record, sizeof(record)) != sizeof(record)) {
+        Log_Debug("ERROR: Failed to write cycle state to persistent storage - %s (%d)\n",
+                  strerror(errno), errno);
     }
 
-cleanup:
-    if (storageFd != 0) {
-        close(storageFd);
+    close(storageFd);
+}
+
+bool PersistentStorage_RetrieveCycleState(CycleState *state)
+{
+    int storageFd = Storage_OpenMutableFile();
+    if (storageFd == -1) {
+        Log_Debug("ERROR: Failed to open mutable storage - %s (%d)\n", strerror(errno), errno);
+        return false;
+    }
+
+    CycleStateRecord record;
+    bool found = lseek(storageFd, CYCLE_STATE_OFFSET, SEEK_SET) != -1 &&
+                 read(storageFd, &record, sizeof(record)) == sizeof(record) &&
+                 record.magic == cycleStateMagicWord &&
+                 record.crc == Crc32(&record.state, sizeof(record.state));
+    close(storageFd);
+
+    if (found) {
+        *state = record.state;
     }
+    return found;
 }
@@ -4,21 +4,74 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include "telemetry.h"
 
 /// <summary>
-///     Persist device telemetry to storage, for retrieval on a future run.
+///     State which is carried from one wake cycle to the next.
 /// </summary>
-/// <param name="telemetry">Pointer to a telemetry object to persist.</param>
-void PersistentStorage_PersistTelemetry(const DeviceTelemetry *telemetry);
+typedef struct {
+    /// <summary>Number of fast cycles which have completed since the last full cycle.</summary>
+    uint32_t fastCyclesSinceFullCycle;
+    /// <summary>
+    ///     Number of local cycles, which did not connect to the cloud, since the last cycle which
+    ///     did. Cycle state which was written before local cycles were introduced holds 0 here.
+    /// </summary>
+    uint32_t localCyclesSinceCloudCycle;
+    /// <summary>
+    ///     Version of the desired properties which were last applied, or -1 if unknown.
+    /// </summary>
+    int64_t desiredPropertiesVersion;
+    /// <summary>
+    ///     Time at which the OS last reported its check for updates, in seconds since the epoch,
+    ///     or 0 if it has not been reported.
+    /// </summary>
+    int64_t lastUpdateCheckTime;
+    /// <summary>
+    ///     Offset of the telemetry slot which the device twin set, in seconds, or -1 to derive it
+    ///     from the device ID. Cycle state which was written before the schedule was introduced
+    ///     does not match the record's CRC, so it is discarded once, and that wake connects.
+    /// </summary>
+    int32_t telemetrySlotOffsetSeconds;
+    /// <summary>Percentage of each reconnect delay which is random.</summary>
+    uint32_t reconnectJitterPercent;
+    /// <summary>Hash of the device ID, or 0 if the device has not yet connected.</summary>
+    uint32_t deviceIdHash;
+} CycleState;
 
 /// <summary>
-///     Attempt to retrieve previously persisted device telemetry from storage. If no previous
-///     telemetry can be found, returns false and sets all fields of the supplied telemetry object
-///     to zero; otherwise, returns true and populates the supplied telemetry object.
+///     Persist the telemetry of each machine to storage, for retrieval on a future run. It
+///     replaces the telemetry which was persisted before, so it should include every machine.
 /// </summary>
+/// <param name="addresses">The address of each machine's MCU.</param>
+/// <param name="telemetry">The telemetry of each machine.</param>
+/// <param name="count">Number of machines, up to MAX_MACHINES.</param>
+void PersistentStorage_PersistTelemetry(const uint8_t *addresses, const DeviceTelemetry *telemetry,
+                                        size_t count);
+
+/// <summary>
+///     Attempt to retrieve the previously persisted telemetry of a machine from storage. If no
+///     previous telemetry can be found for the machine, returns false and sets all fields of the
+///     supplied telemetry object to zero; otherwise, returns true and populates the supplied
+///     telemetry object.
+/// </summary>
+/// <param name="address">Address of the machine's MCU.</param>
 /// <param name="telemetry">
 ///     Pointer to a device telemetry object to receive the persisted data.
 /// </param>
 /// <returns>true if previously-persisted telemetry is found; false if not.</returns>
-bool PersistentStorage_RetrieveTelemetry(DeviceTelemetry *telemetry);
+bool PersistentStorage_RetrieveTelemetry(uint8_t address, DeviceTelemetry *telemetry);
+
+/// <summary>
+///     Persist the cycle state to storage, for retrieval on the next wake.
+/// </summary>
+/// <param name="state">Pointer to the cycle state to persist.</param>
+void PersistentStorage_PersistCycleState(const CycleState *state);
+
+/// <summary>
+///     Attempt to retrieve the previously persisted cycle state from storage.
+/// </summary>
+/// <param name="state">Pointer to a cycle state object to receive the persisted data.</param>
+/// <returns>true if previously-persisted cycle state is found; false if not.</returns>
+bool PersistentStorage_RetrieveCycleState(CycleState *state);
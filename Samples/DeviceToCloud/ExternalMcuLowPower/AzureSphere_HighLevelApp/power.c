@@ -3,16 +3,60 @@
 
 #include <errno.h>
 #include <string.h>
+#include <time.h>
 
 #include <applibs/powermanagement.h>
 
 #include <applibs/log.h>
 
-const unsigned int powerdownResidencyTimeSeconds = 120;
+#include "power.h"
+#include "wake_trace.h"
 
-void Power_RequestPowerdown(void)
+// The MCU wakes the device when it has logged enough telemetry, or needs attention, so the device
+// need not wake often to ask it; POWERDOWN_RESIDENCY_SECONDS may be lengthened for production.
+#ifndef POWERDOWN_RESIDENCY_SECONDS
+#define POWERDOWN_RESIDENCY_SECONDS 120
+#endif
+static const unsigned int powerdownResidencyTimeSeconds = POWERDOWN_RESIDENCY_SECONDS;
+
+// Residency when the MCU has reported more telemetry during the cycle.
+static const unsigned int wakeSoonResidencyTimeSeconds = 5;
+
+// Wake slots are only used once the clock has been set, which it is after the first connection;
+// an earlier time means that it has not been.
+static const time_t earliestValidTime = 1577836800; // 2020-01-01
+
+/// <summary>
+///     Get the residency until the device's next wake slot, which is between half a period and one
+///     and a half periods away, so that the average residency is still the period.
+/// </summary>
+static unsigned int GetSlotResidency(int32_t slotOffsetSeconds)
 {
-    if (PowerManagement_ForceSystemPowerDown(powerdownResidencyTimeSeconds) != 0) {
+    time_t now = time(NULL);
+    if (slotOffsetSeconds < 0 || now < earliestValidTime) {
+        return powerdownResidencyTimeSeconds;
+    }
+
+    int64_t period = powerdownResidencyTimeSeconds;
+    int64_t earliest = (int64_t)now + period / 2;
+    int64_t offset = slotOffsetSeconds % period;
+    int64_t slot = earliest - (earliest % period) + offset;
+    if (slot <= earliest) {
+        slot += period;
+    }
+    return (unsigned int)(slot - (int64_t)now);
+}
+
+void Power_RequestPowerdown(bool wakeSoon, int32_t slotOffsetSeconds)
+{
+    WakeTrace_Mark(WakeTrace_Phase_PowerdownRequested);
+    WakeTrace_Log(WakeTrace_GetCurrent());
+    WakeTrace_Persist();
+
+    unsigned int residency =
+        wakeSoon ? wakeSoonResidencyTimeSeconds : GetSlotResidency(slotOffsetSeconds);
+    Log_Debug("INFO: Powering down for %u seconds.\n", residency);
+    if (PowerManagement_ForceSystemPowerDown(residency) != 0) {
         Log_Debug("ERROR: Unable to force a system power down: %s (%d).\n", strerror(errno), errno);
     } else {
         Log_Debug("INFO: System power down requested.\n");
@@ -21,6 +65,9 @@ void Power_RequestPowerdown(void)
 
 void Power_RequestReboot(void)
 {
+    WakeTrace_Log(WakeTrace_GetCurrent());
+    WakeTrace_Persist();
+
     if (PowerManagement_ForceSystemReboot() != 0) {
         Log_Debug("ERROR: Unable to force a system reboot. %s (%d).\n", strerror(errno), errno);
     } else {
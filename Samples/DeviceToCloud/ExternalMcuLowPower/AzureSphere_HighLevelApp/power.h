@@ -3,10 +3,23 @@
 
 #pragma once
 
+#include <stdbool.h>
+#include <stdint.h>
+
 /// <summary>
 ///     Request that the device powers down for a period.
 /// </summary>
-void Power_RequestPowerdown(void);
+/// <param name="wakeSoon">
+///     If true, the device wakes after a few seconds rather than after the full period, because
+///     there is more telemetry to collect.
+/// </param>
+/// <param name="slotOffsetSeconds">
+///     Offset of the device's wake slot in seconds, which is taken modulo the period; or -1 if
+///     the device has no slot. If the device has a slot and the clock is set, it wakes at the next
+///     time which is offset from a multiple of the period by this much, and which is at least
+///     half a period away, so that devices with different offsets wake at different times.
+/// </param>
+void Power_RequestPowerdown(bool wakeSoon, int32_t slotOffsetSeconds);
 
 /// <summary>
 ///     Request that the device reboots.
@@ -0,0 +1,255 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include <applibs/log.h>
+
+#include "eventloop_timer_utilities.h"
+#include "send_scheduler.h"
+
+// Number of messages which can be queued. Routine messages may use all but
+// RESERVED_QUEUE_ENTRIES of them.
+#define QUEUE_SIZE 8u
+#define RESERVED_QUEUE_ENTRIES 2u
+
+// Number of messages which may await confirmation by the IoT Hub at once. Routine messages may use
+// all but one of them.
+#define MAX_IN_FLIGHT 4u
+
+/// <summary>
+///     Token bucket which limits the rate at which a class is sent: a message takes a token, and a
+///     token is added each refill period, up to the burst size.
+/// </summary>
+typedef struct {
+    unsigned int burst;
+    unsigned int refillPeriodMs;
+    unsigned int tokens;
+    // Time at which the last token was added, in milliseconds.
+    uint64_t lastRefillMs;
+} TokenBucket;
+
+// Rate limits of each class, indexed by SendScheduler_Class. A wake cycle sends one telemetry
+// message and up to WAKE_TRACE_MAX_STORED wake traces, which fit in the routine burst.
+static TokenBucket buckets[SendScheduler_Class_Count] = {
+    [SendScheduler_Class_Alarm] = {.burst = 4, .refillPeriodMs = 1000},
+    [SendScheduler_Class_Ack] = {.burst = 4, .refillPeriodMs = 1000},
+    [SendScheduler_Class_Routine] = {.burst = 6, .refillPeriodMs = 2000},
+};
+
+typedef struct {
+    bool inUse;
+    SendScheduler_Class messageClass;
+    // Order in which the message was queued.
+    uint32_t sequenceNumber;
+    const char *coalesceKey;
+    SendScheduler_SendHandler handler;
+    void *context;
+    size_t size;
+    uint8_t message[SEND_SCHEDULER_MAX_MESSAGE_SIZE];
+} QueueEntry;
+
+static QueueEntry queue[QUEUE_SIZE];
+static uint32_t nextSequenceNumber = 0;
+static unsigned int inFlight = 0;
+
+// Set while messages are being dispatched, so that a message which completes during its send
+// handler does not start another dispatch.
+static bool dispatching = false;
+// The dispatched message is copied here, so that its queue entry can be reused by the handler.
+static uint8_t dispatchBuffer[SEND_SCHEDULER_MAX_MESSAGE_SIZE];
+
+static EventLoopTimer *dispatchTimer = NULL;
+
+static void Dispatch(void);
+
+static uint64_t NowMs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000u + (uint64_t)now.tv_nsec / 1000000u;
+}
+
+static void RefillBucket(TokenBucket *bucket, uint64_t nowMs)
+{
+    uint64_t added = (nowMs - bucket->lastRefillMs) / bucket->refillPeriodMs;
+    if (bucket->tokens + added >= bucket->burst) {
+        bucket->tokens = bucket->burst;
+        bucket->lastRefillMs = nowMs;
+    } else {
+        bucket->tokens += (unsigned int)added;
+        bucket->lastRefillMs += added * bucket->refillPeriodMs;
+    }
+}
+
+static void DispatchTimerEventHandler(EventLoopTimer *timer)
+{
+    if (ConsumeEventLoopTimerEvent(timer) != 0) {
+        Log_Debug("ERROR: Could not consume send scheduler timer event\n");
+        return;
+    }
+    Dispatch();
+}
+
+ExitCode SendScheduler_Initialize(EventLoop *el)
+{
+    memset(queue, 0, sizeof(queue));
+    inFlight = 0;
+
+    uint64_t nowMs = NowMs();
+    for (size_t i = 0; i < SendScheduler_Class_Count; ++i) {
+        buckets[i].tokens = buckets[i].burst;
+        buckets[i].lastRefillMs = nowMs;
+    }
+
+    dispatchTimer = CreateEventLoopDisarmedTimer(el, &DispatchTimerEventHandler);
+    if (dispatchTimer == NULL) {
+        return ExitCode_SendScheduler_Init_Timer;
+    }
+    return ExitCode_Success;
+}
+
+void SendScheduler_Cleanup(void)
+{
+    DisposeEventLoopTimer(dispatchTimer);
+    dispatchTimer = NULL;
+    memset(queue, 0, sizeof(queue));
+}
+
+bool SendScheduler_Enqueue(SendScheduler_Class messageClass, const char *coalesceKey,
+                           SendScheduler_SendHandler handler, const void *message, size_t size,
+                           void *context)
+{
+    if (size > SEND_SCHEDULER_MAX_MESSAGE_SIZE) {
+        Log_Debug("ERROR: Message of %zu bytes is too large to schedule.\n", size);
+        return false;
+    }
+
+    QueueEntry *entry = NULL;
+    size_t used = 0;
+    for (size_t i = 0; i < QUEUE_SIZE; ++i) {
+        if (!queue[i].inUse) {
+            if (entry == NULL) {
+                entry = &queue[i];
+            }
+            continue;
+        }
+        ++used;
+        if (coalesceKey != NULL && queue[i].coalesceKey != NULL &&
+            strcmp(queue[i].coalesceKey, coalesceKey) == 0) {
+            Log_Debug("INFO: Pending '%s' message superseded.\n", coalesceKey);
+            entry = &queue[i];
+            break;
+        }
+    }
+
+    if (entry == NULL || (!entry->inUse && messageClass == SendScheduler_Class_Routine &&
+                          used >= QUEUE_SIZE - RESERVED_QUEUE_ENTRIES)) {
+        Log_Debug("WARNING: Send queue is full; message of class %d dropped.\n", messageClass);
+        return false;
+    }
+
+    if (!entry->inUse) {
+        entry->inUse = true;
+        entry->sequenceNumber = nextSequenceNumber++;
+    }
+    entry->messageClass = messageClass;
+    entry->coalesceKey = coalesceKey;
+    entry->handler = handler;
+    entry->context = context;
+    entry->size = size;
+    memcpy(entry->message, message, size);
+
+    Dispatch();
+    return true;
+}
+
+void SendScheduler_Complete(void)
+{
+    if (inFlight > 0) {
+        --inFlight;
+    }
+    Dispatch();
+}
+
+/// <summary>
+///     Find the oldest queued message of a class.
+/// </summary>
+static QueueEntry *FindOldest(SendScheduler_Class messageClass)
+{
+    QueueEntry *oldest = NULL;
+    for (size_t i = 0; i < QUEUE_SIZE; ++i) {
+        if (queue[i].inUse && queue[i].messageClass == messageClass &&
+            (oldest == NULL ||
+             (int32_t)(queue[i].sequenceNumber - oldest->sequenceNumber) < 0)) {
+            oldest = &queue[i];
+        }
+    }
+    return oldest;
+}
+
+/// <summary>
+///     Send queued messages in priority order while their classes have tokens and there are free
+///     send slots. If a message is waiting only for a token, arm the timer for when one is added.
+/// </summary>
+static void Dispatch(void)
+{
+    if (dispatching || dispatchTimer == NULL) {
+        return;
+    }
+    dispatching = true;
+
+    uint64_t waitMs = 0;
+    bool dispatched;
+    do {
+        dispatched = false;
+        waitMs = 0;
+        uint64_t nowMs = NowMs();
+
+        for (size_t c = 0; c < SendScheduler_Class_Count; ++c) {
+            unsigned int slots =
+                c == SendScheduler_Class_Routine ? MAX_IN_FLIGHT - 1 : MAX_IN_FLIGHT;
+            QueueEntry *entry = FindOldest((SendScheduler_Class)c);
+            if (entry == NULL || inFlight >= slots) {
+                continue;
+            }
+
+            TokenBucket *bucket = &buckets[c];
+            RefillBucket(bucket, nowMs);
+            if (bucket->tokens == 0) {
+                uint64_t classWaitMs = bucket->lastRefillMs + bucket->refillPeriodMs - nowMs;
+                if (waitMs == 0 || classWaitMs < waitMs) {
+                    waitMs = classWaitMs;
+                }
+                continue;
+            }
+
+            --bucket->tokens;
+            ++inFlight;
+            SendScheduler_SendHandler handler = entry->handler;
+            void *context = entry->context;
+            size_t size = entry->size;
+            memcpy(dispatchBuffer, entry->message, size);
+            entry->inUse = false;
+
+            if (!handler(dispatchBuffer, size, context)) {
+                --inFlight;
+            }
+            dispatched = true;
+            break;
+        }
+    } while (dispatched);
+
+    if (waitMs > 0) {
+        struct timespec delay = {.tv_sec = (time_t)(waitMs / 1000),
+                                 .tv_nsec = (long)(waitMs % 1000) * 1000000};
+        if (SetEventLoopTimerOneShot(dispatchTimer, &delay) != 0) {
+            Log_Debug("ERROR: Could not arm send scheduler timer\n");
+        }
+    }
+
+    dispatching = false;
+}
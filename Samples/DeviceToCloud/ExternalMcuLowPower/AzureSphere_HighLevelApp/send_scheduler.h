@@ -0,0 +1,89 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+// The send scheduler orders the messages which the cloud layer sends by priority class, and
+// limits the rate at which each class is sent with a token bucket, so that a burst of routine
+// telemetry cannot fill the IoT Hub client's outbound queue and delay an alarm or acknowledgement.
+//
+// Messages are held in a fixed-size queue until they are dispatched. The highest-priority class
+// which has a message, a token and a free send slot is dispatched first. Routine messages may not
+// use the last queue entries or the last send slot, which are kept for alarms and acknowledgements.
+// A message which is queued with a coalescing key replaces a pending message with the same key, so
+// that a superseded device twin report is never sent.
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <applibs/eventloop.h>
+
+#include "exitcode.h"
+#include "telemetry_queue.h"
+
+/// <summary>Maximum size of a queued message, in bytes.</summary>
+#define SEND_SCHEDULER_MAX_MESSAGE_SIZE (TELEMETRY_QUEUE_MAX_MESSAGE_LENGTH + 1)
+
+/// <summary>
+///     Priority classes, from the most to the least important.
+/// </summary>
+typedef enum {
+    /// <summary>Conditions which need attention, such as low soda.</summary>
+    SendScheduler_Class_Alarm,
+    /// <summary>Acknowledgements of requests from the cloud.</summary>
+    SendScheduler_Class_Ack,
+    /// <summary>Routine telemetry, which can wait.</summary>
+    SendScheduler_Class_Routine,
+    SendScheduler_Class_Count
+} SendScheduler_Class;
+
+/// <summary>
+///     Sends a message which has been dispatched.
+/// </summary>
+/// <param name="message">The message, which is only valid for the duration of the call.</param>
+/// <param name="size">Size of the message in bytes.</param>
+/// <param name="context">Context which was supplied when the message was queued.</param>
+/// <returns>
+///     true if the message was accepted for sending, in which case
+///     <see cref="SendScheduler_Complete" /> must be called once it has been confirmed; false if
+///     it could not be sent.
+/// </returns>
+typedef bool (*SendScheduler_SendHandler)(const void *message, size_t size, void *context);
+
+/// <summary>
+///     Initialize the scheduler.
+/// </summary>
+/// <param name="el">EventLoop to register the dispatch timer to.</param>
+/// <returns>An <see cref="ExitCode" /> indicating success or failure.</returns>
+ExitCode SendScheduler_Initialize(EventLoop *el);
+
+/// <summary>
+///     Discard the queued messages and release the dispatch timer.
+/// </summary>
+void SendScheduler_Cleanup(void);
+
+/// <summary>
+///     Queue a message for dispatch. Messages of a class are dispatched in the order in which they
+///     were queued; a message which replaces a pending message takes its place in the order.
+/// </summary>
+/// <param name="messageClass">Priority class of the message.</param>
+/// <param name="coalesceKey">
+///     Key of a message which supersedes any pending message with the same key, or NULL. The
+///     string must remain valid until the message is dispatched.
+/// </param>
+/// <param name="handler">Function which sends the message once it is dispatched.</param>
+/// <param name="message">The message, which is copied.</param>
+/// <param name="size">Size of the message, up to SEND_SCHEDULER_MAX_MESSAGE_SIZE bytes.</param>
+/// <param name="context">Context which is passed to the handler.</param>
+/// <returns>
+///     true if the message was queued; false if it is too large or the queue is full.
+/// </returns>
+bool SendScheduler_Enqueue(SendScheduler_Class messageClass, const char *coalesceKey,
+                           SendScheduler_SendHandler handler, const void *message, size_t size,
+                           void *context);
+
+/// <summary>
+///     Release the send slot of a message which has been confirmed, or which has failed, so that
+///     the next message can be dispatched.
+/// </summary>
+void SendScheduler_Complete(void);
@@ -3,8 +3,11 @@
 
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 
+#include "color.h"
+
 /// <summary>
 /// Defines the version of the telemetry struct; increment if the struct below is modified.
 /// </summary>
@@ -30,10 +33,112 @@ typedef struct DeviceTelemetry {
     uint32_t capacity;
 } DeviceTelemetry;
 
+/// <summary>
+/// Maximum number of machines whose telemetry is gathered on each wake. Their telemetry is sent to
+/// the cloud in one message, and stored in one telemetry slot, whose sizes bound it.
+/// </summary>
+#define MAX_MACHINES 3u
+
+/// <summary>
+/// Maximum number of events in a <see cref="DeviceTelemetryBatch" />.
+/// </summary>
+#define MAX_TELEMETRY_BATCH_EVENTS 40u
+
+/// <summary>
+///     Type of an event in a <see cref="DeviceTelemetryBatch" />.
+/// </summary>
+typedef enum {
+    /// <summary>A unit was dispensed.</summary>
+    DeviceTelemetryEvent_Dispense,
+    /// <summary>A button was pressed.</summary>
+    DeviceTelemetryEvent_ButtonPress,
+    /// <summary>The flavor LED was set.</summary>
+    DeviceTelemetryEvent_Flavor
+} DeviceTelemetryEventType;
+
+/// <summary>
+///     Button identifiers for <see cref="DeviceTelemetryEvent_ButtonPress" /> events.
+/// </summary>
+typedef enum {
+    DeviceTelemetryButton_Dispense,
+    DeviceTelemetryButton_Restock
+} DeviceTelemetryButton;
+
+/// <summary>
+///     An event recorded by the device.
+/// </summary>
+typedef struct DeviceTelemetryEvent {
+    /// <summary>
+    /// What happened
+    /// </summary>
+    DeviceTelemetryEventType type;
+
+    /// <summary>
+    /// How long before the batch was sent the event happened, in milliseconds. The device clock
+    /// pauses while it sleeps, so this is approximate.
+    /// </summary>
+    uint32_t millisecondsBeforeBatch;
+
+    union {
+        /// <summary>
+        /// For <see cref="DeviceTelemetryEvent_ButtonPress" />, which button was pressed
+        /// </summary>
+        DeviceTelemetryButton button;
+
+        /// <summary>
+        /// For <see cref="DeviceTelemetryEvent_Flavor" />, the LED color which was set
+        /// </summary>
+        LedColor flavorColor;
+    };
+} DeviceTelemetryEvent;
+
+/// <summary>
+///     Telemetry read from the device in a single batch: the counters, plus the events recorded
+///     since the previous batch, oldest first.
+/// </summary>
+typedef struct DeviceTelemetryBatch {
+    /// <summary>
+    /// Current counters
+    /// </summary>
+    DeviceTelemetry counters;
+
+    /// <summary>
+    /// Number of events which the device could not fit in this batch
+    /// </summary>
+    uint32_t droppedEvents;
+
+    /// <summary>
+    /// Sequence number which the device stamped on the batch, or 0 if its firmware does not
+    /// </summary>
+    uint32_t batchSequence;
+
+    /// <summary>
+    /// When the batch was requested, and when it was received, from LatencyTrace_NowMs
+    /// </summary>
+    uint32_t requestSentMs;
+    uint32_t responseReceivedMs;
+
+    /// <summary>
+    /// Number of valid entries in <see cref="events" />
+    /// </summary>
+    size_t eventCount;
+
+    /// <summary>
+    /// Events recorded since the previous batch
+    /// </summary>
+    DeviceTelemetryEvent events[MAX_TELEMETRY_BATCH_EVENTS];
+} DeviceTelemetryBatch;
+
 /// <summary>
 ///     Telemetry for sending to the cloud.
 /// </summary>
 typedef struct CloudTelemetry {
+    /// <summary>
+    /// Address of the machine's MCU, which is MessageProtocol_DefaultAddress if the MCU is alone
+    /// on its UART
+    /// </summary>
+    uint8_t machineAddress;
+
     /// <summary>
     /// Accumulated total number of dispenses made by the machine (since first run)
     /// </summary>
@@ -53,4 +158,30 @@ typedef struct CloudTelemetry {
     /// Boolean indicating if the machine is running low on soda
     /// </summary>
     bool lowSoda;
+
+    /// <summary>
+    /// Sequence number of the batch which the telemetry was calculated from, or 0 if the MCU
+    /// does not send one; see latency_trace.h
+    /// </summary>
+    uint32_t batchSequence;
+
+    /// <summary>
+    /// Boolean indicating if the dispense statistics below are known (see dispense_stats.h)
+    /// </summary>
+    bool haveDispenseStats;
+
+    /// <summary>
+    /// Moving average of the dispenses per hour
+    /// </summary>
+    float dispensesPerHour;
+
+    /// <summary>
+    /// Hours until the machine is empty at that rate, or -1 if the rate is 0
+    /// </summary>
+    int32_t hoursToEmpty;
+
+    /// <summary>
+    /// UTC hour of the day in which most dispenses are made, or -1 if none are recorded
+    /// </summary>
+    int32_t peakHour;
 } CloudTelemetry;
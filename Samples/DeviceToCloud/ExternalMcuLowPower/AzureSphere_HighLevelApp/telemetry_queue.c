@@ -0,0 +1,289 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <stdint.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdbool.h>
+
+#include <applibs/storage.h>
+#include <applibs/log.h>
+
+#include "telemetry_queue.h"
+
+// Layout of the queue within the mutable storage file. The start of the file is used by
+// persistent_storage.c and latency_trace.c; the control block and records follow it. The space
+// after the control block, from offset 320, is used by dispense_stats.c. The last 512 bytes of the
+// file, after the record area, are used by dps_cache.c.
+#define QUEUE_CONTROL_OFFSET 256
+#define QUEUE_RECORDS_OFFSET 512
+#define QUEUE_RECORD_SIZE 256u
+#define QUEUE_RECORD_COUNT 252u
+
+static const uint32_t recordMagic = ('T' << 24) | ('L' << 16) | ('M' << 8) | 'R';
+static const uint32_t controlMagic = ('T' << 24) | ('L' << 16) | ('M' << 8) | 'C';
+
+// Header of each record. The CRC covers the sequence number, length and message.
+typedef struct {
+    uint32_t magic;
+    uint32_t sequenceNumber;
+    uint16_t length;
+    uint16_t reserved;
+    uint32_t crc;
+} RecordHeader;
+
+_Static_assert(sizeof(RecordHeader) + TELEMETRY_QUEUE_MAX_MESSAGE_LENGTH <= QUEUE_RECORD_SIZE,
+               "TELEMETRY_QUEUE_MAX_MESSAGE_LENGTH is too large for QUEUE_RECORD_SIZE");
+
+// The control block records how much of the log has been delivered, so that delivered records are
+// not sent again after a restart. It is rewritten on each acknowledgement; the records themselves
+// are only ever written once.
+typedef struct {
+    uint32_t magic;
+    uint32_t firstUnsentSequenceNumber;
+    uint32_t crc;
+} ControlBlock;
+
+// Sequence number of the oldest message which has not been delivered.
+static uint32_t firstUnsentSequenceNumber = 0;
+// Sequence number which will be given to the next appended message.
+static uint32_t nextSequenceNumber = 0;
+
+static uint32_t Crc32(uint32_t crc, const void *data, size_t length)
+{
+    const uint8_t *bytes = data;
+    crc = ~crc;
+    while (length-- > 0) {
+        crc ^= *bytes++;
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc >> 1) ^ (0xEDB88320u & -(crc & 1u));
+        }
+    }
+    return ~crc;
+}
+
+static uint32_t RecordCrc(const RecordHeader *header, const void *message)
+{
+    uint32_t crc = Crc32(0, &header->sequenceNumber, sizeof(header->sequenceNumber));
+    crc = Crc32(crc, &header->length, sizeof(header->length));
+    return Crc32(crc, message, header->length);
+}
+
+static off_t RecordOffset(uint32_t sequenceNumber)
+{
+    return QUEUE_RECORDS_OFFSET + (off_t)(sequenceNumber % QUEUE_RECORD_COUNT) * QUEUE_RECORD_SIZE;
+}
+
+static bool ReadAt(int fd, off_t offset, void *buffer, size_t length)
+{
+    if (lseek(fd, offset, SEEK_SET) == -1) {
+        return false;
+    }
+    ssize_t bytesRead = read(fd, buffer, length);
+    return bytesRead == (ssize_t)length;
+}
+
+static bool WriteAt(int fd, off_t offset, const void *buffer, size_t length)
+{
+    if (lseek(fd, offset, SEEK_SET) == -1) {
+        return false;
+    }
+    ssize_t bytesWritten = write(fd, buffer, length);
+    return bytesWritten == (ssize_t)length;
+}
+
+// Read and validate the record in the slot for the given sequence number. The message is written
+// to the supplied buffer, which must be at least TELEMETRY_QUEUE_MAX_MESSAGE_LENGTH + 1 bytes.
+static TelemetryQueue_ReadResult ReadRecord(int fd, uint32_t sequenceNumber, char *message,
+                                            size_t *length)
+{
+    // A failed read is a storage error, whereas a short read is of a record which was never
+    // completely written, and so is corrupt.
+    RecordHeader header;
+    if (lseek(fd, RecordOffset(sequenceNumber), SEEK_SET) == -1) {
+        return TelemetryQueue_ReadResult_StorageError;
+    }
+    ssize_t bytesRead = read(fd, &header, sizeof(header));
+    if (bytesRead == -1) {
+        return TelemetryQueue_ReadResult_StorageError;
+    }
+
+    if (bytesRead != sizeof(header) || header.magic != recordMagic ||
+        header.sequenceNumber != sequenceNumber ||
+        header.length > TELEMETRY_QUEUE_MAX_MESSAGE_LENGTH) {
+        return TelemetryQueue_ReadResult_Corrupt;
+    }
+
+    bytesRead = read(fd, message, header.length);
+    if (bytesRead == -1) {
+        return TelemetryQueue_ReadResult_StorageError;
+    }
+    if (bytesRead != header.length) {
+        return TelemetryQueue_ReadResult_Corrupt;
+    }
+    message[header.length] = '\0';
+    *length = header.length;
+
+    return header.crc == RecordCrc(&header, message) ? TelemetryQueue_ReadResult_Ok
+                                                      : TelemetryQueue_ReadResult_Corrupt;
+}
+
+static void WriteControlBlock(int fd)
+{
+    ControlBlock control = {.magic = controlMagic,
+                            .firstUnsentSequenceNumber = firstUnsentSequenceNumber};
+    control.crc = Crc32(0, &control.firstUnsentSequenceNumber,
+                        sizeof(control.firstUnsentSequenceNumber));
+
+    if (!WriteAt(fd, QUEUE_CONTROL_OFFSET, &control, sizeof(control))) {
+        Log_Debug("ERROR: Failed to write telemetry queue control block - %s (%d)\n",
+                  strerror(errno), errno);
+    }
+}
+
+void TelemetryQueue_Initialize(void)
+{
+    firstUnsentSequenceNumber = 0;
+    nextSequenceNumber = 0;
+
+    int storageFd = Storage_OpenMutableFile();
+    if (storageFd == -1) {
+        Log_Debug("ERROR: Failed to open mutable storage - %s (%d)\n", strerror(errno), errno);
+        return;
+    }
+
+    // Find the newest and oldest intact records by scanning every slot; only the headers are read
+    // here, the CRCs are checked as each record is read back.
+    bool foundRecord = false;
+    uint32_t oldestSequenceNumber = 0;
+    for (uint32_t slot = 0; slot < QUEUE_RECORD_COUNT; ++slot) {
+        RecordHeader header;
+        if (!ReadAt(storageFd, QUEUE_RECORDS_OFFSET + (off_t)slot * QUEUE_RECORD_SIZE, &header,
+                    sizeof(header)) ||
+            header.magic != recordMagic || header.sequenceNumber % QUEUE_RECORD_COUNT != slot) {
+            continue;
+        }
+
+        if (!foundRecord || (int32_t)(header.sequenceNumber - nextSequenceNumber) >= 0) {
+            nextSequenceNumber = header.sequenceNumber + 1;
+        }
+        if (!foundRecord || (int32_t)(header.sequenceNumber - oldestSequenceNumber) < 0) {
+            oldestSequenceNumber = header.sequenceNumber;
+        }
+        foundRecord = true;
+    }
+
+    if (foundRecord) {
+        firstUnsentSequenceNumber = oldestSequenceNumber;
+
+        ControlBlock control;
+        if (ReadAt(storageFd, QUEUE_CONTROL_OFFSET, &control, sizeof(control)) &&
+            control.magic == controlMagic &&
+            control.crc == Crc32(0, &control.firstUnsentSequenceNumber,
+                                 sizeof(control.firstUnsentSequenceNumber)) &&
+            (int32_t)(control.firstUnsentSequenceNumber - oldestSequenceNumber) > 0 &&
+            (int32_t)(nextSequenceNumber - control.firstUnsentSequenceNumber) >= 0) {
+            firstUnsentSequenceNumber = control.firstUnsentSequenceNumber;
+        }
+    }
+
+    close(storageFd);
+
+    Log_Debug("INFO: Telemetry queue holds %u unsent message(s)\n", TelemetryQueue_GetCount());
+}
+
+bool TelemetryQueue_Append(const void *message, size_t length)
+{
+    if (length > TELEMETRY_QUEUE_MAX_MESSAGE_LENGTH) {
+        Log_Debug("ERROR: Telemetry message too long to queue (%u bytes)\n", length);
+        return false;
+    }
+
+    int storageFd = Storage_OpenMutableFile();
+    if (storageFd == -1) {
+        Log_Debug("ERROR: Failed to open mutable storage - %s (%d)\n", strerror(errno), errno);
+        return false;
+    }
+
+    // Write the header and message in one operation, so that a record is either wholly written or
+    // fails its CRC check.
+    uint8_t record[QUEUE_RECORD_SIZE];
+    RecordHeader header = {.magic = recordMagic,
+                           .sequenceNumber = nextSequenceNumber,
+                           .length = (uint16_t)length,
+                           .reserved = 0};
+    header.crc = RecordCrc(&header, message);
+    memcpy(record, &header, sizeof(header));
+    memcpy(record + sizeof(header), message, length);
+
+    bool written =
+        WriteAt(storageFd, RecordOffset(nextSequenceNumber), record, sizeof(header) + length);
+    if (!written) {
+        Log_Debug("ERROR: Failed to write telemetry to queue - %s (%d)\n", strerror(errno), errno);
+    } else {
+        ++nextSequenceNumber;
+
+        // If the log was full, the oldest message has just been overwritten.
+        if (nextSequenceNumber - firstUnsentSequenceNumber > QUEUE_RECORD_COUNT) {
+            Log_Debug("WARNING: Telemetry queue full; discarding oldest message\n");
+            firstUnsentSequenceNumber = nextSequenceNumber - QUEUE_RECORD_COUNT;
+            WriteControlBlock(storageFd);
+        }
+    }
+
+    close(storageFd);
+    return written;
+}
+
+size_t TelemetryQueue_GetCount(void)
+{
+    return nextSequenceNumber - firstUnsentSequenceNumber;
+}
+
+TelemetryQueue_ReadResult TelemetryQueue_Read(size_t index, void *buffer, size_t *length,
+                                              uint32_t *sequenceNumber)
+{
+    if (index >= TelemetryQueue_GetCount()) {
+        return TelemetryQueue_ReadResult_NoMessage;
+    }
+
+    *sequenceNumber = firstUnsentSequenceNumber + (uint32_t)index;
+
+    int storageFd = Storage_OpenMutableFile();
+    if (storageFd == -1) {
+        Log_Debug("ERROR: Failed to open mutable storage - %s (%d)\n", strerror(errno), errno);
+        return TelemetryQueue_ReadResult_StorageError;
+    }
+
+    TelemetryQueue_ReadResult result = ReadRecord(storageFd, *sequenceNumber, buffer, length);
+    if (result == TelemetryQueue_ReadResult_Corrupt) {
+        Log_Debug("WARNING: Queued telemetry message %u is corrupt\n", *sequenceNumber);
+    } else if (result == TelemetryQueue_ReadResult_StorageError) {
+        Log_Debug("ERROR: Failed to read queued telemetry message %u - %s (%d)\n",
+                  *sequenceNumber, strerror(errno), errno);
+    }
+
+    close(storageFd);
+    return result;
+}
+
+void TelemetryQueue_Acknowledge(uint32_t sequenceNumber)
+{
+    // Ignore acknowledgements for messages which have already been removed.
+    if ((int32_t)(sequenceNumber - firstUnsentSequenceNumber) < 0 ||
+        (int32_t)(sequenceNumber - nextSequenceNumber) >= 0) {
+        return;
+    }
+
+    firstUnsentSequenceNumber = sequenceNumber + 1;
+
+    int storageFd = Storage_OpenMutableFile();
+    if (storageFd == -1) {
+        Log_Debug("ERROR: Failed to open mutable storage - %s (%d)\n", strerror(errno), errno);
+        return;
+    }
+
+    WriteControlBlock(storageFd);
+    close(storageFd);
+}
@@ -0,0 +1,76 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// The telemetry queue is a store-and-forward log of telemetry messages which could not be sent to
+// the cloud. It is kept in mutable storage as a circular log of fixed-size, CRC-protected records,
+// so it survives reboots and power-downs; when the log is full the oldest record is overwritten.
+
+/// <summary>
+///     Maximum length of a message which can be queued, in bytes.
+/// </summary>
+#define TELEMETRY_QUEUE_MAX_MESSAGE_LENGTH 239u
+
+/// <summary>
+///     Load the state of the queue from mutable storage. Records which fail their CRC check, for
+///     example because power was lost while they were being written, are discarded.
+/// </summary>
+void TelemetryQueue_Initialize(void);
+
+/// <summary>
+///     Append a message to the queue.
+/// </summary>
+/// <param name="message">The message to store, which may be text or binary.</param>
+/// <param name="length">Length of the message in bytes.</param>
+/// <returns>true if the message was stored; false otherwise.</returns>
+bool TelemetryQueue_Append(const void *message, size_t length);
+
+/// <summary>
+///     Get the number of messages in the queue which have not been acknowledged.
+/// </summary>
+/// <returns>The number of queued messages.</returns>
+size_t TelemetryQueue_GetCount(void);
+
+/// <summary>Result of reading a queued message.</summary>
+typedef enum {
+    /// <summary>The message was read.</summary>
+    TelemetryQueue_ReadResult_Ok,
+    /// <summary>There is no message at the index.</summary>
+    TelemetryQueue_ReadResult_NoMessage,
+    /// <summary>The record of the message is corrupt, so it can be skipped.</summary>
+    TelemetryQueue_ReadResult_Corrupt,
+    /// <summary>Mutable storage could not be read; the message may be read later.</summary>
+    TelemetryQueue_ReadResult_StorageError
+} TelemetryQueue_ReadResult;
+
+/// <summary>
+///     Read a queued message without removing it from the queue.
+/// </summary>
+/// <param name="index">Index of the message to read; 0 is the oldest queued message.</param>
+/// <param name="buffer">
+///     Buffer to receive the message, followed by a null terminator so that a text message can be
+///     used as a string; must be at least TELEMETRY_QUEUE_MAX_MESSAGE_LENGTH + 1 bytes long.
+/// </param>
+/// <param name="length">Receives the length of the message in bytes.</param>
+/// <param name="sequenceNumber">
+///     Receives the sequence number to acknowledge the message with. This is set even if the
+///     message is corrupt, so that it can be acknowledged and skipped.
+/// </param>
+/// <returns>
+///     Whether the message was read. Only a corrupt message should be skipped; a message which
+///     could not be read because of a storage error is still in the queue.
+/// </returns>
+TelemetryQueue_ReadResult TelemetryQueue_Read(size_t index, void *buffer, size_t *length,
+                                              uint32_t *sequenceNumber);
+
+/// <summary>
+///     Remove messages from the queue once they have been delivered. All messages up to and
+///     including the one with the given sequence number are removed.
+/// </summary>
+/// <param name="sequenceNumber">Sequence number of the last delivered message.</param>
+void TelemetryQueue_Acknowledge(uint32_t sequenceNumber);
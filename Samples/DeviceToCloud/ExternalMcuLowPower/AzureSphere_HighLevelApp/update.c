@@ -9,6 +9,9 @@
 #include <applibs/powermanagement.h>
 #include <applibs/sysevent.h>
 
+#include "message_protocol.h"
+#include "update_policy.h"
+
 #include "eventloop_timer_utilities.h"
 #include "exitcode.h"
 #include "update.h"
@@ -22,9 +25,12 @@ static void FinishAndReboot(void);
 static void UpdatesStarted(void);
 static void UpdateReadyForInstall(SysEvent_Status status, const SysEvent_Info *info, void *context);
 static const char *UpdateTypeToString(SysEvent_UpdateType updateType);
+static unsigned int GetBusinessLogicActivity(void *context);
+static unsigned int GetMcuActivity(void *context);
 
 static bool businessLogicComplete = false;
 static bool pendingUpdatesDeferred = false;
+static bool updateEventReceived = false;
 
 static Update_UpdatesCompleteCallback updateCompleteCallbackFunc = NULL;
 static ExitCodeCallbackType exitCodeCallbackFunc = NULL;
@@ -37,6 +43,16 @@ static const struct timespec waitForUpdatesCheckTimerInterval = {.tv_sec = 120,
 static EventLoopTimer *waitForUpdatesToDownloadTimer = NULL;
 static const struct timespec waitForUpdatesToDownloadTimerInterval = {.tv_sec = 300, .tv_nsec = 0};
 
+// A pending update is deferred while the business logic runs, or while a request to the MCU is
+// outstanding. Queued telemetry is persisted, so it doesn't hold an update. The device is only
+// awake for a short time, so the sources are sampled every second and the update installs as
+// soon as they are all idle.
+static const UpdatePolicy_Config updatePolicyConfig = {
+    .samplePeriodSeconds = 1, .quietPeriodSeconds = 0, .deferMinutes = 1, .marginMinutes = 1};
+static const UpdatePolicy_Source updatePolicySources[] = {
+    {.name = "business logic running", .getActivity = GetBusinessLogicActivity, .idleLevel = 0},
+    {.name = "MCU request outstanding", .getActivity = GetMcuActivity, .idleLevel = 0}};
+
 ExitCode Update_Initialize(EventLoop *el, Update_UpdatesCompleteCallback updateCompleteCallback,
                            ExitCodeCallbackType failureCallback)
 {
@@ -65,16 +81,26 @@ ExitCode Update_Initialize(EventLoop *el, Update_UpdatesCompleteCallback updateC
         return ExitCode_Update_Init_CreateWaitForUpdatesDownloadTimer;
     }
 
+    if (UpdatePolicy_Start(el, &updatePolicyConfig, updatePolicySources,
+                           sizeof(updatePolicySources) / sizeof(updatePolicySources[0]),
+                           /* handler */ NULL, /* context */ NULL) != 0) {
+        Log_Debug("ERROR: Failed to start update policy: %s (%d)\n", strerror(errno), errno);
+        return ExitCode_Update_Init_UpdatePolicy;
+    }
+
     updateCompleteCallbackFunc = updateCompleteCallback;
     exitCodeCallbackFunc = failureCallback;
     businessLogicComplete = false;
     pendingUpdatesDeferred = false;
+    updateEventReceived = false;
 
     return ExitCode_Success;
 }
 
 void Update_Cleanup(void)
 {
+    UpdatePolicy_Stop();
+
     if (updateEventRegistration != NULL) {
         SysEvent_UnregisterForEventNotifications(updateEventRegistration);
     }
@@ -83,9 +109,26 @@ void Update_Cleanup(void)
     DisposeEventLoopTimer(waitForUpdatesToDownloadTimer);
 }
 
-void Update_NotifyBusinessLogicComplete(void)
+void Update_NotifyBusinessLogicComplete(bool waitForUpdateCheck)
 {
     businessLogicComplete = true;
+    UpdatePolicy_Evaluate();
+
+    // An update which the OS has not yet reported is found by the check on a later cycle, so
+    // don't keep the device awake waiting for it.
+    if (!waitForUpdateCheck && !updateEventReceived) {
+        Log_Debug("INFO: Not waiting for the check for updates.\n");
+        if (DisarmEventLoopTimer(waitForUpdatesCheckTimer) == -1) {
+            Log_Debug("ERROR: Failed to disarm update check timer: %s (%d)\n", strerror(errno),
+                      errno);
+        }
+        NoUpdateAvailable();
+    }
+}
+
+bool Update_IsUpdateCheckReported(void)
+{
+    return updateEventReceived;
 }
 
 static void WaitForUpdatesCheckTimerEventHandler(EventLoopTimer *timer)
@@ -107,6 +150,8 @@ static void WaitForUpdatesDownloadTimerEventHandler(EventLoopTimer *timer)
 static void HandleUpdateEvent(SysEvent_Events event, SysEvent_Status status,
                               const SysEvent_Info *info, void *context)
 {
+    updateEventReceived = true;
+
     // If we've received an update event, we can disable the update check timer.
     if (DisarmEventLoopTimer(waitForUpdatesCheckTimer) == -1) {
         Log_Debug("ERROR: Failed to disarm update check timer: %s (%d)\n", strerror(errno), errno);
@@ -184,22 +229,13 @@ static void UpdateReadyForInstall(SysEvent_Status status, const SysEvent_Info *i
 
     switch (status) {
     case SysEvent_Status_Pending:
-        if (businessLogicComplete) {
-            Log_Debug("INFO: Allowing update.\n");
-            SysEvent_ResumeEvent(SysEvent_Events_UpdateReadyForInstall);
-
-        } else {
-            Log_Debug("INFO: Max deferral time: %u minutes\n", data.max_deferral_time_in_minutes);
-            Log_Debug("INFO: Deferring update for 1 minute.\n");
-            result = SysEvent_DeferEvent(SysEvent_Events_UpdateReadyForInstall, 1);
-
-            if (result == -1) {
-                Log_Debug("ERROR: SysEvent_DeferEvent: %s (%d).\n", strerror(errno), errno);
-                if (exitCodeCallbackFunc != NULL) {
-                    exitCodeCallbackFunc(ExitCode_Update_UpdateCallback_DeferEvent);
-                } else {
-                    Log_Debug("WARNING: No fatal error callback handler registered.\n");
-                }
+        // The update policy lets the update install once the business logic is complete and
+        // the MCU is idle, or defers it until then.
+        if (UpdatePolicy_HandlePendingUpdate(info) == -1) {
+            if (exitCodeCallbackFunc != NULL) {
+                exitCodeCallbackFunc(ExitCode_Update_UpdateCallback_DeferEvent);
+            } else {
+                Log_Debug("WARNING: No fatal error callback handler registered.\n");
             }
         }
         break;
@@ -238,3 +274,14 @@ static const char *UpdateTypeToString(SysEvent_UpdateType updateType)
         return "Unknown";
     }
 }
+
+// The following satisfy the UpdatePolicy_ActivityCallback signature.
+static unsigned int GetBusinessLogicActivity(void *context)
+{
+    return businessLogicComplete ? 0 : 1;
+}
+
+static unsigned int GetMcuActivity(void *context)
+{
+    return MessageProtocol_IsIdle() ? 0 : 1;
+}
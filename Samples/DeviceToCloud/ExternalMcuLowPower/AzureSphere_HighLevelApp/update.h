@@ -36,4 +36,16 @@ void Update_Cleanup(void);
 ///     Indicate to update handling that business logic is complete (and so pending updates
 ///     can now be installed)
 /// </summary>
-void Update_NotifyBusinessLogicComplete(void);
+/// <param name="waitForUpdateCheck">
+///     Whether to wait for the result of the check for updates, if it has not yet been reported. If
+///     false, and no update has been reported, the update check is treated as complete without a
+///     reboot; an update which has already started to download is still waited for.
+/// </param>
+void Update_NotifyBusinessLogicComplete(bool waitForUpdateCheck);
+
+/// <summary>
+///     Whether the OS has reported the result of its check for updates during this wake cycle,
+///     rather than the check having timed out or not been waited for.
+/// </summary>
+/// <returns>true if an update event has been received; false otherwise.</returns>
+bool Update_IsUpdateCheckReported(void);
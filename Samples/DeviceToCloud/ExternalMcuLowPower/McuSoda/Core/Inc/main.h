@@ -56,13 +56,34 @@ _Noreturn void Error_Handler(void);
 
 /* USER CODE BEGIN EFP */
 extern UART_HandleTypeDef huart2;
+extern DMA_HandleTypeDef hdma_usart2_rx;
+extern DMA_HandleTypeDef hdma_usart2_tx;
 
 #define NO_PREV_ISR					0xFFFFFFFF
 #define DEBOUNCE_PERIOD_MS			250
 // The GPIO which wakes up the MT3620 is held low for this amount of time.
 // This must be less than DEBOUNCE_PERIOD_MS, else the main loop in soda.c
-// will go into WFI without systick enabled before the period ends.
+// will enter STOP mode without systick enabled before the period ends.
 #define TO_MT3620_WAKEUP_PERIOD_MS	10
+// Number of dispenses which are held in RAM before the machine state is written to flash.
+// The state is also written when the MT3620 requests telemetry, on restock, and when the
+// supply voltage falls below PERSIST_PVD_LEVEL.
+#define PERSIST_COMMIT_BATCH		16
+// Supply voltage below which the machine state is written to flash at once, and no more
+// flash pages are erased. PWR_PVDLEVEL_5 is about 2.9V.
+#define PERSIST_PVD_LEVEL			PWR_PVDLEVEL_5
+// Address of this machine when several machines share one bus to the MT3620, such as RS-485.
+// The machine only answers requests to its address. A machine which is alone on its UART
+// uses address 0.
+#ifndef MCU_BUS_ADDRESS
+#define MCU_BUS_ADDRESS				0
+#endif
+// Number of dispenses after which the MT3620 is woken and told that telemetry is ready, so
+// that it need not wake often to ask for it. It is also told when the telemetry log is
+// nearly full, when stock runs low and on restock.
+#ifndef TELEMETRY_PUSH_DISPENSES
+#define TELEMETRY_PUSH_DISPENSES	10
+#endif
 
 extern __IO uint32_t lastActivity;
 
@@ -83,13 +104,26 @@ extern MachineState state;
 _Noreturn void RunSodaMachine(void);
 void ReadMessageAsync(void);
 
+void SystemClock_Config(void);
+
+bool IsButtonEventPending(void);
+bool IsMessagePending(void);
 void HandleWakeupFromMT3620(void);
 void HandleButtonPress(void);
 void HandleMessage(void);
+void HandleMessageRxIdle(void);
 void StopWakingUpMT3620(void);
 
 void RestoreStateFromFlash(void);
-void WriteLatestMachineState(void);
+void MarkMachineStateChanged(void);
+void CommitMachineState(void);
+void HandlePowerFail(void);
+void ErasePendingFlashPage(void);
+
+void LogDispenseEvent(void);
+void LogButtonPressEvent(uint8_t button);
+bool IsTelemetryPushDue(void);
+void SendTelemetryReadyEvent(void);
 /* USER CODE END EFP */
 
 /* Private defines -----------------------------------------------------------*/
@@ -56,6 +56,8 @@ void EXTI0_1_IRQHandler(void);
 void EXTI4_15_IRQHandler(void);
 void USART2_IRQHandler(void);
 /* USER CODE BEGIN EFP */
+void PVD_IRQHandler(void);
+void DMA1_Channel4_5_6_7_IRQHandler(void);
 
 /* USER CODE END EFP */
 
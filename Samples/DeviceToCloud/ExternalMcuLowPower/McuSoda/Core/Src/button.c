@@ -2,9 +2,14 @@
    Licensed under the MIT License. */
 
 #include "main.h"
+#include "messages.h"
 
 static void SetFlagIfDebounceExpired(uint32_t *lastIsrTime, __IO bool *event);
 static void WakeUpMT3620(void);
+static void NotifyMT3620(void);
+
+// Whether the wakeup GPIO is being held low.
+static bool mt3620BeingWokenUp = false;
 
 // The last time (in ticks) when an interrupt (button, wakeup, or UART) occurred.
 __IO uint32_t lastActivity = NO_PREV_ISR;
@@ -72,40 +77,60 @@ void HandleButtonPress(void)
 	int availUnits = state.stockedDispenses - state.issuedDispenses;
 
 	if (dispenseButtonPressed) {
+		LogButtonPressEvent(MessageProtocol_McuToCloud_DispenseButton);
+
 		if (availUnits == 0) {
 			// Cannot dispense because no stock.
 		} else {
 			// If require restock then wake up the MT3620. This only happens when the
 			// inventory passes the threshold. It does not happen for every subsequent dispense.
 			if (availUnits - 1 == state.alertThreshold) {
-				WakeUpMT3620();
+				NotifyMT3620();
 			}
 
 			++state.issuedDispenses;
-			// In a real application, would not necessarily write to flash for every update.
-			// This statement is included to demonstrate how the storage mechanism works.
-			WriteLatestMachineState();
+			LogDispenseEvent();
+			// Dispenses are written to flash in batches, so this does not normally
+			// program the flash.
+			MarkMachineStateChanged();
 		}
 
 		dispenseButtonPressed = false;
 	}
 
 	if (restockButtonPressed) {
+		LogButtonPressEvent(MessageProtocol_McuToCloud_RestockButton);
+
 		int unitsToAdd = state.machineCapacity - availUnits;
 
 		state.stockedDispenses += unitsToAdd;
 		restockButtonPressed = false;
 
-		// In a real application, would not necessarily write to flash for every update.
-		// This statement is included to demonstrate how the storage mechanism works.
+		// Restocking is rare, so write the state, including any dispenses which are
+		// waiting to be written, at once.
 		if (unitsToAdd > 0) {
-			WriteLatestMachineState();
+			MarkMachineStateChanged();
+			CommitMachineState();
 		}
 
-		WakeUpMT3620();
+		NotifyMT3620();
+	}
+
+	// Once enough has been logged, wake the MT3620 to collect it, so that it does not need
+	// to wake often to ask.
+	if (IsTelemetryPushDue()) {
+		NotifyMT3620();
 	}
 }
 
+// Whether an event has been recorded which HandleButtonPress, HandleWakeupFromMT3620
+// or StopWakingUpMT3620 has not yet handled.
+bool IsButtonEventPending(void)
+{
+	return dispenseButtonPressed || restockButtonPressed || wakeupSignalReceived
+		|| mt3620BeingWokenUp;
+}
+
 void HandleWakeupFromMT3620(void)
 {
 	if (wakeupSignalReceived) {
@@ -114,8 +139,6 @@ void HandleWakeupFromMT3620(void)
 	}
 }
 
-// Whether the wakeup GPIO is being held high.
-static bool mt3620BeingWokenUp = false;
 // If mt3620BeingWokenUp is true, when the wakeup GPIO was pulled high.
 static uint32_t mt3620WakeUpEndTime;
 
@@ -133,6 +156,14 @@ static void WakeUpMT3620(void)
 	mt3620BeingWokenUp = true;
 }
 
+// Wakes the MT3620 if it is powered down, and tells it that telemetry is ready in case it
+// is awake.
+static void NotifyMT3620(void)
+{
+	WakeUpMT3620();
+	SendTelemetryReadyEvent();
+}
+
 // Called from non-interrupt context to stop waking up the MT3620 if required.
 void StopWakingUpMT3620(void)
 {
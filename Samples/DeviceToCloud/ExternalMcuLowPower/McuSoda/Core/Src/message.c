@@ -5,119 +5,416 @@
 #include "main.h"
 
 #include "messages.h"
+#include "messages_codec.h"
 #include "message_protocol_utilities.h"
 
-static void ReadMessageNextByteAsync(void);
+static void StartRxDma(void);
 
 static void HandleRequest(const MessageProtocol_RequestMessage *request);
-static void HandleInitRequest(const MessageProtocol_RequestMessage *request);
-static void HandleTelemetryRequest(const MessageProtocol_RequestMessage *request);
-static void HandleSetLedRequest(const MessageProtocol_RequestMessage *request);
+static size_t HandleInitRequest(const MessageProtocol_RequestMessage *request, uint8_t *body);
+static size_t HandleTelemetryRequest(const MessageProtocol_RequestMessage *request, uint8_t *body);
+static size_t HandleTelemetryBatchRequest(
+	const MessageProtocol_RequestMessage *request, uint8_t *body);
+static void HandleTelemetryBatchSent(void);
+static size_t HandleSetLedRequest(const MessageProtocol_RequestMessage *request, uint8_t *body);
+
+// Messages are built in place in one of these buffers, and the DMA sends the buffers in the
+// order in which they were queued. With two, the next message can be built while one is sent.
+#define TX_BUFFER_COUNT 2
+
+typedef union {
+	MessageProtocol_ResponseMessage response;
+	MessageProtocol_EventMessage event;
+} TxBuffer;
+
+static TxBuffer *AcquireTxBuffer(void);
+static void SubmitTxBuffer(uint16_t length);
+static void StartTxDma(void);
+static void SubmitResponse(const MessageProtocol_RequestMessage *request,
+	MessageProtocol_ResponseMessage *response, MessageProtocol_ResponseResult result,
+	size_t bodyLength);
+
+// The DMA receives continuously into this ring, which HandleMessage reassembles into frames.
+// The Azure Sphere device may send several requests without waiting for each response, so
+// the ring holds two requests. Its size must be a power of two, so that positions in it
+// can be counted with free-running counters.
+#define RX_RING_SIZE 512
+
+_Static_assert(RX_RING_SIZE >= 2 * sizeof(MessageProtocol_RequestMessage),
+	"RX_RING_SIZE must hold two requests");
+_Static_assert((RX_RING_SIZE & (RX_RING_SIZE - 1)) == 0, "RX_RING_SIZE must be a power of two");
+
+static uint8_t rxRing[RX_RING_SIZE];
+// Number of bytes which the DMA has written to rxRing, updated from interrupt context.
+static __IO uint32_t rxWritten;
+// Number of bytes which HandleMessage has read from rxRing.
+static uint32_t rxRead;
+// Set from interrupt context when reception has been restarted after an error.
+static __IO bool rxRestarted;
+
+// The frame which is being reassembled from rxRing.
+static uint8_t _Alignas(MessageProtocol_RequestMessage)
+	frame[sizeof(MessageProtocol_RequestMessage)];
+static size_t frameLength;
+// Number of complete frames which were discarded because their type, or the request they carry,
+// is not recognized, for inspection with a debugger.
+static uint32_t unrecognizedFrameCount;
+
+static TxBuffer txBuffers[TX_BUFFER_COUNT];
+// Length of the message in each buffer.
+static uint16_t txLengths[TX_BUFFER_COUNT];
+// Index of the buffer which the DMA is sending, and the number of buffers which are queued,
+// including that one. Updated from interrupt context.
+static __IO uint8_t txHead;
+static __IO uint8_t txQueued;
+
+// Events logged since the last RequestTelemetryBatch, already encoded as TLV records. Space is
+// left in the response for the counters record which precedes them, and for a CRC trailer.
+#define TELEMETRY_LOG_SIZE (MAX_RESPONSE_DATA_SIZE - McuToCloud_TlvHeader_EncodedSize \
+	- McuToCloud_TlvCounters_EncodedSize - MESSAGE_PROTOCOL_CRC_SIZE)
+
+static uint8_t telemetryLog[TELEMETRY_LOG_SIZE];
+static size_t telemetryLogLength;
+// Number of events which could not be logged because telemetryLog was full.
+static uint32_t telemetryLogDropped;
+// Number of dispenses logged since the last RequestTelemetryBatch.
+static uint32_t telemetryLogDispenses;
+// Whether the MT3620 has been told that telemetry is ready since the last RequestTelemetryBatch.
+static bool telemetryReadySent;
+// Sequence number of the next batch, which the MT3620 uses to trace the batch to the cloud.
+static uint32_t telemetryBatchSequence = 1;
+
+// The log is nearly full once it cannot hold another record of the largest kind.
+#define MAX_TELEMETRY_RECORD_SIZE (McuToCloud_TlvHeader_EncodedSize \
+	+ MAX_OF(McuToCloud_TlvButtonPress_EncodedSize, McuToCloud_TlvFlavor_EncodedSize))
+
+// Appends a TLV record, whose value has already been encoded, to the telemetry log, or counts it
+// as dropped if there is no room.
+static void LogTelemetryRecord(uint8_t type, const uint8_t *value, uint8_t length)
+{
+	const MessageProtocol_McuToCloud_TlvHeader header = { .type = type, .length = length };
 
-static void SendMessageLen(uint8_t *msg, uint16_t len);
-static void SendResponse(
-	const MessageProtocol_RequestMessage *request, void *body, size_t bodyLength);
+	if (telemetryLogLength + McuToCloud_TlvHeader_EncodedSize + length > sizeof(telemetryLog)) {
+		++telemetryLogDropped;
+		return;
+	}
 
-static __IO ITStatus rxStatus;
-static size_t rxBytesReceived;
-static uint8_t _Alignas(MessageProtocol_RequestMessage) rxBuffer[sizeof(MessageProtocol_RequestMessage)];
+	telemetryLogLength += McuToCloud_TlvHeader_Encode(&header, &telemetryLog[telemetryLogLength]);
+	memcpy(&telemetryLog[telemetryLogLength], value, length);
+	telemetryLogLength += length;
+}
 
-// Moved from RESET -> SET when TX completes.
-static __IO ITStatus txStatus;
-static MessageProtocol_ResponseMessage txResponse;
+void LogDispenseEvent(void)
+{
+	const MessageProtocol_McuToCloud_TlvDispenseStruct d = { .tick = HAL_GetTick() };
+	uint8_t value[McuToCloud_TlvDispense_EncodedSize];
+	LogTelemetryRecord(MessageProtocol_McuToCloud_TlvDispense, value,
+		(uint8_t) McuToCloud_TlvDispense_Encode(&d, value));
+	++telemetryLogDispenses;
+}
+
+void LogButtonPressEvent(uint8_t button)
+{
+	const MessageProtocol_McuToCloud_TlvButtonPressStruct b = {
+		.tick = HAL_GetTick(),
+		.button = button
+	};
+	uint8_t value[McuToCloud_TlvButtonPress_EncodedSize];
+	LogTelemetryRecord(MessageProtocol_McuToCloud_TlvButtonPress, value,
+		(uint8_t) McuToCloud_TlvButtonPress_Encode(&b, value));
+}
+
+// Whether enough has been logged since the last batch that the MT3620 should collect it, and
+// the MT3620 has not yet been told.
+bool IsTelemetryPushDue(void)
+{
+	return ! telemetryReadySent
+		&& (telemetryLogDispenses >= TELEMETRY_PUSH_DISPENSES
+			|| telemetryLogLength + MAX_TELEMETRY_RECORD_SIZE > sizeof(telemetryLog));
+}
+
+// Tells the MT3620 that telemetry is ready. If the MT3620 is powered down, the event is lost,
+// but the MT3620 asks for the telemetry once it has been woken. On a shared bus, an
+// unsolicited message could collide with the response of another machine, so only the wakeup
+// is used there.
+void SendTelemetryReadyEvent(void)
+{
+	telemetryReadySent = true;
+	if (MCU_BUS_ADDRESS != 0) {
+		return;
+	}
+
+	MessageProtocol_EventMessage *event = &AcquireTxBuffer()->event;
+	memset(event, 0, sizeof(*event));
+	memcpy(&event->messageHeaderWithType.messageHeader.preamble,
+		MessageProtocol_MessagePreamble, sizeof(MessageProtocol_MessagePreamble));
+	event->messageHeaderWithType.messageHeader.length =
+		(uint16_t) (sizeof(*event) - sizeof(MessageProtocol_MessageHeader));
+	event->messageHeaderWithType.type = MessageProtocol_EventMessageType;
+	event->messageHeaderWithType.address = MCU_BUS_ADDRESS;
+	event->eventInfo.categoryId = MessageProtocol_McuToCloud_CategoryId;
+	event->eventInfo.eventId = MessageProtocol_McuToCloud_TelemetryReady;
+
+	SubmitTxBuffer(sizeof(*event));
+}
 
 void ReadMessageAsync(void)
 {
-	rxStatus = RESET;
-	rxBytesReceived = 0;
+	rxWritten = 0;
+	rxRead = 0;
+	rxRestarted = false;
+	frameLength = 0;
 
-	ReadMessageNextByteAsync();
+	StartRxDma();
 }
 
-// Read a single byte from the UART which is connected to the Azure Sphere device.
-static void ReadMessageNextByteAsync(void)
+// Receive continuously into rxRing. The DMA wraps around at the end of the ring, and the
+// idle-line, half-transfer and transfer-complete interrupts record how far it has got.
+static void StartRxDma(void)
 {
-	if (HAL_UART_Receive_IT(&huart2, &rxBuffer[rxBytesReceived], 1) != HAL_OK) {
+	if (HAL_UART_Receive_DMA(&huart2, rxRing, sizeof(rxRing)) != HAL_OK) {
 		Error_Handler();
 	}
+
+	__HAL_UART_CLEAR_IDLEFLAG(&huart2);
+	__HAL_UART_ENABLE_IT(&huart2, UART_IT_IDLE);
 }
 
-// Called when the MCU has received a single byte from the Azure Sphere device.
-void HAL_UART_RxCpltCallback(UART_HandleTypeDef * handle)
+// Called from interrupt context to advance rxWritten to the DMA's current position. This is
+// called at least twice for each pass through the ring, so a wrap can be detected by the
+// position moving backwards.
+static void UpdateRxWritten(void)
 {
+	size_t offset = sizeof(rxRing) - __HAL_DMA_GET_COUNTER(huart2.hdmarx);
+	if (offset == sizeof(rxRing)) {
+		offset = 0;
+	}
+
+	size_t previousOffset = rxWritten % sizeof(rxRing);
+	if (offset >= previousOffset) {
+		rxWritten += offset - previousOffset;
+	} else {
+		rxWritten += sizeof(rxRing) - previousOffset + offset;
+	}
+
 	lastActivity = HAL_GetTick();
+}
 
-	// If latest data would overflow RX buffer then abort.
-	size_t currLength = ++rxBytesReceived;
-	if (currLength > sizeof(rxBuffer)) {
-		Error_Handler();
+// Called from the USART2 interrupt. The line goes idle at the end of each frame, so hand
+// the frame to the main loop without waiting for the DMA to reach the middle or end of
+// the ring.
+void HandleMessageRxIdle(void)
+{
+	if (__HAL_UART_GET_FLAG(&huart2, UART_FLAG_IDLE)
+		&& __HAL_UART_GET_IT_SOURCE(&huart2, UART_IT_IDLE)) {
+		__HAL_UART_CLEAR_IDLEFLAG(&huart2);
+		UpdateRxWritten();
+	}
+}
+
+// Called when the DMA has filled the first half of the ring.
+void HAL_UART_RxHalfCpltCallback(UART_HandleTypeDef *handle)
+{
+	UpdateRxWritten();
+}
+
+// Called when the DMA has filled the second half of the ring, and continues at the start.
+void HAL_UART_RxCpltCallback(UART_HandleTypeDef *handle)
+{
+	UpdateRxWritten();
+}
+
+// Called when the first byte of a frame wakes the core from STOP mode. The DMA only runs
+// once the core is awake, so keep it awake until the frame has been received.
+void HAL_UARTEx_WakeupCallback(UART_HandleTypeDef *handle)
+{
+	lastActivity = HAL_GetTick();
+}
+
+// Called when a framing, noise or overrun error has stopped the DMA. Discard whatever was
+// received, including the frame which was in progress, and start again at the start of
+// the ring.
+void HAL_UART_ErrorCallback(UART_HandleTypeDef *handle)
+{
+	lastActivity = HAL_GetTick();
+
+	// A transfer error of the TX DMA stops only the transmission; send the message again from
+	// the start.
+	if (txQueued > 0 && handle->gState == HAL_UART_STATE_READY) {
+		StartTxDma();
 	}
 
+	if (handle->RxState != HAL_UART_STATE_READY) {
+		return;
+	}
+
+	rxWritten += sizeof(rxRing) - (rxWritten % sizeof(rxRing));
+	rxRestarted = true;
+
+	StartRxDma();
+}
+
+// Append a byte to the frame being reassembled, and handle the frame if it is complete.
+static void AppendToFrame(uint8_t byte)
+{
+	// A frame which would overflow the buffer cannot be handled, so discard it and look
+	// for the next preamble.
+	if (frameLength == sizeof(frame)) {
+		frameLength = 0;
+	}
+
+	frame[frameLength++] = byte;
+
 	// If still in header and does not match expected header then discard.
 	// This discards noise at the beginning of the transfer.
-	if (currLength <= sizeof(MessageProtocol_MessagePreamble)) {
-		if (rxBuffer[currLength - 1] != MessageProtocol_MessagePreamble[currLength - 1]) {
-			rxBytesReceived = 0;
-			ReadMessageNextByteAsync();
-			return;
+	if (frameLength <= sizeof(MessageProtocol_MessagePreamble)) {
+		if (byte != MessageProtocol_MessagePreamble[frameLength - 1]) {
+			frameLength = 0;
 		}
+		return;
 	}
 
-	// If received an entire message, set a flag to handle the message when
-	// the ISR completes. Otherwise, read another byte from the Azure Sphere device.
-	if (MessageProtocol_IsMessageComplete(rxBuffer, currLength)) {
-		rxStatus = SET;
-	} else {
-		ReadMessageNextByteAsync();
+	if (! MessageProtocol_IsMessageComplete(frame, frameLength)) {
+		return;
 	}
+
+	const MessageProtocol_MessageHeaderWithType *header =
+		(MessageProtocol_MessageHeaderWithType *) frame;
+	if (header->type == MessageProtocol_RequestMessageType) {
+		// On a shared bus, requests to other machines are received too.
+		if (header->address == MCU_BUS_ADDRESS) {
+			HandleRequest((const MessageProtocol_RequestMessage *) header);
+		}
+	}
+
+	else if (header->type == MessageProtocol_ResponseMessageType) {
+		// On a shared bus, the responses of other machines are received too; ignore them.
+	}
+
+	// A frame of an unrecognized type is most likely one whose type byte was corrupted on the
+	// wire. Its other fields cannot be trusted, so it is not answered, and times out on the MT3620.
+	else {
+		++unrecognizedFrameCount;
+	}
+
+	frameLength = 0;
+}
+
+// Whether the DMA has received bytes which HandleMessage has not yet processed, or is still
+// sending a message. The core must not stop until the DMA has sent every queued message.
+bool IsMessagePending(void)
+{
+	return rxRead != rxWritten || rxRestarted || txQueued > 0;
 }
 
-// Called from non-interrupt context to handle a message.
+// Called from non-interrupt context to reassemble and handle any messages which have been
+// received. The DMA continues to receive into the ring while they are handled, because the
+// attached device may send the next request before the response to this one has been sent.
 void HandleMessage(void)
 {
-	// Do nothing if a completed message has not yet been received.
-	if (rxStatus == RESET) {
+	__disable_irq();
+	uint32_t written = rxWritten;
+	bool restarted = rxRestarted;
+	rxRestarted = false;
+	__enable_irq();
+
+	// If reception restarted, or the DMA has lapped the unread data, then that data is
+	// corrupt. Resynchronize on the next preamble.
+	if (restarted || written - rxRead > sizeof(rxRing)) {
+		rxRead = written;
+		frameLength = 0;
 		return;
 	}
 
-	// Listen for the next command. This should occur before the response
-	// has been sent because the attached device may send the next request
-	// before the MCU has begun to wait for it.
-	ReadMessageAsync();
+	while (rxRead != written) {
+		AppendToFrame(rxRing[rxRead % sizeof(rxRing)]);
+		++rxRead;
+	}
+}
 
-	const MessageProtocol_MessageHeaderWithType *header = (MessageProtocol_MessageHeaderWithType *) rxBuffer;
-	if (header->type == MessageProtocol_RequestMessageType) {
-		HandleRequest((const MessageProtocol_RequestMessage *) header);
+// Encodes the body of the response to a request into body, which has room for
+// MAX_RESPONSE_DATA_SIZE bytes, and returns its length.
+typedef size_t (*RequestHandler)(const MessageProtocol_RequestMessage *request, uint8_t *body);
+
+typedef struct {
+	MessageProtocol_CategoryId categoryId;
+	MessageProtocol_RequestId requestId;
+	RequestHandler handler;
+	// Called once the response has been queued, for work which need not delay it, so that the
+	// work overlaps the transmission; or NULL.
+	void (*afterResponse)(void);
+} RequestHandlerEntry;
+
+static const RequestHandlerEntry requestHandlers[] = {
+	{
+		MessageProtocol_McuToCloud_CategoryId, MessageProtocol_McuToCloud_Init,
+		HandleInitRequest, NULL
+	},
+	{
+		MessageProtocol_McuToCloud_CategoryId, MessageProtocol_McuToCloud_RequestTelemetry,
+		HandleTelemetryRequest, CommitMachineState
+	},
+	{
+		MessageProtocol_McuToCloud_CategoryId, MessageProtocol_McuToCloud_SetLed,
+		HandleSetLedRequest, NULL
+	},
+	{
+		MessageProtocol_McuToCloud_CategoryId, MessageProtocol_McuToCloud_RequestTelemetryBatch,
+		HandleTelemetryBatchRequest, HandleTelemetryBatchSent
 	}
+};
 
-	// Abort if unrecognized message type.
-	else {
-		Error_Handler();
+static const RequestHandlerEntry *FindRequestHandler(const MessageProtocol_RequestHeader *header)
+{
+	for (size_t i = 0; i < sizeof(requestHandlers) / sizeof(requestHandlers[0]); ++i) {
+		if (requestHandlers[i].categoryId == header->categoryId
+			&& requestHandlers[i].requestId == header->requestId) {
+			return &requestHandlers[i];
+		}
 	}
+
+	return NULL;
 }
 
+// The response is built in place in a TX buffer, and sent from it by the DMA, so that the
+// next request can be handled, or the core can stop, while it is being sent.
 static void HandleRequest(const MessageProtocol_RequestMessage *request)
 {
-    if (request->requestHeader.requestId == MessageProtocol_McuToCloud_Init) {
-    	HandleInitRequest(request);
-    } else if (request->requestHeader.requestId == MessageProtocol_McuToCloud_RequestTelemetry) {
-    	HandleTelemetryRequest(request);
-    } else if (request->requestHeader.requestId == MessageProtocol_McuToCloud_SetLed) {
-    	HandleSetLedRequest(request);
-    }
+	MessageProtocol_ResponseMessage *response = &AcquireTxBuffer()->response;
+
+	// A request which was corrupted on the way is not acted on. It is answered at once, so that
+	// the MT3620 sends it again rather than waiting for it to time out.
+	if ((request->requestHeader.flags & MessageProtocol_Flag_Crc) != 0
+		&& ! MessageProtocol_IsCrcValid((const uint8_t *) request)) {
+		SubmitResponse(request, response, MessageProtocol_ResponseResult_CrcError, 0);
+		return;
+	}
+
+	const RequestHandlerEntry *entry = FindRequestHandler(&request->requestHeader);
 
-    // Abort if unrecognized request type.
-    else {
-    	Error_Handler();
-    }
+	// A request which is not recognized, because it was corrupted without a CRC to show it or is
+	// from a newer protocol, is not answered, and times out on the MT3620.
+	if (entry == NULL) {
+		++unrecognizedFrameCount;
+		return;
+	}
+
+	size_t bodyLength = entry->handler(request, response->data);
+	SubmitResponse(request, response, 0, bodyLength);
+
+	if (entry->afterResponse != NULL) {
+		entry->afterResponse();
+	}
 }
 
-static void HandleInitRequest(const MessageProtocol_RequestMessage *request)
+static size_t HandleInitRequest(const MessageProtocol_RequestMessage *request, uint8_t *body)
 {
-	SendResponse(request, /* body */ NULL, /* bodyLength */ 0);
+	return 0;
 }
 
-static void HandleTelemetryRequest(const MessageProtocol_RequestMessage *request)
+// The MT3620 requests telemetry each time it wakes, so the state is written to flash at least
+// that often, once the response has been queued.
+static size_t HandleTelemetryRequest(const MessageProtocol_RequestMessage *request, uint8_t *body)
 {
 	MessageProtocol_McuToCloud_TelemetryStruct t = {
 		.lifetimeTotalDispenses = state.issuedDispenses,
@@ -125,66 +422,158 @@ static void HandleTelemetryRequest(const MessageProtocol_RequestMessage *request
 		.capacity = state.machineCapacity
 	};
 
-	SendResponse(request, &t, sizeof(t));
+	return McuToCloud_Telemetry_Encode(&t, body);
 }
 
-static void HandleSetLedRequest(const MessageProtocol_RequestMessage *request)
+// Responds with the counters followed by every event logged since the previous batch. Once the
+// response has been queued, HandleTelemetryBatchSent starts a new log.
+static size_t HandleTelemetryBatchRequest(
+	const MessageProtocol_RequestMessage *request, uint8_t *body)
 {
-	const MessageProtocol_McuToCloud_SetLedStruct *sls =
-		(const MessageProtocol_McuToCloud_SetLedStruct *) request->data;
+	const MessageProtocol_McuToCloud_TlvHeader header = {
+		.type = MessageProtocol_McuToCloud_TlvCounters,
+		.length = McuToCloud_TlvCounters_EncodedSize
+	};
+	const MessageProtocol_McuToCloud_TlvCountersStruct c = {
+		.counters = {
+			.lifetimeTotalDispenses = state.issuedDispenses,
+			.lifetimeTotalStockedDispenses = state.stockedDispenses,
+			.capacity = state.machineCapacity
+		},
+		.currentTick = HAL_GetTick(),
+		.droppedEvents = telemetryLogDropped,
+		.batchSequence = telemetryBatchSequence
+	};
+
+	size_t bodyLength = 0;
+	bodyLength += McuToCloud_TlvHeader_Encode(&header, &body[bodyLength]);
+	bodyLength += McuToCloud_TlvCounters_Encode(&c, &body[bodyLength]);
+	memcpy(&body[bodyLength], telemetryLog, telemetryLogLength);
+	bodyLength += telemetryLogLength;
+
+	return bodyLength;
+}
+
+// The log has been copied into the response, so it can be reset while the response is sent.
+static void HandleTelemetryBatchSent(void)
+{
+	telemetryLogLength = 0;
+	telemetryLogDropped = 0;
+	telemetryLogDispenses = 0;
+	telemetryReadySent = false;
+	// A request which is repeated because its response was lost is answered with the next
+	// number, so that each number identifies one set of events. 0 means that there is none.
+	if (++telemetryBatchSequence == 0) {
+		telemetryBatchSequence = 1;
+	}
+
+	CommitMachineState();
+}
+
+static size_t HandleSetLedRequest(const MessageProtocol_RequestMessage *request, uint8_t *body)
+{
+	// The body size counts a CRC trailer, if there is one, which the decoder ignores.
+	size_t dataSize = request->requestHeader.messageHeaderWithType.messageHeader.length
+		- (sizeof(MessageProtocol_RequestHeader) - sizeof(MessageProtocol_MessageHeader));
+	MessageProtocol_McuToCloud_SetLedStruct sls;
+
+	// A body which is too short is answered without one, which the MT3620 treats as a failure.
+	if (! McuToCloud_SetLed_Decode(&sls, request->data, dataSize)) {
+		return 0;
+	}
+
+	HAL_GPIO_WritePin(TRILED_R_GPIO_Port, TRILED_R_Pin, sls.red ? GPIO_PIN_SET : GPIO_PIN_RESET);
+	HAL_GPIO_WritePin(TRILED_G_GPIO_Port, TRILED_G_Pin, sls.green ? GPIO_PIN_SET : GPIO_PIN_RESET);
+	HAL_GPIO_WritePin(TRILED_B_GPIO_Port, TRILED_B_Pin, sls.blue ? GPIO_PIN_SET : GPIO_PIN_RESET);
 
-	HAL_GPIO_WritePin(TRILED_R_GPIO_Port, TRILED_R_Pin, sls->red ? GPIO_PIN_SET : GPIO_PIN_RESET);
-	HAL_GPIO_WritePin(TRILED_G_GPIO_Port, TRILED_G_Pin, sls->green ? GPIO_PIN_SET : GPIO_PIN_RESET);
-	HAL_GPIO_WritePin(TRILED_B_GPIO_Port, TRILED_B_Pin, sls->blue ? GPIO_PIN_SET : GPIO_PIN_RESET);
+	// The LED color identifies the current flavor, so keep a history of it.
+	const MessageProtocol_McuToCloud_TlvFlavorStruct f = { .tick = HAL_GetTick(), .color = sls };
+	uint8_t value[McuToCloud_TlvFlavor_EncodedSize];
+	LogTelemetryRecord(MessageProtocol_McuToCloud_TlvFlavor, value,
+		(uint8_t) McuToCloud_TlvFlavor_Encode(&f, value));
 
 	// Echo back LEDStruct as a response.
-	SendResponse(request, (void *)sls, sizeof(*sls));
+	return McuToCloud_SetLed_Encode(&sls, body);
 }
 
-static void SendMessageLen(uint8_t *msg, uint16_t len)
+// Returns the buffer in which to build the next message, first waiting for the DMA to finish
+// sending one if every buffer is in use.
+static TxBuffer *AcquireTxBuffer(void)
 {
-	txStatus = RESET;
+	while (txQueued == TX_BUFFER_COUNT) {
+		// empty; HAL_UART_TxCpltCallback frees a buffer.
+	}
 
-	if (HAL_UART_Transmit_IT(&huart2, msg, len) != HAL_OK) {
-		Error_Handler();
+	// The next free buffer follows the queued ones. The interrupt advances txHead and reduces
+	// txQueued together, so read both at once.
+	__disable_irq();
+	uint8_t index = (txHead + txQueued) % TX_BUFFER_COUNT;
+	__enable_irq();
+
+	return &txBuffers[index];
+}
+
+// Queues the buffer which AcquireTxBuffer returned, whose first length bytes hold a message,
+// and starts sending it unless the DMA is already sending another.
+static void SubmitTxBuffer(uint16_t length)
+{
+	__disable_irq();
+	txLengths[(txHead + txQueued) % TX_BUFFER_COUNT] = length;
+	if (++txQueued == 1) {
+		StartTxDma();
 	}
+	__enable_irq();
+}
 
-	while (txStatus != SET) {
-		// empty.
+// Starts the DMA sending the buffer at the head of the queue.
+static void StartTxDma(void)
+{
+	if (HAL_UART_Transmit_DMA(&huart2, (uint8_t *) &txBuffers[txHead], txLengths[txHead])
+		!= HAL_OK) {
+		Error_Handler();
 	}
 }
 
+// Called once the last byte of a message has left the UART. Frees its buffer and starts sending
+// the next, if one is queued.
 void HAL_UART_TxCpltCallback(UART_HandleTypeDef *handle)
 {
 	lastActivity = HAL_GetTick();
-	txStatus = SET;
+
+	txHead = (txHead + 1) % TX_BUFFER_COUNT;
+	if (--txQueued > 0) {
+		StartTxDma();
+	}
 }
 
-// Populates the response object based on the supplied request and copies
-// the supplied payload (if any) into the response.
-static void SendResponse(
-	const MessageProtocol_RequestMessage *request, void *body, size_t bodyLength)
+// Fills out the header of a response to the supplied request, whose body has already been
+// encoded into response->data, and queues it. A request which has a CRC trailer is answered with
+// a response which has one.
+static void SubmitResponse(const MessageProtocol_RequestMessage *request,
+	MessageProtocol_ResponseMessage *response, MessageProtocol_ResponseResult result,
+	size_t bodyLength)
 {
-	memset(&txResponse, 0, sizeof(txResponse));
+	memset(&response->responseHeader, 0, sizeof(response->responseHeader));
 
-    memcpy(&txResponse.responseHeader.messageHeaderWithType.messageHeader.preamble,
-        MessageProtocol_MessagePreamble, sizeof(MessageProtocol_MessagePreamble));
-	txResponse.responseHeader.messageHeaderWithType.messageHeader.length =
+	memcpy(&response->responseHeader.messageHeaderWithType.messageHeader.preamble,
+		MessageProtocol_MessagePreamble, sizeof(MessageProtocol_MessagePreamble));
+	response->responseHeader.messageHeaderWithType.messageHeader.length =
 		(uint16_t) (
 			sizeof(MessageProtocol_ResponseHeader) - sizeof(MessageProtocol_MessageHeader) + bodyLength);
-	txResponse.responseHeader.messageHeaderWithType.type = MessageProtocol_ResponseMessageType;
-	txResponse.responseHeader.messageHeaderWithType.reserved = 0;
-
-	txResponse.responseHeader.categoryId = request->requestHeader.categoryId;
-	txResponse.responseHeader.requestId = request->requestHeader.requestId;
-	txResponse.responseHeader.sequenceNumber = request->requestHeader.sequenceNumber;
-	txResponse.responseHeader.responseResult = 0;
-	txResponse.responseHeader.reserved = 0;
-
-	if (body != NULL) {
-		memcpy(&txResponse.data, body, bodyLength);
+	response->responseHeader.messageHeaderWithType.type = MessageProtocol_ResponseMessageType;
+	response->responseHeader.messageHeaderWithType.address = MCU_BUS_ADDRESS;
+
+	response->responseHeader.categoryId = request->requestHeader.categoryId;
+	response->responseHeader.requestId = request->requestHeader.requestId;
+	response->responseHeader.sequenceNumber = request->requestHeader.sequenceNumber;
+	response->responseHeader.responseResult = result;
+	response->responseHeader.flags = request->requestHeader.flags & MessageProtocol_Flag_Crc;
+
+	// Only the message itself is sent; the MT3620 would have to discard the rest of the buffer.
+	size_t messageLength = sizeof(MessageProtocol_ResponseHeader) + bodyLength;
+	if ((response->responseHeader.flags & MessageProtocol_Flag_Crc) != 0) {
+		messageLength = MessageProtocol_AppendCrc((uint8_t *) response);
 	}
 
-	SendMessageLen((uint8_t *)&txResponse, sizeof(txResponse));
+	SubmitTxBuffer((uint16_t) messageLength);
 }
-
@@ -3,42 +3,73 @@
 
 #include "main.h"
 
-// Persistent storage takes up two 128-byte pages of flash at 0x0800_4000, which is
-// 16KB after the start of flash. If the application code extends into this page, the
-// data page must be moved.
+// Persistent storage takes up eight 128-byte pages of flash at 0x0800_4000, which is
+// 16KB after the start of flash. If the application code extends into these pages, the
+// data area must be moved.
 //
-// The first page contains the magic words <"MSAS", "SODA">, followed by a sequence of
-// <stocked, issued> pairs.
+// The pages form a rotating log. Each page which is in use starts with a header of the
+// magic word "MSLG" and a sequence number, which is one more than that of the page
+// before it, followed by a sequence of <stocked, issued> entries. Each entry stores the
+// complement of its values, so that an entry is never all zeros, which is how erased
+// flash reads on this MCU. Entries are appended to the page with the highest sequence
+// number; when it is full, the log moves on to the next page, wrapping around, so the
+// older pages keep the history until they are reused, and writes and erases are spread
+// over all the pages.
 //
-// When the application starts, it reads the first two words of the first page.  If they
-// are not contain the magic values, it erases both pages, which sets all bytes to 0x00.
-// The application then writes the magic words to the start of the first page.
+// When the application starts, it reads the header of each page to find the newest
+// page, and then finds the last entry in that page with a binary search, because the
+// written entries always precede the erased ones. If no page has a valid header, it
+// erases the first page and writes the current state to it.
 //
-// When the application stores a new <stocked, issued> pair, it overwrites the first pair
-// of <0x00000000, 0x00000000> words that it finds. If all pages are full, it erases them,
-// re-writes the magic header, followed by the state, to the start of the first page.
+// A page is erased before the log reaches it, but not while an entry is being written.
+// ErasePendingFlashPage, which the main loop calls before it sleeps, erases the page
+// which follows the newest page, so that only one page is erased at a time, and never
+// the page which holds the latest state.
 //
-// This is intentionally simple.  In a full application, the number of erase cycles could
-// be reduced by only writing the machine state when it powers down.
+// Changes to the state are held in RAM, and written to flash in batches: after
+// PERSIST_COMMIT_BATCH changes, when the MT3620 requests telemetry, on restock, or when
+// the programmable voltage detector reports that the supply is falling below
+// PERSIST_PVD_LEVEL, so that the latest state is written before power is lost.
 
-static void EraseAllPages(void);
+static void FormatFirstPage(void);
 static void ReadStateFromExistingPage(void);
+static void StartPage(uint32_t page, uint32_t sequence);
+static void ErasePage(uint32_t page);
+static bool PageIsErased(uint32_t page);
+static void WriteLatestMachineState(void);
+static void EnablePowerFailDetection(void);
 
 #define DATA_AREA_ADDR		(FLASH_BASE + (128 * FLASH_PAGE_SIZE))
-#define DATA_AREA_LENGTH	(2 * FLASH_PAGE_SIZE)
-#define DATA_AREA_END		(DATA_AREA_ADDR + DATA_AREA_LENGTH)
+#define DATA_AREA_PAGES		8
+#define PAGE_ADDR(page)		(DATA_AREA_ADDR + (page) * FLASH_PAGE_SIZE)
 
 static const uint32_t DATA_AREA_SECTORS = OB_WRP_Pages128to159;
 
-static const uint32_t MAGIC_WORD_0 = ('M' << 24) | ('S' << 16) | ('A' << 8) | 'S';
-static const uint32_t MAGIC_WORD_1 = ('S' << 24) | ('O' << 16) | ('D' << 8) | 'A';
-static const uint32_t MAGIC_HEADER_SIZE = 2 * sizeof(uint32_t);
+static const uint32_t PAGE_MAGIC = ('M' << 24) | ('S' << 16) | ('L' << 8) | 'G';
+// { uint32_t magic; uint32_t sequence; }
+#define PAGE_HEADER_SIZE	(2 * sizeof(uint32_t))
 
 // { uint32_t stocked; uint32_t issued; }
-static const uint32_t DATA_ENTRY_SIZE = 2 * sizeof(uint32_t);
+#define DATA_ENTRY_SIZE		(2 * sizeof(uint32_t))
+#define ENTRIES_PER_PAGE	((FLASH_PAGE_SIZE - PAGE_HEADER_SIZE) / DATA_ENTRY_SIZE)
+#define ENTRY_ADDR(page, entry)	(PAGE_ADDR(page) + PAGE_HEADER_SIZE + (entry) * DATA_ENTRY_SIZE)
 
-// Address in flash where last valid entry was written.
-static uint32_t lastEntryAddr;
+// Page which holds the latest entry, and its sequence number.
+static uint32_t currentPage;
+static uint32_t currentSequence;
+// Number of entries which have been written to the current page.
+static uint32_t entriesInPage;
+// Whether the page after the current page may need to be erased.
+static bool erasePending;
+// Number of changes to the state which have not been written to flash.
+static uint32_t uncommittedChanges;
+// Set by the PVD interrupt while the supply voltage is below PERSIST_PVD_LEVEL.
+static __IO bool powerFailing = false;
+
+static uint32_t ReadWord(uint32_t addr)
+{
+	return *(__IO uint32_t*) addr;
+}
 
 void RestoreStateFromFlash(void)
 {
@@ -54,75 +85,210 @@ void RestoreStateFromFlash(void)
 		Error_Handler();
 	}
 
-	uint32_t magic0 = *(__IO uint32_t*) DATA_AREA_ADDR;
-	uint32_t magic1 = *(__IO uint32_t*) (DATA_AREA_ADDR + sizeof(uint32_t));
+	// Find the page with the highest sequence number. A sequence number of zero is
+	// never written, so erased pages are never chosen.
+	bool hasBeenFormatted = false;
+	for (uint32_t page = 0; page < DATA_AREA_PAGES; ++page) {
+		uint32_t sequence = ReadWord(PAGE_ADDR(page) + sizeof(uint32_t));
+		if (ReadWord(PAGE_ADDR(page)) == PAGE_MAGIC && sequence != 0
+				&& (! hasBeenFormatted || sequence > currentSequence)) {
+			hasBeenFormatted = true;
+			currentPage = page;
+			currentSequence = sequence;
+		}
+	}
 
-	// If this is the first time that the device has been used, erase the data page.
-	bool hasBeenFormatted = (magic0 == MAGIC_WORD_0 && magic1 == MAGIC_WORD_1);
+	// If this is the first time that the device has been used, set up the first page.
 	if (! hasBeenFormatted) {
-		EraseAllPages();
+		FormatFirstPage();
 	} else {
 		ReadStateFromExistingPage();
 	}
+
+	EnablePowerFailDetection();
+}
+
+// Interrupt when the supply voltage crosses PERSIST_PVD_LEVEL in either direction.
+static void EnablePowerFailDetection(void)
+{
+	PWR_PVDTypeDef pvd = { };
+	pvd.PVDLevel = PERSIST_PVD_LEVEL;
+	pvd.Mode = PWR_PVD_MODE_IT_RISING_FALLING;
+	HAL_PWR_ConfigPVD(&pvd);
+	HAL_PWR_EnablePVD();
+
+	HAL_NVIC_SetPriority(PVD_IRQn, 0, 0);
+	HAL_NVIC_EnableIRQ(PVD_IRQn);
+}
+
+// Called from the PVD interrupt. The flash is not written here, because the main loop
+// may be writing to it; the interrupt wakes the main loop, which calls HandlePowerFail.
+void HAL_PWR_PVDCallback(void)
+{
+	powerFailing = __HAL_PWR_GET_FLAG(PWR_FLAG_PVDO) != 0;
+}
+
+// Write the state at once if the supply is failing.
+void HandlePowerFail(void)
+{
+	if (powerFailing) {
+		CommitMachineState();
+	}
 }
 
-// Erase all pages which are used to store the machine state and write
-// the magic header followed by the current machine state to the start
-// of the first page.
-static void EraseAllPages(void)
+// Erase the first page which is used to store the machine state, and write a page
+// header followed by the current machine state to it. The other pages are erased
+// later, by ErasePendingFlashPage, before the log reaches them.
+static void FormatFirstPage(void)
+{
+	StartPage(0, 1);
+	WriteLatestMachineState();
+}
+
+// Find the number of entries which have been written to a page. An erased entry reads
+// as zero.
+static uint32_t CountEntries(uint32_t page)
+{
+	uint32_t low = 0;
+	uint32_t high = ENTRIES_PER_PAGE;
+	while (low < high) {
+		uint32_t mid = low + (high - low) / 2;
+		if (ReadWord(ENTRY_ADDR(page, mid)) != 0x0) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+	return low;
+}
+
+// Populate the global state variable with the last complete entry of a page which has
+// the given number of entries. If power was lost while the last entry was being written,
+// its second word may not have been written, so the entry before it is used.
+static bool ReadLastEntry(uint32_t page, uint32_t entries)
+{
+	while (entries > 0 && ReadWord(ENTRY_ADDR(page, entries - 1) + sizeof(uint32_t)) == 0x0) {
+		--entries;
+	}
+	if (entries == 0) {
+		return false;
+	}
+
+	uint32_t lastEntryAddr = ENTRY_ADDR(page, entries - 1);
+	uint32_t stockCmpl = ReadWord(lastEntryAddr);
+	state.stockedDispenses = ~stockCmpl;
+	uint32_t dispCmpl = ReadWord(lastEntryAddr + sizeof(uint32_t));
+	state.issuedDispenses = ~dispCmpl;
+	return true;
+}
+
+// Populate the global state variable with the most recently-written data.
+static void ReadStateFromExistingPage(void)
+{
+	entriesInPage = CountEntries(currentPage);
+	erasePending = true;
+
+	if (ReadLastEntry(currentPage, entriesInPage)) {
+		return;
+	}
+
+	// Power was lost after the current page was started, but before an entry was
+	// completed in it, so the latest state is at the end of the page before it.
+	uint32_t previousPage = (currentPage + DATA_AREA_PAGES - 1) % DATA_AREA_PAGES;
+	if (ReadWord(PAGE_ADDR(previousPage)) == PAGE_MAGIC
+			&& ReadWord(PAGE_ADDR(previousPage) + sizeof(uint32_t)) == currentSequence - 1) {
+		ReadLastEntry(previousPage, CountEntries(previousPage));
+	}
+}
+
+// Make the given page the current page, erasing it first unless it already is.
+static void StartPage(uint32_t page, uint32_t sequence)
+{
+	if (! PageIsErased(page)) {
+		ErasePage(page);
+	}
+
+	HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, PAGE_ADDR(page), PAGE_MAGIC);
+	HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, PAGE_ADDR(page) + sizeof(uint32_t), sequence);
+
+	currentPage = page;
+	currentSequence = sequence;
+	entriesInPage = 0;
+	erasePending = true;
+}
+
+static void ErasePage(uint32_t page)
 {
 	FLASH_EraseInitTypeDef ei = { };
 	ei.TypeErase = FLASH_TYPEERASE_PAGES;
-	ei.PageAddress = DATA_AREA_ADDR;
-	ei.NbPages = DATA_AREA_LENGTH / FLASH_PAGE_SIZE;
+	ei.PageAddress = PAGE_ADDR(page);
+	ei.NbPages = 1;
 
 	uint32_t pageError;
 
 	if (HAL_FLASHEx_Erase(&ei, &pageError) != HAL_OK) {
 		Error_Handler();
 	}
-
-	HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, DATA_AREA_ADDR + 0 * sizeof(uint32_t), MAGIC_WORD_0);
-	HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, DATA_AREA_ADDR + 1 * sizeof(uint32_t), MAGIC_WORD_1);
-
-	lastEntryAddr = DATA_AREA_ADDR + MAGIC_HEADER_SIZE;
-	HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, lastEntryAddr, ~state.stockedDispenses);
-	HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, lastEntryAddr + sizeof(uint32_t), ~state.issuedDispenses);
 }
 
-// Populate the global state variable with the most recently-written data.
-// This assumes the data pages have already been initialized with EraseAllPages.
-static void ReadStateFromExistingPage(void)
+static bool PageIsErased(uint32_t page)
 {
-	// Find the most recently-written data entry.
-	uint32_t searchAddr = DATA_AREA_ADDR + MAGIC_HEADER_SIZE;
-	while (searchAddr < DATA_AREA_END) {
-		uint32_t searchStockCmpl = *(__IO uint32_t*) searchAddr;
-		if (searchStockCmpl == 0x0) {
-			break;
+	for (uint32_t addr = PAGE_ADDR(page); addr < PAGE_ADDR(page + 1); addr += sizeof(uint32_t)) {
+		if (ReadWord(addr) != 0x0) {
+			return false;
 		}
-		searchAddr += DATA_ENTRY_SIZE;
 	}
+	return true;
+}
 
-	lastEntryAddr = searchAddr - DATA_ENTRY_SIZE;
-	uint32_t stockCmpl = *(__IO uint32_t*) lastEntryAddr;
-	state.stockedDispenses = ~stockCmpl;
-	uint32_t dispCmpl = *(__IO uint32_t*) (lastEntryAddr + sizeof(uint32_t));
-	state.issuedDispenses = ~dispCmpl;
+// Erase the page which the log will move on to when the current page is full, if it has
+// not already been erased. Called from the main loop when there is nothing else to do.
+void ErasePendingFlashPage(void)
+{
+	// Erasing takes longer and draws more current than programming, so don't start
+	// while the supply is failing.
+	if (! erasePending || powerFailing) {
+		return;
+	}
+
+	uint32_t nextPage = (currentPage + 1) % DATA_AREA_PAGES;
+	if (! PageIsErased(nextPage)) {
+		ErasePage(nextPage);
+	}
+	erasePending = false;
 }
 
-// Append the current machine state to the flash memory. If the flash memory has been
-// exhausted, erase it and write the state to the start of the first page.
-void WriteLatestMachineState(void)
+// Record that the machine state has changed, and write it to flash if enough changes
+// have accumulated, or if the supply is failing.
+void MarkMachineStateChanged(void)
 {
-	lastEntryAddr += DATA_ENTRY_SIZE;
+	++uncommittedChanges;
+	if (uncommittedChanges >= PERSIST_COMMIT_BATCH || powerFailing) {
+		CommitMachineState();
+	}
+}
 
-	if (lastEntryAddr >= DATA_AREA_END) {
-		EraseAllPages();
-	} else {
-		HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, lastEntryAddr, ~state.stockedDispenses);
-		HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, lastEntryAddr + sizeof(uint32_t), ~state.issuedDispenses);
+// Write the machine state to flash if it has changed since it was last written.
+void CommitMachineState(void)
+{
+	if (uncommittedChanges == 0) {
+		return;
 	}
+
+	WriteLatestMachineState();
+	uncommittedChanges = 0;
 }
 
+// Append the current machine state to the flash memory. If the current page is full,
+// move on to the next page, which has normally been erased already.
+static void WriteLatestMachineState(void)
+{
+	if (entriesInPage == ENTRIES_PER_PAGE) {
+		StartPage((currentPage + 1) % DATA_AREA_PAGES, currentSequence + 1);
+	}
 
+	uint32_t entryAddr = ENTRY_ADDR(currentPage, entriesInPage);
+	HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, entryAddr, ~state.stockedDispenses);
+	HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, entryAddr + sizeof(uint32_t), ~state.issuedDispenses);
+	++entriesInPage;
+}
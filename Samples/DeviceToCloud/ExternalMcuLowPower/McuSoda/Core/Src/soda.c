@@ -17,27 +17,68 @@ MachineState state = {
 	.issuedDispenses = 0
 };
 
+// Whether an interrupt has left work for the main loop, or the main loop is timing
+// something with the system tick.
+static bool IsWorkPending(void)
+{
+	// The system tick is stopped in STOP mode, so don't stop if still in a debounce
+	// period, because when the device wakes because of an interrupt, the handler will
+	// think it is still in the debounce period.
+	if (lastActivity == NO_PREV_ISR || HAL_GetTick() < lastActivity + (2 * DEBOUNCE_PERIOD_MS)) {
+		return true;
+	}
+
+	return IsButtonEventPending() || IsMessagePending();
+}
+
+// Enter STOP mode until the next interrupt, which may be a button or wakeup EXTI, a byte
+// from the MT3620, or the PVD. Returns immediately if work became pending since the
+// caller last checked.
+static void EnterStopMode(void)
+{
+	HAL_SuspendTick();
+
+	// An interrupt which arrives after the check still ends WFI, because it is pending
+	// while interrupts are disabled. It runs, on HSI16, as soon as they are re-enabled.
+	__disable_irq();
+	if (! IsWorkPending()) {
+		HAL_PWR_EnterSTOPMode(PWR_LOWPOWERREGULATOR_ON, PWR_STOPENTRY_WFI);
+	}
+	__enable_irq();
+
+	// The PLL is stopped in STOP mode. USART2 runs from HSI16, so reception is not
+	// affected when the system clock is switched back to the PLL.
+	SystemClock_Config();
+	HAL_ResumeTick();
+}
+
 // Infinite loop waits for and then handled external events, viz. button press,
 // wakeup, and UART RX.
 _Noreturn void RunSodaMachine(void)
 {
 	RestoreStateFromFlash();
 
+	// Restart on HSI16 after STOP mode, which is also the USART2 clock.
+	__HAL_RCC_WAKEUPSTOP_CLK_CONFIG(RCC_STOP_WAKEUPCLOCK_HSI);
+
 	ReadMessageAsync();
 	for (;;) {
-		HAL_SuspendTick();
-		HAL_PWR_EnterSLEEPMode(PWR_MAINREGULATOR_ON, PWR_SLEEPENTRY_WFI);
-		HAL_ResumeTick();
+		// The PVD interrupt wakes the core, so write the state before stopping again if
+		// the supply is failing.
+		HandlePowerFail();
+
+		// Prepare the next flash page while there is nothing else to do, rather than
+		// when an entry is being written.
+		ErasePendingFlashPage();
 
-		// The system tick is stopped during WFI, so don't sleep if still in
-		// a debounce period because when the device wakes because of an interrupt,
-		// the handler will think it is still in the debounce period.
+		EnterStopMode();
 
-		while (lastActivity == NO_PREV_ISR || HAL_GetTick() < lastActivity + (2 * DEBOUNCE_PERIOD_MS)) {
+		while (IsWorkPending()) {
 			HandleWakeupFromMT3620();
 			StopWakingUpMT3620();
 			HandleButtonPress();
 			HandleMessage();
+			HandlePowerFail();
 		}
 	}
 }
@@ -20,6 +20,21 @@ static const MessageProtocol_RequestId MessageProtocol_McuToCloud_RequestTelemet
 /// <summary>SetLed request ID</summary>
 static const MessageProtocol_RequestId MessageProtocol_McuToCloud_SetLed = 0x0003;
 
+/// <summary>RequestTelemetryBatch request ID</summary>
+static const MessageProtocol_RequestId MessageProtocol_McuToCloud_RequestTelemetryBatch = 0x0004;
+
+/// <summary>
+///     TelemetryReady event ID. The MCU sends this event, unsolicited, when it has logged enough
+///     events since the last RequestTelemetryBatch that they are worth sending to the cloud, and
+///     also wakes the MT3620 in case it is powered down. The MT3620 answers with a
+///     RequestTelemetryBatch.
+/// </summary>
+static const MessageProtocol_EventId MessageProtocol_McuToCloud_TelemetryReady = 0x0001;
+
+// The structs below describe the fields of each message body. Bodies are not sent as the structs,
+// whose layout depends on the compiler, but are encoded and decoded with the codecs in
+// messages_codec.h.
+
 /// <summary>
 ///     Struct for the body of a RequestTelemetry response
 /// </summary>
@@ -65,6 +80,89 @@ typedef struct {
     uint8_t reserved;
 } MessageProtocol_McuToCloud_SetLedStruct;
 
+/// <summary>
+///     The body of a RequestTelemetryBatch response is a sequence of records, each made up of a
+///     <see cref="MessageProtocol_McuToCloud_TlvHeader" /> followed by <c>length</c> bytes of
+///     value. Records are packed without padding, so values may be unaligned. The first record is
+///     always a counters record; unknown record types should be skipped, as should any bytes of a
+///     value after the fields which the receiver knows.
+/// </summary>
+typedef struct {
+    /// <summary>Record type; see MessageProtocol_McuToCloud_Tlv*.</summary>
+    uint8_t type;
+
+    /// <summary>Length of the value which follows this header, in bytes.</summary>
+    uint8_t length;
+} MessageProtocol_McuToCloud_TlvHeader;
+
+/// <summary>Record type for <see cref="MessageProtocol_McuToCloud_TlvCountersStruct" />.</summary>
+static const uint8_t MessageProtocol_McuToCloud_TlvCounters = 0x01;
+
+/// <summary>Record type for <see cref="MessageProtocol_McuToCloud_TlvDispenseStruct" />.</summary>
+static const uint8_t MessageProtocol_McuToCloud_TlvDispense = 0x02;
+
+/// <summary>Record type for <see cref="MessageProtocol_McuToCloud_TlvButtonPressStruct" />.</summary>
+static const uint8_t MessageProtocol_McuToCloud_TlvButtonPress = 0x03;
+
+/// <summary>Record type for <see cref="MessageProtocol_McuToCloud_TlvFlavorStruct" />.</summary>
+static const uint8_t MessageProtocol_McuToCloud_TlvFlavor = 0x04;
+
+/// <summary>Button ID for the dispense button.</summary>
+static const uint8_t MessageProtocol_McuToCloud_DispenseButton = 0x00;
+
+/// <summary>Button ID for the restock button.</summary>
+static const uint8_t MessageProtocol_McuToCloud_RestockButton = 0x01;
+
+/// <summary>
+///     Value of a counters record. Event records carry the MCU tick at which they occurred; the
+///     MCU tick does not advance while the MCU sleeps, so event times derived from it are
+///     approximate.
+/// </summary>
+typedef struct {
+    /// <summary>Current values of the counters returned by RequestTelemetry.</summary>
+    MessageProtocol_McuToCloud_TelemetryStruct counters;
+
+    /// <summary>MCU tick, in milliseconds, when the response was sent.</summary>
+    uint32_t currentTick;
+
+    /// <summary>Number of events since the last batch which did not fit in this one.</summary>
+    uint32_t droppedEvents;
+
+    /// <summary>
+    /// Sequence number of the batch, which identifies it as it passes from the MCU to the cloud.
+    /// It starts at 1 when the MCU starts, and increases by one for each batch which is sent;
+    /// earlier firmware does not send it, which decodes as 0.
+    /// </summary>
+    uint32_t batchSequence;
+} MessageProtocol_McuToCloud_TlvCountersStruct;
+
+/// <summary>Value of a dispense record, which is logged for each unit dispensed.</summary>
+typedef struct {
+    /// <summary>MCU tick, in milliseconds, when the unit was dispensed.</summary>
+    uint32_t tick;
+} MessageProtocol_McuToCloud_TlvDispenseStruct;
+
+/// <summary>
+///     Value of a button press record, which is logged for each debounced button press, whether
+///     or not it resulted in a dispense or restock.
+/// </summary>
+typedef struct {
+    /// <summary>MCU tick, in milliseconds, when the button was pressed.</summary>
+    uint32_t tick;
+
+    /// <summary>Which button was pressed; see MessageProtocol_McuToCloud_*Button.</summary>
+    uint8_t button;
+} MessageProtocol_McuToCloud_TlvButtonPressStruct;
+
+/// <summary>Value of a flavor record, which is logged each time the flavor LED is set.</summary>
+typedef struct {
+    /// <summary>MCU tick, in milliseconds, when the LED was set.</summary>
+    uint32_t tick;
+
+    /// <summary>The LED color which was set; this identifies the flavor.</summary>
+    MessageProtocol_McuToCloud_SetLedStruct color;
+} MessageProtocol_McuToCloud_TlvFlavorStruct;
+
 // Checks to make sure the structs fit within the max body size as defined in the message protocol
 #define MAX_OF(a, b) (((a) > (b)) ? (a) : (b))
 
@@ -83,3 +181,8 @@ static_assert(sizeof(MessageProtocol_McuToCloud_TelemetryStruct) <= MAX_BODY_SIZ
 
 static_assert(sizeof(MessageProtocol_McuToCloud_SetLedStruct) <= MAX_BODY_SIZE,
               "MessageProtocol_McuToCloud_TelemetryStruct exceeds SetLedStruct");
+
+static_assert(sizeof(MessageProtocol_McuToCloud_TlvHeader) +
+                      sizeof(MessageProtocol_McuToCloud_TlvCountersStruct) <=
+                  MAX_RESPONSE_DATA_SIZE,
+              "Counters record exceeds MAX_RESPONSE_DATA_SIZE");
@@ -0,0 +1,66 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include "message_codec.h"
+#include "messages.h"
+
+// Codecs for the bodies of the messages in messages.h, which are shared by the high-level app
+// and the MCU firmware. A body should always be encoded and decoded with these, rather than by
+// copying the struct, so that it carries no padding. New fields must be added at the end of a
+// schema, with a higher version; see message_codec.h.
+
+#define MCU_TO_CLOUD_TELEMETRY_FIELDS(X, T)         \
+    X(T, U32, lifetimeTotalDispenses, , 1)          \
+    X(T, U32, lifetimeTotalStockedDispenses, , 1)   \
+    X(T, U32, capacity, , 1)
+
+MESSAGE_CODEC_DEFINE(McuToCloud_Telemetry, MessageProtocol_McuToCloud_TelemetryStruct,
+                     MCU_TO_CLOUD_TELEMETRY_FIELDS)
+
+#define MCU_TO_CLOUD_SET_LED_FIELDS(X, T) \
+    X(T, U8, red, , 1)                    \
+    X(T, U8, green, , 1)                  \
+    X(T, U8, blue, , 1)                   \
+    X(T, RESERVED, reserved, , 1)
+
+MESSAGE_CODEC_DEFINE(McuToCloud_SetLed, MessageProtocol_McuToCloud_SetLedStruct,
+                     MCU_TO_CLOUD_SET_LED_FIELDS)
+
+#define MCU_TO_CLOUD_TLV_HEADER_FIELDS(X, T) \
+    X(T, U8, type, , 1)                      \
+    X(T, U8, length, , 1)
+
+MESSAGE_CODEC_DEFINE(McuToCloud_TlvHeader, MessageProtocol_McuToCloud_TlvHeader,
+                     MCU_TO_CLOUD_TLV_HEADER_FIELDS)
+
+#define MCU_TO_CLOUD_TLV_COUNTERS_FIELDS(X, T)          \
+    X(T, NESTED, counters, McuToCloud_Telemetry, 1)     \
+    X(T, U32, currentTick, , 1)                         \
+    X(T, U32, droppedEvents, , 1)                       \
+    X(T, U32, batchSequence, , 2)
+
+MESSAGE_CODEC_DEFINE(McuToCloud_TlvCounters, MessageProtocol_McuToCloud_TlvCountersStruct,
+                     MCU_TO_CLOUD_TLV_COUNTERS_FIELDS)
+
+#define MCU_TO_CLOUD_TLV_DISPENSE_FIELDS(X, T) X(T, U32, tick, , 1)
+
+MESSAGE_CODEC_DEFINE(McuToCloud_TlvDispense, MessageProtocol_McuToCloud_TlvDispenseStruct,
+                     MCU_TO_CLOUD_TLV_DISPENSE_FIELDS)
+
+// Earlier firmware sent this record as the struct, with three bytes of padding after the button;
+// Decode ignores them.
+#define MCU_TO_CLOUD_TLV_BUTTON_PRESS_FIELDS(X, T) \
+    X(T, U32, tick, , 1)                           \
+    X(T, U8, button, , 1)
+
+MESSAGE_CODEC_DEFINE(McuToCloud_TlvButtonPress, MessageProtocol_McuToCloud_TlvButtonPressStruct,
+                     MCU_TO_CLOUD_TLV_BUTTON_PRESS_FIELDS)
+
+#define MCU_TO_CLOUD_TLV_FLAVOR_FIELDS(X, T)    \
+    X(T, U32, tick, , 1)                        \
+    X(T, NESTED, color, McuToCloud_SetLed, 1)
+
+MESSAGE_CODEC_DEFINE(McuToCloud_TlvFlavor, MessageProtocol_McuToCloud_TlvFlavorStruct,
+                     MCU_TO_CLOUD_TLV_FLAVOR_FIELDS)
@@ -0,0 +1,122 @@
+#  Copyright (c) Microsoft Corporation. All rights reserved.
+#  Licensed under the MIT License.
+
+"""Compresses an nRF52 firmware image into a block-compressed image.
+
+The app decompresses the image as it sends it to the nRF52, so the image package holds the
+compressed image instead of the .bin file. The format is described in lz4_block.h. Each block is
+compressed in the LZ4 block format, which this script implements directly, so that it needs
+nothing except Python 3.
+
+Usage: python3 compress_firmware.py blinkyV1.bin blinkyV1.lz4b
+"""
+
+import argparse
+import struct
+import sys
+
+MAGIC = b"LZ4B"
+MIN_MATCH_LENGTH = 4
+MAX_OFFSET = 65535
+# The LZ4 block format requires the last match to start at least 12 bytes before the end of the
+# block, and the last 5 bytes to be literals.
+MATCH_START_LIMIT = 12
+LAST_LITERALS = 5
+
+
+def _append_length(out, length):
+    """Appends the bytes which extend a length field of 15."""
+    length -= 15
+    while length >= 255:
+        out.append(255)
+        length -= 255
+    out.append(length)
+
+
+def _append_sequence(out, literals, offset=None, match_length=0):
+    literal_field = min(len(literals), 15)
+    match_field = min(match_length - MIN_MATCH_LENGTH, 15) if offset is not None else 0
+    out.append((literal_field << 4) | match_field)
+    if literal_field == 15:
+        _append_length(out, len(literals))
+    out += literals
+    if offset is not None:
+        out += struct.pack("<H", offset)
+        if match_field == 15:
+            _append_length(out, match_length - MIN_MATCH_LENGTH)
+
+
+def compress_block(data):
+    """Compresses one block in the LZ4 block format, with a greedy search for matches."""
+    out = bytearray()
+    positions = {}
+    anchor = 0
+    i = 0
+    limit = len(data) - MATCH_START_LIMIT
+    while i < limit:
+        key = data[i:i + MIN_MATCH_LENGTH]
+        candidate = positions.get(key)
+        positions[key] = i
+        if candidate is None or i - candidate > MAX_OFFSET:
+            i += 1
+            continue
+
+        length = MIN_MATCH_LENGTH
+        max_length = len(data) - LAST_LITERALS - i
+        while length < max_length and data[candidate + length] == data[i + length]:
+            length += 1
+
+        _append_sequence(out, data[anchor:i], i - candidate, length)
+        for j in range(i + 1, min(i + length, limit)):
+            positions[data[j:j + MIN_MATCH_LENGTH]] = j
+        i += length
+        anchor = i
+
+    _append_sequence(out, data[anchor:])
+    return bytes(out)
+
+
+def compress_image(data, block_size):
+    blocks = []
+    for start in range(0, len(data), block_size):
+        block = data[start:start + block_size]
+        compressed = compress_block(block)
+        # A block which does not shrink is stored as it is.
+        blocks.append(compressed if len(compressed) < len(block) else block)
+
+    header = MAGIC + struct.pack("<II", len(data), block_size)
+    offset = len(header) + 4 * (len(blocks) + 1)
+    offsets = []
+    for block in blocks:
+        offsets.append(offset)
+        offset += len(block)
+    offsets.append(offset)
+
+    return header + struct.pack("<%dI" % len(offsets), *offsets) + b"".join(blocks)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("input", help="firmware image (.bin) to compress")
+    parser.add_argument("output", help="block-compressed image to write")
+    parser.add_argument("--block-size", type=int, default=4096,
+                        help="decompressed size of each block; the bootloader's object size "
+                        "must be a multiple of it (default: %(default)s)")
+    args = parser.parse_args()
+
+    if args.block_size <= 0:
+        parser.error("the block size must be positive")
+
+    with open(args.input, "rb") as f:
+        data = f.read()
+    image = compress_image(data, args.block_size)
+    with open(args.output, "wb") as f:
+        f.write(image)
+
+    print("%s: %d bytes compressed to %d bytes (%.0f%%)" %
+          (args.output, len(data), len(image), 100.0 * len(image) / max(len(data), 1)))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
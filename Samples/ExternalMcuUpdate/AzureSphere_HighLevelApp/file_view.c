@@ -5,44 +5,115 @@
 #include <stdio.h>
 #include <errno.h>
 #include <stdlib.h>
-#include <unistd.h>
+#include <string.h>
 #include <sys/types.h>
 
 #include <applibs/log.h>
-#include <applibs/storage.h>
 
 #include "file_view.h"
+#include "lz4_block.h"
+#include "mem_pool.h"
+
+static MemPool_Subsystem fileViewMemory = MEM_POOL_SUBSYSTEM("FileView");
 
 // Call FileViewMoveWindow before attempting to read data from the window.
 // This special value means that the file view does not contain valid data.
 static const off_t NO_VALID_WINDOW = -1;
 
+static uint32_t GetLe32(const uint8_t *data)
+{
+    return (uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) |
+           ((uint32_t)data[3] << 24);
+}
+
+// Whether the window points into the file's mapping, rather than into a buffer.
+static bool IsInPlace(const FileView *self)
+{
+    return ImageAsset_IsMapped(&self->asset) && !self->compressed;
+}
+
+// Reads the header of a block-compressed image, if the file is one.
+static bool ReadCompressedHeader(FileView *self)
+{
+    uint8_t header[LZ4_BLOCK_IMAGE_HEADER_SIZE];
+    if (self->asset.size < LZ4_BLOCK_IMAGE_HEADER_SIZE) {
+        self->compressed = false;
+        return true;
+    }
+
+    const uint8_t *data = ImageAsset_View(&self->asset, 0, sizeof(header), header);
+    if (data == NULL) {
+        return false;
+    }
+
+    self->compressed = Lz4Block_IsImage(data, sizeof(header));
+    if (!self->compressed) {
+        return true;
+    }
+
+    self->fileSize = GetLe32(&data[4]);
+    self->blockSize = GetLe32(&data[8]);
+
+    // The offsets of the blocks follow the header, and the blocks follow them. Windows are
+    // decompressed whole blocks at a time, so they must hold a whole number of blocks.
+    off_t blockCount =
+        self->blockSize == 0 ? 0 : (self->fileSize + self->blockSize - 1) / self->blockSize;
+    if (self->blockSize == 0 || self->windowSize % self->blockSize != 0 ||
+        LZ4_BLOCK_IMAGE_HEADER_SIZE + (blockCount + 1) * 4 > self->asset.size) {
+        Log_Debug("ERROR:%s: compressed image with block size %zu cannot be viewed in windows "
+                  "of %zu bytes\n",
+                  __func__, self->blockSize, self->windowSize);
+        errno = EINVAL;
+        return false;
+    }
+
+    return true;
+}
+
 FileView *OpenFileView(const char *path, size_t windowSize)
 {
-    FileView *self = malloc(sizeof(*self));
+    FileView *self = MemPool_AllocFor(&fileViewMemory, sizeof(*self));
     if (!self) {
         return NULL;
     }
 
     // Initialize owned resources so they can be cleaned
     // up safely if only some of them are initialized.
-    self->fd = -1;
     self->fileOffset = NO_VALID_WINDOW;
     self->window = NULL;
+    self->prefetchWindow = NULL;
+    self->prefetchFileOffset = NO_VALID_WINDOW;
+    self->compressedBlock = NULL;
 
     self->windowSize = windowSize;
-    self->window = malloc(windowSize);
-    if (!self->window) {
+    if (ImageAsset_Open(&self->asset, path) == -1) {
         goto failed;
     }
+    self->fileSize = self->asset.size;
+    if (!ReadCompressedHeader(self)) {
+        goto failed;
+    }
+
+    // A mapped file is used in place, so it does not need window buffers.
+    if (IsInPlace(self)) {
+        return self;
+    }
+
+    // The compressed blocks of a file which is not mapped are read before they are decompressed.
+    if (self->compressed && !ImageAsset_IsMapped(&self->asset)) {
+        self->compressedBlock = MemPool_AllocFor(&fileViewMemory, self->blockSize);
+        if (!self->compressedBlock) {
+            goto failed;
+        }
+    }
 
-    self->fd = Storage_OpenFileInImagePackage(path);
-    if (self->fd == -1) {
+    self->window = MemPool_AllocFor(&fileViewMemory, windowSize);
+    if (!self->window) {
         goto failed;
     }
 
-    self->fileSize = lseek(self->fd, 0, SEEK_END);
-    if (self->fileSize == -1) {
+    self->prefetchWindow = MemPool_AllocFor(&fileViewMemory, windowSize);
+    if (!self->prefetchWindow) {
         goto failed;
     }
 
@@ -59,21 +130,59 @@ void CloseFileView(FileView *self)
         return;
     }
 
-    if (self->fd != -1) {
-        close(self->fd);
-    }
+    ImageAsset_Close(&self->asset);
 
-    free(self->window);
-    free(self);
+    MemPool_Free(self->window);
+    MemPool_Free(self->prefetchWindow);
+    MemPool_Free(self->compressedBlock);
+    MemPool_Free(self);
 }
 
-bool FileViewMoveWindow(FileView *self, off_t offset)
+// Decompresses the block with the supplied index of a compressed image into the supplied buffer,
+// which holds the block's decompressed size.
+static bool DecompressBlock(FileView *self, off_t index, uint8_t *buffer, size_t size)
 {
-    if (lseek(self->fd, offset, SEEK_SET) == -1) {
-        Log_Debug("ERROR:%s: could not seek to %lld (errno=%d)\n", __func__, offset, errno);
+    uint8_t offsetsBuffer[8];
+    off_t offsetsStart = LZ4_BLOCK_IMAGE_HEADER_SIZE + index * 4;
+    const uint8_t *offsets =
+        ImageAsset_View(&self->asset, offsetsStart, sizeof(offsetsBuffer), offsetsBuffer);
+    if (offsets == NULL) {
+        return false;
+    }
+
+    uint32_t start = GetLe32(&offsets[0]);
+    uint32_t end = GetLe32(&offsets[4]);
+    if (end < start || end > self->asset.size || end - start > self->blockSize) {
+        Log_Debug("ERROR:%s: block %lld of the compressed image is invalid\n", __func__, index);
+        errno = EINVAL;
+        return false;
+    }
+
+    const uint8_t *block =
+        ImageAsset_View(&self->asset, start, end - start, self->compressedBlock);
+    if (block == NULL) {
+        return false;
+    }
+
+    // A block which did not compress is stored as it is.
+    if (end - start == size) {
+        memcpy(buffer, block, size);
+        return true;
+    }
+
+    if (Lz4Block_Decompress(block, end - start, buffer, size) != (ssize_t)size) {
+        Log_Debug("ERROR:%s: block %lld of the compressed image could not be decompressed\n",
+                  __func__, index);
+        errno = EINVAL;
         return false;
     }
 
+    return true;
+}
+
+// Reads the window which starts at the supplied offset into the supplied buffer.
+static bool ReadWindow(FileView *self, off_t offset, uint8_t *buffer)
+{
     // Read up to the end of the window or up to the end of
     // the file, whichever is sooner.
     off_t bytesToRead = self->fileSize - offset;
@@ -81,22 +190,77 @@ bool FileViewMoveWindow(FileView *self, off_t offset)
         bytesToRead = self->windowSize;
     }
 
-    off_t bytesSoFar = 0;
-    while (bytesSoFar < bytesToRead) {
-        off_t remainBytes = bytesToRead - bytesSoFar;
-        int b = read(self->fd, &self->window[bytesSoFar], (size_t)remainBytes);
-        if (b == -1) {
-            Log_Debug("ERROR:%s: read failure bytes_so_far=%lld, remain_bytes=%lld, errno=%d\n",
-                      __func__, bytesSoFar, remainBytes, errno);
+    if (self->compressed) {
+        if (offset % (off_t)self->blockSize != 0) {
+            Log_Debug("ERROR:%s: offset %lld is not at the start of a compressed block\n",
+                      __func__, offset);
             return false;
         }
-        bytesSoFar += b;
+
+        for (off_t done = 0; done < bytesToRead; done += (off_t)self->blockSize) {
+            size_t size = (size_t)(bytesToRead - done);
+            if (size > self->blockSize) {
+                size = self->blockSize;
+            }
+            if (!DecompressBlock(self, (offset + done) / (off_t)self->blockSize, &buffer[done],
+                                 size)) {
+                return false;
+            }
+        }
+        return true;
     }
 
+    if (ImageAsset_View(&self->asset, offset, (size_t)bytesToRead, buffer) == NULL) {
+        Log_Debug("ERROR:%s: could not read %lld bytes at %lld (errno=%d)\n", __func__,
+                  bytesToRead, offset, errno);
+        return false;
+    }
+
+    return true;
+}
+
+bool FileViewMoveWindow(FileView *self, off_t offset)
+{
+    if (IsInPlace(self)) {
+        // The window of a mapped file is a pointer into the mapping.
+        if (offset < 0 || offset > self->fileSize) {
+            Log_Debug("ERROR:%s: offset %lld is outside the file\n", __func__, offset);
+            return false;
+        }
+    } else if (self->prefetchFileOffset == offset) {
+        // If the window has been prefetched then swap it in rather than reading it again.
+        uint8_t *window = self->window;
+        self->window = self->prefetchWindow;
+        self->prefetchWindow = window;
+    } else if (!ReadWindow(self, offset, self->window)) {
+        return false;
+    }
+
+    self->prefetchFileOffset = NO_VALID_WINDOW;
     self->fileOffset = offset;
     return true;
 }
 
+bool FileViewPrefetchNextWindow(FileView *self)
+{
+    if (self->fileOffset == NO_VALID_WINDOW || IsInPlace(self)) {
+        return true;
+    }
+
+    off_t nextOffset = self->fileOffset + (off_t)self->windowSize;
+    if (nextOffset >= self->fileSize || self->prefetchFileOffset == nextOffset) {
+        return true;
+    }
+
+    if (!ReadWindow(self, nextOffset, self->prefetchWindow)) {
+        self->prefetchFileOffset = NO_VALID_WINDOW;
+        return false;
+    }
+
+    self->prefetchFileOffset = nextOffset;
+    return true;
+}
+
 void FileViewFileOffsetSize(const FileView *self, off_t *offset, off_t *size)
 {
     if (offset != 0) {
@@ -113,7 +277,7 @@ void FileViewWindow(const FileView *self, uint8_t const **data, off_t *extent)
     assert(self->fileOffset != NO_VALID_WINDOW);
 
     if (data) {
-        *data = self->window;
+        *data = IsInPlace(self) ? self->asset.data + self->fileOffset : self->window;
     }
 
     off_t availBytes = self->windowSize;
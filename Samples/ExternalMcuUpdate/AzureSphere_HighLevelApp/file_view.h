@@ -8,27 +8,58 @@
 #include <sys/types.h>
 #include <time.h>
 
+#include "image_asset.h"
+
 /// <summary>
 /// Provides a movable window to a file's contents.
 /// This removes the need to load the entire file into memory at once.
+/// If the file can be mapped into memory, the window points into the mapping, and no buffers are
+/// allocated. Otherwise the window is double-buffered: while the current window is in use, the
+/// following window can be read into a second buffer with FileViewPrefetchNextWindow, so that
+/// moving to it does not have to wait for storage.
+/// If the file is a block-compressed image (see lz4_block.h), the view gives access to the
+/// decompressed contents: each window is decompressed into its buffer, a block at a time, so the
+/// window size and the offsets to which it is moved must be multiples of the image's block size.
 /// </summary>
 typedef struct {
     /// <summary>
-    /// Opened descriptor for current file.  This is owned by the file view.
+    /// The opened file.  This is owned by the file view.
     /// </summary>
-    int fd;
+    ImageAsset asset;
 
     /// <summary>Size of window in bytes.</summary>
     size_t windowSize;
 
-    /// <summary>Start of window in memory.</summary>
+    /// <summary>Start of window in memory, or NULL if the file is mapped.</summary>
     uint8_t *window;
 
+    /// <summary>Buffer holding the prefetched window, if any, or NULL if the file is
+    /// mapped.</summary>
+    uint8_t *prefetchWindow;
+
+    /// <summary>
+    /// Data in prefetchWindow starts at this offset in the file, or it is -1 if no
+    /// window has been prefetched.
+    /// </summary>
+    off_t prefetchFileOffset;
+
     /// <summary>Data in window starts at this offset in the file.</summary>
     off_t fileOffset;
 
-    /// <summary>Total file size.</summary>
+    /// <summary>Total file size; for a compressed image, its size when decompressed.</summary>
     off_t fileSize;
+
+    /// <summary>Whether the file is a block-compressed image.</summary>
+    bool compressed;
+
+    /// <summary>Decompressed size of each block of a compressed image.</summary>
+    size_t blockSize;
+
+    /// <summary>
+    /// Buffer which each compressed block is read into before it is decompressed, or NULL if
+    /// the file is mapped or not compressed.
+    /// </summary>
+    uint8_t *compressedBlock;
 } FileView;
 
 /// <summary>
@@ -60,6 +91,17 @@ void CloseFileView(FileView *self);
 /// </summary>
 bool FileViewMoveWindow(FileView *self, off_t offset);
 
+/// <summary>
+/// Reads the window which follows the current window into the second buffer, unless that
+/// has already been done or the current window extends to the end of the file. A subsequent
+/// call to FileViewMoveWindow with that window's offset swaps the buffers instead of reading
+/// the file. Call this while waiting for I/O on the current window to complete.
+/// <param name="self">File view returned by OpenFileView.</param>
+/// <returns>true if the following window has been read, or there is none; false otherwise.
+/// If this function fails, then FileViewMoveWindow reads the window itself.</returns>
+/// </summary>
+bool FileViewPrefetchNextWindow(FileView *self);
+
 /// <summary>
 /// Gets current file offset and size.
 /// <param name="self">File view returned by OpenFileView.</param>
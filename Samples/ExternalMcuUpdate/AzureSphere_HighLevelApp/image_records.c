@@ -0,0 +1,196 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <applibs/log.h>
+#include <applibs/storage.h>
+
+#include "nordic/crc.h"
+#include "image_records.h"
+
+// The mutable storage file holds a fixed number of records, one for each image on each
+// attached board.
+#define RECORD_COUNT 8
+
+static const uint32_t recordMagic = ('I' << 24) | ('M' << 16) | ('G' << 8) | 'R';
+
+typedef enum {
+    // The image has been written, but the bootloader has not yet reported its version and size.
+    RecordState_Written = 1,
+    // The record is bound to the version and size which the bootloader reported.
+    RecordState_Reported = 2
+} RecordState;
+
+// The CRC covers all the other fields, so that a record which was only partly written is ignored.
+typedef struct {
+    uint32_t magic;
+    uint8_t target;
+    uint8_t firmwareType;
+    uint8_t state;
+    uint8_t reserved;
+    uint32_t reportedVersion;
+    uint32_t reportedSize;
+    uint32_t imageCrc32;
+    uint32_t crc;
+} ImageRecord;
+
+static uint32_t RecordCrc(const ImageRecord *record)
+{
+    return CalcCrc32((const uint8_t *)record, offsetof(ImageRecord, crc));
+}
+
+static off_t RecordOffset(int slot)
+{
+    return (off_t)slot * (off_t)sizeof(ImageRecord);
+}
+
+static int OpenStorage(void)
+{
+    int fd = Storage_OpenMutableFile();
+    if (fd == -1) {
+        Log_Debug("ERROR: Could not open mutable storage: %s (%d).\n", strerror(errno), errno);
+    }
+    return fd;
+}
+
+static void CloseStorage(int fd)
+{
+    if (close(fd) != 0) {
+        Log_Debug("ERROR: Could not close mutable storage: %s (%d).\n", strerror(errno), errno);
+    }
+}
+
+// Read the record in a slot, returning false if the slot does not hold a valid record.
+static bool ReadRecord(int fd, int slot, ImageRecord *record)
+{
+    if (lseek(fd, RecordOffset(slot), SEEK_SET) == -1 ||
+        read(fd, record, sizeof(*record)) != sizeof(*record)) {
+        return false;
+    }
+
+    return record->magic == recordMagic && record->crc == RecordCrc(record);
+}
+
+static bool WriteRecord(int fd, int slot, ImageRecord *record)
+{
+    record->crc = RecordCrc(record);
+    if (lseek(fd, RecordOffset(slot), SEEK_SET) == -1 ||
+        write(fd, record, sizeof(*record)) != sizeof(*record)) {
+        Log_Debug("ERROR: Could not write image record: %s (%d).\n", strerror(errno), errno);
+        return false;
+    }
+    return true;
+}
+
+// Find the slot which holds the record for an image, returning -1 if there is none. If
+// emptySlot is not NULL, it receives the first slot which does not hold a valid record, or -1.
+static int FindRecord(int fd, uint8_t target, uint8_t firmwareType, ImageRecord *record,
+                      int *emptySlot)
+{
+    if (emptySlot) {
+        *emptySlot = -1;
+    }
+
+    for (int slot = 0; slot < RECORD_COUNT; ++slot) {
+        if (!ReadRecord(fd, slot, record)) {
+            if (emptySlot && *emptySlot == -1) {
+                *emptySlot = slot;
+            }
+            continue;
+        }
+
+        if (record->target == target && record->firmwareType == firmwareType) {
+            return slot;
+        }
+    }
+    return -1;
+}
+
+bool ImageRecords_GetInstalledCrc(uint8_t target, uint8_t firmwareType, uint32_t reportedVersion,
+                                  uint32_t reportedSize, uint32_t *crc32)
+{
+    int fd = OpenStorage();
+    if (fd == -1) {
+        return false;
+    }
+
+    bool installed = false;
+    ImageRecord record;
+    int slot = FindRecord(fd, target, firmwareType, &record, /* emptySlot */ NULL);
+    if (slot == -1) {
+        goto exitLabel;
+    }
+
+    // The first report after the image was written identifies it from then on.
+    if (record.state == RecordState_Written) {
+        record.state = RecordState_Reported;
+        record.reportedVersion = reportedVersion;
+        record.reportedSize = reportedSize;
+        if (!WriteRecord(fd, slot, &record)) {
+            goto exitLabel;
+        }
+    }
+
+    installed = record.state == RecordState_Reported && record.reportedVersion == reportedVersion &&
+                record.reportedSize == reportedSize;
+    if (installed) {
+        *crc32 = record.imageCrc32;
+    }
+
+exitLabel:
+    CloseStorage(fd);
+    return installed;
+}
+
+void ImageRecords_RecordWritten(uint8_t target, uint8_t firmwareType, uint32_t crc32)
+{
+    int fd = OpenStorage();
+    if (fd == -1) {
+        return;
+    }
+
+    ImageRecord record;
+    int emptySlot;
+    int slot = FindRecord(fd, target, firmwareType, &record, &emptySlot);
+    if (slot == -1) {
+        slot = emptySlot;
+    }
+
+    if (slot == -1) {
+        Log_Debug("ERROR: No space to record the written image.\n");
+    } else {
+        memset(&record, 0, sizeof(record));
+        record.magic = recordMagic;
+        record.target = target;
+        record.firmwareType = firmwareType;
+        record.state = RecordState_Written;
+        record.imageCrc32 = crc32;
+        WriteRecord(fd, slot, &record);
+    }
+
+    CloseStorage(fd);
+}
+
+void ImageRecords_Forget(uint8_t target, uint8_t firmwareType)
+{
+    int fd = OpenStorage();
+    if (fd == -1) {
+        return;
+    }
+
+    ImageRecord record;
+    int slot = FindRecord(fd, target, firmwareType, &record, /* emptySlot */ NULL);
+    if (slot != -1) {
+        memset(&record, 0, sizeof(record));
+        if (lseek(fd, RecordOffset(slot), SEEK_SET) == -1 ||
+            write(fd, &record, sizeof(record)) != sizeof(record)) {
+            Log_Debug("ERROR: Could not remove image record: %s (%d).\n", strerror(errno), errno);
+        }
+    }
+
+    CloseStorage(fd);
+}
@@ -0,0 +1,45 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// The nRF52 bootloader reports the version and size of each installed image, but not a hash of
+// its contents. So that an image which is identical to the installed one can be recognized even
+// when the version metadata is stale, the app records in its mutable storage the CRC-32 of each
+// image it writes. The record is bound to the version and size which the bootloader reports the
+// next time it is asked, and is used only while the bootloader continues to report them.
+
+/// <summary>
+///     Gets the CRC-32 of the image which was last written to an attached board, if it is still
+///     installed. A record of an image which has been written but not yet reported by the
+///     bootloader is bound to the reported version and size.
+/// </summary>
+/// <param name="target">Index of the attached board.</param>
+/// <param name="firmwareType">Type of the image.</param>
+/// <param name="reportedVersion">The version of the image which the bootloader reported.</param>
+/// <param name="reportedSize">The size of the image which the bootloader reported.</param>
+/// <param name="crc32">Receives the CRC-32 of the installed image.</param>
+/// <returns>
+///     true if the installed image is the one which was last written; false otherwise.
+/// </returns>
+bool ImageRecords_GetInstalledCrc(uint8_t target, uint8_t firmwareType, uint32_t reportedVersion,
+                                  uint32_t reportedSize, uint32_t *crc32);
+
+/// <summary>
+///     Records that an image has been written to an attached board.
+/// </summary>
+/// <param name="target">Index of the attached board.</param>
+/// <param name="firmwareType">Type of the image.</param>
+/// <param name="crc32">The CRC-32 of the image.</param>
+void ImageRecords_RecordWritten(uint8_t target, uint8_t firmwareType, uint32_t crc32);
+
+/// <summary>
+///     Removes the record of an image, because it is being replaced or its contents are not
+///     known.
+/// </summary>
+/// <param name="target">Index of the attached board.</param>
+/// <param name="firmwareType">Type of the image.</param>
+void ImageRecords_Forget(uint8_t target, uint8_t firmwareType);
@@ -0,0 +1,87 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "lz4_block.h"
+
+// Shortest match which a sequence can hold.
+#define MIN_MATCH_LENGTH 4
+
+// A length field with this value continues in the following bytes.
+#define LENGTH_CONTINUES 15
+
+bool Lz4Block_IsImage(const uint8_t *data, size_t size)
+{
+    return size >= LZ4_BLOCK_IMAGE_HEADER_SIZE && memcmp(data, "LZ4B", 4) == 0;
+}
+
+// Adds the bytes which extend a length field to the length, and advances past them.
+static bool ReadLengthExtension(const uint8_t **in, const uint8_t *inEnd, size_t *length)
+{
+    uint8_t next;
+    do {
+        if (*in == inEnd) {
+            return false;
+        }
+        next = *(*in)++;
+        *length += next;
+    } while (next == 255);
+    return true;
+}
+
+ssize_t Lz4Block_Decompress(const uint8_t *src, size_t srcSize, uint8_t *dst, size_t dstSize)
+{
+    const uint8_t *in = src;
+    const uint8_t *inEnd = src + srcSize;
+    uint8_t *out = dst;
+    uint8_t *outEnd = dst + dstSize;
+
+    // Each sequence holds a run of literals, followed by a match with earlier output, except the
+    // last sequence, which only holds literals.
+    while (in < inEnd) {
+        uint8_t token = *in++;
+
+        size_t literalLength = token >> 4;
+        if (literalLength == LENGTH_CONTINUES && !ReadLengthExtension(&in, inEnd, &literalLength)) {
+            return -1;
+        }
+        if (literalLength > (size_t)(inEnd - in) || literalLength > (size_t)(outEnd - out)) {
+            return -1;
+        }
+        memcpy(out, in, literalLength);
+        in += literalLength;
+        out += literalLength;
+
+        if (in == inEnd) {
+            break;
+        }
+
+        if (inEnd - in < 2) {
+            return -1;
+        }
+        size_t offset = (size_t)in[0] | ((size_t)in[1] << 8);
+        in += 2;
+        if (offset == 0 || offset > (size_t)(out - dst)) {
+            return -1;
+        }
+
+        size_t matchLength = token & 0xF;
+        if (matchLength == LENGTH_CONTINUES && !ReadLengthExtension(&in, inEnd, &matchLength)) {
+            return -1;
+        }
+        matchLength += MIN_MATCH_LENGTH;
+        if (matchLength > (size_t)(outEnd - out)) {
+            return -1;
+        }
+
+        // The match can overlap the bytes which it produces, so copy it one byte at a time.
+        const uint8_t *match = out - offset;
+        for (size_t i = 0; i < matchLength; ++i) {
+            *out++ = *match++;
+        }
+    }
+
+    return out - dst;
+}
@@ -0,0 +1,45 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Firmware images can be stored in the image package compressed, as a block-compressed image,
+// which compress_firmware.py creates. The image is divided into blocks of a fixed size, and each
+// block is compressed separately in the LZ4 block format, so that any block can be decompressed
+// without the ones before it. All fields are little-endian:
+//
+//  - Magic (4 bytes): "LZ4B".
+//  - Size of the image when decompressed (4 bytes).
+//  - Size of each block when decompressed (4 bytes); the last block may be shorter.
+//  - Offsets of the blocks in the file (4 bytes each), one per block and one after the last
+//    block, so that the size of each block is the difference between its offset and the next.
+//  - The blocks. A block which is as large as its decompressed size is stored uncompressed.
+
+/// <summary>Size of the header which precedes the block offsets, in bytes.</summary>
+#define LZ4_BLOCK_IMAGE_HEADER_SIZE 12
+
+/// <summary>
+///     Tests whether the start of a file is the header of a block-compressed image.
+/// </summary>
+/// <param name="data">Start of the file.</param>
+/// <param name="size">Number of bytes at data.</param>
+/// <returns>true if the file starts with the image's magic; false otherwise.</returns>
+bool Lz4Block_IsImage(const uint8_t *data, size_t size);
+
+/// <summary>
+///     Decompresses one block, which is in the LZ4 block format.
+/// </summary>
+/// <param name="src">The compressed block.</param>
+/// <param name="srcSize">Size of the compressed block in bytes.</param>
+/// <param name="dst">Buffer into which the block is decompressed.</param>
+/// <param name="dstSize">Size of dst in bytes.</param>
+/// <returns>
+///     The size of the decompressed block, or -1 if the block is not valid or does not fit in
+///     dst.
+/// </returns>
+ssize_t Lz4Block_Decompress(const uint8_t *src, size_t srcSize, uint8_t *dst, size_t dstSize);
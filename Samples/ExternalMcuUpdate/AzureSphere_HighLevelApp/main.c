@@ -16,6 +16,13 @@
 #include <applibs/log.h>
 
 #include "eventloop_timer_utilities.h"
+#include "mem_pool.h"
+#include "power_governor.h"
+#include "worker_pool.h"
+
+#ifdef EVENT_TRACE
+#include "event_trace.h"
+#endif
 
 // The following #include imports a "sample appliance" definition. This app comes with multiple
 // implementations of the sample appliance, each in a separate directory, which allow the code to
@@ -53,12 +60,20 @@ typedef enum {
     ExitCode_Init_Trigger = 8,
     ExitCode_Init_ButtonTimer = 9,
 
-    ExitCode_Main_EventLoopFail = 10
+    ExitCode_Main_EventLoopFail = 10,
+
+    ExitCode_Init_DfuTarget = 11,
+    ExitCode_Init_MemPool = 12,
+    ExitCode_Init_WorkerPool = 13,
+    ExitCode_Init_PowerGovernor = 14
 } ExitCode;
 
 static void TerminationHandler(int signalNumber);
-void DfuTerminationHandler(DfuResultStatus status);
+void DfuTerminationHandler(DfuTarget *target, DfuResultStatus status);
 static void ButtonPollTimerEventHandler(EventLoopTimer *timer);
+static int OpenNrfUart(uint32_t baudRate);
+static int ReopenNrfUart(DfuTarget *target, uint32_t baudRate);
+static void StartProgramming(DfuImageData *imagesToProgram, size_t count);
 static ExitCode InitPeripheralsAndHandlers(void);
 static void CloseFdAndPrintError(int fd, const char *fdName);
 static void ClosePeripheralsAndHandlers(void);
@@ -73,12 +88,41 @@ static int nrfResetGpioFd = -1;
 static int nrfDfuModeGpioFd = -1;
 static int triggerUpdateButtonGpioFd = -1;
 
+// The attached board which is updated. To update several boards at once, call InitUartProtocol
+// once for each board, with its own UART and GPIOs, and call ProgramImages for each of them.
+static DfuTarget *nrfTarget = NULL;
+
+// Baud rates to try when communicating with the nRF52 bootloader, fastest first. The bootloader
+// in this sample listens at 1000000 baud; earlier builds of it listen at 115200 baud.
+static const uint32_t nrfUartBaudRates[] = {1000000, 460800, 230400, 115200};
+static const size_t nrfUartBaudRateCount = sizeof(nrfUartBaudRates) / sizeof(nrfUartBaudRates[0]);
+
+// The timers, file views and memory buffers are allocated from a fixed-size pool rather than the
+// heap, so the memory which an update uses is reserved when the app starts, and cannot be lost to
+// fragmentation however many updates it performs. The classes are sized for one attached board:
+// the small blocks hold the timers and the file view and buffer structures, the medium blocks
+// the transmit buffer, which holds up to one MTU, and the large blocks the file view windows,
+// each of which holds one DFU object. Two file views are open at once when a transfer resumes;
+// each has two windows, which a compressed image is decompressed into, and one more block for its
+// compressed data if the image is not mapped.
+static const MemPool_SizeClass memPoolClasses[] = {{64, 16}, {256, 4}, {4096, 6}};
+static uint64_t memPoolArena[(MEM_POOL_CLASS_SIZE(64, 16) + MEM_POOL_CLASS_SIZE(256, 4) +
+                              MEM_POOL_CLASS_SIZE(4096, 6)) /
+                             sizeof(uint64_t)];
+
 // State variables
 static GPIO_Value_Type buttonState = GPIO_Value_High;
 
 // To write an image to the Nordic board, add the data and binary files as
 // resources to the solution and modify this object. The first image should
-// be the softdevice; the second image is the application.
+// be the softdevice; the second image is the application. An image can also name a delta
+// update, which is sent instead of the full image when the attached board has the version which
+// the delta patches, for example:
+//     .deltaDatPathname = "ExternalNRF52Firmware/blinkyV1toV2.dat",
+//     .deltaBinPathname = "ExternalNRF52Firmware/blinkyV1toV2.bin",
+//     .deltaBaseVersion = 1
+// A binary file can also be a block-compressed image which compress_firmware.py has made from
+// the .bin file, such as "ExternalNRF52Firmware/blinkyV1.lz4b"; it is decompressed as it is sent.
 static DfuImageData images[] = {
     {.datPathname = "ExternalNRF52Firmware/s132_nrf52_6.1.0_softdevice.dat",
      .binPathname = "ExternalNRF52Firmware/s132_nrf52_6.1.0_softdevice.bin",
@@ -91,6 +135,48 @@ static DfuImageData images[] = {
 
 static const size_t imageCount = sizeof(images) / sizeof(images[0]);
 
+// Define this to benchmark the firmware update. Instead of writing the images once when it
+// starts, the app writes the benchmark images this many times, and then logs a summary of the
+// throughput. This measures the effect of changes to the transfer.
+//#define DFU_BENCHMARK_RUNS 10
+
+#ifdef DFU_BENCHMARK_RUNS
+// The benchmark alternates between two versions of the application, so that each run writes an
+// image. The softdevice is written only if it is not already installed.
+static DfuImageData benchmarkImages[2][2] = {
+    {{.datPathname = "ExternalNRF52Firmware/s132_nrf52_6.1.0_softdevice.dat",
+      .binPathname = "ExternalNRF52Firmware/s132_nrf52_6.1.0_softdevice.bin",
+      .firmwareType = DfuFirmware_Softdevice,
+      .version = 6001000},
+     {.datPathname = "ExternalNRF52Firmware/blinkyV1.dat",
+      .binPathname = "ExternalNRF52Firmware/blinkyV1.bin",
+      .firmwareType = DfuFirmware_Application,
+      .version = 1}},
+    {{.datPathname = "ExternalNRF52Firmware/s132_nrf52_6.1.0_softdevice.dat",
+      .binPathname = "ExternalNRF52Firmware/s132_nrf52_6.1.0_softdevice.bin",
+      .firmwareType = DfuFirmware_Softdevice,
+      .version = 6001000},
+     {.datPathname = "ExternalNRF52Firmware/blinkyV2.dat",
+      .binPathname = "ExternalNRF52Firmware/blinkyV2.bin",
+      .firmwareType = DfuFirmware_Application,
+      .version = 2}}};
+
+// Whether the benchmark is running, and the totals over the runs which have completed.
+static bool benchmarkActive = false;
+static unsigned int benchmarkRunsCompleted = 0;
+static unsigned int benchmarkFailures = 0;
+static uint64_t benchmarkBytes = 0;
+static uint64_t benchmarkMs = 0;
+static uint32_t benchmarkMinBytesPerSecond = UINT32_MAX;
+static uint32_t benchmarkMaxBytesPerSecond = 0;
+static uint32_t benchmarkRetransmits = 0;
+static uint32_t benchmarkChecksumMismatches = 0;
+static uint32_t benchmarkTimeouts = 0;
+
+static void StartBenchmarkRun(void);
+static void RecordBenchmarkRun(const DfuTransferStats *stats, DfuResultStatus status);
+#endif
+
 // Whether currently writing images to attached board.
 static bool inDfuMode = false;
 
@@ -106,11 +192,114 @@ static void TerminationHandler(int signalNumber)
     exitCode = ExitCode_TermHandler_SigTerm;
 }
 
-void DfuTerminationHandler(DfuResultStatus status)
+void DfuTerminationHandler(DfuTarget *target, DfuResultStatus status)
 {
     Log_Debug("\nFinished updating images with status: %s, setting DFU mode to false.\n",
               status == DfuResult_Success ? "SUCCESS" : "FAILED");
+    LogTransferStats(target);
+    MemPool_LogStats();
+#ifdef EVENT_TRACE
+    // Log the timeline of this transfer, and start the next one's afresh.
+    EventTrace_Log();
+    EventTrace_Clear();
+#endif
     inDfuMode = false;
+    PowerGovernor_EndPhase(PowerGovernor_Phase_Transfer);
+
+#ifdef DFU_BENCHMARK_RUNS
+    if (benchmarkActive) {
+        RecordBenchmarkRun(GetTransferStats(target), status);
+        if (benchmarkRunsCompleted < DFU_BENCHMARK_RUNS) {
+            StartBenchmarkRun();
+        }
+    }
+#endif
+}
+
+#ifdef DFU_BENCHMARK_RUNS
+/// <summary>
+///     Starts the next run of the benchmark.
+/// </summary>
+static void StartBenchmarkRun(void)
+{
+    DfuImageData *runImages = benchmarkImages[benchmarkRunsCompleted % 2];
+    Log_Debug("\nStarting benchmark run %u of %d...\n", benchmarkRunsCompleted + 1,
+              DFU_BENCHMARK_RUNS);
+    benchmarkActive = true;
+    StartProgramming(runImages, 2);
+}
+
+/// <summary>
+///     Adds the statistics of a benchmark run to the totals, and logs a summary once all the
+///     runs have completed.
+/// </summary>
+static void RecordBenchmarkRun(const DfuTransferStats *stats, DfuResultStatus status)
+{
+    ++benchmarkRunsCompleted;
+    if (status != DfuResult_Success) {
+        ++benchmarkFailures;
+    }
+
+    benchmarkBytes += stats->bytesWritten;
+    benchmarkMs += stats->elapsedMs;
+    benchmarkRetransmits += stats->retransmits;
+    benchmarkChecksumMismatches += stats->checksumMismatches;
+    benchmarkTimeouts += stats->timeouts;
+
+    if (stats->elapsedMs > 0) {
+        uint32_t bytesPerSecond =
+            (uint32_t)((uint64_t)stats->bytesWritten * 1000 / stats->elapsedMs);
+        if (bytesPerSecond < benchmarkMinBytesPerSecond) {
+            benchmarkMinBytesPerSecond = bytesPerSecond;
+        }
+        if (bytesPerSecond > benchmarkMaxBytesPerSecond) {
+            benchmarkMaxBytesPerSecond = bytesPerSecond;
+        }
+    }
+
+    if (benchmarkRunsCompleted < DFU_BENCHMARK_RUNS) {
+        return;
+    }
+
+    benchmarkActive = false;
+    uint32_t meanBytesPerSecond =
+        (benchmarkMs > 0) ? (uint32_t)(benchmarkBytes * 1000 / benchmarkMs) : 0;
+    Log_Debug("\nBenchmark: %u runs, %u failed.\n", benchmarkRunsCompleted, benchmarkFailures);
+    Log_Debug("Throughput (bytes/s): min %u, mean %u, max %u.\n",
+              (benchmarkMinBytesPerSecond == UINT32_MAX) ? 0u : benchmarkMinBytesPerSecond,
+              meanBytesPerSecond, benchmarkMaxBytesPerSecond);
+    Log_Debug("Retransmits: %u, checksum mismatches: %u, timeouts: %u.\n", benchmarkRetransmits,
+              benchmarkChecksumMismatches, benchmarkTimeouts);
+}
+#endif
+
+/// <summary>
+///     Opens the UART to the nRF52 at a baud rate.
+/// </summary>
+/// <param name="baudRate">Baud rate at which to open the UART.</param>
+/// <returns>The UART descriptor, or -1 if the UART could not be opened.</returns>
+static int OpenNrfUart(uint32_t baudRate)
+{
+    UART_Config uartConfig;
+    UART_InitConfig(&uartConfig);
+    uartConfig.baudRate = baudRate;
+    uartConfig.flowControl = UART_FlowControl_RTSCTS;
+    int fd = UART_Open(SAMPLE_NRF52_UART, &uartConfig);
+    if (fd == -1) {
+        Log_Debug("ERROR: Could not open UART at %u baud: %s (%d).\n", baudRate, strerror(errno),
+                  errno);
+    }
+    return fd;
+}
+
+/// <summary>
+///     Called by the firmware update to reopen the UART to the nRF52 at another baud rate.
+/// </summary>
+static int ReopenNrfUart(DfuTarget *target, uint32_t baudRate)
+{
+    CloseFdAndPrintError(nrfUartFd, "NrfUart");
+    nrfUartFd = OpenNrfUart(baudRate);
+    return nrfUartFd;
 }
 
 /// <summary>
@@ -138,14 +327,25 @@ static void ButtonPollTimerEventHandler(EventLoopTimer *timer)
         if (newButtonState == GPIO_Value_Low) {
             if (!inDfuMode) {
                 Log_Debug("\nStarting firmware update...\n");
-                inDfuMode = true;
-                ProgramImages(images, imageCount, &DfuTerminationHandler);
+                StartProgramming(images, imageCount);
             }
         }
         buttonState = newButtonState;
     }
 }
 
+/// <summary>
+///     Starts programming images into the nRF52, at the high-performance power profile until the
+///     transfer has finished, so that decompressing and checking the images keeps up with the
+///     UART.
+/// </summary>
+static void StartProgramming(DfuImageData *imagesToProgram, size_t count)
+{
+    inDfuMode = true;
+    PowerGovernor_BeginPhase(PowerGovernor_Phase_Transfer);
+    ProgramImages(nrfTarget, imagesToProgram, count, &DfuTerminationHandler);
+}
+
 /// <summary>
 ///     Set up SIGTERM termination handler, initialize peripherals, and set up event handlers.
 /// </summary>
@@ -155,6 +355,13 @@ static void ButtonPollTimerEventHandler(EventLoopTimer *timer)
 /// </returns>
 static ExitCode InitPeripheralsAndHandlers(void)
 {
+    if (MemPool_Initialize(memPoolArena, sizeof(memPoolArena), memPoolClasses,
+                           sizeof(memPoolClasses) / sizeof(memPoolClasses[0])) != 0) {
+        Log_Debug("ERROR: Could not initialize the memory pool: %s (%d).\n", strerror(errno),
+                  errno);
+        return ExitCode_Init_MemPool;
+    }
+
     nrfResetGpioFd =
         GPIO_OpenAsOutput(SAMPLE_NRF52_RESET, GPIO_OutputMode_OpenDrain, GPIO_Value_High);
     if (nrfResetGpioFd == -1) {
@@ -174,14 +381,20 @@ static ExitCode InitPeripheralsAndHandlers(void)
         return ExitCode_Init_EventLoop;
     }
 
-    // Create a UART_Config object, open the UART and set up UART event handler
-    UART_Config uartConfig;
-    UART_InitConfig(&uartConfig);
-    uartConfig.baudRate = 115200;
-    uartConfig.flowControl = UART_FlowControl_RTSCTS;
-    nrfUartFd = UART_Open(SAMPLE_NRF52_UART, &uartConfig);
+    // A worker thread calculates the checksum of the start of an image when an interrupted
+    // transfer is resumed, so that reading the image does not delay the UART handlers.
+    if (WorkerPool_Initialize(eventLoop, 1) != 0) {
+        return ExitCode_Init_WorkerPool;
+    }
+
+    // The device runs at the power-saver profile while it waits for the button.
+    if (PowerGovernor_Start(eventLoop) != 0) {
+        return ExitCode_Init_PowerGovernor;
+    }
+
+    // Open the UART. The firmware update reopens it at the fastest baud rate which works.
+    nrfUartFd = OpenNrfUart(115200);
     if (nrfUartFd == -1) {
-        Log_Debug("ERROR: Could not open UART: %s (%d).\n", strerror(errno), errno);
         return ExitCode_Init_Uart;
     }
     // uartFd will be added to the event loop when needed
@@ -193,7 +406,23 @@ static ExitCode InitPeripheralsAndHandlers(void)
         return ExitCode_Init_DfuMode;
     }
 
-    InitUartProtocol(nrfUartFd, nrfResetGpioFd, nrfDfuModeGpioFd, eventLoop);
+    nrfTarget = InitUartProtocol(nrfUartFd, nrfResetGpioFd, nrfDfuModeGpioFd, eventLoop);
+    if (nrfTarget == NULL) {
+        return ExitCode_Init_DfuTarget;
+    }
+
+    // The nRF52 bootloader receives firmware in 4 KB objects, in 256-byte fragments. With a
+    // notification after every 16 fragments, the board reports each object's checksum as soon as
+    // the object has been written, rather than waiting to be asked for it. A bootloader which
+    // reports a smaller MTU, such as the nRF5 SDK's with 64-byte fragments, sends several
+    // notifications per object instead.
+    SetPacketReceiptNotificationInterval(nrfTarget, 16);
+
+    // The bootloader in this sample answers each execute request before it handles the next
+    // request, so the request to create each object can be sent with the previous execute.
+    SetObjectPipelining(nrfTarget, true);
+
+    SetUartBaudRates(nrfTarget, nrfUartBaudRates, nrfUartBaudRateCount, &ReopenNrfUart);
 
     Log_Debug("Opening SAMPLE_BUTTON_1 as input\n");
     triggerUpdateButtonGpioFd = GPIO_OpenAsInput(SAMPLE_BUTTON_1);
@@ -212,9 +441,12 @@ static ExitCode InitPeripheralsAndHandlers(void)
     // Take nRF52 out of reset, allowing its application to start
     GPIO_SetValue(nrfResetGpioFd, GPIO_Value_High);
 
+#ifdef DFU_BENCHMARK_RUNS
+    StartBenchmarkRun();
+#else
     Log_Debug("\nStarting firmware update...\n");
-    inDfuMode = true;
-    ProgramImages(images, imageCount, &DfuTerminationHandler);
+    StartProgramming(images, imageCount);
+#endif
 
     return ExitCode_Success;
 }
@@ -234,6 +466,9 @@ static void CloseFdAndPrintError(int fd, const char *fdName)
 /// </summary>
 static void ClosePeripheralsAndHandlers(void)
 {
+    // Wait for any checksum which is being calculated before the state machine's resources go.
+    WorkerPool_Cleanup();
+
     Log_Debug("Closing file descriptors\n");
     CloseFdAndPrintError(triggerUpdateButtonGpioFd, "TriggerUpdateButtonGpio");
     CloseFdAndPrintError(nrfResetGpioFd, "NrfResetGpio");
@@ -241,6 +476,7 @@ static void ClosePeripheralsAndHandlers(void)
     CloseFdAndPrintError(nrfUartFd, "NrfUart");
 
     DisposeEventLoopTimer(buttonPollTimer);
+    PowerGovernor_Stop();
     EventLoop_Close(eventLoop);
 }
 
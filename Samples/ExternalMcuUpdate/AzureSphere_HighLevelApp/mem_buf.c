@@ -14,43 +14,119 @@
 
 #include <applibs/log.h>
 #include "mem_buf.h"
+#include "mem_pool.h"
+
+static MemPool_Subsystem memBufMemory = MEM_POOL_SUBSYSTEM("MemBuf");
 
 MemBuf *AllocMemBuf(size_t maxSize)
 {
-    uint8_t *data = calloc(maxSize, sizeof(uint8_t));
+    uint8_t *data = MemPool_CallocFor(&memBufMemory, maxSize, sizeof(uint8_t));
     if (!data) {
         return NULL;
     }
 
-    MemBuf *self = malloc(sizeof(*self));
+    MemBuf *self = MemPool_AllocFor(&memBufMemory, sizeof(*self));
     if (!self) {
-        free(data);
+        MemPool_Free(data);
         return NULL;
     }
 
     self->maxSize = maxSize;
     self->curSize = 0;
     self->data = data;
+    self->start = 0;
+    self->staticCapacity = 0;
+    self->circular = false;
 
     return self;
 }
 
+void InitMemBuf(MemBuf *self, uint8_t *storage, size_t capacity, bool circular)
+{
+    assert(capacity > 0);
+
+    self->maxSize = capacity;
+    self->curSize = 0;
+    self->data = storage;
+    self->start = 0;
+    self->staticCapacity = capacity;
+    self->circular = circular;
+}
+
 void FreeMemBuf(MemBuf *self)
 {
-    if (!self) {
+    if (!self || self->staticCapacity != 0) {
         return;
     }
 
-    free(self->data);
-    free(self);
+    MemPool_Free(self->data);
+    MemPool_Free(self);
+}
+
+// ---- circular buffer support ----
+
+// Gets the offset in the backing store of the byte at the supplied index in the buffer.
+static size_t PhysicalIndex(const MemBuf *self, size_t idx)
+{
+    size_t physicalIdx = self->start + idx;
+    if (physicalIdx >= self->maxSize) {
+        physicalIdx -= self->maxSize;
+    }
+    return physicalIdx;
+}
+
+// Reverses the order of the bytes in data[begin, end).
+static void ReverseBytes(uint8_t *data, size_t begin, size_t end)
+{
+    while (begin + 1 < end) {
+        --end;
+        uint8_t b = data[begin];
+        data[begin] = data[end];
+        data[end] = b;
+        ++begin;
+    }
+}
+
+// Rotates the backing store in place so that the data starts at offset zero. This
+// is only required before a circular buffer is resized, which is rare.
+static void Linearize(MemBuf *self)
+{
+    if (self->start == 0) {
+        return;
+    }
+
+    ReverseBytes(self->data, 0, self->start);
+    ReverseBytes(self->data, self->start, self->maxSize);
+    ReverseBytes(self->data, 0, self->maxSize);
+    self->start = 0;
+}
+
+// Copies bytes out of the buffer, wrapping around the end of the backing store if required.
+static void CopyOut(const MemBuf *self, size_t offset, void *dest, size_t len)
+{
+    assert(offset <= self->curSize && len <= self->curSize - offset);
+    if (len == 0) {
+        return;
+    }
+
+    size_t physicalIdx = PhysicalIndex(self, offset);
+    size_t firstLen = self->maxSize - physicalIdx;
+    if (firstLen > len) {
+        firstLen = len;
+    }
+
+    memcpy(dest, &self->data[physicalIdx], firstLen);
+    memcpy((uint8_t *)dest + firstLen, self->data, len - firstLen);
 }
 
 // ---- window management ----
 
 void MemBufData(const MemBuf *self, uint8_t const **data, size_t *extent)
 {
+    assert(self->start + self->curSize <= self->maxSize);
+
     if (data) {
-        *data = self->data;
+        *data = &self->data[self->start];
     }
 
     *extent = self->curSize;
@@ -69,10 +145,27 @@ size_t MemBufMaxSize(const MemBuf *self)
 void MemBufReset(MemBuf *self)
 {
     self->curSize = 0;
+    self->start = 0;
 }
 
 bool MemBufResize(MemBuf *self, size_t maxSize)
 {
+    if (self->staticCapacity != 0 && maxSize > self->staticCapacity) {
+        return false;
+    }
+
+    // Move the data to the start of the backing store, so that it is not
+    // split by the change in the point at which it wraps around.
+    Linearize(self);
+
+    if (self->staticCapacity != 0) {
+        self->maxSize = maxSize;
+        if (self->curSize > self->maxSize) {
+            self->curSize = self->maxSize;
+        }
+        return true;
+    }
+
     // Ensure at least one byte is allocated even if maxSize == 0.
     // This ensures the underlying buffer does not get freed, and so
     // do not have to special-case NULL buffer pointers. The maximum
@@ -83,7 +176,7 @@ bool MemBufResize(MemBuf *self, size_t maxSize)
         allocSize = 1;
     }
 
-    uint8_t *newData = realloc(self->data, allocSize);
+    uint8_t *newData = MemPool_ReallocFor(&memBufMemory, self->data, allocSize);
     if (!newData) {
         return false;
     }
@@ -102,23 +195,37 @@ void MemBufShiftLeft(MemBuf *self, size_t distance)
     assert(distance <= self->curSize);
 
     size_t newSize = self->curSize - distance;
-    memmove(self->data, &self->data[distance], newSize);
+    if (self->circular) {
+        self->start = (newSize == 0) ? 0 : PhysicalIndex(self, distance);
+    } else {
+        memmove(self->data, &self->data[distance], newSize);
+    }
     self->curSize = newSize;
 }
 
 void MemBufDump(const MemBuf *self, const char *desc)
 {
+    // The bytes are formatted into a line buffer, which is written each time it fills, rather than
+    // writing each byte with its own call to Log_Debug.
+    char line[128];
     size_t extent = self->curSize;
-    Log_Debug("%s: (%zu): [", desc, extent);
+    int length = snprintf(line, sizeof(line), "%s: (%zu): [", desc, extent);
+    if (length < 0 || (size_t)length >= sizeof(line)) {
+        length = 0;
+    }
 
     for (size_t i = 0; i < extent; ++i) {
-        Log_Debug("%" PRIu8, MemBufRead8(self, i));
-        if (i + 1 < self->curSize) {
-            Log_Debug(" ");
+        // Each byte takes at most four characters, and the line needs room for "]\n".
+        if ((size_t)length + 4 + 2 >= sizeof(line)) {
+            Log_Debug("%s", line);
+            length = 0;
         }
+
+        length += snprintf(&line[length], sizeof(line) - (size_t)length, "%" PRIu8 "%s",
+                           MemBufRead8(self, i), (i + 1 < extent) ? " " : "");
     }
 
-    Log_Debug("]\n");
+    Log_Debug("%s]\n", line);
 }
 
 // ---- read / write window contents ----
@@ -126,13 +233,13 @@ void MemBufDump(const MemBuf *self, const char *desc)
 void MemBufWrite8(MemBuf *self, size_t idx, uint8_t val)
 {
     assert(idx < self->curSize);
-    self->data[idx] = val;
+    self->data[PhysicalIndex(self, idx)] = val;
 }
 
 uint8_t MemBufRead8(const MemBuf *self, size_t idx)
 {
     assert(idx < self->curSize);
-    return self->data[idx];
+    return self->data[PhysicalIndex(self, idx)];
 }
 
 void MemBufAppend8(MemBuf *self, uint8_t val)
@@ -143,11 +250,30 @@ void MemBufAppend8(MemBuf *self, uint8_t val)
     MemBufWrite8(self, self->curSize - 1, val);
 }
 
+void MemBufAppend(MemBuf *self, const uint8_t *data, size_t len)
+{
+    assert(len <= self->maxSize - self->curSize);
+    if (len == 0) {
+        return;
+    }
+
+    // In a circular buffer, the new data may wrap around the end of the backing store.
+    size_t physicalIdx = PhysicalIndex(self, self->curSize);
+    size_t firstLen = self->maxSize - physicalIdx;
+    if (firstLen > len) {
+        firstLen = len;
+    }
+
+    memcpy(&self->data[physicalIdx], data, firstLen);
+    memcpy(self->data, &data[firstLen], len - firstLen);
+    self->curSize += len;
+}
+
 uint16_t MemBufReadLe16(const MemBuf *self, size_t offset)
 {
     // Copy to a local value to avoid alignment problems.
     uint16_t value;
-    memcpy(&value, &self->data[offset], sizeof(value));
+    CopyOut(self, offset, &value, sizeof(value));
 
     return le16toh(value);
 }
@@ -156,7 +282,7 @@ uint32_t MemBufReadLe32(const MemBuf *self, size_t offset)
 {
     // Copy to a local value to avoid alignment problems.
     uint32_t value;
-    memcpy(&value, &self->data[offset], sizeof(value));
+    CopyOut(self, offset, &value, sizeof(value));
 
     return le32toh(value);
 }
@@ -13,7 +13,11 @@
 /// UART.<para>
 /// <para>The buffer's maximum size is set when it is allocated or resized, but
 /// the caller does not have to use the whole buffer.  The buffer will track the
-/// amount of space which is currently used.
+/// amount of space which is currently used.</para>
+/// <para>A circular buffer discards data from its start in constant time, without
+/// moving the following data; its contents may then wrap around the end of the
+/// backing store. The backing store can be allocated by AllocMemBuf, or supplied by
+/// the caller with InitMemBuf so that it is never reallocated.</para>
 /// </summary>
 typedef struct {
     /// <summary>Maximum size of buffer in bytes.</summary>
@@ -24,6 +28,17 @@ typedef struct {
 
     /// <summary>Start of buffer in memory.</summary>
     uint8_t *data;
+
+    /// <summary>Offset in data of the first byte in the buffer. Always zero
+    /// unless the buffer is circular.</summary>
+    size_t start;
+
+    /// <summary>Size of the backing store in bytes if it was supplied by the
+    /// caller; zero if it was allocated by AllocMemBuf.</summary>
+    size_t staticCapacity;
+
+    /// <summary>Whether the buffer is circular.</summary>
+    bool circular;
 } MemBuf;
 
 /// <summary>
@@ -36,10 +51,24 @@ typedef struct {
 /// </summary>
 MemBuf *AllocMemBuf(size_t maxSize);
 
+/// <summary>
+/// <para>Initialize a buffer which uses a backing store supplied by the caller, for
+/// example a static array.  The buffer is never reallocated, and can be resized only
+/// up to the size of the backing store.</para>
+/// <para>On return the buffer is empty, and its maximum size is the size of the
+/// backing store.</para>
+/// <param name="self">Buffer to initialize.</param>
+/// <param name="storage">Backing store, which must outlive the buffer.</param>
+/// <param name="capacity">Size of the backing store in bytes.  Must not be zero.</param>
+/// <param name="circular">Whether the buffer is circular.</param>
+/// </summary>
+void InitMemBuf(MemBuf *self, uint8_t *storage, size_t capacity, bool circular);
+
 /// <summary>
 /// Frees a memory buffer which was allocated with AllocMemBuf.
 /// <param name="self">Buffer which was allocated by AllocMemBuf.  It is safe
-/// to call this function with a NULL pointer.</param>
+/// to call this function with a NULL pointer, or with a buffer which was
+/// initialized with InitMemBuf, in which case it does nothing.</param>
 /// </summary>
 void FreeMemBuf(MemBuf *self);
 
@@ -49,6 +78,7 @@ void FreeMemBuf(MemBuf *self);
 /// <param name="data">On return contains address of data.  This parameter
 /// can be NULL.</param>
 /// <param name="extent">On return contains amount of used buffer space in bytes.</param>
+/// The data in a circular buffer must not wrap around the end of the backing store.
 /// </summary>
 void MemBufData(const MemBuf *self, uint8_t const **data, size_t *extent);
 
@@ -76,7 +106,8 @@ void MemBufReset(MemBuf *self);
 
 /// <summary>
 /// Changes the maximum buffer size.  Any existing data will be
-/// preserved if possible.
+/// preserved if possible.  A buffer which was initialized with InitMemBuf
+/// is not reallocated, and cannot grow beyond its backing store.
 /// <param name="self">Buffer which was allocated by AllocMemBuf.</param>
 /// <param name="maxSize">New maximum size in bytes.</param>
 /// <returns>true if the buffer was resized; false otherwise.  If the
@@ -87,7 +118,7 @@ bool MemBufResize(MemBuf *self, size_t maxSize);
 
 /// <summary>
 /// Discards data at the beginning of the buffer and moves the following
-/// data down.
+/// data down.  A circular buffer instead advances its start, in constant time.
 /// <param name="self">Buffer which was allocated by AllocMemBuf.</param>
 /// <param name="distance">Number of bytes to discard from the start
 /// of the buffer.  This must be no greater than the current buffer size.</param>
@@ -130,6 +161,16 @@ uint8_t MemBufRead8(const MemBuf *self, size_t idx);
 /// </summary>
 void MemBufAppend8(MemBuf *self, uint8_t val);
 
+/// <summary>
+/// <para>Append a block of data to the end of the buffer.</para>
+/// <para>On exit the current size is increased by len.  It must not
+/// exceed the maximum size.</para>
+/// <param name="self">Buffer which was allocated by AllocMemBuf.</param>
+/// <param name="data">Start of data to append to the end of the buffer.</param>
+/// <param name="len">Length of data in bytes.</param>
+/// </summary>
+void MemBufAppend(MemBuf *self, const uint8_t *data, size_t len);
+
 /// <summary>
 /// Read a unsigned little-endian 16-bit value from the buffer.
 /// <param name="self">Buffer which was allocated by AllocMemBuf.</param>
@@ -1,6 +1,13 @@
 /* This code is a C port of the nrfutil Python tool from Nordic Semiconductor ASA. The porting was done by Microsoft. See the
 LICENSE.txt in this directory, and for more background, see the README.md for this sample. */
 
+#include <stdbool.h>
+#include <string.h>
+
+#if defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
 #include "crc.h"
 
 uint32_t CalcCrc32(const uint8_t *data, size_t len)
@@ -44,7 +51,7 @@ static const uint32_t crc32Table[] = {
     0xBDBDF21C, 0xCABAC28A, 0x53B39330, 0x24B4A3A6, 0xBAD03605, 0xCDD70693, 0x54DE5729, 0x23D967BF,
     0xB3667A2E, 0xC4614AB8, 0x5D681B02, 0x2A6F2B94, 0xB40BBE37, 0xC30C8EA1, 0x5A05DF1B, 0x2D02EF8D};
 
-uint32_t CalcCrc32WithSeed(const uint8_t *data, size_t len, uint32_t seed)
+uint32_t CalcCrc32WithSeedBytewise(const uint8_t *data, size_t len, uint32_t seed)
 {
     uint32_t crc32 = seed ^ 0xFFFFFFFF;
 
@@ -54,3 +61,82 @@ uint32_t CalcCrc32WithSeed(const uint8_t *data, size_t len, uint32_t seed)
 
     return crc32 ^ 0xFFFFFFFF;
 }
+
+#if defined(__ARM_FEATURE_CRC32)
+
+// The ARMv8 CRC32 instructions use the same polynomial and bit order as crc32Table. The MT3620's
+// Cortex-A7 core is ARMv7-A and does not have them, so this is only used when building for a core
+// which does.
+uint32_t CalcCrc32WithSeed(const uint8_t *data, size_t len, uint32_t seed)
+{
+    uint32_t crc32 = seed ^ 0xFFFFFFFF;
+
+    for (; len >= 4; data += 4, len -= 4) {
+        uint32_t word;
+        memcpy(&word, data, sizeof(word));
+        crc32 = __crc32w(crc32, word);
+    }
+
+    for (; len > 0; ++data, --len) {
+        crc32 = __crc32b(crc32, *data);
+    }
+
+    return crc32 ^ 0xFFFFFFFF;
+}
+
+#elif __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+
+// Slicing-by-8: crc32SliceTables[n - 1][b] is the CRC of byte b followed by n zero bytes, so the
+// CRC of eight bytes can be calculated with eight independent table lookups rather than a chain of
+// eight dependent ones. The tables are derived from crc32Table when first needed.
+static uint32_t crc32SliceTables[7][256];
+static bool crc32SliceTablesInitialized = false;
+
+static void InitCrc32SliceTables(void)
+{
+    for (size_t index = 0; index < 256; ++index) {
+        uint32_t crc32 = crc32Table[index];
+        for (size_t slice = 0; slice < 7; ++slice) {
+            crc32 = crc32Table[crc32 & 0xff] ^ (crc32 >> 8);
+            crc32SliceTables[slice][index] = crc32;
+        }
+    }
+
+    crc32SliceTablesInitialized = true;
+}
+
+uint32_t CalcCrc32WithSeed(const uint8_t *data, size_t len, uint32_t seed)
+{
+    if (!crc32SliceTablesInitialized) {
+        InitCrc32SliceTables();
+    }
+
+    uint32_t crc32 = seed ^ 0xFFFFFFFF;
+
+    for (; len >= 8; data += 8, len -= 8) {
+        uint32_t low, high;
+        memcpy(&low, data, sizeof(low));
+        memcpy(&high, data + 4, sizeof(high));
+        low ^= crc32;
+
+        crc32 = crc32SliceTables[6][low & 0xff] ^ crc32SliceTables[5][(low >> 8) & 0xff] ^
+                crc32SliceTables[4][(low >> 16) & 0xff] ^ crc32SliceTables[3][low >> 24] ^
+                crc32SliceTables[2][high & 0xff] ^ crc32SliceTables[1][(high >> 8) & 0xff] ^
+                crc32SliceTables[0][(high >> 16) & 0xff] ^ crc32Table[high >> 24];
+    }
+
+    for (; len > 0; ++data, --len) {
+        crc32 = crc32Table[(crc32 & 0xff) ^ *data] ^ (crc32 >> 8);
+    }
+
+    return crc32 ^ 0xFFFFFFFF;
+}
+
+#else
+
+uint32_t CalcCrc32WithSeed(const uint8_t *data, size_t len, uint32_t seed)
+{
+    return CalcCrc32WithSeedBytewise(data, len, seed);
+}
+
+#endif
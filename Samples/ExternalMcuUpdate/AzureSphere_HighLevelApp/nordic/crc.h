@@ -29,3 +29,16 @@ uint32_t CalcCrc32(const uint8_t *data, size_t len);
 /// again, passing in the returned value as the seed.</returns>
 /// <seealso cref="CalcCrc32" />
 uint32_t CalcCrc32WithSeed(const uint8_t *data, size_t len, uint32_t seed);
+
+/// <summary>
+/// <para>Calculates the CRC-32 checksum for the supplied data, given a seed, one byte at a
+/// time.</para>
+/// <para>This is the reference implementation against which CalcCrc32WithSeed, which processes
+/// several bytes at a time, can be checked and measured. It returns the same result.</para>
+/// </summary>
+/// <param name="data">Sub-block of data over which to calculate checksum.</param>
+/// <param name="len">Number of bytes in sub-block.</param>
+/// <param name="seed">As for CalcCrc32WithSeed.</param>
+/// <returns>As for CalcCrc32WithSeed.</returns>
+/// <seealso cref="CalcCrc32WithSeed" />
+uint32_t CalcCrc32WithSeedBytewise(const uint8_t *data, size_t len, uint32_t seed);
@@ -5,12 +5,15 @@ LICENSE.txt in this directory, and for more background, see the README.md for th
 
 #include <unistd.h>
 #include <stdint.h>
+#include <time.h>
 
 #include "../file_view.h"
 #include "../mem_buf.h"
 #include "../eventloop_timer_utilities.h"
 
 #include "slip.h"
+#include "dfu_uart_protocol.h"
+#include "worker_pool.h"
 
 /// <summary>
 /// These opcodes are included in the headers for requests sent to and responses
@@ -127,13 +130,15 @@ typedef enum {
     DfuState_Failed,
 
     /// <summary>Entered after a file has been written to the attached board.
-    /// Launches a timer which gives the board time to consume the file.</summary>
+    /// Pings the board until it has reset to activate the image and answers
+    /// again.</summary>
     DfuState_PostValidateImage,
 
-    /// <summary>A short timer is used to give the attached board some time to
-    /// go into DFU mode before images can be written. This state is entered
-    /// when that timer expires.</summary>
-    DfuState_InitTimerExpired,
+    /// <summary>Clears the UART and pings the attached board. While the board
+    /// is expected to become ready, after it is reset into DFU mode or after an
+    /// image has been written, this state is entered again a short time after
+    /// each ping which is not answered.</summary>
+    DfuState_SendPing,
 
     /// <summary>Have received a ping response from the attached board.</summary>
     DfuState_PingReceivedResponse,
@@ -165,6 +170,12 @@ typedef enum {
     /// <summary>Have asked board to begin receiving firmware data.</summary>
     DfuState_FirmwareDoneSelectData,
 
+    /// <summary>
+    /// Have calculated the checksum of the firmware data which the attached board
+    /// received in an interrupted transfer.
+    /// </summary>
+    DfuState_FirmwareCalculatedResumeChecksum,
+
     /// <summary>Have received response to NrfDfuOp_ObjectSelect request.</summary>
     DfuState_SelectReceivedSelectResponse,
 
@@ -177,11 +188,20 @@ typedef enum {
     /// <summary>Have received response to NrfDfuOp_ObjectWrite request.</summary>
     DfuState_FileTransferSentWriteObjectRequest,
 
+    /// <summary>
+    /// Have received the packet receipt notification which the attached board sends
+    /// after every dts.prn NrfDfuOp_ObjectWrite requests.
+    /// </summary>
+    DfuState_FileTransferReceivedReceiptNotification,
+
     /// <summary>Have received response to NrfDfuOp_CrcGet request.</summary>
     DfuState_FileTrnasferReceivedWindowChecksumResponse,
 
     /// <summary>Have received response to NrfDfuOp_ObjectExecute request.</summary>
     DfuState_FileTransferReceivedExecuteResponse,
+
+    /// <summary>Number of states. This is not a state.</summary>
+    DfuState_Count
 } DfuProtocolStates;
 
 /// <summary>
@@ -243,12 +263,108 @@ typedef enum {
     StateTransition_Done
 } StateTransition;
 
+/// <summary>
+/// What the state machine is waiting for the attached board to do, while it pings the board
+/// to find out when it is ready rather than waiting for the longest time it could take.
+/// </summary>
+typedef enum {
+    /// <summary>The board is ready, and an unanswered request is a failure.</summary>
+    DfuReadiness_Ready,
+    /// <summary>The board has been reset into DFU mode, and has not yet answered a
+    /// ping.</summary>
+    DfuReadiness_AwaitAnswer,
+    /// <summary>An image has been written, and the bootloader, which still answers,
+    /// has not yet reset to activate it.</summary>
+    DfuReadiness_AwaitReset,
+    /// <summary>The bootloader has stopped answering to activate an image, and has not
+    /// yet answered again.</summary>
+    DfuReadiness_AwaitRestart
+} DfuReadiness;
+
 /// <summary>
 ///     Because the state machine runs asynchronously, it must retain
 ///     its state while it is waiting to transition to the next state.
-///     This structure holds that state.
+///     This structure holds that state. Each attached board has its own.
 /// </summary>
 struct DeviceTransferState {
+    /// <summary>Descriptor used to write to and read from attached board. Not owned.</summary>
+    int uartFd;
+
+    /// <summary>GPIO used to reset attached board. Not owned.</summary>
+    int gpioResetFd;
+
+    /// <summary>GPIO used to put attached board into DFU mode. Not owned.</summary>
+    int gpioDfuFd;
+
+    /// <summary>Event loop which is used to be notified of reads and writes. Not owned.</summary>
+    EventLoop *eventLoop;
+
+    /// <summary>Invoked when the state machine completes successfully or otherwise.</summary>
+    DfuResultHandler resultHandler;
+
+    /// <summary>Status which is passed to resultHandler.</summary>
+    DfuResultStatus statusToReturn;
+
+    /// <summary>
+    /// Multiple images, e.g. soft device and application, can be written to the
+    /// attached board. This is the index of the next image to consider.
+    /// </summary>
+    size_t nextImageIndex;
+
+    /// <summary>Number of images in allImages.</summary>
+    size_t numberOfImages;
+
+    /// <summary>Images to write to the attached board. Not owned.</summary>
+    DfuImageData *allImages;
+
+    /// <summary>Image which is being written.</summary>
+    const DfuImageData *currentImage;
+
+    /// <summary>
+    /// Files which are sent for the current image: either the full image, or the delta
+    /// update when the attached board has the version which the delta patches.
+    /// </summary>
+    const char *currentDatPathname;
+    const char *currentBinPathname;
+
+    /// <summary>Tracks image number requested from attached board.</summary>
+    uint8_t nrfImageIndex;
+
+    /// <summary>Packet receipt notification interval to request when images are next
+    /// written.</summary>
+    uint16_t requestedPrn;
+
+    /// <summary>Whether to send the request to create each data object with the request to
+    /// execute the previous object.</summary>
+    bool pipelineObjects;
+
+    /// <summary>Baud rates to try, fastest first. Not owned. NULL if the UART is used at the
+    /// rate it was opened with.</summary>
+    const uint32_t *baudRates;
+
+    /// <summary>Number of baud rates in baudRates.</summary>
+    size_t baudRateCount;
+
+    /// <summary>Reopens the UART at one of baudRates.</summary>
+    DfuUartReopenHandler reopenUart;
+
+    /// <summary>Index in baudRates of the rate at which the UART is open.</summary>
+    size_t baudRateIndex;
+
+    /// <summary>
+    /// Number of pings which the attached board must still answer before the UART's
+    /// baud rate is accepted. Zero when the rate has been accepted, or when the UART
+    /// is used at the rate it was opened with.
+    /// </summary>
+    uint8_t probePingsRemaining;
+
+    /// <summary>
+    /// Number of times the probe can be restarted at the current baud rate before
+    /// falling back to a lower rate. The first ping at a new rate can fail because
+    /// the attached board received garbage while the rates did not match.
+    /// </summary>
+    uint8_t probeRetriesRemaining;
+
     /// <summary>
     /// The next state that MoveToNextDfuState will transition to.
     /// This is not the state which was just executed.
@@ -256,15 +372,18 @@ struct DeviceTransferState {
     DfuProtocolStates state;
 
     /// <summary>
-    ///     Timer which is started after MT3620 restarts the bootloader.
+    ///     Timer which spaces the pings while the state machine waits for the
+    ///     attached board to become ready.
     /// </summary>
-    EventLoopTimer *initTimer;
+    EventLoopTimer *readinessTimer;
 
-    /// <summary>
-    ///     Post-validation timer which is started after
-    ///     a file has been written to the attached board.
-    /// </summary>
-    EventLoopTimer *postValidateTimer;
+    /// <summary>What the state machine is waiting for the attached board to do.</summary>
+    DfuReadiness readiness;
+
+    /// <summary>When the state machine started to wait for readiness, and how long the
+    /// board may take to become ready from then.</summary>
+    struct timespec readinessStart;
+    uint32_t readinessTimeoutMs;
 
     /// <summary>
     /// Holds up to one MTU worth of SLIP-encoded data which will be written
@@ -273,20 +392,39 @@ struct DeviceTransferState {
     MemBuf *txBuf;
 
     /// <summary>
-    /// Holds up to one MTU worth of data which has been received from attached board
-    /// and SLIP-decoded.
+    /// Holds a response which has been received from attached board and SLIP-decoded.
+    /// This is a circular buffer backed by decodedRxStorage.
     /// </summary>
     MemBuf *decodedRxBuf;
 
+    /// <summary>
+    /// The MemBuf which decodedRxBuf points to. Its backing store is not reallocated
+    /// when the MTU is known; responses are read up to its size.
+    /// </summary>
+    MemBuf decodedRxMemBuf;
+
+    /// <summary>Backing store for decodedRxMemBuf.</summary>
+    uint8_t decodedRxStorage[256];
+
     /// <summary>
     /// Identifier sent with ping request. The state machine verifies that
     /// the ping response contains the same identifier.
     /// </summary>
     uint8_t pingId;
 
-    /// <summary>Packet receipt notification. Always set to zero.</summary>
+    /// <summary>
+    /// Packet receipt notification interval. The attached board reports the offset
+    /// and CRC-32 of the data it has received after this many write requests,
+    /// counted from the start of each object. Zero if it does not report them.
+    /// </summary>
     uint16_t prn;
 
+    /// <summary>
+    /// Number of write requests sent since the current object was created, or since
+    /// the last packet receipt notification.
+    /// </summary>
+    uint16_t fragmentsSinceReceipt;
+
     /// <summary>Maximum transfer unit size in bytes.</summary>
     uint16_t mtu;
 
@@ -300,12 +438,52 @@ struct DeviceTransferState {
     /// <summary>CRC-32 of data which has been written so far.</summary>
     uint32_t runningCrc32;
 
+    /// <summary>
+    /// Offset reported in the select response: how much of the init packet or
+    /// firmware the attached board has already received.
+    /// </summary>
+    uint32_t selectOffset;
+
+    /// <summary>
+    /// Whether to send the init packet even if the attached board already has it,
+    /// because the firmware data it has received does not match the image.
+    /// </summary>
+    bool resendInitPacket;
+
     /// <summary>
     /// Provides access to the init packet file or the firmware file, whichever
     /// is currently being transferred.
     ///</summary>
     FileView *fv;
 
+    /// <summary>
+    /// Calculates the CRC-32 of the firmware data which the attached board received
+    /// in an interrupted transfer, on a worker thread, because reading and possibly
+    /// decompressing the start of the image would delay the other event handlers.
+    /// </summary>
+    WorkerPool_Job resumeChecksumJob;
+
+    /// <summary>
+    /// File view which resumeChecksumJob reads. Only the worker thread uses it while
+    /// the job runs. NULL when no job is running.
+    /// </summary>
+    FileView *resumeChecksumFv;
+
+    /// <summary>
+    /// Start of the object in which the firmware data on the attached board ends,
+    /// from where the transfer resumes.
+    /// </summary>
+    off_t resumeObjectStart;
+
+    /// <summary>CRC-32 of the firmware file up to resumeObjectStart.</summary>
+    uint32_t resumeObjectStartCrc32;
+
+    /// <summary>CRC-32 of the firmware file up to selectOffset.</summary>
+    uint32_t resumeSelectOffsetCrc32;
+
+    /// <summary>Whether resumeChecksumJob could read the firmware file.</summary>
+    bool resumeChecksumSucceeded;
+
     /// <summary>
     /// Number of bytes to write in a single operation. This value is chosen so
     /// that the amount of data will not exceed the MTU size, even after SLIP encoding.
@@ -338,12 +516,24 @@ struct DeviceTransferState {
     /// <summary>How many bytes have been read from the UART.</summary>
     size_t bytesRead;
 
+    /// <summary>
+    /// Bytes read from the UART in bulk which have not yet been decoded. Any bytes
+    /// after the end of one packet are kept for the next read.
+    /// </summary>
+    uint8_t uartRxBuf[64];
+
+    /// <summary>Offset of the first byte in uartRxBuf which has not been decoded.</summary>
+    size_t uartRxStart;
+
+    /// <summary>Offset after the last byte which has been read into uartRxBuf.</summary>
+    size_t uartRxEnd;
+
     /// <summary>Whether to launch a read when the write completes successfully.</summary>
     bool readAfterWrite;
 
     /// <summary>
-    /// How the SLIP decoding is progressing. Data is read from the UART one
-    /// byte at a time and so need to keep track of whether in escape sequence.
+    /// How the SLIP decoding is progressing. A packet may be read from the UART
+    /// in several parts and so need to keep track of whether in escape sequence.
     /// </summary>
     NrfSlipDecodeState decodeState;
 
@@ -363,9 +553,34 @@ struct DeviceTransferState {
     /// </summary>
     DfuProtocolStates fileTransferContinueState;
 
+    /// <summary>
+    /// Whether the request to create the next object was sent with the request to execute
+    /// the current one, so its response follows the execute response.
+    /// </summary>
+    bool createPipelined;
+
     /// <summary>
     ///     Timer used to detect when attached board does not respond.
     /// </summary>
     EventLoopTimer *timeoutTimer;
+
+    /// <summary>Statistics about the current or last call to ProgramImages.</summary>
+    DfuTransferStats stats;
+
+    /// <summary>When ProgramImages was called.</summary>
+    struct timespec transferStart;
+
+    /// <summary>
+    /// Time spent in each state, in nanoseconds. This includes the time the state's
+    /// handler ran and the time spent waiting for the IO or timer it launched.
+    /// </summary>
+    uint64_t stateDwellNs[DfuState_Count];
+
+    /// <summary>Number of times each state's handler has been called.</summary>
+    uint32_t stateEntries[DfuState_Count];
+
+    /// <summary>State whose handler was called most recently, and when it was called.</summary>
+    DfuProtocolStates timedState;
+    struct timespec timedStateStart;
 };
 
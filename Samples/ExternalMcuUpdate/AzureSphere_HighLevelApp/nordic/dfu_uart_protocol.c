@@ -7,6 +7,7 @@ for this sample. */
 #include <stdbool.h>
 #include <assert.h>
 #include <inttypes.h>
+#include <time.h>
 
 #include <applibs/log.h>
 #include <applibs/gpio.h>
@@ -19,18 +20,47 @@ for this sample. */
 #include "../file_view.h"
 #include "../mem_buf.h"
 #include "../eventloop_timer_utilities.h"
+#include "../image_records.h"
 
 #include "crc.h"
 #include "slip.h"
 #include "dfu_uart_protocol.h"
 #include "dfu_defs.h"
 
+#ifdef EVENT_TRACE
+#include "event_trace.h"
+#endif
+
 // Enable this to print the encoded data which is sent to the board.
 //#define DUMP_TX_ENCODED
 
 // Value used by the nRF52 bootloader to respond to a firmware version request.
 #define IMAGE_TYPE_UNKNOWN 255
 
+// Size of the window used to read a file when its checksum is calculated.
+#define FILE_CRC_WINDOW_SIZE 4096
+
+// Number of consecutive pings the attached board must answer before a baud rate is accepted.
+#define BAUD_RATE_PROBE_PINGS 16
+
+// While the attached board is expected to become ready, it is pinged this often until it answers,
+// instead of waiting for the longest time it could take.
+#define READINESS_POLL_INTERVAL_MS 20
+
+// Time within which the bootloader must answer after it is reset into DFU mode.
+#define INIT_READY_TIMEOUT_MS 1500
+
+// After an image has been written, the bootloader keeps answering until it has written its
+// settings and resets to activate the image, which it does within these times; if it has not
+// stopped answering by then, the reset was missed, and the transfer continues.
+#define POSTVALIDATE_RESET_TIMEOUT_MS 1000
+#define POSTVALIDATE_SOFTDEVICE_RESET_TIMEOUT_MS 5000
+
+// Time within which the bootloader must answer again once it has reset to activate an image. A
+// SoftDevice is copied into place before the bootloader answers, which takes longer.
+#define POSTVALIDATE_RESTART_TIMEOUT_MS 5000
+#define POSTVALIDATE_SOFTDEVICE_RESTART_TIMEOUT_MS 15000
+
 // Support functions.
 static void LaunchRead(void);
 static void ReadEventHandler(bool fromEvent);
@@ -45,12 +75,24 @@ static bool ValidateHeader(NrfDfuOpCode op);
 static bool ValidateAndRemoveHeader(NrfDfuOpCode op);
 
 static void MoveToNextDfuState(void);
+static void PrefetchWhileWaiting(void);
 
 static void CleanUpStateMachine(void);
 
+static void RecordStateEntry(void);
+static void FinishTransferStats(void);
+
+static bool OpenUartAtBaudRate(void);
+static void StartBaudRateProbe(void);
+static bool RetryBaudRateProbe(void);
+
 static StateTransition HandleStart(void);
-static void InitTimerEventHandler(EventLoopTimer *timer);
-static StateTransition HandleInitTimerExpired(void);
+static void ReadinessTimerEventHandler(EventLoopTimer *timer);
+static void AwaitReadiness(DfuReadiness readiness, uint32_t timeoutMs);
+static uint32_t ReadinessElapsedMs(void);
+static StateTransition ScheduleReadinessPing(void);
+static StateTransition HandleUnansweredReadinessPing(void);
+static StateTransition HandleSendPing(void);
 static StateTransition HandlePingReceivedResponse(void);
 static StateTransition HandlePrnReceivedResponse(void);
 static StateTransition HandleMtuReceivedResponse(void);
@@ -63,6 +105,10 @@ static StateTransition HandleInitPacketDoneSelectCommand(void);
 
 static StateTransition HandleFirmwareStart(void);
 static StateTransition HandleFirmwareDoneSelectData(void);
+static void CalculateResumeChecksum(void *context);
+static void ResumeChecksumCompleted(void *context);
+static StateTransition RestartInterruptedImage(void);
+static StateTransition HandleFirmwareCalculatedResumeChecksum(void);
 
 static StateTransition LaunchSelect(uint8_t objectType, DfuProtocolStates continueState);
 static StateTransition HandleSelectReceivedSelectResponse(void);
@@ -71,100 +117,345 @@ static StateTransition TransferDataInFileViewWindow(uint8_t objectType,
                                                     DfuProtocolStates continueState);
 static StateTransition HandleFileTransferReceivedCreateResponse(void);
 static StateTransition HandleFileTransferSendNextFragmentFromFileView(void);
+static StateTransition HandleFileTransferReceivedReceiptNotification(void);
+static StateTransition FinishFileViewWindow(void);
+static bool ValidateChecksumResponse(off_t expectedOffset);
 static StateTransition HandleFileTransferSentWriteObjectRequest(void);
 static StateTransition HandleFileTransferReceivedWindowChecksumResponse(void);
 static StateTransition HandleFileTransferReceivedExecuteResponse(void);
 
 static StateTransition HandlePostValidateImage(void);
-static void PostValidateTimerEventHandler(EventLoopTimer *timer);
+static StateTransition FinishPostValidation(void);
 
 // When the state machine completes successfully or otherwise,
 // it calls the termination handler which is provided to ProgramImages.
-static DfuResultHandler resultHandler = NULL;
-static DfuResultStatus statusToReturn = DfuResult_Success;
-
-struct DeviceTransferState dts;
-
 // The state machine issues a ping request followed by an
 // MTU request.  The MTU response contains the MTU value.
 // Until this value is available, the buffer must be large
 // enough to read responses from the device.
 static const uint16_t PREAMBLE_MTU_SIZE = 16;
 
-static int nrfUartFd = -1; // not owned
+// Names of the states, which are used when the transfer statistics are logged.
+static const char *const stateNames[DfuState_Count] = {
+    [DfuState_Start] = "Start",
+    [DfuState_Success] = "Success",
+    [DfuState_Failed] = "Failed",
+    [DfuState_PostValidateImage] = "PostValidateImage",
+    [DfuState_SendPing] = "SendPing",
+    [DfuState_PingReceivedResponse] = "PingReceivedResponse",
+    [DfuState_ReceiptNotificationReceivedResponse] = "ReceiptNotificationReceivedResponse",
+    [DfuState_MtuReceivedResponse] = "MtuReceivedResponse",
+    [DfuState_GetFirmwareDetails] = "GetFirmwareDetails",
+    [DfuState_FirmwareVersionReceivedResponse] = "FirmwareVersionReceivedResponse",
+    [DfuState_SelectNextImage] = "SelectNextImage",
+    [DfuState_InitPacketStart] = "InitPacketStart",
+    [DfuState_InitPacketDoneSelectCommand] = "InitPacketDoneSelectCommand",
+    [DfuState_FirmwareStart] = "FirmwareStart",
+    [DfuState_FirmwareDoneSelectData] = "FirmwareDoneSelectData",
+    [DfuState_FirmwareCalculatedResumeChecksum] = "FirmwareCalculatedResumeChecksum",
+    [DfuState_SelectReceivedSelectResponse] = "SelectReceivedSelectResponse",
+    [DfuState_FileTransferReceivedCreateResponse] = "FileTransferReceivedCreateResponse",
+    [DfuState_FileTransferSendNextFragmentFromFileView] =
+        "FileTransferSendNextFragmentFromFileView",
+    [DfuState_FileTransferSentWriteObjectRequest] = "FileTransferSentWriteObjectRequest",
+    [DfuState_FileTransferReceivedReceiptNotification] =
+        "FileTransferReceivedReceiptNotification",
+    [DfuState_FileTrnasferReceivedWindowChecksumResponse] =
+        "FileTransferReceivedWindowChecksumResponse",
+    [DfuState_FileTransferReceivedExecuteResponse] = "FileTransferReceivedExecuteResponse"};
+
+// Each attached board has its own state machine, so that several boards can be updated at once
+// on the same event loop.
+static struct DeviceTransferState targets[DFU_MAX_TARGETS];
+static size_t targetCount = 0;
+
+// The state machine of the board whose event is being handled. Every entry point into the state
+// machine - the public functions, and the UART and timer event handlers - sets this before it
+// calls any other function in this file.
+static struct DeviceTransferState *dts = NULL;
 
-static int gpioResetFd = -1;
-static int gpioDfuFd = -1;
-static EventLoop *eventLoop = NULL; // not owned
+/// <summary>
+///     Finds the attached board which owns a timer.
+/// </summary>
+/// <param name="timer">One of the board's timers.</param>
+/// <returns>The state machine of the board which owns the timer.</returns>
+static struct DeviceTransferState *FindTargetByTimer(const EventLoopTimer *timer)
+{
+    for (size_t i = 0; i < targetCount; ++i) {
+        if (timer == targets[i].readinessTimer || timer == targets[i].timeoutTimer) {
+            return &targets[i];
+        }
+    }
 
-// Multiple images, e.g. soft device and application, can be written
-// to the device.  These variables track which image is being written.
-static size_t nextImageIndex = 0;
-static size_t numberOfImages = 0;
-static DfuImageData *allImages = NULL;
-static const DfuImageData *currentImage = NULL;
+    assert(false);
+    return NULL;
+}
 
-// Tracks image number requested from nRF52
-static uint8_t nrfImageIndex = 0;
+// Gets the index of the current attached board, which identifies its image records.
+static uint8_t TargetIndex(void)
+{
+    return (uint8_t)(dts - targets);
+}
+
+/// <summary>
+///     Calculates the CRC-32 of the start of a file, and of a shorter prefix of it, in one pass.
+///     This does not use any state which is shared with other file views, so it can run on a
+///     worker thread.
+/// </summary>
+/// <param name="fv">File view whose window size is FILE_CRC_WINDOW_SIZE.</param>
+/// <param name="prefixLength">Number of bytes in the shorter prefix.</param>
+/// <param name="length">Number of bytes from the start of the file, which must not be less than
+///     prefixLength or exceed the file size.</param>
+/// <param name="prefixCrc32">Receives the CRC-32 of the shorter prefix.</param>
+/// <param name="crc32">Receives the CRC-32.</param>
+/// <returns>true on success; false if the file could not be read.</returns>
+static bool CalcFileViewCrc32(FileView *fv, off_t prefixLength, off_t length,
+                              uint32_t *prefixCrc32, uint32_t *crc32)
+{
+    off_t fileSize;
+    FileViewFileOffsetSize(fv, NULL, &fileSize);
+
+    bool succeeded = prefixLength <= length && length <= fileSize;
+    uint32_t crc = 0;
+    uint32_t prefixCrc = 0;
+    off_t offset = 0;
+    while (succeeded && offset < length) {
+        succeeded = FileViewMoveWindow(fv, offset);
+        if (succeeded) {
+            const uint8_t *data;
+            off_t extent;
+            FileViewWindow(fv, &data, &extent);
+            if (extent > length - offset) {
+                extent = length - offset;
+            }
+
+            // Split the window where the prefix ends.
+            if (offset < prefixLength && prefixLength <= offset + extent) {
+                off_t prefixExtent = prefixLength - offset;
+                prefixCrc = CalcCrc32WithSeed(data, (size_t)prefixExtent, crc);
+                crc = CalcCrc32WithSeed(&data[prefixExtent], (size_t)(extent - prefixExtent),
+                                        prefixCrc);
+            } else {
+                crc = CalcCrc32WithSeed(data, (size_t)extent, crc);
+            }
+            offset += extent;
+        }
+    }
+
+    if (succeeded) {
+        *prefixCrc32 = prefixCrc;
+        *crc32 = crc;
+    }
+    return succeeded;
+}
+
+/// <summary>
+///     Calculates the CRC-32 of a whole file.
+/// </summary>
+/// <param name="pathname">File in the image package.</param>
+/// <param name="crc32">Receives the CRC-32.</param>
+/// <returns>true on success; false if the file could not be read.</returns>
+static bool CalcFileCrc32(const char *pathname, uint32_t *crc32)
+{
+    FileView *fv = OpenFileView(pathname, FILE_CRC_WINDOW_SIZE);
+    if (!fv) {
+        Log_Debug("ERROR: Opening file %s failed with error code: %s (%d).\n", pathname,
+                  strerror(errno), errno);
+        return false;
+    }
+
+    off_t fileSize;
+    FileViewFileOffsetSize(fv, NULL, &fileSize);
+    uint32_t unusedPrefixCrc32;
+    bool succeeded = CalcFileViewCrc32(fv, 0, fileSize, &unusedPrefixCrc32, crc32);
+
+    CloseFileView(fv);
+    return succeeded;
+}
 
-void ProgramImages(DfuImageData *imagesToWrite, size_t imageCount, DfuResultHandler exitHandler)
+void SetPacketReceiptNotificationInterval(DfuTarget *target, uint16_t interval)
 {
+    target->requestedPrn = interval;
+}
+
+void SetObjectPipelining(DfuTarget *target, bool enable)
+{
+    target->pipelineObjects = enable;
+}
+
+void SetUartBaudRates(DfuTarget *target, const uint32_t *baudRates, size_t count,
+                      DfuUartReopenHandler reopenUart)
+{
+    assert(count == 0 || (baudRates != NULL && reopenUart != NULL));
+
+    target->baudRates = baudRates;
+    target->baudRateCount = count;
+    target->reopenUart = reopenUart;
+}
+
+void ProgramImages(DfuTarget *target, DfuImageData *imagesToWrite, size_t imageCount,
+                   DfuResultHandler exitHandler)
+{
+    assert(target != NULL);
     assert(exitHandler != NULL);
 
     // Fail if no image was provided.
     if (!imagesToWrite || imageCount == 0) {
         Log_Debug("ERROR:Invalid array of images.\n");
-        exitHandler(DfuResult_Fail);
+        exitHandler(target, DfuResult_Fail);
         return;
     }
 
-    resultHandler = exitHandler;
-    allImages = imagesToWrite;
-    numberOfImages = imageCount;
-    nextImageIndex = 0;
-    nrfImageIndex = 0;
-    for (unsigned int i = 0; i < numberOfImages; ++i) {
-        allImages[i].isInstalled = false;
+    dts = target;
+    dts->resultHandler = exitHandler;
+    dts->allImages = imagesToWrite;
+    dts->numberOfImages = imageCount;
+    dts->nextImageIndex = 0;
+    dts->nrfImageIndex = 0;
+    for (unsigned int i = 0; i < dts->numberOfImages; ++i) {
+        dts->allImages[i].isInstalled = false;
     }
-    dts.state = DfuState_Start;
+    dts->state = DfuState_Start;
+
+    memset(&dts->stats, 0, sizeof(dts->stats));
+    memset(dts->stateDwellNs, 0, sizeof(dts->stateDwellNs));
+    memset(dts->stateEntries, 0, sizeof(dts->stateEntries));
+    clock_gettime(CLOCK_MONOTONIC, &dts->transferStart);
+    dts->timedState = DfuState_Start;
+    dts->timedStateStart = dts->transferStart;
+
     MoveToNextDfuState();
 }
 
-void InitUartProtocol(int openedUartFd, int openedResetFd, int openedDfuFd,
-                      EventLoop *eventLoopInstance)
+const DfuTransferStats *GetTransferStats(const DfuTarget *target)
+{
+    return &target->stats;
+}
+
+void LogTransferStats(const DfuTarget *target)
+{
+    const DfuTransferStats *stats = &target->stats;
+    uint32_t bytesPerSecond = 0;
+    if (stats->elapsedMs > 0) {
+        bytesPerSecond = (uint32_t)((uint64_t)stats->bytesWritten * 1000 / stats->elapsedMs);
+    }
+
+    Log_Debug("Wrote %" PRIu32 " images, %" PRIu32 " bytes in %" PRIu32 " ms (%" PRIu32
+              " bytes/s).\n",
+              stats->imagesWritten, stats->bytesWritten, stats->elapsedMs, bytesPerSecond);
+    Log_Debug("Retransmits: %" PRIu32 ", checksum mismatches: %" PRIu32 ", timeouts: %" PRIu32
+              ".\n",
+              stats->retransmits, stats->checksumMismatches, stats->timeouts);
+
+    for (size_t i = 0; i < DfuState_Count; ++i) {
+        if (target->stateEntries[i] > 0) {
+            Log_Debug("  %-42s %6" PRIu32 " calls %10" PRIu64 " us\n", stateNames[i],
+                      target->stateEntries[i], target->stateDwellNs[i] / 1000);
+        }
+    }
+}
+
+// Nanoseconds from one time to a later one.
+static uint64_t ElapsedNs(const struct timespec *from, const struct timespec *to)
+{
+    return (uint64_t)(to->tv_sec - from->tv_sec) * 1000000000u + (uint64_t)to->tv_nsec -
+           (uint64_t)from->tv_nsec;
+}
+
+#ifdef EVENT_TRACE
+static uint64_t TimespecToUs(const struct timespec *time)
 {
-    nrfUartFd = openedUartFd;
-    gpioResetFd = openedResetFd;
-    gpioDfuFd = openedDfuFd;
-    eventLoop = eventLoopInstance;
-    dts.state = DfuState_Start;
-    dts.mtu = PREAMBLE_MTU_SIZE;
+    return (uint64_t)time->tv_sec * 1000000 + (uint64_t)time->tv_nsec / 1000;
+}
+#endif
+
+// Called before a state's handler is called. Charges the time since the previous handler was
+// called to the previous state, so each state is charged for the IO or timer it waited for.
+static void RecordStateEntry(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    dts->stateDwellNs[dts->timedState] += ElapsedNs(&dts->timedStateStart, &now);
+#ifdef EVENT_TRACE
+    // Each target's states are shown in a row of their own.
+    EventTrace_AsyncSpan("dfu", stateNames[dts->timedState], (uint32_t)(dts - targets),
+                         TimespecToUs(&dts->timedStateStart), TimespecToUs(&now), NULL, 0);
+#endif
+
+    if (dts->state < DfuState_Count) {
+        dts->timedState = dts->state;
+        ++dts->stateEntries[dts->state];
+    }
+    dts->timedStateStart = now;
+}
+
+// Called when the state machine completes, before the result handler is invoked.
+static void FinishTransferStats(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    dts->stateDwellNs[dts->timedState] += ElapsedNs(&dts->timedStateStart, &now);
+    dts->timedStateStart = now;
+    dts->stats.elapsedMs = (uint32_t)(ElapsedNs(&dts->transferStart, &now) / 1000000);
+}
+
+DfuTarget *InitUartProtocol(int openedUartFd, int openedResetFd, int openedDfuFd,
+                            EventLoop *eventLoopInstance)
+{
+    if (targetCount == DFU_MAX_TARGETS) {
+        Log_Debug("ERROR: Cannot update more than %d attached boards.\n", DFU_MAX_TARGETS);
+        return NULL;
+    }
+
+    dts = &targets[targetCount];
+    ++targetCount;
+
+    memset(dts, 0, sizeof(*dts));
+    dts->uartFd = openedUartFd;
+    dts->gpioResetFd = openedResetFd;
+    dts->gpioDfuFd = openedDfuFd;
+    dts->eventLoop = eventLoopInstance;
+    dts->state = DfuState_Start;
+    dts->mtu = PREAMBLE_MTU_SIZE;
+    return dts;
 }
 
 /// <summary>
-///     Encodes the header and (optionally) the payload.
+///     Encodes the header and (optionally) the payload after any requests which
+///     are already in the transmit buffer, so that they are sent together.
 /// </summary>
 /// <param name="op">Type of request to send.</param>
 /// <param name="buf">Start of payload data. Can be NULL.</param>
 /// <param name="len">Length of payload data. Not used if buf is NULL.</param>
-static void EncodeHeaderAndOptionalPayload(NrfDfuOpCode op, const uint8_t *buf, size_t len)
+static void AppendHeaderAndOptionalPayload(NrfDfuOpCode op, const uint8_t *buf, size_t len)
 {
     // Encode header.
-    MemBufReset(dts.txBuf);
     uint8_t op8 = (uint8_t)op;
-    SlipEncodeAppend(dts.txBuf, &op8, sizeof(op8));
+    SlipEncodeAppend(dts->txBuf, &op8, sizeof(op8));
 
     // Encode payload if required.
     if (buf) {
-        SlipEncodeAppend(dts.txBuf, buf, len);
+        SlipEncodeAppend(dts->txBuf, buf, len);
     }
-    SlipEncodeAddEndMarker(dts.txBuf);
+    SlipEncodeAddEndMarker(dts->txBuf);
 
 #ifdef DUMP_TX_ENCODED
-    MemBufDump(dts.txBuf, "Slip TX.Wire");
+    MemBufDump(dts->txBuf, "Slip TX.Wire");
 #endif
 }
 
+/// <summary>
+///     Encodes the header and (optionally) the payload.
+/// </summary>
+/// <param name="op">Type of request to send.</param>
+/// <param name="buf">Start of payload data. Can be NULL.</param>
+/// <param name="len">Length of payload data. Not used if buf is NULL.</param>
+static void EncodeHeaderAndOptionalPayload(NrfDfuOpCode op, const uint8_t *buf, size_t len)
+{
+    MemBufReset(dts->txBuf);
+    AppendHeaderAndOptionalPayload(op, buf, len);
+}
+
 // Encode a request without a payload.
 static void EncodeHeaderOnly(NrfDfuOpCode op)
 {
@@ -188,17 +479,13 @@ static void EncodeHeaderAndPayload(NrfDfuOpCode op, const uint8_t *buf, size_t l
 static bool ValidateHeader(NrfDfuOpCode op)
 {
     // The received data must be at least three bytes long to contain a valid header.
-    const uint8_t *data;
-    size_t extent;
-    MemBufData(dts.decodedRxBuf, &data, &extent);
-
-    if (extent < 3) {
+    if (MemBufCurSize(dts->decodedRxBuf) < 3) {
         return false;
     }
 
-    uint8_t r0 = MemBufRead8(dts.decodedRxBuf, /* idx */ 0);
-    uint8_t r1 = MemBufRead8(dts.decodedRxBuf, /* idx */ 1);
-    uint8_t r2 = MemBufRead8(dts.decodedRxBuf, /* idx */ 2);
+    uint8_t r0 = MemBufRead8(dts->decodedRxBuf, /* idx */ 0);
+    uint8_t r1 = MemBufRead8(dts->decodedRxBuf, /* idx */ 1);
+    uint8_t r2 = MemBufRead8(dts->decodedRxBuf, /* idx */ 2);
 
     bool asExpected = (r0 == NrfDfuOp_Response && r1 == op && r2 == NrfDfuRes_Success);
     if (r2 != NrfDfuRes_Success) {
@@ -209,8 +496,8 @@ static bool ValidateHeader(NrfDfuOpCode op)
 
 /// <summary>
 ///     Tests whether the received data contains an expected, successful
-///     header. If so, it removes the header and shifts the payload down
-///     to the start of the buffer.
+///     header. If so, it removes the header so that the payload is at
+///     the start of the buffer.
 /// </summary>
 /// <param name="op">The response should be for this operation.</param>
 /// <returns>
@@ -223,7 +510,7 @@ static bool ValidateAndRemoveHeader(NrfDfuOpCode op)
     }
 
     // Header is always three bytes.
-    MemBufShiftLeft(dts.decodedRxBuf, 3);
+    MemBufShiftLeft(dts->decodedRxBuf, 3);
     return true;
 }
 
@@ -231,19 +518,19 @@ static bool ValidateAndRemoveHeader(NrfDfuOpCode op)
 ///     <para>
 ///         Resets the state machine's read buffer and reads a packet from the
 ///         attached device. The incoming packet will be SLIP-encoded, but is
-///         stored in dts.decodedRxBuf in decoded form.
+///         stored in dts->decodedRxBuf in decoded form.
 ///     </para>
 ///     <para>
 ///         If the read completes successfully, the state machine will advance
-///         to dts.state. If an error occurs, the state machine will advance to
+///         to dts->state. If an error occurs, the state machine will advance to
 ///         DfuState_Failed.
 ///     </para>
 /// </summary>
 static void LaunchRead(void)
 {
-    dts.bytesRead = 0;
-    dts.decodeState = NRF_SLIP_STATE_DECODING;
-    MemBufReset(dts.decodedRxBuf);
+    dts->bytesRead = 0;
+    dts->decodeState = NRF_SLIP_STATE_DECODING;
+    MemBufReset(dts->decodedRxBuf);
 
     ReadEventHandler(false);
 }
@@ -258,6 +545,8 @@ static void LaunchRead(void)
 /// </summary>
 static void UartEventHandler(EventLoop *el, int fd, EventLoop_IoEvents events, void *context)
 {
+    dts = context;
+
     if (events & EventLoop_Input) {
         ReadEventHandler(true);
     }
@@ -288,52 +577,70 @@ static void ReadEventHandler(bool fromEvent)
 {
     if (fromEvent) {
         CancelTimeoutTimer();
-        EventLoop_ModifyIoEvents(eventLoop, dts.uartEventReg, EventLoop_None);
+        EventLoop_ModifyIoEvents(dts->eventLoop, dts->uartEventReg, EventLoop_None);
     }
 
-    bool finished = false;
-    while (!finished && dts.bytesRead < dts.mtu) {
-        // Read a single byte from the UART and decode it.
-        uint8_t b;
-        ssize_t bytesReadOneSysCall = read(nrfUartFd, &b, 1);
+    // Responses are much shorter than the requests which the MTU allows for, and are decoded
+    // into decodedRxBuf, so read no more than fits in it. SLIP decoding never lengthens data.
+    size_t maxRead = dts->mtu;
+    if (maxRead > MemBufMaxSize(dts->decodedRxBuf)) {
+        maxRead = MemBufMaxSize(dts->decodedRxBuf);
+    }
 
-        // Successfully read a single byte.
-        if (bytesReadOneSysCall == 1) {
-            ++dts.bytesRead;
+    bool finished = false;
+    while (!finished && dts->bytesRead < maxRead) {
+        // Decode the bytes which have already been read, up to the end of the packet.
+        if (dts->uartRxStart < dts->uartRxEnd) {
+            size_t availBytes = dts->uartRxEnd - dts->uartRxStart;
+            if (availBytes > maxRead - dts->bytesRead) {
+                availBytes = maxRead - dts->bytesRead;
+            }
 
-            SlipDecodeAddByte(b, dts.decodedRxBuf, &dts.decodeState, &finished);
+            size_t decodedBytes = SlipDecodeAppend(&dts->uartRxBuf[dts->uartRxStart], availBytes,
+                                                   dts->decodedRxBuf, &dts->decodeState, &finished);
+            dts->uartRxStart += decodedBytes;
+            dts->bytesRead += decodedBytes;
 
             // If the incoming data could not be decoded then abort the transfer.
-            if (dts.decodeState == NRF_SLIP_STATE_CLEARING_INVALID_PACKET) {
-                dts.state = DfuState_Failed;
+            if (dts->decodeState == NRF_SLIP_STATE_CLEARING_INVALID_PACKET) {
+                dts->state = DfuState_Failed;
                 finished = true;
             }
+            continue;
+        }
+
+        // Read as many bytes as are available from the UART.
+        ssize_t bytesReadOneSysCall = read(dts->uartFd, dts->uartRxBuf, sizeof(dts->uartRxBuf));
+
+        if (bytesReadOneSysCall > 0) {
+            dts->uartRxStart = 0;
+            dts->uartRxEnd = (size_t)bytesReadOneSysCall;
         }
 
         // If the underlying buffer is empty then stay in current state and wait for
         // the next read event.
         else if ((bytesReadOneSysCall == 0) || (bytesReadOneSysCall < 0 && errno == EAGAIN)) {
             if (StartTimeoutTimer() == -1) {
-                dts.state = DfuState_Failed;
+                dts->state = DfuState_Failed;
                 break;
             }
 
             // Return rather than transition to next state.
-            EventLoop_ModifyIoEvents(eventLoop, dts.uartEventReg, EventLoop_Input);
+            EventLoop_ModifyIoEvents(dts->eventLoop, dts->uartEventReg, EventLoop_Input);
             return;
         }
 
         // Another error occured so abort the transfer.
         else {
-            dts.state = DfuState_Failed;
+            dts->state = DfuState_Failed;
             break;
         }
     }
 
     // If received full mtu of bytes and Slip data has not yet
     // finished, then an error has occured so abort the transfer.
-    if (!finished && dts.bytesRead == dts.mtu) {
-        dts.state = DfuState_Failed;
+    if (!finished && dts->bytesRead == maxRead) {
+        dts->state = DfuState_Failed;
     }
 
     // receive finished - move to next DFU state
@@ -342,28 +649,28 @@ static void ReadEventHandler(bool fromEvent)
 
 /// <summary>
 ///     <para>
-///         Writes data in dts.txBuf to the attached board. The data must be in
+///         Writes data in dts->txBuf to the attached board. The data must be in
 ///         SLIP-encoded format. If data cannot be immediately written because the
 ///         underlying buffer is full, this function will return to the event loop,
 ///         which will call it again when there is space in the buffer.
 ///     </para>
 ///     <para>
 ///         If the full write completes successfully, this function will advance the
-///         state machine to dts.state. If an error occurs then it will advance the
+///         state machine to dts->state. If an error occurs then it will advance the
 ///         state machine to DfuState_Failed.
 ///     </para>
 /// </summary>
 static void LaunchWrite(void)
 {
-    dts.bytesSent = 0;
-    dts.readAfterWrite = false;
+    dts->bytesSent = 0;
+    dts->readAfterWrite = false;
 
     WriteEventHandler(false);
 }
 
 /// <summary>
 ///     <para>
-///         Writes data in dts.txBuf to the attached board. The data
+///         Writes data in dts->txBuf to the attached board. The data
 ///         must be in SLIP-encoded format. If the data cannot be
 ///         immediately written because the underlying buffer is full,
 ///         this function will return to the event loop, which will call
@@ -378,8 +685,8 @@ static void LaunchWrite(void)
 /// </summary>
 static void LaunchWriteThenRead(void)
 {
-    dts.bytesSent = 0;
-    dts.readAfterWrite = true;
+    dts->bytesSent = 0;
+    dts->readAfterWrite = true;
 
     WriteEventHandler(false);
 }
@@ -397,58 +704,65 @@ static void WriteEventHandler(bool fromEvent)
 {
     if (fromEvent) {
         CancelTimeoutTimer();
-        EventLoop_ModifyIoEvents(eventLoop, dts.uartEventReg, EventLoop_None);
+        EventLoop_ModifyIoEvents(dts->eventLoop, dts->uartEventReg, EventLoop_None);
     }
 
     // Continue to fill the UART buffer while there is data remaining
     // and while the buffer is not full.
-    while (dts.bytesSent < MemBufCurSize(dts.txBuf)) {
+    while (dts->bytesSent < MemBufCurSize(dts->txBuf)) {
         const uint8_t *data;
         size_t availBytes;
-        MemBufData(dts.txBuf, &data, &availBytes);
+        MemBufData(dts->txBuf, &data, &availBytes);
 
-        size_t remainingBytes = availBytes - dts.bytesSent;
-        ssize_t bytesSent = write(nrfUartFd, &data[dts.bytesSent], remainingBytes);
+        size_t remainingBytes = availBytes - dts->bytesSent;
+        ssize_t bytesSent = write(dts->uartFd, &data[dts->bytesSent], remainingBytes);
 
         // If actually sent data then stay in the while loop and try
         // to send more data.
         if (bytesSent > 0) {
-            dts.bytesSent += (size_t)bytesSent;
+            dts->bytesSent += (size_t)bytesSent;
         }
 
         // If underlying buffer is full then wait for next write event.
         // Return rather than advance state machine to stay in current state.
         else if (bytesSent < 0 && errno == EAGAIN) {
             if (StartTimeoutTimer() == -1) {
-                dts.state = DfuState_Failed;
+                dts->state = DfuState_Failed;
                 break;
             }
 
-            EventLoop_ModifyIoEvents(eventLoop, dts.uartEventReg, EventLoop_Output);
+            EventLoop_ModifyIoEvents(dts->eventLoop, dts->uartEventReg, EventLoop_Output);
             return;
         }
 
         // Else another error occured so move to invalid state to abort transfer.
         // A return code of zero is interpreted as an error.
         else {
-            dts.state = DfuState_Failed;
+            dts->state = DfuState_Failed;
             break;
         }
     }
 
     // Write completed successfully or otherwise.
-    if (dts.state != DfuState_Failed && dts.readAfterWrite) {
+    if (dts->state != DfuState_Failed && dts->readAfterWrite) {
         LaunchRead();
     } else {
         MoveToNextDfuState();
     }
 }
 
-// Start a 5 second timer to identify timeout conditions.
+// Start a 5 second timer to identify timeout conditions. While a baud rate is being probed, or
+// the state machine is waiting for the attached board to become ready, a ready board should
+// answer at once, so a shorter timeout is used.
 static int StartTimeoutTimer(void)
 {
     static const struct timespec timeoutDuration = {.tv_sec = 5, .tv_nsec = 0};
-    if (SetEventLoopTimerOneShot(dts.timeoutTimer, &timeoutDuration) == -1) {
+    static const struct timespec probeTimeoutDuration = {.tv_sec = 0, .tv_nsec = 250000000};
+    const struct timespec *duration =
+        (dts->probePingsRemaining > 0 || dts->readiness != DfuReadiness_Ready)
+            ? &probeTimeoutDuration
+            : &timeoutDuration;
+    if (SetEventLoopTimerOneShot(dts->timeoutTimer, duration) == -1) {
         return -1;
     }
 
@@ -458,25 +772,30 @@ static int StartTimeoutTimer(void)
 // Called when a read or write has occurred.
 static void CancelTimeoutTimer(void)
 {
-    DisarmEventLoopTimer(dts.timeoutTimer);
+    DisarmEventLoopTimer(dts->timeoutTimer);
 }
 
 static void TimeoutTimerEventHandler(EventLoopTimer *timer)
 {
+    dts = FindTargetByTimer(timer);
     ConsumeEventLoopTimerEvent(timer);
 
     // Don't get notified if pending read or write completes after
     // this timer has expired.
-    EventLoop_ModifyIoEvents(eventLoop, dts.uartEventReg, EventLoop_None);
+    EventLoop_ModifyIoEvents(dts->eventLoop, dts->uartEventReg, EventLoop_None);
 
-    dts.state = DfuState_Failed;
+    dts->state = DfuState_Failed;
 
-    Log_Debug("ERROR: Could not communicate with board. Operation timed out.\n");
+    // A board which is not yet ready is expected not to answer.
+    if (dts->readiness == DfuReadiness_Ready) {
+        ++dts->stats.timeouts;
+        Log_Debug("ERROR: Could not communicate with board. Operation timed out.\n");
+    }
     MoveToNextDfuState();
 }
 
 /// <summary>
-///     Calls the state handler for dts.state. This may launch a read,
+///     Calls the state handler for dts->state. This may launch a read,
 ///     write, or read-then-write; cause an immediate transition; indicate
 ///     a failure; or indicate a successful termination.
 /// </summary>
@@ -491,14 +810,16 @@ static void MoveToNextDfuState(void)
     bool done = false;
 
     do {
-        switch (dts.state) {
+        RecordStateEntry();
+
+        switch (dts->state) {
             // Preamble.
         case DfuState_Start:
             sttr = HandleStart();
             break;
 
-        case DfuState_InitTimerExpired:
-            sttr = HandleInitTimerExpired();
+        case DfuState_SendPing:
+            sttr = HandleSendPing();
             break;
 
         case DfuState_PingReceivedResponse:
@@ -543,6 +864,10 @@ static void MoveToNextDfuState(void)
             sttr = HandleFirmwareDoneSelectData();
             break;
 
+        case DfuState_FirmwareCalculatedResumeChecksum:
+            sttr = HandleFirmwareCalculatedResumeChecksum();
+            break;
+
             // File transfer states common to .BIN and.DAT.
         case DfuState_FileTransferReceivedCreateResponse:
             sttr = HandleFileTransferReceivedCreateResponse();
@@ -556,6 +881,10 @@ static void MoveToNextDfuState(void)
             sttr = HandleFileTransferSentWriteObjectRequest();
             break;
 
+        case DfuState_FileTransferReceivedReceiptNotification:
+            sttr = HandleFileTransferReceivedReceiptNotification();
+            break;
+
         case DfuState_FileTrnasferReceivedWindowChecksumResponse:
             sttr = HandleFileTransferReceivedWindowChecksumResponse();
             break;
@@ -575,17 +904,30 @@ static void MoveToNextDfuState(void)
 
             // Terminal states.
         case DfuState_Success:
-            statusToReturn = DfuResult_Success;
+            dts->statusToReturn = DfuResult_Success;
             sttr = StateTransition_Done;
             break;
 
         case DfuState_Failed:
-            statusToReturn = DfuResult_Fail;
+            // A ping which fails while the board is becoming ready is sent again.
+            if (dts->readiness != DfuReadiness_Ready) {
+                sttr = HandleUnansweredReadinessPing();
+                break;
+            }
+
+            // A failure while a baud rate is being probed means the rate cannot be used.
+            if (RetryBaudRateProbe()) {
+                dts->state = DfuState_SendPing;
+                sttr = StateTransition_MoveImmediately;
+                break;
+            }
+
+            dts->statusToReturn = DfuResult_Fail;
             sttr = StateTransition_Done;
             break;
 
         default:
-            Log_Debug("Unrecognized state %d\n", dts.state);
+            Log_Debug("Unrecognized state %d\n", dts->state);
             sttr = StateTransition_Done;
             assert(false);
             break;
@@ -596,21 +938,24 @@ static void MoveToNextDfuState(void)
         switch (sttr) {
         case StateTransition_LaunchRead:
             LaunchRead();
+            PrefetchWhileWaiting();
             done = true;
             break;
 
         case StateTransition_LaunchWrite:
             LaunchWrite();
+            PrefetchWhileWaiting();
             done = true;
             break;
 
         case StateTransition_LaunchWriteThenRead:
             LaunchWriteThenRead();
+            PrefetchWhileWaiting();
             done = true;
             break;
 
         case StateTransition_Failed:
-            dts.state = DfuState_Failed;
+            dts->state = DfuState_Failed;
             break;
 
         case StateTransition_MoveImmediately:
@@ -622,11 +967,12 @@ static void MoveToNextDfuState(void)
 
         case StateTransition_Done:
             CleanUpStateMachine();
+            FinishTransferStats();
             // Exit DFU mode and restart the available firmware.
-            GPIO_SetValue(gpioDfuFd, GPIO_Value_High);
-            GPIO_SetValue(gpioResetFd, GPIO_Value_Low);
-            GPIO_SetValue(gpioResetFd, GPIO_Value_High);
-            resultHandler(statusToReturn);
+            GPIO_SetValue(dts->gpioDfuFd, GPIO_Value_High);
+            GPIO_SetValue(dts->gpioResetFd, GPIO_Value_Low);
+            GPIO_SetValue(dts->gpioResetFd, GPIO_Value_High);
+            dts->resultHandler(dts, dts->statusToReturn);
             done = true;
             return;
 
@@ -638,32 +984,131 @@ static void MoveToNextDfuState(void)
     } while (!done);
 }
 
+/// <summary>
+///     Called after an async UART operation has been launched. While the UART
+///     sends the buffered data and the attached board responds, read the next window
+///     of the file which is being transferred, so it is ready when the current
+///     window has been executed.
+/// </summary>
+static void PrefetchWhileWaiting(void)
+{
+    if (dts->fv != NULL && !FileViewPrefetchNextWindow(dts->fv)) {
+        Log_Debug("WARNING: Could not prefetch next window; it will be read when needed.\n");
+    }
+}
+
 /// <summary>
 ///     Clean up any resources which were successfully allocated
 ///     by the state machine.
 /// </summary>
 static void CleanUpStateMachine(void)
 {
-    DisposeEventLoopTimer(dts.initTimer);
-    dts.initTimer = NULL;
+    DisposeEventLoopTimer(dts->readinessTimer);
+    dts->readinessTimer = NULL;
+    dts->readiness = DfuReadiness_Ready;
+
+    DisposeEventLoopTimer(dts->timeoutTimer);
+    dts->timeoutTimer = NULL;
+
+    EventLoop_UnregisterIo(dts->eventLoop, dts->uartEventReg);
+    dts->uartEventReg = NULL;
+
+    CloseFileView(dts->fv);
+    dts->fv = NULL;
+
+    // The state machine does not finish while resumeChecksumJob runs, so the worker thread no
+    // longer uses this file view.
+    CloseFileView(dts->resumeChecksumFv);
+    dts->resumeChecksumFv = NULL;
+
+    FreeMemBuf(dts->txBuf);
+    dts->txBuf = NULL;
+
+    FreeMemBuf(dts->decodedRxBuf);
+    dts->decodedRxBuf = NULL;
+
+    dts->probePingsRemaining = 0;
+}
+
+/// <summary>
+///     Reopens the UART at dts->baudRates[dts->baudRateIndex]. If the UART cannot be opened at
+///     that rate, the next lower rate is tried.
+/// </summary>
+/// <returns>
+///     true if the UART was opened; false if it could not be opened at any lower rate.
+/// </returns>
+static bool OpenUartAtBaudRate(void)
+{
+    for (; dts->baudRateIndex < dts->baudRateCount; ++dts->baudRateIndex) {
+        uint32_t baudRate = dts->baudRates[dts->baudRateIndex];
+        dts->uartFd = dts->reopenUart(dts, baudRate);
+        if (dts->uartFd != -1) {
+            return true;
+        }
+
+        Log_Debug("WARNING: Could not open UART at %u baud.\n", baudRate);
+    }
+
+    Log_Debug("ERROR: Could not open UART at any baud rate.\n");
+    return false;
+}
+
+// Requires the attached board to answer a run of pings at the current baud rate.
+static void StartBaudRateProbe(void)
+{
+    dts->probePingsRemaining = BAUD_RATE_PROBE_PINGS;
+    dts->probeRetriesRemaining = 1;
+}
+
+/// <summary>
+///     Called when the state machine fails. If a baud rate was being probed, restarts the probe
+///     at the same rate if it has not already been restarted, or else at the next lower rate.
+/// </summary>
+/// <returns>true if the probe was restarted; false if the state machine should terminate.</returns>
+static bool RetryBaudRateProbe(void)
+{
+    if (dts->probePingsRemaining == 0) {
+        return false;
+    }
 
-    DisposeEventLoopTimer(dts.postValidateTimer);
-    dts.postValidateTimer = NULL;
+    CancelTimeoutTimer();
+    EventLoop_ModifyIoEvents(dts->eventLoop, dts->uartEventReg, EventLoop_None);
 
-    DisposeEventLoopTimer(dts.timeoutTimer);
-    dts.timeoutTimer = NULL;
+    if (dts->probeRetriesRemaining > 0) {
+        --dts->probeRetriesRemaining;
+        dts->probePingsRemaining = BAUD_RATE_PROBE_PINGS;
+        return true;
+    }
 
-    EventLoop_UnregisterIo(eventLoop, dts.uartEventReg);
-    dts.uartEventReg = NULL;
+    if (dts->baudRateIndex + 1 >= dts->baudRateCount) {
+        Log_Debug("ERROR: Could not communicate with board at any baud rate.\n");
+        return false;
+    }
 
-    CloseFileView(dts.fv);
-    dts.fv = NULL;
+    Log_Debug("WARNING: Could not communicate with board at %u baud; trying %u baud.\n",
+              dts->baudRates[dts->baudRateIndex], dts->baudRates[dts->baudRateIndex + 1]);
 
-    FreeMemBuf(dts.txBuf);
-    dts.txBuf = NULL;
+    // The UART event is registered for the descriptor which is about to be closed.
+    EventLoop_UnregisterIo(dts->eventLoop, dts->uartEventReg);
+    dts->uartEventReg = NULL;
 
-    FreeMemBuf(dts.decodedRxBuf);
-    dts.decodedRxBuf = NULL;
+    ++dts->baudRateIndex;
+    if (!OpenUartAtBaudRate()) {
+        return false;
+    }
+
+    dts->uartEventReg =
+        EventLoop_RegisterIo(dts->eventLoop, dts->uartFd, 0x0, UartEventHandler, /* context */ dts);
+    if (dts->uartEventReg == NULL) {
+        return false;
+    }
+
+    // Discard bytes which were read at the previous rate.
+    dts->uartRxStart = 0;
+    dts->uartRxEnd = 0;
+
+    StartBaudRateProbe();
+    return true;
 }
 
 // Called on DfuState_Start.
@@ -674,107 +1119,194 @@ static StateTransition HandleStart(void)
 {
     // Mark resources as unused so they can be safely cleaned up if an
     // error occurs before they are all initialized.
-    dts.txBuf = NULL;
-    dts.decodedRxBuf = NULL;
-    dts.fv = NULL;
+    dts->txBuf = NULL;
+    dts->decodedRxBuf = NULL;
+    dts->fv = NULL;
+    dts->resumeChecksumFv = NULL;
+
+    dts->readinessTimer = NULL;
+    dts->readiness = DfuReadiness_Ready;
+    dts->timeoutTimer = NULL;
 
-    dts.initTimer = NULL;
-    dts.postValidateTimer = NULL;
-    dts.timeoutTimer = NULL;
+    dts->uartEventReg = NULL;
 
-    dts.uartEventReg = NULL;
+    dts->uartRxStart = 0;
+    dts->uartRxEnd = 0;
 
     // These buffer sizes are large enough to send the ping
     // and request the MTU size.  They will be adjusted once the
     // actual MTU size has been retrieved from the device.
-    dts.txBuf = AllocMemBuf(PREAMBLE_MTU_SIZE);
+    dts->txBuf = AllocMemBuf(PREAMBLE_MTU_SIZE);
 
-    if (!dts.txBuf) {
+    if (!dts->txBuf) {
         return StateTransition_Failed;
     }
 
-    dts.decodedRxBuf = AllocMemBuf(PREAMBLE_MTU_SIZE);
-    if (!dts.decodedRxBuf) {
+    InitMemBuf(&dts->decodedRxMemBuf, dts->decodedRxStorage, sizeof(dts->decodedRxStorage),
+               /* circular */ true);
+    dts->decodedRxBuf = &dts->decodedRxMemBuf;
+
+    // Start at the fastest baud rate, if a list of rates was supplied.
+    dts->baudRateIndex = 0;
+    if (dts->baudRateCount > 0 && !OpenUartAtBaudRate()) {
         return StateTransition_Failed;
     }
 
     // Create UART event. It is updated to listen for read or write events as required.
-    dts.uartEventReg =
-        EventLoop_RegisterIo(eventLoop, nrfUartFd, 0x0, UartEventHandler, /* context */ NULL);
+    dts->uartEventReg =
+        EventLoop_RegisterIo(dts->eventLoop, dts->uartFd, 0x0, UartEventHandler, /* context */ dts);
 
     // Create all of the required timers in disarmed state.
-    dts.initTimer = CreateEventLoopDisarmedTimer(eventLoop, InitTimerEventHandler);
-    if (dts.initTimer == NULL) {
+    dts->readinessTimer = CreateEventLoopDisarmedTimer(dts->eventLoop, ReadinessTimerEventHandler);
+    if (dts->readinessTimer == NULL) {
         return StateTransition_Failed;
     }
 
-    dts.postValidateTimer = CreateEventLoopDisarmedTimer(eventLoop, PostValidateTimerEventHandler);
-    if (dts.postValidateTimer == NULL) {
+    dts->timeoutTimer = CreateEventLoopDisarmedTimer(dts->eventLoop, TimeoutTimerEventHandler);
+    if (dts->timeoutTimer == NULL) {
         return StateTransition_Failed;
     }
 
-    dts.timeoutTimer = CreateEventLoopDisarmedTimer(eventLoop, TimeoutTimerEventHandler);
-    if (dts.timeoutTimer == NULL) {
-        return StateTransition_Failed;
-    }
-
-    dts.pingId = 1;
+    dts->pingId = 1;
 
     // Put the nRF52 into DFU mode.
-    GPIO_SetValue(gpioResetFd, GPIO_Value_Low);
-    GPIO_SetValue(gpioDfuFd, GPIO_Value_Low);
-    GPIO_SetValue(gpioResetFd, GPIO_Value_High);
+    GPIO_SetValue(dts->gpioResetFd, GPIO_Value_Low);
+    GPIO_SetValue(dts->gpioDfuFd, GPIO_Value_Low);
+    GPIO_SetValue(dts->gpioResetFd, GPIO_Value_High);
 
-    // Wait one second for nRF52 to go into DFU mode.
-    static const struct timespec initTimerDuration = {.tv_sec = 1, .tv_nsec = 0};
-    if (SetEventLoopTimerOneShot(dts.initTimer, &initTimerDuration) == -1) {
-        return StateTransition_Failed;
+    if (dts->baudRateCount > 0) {
+        StartBaudRateProbe();
     }
 
-    // Do not set next state - that happens in InitTimerEventHandler.
-    return StateTransition_WaitAsync;
+    // Ping the nRF52 until it has gone into DFU mode.
+    AwaitReadiness(DfuReadiness_AwaitAnswer, INIT_READY_TIMEOUT_MS);
+    return ScheduleReadinessPing();
 }
 
-// Called when init timer expires.
+// Called when the readiness timer expires.
 // Consumes one-shot timer event but does not close the timer.
-static void InitTimerEventHandler(EventLoopTimer *timer)
+static void ReadinessTimerEventHandler(EventLoopTimer *timer)
 {
+    dts = FindTargetByTimer(timer);
     bool consumed = (ConsumeEventLoopTimerEvent(timer) == 0);
-    dts.state = consumed ? DfuState_InitTimerExpired : DfuState_Failed;
+    dts->state = consumed ? DfuState_SendPing : DfuState_Failed;
 
     MoveToNextDfuState();
 }
 
-// Called on DfuState_InitTimerExpired.
-static StateTransition HandleInitTimerExpired(void)
+// Starts to wait for the attached board to become ready.
+static void AwaitReadiness(DfuReadiness readiness, uint32_t timeoutMs)
+{
+    dts->readiness = readiness;
+    dts->readinessTimeoutMs = timeoutMs;
+    clock_gettime(CLOCK_MONOTONIC, &dts->readinessStart);
+}
+
+// Returns the time since the state machine started to wait for the current readiness.
+static uint32_t ReadinessElapsedMs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t)(ElapsedNs(&dts->readinessStart, &now) / 1000000);
+}
+
+// Sends the next readiness ping after a short interval.
+static StateTransition ScheduleReadinessPing(void)
+{
+    static const struct timespec pollInterval = {.tv_sec = 0,
+                                                 .tv_nsec = READINESS_POLL_INTERVAL_MS * 1000000};
+    if (SetEventLoopTimerOneShot(dts->readinessTimer, &pollInterval) == -1) {
+        // Stop waiting, so that the failure is not retried.
+        dts->readiness = DfuReadiness_Ready;
+        return StateTransition_Failed;
+    }
+
+    // Do not set next state - that happens in ReadinessTimerEventHandler.
+    return StateTransition_WaitAsync;
+}
+
+/// <summary>
+///     Called on DfuState_Failed while the state machine waits for the attached board to become
+///     ready, when a ping was not answered, or its answer was garbled. The ping is sent again
+///     until the board has had the longest time it could take.
+/// </summary>
+static StateTransition HandleUnansweredReadinessPing(void)
+{
+    CancelTimeoutTimer();
+    EventLoop_ModifyIoEvents(dts->eventLoop, dts->uartEventReg, EventLoop_None);
+
+    bool expired = ReadinessElapsedMs() >= dts->readinessTimeoutMs;
+    switch (dts->readiness) {
+    case DfuReadiness_AwaitAnswer:
+        if (expired) {
+            Log_Debug("ERROR: Board did not answer within %u ms of being reset.\n",
+                      dts->readinessTimeoutMs);
+            dts->readiness = DfuReadiness_Ready;
+            return StateTransition_Failed;
+        }
+        break;
+
+    case DfuReadiness_AwaitReset:
+        // The bootloader has reset to activate the image.
+        Log_Debug("INFO: Bootloader reset %u ms after postvalidation.\n", ReadinessElapsedMs());
+        AwaitReadiness(DfuReadiness_AwaitRestart,
+                       dts->currentImage->firmwareType == DfuFirmware_Softdevice
+                           ? POSTVALIDATE_SOFTDEVICE_RESTART_TIMEOUT_MS
+                           : POSTVALIDATE_RESTART_TIMEOUT_MS);
+        break;
+
+    case DfuReadiness_AwaitRestart:
+        if (expired) {
+            // The image was validated before the bootloader reset, so the transfer continues as
+            // it did when it waited a fixed time; the next step fails if the board stays silent.
+            Log_Debug("WARNING: Bootloader did not answer within %u ms of resetting.\n",
+                      dts->readinessTimeoutMs);
+            dts->readiness = DfuReadiness_Ready;
+            return FinishPostValidation();
+        }
+        break;
+
+    default:
+        break;
+    }
+
+    return ScheduleReadinessPing();
+}
+
+// Called on DfuState_SendPing.
+static StateTransition HandleSendPing(void)
 {
     // At this point the nRF52 should not be sending any data so
-    // clear any previously-sent data from the OS receive buffer.
+    // clear any previously-sent data from the OS receive buffer,
+    // such as the late answer to an earlier ping.
 
     bool cleared = false;
     do {
         uint8_t b;
-        int r = read(nrfUartFd, &b, 1);
-
-        // If a read error occurred then abort.
-        if (r == -1) {
-            return StateTransition_Failed;
-        }
+        ssize_t r = read(dts->uartFd, &b, 1);
 
         // If no data was read then have exhausted the OS receive
         // buffer so stop reading from the UART.
-        else if (r == 0) {
+        if (r == 0 || (r == -1 && errno == EAGAIN)) {
             cleared = true;
         }
 
+        // If a read error occurred then abort.
+        else if (r == -1) {
+            return StateTransition_Failed;
+        }
+
         // Else a byte was read from the buffer, so iterate again.
     } while (!cleared);
 
+    dts->uartRxStart = 0;
+    dts->uartRxEnd = 0;
+
     // Send the ping command.
-    ++dts.pingId;
-    EncodeHeaderAndPayload(NrfDfuOp_Ping, &dts.pingId, 1);
+    ++dts->pingId;
+    EncodeHeaderAndPayload(NrfDfuOp_Ping, &dts->pingId, 1);
 
-    dts.state = DfuState_PingReceivedResponse;
+    dts->state = DfuState_PingReceivedResponse;
     return StateTransition_LaunchWriteThenRead;
 }
 
@@ -786,22 +1318,60 @@ static StateTransition HandlePingReceivedResponse(void)
     }
 
     // Payload should contain a one-byte ping id.
-    if (MemBufCurSize(dts.decodedRxBuf) != 1) {
+    if (MemBufCurSize(dts->decodedRxBuf) != 1) {
         return StateTransition_Failed;
     }
 
     // Ensure the ping id in the payload is equal to the ping id that was sent.
-    uint8_t receivedPingId = MemBufRead8(dts.decodedRxBuf, /* idx */ 0);
-    if (receivedPingId != dts.pingId) {
+    uint8_t receivedPingId = MemBufRead8(dts->decodedRxBuf, /* idx */ 0);
+    if (receivedPingId != dts->pingId) {
         return StateTransition_Failed;
     }
 
+    switch (dts->readiness) {
+    case DfuReadiness_AwaitAnswer:
+        Log_Debug("INFO: Board answered %u ms after being reset.\n", ReadinessElapsedMs());
+        dts->readiness = DfuReadiness_Ready;
+        break;
+
+    case DfuReadiness_AwaitReset:
+        if (ReadinessElapsedMs() < dts->readinessTimeoutMs) {
+            return ScheduleReadinessPing();
+        }
+        Log_Debug("WARNING: Bootloader did not reset within %u ms of postvalidation.\n",
+                  dts->readinessTimeoutMs);
+        dts->readiness = DfuReadiness_Ready;
+        return FinishPostValidation();
+
+    case DfuReadiness_AwaitRestart:
+        Log_Debug("INFO: Bootloader answered %u ms after resetting.\n", ReadinessElapsedMs());
+        dts->readiness = DfuReadiness_Ready;
+        return FinishPostValidation();
+
+    default:
+        break;
+    }
+
+    // While a baud rate is being probed, keep pinging until the attached board has answered
+    // enough pings to show that the link is reliable at this rate.
+    if (dts->probePingsRemaining > 0) {
+        --dts->probePingsRemaining;
+        if (dts->probePingsRemaining > 0) {
+            ++dts->pingId;
+            EncodeHeaderAndPayload(NrfDfuOp_Ping, &dts->pingId, 1);
+            return StateTransition_LaunchWriteThenRead;
+        }
+
+        Log_Debug("INFO: Communicating with board at %u baud.\n",
+                  dts->baudRates[dts->baudRateIndex]);
+    }
+
     // Send the packet receipt notification (PRN).
-    dts.prn = 0;
-    uint16_t sendPrn = htole16(dts.prn);
+    dts->prn = dts->requestedPrn;
+    uint16_t sendPrn = htole16(dts->prn);
     EncodeHeaderAndPayload(NrfDfuOp_ReceiptNotificationSet, (const uint8_t *)&sendPrn, 2);
 
-    dts.state = DfuState_ReceiptNotificationReceivedResponse;
+    dts->state = DfuState_ReceiptNotificationReceivedResponse;
     return StateTransition_LaunchWriteThenRead;
 }
 
@@ -813,13 +1383,13 @@ static StateTransition HandlePrnReceivedResponse(void)
     }
 
     // There should not be any payload with this response.
-    if (MemBufCurSize(dts.decodedRxBuf) != 0) {
+    if (MemBufCurSize(dts->decodedRxBuf) != 0) {
         return StateTransition_Failed;
     }
 
     // Request MTU from nRF52 board.
     EncodeHeaderOnly(NrfDfuOp_MtuGet);
-    dts.state = DfuState_MtuReceivedResponse;
+    dts->state = DfuState_MtuReceivedResponse;
     return StateTransition_LaunchWriteThenRead;
 }
 
@@ -830,10 +1400,10 @@ static StateTransition HandleMtuReceivedResponse(void)
         return StateTransition_Failed;
     }
 
-    dts.mtu = MemBufReadLe16(dts.decodedRxBuf, 0);
+    dts->mtu = MemBufReadLe16(dts->decodedRxBuf, 0);
 
     // The MTU must be non-empty, else can't transfer any data.
-    if (dts.mtu == 0) {
+    if (dts->mtu == 0) {
         return StateTransition_Failed;
     }
 
@@ -843,29 +1413,30 @@ static StateTransition HandleMtuReceivedResponse(void)
     // up before it is encoded to ensure that it does not exceed
     // the MTU after it has been encoded.
 
-    if (!MemBufResize(dts.txBuf, dts.mtu)) {
+    if (!MemBufResize(dts->txBuf, dts->mtu)) {
         return StateTransition_Failed;
     }
 
-    // The RX buffer contains decoded payloads, and so will be
-    // no longer than the MTU.
-    if (!MemBufResize(dts.decodedRxBuf, dts.mtu)) {
-        return StateTransition_Failed;
-    }
+    // The RX buffer contains decoded responses. Its backing store is not reallocated: the MTU
+    // limits the size of requests, and responses are short, so reads are limited to its size
+    // when the MTU is larger. The larger the MTU, the fewer write requests, and receipt
+    // notifications or checksum requests, there are per object.
+    Log_Debug("Attached board's MTU is %" PRIu16 " bytes; writing %d bytes per request.\n",
+              dts->mtu, (dts->mtu - 1) / 2 - 1);
 
-    // if the nextImageIndex is greater than 0
+    // if the dts->nextImageIndex is greater than 0
     // then the image isInstalled and installedVersion
     // fields have been set for all images which
     // have to be updated
-    if (nextImageIndex != 0) {
-        dts.state = DfuState_SelectNextImage;
+    if (dts->nextImageIndex != 0) {
+        dts->state = DfuState_SelectNextImage;
     }
     // otherwise, the version of each image has to be
     // checked and the isInstalled and installedVersion fields
     // have to be set accordingly
     else {
         Log_Debug("Requesting details of firmware present on nRF52:\n");
-        dts.state = DfuState_GetFirmwareDetails;
+        dts->state = DfuState_GetFirmwareDetails;
     }
     return StateTransition_MoveImmediately;
 }
@@ -873,9 +1444,9 @@ static StateTransition HandleMtuReceivedResponse(void)
 // Called on DfuState_GetFirmwareDetails.
 static StateTransition HandleGetFirmwareDetails(void)
 {
-    EncodeHeaderAndOptionalPayload(NrfDfuOp_FirmwareVersion, &nrfImageIndex, 1);
-    nrfImageIndex++;
-    dts.state = DfuState_FirmwareVersionReceivedResponse;
+    EncodeHeaderAndOptionalPayload(NrfDfuOp_FirmwareVersion, &dts->nrfImageIndex, 1);
+    dts->nrfImageIndex++;
+    dts->state = DfuState_FirmwareVersionReceivedResponse;
     return StateTransition_LaunchWriteThenRead;
 }
 
@@ -887,70 +1458,109 @@ static StateTransition HandleFirmwareVersionReceivedResponse(void)
     }
 
     size_t currentOffset = 0;
-    uint8_t type = MemBufRead8(dts.decodedRxBuf, currentOffset);
+    uint8_t type = MemBufRead8(dts->decodedRxBuf, currentOffset);
     currentOffset += 1;
-    uint32_t version = MemBufReadLe32(dts.decodedRxBuf, currentOffset);
+    uint32_t version = MemBufReadLe32(dts->decodedRxBuf, currentOffset);
     currentOffset += sizeof(version);
-    uint32_t addr = MemBufReadLe32(dts.decodedRxBuf, currentOffset);
+    uint32_t addr = MemBufReadLe32(dts->decodedRxBuf, currentOffset);
     currentOffset += sizeof(addr);
-    uint32_t len = MemBufReadLe32(dts.decodedRxBuf, currentOffset);
+    uint32_t len = MemBufReadLe32(dts->decodedRxBuf, currentOffset);
 
     // Unknown image type means no more images are present on the nRF52
     if (type == IMAGE_TYPE_UNKNOWN) {
-        dts.state = DfuState_SelectNextImage;
+        dts->state = DfuState_SelectNextImage;
         return StateTransition_MoveImmediately;
     }
 
     Log_Debug("Image %zu has type %" PRIu8 " version %" PRIu32 " address %" PRIu32 " size %" PRIu32
               ".\n",
-              nrfImageIndex - 1, type, version, addr, len);
-
-    for (unsigned int i = 0; i < numberOfImages; ++i) {
-        if ((uint8_t)type == (uint8_t)allImages[i].firmwareType) {
-            allImages[i].isInstalled = true;
-            allImages[i].installedVersion = version;
-            if (allImages[i].installedVersion != allImages[i].version) {
+              dts->nrfImageIndex - 1, type, version, addr, len);
+
+    for (unsigned int i = 0; i < dts->numberOfImages; ++i) {
+        if ((uint8_t)type == (uint8_t)dts->allImages[i].firmwareType) {
+            dts->allImages[i].isInstalled = true;
+            dts->allImages[i].installedVersion = version;
+            dts->allImages[i].installedSize = len;
+            if (dts->allImages[i].installedVersion != dts->allImages[i].version) {
                 Log_Debug("Image %s (%zu/%zu) with version %zu needs update to version %zu.\n",
-                          allImages[i].datPathname, i + 1, numberOfImages, version,
-                          allImages[i].version);
+                          dts->allImages[i].datPathname, i + 1, dts->numberOfImages, version,
+                          dts->allImages[i].version);
             }
         }
     }
 
-    dts.state = DfuState_GetFirmwareDetails;
+    dts->state = DfuState_GetFirmwareDetails;
     return StateTransition_MoveImmediately;
 }
 
 // Called on DfuState_SelectNextImage.
 static StateTransition HandleSelectNextImage(void)
 {
-    while (nextImageIndex < numberOfImages) {
-        currentImage = &(allImages[nextImageIndex]);
-        nextImageIndex++;
+    while (dts->nextImageIndex < dts->numberOfImages) {
+        dts->currentImage = &(dts->allImages[dts->nextImageIndex]);
+        dts->nextImageIndex++;
+        dts->currentDatPathname = dts->currentImage->datPathname;
+        dts->currentBinPathname = dts->currentImage->binPathname;
+        dts->resendInitPacket = false;
         // if there is an image to add, it will be added
-        if (!currentImage->isInstalled) {
-            Log_Debug("Adding image %s (%zu/%zu) with version %zu.\n", currentImage->datPathname,
-                      nextImageIndex, numberOfImages, currentImage->version);
-            dts.state = DfuState_InitPacketStart;
+        if (!dts->currentImage->isInstalled) {
+            Log_Debug("Adding image %s (%zu/%zu) with version %zu.\n",
+                      dts->currentImage->datPathname, dts->nextImageIndex, dts->numberOfImages,
+                      dts->currentImage->version);
+            ImageRecords_Forget(TargetIndex(), (uint8_t)dts->currentImage->firmwareType);
+            dts->state = DfuState_InitPacketStart;
             break;
         }
-        // if there is an image to update, it will be updated
-        if (currentImage->installedVersion != currentImage->version) {
-            Log_Debug("Updating image %s (%zu/%zu) from version %zu to version %zu.\n",
-                      currentImage->datPathname, nextImageIndex, numberOfImages,
-                      currentImage->installedVersion, currentImage->version);
-            dts.state = DfuState_InitPacketStart;
+        // if there is an image to update, it will be updated. If the contents of the installed
+        // image are known, they decide whether it is updated, rather than its version.
+        bool needsUpdate = dts->currentImage->installedVersion != dts->currentImage->version;
+        uint32_t installedCrc32;
+        uint32_t imageCrc32;
+        if (ImageRecords_GetInstalledCrc(TargetIndex(), (uint8_t)dts->currentImage->firmwareType,
+                                         dts->currentImage->installedVersion,
+                                         dts->currentImage->installedSize, &installedCrc32) &&
+            CalcFileCrc32(dts->currentImage->binPathname, &imageCrc32)) {
+            if (needsUpdate && installedCrc32 == imageCrc32) {
+                Log_Debug("Image %s (%zu/%zu) is identical to the installed image.\n",
+                          dts->currentImage->datPathname, dts->nextImageIndex,
+                          dts->numberOfImages);
+            } else if (!needsUpdate && installedCrc32 != imageCrc32) {
+                Log_Debug("Image %s (%zu/%zu) differs from the installed image.\n",
+                          dts->currentImage->datPathname, dts->nextImageIndex,
+                          dts->numberOfImages);
+            }
+            needsUpdate = installedCrc32 != imageCrc32;
+        }
+        if (needsUpdate) {
+            // Send the delta update instead of the full image if it patches the installed version.
+            if (dts->currentImage->deltaDatPathname && dts->currentImage->deltaBinPathname &&
+                dts->currentImage->installedVersion == dts->currentImage->deltaBaseVersion) {
+                dts->currentDatPathname = dts->currentImage->deltaDatPathname;
+                dts->currentBinPathname = dts->currentImage->deltaBinPathname;
+                Log_Debug("Updating image %s (%zu/%zu) from version %zu to version %zu with delta "
+                          "%s.\n",
+                          dts->currentImage->datPathname, dts->nextImageIndex, dts->numberOfImages,
+                          dts->currentImage->installedVersion, dts->currentImage->version,
+                          dts->currentDatPathname);
+            } else {
+                Log_Debug("Updating image %s (%zu/%zu) from version %zu to version %zu.\n",
+                          dts->currentImage->datPathname, dts->nextImageIndex, dts->numberOfImages,
+                          dts->currentImage->installedVersion, dts->currentImage->version);
+            }
+            ImageRecords_Forget(TargetIndex(), (uint8_t)dts->currentImage->firmwareType);
+            dts->state = DfuState_InitPacketStart;
             break;
         }
         Log_Debug("Image %s (%zu/%zu) with version %zu doesn't need update.\n",
-                  currentImage->datPathname, nextImageIndex, numberOfImages, currentImage->version);
+                  dts->currentImage->datPathname, dts->nextImageIndex, dts->numberOfImages,
+                  dts->currentImage->version);
     }
 
     // if no image needs update (including the last image), then the DFU update operation is aborted
-    if (nextImageIndex >= numberOfImages && dts.state != DfuState_InitPacketStart) {
+    if (dts->nextImageIndex >= dts->numberOfImages && dts->state != DfuState_InitPacketStart) {
         Log_Debug("All images are up to date.\n");
         EncodeHeaderAndOptionalPayload(NrfDfuOp_Abort, NULL, 0);
-        dts.state = DfuState_Success;
+        dts->state = DfuState_Success;
         return StateTransition_LaunchWrite;
     }
 
@@ -967,24 +1577,40 @@ static StateTransition HandleInitPacketStart(void)
 static StateTransition HandleInitPacketDoneSelectCommand(void)
 {
     // Open the init packet file and send send it to the nRF52.
-    dts.fv = OpenFileView(currentImage->datPathname, dts.maxTxSize);
-    if (!dts.fv) {
+    dts->fv = OpenFileView(dts->currentDatPathname, dts->maxTxSize);
+    if (!dts->fv) {
         Log_Debug("ERROR: Opening file %s failed with error code: %s (%d).\n",
-                  currentImage->datPathname, strerror(errno), errno);
+                  dts->currentDatPathname, strerror(errno), errno);
         return StateTransition_Failed;
     }
 
     // The init packet file must fit within a single transfer.
     off_t fileSize;
-    FileViewFileOffsetSize(dts.fv, NULL, &fileSize);
-    if (fileSize > (off_t)dts.maxTxSize) {
+    FileViewFileOffsetSize(dts->fv, NULL, &fileSize);
+    if (fileSize > (off_t)dts->maxTxSize) {
         return StateTransition_Failed;
     }
 
-    if (!FileViewMoveWindow(dts.fv, 0)) {
+    if (!FileViewMoveWindow(dts->fv, 0)) {
         return StateTransition_Failed;
     }
 
+    // If the attached board already has this init packet, because an earlier transfer of the
+    // image was interrupted, then execute it rather than send it again. Sending it again would
+    // discard the firmware data which the board has already received.
+    const uint8_t *data;
+    off_t extent;
+    FileViewWindow(dts->fv, &data, &extent);
+    if (!dts->resendInitPacket && dts->selectOffset == (uint32_t)fileSize &&
+        dts->runningCrc32 == CalcCrc32(data, (size_t)extent)) {
+        Log_Debug("Init packet %s is already on the board; resuming the transfer.\n",
+                  dts->currentDatPathname);
+        dts->fileTransferContinueState = DfuState_FirmwareStart;
+        return FinishFileViewWindow();
+    }
+
+    // Creating the object discards any init packet and firmware data on the board.
+    dts->runningCrc32 = 0;
     return TransferDataInFileViewWindow(0x1, DfuState_FirmwareStart);
 }
 
@@ -1001,14 +1627,114 @@ static StateTransition HandleFirmwareDoneSelectData(void)
 {
     // The init packet must fit within a single transfer so
     // open the init packet file and move to the start.
-    dts.fv = OpenFileView(currentImage->binPathname, dts.maxTxSize);
-    if (!dts.fv) {
+    dts->fv = OpenFileView(dts->currentBinPathname, dts->maxTxSize);
+    if (!dts->fv) {
         Log_Debug("ERROR: Opening file %s failed with error code: %s (%d).\n",
-                  currentImage->binPathname, strerror(errno), errno);
+                  dts->currentBinPathname, strerror(errno), errno);
+        return StateTransition_Failed;
+    }
+
+    if (dts->selectOffset != 0) {
+        // Firmware data from an interrupted transfer is on the attached board. Resume the
+        // transfer if that data matches the start of the file; the checksum of the start of the
+        // file is calculated on a worker thread.
+        off_t fileSize;
+        FileViewFileOffsetSize(dts->fv, NULL, &fileSize);
+        if ((off_t)dts->selectOffset > fileSize) {
+            return RestartInterruptedImage();
+        }
+
+        dts->resumeChecksumFv = OpenFileView(dts->currentBinPathname, FILE_CRC_WINDOW_SIZE);
+        if (!dts->resumeChecksumFv) {
+            Log_Debug("ERROR: Opening file %s failed with error code: %s (%d).\n",
+                      dts->currentBinPathname, strerror(errno), errno);
+            return StateTransition_Failed;
+        }
+
+        // Objects start at multiples of the maximum object size. If the data ends within an
+        // object, creating the next object discards the part of the object which was received,
+        // so the transfer resumes from the start of that object.
+        off_t remainder = (off_t)(dts->selectOffset % dts->maxTxSize);
+        dts->resumeObjectStart = (off_t)dts->selectOffset - remainder;
+
+        dts->resumeChecksumJob.work = CalculateResumeChecksum;
+        dts->resumeChecksumJob.complete = ResumeChecksumCompleted;
+        dts->resumeChecksumJob.context = dts;
+        if (WorkerPool_Submit(&dts->resumeChecksumJob) == -1) {
+            // Without a worker, calculate the checksum on this thread.
+            CalculateResumeChecksum(dts);
+            dts->state = DfuState_FirmwareCalculatedResumeChecksum;
+            return StateTransition_MoveImmediately;
+        }
+
+        // Do not set next state - that happens in ResumeChecksumCompleted.
+        return StateTransition_WaitAsync;
+    }
+
+    if (!FileViewMoveWindow(dts->fv, 0)) {
         return StateTransition_Failed;
     }
 
-    if (!FileViewMoveWindow(dts.fv, 0)) {
+    return TransferDataInFileViewWindow(0x2, DfuState_PostValidateImage);
+}
+
+// Runs on a worker thread, so it only uses the fields of the transfer state which the event
+// loop's thread does not use until the job has completed.
+static void CalculateResumeChecksum(void *context)
+{
+    struct DeviceTransferState *target = context;
+    target->resumeChecksumSucceeded = CalcFileViewCrc32(
+        target->resumeChecksumFv, target->resumeObjectStart, (off_t)target->selectOffset,
+        &target->resumeObjectStartCrc32, &target->resumeSelectOffsetCrc32);
+}
+
+// Called on the event loop's thread when resumeChecksumJob has completed.
+static void ResumeChecksumCompleted(void *context)
+{
+    dts = context;
+    dts->state = DfuState_FirmwareCalculatedResumeChecksum;
+    MoveToNextDfuState();
+}
+
+// Called when the firmware data on the attached board does not match the image.
+static StateTransition RestartInterruptedImage(void)
+{
+    Log_Debug("Data on the board does not match %s; sending the image again.\n",
+              dts->currentBinPathname);
+    CloseFileView(dts->fv);
+    dts->fv = NULL;
+    dts->resendInitPacket = true;
+    ++dts->stats.retransmits;
+    dts->state = DfuState_InitPacketStart;
+    return StateTransition_MoveImmediately;
+}
+
+// Called on DfuState_FirmwareCalculatedResumeChecksum.
+static StateTransition HandleFirmwareCalculatedResumeChecksum(void)
+{
+    CloseFileView(dts->resumeChecksumFv);
+    dts->resumeChecksumFv = NULL;
+
+    if (!dts->resumeChecksumSucceeded || dts->resumeSelectOffsetCrc32 != dts->runningCrc32) {
+        return RestartInterruptedImage();
+    }
+
+    Log_Debug("Resuming transfer of %s from offset %" PRIu32 ".\n", dts->currentBinPathname,
+              dts->selectOffset);
+
+    // If the data ends at the end of an object, then that object may not have been executed.
+    // Executing it has no effect if it has, so execute it and then continue with the next
+    // object.
+    if (dts->resumeObjectStart == (off_t)dts->selectOffset) {
+        if (!FileViewMoveWindow(dts->fv, (off_t)(dts->selectOffset - dts->maxTxSize))) {
+            return StateTransition_Failed;
+        }
+        dts->fileTransferContinueState = DfuState_PostValidateImage;
+        return FinishFileViewWindow();
+    }
+
+    dts->runningCrc32 = dts->resumeObjectStartCrc32;
+    if (!FileViewMoveWindow(dts->fv, dts->resumeObjectStart)) {
         return StateTransition_Failed;
     }
 
@@ -1022,60 +1748,64 @@ static StateTransition HandleFirmwareDoneSelectData(void)
 static StateTransition LaunchSelect(uint8_t objectType, DfuProtocolStates continueState)
 {
     EncodeHeaderAndPayload(NrfDfuOp_ObjectSelect, &objectType, sizeof(objectType));
-    dts.selectContinueState = continueState;
-    dts.state = DfuState_SelectReceivedSelectResponse;
+    dts->selectContinueState = continueState;
+    dts->state = DfuState_SelectReceivedSelectResponse;
     return StateTransition_LaunchWriteThenRead;
 }
 
 // Called on DfuState_SelectReceivedSelectResponse.
 //
-// On exit from this state, dts.maxTxSize and dts.runningCrc32
-// have been updated with the values in the select response.
+// On exit from this state, dts->maxTxSize, dts->selectOffset and
+// dts->runningCrc32 have been updated with the values in the select response.
 static StateTransition HandleSelectReceivedSelectResponse(void)
 {
     if (!ValidateAndRemoveHeader(NrfDfuOp_ObjectSelect)) {
         return StateTransition_Failed;
     }
 
-    if (MemBufCurSize(dts.decodedRxBuf) != 12) {
+    if (MemBufCurSize(dts->decodedRxBuf) != 12) {
         return StateTransition_Failed;
     }
 
-    dts.maxTxSize = MemBufReadLe32(dts.decodedRxBuf, 0);
-
-    // It only makes sense for offset == 0 at this point because
-    // no file data has been transferred. If the returned value
-    // is not zero then abort. This can happen if the device has
-    // not fully reset since the last file was transferred.
-    uint32_t offset = MemBufReadLe32(dts.decodedRxBuf, 4);
-    if (offset != 0) {
+    dts->maxTxSize = MemBufReadLe32(dts->decodedRxBuf, 0);
+    if (dts->maxTxSize == 0) {
         return StateTransition_Failed;
     }
 
-    dts.runningCrc32 = MemBufReadLe32(dts.decodedRxBuf, 8);
+    // The offset is not zero if the attached board has data from an
+    // earlier transfer which was interrupted. The continue state
+    // decides whether to resume that transfer.
+    dts->selectOffset = MemBufReadLe32(dts->decodedRxBuf, 4);
+    dts->runningCrc32 = MemBufReadLe32(dts->decodedRxBuf, 8);
 
-    dts.state = dts.selectContinueState;
+    dts->state = dts->selectContinueState;
     return StateTransition_MoveImmediately;
 }
 
-// Called on DfuState_FileTransferReceivedCreateResponse.
-static StateTransition TransferDataInFileViewWindow(uint8_t objectType,
-                                                    DfuProtocolStates continueState)
+// Appends a request to create an object which holds the data in the file view.
+static void AppendCreateRequest(uint8_t objectType)
 {
-    // Create an object.
-    // For the init packet, this will be a command object; for the
-    // firmware it will be a data object.
-
     off_t extent;
-    FileViewWindow(dts.fv, /* data */ NULL, &extent);
+    FileViewWindow(dts->fv, /* data */ NULL, &extent);
 
     uint8_t buf[5];
     buf[0] = objectType;
     uint32_t lenLe = htole32((uint32_t)extent);
     memcpy(&buf[1], &lenLe, sizeof(lenLe));
-    EncodeHeaderAndPayload(NrfDfuOp_ObjectCreate, buf, sizeof(buf));
-    dts.fileTransferContinueState = continueState;
-    dts.state = DfuState_FileTransferReceivedCreateResponse;
+    AppendHeaderAndOptionalPayload(NrfDfuOp_ObjectCreate, buf, sizeof(buf));
+}
+
+// Called on DfuState_FileTransferReceivedCreateResponse.
+static StateTransition TransferDataInFileViewWindow(uint8_t objectType,
+                                                    DfuProtocolStates continueState)
+{
+    // Create an object.
+    // For the init packet, this will be a command object; for the
+    // firmware it will be a data object.
+    MemBufReset(dts->txBuf);
+    AppendCreateRequest(objectType);
+    dts->fileTransferContinueState = continueState;
+    dts->state = DfuState_FileTransferReceivedCreateResponse;
     return StateTransition_LaunchWriteThenRead;
 }
 
@@ -1089,10 +1819,14 @@ static StateTransition HandleFileTransferReceivedCreateResponse(void)
     // The SLIP encoding can, in the worst case, double the payload
     // size and then add a terminator, so ensure there is enough space
     // in the MTU-sized buffer.
-    dts.stepSize = (dts.mtu - 1) / 2 - 1;
-    dts.offsetIntoFileView = 0;
+    dts->stepSize = (dts->mtu - 1) / 2 - 1;
+    dts->offsetIntoFileView = 0;
+
+    // The attached board counts write requests for receipt notifications from the
+    // start of each object.
+    dts->fragmentsSinceReceipt = 0;
 
-    dts.state = DfuState_FileTransferSendNextFragmentFromFileView;
+    dts->state = DfuState_FileTransferSendNextFragmentFromFileView;
     return StateTransition_MoveImmediately;
 }
 
@@ -1101,21 +1835,22 @@ static StateTransition HandleFileTransferSendNextFragmentFromFileView(void)
 {
     const uint8_t *data;
     off_t extent;
-    FileViewWindow(dts.fv, &data, &extent);
+    FileViewWindow(dts->fv, &data, &extent);
 
-    off_t bytesToSend = extent - dts.offsetIntoFileView;
-    if (bytesToSend > dts.stepSize) {
-        bytesToSend = dts.stepSize;
+    off_t bytesToSend = extent - dts->offsetIntoFileView;
+    if (bytesToSend > dts->stepSize) {
+        bytesToSend = dts->stepSize;
     }
 
-    dts.fvFragmentLen = bytesToSend;
+    dts->fvFragmentLen = bytesToSend;
 
-    const uint8_t *dataToSend = &data[dts.offsetIntoFileView];
+    const uint8_t *dataToSend = &data[dts->offsetIntoFileView];
     EncodeHeaderAndPayload(NrfDfuOp_ObjectWrite, dataToSend, (size_t)bytesToSend);
 
-    dts.runningCrc32 = CalcCrc32WithSeed(dataToSend, (size_t)bytesToSend, dts.runningCrc32);
+    dts->runningCrc32 = CalcCrc32WithSeed(dataToSend, (size_t)bytesToSend, dts->runningCrc32);
+    dts->stats.bytesWritten += (uint32_t)bytesToSend;
 
-    dts.state = DfuState_FileTransferSentWriteObjectRequest;
+    dts->state = DfuState_FileTransferSentWriteObjectRequest;
     return StateTransition_LaunchWrite;
 }
 
@@ -1124,22 +1859,86 @@ static StateTransition HandleFileTransferSentWriteObjectRequest(void)
 {
     // No response to check.
 
-    dts.offsetIntoFileView += dts.fvFragmentLen;
+    dts->offsetIntoFileView += dts->fvFragmentLen;
+
+    // If the attached board sends a receipt notification after this fragment,
+    // then read and verify it before continuing.
+    ++dts->fragmentsSinceReceipt;
+    if (dts->prn != 0 && dts->fragmentsSinceReceipt == dts->prn) {
+        dts->fragmentsSinceReceipt = 0;
+        dts->state = DfuState_FileTransferReceivedReceiptNotification;
+        return StateTransition_LaunchRead;
+    }
 
     // If data remaining in file view, then send next fragment.
     off_t extent;
-    FileViewWindow(dts.fv, /* data */ NULL, &extent);
-    if (dts.offsetIntoFileView < extent) {
-        dts.state = DfuState_FileTransferSendNextFragmentFromFileView;
+    FileViewWindow(dts->fv, /* data */ NULL, &extent);
+    if (dts->offsetIntoFileView < extent) {
+        dts->state = DfuState_FileTransferSendNextFragmentFromFileView;
         return StateTransition_MoveImmediately;
     }
 
     // Have sent all data in file view, so ask for a checksum.
     EncodeHeaderOnly(NrfDfuOp_CrcGet);
-    dts.state = DfuState_FileTrnasferReceivedWindowChecksumResponse;
+    dts->state = DfuState_FileTrnasferReceivedWindowChecksumResponse;
     return StateTransition_LaunchWriteThenRead;
 }
 
+// Called on DfuState_FileTransferReceivedReceiptNotification.
+static StateTransition HandleFileTransferReceivedReceiptNotification(void)
+{
+    // The notification has the same form as the response to NrfDfuOp_CrcGet.
+    if (!ValidateAndRemoveHeader(NrfDfuOp_CrcGet)) {
+        return StateTransition_Failed;
+    }
+
+    off_t fileOffset;
+    FileViewFileOffsetSize(dts->fv, &fileOffset, /* size */ NULL);
+    if (!ValidateChecksumResponse(fileOffset + dts->offsetIntoFileView)) {
+        return StateTransition_Failed;
+    }
+
+    // If data remaining in file view, then send next fragment.
+    off_t extent;
+    FileViewWindow(dts->fv, /* data */ NULL, &extent);
+    if (dts->offsetIntoFileView < extent) {
+        dts->state = DfuState_FileTransferSendNextFragmentFromFileView;
+        return StateTransition_MoveImmediately;
+    }
+
+    // The notification has verified all the data in the file view,
+    // so there is no need to ask for a checksum.
+    return FinishFileViewWindow();
+}
+
+// Checks whether the offset and CRC in a checksum response or receipt notification,
+// with its header removed, match the data which has been sent.
+static bool ValidateChecksumResponse(off_t expectedOffset)
+{
+    if (MemBufCurSize(dts->decodedRxBuf) < 8) {
+        return false;
+    }
+
+    uint32_t reportedOffset = MemBufReadLe32(dts->decodedRxBuf, 0);
+    uint32_t reportedCrc32 = MemBufReadLe32(dts->decodedRxBuf, 4);
+
+    if (reportedOffset != expectedOffset) {
+        ++dts->stats.checksumMismatches;
+        Log_Debug("ERROR: Board reported offset %u, expected %lld.\n", reportedOffset,
+                  expectedOffset);
+        return false;
+    }
+
+    if (reportedCrc32 != dts->runningCrc32) {
+        ++dts->stats.checksumMismatches;
+        Log_Debug("ERROR: Board reported CRC 0x%08x, expected 0x%08x.\n", reportedCrc32,
+                  dts->runningCrc32);
+        return false;
+    }
+
+    return true;
+}
+
 // DfuState_FileTrnasferReceivedWindowChecksumResponse
 static StateTransition HandleFileTransferReceivedWindowChecksumResponse(void)
 {
@@ -1148,28 +1947,46 @@ static StateTransition HandleFileTransferReceivedWindowChecksumResponse(void)
     }
 
     // Check whether the reported offset and CRC match the expected values.
-    uint32_t reportedOffset = MemBufReadLe32(dts.decodedRxBuf, 0);
-    uint32_t reportedCrc32 = MemBufReadLe32(dts.decodedRxBuf, 4);
-
     // Have just sent another window's worth of data from the
     // file, so ensure the offset matches the expected file position.
 
     off_t fileOffset;
-    FileViewFileOffsetSize(dts.fv, &fileOffset, /* size */ NULL);
+    FileViewFileOffsetSize(dts->fv, &fileOffset, /* size */ NULL);
     off_t windowExtent;
-    FileViewWindow(dts.fv, /* data */ NULL, &windowExtent);
+    FileViewWindow(dts->fv, /* data */ NULL, &windowExtent);
 
-    if (reportedOffset != fileOffset + windowExtent) {
+    if (!ValidateChecksumResponse(fileOffset + windowExtent)) {
         return StateTransition_Failed;
     }
 
-    if (reportedCrc32 != dts.runningCrc32) {
-        return StateTransition_Failed;
-    }
+    return FinishFileViewWindow();
+}
 
+// Called when all the data in the file view has been sent and verified.
+static StateTransition FinishFileViewWindow(void)
+{
     // Send the execute opcode.
     EncodeHeaderOnly(NrfDfuOp_ObjectExecute);
-    dts.state = DfuState_FileTransferReceivedExecuteResponse;
+    dts->state = DfuState_FileTransferReceivedExecuteResponse;
+    dts->createPipelined = false;
+
+    // If a firmware data object follows this one, then send the request to create it
+    // straight after the execute request, rather than waiting for the execute response.
+    off_t fileOffset;
+    off_t fileSize;
+    FileViewFileOffsetSize(dts->fv, &fileOffset, &fileSize);
+    off_t windowExtent;
+    FileViewWindow(dts->fv, /* data */ NULL, &windowExtent);
+
+    if (dts->pipelineObjects && dts->fileTransferContinueState == DfuState_PostValidateImage &&
+        fileOffset + windowExtent < fileSize) {
+        if (!FileViewMoveWindow(dts->fv, fileOffset + windowExtent)) {
+            return StateTransition_Failed;
+        }
+        AppendCreateRequest(0x2);
+        dts->createPipelined = true;
+    }
+
     return StateTransition_LaunchWriteThenRead;
 }
 
@@ -1180,64 +1997,79 @@ static StateTransition HandleFileTransferReceivedExecuteResponse(void)
         return StateTransition_Failed;
     }
 
+    // The request to create the next object was sent with the execute request, and the
+    // file view has already been moved to its data, so read the create response.
+    if (dts->createPipelined) {
+        dts->createPipelined = false;
+        dts->state = DfuState_FileTransferReceivedCreateResponse;
+        return StateTransition_LaunchRead;
+    }
+
     // If there is more data after the file view then move the
     // window and send the next block of data.
     off_t fileOffset;
     off_t fileSize;
-    FileViewFileOffsetSize(dts.fv, &fileOffset, &fileSize);
+    FileViewFileOffsetSize(dts->fv, &fileOffset, &fileSize);
     off_t windowExtent;
-    FileViewWindow(dts.fv, /* data */ NULL, &windowExtent);
+    FileViewWindow(dts->fv, /* data */ NULL, &windowExtent);
 
     if (fileOffset + windowExtent < fileSize) {
-        FileViewMoveWindow(dts.fv, fileOffset + windowExtent);
-        dts.state = DfuState_FileTransferSendNextFragmentFromFileView;
-        dts.offsetIntoFileView = 0;
+        if (!FileViewMoveWindow(dts->fv, fileOffset + windowExtent)) {
+            return StateTransition_Failed;
+        }
+        dts->state = DfuState_FileTransferSendNextFragmentFromFileView;
+        dts->offsetIntoFileView = 0;
         return TransferDataInFileViewWindow(0x2, DfuState_PostValidateImage);
     }
 
-    CloseFileView(dts.fv);
-    dts.fv = NULL;
+    CloseFileView(dts->fv);
+    dts->fv = NULL;
 
-    dts.state = dts.fileTransferContinueState;
+    dts->state = dts->fileTransferContinueState;
     return StateTransition_MoveImmediately;
 }
 
 // Called on DfuState_PostValidateImage.
 //
-// Waits for DFU to postvalidate the updated image.
+// Waits for DFU to postvalidate the updated image. The bootloader resets to activate the image,
+// and answers again once it has been activated, so it is pinged until it has stopped answering
+// and answered again. How long that takes depends on the firmware type.
 static StateTransition HandlePostValidateImage(void)
 {
-    // Finished sending an image update, so wait for postvalidation on DFU side.
-    // the waiting time differs based on the firmware type
-    time_t waitTime = 1;
-    if (currentImage->firmwareType == DfuFirmware_Softdevice) {
-        waitTime = 5;
-    }
-
-    const struct timespec postValidateTimerDuration = {.tv_sec = waitTime, .tv_nsec = 0};
-    if (SetEventLoopTimerOneShot(dts.postValidateTimer, &postValidateTimerDuration) == -1) {
-        return StateTransition_Failed;
-    }
-
-    Log_Debug("Waiting for image %s postvalidation\n", currentImage->datPathname);
-    // Do not set next state - that happens in postValidateTimerExpiredEvent.
-    return StateTransition_WaitAsync;
+    Log_Debug("Waiting for image %s postvalidation\n", dts->currentDatPathname);
+    AwaitReadiness(DfuReadiness_AwaitReset,
+                   dts->currentImage->firmwareType == DfuFirmware_Softdevice
+                       ? POSTVALIDATE_SOFTDEVICE_RESET_TIMEOUT_MS
+                       : POSTVALIDATE_RESET_TIMEOUT_MS);
+    dts->state = DfuState_SendPing;
+    return StateTransition_MoveImmediately;
 }
 
-static void PostValidateTimerEventHandler(EventLoopTimer *timer)
+// Called once the image which was written has been activated.
+static StateTransition FinishPostValidation(void)
 {
-    bool consumed = (ConsumeEventLoopTimerEvent(timer) == 0);
-    dts.state = consumed ? DfuState_Success : DfuState_Failed;
+    dts->state = DfuState_Success;
+
+    // Record the contents of the image which was written, so that it is recognized later. The
+    // running checksum covers the whole file. The result of applying a delta update is not
+    // known, so it is not recorded.
+    ++dts->stats.imagesWritten;
+    if (dts->currentBinPathname == dts->currentImage->binPathname) {
+        ImageRecords_RecordWritten(TargetIndex(), (uint8_t)dts->currentImage->firmwareType,
+                                   dts->runningCrc32);
+    }
 
     // Check if there are images which have to be added or updated.
-    for (size_t i = nextImageIndex; i < numberOfImages && dts.state != DfuState_Failed; ++i) {
-        if (!allImages[i].isInstalled || (allImages[i].installedVersion != allImages[i].version)) {
-            dts.state = DfuState_Start;
+    for (size_t i = dts->nextImageIndex; i < dts->numberOfImages && dts->state != DfuState_Failed;
+         ++i) {
+        const DfuImageData *image = &dts->allImages[i];
+        if (!image->isInstalled || (image->installedVersion != image->version)) {
+            dts->state = DfuState_Start;
             CleanUpStateMachine();
             break;
         }
     }
 
-    MoveToNextDfuState();
+    return StateTransition_MoveImmediately;
 }
 
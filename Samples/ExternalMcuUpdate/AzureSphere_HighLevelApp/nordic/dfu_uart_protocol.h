@@ -47,11 +47,33 @@ typedef struct {
     /// already on the attached board.</summary>
     uint32_t version;
 
+    /// <summary>
+    /// Optional init packet for a delta update, which patches the firmware at
+    /// deltaBaseVersion to produce this version. NULL if there is no delta update.
+    /// </summary>
+    const char *deltaDatPathname;
+
+    /// <summary>
+    /// Optional patch which the attached board's bootloader applies to the installed
+    /// firmware to produce this version. NULL if there is no delta update.
+    /// </summary>
+    const char *deltaBinPathname;
+
+    /// <summary>Version of the firmware which the delta update patches. The delta
+    /// update is sent only if this version is installed on the attached board;
+    /// otherwise the full image is sent.</summary>
+    uint32_t deltaBaseVersion;
+
     /// <summary>Version of the firmware available on the attached board.
     /// If the firmware is not present on the attached board, this field will
     /// have an undetermined value.</summary>
     uint32_t installedVersion;
 
+    /// <summary>Size of the firmware available on the attached board, as
+    /// reported by it. If the firmware is not present on the attached board,
+    /// this field will have an undetermined value.</summary>
+    uint32_t installedSize;
+
     /// <summary>Whether an existing version of the image is present on the nRF52
     /// device.</summary>
     bool isInstalled;
@@ -71,11 +93,51 @@ typedef enum {
     DfuResult_Fail
 } DfuResultStatus;
 
+/// <summary>
+/// Statistics about the last call to ProgramImages for an attached board. They measure the
+/// throughput of the transfer, and how often it had to recover from errors.
+/// </summary>
+typedef struct {
+    /// <summary>Time from the call to ProgramImages until the result handler was invoked,
+    /// in milliseconds.</summary>
+    uint32_t elapsedMs;
+
+    /// <summary>Number of bytes of init packet and firmware data written to the attached
+    /// board.</summary>
+    uint32_t bytesWritten;
+
+    /// <summary>Number of images which were written and postvalidated.</summary>
+    uint32_t imagesWritten;
+
+    /// <summary>Number of times an image was sent again from the start because the data
+    /// which the attached board had received did not match it.</summary>
+    uint32_t retransmits;
+
+    /// <summary>Number of times the attached board reported an offset or CRC which did not
+    /// match the data which had been sent.</summary>
+    uint32_t checksumMismatches;
+
+    /// <summary>Number of times the attached board did not respond in time.</summary>
+    uint32_t timeouts;
+} DfuTransferStats;
+
+/// <summary>Maximum number of attached boards which can be updated.</summary>
+#define DFU_MAX_TARGETS 4
+
+/// <summary>
+/// State about the firmware update of one attached board. Each attached board is
+/// updated independently, so several can be updated at once on the same event loop,
+/// each over its own UART. The client should not directly access member variables.
+/// </summary>
+typedef struct DeviceTransferState DfuTarget;
+
 /// <summary>
 /// When the firmware update completes successfully or otherwise, it invokes
 /// a callback of this type.
+/// <param name="target">Attached board which was being updated.</param>
+/// <param name="statusToReturn">Whether the images were written successfully.</param>
 /// </summary>
-typedef void (*DfuResultHandler)(DfuResultStatus statusToReturn);
+typedef void (*DfuResultHandler)(DfuTarget *target, DfuResultStatus statusToReturn);
 
 /// <summary>
 /// Supply opened file descriptors to the device firmware update protocol.
@@ -85,17 +147,91 @@ typedef void (*DfuResultHandler)(DfuResultStatus statusToReturn);
 /// <param name="openedResetFd">GPIO used to reset attached board.</param>
 /// <param name="openedDfuFd">GPIO used to put attached board into DFU mode.</param>
 /// <param name="eventLoopInstance">EVent loop which is used to be notified of reads and writes.</param>
+/// <returns>The attached board, which is passed to the other functions; or NULL if
+/// DFU_MAX_TARGETS boards have already been supplied.</returns>
+/// </summary>
+DfuTarget *InitUartProtocol(int openedUartFd, int openedResetFd, int openedDfuFd,
+                            EventLoop *eventLoopInstance);
+
+/// <summary>
+/// <para>Sets the packet receipt notification (PRN) interval to use when images are next
+/// written. Fragments of each object are written back-to-back, and the attached board
+/// reports the offset and checksum of the data it has received after every
+/// <paramref name="interval" /> fragments, which are verified as they arrive.</para>
+/// <para>When a notification arrives at the end of an object, it replaces the separate
+/// request for the object's checksum, saving a round trip; so an interval equal to the number
+/// of fragments in an object minimizes the number of round trips. Zero, the default, disables
+/// the notifications, and each object's checksum is requested once it has been written.</para>
+/// <param name="target">Attached board returned by InitUartProtocol.</param>
+/// <param name="interval">Number of fragments between notifications, or zero.</param>
+/// </summary>
+void SetPacketReceiptNotificationInterval(DfuTarget *target, uint16_t interval);
+
+/// <summary>
+/// <para>Sets whether firmware data objects are pipelined when images are next written. When
+/// they are, the request to create each object is sent together with the request to execute
+/// the previous object, and the two responses are read in turn, saving a round trip per
+/// object. The attached board then erases the flash for the next object without waiting for
+/// the app.</para>
+/// <para>Only enable this with a bootloader which answers each execute request before it
+/// handles the next request, as the bootloader in this sample does. It is disabled by
+/// default.</para>
+/// <param name="target">Attached board returned by InitUartProtocol.</param>
+/// <param name="enable">Whether to pipeline data objects.</param>
+/// </summary>
+void SetObjectPipelining(DfuTarget *target, bool enable);
+
+/// <summary>
+/// Reopens the UART to an attached board at a different baud rate. The callback should close
+/// the UART descriptor which the firmware update is using, and open the UART again at the
+/// requested rate. The firmware update uses, but does not clean up, the new descriptor.
+/// <param name="target">Attached board whose UART is reopened.</param>
+/// <param name="baudRate">Baud rate at which to open the UART.</param>
+/// <returns>The new UART descriptor, or -1 if the UART could not be opened at this rate.</returns>
 /// </summary>
-void InitUartProtocol(int openedUartFd, int openedResetFd, int openedDfuFd,
-                      EventLoop *eventLoopInstance);
+typedef int (*DfuUartReopenHandler)(DfuTarget *target, uint32_t baudRate);
+
+/// <summary>
+/// <para>Sets the baud rates to try when images are next written. The attached board's
+/// bootloader listens at a single rate, which is fixed when it is built. Before the transfer,
+/// the UART is reopened at each rate in turn, fastest first, until the attached board answers a
+/// run of pings at that rate without error; the transfer then uses that rate.</para>
+/// <para>If this function is not called, the UART is used at the rate it was opened with.</para>
+/// <param name="target">Attached board returned by InitUartProtocol.</param>
+/// <param name="baudRates">Baud rates to try, fastest first. Not copied, so the array must
+/// remain valid while images are written.</param>
+/// <param name="count">Number of baud rates in baudRates.</param>
+/// <param name="reopenUart">Function which reopens the UART at a baud rate.</param>
+/// </summary>
+void SetUartBaudRates(DfuTarget *target, const uint32_t *baudRates, size_t count,
+                      DfuUartReopenHandler reopenUart);
 
 /// <summary>
 /// Start writing the supplied images to the attached board.  When the
 /// images have been successfully written, or when the operation has failed,
-/// the supplied exit handler will be called.
+/// the supplied exit handler will be called.  Other attached boards can be
+/// updated at the same time, but each needs its own array of images, since the
+/// array records which versions are installed on the attached board.
+/// <param name="target">Attached board returned by InitUartProtocol.</param>
 /// <param name="imagesToWrite">Array of images to write to the attached board.</param>
 /// <param name="imageCount">Number of images in imagesToWrite array.</param>
 /// <param name="exitHandler">Function to invoke when completed successfully or otherwise.</param>
 /// </summary>
-void ProgramImages(DfuImageData *imagesToWrite, size_t imageCount, DfuResultHandler exitHandler);
+void ProgramImages(DfuTarget *target, DfuImageData *imagesToWrite, size_t imageCount,
+                   DfuResultHandler exitHandler);
+
+/// <summary>
+/// Gets statistics about the last call to ProgramImages. They are complete when the result
+/// handler is invoked, and are reset by the next call to ProgramImages.
+/// <param name="target">Attached board returned by InitUartProtocol.</param>
+/// <returns>Statistics which remain owned by the attached board.</returns>
+/// </summary>
+const DfuTransferStats *GetTransferStats(const DfuTarget *target);
+
+/// <summary>
+/// Logs the statistics about the last call to ProgramImages, including how long the state
+/// machine spent in each of its states.
+/// <param name="target">Attached board returned by InitUartProtocol.</param>
+/// </summary>
+void LogTransferStats(const DfuTarget *target);
 
@@ -5,19 +5,36 @@ LICENSE.txt in this directory, and for more background, see the README.md for th
 
 #include "slip.h"
 
+// Returns the length of the run of bytes at the start of the data which
+// are neither END nor ESC, and so are not changed by SLIP encoding.
+static size_t UnescapedRunLength(const uint8_t *data, size_t len)
+{
+    size_t i = 0;
+    while (i < len && data[i] != NRF_SLIP_BYTE_END && data[i] != NRF_SLIP_BYTE_ESC) {
+        ++i;
+    }
+    return i;
+}
+
+size_t SlipEncodedMaxSize(size_t len)
+{
+    return 2 * len;
+}
+
 void SlipEncodeAppend(MemBuf *encBuf, const uint8_t *data, size_t len)
 {
-    for (size_t i = 0; i < len; ++i) {
-        uint8_t elem = data[i];
-
-        if (elem == NRF_SLIP_BYTE_END) {
-            MemBufAppend8(encBuf, NRF_SLIP_BYTE_ESC);
-            MemBufAppend8(encBuf, NRF_SLIP_BYTE_ESC_END);
-        } else if (elem == NRF_SLIP_BYTE_ESC) {
-            MemBufAppend8(encBuf, NRF_SLIP_BYTE_ESC);
-            MemBufAppend8(encBuf, NRF_SLIP_BYTE_ESC_ESC);
-        } else {
-            MemBufAppend8(encBuf, elem);
+    size_t i = 0;
+    while (i < len) {
+        size_t runLength = UnescapedRunLength(&data[i], len - i);
+        MemBufAppend(encBuf, &data[i], runLength);
+        i += runLength;
+
+        if (i < len) {
+            uint8_t escaped[2] = {NRF_SLIP_BYTE_ESC, (data[i] == NRF_SLIP_BYTE_END)
+                                                         ? NRF_SLIP_BYTE_ESC_END
+                                                         : NRF_SLIP_BYTE_ESC_ESC};
+            MemBufAppend(encBuf, escaped, sizeof(escaped));
+            ++i;
         }
     }
 }
@@ -65,3 +82,31 @@ void SlipDecodeAddByte(uint8_t b, MemBuf *decBuf, NrfSlipDecodeState *state, boo
         break;
     }
 }
+
+size_t SlipDecodeAppend(const uint8_t *data, size_t len, MemBuf *decBuf,
+                        NrfSlipDecodeState *state, bool *finished)
+{
+    *finished = false;
+
+    size_t i = 0;
+    while (i < len) {
+        if (*state == NRF_SLIP_STATE_DECODING) {
+            size_t runLength = UnescapedRunLength(&data[i], len - i);
+            MemBufAppend(decBuf, &data[i], runLength);
+            i += runLength;
+
+            if (i == len) {
+                break;
+            }
+        }
+
+        SlipDecodeAddByte(data[i], decBuf, state, finished);
+        ++i;
+
+        if (*finished || *state == NRF_SLIP_STATE_CLEARING_INVALID_PACKET) {
+            break;
+        }
+    }
+
+    return i;
+}
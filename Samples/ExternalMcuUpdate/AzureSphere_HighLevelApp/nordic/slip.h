@@ -35,7 +35,17 @@ typedef enum {
 } NrfSlipDecodeState;
 
 /// <summary>
-/// Append multiple bytes to the SLIP-encoded buffer.
+/// Gets the largest size to which a block of data can grow when it is SLIP-encoded,
+/// which is when every byte has to be escaped.  This does not include the end marker.
+/// <param name="len">Length of unencoded data in bytes.</param>
+/// <returns>Maximum length of the encoded data in bytes.</returns>
+/// </summary>
+size_t SlipEncodedMaxSize(size_t len);
+
+/// <summary>
+/// Append multiple bytes to the SLIP-encoded buffer.  Runs of bytes which do not
+/// need to be escaped are copied in bulk.  The buffer must have space for
+/// SlipEncodedMaxSize(len) bytes, unless the caller knows the data encodes to less.
 /// <param name="encBuf">Buffer which contains SLIP-encoded data.</param>
 /// <param name="data">Start of data to encode and append to buffer.</param>
 /// <param name="len">Length of unencoded data in bytes.</param>
@@ -58,3 +68,20 @@ void SlipEncodeAddEndMarker(MemBuf *encBuf);
 /// <param name="finished">Set to true if reached end of packet, false otherwise.</param>
 /// </summary>
 void SlipDecodeAddByte(uint8_t b, MemBuf *decBuf, NrfSlipDecodeState *state, bool *finished);
+
+/// <summary>
+/// Process a block of SLIP-encoded bytes and add them to the buffer which
+/// contains decoded data.  Runs of bytes which are not escaped are copied in bulk.
+/// Decoding stops after the end of a packet, or at a byte which is not validly
+/// escaped, so that any following bytes can be processed separately.
+/// <param name="data">Start of encoded data.</param>
+/// <param name="len">Length of encoded data in bytes.  The decoded buffer must have
+/// space for this many bytes.</param>
+/// <param name="decBuf">Buffer which contains decoded data.</param>
+/// <param name="state">Keeps track of whether in escaped sequence or
+/// processing invalid data.</param>
+/// <param name="finished">Set to true if reached end of packet, false otherwise.</param>
+/// <returns>Number of encoded bytes which were processed.</returns>
+/// </summary>
+size_t SlipDecodeAppend(const uint8_t *data, size_t len, MemBuf *decBuf,
+                        NrfSlipDecodeState *state, bool *finished);
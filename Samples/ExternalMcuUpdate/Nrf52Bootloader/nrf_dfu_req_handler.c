@@ -551,9 +551,17 @@ static void on_data_obj_execute_request_sched(void * p_evt, uint16_t event_lengt
 
     ret_code_t          ret;
     nrf_dfu_request_t * p_req = (nrf_dfu_request_t *)(p_evt);
-
-    /* Wait for all buffers to be written in flash. */
-    if (nrf_fstorage_is_busy(NULL))
+    bool const          image_received =
+        (s_dfu_settings.progress.firmware_image_offset == m_firmware_size_req);
+
+    /* Wait for all buffers to be written in flash before the whole image is postvalidated.
+     * Other objects are executed without waiting, so that their data is programmed while the
+     * next object is received. fstorage executes operations in the order they are queued, so
+     * the erase for the next object and any progress saved below follow this object's data.
+     * Because the response is sent before the next request is handled, the peer may send the
+     * request to create the next object together with this request.
+     */
+    if (image_received && nrf_fstorage_is_busy(NULL))
     {
         ret = app_sched_event_put(p_req, sizeof(nrf_dfu_request_t), on_data_obj_execute_request_sched);
         if (ret != NRF_SUCCESS)
@@ -568,7 +576,7 @@ static void on_data_obj_execute_request_sched(void * p_evt, uint16_t event_lengt
         .request = NRF_DFU_OP_OBJECT_EXECUTE,
     };
 
-    if (s_dfu_settings.progress.firmware_image_offset == m_firmware_size_req)
+    if (image_received)
     {
         NRF_LOG_DEBUG("Whole firmware image received. Postvalidating.");
 
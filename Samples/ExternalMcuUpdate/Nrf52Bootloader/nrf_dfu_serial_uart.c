@@ -0,0 +1,295 @@
+/**
+ * This code is based on a sample from Nordic Semiconductor ASA (see license below),
+ * with modifications made by Microsoft (see the README.md in this directory).
+ *
+ * Modified version of secure_bootloader\pca10040_uart_debug example from Nordic nRF5 SDK version 15.2.0
+ * (https://developer.nordicsemi.com/nRF5_SDK/nRF5_SDK_v15.x.x/nRF5_SDK_15.2.0_9412b96.zip)
+ *
+ * Original file: {SDK_ROOT}\components\libraries\bootloader\serial_dfu\nrf_dfu_serial_uart.c
+ **/
+
+/**
+ * Copyright (c) 2016 - 2018, Nordic Semiconductor ASA
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form, except as embedded into a Nordic
+ *    Semiconductor ASA integrated circuit in a product or a software update for
+ *    such product, must reproduce the above copyright notice, this list of
+ *    conditions and the following disclaimer in the documentation and/or other
+ *    materials provided with the distribution.
+ *
+ * 3. Neither the name of Nordic Semiconductor ASA nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * 4. This software, with or without modification, must only be used with a
+ *    Nordic Semiconductor ASA integrated circuit.
+ *
+ * 5. Any software provided in binary form under this license must not be reverse
+ *    engineered, decompiled, modified and/or disassembled.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NORDIC SEMICONDUCTOR ASA "AS IS" AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY, NONINFRINGEMENT, AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL NORDIC SEMICONDUCTOR ASA OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "nrf_dfu_serial.h"
+
+#include <string.h>
+
+#include "boards.h"
+#include "app_util_platform.h"
+#include "nrf_dfu_transport.h"
+#include "nrf_dfu_req_handler.h"
+#include "slip.h"
+#include "nrf_balloc.h"
+#include "nrf_drv_uart.h"
+
+#define NRF_LOG_MODULE_NAME nrf_dfu_serial_uart
+#include "nrf_log.h"
+NRF_LOG_MODULE_REGISTER();
+
+/**@file
+ *
+ * @defgroup nrf_dfu_serial_uart DFU Serial UART transport
+ * @ingroup  nrf_dfu
+ * @brief    Device Firmware Update (DFU) transport layer using UART.
+ *
+ * Bytes are received through EasyDMA into two one-byte buffers. While one byte is being
+ * decoded, the UARTE is already receiving into the other buffer, so that no byte has to wait
+ * for the interrupt handler to restart reception. SLIP packets have no length, so bytes are
+ * not received in larger blocks: the end of a packet must be seen as soon as it arrives.
+ *
+ * Each packet is decoded directly into a buffer from a pool, which is handed to the request
+ * handler when the packet ends. Packets may hold up to NRF_DFU_SERIAL_UART_RX_BUF_SIZE bytes
+ * of payload, which is reported to the peer through the MTU, so that firmware data is written
+ * in fewer, larger requests.
+ */
+
+#define NRF_SERIAL_OPCODE_SIZE          (sizeof(uint8_t))
+#define NRF_UART_MAX_RESPONSE_SIZE_SLIP (2 * NRF_SERIAL_MAX_RESPONSE_SIZE + 1)
+#define RX_BUF_SIZE                     (NRF_DFU_SERIAL_UART_RX_BUF_SIZE)
+#define OPCODE_OFFSET                   (sizeof(uint32_t) - NRF_SERIAL_OPCODE_SIZE)
+#define DATA_OFFSET                     (OPCODE_OFFSET + NRF_SERIAL_OPCODE_SIZE)
+#define UART_SLIP_MTU                   (2 * (RX_BUF_SIZE + 1) + 1)
+#define BALLOC_BUF_SIZE                 (OPCODE_OFFSET + NRF_SERIAL_OPCODE_SIZE + RX_BUF_SIZE)
+
+/* Keeps the pool's buffers, and so the data in them, word-aligned. */
+STATIC_ASSERT((RX_BUF_SIZE % sizeof(uint32_t)) == 0);
+
+/* The payload of write requests starts DATA_OFFSET bytes into each buffer, so that it is
+ * word-aligned for flash writes. */
+NRF_BALLOC_DEF(m_payload_pool, BALLOC_BUF_SIZE, NRF_DFU_SERIAL_UART_RX_BUFFERS);
+
+static nrf_drv_uart_t m_uart = NRF_DRV_UART_INSTANCE(0);
+static uint8_t        m_rx_bytes[2]; /**< EasyDMA buffers which bytes are received into, in turn. */
+static uint8_t *      m_p_rx_buf;    /**< Buffer which the current packet is decoded into. */
+
+static nrf_dfu_serial_t m_serial;
+static slip_t           m_slip;
+static uint8_t          m_rsp_buf[NRF_UART_MAX_RESPONSE_SIZE_SLIP];
+static bool             m_active;
+
+static nrf_dfu_observer_t m_observer;
+
+static uint32_t uart_dfu_transport_init(nrf_dfu_observer_t observer);
+static uint32_t uart_dfu_transport_close(nrf_dfu_transport_t const * p_exception);
+
+DFU_TRANSPORT_REGISTER(nrf_dfu_transport_t const uart_dfu_transport) =
+{
+    .init_func  = uart_dfu_transport_init,
+    .close_func = uart_dfu_transport_close,
+};
+
+
+static void payload_free(void * p_buf)
+{
+    uint8_t * p_buf_root = (uint8_t *)p_buf - DATA_OFFSET; // Pointer is shifted to point to data.
+    nrf_balloc_free(&m_payload_pool, p_buf_root);
+}
+
+
+static ret_code_t rsp_send(uint8_t const * p_data, uint32_t length)
+{
+    uint32_t slip_len;
+    (void) slip_encode(m_rsp_buf, (uint8_t *)p_data, length, &slip_len);
+
+    return nrf_drv_uart_tx(&m_uart, m_rsp_buf, slip_len);
+}
+
+
+static void slip_reset(uint8_t * p_rx_buf)
+{
+    m_p_rx_buf           = p_rx_buf;
+    m_slip.p_buffer      = &p_rx_buf[OPCODE_OFFSET];
+    m_slip.current_index = 0;
+    m_slip.buffer_len    = NRF_SERIAL_OPCODE_SIZE + RX_BUF_SIZE;
+    m_slip.state         = SLIP_STATE_DECODING;
+}
+
+
+static void on_rx_complete(void)
+{
+    /* Zero length packets are valid for SLIP; decode the next packet into the same buffer. */
+    if (m_slip.current_index == 0)
+    {
+        slip_reset(m_p_rx_buf);
+        return;
+    }
+
+    /* Take the next buffer before handing this one over. If none is free because flash writes
+     * are still pending, drop the packet, so that the peer detects a CRC error and retransmits
+     * the object, and keep decoding into the same buffer.
+     */
+    uint8_t * p_next_buf = nrf_balloc_alloc(&m_payload_pool);
+    if (p_next_buf == NULL)
+    {
+        NRF_LOG_ERROR("No free RX buffer, dropping packet");
+        slip_reset(m_p_rx_buf);
+        return;
+    }
+
+    /* The serial layer frees the buffer, once the request has been handled. */
+    ret_code_t ret_code = nrf_dfu_serial_on_packet_received(&m_serial,
+                                                            m_slip.p_buffer,
+                                                            m_slip.current_index);
+    if (ret_code != NRF_SUCCESS)
+    {
+        NRF_LOG_ERROR("Failed to handle packet: 0x%x", ret_code);
+    }
+
+    slip_reset(p_next_buf);
+}
+
+
+static void rx_start(void)
+{
+    /* The second call sets the buffer which the UARTE switches to when the first is full. */
+    (void)nrf_drv_uart_rx(&m_uart, &m_rx_bytes[0], 1);
+    (void)nrf_drv_uart_rx(&m_uart, &m_rx_bytes[1], 1);
+}
+
+
+static void uart_event_handler(nrf_drv_uart_event_t * p_event, void * p_context)
+{
+    switch (p_event->type)
+    {
+        case NRF_DRV_UART_EVT_RX_DONE:
+        {
+            uint8_t * p_rx_byte = p_event->data.rxtx.p_data;
+
+            if (slip_decode_add_byte(&m_slip, *p_rx_byte) == NRF_SUCCESS)
+            {
+                on_rx_complete();
+            }
+
+            /* Queue this buffer again behind the one which the UARTE is receiving into. */
+            (void)nrf_drv_uart_rx(&m_uart, p_rx_byte, 1);
+        }
+        break;
+
+        case NRF_DRV_UART_EVT_ERROR:
+        {
+            /* The driver has stopped receiving; discard the partial packet and restart. */
+            NRF_LOG_WARNING("UART error 0x%x", p_event->data.error.error_mask);
+            slip_reset(m_p_rx_buf);
+            rx_start();
+        }
+        break;
+
+        case NRF_DRV_UART_EVT_TX_DONE:
+            break;
+
+        default:
+            NRF_LOG_ERROR("Unknown event id: %d.", p_event->type);
+            break;
+    }
+}
+
+
+static uint32_t uart_dfu_transport_init(nrf_dfu_observer_t observer)
+{
+    uint32_t err_code = NRF_SUCCESS;
+
+    if (m_active)
+    {
+        return err_code;
+    }
+
+    NRF_LOG_DEBUG("serial_dfu_transport_init()");
+
+    m_observer = observer;
+
+    err_code = nrf_balloc_init(&m_payload_pool);
+    if (err_code != NRF_SUCCESS)
+    {
+        return err_code;
+    }
+
+    slip_reset(nrf_balloc_alloc(&m_payload_pool));
+
+    m_serial.rsp_func              = rsp_send;
+    m_serial.payload_free_func     = payload_free;
+    m_serial.mtu                   = UART_SLIP_MTU;
+    m_serial.p_rsp_buf             = &m_rsp_buf[NRF_UART_MAX_RESPONSE_SIZE_SLIP -
+                                                NRF_SERIAL_MAX_RESPONSE_SIZE];
+    m_serial.p_low_level_transport = &uart_dfu_transport;
+
+    nrf_drv_uart_config_t uart_config = NRF_DRV_UART_DEFAULT_CONFIG;
+
+    uart_config.pseltxd      = TX_PIN_NUMBER;
+    uart_config.pselrxd      = RX_PIN_NUMBER;
+    uart_config.pselcts      = CTS_PIN_NUMBER;
+    uart_config.pselrts      = RTS_PIN_NUMBER;
+    uart_config.hwfc         = NRF_DFU_SERIAL_UART_USES_HWFC ?
+                                   NRF_UART_HWFC_ENABLED : NRF_UART_HWFC_DISABLED;
+    uart_config.use_easy_dma = true;
+    uart_config.p_context    = &m_serial;
+
+    err_code = nrf_drv_uart_init(&m_uart, &uart_config, uart_event_handler);
+    if (err_code != NRF_SUCCESS)
+    {
+        NRF_LOG_ERROR("Failed initializing uart");
+        return err_code;
+    }
+
+    rx_start();
+
+    NRF_LOG_DEBUG("serial_dfu_transport_init() completed, MTU %d", UART_SLIP_MTU);
+
+    m_active = true;
+
+    if (m_observer)
+    {
+        m_observer(NRF_DFU_EVT_TRANSPORT_ACTIVATED);
+    }
+
+    return err_code;
+}
+
+
+static uint32_t uart_dfu_transport_close(nrf_dfu_transport_t const * p_exception)
+{
+    if ((m_active == true) && (p_exception != &uart_dfu_transport))
+    {
+        nrf_drv_uart_uninit(&m_uart);
+        m_active = false;
+    }
+
+    return NRF_SUCCESS;
+}
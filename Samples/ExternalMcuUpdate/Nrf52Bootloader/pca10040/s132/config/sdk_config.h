@@ -1115,6 +1115,15 @@
 #define NRF_DFU_SERIAL_UART_RX_BUFFERS 3
 #endif
 
+// <o> NRF_DFU_SERIAL_UART_RX_BUF_SIZE - Maximum payload size of a packet, in bytes.
+// <i> The MTU which is reported to the peer allows for packets with this much
+// <i> payload, so that firmware data is written in fewer requests. Each RX buffer
+// <i> holds one packet. Must be a multiple of 4.
+
+#ifndef NRF_DFU_SERIAL_UART_RX_BUF_SIZE
+#define NRF_DFU_SERIAL_UART_RX_BUF_SIZE 256
+#endif
+
 // </h>
 //==========================================================
 
@@ -1501,8 +1510,12 @@
 // <251658240=> 921600 baud
 // <268435456=> 1000000 baud
 
+// The DFU serial transport uses this rate. The Azure Sphere app probes for the fastest rate at
+// which it can communicate with the bootloader, so it also works with bootloaders which use
+// 115200 baud.
+
 #ifndef UART_DEFAULT_CONFIG_BAUDRATE
-#define UART_DEFAULT_CONFIG_BAUDRATE 30801920
+#define UART_DEFAULT_CONFIG_BAUDRATE 268435456
 #endif
 
 // <o> UART_DEFAULT_CONFIG_IRQ_PRIORITY  - Interrupt priority
@@ -40,6 +40,7 @@
 
 // This sample uses a single-thread event loop pattern.
 #include "eventloop_timer_utilities.h"
+#include "button_input.h"
 
 /// <summary>
 /// Termination codes for this application. These are used for the
@@ -54,27 +55,27 @@ typedef enum {
     ExitCode_LedTimer_Consume = 2,
     ExitCode_LedTimer_SetLedState = 3,
 
-    ExitCode_ButtonTimer_Consume = 4,
-    ExitCode_ButtonTimer_GetButtonState = 5,
-    ExitCode_ButtonTimer_SetBlinkPeriod = 6,
+    ExitCode_Buttons_Timer = 4,
+    ExitCode_Buttons_GetButtonState = 5,
+    ExitCode_ButtonPress_SetBlinkPeriod = 6,
 
     ExitCode_Init_EventLoop = 7,
     ExitCode_Init_Button = 8,
-    ExitCode_Init_ButtonPollTimer = 9,
+    ExitCode_Init_Buttons = 9,
     ExitCode_Init_Led = 10,
     ExitCode_Init_LedBlinkTimer = 11,
-    ExitCode_Main_EventLoopFail = 12
+    ExitCode_Main_EventLoopFail = 12,
+    ExitCode_Init_AddButton = 13
 } ExitCode;
 
 // File descriptors - initialized to invalid value
 static EventLoop *eventLoop = NULL;
 static int ledBlinkRateButtonGpioFd = -1;
-static EventLoopTimer *buttonPollTimer = NULL;
+static ButtonInput *buttons = NULL;
 static int blinkingLedGpioFd = -1;
 static EventLoopTimer *blinkTimer = NULL;
 
-// Button state variables
-static GPIO_Value_Type buttonState = GPIO_Value_High;
+// LED state variables
 static GPIO_Value_Type ledState = GPIO_Value_High;
 
 // Blink interval variables
@@ -89,7 +90,9 @@ static volatile sig_atomic_t exitCode = ExitCode_Success;
 
 static void TerminationHandler(int signalNumber);
 static void BlinkingLedTimerEventHandler(EventLoopTimer *timer);
-static void ButtonTimerEventHandler(EventLoopTimer *timer);
+static void ButtonEventHandler(int gpioFd, ButtonInput_Event event, unsigned int count,
+                               void *context);
+static void ButtonsErrorHandler(int gpioFd, void *context);
 static ExitCode InitPeripheralsAndHandlers(void);
 static void CloseFdAndPrintError(int fd, const char *fdName);
 static void ClosePeripheralsAndHandlers(void);
@@ -125,35 +128,27 @@ static void BlinkingLedTimerEventHandler(EventLoopTimer *timer)
 }
 
 /// <summary>
-///     Handle button timer event: if the button is pressed, change the LED blink rate.
+///     Handle button press: change the LED blink rate.
 /// </summary>
-static void ButtonTimerEventHandler(EventLoopTimer *timer)
+static void ButtonEventHandler(int gpioFd, ButtonInput_Event event, unsigned int count,
+                               void *context)
 {
-    if (ConsumeEventLoopTimerEvent(timer) != 0) {
-        exitCode = ExitCode_ButtonTimer_Consume;
+    if (event != ButtonInput_Event_Pressed) {
         return;
     }
 
-    // Check for a button press
-    GPIO_Value_Type newButtonState;
-    int result = GPIO_GetValue(ledBlinkRateButtonGpioFd, &newButtonState);
-    if (result != 0) {
-        Log_Debug("ERROR: Could not read button GPIO: %s (%d).\n", strerror(errno), errno);
-        exitCode = ExitCode_ButtonTimer_GetButtonState;
-        return;
+    blinkIntervalIndex = (blinkIntervalIndex + 1) % numBlinkIntervals;
+    if (SetEventLoopTimerPeriod(blinkTimer, &blinkIntervals[blinkIntervalIndex]) != 0) {
+        exitCode = ExitCode_ButtonPress_SetBlinkPeriod;
     }
+}
 
-    // If the button has just been pressed, change the LED blink interval
-    // The button has GPIO_Value_Low when pressed and GPIO_Value_High when released
-    if (newButtonState != buttonState) {
-        if (newButtonState == GPIO_Value_Low) {
-            blinkIntervalIndex = (blinkIntervalIndex + 1) % numBlinkIntervals;
-            if (SetEventLoopTimerPeriod(blinkTimer, &blinkIntervals[blinkIntervalIndex]) != 0) {
-                exitCode = ExitCode_ButtonTimer_SetBlinkPeriod;
-            }
-        }
-        buttonState = newButtonState;
-    }
+/// <summary>
+///     Handle failure to sample the button.
+/// </summary>
+static void ButtonsErrorHandler(int gpioFd, void *context)
+{
+    exitCode = (gpioFd == -1) ? ExitCode_Buttons_Timer : ExitCode_Buttons_GetButtonState;
 }
 
 /// <summary>
@@ -176,18 +171,20 @@ static ExitCode InitPeripheralsAndHandlers(void)
         return ExitCode_Init_EventLoop;
     }
 
-    // Open SAMPLE_BUTTON_1 GPIO as input, and set up a timer to poll it
+    // Open SAMPLE_BUTTON_1 GPIO as input, and be notified when it is pressed
     Log_Debug("Opening SAMPLE_BUTTON_1 as input.\n");
     ledBlinkRateButtonGpioFd = GPIO_OpenAsInput(SAMPLE_BUTTON_1);
     if (ledBlinkRateButtonGpioFd == -1) {
         Log_Debug("ERROR: Could not open SAMPLE_BUTTON_1: %s (%d).\n", strerror(errno), errno);
         return ExitCode_Init_Button;
     }
-    struct timespec buttonPressCheckPeriod = {.tv_sec = 0, .tv_nsec = 1000000};
-    buttonPollTimer =
-        CreateEventLoopPeriodicTimer(eventLoop, &ButtonTimerEventHandler, &buttonPressCheckPeriod);
-    if (buttonPollTimer == NULL) {
-        return ExitCode_Init_ButtonPollTimer;
+    // The button input engine debounces the button, and samples it slowly while it is idle.
+    buttons = ButtonInput_Create(eventLoop, NULL, &ButtonsErrorHandler, NULL);
+    if (buttons == NULL) {
+        return ExitCode_Init_Buttons;
+    }
+    if (ButtonInput_Add(buttons, ledBlinkRateButtonGpioFd, &ButtonEventHandler, NULL) != 0) {
+        return ExitCode_Init_AddButton;
     }
 
     // Open SAMPLE_LED GPIO, set as output with value GPIO_Value_High (off), and set up a timer to
@@ -232,7 +229,7 @@ static void ClosePeripheralsAndHandlers(void)
         GPIO_SetValue(blinkingLedGpioFd, GPIO_Value_High);
     }
 
-    DisposeEventLoopTimer(buttonPollTimer);
+    ButtonInput_Dispose(buttons);
     DisposeEventLoopTimer(blinkTimer);
     EventLoop_Close(eventLoop);
 
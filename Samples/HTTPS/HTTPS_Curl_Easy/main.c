@@ -3,29 +3,39 @@
 
 // This sample C application for Azure Sphere periodically downloads and outputs the index web page
 // at example.com, by using cURL over a secure HTTPS connection.
-// It uses the cURL 'easy' API which is a synchronous (blocking) API.
+// It uses the shared HTTPS client with its cURL backend, which runs the download on the event loop
+// without blocking it, and keeps the connection open between the periodic downloads.
+// The page is cached in mutable storage, and downloads of it are made conditional on the cached
+// copy's ETag and Last-Modified date, so that an unchanged page is not downloaded again.
 //
 // It uses the following Azure Sphere libraries:
 // - log (messages shown in Visual Studio's Device Output window during debugging);
 // - storage (device storage interaction);
-// - curl (URL transfer library).
+// - curl (URL transfer library), through the HTTPS client library.
 // - eventloop (system invokes handlers for timer events)
 
 #include <errno.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <string.h>
+#include <strings.h>
 #include <stdlib.h>
 #include <signal.h>
 
-#include <curl/curl.h>
-
 // applibs_versions.h defines the API struct versions to use for applibs APIs.
 #include "applibs_versions.h"
 #include <applibs/log.h>
 #include <applibs/networking.h>
-#include <applibs/storage.h>
 
 #include "eventloop_timer_utilities.h"
+#include "https_client.h"
+#include "response_cache.h"
+#include "mem_pool.h"
+#include "network_state.h"
+
+#ifdef EVENT_TRACE
+#include "event_trace.h"
+#endif
 
 /// <summary>
 /// Exit codes for this application. These are used for the
@@ -39,29 +49,63 @@ typedef enum {
     ExitCode_Init_EventLoop = 3,
     ExitCode_Init_DownloadTimer = 4,
     ExitCode_Main_EventLoopFail = 5,
-    ExitCode_InterfaceConnectionStatus_Failed = 6
+    ExitCode_InterfaceConnectionStatus_Failed = 6,
+    ExitCode_Init_MemPool = 7,
+    ExitCode_Init_NetworkState = 8,
+    ExitCode_Init_HttpsClient = 9
 } ExitCode;
 
 static void TerminationHandler(int signalNumber);
-static size_t StoreDownloadedDataCallback(void *chunks, size_t chunkSize, size_t chunksCount,
-                                          void *memoryBlock);
-static void LogCurlError(const char *message, int curlErrCode);
+static bool StoreDownloadedDataHandler(const uint8_t *data, size_t size, void *context);
+static void StoreValidatorsHandler(const char *name, const char *value, void *context);
+static void DownloadCompletedHandler(HttpsClient_Result result, const HttpsClient_Metrics *metrics,
+                                     void *context);
 static void PrintResponse(const char *data, size_t actualLength, size_t maxPrintLength);
+static bool CreateConditionalRequestHeaders(const ResponseCache_Validators *cached, char *headers,
+                                            size_t headersSize);
 static void PerformWebPageDownload(void);
 static void TimerEventHandler(EventLoopTimer *timer);
 static ExitCode InitHandlers(void);
 static void CloseHandlers(void);
-static bool IsNetworkInterfaceConnectedToInternet(void);
+static void NetworkStateChangedHandler(Networking_InterfaceConnectionStatus status, void *context);
+static void NetworkStateErrorHandler(void *context);
 
 static EventLoop *eventLoop = NULL;
 static EventLoopTimer *downloadTimer = NULL;
 static const char networkInterface[] = "wlan0";
 
+// The URL of the web page to download.
+// Important: any change in the domain name must be reflected in the AllowedConnections
+// capability in app_manifest.json.
+static const char downloadUrl[] = "https://example.com";
+
+// The HTTPS client keeps the connection to the server open between downloads, so that each
+// download after the first is sent without a TCP or TLS handshake.
+static const HttpsClient_Config httpsClientConfig = {
+    .backend = HttpsClient_Backend_Curl,
+    // The DigiCertGlobalRootCA.pem file is the certificate that is used to verify the server
+    // identity.
+    .caCertificatePath = "certs/DigiCertGlobalRootCA.pem",
+    .userAgent = "libcurl-agent/1.0",
+    .maxIdleConnections = 1};
+
 static volatile sig_atomic_t exitCode = ExitCode_Success;
 
 // The maximum number of characters which are printed from the HTTP response body.
 static const size_t maxResponseCharsToPrint = 2048;
 
+// The page, the cached copy of it and the timer are allocated from a fixed-size pool rather than
+// the heap, so the memory which a download uses is reserved when the app starts, and cannot be
+// lost to fragmentation over many downloads. As the page arrives, it moves up through the larger
+// blocks, and so pages of up to 16 KB can be downloaded, which is as large as the cache stores.
+static const MemPool_SizeClass memPoolClasses[] = {
+    {64, 8}, {512, 2}, {2048, 2}, {8192, 1}, {16384, 1}};
+static uint64_t memPoolArena[(MEM_POOL_CLASS_SIZE(64, 8) + MEM_POOL_CLASS_SIZE(512, 2) +
+                              MEM_POOL_CLASS_SIZE(2048, 2) + MEM_POOL_CLASS_SIZE(8192, 1) +
+                              MEM_POOL_CLASS_SIZE(16384, 1)) /
+                             sizeof(uint64_t)];
+static MemPool_Subsystem downloadMemory = MEM_POOL_SUBSYSTEM("Download");
+
 /// <summary>
 ///     Signal handler for termination requests. This handler must be async-signal-safe.
 /// </summary>
@@ -72,76 +116,190 @@ static void TerminationHandler(int signalNumber)
 }
 
 /// <summary>
-///     Data pointer and size of a block of memory allocated on the heap.
+///     Data pointer and size of a block of memory allocated from the memory pool.
 /// </summary>
 typedef struct {
     char *data;
     size_t size;
 } MemoryBlock;
 
+// The download in progress: the body received so far, and the validators which the server has
+// sent with it.
+static bool downloadInProgress = false;
+static MemoryBlock downloadedBlock = {.data = NULL, .size = 0};
+static ResponseCache_Validators receivedValidators;
+
 /// <summary>
-///     Callback for curl_easy_perform() that copies all the downloaded chunks in a single memory
-///     block.
-/// <param name="chunks">The pointer to the chunks array</param>
-/// <param name="chunkSize">The size of each chunk</param>
-/// <param name="chunksCount">The count of the chunks</param>
-/// <param name="memoryBlock">The pointer where all the downloaded chunks are aggregated</param>
+///     Body handler for the HTTPS client that copies all the downloaded parts in a single memory
+///     block, downloadedBlock.
+/// <param name="data">The part of the body</param>
+/// <param name="size">The size of the part</param>
+/// <param name="context">Not used</param>
 /// </summary>
-static size_t StoreDownloadedDataCallback(void *chunks, size_t chunkSize, size_t chunksCount,
-                                          void *memoryBlock)
+static bool StoreDownloadedDataHandler(const uint8_t *data, size_t size, void *context)
 {
-    MemoryBlock *block = (MemoryBlock *)memoryBlock;
+    MemoryBlock *block = &downloadedBlock;
 
-    size_t additionalDataSize = chunkSize * chunksCount;
-    block->data = realloc(block->data, block->size + additionalDataSize + 1);
-    if (block->data == NULL) {
-        Log_Debug("Out of memory, realloc returned NULL: errno=%d (%s)'n", errno, strerror(errno));
-        abort();
+    char *blockData = MemPool_ReallocFor(&downloadMemory, block->data, block->size + size + 1);
+    if (blockData == NULL) {
+        // Returning false makes the client abandon the download.
+        Log_Debug("ERROR: The page is too large to download: %zu bytes received so far.\n",
+                  block->size + size);
+        return false;
     }
+    block->data = blockData;
 
-    memcpy(block->data + block->size, chunks, additionalDataSize);
-    block->size += additionalDataSize;
+    memcpy(block->data + block->size, data, size);
+    block->size += size;
     block->data[block->size] = 0; // Ensure the block of memory is null terminated.
 
-    return additionalDataSize;
+    return true;
 }
 
 /// <summary>
-///     Logs a cURL error.
+///     Copies a header value into a buffer. A value which does not fit is discarded.
 /// </summary>
-/// <param name="message">The message to print</param>
-/// <param name="curlErrCode">The cURL error code to describe</param>
-static void LogCurlError(const char *message, int curlErrCode)
+static void CopyHeaderValue(const char *value, char *buffer, size_t bufferSize)
 {
-    Log_Debug(message);
-    Log_Debug(" (curl err=%d, '%s')\n", curlErrCode, curl_easy_strerror(curlErrCode));
+    size_t length = strlen(value);
+    if (length >= bufferSize) {
+        length = 0;
+    }
+    memcpy(buffer, value, length);
+    buffer[length] = '\0';
 }
 
 /// <summary>
-///     Checks that the interface is connected to the internet.
+///     Header handler for the HTTPS client that records the ETag and Last-Modified headers of the
+///     response in receivedValidators.
+/// <param name="name">The header name</param>
+/// <param name="value">The header value</param>
+/// <param name="context">Not used</param>
 /// </summary>
-static bool IsNetworkInterfaceConnectedToInternet(void)
+static void StoreValidatorsHandler(const char *name, const char *value, void *context)
 {
-    Networking_InterfaceConnectionStatus status;
-    if (Networking_GetInterfaceConnectionStatus(networkInterface, &status) != 0) {
-        if (errno != EAGAIN) {
-            Log_Debug("ERROR: Networking_GetInterfaceConnectionStatus: %d (%s)\n", errno,
-                      strerror(errno));
-            exitCode = ExitCode_InterfaceConnectionStatus_Failed;
+    ResponseCache_Validators *received = &receivedValidators;
+
+    if (strcasecmp(name, "ETag") == 0) {
+        CopyHeaderValue(value, received->etag, sizeof(received->etag));
+    } else if (strcasecmp(name, "Last-Modified") == 0) {
+        CopyHeaderValue(value, received->lastModified, sizeof(received->lastModified));
+    }
+}
+
+/// <summary>
+///     Builds the request headers which make a download conditional on whether the cached
+///     response is still current.
+/// </summary>
+/// <param name="cached">The validators of the cached response</param>
+/// <param name="headers">Buffer which receives the headers, each terminated by CRLF</param>
+/// <param name="headersSize">The size of the buffer</param>
+/// <returns>true if the headers fit in the buffer; false otherwise</returns>
+static bool CreateConditionalRequestHeaders(const ResponseCache_Validators *cached, char *headers,
+                                            size_t headersSize)
+{
+    size_t length = 0;
+    headers[0] = '\0';
+
+    if (cached->etag[0] != '\0') {
+        length += (size_t)snprintf(headers + length, headersSize - length,
+                                   "If-None-Match: %s\r\n", cached->etag);
+        if (length >= headersSize) {
             return false;
         }
-        Log_Debug("WARNING: Not doing download because the networking stack isn't ready yet.\n");
-        return false;
     }
 
-    if ((status & Networking_InterfaceConnectionStatus_ConnectedToInternet) == 0) {
-        Log_Debug("WARNING: Not doing download because there is no internet connectivity.\n");
-        return false;
+    if (cached->lastModified[0] != '\0') {
+        length += (size_t)snprintf(headers + length, headersSize - length,
+                                   "If-Modified-Since: %s\r\n", cached->lastModified);
+        if (length >= headersSize) {
+            return false;
+        }
     }
 
     return true;
 }
 
+/// <summary>
+///     Handles the response to a download: prints the page, either as downloaded or, if it has not
+///     changed, from the cache; and updates the cache.
+/// </summary>
+/// <param name="responseCode">The HTTP status of the response</param>
+/// <param name="block">The downloaded body</param>
+/// <param name="validators">The validators received with the response</param>
+static void HandleResponse(int responseCode, const MemoryBlock *block,
+                           const ResponseCache_Validators *validators)
+{
+    if (responseCode == 304) {
+        size_t cachedSize;
+        char *cached = ResponseCache_ReadBody(downloadUrl, &cachedSize);
+        if (cached == NULL) {
+            // Download the whole page next time.
+            ResponseCache_Remove(downloadUrl);
+            return;
+        }
+
+        Log_Debug("INFO: The page has not changed; using the cached copy.\n");
+        PrintResponse(cached, cachedSize, maxResponseCharsToPrint);
+        MemPool_Free(cached);
+        return;
+    }
+
+    PrintResponse(block->data != NULL ? block->data : "", block->size, maxResponseCharsToPrint);
+
+    // Cache the page only if the server has said how to validate it.
+    if (responseCode == 200 &&
+        (validators->etag[0] != '\0' || validators->lastModified[0] != '\0')) {
+        ResponseCache_Store(downloadUrl, validators, block->data, block->size);
+    } else {
+        ResponseCache_Remove(downloadUrl);
+    }
+}
+
+/// <summary>
+///     Called by the HTTPS client when a download has completed.
+/// </summary>
+static void DownloadCompletedHandler(HttpsClient_Result result, const HttpsClient_Metrics *metrics,
+                                     void *context)
+{
+    if (result == HttpsClient_Result_Succeeded) {
+        HandleResponse(metrics->status, &downloadedBlock, &receivedValidators);
+    } else {
+        Log_Debug("ERROR: The download did not complete.\n");
+    }
+
+    MemPool_Free(downloadedBlock.data);
+    downloadedBlock.data = NULL;
+    downloadedBlock.size = 0;
+    downloadInProgress = false;
+    Log_Debug("\n -===- END-OF-DOWNLOAD -===-\n");
+
+#ifdef EVENT_TRACE
+    // Log the timeline since the previous download, and start the next one's afresh.
+    EventTrace_Log();
+    EventTrace_Clear();
+#endif
+}
+
+/// <summary>
+///     Called when the connection status of the interface changes. The page is downloaded as soon
+///     as the interface connects to the internet, rather than at the next timer event.
+/// </summary>
+static void NetworkStateChangedHandler(Networking_InterfaceConnectionStatus status, void *context)
+{
+    if ((status & Networking_InterfaceConnectionStatus_ConnectedToInternet) != 0) {
+        PerformWebPageDownload();
+    }
+}
+
+/// <summary>
+///     Called when the connection status of the interface cannot be read.
+/// </summary>
+static void NetworkStateErrorHandler(void *context)
+{
+    exitCode = ExitCode_InterfaceConnectionStatus_Failed;
+}
+
 /// <summary>
 ///     Print the response contents, truncating if required.
 /// </summary>
@@ -171,108 +329,44 @@ static void PrintResponse(const char *data, size_t actualLength, size_t maxPrint
 }
 
 /// <summary>
-///     Download a web page over HTTPS protocol using cURL.
+///     Start to download a web page over HTTPS protocol using the HTTPS client.
 /// </summary>
 static void PerformWebPageDownload(void)
 {
-    CURL *curlHandle = NULL;
-    CURLcode res = 0;
-    MemoryBlock block = {.data = NULL, .size = 0};
-    char *certificatePath = NULL;
-
-    if (IsNetworkInterfaceConnectedToInternet() == false) {
-        goto exitLabel;
-    }
-
-    Log_Debug("\n -===- Starting download -===-\n");
-
-    // Init the cURL library.
-    if ((res = curl_global_init(CURL_GLOBAL_ALL)) != CURLE_OK) {
-        LogCurlError("curl_global_init", res);
-        goto exitLabel;
-    }
-
-    if ((curlHandle = curl_easy_init()) == NULL) {
-        Log_Debug("curl_easy_init() failed\n");
-        goto cleanupLabel;
-    }
-
-    // Specify URL to download.
-    // Important: any change in the domain name must be reflected in the AllowedConnections
-    // capability in app_manifest.json.
-    if ((res = curl_easy_setopt(curlHandle, CURLOPT_URL, "https://example.com")) != CURLE_OK) {
-        LogCurlError("curl_easy_setopt CURLOPT_URL", res);
-        goto cleanupLabel;
-    }
-
-    // Set output level to verbose.
-    if ((res = curl_easy_setopt(curlHandle, CURLOPT_VERBOSE, 1L)) != CURLE_OK) {
-        LogCurlError("curl_easy_setopt CURLOPT_VERBOSE", res);
-        goto cleanupLabel;
-    }
-
-    // Get the full path to the certificate file used to authenticate the HTTPS server identity.
-    // The DigiCertGlobalRootCA.pem file is the certificate that is used to verify the
-    // server identity.
-    certificatePath = Storage_GetAbsolutePathInImagePackage("certs/DigiCertGlobalRootCA.pem");
-    if (certificatePath == NULL) {
-        Log_Debug("The certificate path could not be resolved: errno=%d (%s)\n", errno,
-                  strerror(errno));
-        goto cleanupLabel;
-    }
-
-    // Set the path for the certificate file that cURL uses to validate the server certificate.
-    if ((res = curl_easy_setopt(curlHandle, CURLOPT_CAINFO, certificatePath)) != CURLE_OK) {
-        LogCurlError("curl_easy_setopt CURLOPT_CAINFO", res);
-        goto cleanupLabel;
-    }
-
-    // Let cURL follow any HTTP 3xx redirects.
-    // Important: any redirection to different domain names requires that domain name to be added to
-    // app_manifest.json.
-    if ((res = curl_easy_setopt(curlHandle, CURLOPT_FOLLOWLOCATION, 1L)) != CURLE_OK) {
-        LogCurlError("curl_easy_setopt CURLOPT_FOLLOWLOCATION", res);
-        goto cleanupLabel;
+    if (!NetworkState_IsConnectedToInternet()) {
+        Log_Debug("WARNING: Not doing download because there is no internet connectivity.\n");
+        return;
     }
 
-    // Set up callback for cURL to use when downloading data.
-    if ((res = curl_easy_setopt(curlHandle, CURLOPT_WRITEFUNCTION, StoreDownloadedDataCallback)) !=
-        CURLE_OK) {
-        LogCurlError("curl_easy_setopt CURLOPT_WRITEFUNCTION", res);
-        goto cleanupLabel;
+    if (downloadInProgress) {
+        Log_Debug("WARNING: Not doing download because the last one is still in progress.\n");
+        return;
     }
 
-    // Set the custom parameter of the callback to the memory block.
-    if ((res = curl_easy_setopt(curlHandle, CURLOPT_WRITEDATA, (void *)&block)) != CURLE_OK) {
-        LogCurlError("curl_easy_setopt CURLOPT_WRITEDATA", res);
-        goto cleanupLabel;
-    }
+    Log_Debug("\n -===- Starting download -===-\n");
 
-    // Specify a user agent.
-    if ((res = curl_easy_setopt(curlHandle, CURLOPT_USERAGENT, "libcurl-agent/1.0")) != CURLE_OK) {
-        LogCurlError("curl_easy_setopt CURLOPT_USERAGENT", res);
-        goto cleanupLabel;
+    // If the page is cached, ask the server to send it only if it has changed.
+    char requestHeaders[HTTPS_CLIENT_MAX_REQUEST_HEADERS_LENGTH + 1] = "";
+    ResponseCache_Validators cachedValidators;
+    if (ResponseCache_GetValidators(downloadUrl, &cachedValidators) &&
+        !CreateConditionalRequestHeaders(&cachedValidators, requestHeaders,
+                                         sizeof(requestHeaders))) {
+        // Download the whole page instead.
+        requestHeaders[0] = '\0';
     }
 
-    // Perform the download of the web page.
-    if ((res = curl_easy_perform(curlHandle)) != CURLE_OK) {
-        LogCurlError("curl_easy_perform", res);
-    } else {
-        PrintResponse(block.data, block.size, maxResponseCharsToPrint);
+    memset(&receivedValidators, 0, sizeof(receivedValidators));
+    HttpsClient_Request request = {.url = downloadUrl,
+                                   .headers = requestHeaders,
+                                   .headerHandler = StoreValidatorsHandler,
+                                   .bodyHandler = StoreDownloadedDataHandler,
+                                   .completionHandler = DownloadCompletedHandler,
+                                   .context = NULL};
+    if (HttpsClient_Get(&request) != 0) {
+        Log_Debug("ERROR: Could not start the download: %s (%d).\n", strerror(errno), errno);
+        return;
     }
-
-cleanupLabel:
-    // Clean up allocated memory.
-    free(block.data);
-    free(certificatePath);
-    // Clean up sample's cURL resources.
-    curl_easy_cleanup(curlHandle);
-    // Clean up cURL library's resources.
-    curl_global_cleanup();
-    Log_Debug("\n -===- END-OF-DOWNLOAD -===-\n");
-
-exitLabel:
-    return;
+    downloadInProgress = true;
 }
 
 /// <summary>
@@ -302,12 +396,31 @@ static ExitCode InitHandlers(void)
     action.sa_handler = TerminationHandler;
     sigaction(SIGTERM, &action, NULL);
 
+    if (MemPool_Initialize(memPoolArena, sizeof(memPoolArena), memPoolClasses,
+                           sizeof(memPoolClasses) / sizeof(memPoolClasses[0])) != 0) {
+        Log_Debug("ERROR: Could not initialize the memory pool: %s (%d).\n", strerror(errno),
+                  errno);
+        return ExitCode_Init_MemPool;
+    }
+
     eventLoop = EventLoop_Create();
     if (eventLoop == NULL) {
         Log_Debug("Could not create event loop.\n");
         return ExitCode_Init_EventLoop;
     }
 
+    // Download the page when the interface connects to the internet.
+    if (NetworkState_Start(eventLoop, networkInterface, NetworkStateErrorHandler, NULL) != 0 ||
+        NetworkState_Subscribe(NetworkStateChangedHandler, NULL) != 0) {
+        return ExitCode_Init_NetworkState;
+    }
+
+    if (HttpsClient_Init(eventLoop, &httpsClientConfig) != 0) {
+        Log_Debug("ERROR: Could not initialize the HTTPS client: %s (%d).\n", strerror(errno),
+                  errno);
+        return ExitCode_Init_HttpsClient;
+    }
+
     // Issue an HTTPS request at the specified period.
     static const struct timespec tenSeconds = {.tv_sec = 10, .tv_nsec = 0};
     downloadTimer = CreateEventLoopPeriodicTimer(eventLoop, &TimerEventHandler, &tenSeconds);
@@ -324,7 +437,11 @@ static ExitCode InitHandlers(void)
 static void CloseHandlers(void)
 {
     DisposeEventLoopTimer(downloadTimer);
+    HttpsClient_Cleanup();
+    MemPool_Free(downloadedBlock.data);
+    NetworkState_Stop();
     EventLoop_Close(eventLoop);
+    MemPool_LogStats();
 }
 
 /// <summary>
@@ -332,14 +449,10 @@ static void CloseHandlers(void)
 /// </summary>
 int main(int argc, char *argv[])
 {
-    Log_Debug("cURL easy interface based application starting.\n");
-    Log_Debug("This sample periodically attempts to download a webpage, using curl's 'easy' API.");
+    Log_Debug("HTTPS client based application starting.\n");
+    Log_Debug("This sample periodically attempts to download a webpage, using the HTTPS client.\n");
 
     exitCode = InitHandlers();
-    if (exitCode == ExitCode_Success) {
-        // Download the web page immediately.
-        PerformWebPageDownload();
-    }
 
     // Use event loop to wait for events and trigger handlers, until an error or SIGTERM happens
     while (exitCode == ExitCode_Success) {
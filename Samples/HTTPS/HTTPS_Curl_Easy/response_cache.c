@@ -0,0 +1,273 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// applibs_versions.h defines the API struct versions to use for applibs APIs.
+#include "applibs_versions.h"
+#include <applibs/log.h>
+#include <applibs/storage.h>
+
+#include "response_cache.h"
+#include "mem_pool.h"
+
+// The mutable storage file is divided into fixed-size slots, each holding one cached response: a
+// header describing the response, followed by its body. The storage size must match the
+// MutableStorage size declared in app_manifest.json.
+#define STORAGE_SIZE (64 * 1024)
+#define SLOT_COUNT 4
+#define SLOT_SIZE (STORAGE_SIZE / SLOT_COUNT)
+#define BODY_OFFSET 512
+#define BODY_CAPACITY (SLOT_SIZE - BODY_OFFSET)
+
+static const uint32_t headerMagic = ('R' << 24) | ('S' << 16) | ('P' << 8) | 'C';
+
+static MemPool_Subsystem cacheMemory = MEM_POOL_SUBSYSTEM("ResponseCache");
+
+// The body is written before the header. The header's CRC covers all its other fields, and the CRC
+// of the body is checked when it is read, so that an entry which was only partly written is
+// ignored.
+typedef struct {
+    uint32_t magic;
+    uint32_t sequenceNumber; // Higher for entries stored more recently.
+    uint32_t bodySize;
+    uint32_t bodyCrc;
+    char url[RESPONSE_CACHE_MAX_URL_LENGTH + 1];
+    ResponseCache_Validators validators;
+    uint32_t crc;
+} EntryHeader;
+
+_Static_assert(sizeof(EntryHeader) <= BODY_OFFSET, "EntryHeader overlaps the body");
+
+static uint32_t Crc32(const void *data, size_t length)
+{
+    const uint8_t *bytes = data;
+    uint32_t crc = 0xFFFFFFFFu;
+    while (length-- > 0) {
+        crc ^= *bytes++;
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc >> 1) ^ (0xEDB88320u & -(crc & 1u));
+        }
+    }
+    return ~crc;
+}
+
+static uint32_t HeaderCrc(const EntryHeader *header)
+{
+    return Crc32(header, offsetof(EntryHeader, crc));
+}
+
+static off_t SlotOffset(int slot)
+{
+    return (off_t)slot * SLOT_SIZE;
+}
+
+static bool ReadAt(int fd, off_t offset, void *buffer, size_t length)
+{
+    if (lseek(fd, offset, SEEK_SET) == -1) {
+        return false;
+    }
+    return read(fd, buffer, length) == (ssize_t)length;
+}
+
+static bool WriteAt(int fd, off_t offset, const void *buffer, size_t length)
+{
+    if (lseek(fd, offset, SEEK_SET) == -1) {
+        return false;
+    }
+    return write(fd, buffer, length) == (ssize_t)length;
+}
+
+static int OpenStorage(void)
+{
+    int fd = Storage_OpenMutableFile();
+    if (fd == -1) {
+        Log_Debug("ERROR: Could not open mutable storage: errno=%d (%s)\n", errno,
+                  strerror(errno));
+    }
+    return fd;
+}
+
+static void CloseStorage(int fd)
+{
+    if (close(fd) != 0) {
+        Log_Debug("ERROR: Could not close mutable storage: errno=%d (%s)\n", errno,
+                  strerror(errno));
+    }
+}
+
+// Read the header of a slot, returning false if the slot does not hold a valid entry.
+static bool ReadHeader(int fd, int slot, EntryHeader *header)
+{
+    if (!ReadAt(fd, SlotOffset(slot), header, sizeof(*header))) {
+        return false;
+    }
+
+    return header->magic == headerMagic && header->crc == HeaderCrc(header) &&
+           header->bodySize <= BODY_CAPACITY &&
+           header->url[RESPONSE_CACHE_MAX_URL_LENGTH] == '\0' &&
+           header->validators.etag[RESPONSE_CACHE_MAX_ETAG_LENGTH] == '\0' &&
+           header->validators.lastModified[RESPONSE_CACHE_MAX_LAST_MODIFIED_LENGTH] == '\0';
+}
+
+// Find the slot which holds the entry for a URL, returning -1 if there is none.
+static int FindEntry(int fd, const char *url, EntryHeader *header)
+{
+    for (int slot = 0; slot < SLOT_COUNT; ++slot) {
+        if (ReadHeader(fd, slot, header) && strcmp(header->url, url) == 0) {
+            return slot;
+        }
+    }
+    return -1;
+}
+
+bool ResponseCache_GetValidators(const char *url, ResponseCache_Validators *validators)
+{
+    int fd = OpenStorage();
+    if (fd == -1) {
+        return false;
+    }
+
+    EntryHeader header;
+    bool found = FindEntry(fd, url, &header) != -1;
+    if (found) {
+        *validators = header.validators;
+    }
+
+    CloseStorage(fd);
+    return found;
+}
+
+char *ResponseCache_ReadBody(const char *url, size_t *size)
+{
+    int fd = OpenStorage();
+    if (fd == -1) {
+        return NULL;
+    }
+
+    char *body = NULL;
+    EntryHeader header;
+    int slot = FindEntry(fd, url, &header);
+    if (slot == -1) {
+        goto exitLabel;
+    }
+
+    body = MemPool_AllocFor(&cacheMemory, header.bodySize + 1);
+    if (body == NULL) {
+        Log_Debug("ERROR: Could not allocate %u bytes for a cached response\n", header.bodySize);
+        goto exitLabel;
+    }
+
+    if (!ReadAt(fd, SlotOffset(slot) + BODY_OFFSET, body, header.bodySize) ||
+        Crc32(body, header.bodySize) != header.bodyCrc) {
+        Log_Debug("ERROR: The cached response for %s could not be read\n", url);
+        MemPool_Free(body);
+        body = NULL;
+        goto exitLabel;
+    }
+
+    body[header.bodySize] = '\0';
+    *size = header.bodySize;
+
+exitLabel:
+    CloseStorage(fd);
+    return body;
+}
+
+bool ResponseCache_Store(const char *url, const ResponseCache_Validators *validators,
+                         const char *body, size_t size)
+{
+    if (strlen(url) > RESPONSE_CACHE_MAX_URL_LENGTH) {
+        Log_Debug("INFO: URL too long to cache the response\n");
+        return false;
+    }
+
+    if (size > BODY_CAPACITY) {
+        Log_Debug("INFO: Response of %zu bytes is too large to cache (%d bytes)\n", size,
+                  BODY_CAPACITY);
+        ResponseCache_Remove(url);
+        return false;
+    }
+
+    int fd = OpenStorage();
+    if (fd == -1) {
+        return false;
+    }
+
+    // Use the slot which already holds the entry for the URL; otherwise an empty slot; otherwise
+    // the slot which holds the oldest entry.
+    int targetSlot = -1;
+    int emptySlot = -1;
+    int oldestSlot = 0;
+    uint32_t oldestSequenceNumber = UINT32_MAX;
+    uint32_t newestSequenceNumber = 0;
+
+    for (int slot = 0; slot < SLOT_COUNT; ++slot) {
+        EntryHeader existing;
+        if (!ReadHeader(fd, slot, &existing)) {
+            if (emptySlot == -1) {
+                emptySlot = slot;
+            }
+            continue;
+        }
+
+        if (strcmp(existing.url, url) == 0) {
+            targetSlot = slot;
+        }
+        if (existing.sequenceNumber < oldestSequenceNumber) {
+            oldestSequenceNumber = existing.sequenceNumber;
+            oldestSlot = slot;
+        }
+        if (existing.sequenceNumber > newestSequenceNumber) {
+            newestSequenceNumber = existing.sequenceNumber;
+        }
+    }
+
+    if (targetSlot == -1) {
+        targetSlot = (emptySlot != -1) ? emptySlot : oldestSlot;
+    }
+
+    EntryHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = headerMagic;
+    header.sequenceNumber = newestSequenceNumber + 1;
+    header.bodySize = (uint32_t)size;
+    header.bodyCrc = Crc32(body, size);
+    strcpy(header.url, url);
+    header.validators = *validators;
+    header.crc = HeaderCrc(&header);
+
+    bool stored = WriteAt(fd, SlotOffset(targetSlot) + BODY_OFFSET, body, size) &&
+                  WriteAt(fd, SlotOffset(targetSlot), &header, sizeof(header));
+    if (!stored) {
+        Log_Debug("ERROR: Could not store the response in the cache: errno=%d (%s)\n", errno,
+                  strerror(errno));
+    }
+
+    CloseStorage(fd);
+    return stored;
+}
+
+void ResponseCache_Remove(const char *url)
+{
+    int fd = OpenStorage();
+    if (fd == -1) {
+        return;
+    }
+
+    EntryHeader header;
+    int slot = FindEntry(fd, url, &header);
+    if (slot != -1) {
+        static const uint32_t noMagic = 0;
+        if (!WriteAt(fd, SlotOffset(slot), &noMagic, sizeof(noMagic))) {
+            Log_Debug("ERROR: Could not remove the response from the cache: errno=%d (%s)\n",
+                      errno, strerror(errno));
+        }
+    }
+
+    CloseStorage(fd);
+}
@@ -0,0 +1,74 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// The response cache stores the bodies of HTTP responses in the application's mutable storage,
+// keyed by URL, together with the ETag and Last-Modified headers which validate them. A download
+// of a cached URL is made conditional on these validators, so that if the resource has not changed
+// the server responds with 304 Not Modified and no body, and the cached body is used instead.
+// The cache holds a small fixed number of entries; when it is full, the oldest entry is replaced.
+
+/// <summary>
+///     Maximum length of the URL of a cached response, excluding the null terminator.
+/// </summary>
+#define RESPONSE_CACHE_MAX_URL_LENGTH 255
+
+/// <summary>
+///     Maximum length of an ETag, excluding the null terminator.
+/// </summary>
+#define RESPONSE_CACHE_MAX_ETAG_LENGTH 127
+
+/// <summary>
+///     Maximum length of a Last-Modified date, excluding the null terminator.
+/// </summary>
+#define RESPONSE_CACHE_MAX_LAST_MODIFIED_LENGTH 63
+
+/// <summary>
+///     The validators of a cached response. A validator which the server did not send is empty.
+/// </summary>
+typedef struct {
+    /// <summary>The value of the ETag header, including its quotes.</summary>
+    char etag[RESPONSE_CACHE_MAX_ETAG_LENGTH + 1];
+    /// <summary>The value of the Last-Modified header.</summary>
+    char lastModified[RESPONSE_CACHE_MAX_LAST_MODIFIED_LENGTH + 1];
+} ResponseCache_Validators;
+
+/// <summary>
+///     Gets the validators of the cached response for a URL.
+/// </summary>
+/// <param name="url">The URL.</param>
+/// <param name="validators">Receives the validators.</param>
+/// <returns>true if a response for the URL is cached; false otherwise.</returns>
+bool ResponseCache_GetValidators(const char *url, ResponseCache_Validators *validators);
+
+/// <summary>
+///     Reads the body of the cached response for a URL.
+/// </summary>
+/// <param name="url">The URL.</param>
+/// <param name="size">Receives the size of the body in bytes.</param>
+/// <returns>
+///     The body followed by a null terminator, which the caller must free with MemPool_Free; or
+///     NULL if no response for the URL is cached or the body could not be read.
+/// </returns>
+char *ResponseCache_ReadBody(const char *url, size_t *size);
+
+/// <summary>
+///     Stores a response in the cache, replacing any cached response for the same URL.
+/// </summary>
+/// <param name="url">The URL.</param>
+/// <param name="validators">The validators which the server sent with the response.</param>
+/// <param name="body">The body of the response.</param>
+/// <param name="size">Size of the body in bytes.</param>
+/// <returns>true on success; false if the response is too large or could not be stored.</returns>
+bool ResponseCache_Store(const char *url, const ResponseCache_Validators *validators,
+                         const char *body, size_t size);
+
+/// <summary>
+///     Removes the cached response for a URL, if there is one.
+/// </summary>
+/// <param name="url">The URL.</param>
+void ResponseCache_Remove(const char *url);
@@ -25,11 +25,16 @@ typedef enum {
     ExitCode_UiInit_ButtonPollTimer = 7,
 
     ExitCode_WebClientInit_CurlTimer = 8,
+    ExitCode_WebClientInit_MaxConcurrentTransfers = 26,
+    ExitCode_WebClientInit_RetryTimer = 32,
 
     ExitCode_CurlInit_GlobalInit = 9,
     ExitCode_CurlInit_MultiInit = 10,
     ExitCode_CurlInit_MultiSetOptSocketFunction = 11,
     ExitCode_CurlInit_MultiSetOptTimerFunction = 12,
+    ExitCode_CurlInit_ShareInit = 27,
+    ExitCode_CurlInit_ShareSetOpt = 28,
+    ExitCode_CurlInit_MultiSetOptPipelining = 29,
 
     ExitCode_CurlSetupEasy_EasyInit = 13,
     ExitCode_CurlSetupEasy_OptUrl = 14,
@@ -42,7 +47,10 @@ typedef enum {
     ExitCode_CurlSetupEasy_OptUserAgent = 21,
     ExitCode_CurlSetupEasy_StoragePath = 22,
     ExitCode_CurlSetupEasy_CAInfo = 23,
-    ExitCode_CurlSetupEasy_Verbose = 24
+    ExitCode_CurlSetupEasy_Verbose = 24,
+    ExitCode_CurlSetupEasy_OptHeaderFunction = 25,
+    ExitCode_CurlSetupEasy_OptShare = 30,
+    ExitCode_CurlSetupEasy_OptAcceptEncoding = 31
 } ExitCode;
 
 // Network  interface to use.
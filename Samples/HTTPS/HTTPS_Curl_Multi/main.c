@@ -50,6 +50,11 @@ static EventLoop *eventLoop = NULL;
 // Termination state
 static volatile sig_atomic_t exitCode = ExitCode_Success;
 
+// The maximum number of web transfers to run at once.
+static const size_t maxConcurrentTransfers = 2;
+// The amount by which cURL's timeouts may be delayed so that they can be coalesced.
+static const unsigned int curlTimerSlackMilliseconds = 20;
+
 // Network interface to use.
 const char networkInterface[] = "wlan0";
 
@@ -87,10 +92,13 @@ static ExitCode InitPeripheralsAndHandlers(void)
         return localExitCode;
     }
 
-    localExitCode = WebClient_Init(eventLoop);
+    // No response data callback is registered, so the web client stores each response body and
+    // prints the start of it when the transfer completes.
+    localExitCode = WebClient_Init(eventLoop, NULL, maxConcurrentTransfers);
     if (localExitCode != ExitCode_Success) {
         return localExitCode;
     }
+    WebClient_SetTimerSlack(curlTimerSlackMilliseconds);
 
     return ExitCode_Success;
 }
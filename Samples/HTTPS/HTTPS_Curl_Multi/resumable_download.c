@@ -0,0 +1,230 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+
+// applibs_versions.h defines the API struct versions to use for applibs APIs.
+#include "applibs_versions.h"
+#include <applibs/log.h>
+#include <applibs/storage.h>
+
+#include "log_utils.h"
+#include "resumable_download.h"
+
+// Layout of the download within the mutable storage file: a header recording the progress of the
+// download, followed by the content. The storage size must match the MutableStorage size declared
+// in app_manifest.json.
+#define STORAGE_SIZE (64 * 1024)
+#define CONTENT_OFFSET 512
+#define CONTENT_CAPACITY (STORAGE_SIZE - CONTENT_OFFSET)
+
+// Data is committed to storage in chunks of this size.
+#define COMMIT_CHUNK_SIZE 4096
+
+static const uint32_t headerMagic = ('D' << 24) | ('N' << 16) | ('L' << 8) | 'D';
+
+// The header is rewritten after each chunk of content is committed. The CRC covers all the other
+// fields, so that a header which was only partly written is ignored.
+typedef struct {
+    uint32_t magic;
+    uint32_t committedSize;
+    uint32_t totalSize; // 0 if not known
+    uint32_t complete;
+    char url[RESUMABLE_DOWNLOAD_MAX_URL_LENGTH + 1];
+    uint32_t crc;
+} DownloadHeader;
+
+_Static_assert(sizeof(DownloadHeader) <= CONTENT_OFFSET, "DownloadHeader overlaps the content");
+
+static int storageFd = -1;
+static DownloadHeader header;
+
+// Content received but not yet committed to storage.
+static uint8_t pendingData[COMMIT_CHUNK_SIZE];
+static size_t pendingSize = 0;
+
+static uint32_t Crc32(const void *data, size_t length)
+{
+    const uint8_t *bytes = data;
+    uint32_t crc = 0xFFFFFFFFu;
+    while (length-- > 0) {
+        crc ^= *bytes++;
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc >> 1) ^ (0xEDB88320u & -(crc & 1u));
+        }
+    }
+    return ~crc;
+}
+
+static uint32_t HeaderCrc(const DownloadHeader *h)
+{
+    return Crc32(h, offsetof(DownloadHeader, crc));
+}
+
+static bool WriteAt(int fd, off_t offset, const void *buffer, size_t length)
+{
+    if (lseek(fd, offset, SEEK_SET) == -1) {
+        return false;
+    }
+    return write(fd, buffer, length) == (ssize_t)length;
+}
+
+static bool WriteHeader(void)
+{
+    header.crc = HeaderCrc(&header);
+    if (!WriteAt(storageFd, 0, &header, sizeof(header))) {
+        LogErrno("ERROR: Could not write the download header");
+        return false;
+    }
+    return true;
+}
+
+// Read the header from storage, returning false if there is no valid header.
+static bool ReadHeader(int fd, DownloadHeader *h)
+{
+    if (lseek(fd, 0, SEEK_SET) == -1 || read(fd, h, sizeof(*h)) != sizeof(*h)) {
+        return false;
+    }
+
+    return h->magic == headerMagic && h->crc == HeaderCrc(h) &&
+           h->committedSize <= CONTENT_CAPACITY &&
+           h->url[RESUMABLE_DOWNLOAD_MAX_URL_LENGTH] == '\0';
+}
+
+// Write the pending data after the committed content, then record it as committed.
+static bool CommitPendingData(void)
+{
+    if (pendingSize == 0) {
+        return true;
+    }
+
+    if (!WriteAt(storageFd, CONTENT_OFFSET + (off_t)header.committedSize, pendingData,
+                 pendingSize)) {
+        LogErrno("ERROR: Could not write downloaded content to storage");
+        return false;
+    }
+
+    header.committedSize += (uint32_t)pendingSize;
+    pendingSize = 0;
+    return WriteHeader();
+}
+
+bool ResumableDownload_Begin(const char *url, size_t *resumeOffset)
+{
+    if (strlen(url) > RESUMABLE_DOWNLOAD_MAX_URL_LENGTH) {
+        Log_Debug("ERROR: URL too long for a resumable download\n");
+        return false;
+    }
+
+    if (storageFd == -1) {
+        storageFd = Storage_OpenMutableFile();
+        if (storageFd == -1) {
+            LogErrno("ERROR: Could not open mutable storage");
+            return false;
+        }
+    }
+
+    pendingSize = 0;
+
+    // Resume the stored download if it is of the same URL and did not complete.
+    if (ReadHeader(storageFd, &header) && !header.complete && strcmp(header.url, url) == 0) {
+        *resumeOffset = header.committedSize;
+        Log_Debug("INFO: Resuming download of %s from byte %u\n", url, header.committedSize);
+        return true;
+    }
+
+    memset(&header, 0, sizeof(header));
+    header.magic = headerMagic;
+    strcpy(header.url, url);
+    *resumeOffset = 0;
+    return WriteHeader();
+}
+
+void ResumableDownload_Restart(void)
+{
+    Log_Debug("INFO: Server did not resume the download; starting again\n");
+    header.committedSize = 0;
+    header.totalSize = 0;
+    pendingSize = 0;
+    WriteHeader();
+}
+
+bool ResumableDownload_SetTotalSize(size_t totalSize)
+{
+    if (totalSize > CONTENT_CAPACITY) {
+        Log_Debug("ERROR: Download of %zu bytes does not fit in mutable storage (%d bytes)\n",
+                  totalSize, CONTENT_CAPACITY);
+        return false;
+    }
+
+    header.totalSize = (uint32_t)totalSize;
+    return true;
+}
+
+bool ResumableDownload_Write(const uint8_t *data, size_t size)
+{
+    if (storageFd == -1) {
+        return false;
+    }
+
+    if (size > CONTENT_CAPACITY - header.committedSize - pendingSize) {
+        Log_Debug("ERROR: Download does not fit in mutable storage (%d bytes)\n",
+                  CONTENT_CAPACITY);
+        return false;
+    }
+
+    while (size > 0) {
+        size_t space = COMMIT_CHUNK_SIZE - pendingSize;
+        size_t toCopy = (size < space) ? size : space;
+        memcpy(pendingData + pendingSize, data, toCopy);
+        pendingSize += toCopy;
+        data += toCopy;
+        size -= toCopy;
+
+        if (pendingSize == COMMIT_CHUNK_SIZE && !CommitPendingData()) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+size_t ResumableDownload_End(bool complete)
+{
+    if (storageFd == -1) {
+        return 0;
+    }
+
+    // Data already received is kept even if the transfer failed, since the download resumes
+    // from the end of it.
+    if (CommitPendingData() && complete) {
+        header.complete = 1;
+        WriteHeader();
+    }
+
+    size_t committedSize = header.committedSize;
+    CloseFdAndLogOnError(storageFd, "mutable storage");
+    storageFd = -1;
+    return committedSize;
+}
+
+bool ResumableDownload_GetIncomplete(char *url)
+{
+    int fd = Storage_OpenMutableFile();
+    if (fd == -1) {
+        LogErrno("ERROR: Could not open mutable storage");
+        return false;
+    }
+
+    DownloadHeader stored;
+    bool incomplete = ReadHeader(fd, &stored) && !stored.complete;
+    if (incomplete) {
+        memcpy(url, stored.url, sizeof(stored.url));
+    }
+
+    CloseFdAndLogOnError(fd, "mutable storage");
+    return incomplete;
+}
@@ -0,0 +1,68 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A resumable download is written to the application's mutable storage in chunks. After each chunk
+// is written, the number of bytes stored is recorded alongside the URL, so that if the transfer
+// fails or the device restarts, the download can be resumed from that offset with an HTTP Range
+// request rather than started again. Only one download is stored at a time.
+
+/// <summary>
+///     Maximum length of the URL of a resumable download, excluding the null terminator.
+/// </summary>
+#define RESUMABLE_DOWNLOAD_MAX_URL_LENGTH 255
+
+/// <summary>
+///     Begins a download, or resumes it if a previous download of the same URL did not complete.
+///     A stored download of a different URL is discarded.
+/// </summary>
+/// <param name="url">The URL to download.</param>
+/// <param name="resumeOffset">
+///     Receives the offset from which to request the content; 0 if the download starts afresh.
+/// </param>
+/// <returns>true on success; false if mutable storage could not be opened.</returns>
+bool ResumableDownload_Begin(const char *url, size_t *resumeOffset);
+
+/// <summary>
+///     Discards the stored part of the download, because the server sent the content from the
+///     start rather than from the requested offset.
+/// </summary>
+void ResumableDownload_Restart(void);
+
+/// <summary>
+///     Sets the total size of the content, if it is known.
+/// </summary>
+/// <param name="totalSize">The total size in bytes.</param>
+/// <returns>true if the content fits in mutable storage; false otherwise.</returns>
+bool ResumableDownload_SetTotalSize(size_t totalSize);
+
+/// <summary>
+///     Appends data to the download. Data is committed to storage each time a chunk is complete.
+/// </summary>
+/// <param name="data">The data.</param>
+/// <param name="size">Size of the data in bytes.</param>
+/// <returns>true on success; false if the data could not be written or does not fit.</returns>
+bool ResumableDownload_Write(const uint8_t *data, size_t size);
+
+/// <summary>
+///     Ends the current attempt at the download, committing any data received so far.
+/// </summary>
+/// <param name="complete">true if all of the content has been received.</param>
+/// <returns>The number of bytes of the content which are stored.</returns>
+size_t ResumableDownload_End(bool complete);
+
+/// <summary>
+///     Gets the URL of a download which has not completed, for example because the device
+///     restarted while it was in progress.
+/// </summary>
+/// <param name="url">
+///     Buffer to receive the null-terminated URL; must be at least
+///     RESUMABLE_DOWNLOAD_MAX_URL_LENGTH + 1 bytes long.
+/// </param>
+/// <returns>true if there is an incomplete download; false otherwise.</returns>
+bool ResumableDownload_GetIncomplete(char *url);
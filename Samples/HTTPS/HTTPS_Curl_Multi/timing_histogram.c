@@ -0,0 +1,57 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include "timing_histogram.h"
+
+// Upper bound, in microseconds, of the durations held by a bucket other than the last.
+static uint64_t BucketUpperBound(unsigned int bucket)
+{
+    return 1000ull << bucket;
+}
+
+void TimingHistogram_Add(TimingHistogram *histogram, uint64_t microseconds)
+{
+    unsigned int bucket = 0;
+    while (bucket < TIMING_HISTOGRAM_BUCKET_COUNT - 1 && microseconds >= BucketUpperBound(bucket)) {
+        ++bucket;
+    }
+    histogram->buckets[bucket]++;
+
+    if (histogram->count == 0 || microseconds < histogram->minimumMicroseconds) {
+        histogram->minimumMicroseconds = microseconds;
+    }
+    if (microseconds > histogram->maximumMicroseconds) {
+        histogram->maximumMicroseconds = microseconds;
+    }
+    histogram->totalMicroseconds += microseconds;
+    histogram->count++;
+}
+
+void TimingHistogram_Summarize(const TimingHistogram *histogram, TimingSummary *summary)
+{
+    *summary = (TimingSummary){0};
+    if (histogram->count == 0) {
+        return;
+    }
+
+    summary->count = histogram->count;
+    summary->minimumMicroseconds = histogram->minimumMicroseconds;
+    summary->maximumMicroseconds = histogram->maximumMicroseconds;
+    summary->averageMicroseconds = histogram->totalMicroseconds / histogram->count;
+
+    // Find the bucket holding the 95th percentile; the estimate cannot exceed the maximum.
+    uint32_t rank = (uint32_t)(((uint64_t)histogram->count * 95 + 99) / 100);
+    uint32_t seen = 0;
+    for (unsigned int bucket = 0; bucket < TIMING_HISTOGRAM_BUCKET_COUNT; ++bucket) {
+        seen += histogram->buckets[bucket];
+        if (seen >= rank) {
+            uint64_t upperBound = (bucket < TIMING_HISTOGRAM_BUCKET_COUNT - 1)
+                                      ? BucketUpperBound(bucket)
+                                      : histogram->maximumMicroseconds;
+            summary->p95Microseconds = (upperBound < histogram->maximumMicroseconds)
+                                           ? upperBound
+                                           : histogram->maximumMicroseconds;
+            break;
+        }
+    }
+}
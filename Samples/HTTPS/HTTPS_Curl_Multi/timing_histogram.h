@@ -0,0 +1,54 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdint.h>
+
+// A timing histogram records durations in buckets whose widths double, from 1 millisecond up to
+// about 65 seconds. It uses a fixed amount of memory however many durations are recorded, and
+// estimates percentiles to within the width of a bucket; the minimum, maximum and mean are exact.
+
+/// <summary>
+///     Number of buckets in a timing histogram. Bucket 0 holds durations below 1 ms, bucket n holds
+///     durations from 2^(n-1) ms up to 2^n ms, and the last bucket holds all longer durations.
+/// </summary>
+#define TIMING_HISTOGRAM_BUCKET_COUNT 18
+
+/// <summary>
+///     A histogram of durations. Initialize it to all zeros.
+/// </summary>
+typedef struct {
+    uint32_t buckets[TIMING_HISTOGRAM_BUCKET_COUNT];
+    uint32_t count;
+    uint64_t minimumMicroseconds;
+    uint64_t maximumMicroseconds;
+    uint64_t totalMicroseconds;
+} TimingHistogram;
+
+/// <summary>
+///     A summary of the durations recorded in a timing histogram. All times are in microseconds,
+///     and are 0 if no durations have been recorded.
+/// </summary>
+typedef struct {
+    uint32_t count;
+    uint64_t minimumMicroseconds;
+    uint64_t averageMicroseconds;
+    /// <summary>95th percentile, estimated as the upper bound of the bucket it falls in.</summary>
+    uint64_t p95Microseconds;
+    uint64_t maximumMicroseconds;
+} TimingSummary;
+
+/// <summary>
+///     Record a duration.
+/// </summary>
+/// <param name="histogram">The histogram.</param>
+/// <param name="microseconds">The duration in microseconds.</param>
+void TimingHistogram_Add(TimingHistogram *histogram, uint64_t microseconds);
+
+/// <summary>
+///     Summarize the durations recorded in a histogram.
+/// </summary>
+/// <param name="histogram">The histogram.</param>
+/// <param name="summary">Receives the summary.</param>
+void TimingHistogram_Summarize(const TimingHistogram *histogram, TimingSummary *summary);
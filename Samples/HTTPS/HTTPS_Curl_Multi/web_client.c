@@ -4,8 +4,12 @@
 #include <assert.h>
 #include <errno.h>
 #include <memory.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
 #include <sys/timerfd.h>
+#include <unistd.h>
 
 #include <curl/curl.h>
 
@@ -16,11 +20,14 @@
 
 #include "eventloop_timer_utilities.h"
 #include "log_utils.h"
+#include "resumable_download.h"
 #include "web_client.h"
 #include "curlmulti.h"
 
 /// File descriptor for the timerfd running for cURL.
 static EventLoopTimer *curlTimer = NULL;
+/// Timer which starts queued transfers once their retry delay has passed.
+static EventLoopTimer *retryTimer = NULL;
 static EventLoop *eventLoop = NULL; // not owned
 
 /// <summary>
@@ -31,40 +38,147 @@ typedef struct {
     size_t size;
 } MemoryBlock;
 
+// Size of the data in each response chunk.
+#define RESPONSE_CHUNK_SIZE 4096
+
+/// <summary>
+///     A fixed-size part of a response body whose size was not known in advance.
+/// </summary>
+typedef struct ResponseChunk {
+    struct ResponseChunk *next;
+    size_t size;
+    uint8_t data[RESPONSE_CHUNK_SIZE];
+} ResponseChunk;
+
 /// <summary>
-///     The storage for an HTTP response content.
+///     The storage for an HTTP response content. If the server sends a Content-Length, the content
+///     is stored in a single block of that size; otherwise, or if the content turns out to be
+///     longer, it is stored in a list of chunks which follows the block.
 /// </summary>
 typedef struct {
     MemoryBlock content;
+    size_t contentCapacity;
+    ResponseChunk *firstChunk;
+    ResponseChunk *lastChunk;
+    // Total size of the content received, whether stored or streamed to the application.
+    size_t totalSize;
 } HttpResponse;
 
 // The cURL's 'multi' interface instance.
 static CURLM *curlMulti = 0;
-
-// Data type containing data for each web transfer.
+// Cache of DNS lookups and TLS sessions shared by all the easy handles, so that a new connection
+// to a host which has been visited before can resume the TLS session rather than make a full
+// handshake. Connections themselves are cached by the multi handle.
+static CURLSH *curlShare = NULL;
+
+// Counts of connections made, for WebClient_GetStatistics.
+static WebClient_Statistics statistics;
+
+// Timings of the phases of completed transfers, for WebClient_GetTimingStatistics.
+static TimingHistogram dnsHistogram;
+static TimingHistogram connectHistogram;
+static TimingHistogram tlsHistogram;
+static TimingHistogram firstByteHistogram;
+static TimingHistogram totalHistogram;
+static uint64_t bytesDownloaded = 0;
+static uint64_t bytesUploaded = 0;
+
+// Data type containing data for each web transfer. Each running transfer occupies one of a fixed
+// set of slots, whose easy handles are reused from one transfer to the next.
 typedef struct {
     CURL *easyHandle;
-    char *url;
+    char url[WEB_CLIENT_MAX_URL_LENGTH + 1];
+    bool inProgress;
+    // Set if the content is written to mutable storage as a resumable download.
+    bool toStorage;
+    // Offset from which a resumable download was requested.
+    size_t resumeOffset;
+    // Set once the status of the response to a resumable download has been checked.
+    bool responseChecked;
+    // Set if the response is not content to store, such as an error status.
+    bool discardContent;
+    // Number of times the transfer has been retried after failing.
+    unsigned int retries;
+    int priority;
     HttpResponse httpResponse;
     struct timespec startTime;
 } WebTransfer;
 
-// The web transfers executed with cURL.
-WebTransfer webTransfers[] = {
+// A transfer waiting for a free slot.
+typedef struct {
+    char url[WEB_CLIENT_MAX_URL_LENGTH + 1];
+    int priority;
+    bool toStorage;
+    unsigned int retries;
+    // Order in which the transfer was queued, so that transfers of equal priority start in order.
+    uint32_t sequenceNumber;
+    // Time on the monotonic clock, in milliseconds, before which a retried transfer is not started.
+    int64_t notBeforeMillis;
+} QueuedTransfer;
+
+// The slots for web transfers executed with cURL.
+static WebTransfer webTransfers[WEB_CLIENT_MAX_CONCURRENT_TRANSFERS];
+static size_t transferCount = 0;
+
+// The transfers waiting for a free slot.
+static QueuedTransfer transferQueue[WEB_CLIENT_MAX_QUEUED_TRANSFERS];
+static size_t queuedTransferCount = 0;
+static uint32_t nextQueueSequenceNumber = 0;
+
+// The web pages downloaded by WebClient_StartTransfers.
+static const char *const sampleUrls[] = {
     // Download a web page with a delay of 5 seconds with status 200.
-    {.url = "https://httpstat.us/200?sleep=5000", .easyHandle = NULL},
+    "https://httpstat.us/200?sleep=5000",
     // Download a web page with a delay of 1 second with status 400.
-    {.url = "https://httpstat.us/400?sleep=1000", .easyHandle = NULL}};
-static const size_t transferCount = sizeof(webTransfers) / sizeof(*webTransfers);
+    "https://httpstat.us/400?sleep=1000"};
+static const size_t sampleUrlCount = sizeof(sampleUrls) / sizeof(*sampleUrls);
 
 /// cURL transfers in progress (i.e. not completed) as reported by curl_multi_socket_action().
 static int runningEasyHandles = 0;
 /// Time out provided by cURL.
 static int curlTimeout = -1;
+/// Amount by which cURL's timeouts may be delayed so that they can be coalesced, in milliseconds.
+static unsigned int curlTimerSlackMillis = 0;
+/// Whether curlTimer is armed, and the time on the monotonic clock at which it expires.
+static bool curlTimerArmed = false;
+static int64_t curlTimerDeadlineMillis = 0;
 // The number of outstanding transfers in progress executed by cURL.
 size_t curlTransferInProgress = 0;
 // The maximum number of characters which are printed from the HTTP response body.
 static const size_t maxResponseCharsToPrint = 2048;
+// The largest Content-Length for which a single block is allocated in advance.
+static const curl_off_t maxPresizedResponseSize = 256 * 1024;
+// The maximum number of response chunks which may be allocated at once, across all transfers.
+static const size_t maxResponseChunks = 64;
+
+// Whether cURL was built with zlib, and so can decompress gzip and deflate content as it arrives.
+static bool contentDecodingSupported = false;
+
+// The certificates bundle which is used to authenticate the HTTPS server identity. It is read from
+// the image package once, and passed to each easy handle from memory, so that it is not read from
+// storage again for each new connection. If it cannot be read into memory, or cURL cannot take it
+// from memory, cURL reads the file at certificatePath instead.
+static const char certificateBundle[] = "certs/bundle.pem";
+static char *certificatePath = NULL;
+static uint8_t *certificateData = NULL;
+static size_t certificateDataSize = 0;
+
+// Function to stream response bodies to, or NULL if they are stored.
+static WebClient_ResponseDataCallbackType responseDataCallbackFunc = NULL;
+
+// The number of times a failed resumable download is retried before it is left until the next
+// restart.
+static const unsigned int maxDownloadRetries = 5;
+
+// Delay before the first retry of a failed resumable download, which doubles with each further
+// retry up to the maximum, so that a failing server is not retried in a tight loop.
+static const int64_t initialRetryDelayMillis = 1000;
+static const int64_t maxRetryDelayMillis = 30000;
+
+// Chunks which have been released are kept for reuse rather than freed, so that repeated
+// downloads do not fragment the heap.
+static ResponseChunk *freeChunks = NULL;
+static size_t allocatedChunks = 0;
 
 /// <summary>
 ///     Logs a cURL easy error.
@@ -88,40 +202,308 @@ static void LogCurlMultiError(const char *message, CURLMcode code)
     Log_Debug(" (curl multi err=%d, '%s')\n", code, curl_multi_strerror(code));
 }
 
+static void CurlProcessCompletedTransfer(void);
+
+/// <summary>
+///     Take a response chunk from the pool, allocating one if the pool is empty.
+/// </summary>
+/// <returns>The chunk, or NULL if the maximum number of chunks are in use.</returns>
+static ResponseChunk *AcquireResponseChunk(void)
+{
+    ResponseChunk *chunk = freeChunks;
+    if (chunk != NULL) {
+        freeChunks = chunk->next;
+    } else if (allocatedChunks < maxResponseChunks) {
+        chunk = malloc(sizeof(ResponseChunk));
+        if (chunk == NULL) {
+            LogErrno("ERROR: Out of memory, cannot allocate a response chunk");
+            return NULL;
+        }
+        ++allocatedChunks;
+    } else {
+        return NULL;
+    }
+
+    chunk->next = NULL;
+    chunk->size = 0;
+    return chunk;
+}
+
 /// <summary>
-///     cURL callback that aggregates all the downloaded chunks in a single
-///     memory block.
+///     Release a response's storage, returning its chunks to the pool.
+/// </summary>
+static void ReleaseResponse(HttpResponse *response)
+{
+    free(response->content.data);
+    response->content.data = NULL;
+    response->content.size = 0;
+    response->contentCapacity = 0;
+
+    if (response->lastChunk != NULL) {
+        response->lastChunk->next = freeChunks;
+        freeChunks = response->firstChunk;
+    }
+    response->firstChunk = NULL;
+    response->lastChunk = NULL;
+    response->totalSize = 0;
+}
+
+/// <summary>
+///     Free the chunks in the pool.
+/// </summary>
+static void FreeResponseChunks(void)
+{
+    while (freeChunks != NULL) {
+        ResponseChunk *next = freeChunks->next;
+        free(freeChunks);
+        freeChunks = next;
+        --allocatedChunks;
+    }
+}
+
+/// <summary>
+///     Store part of a response body, in the block allocated from the Content-Length while it
+///     fits, and otherwise in chunks.
+/// </summary>
+/// <returns>true if the data was stored; false if there is not enough memory.</returns>
+static bool StoreResponseData(HttpResponse *response, const uint8_t *data, size_t size)
+{
+    size_t blockSpace = response->contentCapacity - response->content.size;
+    size_t toBlock = (size < blockSpace) ? size : blockSpace;
+    if (toBlock > 0) {
+        memcpy(response->content.data + response->content.size, data, toBlock);
+        response->content.size += toBlock;
+        data += toBlock;
+        size -= toBlock;
+    }
+
+    while (size > 0) {
+        ResponseChunk *chunk = response->lastChunk;
+        if (chunk == NULL || chunk->size == RESPONSE_CHUNK_SIZE) {
+            chunk = AcquireResponseChunk();
+            if (chunk == NULL) {
+                return false;
+            }
+            if (response->lastChunk == NULL) {
+                response->firstChunk = chunk;
+            } else {
+                response->lastChunk->next = chunk;
+            }
+            response->lastChunk = chunk;
+        }
+
+        size_t chunkSpace = RESPONSE_CHUNK_SIZE - chunk->size;
+        size_t toChunk = (size < chunkSpace) ? size : chunkSpace;
+        memcpy(chunk->data + chunk->size, data, toChunk);
+        chunk->size += toChunk;
+        data += toChunk;
+        size -= toChunk;
+    }
+
+    return true;
+}
+
+/// <summary>
+///     cURL callback that receives the headers of each response. They are not stored; only the
+///     status line is logged.
+/// </summary>
+static size_t CurlHeaderCallback(char *buffer, size_t size, size_t itemsCount, void *userData)
+{
+    WebTransfer *transfer = (WebTransfer *)userData;
+    size_t headerSize = size * itemsCount;
+    if (headerSize > 5 && memcmp(buffer, "HTTP/", 5) == 0) {
+        // Trim the trailing CRLF.
+        size_t length = headerSize;
+        while (length > 0 && (buffer[length - 1] == '\r' || buffer[length - 1] == '\n')) {
+            --length;
+        }
+        Log_Debug("%s: %.*s\n", transfer->url, (int)length, buffer);
+    }
+    return headerSize;
+}
+
+/// <summary>
+///     Write part of a resumable download to mutable storage. The status of the response is checked
+///     when the first data arrives, since the server may not honour the Range request.
+/// </summary>
+/// <returns>The number of bytes handled; anything else makes cURL fail the transfer.</returns>
+static size_t StoreResumableDownloadData(WebTransfer *transfer, const uint8_t *data, size_t size)
+{
+    if (!transfer->responseChecked) {
+        transfer->responseChecked = true;
+
+        long responseCode = 0;
+        curl_easy_getinfo(transfer->easyHandle, CURLINFO_RESPONSE_CODE, &responseCode);
+        // cURL normally fails a transfer whose server ignores the Range request with
+        // CURLE_RANGE_ERROR before any data arrives, but should the content from the start arrive
+        // instead, it is not appended to the stored part; the download restarts once this
+        // transfer completes (see CompleteResumableDownload). Nor is an error page stored as
+        // content.
+        if ((responseCode == 200 && transfer->resumeOffset > 0) ||
+            (responseCode != 200 && responseCode != 206)) {
+            transfer->discardContent = true;
+        }
+
+        curl_off_t contentLength = -1;
+        if (!transfer->discardContent &&
+            curl_easy_getinfo(transfer->easyHandle, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T,
+                              &contentLength) == CURLE_OK &&
+            contentLength >= 0 &&
+            !ResumableDownload_SetTotalSize(transfer->resumeOffset + (size_t)contentLength)) {
+            return 0;
+        }
+    }
+
+    if (transfer->discardContent) {
+        return size;
+    }
+
+    if (!ResumableDownload_Write(data, size)) {
+        return 0;
+    }
+
+    transfer->httpResponse.totalSize += size;
+    return size;
+}
+
+/// <summary>
+///     cURL callback that receives each part of a response body as it is downloaded, and either
+///     streams it to the application or stores it.
 /// </summary>
 /// <param name="chunks">The pointer to the chunks array</param>
 /// <param name="chunkSize">The size of each chunk</param>
 /// <param name="chunksCount">The count of the chunks</param>
-/// <param name="memoryBlock">The pointer where all the downloaded chunks are aggregated</param>
+/// <param name="userData">The web transfer the data belongs to</param>
+/// <returns>The number of bytes handled; anything else makes cURL fail the transfer.</returns>
 static size_t CurlStoreDownloadedContentCallback(void *chunks, size_t chunkSize, size_t chunksCount,
                                                  void *userData)
 {
-    MemoryBlock *block = (MemoryBlock *)userData;
+    WebTransfer *transfer = (WebTransfer *)userData;
+    HttpResponse *response = &transfer->httpResponse;
     size_t additionalDataSize = chunkSize * chunksCount;
-    block->data = realloc(block->data, block->size + additionalDataSize + 1);
-    if (block->data == NULL) {
-        LogErrno("ERROR: Out of memory, realloc returned NULL");
-        abort();
-    }
-    memcpy(block->data + block->size, chunks, additionalDataSize);
-    block->size += additionalDataSize;
-    block->data[block->size] = 0; // Ensure the block of memory is null terminated.
+
+    if (transfer->toStorage) {
+        return StoreResumableDownloadData(transfer, chunks, additionalDataSize);
+    }
+
+    if (responseDataCallbackFunc != NULL) {
+        responseDataCallbackFunc(transfer->url, chunks, additionalDataSize);
+        response->totalSize += additionalDataSize;
+        return additionalDataSize;
+    }
+
+    // Once the headers have been received, size the content block from the Content-Length.
+    if (response->totalSize == 0 && response->contentCapacity == 0) {
+        curl_off_t contentLength = -1;
+        if (curl_easy_getinfo(transfer->easyHandle, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T,
+                              &contentLength) == CURLE_OK &&
+            contentLength > 0 && contentLength <= maxPresizedResponseSize) {
+            response->content.data = malloc((size_t)contentLength);
+            if (response->content.data != NULL) {
+                response->contentCapacity = (size_t)contentLength;
+            }
+        }
+    }
+
+    if (!StoreResponseData(response, chunks, additionalDataSize)) {
+        Log_Debug("ERROR: Not enough memory to store the response from %s.\n", transfer->url);
+        return 0;
+    }
+
+    response->totalSize += additionalDataSize;
     return additionalDataSize;
 }
 
 /// <summary>
-///     Creates an cURL easy handle to download the specified URL.
+///     Reads the certificates bundle into memory. On failure, certificateData is left NULL, and
+///     cURL reads the file for each connection instead.
+/// </summary>
+static void LoadCertificates(void)
+{
+    int fd = Storage_OpenFileInImagePackage(certificateBundle);
+    if (fd == -1) {
+        LogErrno("WARNING: Could not open the certificates bundle");
+        return;
+    }
+
+    struct stat fileStatus;
+    if (fstat(fd, &fileStatus) == -1 || fileStatus.st_size <= 0) {
+        goto errorLabel;
+    }
+
+    certificateDataSize = (size_t)fileStatus.st_size;
+    certificateData = malloc(certificateDataSize);
+    if (certificateData == NULL) {
+        goto errorLabel;
+    }
+
+    size_t offset = 0;
+    while (offset < certificateDataSize) {
+        ssize_t bytesRead = read(fd, certificateData + offset, certificateDataSize - offset);
+        if (bytesRead <= 0) {
+            goto errorLabel;
+        }
+        offset += (size_t)bytesRead;
+    }
+
+    close(fd);
+    return;
+
+errorLabel:
+    Log_Debug("WARNING: Could not read the certificates bundle into memory.\n");
+    free(certificateData);
+    certificateData = NULL;
+    certificateDataSize = 0;
+    close(fd);
+}
+
+/// <summary>
+///     Sets the certificates which cURL uses to validate the server certificate: from memory, if
+///     cURL and its TLS backend support CURLOPT_CAINFO_BLOB, or else from the file.
+/// </summary>
+/// <param name="easyHandle">The easy handle</param>
+/// <returns>The result of curl_easy_setopt</returns>
+static CURLcode CurlSetCertificates(CURL *easyHandle)
+{
+#if LIBCURL_VERSION_NUM >= 0x074D00
+    if (certificateData != NULL) {
+        struct curl_blob blob = {
+            .data = certificateData, .len = certificateDataSize, .flags = CURL_BLOB_NOCOPY};
+        CURLcode res = curl_easy_setopt(easyHandle, CURLOPT_CAINFO_BLOB, &blob);
+        if (res != CURLE_NOT_BUILT_IN && res != CURLE_UNKNOWN_OPTION) {
+            return res;
+        }
+
+        Log_Debug("INFO: cURL cannot take the certificates from memory; it reads the file.\n");
+        free(certificateData);
+        certificateData = NULL;
+        certificateDataSize = 0;
+    }
+#endif
+    return curl_easy_setopt(easyHandle, CURLOPT_CAINFO, certificatePath);
+}
+
+/// <summary>
+///     Releases the certificates bundle path and data.
+/// </summary>
+static void FreeCertificates(void)
+{
+    free(certificateData);
+    certificateData = NULL;
+    certificateDataSize = 0;
+    free(certificatePath);
+    certificatePath = NULL;
+}
+
+/// <summary>
+///     Creates an cURL easy handle for a transfer slot. The URL is set when a transfer is started.
 ///     Note that:
 ///         - download is restricted to HTTP and HTTPS protocols only;
 ///         - redirects are followed;
 ///         - it is necessary to update the AllowedConnection's hostnames
 ///           in app_manifest.json.
 /// </summary>
-/// <param name="url">HTTP or HTTPS URL to download</param>
-/// <param name="response">Storage of the response</param>
+/// <param name="transfer">The web transfer slot, which holds the storage of the response</param>
 /// <param name="callerExitCode">
 ///     Set to ExitCode_Success if succeeded, in which case the return value is non-NULL.
 ///     Otherwise set to another exit code which indicates the specific failure.
@@ -130,12 +512,10 @@ static size_t CurlStoreDownloadedContentCallback(void *chunks, size_t chunkSize,
 ///     Pointer to a curl easy handle, which must be disposed of with curl_easy_cleanup.
 ///     On failure, returns NULL and puts a specific failure reason in *status.
 /// </returns>
-static CURL *CurlSetupEasyHandle(char *url, HttpResponse *response, ExitCode *callerExitCode)
+static CURL *CurlSetupEasyHandle(WebTransfer *transfer, ExitCode *callerExitCode)
 {
     CURL *returnedEasyHandle = NULL; // Easy cURL handle for a transfer.
     CURLcode res = 0;
-    // Certificates bundle path storage.
-    char *certificatePath = NULL;
 
     // Create the cURL easy handle.
     CURL *easyHandle = NULL;
@@ -145,13 +525,6 @@ static CURL *CurlSetupEasyHandle(char *url, HttpResponse *response, ExitCode *ca
         goto errorLabel;
     }
 
-    // Set the URL to be downloaded.
-    if ((res = curl_easy_setopt(easyHandle, CURLOPT_URL, url)) != CURLE_OK) {
-        LogCurlEasyError("curl_easy_setopt CURLOPT_URL", res);
-        *callerExitCode = ExitCode_CurlSetupEasy_OptUrl;
-        goto errorLabel;
-    }
-
     // Follow redirect, i.e. 3xx statuses.
     if ((res = curl_easy_setopt(easyHandle, CURLOPT_FOLLOWLOCATION, 1L)) != CURLE_OK) {
         LogCurlEasyError("curl_easy_setopt CURLOPT_FOLLOWLOCATION", res);
@@ -181,21 +554,53 @@ static CURL *CurlSetupEasyHandle(char *url, HttpResponse *response, ExitCode *ca
         goto errorLabel;
     }
 
-    // Set the custom parameter of the callback to the memory block.
-    if ((res = curl_easy_setopt(easyHandle, CURLOPT_WRITEDATA, (void *)&response->content)) !=
-        CURLE_OK) {
+    // Set the custom parameter of the callback to the web transfer.
+    if ((res = curl_easy_setopt(easyHandle, CURLOPT_WRITEDATA, (void *)transfer)) != CURLE_OK) {
         LogCurlEasyError("curl_easy_setopt CURLOPT_WRITEDATA", res);
         *callerExitCode = ExitCode_CurlSetupEasy_OptWriteData;
         goto errorLabel;
     }
 
+    // Receive the headers separately, so that they are not stored with the content.
+    if ((res = curl_easy_setopt(easyHandle, CURLOPT_HEADERFUNCTION, &CurlHeaderCallback)) !=
+        CURLE_OK) {
+        LogCurlEasyError("curl_easy_setopt CURLOPT_HEADERFUNCTION", res);
+        *callerExitCode = ExitCode_CurlSetupEasy_OptHeaderFunction;
+        goto errorLabel;
+    }
+
     // Set the custom parameter of the for headers retrieval.
-    if ((res = curl_easy_setopt(easyHandle, CURLOPT_HEADERDATA, (void *)response)) != CURLE_OK) {
+    if ((res = curl_easy_setopt(easyHandle, CURLOPT_HEADERDATA, (void *)transfer)) != CURLE_OK) {
         LogCurlEasyError("curl_easy_setopt CURLOPT_HEADERDATA", res);
         *callerExitCode = ExitCode_CurlSetupEasy_OptHeaderData;
         goto errorLabel;
     }
 
+    // Share the DNS and TLS session caches with the other easy handles.
+    if ((res = curl_easy_setopt(easyHandle, CURLOPT_SHARE, curlShare)) != CURLE_OK) {
+        LogCurlEasyError("curl_easy_setopt CURLOPT_SHARE", res);
+        *callerExitCode = ExitCode_CurlSetupEasy_OptShare;
+        goto errorLabel;
+    }
+
+    // Use HTTP/2 for HTTPS where the server offers it, so that transfers to the same host can be
+    // multiplexed over one connection. This fails if cURL was built without HTTP/2 support, in
+    // which case HTTP/1.1 is used.
+    if ((res = curl_easy_setopt(easyHandle, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2TLS)) !=
+        CURLE_OK) {
+        LogCurlEasyError("INFO: HTTP/2 is not available", res);
+    }
+
+    // Ask for compressed content where cURL can decompress it. cURL then sends an Accept-Encoding
+    // header for the encodings it supports, and inflates the content incrementally, with a
+    // fixed-size window, before passing it to the write callback.
+    if (contentDecodingSupported &&
+        (res = curl_easy_setopt(easyHandle, CURLOPT_ACCEPT_ENCODING, "")) != CURLE_OK) {
+        LogCurlEasyError("curl_easy_setopt CURLOPT_ACCEPT_ENCODING", res);
+        *callerExitCode = ExitCode_CurlSetupEasy_OptAcceptEncoding;
+        goto errorLabel;
+    }
+
     // Specify a user agent.
     if ((res = curl_easy_setopt(easyHandle, CURLOPT_USERAGENT, "libcurl/1.0")) != CURLE_OK) {
         LogCurlEasyError("curl_easy_setopt CURLOPT_USERAGENT", res);
@@ -203,17 +608,8 @@ static CURL *CurlSetupEasyHandle(char *url, HttpResponse *response, ExitCode *ca
         goto errorLabel;
     }
 
-    // Get the full path to the certificates bundle file used to authenticate the HTTPS server
-    // identity.
-    certificatePath = Storage_GetAbsolutePathInImagePackage("certs/bundle.pem");
-    if (certificatePath == NULL) {
-        LogErrno("ERROR: The certificate path could not be resolved");
-        *callerExitCode = ExitCode_CurlSetupEasy_StoragePath;
-        goto errorLabel;
-    }
-
-    // Set the path for the certificate file that cURL uses to validate the server certificate.
-    if ((res = curl_easy_setopt(easyHandle, CURLOPT_CAINFO, certificatePath)) != CURLE_OK) {
+    // Set the certificates that cURL uses to validate the server certificate.
+    if ((res = CurlSetCertificates(easyHandle)) != CURLE_OK) {
         LogCurlEasyError("curl_easy_setopt CURLOPT_CAINFO", res);
         *callerExitCode = ExitCode_CurlSetupEasy_CAInfo;
         goto errorLabel;
@@ -234,7 +630,6 @@ errorLabel:
         curl_easy_cleanup(easyHandle);
     }
 
-    free(certificatePath);
     return returnedEasyHandle;
 }
 
@@ -244,11 +639,17 @@ errorLabel:
 static void CurlProcessTransfers(void)
 {
     CURLMcode code;
-    if ((code = curl_multi_socket_action(curlMulti, CURL_SOCKET_TIMEOUT, 0, &runningEasyHandles)) !=
-        CURLM_OK) {
+    int newRunningEasyHandles = 0;
+    if ((code = curl_multi_socket_action(curlMulti, CURL_SOCKET_TIMEOUT, 0,
+                                         &newRunningEasyHandles)) != CURLM_OK) {
         LogCurlMultiError("curl_multi_socket_action", code);
         return;
     }
+    // Transfers can also complete here, for example when they time out.
+    if (newRunningEasyHandles != runningEasyHandles) {
+        CurlProcessCompletedTransfer();
+    }
+    runningEasyHandles = newRunningEasyHandles;
 }
 
 /// <summary>
@@ -256,6 +657,8 @@ static void CurlProcessTransfers(void)
 /// </summary>
 static void CurlTimerEventHandler(EventLoopTimer *timer)
 {
+    curlTimerArmed = false;
+
     if (ConsumeEventLoopTimerEvent(timer) != 0) {
         Log_Debug("ERROR: cannot consume the timer event.\n");
         return;
@@ -265,35 +668,378 @@ static void CurlTimerEventHandler(EventLoopTimer *timer)
 }
 
 /// <summary>
-///     Print the response contents, truncating if required.
+///     Print the part of a response stored in one block of memory, up to a limit.
 /// </summary>
-/// <param name="data">
-///     Content as null-terminated string.
-/// </param>
-/// <param name="actualLength">
-///     Length of response in characters. Does not include null terminator.
+/// <param name="data">The data to print.</param>
+/// <param name="size">Size of the data in bytes.</param>
+/// <param name="remainingPrintLength">
+///     Number of characters which may still be printed; reduced by the number printed.
 /// </param>
+static void PrintResponsePart(const uint8_t *data, size_t size, size_t *remainingPrintLength)
+{
+    size_t printLength = (size < *remainingPrintLength) ? size : *remainingPrintLength;
+    if (printLength > 0) {
+        Log_Debug("%.*s", (int)printLength, (const char *)data);
+        *remainingPrintLength -= printLength;
+    }
+}
+
+/// <summary>
+///     Print the response contents, truncating if required.
+/// </summary>
+/// <param name="response">The stored response.</param>
 /// <param name="maxPrintLength">
 ///     Maximum number of characters to print from response. Response is
-///     truncated if <paramref name="actualLength" /> &gt;
-///     <paramref name="maxPrintLength" />.
+///     truncated if it is longer than <paramref name="maxPrintLength" />.
 /// </param>
-static void PrintResponse(const char *data, size_t actualLength, size_t maxPrintLength)
+static void PrintResponse(const HttpResponse *response, size_t maxPrintLength)
 {
+    size_t actualLength = response->totalSize;
     if (maxPrintLength >= actualLength) {
         Log_Debug(" -===- Downloaded content (%zu bytes): -===- \n\n", actualLength);
-        Log_Debug("%s\n", data);
-        Log_Debug(" -===- End of downloaded content. -===- \n");
     } else {
         Log_Debug(" -===- Downloaded content (%zu bytes; displaying %zu): -===- \n\n", actualLength,
                   maxPrintLength);
-        Log_Debug("%.*s\n", maxPrintLength, data);
+    }
+
+    size_t remainingPrintLength = maxPrintLength;
+    PrintResponsePart(response->content.data, response->content.size, &remainingPrintLength);
+    for (const ResponseChunk *chunk = response->firstChunk; chunk != NULL; chunk = chunk->next) {
+        PrintResponsePart(chunk->data, chunk->size, &remainingPrintLength);
+    }
+    Log_Debug("\n");
+
+    if (maxPrintLength >= actualLength) {
+        Log_Debug(" -===- End of downloaded content. -===- \n");
+    } else {
         Log_Debug(" -===- End of partial downloaded content. -===- \n");
     }
 }
 
 /// <summary>
-///     Process a completed web transfer by display HTTP status and content of the transfer.
+///     Get one of cURL's timings of a transfer, in microseconds since the transfer started.
+/// </summary>
+static curl_off_t GetTransferTime(CURL *easyHandle, CURLINFO info)
+{
+    curl_off_t time = 0;
+    if (curl_easy_getinfo(easyHandle, info, &time) != CURLE_OK) {
+        return 0;
+    }
+    return time;
+}
+
+/// <summary>
+///     Record the timings of the phases of a completed transfer, and the bytes it transferred.
+/// </summary>
+/// <param name="transfer">The completed transfer.</param>
+/// <param name="madeNewConnection">true if the transfer made a new connection.</param>
+static void RecordTimings(WebTransfer *transfer, bool madeNewConnection)
+{
+    CURL *e = transfer->easyHandle;
+
+    // cURL's timings are cumulative from the start of the transfer.
+    curl_off_t nameLookup = GetTransferTime(e, CURLINFO_NAMELOOKUP_TIME_T);
+    curl_off_t connect = GetTransferTime(e, CURLINFO_CONNECT_TIME_T);
+    curl_off_t appConnect = GetTransferTime(e, CURLINFO_APPCONNECT_TIME_T);
+    curl_off_t preTransfer = GetTransferTime(e, CURLINFO_PRETRANSFER_TIME_T);
+    curl_off_t startTransfer = GetTransferTime(e, CURLINFO_STARTTRANSFER_TIME_T);
+    curl_off_t total = GetTransferTime(e, CURLINFO_TOTAL_TIME_T);
+
+    if (madeNewConnection) {
+        TimingHistogram_Add(&dnsHistogram, (uint64_t)nameLookup);
+        if (connect >= nameLookup) {
+            TimingHistogram_Add(&connectHistogram, (uint64_t)(connect - nameLookup));
+        }
+        if (appConnect > 0 && appConnect >= connect) {
+            TimingHistogram_Add(&tlsHistogram, (uint64_t)(appConnect - connect));
+        }
+    }
+    if (startTransfer >= preTransfer && startTransfer > 0) {
+        TimingHistogram_Add(&firstByteHistogram, (uint64_t)(startTransfer - preTransfer));
+    }
+    TimingHistogram_Add(&totalHistogram, (uint64_t)total);
+
+    curl_off_t downloaded = 0, uploaded = 0;
+    curl_easy_getinfo(e, CURLINFO_SIZE_DOWNLOAD_T, &downloaded);
+    curl_easy_getinfo(e, CURLINFO_SIZE_UPLOAD_T, &uploaded);
+    bytesDownloaded += (uint64_t)downloaded;
+    bytesUploaded += (uint64_t)uploaded;
+
+    Log_Debug("INFO: %s: DNS %lld us, connect %lld us, TLS %lld us, first byte %lld us, total %lld "
+              "us; %lld bytes downloaded\n",
+              transfer->url, (long long)nameLookup, (long long)(connect - nameLookup),
+              (long long)((appConnect > 0) ? appConnect - connect : 0),
+              (long long)(startTransfer - preTransfer), (long long)total, (long long)downloaded);
+}
+
+/// <summary>
+///     Count the connections made by a completed transfer.
+/// </summary>
+/// <param name="transfer">The completed transfer.</param>
+static void UpdateStatistics(WebTransfer *transfer)
+{
+    CURL *easyHandle = transfer->easyHandle;
+    statistics.completedTransfers++;
+
+    long newConnections = 0;
+    if (curl_easy_getinfo(easyHandle, CURLINFO_NUM_CONNECTS, &newConnections) == CURLE_OK) {
+        if (newConnections == 0) {
+            statistics.reusedConnections++;
+        } else {
+            statistics.newConnections += (size_t)newConnections;
+
+            // The time to complete the TLS handshake is only set if one was made.
+            curl_off_t appConnectTime = 0;
+            if (curl_easy_getinfo(easyHandle, CURLINFO_APPCONNECT_TIME_T, &appConnectTime) ==
+                    CURLE_OK &&
+                appConnectTime > 0) {
+                statistics.tlsHandshakes++;
+            }
+        }
+    }
+
+    long httpVersion = 0;
+    if (curl_easy_getinfo(easyHandle, CURLINFO_HTTP_VERSION, &httpVersion) == CURLE_OK &&
+        httpVersion == CURL_HTTP_VERSION_2_0) {
+        statistics.http2Transfers++;
+    }
+
+    RecordTimings(transfer, newConnections > 0);
+
+    Log_Debug("INFO: %zu transfers: %zu new connections (%zu TLS handshakes), %zu reused, %zu over "
+              "HTTP/2.\n",
+              statistics.completedTransfers, statistics.newConnections, statistics.tlsHandshakes,
+              statistics.reusedConnections, statistics.http2Transfers);
+}
+
+/// <summary>
+///     Gets the time on the monotonic clock in milliseconds.
+/// </summary>
+static int64_t GetMonotonicMillis(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/// <summary>
+///     Add a transfer to the queue, without starting it.
+/// </summary>
+/// <param name="delayMillis">Time for which the transfer is held before it is started.</param>
+/// <returns>0 on success, -1 if the URL is too long or the queue is full</returns>
+static int QueueTransfer(const char *url, int priority, bool toStorage, unsigned int retries,
+                         int64_t delayMillis)
+{
+    if (strlen(url) > WEB_CLIENT_MAX_URL_LENGTH) {
+        Log_Debug("ERROR: URL too long to queue: %s\n", url);
+        return -1;
+    }
+
+    if (queuedTransferCount == WEB_CLIENT_MAX_QUEUED_TRANSFERS) {
+        Log_Debug("ERROR: Transfer queue full; cannot queue %s\n", url);
+        return -1;
+    }
+
+    QueuedTransfer *queued = &transferQueue[queuedTransferCount++];
+    strcpy(queued->url, url);
+    queued->priority = priority;
+    queued->toStorage = toStorage;
+    queued->retries = retries;
+    queued->sequenceNumber = nextQueueSequenceNumber++;
+    queued->notBeforeMillis = (delayMillis > 0) ? GetMonotonicMillis() + delayMillis : 0;
+    return 0;
+}
+
+/// <summary>
+///     Arm the retry timer to expire when the earliest held transfer becomes due, if any is held.
+/// </summary>
+static void ArmRetryTimer(int64_t nowMillis)
+{
+    int64_t earliestMillis = INT64_MAX;
+    for (size_t i = 0; i < queuedTransferCount; i++) {
+        if (transferQueue[i].notBeforeMillis > nowMillis &&
+            transferQueue[i].notBeforeMillis < earliestMillis) {
+            earliestMillis = transferQueue[i].notBeforeMillis;
+        }
+    }
+
+    if (earliestMillis == INT64_MAX) {
+        return;
+    }
+
+    int64_t delayMillis = earliestMillis - nowMillis;
+    const struct timespec delay = {.tv_sec = delayMillis / 1000,
+                                   .tv_nsec = (delayMillis % 1000) * 1000000};
+    if (SetEventLoopTimerOneShot(retryTimer, &delay) != 0) {
+        Log_Debug("ERROR: Could not arm the retry timer.\n");
+    }
+}
+
+/// <summary>
+///     Start queued transfers while there are free slots, highest priority first. Transfers which
+///     are held for a retry delay are started by the retry timer once the delay has passed.
+/// </summary>
+static void StartQueuedTransfers(void)
+{
+    int64_t nowMillis = GetMonotonicMillis();
+    for (size_t slot = 0; slot < transferCount && queuedTransferCount > 0; slot++) {
+        WebTransfer *transfer = &webTransfers[slot];
+        if (transfer->inProgress) {
+            continue;
+        }
+
+        // Find the due queued transfer with the highest priority which was queued first.
+        size_t next = queuedTransferCount;
+        for (size_t i = 0; i < queuedTransferCount; i++) {
+            if (transferQueue[i].notBeforeMillis > nowMillis) {
+                continue;
+            }
+            if (next == queuedTransferCount ||
+                transferQueue[i].priority > transferQueue[next].priority ||
+                (transferQueue[i].priority == transferQueue[next].priority &&
+                 (int32_t)(transferQueue[i].sequenceNumber - transferQueue[next].sequenceNumber) <
+                     0)) {
+                next = i;
+            }
+        }
+        if (next == queuedTransferCount) {
+            break;
+        }
+
+        memcpy(transfer->url, transferQueue[next].url, sizeof(transfer->url));
+        transfer->toStorage = transferQueue[next].toStorage;
+        transfer->retries = transferQueue[next].retries;
+        transfer->priority = transferQueue[next].priority;
+        transferQueue[next] = transferQueue[--queuedTransferCount];
+
+        // A resumable download asks for the content from the end of what is already stored.
+        // The easy handles are reused, so this is reset for other transfers.
+        transfer->resumeOffset = 0;
+        transfer->responseChecked = false;
+        transfer->discardContent = false;
+        if (transfer->toStorage &&
+            !ResumableDownload_Begin(transfer->url, &transfer->resumeOffset)) {
+            continue;
+        }
+
+        CURLcode res;
+        if ((res = curl_easy_setopt(transfer->easyHandle, CURLOPT_URL, transfer->url)) !=
+            CURLE_OK) {
+            LogCurlEasyError("curl_easy_setopt CURLOPT_URL", res);
+            if (transfer->toStorage) {
+                ResumableDownload_End(false);
+            }
+            continue;
+        }
+
+        // The Range of a resumable download must be of the decoded content, so compressed content
+        // is not requested for it.
+        if (contentDecodingSupported &&
+            (res = curl_easy_setopt(transfer->easyHandle, CURLOPT_ACCEPT_ENCODING,
+                                    transfer->toStorage ? NULL : "")) != CURLE_OK) {
+            LogCurlEasyError("curl_easy_setopt CURLOPT_ACCEPT_ENCODING", res);
+            if (transfer->toStorage) {
+                ResumableDownload_End(false);
+            }
+            continue;
+        }
+
+        if ((res = curl_easy_setopt(transfer->easyHandle, CURLOPT_RESUME_FROM_LARGE,
+                                    (curl_off_t)transfer->resumeOffset)) != CURLE_OK) {
+            LogCurlEasyError("curl_easy_setopt CURLOPT_RESUME_FROM_LARGE", res);
+            if (transfer->toStorage) {
+                ResumableDownload_End(false);
+            }
+            continue;
+        }
+
+        CURLMcode code;
+        if ((code = curl_multi_add_handle(curlMulti, transfer->easyHandle)) != CURLM_OK) {
+            LogCurlMultiError("curl_multi_add_handle", code);
+            if (transfer->toStorage) {
+                ResumableDownload_End(false);
+            }
+            continue;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &transfer->startTime);
+        transfer->inProgress = true;
+        curlTransferInProgress++;
+    }
+
+    ArmRetryTimer(nowMillis);
+}
+
+/// <summary>
+///     Single shot timer event handler to start transfers whose retry delay has passed.
+/// </summary>
+static void RetryTimerEventHandler(EventLoopTimer *timer)
+{
+    if (ConsumeEventLoopTimerEvent(timer) != 0) {
+        Log_Debug("ERROR: cannot consume the timer event.\n");
+        return;
+    }
+
+    StartQueuedTransfers();
+}
+
+/// <summary>
+///     Commit what has been received of a resumable download, and queue it again to resume if it
+///     did not complete.
+/// </summary>
+static void CompleteResumableDownload(WebTransfer *transfer, CURLcode result)
+{
+    long responseCode = 0;
+    curl_easy_getinfo(transfer->easyHandle, CURLINFO_RESPONSE_CODE, &responseCode);
+
+    // A server which ignores the Range request sends the content from the start, which cURL
+    // reports as CURLE_RANGE_ERROR; the stored part is then discarded, so that the retry requests
+    // the whole content rather than failing again at the same offset.
+    bool rangeIgnored = (result == CURLE_RANGE_ERROR) ||
+                        (result == CURLE_OK && responseCode == 200 && transfer->resumeOffset > 0);
+    if (rangeIgnored) {
+        Log_Debug("INFO: Server ignored the request to resume %s from byte %zu\n", transfer->url,
+                  transfer->resumeOffset);
+        ResumableDownload_Restart();
+        transfer->resumeOffset = 0;
+    }
+
+    // A server responds with 416 Range Not Satisfiable if everything has already been received.
+    bool complete = !rangeIgnored && (result == CURLE_OK) &&
+                    (responseCode == 200 || responseCode == 206 ||
+                     (responseCode == 416 && transfer->resumeOffset > 0));
+    size_t storedSize = ResumableDownload_End(complete);
+
+    if (complete) {
+        Log_Debug(" -===- Downloaded content stored (%zu bytes) -===- \n", storedSize);
+        return;
+    }
+
+    if (!rangeIgnored) {
+        if (result != CURLE_OK) {
+            LogCurlEasyError("ERROR: Resumable download failed", result);
+        } else {
+            Log_Debug("ERROR: Resumable download failed with HTTP status %ld\n", responseCode);
+        }
+    }
+    Log_Debug("INFO: %zu bytes of %s are stored\n", storedSize, transfer->url);
+
+    if (transfer->retries < maxDownloadRetries) {
+        int64_t delayMillis = initialRetryDelayMillis << transfer->retries;
+        if (delayMillis > maxRetryDelayMillis) {
+            delayMillis = maxRetryDelayMillis;
+        }
+        Log_Debug("INFO: Retrying the download in %lld ms\n", (long long)delayMillis);
+        QueueTransfer(transfer->url, transfer->priority, true, transfer->retries + 1,
+                      delayMillis);
+    } else {
+        Log_Debug("INFO: Download will resume when the application next starts\n");
+    }
+}
+
+/// <summary>
+///     Process a completed web transfer by display HTTP status and content of the transfer, then
+///     start any queued transfers in the slots which have been freed.
 /// </summary>
 static void CurlProcessCompletedTransfer(void)
 {
@@ -302,10 +1048,9 @@ static void CurlProcessCompletedTransfer(void)
         int msgq = 0;
         curlMessage = curl_multi_info_read(curlMulti, &msgq);
         if ((curlMessage != NULL) && (curlMessage->msg == CURLMSG_DONE)) {
-            curlTransferInProgress--;
             CURL *e = curlMessage->easy_handle;
             for (size_t i = 0; i < transferCount; i++) {
-                if (webTransfers[i].easyHandle == e) {
+                if (webTransfers[i].easyHandle == e && webTransfers[i].inProgress) {
                     struct timespec currentTime;
                     clock_gettime(CLOCK_MONOTONIC, &currentTime);
                     // Display the HTTP status header and the content of the completed web transfer.
@@ -316,17 +1061,35 @@ static void CurlProcessCompletedTransfer(void)
                         (currentTime.tv_sec - webTransfers[i].startTime.tv_sec) * 1000 +
                             (currentTime.tv_nsec - webTransfers[i].startTime.tv_nsec) / 1000000);
 
-                    PrintResponse(webTransfers[i].httpResponse.content.data,
-                                  webTransfers[i].httpResponse.content.size,
-                                  maxResponseCharsToPrint);
-
-                    free(webTransfers[i].httpResponse.content.data);
-                    webTransfers[i].httpResponse.content.data = 0;
-                    webTransfers[i].httpResponse.content.size = 0;
+                    UpdateStatistics(&webTransfers[i]);
+
+                    if (webTransfers[i].toStorage) {
+                        CompleteResumableDownload(&webTransfers[i], curlMessage->data.result);
+                    } else if (curlMessage->data.result != CURLE_OK) {
+                        LogCurlEasyError("ERROR: Transfer failed", curlMessage->data.result);
+                    } else if (responseDataCallbackFunc != NULL) {
+                        Log_Debug(" -===- Downloaded content (%zu bytes) -===- \n",
+                                  webTransfers[i].httpResponse.totalSize);
+                    } else {
+                        PrintResponse(&webTransfers[i].httpResponse, maxResponseCharsToPrint);
+                    }
+
+                    ReleaseResponse(&webTransfers[i].httpResponse);
+
+                    // Free the slot for the next transfer. The result of the transfer has been
+                    // read, so the message is not needed once the handle is removed.
+                    CURLMcode code;
+                    if ((code = curl_multi_remove_handle(curlMulti, e)) != CURLM_OK) {
+                        LogCurlMultiError("curl_multi_remove_handle", code);
+                    }
+                    webTransfers[i].inProgress = false;
+                    curlTransferInProgress--;
                 }
             }
         }
     } while (curlMessage);
+
+    StartQueuedTransfers();
 }
 
 /// <summary>
@@ -412,15 +1175,39 @@ static int CurlTimerCallback(CURLM *multi, long timeoutMillis, void *unused)
 
     // A value of -1 means the timer does not need to be started.
     if (timeoutMillis != -1) {
-        // Invoke cURL immediately if requested to do so.
-        if (timeoutMillis == 0) {
-            CurlProcessTransfers();
-        } else {
-            // Start a single shot timer with the period as provided by cURL.
-            // The timer handler will invoke cURL to process the web transfers.
-            const struct timespec timeout = {.tv_sec = timeoutMillis / 1000,
-                                             .tv_nsec = (timeoutMillis % 1000) * 1000000};
-            SetEventLoopTimerOneShot(curlTimer, &timeout);
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        int64_t nowMillis = (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+        int64_t requestedMillis = nowMillis + timeoutMillis;
+
+        // cURL tolerates being invoked late, so if the timer is already armed to expire within the
+        // slack after the requested time, leave it; this avoids re-arming the timer each time cURL
+        // asks for a slightly different timeout during active transfers.
+        if (curlTimerArmed && curlTimerDeadlineMillis >= requestedMillis &&
+            curlTimerDeadlineMillis - requestedMillis <= curlTimerSlackMillis) {
+            return 0;
+        }
+
+        // Otherwise, round the deadline up to a multiple of the slack, so that timeouts requested
+        // at nearby times expire together.
+        int64_t deadlineMillis = requestedMillis;
+        if (curlTimerSlackMillis > 0) {
+            deadlineMillis += curlTimerSlackMillis - 1;
+            deadlineMillis -= deadlineMillis % curlTimerSlackMillis;
+        }
+        int64_t delayMillis = deadlineMillis - nowMillis;
+
+        // Start a single shot timer with the period as provided by cURL.
+        // The timer handler will invoke cURL to process the web transfers. If cURL asks to be
+        // invoked immediately, the shortest possible timer is used, because cURL must not be
+        // called, nor transfers started, from within one of its own callbacks.
+        const struct timespec timeout = {.tv_sec = delayMillis / 1000,
+                                         .tv_nsec = (delayMillis % 1000) * 1000000};
+        const struct timespec immediately = {.tv_sec = 0, .tv_nsec = 1};
+        if (SetEventLoopTimerOneShot(curlTimer, (delayMillis == 0) ? &immediately : &timeout) ==
+            0) {
+            curlTimerArmed = true;
+            curlTimerDeadlineMillis = deadlineMillis;
         }
     }
 
@@ -428,7 +1215,8 @@ static int CurlTimerCallback(CURLM *multi, long timeoutMillis, void *unused)
 }
 
 /// <summary>
-///     Initializes the cURL library for downloading concurrently a set of web pages.
+///     Initializes the cURL library, and an easy handle for each transfer slot, for downloading
+///     concurrently a set of web pages.
 /// </summary>
 /// <returns>
 ///     ExitCode_Success if all resources were allocated successfully; otherwise another
@@ -444,11 +1232,48 @@ static ExitCode CurlInit(void)
     }
     Log_Debug("Using %s\n", curl_version());
 
+    curl_version_info_data *versionInfo = curl_version_info(CURLVERSION_NOW);
+    contentDecodingSupported = (versionInfo->features & CURL_VERSION_LIBZ) != 0;
+    if (!contentDecodingSupported) {
+        Log_Debug("INFO: cURL was built without zlib; content will not be compressed.\n");
+    }
+
     ExitCode localExitCode;
 
+    // Set up the cache shared by the easy handles. All transfers run on the event loop thread, so
+    // no locking functions are needed.
+    curlShare = curl_share_init();
+    if (curlShare == NULL) {
+        Log_Debug("curl_share_init() failed!\n");
+        localExitCode = ExitCode_CurlInit_ShareInit;
+        goto errorLabel;
+    }
+
+    CURLSHcode shareRes;
+    if ((shareRes = curl_share_setopt(curlShare, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS)) !=
+            CURLSHE_OK ||
+        (shareRes = curl_share_setopt(curlShare, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION)) !=
+            CURLSHE_OK) {
+        Log_Debug("curl_share_setopt CURLSHOPT_SHARE (curl share err=%d, '%s')\n", shareRes,
+                  curl_share_strerror(shareRes));
+        localExitCode = ExitCode_CurlInit_ShareSetOpt;
+        goto errorLabel;
+    }
+
+    // Get the full path to the certificates bundle file used to authenticate the HTTPS server
+    // identity, and read the bundle once for all the easy handles.
+    certificatePath = Storage_GetAbsolutePathInImagePackage(certificateBundle);
+    if (certificatePath == NULL) {
+        LogErrno("ERROR: The certificate path could not be resolved");
+        localExitCode = ExitCode_CurlSetupEasy_StoragePath;
+        goto errorLabel;
+    }
+#if LIBCURL_VERSION_NUM >= 0x074D00
+    LoadCertificates();
+#endif
+
     for (size_t i = 0; i < transferCount; i++) {
-        webTransfers[i].easyHandle =
-            CurlSetupEasyHandle(webTransfers[i].url, &webTransfers[i].httpResponse, &localExitCode);
+        webTransfers[i].easyHandle = CurlSetupEasyHandle(&webTransfers[i], &localExitCode);
 
         if (webTransfers[i].easyHandle == NULL) {
             goto errorLabel;
@@ -475,6 +1300,13 @@ static ExitCode CurlInit(void)
         localExitCode = ExitCode_CurlInit_MultiSetOptTimerFunction;
         goto errorLabel;
     }
+    // Allow transfers to the same host to share an HTTP/2 connection.
+    if ((res = curl_multi_setopt(curlMulti, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX)) !=
+        CURLM_OK) {
+        LogCurlMultiError("curl_multi_setopt CURLMOPT_PIPELINING", res);
+        localExitCode = ExitCode_CurlInit_MultiSetOptPipelining;
+        goto errorLabel;
+    }
 
     return ExitCode_Success;
 
@@ -485,6 +1317,10 @@ errorLabel:
         // Set pointer to NULL so not cleaned up again in CurlFini.
         webTransfers[i].easyHandle = NULL;
     }
+    // Safe to call curl_share_cleanup with NULL pointer.
+    curl_share_cleanup(curlShare);
+    curlShare = NULL;
+    FreeCertificates();
     return localExitCode;
 }
 
@@ -494,55 +1330,148 @@ errorLabel:
 static void CurlFini(void)
 {
     for (size_t i = 0; i < transferCount; i++) {
+        if (webTransfers[i].inProgress) {
+            curl_multi_remove_handle(curlMulti, webTransfers[i].easyHandle);
+            webTransfers[i].inProgress = false;
+            if (webTransfers[i].toStorage) {
+                ResumableDownload_End(false);
+            }
+        }
         curl_easy_cleanup(webTransfers[i].easyHandle);
+        ReleaseResponse(&webTransfers[i].httpResponse);
     }
+    FreeResponseChunks();
+    queuedTransferCount = 0;
+    curlTransferInProgress = 0;
 
     CURLMcode res;
     if ((res = curl_multi_cleanup(curlMulti)) != CURLM_OK) {
         LogCurlMultiError("curl_multi_cleanup failed", res);
     }
+    // The share must be cleaned up after the easy handles which use it.
+    curl_share_cleanup(curlShare);
+    curlShare = NULL;
+    // The easy handles refer to the certificates without copying them.
+    FreeCertificates();
     curl_global_cleanup();
 }
 
+int WebClient_EnqueueTransfer(const char *url, int priority)
+{
+    if (QueueTransfer(url, priority, false, 0, 0) != 0) {
+        return -1;
+    }
+
+    StartQueuedTransfers();
+    return 0;
+}
+
+int WebClient_EnqueueResumableDownload(const char *url, int priority)
+{
+    // Mutable storage holds only one download at a time.
+    for (size_t i = 0; i < transferCount; i++) {
+        if (webTransfers[i].inProgress && webTransfers[i].toStorage) {
+            Log_Debug("ERROR: A resumable download is already in progress\n");
+            return -1;
+        }
+    }
+    for (size_t i = 0; i < queuedTransferCount; i++) {
+        if (transferQueue[i].toStorage) {
+            Log_Debug("ERROR: A resumable download is already queued\n");
+            return -1;
+        }
+    }
+
+    if (strlen(url) > RESUMABLE_DOWNLOAD_MAX_URL_LENGTH) {
+        Log_Debug("ERROR: URL too long for a resumable download: %s\n", url);
+        return -1;
+    }
+
+    if (QueueTransfer(url, priority, true, 0, 0) != 0) {
+        return -1;
+    }
+
+    StartQueuedTransfers();
+    return 0;
+}
+
+void WebClient_GetStatistics(WebClient_Statistics *statisticsOut)
+{
+    *statisticsOut = statistics;
+}
+
+void WebClient_SetTimerSlack(unsigned int slackMillis)
+{
+    curlTimerSlackMillis = slackMillis;
+}
+
+void WebClient_GetTimingStatistics(WebClient_TimingStatistics *timingStatistics)
+{
+    TimingHistogram_Summarize(&dnsHistogram, &timingStatistics->dns);
+    TimingHistogram_Summarize(&connectHistogram, &timingStatistics->connect);
+    TimingHistogram_Summarize(&tlsHistogram, &timingStatistics->tls);
+    TimingHistogram_Summarize(&firstByteHistogram, &timingStatistics->firstByte);
+    TimingHistogram_Summarize(&totalHistogram, &timingStatistics->total);
+    timingStatistics->bytesDownloaded = bytesDownloaded;
+    timingStatistics->bytesUploaded = bytesUploaded;
+}
+
 int WebClient_StartTransfers(void)
 {
     // Start new web page downloads if not already in progress.
-    if (curlTransferInProgress == 0) {
-        struct timespec currentTime;
-        clock_gettime(CLOCK_MONOTONIC, &currentTime);
-        CURLMcode res;
-        for (size_t i = 0; i < transferCount; i++) {
-            if ((res = curl_multi_remove_handle(curlMulti, webTransfers[i].easyHandle)) !=
-                CURLM_OK) {
-                LogCurlMultiError("curl_multi_remove_handle", res);
+    if (curlTransferInProgress == 0 && queuedTransferCount == 0) {
+        for (size_t i = 0; i < sampleUrlCount; i++) {
+            if (WebClient_EnqueueTransfer(sampleUrls[i], 0) != 0) {
                 return -1;
             }
-            if ((res = curl_multi_add_handle(curlMulti, webTransfers[i].easyHandle)) != CURLM_OK) {
-                LogCurlMultiError("curl_multi_add_handle", res);
-                return -1;
-            }
-            webTransfers[i].startTime = currentTime;
-            curlTransferInProgress++;
         }
     }
 
     return 0;
 }
 
-ExitCode WebClient_Init(EventLoop *eventLoopInstance)
+ExitCode WebClient_Init(EventLoop *eventLoopInstance,
+                        WebClient_ResponseDataCallbackType responseDataCallback,
+                        size_t maxConcurrentTransfers)
 {
+    if (maxConcurrentTransfers == 0 ||
+        maxConcurrentTransfers > WEB_CLIENT_MAX_CONCURRENT_TRANSFERS) {
+        Log_Debug("ERROR: Maximum number of concurrent transfers must be between 1 and %d.\n",
+                  WEB_CLIENT_MAX_CONCURRENT_TRANSFERS);
+        return ExitCode_WebClientInit_MaxConcurrentTransfers;
+    }
+
     eventLoop = eventLoopInstance;
+    responseDataCallbackFunc = responseDataCallback;
+    transferCount = maxConcurrentTransfers;
 
     curlTimer = CreateEventLoopDisarmedTimer(eventLoop, &CurlTimerEventHandler);
     if (curlTimer == NULL) {
         return ExitCode_WebClientInit_CurlTimer;
     }
 
-    return CurlInit();
+    retryTimer = CreateEventLoopDisarmedTimer(eventLoop, &RetryTimerEventHandler);
+    if (retryTimer == NULL) {
+        return ExitCode_WebClientInit_RetryTimer;
+    }
+
+    ExitCode localExitCode = CurlInit();
+    if (localExitCode != ExitCode_Success) {
+        return localExitCode;
+    }
+
+    // Resume a download which was interrupted by the application stopping.
+    char incompleteUrl[RESUMABLE_DOWNLOAD_MAX_URL_LENGTH + 1];
+    if (ResumableDownload_GetIncomplete(incompleteUrl)) {
+        WebClient_EnqueueResumableDownload(incompleteUrl, 0);
+    }
+
+    return ExitCode_Success;
 }
 
 void WebClient_Fini(void)
 {
     CurlFini();
+    DisposeEventLoopTimer(retryTimer);
     DisposeEventLoopTimer(curlTimer);
 }
@@ -3,17 +3,95 @@
 
 #pragma once
 
+#include <stddef.h>
+#include <stdint.h>
+
+#include <applibs/eventloop.h>
+
 #include "curlmulti.h"
+#include "timing_histogram.h"
+
+/// <summary>
+///     Upper limit on the number of transfers which may run concurrently.
+/// </summary>
+#define WEB_CLIENT_MAX_CONCURRENT_TRANSFERS 4
+
+/// <summary>
+///     Maximum number of transfers which may wait in the queue for a free slot.
+/// </summary>
+#define WEB_CLIENT_MAX_QUEUED_TRANSFERS 16
+
+/// <summary>
+///     Maximum length of a URL which can be queued, excluding the null terminator.
+/// </summary>
+#define WEB_CLIENT_MAX_URL_LENGTH 255
+
+/// <summary>
+///     Counts of the connections made by the web client, to show how often connections and TLS
+///     sessions are reused.
+/// </summary>
+typedef struct {
+    /// <summary>The number of transfers which have completed.</summary>
+    size_t completedTransfers;
+    /// <summary>The number of new connections made, each of which needed a TCP handshake.</summary>
+    size_t newConnections;
+    /// <summary>The number of TLS handshakes made on new connections.</summary>
+    size_t tlsHandshakes;
+    /// <summary>The number of transfers which reused an existing connection.</summary>
+    size_t reusedConnections;
+    /// <summary>The number of transfers which used HTTP/2.</summary>
+    size_t http2Transfers;
+} WebClient_Statistics;
+
+/// <summary>
+///     Timings of the phases of the completed transfers, and the number of bytes transferred. DNS
+///     and connection times only include transfers which made a new connection, and TLS times only
+///     those which made a TLS handshake.
+/// </summary>
+typedef struct {
+    /// <summary>Time to resolve the host name.</summary>
+    TimingSummary dns;
+    /// <summary>Time to make the TCP connection, after resolving the host name.</summary>
+    TimingSummary connect;
+    /// <summary>Time for the TLS handshake, after the TCP connection was made.</summary>
+    TimingSummary tls;
+    /// <summary>Time from sending the request to receiving the first byte of the reply.</summary>
+    TimingSummary firstByte;
+    /// <summary>Total time of the transfer.</summary>
+    TimingSummary total;
+    uint64_t bytesDownloaded;
+    uint64_t bytesUploaded;
+} WebClient_TimingStatistics;
+
+/// <summary>
+///     Function called with each part of a response body as it is downloaded.
+/// </summary>
+/// <param name="url">URL of the transfer.</param>
+/// <param name="data">The data; this is only valid for the duration of the call.</param>
+/// <param name="size">Size of the data in bytes.</param>
+typedef void (*WebClient_ResponseDataCallbackType)(const char *url, const uint8_t *data,
+                                                   size_t size);
 
 /// <summary>
 ///     Initializes the web client's resources.
 /// </summary>
 /// <param name="eventLoopInstance">Event loop which is used to handle socket IO.</param>
+/// <param name="responseDataCallback">
+///     Function to stream response bodies to as they are downloaded, so that they need not be held
+///     in memory. If NULL, each body is stored, and the start of it is printed when the transfer
+///     completes.
+/// </param>
+/// <param name="maxConcurrentTransfers">
+///     Maximum number of transfers to run at once, between 1 and
+///     WEB_CLIENT_MAX_CONCURRENT_TRANSFERS. Further transfers wait in the queue until one finishes.
+/// </param>
 /// <returns>
 ///     ExitCode_Success if all resources were allocated successfully; otherwise another
 ///     ExitCode value which indicates the specific failure.
 /// </returns>
-ExitCode WebClient_Init(EventLoop *eventLoopInstance);
+ExitCode WebClient_Init(EventLoop *eventLoopInstance,
+                        WebClient_ResponseDataCallbackType responseDataCallback,
+                        size_t maxConcurrentTransfers);
 
 /// <summary>
 ///     Finalizes the web client's resources.
@@ -21,7 +99,54 @@ ExitCode WebClient_Init(EventLoop *eventLoopInstance);
 void WebClient_Fini(void);
 
 /// <summary>
-///     Starts web page download.
+///     Queues the download of a URL. The transfer starts as soon as fewer than the maximum number
+///     of transfers are running; queued transfers with a higher priority start first, and those
+///     with equal priority start in the order they were queued.
+/// </summary>
+/// <param name="url">HTTP or HTTPS URL to download; this is copied.</param>
+/// <param name="priority">Priority of the transfer; higher values start first.</param>
+/// <returns>0 on success, -1 if the URL is too long or the queue is full</returns>
+int WebClient_EnqueueTransfer(const char *url, int priority);
+
+/// <summary>
+///     Queues a resumable download of a URL to mutable storage. The content is committed to
+///     storage in chunks as it arrives; if the transfer fails, or the application stops before it
+///     completes, the download is resumed from the last committed offset with an HTTP Range
+///     request. Only one resumable download may be queued or in progress at a time, and the
+///     content must fit in the MutableStorage size declared in app_manifest.json.
+/// </summary>
+/// <param name="url">HTTP or HTTPS URL to download; this is copied.</param>
+/// <param name="priority">Priority of the transfer; higher values start first.</param>
+/// <returns>
+///     0 on success, -1 if the URL is too long, the queue is full or another resumable download
+///     is pending
+/// </returns>
+int WebClient_EnqueueResumableDownload(const char *url, int priority);
+
+/// <summary>
+///     Sets the amount by which cURL's timeouts may be delayed, so that timeouts requested at
+///     nearby times expire together and the timer is not re-armed each time cURL asks for a
+///     slightly different timeout. This reduces the number of times the application wakes during
+///     long-running transfers. The default, 0, runs cURL exactly when it asks.
+/// </summary>
+/// <param name="slackMillis">The slack in milliseconds.</param>
+void WebClient_SetTimerSlack(unsigned int slackMillis);
+
+/// <summary>
+///     Gets the counts of connections made since the web client was initialized.
+/// </summary>
+/// <param name="statistics">Receives the counts.</param>
+void WebClient_GetStatistics(WebClient_Statistics *statistics);
+
+/// <summary>
+///     Gets the minimum, average and 95th percentile of the timings of each phase of the transfers
+///     completed since the web client was initialized.
+/// </summary>
+/// <param name="timingStatistics">Receives the timings.</param>
+void WebClient_GetTimingStatistics(WebClient_TimingStatistics *timingStatistics);
+
+/// <summary>
+///     Starts the sample's web page downloads, unless transfers are already running or queued.
 /// </summary>
 /// <returns>0 on success, -1 on error</returns>
 int WebClient_StartTransfers(void);
\ No newline at end of file
@@ -0,0 +1,158 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <string.h>
+
+#include "i2c_register_batch.h"
+
+static I2cRegisterBatch_Op *AppendOp(I2cRegisterBatch *batch);
+static bool CheckTransferSize(size_t expectedBytes, ssize_t actualBytes);
+static size_t ExecuteWrites(I2cRegisterBatch *batch, size_t first);
+static size_t ExecuteReads(I2cRegisterBatch *batch, size_t first);
+
+void I2cRegisterBatch_Init(I2cRegisterBatch *batch, int fd, I2C_DeviceAddress address)
+{
+    memset(batch, 0, sizeof(*batch));
+    batch->fd = fd;
+    batch->address = address;
+}
+
+static I2cRegisterBatch_Op *AppendOp(I2cRegisterBatch *batch)
+{
+    if (batch->opCount == I2C_REGISTER_BATCH_MAX_OPS) {
+        batch->overflowed = true;
+        return NULL;
+    }
+
+    return &batch->ops[batch->opCount++];
+}
+
+void I2cRegisterBatch_Write(I2cRegisterBatch *batch, uint8_t regId, uint8_t value)
+{
+    I2cRegisterBatch_Op *op = AppendOp(batch);
+    if (op == NULL) {
+        return;
+    }
+
+    *op = (I2cRegisterBatch_Op){.regId = regId, .isRead = false, .value = value, .size = 1};
+}
+
+void I2cRegisterBatch_Read(I2cRegisterBatch *batch, uint8_t regId, void *data, size_t size)
+{
+    I2cRegisterBatch_Op *op = AppendOp(batch);
+    if (op == NULL) {
+        return;
+    }
+
+    *op = (I2cRegisterBatch_Op){.regId = regId, .isRead = true, .data = data, .size = size};
+}
+
+// Sets errno and returns false if a transfer moved fewer bytes than expected.
+static bool CheckTransferSize(size_t expectedBytes, ssize_t actualBytes)
+{
+    if (actualBytes < 0) {
+        return false;
+    }
+
+    if (actualBytes != (ssize_t)expectedBytes) {
+        errno = EIO;
+        return false;
+    }
+
+    return true;
+}
+
+// Writes the run of writes to consecutive registers which starts at the given operation, in one
+// transfer. Returns the number of operations which were executed, or 0 on failure.
+static size_t ExecuteWrites(I2cRegisterBatch *batch, size_t first)
+{
+    uint8_t command[1 + I2C_REGISTER_BATCH_MAX_BURST];
+    command[0] = batch->ops[first].regId;
+    size_t count = 0;
+
+    while (first + count < batch->opCount && count < I2C_REGISTER_BATCH_MAX_BURST) {
+        const I2cRegisterBatch_Op *op = &batch->ops[first + count];
+        if (op->isRead || op->regId != (uint8_t)(command[0] + count)) {
+            break;
+        }
+        command[1 + count] = op->value;
+        ++count;
+    }
+
+    ssize_t transferredBytes = I2CMaster_Write(batch->fd, batch->address, command, 1 + count);
+    ++batch->transferCount;
+    return CheckTransferSize(1 + count, transferredBytes) ? count : 0;
+}
+
+// Reads the run of reads of consecutive registers which starts at the given operation, in one
+// transfer. Returns the number of operations which were executed, or 0 on failure.
+static size_t ExecuteReads(I2cRegisterBatch *batch, size_t first)
+{
+    const I2cRegisterBatch_Op *firstOp = &batch->ops[first];
+    uint8_t regId = firstOp->regId;
+
+    // A read which does not fit in the burst buffer is transferred directly into its
+    // destination.
+    if (firstOp->size > I2C_REGISTER_BATCH_MAX_BURST) {
+        ssize_t transferredBytes = I2CMaster_WriteThenRead(
+            batch->fd, batch->address, &regId, sizeof(regId), firstOp->data, firstOp->size);
+        ++batch->transferCount;
+        return CheckTransferSize(sizeof(regId) + firstOp->size, transferredBytes) ? 1 : 0;
+    }
+
+    size_t count = 0;
+    size_t size = 0;
+    while (first + count < batch->opCount) {
+        const I2cRegisterBatch_Op *op = &batch->ops[first + count];
+        if (!op->isRead || op->regId != (uint8_t)(regId + size) ||
+            size + op->size > I2C_REGISTER_BATCH_MAX_BURST) {
+            break;
+        }
+        size += op->size;
+        ++count;
+    }
+
+    uint8_t values[I2C_REGISTER_BATCH_MAX_BURST];
+    ssize_t transferredBytes =
+        I2CMaster_WriteThenRead(batch->fd, batch->address, &regId, sizeof(regId), values, size);
+    ++batch->transferCount;
+    if (!CheckTransferSize(sizeof(regId) + size, transferredBytes)) {
+        return 0;
+    }
+
+    const uint8_t *value = values;
+    for (size_t i = 0; i < count; ++i) {
+        const I2cRegisterBatch_Op *op = &batch->ops[first + i];
+        memcpy(op->data, value, op->size);
+        value += op->size;
+    }
+
+    return count;
+}
+
+int I2cRegisterBatch_Execute(I2cRegisterBatch *batch)
+{
+    int result = 0;
+    batch->transferCount = 0;
+
+    if (batch->overflowed) {
+        errno = ENOBUFS;
+        result = -1;
+        goto cleanup;
+    }
+
+    for (size_t i = 0; i < batch->opCount;) {
+        size_t executed = batch->ops[i].isRead ? ExecuteReads(batch, i) : ExecuteWrites(batch, i);
+        if (executed == 0) {
+            result = -1;
+            goto cleanup;
+        }
+        i += executed;
+    }
+
+cleanup:
+    batch->opCount = 0;
+    batch->overflowed = false;
+    return result;
+}
@@ -0,0 +1,91 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <applibs/i2c.h>
+
+// A register batch queues reads and writes of an I2C device's registers, and then executes them
+// in as few bus transfers as possible. Writes to consecutive registers are combined into one
+// I2CMaster_Write of the first register address followed by all the values, and reads of
+// consecutive registers are combined into one I2CMaster_WriteThenRead, in which the register
+// address is followed by a repeated start. Both rely on the device incrementing the register
+// address after each byte, as the LSM6DS3 does by default (CTRL3_C IF_INC). Operations are
+// executed in the order in which they were queued, so a read after a write sees its value.
+
+/// <summary>Maximum number of operations which can be queued in one batch.</summary>
+#define I2C_REGISTER_BATCH_MAX_OPS 16
+
+/// <summary>Maximum number of bytes which are combined into one transfer.</summary>
+#define I2C_REGISTER_BATCH_MAX_BURST 32
+
+/// <summary>A queued operation. Private to i2c_register_batch.c.</summary>
+typedef struct {
+    uint8_t regId;
+    bool isRead;
+    // The value to write, or where to store the values which are read.
+    uint8_t value;
+    uint8_t *data;
+    size_t size;
+} I2cRegisterBatch_Op;
+
+/// <summary>
+///     Queued operations on the registers of one I2C device. The client should not directly
+///     modify member variables.
+/// </summary>
+typedef struct {
+    /// <summary>I2C master interface on which the device is attached. Not owned.</summary>
+    int fd;
+    /// <summary>Address of the device on the bus.</summary>
+    I2C_DeviceAddress address;
+    /// <summary>Number of bus transfers used by the last call to
+    /// I2cRegisterBatch_Execute.</summary>
+    size_t transferCount;
+    size_t opCount;
+    // Set if an operation could not be queued, so that the batch fails when it is executed.
+    bool overflowed;
+    I2cRegisterBatch_Op ops[I2C_REGISTER_BATCH_MAX_OPS];
+} I2cRegisterBatch;
+
+/// <summary>
+///     Initializes an empty batch for a device.
+/// </summary>
+/// <param name="batch">The batch to initialize.</param>
+/// <param name="fd">I2C master interface returned by I2CMaster_Open.</param>
+/// <param name="address">Address of the device on the bus.</param>
+void I2cRegisterBatch_Init(I2cRegisterBatch *batch, int fd, I2C_DeviceAddress address);
+
+/// <summary>
+///     Queues a write of one register.
+/// </summary>
+/// <param name="batch">The batch.</param>
+/// <param name="regId">Address of the register.</param>
+/// <param name="value">Value to write.</param>
+void I2cRegisterBatch_Write(I2cRegisterBatch *batch, uint8_t regId, uint8_t value);
+
+/// <summary>
+///     Queues a read of one or more consecutive registers.
+/// </summary>
+/// <param name="batch">The batch.</param>
+/// <param name="regId">Address of the first register.</param>
+/// <param name="data">
+///     Receives the register values when the batch is executed. It must remain valid until then.
+/// </param>
+/// <param name="size">Number of registers to read.</param>
+void I2cRegisterBatch_Read(I2cRegisterBatch *batch, uint8_t regId, void *data, size_t size);
+
+/// <summary>
+///     Executes the queued operations in order, and empties the batch. Execution stops at the
+///     first transfer which fails.
+/// </summary>
+/// <param name="batch">The batch.</param>
+/// <returns>
+///     0 on success; or -1 on failure, in which case errno is set to the error value. EIO
+///     indicates that fewer bytes were transferred than requested, and ENOBUFS that more
+///     operations were queued than the batch can hold.
+/// </returns>
+int I2cRegisterBatch_Execute(I2cRegisterBatch *batch);
@@ -37,7 +37,11 @@
 // See https://aka.ms/AzureSphereHardwareDefinitions for more details.
 #include <hw/sample_appliance.h>
 
+#include "accel_filter.h"
+#include "anomaly_detector.h"
+#include "async_log.h"
 #include "eventloop_timer_utilities.h"
+#include "i2c_register_batch.h"
 
 /// <summary>
 /// Exit codes for this application. These are used for the
@@ -50,8 +54,8 @@ typedef enum {
     ExitCode_TermHandler_SigTerm = 1,
 
     ExitCode_AccelTimer_Consume = 2,
-    ExitCode_AccelTimer_ReadStatus = 3,
-    ExitCode_AccelTimer_ReadZAccel = 4,
+    ExitCode_AccelTimer_ReadFifoStatus = 3,
+    ExitCode_AccelTimer_ReadFifoData = 4,
 
     ExitCode_ReadWhoAmI_WriteThenRead = 5,
     ExitCode_ReadWhoAmI_WriteThenReadCompare = 6,
@@ -63,7 +67,7 @@ typedef enum {
     ExitCode_ReadWhoAmI_PosixCompare = 12,
 
     ExitCode_SampleRange_Reset = 13,
-    ExitCode_SampleRange_SetRange = 14,
+    ExitCode_SampleRange_Configure = 14,
 
     ExitCode_Init_EventLoop = 15,
     ExitCode_Init_AccelTimer = 16,
@@ -72,7 +76,11 @@ typedef enum {
     ExitCode_Init_SetTimeout = 19,
     ExitCode_Init_SetDefaultTarget = 20,
 
-    ExitCode_Main_EventLoopFail = 21
+    ExitCode_Main_EventLoopFail = 21,
+
+    ExitCode_Init_AsyncLog = 22,
+
+    ExitCode_Init_AnomalyDetector = 23
 } ExitCode;
 
 // Support functions.
@@ -80,6 +88,7 @@ static void TerminationHandler(int signalNumber);
 static void AccelTimerEventHandler(EventLoopTimer *timer);
 static ExitCode ReadWhoAmI(void);
 static bool CheckTransferSize(const char *desc, size_t expectedBytes, ssize_t actualBytes);
+static bool ReadRegisters(const char *desc, uint8_t regId, void *data, size_t size);
 static ExitCode ResetAndSetSampleRange(void);
 static ExitCode InitPeripheralsAndHandlers(void);
 static void CloseFdAndPrintError(int fd, const char *fdName);
@@ -95,6 +104,42 @@ static EventLoopTimer *accelTimer = NULL;
 // SDO is tied to ground so the least significant bit of the address is zero.
 static const uint8_t lsm6ds3Address = 0x6A;
 
+// The accelerometer queues samples in its FIFO at this rate, and the app drains them once a
+// second. DocID026899 Rev 10, S9.6, FIFO_CTRL5 (0Ah); ODR_FIFO = 0100 selects 104Hz.
+#define ACCEL_SAMPLE_RATE_HZ 104
+
+// Each sample in the FIFO is three 16-bit words, for the X, Y, and Z axes in that order.
+#define FIFO_WORDS_PER_SAMPLE ACCEL_AXES
+
+// The FIFO watermark flag is set when at least this many samples are queued. The timer only
+// drains the FIFO when the flag is set, so each drain reads at least this many samples.
+#define FIFO_WATERMARK_SAMPLES (ACCEL_SAMPLE_RATE_HZ / 2)
+#define FIFO_WATERMARK_WORDS (FIFO_WATERMARK_SAMPLES * FIFO_WORDS_PER_SAMPLE)
+
+// Maximum number of samples which are read from the FIFO in one I2C transfer. This is large
+// enough to hold the samples which arrive in one timer period.
+#define FIFO_MAX_SAMPLES_PER_READ 128
+
+// The samples are low-pass filtered with a time constant of 2^ACCEL_FILTER_IIR_SHIFT samples,
+// and then decimated to 8Hz.
+#define ACCEL_FILTER_IIR_SHIFT 2
+#define ACCEL_FILTER_DECIMATION 13
+
+static AccelFilter accelFilter;
+
+// The unfiltered samples are also checked for anomalies, such as a shock. A summary of every ten
+// seconds is logged, and the samples from half a second before to a second after each anomaly
+// are captured at the full rate; a connected device would upload these instead of the stream.
+static const AnomalyDetector_Config anomalyConfig = {.method = AnomalyDetector_Method_ZScore,
+                                                     .threshold = 8.0f,
+                                                     .minDeviation = 20.0f,
+                                                     .framesPerWindow = ACCEL_SAMPLE_RATE_HZ * 10,
+                                                     .preTriggerFrames = ACCEL_SAMPLE_RATE_HZ / 2,
+                                                     .postTriggerFrames = ACCEL_SAMPLE_RATE_HZ,
+                                                     .holdoffFrames = ACCEL_SAMPLE_RATE_HZ * 10};
+
+static AnomalyDetector anomalyDetector;
+
 // Termination state
 static volatile sig_atomic_t exitCode = ExitCode_Success;
 
@@ -107,6 +152,29 @@ static void TerminationHandler(int signalNumber)
     exitCode = ExitCode_TermHandler_SigTerm;
 }
 
+/// <summary>
+///     Logs the summary of a window of accelerometer samples.
+/// </summary>
+static void AnomalySummaryHandler(const AnomalyDetector_Summary *summary, void *context)
+{
+    ASYNC_LOG_INFO("INFO: %u samples; mean x=%dmg y=%dmg z=%dmg; %u anomalous, peak score %d\n",
+                   summary->frameCount, (int)summary->channels[0].mean,
+                   (int)summary->channels[1].mean, (int)summary->channels[2].mean,
+                   summary->anomalousFrames, (int)summary->peakScore);
+}
+
+/// <summary>
+///     Logs a captured anomaly. A connected device would upload capture->frames here.
+/// </summary>
+static void AnomalyCaptureHandler(const AnomalyDetector_Capture *capture, void *context)
+{
+    const int16_t *trigger = &capture->frames[capture->triggerIndex * ACCEL_AXES];
+    ASYNC_LOG_WARNING(
+        "WARNING: Anomaly on axis %zu, score %d: x=%dmg y=%dmg z=%dmg; captured %zu samples.\n",
+        capture->triggerChannel, (int)capture->score, trigger[0], trigger[1], trigger[2],
+        capture->frameCount);
+}
+
 /// <summary>
 ///     Print latest data from accelerometer.
 /// </summary>
@@ -119,37 +187,81 @@ static void AccelTimerEventHandler(EventLoopTimer *timer)
         return;
     }
 
-    // Status register describes whether accelerometer is available.
-    // DocID026899 Rev 10, S9.26, STATUS_REG (1Eh); [0] = XLDA
-    static const uint8_t statusRegId = 0x1E;
-    uint8_t status;
-    ssize_t transferredBytes = I2CMaster_WriteThenRead(
-        i2cFd, lsm6ds3Address, &statusRegId, sizeof(statusRegId), &status, sizeof(status));
-    if (!CheckTransferSize("I2CMaster_WriteThenRead (STATUS_REG)",
-                           sizeof(statusRegId) + sizeof(status), transferredBytes)) {
-        exitCode = ExitCode_AccelTimer_ReadStatus;
+    // Read the number of unread words, the flags, and which axis the next word holds,
+    // in one burst. DocID026899 Rev 10, S9.41-S9.44, FIFO_STATUS1-4 (3Ah-3Dh)
+    uint8_t fifoStatus[4];
+    if (!ReadRegisters("FIFO_STATUS1", 0x3A, fifoStatus, sizeof(fifoStatus))) {
+        exitCode = ExitCode_AccelTimer_ReadFifoStatus;
+        return;
+    }
+
+    size_t unreadWords = fifoStatus[0] | ((fifoStatus[1] & 0x0F) << 8);
+    size_t pattern = fifoStatus[2] | ((fifoStatus[3] & 0x03) << 8);
+
+    // FIFO_STATUS2; [6] = OVER_RUN
+    if ((fifoStatus[1] & 0x40) != 0) {
+        ASYNC_LOG_WARNING("WARNING: %d: Accelerometer FIFO overran, so samples were lost.\n", iter);
+    }
+
+    // FIFO_STATUS2; [7] = WaterM
+    if ((fifoStatus[1] & 0x80) == 0) {
+        ASYNC_LOG_INFO("INFO: %d: No accelerometer data.\n", iter);
+        ++iter;
+        return;
+    }
+
+    // If the next word is not an X axis, discard the words up to the start of the next sample.
+    // Reading FIFO_DATA_OUT_H (3Fh) rolls the register address back to FIFO_DATA_OUT_L (3Eh),
+    // so consecutive words are read in one burst.
+    // DocID026899 Rev 10, S9.45, FIFO_DATA_OUT_L (3Eh)
+    static const uint8_t fifoDataOutLRegId = 0x3E;
+    AccelFrame samples[FIFO_MAX_SAMPLES_PER_READ];
+    size_t skipWords = (FIFO_WORDS_PER_SAMPLE - pattern) % FIFO_WORDS_PER_SAMPLE;
+    if (skipWords > unreadWords) {
+        skipWords = unreadWords;
+    }
+    if (skipWords > 0 && !ReadRegisters("FIFO_DATA_OUT_L", fifoDataOutLRegId, samples,
+                                        skipWords * sizeof(int16_t))) {
+        exitCode = ExitCode_AccelTimer_ReadFifoData;
         return;
     }
 
-    if ((status & 0x1) == 0) {
-        Log_Debug("INFO: %d: No accelerometer data.\n", iter);
-    } else {
-        // Read two-byte Z-axis output register.
-        // DocID026899 Rev 10, S9.38, OUTZ_L_XL (2Ch)
-        static const uint8_t outZLXl = 0x2C;
-        int16_t zRaw;
-        transferredBytes = I2CMaster_WriteThenRead(i2cFd, lsm6ds3Address, &outZLXl, sizeof(outZLXl),
-                                                   (uint8_t *)&zRaw, sizeof(zRaw));
-        if (!CheckTransferSize("I2CMaster_WriteThenRead (OUTZ_L_XL)",
-                               sizeof(outZLXl) + sizeof(zRaw), transferredBytes)) {
-            exitCode = ExitCode_AccelTimer_ReadZAccel;
+    // Drain the queued samples in as few bursts as possible.
+    size_t remainingSamples = (unreadWords - skipWords) / FIFO_WORDS_PER_SAMPLE;
+    size_t sampleCount = 0;
+    size_t filteredCount = 0;
+    AccelFrame filtered[FIFO_MAX_SAMPLES_PER_READ / ACCEL_FILTER_DECIMATION + 1];
+    AccelFrame latest = {{0, 0, 0}};
+    while (remainingSamples > 0) {
+        size_t count = remainingSamples;
+        if (count > FIFO_MAX_SAMPLES_PER_READ) {
+            count = FIFO_MAX_SAMPLES_PER_READ;
+        }
+
+        if (!ReadRegisters("FIFO_DATA_OUT_L", fifoDataOutLRegId, samples,
+                           count * sizeof(samples[0]))) {
+            exitCode = ExitCode_AccelTimer_ReadFifoData;
             return;
         }
 
-        // DocID026899 Rev 10, S4.1, Mechanical characteristics
-        // These constants are specific to LA_So where FS = +/-4g, as set in CTRL1_X.
-        double g = (zRaw * 0.122) / 1000.0;
-        Log_Debug("INFO: %d: vertical acceleration: %.2lfg\n", iter, g);
+        // Convert the whole burst to milli-g, and then filter and decimate it.
+        AccelFilter_ConvertToMilliG((int16_t *)samples, count * ACCEL_AXES,
+                                    ACCEL_MILLI_G_PER_LSB_Q16_FS4G);
+        AnomalyDetector_AddFrames(&anomalyDetector, (const int16_t *)samples, count);
+        size_t outputCount = AccelFilter_Process(&accelFilter, samples, count, filtered);
+        if (outputCount > 0) {
+            latest = filtered[outputCount - 1];
+        }
+
+        sampleCount += count;
+        filteredCount += outputCount;
+        remainingSamples -= count;
+    }
+
+    if (filteredCount > 0) {
+        ASYNC_LOG_INFO(
+            "INFO: %d: %zu samples filtered to %zu; acceleration: x=%dmg y=%dmg z=%dmg\n", iter,
+            sampleCount, filteredCount, latest.axis[0], latest.axis[1], latest.axis[2]);
     }
 
     ++iter;
@@ -243,7 +355,23 @@ static bool CheckTransferSize(const char *desc, size_t expectedBytes, ssize_t ac
 }
 
 /// <summary>
-///     Resets the accelerometer and sets the sample range.
+///     Reads consecutive registers from the accelerometer in one I2C transfer.
+/// </summary>
+/// <param name="desc">Name of the first register, which is used in error messages.</param>
+/// <param name="regId">Address of the first register.</param>
+/// <param name="data">Receives the register values.</param>
+/// <param name="size">Number of bytes to read.</param>
+/// <returns>true on success, or false on failure</returns>
+static bool ReadRegisters(const char *desc, uint8_t regId, void *data, size_t size)
+{
+    ssize_t transferredBytes =
+        I2CMaster_WriteThenRead(i2cFd, lsm6ds3Address, &regId, sizeof(regId), data, size);
+    return CheckTransferSize(desc, sizeof(regId) + size, transferredBytes);
+}
+
+/// <summary>
+///     Resets the accelerometer, sets the sample range, and configures its FIFO to queue
+///     samples of all three axes until they are read.
 /// </summary>
 /// <returns>
 ///     ExitCode_Success on success; otherwise another ExitCode value which indicates
@@ -268,15 +396,36 @@ static ExitCode ResetAndSetSampleRange(void)
                                                    sizeof(ctrl3cRegId), &ctrl3c, sizeof(ctrl3c));
     } while (!(transferredBytes == (sizeof(ctrl3cRegId) + sizeof(ctrl3c)) && (ctrl3c & 0x1) == 0));
 
-    // Use sample range +/- 4g, with 12.5Hz frequency.
+    // The remaining registers are written as one batch, which combines the writes to
+    // consecutive registers into a single transfer.
+    I2cRegisterBatch batch;
+    I2cRegisterBatch_Init(&batch, i2cFd, lsm6ds3Address);
+
+    // Use sample range +/- 4g, with 104Hz frequency.
     // DocID026899 Rev 10, S9.12, CTRL1_XL (10h)
-    static const uint8_t setCtrl1XlCommand[] = {0x10, 0x18};
-    transferredBytes =
-        I2CMaster_Write(i2cFd, lsm6ds3Address, setCtrl1XlCommand, sizeof(setCtrl1XlCommand));
-    if (!CheckTransferSize("I2CMaster_Write (CTRL1_XL)", sizeof(setCtrl1XlCommand),
-                           transferredBytes)) {
-        return ExitCode_SampleRange_SetRange;
+    I2cRegisterBatch_Write(&batch, 0x10, 0x48);
+
+    // Configure the FIFO to queue samples of all three axes until they are read.
+    // DocID026899 Rev 10, S9.2-S9.6, FIFO_CTRL1-5 (06h-0Ah)
+    // FIFO_CTRL1, FIFO_CTRL2 [3:0] = FTH; watermark, in words
+    I2cRegisterBatch_Write(&batch, 0x06, FIFO_WATERMARK_WORDS & 0xFF);
+    I2cRegisterBatch_Write(&batch, 0x07, (FIFO_WATERMARK_WORDS >> 8) & 0x0F);
+    // FIFO_CTRL3 [2:0] = DEC_FIFO_XL; 001 queues every accelerometer sample, and no gyroscope
+    I2cRegisterBatch_Write(&batch, 0x08, 0x01);
+    // FIFO_CTRL4 = 0; no third or fourth data set
+    I2cRegisterBatch_Write(&batch, 0x09, 0x00);
+    // FIFO_CTRL5 [6:3] = ODR_FIFO; 0100 = 104Hz, [2:0] = FIFO_MODE; 110 = continuous
+    I2cRegisterBatch_Write(&batch, 0x0A, 0x26);
+
+    if (I2cRegisterBatch_Execute(&batch) != 0) {
+        Log_Debug("ERROR: Cannot configure accelerometer: errno=%d (%s)\n", errno,
+                  strerror(errno));
+        return ExitCode_SampleRange_Configure;
     }
+    Log_Debug("INFO: Configured accelerometer in %zu I2C transfers.\n", batch.transferCount);
+
+    // The filter starts again along with the FIFO.
+    AccelFilter_Init(&accelFilter, ACCEL_FILTER_IIR_SHIFT, ACCEL_FILTER_DECIMATION);
 
     return ExitCode_Success;
 }
@@ -301,7 +450,18 @@ static ExitCode InitPeripheralsAndHandlers(void)
         return ExitCode_Init_EventLoop;
     }
 
-    // Print accelerometer data every second.
+    // Messages from the accelerometer handler are written from the event loop.
+    if (AsyncLog_Initialize(eventLoop) != 0) {
+        return ExitCode_Init_AsyncLog;
+    }
+
+    if (AnomalyDetector_Init(&anomalyDetector, ACCEL_AXES, &anomalyConfig, AnomalySummaryHandler,
+                             AnomalyCaptureHandler, NULL) != 0) {
+        Log_Debug("ERROR: Invalid anomaly detector configuration.\n");
+        return ExitCode_Init_AnomalyDetector;
+    }
+
+    // Drain the accelerometer FIFO and print a summary of the samples every second.
     static const struct timespec accelReadPeriod = {.tv_sec = 1, .tv_nsec = 0};
     accelTimer = CreateEventLoopPeriodicTimer(eventLoop, &AccelTimerEventHandler, &accelReadPeriod);
     if (accelTimer == NULL) {
@@ -369,6 +529,7 @@ static void CloseFdAndPrintError(int fd, const char *fdName)
 static void ClosePeripheralsAndHandlers(void)
 {
     DisposeEventLoopTimer(accelTimer);
+    AsyncLog_Cleanup();
     EventLoop_Close(eventLoop);
 
     Log_Debug("Closing file descriptors.\n");
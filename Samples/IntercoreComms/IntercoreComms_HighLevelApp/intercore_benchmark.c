@@ -0,0 +1,350 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <applibs/log.h>
+
+#include "eventloop_timer_utilities.h"
+#include "intercore_benchmark.h"
+#include "intercore_rpc.h"
+
+// Payload sizes which are measured, from 4 bytes to 1KB.
+static const size_t payloadSizes[] = {4, 16, 64, 256, 1024};
+#define PAYLOAD_SIZE_COUNT (sizeof(payloadSizes) / sizeof(payloadSizes[0]))
+
+// Time to wait for each echo.
+static const uint32_t echoTimeoutMs = 1000;
+
+// The timer handler does not take a context, so the benchmark state is held here.
+static EventLoopTimer *sendTimer = NULL;
+static IntercoreStream_State *benchmarkStream = NULL;
+static IntercoreBenchmark_DoneHandler benchmarkDoneHandler = NULL;
+static bool running = false;
+static uint32_t messagesPerSize = 0;
+static struct timespec sendPeriod;
+static size_t sizeIndex = 0;
+
+// Counters for the current size.
+static uint32_t attemptedCount = 0;
+static uint32_t sentCount = 0;
+static uint32_t echoedCount = 0;
+static uint32_t timedOutCount = 0;
+static uint32_t failedCount = 0;
+static uint32_t windowFullCount = 0;
+static uint32_t sendErrorCount = 0;
+static struct timespec sizeStartTime;
+static struct timespec lastEchoTime;
+static uint64_t queueDropsAtSizeStart = 0;
+
+static struct timespec sendTimes[INTERCORE_BENCHMARK_MAX_MESSAGES];
+static uint32_t latenciesUs[INTERCORE_BENCHMARK_MAX_MESSAGES];
+static uint8_t payload[1024];
+
+// Counters on the real-time capable application before the first size was measured.
+static IntercoreRpc_RemoteStats remoteStatsAtStart;
+
+static void SendTimerEventHandler(EventLoopTimer *timer);
+static void EchoCompletionHandler(IntercoreRpc_Status status, const uint8_t *response,
+                                  size_t size, void *context);
+static void StartSize(void);
+static void FinishSizeIfComplete(void);
+static void RequestRemoteStats(IntercoreRpc_CompletionHandler completionHandler);
+static void InitialStatsCompletionHandler(IntercoreRpc_Status status, const uint8_t *response,
+                                          size_t size, void *context);
+static void FinalStatsCompletionHandler(IntercoreRpc_Status status, const uint8_t *response,
+                                        size_t size, void *context);
+static void ChannelStatsCompletionHandler(IntercoreRpc_Status status, const uint8_t *response,
+                                          size_t size, void *context);
+static void ProfileCompletionHandler(IntercoreRpc_Status status, const uint8_t *response,
+                                     size_t size, void *context);
+static void Finish(void);
+static uint32_t ElapsedUs(const struct timespec *from, const struct timespec *to);
+static int CompareLatencies(const void *a, const void *b);
+static uint32_t Percentile(uint32_t percent);
+
+// Microseconds from one time to a later one.
+static uint32_t ElapsedUs(const struct timespec *from, const struct timespec *to)
+{
+    int64_t us = (int64_t)(to->tv_sec - from->tv_sec) * 1000000 +
+                 (to->tv_nsec - from->tv_nsec) / 1000;
+    return (us > 0) ? (uint32_t)us : 0;
+}
+
+static int CompareLatencies(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Returns a percentile of the sorted latencies for the current size.
+static uint32_t Percentile(uint32_t percent)
+{
+    return latenciesUs[((echoedCount - 1) * percent) / 100];
+}
+
+// Sends the next message at the current size.
+static void SendTimerEventHandler(EventLoopTimer *timer)
+{
+    if (ConsumeEventLoopTimerEvent(timer) != 0 || !running) {
+        return;
+    }
+
+    uint32_t index = attemptedCount++;
+    clock_gettime(CLOCK_MONOTONIC, &sendTimes[index]);
+    if (IntercoreRpc_Call(IntercoreRpc_Method_Echo, payload, payloadSizes[sizeIndex],
+                          echoTimeoutMs, EchoCompletionHandler,
+                          (void *)(uintptr_t)index) == 0) {
+        ++sentCount;
+    } else if (errno == EBUSY) {
+        ++windowFullCount;
+    } else {
+        ++sendErrorCount;
+    }
+
+    if (attemptedCount == messagesPerSize) {
+        DisarmEventLoopTimer(sendTimer);
+        FinishSizeIfComplete();
+    }
+}
+
+static void EchoCompletionHandler(IntercoreRpc_Status status, const uint8_t *response,
+                                  size_t size, void *context)
+{
+    if (!running) {
+        return;
+    }
+
+    uint32_t index = (uint32_t)(uintptr_t)context;
+    if (status == IntercoreRpc_Status_Ok && size == payloadSizes[sizeIndex]) {
+        clock_gettime(CLOCK_MONOTONIC, &lastEchoTime);
+        latenciesUs[echoedCount++] = ElapsedUs(&sendTimes[index], &lastEchoTime);
+    } else if (status == IntercoreRpc_Status_Timeout) {
+        ++timedOutCount;
+    } else {
+        ++failedCount;
+    }
+
+    FinishSizeIfComplete();
+}
+
+// Resets the counters, and starts sending messages at the current size.
+static void StartSize(void)
+{
+    attemptedCount = 0;
+    sentCount = 0;
+    echoedCount = 0;
+    timedOutCount = 0;
+    failedCount = 0;
+    windowFullCount = 0;
+    sendErrorCount = 0;
+    queueDropsAtSizeStart = benchmarkStream->stats.sentMessagesDropped;
+    memset(payload, (int)sizeIndex, sizeof(payload));
+
+    clock_gettime(CLOCK_MONOTONIC, &sizeStartTime);
+    lastEchoTime = sizeStartTime;
+    SetEventLoopTimerPeriod(sendTimer, &sendPeriod);
+}
+
+// If every message at the current size has been sent and has completed, logs the results, and
+// moves on to the next size.
+static void FinishSizeIfComplete(void)
+{
+    if (attemptedCount < messagesPerSize || echoedCount + timedOutCount + failedCount < sentCount) {
+        return;
+    }
+
+    size_t size = payloadSizes[sizeIndex];
+    Log_Debug("Benchmark %zu bytes: %u sent, %u echoed, %u timed out, %u failed; not sent: %u "
+              "window full, %u errors; %llu dropped by the send queue.\n",
+              size, sentCount, echoedCount, timedOutCount, failedCount, windowFullCount,
+              sendErrorCount,
+              (unsigned long long)(benchmarkStream->stats.sentMessagesDropped -
+                                   queueDropsAtSizeStart));
+
+    if (echoedCount > 0) {
+        qsort(latenciesUs, echoedCount, sizeof(latenciesUs[0]), CompareLatencies);
+        uint32_t elapsedUs = ElapsedUs(&sizeStartTime, &lastEchoTime);
+        double megabytesPerSecond =
+            (elapsedUs > 0) ? ((double)echoedCount * (double)size / (double)elapsedUs) : 0.0;
+        Log_Debug("    Round trip (us): p50 %u, p90 %u, p99 %u, max %u; %.3f MB/s each way.\n",
+                  Percentile(50), Percentile(90), Percentile(99), latenciesUs[echoedCount - 1],
+                  megabytesPerSecond);
+    }
+
+    if (++sizeIndex < PAYLOAD_SIZE_COUNT) {
+        StartSize();
+    } else {
+        RequestRemoteStats(FinalStatsCompletionHandler);
+    }
+}
+
+static void RequestRemoteStats(IntercoreRpc_CompletionHandler completionHandler)
+{
+    if (IntercoreRpc_Call(IntercoreRpc_Method_GetStats, NULL, 0, echoTimeoutMs,
+                          completionHandler, NULL) == -1) {
+        completionHandler(IntercoreRpc_Status_Cancelled, NULL, 0, NULL);
+    }
+}
+
+static void InitialStatsCompletionHandler(IntercoreRpc_Status status, const uint8_t *response,
+                                          size_t size, void *context)
+{
+    if (!running) {
+        return;
+    }
+
+    memset(&remoteStatsAtStart, 0, sizeof(remoteStatsAtStart));
+    if (status == IntercoreRpc_Status_Ok && size == sizeof(remoteStatsAtStart)) {
+        memcpy(&remoteStatsAtStart, response, size);
+    } else {
+        Log_Debug("WARNING: Could not get RTApp counters; status %d.\n", status);
+    }
+
+    StartSize();
+}
+
+static void FinalStatsCompletionHandler(IntercoreRpc_Status status, const uint8_t *response,
+                                        size_t size, void *context)
+{
+    if (!running) {
+        return;
+    }
+
+    IntercoreRpc_RemoteStats remoteStats;
+    if (status == IntercoreRpc_Status_Ok && size == sizeof(remoteStats)) {
+        memcpy(&remoteStats, response, size);
+        Log_Debug("RTApp: %u messages received, %u empty polls (Intercore_Recv_NoBlockSize); "
+                  "%u messages sent, %u not sent because the buffer was full "
+                  "(Intercore_Send_NotEnoughBufferSpace), %u because there was no credit "
+                  "(Intercore_Send_NoCredit).\n",
+                  remoteStats.messagesReceived - remoteStatsAtStart.messagesReceived,
+                  remoteStats.recvNoBlockSize - remoteStatsAtStart.recvNoBlockSize,
+                  remoteStats.messagesSent - remoteStatsAtStart.messagesSent,
+                  remoteStats.sendNotEnoughBufferSpace -
+                      remoteStatsAtStart.sendNotEnoughBufferSpace,
+                  remoteStats.sendNoCredit - remoteStatsAtStart.sendNoCredit);
+    } else {
+        Log_Debug("WARNING: Could not get RTApp counters; status %d.\n", status);
+    }
+
+    IntercoreStream_LogStats(benchmarkStream);
+
+    if (IntercoreRpc_Call(IntercoreRpc_Method_GetChannelStats, NULL, 0, echoTimeoutMs,
+                          ChannelStatsCompletionHandler, NULL) == -1) {
+        ChannelStatsCompletionHandler(IntercoreRpc_Status_Cancelled, NULL, 0, NULL);
+    }
+}
+
+// Logs how long the real-time capable application's messages waited in each of its channels,
+// which shows whether the echoes were held up by other traffic.
+static void ChannelStatsCompletionHandler(IntercoreRpc_Status status, const uint8_t *response,
+                                          size_t size, void *context)
+{
+    if (!running) {
+        return;
+    }
+
+    static const char *const channelNames[] = {"control", "normal", "bulk"};
+    if (status == IntercoreRpc_Status_Ok && size % sizeof(IntercoreRpc_ChannelStats) == 0) {
+        size_t count = size / sizeof(IntercoreRpc_ChannelStats);
+        for (size_t i = 0; i < count; ++i) {
+            IntercoreRpc_ChannelStats stats;
+            memcpy(&stats, response + i * sizeof(stats), sizeof(stats));
+            const char *name =
+                (i < sizeof(channelNames) / sizeof(channelNames[0])) ? channelNames[i] : "other";
+            Log_Debug("RTApp %s channel: %u sent, %u queued (at most %u at once, waited at most "
+                      "%u us), %u dropped.\n",
+                      name, stats.messagesSent, stats.messagesQueued, stats.maxQueuedMessages,
+                      stats.maxQueueWaitUs, stats.messagesDropped);
+        }
+    } else {
+        Log_Debug("WARNING: Could not get RTApp channel counters; status %d.\n", status);
+    }
+
+    if (IntercoreRpc_Call(IntercoreRpc_Method_GetProfile, NULL, 0, echoTimeoutMs,
+                          ProfileCompletionHandler, NULL) == -1) {
+        Finish();
+    }
+}
+
+// Logs the time taken by the real-time capable application's interrupt handlers and DPCs, if it
+// was built with RTAPP_PROFILE. Otherwise the response is empty, or the method is unknown.
+static void ProfileCompletionHandler(IntercoreRpc_Status status, const uint8_t *response,
+                                     size_t size, void *context)
+{
+    if (!running) {
+        return;
+    }
+
+    if (status == IntercoreRpc_Status_Ok && size % sizeof(IntercoreRpc_ProfileRecord) == 0) {
+        for (size_t offset = 0; offset < size; offset += sizeof(IntercoreRpc_ProfileRecord)) {
+            IntercoreRpc_ProfileRecord record;
+            memcpy(&record, response + offset, sizeof(record));
+            if (record.count == 0) {
+                continue;
+            }
+
+            Log_Debug("RTApp %.*s: %u runs, min %u, mean %llu, max %u cycles.\n",
+                      (int)sizeof(record.name), record.name, record.count, record.minCycles,
+                      (unsigned long long)(record.totalCycles / record.count), record.maxCycles);
+        }
+    }
+
+    Finish();
+}
+
+static void Finish(void)
+{
+    Log_Debug("Benchmark finished.\n");
+    IntercoreBenchmark_Stop();
+    if (benchmarkDoneHandler != NULL) {
+        benchmarkDoneHandler();
+    }
+}
+
+int IntercoreBenchmark_Start(EventLoop *eventLoopInstance, IntercoreStream_State *stream,
+                             uint32_t messagesPerSecond, uint32_t count,
+                             IntercoreBenchmark_DoneHandler doneHandler)
+{
+    if (messagesPerSecond == 0 || count == 0 || count > INTERCORE_BENCHMARK_MAX_MESSAGES) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    sendTimer = CreateEventLoopDisarmedTimer(eventLoopInstance, SendTimerEventHandler);
+    if (sendTimer == NULL) {
+        return -1;
+    }
+
+    benchmarkStream = stream;
+    benchmarkDoneHandler = doneHandler;
+    messagesPerSize = count;
+    uint64_t periodNs = 1000000000ULL / messagesPerSecond;
+    sendPeriod.tv_sec = (time_t)(periodNs / 1000000000ULL);
+    sendPeriod.tv_nsec = (long)(periodNs % 1000000000ULL);
+    sizeIndex = 0;
+    running = true;
+
+    Log_Debug("Benchmark: %u messages at each size, %u per second.\n", messagesPerSize,
+              messagesPerSecond);
+
+    RequestRemoteStats(InitialStatsCompletionHandler);
+    return 0;
+}
+
+bool IntercoreBenchmark_IsRunning(void)
+{
+    return running;
+}
+
+void IntercoreBenchmark_Stop(void)
+{
+    running = false;
+    DisposeEventLoopTimer(sendTimer);
+    sendTimer = NULL;
+}
@@ -0,0 +1,46 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <applibs/eventloop.h>
+
+#include "intercore_stream.h"
+
+/// <summary>Maximum number of messages which are sent at each size.</summary>
+#define INTERCORE_BENCHMARK_MAX_MESSAGES 1000
+
+/// <summary>Invoked when the benchmark has finished and logged its results.</summary>
+typedef void (*IntercoreBenchmark_DoneHandler)(void);
+
+/// <summary>
+///     <para>Measures the round-trip latency and throughput of the intercore channel. At each
+///     payload size from 4 bytes to 1KB, messages are sent to the real-time capable application
+///     at a fixed rate with IntercoreRpc_Method_Echo, and the time until each echo arrives is
+///     recorded. For each size, the latency percentiles and the sustained throughput are
+///     logged, together with the number of messages which were not sent, or not answered.</para>
+///     <para>When every size has been measured, the real-time capable application's counters
+///     are fetched, so drops on that core are reported too. IntercoreRpc_Init must have been
+///     called, and RPC responses must be passed to IntercoreRpc_HandleMessage.</para>
+/// </summary>
+/// <param name="eventLoopInstance">Event loop which runs the send timer.</param>
+/// <param name="stream">Stream to the real-time capable application, whose counters are
+/// logged.</param>
+/// <param name="messagesPerSecond">Rate at which messages are sent.</param>
+/// <param name="count">
+///     Number of messages which are sent at each size, at most INTERCORE_BENCHMARK_MAX_MESSAGES.
+/// </param>
+/// <param name="doneHandler">Function to invoke when the benchmark has finished.</param>
+/// <returns>0 on success, or -1 on failure, in which case errno is set.</returns>
+int IntercoreBenchmark_Start(EventLoop *eventLoopInstance, IntercoreStream_State *stream,
+                             uint32_t messagesPerSecond, uint32_t count,
+                             IntercoreBenchmark_DoneHandler doneHandler);
+
+/// <summary>Whether the benchmark has been started and has not finished.</summary>
+bool IntercoreBenchmark_IsRunning(void);
+
+/// <summary>Stops the benchmark if it is running, and frees its resources.</summary>
+void IntercoreBenchmark_Stop(void);
@@ -0,0 +1,211 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#include <applibs/log.h>
+
+#include "eventloop_timer_utilities.h"
+#include "intercore_rpc.h"
+
+// A call which is waiting for a response.
+typedef struct {
+    bool inUse;
+    uint32_t correlationId;
+    struct timespec deadline;
+    IntercoreRpc_CompletionHandler completionHandler;
+    void *context;
+} PendingCall;
+
+// The timer handler does not take a context, so the RPC state is held here.
+static IntercoreStream_State *rpcStream = NULL;
+static EventLoopTimer *timeoutTimer = NULL;
+static uint32_t nextCorrelationId = 1;
+static PendingCall pendingCalls[INTERCORE_RPC_MAX_PENDING_CALLS];
+static uint8_t txMessage[INTERCORE_STREAM_MAX_MESSAGE_SIZE];
+
+static void TimeoutTimerEventHandler(EventLoopTimer *timer);
+static void ArmTimeoutTimer(void);
+static void CompleteCall(PendingCall *call, IntercoreRpc_Status status, const uint8_t *response,
+                         size_t size);
+static bool IsBefore(const struct timespec *a, const struct timespec *b);
+
+// Whether time a is earlier than time b.
+static bool IsBefore(const struct timespec *a, const struct timespec *b)
+{
+    return (a->tv_sec < b->tv_sec) || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+// Frees the call's slot, and then invokes its completion handler, which can make another call.
+static void CompleteCall(PendingCall *call, IntercoreRpc_Status status, const uint8_t *response,
+                         size_t size)
+{
+    IntercoreRpc_CompletionHandler completionHandler = call->completionHandler;
+    void *context = call->context;
+    call->inUse = false;
+
+    completionHandler(status, response, size, context);
+}
+
+// Sets the timeout timer to expire at the earliest deadline of the pending calls.
+static void ArmTimeoutTimer(void)
+{
+    const struct timespec *earliest = NULL;
+    for (size_t i = 0; i < INTERCORE_RPC_MAX_PENDING_CALLS; ++i) {
+        if (pendingCalls[i].inUse &&
+            (earliest == NULL || IsBefore(&pendingCalls[i].deadline, earliest))) {
+            earliest = &pendingCalls[i].deadline;
+        }
+    }
+
+    if (earliest == NULL) {
+        DisarmEventLoopTimer(timeoutTimer);
+        return;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    // A zero delay would disarm the timer, so a deadline which has passed expires after 1ns.
+    struct timespec delay = {.tv_sec = 0, .tv_nsec = 1};
+    if (IsBefore(&now, earliest)) {
+        delay.tv_sec = earliest->tv_sec - now.tv_sec;
+        delay.tv_nsec = earliest->tv_nsec - now.tv_nsec;
+        if (delay.tv_nsec < 0) {
+            --delay.tv_sec;
+            delay.tv_nsec += 1000 * 1000 * 1000;
+        }
+    }
+
+    SetEventLoopTimerOneShot(timeoutTimer, &delay);
+}
+
+// Completes every call whose deadline has passed.
+static void TimeoutTimerEventHandler(EventLoopTimer *timer)
+{
+    if (ConsumeEventLoopTimerEvent(timer) != 0) {
+        return;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    for (size_t i = 0; i < INTERCORE_RPC_MAX_PENDING_CALLS; ++i) {
+        if (pendingCalls[i].inUse && !IsBefore(&now, &pendingCalls[i].deadline)) {
+            Log_Debug("ERROR: RPC call %u timed out.\n", pendingCalls[i].correlationId);
+            CompleteCall(&pendingCalls[i], IntercoreRpc_Status_Timeout, NULL, 0);
+        }
+    }
+
+    ArmTimeoutTimer();
+}
+
+int IntercoreRpc_Init(EventLoop *eventLoopInstance, IntercoreStream_State *stream)
+{
+    timeoutTimer = CreateEventLoopDisarmedTimer(eventLoopInstance, TimeoutTimerEventHandler);
+    if (timeoutTimer == NULL) {
+        return -1;
+    }
+
+    rpcStream = stream;
+    memset(pendingCalls, 0, sizeof(pendingCalls));
+    return 0;
+}
+
+int IntercoreRpc_Call(uint16_t methodId, const void *request, size_t size, uint32_t timeoutMs,
+                      IntercoreRpc_CompletionHandler completionHandler, void *context)
+{
+    if (size > INTERCORE_RPC_MAX_PAYLOAD_SIZE) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    PendingCall *call = NULL;
+    for (size_t i = 0; i < INTERCORE_RPC_MAX_PENDING_CALLS && call == NULL; ++i) {
+        if (!pendingCalls[i].inUse) {
+            call = &pendingCalls[i];
+        }
+    }
+
+    if (call == NULL) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    IntercoreRpc_Header header = {.magic = INTERCORE_RPC_MAGIC,
+                                  .version = INTERCORE_RPC_VERSION,
+                                  .kind = IntercoreRpc_Kind_Request,
+                                  .methodId = methodId,
+                                  .status = 0,
+                                  .correlationId = nextCorrelationId++,
+                                  .payloadSize = (uint32_t)size};
+    memcpy(txMessage, &header, sizeof(header));
+    memcpy(txMessage + sizeof(header), request, size);
+
+    if (IntercoreStream_SendWithPriority(rpcStream, IntercoreStream_Priority_Control, txMessage,
+                                         sizeof(header) + size) == -1) {
+        return -1;
+    }
+
+    call->inUse = true;
+    call->correlationId = header.correlationId;
+    call->completionHandler = completionHandler;
+    call->context = context;
+    clock_gettime(CLOCK_MONOTONIC, &call->deadline);
+    call->deadline.tv_sec += timeoutMs / 1000;
+    call->deadline.tv_nsec += (long)(timeoutMs % 1000) * 1000 * 1000;
+    if (call->deadline.tv_nsec >= 1000 * 1000 * 1000) {
+        ++call->deadline.tv_sec;
+        call->deadline.tv_nsec -= 1000 * 1000 * 1000;
+    }
+
+    ArmTimeoutTimer();
+    return 0;
+}
+
+bool IntercoreRpc_HandleMessage(const uint8_t *data, size_t size)
+{
+    IntercoreRpc_Header header;
+    if (size < sizeof(header)) {
+        return false;
+    }
+
+    memcpy(&header, data, sizeof(header));
+    if (header.magic != INTERCORE_RPC_MAGIC) {
+        return false;
+    }
+
+    if (header.version != INTERCORE_RPC_VERSION || header.kind != IntercoreRpc_Kind_Response ||
+        header.payloadSize > size - sizeof(header)) {
+        Log_Debug("ERROR: Ignoring malformed RPC message.\n");
+        return true;
+    }
+
+    for (size_t i = 0; i < INTERCORE_RPC_MAX_PENDING_CALLS; ++i) {
+        if (pendingCalls[i].inUse && pendingCalls[i].correlationId == header.correlationId) {
+            CompleteCall(&pendingCalls[i], header.status, data + sizeof(header),
+                         header.payloadSize);
+            ArmTimeoutTimer();
+            return true;
+        }
+    }
+
+    // The call has already timed out.
+    Log_Debug("Ignoring late response to RPC call %u.\n", header.correlationId);
+    return true;
+}
+
+void IntercoreRpc_Cleanup(void)
+{
+    for (size_t i = 0; i < INTERCORE_RPC_MAX_PENDING_CALLS; ++i) {
+        if (pendingCalls[i].inUse) {
+            CompleteCall(&pendingCalls[i], IntercoreRpc_Status_Cancelled, NULL, 0);
+        }
+    }
+
+    DisposeEventLoopTimer(timeoutTimer);
+    timeoutTimer = NULL;
+    rpcStream = NULL;
+}
@@ -0,0 +1,236 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <applibs/eventloop.h>
+
+#include "intercore_stream.h"
+
+// Remote procedure calls (RPCs) to the real-time capable application. Each message starts with
+// a fixed 16-byte header, which is followed by the payload. The same definitions are used by
+// the real-time capable application, in logical-rpc.h.
+
+/// <summary>
+///     Value of the magic field, which distinguishes RPC messages from other messages.
+/// </summary>
+#define INTERCORE_RPC_MAGIC 0x4352 // "RC"
+
+/// <summary>Version of the header layout.</summary>
+#define INTERCORE_RPC_VERSION 1
+
+/// <summary>Maximum size of a request or response payload in bytes.</summary>
+#define INTERCORE_RPC_MAX_PAYLOAD_SIZE \
+    (INTERCORE_STREAM_MAX_MESSAGE_SIZE - sizeof(IntercoreRpc_Header))
+
+/// <summary>Maximum number of calls which can be waiting for a response.</summary>
+#define INTERCORE_RPC_MAX_PENDING_CALLS 8
+
+/// <summary>Whether a message is a request or a response.</summary>
+typedef enum {
+    IntercoreRpc_Kind_Request = 0,
+    IntercoreRpc_Kind_Response = 1
+} IntercoreRpc_Kind;
+
+/// <summary>Methods which the real-time capable application implements.</summary>
+typedef enum {
+    /// <summary>Returns the request payload unchanged.</summary>
+    IntercoreRpc_Method_Echo = 1,
+    /// <summary>
+    ///     Applies a moving-average filter to little-endian int16_t samples. The request is a
+    ///     uint16_t window length followed by the samples; the response is the filtered samples.
+    /// </summary>
+    IntercoreRpc_Method_MovingAverage = 2,
+    /// <summary>
+    ///     Returns the real-time capable application's traffic counters as an
+    ///     IntercoreRpc_RemoteStats. The request is empty.
+    /// </summary>
+    IntercoreRpc_Method_GetStats = 3,
+    /// <summary>
+    ///     Returns an IntercoreRpc_ProfileRecord for each region of code which the real-time
+    ///     capable application has timed since its last periodic report. The request is empty.
+    ///     The response is empty unless that application is built with RTAPP_PROFILE.
+    /// </summary>
+    IntercoreRpc_Method_GetProfile = 4,
+    /// <summary>
+    ///     Returns an IntercoreRpc_ChannelStats for each of the real-time capable application's
+    ///     logical channels, highest priority first. The request is empty.
+    /// </summary>
+    IntercoreRpc_Method_GetChannelStats = 5
+} IntercoreRpc_Method;
+
+/// <summary>
+///     Traffic counters on the real-time capable application, which are returned by
+///     IntercoreRpc_Method_GetStats. The layout matches IntercoreStats in logical-intercore.h.
+/// </summary>
+typedef struct {
+    /// <summary>Number of messages received from this application.</summary>
+    uint32_t messagesReceived;
+    /// <summary>Number of payload bytes in the received messages.</summary>
+    uint32_t bytesReceived;
+    /// <summary>Number of times the inbound buffer was found to be empty.</summary>
+    uint32_t recvNoBlockSize;
+    /// <summary>Number of messages sent to this application.</summary>
+    uint32_t messagesSent;
+    /// <summary>Number of payload bytes in the sent messages.</summary>
+    uint32_t bytesSent;
+    /// <summary>Number of messages which were not sent because the outbound buffer was
+    /// full.</summary>
+    uint32_t sendNotEnoughBufferSpace;
+    /// <summary>Number of messages which were not sent because they were too large.</summary>
+    uint32_t sendMessageTooLarge;
+    /// <summary>Number of messages which were not sent because this application had not
+    /// granted credit for them.</summary>
+    uint32_t sendNoCredit;
+    /// <summary>Number of credit grants received from this application.</summary>
+    uint32_t creditGrantsReceived;
+    /// <summary>Number of credit grants sent to this application.</summary>
+    uint32_t creditGrantsSent;
+} IntercoreRpc_RemoteStats;
+
+/// <summary>
+///     Counters of one logical channel on the real-time capable application, which are returned
+///     by IntercoreRpc_Method_GetChannelStats. The layout matches IntercoreChannelStats in
+///     logical-channel.h.
+/// </summary>
+typedef struct {
+    /// <summary>Number of messages which were written to the outbound buffer.</summary>
+    uint32_t messagesSent;
+    /// <summary>Number of messages which were queued, rather than sent at once.</summary>
+    uint32_t messagesQueued;
+    /// <summary>Number of messages which were dropped because the channel's queue was
+    /// full.</summary>
+    uint32_t messagesDropped;
+    /// <summary>Largest number of messages which have been queued at once.</summary>
+    uint32_t maxQueuedMessages;
+    /// <summary>Longest time in microseconds for which a message was queued.</summary>
+    uint32_t maxQueueWaitUs;
+} IntercoreRpc_ChannelStats;
+
+/// <summary>Number of bins in the histogram of an IntercoreRpc_ProfileRecord.</summary>
+#define INTERCORE_RPC_PROFILE_HISTOGRAM_BINS 16
+
+/// <summary>
+///     Statistics of one region of code on the real-time capable application, which are returned
+///     by IntercoreRpc_Method_GetProfile. The layout matches ProfileRecord in logical-profile.h.
+///     Durations are in cycles of the real-time core's clock.
+/// </summary>
+typedef struct {
+    /// <summary>Total duration.</summary>
+    uint64_t totalCycles;
+    /// <summary>Number of times the region ran.</summary>
+    uint32_t count;
+    /// <summary>Shortest duration, or 0 if the region did not run.</summary>
+    uint32_t minCycles;
+    /// <summary>Longest duration.</summary>
+    uint32_t maxCycles;
+    /// <summary>Reserved; zero.</summary>
+    uint32_t reserved;
+    /// <summary>Bin 0 counts durations of less than 64 cycles, bin n counts durations from
+    /// 2^(n+5) to 2^(n+6)-1 cycles, and the last bin also counts every longer one.</summary>
+    uint32_t histogram[INTERCORE_RPC_PROFILE_HISTOGRAM_BINS];
+    /// <summary>Name of the region, which is not terminated if it fills the array.</summary>
+    char name[24];
+} IntercoreRpc_ProfileRecord;
+
+_Static_assert(sizeof(IntercoreRpc_ProfileRecord) == 112,
+               "IntercoreRpc_ProfileRecord must be 112 bytes");
+
+/// <summary>Outcome of a call, which is passed to the completion handler.</summary>
+typedef enum {
+    /// <summary>The method succeeded, and the response contains its result.</summary>
+    IntercoreRpc_Status_Ok = 0,
+    /// <summary>The real-time capable application does not implement the method.</summary>
+    IntercoreRpc_Status_UnknownMethod = 1,
+    /// <summary>The request was malformed.</summary>
+    IntercoreRpc_Status_BadRequest = 2,
+    /// <summary>The result did not fit in a response.</summary>
+    IntercoreRpc_Status_ResponseTooLarge = 3,
+    /// <summary>No response arrived before the timeout. Reported locally.</summary>
+    IntercoreRpc_Status_Timeout = 0x100,
+    /// <summary>The call was abandoned by <see cref="IntercoreRpc_Cleanup" />. Reported
+    /// locally.</summary>
+    IntercoreRpc_Status_Cancelled = 0x101
+} IntercoreRpc_Status;
+
+/// <summary>Header at the start of every RPC message. All fields are little-endian.</summary>
+typedef struct {
+    /// <summary>INTERCORE_RPC_MAGIC.</summary>
+    uint16_t magic;
+    /// <summary>INTERCORE_RPC_VERSION.</summary>
+    uint8_t version;
+    /// <summary>One of the IntercoreRpc_Kind values.</summary>
+    uint8_t kind;
+    /// <summary>One of the IntercoreRpc_Method values.</summary>
+    uint16_t methodId;
+    /// <summary>For a response, one of the IntercoreRpc_Status values. Zero for a
+    /// request.</summary>
+    uint16_t status;
+    /// <summary>Chosen by the caller, and copied into the response.</summary>
+    uint32_t correlationId;
+    /// <summary>Number of payload bytes which follow the header.</summary>
+    uint32_t payloadSize;
+} IntercoreRpc_Header;
+
+_Static_assert(sizeof(IntercoreRpc_Header) == 16, "IntercoreRpc_Header must be 16 bytes");
+
+/// <summary>
+///     <para>Invoked on the event loop when a call completes.</para>
+///     <param name="status">Whether the call succeeded.</param>
+///     <param name="response">Response payload, which is valid until the handler returns.
+///     Empty unless the status is IntercoreRpc_Status_Ok.</param>
+///     <param name="size">Size of the response payload in bytes.</param>
+///     <param name="context">Context which was supplied to IntercoreRpc_Call.</param>
+/// </summary>
+typedef void (*IntercoreRpc_CompletionHandler)(IntercoreRpc_Status status, const uint8_t *response,
+                                               size_t size, void *context);
+
+/// <summary>
+///     Prepares to make calls over a stream to the real-time capable application. The
+///     application must pass each message which it receives on the stream to
+///     <see cref="IntercoreRpc_HandleMessage" />.
+/// </summary>
+/// <param name="eventLoopInstance">Event loop which runs the timeout timer.</param>
+/// <param name="stream">Stream to send requests on.</param>
+/// <returns>0 on success, or -1 on failure, in which case errno is set.</returns>
+int IntercoreRpc_Init(EventLoop *eventLoopInstance, IntercoreStream_State *stream);
+
+/// <summary>
+///     Sends a request to the real-time capable application without blocking. The completion
+///     handler is invoked exactly once, when the response arrives or the timeout expires,
+///     but never from within this function.
+/// </summary>
+/// <param name="methodId">Method to call.</param>
+/// <param name="request">Request payload.</param>
+/// <param name="size">Size of the request payload, at most INTERCORE_RPC_MAX_PAYLOAD_SIZE.</param>
+/// <param name="timeoutMs">Time to wait for the response, in milliseconds.</param>
+/// <param name="completionHandler">Function to invoke when the call completes.</param>
+/// <param name="context">Context which is passed to the completion handler.</param>
+/// <returns>
+///     0 if the request was sent; or -1 on failure, in which case errno is set to EMSGSIZE if
+///     the request is too large, EBUSY if INTERCORE_RPC_MAX_PENDING_CALLS calls are already
+///     waiting for a response, or another value if the request could not be sent.
+/// </returns>
+int IntercoreRpc_Call(uint16_t methodId, const void *request, size_t size, uint32_t timeoutMs,
+                      IntercoreRpc_CompletionHandler completionHandler, void *context);
+
+/// <summary>
+///     Completes the pending call which a message answers, if it is an RPC response.
+/// </summary>
+/// <param name="data">Message which was received from the real-time capable application.</param>
+/// <param name="size">Size of the message in bytes.</param>
+/// <returns>
+///     true if the message was an RPC message, and so has been handled; false if it should be
+///     handled by the application.
+/// </returns>
+bool IntercoreRpc_HandleMessage(const uint8_t *data, size_t size);
+
+/// <summary>
+///     Completes any pending calls with IntercoreRpc_Status_Cancelled, and frees the resources
+///     which were allocated by <see cref="IntercoreRpc_Init" />.
+/// </summary>
+void IntercoreRpc_Cleanup(void);
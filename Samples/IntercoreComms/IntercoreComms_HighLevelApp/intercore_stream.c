@@ -0,0 +1,466 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/socket.h>
+
+#include <applibs/log.h>
+
+#include "intercore_stream.h"
+
+static void HandleSocketEvent(EventLoop *el, int fd, EventLoop_IoEvents events, void *context);
+static bool ReceiveBatch(IntercoreStream_State *stream, size_t *count);
+static bool HandleGrant(IntercoreStream_State *stream, const uint8_t *data, size_t size);
+static void SendGrant(IntercoreStream_State *stream);
+static bool HasCredit(const IntercoreStream_State *stream, IntercoreStream_Priority priority);
+static bool HasQueuedMessages(const IntercoreStream_State *stream,
+                              IntercoreStream_Priority highestPriority);
+static bool CanDrain(const IntercoreStream_State *stream);
+static int TrySend(IntercoreStream_State *stream, IntercoreStream_Priority priority,
+                   const void *data, size_t size);
+static void DrainSendQueue(IntercoreStream_State *stream);
+static void WatchForSpace(IntercoreStream_State *stream);
+static uint64_t ElapsedUs(const struct timespec *from, const struct timespec *to);
+
+static const char *const priorityNames[INTERCORE_STREAM_PRIORITY_COUNT] = {"Control", "Normal",
+                                                                           "Bulk"};
+
+IntercoreStream_State *IntercoreStream_Start(EventLoop *eventLoopInstance, int sockFd,
+                                             IntercoreStream_MessageHandler messageHandler,
+                                             IntercoreStream_ErrorHandler errorHandler,
+                                             void *context)
+{
+    IntercoreStream_State *stream = malloc(sizeof(*stream));
+    if (!stream) {
+        abort();
+    }
+
+    memset(stream, 0, sizeof(*stream));
+    stream->eventLoop = eventLoopInstance;
+    stream->sockFd = sockFd;
+    stream->messageHandler = messageHandler;
+    stream->errorHandler = errorHandler;
+    stream->context = context;
+    clock_gettime(CLOCK_MONOTONIC, &stream->loggedTime);
+
+    // The session only needs to differ from the one before a restart.
+    stream->recvSession = (uint32_t)stream->loggedTime.tv_sec * 1000000000u +
+                          (uint32_t)stream->loggedTime.tv_nsec;
+    stream->sendLimit = INTERCORE_FLOW_INITIAL_CREDITS;
+
+    for (size_t i = 0; i < INTERCORE_STREAM_BATCH_SIZE; ++i) {
+        stream->batch[i].data = stream->buffers[i];
+    }
+
+    for (size_t i = 0; i < INTERCORE_STREAM_SEND_QUEUE_SIZE; ++i) {
+        stream->sendQueueFree[i] = i;
+    }
+    stream->sendQueueFreeCount = INTERCORE_STREAM_SEND_QUEUE_SIZE;
+
+    stream->sockEvents = EventLoop_Input;
+    stream->sockEventReg = EventLoop_RegisterIo(eventLoopInstance, sockFd, stream->sockEvents,
+                                                HandleSocketEvent, stream);
+    if (stream->sockEventReg == NULL) {
+        Log_Debug("ERROR: Unable to register socket event: %d (%s)\n", errno, strerror(errno));
+        free(stream);
+        return NULL;
+    }
+
+    // Tell the real-time capable application the window now, rather than after its first
+    // messages.
+    SendGrant(stream);
+    WatchForSpace(stream);
+
+    return stream;
+}
+
+// Reads up to a batch of messages from the socket without blocking. Returns false if an error
+// occurred; otherwise, sets count to the number of messages which were read, which is less than
+// the batch size if no more messages are available.
+static bool ReceiveBatch(IntercoreStream_State *stream, size_t *count)
+{
+    *count = 0;
+    while (*count < INTERCORE_STREAM_BATCH_SIZE) {
+        // MSG_TRUNC returns the full size of a message which is larger than the buffer.
+        ssize_t bytesReceived = recv(stream->sockFd, stream->buffers[*count],
+                                     INTERCORE_STREAM_MAX_MESSAGE_SIZE, MSG_DONTWAIT | MSG_TRUNC);
+        if (bytesReceived == -1) {
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+
+        size_t size = (size_t)bytesReceived;
+        if (HandleGrant(stream, stream->buffers[*count], size)) {
+            continue;
+        }
+
+        if (size > INTERCORE_STREAM_MAX_MESSAGE_SIZE) {
+            ++stream->stats.receivedMessagesTruncated;
+            size = INTERCORE_STREAM_MAX_MESSAGE_SIZE;
+        }
+
+        ++stream->recvConsumed;
+        ++stream->stats.messagesReceived;
+        stream->stats.bytesReceived += size;
+        stream->batch[*count].size = size;
+        ++*count;
+    }
+
+    return true;
+}
+
+// If the message is a grant, updates the credit for outbound messages, and returns true.
+static bool HandleGrant(IntercoreStream_State *stream, const uint8_t *data, size_t size)
+{
+    IntercoreStream_FlowGrant grant;
+    if (size != sizeof(grant)) {
+        return false;
+    }
+
+    memcpy(&grant, data, sizeof(grant));
+    if (grant.magic != INTERCORE_FLOW_MAGIC || grant.version != INTERCORE_FLOW_VERSION) {
+        return false;
+    }
+
+    ++stream->stats.creditGrantsReceived;
+
+    // After either side has restarted, the messages which were in flight are treated as
+    // consumed, so the window starts again from this grant. An application which has just
+    // started does not know this stream's window either, so it is sent a grant.
+    if (!stream->sendSessionKnown || grant.session != stream->sendSession) {
+        stream->sendSessionKnown = true;
+        stream->sendSession = grant.session;
+        stream->sendCount = grant.consumed;
+        stream->sendLimit = grant.consumed + grant.window;
+        SendGrant(stream);
+        return true;
+    }
+
+    // A repeated grant must not move the limit back. The counts wrap around, so the difference
+    // is interpreted as signed.
+    uint32_t limit = grant.consumed + grant.window;
+    if ((int32_t)(limit - stream->sendLimit) > 0) {
+        stream->sendLimit = limit;
+    }
+    return true;
+}
+
+// Grants the real-time capable application credit for INTERCORE_STREAM_RECEIVE_WINDOW messages
+// beyond those which have been received. If the outbound buffer is full, the grant is sent when
+// the socket becomes writable.
+static void SendGrant(IntercoreStream_State *stream)
+{
+    IntercoreStream_FlowGrant grant = {.magic = INTERCORE_FLOW_MAGIC,
+                                       .version = INTERCORE_FLOW_VERSION,
+                                       .reserved = 0,
+                                       .session = stream->recvSession,
+                                       .consumed = stream->recvConsumed,
+                                       .window = INTERCORE_STREAM_RECEIVE_WINDOW};
+
+    stream->grantPending = true;
+    if (send(stream->sockFd, &grant, sizeof(grant), MSG_DONTWAIT) == -1) {
+        // Another error would recur, so the grant is abandoned; the next one replaces it.
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            Log_Debug("ERROR: Unable to send credit grant: %d (%s)\n", errno, strerror(errno));
+            stream->grantPending = false;
+        }
+        return;
+    }
+
+    stream->recvGrantedConsumed = stream->recvConsumed;
+    stream->grantPending = false;
+    ++stream->stats.creditGrantsSent;
+}
+
+// Returns whether there is credit for a message of the specified priority. Messages below
+// IntercoreStream_Priority_Control leave INTERCORE_STREAM_CONTROL_RESERVE credits.
+static bool HasCredit(const IntercoreStream_State *stream, IntercoreStream_Priority priority)
+{
+    uint32_t reserve =
+        (priority == IntercoreStream_Priority_Control) ? 0 : INTERCORE_STREAM_CONTROL_RESERVE;
+    return IntercoreStream_GetSendCredits(stream) > reserve;
+}
+
+// Returns whether a message of the specified priority or higher is queued.
+static bool HasQueuedMessages(const IntercoreStream_State *stream,
+                              IntercoreStream_Priority highestPriority)
+{
+    for (int p = 0; p <= (int)highestPriority; ++p) {
+        if (stream->sendQueues[p].count > 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Returns whether there is credit for the next queued message, which is the oldest one of the
+// highest priority.
+static bool CanDrain(const IntercoreStream_State *stream)
+{
+    for (int p = 0; p < INTERCORE_STREAM_PRIORITY_COUNT; ++p) {
+        if (stream->sendQueues[p].count > 0) {
+            return HasCredit(stream, (IntercoreStream_Priority)p);
+        }
+    }
+    return false;
+}
+
+// Sends a message which there is credit for. Returns 1 if the message was sent; 0 if the outbound
+// buffer was full; or -1 if an error occurred, in which case errno is set.
+static int TrySend(IntercoreStream_State *stream, IntercoreStream_Priority priority,
+                   const void *data, size_t size)
+{
+    ssize_t bytesSent = send(stream->sockFd, data, size, MSG_DONTWAIT);
+    if (bytesSent == -1) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            ++stream->stats.sendBufferFull;
+            return 0;
+        }
+        return -1;
+    }
+
+    ++stream->sendCount;
+    ++stream->stats.messagesSent;
+    stream->stats.bytesSent += size;
+    ++stream->stats.priorities[priority].messagesSent;
+    return 1;
+}
+
+// Sends as many queued messages as there is credit and space for, highest priority first, and in
+// order within a priority. A message which cannot be sent holds back those of lower priority,
+// which need at least as much credit and space.
+static void DrainSendQueue(IntercoreStream_State *stream)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    for (int p = 0; p < INTERCORE_STREAM_PRIORITY_COUNT; ++p) {
+        IntercoreStream_Priority priority = (IntercoreStream_Priority)p;
+        IntercoreStream_PriorityQueue *queue = &stream->sendQueues[p];
+        IntercoreStream_PriorityStats *priorityStats = &stream->stats.priorities[p];
+        while (queue->count > 0) {
+            if (!HasCredit(stream, priority)) {
+                return;
+            }
+
+            size_t slot = queue->slots[queue->head];
+            int result =
+                TrySend(stream, priority, stream->sendQueue[slot], stream->sendQueueSizes[slot]);
+            if (result == 0) {
+                return;
+            }
+
+            if (result == -1) {
+                Log_Debug("ERROR: Unable to send queued message: %d (%s)\n", errno,
+                          strerror(errno));
+                ++stream->stats.sentMessagesDropped;
+                ++priorityStats->messagesDropped;
+            } else {
+                uint64_t waitUs = ElapsedUs(&stream->sendQueueTimes[slot], &now);
+                if (waitUs > priorityStats->maxQueueWaitUs) {
+                    priorityStats->maxQueueWaitUs = waitUs;
+                }
+            }
+
+            queue->head = (queue->head + 1) % INTERCORE_STREAM_SEND_QUEUE_SIZE;
+            --queue->count;
+            --stream->sendQueueCount;
+            stream->sendQueueFree[stream->sendQueueFreeCount++] = slot;
+        }
+    }
+}
+
+// Watches the socket for space in the outbound buffer only while a grant, or a message which
+// there is credit for, is waiting for it. Otherwise the event would be raised continually, and a
+// message which is waiting for credit is sent when a grant is received.
+static void WatchForSpace(IntercoreStream_State *stream)
+{
+    // The stream no longer watches the socket after an error.
+    if (stream->sockEvents == EventLoop_None) {
+        return;
+    }
+
+    bool waiting = stream->grantPending || CanDrain(stream);
+    EventLoop_IoEvents events = waiting ? (EventLoop_Input | EventLoop_Output) : EventLoop_Input;
+    if (events != stream->sockEvents) {
+        EventLoop_ModifyIoEvents(stream->eventLoop, stream->sockEventReg, events);
+        stream->sockEvents = events;
+    }
+}
+
+// Sends any grant or queued messages which were waiting for space, drains all the available
+// messages, passing them to the handler in batches, and then grants credit for them and sends
+// the messages which the grants that arrived allow.
+static void HandleSocketEvent(EventLoop *el, int fd, EventLoop_IoEvents events, void *context)
+{
+    IntercoreStream_State *stream = context;
+
+    if ((events & EventLoop_Output) != 0) {
+        if (stream->grantPending) {
+            SendGrant(stream);
+        }
+        DrainSendQueue(stream);
+        WatchForSpace(stream);
+    }
+
+    if ((events & EventLoop_Input) == 0) {
+        return;
+    }
+
+    ++stream->stats.receiveEvents;
+
+    size_t count;
+    do {
+        bool succeeded = ReceiveBatch(stream, &count);
+        // Save the error before the handler runs, because the handler may change errno.
+        int error = succeeded ? 0 : errno;
+
+        if (count > 0) {
+            stream->messageHandler(stream->batch, count, stream->context);
+        }
+
+        if (!succeeded) {
+            Log_Debug("ERROR: Unable to receive message: %d (%s)\n", error, strerror(error));
+            EventLoop_ModifyIoEvents(stream->eventLoop, stream->sockEventReg, EventLoop_None);
+            stream->sockEvents = EventLoop_None;
+            stream->errorHandler(error, stream->context);
+            return;
+        }
+    } while (count == INTERCORE_STREAM_BATCH_SIZE);
+
+    // Grant more credit once half of the window has been used, so the real-time capable
+    // application can keep sending while the grant is on its way.
+    if (stream->recvConsumed - stream->recvGrantedConsumed >= INTERCORE_STREAM_RECEIVE_WINDOW / 2) {
+        SendGrant(stream);
+    }
+
+    DrainSendQueue(stream);
+    WatchForSpace(stream);
+}
+
+int IntercoreStream_Send(IntercoreStream_State *stream, const void *data, size_t size)
+{
+    return IntercoreStream_SendWithPriority(stream, IntercoreStream_Priority_Normal, data, size);
+}
+
+int IntercoreStream_SendWithPriority(IntercoreStream_State *stream,
+                                     IntercoreStream_Priority priority, const void *data,
+                                     size_t size)
+{
+    if ((unsigned)priority >= INTERCORE_STREAM_PRIORITY_COUNT) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (size > INTERCORE_STREAM_MAX_MESSAGE_SIZE) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    // A message which is sent at once must not overtake one which is queued.
+    IntercoreStream_PriorityStats *priorityStats = &stream->stats.priorities[priority];
+    bool hasCredit = HasCredit(stream, priority);
+    if (!HasQueuedMessages(stream, priority) && hasCredit) {
+        int result = TrySend(stream, priority, data, size);
+        if (result != 0) {
+            return (result == 1) ? 0 : -1;
+        }
+    } else if (!hasCredit) {
+        ++stream->stats.sendNoCredit;
+    }
+
+    size_t reserve =
+        (priority == IntercoreStream_Priority_Control) ? 0 : INTERCORE_STREAM_CONTROL_RESERVE;
+    if (stream->sendQueueFreeCount <= reserve) {
+        ++stream->stats.sentMessagesDropped;
+        ++priorityStats->messagesDropped;
+        return 0;
+    }
+
+    size_t slot = stream->sendQueueFree[--stream->sendQueueFreeCount];
+    memcpy(stream->sendQueue[slot], data, size);
+    stream->sendQueueSizes[slot] = size;
+    clock_gettime(CLOCK_MONOTONIC, &stream->sendQueueTimes[slot]);
+
+    IntercoreStream_PriorityQueue *queue = &stream->sendQueues[priority];
+    queue->slots[(queue->head + queue->count) % INTERCORE_STREAM_SEND_QUEUE_SIZE] = slot;
+    ++queue->count;
+    ++priorityStats->messagesQueued;
+    ++stream->sendQueueCount;
+    if (stream->sendQueueCount > stream->stats.sendQueueHighWater) {
+        stream->stats.sendQueueHighWater = stream->sendQueueCount;
+    }
+
+    WatchForSpace(stream);
+    return 0;
+}
+
+uint32_t IntercoreStream_GetSendCredits(const IntercoreStream_State *stream)
+{
+    int32_t credits = (int32_t)(stream->sendLimit - stream->sendCount);
+    return (credits > 0) ? (uint32_t)credits : 0;
+}
+
+// Microseconds from one time to a later one.
+static uint64_t ElapsedUs(const struct timespec *from, const struct timespec *to)
+{
+    int64_t us =
+        (int64_t)(to->tv_sec - from->tv_sec) * 1000000 + (to->tv_nsec - from->tv_nsec) / 1000;
+    return (us > 0) ? (uint64_t)us : 0;
+}
+
+void IntercoreStream_LogStats(IntercoreStream_State *stream)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t elapsedMs = ElapsedUs(&stream->loggedTime, &now) / 1000;
+
+    const IntercoreStream_Stats *stats = &stream->stats;
+    const IntercoreStream_Stats *logged = &stream->loggedStats;
+    uint64_t rxBytesPerSecond = 0;
+    uint64_t txBytesPerSecond = 0;
+    if (elapsedMs > 0) {
+        rxBytesPerSecond = (stats->bytesReceived - logged->bytesReceived) * 1000 / elapsedMs;
+        txBytesPerSecond = (stats->bytesSent - logged->bytesSent) * 1000 / elapsedMs;
+    }
+
+    Log_Debug("Received %" PRIu64 " messages (%" PRIu64 " bytes, %" PRIu64
+              " bytes/s) in %" PRIu64 " events; %" PRIu64 " truncated.\n",
+              stats->messagesReceived, stats->bytesReceived, rxBytesPerSecond,
+              stats->receiveEvents, stats->receivedMessagesTruncated);
+    Log_Debug("Sent %" PRIu64 " messages (%" PRIu64 " bytes, %" PRIu64 " bytes/s); %" PRIu64
+              " dropped.\n",
+              stats->messagesSent, stats->bytesSent, txBytesPerSecond,
+              stats->sentMessagesDropped);
+    Log_Debug("Flow control: %" PRIu32 " credits, %zu queued (at most %" PRIu64 "); %" PRIu64
+              " waits for credit, %" PRIu64 " for space; %" PRIu64 " grants received, %" PRIu64
+              " sent.\n",
+              IntercoreStream_GetSendCredits(stream), stream->sendQueueCount,
+              stats->sendQueueHighWater, stats->sendNoCredit, stats->sendBufferFull,
+              stats->creditGrantsReceived, stats->creditGrantsSent);
+    for (int p = 0; p < INTERCORE_STREAM_PRIORITY_COUNT; ++p) {
+        const IntercoreStream_PriorityStats *priorityStats = &stats->priorities[p];
+        Log_Debug("    %s: %" PRIu64 " sent, %" PRIu64 " queued (%zu now, waited at most %" PRIu64
+                  " us), %" PRIu64 " dropped.\n",
+                  priorityNames[p], priorityStats->messagesSent, priorityStats->messagesQueued,
+                  stream->sendQueues[p].count, priorityStats->maxQueueWaitUs,
+                  priorityStats->messagesDropped);
+    }
+
+    stream->loggedStats = *stats;
+    stream->loggedTime = now;
+}
+
+void IntercoreStream_Stop(IntercoreStream_State *stream)
+{
+    if (!stream) {
+        return;
+    }
+
+    EventLoop_UnregisterIo(stream->eventLoop, stream->sockEventReg);
+    free(stream);
+}
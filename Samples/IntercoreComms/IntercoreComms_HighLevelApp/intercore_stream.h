@@ -0,0 +1,329 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <applibs/eventloop.h>
+
+/// <summary>
+///     Maximum size of a message which can be sent between the cores. Larger messages which are
+///     received from the real-time capable application are truncated and counted in
+///     IntercoreStream_Stats.receivedMessagesTruncated.
+/// </summary>
+#define INTERCORE_STREAM_MAX_MESSAGE_SIZE 1040
+
+/// <summary>Number of messages which are received before they are passed to the handler.</summary>
+#define INTERCORE_STREAM_BATCH_SIZE 16
+
+/// <summary>
+///     Number of messages which the real-time capable application is allowed to send beyond
+///     those which have been received, when flow control is enabled.
+/// </summary>
+#define INTERCORE_STREAM_RECEIVE_WINDOW 16
+
+/// <summary>
+///     Number of messages which are held while the real-time capable application has not granted
+///     credit for them. Messages which are sent while the queue is full are dropped.
+/// </summary>
+#define INTERCORE_STREAM_SEND_QUEUE_SIZE 16
+
+/// <summary>
+///     Number of send queue slots, and of credits, which messages below
+///     IntercoreStream_Priority_Control leave for control messages, so that an RPC request can
+///     still be sent while other messages fill the link.
+/// </summary>
+#define INTERCORE_STREAM_CONTROL_RESERVE 2
+
+/// <summary>
+///     Priority of an outbound message. Queued messages are sent highest priority first, and in
+///     order within a priority. The priorities match IntercoreChannelPriority in
+///     logical-channel.h.
+/// </summary>
+typedef enum {
+    /// <summary>Small messages which must be delivered with bounded latency, such as RPC
+    /// requests.</summary>
+    IntercoreStream_Priority_Control = 0,
+    /// <summary>Regular messages.</summary>
+    IntercoreStream_Priority_Normal = 1,
+    /// <summary>Streams which may fill the link.</summary>
+    IntercoreStream_Priority_Bulk = 2
+} IntercoreStream_Priority;
+
+/// <summary>Number of values of IntercoreStream_Priority.</summary>
+#define INTERCORE_STREAM_PRIORITY_COUNT 3
+
+/// <summary>
+///     Value of the magic field of a credit grant, which distinguishes it from other messages.
+///     The grant is defined here and, for the real-time capable application, in
+///     logical-intercore.h.
+/// </summary>
+#define INTERCORE_FLOW_MAGIC 0x4346 // "FC"
+
+/// <summary>Version of the credit grant layout.</summary>
+#define INTERCORE_FLOW_VERSION 1
+
+/// <summary>
+///     Number of messages which each side may send before it has received a credit grant.
+/// </summary>
+#define INTERCORE_FLOW_INITIAL_CREDITS 4
+
+/// <summary>
+///     <para>A credit grant, which the receiver of a stream of messages sends to the sender to
+///     say how many more messages it can absorb. Grants are not themselves counted or limited
+///     by credits. All fields are little-endian.</para>
+///     <para>The counts are cumulative, so a later grant replaces an earlier one. The sender may
+///     send while it has sent fewer than consumed + window messages since the session
+///     started.</para>
+/// </summary>
+typedef struct {
+    /// <summary>INTERCORE_FLOW_MAGIC.</summary>
+    uint16_t magic;
+    /// <summary>INTERCORE_FLOW_VERSION.</summary>
+    uint8_t version;
+    /// <summary>Reserved - must be 0.</summary>
+    uint8_t reserved;
+    /// <summary>Chosen by the receiver when it starts. A grant with a new session tells the
+    /// sender that the receiver has restarted, so its count of sent messages starts again from
+    /// consumed.</summary>
+    uint32_t session;
+    /// <summary>Number of messages, other than grants, which the receiver has consumed in the
+    /// session.</summary>
+    uint32_t consumed;
+    /// <summary>Number of messages beyond those which the receiver can absorb.</summary>
+    uint32_t window;
+} IntercoreStream_FlowGrant;
+
+/// <summary>A message which has been received from the real-time capable application.</summary>
+typedef struct {
+    /// <summary>Message payload, which is valid until the handler returns.</summary>
+    const uint8_t *data;
+    /// <summary>Size of the payload in bytes.</summary>
+    size_t size;
+} IntercoreStream_Message;
+
+/// <summary>Counters which describe the outbound messages of one priority.</summary>
+typedef struct {
+    /// <summary>Number of messages sent to the real-time capable application.</summary>
+    uint64_t messagesSent;
+    /// <summary>Number of messages which were queued, rather than sent at once.</summary>
+    uint64_t messagesQueued;
+    /// <summary>Number of messages which were dropped because the send queue was full, or
+    /// which could not be sent.</summary>
+    uint64_t messagesDropped;
+    /// <summary>Longest time in microseconds for which a message was queued.</summary>
+    uint64_t maxQueueWaitUs;
+} IntercoreStream_PriorityStats;
+
+/// <summary>Counters which describe the traffic on a stream since it was started.</summary>
+typedef struct {
+    /// <summary>Number of messages received from the real-time capable application.</summary>
+    uint64_t messagesReceived;
+    /// <summary>Number of payload bytes received from the real-time capable application.</summary>
+    uint64_t bytesReceived;
+    /// <summary>Number of received messages which were larger than
+    /// INTERCORE_STREAM_MAX_MESSAGE_SIZE, and so were truncated.</summary>
+    uint64_t receivedMessagesTruncated;
+    /// <summary>Number of messages sent to the real-time capable application.</summary>
+    uint64_t messagesSent;
+    /// <summary>Number of payload bytes sent to the real-time capable application.</summary>
+    uint64_t bytesSent;
+    /// <summary>Number of messages which were not sent because the send queue was
+    /// full.</summary>
+    uint64_t sentMessagesDropped;
+    /// <summary>Number of socket events, each of which drains all the available
+    /// messages.</summary>
+    uint64_t receiveEvents;
+    /// <summary>Number of messages which were queued, rather than sent at once, because the
+    /// real-time capable application had not granted credit for them. Each is a stall of the
+    /// outbound stream.</summary>
+    uint64_t sendNoCredit;
+    /// <summary>Number of times the outbound buffer was full although there was credit, so the
+    /// queue waited for the socket to become writable.</summary>
+    uint64_t sendBufferFull;
+    /// <summary>Largest number of messages which have been held in the send queue.</summary>
+    uint64_t sendQueueHighWater;
+    /// <summary>Number of credit grants received from the real-time capable
+    /// application.</summary>
+    uint64_t creditGrantsReceived;
+    /// <summary>Number of credit grants sent to the real-time capable application.</summary>
+    uint64_t creditGrantsSent;
+    /// <summary>Counters for the outbound messages of each priority.</summary>
+    IntercoreStream_PriorityStats priorities[INTERCORE_STREAM_PRIORITY_COUNT];
+} IntercoreStream_Stats;
+
+/// <summary>Send queue slots which hold the messages of one priority, oldest first.</summary>
+typedef struct {
+    /// <summary>Indexes in IntercoreStream_State.sendQueue, as a circular buffer.</summary>
+    size_t slots[INTERCORE_STREAM_SEND_QUEUE_SIZE];
+    /// <summary>Index in slots of the oldest message.</summary>
+    size_t head;
+    /// <summary>Number of queued messages.</summary>
+    size_t count;
+} IntercoreStream_PriorityQueue;
+
+struct IntercoreStream_State;
+
+/// <summary>
+///     <para>Invoked with a batch of messages which have been received from the real-time
+///     capable application.</para>
+///     <param name="messages">The messages, in the order in which they were received.</param>
+///     <param name="count">Number of messages, which is at most
+///     INTERCORE_STREAM_BATCH_SIZE.</param>
+///     <param name="context">Context which was supplied to IntercoreStream_Start.</param>
+/// </summary>
+typedef void (*IntercoreStream_MessageHandler)(const IntercoreStream_Message *messages,
+                                               size_t count, void *context);
+
+/// <summary>
+///     <para>Invoked when the stream cannot receive any more messages because of an error.</para>
+///     <param name="error">The errno value which describes the error.</param>
+///     <param name="context">Context which was supplied to IntercoreStream_Start.</param>
+/// </summary>
+typedef void (*IntercoreStream_ErrorHandler)(int error, void *context);
+
+/// <summary>
+///     Bundles together state about a stream of messages to and from a real-time capable
+///     application. This should be allocated with <see cref="IntercoreStream_Start" /> and
+///     freed with <see cref="IntercoreStream_Stop" />. The client should not directly modify
+///     member variables.
+/// </summary>
+typedef struct IntercoreStream_State {
+    /// <summary>Used to be notified when messages arrive.</summary>
+    EventLoop *eventLoop;
+    /// <summary>Socket connected to the real-time capable application. Not owned.</summary>
+    int sockFd;
+    /// <summary>Invoked when messages arrive.</summary>
+    EventRegistration *sockEventReg;
+    /// <summary>Invoked with each batch of received messages.</summary>
+    IntercoreStream_MessageHandler messageHandler;
+    /// <summary>Invoked when an error occurs.</summary>
+    IntercoreStream_ErrorHandler errorHandler;
+    /// <summary>Context which is passed to the handlers.</summary>
+    void *context;
+    /// <summary>Traffic counters.</summary>
+    IntercoreStream_Stats stats;
+    /// <summary>Counters when the throughput was last logged, and when that was.</summary>
+    IntercoreStream_Stats loggedStats;
+    struct timespec loggedTime;
+    /// <summary>Describes the messages in the current batch.</summary>
+    IntercoreStream_Message batch[INTERCORE_STREAM_BATCH_SIZE];
+    /// <summary>Pooled buffers which hold the messages in the current batch.</summary>
+    uint8_t buffers[INTERCORE_STREAM_BATCH_SIZE][INTERCORE_STREAM_MAX_MESSAGE_SIZE];
+    /// <summary>Events which the socket is registered for.</summary>
+    EventLoop_IoEvents sockEvents;
+    /// <summary>Session which is sent in this stream's grants.</summary>
+    uint32_t recvSession;
+    /// <summary>Number of received messages, other than grants.</summary>
+    uint32_t recvConsumed;
+    /// <summary>Value of recvConsumed in the last grant which was sent.</summary>
+    uint32_t recvGrantedConsumed;
+    /// <summary>Whether a grant could not be sent when it was due.</summary>
+    bool grantPending;
+    /// <summary>Whether a grant has been received from the real-time capable
+    /// application.</summary>
+    bool sendSessionKnown;
+    /// <summary>Session of the last grant which was received.</summary>
+    uint32_t sendSession;
+    /// <summary>Number of messages sent, counted as the real-time capable application counts
+    /// consumed messages.</summary>
+    uint32_t sendCount;
+    /// <summary>Value of sendCount up to which the real-time capable application has granted
+    /// credit.</summary>
+    uint32_t sendLimit;
+    /// <summary>Number of queued messages, of all priorities.</summary>
+    size_t sendQueueCount;
+    /// <summary>Queued messages of each priority.</summary>
+    IntercoreStream_PriorityQueue sendQueues[INTERCORE_STREAM_PRIORITY_COUNT];
+    /// <summary>Indexes in sendQueue of the slots which are not in use.</summary>
+    size_t sendQueueFree[INTERCORE_STREAM_SEND_QUEUE_SIZE];
+    /// <summary>Number of slots which are not in use.</summary>
+    size_t sendQueueFreeCount;
+    /// <summary>Sizes of the queued messages.</summary>
+    size_t sendQueueSizes[INTERCORE_STREAM_SEND_QUEUE_SIZE];
+    /// <summary>Times at which the messages were queued.</summary>
+    struct timespec sendQueueTimes[INTERCORE_STREAM_SEND_QUEUE_SIZE];
+    /// <summary>Messages which are waiting for credit, or for space in the outbound
+    /// buffer.</summary>
+    uint8_t sendQueue[INTERCORE_STREAM_SEND_QUEUE_SIZE][INTERCORE_STREAM_MAX_MESSAGE_SIZE];
+} IntercoreStream_State;
+
+/// <summary>
+///     <para>Starts receiving messages on a socket which is connected to a real-time capable
+///     application. Each time the socket becomes readable, all the available messages are
+///     read, and passed to the message handler in batches.</para>
+///     <para>The stream uses credit-based flow control, which the real-time capable application
+///     enables with IntercoreSetFlowControl. It grants that application credit for
+///     INTERCORE_STREAM_RECEIVE_WINDOW messages beyond those which have been received, and
+///     consumes the grants which that application sends, so the handler never sees
+///     them.</para>
+///     <param name="eventLoopInstance">Event loop which will invoke IO callbacks.</param>
+///     <param name="sockFd">
+///         Socket returned by Application_Connect. It is used, but not closed, by the stream.
+///     </param>
+///     <param name="messageHandler">Function to invoke with each batch of messages.</param>
+///     <param name="errorHandler">Function to invoke when an error occurs.</param>
+///     <param name="context">Context which is passed to the handlers.</param>
+///     <returns>
+///         Stream state, or NULL on failure. Should be disposed of with
+///         <see cref="IntercoreStream_Stop" />.
+///     </returns>
+/// </summary>
+IntercoreStream_State *IntercoreStream_Start(EventLoop *eventLoopInstance, int sockFd,
+                                             IntercoreStream_MessageHandler messageHandler,
+                                             IntercoreStream_ErrorHandler errorHandler,
+                                             void *context);
+
+/// <summary>
+///     <para>Sends a message to the real-time capable application without blocking, with
+///     IntercoreStream_Priority_Normal. See <see cref="IntercoreStream_SendWithPriority" />.</para>
+///     <param name="stream">Stream returned by IntercoreStream_Start.</param>
+///     <param name="data">Payload to send.</param>
+///     <param name="size">Size of the payload, at most INTERCORE_STREAM_MAX_MESSAGE_SIZE.</param>
+///     <returns>0 if the message was sent, queued or dropped; -1 if an error occurred, in which
+///     case errno is set.</returns>
+/// </summary>
+int IntercoreStream_Send(IntercoreStream_State *stream, const void *data, size_t size);
+
+/// <summary>
+///     <para>Sends a message to the real-time capable application without blocking. If that
+///     application has not granted credit for the message, the outbound buffer is full, or a
+///     message of the same or a higher priority is queued, the message is queued, and sent when
+///     a grant arrives or the buffer has space. Queued messages are sent highest priority first.
+///     If the queue is full, the message is dropped and counted.</para>
+///     <para>Messages below IntercoreStream_Priority_Control leave
+///     INTERCORE_STREAM_CONTROL_RESERVE credits and queue slots unused.</para>
+///     <param name="stream">Stream returned by IntercoreStream_Start.</param>
+///     <param name="priority">Priority of the message.</param>
+///     <param name="data">Payload to send.</param>
+///     <param name="size">Size of the payload, at most INTERCORE_STREAM_MAX_MESSAGE_SIZE.</param>
+///     <returns>0 if the message was sent, queued or dropped; -1 if an error occurred, in which
+///     case errno is set.</returns>
+/// </summary>
+int IntercoreStream_SendWithPriority(IntercoreStream_State *stream,
+                                     IntercoreStream_Priority priority, const void *data,
+                                     size_t size);
+
+/// <summary>
+///     Gets the number of messages which can be sent before the real-time capable application
+///     grants more credit. Messages which are sent beyond this are queued.
+///     <param name="stream">Stream returned by IntercoreStream_Start.</param>
+///     <returns>The number of messages.</returns>
+/// </summary>
+uint32_t IntercoreStream_GetSendCredits(const IntercoreStream_State *stream);
+
+/// <summary>
+///     Logs the traffic counters, the state of the flow control, and the throughput since the
+///     counters were last logged.
+///     <param name="stream">Stream returned by IntercoreStream_Start.</param>
+/// </summary>
+void IntercoreStream_LogStats(IntercoreStream_State *stream);
+
+/// <summary>
+///     Stops receiving messages, and frees the stream. The socket is not closed.
+///     <param name="stream">Stream returned by IntercoreStream_Start, or NULL.</param>
+/// </summary>
+void IntercoreStream_Stop(IntercoreStream_State *stream);
@@ -0,0 +1,59 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <string.h>
+
+#include <applibs/log.h>
+
+#include "intercore_telemetry.h"
+
+// Sequence number which the next summary should have, used to count lost summaries.
+static uint32_t expectedSequence = 0;
+
+// Converts an aggregate from sensor units to milli-g.
+static float ToMilliG(int32_t value)
+{
+    return (float)value * INTERCORE_TELEMETRY_MICRO_G_PER_LSB / 1000.0f;
+}
+
+bool IntercoreTelemetry_HandleMessage(const uint8_t *data, size_t size)
+{
+    IntercoreTelemetry_Summary summary;
+    if (size < sizeof(summary.magic)) {
+        return false;
+    }
+
+    memcpy(&summary.magic, data, sizeof(summary.magic));
+    if (summary.magic != INTERCORE_TELEMETRY_MAGIC) {
+        return false;
+    }
+
+    if (size != sizeof(summary)) {
+        Log_Debug("ERROR: Ignoring telemetry summary of %zu bytes.\n", size);
+        return true;
+    }
+
+    memcpy(&summary, data, sizeof(summary));
+    if (summary.version != INTERCORE_TELEMETRY_VERSION ||
+        summary.axisCount != INTERCORE_TELEMETRY_AXIS_COUNT) {
+        Log_Debug("ERROR: Ignoring telemetry summary version %u.\n", summary.version);
+        return true;
+    }
+
+    if (summary.sequence != expectedSequence && expectedSequence != 0) {
+        Log_Debug("WARNING: %u telemetry summaries lost.\n", summary.sequence - expectedSequence);
+    }
+    expectedSequence = summary.sequence + 1;
+
+    Log_Debug("Telemetry %u: %u samples in %u us (%u failed, %u summaries dropped by RTApp)\n",
+              summary.sequence, summary.sampleCount, summary.windowDurationUs,
+              summary.failedSamples, summary.droppedSummaries);
+    static const char axisNames[INTERCORE_TELEMETRY_AXIS_COUNT] = {'X', 'Y', 'Z'};
+    for (int axis = 0; axis < INTERCORE_TELEMETRY_AXIS_COUNT; ++axis) {
+        const IntercoreTelemetry_AxisSummary *a = &summary.axes[axis];
+        Log_Debug("    %c: min %.1f mg, max %.1f mg, mean %.1f mg, RMS %.1f mg\n", axisNames[axis],
+                  ToMilliG(a->min), ToMilliG(a->max), ToMilliG(a->mean), ToMilliG(a->rms));
+    }
+
+    return true;
+}
@@ -0,0 +1,81 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Telemetry summaries from the real-time capable application, which samples the LSM6DS3
+// accelerometer at a high rate and sends one summary per window of samples. The same definitions
+// are used by the real-time capable application, in logical-telemetry.h.
+
+/// <summary>
+///     Value of the magic field, which distinguishes telemetry summaries from other messages.
+/// </summary>
+#define INTERCORE_TELEMETRY_MAGIC 0x5354 // "TS"
+
+/// <summary>Version of the summary layout.</summary>
+#define INTERCORE_TELEMETRY_VERSION 1
+
+/// <summary>Number of axes in each sample.</summary>
+#define INTERCORE_TELEMETRY_AXIS_COUNT 3
+
+/// <summary>
+///     Acceleration of one unit of a sample in micro-g. The real-time capable application sets
+///     the accelerometer's range to +/-2 g; see LSM6DS3_MICRO_G_PER_LSB in lsm6ds3.h.
+/// </summary>
+#define INTERCORE_TELEMETRY_MICRO_G_PER_LSB 61
+
+/// <summary>Aggregates of one axis over a window. All fields are little-endian.</summary>
+typedef struct {
+    /// <summary>Smallest sample.</summary>
+    int16_t min;
+    /// <summary>Largest sample.</summary>
+    int16_t max;
+    /// <summary>Mean of the samples, rounded towards zero.</summary>
+    int16_t mean;
+    /// <summary>Root mean square of the samples, rounded down.</summary>
+    uint16_t rms;
+} IntercoreTelemetry_AxisSummary;
+
+/// <summary>Message which summarizes a window of samples. All fields are little-endian.</summary>
+typedef struct {
+    /// <summary>INTERCORE_TELEMETRY_MAGIC.</summary>
+    uint16_t magic;
+    /// <summary>INTERCORE_TELEMETRY_VERSION.</summary>
+    uint8_t version;
+    /// <summary>INTERCORE_TELEMETRY_AXIS_COUNT.</summary>
+    uint8_t axisCount;
+    /// <summary>Incremented for each window, so that lost summaries can be detected.</summary>
+    uint32_t sequence;
+    /// <summary>Time of the first sample in the window, from the real-time core's microsecond
+    /// counter.</summary>
+    uint32_t windowStartUs;
+    /// <summary>Time from the first sample to the last sample in microseconds.</summary>
+    uint32_t windowDurationUs;
+    /// <summary>Number of samples which were aggregated.</summary>
+    uint32_t sampleCount;
+    /// <summary>Number of samples in the window which the sensor could not supply.</summary>
+    uint32_t failedSamples;
+    /// <summary>Number of earlier summaries which the real-time capable application could not
+    /// send because the buffer was full.</summary>
+    uint32_t droppedSummaries;
+    /// <summary>Aggregates of each axis.</summary>
+    IntercoreTelemetry_AxisSummary axes[INTERCORE_TELEMETRY_AXIS_COUNT];
+} IntercoreTelemetry_Summary;
+
+_Static_assert(sizeof(IntercoreTelemetry_Summary) == 52,
+               "IntercoreTelemetry_Summary must be 52 bytes");
+
+/// <summary>
+///     Logs a message if it is a telemetry summary, with each axis's acceleration in milli-g.
+/// </summary>
+/// <param name="data">Message which was received from the real-time capable application.</param>
+/// <param name="size">Size of the message in bytes.</param>
+/// <returns>
+///     true if the message was a telemetry summary, and so has been handled; false if it should
+///     be handled by the application.
+/// </returns>
+bool IntercoreTelemetry_HandleMessage(const uint8_t *data, size_t size);
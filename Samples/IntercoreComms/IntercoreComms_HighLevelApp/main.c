@@ -4,6 +4,10 @@
 // This sample C application for Azure Sphere sends messages to, and receives
 // responses from, a real-time capable application. It sends a message every
 // second and prints the message which was sent, and the response which was received.
+// Each second it also makes a remote procedure call which asks the real-time capable
+// application to filter a block of samples, and prints how long the call took. The real-time
+// capable application also samples the LSM6DS3 accelerometer, and sends a summary once per
+// second, so this application does not read the sensor itself.
 //
 // It uses the following Azure Sphere libraries
 // - log (messages shown in Visual Studio's Device Output window during debugging);
@@ -25,6 +29,10 @@
 #include <applibs/application.h>
 
 #include "eventloop_timer_utilities.h"
+#include "intercore_benchmark.h"
+#include "intercore_rpc.h"
+#include "intercore_stream.h"
+#include "intercore_telemetry.h"
 
 /// <summary>
 /// Exit codes for this application. These are used for the
@@ -42,21 +50,44 @@ typedef enum {
     ExitCode_Init_Connection = 7,
     ExitCode_Init_SetSockOpt = 8,
     ExitCode_Init_RegisterIo = 9,
-    ExitCode_Main_EventLoopFail = 10
+    ExitCode_Main_EventLoopFail = 10,
+    ExitCode_Init_Rpc = 11,
+    ExitCode_Init_Benchmark = 12
 } ExitCode;
 
 static int sockFd = -1;
 static EventLoop *eventLoop = NULL;
 static EventLoopTimer *sendTimer = NULL;
-static EventRegistration *socketEventReg = NULL;
+static IntercoreStream_State *stream = NULL;
 static volatile sig_atomic_t exitCode = ExitCode_Success;
 
 static const char rtAppComponentId[] = "005180bc-402f-4cb3-a662-72937dbcde47";
 
+// Define this to benchmark the intercore channel. When the app starts, it sends this many echo
+// requests per second to the RTApp at each of a range of sizes, and logs the round-trip latency
+// percentiles, the throughput and the drop counts. The regular messages resume afterwards.
+//#define INTERCORE_BENCHMARK_RATE 1000
+
+#ifdef INTERCORE_BENCHMARK_RATE
+static const uint32_t benchmarkMessagesPerSize = 1000;
+static void BenchmarkDoneHandler(void);
+#endif
+
+// Each second a block of samples is sent to the RTApp to be filtered.
+#define FILTER_SAMPLE_COUNT 256
+static const uint16_t filterWindow = 8;
+static const uint32_t filterTimeoutMs = 500;
+static struct timespec filterCallTime;
+
 static void TerminationHandler(int signalNumber);
 static void SendTimerEventHandler(EventLoopTimer *timer);
 static void SendMessageToRTApp(void);
-static void SocketEventHandler(EventLoop *el, int fd, EventLoop_IoEvents events, void *context);
+static void CallFilterOnRTApp(void);
+static void FilterCompletionHandler(IntercoreRpc_Status status, const uint8_t *response,
+                                    size_t size, void *context);
+static void MessagesReceivedHandler(const IntercoreStream_Message *messages, size_t count,
+                                    void *context);
+static void StreamErrorHandler(int error, void *context);
 static ExitCode InitHandlers(void);
 static void CloseHandlers(void);
 
@@ -79,7 +110,21 @@ static void SendTimerEventHandler(EventLoopTimer *timer)
         return;
     }
 
+#ifdef INTERCORE_BENCHMARK_RATE
+    // The regular messages would disturb the measurements.
+    if (IntercoreBenchmark_IsRunning()) {
+        return;
+    }
+#endif
+
     SendMessageToRTApp();
+    CallFilterOnRTApp();
+
+    // Log the throughput every ten seconds.
+    static int sendCount = 0;
+    if (++sendCount % 10 == 0) {
+        IntercoreStream_LogStats(stream);
+    }
 }
 
 /// <summary>
@@ -95,8 +140,7 @@ static void SendMessageToRTApp(void)
     iter = (iter + 1) % 100;
     Log_Debug("Sending: %s\n", txMessage);
 
-    int bytesSent = send(sockFd, txMessage, strlen(txMessage), 0);
-    if (bytesSent == -1) {
+    if (IntercoreStream_Send(stream, txMessage, strlen(txMessage)) == -1) {
         Log_Debug("ERROR: Unable to send message: %d (%s)\n", errno, strerror(errno));
         exitCode = ExitCode_SendMsg_Send;
         return;
@@ -104,28 +148,91 @@ static void SendMessageToRTApp(void)
 }
 
 /// <summary>
-///     Handle socket event by reading incoming data from real-time capable application.
+///     Helper function for TimerEventHandler asks the real-time capable application to filter a
+///     block of samples, so the cost of offloading work to it can be seen.
+/// </summary>
+static void CallFilterOnRTApp(void)
+{
+    // The request is the window length followed by a sawtooth wave.
+    uint8_t request[sizeof(uint16_t) + FILTER_SAMPLE_COUNT * sizeof(int16_t)];
+    memcpy(request, &filterWindow, sizeof(filterWindow));
+    for (int16_t i = 0; i < FILTER_SAMPLE_COUNT; ++i) {
+        int16_t sample = (int16_t)((i % 32) * 1000);
+        memcpy(request + sizeof(uint16_t) + i * sizeof(int16_t), &sample, sizeof(sample));
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &filterCallTime);
+    if (IntercoreRpc_Call(IntercoreRpc_Method_MovingAverage, request, sizeof(request),
+                          filterTimeoutMs, FilterCompletionHandler, /* context */ NULL) == -1) {
+        Log_Debug("ERROR: Unable to call RTApp: %d (%s)\n", errno, strerror(errno));
+    }
+}
+
+/// <summary>
+///     Invoked when the real-time capable application has filtered the samples, or the call
+///     timed out.
 /// </summary>
-static void SocketEventHandler(EventLoop *el, int fd, EventLoop_IoEvents events, void *context)
+static void FilterCompletionHandler(IntercoreRpc_Status status, const uint8_t *response,
+                                    size_t size, void *context)
 {
-    // Read response from real-time capable application.
-    // If the RTApp has sent more than 32 bytes, then truncate.
-    char rxBuf[32];
-    int bytesReceived = recv(fd, rxBuf, sizeof(rxBuf), 0);
-
-    if (bytesReceived == -1) {
-        Log_Debug("ERROR: Unable to receive message: %d (%s)\n", errno, strerror(errno));
-        exitCode = ExitCode_SocketHandler_Recv;
+    if (status != IntercoreRpc_Status_Ok) {
+        Log_Debug("ERROR: RPC call failed with status %d.\n", status);
         return;
     }
 
-    Log_Debug("Received %d bytes: ", bytesReceived);
-    for (int i = 0; i < bytesReceived; ++i) {
-        Log_Debug("%c", isprint(rxBuf[i]) ? rxBuf[i] : '.');
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long elapsedUs = (long)(now.tv_sec - filterCallTime.tv_sec) * 1000000 +
+                     (now.tv_nsec - filterCallTime.tv_nsec) / 1000;
+
+    int16_t last = 0;
+    if (size >= sizeof(last)) {
+        memcpy(&last, response + size - sizeof(last), sizeof(last));
+    }
+    Log_Debug("Filtered %zu samples on RTApp in %ld us; last output %d.\n", size / sizeof(last),
+              elapsedUs, last);
+}
+
+/// <summary>
+///     Handle a batch of messages which were received from the real-time capable application.
+///     The stream reads all the available messages each time the socket becomes readable.
+/// </summary>
+static void MessagesReceivedHandler(const IntercoreStream_Message *messages, size_t count,
+                                    void *context)
+{
+    for (size_t m = 0; m < count; ++m) {
+        if (IntercoreRpc_HandleMessage(messages[m].data, messages[m].size) ||
+            IntercoreTelemetry_HandleMessage(messages[m].data, messages[m].size)) {
+            continue;
+        }
+
+        Log_Debug("Received %zu bytes: ", messages[m].size);
+        for (size_t i = 0; i < messages[m].size; ++i) {
+            Log_Debug("%c", isprint(messages[m].data[i]) ? messages[m].data[i] : '.');
+        }
+        Log_Debug("\n");
     }
-    Log_Debug("\n");
 }
 
+/// <summary>
+///     Handle an error which stops messages being received from the real-time capable
+///     application.
+/// </summary>
+static void StreamErrorHandler(int error, void *context)
+{
+    exitCode = ExitCode_SocketHandler_Recv;
+}
+
+#ifdef INTERCORE_BENCHMARK_RATE
+/// <summary>
+///     Invoked when the benchmark has logged its results.
+/// </summary>
+static void BenchmarkDoneHandler(void)
+{
+    Log_Debug("Resuming regular messages.\n");
+}
+#endif
+
 /// <summary>
 ///     Set up SIGTERM termination handler and event handlers for send timer
 ///     and to receive data from real-time capable application.
@@ -169,14 +276,26 @@ static ExitCode InitHandlers(void)
         return ExitCode_Init_SetSockOpt;
     }
 
-    // Register handler for incoming messages from real-time capable application.
-    socketEventReg = EventLoop_RegisterIo(eventLoop, sockFd, EventLoop_Input, SocketEventHandler,
-                                          /* context */ NULL);
-    if (socketEventReg == NULL) {
-        Log_Debug("ERROR: Unable to register socket event: %d (%s)\n", errno, strerror(errno));
+    // Receive incoming messages from real-time capable application.
+    stream = IntercoreStream_Start(eventLoop, sockFd, MessagesReceivedHandler, StreamErrorHandler,
+                                   /* context */ NULL);
+    if (stream == NULL) {
         return ExitCode_Init_RegisterIo;
     }
 
+    if (IntercoreRpc_Init(eventLoop, stream) == -1) {
+        Log_Debug("ERROR: Unable to initialize RPC: %d (%s)\n", errno, strerror(errno));
+        return ExitCode_Init_Rpc;
+    }
+
+#ifdef INTERCORE_BENCHMARK_RATE
+    if (IntercoreBenchmark_Start(eventLoop, stream, INTERCORE_BENCHMARK_RATE,
+                                 benchmarkMessagesPerSize, BenchmarkDoneHandler) == -1) {
+        Log_Debug("ERROR: Unable to start benchmark: %d (%s)\n", errno, strerror(errno));
+        return ExitCode_Init_Benchmark;
+    }
+#endif
+
     return ExitCode_Success;
 }
 
@@ -201,7 +320,9 @@ static void CloseFdAndPrintError(int fd, const char *fdName)
 static void CloseHandlers(void)
 {
     DisposeEventLoopTimer(sendTimer);
-    EventLoop_UnregisterIo(eventLoop, socketEventReg);
+    IntercoreBenchmark_Stop();
+    IntercoreRpc_Cleanup();
+    IntercoreStream_Stop(stream);
     EventLoop_Close(eventLoop);
 
     Log_Debug("Closing file descriptors.\n");
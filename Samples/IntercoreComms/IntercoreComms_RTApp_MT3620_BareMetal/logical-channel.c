@@ -0,0 +1,267 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <stdbool.h>
+
+#include "logical-channel.h"
+#include "logical-dpc.h"
+#include "logical-timer.h"
+
+#include "mt3620-timer.h"
+
+/// <summary>Header of each message in a channel's queue.</summary>
+typedef struct {
+    /// <summary>Payload size in bytes.</summary>
+    uint32_t size;
+    /// <summary>Time at which the message was queued, in microseconds.</summary>
+    uint32_t queuedUs;
+    /// <summary>HLApp which should receive the message.</summary>
+    ComponentId destAppId;
+} QueueEntryHeader;
+
+_Static_assert(INTERCORE_CHANNEL_ENTRY_SIZE(0) == sizeof(QueueEntryHeader),
+               "INTERCORE_CHANNEL_ENTRY_SIZE must match QueueEntryHeader");
+
+static bool HasQueuedMessages(IntercoreChannelPriority highestPriority);
+static bool CanSend(IntercoreChannelPriority priority, size_t size);
+static void CopyFromQueue(const IntercoreChannel *channel, uint32_t offset, void *dest,
+                          size_t size);
+static void CopyToQueue(IntercoreChannel *channel, uint32_t offset, const void *src, size_t size);
+static bool SendHead(IntercoreChannel *channel);
+static void SendQueuedMessages(void);
+static void HandleSendReady(void);
+static void HandleRetryTimerIrq(void);
+
+static IntercoreComm *channelIcc = NULL;
+static uint32_t reservedCredits = 0;
+static uint32_t reservedSpace = 0;
+static uint32_t retryPeriodUs = 0;
+
+// The channels of each priority, in the order in which they take turns.
+static IntercoreChannel *channels[IntercoreChannelPriority_Count];
+
+static CallbackNode sendCbNode = {
+    .enqueued = false, .cb = SendQueuedMessages, .priority = DpcPriority_High};
+static SoftTimer retryTimer = {.next = NULL, .active = false, .cb = HandleRetryTimerIrq};
+// Whether the retry timer is running. It is not restarted by each blocked attempt, so that
+// frequent sends do not keep postponing it.
+static volatile bool retryPending = false;
+
+void IntercoreChannelsInit(IntercoreComm *icc, uint32_t controlCredits,
+                           uint32_t controlReserveSize, uint32_t retryUs)
+{
+    channelIcc = icc;
+    reservedCredits = controlCredits;
+    reservedSpace = INTERCORE_BLOCK_SIZE(controlReserveSize);
+    retryPeriodUs = retryUs;
+    for (int p = 0; p < IntercoreChannelPriority_Count; ++p) {
+        channels[p] = NULL;
+    }
+
+    IntercoreSetSendReadyCallback(icc, HandleSendReady);
+}
+
+void IntercoreChannelOpen(IntercoreChannel *channel, IntercoreChannelPriority priority,
+                          void *storage, size_t storageSize)
+{
+    channel->next = NULL;
+    channel->priority = priority;
+    channel->storage = storage;
+    channel->storageSize = storageSize;
+    channel->head = 0;
+    channel->used = 0;
+    channel->queuedCount = 0;
+    __builtin_memset(&channel->stats, 0, sizeof(channel->stats));
+
+    // New channels take their turn after the existing ones.
+    IntercoreChannel **link = &channels[priority];
+    while (*link != NULL) {
+        link = &(*link)->next;
+    }
+    *link = channel;
+}
+
+// Returns whether a message is queued on a channel with the specified priority or higher.
+static bool HasQueuedMessages(IntercoreChannelPriority highestPriority)
+{
+    for (int p = 0; p <= (int)highestPriority; ++p) {
+        for (const IntercoreChannel *channel = channels[p]; channel != NULL;
+             channel = channel->next) {
+            if (channel->queuedCount != 0) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// Returns whether a message with the specified priority and size can be written to the outbound
+// buffer now. Lower-priority messages leave credit and space for a control message.
+static bool CanSend(IntercoreChannelPriority priority, size_t size)
+{
+    uint32_t credits = IntercoreGetSendCredits(channelIcc);
+    uint32_t required = INTERCORE_BLOCK_OVERHEAD + size;
+    if (priority != IntercoreChannelPriority_Control) {
+        if (credits <= reservedCredits) {
+            return false;
+        }
+        required += reservedSpace;
+    }
+
+    return credits > 0 && IntercoreGetSendSpace(channelIcc) >= required;
+}
+
+IntercoreResult IntercoreChannelSend(IntercoreChannel *channel, const ComponentId *destAppId,
+                                     const void *data, size_t size)
+{
+    if (size > INTERCORE_MAX_PAYLOAD_LEN) {
+        ++channel->stats.messagesDropped;
+        return Intercore_Send_MessageTooLarge;
+    }
+
+    // A message which is sent at once must not overtake one which is queued.
+    if (!HasQueuedMessages(channel->priority) && CanSend(channel->priority, size)) {
+        IntercoreResult icr = IntercoreSend(channelIcc, destAppId, data, size);
+        if (icr == Intercore_OK) {
+            ++channel->stats.messagesSent;
+            return Intercore_OK;
+        }
+    }
+
+    uint32_t entrySize = INTERCORE_CHANNEL_ENTRY_SIZE(size);
+    if (channel->storageSize - channel->used < entrySize) {
+        ++channel->stats.messagesDropped;
+        return Intercore_Send_NotEnoughBufferSpace;
+    }
+
+    QueueEntryHeader header = {.size = size,
+                               .queuedUs = MT3620_Gpt_ReadMicroseconds(),
+                               .destAppId = *destAppId};
+    uint32_t tail = channel->head + channel->used;
+    CopyToQueue(channel, tail, &header, sizeof(header));
+    CopyToQueue(channel, tail + sizeof(header), data, size);
+    channel->used += entrySize;
+    ++channel->queuedCount;
+
+    ++channel->stats.messagesQueued;
+    if (channel->queuedCount > channel->stats.maxQueuedMessages) {
+        channel->stats.maxQueuedMessages = channel->queuedCount;
+    }
+
+    // A higher-priority message may have been queued for want of credit which has since been
+    // granted; sending the queue in order starts with it.
+    SendQueuedMessages();
+    return Intercore_OK;
+}
+
+const IntercoreChannelStats *IntercoreChannelGetStats(const IntercoreChannel *channel)
+{
+    return &channel->stats;
+}
+
+// Copies size bytes from a channel's queue, starting at offset, which wraps around to the start
+// of the storage.
+static void CopyFromQueue(const IntercoreChannel *channel, uint32_t offset, void *dest,
+                          size_t size)
+{
+    offset %= channel->storageSize;
+    size_t toEnd = channel->storageSize - offset;
+    size_t fromEnd = (size > toEnd) ? toEnd : size;
+    __builtin_memcpy(dest, channel->storage + offset, fromEnd);
+    __builtin_memcpy((uint8_t *)dest + fromEnd, channel->storage, size - fromEnd);
+}
+
+// Copies size bytes to a channel's queue, starting at offset, which wraps around to the start of
+// the storage.
+static void CopyToQueue(IntercoreChannel *channel, uint32_t offset, const void *src, size_t size)
+{
+    offset %= channel->storageSize;
+    size_t toEnd = channel->storageSize - offset;
+    size_t toEndSize = (size > toEnd) ? toEnd : size;
+    __builtin_memcpy(channel->storage + offset, src, toEndSize);
+    __builtin_memcpy(channel->storage, (const uint8_t *)src + toEndSize, size - toEndSize);
+}
+
+// Writes the oldest queued message on a channel to the outbound buffer, and removes it from the
+// queue. Returns false if there is not yet credit or space for it.
+static bool SendHead(IntercoreChannel *channel)
+{
+    QueueEntryHeader header;
+    CopyFromQueue(channel, channel->head, &header, sizeof(header));
+    if (!CanSend(channel->priority, header.size)) {
+        return false;
+    }
+
+    // The payload is copied from the queue into the outbound buffer, without a second copy.
+    IntercoreSpans payload;
+    if (IntercoreReserve(channelIcc, &header.destAppId, header.size, &payload) != Intercore_OK) {
+        return false;
+    }
+    uint32_t payloadOffset = channel->head + sizeof(header);
+    CopyFromQueue(channel, payloadOffset, payload.first, payload.firstSize);
+    CopyFromQueue(channel, payloadOffset + payload.firstSize, payload.second,
+                  header.size - payload.firstSize);
+    IntercoreCommit(channelIcc, header.size);
+
+    uint32_t entrySize = INTERCORE_CHANNEL_ENTRY_SIZE(header.size);
+    channel->head = (channel->head + entrySize) % channel->storageSize;
+    channel->used -= entrySize;
+    --channel->queuedCount;
+
+    ++channel->stats.messagesSent;
+    uint32_t waitUs = MT3620_Gpt_ReadMicroseconds() - header.queuedUs;
+    if (waitUs > channel->stats.maxQueueWaitUs) {
+        channel->stats.maxQueueWaitUs = waitUs;
+    }
+    return true;
+}
+
+// Sends queued messages, one at a time, until none are queued or the next one cannot be sent.
+// After each round of the channels of one priority, it starts again from the highest priority,
+// so that a control message which was queued meanwhile goes next. A message which cannot be sent
+// holds back all those of lower priority, which need at least as much credit and space.
+static void SendQueuedMessages(void)
+{
+    if (channelIcc == NULL) {
+        return;
+    }
+
+    bool sent;
+    do {
+        sent = false;
+        for (int p = 0; p < IntercoreChannelPriority_Count && !sent; ++p) {
+            for (IntercoreChannel *channel = channels[p]; channel != NULL;
+                 channel = channel->next) {
+                if (channel->queuedCount == 0) {
+                    continue;
+                }
+
+                if (!SendHead(channel)) {
+                    if (!retryPending) {
+                        retryPending = true;
+                        StartSoftTimer(&retryTimer, retryPeriodUs, 0);
+                    }
+                    return;
+                }
+                sent = true;
+            }
+        }
+    } while (sent);
+
+    StopSoftTimer(&retryTimer);
+    retryPending = false;
+}
+
+// Invoked by IntercorePeek when a grant arrives. The queued messages are sent once the caller
+// has finished with the inbound message.
+static void HandleSendReady(void)
+{
+    EnqueueDeferredProc(&sendCbNode);
+}
+
+// Runs in IRQ context when the retry period expires, and schedules SendQueuedMessages.
+static void HandleRetryTimerIrq(void)
+{
+    retryPending = false;
+    EnqueueDeferredProc(&sendCbNode);
+}
@@ -0,0 +1,136 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "logical-intercore.h"
+
+// Logical channels multiplex several streams of outbound messages, with different priorities,
+// over one IntercoreComm. Each channel queues the messages which cannot be sent at once, and
+// the queued messages are sent highest priority first, one message at a time, so a control
+// message waits for at most the message which is being written, rather than for every bulk
+// message which was sent before it. Channels with the same priority take turns.
+//
+// Channels below IntercoreChannelPriority_Control leave some credit and some space in the
+// outbound buffer unused, so that a control message can still be sent while a bulk stream fills
+// the link. Messages keep the format which the application gives them; the receiver tells the
+// streams apart by their contents, as it does without channels.
+
+/// <summary>Priority of a channel.</summary>
+typedef enum {
+    /// <summary>Small messages which must be delivered with bounded latency, such as RPC
+    /// responses.</summary>
+    IntercoreChannelPriority_Control = 0,
+    /// <summary>Regular messages.</summary>
+    IntercoreChannelPriority_Normal = 1,
+    /// <summary>Streams which may fill the link, such as sensor data.</summary>
+    IntercoreChannelPriority_Bulk = 2,
+    /// <summary>Number of priorities.</summary>
+    IntercoreChannelPriority_Count
+} IntercoreChannelPriority;
+
+/// <summary>Counters which describe the traffic on a channel since it was opened.</summary>
+typedef struct {
+    /// <summary>Number of messages which were written to the outbound buffer.</summary>
+    uint32_t messagesSent;
+    /// <summary>Number of messages which were queued, because they could not be sent when
+    /// <see cref="IntercoreChannelSend" /> was called.</summary>
+    uint32_t messagesQueued;
+    /// <summary>Number of messages which were dropped because the queue was full.</summary>
+    uint32_t messagesDropped;
+    /// <summary>Largest number of messages which have been queued at once.</summary>
+    uint32_t maxQueuedMessages;
+    /// <summary>Longest time in microseconds for which a message was queued.</summary>
+    uint32_t maxQueueWaitUs;
+} IntercoreChannelStats;
+
+/// <summary>
+///     A logical channel. This object is a handle, so the caller should not read or write the
+///     contained data. Initialize this object with <see cref="IntercoreChannelOpen" />.
+/// </summary>
+typedef struct IntercoreChannel {
+    /// <summary>Next channel with the same priority.</summary>
+    struct IntercoreChannel *next;
+    /// <summary>Priority of the channel.</summary>
+    IntercoreChannelPriority priority;
+    /// <summary>Storage for queued messages, which is used as a circular buffer.</summary>
+    uint8_t *storage;
+    /// <summary>Size of the storage in bytes.</summary>
+    uint32_t storageSize;
+    /// <summary>Offset in the storage of the oldest queued message.</summary>
+    uint32_t head;
+    /// <summary>Number of bytes of the storage which are used.</summary>
+    uint32_t used;
+    /// <summary>Number of queued messages.</summary>
+    uint32_t queuedCount;
+    /// <summary>Traffic counters.</summary>
+    IntercoreChannelStats stats;
+} IntercoreChannel;
+
+/// <summary>
+///     Storage which a channel needs to queue one message with a payload of
+///     <paramref name="payloadLen" /> bytes.
+/// </summary>
+#define INTERCORE_CHANNEL_ENTRY_SIZE(payloadLen) \
+    ((sizeof(uint32_t) * 2 + sizeof(ComponentId) + (payloadLen) + 3) & ~(size_t)3)
+
+/// <summary>
+///     <para>Sets up the channels to send messages on a handle. Only one handle can have
+///     channels.</para>
+///     <para>The application should call <see cref="InitSoftTimers" /> first, and must call
+///     <see cref="InvokeDeferredProcs" />, which sends queued messages. If flow control is
+///     enabled, this sets the handle's send-ready callback, so queued messages are sent as soon
+///     as the HLApp grants credit; they are also retried every <paramref name="retryUs" />
+///     microseconds while they cannot be sent.</para>
+/// </summary>
+/// <param name="icc">Handle which was initialized by <see cref="SetupIntercoreComm" /></param>
+/// <param name="controlCredits">Number of credits which lower-priority channels leave for
+/// control messages.</param>
+/// <param name="controlReserveSize">Payload size of a control message for which lower-priority
+/// channels leave space in the outbound buffer.</param>
+/// <param name="retryUs">Period in microseconds at which queued messages which could not be
+/// sent are retried.</param>
+void IntercoreChannelsInit(IntercoreComm *icc, uint32_t controlCredits,
+                           uint32_t controlReserveSize, uint32_t retryUs);
+
+/// <summary>
+///     Opens a channel. The channel and its storage must remain valid while the application
+///     runs.
+/// </summary>
+/// <param name="channel">Channel to initialize.</param>
+/// <param name="priority">Priority of the channel.</param>
+/// <param name="storage">Storage for queued messages. Each message needs
+/// INTERCORE_CHANNEL_ENTRY_SIZE of its payload.</param>
+/// <param name="storageSize">Size of the storage in bytes.</param>
+void IntercoreChannelOpen(IntercoreChannel *channel, IntercoreChannelPriority priority,
+                          void *storage, size_t storageSize);
+
+/// <summary>
+///     Sends a message on a channel. The message is sent at once if no message of the same or a
+///     higher priority is queued, and there is credit and space for it; otherwise it is copied
+///     to the channel's queue. This must not be called while a message is reserved with
+///     <see cref="IntercoreReserve" />.
+/// </summary>
+/// <param name="channel">Channel which was opened by <see cref="IntercoreChannelOpen" />.</param>
+/// <param name="destAppId">HLApp which should receive the message.</param>
+/// <param name="data">Data to send to the HLApp.</param>
+/// <param name="size">Amount of data in bytes.</param>
+/// <returns>
+///     <see cref="Intercore_OK" /> if the message was sent or queued;
+///     <see cref="Intercore_Send_MessageTooLarge" /> if the message was greater than
+///     INTERCORE_MAX_PAYLOAD_LEN bytes; or <see cref="Intercore_Send_NotEnoughBufferSpace" />
+///     if the channel's queue was full, in which case the message is dropped.
+/// </returns>
+IntercoreResult IntercoreChannelSend(IntercoreChannel *channel, const ComponentId *destAppId,
+                                     const void *data, size_t size);
+
+/// <summary>
+///     Gets the traffic counters for a channel.
+/// </summary>
+/// <param name="channel">Channel which was opened by <see cref="IntercoreChannelOpen" />.</param>
+/// <returns>Counters which remain owned by the channel.</returns>
+const IntercoreChannelStats *IntercoreChannelGetStats(const IntercoreChannel *channel);
@@ -3,34 +3,112 @@
 
 #include "logical-dpc.h"
 
-static CallbackNode *volatile callbacks = NULL;
+#if defined(RTAPP_PROFILE)
+#include "logical-profile.h"
+#endif
+
+// Pending DPCs at one priority level, in the order in which they were enqueued.
+typedef struct {
+    CallbackNode *head;
+    CallbackNode *tail;
+} DpcList;
+
+// Each list is only modified with IRQs blocked, and each bit in readyMask is set if the
+// corresponding list is not empty. Every IRQ-blocked section takes constant time, however
+// many DPCs are pending.
+static DpcList readyLists[DpcPriority_Count];
+static volatile uint32_t readyMask = 0;
+
+static uint32_t HighestPriority(uint32_t mask);
+
+// Returns the highest priority whose bit is set in the supplied non-zero mask.
+static uint32_t HighestPriority(uint32_t mask)
+{
+    return 31 - (uint32_t)__builtin_clz(mask);
+}
 
 void EnqueueDeferredProc(CallbackNode *node)
 {
+    uint32_t priority = node->priority;
+    if (priority >= DpcPriority_Count) {
+        priority = DpcPriority_Count - 1;
+    }
+
     uint32_t prevBasePri = BlockIrqs();
     if (!node->enqueued) {
-        CallbackNode *prevHead = callbacks;
+        DpcList *list = &readyLists[priority];
         node->enqueued = true;
-        callbacks = node;
-        node->next = prevHead;
+        node->next = NULL;
+        if (list->tail) {
+            list->tail->next = node;
+        } else {
+            list->head = node;
+        }
+        list->tail = node;
+        readyMask |= 1U << priority;
     }
     RestoreIrqs(prevBasePri);
 }
 
 void InvokeDeferredProcs(void)
 {
-    CallbackNode *node;
-    do {
+    for (;;) {
+        // Take every pending DPC at the highest pending priority in a single IRQ-blocked
+        // section, rather than blocking IRQs once per callback.
         uint32_t prevBasePri = BlockIrqs();
-        node = callbacks;
-        if (node) {
-            node->enqueued = false;
-            callbacks = node->next;
+        uint32_t mask = readyMask;
+        if (mask == 0) {
+            RestoreIrqs(prevBasePri);
+            return;
         }
+
+        uint32_t priority = HighestPriority(mask);
+        DpcList *list = &readyLists[priority];
+        CallbackNode *node = list->head;
+        CallbackNode *batchTail = list->tail;
+        list->head = list->tail = NULL;
+        readyMask = mask & ~(1U << priority);
         RestoreIrqs(prevBasePri);
 
-        if (node) {
+        while (node) {
+            // Read the next node before the flag is cleared, because once it is clear an ISR can
+            // enqueue this node again and overwrite its next pointer.
+            CallbackNode *next = node->next;
+            __atomic_store_n(&node->enqueued, false, __ATOMIC_RELEASE);
+#if defined(RTAPP_PROFILE)
+            ProfileRegion *profile = node->profile;
+            uint32_t startCycles = Profile_Begin();
+            (*node->cb)();
+            Profile_End(profile, startCycles);
+#else
             (*node->cb)();
+#endif
+            node = next;
+
+            // If a higher-priority DPC was enqueued by the callback or by an ISR, put the rest of
+            // the batch back at the front of its list, so it still runs in order, and start again.
+            if (node && (readyMask >> (priority + 1)) != 0) {
+                prevBasePri = BlockIrqs();
+                batchTail->next = list->head;
+                if (!list->head) {
+                    list->tail = batchTail;
+                }
+                list->head = node;
+                readyMask |= 1U << priority;
+                RestoreIrqs(prevBasePri);
+                break;
+            }
         }
-    } while (node);
+    }
+}
+
+void WaitForDeferredProcs(void)
+{
+    // With PRIMASK set, an interrupt which becomes pending after readyMask is checked still
+    // wakes the core from WFI, and is then taken when PRIMASK is cleared.
+    __asm__ volatile("cpsid i" : : : "memory");
+    if (readyMask == 0) {
+        __asm__ volatile("dsb\n\twfi" : : : "memory");
+    }
+    __asm__ volatile("cpsie i" : : : "memory");
 }
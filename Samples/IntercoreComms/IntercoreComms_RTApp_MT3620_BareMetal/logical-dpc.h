@@ -7,6 +7,22 @@
 
 #include "mt3620-baremetal.h"
 
+/// <summary>
+///     Priority of a deferred procedure call (DPC). Pending DPCs with a higher priority are
+///     invoked before those with a lower priority, and DPCs with the same priority are invoked
+///     in the order in which they were enqueued.
+/// </summary>
+typedef enum {
+    /// <summary>Background work. This is the default for a zero-initialized node.</summary>
+    DpcPriority_Low = 0,
+    /// <summary>Periodic application work.</summary>
+    DpcPriority_Normal = 1,
+    /// <summary>Work which must run with bounded latency, such as mailbox handling.</summary>
+    DpcPriority_High = 2,
+    /// <summary>Number of priority levels.</summary>
+    DpcPriority_Count
+} DpcPriority;
+
 /// <summary>
 ///     <para>
 ///         This node is used to build a linked list of deferred procedure calls (DPCs)
@@ -25,12 +41,20 @@ typedef struct CallbackNode {
     ///     the processor leaves interrupt context.
     /// </summary>
     Callback cb;
+    /// <summary>Initialize to the priority with which the callback is invoked.</summary>
+    DpcPriority priority;
+    /// <summary>
+    ///     Initialize to NULL, or to a region which times the callback when the application is
+    ///     built with RTAPP_PROFILE; see PROFILE_REGION_PTR in logical-profile.h.
+    /// </summary>
+    struct ProfileRegion *profile;
 } CallbackNode;
 
 /// <summary>
 ///     This function should be called from an interrupt service routine.
 ///     It schedules a function to be run when the core leaves IRQ context.
 ///     The callbacks will be run by <see cref="InvokeDeferredProcs" />.
+///     If the node is already scheduled, this function has no effect.
 /// </summary>
 /// <param name="node">
 ///     Contains function to schedule. This object must exist until the deferred
@@ -39,9 +63,22 @@ typedef struct CallbackNode {
 void EnqueueDeferredProc(CallbackNode *node);
 
 /// <summary>
-///     Runs any DPCs which have been scheduled with <see cref="EnqueueDeferredProc" />.
-///     The RTApp will typically set up its resources and then go into a loop
-///     which waits for an interrupt, and then calls this function to schedule
-///     enqueued DPCs.
+///     <para>
+///         Runs any DPCs which have been scheduled with <see cref="EnqueueDeferredProc" />,
+///         highest priority first, until none are pending. The RTApp will typically set up its
+///         resources and then go into a loop which calls this function and then
+///         <see cref="WaitForDeferredProcs" />.
+///     </para>
+///     <para>
+///         A DPC which is enqueued while a lower-priority DPC is running is invoked as soon as
+///         that DPC returns.
+///     </para>
 /// </summary>
 void InvokeDeferredProcs(void);
+
+/// <summary>
+///     Puts the core to sleep until an interrupt occurs, unless a DPC is already pending.
+///     Unlike a bare WFI instruction, this does not miss a DPC which was enqueued just after
+///     <see cref="InvokeDeferredProcs" /> returned. It must not be called from IRQ context.
+/// </summary>
+void WaitForDeferredProcs(void);
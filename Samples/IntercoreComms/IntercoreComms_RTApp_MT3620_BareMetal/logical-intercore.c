@@ -3,10 +3,13 @@
 
 #include <stdbool.h>
 
+#include "logical-dpc.h"
 #include "logical-intercore.h"
+#include "logical-timer.h"
 
 #include "mt3620-baremetal.h"
 #include "mt3620-intercore.h"
+#include "mt3620-timer.h"
 
 /// <summary>
 ///     The inbound and outbound buffers track how much data has been written
@@ -35,10 +38,17 @@ struct BufferHeaderImpl {
     ///     </para>
     /// </summary>
     uint32_t readPosition;
-    /// <summary>Align up to 64 bytes, to match high-level L2 cache line.</summary>
+    /// <summary>
+    ///     Align up to 64 bytes, to match high-level L2 cache line. Each header is written
+    ///     by only one core - the inbound header by the high-level application, and the
+    ///     outbound header by this application - so the two cores never write the same line.
+    /// </summary>
     uint32_t reserved[14];
 };
 
+_Static_assert(sizeof(BufferHeader) == INTERCORE_CACHE_LINE_SIZE,
+               "BufferHeader must fill one cache line");
+
 static uint32_t GetBufferSize(uint32_t bufferBase);
 static BufferHeader *GetBufferHeader(uint32_t bufferBase);
 
@@ -49,6 +59,36 @@ static uint32_t ReadInboundCircular(const IntercoreComm *icc, uint32_t startPos,
                                     size_t len);
 static uint32_t WriteOutboundCircular(const IntercoreComm *icc, uint32_t startPos, const void *src,
                                       size_t size);
+static void GetCircularSpans(BufferHeader *header, uint32_t bufSize, uint32_t startPos,
+                             size_t size, IntercoreSpans *spans);
+static uint32_t AdvanceCircular(uint32_t pos, size_t size, uint32_t bufSize);
+static void CopyFromSpans(void *dest, const IntercoreSpans *spans, size_t size);
+static void CopyToSpans(const IntercoreSpans *spans, const void *src, size_t size);
+static uint32_t LocalWritePosition(const IntercoreComm *icc);
+static uint32_t AvailableSpace(const IntercoreComm *icc);
+static void HandleBatchTimerIrq(void);
+static void HandleBatchTimerDeferred(void);
+static IntercoreResult PeekBlock(IntercoreComm *icc, ComponentId *srcAppId,
+                                 IntercoreSpans *payload);
+static void ReleaseBlock(IntercoreComm *icc);
+static IntercoreResult ReserveBlock(IntercoreComm *icc, const ComponentId *destAppId,
+                                    size_t size, IntercoreSpans *payload);
+static void CommitBlock(IntercoreComm *icc, size_t size);
+static bool HandleGrant(IntercoreComm *icc, const IntercoreSpans *payload);
+static void SendGrant(IntercoreComm *icc);
+static void HandleFlowTimerIrq(void);
+static void HandleFlowTimerDeferred(void);
+
+// The batch latency timer callbacks do not take an argument, so the handle whose batch
+// they flush is stored here.
+static IntercoreComm *batchIcc = NULL;
+static CallbackNode batchFlushCbNode = {
+    .enqueued = false, .cb = HandleBatchTimerDeferred, .priority = DpcPriority_High};
+
+// Likewise, the handle on which flow control is enabled.
+static IntercoreComm *flowIcc = NULL;
+static CallbackNode flowGrantCbNode = {
+    .enqueued = false, .cb = HandleFlowTimerDeferred, .priority = DpcPriority_Normal};
 
 // If intercore debugging is enabled and the application detects a corrupt buffer,
 // it will spin forever in the Assert function. The user can then use a debugger
@@ -107,6 +147,21 @@ IntercoreResult SetupIntercoreComm(IntercoreComm *icc, Callback recvCallback)
     icc->inbound = GetBufferHeader(inboundBase);
     icc->outbound = GetBufferHeader(outboundBase);
 
+    icc->sendReserved = false;
+    icc->recvPeeked = false;
+    icc->batchThreshold = 0;
+    icc->batchLatencyUs = 0;
+    icc->batchTimer.next = NULL;
+    icc->batchTimer.active = false;
+    icc->batchTimer.cb = HandleBatchTimerIrq;
+    icc->pendingCount = 0;
+    icc->flowEnabled = false;
+    icc->flowTimer.next = NULL;
+    icc->flowTimer.active = false;
+    icc->flowTimer.cb = HandleFlowTimerIrq;
+    icc->sendReady = NULL;
+    __builtin_memset(&icc->stats, 0, sizeof(icc->stats));
+
     return Intercore_OK;
 }
 
@@ -154,7 +209,52 @@ static uint32_t ReadInboundCircular(const IntercoreComm *icc, uint32_t startPos,
     return finalPos;
 }
 
-IntercoreResult IntercoreRecv(IntercoreComm *icc, ComponentId *srcAppId, void *dest, size_t *size)
+// Describes size bytes of a shared buffer, starting at startPos, which wrap
+// around to the start of the buffer if required.
+static void GetCircularSpans(BufferHeader *header, uint32_t bufSize, uint32_t startPos,
+                             size_t size, IntercoreSpans *spans)
+{
+    if (startPos >= bufSize) {
+        startPos -= bufSize;
+    }
+
+    uint32_t spaceToEnd = bufSize - startPos;
+    spans->first = DataAreaOffset8(header, startPos);
+    spans->firstSize = (size > spaceToEnd) ? spaceToEnd : size;
+    spans->second = DataAreaOffset8(header, 0);
+    spans->secondSize = size - spans->firstSize;
+}
+
+// Returns the position size bytes after pos, wrapping around to the start of the buffer.
+static uint32_t AdvanceCircular(uint32_t pos, size_t size, uint32_t bufSize)
+{
+    uint32_t finalPos = pos + size;
+    if (finalPos >= bufSize) {
+        finalPos -= bufSize;
+    }
+    return finalPos;
+}
+
+// Copies the first size bytes of the supplied spans to dest.
+static void CopyFromSpans(void *dest, const IntercoreSpans *spans, size_t size)
+{
+    size_t fromFirst = (size > spans->firstSize) ? spans->firstSize : size;
+    __builtin_memcpy(dest, spans->first, fromFirst);
+    __builtin_memcpy((uint8_t *)dest + fromFirst, spans->second, size - fromFirst);
+}
+
+// Copies size bytes from src to the start of the supplied spans.
+static void CopyToSpans(const IntercoreSpans *spans, const void *src, size_t size)
+{
+    size_t toFirst = (size > spans->firstSize) ? spans->firstSize : size;
+    __builtin_memcpy(spans->first, src, toFirst);
+    __builtin_memcpy(spans->second, (const uint8_t *)src + toFirst, size - toFirst);
+}
+
+// Helper function for IntercorePeek. Gets the next block in the inbound buffer, whether it is an
+// application message or a grant.
+static IntercoreResult PeekBlock(IntercoreComm *icc, ComponentId *srcAppId,
+                                 IntercoreSpans *payload)
 {
     // Don't read message content until have seen that remote write position has been updated.
     // Corresponding release occurs on high-level core.
@@ -186,6 +286,7 @@ IntercoreResult IntercoreRecv(IntercoreComm *icc, ComponentId *srcAppId, void *d
     // If not, caller will assume that no message was available.
     const size_t blockSizeSize = sizeof(uint32_t);
     if (availData < blockSizeSize) {
+        ++icc->stats.recvNoBlockSize;
         return Intercore_Recv_NoBlockSize;
     }
 
@@ -210,24 +311,15 @@ IntercoreResult IntercoreRecv(IntercoreComm *icc, ComponentId *srcAppId, void *d
     const uint32_t reservedWordSize = sizeof(uint32_t);
     const uint32_t minReqBlockSize = senderComponentIdSize + reservedWordSize;
     INTERCORE_ASSERT(blockSize >= minReqBlockSize);
-
-    // The caller-supplied buffer must be large enough to contain the payload in the buffer,
-    // excluding component ID and reserved word.
     size_t senderPayloadSize = blockSize - minReqBlockSize;
-    if (senderPayloadSize > *size) {
-        return Intercore_Recv_BufferTooSmall;
-    }
-
-    // Tell the caller the actual block size.
-    *size = senderPayloadSize;
 
-    // Read the sender component ID, reserved word, and app-specific payload from the block.
-    // This may wraparound to the start of the buffer.
+    // Read the sender component ID and skip the reserved word. This may wraparound to the
+    // start of the buffer. The app-specific payload is left in place.
     localReadPosition = ReadInboundCircular(icc, localReadPosition, srcAppId, sizeof(*srcAppId));
-    uint32_t reservedWord; // discarded
-    localReadPosition =
-        ReadInboundCircular(icc, localReadPosition, &reservedWord, sizeof(reservedWord));
-    localReadPosition = ReadInboundCircular(icc, localReadPosition, dest, senderPayloadSize);
+    localReadPosition = AdvanceCircular(localReadPosition, reservedWordSize, icc->inboundBufSize);
+    GetCircularSpans(icc->inbound, icc->inboundBufSize, localReadPosition, senderPayloadSize,
+                     payload);
+    localReadPosition = AdvanceCircular(localReadPosition, senderPayloadSize, icc->inboundBufSize);
 
     // Align read position to next possible location for next buffer. This may wrap around.
     localReadPosition = RoundUp(localReadPosition, RINGBUFFER_ALIGNMENT);
@@ -235,11 +327,91 @@ IntercoreResult IntercoreRecv(IntercoreComm *icc, ComponentId *srcAppId, void *d
         localReadPosition -= icc->inboundBufSize;
     }
 
+    // The read position is not updated until the caller has finished with the payload.
+    icc->recvNextPosition = localReadPosition;
+    icc->recvPeeked = true;
+
+    return Intercore_OK;
+}
+
+IntercoreResult IntercorePeek(IntercoreComm *icc, ComponentId *srcAppId, IntercoreSpans *payload)
+{
+    // A message which was peeked and not released is returned again; it is not a grant.
+    if (icc->recvPeeked) {
+        return PeekBlock(icc, srcAppId, payload);
+    }
+
+    for (;;) {
+        IntercoreResult icr = PeekBlock(icc, srcAppId, payload);
+        if (icr != Intercore_OK) {
+            return icr;
+        }
+
+        // Grants are consumed here, so the application only sees its own messages.
+        if (!icc->flowEnabled || !HandleGrant(icc, payload)) {
+            break;
+        }
+        ReleaseBlock(icc);
+    }
+
+    ++icc->stats.messagesReceived;
+    icc->stats.bytesReceived += payload->firstSize + payload->secondSize;
+
+    return Intercore_OK;
+}
+
+// Helper function for IntercoreRelease. Removes the peeked block from the inbound buffer.
+static void ReleaseBlock(IntercoreComm *icc)
+{
+    INTERCORE_ASSERT(icc->recvPeeked);
+    icc->recvPeeked = false;
+
     // The message content must have been retrieved before the high-level core sees the read
     // position has been updated. Corresponding acquire occurs on high-level core.
-    __atomic_store(&icc->outbound->readPosition, &localReadPosition, __ATOMIC_RELEASE);
+    __atomic_store(&icc->outbound->readPosition, &icc->recvNextPosition, __ATOMIC_RELEASE);
 
     MT3620_SignalHLCoreMessageReceived();
+}
+
+void IntercoreRelease(IntercoreComm *icc)
+{
+    ReleaseBlock(icc);
+
+    if (!icc->flowEnabled) {
+        return;
+    }
+
+    // Grant more credit once half of the window has been used, so the HLApp can keep sending
+    // while the grant is on its way.
+    ++icc->recvConsumed;
+    uint32_t threshold = (icc->flowWindow > 1) ? icc->flowWindow / 2 : 1;
+    if (icc->recvConsumed - icc->recvGrantedConsumed >= threshold) {
+        SendGrant(icc);
+    }
+}
+
+IntercoreResult IntercoreRecv(IntercoreComm *icc, ComponentId *srcAppId, void *dest, size_t *size)
+{
+    ComponentId sender;
+    IntercoreSpans payload;
+    IntercoreResult icr = IntercorePeek(icc, &sender, &payload);
+    if (icr != Intercore_OK) {
+        return icr;
+    }
+
+    // The caller-supplied buffer must be large enough to contain the payload in the buffer,
+    // excluding component ID and reserved word. If it is not, the message is left in the buffer.
+    size_t senderPayloadSize = payload.firstSize + payload.secondSize;
+    if (senderPayloadSize > *size) {
+        return Intercore_Recv_BufferTooSmall;
+    }
+
+    // Tell the caller the sender and the actual block size.
+    *srcAppId = sender;
+    *size = senderPayloadSize;
+    CopyFromSpans(dest, &payload, senderPayloadSize);
+
+    IntercoreRelease(icc);
 
     return Intercore_OK;
 }
@@ -271,18 +443,153 @@ static uint32_t WriteOutboundCircular(const IntercoreComm *icc, uint32_t startPo
     return finalPos;
 }
 
-IntercoreResult IntercoreSend(IntercoreComm *icc, const ComponentId *destAppId, const void *data,
-                              size_t size)
+IntercoreResult IntercoreReserve(IntercoreComm *icc, const ComponentId *destAppId, size_t size,
+                                 IntercoreSpans *payload)
+{
+    INTERCORE_ASSERT(!icc->sendReserved);
+
+    if (IntercoreGetSendCredits(icc) == 0) {
+        ++icc->stats.sendNoCredit;
+        // The HLApp cannot grant more credit for messages which it has not seen.
+        IntercoreFlush(icc);
+        return Intercore_Send_NoCredit;
+    }
+
+    return ReserveBlock(icc, destAppId, size, payload);
+}
+
+// Helper function for IntercoreReserve. Reserves space for a block in the outbound buffer,
+// whether it is an application message or a grant.
+static IntercoreResult ReserveBlock(IntercoreComm *icc, const ComponentId *destAppId,
+                                    size_t size, IntercoreSpans *payload)
 {
     if (size > INTERCORE_MAX_PAYLOAD_LEN) {
+        ++icc->stats.sendMessageTooLarge;
         return Intercore_Send_MessageTooLarge;
     }
 
+    uint32_t localWritePosition = LocalWritePosition(icc);
+    uint32_t availSpace = AvailableSpace(icc);
+
+    // Check whether there is enough space to enqueue the next block.
+    uint32_t reqBlockSize = INTERCORE_BLOCK_OVERHEAD + size;
+
+    if (availSpace < reqBlockSize + RINGBUFFER_ALIGNMENT) {
+        ++icc->stats.sendNotEnoughBufferSpace;
+        return Intercore_Send_NotEnoughBufferSpace;
+    }
+
+    // The block size field is written when the message is committed, because the
+    // payload size is not known until then.
+    uint32_t headerPosition =
+        AdvanceCircular(localWritePosition, sizeof(uint32_t), icc->outboundBufSize);
+    headerPosition = WriteOutboundCircular(icc, headerPosition, destAppId, sizeof(*destAppId));
+    uint32_t reservedWord = 0;
+    headerPosition =
+        WriteOutboundCircular(icc, headerPosition, &reservedWord, sizeof(reservedWord));
+    GetCircularSpans(icc->outbound, icc->outboundBufSize, headerPosition, size, payload);
+
+    icc->sendReservedPosition = localWritePosition;
+    icc->sendReservedSize = size;
+    icc->sendReserved = true;
+
+    return Intercore_OK;
+}
+
+void IntercoreCommit(IntercoreComm *icc, size_t size)
+{
+    ++icc->stats.messagesSent;
+    icc->stats.bytesSent += size;
+
+    CommitBlock(icc, size);
+
+    if (!icc->flowEnabled) {
+        return;
+    }
+
+    // A batch can hold at most the messages which the HLApp has granted credit for, so it is
+    // published when the credit runs out, rather than waiting for a threshold it cannot reach.
+    ++icc->sendCount;
+    if (IntercoreGetSendCredits(icc) == 0) {
+        IntercoreFlush(icc);
+    }
+}
+
+// Helper function for IntercoreCommit. Commits the reserved block, and publishes it unless it is
+// batched.
+static void CommitBlock(IntercoreComm *icc, size_t size)
+{
+    INTERCORE_ASSERT(icc->sendReserved);
+    INTERCORE_ASSERT(size <= icc->sendReservedSize);
+    icc->sendReserved = false;
+
+    // The value in the block size field does not include the space taken by the
+    // block size field itself.
+    uint32_t blockSizeExcSizeField = sizeof(ComponentId) + sizeof(uint32_t) + size;
+    uint32_t localWritePosition =
+        WriteOutboundCircular(icc, icc->sendReservedPosition, &blockSizeExcSizeField,
+                              sizeof(blockSizeExcSizeField));
+    localWritePosition =
+        AdvanceCircular(localWritePosition, blockSizeExcSizeField, icc->outboundBufSize);
+
+    // Advance write position to start of next possible block.
+    localWritePosition = RoundUp(localWritePosition, RINGBUFFER_ALIGNMENT);
+    if (localWritePosition >= icc->outboundBufSize) {
+        localWritePosition -= icc->outboundBufSize;
+    }
+
+    icc->pendingWritePosition = localWritePosition;
+    ++icc->pendingCount;
+
+    // Publish the message now unless it is batched. The first message in a batch starts
+    // the latency deadline.
+    if (icc->pendingCount >= icc->batchThreshold) {
+        IntercoreFlush(icc);
+    } else if (icc->pendingCount == 1 && icc->batchLatencyUs != 0) {
+        StartSoftTimer(&icc->batchTimer, icc->batchLatencyUs, 0);
+    }
+}
+
+void IntercoreFlush(IntercoreComm *icc)
+{
+    if (icc->pendingCount == 0) {
+        return;
+    }
+    icc->pendingCount = 0;
+    StopSoftTimer(&icc->batchTimer);
+
+    // Ensure write position update is seen after new content has been written.
+    // Corresponding acquire is on high-level core.
+    __atomic_store(&icc->outbound->writePosition, &icc->pendingWritePosition, __ATOMIC_RELEASE);
+
+    MT3620_SignalHLCoreMessageSent();
+}
+
+void IntercoreSetBatching(IntercoreComm *icc, uint32_t flushThreshold, uint32_t maxLatencyUs)
+{
+    IntercoreFlush(icc);
+
+    icc->batchThreshold = flushThreshold;
+    icc->batchLatencyUs = maxLatencyUs;
+    batchIcc = icc;
+}
+
+// Returns the position after the last message which was committed, whether or not
+// it has been published.
+static uint32_t LocalWritePosition(const IntercoreComm *icc)
+{
+    return (icc->pendingCount != 0) ? icc->pendingWritePosition : icc->outbound->writePosition;
+}
+
+// Returns the number of bytes in the outbound buffer from the position after the last committed
+// message up to the position which the HLApp has read to.
+static uint32_t AvailableSpace(const IntercoreComm *icc)
+{
     // Last position read by HLApp. Corresponding release occurs on high-level core.
     uint32_t remoteReadPosition;
     __atomic_load(&icc->inbound->readPosition, &remoteReadPosition, __ATOMIC_ACQUIRE);
-    // Last position written to by RTApp.
-    uint32_t localWritePosition = icc->outbound->writePosition;
+    // Last position written to by RTApp, including messages which have not been published.
+    uint32_t localWritePosition = LocalWritePosition(icc);
 
     // Sanity check read and write positions.
     INTERCORE_ASSERT(remoteReadPosition < icc->outboundBufSize);
@@ -292,47 +599,177 @@ IntercoreResult IntercoreSend(IntercoreComm *icc, const ComponentId *destAppId,
 
     // If the read pointer is behind the write pointer, then the free space
     // wraps around, and the used space doesn't.
-    uint32_t availSpace;
     if (remoteReadPosition <= localWritePosition) {
-        availSpace = remoteReadPosition - localWritePosition + icc->outboundBufSize;
+        return remoteReadPosition - localWritePosition + icc->outboundBufSize;
+    }
+    return remoteReadPosition - localWritePosition;
+}
+
+// Runs in IRQ context when the batch latency deadline expires, and schedules
+// HandleBatchTimerDeferred to flush the batch.
+static void HandleBatchTimerIrq(void)
+{
+    EnqueueDeferredProc(&batchFlushCbNode);
+}
+
+// Queued by HandleBatchTimerIrq. If the batch was already published because it reached the
+// threshold, then there is nothing to flush.
+static void HandleBatchTimerDeferred(void)
+{
+    if (batchIcc != NULL) {
+        IntercoreFlush(batchIcc);
+    }
+}
+
+IntercoreResult IntercoreSend(IntercoreComm *icc, const ComponentId *destAppId, const void *data,
+                              size_t size)
+{
+    IntercoreSpans payload;
+    IntercoreResult icr = IntercoreReserve(icc, destAppId, size, &payload);
+    if (icr != Intercore_OK) {
+        return icr;
+    }
+
+    CopyToSpans(&payload, data, size);
+    IntercoreCommit(icc, size);
+
+    return Intercore_OK;
+}
+
+const IntercoreStats *IntercoreGetStats(const IntercoreComm *icc)
+{
+    return &icc->stats;
+}
+
+void IntercoreSetFlowControl(IntercoreComm *icc, const ComponentId *peer, uint32_t window,
+                             uint32_t grantPeriodUs)
+{
+    icc->flowPeer = peer;
+    icc->flowWindow = window;
+    icc->flowGrantPending = false;
+    // The session only needs to differ from the one before a restart.
+    icc->recvSession = MT3620_Gpt_ReadMicroseconds();
+    icc->recvConsumed = 0;
+    icc->recvGrantedConsumed = 0;
+    icc->sendSessionKnown = false;
+    icc->sendCount = 0;
+    icc->sendLimit = INTERCORE_FLOW_INITIAL_CREDITS;
+    icc->flowEnabled = true;
+    flowIcc = icc;
+
+    // Tell the HLApp the window now, rather than after the first messages.
+    SendGrant(icc);
+    StartSoftTimer(&icc->flowTimer, grantPeriodUs, grantPeriodUs);
+}
+
+uint32_t IntercoreGetSendCredits(const IntercoreComm *icc)
+{
+    if (!icc->flowEnabled) {
+        return UINT32_MAX;
+    }
+
+    // The counts wrap around, so the difference is interpreted as signed.
+    int32_t credits = (int32_t)(icc->sendLimit - icc->sendCount);
+    return (credits > 0) ? (uint32_t)credits : 0;
+}
+
+uint32_t IntercoreGetSendSpace(const IntercoreComm *icc)
+{
+    // IntercoreReserve leaves one alignment unit free, so that a full buffer can be told from
+    // an empty one.
+    uint32_t availSpace = AvailableSpace(icc);
+    return (availSpace > RINGBUFFER_ALIGNMENT) ? availSpace - RINGBUFFER_ALIGNMENT : 0;
+}
+
+void IntercoreSetSendReadyCallback(IntercoreComm *icc, Callback sendReady)
+{
+    icc->sendReady = sendReady;
+}
+
+// If the payload is a grant, updates the credit for outbound messages, and returns true.
+static bool HandleGrant(IntercoreComm *icc, const IntercoreSpans *payload)
+{
+    IntercoreFlowGrant grant;
+    if (payload->firstSize + payload->secondSize != sizeof(grant)) {
+        return false;
+    }
+
+    CopyFromSpans(&grant, payload, sizeof(grant));
+    if (grant.magic != INTERCORE_FLOW_MAGIC || grant.version != INTERCORE_FLOW_VERSION) {
+        return false;
+    }
+
+    ++icc->stats.creditGrantsReceived;
+
+    // After either side has restarted, the messages which were in flight are treated as
+    // consumed, so the window starts again from this grant. An HLApp which has just started
+    // does not know this application's window either, so it is sent a grant.
+    if (!icc->sendSessionKnown || grant.session != icc->sendSession) {
+        icc->sendSessionKnown = true;
+        icc->sendSession = grant.session;
+        icc->sendCount = grant.consumed;
+        icc->sendLimit = grant.consumed + grant.window;
+        SendGrant(icc);
     } else {
-        availSpace = remoteReadPosition - localWritePosition;
+        // Grants are sent in order, but a repeated grant must not move the limit back.
+        uint32_t limit = grant.consumed + grant.window;
+        if ((int32_t)(limit - icc->sendLimit) > 0) {
+            icc->sendLimit = limit;
+        }
     }
 
-    // Check whether there is enough space to enqueue the next block.
-    uint32_t reqBlockSize = 0;
-    reqBlockSize += sizeof(uint32_t);    // block size field
-    reqBlockSize += sizeof(ComponentId); // destination HLApp ID
-    reqBlockSize += sizeof(uint32_t);    // reserved word
-    reqBlockSize += size;                // payload
+    if (icc->sendReady != NULL) {
+        icc->sendReady();
+    }
+    return true;
+}
 
-    if (availSpace < reqBlockSize + RINGBUFFER_ALIGNMENT) {
-        return Intercore_Send_NotEnoughBufferSpace;
+// Grants the HLApp credit for flowWindow messages beyond those which have been released. If the
+// grant cannot be sent now, the grant timer sends it later.
+static void SendGrant(IntercoreComm *icc)
+{
+    // The grant cannot be written while the application has a message reserved.
+    icc->flowGrantPending = true;
+    if (icc->sendReserved) {
+        return;
     }
 
-    // The value in the block size field does not include the space taken by the
-    // block size field itself.
-    uint32_t blockSizeExcSizeField = reqBlockSize - sizeof(uint32_t);
-    localWritePosition = WriteOutboundCircular(icc, localWritePosition, &blockSizeExcSizeField,
-                                               sizeof(blockSizeExcSizeField));
-    localWritePosition =
-        WriteOutboundCircular(icc, localWritePosition, destAppId, sizeof(*destAppId));
-    uint32_t reservedWord = 0;
-    localWritePosition =
-        WriteOutboundCircular(icc, localWritePosition, &reservedWord, sizeof(reservedWord));
-    localWritePosition = WriteOutboundCircular(icc, localWritePosition, data, size);
+    IntercoreFlowGrant grant = {.magic = INTERCORE_FLOW_MAGIC,
+                                .version = INTERCORE_FLOW_VERSION,
+                                .reserved = 0,
+                                .session = icc->recvSession,
+                                .consumed = icc->recvConsumed,
+                                .window = icc->flowWindow};
 
-    // Advance write position to start of next possible block.
-    localWritePosition = RoundUp(localWritePosition, RINGBUFFER_ALIGNMENT);
-    if (localWritePosition >= icc->outboundBufSize) {
-        localWritePosition -= icc->outboundBufSize;
+    // Grants are not limited by credit, or held in a batch.
+    IntercoreSpans payload;
+    if (ReserveBlock(icc, icc->flowPeer, sizeof(grant), &payload) != Intercore_OK) {
+        return;
     }
+    CopyToSpans(&payload, &grant, sizeof(grant));
+    CommitBlock(icc, sizeof(grant));
+    IntercoreFlush(icc);
 
-    // Ensure write position update is seen after new content has been written.
-    // Corresponding acquire is on high-level core.
-    __atomic_store(&icc->outbound->writePosition, &localWritePosition, __ATOMIC_RELEASE);
+    icc->recvGrantedConsumed = icc->recvConsumed;
+    icc->flowGrantPending = false;
+    ++icc->stats.creditGrantsSent;
+}
 
-    MT3620_SignalHLCoreMessageSent();
+// Runs in IRQ context when the grant timer expires, and schedules HandleFlowTimerDeferred.
+static void HandleFlowTimerIrq(void)
+{
+    EnqueueDeferredProc(&flowGrantCbNode);
+}
 
-    return Intercore_OK;
+// Queued by HandleFlowTimerIrq. Sends a grant which could not be sent before, or which covers
+// messages that have been released since the last one.
+static void HandleFlowTimerDeferred(void)
+{
+    if (flowIcc == NULL) {
+        return;
+    }
+
+    if (flowIcc->flowGrantPending || flowIcc->recvConsumed != flowIcc->recvGrantedConsumed) {
+        SendGrant(flowIcc);
+    }
 }
@@ -3,10 +3,12 @@
 
 #pragma once
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <stddef.h>
 
 #include "mt3620-baremetal.h" // for Callback
+#include "logical-timer.h"    // for SoftTimer
 
 /// <summary>
 ///     When sending a message, this is the recipient HLApp's component ID.
@@ -23,16 +25,121 @@ typedef struct {
     uint8_t data4[8];
 } ComponentId;
 
-/// <summary>Blocks inside the shared buffer have this alignment.</summary>
+/// <summary>
+///     Blocks inside the shared buffer have this alignment. The high-level side of the buffer is
+///     implemented by the OS, which requires this value, so it cannot be reduced for small
+///     messages.
+/// </summary>
 #define RINGBUFFER_ALIGNMENT 16
+
+/// <summary>
+///     Size of the cache line on the high-level core. Each buffer header fills one line.
+/// </summary>
+#define INTERCORE_CACHE_LINE_SIZE 64
+
+/// <summary>
+///     Bytes which each block uses in the shared buffer before its payload: the block size,
+///     the HLApp component ID, and a reserved word.
+/// </summary>
+#define INTERCORE_BLOCK_OVERHEAD (sizeof(uint32_t) + sizeof(ComponentId) + sizeof(uint32_t))
+
+/// <summary>
+///     Bytes which a message with a payload of <paramref name="payloadLen" /> bytes uses in the
+///     shared buffer. A 4-byte payload uses 32 bytes, so applications which send many small
+///     messages can fit more into the buffer by packing several into one payload, or by using
+///     <see cref="IntercoreSetBatching" />.
+/// </summary>
+#define INTERCORE_BLOCK_SIZE(payloadLen) \
+    (((INTERCORE_BLOCK_OVERHEAD + (payloadLen)) + RINGBUFFER_ALIGNMENT - 1) & \
+     ~(size_t)(RINGBUFFER_ALIGNMENT - 1))
+
+#ifndef INTERCORE_MAX_PAYLOAD_LEN
 /// <summary>
 ///     Maximum payload size in bytes. This does not include a header which
-///     is prepended by <see cref="IntercoreSend" />.
+///     is prepended by <see cref="IntercoreSend" />. An application which only sends small
+///     messages can define a lower value when it is built, which shrinks the buffers which are
+///     sized by it, such as the RPC response buffer.
 /// </summary>
 #define INTERCORE_MAX_PAYLOAD_LEN 1040
+#endif
+
+_Static_assert(INTERCORE_MAX_PAYLOAD_LEN <= 1040,
+               "INTERCORE_MAX_PAYLOAD_LEN cannot exceed the OS limit of 1040 bytes");
 
 typedef struct BufferHeaderImpl BufferHeader;
 
+/// <summary>
+///     Value of the magic field of a credit grant, which distinguishes it from other messages.
+///     The grant is defined here and, for the high-level application, in intercore_stream.h.
+/// </summary>
+#define INTERCORE_FLOW_MAGIC 0x4346 // "FC"
+
+/// <summary>Version of the credit grant layout.</summary>
+#define INTERCORE_FLOW_VERSION 1
+
+/// <summary>
+///     Number of messages which each side may send before it has received a credit grant.
+/// </summary>
+#define INTERCORE_FLOW_INITIAL_CREDITS 4
+
+/// <summary>
+///     <para>A credit grant, which the receiver of a stream of messages sends to the sender to
+///     say how many more messages it can absorb. Grants are not themselves counted or limited
+///     by credits. All fields are little-endian.</para>
+///     <para>The counts are cumulative, so a later grant replaces an earlier one, and a grant
+///     which could not be sent does not need to be repeated exactly. The sender may send while
+///     it has sent fewer than consumed + window messages since the session started.</para>
+/// </summary>
+typedef struct {
+    /// <summary>INTERCORE_FLOW_MAGIC.</summary>
+    uint16_t magic;
+    /// <summary>INTERCORE_FLOW_VERSION.</summary>
+    uint8_t version;
+    /// <summary>Reserved - must be 0.</summary>
+    uint8_t reserved;
+    /// <summary>Chosen by the receiver when it starts. A grant with a new session tells the
+    /// sender that the receiver has restarted, so its count of sent messages starts again from
+    /// consumed.</summary>
+    uint32_t session;
+    /// <summary>Number of messages, other than grants, which the receiver has consumed in the
+    /// session.</summary>
+    uint32_t consumed;
+    /// <summary>Number of messages beyond those which the receiver can absorb.</summary>
+    uint32_t window;
+} IntercoreFlowGrant;
+
+/// <summary>
+///     Counters which describe the traffic through an <see cref="IntercoreComm" /> since it was
+///     set up. They distinguish finding the inbound buffer empty from failing to send because
+///     the outbound buffer was full.
+/// </summary>
+typedef struct {
+    /// <summary>Number of messages returned by IntercorePeek or IntercoreRecv.</summary>
+    uint32_t messagesReceived;
+    /// <summary>Number of payload bytes in the received messages.</summary>
+    uint32_t bytesReceived;
+    /// <summary>Number of times there was no message to receive
+    /// (Intercore_Recv_NoBlockSize).</summary>
+    uint32_t recvNoBlockSize;
+    /// <summary>Number of messages committed to the outbound buffer.</summary>
+    uint32_t messagesSent;
+    /// <summary>Number of payload bytes in the sent messages.</summary>
+    uint32_t bytesSent;
+    /// <summary>Number of messages which could not be sent because the outbound buffer was full
+    /// (Intercore_Send_NotEnoughBufferSpace).</summary>
+    uint32_t sendNotEnoughBufferSpace;
+    /// <summary>Number of messages which could not be sent because they were too large
+    /// (Intercore_Send_MessageTooLarge).</summary>
+    uint32_t sendMessageTooLarge;
+    /// <summary>Number of times a message could not be sent because the HLApp had not granted
+    /// credit for it (Intercore_Send_NoCredit). Each is a stall of the outbound stream.</summary>
+    uint32_t sendNoCredit;
+    /// <summary>Number of credit grants which were received from the HLApp.</summary>
+    uint32_t creditGrantsReceived;
+    /// <summary>Number of credit grants which were sent to the HLApp.</summary>
+    uint32_t creditGrantsSent;
+} IntercoreStats;
+
 /// <summary>
 ///     Encapsulates information which is used to send data to, and receive data from HLApps.
 ///     This object is a handle, so the caller should not read or write the contained data.
@@ -47,8 +154,81 @@ typedef struct {
     uint32_t inboundBufSize;
     /// <summary>Outbound buffer size in bytes.</summary>
     uint32_t outboundBufSize;
+    /// <summary>Whether IntercoreReserve has reserved a message which has not been committed.
+    /// </summary>
+    bool sendReserved;
+    /// <summary>Position of the reserved message in the outbound buffer.</summary>
+    uint32_t sendReservedPosition;
+    /// <summary>Payload size of the reserved message in bytes.</summary>
+    uint32_t sendReservedSize;
+    /// <summary>Whether IntercorePeek has returned a message which has not been released.</summary>
+    bool recvPeeked;
+    /// <summary>Read position after the message which IntercorePeek returned.</summary>
+    uint32_t recvNextPosition;
+    /// <summary>Number of committed messages which are published together; 0 or 1 if
+    /// each message is published when it is committed.</summary>
+    uint32_t batchThreshold;
+    /// <summary>Maximum time in microseconds for which a committed message is held back;
+    /// 0 if messages are held until the threshold is reached or the batch is flushed.</summary>
+    uint32_t batchLatencyUs;
+    /// <summary>Timer which flushes the batch when the latency deadline expires.</summary>
+    SoftTimer batchTimer;
+    /// <summary>Number of committed messages which have not been published.</summary>
+    uint32_t pendingCount;
+    /// <summary>Write position after the last committed message, if pendingCount is not
+    /// zero.</summary>
+    uint32_t pendingWritePosition;
+    /// <summary>Whether flow control has been enabled with IntercoreSetFlowControl.</summary>
+    bool flowEnabled;
+    /// <summary>HLApp which sends and receives the flow-controlled messages.</summary>
+    const ComponentId *flowPeer;
+    /// <summary>Number of inbound messages which this application grants beyond those which it
+    /// has consumed.</summary>
+    uint32_t flowWindow;
+    /// <summary>Timer which sends grants which could not be sent when they were due, and
+    /// grants for messages which have been released since the last one.</summary>
+    SoftTimer flowTimer;
+    /// <summary>Whether a grant could not be sent when it was due.</summary>
+    bool flowGrantPending;
+    /// <summary>Session which is sent in this application's grants.</summary>
+    uint32_t recvSession;
+    /// <summary>Number of inbound messages, other than grants, which have been released.
+    /// </summary>
+    uint32_t recvConsumed;
+    /// <summary>Value of recvConsumed in the last grant which was sent.</summary>
+    uint32_t recvGrantedConsumed;
+    /// <summary>Whether a grant has been received from the HLApp.</summary>
+    bool sendSessionKnown;
+    /// <summary>Session of the last grant which was received from the HLApp.</summary>
+    uint32_t sendSession;
+    /// <summary>Number of outbound messages which have been sent, counted as the HLApp counts
+    /// consumed messages.</summary>
+    uint32_t sendCount;
+    /// <summary>Value of sendCount up to which the HLApp has granted credit.</summary>
+    uint32_t sendLimit;
+    /// <summary>Invoked when a grant has been received; NULL if none.</summary>
+    Callback sendReady;
+    /// <summary>Traffic counters.</summary>
+    IntercoreStats stats;
 } IntercoreComm;
 
+/// <summary>
+///     Describes a message payload in place in a shared buffer. The buffers are circular, so a
+///     payload which wraps around the end of a buffer occupies two spans: the first ends at the
+///     end of the buffer, and the second starts at the start of the buffer. Otherwise, the
+///     second span is empty.
+/// </summary>
+typedef struct {
+    /// <summary>Start of the first span.</summary>
+    uint8_t *first;
+    /// <summary>Size of the first span in bytes.</summary>
+    size_t firstSize;
+    /// <summary>Start of the second span.</summary>
+    uint8_t *second;
+    /// <summary>Size of the second span in bytes, which may be zero.</summary>
+    size_t secondSize;
+} IntercoreSpans;
+
 /// <summary>
 ///     Error codes which can occur when using the intercore buffers.
 ///     These are errors which can occur during normal use, for example
@@ -76,7 +256,13 @@ typedef enum {
     Intercore_Send_MessageTooLarge = 0x20,
 
     /// <summary>There was not enough space in the buffer to send the supplied message.</summary>
-    Intercore_Send_NotEnoughBufferSpace = 0x21
+    Intercore_Send_NotEnoughBufferSpace = 0x21,
+
+    /// <summary>
+    ///     Flow control is enabled, and the HLApp has not granted credit for another message.
+    ///     The message can be sent once a grant has arrived.
+    /// </summary>
+    Intercore_Send_NoCredit = 0x22
 } IntercoreResult;
 
 /// <summary>
@@ -120,7 +306,158 @@ IntercoreResult IntercoreRecv(IntercoreComm *icc, ComponentId *sender, void *des
 ///     into the outbound buffer; <see cref="Intercore_Send_MessageTooLarge"> if the message
 ///     was greater than 1040 bytes, in which case nothing is sent; or
 ///     <see cref="Intercore_Send_NotEnoughBufferSpace" /> if there was not enough space
-///     in the buffer to send the message.
+///     in the buffer to send the message; or <see cref="Intercore_Send_NoCredit" /> if flow
+///     control is enabled and the HLApp has not granted credit for the message.
 /// </returns>
 IntercoreResult IntercoreSend(IntercoreComm *icc, const ComponentId *recipient, const void *data,
                               size_t size);
+
+/// <summary>
+///     <para>Gets the next incoming message from the HLApp without copying its payload. The
+///     payload remains in the inbound buffer, where the caller can parse it in place, until
+///     the caller calls <see cref="IntercoreRelease" />.</para>
+///     <para>Calling this function again before the message is released returns the same
+///     message.</para>
+/// </summary>
+/// <param name="icc">Handle which was initialized by <see cref="SetupIntercoreComm" /></param>
+/// <param name="sender">Component ID which will be populated with the sending HLApp's ID.</param>
+/// <param name="payload">On success, set to the spans which hold the message payload.</param>
+/// <returns>
+///     <see cref="Intercore_OK" /> if the message was retrieved successfully; or
+///     <see cref="Intercore_Recv_NoBlockSize" /> if there was no message to retrieve.
+/// </returns>
+IntercoreResult IntercorePeek(IntercoreComm *icc, ComponentId *sender, IntercoreSpans *payload);
+
+/// <summary>
+///     Removes the message which was returned by <see cref="IntercorePeek" /> from the inbound
+///     buffer, and tells the HLApp that it has been read. The payload spans must not be used
+///     after this function has been called.
+/// </summary>
+/// <param name="icc">Handle which was initialized by <see cref="SetupIntercoreComm" /></param>
+void IntercoreRelease(IntercoreComm *icc);
+
+/// <summary>
+///     <para>Reserves space for a message to the HLApp in the outbound buffer, so that the
+///     caller can write the payload in place, for example by DMA, rather than copy it. The
+///     message is sent when the caller calls <see cref="IntercoreCommit" />.</para>
+///     <para>Only one message can be reserved at a time, and no other message can be sent
+///     until it has been committed.</para>
+/// </summary>
+/// <param name="icc">Handle which was initialized by <see cref="SetupIntercoreComm" /></param>
+/// <param name="recipient">HLApp which should receive the message.</param>
+/// <param name="size">Maximum size of the payload in bytes.</param>
+/// <param name="payload">On success, set to the spans which the payload should be written to.
+/// </param>
+/// <returns>
+///     <see cref="Intercore_OK" /> if the space was reserved;
+///     <see cref="Intercore_Send_MessageTooLarge"> if the size was greater than 1040 bytes; or
+///     <see cref="Intercore_Send_NotEnoughBufferSpace" /> if there was not enough space
+///     in the buffer for the message; or <see cref="Intercore_Send_NoCredit" /> if flow control
+///     is enabled and the HLApp has not granted credit for the message.
+/// </returns>
+IntercoreResult IntercoreReserve(IntercoreComm *icc, const ComponentId *recipient, size_t size,
+                                 IntercoreSpans *payload);
+
+/// <summary>
+///     Sends the message which was reserved by <see cref="IntercoreReserve" />. The payload
+///     must have been written before this function is called.
+/// </summary>
+/// <param name="icc">Handle which was initialized by <see cref="SetupIntercoreComm" /></param>
+/// <param name="size">
+///     Amount of payload data in bytes, which must not exceed the reserved size. The payload
+///     occupies the start of the reserved spans.
+/// </param>
+void IntercoreCommit(IntercoreComm *icc, size_t size);
+
+/// <summary>
+///     <para>Configures how outbound messages are batched. Each message which is sent is placed
+///     in the outbound buffer, but the high-level core does not see it, and is not interrupted,
+///     until the batch is published. The batch is published when it holds
+///     <paramref name="flushThreshold" /> messages, when <paramref name="maxLatencyUs" />
+///     microseconds have passed since its first message was sent, or when the application calls
+///     <see cref="IntercoreFlush" />. A single interrupt is raised for the whole batch.</para>
+///     <para>The latency deadline uses a software timer, so the application should call
+///     <see cref="InitSoftTimers" /> first. The batch is published by a DPC, so the application
+///     must call <see cref="InvokeDeferredProcs" />. Messages must also be sent from DPCs or from
+///     the main application thread, rather than from interrupt context.</para>
+///     <para>Any messages which are held when this function is called are published.</para>
+/// </summary>
+/// <param name="icc">Handle which was initialized by <see cref="SetupIntercoreComm" /></param>
+/// <param name="flushThreshold">
+///     Number of messages in a batch. 0 or 1 publishes each message when it is sent, which is
+///     the default.
+/// </param>
+/// <param name="maxLatencyUs">
+///     Maximum time in microseconds for which a message is held, or 0 if there is no deadline.
+/// </param>
+void IntercoreSetBatching(IntercoreComm *icc, uint32_t flushThreshold, uint32_t maxLatencyUs);
+
+/// <summary>
+///     Publishes any messages which have been sent but are held in the current batch, and raises
+///     a single interrupt to tell the high-level core about them.
+/// </summary>
+/// <param name="icc">Handle which was initialized by <see cref="SetupIntercoreComm" /></param>
+void IntercoreFlush(IntercoreComm *icc);
+
+/// <summary>
+///     <para>Enables credit-based flow control with an HLApp which implements it, as
+///     IntercoreComms_HighLevelApp does. Each side may only send as many messages as the other
+///     has granted credit for, so a stream which is faster than its receiver is held back by
+///     its sender, rather than being dropped when the buffer is full.</para>
+///     <para>A grant is sent when flow control is enabled, and whenever a grant arrives from an
+///     HLApp which has started since the last one, so that each side learns the other's window
+///     after either restarts. After <paramref name="window" /> / 2 inbound messages have been
+///     released, this application grants the HLApp credit for <paramref name="window" /> more.
+///     A grant which cannot be sent, because the outbound buffer is full, is sent by a timer
+///     with a period of <paramref name="grantPeriodUs" /> microseconds, which also grants
+///     credit for any messages which have been released since the last grant. Grants from the
+///     HLApp are consumed by <see cref="IntercorePeek" /> and <see cref="IntercoreRecv" />, and
+///     are not returned to the application.</para>
+///     <para>When the credit runs out, any batched messages are published, and further sends
+///     fail with <see cref="Intercore_Send_NoCredit" /> until a grant arrives. The window
+///     should be chosen so that the inbound buffer can hold that many of the HLApp's messages;
+///     the space in the buffer is still checked.</para>
+///     <para>The timer uses a software timer, so the application should call
+///     <see cref="InitSoftTimers" /> first, and must call <see cref="InvokeDeferredProcs" />.
+///     Flow control can only be enabled on one handle.</para>
+/// </summary>
+/// <param name="icc">Handle which was initialized by <see cref="SetupIntercoreComm" /></param>
+/// <param name="peer">HLApp which grants are sent to. This must remain valid.</param>
+/// <param name="window">Number of inbound messages which the HLApp is allowed to send beyond
+/// those which this application has released.</param>
+/// <param name="grantPeriodUs">Period in microseconds of the grant timer.</param>
+void IntercoreSetFlowControl(IntercoreComm *icc, const ComponentId *peer, uint32_t window,
+                             uint32_t grantPeriodUs);
+
+/// <summary>
+///     Gets the number of messages which can be sent before the HLApp grants more credit.
+/// </summary>
+/// <param name="icc">Handle which was initialized by <see cref="SetupIntercoreComm" /></param>
+/// <returns>The number of messages, or UINT32_MAX if flow control is not enabled.</returns>
+uint32_t IntercoreGetSendCredits(const IntercoreComm *icc);
+
+/// <summary>
+///     Gets the space in the outbound buffer which is free for messages. A message with a
+///     payload of n bytes fits if INTERCORE_BLOCK_OVERHEAD + n bytes are free.
+/// </summary>
+/// <param name="icc">Handle which was initialized by <see cref="SetupIntercoreComm" /></param>
+/// <returns>The free space in bytes.</returns>
+uint32_t IntercoreGetSendSpace(const IntercoreComm *icc);
+
+/// <summary>
+///     Sets a function which is invoked each time a credit grant is received from the HLApp.
+///     Grants follow the HLApp reading messages, so a sender which is waiting for credit or for
+///     space can try again. The function is called from <see cref="IntercorePeek" />, while the
+///     application may be handling a message or have one reserved, so it should schedule the
+///     sending, for example with <see cref="EnqueueDeferredProc" />, rather than send.
+/// </summary>
+/// <param name="icc">Handle which was initialized by <see cref="SetupIntercoreComm" /></param>
+/// <param name="sendReady">Function to invoke, or NULL.</param>
+void IntercoreSetSendReadyCallback(IntercoreComm *icc, Callback sendReady);
+
+/// <summary>
+///     Gets the traffic counters for a handle.
+/// </summary>
+/// <param name="icc">Handle which was initialized by <see cref="SetupIntercoreComm" /></param>
+/// <returns>Counters which remain owned by the handle.</returns>
+const IntercoreStats *IntercoreGetStats(const IntercoreComm *icc);
@@ -0,0 +1,200 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include "logical-profile.h"
+#include "logical-dpc.h"
+#include "logical-timer.h"
+
+#include "mt3620-uart.h"
+
+// Debug Exception and Monitor Control Register, ARM DDI 0403E.d SC1.6.5. TRCENA enables the
+// DWT unit.
+static const uintptr_t DCB_DEMCR = 0xE000EDFC;
+static const uint32_t DCB_DEMCR_TRCENA = UINT32_C(1) << 24;
+
+// DWT Control Register, ARM DDI 0403E.d SC1.8.7. NOCYCCNT is set if there is no cycle counter.
+static const uintptr_t DWT_BASE = 0xE0001000;
+static const size_t DWT_CTRL = 0x00;
+static const size_t DWT_CYCCNT = 0x04;
+static const uint32_t DWT_CTRL_CYCCNTENA = UINT32_C(1) << 0;
+static const uint32_t DWT_CTRL_NOCYCCNT = UINT32_C(1) << 25;
+
+// Durations of less than 2^HISTOGRAM_FIRST_BITS cycles are counted in bin 0.
+#define HISTOGRAM_FIRST_BITS 6
+
+static void HandleReportTimerIrq(void);
+static void HandleReportTimerDeferred(void);
+static void RegisterRegion(ProfileRegion *region);
+static void ResetRegion(ProfileRegion *region);
+static void WriteReport(const ProfileRecord *records, size_t count);
+static void WriteUnsigned(uint64_t value);
+
+// Regions are only added with IRQs blocked, and are never removed.
+static ProfileRegion *regions[PROFILE_MAX_REGIONS];
+static volatile size_t regionCount = 0;
+
+static ProfileReportHandler reportHandler = NULL;
+static SoftTimer reportTimer = {.next = NULL, .active = false, .cb = HandleReportTimerIrq};
+static CallbackNode reportCbNode = {
+    .enqueued = false, .cb = HandleReportTimerDeferred, .priority = DpcPriority_Low};
+
+bool Profile_Init(void)
+{
+    SetReg32(DCB_DEMCR, 0, DCB_DEMCR_TRCENA);
+    if ((ReadReg32(DWT_BASE, DWT_CTRL) & DWT_CTRL_NOCYCCNT) != 0) {
+        return false;
+    }
+
+    WriteReg32(DWT_BASE, DWT_CYCCNT, 0);
+    SetReg32(DWT_BASE, DWT_CTRL, DWT_CTRL_CYCCNTENA);
+    return true;
+}
+
+void Profile_End(ProfileRegion *region, uint32_t startCycles)
+{
+    if (region == NULL) {
+        return;
+    }
+
+    uint32_t cycles = Profile_Begin() - startCycles;
+
+    if (!region->registered) {
+        RegisterRegion(region);
+    }
+
+    ++region->count;
+    region->totalCycles += cycles;
+    if (cycles < region->minCycles) {
+        region->minCycles = cycles;
+    }
+    if (cycles > region->maxCycles) {
+        region->maxCycles = cycles;
+    }
+
+    uint32_t bits = 32 - (uint32_t)__builtin_clz(cycles | 1);
+    uint32_t bin = (bits <= HISTOGRAM_FIRST_BITS) ? 0 : bits - HISTOGRAM_FIRST_BITS;
+    if (bin >= PROFILE_HISTOGRAM_BINS) {
+        bin = PROFILE_HISTOGRAM_BINS - 1;
+    }
+    ++region->histogram[bin];
+}
+
+// Adds a region to the list which is reported. If the list is full, the region is marked as
+// registered anyway, so that it is not retried on every call; it is timed but not reported.
+static void RegisterRegion(ProfileRegion *region)
+{
+    uint32_t prevBasePri = BlockIrqs();
+    if (!region->registered) {
+        region->registered = true;
+        if (regionCount < PROFILE_MAX_REGIONS) {
+            regions[regionCount++] = region;
+        }
+    }
+    RestoreIrqs(prevBasePri);
+}
+
+static void ResetRegion(ProfileRegion *region)
+{
+    region->count = 0;
+    region->minCycles = UINT32_MAX;
+    region->maxCycles = 0;
+    region->totalCycles = 0;
+    __builtin_memset(region->histogram, 0, sizeof(region->histogram));
+}
+
+size_t Profile_GetRecords(ProfileRecord *records, size_t maxCount, bool reset)
+{
+    size_t count = regionCount;
+    if (count > maxCount) {
+        count = maxCount;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        ProfileRegion *region = regions[i];
+        ProfileRecord *record = &records[i];
+
+        // A region can be timed in interrupt context, so it is copied with IRQs blocked, to
+        // keep its fields consistent with each other.
+        uint32_t prevBasePri = BlockIrqs();
+        record->totalCycles = region->totalCycles;
+        record->count = region->count;
+        record->minCycles = (region->count != 0) ? region->minCycles : 0;
+        record->maxCycles = region->maxCycles;
+        record->reserved = 0;
+        __builtin_memcpy(record->histogram, region->histogram, sizeof(record->histogram));
+        if (reset) {
+            ResetRegion(region);
+        }
+        RestoreIrqs(prevBasePri);
+
+        __builtin_strncpy(record->name, region->name, sizeof(record->name));
+    }
+
+    return count;
+}
+
+void Profile_StartReports(uint32_t periodUs, ProfileReportHandler handler)
+{
+    reportHandler = (handler != NULL) ? handler : WriteReport;
+    StartSoftTimer(&reportTimer, periodUs, periodUs);
+}
+
+// Runs in IRQ context.
+static void HandleReportTimerIrq(void)
+{
+    EnqueueDeferredProc(&reportCbNode);
+}
+
+// Queued by HandleReportTimerIrq. Reporting is slow, so this runs at low priority, after the
+// DPCs which are being timed.
+static void HandleReportTimerDeferred(void)
+{
+    ProfileRecord records[PROFILE_MAX_REGIONS];
+    size_t count = Profile_GetRecords(records, PROFILE_MAX_REGIONS, true);
+    reportHandler(records, count);
+}
+
+// Writes one line for each region which ran in the period to the debug UART.
+static void WriteReport(const ProfileRecord *records, size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        const ProfileRecord *record = &records[i];
+        if (record->count == 0) {
+            continue;
+        }
+
+        char name[PROFILE_NAME_LEN + 1];
+        __builtin_memcpy(name, record->name, PROFILE_NAME_LEN);
+        name[PROFILE_NAME_LEN] = '\0';
+
+        Uart_WriteString("Profile ");
+        Uart_WriteString(name);
+        Uart_WriteString(": n=");
+        WriteUnsigned(record->count);
+        Uart_WriteString(" min=");
+        WriteUnsigned(record->minCycles);
+        Uart_WriteString(" mean=");
+        WriteUnsigned(record->totalCycles / record->count);
+        Uart_WriteString(" max=");
+        WriteUnsigned(record->maxCycles);
+        Uart_WriteString(" cycles; log2 bins");
+        for (size_t bin = 0; bin < PROFILE_HISTOGRAM_BINS; ++bin) {
+            Uart_WriteString(bin == 0 ? " " : ",");
+            WriteUnsigned(record->histogram[bin]);
+        }
+        Uart_WriteString("\r\n");
+    }
+}
+
+// Uart_WriteInteger takes an int, so large counts are written here.
+static void WriteUnsigned(uint64_t value)
+{
+    char digits[21];
+    size_t position = sizeof(digits) - 1;
+    digits[position] = '\0';
+    do {
+        digits[--position] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+    Uart_WriteString(&digits[position]);
+}
@@ -0,0 +1,184 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mt3620-baremetal.h"
+
+// Cycle-accurate profiling. The Cortex-M4's DWT cycle counter times regions of code, such as an
+// interrupt handler, a DPC, or a block between PROFILE_BEGIN and PROFILE_END, and each region
+// records how often it ran, its shortest, longest and total duration, and a histogram of its
+// durations, so that the worst case can be checked against a latency budget. A region's time
+// includes the time taken by any interrupt which preempted it.
+//
+// Profiling is opt-in: when the application is built with RTAPP_PROFILE defined, the macros below
+// time their regions, and the DPCs whose nodes name a region are timed. Without RTAPP_PROFILE,
+// the macros expand to nothing, so the instrumentation can be left in place.
+
+/// <summary>Maximum number of regions which are recorded. Further regions are not timed.</summary>
+#define PROFILE_MAX_REGIONS 8
+
+/// <summary>
+///     Number of bins in each region's histogram. Bin 0 counts durations of less than 64
+///     cycles, bin n counts durations from 2^(n+5) to 2^(n+6)-1 cycles, and the last bin also
+///     counts every longer duration.
+/// </summary>
+#define PROFILE_HISTOGRAM_BINS 16
+
+/// <summary>Longest region name which is reported, in characters.</summary>
+#define PROFILE_NAME_LEN 24
+
+/// <summary>Default period at which the statistics are reported, in microseconds.</summary>
+#define PROFILE_REPORT_PERIOD_US (10 * 1000 * 1000)
+
+/// <summary>
+///     <para>A region of code which is timed.</para>
+///     <para>The application should not modify this object after it has been initialized with
+///     PROFILE_REGION_INIT.</para>
+/// </summary>
+typedef struct ProfileRegion {
+    /// <summary>Name which is reported.</summary>
+    const char *name;
+    /// <summary>Internal use. Initialize to false.</summary>
+    bool registered;
+    /// <summary>Number of times the region ran.</summary>
+    uint32_t count;
+    /// <summary>Shortest duration, in cycles.</summary>
+    uint32_t minCycles;
+    /// <summary>Longest duration, in cycles.</summary>
+    uint32_t maxCycles;
+    /// <summary>Total duration, in cycles.</summary>
+    uint64_t totalCycles;
+    /// <summary>Number of durations in each bin; see PROFILE_HISTOGRAM_BINS.</summary>
+    uint32_t histogram[PROFILE_HISTOGRAM_BINS];
+} ProfileRegion;
+
+/// <summary>
+///     Statistics of one region, as they are reported. All fields are little-endian, and the
+///     layout is shared with the high-level application.
+/// </summary>
+typedef struct {
+    /// <summary>Total duration, in cycles.</summary>
+    uint64_t totalCycles;
+    /// <summary>Number of times the region ran.</summary>
+    uint32_t count;
+    /// <summary>Shortest duration, in cycles, or 0 if the region did not run.</summary>
+    uint32_t minCycles;
+    /// <summary>Longest duration, in cycles.</summary>
+    uint32_t maxCycles;
+    /// <summary>Reserved; zero.</summary>
+    uint32_t reserved;
+    /// <summary>Number of durations in each bin; see PROFILE_HISTOGRAM_BINS.</summary>
+    uint32_t histogram[PROFILE_HISTOGRAM_BINS];
+    /// <summary>Name of the region, which is not terminated if it fills the array.</summary>
+    char name[PROFILE_NAME_LEN];
+} ProfileRecord;
+
+_Static_assert(sizeof(ProfileRecord) == 112, "ProfileRecord must be 112 bytes");
+
+/// <summary>
+///     Invoked in a DPC with the statistics at the end of each report period, after which they
+///     are reset.
+/// </summary>
+/// <param name="records">Statistics of each region, which are valid until the handler
+/// returns.</param>
+/// <param name="count">Number of elements in records.</param>
+typedef void (*ProfileReportHandler)(const ProfileRecord *records, size_t count);
+
+/// <summary>Initializes a region with the supplied name, which must remain valid.</summary>
+#define PROFILE_REGION_INIT(name_) \
+    {.name = (name_), .registered = false, .count = 0, .minCycles = UINT32_MAX}
+
+/// <summary>
+///     Enables the DWT cycle counter. Call this once at startup, before any region is timed.
+/// </summary>
+/// <returns>true if the core has a cycle counter; false otherwise, in which case every
+/// duration is recorded as zero.</returns>
+bool Profile_Init(void);
+
+/// <summary>
+///     Gets the time at which a region starts, to pass to <see cref="Profile_End" />.
+/// </summary>
+/// <returns>The value of the cycle counter, which wraps around.</returns>
+static inline uint32_t Profile_Begin(void)
+{
+    return ReadReg32(0xE0001000, 0x04); // DWT_CYCCNT, ARM DDI 0403E.d SC1.8.8
+}
+
+/// <summary>
+///     Records that a region has finished. This can be called from interrupt context, but each
+///     region must only be timed from one context, so that its updates do not interleave.
+/// </summary>
+/// <param name="region">Region, or NULL, in which case nothing is recorded. It is registered
+/// the first time it is recorded, and must exist for as long as the application runs.</param>
+/// <param name="startCycles">Value returned by <see cref="Profile_Begin" /> when the region
+/// started.</param>
+void Profile_End(ProfileRegion *region, uint32_t startCycles);
+
+/// <summary>
+///     Copies the statistics of each region which has been registered.
+/// </summary>
+/// <param name="records">Receives the statistics.</param>
+/// <param name="maxCount">Number of elements in records.</param>
+/// <param name="reset">Whether to reset the statistics after they have been copied.</param>
+/// <returns>Number of records which were written.</returns>
+size_t Profile_GetRecords(ProfileRecord *records, size_t maxCount, bool reset);
+
+/// <summary>
+///     <para>Reports the statistics periodically, and then resets them.</para>
+///     <para>The application must call <see cref="InitSoftTimers" /> first, and must call
+///     <see cref="InvokeDeferredProcs" />, which reports the statistics.</para>
+/// </summary>
+/// <param name="periodUs">Period in microseconds, at most SOFT_TIMER_MAX_US; usually
+/// PROFILE_REPORT_PERIOD_US.</param>
+/// <param name="handler">Function which receives the statistics, or NULL to write them to the
+/// debug UART.</param>
+void Profile_StartReports(uint32_t periodUs, ProfileReportHandler handler);
+
+#if defined(RTAPP_PROFILE)
+
+/// <summary>Defines a static region with the supplied variable name and reported name.</summary>
+#define PROFILE_REGION(var_, name_) static ProfileRegion var_ = PROFILE_REGION_INIT(name_)
+
+/// <summary>Pointer to a region which was defined with PROFILE_REGION, to set as the profile
+/// field of a CallbackNode.</summary>
+#define PROFILE_REGION_PTR(var_) (&(var_))
+
+/// <summary>Starts timing a region, storing the start time in a new variable.</summary>
+#define PROFILE_BEGIN(start_) uint32_t start_ = Profile_Begin()
+
+/// <summary>Finishes timing a region which was started with PROFILE_BEGIN.</summary>
+#define PROFILE_END(var_, start_) Profile_End(&(var_), (start_))
+
+/// <summary>
+///     Defines ProfiledIrq_handler_, which runs an interrupt handler and times it in a region
+///     with the handler's name. Use PROFILE_IRQ(handler_) in the exception vector table.
+/// </summary>
+#define PROFILE_DEFINE_IRQ_HANDLER(handler_)                              \
+    static void ProfiledIrq_##handler_(void)                              \
+    {                                                                     \
+        static ProfileRegion region = PROFILE_REGION_INIT(#handler_);     \
+        uint32_t startCycles = Profile_Begin();                           \
+        handler_();                                                       \
+        Profile_End(&region, startCycles);                                \
+    }                                                                     \
+    static void ProfiledIrq_##handler_(void)
+
+/// <summary>The handler to install for an interrupt handler which was defined with
+/// PROFILE_DEFINE_IRQ_HANDLER.</summary>
+#define PROFILE_IRQ(handler_) ProfiledIrq_##handler_
+
+#else
+
+#define PROFILE_REGION(var_, name_) _Static_assert(1, name_)
+#define PROFILE_REGION_PTR(var_) NULL
+#define PROFILE_BEGIN(start_) ((void)0)
+#define PROFILE_END(var_, start_) ((void)0)
+#define PROFILE_DEFINE_IRQ_HANDLER(handler_) void handler_(void)
+#define PROFILE_IRQ(handler_) handler_
+
+#endif
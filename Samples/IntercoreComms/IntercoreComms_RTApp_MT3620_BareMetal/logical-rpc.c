@@ -0,0 +1,111 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include "logical-rpc.h"
+
+static const IntercoreRpcMethod *rpcMethods = NULL;
+static size_t rpcMethodCount = 0;
+
+// A request which wraps around the end of the inbound buffer is copied here.
+static uint8_t requestBuffer[INTERCORE_RPC_MAX_PAYLOAD_SIZE];
+// The response header and payload are built here.
+static uint8_t responseMessage[INTERCORE_MAX_PAYLOAD_LEN] __attribute__((aligned(4)));
+
+static void CopyFromPayload(void *dest, const IntercoreSpans *payload, size_t offset, size_t size);
+static const uint8_t *GetRequest(const IntercoreSpans *payload, size_t size);
+static IntercoreRpcStatus CallMethod(uint16_t methodId, const uint8_t *request,
+                                     size_t requestSize, uint8_t *response,
+                                     size_t *responseSize);
+
+// Copies bytes from a message which may wrap around the end of the inbound buffer.
+static void CopyFromPayload(void *dest, const IntercoreSpans *payload, size_t offset, size_t size)
+{
+    uint8_t *dest8 = dest;
+    for (size_t i = 0; i < size; ++i, ++offset) {
+        dest8[i] = (offset < payload->firstSize) ? payload->first[offset]
+                                                 : payload->second[offset - payload->firstSize];
+    }
+}
+
+// Returns the request which follows the header, in place if it is contiguous; otherwise,
+// copies it into requestBuffer.
+static const uint8_t *GetRequest(const IntercoreSpans *payload, size_t size)
+{
+    const size_t offset = sizeof(IntercoreRpcHeader);
+    if (offset + size <= payload->firstSize) {
+        return payload->first + offset;
+    }
+    if (offset >= payload->firstSize) {
+        return payload->second + (offset - payload->firstSize);
+    }
+
+    CopyFromPayload(requestBuffer, payload, offset, size);
+    return requestBuffer;
+}
+
+static IntercoreRpcStatus CallMethod(uint16_t methodId, const uint8_t *request,
+                                     size_t requestSize, uint8_t *response, size_t *responseSize)
+{
+    for (size_t i = 0; i < rpcMethodCount; ++i) {
+        if (rpcMethods[i].methodId == methodId) {
+            return rpcMethods[i].handler(request, requestSize, response, responseSize);
+        }
+    }
+
+    return IntercoreRpc_Status_UnknownMethod;
+}
+
+void IntercoreRpcRegisterMethods(const IntercoreRpcMethod *methods, size_t count)
+{
+    rpcMethods = methods;
+    rpcMethodCount = count;
+}
+
+bool IntercoreRpcDispatch(IntercoreChannel *channel, const ComponentId *sender,
+                          const IntercoreSpans *payload)
+{
+    size_t messageSize = payload->firstSize + payload->secondSize;
+
+    IntercoreRpcHeader header;
+    if (messageSize < sizeof(header)) {
+        return false;
+    }
+
+    CopyFromPayload(&header, payload, 0, sizeof(header));
+    if (header.magic != INTERCORE_RPC_MAGIC) {
+        return false;
+    }
+
+    // Responses are not expected, and a message of an unknown version cannot be answered.
+    if (header.version != INTERCORE_RPC_VERSION || header.kind != IntercoreRpc_Kind_Request) {
+        return true;
+    }
+
+    IntercoreRpcHeader *responseHeader = (IntercoreRpcHeader *)responseMessage;
+    uint8_t *response = responseMessage + sizeof(header);
+    size_t responseSize = INTERCORE_RPC_MAX_PAYLOAD_SIZE;
+
+    IntercoreRpcStatus status;
+    if (header.payloadSize != messageSize - sizeof(header)) {
+        status = IntercoreRpc_Status_BadRequest;
+    } else {
+        const uint8_t *request = GetRequest(payload, header.payloadSize);
+        status = CallMethod(header.methodId, request, header.payloadSize, response, &responseSize);
+    }
+
+    if (status != IntercoreRpc_Status_Ok) {
+        responseSize = 0;
+    }
+
+    responseHeader->magic = INTERCORE_RPC_MAGIC;
+    responseHeader->version = INTERCORE_RPC_VERSION;
+    responseHeader->kind = IntercoreRpc_Kind_Response;
+    responseHeader->methodId = header.methodId;
+    responseHeader->status = (uint16_t)status;
+    responseHeader->correlationId = header.correlationId;
+    responseHeader->payloadSize = (uint32_t)responseSize;
+
+    // If the channel's queue is full, the caller's timeout reports the failure.
+    IntercoreChannelSend(channel, sender, responseMessage, sizeof(header) + responseSize);
+    return true;
+}
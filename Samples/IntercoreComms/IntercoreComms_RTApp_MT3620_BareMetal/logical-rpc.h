@@ -0,0 +1,140 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "logical-channel.h"
+#include "logical-intercore.h"
+
+// Remote procedure calls (RPCs) from the high-level application. Each message starts with a
+// fixed 16-byte header, which is followed by the payload. The same definitions are used by
+// the high-level application, in intercore_rpc.h.
+
+/// <summary>
+///     Value of the magic field, which distinguishes RPC messages from other messages.
+/// </summary>
+#define INTERCORE_RPC_MAGIC 0x4352 // "RC"
+
+/// <summary>Version of the header layout.</summary>
+#define INTERCORE_RPC_VERSION 1
+
+/// <summary>Maximum size of a request or response payload in bytes.</summary>
+#define INTERCORE_RPC_MAX_PAYLOAD_SIZE (INTERCORE_MAX_PAYLOAD_LEN - sizeof(IntercoreRpcHeader))
+
+/// <summary>Whether a message is a request or a response.</summary>
+typedef enum {
+    IntercoreRpc_Kind_Request = 0,
+    IntercoreRpc_Kind_Response = 1
+} IntercoreRpcKind;
+
+/// <summary>Methods which this application implements.</summary>
+typedef enum {
+    /// <summary>Returns the request payload unchanged.</summary>
+    IntercoreRpc_Method_Echo = 1,
+    /// <summary>
+    ///     Applies a moving-average filter to little-endian int16_t samples. The request is a
+    ///     uint16_t window length followed by the samples; the response is the filtered samples.
+    /// </summary>
+    IntercoreRpc_Method_MovingAverage = 2,
+    /// <summary>
+    ///     Returns this application's IntercoreStats. The request is empty. The high-level
+    ///     application uses this to report drops on this core during a benchmark.
+    /// </summary>
+    IntercoreRpc_Method_GetStats = 3,
+    /// <summary>
+    ///     Returns a ProfileRecord for each region which has been timed, since the last periodic
+    ///     report. The request is empty. The response is empty unless this application is built
+    ///     with RTAPP_PROFILE.
+    /// </summary>
+    IntercoreRpc_Method_GetProfile = 4,
+    /// <summary>
+    ///     Returns the IntercoreChannelStats of each of this application's channels, highest
+    ///     priority first. The request is empty.
+    /// </summary>
+    IntercoreRpc_Method_GetChannelStats = 5
+} IntercoreRpcMethodId;
+
+/// <summary>Outcome of a call, which is returned in the response header.</summary>
+typedef enum {
+    /// <summary>The method succeeded, and the response contains its result.</summary>
+    IntercoreRpc_Status_Ok = 0,
+    /// <summary>This application does not implement the method.</summary>
+    IntercoreRpc_Status_UnknownMethod = 1,
+    /// <summary>The request was malformed.</summary>
+    IntercoreRpc_Status_BadRequest = 2,
+    /// <summary>The result did not fit in a response.</summary>
+    IntercoreRpc_Status_ResponseTooLarge = 3
+} IntercoreRpcStatus;
+
+/// <summary>Header at the start of every RPC message. All fields are little-endian.</summary>
+typedef struct {
+    /// <summary>INTERCORE_RPC_MAGIC.</summary>
+    uint16_t magic;
+    /// <summary>INTERCORE_RPC_VERSION.</summary>
+    uint8_t version;
+    /// <summary>One of the IntercoreRpcKind values.</summary>
+    uint8_t kind;
+    /// <summary>One of the IntercoreRpcMethodId values.</summary>
+    uint16_t methodId;
+    /// <summary>For a response, one of the IntercoreRpcStatus values. Zero for a
+    /// request.</summary>
+    uint16_t status;
+    /// <summary>Chosen by the caller, and copied into the response.</summary>
+    uint32_t correlationId;
+    /// <summary>Number of payload bytes which follow the header.</summary>
+    uint32_t payloadSize;
+} IntercoreRpcHeader;
+
+_Static_assert(sizeof(IntercoreRpcHeader) == 16, "IntercoreRpcHeader must be 16 bytes");
+
+/// <summary>
+///     Implements a method. It runs in the context which called
+///     <see cref="IntercoreRpcDispatch" />.
+/// </summary>
+/// <param name="request">Request payload. It is not necessarily aligned.</param>
+/// <param name="requestSize">Size of the request payload in bytes.</param>
+/// <param name="response">Buffer which receives the response payload.</param>
+/// <param name="responseSize">
+///     On entry, the size of the response buffer, which is INTERCORE_RPC_MAX_PAYLOAD_SIZE. On
+///     return, set to the size of the response payload.
+/// </param>
+/// <returns>Status which is returned to the caller.</returns>
+typedef IntercoreRpcStatus (*IntercoreRpcHandler)(const uint8_t *request, size_t requestSize,
+                                                  uint8_t *response, size_t *responseSize);
+
+/// <summary>Associates a method ID with the function which implements it.</summary>
+typedef struct {
+    /// <summary>Method ID which is used in requests.</summary>
+    uint16_t methodId;
+    /// <summary>Function which implements the method.</summary>
+    IntercoreRpcHandler handler;
+} IntercoreRpcMethod;
+
+/// <summary>
+///     Sets the methods which <see cref="IntercoreRpcDispatch" /> can call.
+/// </summary>
+/// <param name="methods">Methods. Not copied, so the array must remain valid.</param>
+/// <param name="count">Number of methods.</param>
+void IntercoreRpcRegisterMethods(const IntercoreRpcMethod *methods, size_t count);
+
+/// <summary>
+///     <para>If a received message is an RPC request, calls the method which it names and sends
+///     the response to the sender. Call this for each message which is returned by
+///     <see cref="IntercorePeek" />, before it is released.</para>
+///     <para>The request is passed to the method in place when it is contiguous in the inbound
+///     buffer, and the response is sent with a single <see cref="IntercoreChannelSend" />, so
+///     that it can overtake bulk messages if the channel has a higher priority.</para>
+/// </summary>
+/// <param name="channel">Channel on which responses are sent.</param>
+/// <param name="sender">Component ID of the application which sent the message.</param>
+/// <param name="payload">Message which was returned by <see cref="IntercorePeek" />.</param>
+/// <returns>
+///     true if the message was an RPC message, and so has been handled; false if it should be
+///     handled by the application.
+/// </returns>
+bool IntercoreRpcDispatch(IntercoreChannel *channel, const ComponentId *sender,
+                          const IntercoreSpans *payload);
@@ -0,0 +1,167 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include "logical-dpc.h"
+#include "logical-profile.h"
+#include "logical-telemetry.h"
+#include "logical-timer.h"
+
+// Running aggregates of one axis.
+typedef struct {
+    int16_t min;
+    int16_t max;
+    int64_t sum;
+    uint64_t sumOfSquares;
+} AxisAccumulator;
+
+static void HandleSampleTimerIrq(void);
+static void HandleSampleTimerDeferred(void);
+static void ResetWindow(void);
+static void SendSummary(void);
+static uint32_t SquareRoot(uint64_t value);
+
+// The timer and DPC callbacks do not take an argument, so the telemetry state is held here.
+static IntercoreChannel *telemetryChannel = NULL;
+static const ComponentId *telemetryDestAppId = NULL;
+static TelemetrySampler telemetrySampler = NULL;
+static uint32_t telemetrySamplesPerWindow = 0;
+
+PROFILE_REGION(sampleProfile, "TelemetrySample");
+static SoftTimer sampleTimer = {.next = NULL, .active = false, .cb = HandleSampleTimerIrq};
+static CallbackNode sampleCbNode = {.enqueued = false,
+                                    .cb = HandleSampleTimerDeferred,
+                                    .priority = DpcPriority_High,
+                                    .profile = PROFILE_REGION_PTR(sampleProfile)};
+
+static AxisAccumulator accumulators[TELEMETRY_AXIS_COUNT];
+static uint32_t windowSampleCount = 0;
+static uint32_t windowFailedSamples = 0;
+static uint32_t windowStartUs = 0;
+static uint32_t lastSampleUs = 0;
+static uint32_t summarySequence = 0;
+static uint32_t droppedSummaries = 0;
+
+// Runs in IRQ context, and schedules HandleSampleTimerDeferred to read the sensor, because the
+// sampler may take too long to run with other interrupts blocked.
+static void HandleSampleTimerIrq(void)
+{
+    EnqueueDeferredProc(&sampleCbNode);
+}
+
+// Queued by HandleSampleTimerIrq. Reads a sample and adds it to the window.
+static void HandleSampleTimerDeferred(void)
+{
+    if (telemetrySampler == NULL) {
+        return;
+    }
+
+    int16_t sample[TELEMETRY_AXIS_COUNT];
+    uint32_t nowUs = MT3620_Gpt_ReadMicroseconds();
+    if (!telemetrySampler(sample)) {
+        ++windowFailedSamples;
+    } else {
+        if (windowSampleCount == 0) {
+            windowStartUs = nowUs;
+        }
+        lastSampleUs = nowUs;
+
+        for (int axis = 0; axis < TELEMETRY_AXIS_COUNT; ++axis) {
+            AxisAccumulator *acc = &accumulators[axis];
+            int16_t value = sample[axis];
+            if (windowSampleCount == 0 || value < acc->min) {
+                acc->min = value;
+            }
+            if (windowSampleCount == 0 || value > acc->max) {
+                acc->max = value;
+            }
+            acc->sum += value;
+            acc->sumOfSquares += (uint64_t)((int32_t)value * value);
+        }
+        ++windowSampleCount;
+    }
+
+    if (windowSampleCount + windowFailedSamples >= telemetrySamplesPerWindow) {
+        SendSummary();
+        ResetWindow();
+    }
+}
+
+static void ResetWindow(void)
+{
+    __builtin_memset(accumulators, 0, sizeof(accumulators));
+    windowSampleCount = 0;
+    windowFailedSamples = 0;
+}
+
+// Reduces the window to a summary and sends it. If the channel's queue is full, the summary is
+// dropped and counted in the next one, rather than delaying sampling.
+static void SendSummary(void)
+{
+    TelemetrySummary summary = {.magic = TELEMETRY_MAGIC,
+                                .version = TELEMETRY_VERSION,
+                                .axisCount = TELEMETRY_AXIS_COUNT,
+                                .sequence = summarySequence++,
+                                .windowStartUs = windowStartUs,
+                                .windowDurationUs = lastSampleUs - windowStartUs,
+                                .sampleCount = windowSampleCount,
+                                .failedSamples = windowFailedSamples,
+                                .droppedSummaries = droppedSummaries};
+
+    for (int axis = 0; axis < TELEMETRY_AXIS_COUNT && windowSampleCount > 0; ++axis) {
+        const AxisAccumulator *acc = &accumulators[axis];
+        summary.axes[axis].min = acc->min;
+        summary.axes[axis].max = acc->max;
+        summary.axes[axis].mean = (int16_t)(acc->sum / (int64_t)windowSampleCount);
+        summary.axes[axis].rms = (uint16_t)SquareRoot(acc->sumOfSquares / windowSampleCount);
+    }
+
+    IntercoreResult icr =
+        IntercoreChannelSend(telemetryChannel, telemetryDestAppId, &summary, sizeof(summary));
+    if (icr != Intercore_OK) {
+        ++droppedSummaries;
+    }
+}
+
+// Integer square root, rounded down, so that the RMS does not need floating point.
+static uint32_t SquareRoot(uint64_t value)
+{
+    uint64_t root = 0;
+    uint64_t bit = UINT64_C(1) << 62;
+    while (bit > value) {
+        bit >>= 2;
+    }
+
+    while (bit != 0) {
+        if (value >= root + bit) {
+            value -= root + bit;
+            root = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+
+    return (uint32_t)root;
+}
+
+void StartTelemetry(IntercoreChannel *channel, const ComponentId *destAppId,
+                    TelemetrySampler sampler, uint32_t samplePeriodUs, uint32_t samplesPerWindow)
+{
+    StopTelemetry();
+
+    telemetryChannel = channel;
+    telemetryDestAppId = destAppId;
+    telemetrySampler = sampler;
+    telemetrySamplesPerWindow = samplesPerWindow;
+    summarySequence = 0;
+    droppedSummaries = 0;
+
+    StartSoftTimer(&sampleTimer, samplePeriodUs, samplePeriodUs);
+}
+
+void StopTelemetry(void)
+{
+    StopSoftTimer(&sampleTimer);
+    telemetrySampler = NULL;
+    ResetWindow();
+}
@@ -0,0 +1,93 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "logical-channel.h"
+#include "logical-intercore.h"
+
+// Telemetry aggregation. A sensor is sampled at a high rate on this core, and each window of
+// samples is reduced to a compact summary which is sent to the high-level application, so that
+// it receives one message per window rather than handling every sample. The same definitions
+// are used by the high-level application, in intercore_telemetry.h.
+
+/// <summary>
+///     Value of the magic field, which distinguishes telemetry summaries from other messages.
+/// </summary>
+#define TELEMETRY_MAGIC 0x5354 // "TS"
+
+/// <summary>Version of the summary layout.</summary>
+#define TELEMETRY_VERSION 1
+
+/// <summary>Number of axes in each sample, for example X, Y and Z acceleration.</summary>
+#define TELEMETRY_AXIS_COUNT 3
+
+/// <summary>Aggregates of one axis over a window. All fields are little-endian.</summary>
+typedef struct {
+    /// <summary>Smallest sample.</summary>
+    int16_t min;
+    /// <summary>Largest sample.</summary>
+    int16_t max;
+    /// <summary>Mean of the samples, rounded towards zero.</summary>
+    int16_t mean;
+    /// <summary>Root mean square of the samples, rounded down.</summary>
+    uint16_t rms;
+} TelemetryAxisSummary;
+
+/// <summary>Message which summarizes a window of samples. All fields are little-endian.</summary>
+typedef struct {
+    /// <summary>TELEMETRY_MAGIC.</summary>
+    uint16_t magic;
+    /// <summary>TELEMETRY_VERSION.</summary>
+    uint8_t version;
+    /// <summary>TELEMETRY_AXIS_COUNT.</summary>
+    uint8_t axisCount;
+    /// <summary>Incremented for each window, so that lost summaries can be detected.</summary>
+    uint32_t sequence;
+    /// <summary>Time of the first sample in the window, from the microsecond counter.</summary>
+    uint32_t windowStartUs;
+    /// <summary>Time from the first sample to the last sample in microseconds.</summary>
+    uint32_t windowDurationUs;
+    /// <summary>Number of samples which were aggregated.</summary>
+    uint32_t sampleCount;
+    /// <summary>Number of samples in the window which the sensor could not supply.</summary>
+    uint32_t failedSamples;
+    /// <summary>Number of earlier summaries which could not be sent because the channel's
+    /// queue was full.</summary>
+    uint32_t droppedSummaries;
+    /// <summary>Aggregates of each axis.</summary>
+    TelemetryAxisSummary axes[TELEMETRY_AXIS_COUNT];
+} TelemetrySummary;
+
+_Static_assert(sizeof(TelemetrySummary) == 52, "TelemetrySummary must be 52 bytes");
+
+/// <summary>
+///     Reads one sample from the sensor. It runs in a DPC.
+/// </summary>
+/// <param name="sample">Receives the value of each axis.</param>
+/// <returns>true if a sample was read; false if the sensor could not supply one.</returns>
+typedef bool (*TelemetrySampler)(int16_t sample[TELEMETRY_AXIS_COUNT]);
+
+/// <summary>
+///     <para>Starts sampling a sensor, and sending a summary to the high-level application each
+///     time a window of samples has been aggregated. Only one sensor can be sampled at a time.
+///     If telemetry has already been started, it is restarted with the new settings.</para>
+///     <para>The application must call <see cref="InitSoftTimers" /> first, and must call
+///     <see cref="InvokeDeferredProcs" />, which reads the samples and sends the summaries.</para>
+/// </summary>
+/// <param name="channel">Channel on which the summaries are sent.</param>
+/// <param name="destAppId">Component ID of the application which receives the summaries. This
+/// object must exist while telemetry is running.</param>
+/// <param name="sampler">Function which reads a sample.</param>
+/// <param name="samplePeriodUs">Microseconds between samples.</param>
+/// <param name="samplesPerWindow">Number of samples in each window. Must be non-zero.</param>
+void StartTelemetry(IntercoreChannel *channel, const ComponentId *destAppId,
+                    TelemetrySampler sampler, uint32_t samplePeriodUs, uint32_t samplesPerWindow);
+
+/// <summary>
+///     Stops sampling. The partially filled window is discarded.
+/// </summary>
+void StopTelemetry(void);
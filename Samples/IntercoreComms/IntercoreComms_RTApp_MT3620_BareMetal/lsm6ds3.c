@@ -0,0 +1,78 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include "lsm6ds3.h"
+#include "mt3620-i2c.h"
+#include "mt3620-timer.h"
+
+// DocID026899 Rev 10, S9.11, WHO_AM_I (0Fh); has fixed value 0x69.
+static const uint8_t WHO_AM_I = 0x0F;
+static const uint8_t EXPECTED_WHO_AM_I = 0x69;
+// S9.12, CTRL1_XL (10h). 0x80 selects an output data rate of 1.66 kHz and a range of +/-2 g, so
+// that each sample which is read at 1 kHz is a new measurement.
+static const uint8_t CTRL1_XL = 0x10;
+static const uint8_t CTRL1_XL_1660HZ_2G = 0x80;
+// S9.14, CTRL3_C (12h). SW_RESET resets the registers, and clears itself when the reset has
+// finished. BDU stops the output registers being updated while they are read, so the low and
+// high bytes of an axis always come from the same measurement, and IF_INC advances the register
+// number after each byte, so all the axes are read in one transfer.
+static const uint8_t CTRL3_C = 0x12;
+static const uint8_t CTRL3_C_SW_RESET = 1U << 0;
+static const uint8_t CTRL3_C_IF_INC = 1U << 2;
+static const uint8_t CTRL3_C_BDU = 1U << 6;
+// S9.29-9.34, OUTX_L_XL (28h) to OUTZ_H_XL (2Dh), each axis little-endian.
+static const uint8_t OUTX_L_XL = 0x28;
+
+// The reset takes about 50 microseconds.
+static const uint32_t RESET_TIMEOUT_US = 10 * 1000;
+
+static bool WriteRegister(uint8_t reg, uint8_t value);
+static bool ReadRegisters(uint8_t reg, uint8_t *data, size_t size);
+
+static bool WriteRegister(uint8_t reg, uint8_t value)
+{
+    const uint8_t command[] = {reg, value};
+    return I2cMaster_Write(LSM6DS3_I2C_ADDRESS, command, sizeof(command));
+}
+
+static bool ReadRegisters(uint8_t reg, uint8_t *data, size_t size)
+{
+    return I2cMaster_WriteThenRead(LSM6DS3_I2C_ADDRESS, &reg, sizeof(reg), data, size);
+}
+
+bool Lsm6ds3_Init(void)
+{
+    uint8_t whoAmI;
+    if (!ReadRegisters(WHO_AM_I, &whoAmI, sizeof(whoAmI)) || whoAmI != EXPECTED_WHO_AM_I) {
+        return false;
+    }
+
+    if (!WriteRegister(CTRL3_C, CTRL3_C_SW_RESET)) {
+        return false;
+    }
+
+    uint32_t startUs = MT3620_Gpt_ReadMicroseconds();
+    uint8_t ctrl3c;
+    do {
+        if (MT3620_Gpt_ReadMicroseconds() - startUs > RESET_TIMEOUT_US ||
+            !ReadRegisters(CTRL3_C, &ctrl3c, sizeof(ctrl3c))) {
+            return false;
+        }
+    } while (ctrl3c & CTRL3_C_SW_RESET);
+
+    return WriteRegister(CTRL3_C, CTRL3_C_BDU | CTRL3_C_IF_INC) &&
+           WriteRegister(CTRL1_XL, CTRL1_XL_1660HZ_2G);
+}
+
+bool Lsm6ds3_ReadAcceleration(int16_t sample[TELEMETRY_AXIS_COUNT])
+{
+    uint8_t data[2 * TELEMETRY_AXIS_COUNT];
+    if (!ReadRegisters(OUTX_L_XL, data, sizeof(data))) {
+        return false;
+    }
+
+    for (int axis = 0; axis < TELEMETRY_AXIS_COUNT; ++axis) {
+        sample[axis] = (int16_t)(data[2 * axis] | (data[2 * axis + 1] << 8));
+    }
+    return true;
+}
@@ -0,0 +1,39 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "logical-telemetry.h"
+
+// The LSM6DS3 accelerometer, which is read over the ISU0 I2C master. The register numbers are
+// from the ST datasheet, DocID026899.
+
+/// <summary>7-bit I2C address of the LSM6DS3, with its SA0 pin tied low.</summary>
+#define LSM6DS3_I2C_ADDRESS 0x6A
+
+/// <summary>
+///     Acceleration of one unit of a sample in micro-g, at the full-scale range of +/-2 g which
+///     <see cref="Lsm6ds3_Init" /> selects. DocID026899 Rev 10, Table 3.
+/// </summary>
+#define LSM6DS3_MICRO_G_PER_LSB 61
+
+/// <summary>
+///     Check that an LSM6DS3 is present, reset it, and configure its accelerometer to measure
+///     at 1.66 kHz with a range of +/-2 g. Call <see cref="I2cMaster_Init" /> and
+///     <see cref="MT3620_Gpt_Init" /> first.
+/// </summary>
+/// <returns>true if the sensor was configured; false if it did not respond, or its WHO_AM_I
+/// register did not identify it as an LSM6DS3.</returns>
+bool Lsm6ds3_Init(void);
+
+/// <summary>
+///     Read the latest acceleration on each axis. This is a <see cref="TelemetrySampler" />, so
+///     it can be passed to <see cref="StartTelemetry" />. It takes about 250 microseconds.
+/// </summary>
+/// <param name="sample">Receives the X, Y and Z acceleration, in units of
+/// LSM6DS3_MICRO_G_PER_LSB.</param>
+/// <returns>true if the acceleration was read; false if the transfer failed.</returns>
+bool Lsm6ds3_ReadAcceleration(int16_t sample[TELEMETRY_AXIS_COUNT]);
@@ -3,12 +3,18 @@
 
 // This sample C application for the real-time core demonstrates intercore communications by
 // sending a message to a high-level application every second, and printing out any received
-// messages.
+// messages. It also samples the LSM6DS3 accelerometer, and sends the high-level application a
+// summary of each second of samples. RPC responses, the regular messages and the telemetry
+// summaries are sent on logical channels with decreasing priority, so that a response is not
+// held up by telemetry.
 //
 // It demontrates the following hardware
 // - UART (used to write a message via the built-in UART)
 // - mailbox (used to report buffer sizes and send / receive events)
-// - timer (used to send a message to the HLApp)
+// - timer (used to send a message to the HLApp, and to time the accelerometer samples)
+// - I2C (used to read the LSM6DS3 accelerometer via ISU0)
+//
+// Build with -DRTAPP_PROFILE=ON to time the interrupt handlers and DPCs with the cycle counter.
 
 #include <ctype.h>
 #include <stddef.h>
@@ -16,11 +22,18 @@
 #include <stdint.h>
 #include <errno.h>
 
+#include "logical-channel.h"
 #include "logical-dpc.h"
 #include "logical-intercore.h"
+#include "logical-profile.h"
+#include "logical-rpc.h"
+#include "logical-telemetry.h"
+#include "logical-timer.h"
+#include "lsm6ds3.h"
 
 #include "mt3620-baremetal.h"
-#include "mt3620-uart-poll.h"
+#include "mt3620-i2c.h"
+#include "mt3620-uart.h"
 #include "mt3620-intercore.h"
 #include "mt3620-timer.h"
 
@@ -28,17 +41,77 @@ extern uint32_t StackTop; // &StackTop == end of TCM
 
 static IntercoreComm icc;
 
-static const uint32_t sendTimerIntervalMs = 1000;
+// The component ID for IntercoreComms_HighLevelApp.
+static const ComponentId hlAppId = {.data1 = 0x25025d2c,
+                                    .data2 = 0x66da,
+                                    .data3 = 0x4448,
+                                    .data4 = {0xba, 0xe1, 0xac, 0x26, 0xfc, 0xdd, 0x36, 0x27}};
+
+static const uint32_t sendTimerIntervalUs = 1000 * 1000;
+
+// The HLApp may send this many messages beyond those which have been handled. Grants which
+// could not be sent when the messages were handled are sent by a timer with this period.
+static const uint32_t flowWindow = 8;
+static const uint32_t flowGrantPeriodUs = 100 * 1000;
+
+// The lower-priority channels leave this much credit, and space for a control message of this
+// size, so an RPC response can be sent while telemetry fills the link. Queued messages which
+// could not be sent are retried with this period.
+static const uint32_t channelControlCredits = 2;
+static const uint32_t channelControlReserveSize = 64;
+static const uint32_t channelRetryUs = 10 * 1000;
+
+// Each channel's queue holds a few of its largest messages.
+static IntercoreChannel controlChannel;
+static IntercoreChannel normalChannel;
+static IntercoreChannel bulkChannel;
+static uint8_t controlStorage[2 * INTERCORE_CHANNEL_ENTRY_SIZE(INTERCORE_MAX_PAYLOAD_LEN)];
+static uint8_t normalStorage[4 * INTERCORE_CHANNEL_ENTRY_SIZE(32)];
+static uint8_t bulkStorage[8 * INTERCORE_CHANNEL_ENTRY_SIZE(sizeof(TelemetrySummary))];
+
+// The accelerometer is sampled at 1kHz, and a summary is sent to the HLApp once a second. Each
+// sample is one I2C transfer on this core, so the HLApp handles one message a second instead.
+static const uint32_t telemetrySamplePeriodUs = 1000;
+static const uint32_t telemetrySamplesPerWindow = 1000;
 
 static _Noreturn void DefaultExceptionHandler(void);
 static void HandleSendTimerIrq(void);
 static void HandleSendTimerDeferred(void);
 
+static SoftTimer sendTimer = {.next = NULL, .active = false, .cb = HandleSendTimerIrq};
+
+PROFILE_REGION(sendTimerProfile, "HandleSendTimerDeferred");
+PROFILE_REGION(rpcProfile, "IntercoreRpcDispatch");
+
 static void PrintBytes(const void *buf, int start, int end);
 static void PrintGuid(const ComponentId *cid);
+static uint8_t PayloadByte(const IntercoreSpans *payload, size_t i);
+
+static IntercoreRpcStatus HandleEchoRpc(const uint8_t *request, size_t requestSize,
+                                        uint8_t *response, size_t *responseSize);
+static IntercoreRpcStatus HandleMovingAverageRpc(const uint8_t *request, size_t requestSize,
+                                                 uint8_t *response, size_t *responseSize);
+static IntercoreRpcStatus HandleGetStatsRpc(const uint8_t *request, size_t requestSize,
+                                            uint8_t *response, size_t *responseSize);
+static IntercoreRpcStatus HandleGetProfileRpc(const uint8_t *request, size_t requestSize,
+                                              uint8_t *response, size_t *responseSize);
+static IntercoreRpcStatus HandleGetChannelStatsRpc(const uint8_t *request, size_t requestSize,
+                                                   uint8_t *response, size_t *responseSize);
+
+static const IntercoreRpcMethod rpcMethods[] = {
+    {.methodId = IntercoreRpc_Method_Echo, .handler = HandleEchoRpc},
+    {.methodId = IntercoreRpc_Method_MovingAverage, .handler = HandleMovingAverageRpc},
+    {.methodId = IntercoreRpc_Method_GetStats, .handler = HandleGetStatsRpc},
+    {.methodId = IntercoreRpc_Method_GetProfile, .handler = HandleGetProfileRpc},
+    {.methodId = IntercoreRpc_Method_GetChannelStats, .handler = HandleGetChannelStatsRpc}};
 
 static _Noreturn void RTCoreMain(void);
 
+// With RTAPP_PROFILE, each interrupt is handled by a wrapper which times its handler.
+PROFILE_DEFINE_IRQ_HANDLER(MT3620_Gpt_HandleIrq1);
+PROFILE_DEFINE_IRQ_HANDLER(Uart_HandleIrq4);
+PROFILE_DEFINE_IRQ_HANDLER(MT3620_HandleMailboxIrq11);
+
 // ARM DDI0403E.d SB1.5.2-3
 // From SB1.5.3, "The Vector table must be naturally aligned to a power of two whose alignment
 // value is greater than or equal to (Number of Exceptions supported x 4), with a minimum alignment
@@ -64,9 +137,11 @@ __attribute__((used)) = {
     [15] = (uintptr_t)DefaultExceptionHandler, // SysTick
 
     [INT_TO_EXC(0)] = (uintptr_t)DefaultExceptionHandler,
-    [INT_TO_EXC(1)] = (uintptr_t)MT3620_Gpt_HandleIrq1,
-    [INT_TO_EXC(2)... INT_TO_EXC(10)] = (uintptr_t)DefaultExceptionHandler,
-    [INT_TO_EXC(11)] = (uintptr_t)MT3620_HandleMailboxIrq11,
+    [INT_TO_EXC(1)] = (uintptr_t)PROFILE_IRQ(MT3620_Gpt_HandleIrq1),
+    [INT_TO_EXC(2)... INT_TO_EXC(3)] = (uintptr_t)DefaultExceptionHandler,
+    [INT_TO_EXC(4)] = (uintptr_t)PROFILE_IRQ(Uart_HandleIrq4),
+    [INT_TO_EXC(5)... INT_TO_EXC(10)] = (uintptr_t)DefaultExceptionHandler,
+    [INT_TO_EXC(11)] = (uintptr_t)PROFILE_IRQ(MT3620_HandleMailboxIrq11),
     [INT_TO_EXC(12)... INT_TO_EXC(INTERRUPT_COUNT - 1)] = (uintptr_t)DefaultExceptionHandler};
 
 // If the applications end up in this function then an unexpected exception has occurred.
@@ -80,7 +155,10 @@ static _Noreturn void DefaultExceptionHandler(void)
 // Runs in IRQ context and schedules HandleSendTimerDeferred to run later.
 static void HandleSendTimerIrq(void)
 {
-    static CallbackNode cbn = {.enqueued = false, .cb = HandleSendTimerDeferred};
+    static CallbackNode cbn = {.enqueued = false,
+                               .cb = HandleSendTimerDeferred,
+                               .priority = DpcPriority_Normal,
+                               .profile = PROFILE_REGION_PTR(sendTimerProfile)};
     EnqueueDeferredProc(&cbn);
 }
 
@@ -88,28 +166,21 @@ static void HandleSendTimerIrq(void)
 static void HandleSendTimerDeferred(void)
 {
     static int iter = 0;
-    // The component ID for IntercoreComms_HighLevelApp.
-    static const ComponentId hlAppId = {.data1 = 0x25025d2c,
-                                        .data2 = 0x66da,
-                                        .data3 = 0x4448,
-                                        .data4 = {0xba, 0xe1, 0xac, 0x26, 0xfc, 0xdd, 0x36, 0x27}};
 
     // The number cycles from "00" to "99".
     static char txMsg[] = "rt-app-to-hl-app-00";
     const size_t txMsgLen = sizeof(txMsg);
 
-    IntercoreResult icr = IntercoreSend(&icc, &hlAppId, txMsg, sizeof(txMsg) - 1);
+    IntercoreResult icr = IntercoreChannelSend(&normalChannel, &hlAppId, txMsg, sizeof(txMsg) - 1);
     if (icr != Intercore_OK) {
-        Uart_WriteStringPoll("IntercoreSend: ");
-        Uart_WriteIntegerPoll(icr);
-        Uart_WriteStringPoll("\r\n");
+        Uart_WriteString("IntercoreChannelSend: ");
+        Uart_WriteInteger(icr);
+        Uart_WriteString("\r\n");
     }
 
     txMsg[txMsgLen - 3] = '0' + (iter / 10);
     txMsg[txMsgLen - 2] = '0' + (iter % 10);
     iter = (iter + 1) % 100;
-
-    MT3620_Gpt_LaunchTimerMs(TimerGpt0, sendTimerIntervalMs, HandleSendTimerIrq);
 }
 
 // Prints a sequence of bytes. If the start position occurs after the end
@@ -121,9 +192,9 @@ static void PrintBytes(const void *buf, int start, int end)
     int step = (end >= start) ? +1 : -1;
 
     for (/* nop */; start != end; start += step) {
-        Uart_WriteHexBytePoll(buf8[start]);
+        Uart_WriteHexByte(buf8[start]);
     }
-    Uart_WriteHexBytePoll(buf8[end]);
+    Uart_WriteHexByte(buf8[end]);
 }
 
 // Renders the supplied component ID as a string "00112233-4455-6677-8899-aabbccddeeff".
@@ -131,26 +202,126 @@ static void PrintBytes(const void *buf, int start, int end)
 static void PrintGuid(const ComponentId *cid)
 {
     PrintBytes(&cid->data1, 3, 0); // 4-byte little-endian word
-    Uart_WriteStringPoll("-");
+    Uart_WriteString("-");
     PrintBytes(&cid->data2, 1, 0); // 2-byte little-endian half
-    Uart_WriteStringPoll("-");
+    Uart_WriteString("-");
     PrintBytes(&cid->data3, 1, 0); // 2-byte little-endian half
-    Uart_WriteStringPoll("-");
+    Uart_WriteString("-");
     PrintBytes(&cid->data4, 0, 1); // 2 bytes
-    Uart_WriteStringPoll("-");
+    Uart_WriteString("-");
     PrintBytes(&cid->data4, 2, 7); // 6 bytes
 }
 
+// Gets a byte of a message payload which is held in place in the inbound buffer.
+static uint8_t PayloadByte(const IntercoreSpans *payload, size_t i)
+{
+    return (i < payload->firstSize) ? payload->first[i] : payload->second[i - payload->firstSize];
+}
+
+// Implements IntercoreRpc_Method_Echo by returning the request unchanged.
+static IntercoreRpcStatus HandleEchoRpc(const uint8_t *request, size_t requestSize,
+                                        uint8_t *response, size_t *responseSize)
+{
+    __builtin_memcpy(response, request, requestSize);
+    *responseSize = requestSize;
+    return IntercoreRpc_Status_Ok;
+}
+
+// Implements IntercoreRpc_Method_MovingAverage. Each output sample is the mean of the input
+// sample at the same position and the preceding ones in the window, so the first outputs
+// average fewer samples.
+static IntercoreRpcStatus HandleMovingAverageRpc(const uint8_t *request, size_t requestSize,
+                                                 uint8_t *response, size_t *responseSize)
+{
+    uint16_t window;
+    if (requestSize < sizeof(window) || (requestSize - sizeof(window)) % sizeof(int16_t) != 0) {
+        return IntercoreRpc_Status_BadRequest;
+    }
+
+    __builtin_memcpy(&window, request, sizeof(window));
+    if (window == 0) {
+        return IntercoreRpc_Status_BadRequest;
+    }
+
+    const uint8_t *samples = request + sizeof(window);
+    size_t sampleCount = (requestSize - sizeof(window)) / sizeof(int16_t);
+    if (sampleCount * sizeof(int16_t) > *responseSize) {
+        return IntercoreRpc_Status_ResponseTooLarge;
+    }
+
+    // The samples are not necessarily aligned, so they are copied in and out.
+    int32_t sum = 0;
+    for (size_t i = 0; i < sampleCount; ++i) {
+        int16_t sample;
+        __builtin_memcpy(&sample, samples + i * sizeof(sample), sizeof(sample));
+        sum += sample;
+
+        if (i >= window) {
+            int16_t oldest;
+            __builtin_memcpy(&oldest, samples + (i - window) * sizeof(oldest), sizeof(oldest));
+            sum -= oldest;
+        }
+
+        int32_t count = (i + 1 < window) ? (int32_t)(i + 1) : window;
+        int16_t mean = (int16_t)(sum / count);
+        __builtin_memcpy(response + i * sizeof(mean), &mean, sizeof(mean));
+    }
+
+    *responseSize = sampleCount * sizeof(int16_t);
+    return IntercoreRpc_Status_Ok;
+}
+
+// Implements IntercoreRpc_Method_GetStats by returning the intercore traffic counters.
+static IntercoreRpcStatus HandleGetStatsRpc(const uint8_t *request, size_t requestSize,
+                                            uint8_t *response, size_t *responseSize)
+{
+    const IntercoreStats *stats = IntercoreGetStats(&icc);
+    __builtin_memcpy(response, stats, sizeof(*stats));
+    *responseSize = sizeof(*stats);
+    return IntercoreRpc_Status_Ok;
+}
+
+// Implements IntercoreRpc_Method_GetProfile by returning the statistics of each region which has
+// been timed since the last periodic report, without resetting them.
+static IntercoreRpcStatus HandleGetProfileRpc(const uint8_t *request, size_t requestSize,
+                                              uint8_t *response, size_t *responseSize)
+{
+    ProfileRecord records[PROFILE_MAX_REGIONS];
+    size_t count = Profile_GetRecords(records, PROFILE_MAX_REGIONS, false);
+    if (count * sizeof(ProfileRecord) > *responseSize) {
+        return IntercoreRpc_Status_ResponseTooLarge;
+    }
+
+    __builtin_memcpy(response, records, count * sizeof(ProfileRecord));
+    *responseSize = count * sizeof(ProfileRecord);
+    return IntercoreRpc_Status_Ok;
+}
+
+// Implements IntercoreRpc_Method_GetChannelStats by returning the counters of the control, normal
+// and bulk channels, in that order.
+static IntercoreRpcStatus HandleGetChannelStatsRpc(const uint8_t *request, size_t requestSize,
+                                                   uint8_t *response, size_t *responseSize)
+{
+    const IntercoreChannel *channels[] = {&controlChannel, &normalChannel, &bulkChannel};
+    const size_t channelCount = sizeof(channels) / sizeof(channels[0]);
+    for (size_t i = 0; i < channelCount; ++i) {
+        __builtin_memcpy(response + i * sizeof(IntercoreChannelStats),
+                         IntercoreChannelGetStats(channels[i]), sizeof(IntercoreChannelStats));
+    }
+    *responseSize = channelCount * sizeof(IntercoreChannelStats);
+    return IntercoreRpc_Status_Ok;
+}
+
 // Runs with interrupts enabled. Retrieves messages from the inbound buffer
-// and prints their sender ID, length, and content (hex and text).
+// and prints their sender ID, length, and content (hex and text). The messages
+// are printed in place, so they are not copied or truncated.
 static void HandleReceivedMessageDeferred(void)
 {
     for (;;) {
         ComponentId sender;
-        uint8_t rxData[32];
-        size_t rxDataSize = sizeof(rxData);
+        IntercoreSpans payload;
 
-        IntercoreResult icr = IntercoreRecv(&icc, &sender, rxData, &rxDataSize);
+        IntercoreResult icr = IntercorePeek(&icc, &sender, &payload);
 
         // Return if read all messages in buffer.
         if (icr == Intercore_Recv_NoBlockSize) {
@@ -159,40 +330,54 @@ static void HandleReceivedMessageDeferred(void)
 
         // Return if an error occurred.
         if (icr != Intercore_OK) {
-            Uart_WriteStringPoll("IntercoreRecv: ");
-            Uart_WriteIntegerPoll(icr);
-            Uart_WriteStringPoll("\r\n");
+            Uart_WriteString("IntercorePeek: ");
+            Uart_WriteInteger(icr);
+            Uart_WriteString("\r\n");
             return;
         }
 
+        // Answer RPC requests without printing them.
+        PROFILE_BEGIN(rpcStartCycles);
+        bool isRpc = IntercoreRpcDispatch(&controlChannel, &sender, &payload);
+        PROFILE_END(rpcProfile, rpcStartCycles);
+        if (isRpc) {
+            IntercoreRelease(&icc);
+            continue;
+        }
+
         // Display sender component ID.
-        Uart_WriteStringPoll("Sender: ");
+        Uart_WriteString("Sender: ");
         PrintGuid(&sender);
-        Uart_WriteStringPoll("\r\n");
+        Uart_WriteString("\r\n");
 
-        Uart_WriteStringPoll("Message size: ");
-        Uart_WriteIntegerPoll((int)rxDataSize);
-        Uart_WriteStringPoll(" bytes:\r\n");
+        size_t rxDataSize = payload.firstSize + payload.secondSize;
+        Uart_WriteString("Message size: ");
+        Uart_WriteInteger((int)rxDataSize);
+        Uart_WriteString(" bytes:\r\n");
 
         // Print message as hex.
-        Uart_WriteStringPoll("Hex: ");
+        Uart_WriteString("Hex: ");
         for (uint32_t i = 0; i < rxDataSize; ++i) {
-            Uart_WriteHexBytePoll(rxData[i]);
+            Uart_WriteHexByte(PayloadByte(&payload, i));
             if (i != rxDataSize - 1) {
-                Uart_WriteStringPoll(":");
+                Uart_WriteString(":");
             }
         }
-        Uart_WriteStringPoll("\r\n");
+        Uart_WriteString("\r\n");
 
         // Print message as text.
-        Uart_WriteStringPoll("Text: ");
+        Uart_WriteString("Text: ");
         for (uint32_t i = 0; i < rxDataSize; ++i) {
+            uint8_t b = PayloadByte(&payload, i);
             char c[2];
-            c[0] = isprint(rxData[i]) ? rxData[i] : '.';
+            c[0] = isprint(b) ? b : '.';
             c[1] = '\0';
-            Uart_WriteStringPoll(c);
+            Uart_WriteString(c);
         }
-        Uart_WriteStringPoll("\r\n");
+        Uart_WriteString("\r\n");
+
+        // The message has been printed, so remove it from the inbound buffer.
+        IntercoreRelease(&icc);
     }
 }
 
@@ -210,23 +395,49 @@ static _Noreturn void RTCoreMain(void)
     WriteReg32(SCB_BASE, 0x08, (uint32_t)ExceptionVectorTable);
 
     Uart_Init();
-    Uart_WriteStringPoll("--------------------------------\r\n");
-    Uart_WriteStringPoll("IntercoreComms_RTApp_MT3620_BareMetal\r\n");
-    Uart_WriteStringPoll("App built on: " __DATE__ ", " __TIME__ "\r\n");
+    Uart_WriteString("--------------------------------\r\n");
+    Uart_WriteString("IntercoreComms_RTApp_MT3620_BareMetal\r\n");
+    Uart_WriteString("App built on: " __DATE__ ", " __TIME__ "\r\n");
 
     MT3620_Gpt_Init();
+    InitSoftTimers(TimerGpt0);
+
+#if defined(RTAPP_PROFILE)
+    if (!Profile_Init()) {
+        Uart_WriteString("Profile_Init: no cycle counter\r\n");
+    }
+    Profile_StartReports(PROFILE_REPORT_PERIOD_US, NULL);
+#endif
 
     IntercoreResult icr = SetupIntercoreComm(&icc, HandleReceivedMessageDeferred);
     if (icr != Intercore_OK) {
-        Uart_WriteStringPoll("SetupIntercoreComm: ");
-        Uart_WriteIntegerPoll(icr);
-        Uart_WriteStringPoll("\r\n");
+        Uart_WriteString("SetupIntercoreComm: ");
+        Uart_WriteInteger(icr);
+        Uart_WriteString("\r\n");
     } else {
-        MT3620_Gpt_LaunchTimerMs(TimerGpt0, sendTimerIntervalMs, HandleSendTimerIrq);
+        IntercoreSetFlowControl(&icc, &hlAppId, flowWindow, flowGrantPeriodUs);
+        IntercoreChannelsInit(&icc, channelControlCredits, channelControlReserveSize,
+                              channelRetryUs);
+        IntercoreChannelOpen(&controlChannel, IntercoreChannelPriority_Control, controlStorage,
+                             sizeof(controlStorage));
+        IntercoreChannelOpen(&normalChannel, IntercoreChannelPriority_Normal, normalStorage,
+                             sizeof(normalStorage));
+        IntercoreChannelOpen(&bulkChannel, IntercoreChannelPriority_Bulk, bulkStorage,
+                             sizeof(bulkStorage));
+        IntercoreRpcRegisterMethods(rpcMethods, sizeof(rpcMethods) / sizeof(rpcMethods[0]));
+        StartSoftTimer(&sendTimer, sendTimerIntervalUs, sendTimerIntervalUs);
+
+        I2cMaster_Init();
+        if (Lsm6ds3_Init()) {
+            StartTelemetry(&bulkChannel, &hlAppId, Lsm6ds3_ReadAcceleration,
+                           telemetrySamplePeriodUs, telemetrySamplesPerWindow);
+        } else {
+            Uart_WriteString("Lsm6ds3_Init: no accelerometer on ISU0 I2C\r\n");
+        }
     }
 
     for (;;) {
         InvokeDeferredProcs();
-        __asm__("wfi");
+        WaitForDeferredProcs();
     }
 }
@@ -132,10 +132,13 @@ static inline void SetReg32(uintptr_t baseAddr, size_t offset, uint32_t setBits)
 static inline uint32_t BlockIrqs(void)
 {
     uint32_t prevBasePri;
-    uint32_t newBasePri = 1; // block IRQs priority 1 and above
+    // BASEPRI holds the priority in its top IRQ_PRIORITY_BITS bits, as the priority registers do;
+    // the lower bits are ignored, so a value of 1 would block nothing.
+    uint32_t newBasePri = 1 << (8 - IRQ_PRIORITY_BITS); // block IRQs priority 1 and above
 
-    __asm__("mrs %0, BASEPRI" : "=r"(prevBasePri) :);
-    __asm__("msr BASEPRI, %0" : : "r"(newBasePri));
+    // The memory clobbers keep the compiler from moving accesses out of the critical section.
+    __asm__ volatile("mrs %0, BASEPRI" : "=r"(prevBasePri) : : "memory");
+    __asm__ volatile("msr BASEPRI, %0" : : "r"(newBasePri) : "memory");
     return prevBasePri;
 }
 
@@ -145,7 +148,7 @@ static inline uint32_t BlockIrqs(void)
 /// <param name="prevBasePri">Value returned from <see cref="BlockIrqs" />.</param>
 static inline void RestoreIrqs(uint32_t prevBasePri)
 {
-    __asm__("msr BASEPRI, %0" : : "r"(prevBasePri));
+    __asm__ volatile("msr BASEPRI, %0" : : "r"(prevBasePri) : "memory");
 }
 
 /// <summary>
@@ -0,0 +1,134 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include "mt3620-baremetal.h"
+#include "mt3620-i2c.h"
+#include "mt3620-timer.h"
+
+// The ISU0 I2C master.
+static const uintptr_t I2C_BASE = 0x38070200;
+
+// Register offsets.
+static const size_t I2C_INT_CTRL = 0x00;
+static const size_t I2C_MM_CNT_VAL_PHL = 0x44;
+static const size_t I2C_MM_CNT_VAL_PHH = 0x48;
+static const size_t I2C_MM_CNT_BYTE_VAL_PK0 = 0x50;
+static const size_t I2C_MM_CNT_BYTE_VAL_PK1 = 0x54;
+static const size_t I2C_MM_SLAVE_ID = 0x60;
+static const size_t I2C_MM_PACK_CON0 = 0x68;
+static const size_t I2C_MM_CON0 = 0x70;
+static const size_t I2C_MM_STATUS = 0x74;
+static const size_t I2C_MM_FIFO_CON0 = 0x78;
+static const size_t I2C_MM_FIFO_DATA = 0x7C;
+
+// MM_CON0[15] enables the master, and MM_CON0[0] starts a transfer. The start bit is cleared by
+// the hardware when the transfer, including its stop condition, has completed.
+static const uint32_t I2C_MM_CON0_MASTER_EN = 1U << 15;
+static const uint32_t I2C_MM_CON0_MM_START = 1U << 0;
+// MM_PACK_CON0[1:0] holds the number of packets less one, and MM_PACK_CON0[4 + n] is set if
+// packet n reads from the target. Consecutive packets are separated by a repeated start.
+static const uint32_t I2C_MM_PACK_CON0_TWO_PACKETS = 1U << 0;
+static const uint32_t I2C_MM_PACK_CON0_RW_PK0 = 1U << 4;
+static const uint32_t I2C_MM_PACK_CON0_RW_PK1 = 1U << 5;
+// MM_STATUS[1] is set if the target did not acknowledge its address or a byte, and MM_STATUS[2]
+// if arbitration was lost. Writing them clears them.
+static const uint32_t I2C_MM_STATUS_NACK_ERR = 1U << 1;
+static const uint32_t I2C_MM_STATUS_ARB_LOST = 1U << 2;
+// MM_FIFO_CON0[0] discards the transmit FIFO, and MM_FIFO_CON0[1] the receive FIFO.
+static const uint32_t I2C_MM_FIFO_CON0_CLEAR = (1U << 0) | (1U << 1);
+
+// The ISU's source clock. Each half of an SCL period lasts this many ticks.
+static const uint32_t I2C_SOURCE_CLOCK_HZ = 26000000;
+static const uint32_t I2C_PHASE_TICKS = I2C_SOURCE_CLOCK_HZ / (2 * I2C_MASTER_BUS_SPEED_HZ);
+
+// A full transfer of both FIFOs takes under 500 microseconds, so a transfer which takes longer
+// than this has stalled, for example because the target is holding SCL low.
+static const uint32_t I2C_TIMEOUT_US = 2000;
+
+static uint32_t failedTransferCount = 0;
+
+static bool FailTransfer(void);
+
+void I2cMaster_Init(void)
+{
+    // Configure the master while it is disabled.
+    WriteReg32(I2C_BASE, I2C_MM_CON0, 0);
+    WriteReg32(I2C_BASE, I2C_INT_CTRL, 0);
+    WriteReg32(I2C_BASE, I2C_MM_CNT_VAL_PHL, I2C_PHASE_TICKS);
+    WriteReg32(I2C_BASE, I2C_MM_CNT_VAL_PHH, I2C_PHASE_TICKS);
+    WriteReg32(I2C_BASE, I2C_MM_FIFO_CON0, I2C_MM_FIFO_CON0_CLEAR);
+    WriteReg32(I2C_BASE, I2C_MM_STATUS, I2C_MM_STATUS_NACK_ERR | I2C_MM_STATUS_ARB_LOST);
+    WriteReg32(I2C_BASE, I2C_MM_CON0, I2C_MM_CON0_MASTER_EN);
+
+    failedTransferCount = 0;
+}
+
+// Counts a failed transfer, and resets the master so that the next transfer starts from a
+// known state.
+static bool FailTransfer(void)
+{
+    uint32_t count = failedTransferCount;
+    I2cMaster_Init();
+    failedTransferCount = count + 1;
+    return false;
+}
+
+bool I2cMaster_WriteThenRead(uint8_t address, const uint8_t *writeData, size_t writeSize,
+                             uint8_t *readData, size_t readSize)
+{
+    if (writeSize > I2C_MASTER_FIFO_SIZE || readSize > I2C_MASTER_FIFO_SIZE ||
+        (writeSize == 0 && readSize == 0)) {
+        return false;
+    }
+
+    WriteReg32(I2C_BASE, I2C_MM_FIFO_CON0, I2C_MM_FIFO_CON0_CLEAR);
+    WriteReg32(I2C_BASE, I2C_MM_SLAVE_ID, address & 0x7F);
+
+    // The write, if there is one, is the first packet, and the read the second.
+    if (writeSize > 0 && readSize > 0) {
+        WriteReg32(I2C_BASE, I2C_MM_CNT_BYTE_VAL_PK0, writeSize);
+        WriteReg32(I2C_BASE, I2C_MM_CNT_BYTE_VAL_PK1, readSize);
+        WriteReg32(I2C_BASE, I2C_MM_PACK_CON0,
+                   I2C_MM_PACK_CON0_TWO_PACKETS | I2C_MM_PACK_CON0_RW_PK1);
+    } else if (writeSize > 0) {
+        WriteReg32(I2C_BASE, I2C_MM_CNT_BYTE_VAL_PK0, writeSize);
+        WriteReg32(I2C_BASE, I2C_MM_PACK_CON0, 0);
+    } else {
+        WriteReg32(I2C_BASE, I2C_MM_CNT_BYTE_VAL_PK0, readSize);
+        WriteReg32(I2C_BASE, I2C_MM_PACK_CON0, I2C_MM_PACK_CON0_RW_PK0);
+    }
+
+    for (size_t i = 0; i < writeSize; ++i) {
+        WriteReg32(I2C_BASE, I2C_MM_FIFO_DATA, writeData[i]);
+    }
+
+    SetReg32(I2C_BASE, I2C_MM_CON0, I2C_MM_CON0_MM_START);
+
+    uint32_t startUs = MT3620_Gpt_ReadMicroseconds();
+    while (ReadReg32(I2C_BASE, I2C_MM_CON0) & I2C_MM_CON0_MM_START) {
+        if (MT3620_Gpt_ReadMicroseconds() - startUs > I2C_TIMEOUT_US) {
+            return FailTransfer();
+        }
+    }
+
+    uint32_t status = ReadReg32(I2C_BASE, I2C_MM_STATUS);
+    if (status & (I2C_MM_STATUS_NACK_ERR | I2C_MM_STATUS_ARB_LOST)) {
+        return FailTransfer();
+    }
+
+    for (size_t i = 0; i < readSize; ++i) {
+        readData[i] = (uint8_t)ReadReg32(I2C_BASE, I2C_MM_FIFO_DATA);
+    }
+
+    return true;
+}
+
+bool I2cMaster_Write(uint8_t address, const uint8_t *data, size_t size)
+{
+    return I2cMaster_WriteThenRead(address, data, size, NULL, 0);
+}
+
+uint32_t I2cMaster_GetFailedTransferCount(void)
+{
+    return failedTransferCount;
+}
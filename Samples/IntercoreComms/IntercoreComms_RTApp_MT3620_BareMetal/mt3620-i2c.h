@@ -0,0 +1,59 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// <summary>
+///     Maximum number of bytes which can be written, and the maximum number which can be read,
+///     in one transfer. This is the depth of the I2C master's FIFO.
+/// </summary>
+#define I2C_MASTER_FIFO_SIZE 8
+
+/// <summary>Bus speed in Hz.</summary>
+#define I2C_MASTER_BUS_SPEED_HZ 400000
+
+/// <summary>
+///     Initialize the ISU0 I2C master at I2C_MASTER_BUS_SPEED_HZ. The application manifest must
+///     list ISU0 in its I2cMaster capability. The transfers are polled, so the ISU interrupt is
+///     not used.
+/// </summary>
+void I2cMaster_Init(void);
+
+/// <summary>
+///     <para>Write bytes to a target, and then read bytes from it after a repeated start
+///     condition, in one transfer. Either part can be empty.</para>
+///     <para>This function waits for the transfer to complete, which takes about 25
+///     microseconds per byte. Call it from the main application thread or from a DPC.</para>
+/// </summary>
+/// <param name="address">7-bit target address.</param>
+/// <param name="writeData">Bytes to write.</param>
+/// <param name="writeSize">Number of bytes to write. Must not exceed
+/// I2C_MASTER_FIFO_SIZE.</param>
+/// <param name="readData">Receives the bytes which are read.</param>
+/// <param name="readSize">Number of bytes to read. Must not exceed I2C_MASTER_FIFO_SIZE.</param>
+/// <returns>true if the transfer completed and the target acknowledged every byte; false if
+/// the sizes are invalid, the target did not acknowledge a byte, or the transfer timed
+/// out.</returns>
+bool I2cMaster_WriteThenRead(uint8_t address, const uint8_t *writeData, size_t writeSize,
+                             uint8_t *readData, size_t readSize);
+
+/// <summary>
+///     Write bytes to a target. This is equivalent to calling
+///     <see cref="I2cMaster_WriteThenRead" /> with nothing to read.
+/// </summary>
+/// <param name="address">7-bit target address.</param>
+/// <param name="data">Bytes to write.</param>
+/// <param name="size">Number of bytes to write. Must not exceed I2C_MASTER_FIFO_SIZE.</param>
+/// <returns>true if the transfer succeeded; false otherwise.</returns>
+bool I2cMaster_Write(uint8_t address, const uint8_t *data, size_t size);
+
+/// <summary>
+///     Gets the number of transfers which failed because the target did not acknowledge a byte
+///     or the transfer timed out.
+/// </summary>
+/// <returns>Number of failed transfers since <see cref="I2cMaster_Init" /> was called.</returns>
+uint32_t I2cMaster_GetFailedTransferCount(void);
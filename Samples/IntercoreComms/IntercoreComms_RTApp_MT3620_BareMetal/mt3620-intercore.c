@@ -5,7 +5,7 @@
 
 #include "mt3620-baremetal.h"
 #include "mt3620-intercore.h"
-#include "mt3620-uart-poll.h"
+#include "mt3620-uart.h"
 
 // Register locations and values.
 static const uint32_t MAILBOX_COMMAND_OUTBOUND_BUFFER = 0xba5e0001;
@@ -50,6 +50,7 @@ void MT3620_SetupIntercoreComm(uint32_t *inboundBase, uint32_t *outboundBase, Ca
     recvCbNode.enqueued = false;
     recvCbNode.next = NULL;
     recvCbNode.cb = recvCallback;
+    recvCbNode.priority = DpcPriority_High;
 
     // Wait for the mailbox to be set up.
     while (true) {
@@ -8,6 +8,18 @@
 
 static const uintptr_t GPT_BASE = 0x21030000;
 
+// GPT3 is a free-running counter. GPT3_CTRL[21:16] is the number of oscillator cycles in one
+// microsecond, less one, so with the 26MHz crystal the counter increments once a microsecond.
+static const size_t GPT3_CTRL = 0x50;
+static const size_t GPT3_CNT = 0x58;
+static const uint32_t GPT3_OSC_CNT_1US = 26 - 1;
+
+// GPTx_CTRL values which start a one-shot timer that is automatically cleared when it expires.
+static const uint32_t GPT_CTRL_ONE_SHOT_1KHZ = 0x9;
+static const uint32_t GPT_CTRL_ONE_SHOT_32KHZ = 0x1;
+
+static void LaunchTimer(TimerGpt gpt, uint32_t count, uint32_t ctrl, Callback callback);
+
 static volatile Callback timerCallbacks[TIMER_GPT_COUNT] = {[TimerGpt0] = NULL, [TimerGpt1] = NULL};
 
 typedef struct {
@@ -27,6 +39,9 @@ void MT3620_Gpt_Init(void)
     // IO CM4 GPT0 timer and GPT1 timer interrupt both use INT1.
     SetNvicPriority(1, GPT_PRIORITY);
     EnableNvicInterrupt(1);
+
+    // Start the free-running microsecond counter.
+    WriteReg32(GPT_BASE, GPT3_CTRL, (GPT3_OSC_CNT_1US << 16) | 0x01);
 }
 
 void MT3620_Gpt_HandleIrq1(void)
@@ -47,6 +62,24 @@ void MT3620_Gpt_HandleIrq1(void)
 }
 
 void MT3620_Gpt_LaunchTimerMs(TimerGpt gpt, uint32_t periodMs, Callback callback)
+{
+    // GPTx_ICNT = delay in milliseconds (assuming 1KHz clock in GPTx_CTRL).
+    // Note 1KHz is approximate - the precise value depends on the clock source,
+    // but it will be 0.99kHz to 2 decimal places.
+    LaunchTimer(gpt, periodMs, GPT_CTRL_ONE_SHOT_1KHZ, callback);
+}
+
+void MT3620_Gpt_LaunchTimer32k(TimerGpt gpt, uint32_t ticks, Callback callback)
+{
+    LaunchTimer(gpt, ticks, GPT_CTRL_ONE_SHOT_32KHZ, callback);
+}
+
+uint32_t MT3620_Gpt_ReadMicroseconds(void)
+{
+    return ReadReg32(GPT_BASE, GPT3_CNT);
+}
+
+static void LaunchTimer(TimerGpt gpt, uint32_t count, uint32_t ctrl, Callback callback)
 {
     timerCallbacks[gpt] = callback;
 
@@ -64,11 +97,9 @@ void MT3620_Gpt_LaunchTimerMs(TimerGpt gpt, uint32_t periodMs, Callback callback
     SetReg32(GPT_BASE, 0x04, mask);
     RestoreIrqs(prevBasePri);
 
-    // GPTx_ICNT = delay in milliseconds (assuming 1KHz clock in GPTx_CTRL).
-    // Note 1KHz is approximate - the precise value depends on the clock source,
-    // but it will be 0.99kHz to 2 decimal places.
-    WriteReg32(GPT_BASE, gptRegOffsets[gpt].icntRegOffset, periodMs);
+    // GPTx_ICNT = delay in ticks of the clock which is selected in GPTx_CTRL.
+    WriteReg32(GPT_BASE, gptRegOffsets[gpt].icntRegOffset, count);
 
-    // GPTx_CTRL -> auto clear; 1kHz, one shot, enable timer.
-    WriteReg32(GPT_BASE, gptRegOffsets[gpt].ctrlRegOffset, 0x9);
+    // GPTx_CTRL -> auto clear; clock speed, one shot, enable timer.
+    WriteReg32(GPT_BASE, gptRegOffsets[gpt].ctrlRegOffset, ctrl);
 }
@@ -60,3 +60,27 @@ void MT3620_Gpt_HandleIrq1(void);
 /// <param name="periodMs">Period in milliseconds.</param>
 /// <param name="callback">Function to invoke in interrupt context when the timer expires.</param>
 void MT3620_Gpt_LaunchTimerMs(TimerGpt gpt, uint32_t periodMs, Callback callback);
+
+/// <summary>
+///     Frequency in Hz of the clock which is used by <see cref="Gpt_LaunchTimer32k" />.
+/// </summary>
+#define TIMER_GPT_32K_HZ 32768
+
+/// <summary>
+///     <para>
+///         Register a callback for the supplied timer, with a delay which is measured in ticks
+///         of the 32kHz clock rather than in milliseconds. This behaves in the same way as
+///         <see cref="Gpt_LaunchTimerMs" />, but has a resolution of about 30 microseconds.
+///     </para>
+/// </summary>
+/// <param name="gpt">Which hardware timer to use.</param>
+/// <param name="ticks">Delay in ticks of a TIMER_GPT_32K_HZ clock. Must be non-zero.</param>
+/// <param name="callback">Function to invoke in interrupt context when the timer expires.</param>
+void MT3620_Gpt_LaunchTimer32k(TimerGpt gpt, uint32_t ticks, Callback callback);
+
+/// <summary>
+///     Reads the free-running microsecond counter, which is started by
+///     <see cref="Gpt_Init" />. The counter wraps around after 2^32 microseconds.
+/// </summary>
+/// <returns>Number of microseconds since the counter was started, modulo 2^32.</returns>
+uint32_t MT3620_Gpt_ReadMicroseconds(void);
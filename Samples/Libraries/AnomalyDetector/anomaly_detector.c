@@ -0,0 +1,227 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <math.h>
+#include <string.h>
+
+#include "anomaly_detector.h"
+
+static void ResetWindow(AnomalyDetector *detector)
+{
+    for (size_t c = 0; c < detector->channelCount; ++c) {
+        AnomalyDetector_Welford *stats = &detector->window[c];
+        stats->mean = 0.0;
+        stats->m2 = 0.0;
+        stats->min = INT16_MAX;
+        stats->max = INT16_MIN;
+    }
+
+    detector->windowFrames = 0;
+    detector->windowAnomalies = 0;
+    detector->windowCaptures = 0;
+    detector->windowPeakScore = 0.0f;
+    detector->windowDisturbed = detector->capturing;
+}
+
+/// <summary>
+///     Reports the current window, and makes it the baseline unless a capture disturbed it, so
+///     that the baseline follows slow changes but does not learn the anomalies. If the previous
+///     window was disturbed too, the anomaly has lasted, so it is learned.
+/// </summary>
+static void FinishWindow(AnomalyDetector *detector)
+{
+    bool learn = !detector->windowDisturbed || detector->previousWindowDisturbed;
+
+    AnomalyDetector_Summary summary = {.frameCount = detector->windowFrames,
+                                       .anomalousFrames = detector->windowAnomalies,
+                                       .captures = detector->windowCaptures,
+                                       .peakScore = sqrtf(detector->windowPeakScore)};
+
+    float minVariance = detector->config.minDeviation * detector->config.minDeviation;
+    float ewmaVarianceScale = 1.0f;
+    if (detector->config.method == AnomalyDetector_Method_Ewma) {
+        // The variance of an EWMA of independent samples is w / (2 - w) of theirs.
+        ewmaVarianceScale = detector->config.ewmaWeight / (2.0f - detector->config.ewmaWeight);
+    }
+
+    for (size_t c = 0; c < detector->channelCount; ++c) {
+        const AnomalyDetector_Welford *stats = &detector->window[c];
+        float variance = (float)(stats->m2 / detector->windowFrames);
+        summary.channels[c].mean = (float)stats->mean;
+        summary.channels[c].deviation = sqrtf(variance);
+        summary.channels[c].min = stats->min;
+        summary.channels[c].max = stats->max;
+
+        if (learn) {
+            if (!detector->hasBaseline) {
+                detector->ewma[c] = (float)stats->mean;
+            }
+            if (variance < minVariance) {
+                variance = minVariance;
+            }
+            detector->baselineMean[c] = (float)stats->mean;
+            detector->baselineScale[c] = 1.0f / (variance * ewmaVarianceScale);
+        }
+    }
+
+    if (learn) {
+        detector->hasBaseline = true;
+    }
+    detector->previousWindowDisturbed = detector->windowDisturbed && !learn;
+
+    ResetWindow(detector);
+    detector->summaryHandler(&summary, detector->context);
+}
+
+/// <summary>
+///     Copies the frames of the pending capture out of the history, oldest first, and hands
+///     them to the application.
+/// </summary>
+static void FinishCapture(AnomalyDetector *detector)
+{
+    size_t channels = detector->channelCount;
+    size_t frameCount = detector->triggerFrames + detector->config.postTriggerFrames;
+    size_t start = (detector->historyNext + ANOMALY_DETECTOR_MAX_CAPTURE_FRAMES - frameCount) %
+                   ANOMALY_DETECTOR_MAX_CAPTURE_FRAMES;
+
+    // The history is a ring, so the frames are in at most two pieces.
+    size_t firstPiece = ANOMALY_DETECTOR_MAX_CAPTURE_FRAMES - start;
+    if (firstPiece > frameCount) {
+        firstPiece = frameCount;
+    }
+    memcpy(detector->capture, &detector->history[start * channels],
+           firstPiece * channels * sizeof(int16_t));
+    memcpy(&detector->capture[firstPiece * channels], detector->history,
+           (frameCount - firstPiece) * channels * sizeof(int16_t));
+
+    AnomalyDetector_Capture capture = {.frames = detector->capture,
+                                       .frameCount = frameCount,
+                                       .triggerIndex = detector->triggerFrames - 1,
+                                       .triggerChannel = detector->triggerChannel,
+                                       .score = detector->triggerScore};
+
+    detector->capturing = false;
+    detector->framesRemaining = detector->config.holdoffFrames;
+    detector->captureHandler(&capture, detector->context);
+}
+
+/// <summary>
+///     Returns the square of the greatest score of any channel in a frame, and which channel
+///     it was. The squares are compared so that no square root is taken for each frame.
+/// </summary>
+static float ScoreFrame(AnomalyDetector *detector, const int16_t *frame, size_t *channel)
+{
+    float peak = 0.0f;
+    for (size_t c = 0; c < detector->channelCount; ++c) {
+        float value = frame[c];
+        if (detector->config.method == AnomalyDetector_Method_Ewma) {
+            detector->ewma[c] += detector->config.ewmaWeight * (value - detector->ewma[c]);
+            value = detector->ewma[c];
+        }
+
+        float difference = value - detector->baselineMean[c];
+        float scoreSquared = difference * difference * detector->baselineScale[c];
+        if (scoreSquared > peak) {
+            peak = scoreSquared;
+            *channel = c;
+        }
+    }
+
+    return peak;
+}
+
+static void AddFrame(AnomalyDetector *detector, const int16_t *frame)
+{
+    size_t channels = detector->channelCount;
+    memcpy(&detector->history[detector->historyNext * channels], frame,
+           channels * sizeof(int16_t));
+    detector->historyNext = (detector->historyNext + 1) % ANOMALY_DETECTOR_MAX_CAPTURE_FRAMES;
+    if (detector->historyCount < ANOMALY_DETECTOR_MAX_CAPTURE_FRAMES) {
+        ++detector->historyCount;
+    }
+
+    if (detector->hasBaseline) {
+        size_t channel = 0;
+        float scoreSquared = ScoreFrame(detector, frame, &channel);
+        if (scoreSquared > detector->windowPeakScore) {
+            detector->windowPeakScore = scoreSquared;
+        }
+
+        if (scoreSquared > detector->thresholdSquared) {
+            ++detector->windowAnomalies;
+            if (!detector->capturing && detector->framesRemaining == 0) {
+                size_t preTrigger = detector->config.preTriggerFrames + 1;
+                detector->capturing = true;
+                detector->windowDisturbed = true;
+                detector->framesRemaining = detector->config.postTriggerFrames + 1;
+                detector->triggerFrames =
+                    detector->historyCount < preTrigger ? detector->historyCount : preTrigger;
+                detector->triggerChannel = channel;
+                detector->triggerScore = sqrtf(scoreSquared);
+                ++detector->windowCaptures;
+            }
+        }
+
+        // The trigger frame is counted here too, so that a capture with no post-trigger frames
+        // finishes at once.
+        if (detector->framesRemaining > 0) {
+            --detector->framesRemaining;
+            if (detector->capturing && detector->framesRemaining == 0) {
+                FinishCapture(detector);
+            }
+        }
+    }
+
+    // Welford's algorithm, which does not lose precision as the window grows, as a sum of
+    // squares does.
+    uint32_t n = ++detector->windowFrames;
+    for (size_t c = 0; c < channels; ++c) {
+        AnomalyDetector_Welford *stats = &detector->window[c];
+        double delta = frame[c] - stats->mean;
+        stats->mean += delta / n;
+        stats->m2 += delta * (frame[c] - stats->mean);
+        if (frame[c] < stats->min) {
+            stats->min = frame[c];
+        }
+        if (frame[c] > stats->max) {
+            stats->max = frame[c];
+        }
+    }
+
+    if (n == detector->config.framesPerWindow) {
+        FinishWindow(detector);
+    }
+}
+
+int AnomalyDetector_Init(AnomalyDetector *detector, size_t channelCount,
+                         const AnomalyDetector_Config *config,
+                         AnomalyDetector_SummaryHandler summaryHandler,
+                         AnomalyDetector_CaptureHandler captureHandler, void *context)
+{
+    if (channelCount == 0 || channelCount > ANOMALY_DETECTOR_MAX_CHANNELS ||
+        config->threshold <= 0.0f || config->framesPerWindow < 2 ||
+        (size_t)config->preTriggerFrames + 1 + config->postTriggerFrames >
+            ANOMALY_DETECTOR_MAX_CAPTURE_FRAMES ||
+        (config->method == AnomalyDetector_Method_Ewma &&
+         !(config->ewmaWeight > 0.0f && config->ewmaWeight <= 1.0f))) {
+        return -1;
+    }
+
+    memset(detector, 0, sizeof(*detector));
+    detector->config = *config;
+    detector->channelCount = channelCount;
+    detector->summaryHandler = summaryHandler;
+    detector->captureHandler = captureHandler;
+    detector->context = context;
+    detector->thresholdSquared = config->threshold * config->threshold;
+    ResetWindow(detector);
+    return 0;
+}
+
+void AnomalyDetector_AddFrames(AnomalyDetector *detector, const int16_t *frames,
+                               size_t frameCount)
+{
+    for (size_t i = 0; i < frameCount; ++i) {
+        AddFrame(detector, &frames[i * detector->channelCount]);
+    }
+}
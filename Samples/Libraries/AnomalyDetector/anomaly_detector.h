@@ -0,0 +1,202 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// The anomaly detector decides which parts of a high-rate sensor stream are worth sending. It
+// keeps the mean and variance of each channel over a window of frames with Welford's algorithm,
+// and reports a summary of each window. Each frame is compared with the statistics of the last
+// quiet window; when a channel is further from its mean than a configured number of standard
+// deviations, the detector captures the frames around it, at full resolution, and hands them to
+// the application. Everything else is reduced to the summaries. A change which lasts for two
+// windows becomes the new baseline, so it is captured once rather than continually.
+//
+// Frames are arrays of 16-bit values, one for each channel, such as the axes of an
+// accelerometer in milli-g or ADC counts. The detector never allocates memory.
+
+/// <summary>Maximum number of channels in each frame.</summary>
+#define ANOMALY_DETECTOR_MAX_CHANNELS 4
+
+/// <summary>Maximum number of frames in a capture, including the one which triggered it.</summary>
+#define ANOMALY_DETECTOR_MAX_CAPTURE_FRAMES 256
+
+/// <summary>How a frame is compared with the baseline.</summary>
+typedef enum {
+    /// <summary>Each sample is compared with the baseline, which detects short events such as a
+    /// shock or a spike.</summary>
+    AnomalyDetector_Method_ZScore = 0,
+    /// <summary>An exponentially weighted moving average of the samples is compared with the
+    /// baseline, which detects a small but sustained shift, such as an offset or a change in
+    /// vibration, and ignores single outliers.</summary>
+    AnomalyDetector_Method_Ewma = 1
+} AnomalyDetector_Method;
+
+/// <summary>Configuration of a detector.</summary>
+typedef struct {
+    AnomalyDetector_Method method;
+    /// <summary>A frame triggers a capture when the score of any channel, which is its distance
+    /// from the baseline mean in standard deviations, is greater than this.</summary>
+    float threshold;
+    /// <summary>Weight of each new sample in the moving average, between 0 and 1, for
+    /// AnomalyDetector_Method_Ewma. The standard deviation of the average is scaled to
+    /// match.</summary>
+    float ewmaWeight;
+    /// <summary>Smallest standard deviation which is assumed for a channel, in the units of its
+    /// samples, so that a quiet sensor does not trigger on its own quantization noise.</summary>
+    float minDeviation;
+    /// <summary>Number of frames in each summary window. The first window is the first
+    /// baseline, so nothing is detected until it completes.</summary>
+    uint32_t framesPerWindow;
+    /// <summary>Number of frames before the trigger which are included in a capture.</summary>
+    uint32_t preTriggerFrames;
+    /// <summary>Number of frames after the trigger which are included in a capture.
+    /// preTriggerFrames + 1 + postTriggerFrames must not exceed
+    /// ANOMALY_DETECTOR_MAX_CAPTURE_FRAMES.</summary>
+    uint32_t postTriggerFrames;
+    /// <summary>Number of frames after a capture during which no new capture is triggered, which
+    /// limits how much a continuing anomaly sends.</summary>
+    uint32_t holdoffFrames;
+} AnomalyDetector_Config;
+
+/// <summary>Statistics of one channel over a window.</summary>
+typedef struct {
+    float mean;
+    float deviation;
+    int16_t min;
+    int16_t max;
+} AnomalyDetector_ChannelSummary;
+
+/// <summary>Summary of a window of frames.</summary>
+typedef struct {
+    /// <summary>Number of frames in the window.</summary>
+    uint32_t frameCount;
+    /// <summary>Number of frames in the window whose score exceeded the threshold, whether or
+    /// not they triggered a capture.</summary>
+    uint32_t anomalousFrames;
+    /// <summary>Number of captures which were triggered in the window.</summary>
+    uint32_t captures;
+    /// <summary>Greatest score of any frame in the window, or 0 before there is a
+    /// baseline.</summary>
+    float peakScore;
+    AnomalyDetector_ChannelSummary channels[ANOMALY_DETECTOR_MAX_CHANNELS];
+} AnomalyDetector_Summary;
+
+/// <summary>A captured anomaly.</summary>
+typedef struct {
+    /// <summary>Frames, each of which holds one sample of every channel, oldest first.</summary>
+    const int16_t *frames;
+    /// <summary>Number of frames. It is less than the configured pre-trigger and post-trigger
+    /// frames if fewer frames had arrived before the trigger.</summary>
+    size_t frameCount;
+    /// <summary>Index in frames of the frame which triggered the capture.</summary>
+    size_t triggerIndex;
+    /// <summary>Channel whose score triggered the capture.</summary>
+    size_t triggerChannel;
+    /// <summary>Score of the trigger.</summary>
+    float score;
+} AnomalyDetector_Capture;
+
+/// <summary>
+///     Function which is called when a window completes.
+/// </summary>
+/// <param name="summary">Summary of the window, which is only valid during the call.</param>
+/// <param name="context">Context which was supplied to AnomalyDetector_Init.</param>
+typedef void (*AnomalyDetector_SummaryHandler)(const AnomalyDetector_Summary *summary,
+                                               void *context);
+
+/// <summary>
+///     Function which is called when the frames after a trigger have arrived.
+/// </summary>
+/// <param name="capture">The capture, which is only valid during the call.</param>
+/// <param name="context">Context which was supplied to AnomalyDetector_Init.</param>
+typedef void (*AnomalyDetector_CaptureHandler)(const AnomalyDetector_Capture *capture,
+                                               void *context);
+
+/// <summary>
+///     Running mean and variance of one channel, with Welford's algorithm. The client should not
+///     directly modify member variables.
+/// </summary>
+typedef struct {
+    double mean;
+    /// <summary>Sum of the squared differences from the mean.</summary>
+    double m2;
+    int16_t min;
+    int16_t max;
+} AnomalyDetector_Welford;
+
+/// <summary>
+///     State of a detector. The client should not directly modify member variables.
+/// </summary>
+typedef struct {
+    AnomalyDetector_Config config;
+    size_t channelCount;
+    AnomalyDetector_SummaryHandler summaryHandler;
+    AnomalyDetector_CaptureHandler captureHandler;
+    void *context;
+
+    /// <summary>Statistics of the current window.</summary>
+    AnomalyDetector_Welford window[ANOMALY_DETECTOR_MAX_CHANNELS];
+    uint32_t windowFrames;
+    uint32_t windowAnomalies;
+    uint32_t windowCaptures;
+    float windowPeakScore;
+
+    /// <summary>Whether a capture was triggered or in progress during the current window, which
+    /// keeps the window from becoming the baseline unless the previous one was too.</summary>
+    bool windowDisturbed;
+    bool previousWindowDisturbed;
+
+    /// <summary>Mean of each channel in the baseline window.</summary>
+    float baselineMean[ANOMALY_DETECTOR_MAX_CHANNELS];
+    /// <summary>Reciprocal of the variance of each channel in the baseline, scaled for the
+    /// method, so that the square of a score is a multiplication.</summary>
+    float baselineScale[ANOMALY_DETECTOR_MAX_CHANNELS];
+    bool hasBaseline;
+    float thresholdSquared;
+    float ewma[ANOMALY_DETECTOR_MAX_CHANNELS];
+
+    /// <summary>The latest frames, in a ring, from which captures are taken.</summary>
+    int16_t history[ANOMALY_DETECTOR_MAX_CAPTURE_FRAMES * ANOMALY_DETECTOR_MAX_CHANNELS];
+    size_t historyNext;
+    size_t historyCount;
+    /// <summary>Frames of a completed capture, oldest first.</summary>
+    int16_t capture[ANOMALY_DETECTOR_MAX_CAPTURE_FRAMES * ANOMALY_DETECTOR_MAX_CHANNELS];
+
+    bool capturing;
+    /// <summary>While capturing, the number of frames which are still to arrive; otherwise the
+    /// number of frames before a new capture can be triggered.</summary>
+    uint32_t framesRemaining;
+    /// <summary>Number of frames in the pending capture up to and including the trigger.</summary>
+    size_t triggerFrames;
+    size_t triggerChannel;
+    float triggerScore;
+} AnomalyDetector;
+
+/// <summary>
+///     Initializes a detector.
+/// </summary>
+/// <param name="detector">Detector to initialize.</param>
+/// <param name="channelCount">Number of channels in each frame, from 1 to
+///     ANOMALY_DETECTOR_MAX_CHANNELS.</param>
+/// <param name="config">Configuration, which is copied.</param>
+/// <param name="summaryHandler">Function which is called when a window completes.</param>
+/// <param name="captureHandler">Function which is called with each capture.</param>
+/// <param name="context">Context which is passed to the handlers.</param>
+/// <returns>0 on success; -1 if the configuration is not valid.</returns>
+int AnomalyDetector_Init(AnomalyDetector *detector, size_t channelCount,
+                         const AnomalyDetector_Config *config,
+                         AnomalyDetector_SummaryHandler summaryHandler,
+                         AnomalyDetector_CaptureHandler captureHandler, void *context);
+
+/// <summary>
+///     Adds frames to the detector, which may call the handlers before it returns.
+/// </summary>
+/// <param name="detector">Detector initialized with AnomalyDetector_Init.</param>
+/// <param name="frames">Frames, each of which holds one sample of every channel.</param>
+/// <param name="frameCount">Number of frames.</param>
+void AnomalyDetector_AddFrames(AnomalyDetector *detector, const int16_t *frames,
+                               size_t frameCount);
@@ -0,0 +1,516 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+#include <sys/types.h>
+
+#include <applibs/log.h>
+
+#include "async_log.h"
+
+// Size of the buffer into which one message is formatted. Longer messages are truncated.
+#define LINE_BUFFER_SIZE 256
+
+// Size of the buffer which collects formatted messages, so that several are written with one call
+// to Log_Debug.
+#define OUTPUT_BUFFER_SIZE 1024
+
+// Size of the buffer into which one conversion specification is rebuilt before it is formatted.
+#define SPEC_BUFFER_SIZE 32
+
+// A message which is waiting to be written. The types of the arguments are not stored; they are
+// found again from the format string when the message is formatted.
+typedef union {
+    intmax_t signedValue;
+    uintmax_t unsignedValue;
+    double doubleValue;
+    const void *pointerValue;
+    size_t stringOffset; // Offset in the record's strings of a copied %s argument.
+} Argument;
+
+typedef struct {
+    const char *format;
+    uint32_t suppressed; // Messages from the same site which were suppressed before this one.
+    Argument arguments[ASYNC_LOG_MAX_ARGS];
+    char strings[ASYNC_LOG_STRING_SPACE];
+} Record;
+
+// A conversion specification in a format string, such as "%-8.*lu".
+typedef struct {
+    const char *start; // The '%'.
+    const char *end;   // The character after the conversion.
+    const char *flags;
+    size_t flagsLength;
+    bool widthStar;
+    const char *width;
+    size_t widthLength;
+    bool hasPrecision;
+    bool precisionStar;
+    const char *precision;
+    size_t precisionLength;
+    char lengthModifier; // 0, or one of "hlLjzt"; 'H' for "hh" and 'q' for "ll".
+    char conversion;
+} Specification;
+
+static Record records[ASYNC_LOG_RECORD_COUNT];
+static size_t firstRecord = 0;
+static size_t recordCount = 0;
+static uint32_t droppedCount = 0;
+
+static EventLoop *drainEventLoop = NULL;
+static int timerFd = -1;
+static EventRegistration *timerRegistration = NULL;
+static bool drainScheduled = false;
+
+static uint64_t NowMs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + (uint64_t)now.tv_nsec / 1000000;
+}
+
+static size_t SpanOf(const char *s, const char *accept)
+{
+    return strspn(s, accept);
+}
+
+// Finds the next conversion specification in a format string. Returns false if there are no more,
+// or if the specification is incomplete.
+static bool FindSpecification(const char *format, Specification *spec)
+{
+    const char *p = strchr(format, '%');
+    if (p == NULL) {
+        return false;
+    }
+
+    memset(spec, 0, sizeof(*spec));
+    spec->start = p++;
+
+    spec->flags = p;
+    spec->flagsLength = SpanOf(p, "-+ #0");
+    p += spec->flagsLength;
+
+    spec->width = p;
+    if (*p == '*') {
+        spec->widthStar = true;
+        ++p;
+    } else {
+        spec->widthLength = SpanOf(p, "0123456789");
+        p += spec->widthLength;
+    }
+
+    if (*p == '.') {
+        spec->hasPrecision = true;
+        spec->precision = ++p;
+        if (*p == '*') {
+            spec->precisionStar = true;
+            ++p;
+        } else {
+            spec->precisionLength = SpanOf(p, "0123456789");
+            p += spec->precisionLength;
+        }
+    }
+
+    if ((p[0] == 'h' && p[1] == 'h') || (p[0] == 'l' && p[1] == 'l')) {
+        spec->lengthModifier = (p[0] == 'h') ? 'H' : 'q';
+        p += 2;
+    } else if (*p != '\0' && strchr("hlLjzt", *p) != NULL) {
+        spec->lengthModifier = *p++;
+    }
+
+    spec->conversion = *p;
+    if (spec->conversion == '\0') {
+        return false;
+    }
+
+    spec->end = p + 1;
+    return true;
+}
+
+static size_t ArgumentCount(const Specification *spec)
+{
+    size_t count = (spec->widthStar ? 1 : 0) + (spec->precisionStar ? 1 : 0);
+    return (spec->conversion == '%') ? count : count + 1;
+}
+
+static intmax_t ReadSigned(char lengthModifier, va_list *args)
+{
+    switch (lengthModifier) {
+    case 'l':
+        return va_arg(*args, long);
+    case 'q':
+        return va_arg(*args, long long);
+    case 'j':
+        return va_arg(*args, intmax_t);
+    case 'z':
+        return va_arg(*args, ssize_t);
+    case 't':
+        return va_arg(*args, ptrdiff_t);
+    default:
+        return va_arg(*args, int);
+    }
+}
+
+static uintmax_t ReadUnsigned(char lengthModifier, va_list *args)
+{
+    switch (lengthModifier) {
+    case 'l':
+        return va_arg(*args, unsigned long);
+    case 'q':
+        return va_arg(*args, unsigned long long);
+    case 'j':
+        return va_arg(*args, uintmax_t);
+    case 'z':
+        return va_arg(*args, size_t);
+    case 't':
+        return (uintmax_t)va_arg(*args, ptrdiff_t);
+    case 'H':
+        return (unsigned char)va_arg(*args, unsigned int);
+    case 'h':
+        return (unsigned short)va_arg(*args, unsigned int);
+    default:
+        return va_arg(*args, unsigned int);
+    }
+}
+
+// Copies a message's arguments into a record. Returns false if the message cannot be deferred,
+// because it has too many arguments or uses conversions which are not supported.
+static bool CaptureArguments(Record *record, const char *format, va_list *args)
+{
+    size_t argumentIndex = 0;
+    size_t stringsUsed = 0;
+    Specification spec;
+
+    while (FindSpecification(format, &spec)) {
+        format = spec.end;
+        if (argumentIndex + ArgumentCount(&spec) > ASYNC_LOG_MAX_ARGS) {
+            return false;
+        }
+
+        if (spec.widthStar) {
+            record->arguments[argumentIndex++].signedValue = va_arg(*args, int);
+        }
+        if (spec.precisionStar) {
+            record->arguments[argumentIndex++].signedValue = va_arg(*args, int);
+        }
+
+        Argument *argument = &record->arguments[argumentIndex];
+        switch (spec.conversion) {
+        case '%':
+            continue;
+        case 'd':
+        case 'i':
+            argument->signedValue = ReadSigned(spec.lengthModifier, args);
+            break;
+        case 'o':
+        case 'u':
+        case 'x':
+        case 'X':
+            argument->unsignedValue = ReadUnsigned(spec.lengthModifier, args);
+            break;
+        case 'c':
+            if (spec.lengthModifier != 0) {
+                return false;
+            }
+            argument->signedValue = va_arg(*args, int);
+            break;
+        case 'e':
+        case 'E':
+        case 'f':
+        case 'F':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+            argument->doubleValue = (spec.lengthModifier == 'L')
+                                        ? (double)va_arg(*args, long double)
+                                        : va_arg(*args, double);
+            break;
+        case 'p':
+            argument->pointerValue = va_arg(*args, const void *);
+            break;
+        case 's': {
+            if (spec.lengthModifier != 0) {
+                return false;
+            }
+            const char *s = va_arg(*args, const char *);
+            if (s == NULL) {
+                s = "(null)";
+            }
+            // The copy is truncated to the space which remains, and always terminated.
+            size_t length = strnlen(s, sizeof(record->strings) - stringsUsed - 1);
+            memcpy(&record->strings[stringsUsed], s, length);
+            record->strings[stringsUsed + length] = '\0';
+            argument->stringOffset = stringsUsed;
+            stringsUsed += length + (stringsUsed + length + 1 < sizeof(record->strings) ? 1 : 0);
+            break;
+        }
+        default:
+            return false;
+        }
+
+        ++argumentIndex;
+    }
+
+    return true;
+}
+
+// Rebuilds a conversion specification with the values of any * arguments, and with the length
+// modifier which matches the type in which its argument was stored.
+static void BuildSpecification(const Specification *spec, const Argument *arguments,
+                               char *buffer, size_t size)
+{
+    char lengthModifier[2] = {0, 0};
+    if (strchr("diouxX", spec->conversion) != NULL) {
+        lengthModifier[0] = 'j';
+    }
+
+    char width[16] = {0};
+    if (spec->widthStar) {
+        snprintf(width, sizeof(width), "%jd", (*arguments++).signedValue);
+    } else {
+        snprintf(width, sizeof(width), "%.*s", (int)spec->widthLength, spec->width);
+    }
+
+    char precision[16] = {0};
+    if (spec->precisionStar) {
+        snprintf(precision, sizeof(precision), ".%jd", arguments->signedValue);
+    } else if (spec->hasPrecision) {
+        snprintf(precision, sizeof(precision), ".%.*s", (int)spec->precisionLength,
+                 spec->precision);
+    }
+
+    snprintf(buffer, size, "%%%.*s%s%s%s%c", (int)spec->flagsLength, spec->flags, width,
+             precision, lengthModifier, spec->conversion);
+}
+
+static size_t Append(char *buffer, size_t size, size_t length, int written)
+{
+    if (written < 0) {
+        return length;
+    }
+    length += (size_t)written;
+    return (length < size) ? length : size - 1;
+}
+
+// Formats a record into a buffer, and returns the length of the formatted message.
+static size_t FormatRecord(const Record *record, char *buffer, size_t size)
+{
+    size_t length = 0;
+    if (record->suppressed > 0) {
+        length = Append(buffer, size, length,
+                        snprintf(buffer, size, "(%u similar messages suppressed) ",
+                                 record->suppressed));
+    }
+
+    const char *format = record->format;
+    size_t argumentIndex = 0;
+    Specification spec;
+    while (FindSpecification(format, &spec)) {
+        length = Append(buffer, size, length,
+                        snprintf(&buffer[length], size - length, "%.*s",
+                                 (int)(spec.start - format), format));
+        format = spec.end;
+
+        if (spec.conversion == '%') {
+            length = Append(buffer, size, length, snprintf(&buffer[length], size - length, "%%"));
+            continue;
+        }
+
+        char specBuffer[SPEC_BUFFER_SIZE];
+        BuildSpecification(&spec, &record->arguments[argumentIndex], specBuffer,
+                           sizeof(specBuffer));
+        argumentIndex += ArgumentCount(&spec) - 1;
+
+        const Argument *argument = &record->arguments[argumentIndex++];
+        char *out = &buffer[length];
+        size_t remaining = size - length;
+        int written;
+        switch (spec.conversion) {
+        case 'd':
+        case 'i':
+            written = snprintf(out, remaining, specBuffer, argument->signedValue);
+            break;
+        case 'c':
+            written = snprintf(out, remaining, specBuffer, (int)argument->signedValue);
+            break;
+        case 'o':
+        case 'u':
+        case 'x':
+        case 'X':
+            written = snprintf(out, remaining, specBuffer, argument->unsignedValue);
+            break;
+        case 'p':
+            written = snprintf(out, remaining, specBuffer, argument->pointerValue);
+            break;
+        case 's':
+            written =
+                snprintf(out, remaining, specBuffer, &record->strings[argument->stringOffset]);
+            break;
+        default:
+            written = snprintf(out, remaining, specBuffer, argument->doubleValue);
+            break;
+        }
+        length = Append(buffer, size, length, written);
+    }
+
+    return Append(buffer, size, length, snprintf(&buffer[length], size - length, "%s", format));
+}
+
+static void ScheduleDrain(void)
+{
+    if (drainScheduled) {
+        return;
+    }
+
+    struct itimerspec delay = {.it_value = {.tv_sec = 0,
+                                            .tv_nsec = ASYNC_LOG_DRAIN_DELAY_MS * 1000000L}};
+    if (timerfd_settime(timerFd, /* flags */ 0, &delay, /* old_value */ NULL) == -1) {
+        // Without the timer, the messages are written as they are logged.
+        AsyncLog_Flush();
+        return;
+    }
+
+    drainScheduled = true;
+}
+
+// This satisfies the EventLoopIoCallback signature.
+static void DrainTimerCallback(EventLoop *el, int fd, EventLoop_IoEvents events, void *context)
+{
+    uint64_t timerData = 0;
+    if (read(timerFd, &timerData, sizeof(timerData)) == -1 && errno != EAGAIN) {
+        Log_Debug("ERROR: Could not read timerfd %s (%d).\n", strerror(errno), errno);
+    }
+
+    drainScheduled = false;
+    AsyncLog_Flush();
+}
+
+void AsyncLog_Flush(void)
+{
+    static char output[OUTPUT_BUFFER_SIZE];
+    size_t outputLength = 0;
+
+    while (recordCount > 0 || droppedCount > 0) {
+        char line[LINE_BUFFER_SIZE];
+        size_t lineLength;
+        if (recordCount > 0) {
+            lineLength = FormatRecord(&records[firstRecord], line, sizeof(line));
+            firstRecord = (firstRecord + 1) % ASYNC_LOG_RECORD_COUNT;
+            --recordCount;
+        } else {
+            // The dropped messages were logged after all the waiting ones.
+            lineLength = (size_t)snprintf(line, sizeof(line),
+                                          "WARNING: Log full; dropped %u messages.\n",
+                                          droppedCount);
+            droppedCount = 0;
+        }
+
+        if (outputLength + lineLength >= sizeof(output)) {
+            Log_Debug("%s", output);
+            outputLength = 0;
+        }
+        memcpy(&output[outputLength], line, lineLength + 1);
+        outputLength += lineLength;
+    }
+
+    if (outputLength > 0) {
+        Log_Debug("%s", output);
+    }
+}
+
+void AsyncLog_Write(AsyncLog_Site *site, const char *format, ...)
+{
+    uint64_t nowMs = NowMs();
+    if (nowMs - site->windowStartMs >= 1000) {
+        site->windowStartMs = nowMs;
+        site->windowCount = 0;
+    }
+    if (site->windowCount >= ASYNC_LOG_RATE_LIMIT_PER_SECOND) {
+        ++site->suppressed;
+        return;
+    }
+    ++site->windowCount;
+
+    va_list args;
+    va_start(args, format);
+
+    if (timerRegistration == NULL) {
+        Log_DebugVarArgs(format, args);
+        goto done;
+    }
+
+    if (recordCount == ASYNC_LOG_RECORD_COUNT) {
+        ++droppedCount;
+        goto done;
+    }
+
+    Record *record = &records[(firstRecord + recordCount) % ASYNC_LOG_RECORD_COUNT];
+    va_list capturedArgs;
+    va_copy(capturedArgs, args);
+    bool captured = CaptureArguments(record, format, &capturedArgs);
+    va_end(capturedArgs);
+
+    if (!captured) {
+        // Write the message now, after the waiting messages, so that the order is kept.
+        AsyncLog_Flush();
+        Log_DebugVarArgs(format, args);
+        goto done;
+    }
+
+    record->format = format;
+    record->suppressed = site->suppressed;
+    site->suppressed = 0;
+    ++recordCount;
+    ScheduleDrain();
+
+done:
+    va_end(args);
+}
+
+int AsyncLog_Initialize(EventLoop *eventLoop)
+{
+    timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (timerFd == -1) {
+        Log_Debug("ERROR: Unable to create timer: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+
+    timerRegistration =
+        EventLoop_RegisterIo(eventLoop, timerFd, EventLoop_Input, DrainTimerCallback, NULL);
+    if (timerRegistration == NULL) {
+        Log_Debug("ERROR: Unable to register timer event: %s (%d).\n", strerror(errno), errno);
+        int error = errno;
+        close(timerFd);
+        timerFd = -1;
+        errno = error;
+        return -1;
+    }
+
+    drainEventLoop = eventLoop;
+    drainScheduled = false;
+    return 0;
+}
+
+void AsyncLog_Cleanup(void)
+{
+    AsyncLog_Flush();
+
+    if (timerRegistration != NULL) {
+        EventLoop_UnregisterIo(drainEventLoop, timerRegistration);
+        timerRegistration = NULL;
+    }
+    if (timerFd != -1) {
+        close(timerFd);
+        timerFd = -1;
+    }
+    drainScheduled = false;
+}
@@ -0,0 +1,138 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <applibs/eventloop.h>
+
+// The asynchronous logger replaces Log_Debug on hot paths. A message is not formatted when it is
+// logged: its format string and arguments are copied into a ring of fixed-size records, and the
+// event loop formats the records and writes them with Log_Debug ASYNC_LOG_DRAIN_DELAY_MS later,
+// so that the messages which a burst of events logs are written together, after the burst. Each
+// call site is rate-limited, and messages with a level above ASYNC_LOG_LEVEL compile to nothing.
+//
+// The format string must remain valid until the message is written, so it should be a string
+// literal. Arguments for %s are copied, up to ASYNC_LOG_STRING_SPACE bytes per message in all. The
+// logger is not thread-safe; it should only be used from the event loop's thread.
+
+#define ASYNC_LOG_LEVEL_NONE 0
+#define ASYNC_LOG_LEVEL_ERROR 1
+#define ASYNC_LOG_LEVEL_WARNING 2
+#define ASYNC_LOG_LEVEL_INFO 3
+#define ASYNC_LOG_LEVEL_DEBUG 4
+
+/// <summary>
+///     Most verbose level which is compiled in. Define it on the compiler command line to change
+///     it; for example, -DASYNC_LOG_LEVEL=ASYNC_LOG_LEVEL_WARNING removes the info and debug
+///     messages, and their arguments are not evaluated.
+/// </summary>
+#ifndef ASYNC_LOG_LEVEL
+#define ASYNC_LOG_LEVEL ASYNC_LOG_LEVEL_INFO
+#endif
+
+/// <summary>Maximum number of arguments, including * widths and precisions, per message. A
+/// message with more arguments is formatted when it is logged.</summary>
+#define ASYNC_LOG_MAX_ARGS 8
+
+/// <summary>Number of bytes per message which hold copies of %s arguments.</summary>
+#define ASYNC_LOG_STRING_SPACE 96
+
+/// <summary>Number of messages which can wait to be written. Further messages are dropped, and
+/// counted, until the waiting messages have been written.</summary>
+#define ASYNC_LOG_RECORD_COUNT 64
+
+/// <summary>Delay from when a message is logged with no other messages waiting, until the waiting
+/// messages are written.</summary>
+#define ASYNC_LOG_DRAIN_DELAY_MS 10
+
+/// <summary>Maximum number of messages which each call site logs per second. Further messages
+/// from the site are suppressed, and the number suppressed is reported with its next
+/// message.</summary>
+#define ASYNC_LOG_RATE_LIMIT_PER_SECOND 20
+
+/// <summary>
+///     Rate-limiting state of one call site. The logging macros declare one for each call site;
+///     the client should not access its members.
+/// </summary>
+typedef struct {
+    uint64_t windowStartMs;
+    uint32_t windowCount;
+    uint32_t suppressed;
+} AsyncLog_Site;
+
+/// <summary>
+///     Starts writing the messages which are logged from the event loop. Until this is called,
+///     and after <see cref="AsyncLog_Cleanup" />, messages are written as they are logged.
+/// </summary>
+/// <param name="eventLoop">Event loop which writes the messages.</param>
+/// <returns>0 on success, or -1 on failure, in which case errno is set.</returns>
+int AsyncLog_Initialize(EventLoop *eventLoop);
+
+/// <summary>
+///     Writes any messages which are waiting, and stops writing messages from the event loop.
+///     Should be called before the event loop is closed.
+/// </summary>
+void AsyncLog_Cleanup(void);
+
+/// <summary>
+///     Writes any messages which are waiting, for example before a blocking operation.
+/// </summary>
+void AsyncLog_Flush(void);
+
+/// <summary>
+///     Logs a message at a call site. Use the ASYNC_LOG_ERROR, ASYNC_LOG_WARNING, ASYNC_LOG_INFO
+///     and ASYNC_LOG_DEBUG macros, which supply the site, rather than calling this directly.
+/// </summary>
+/// <param name="site">Rate-limiting state of the call site.</param>
+/// <param name="format">printf format string, which must remain valid until the message is
+/// written.</param>
+void AsyncLog_Write(AsyncLog_Site *site, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+/// <summary>
+///     Checks the arguments of a message which is not compiled in, so that it still builds when it
+///     is compiled in. It is never called.
+/// </summary>
+static inline __attribute__((format(printf, 1, 2))) void AsyncLog_Discard(const char *format,
+                                                                            ...)
+{
+}
+
+#define ASYNC_LOG_WRITE_(...)                        \
+    do {                                             \
+        static AsyncLog_Site asyncLogSite_;          \
+        AsyncLog_Write(&asyncLogSite_, __VA_ARGS__); \
+    } while (0)
+
+#define ASYNC_LOG_DISCARD_(...)            \
+    do {                                   \
+        if (0) {                           \
+            AsyncLog_Discard(__VA_ARGS__); \
+        }                                  \
+    } while (0)
+
+#if ASYNC_LOG_LEVEL >= ASYNC_LOG_LEVEL_ERROR
+#define ASYNC_LOG_ERROR(...) ASYNC_LOG_WRITE_(__VA_ARGS__)
+#else
+#define ASYNC_LOG_ERROR(...) ASYNC_LOG_DISCARD_(__VA_ARGS__)
+#endif
+
+#if ASYNC_LOG_LEVEL >= ASYNC_LOG_LEVEL_WARNING
+#define ASYNC_LOG_WARNING(...) ASYNC_LOG_WRITE_(__VA_ARGS__)
+#else
+#define ASYNC_LOG_WARNING(...) ASYNC_LOG_DISCARD_(__VA_ARGS__)
+#endif
+
+#if ASYNC_LOG_LEVEL >= ASYNC_LOG_LEVEL_INFO
+#define ASYNC_LOG_INFO(...) ASYNC_LOG_WRITE_(__VA_ARGS__)
+#else
+#define ASYNC_LOG_INFO(...) ASYNC_LOG_DISCARD_(__VA_ARGS__)
+#endif
+
+#if ASYNC_LOG_LEVEL >= ASYNC_LOG_LEVEL_DEBUG
+#define ASYNC_LOG_DEBUG(...) ASYNC_LOG_WRITE_(__VA_ARGS__)
+#else
+#define ASYNC_LOG_DEBUG(...) ASYNC_LOG_DISCARD_(__VA_ARGS__)
+#endif
@@ -0,0 +1,125 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#include <applibs/log.h>
+
+#include "benchmark.h"
+
+static volatile uintptr_t sink;
+
+void Benchmark_Consume(uintptr_t value)
+{
+    sink ^= value;
+}
+
+static uint64_t NowNs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+// Insertion sort, which is fast enough for BENCHMARK_MAX_REPETITIONS values.
+static void Sort(uint64_t *values, size_t count)
+{
+    for (size_t i = 1; i < count; ++i) {
+        uint64_t value = values[i];
+        size_t j = i;
+        while (j > 0 && values[j - 1] > value) {
+            values[j] = values[j - 1];
+            --j;
+        }
+        values[j] = value;
+    }
+}
+
+int Benchmark_Run(const Benchmark_Kernel *kernel, const Benchmark_Config *config,
+                  Benchmark_Result *result)
+{
+    static const Benchmark_Config defaultConfig = BENCHMARK_DEFAULT_CONFIG;
+    if (config == NULL) {
+        config = &defaultConfig;
+    }
+
+    if (kernel->run == NULL || config->repetitions == 0 ||
+        config->repetitions > BENCHMARK_MAX_REPETITIONS || config->runsPerRepetition == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (kernel->setUp != NULL && kernel->setUp(kernel->context) != 0) {
+        return -1;
+    }
+
+    for (unsigned int i = 0; i < config->warmUpRuns; ++i) {
+        kernel->run(kernel->context);
+    }
+
+    uint64_t repetitionNs[BENCHMARK_MAX_REPETITIONS];
+    uint64_t totalNs = 0;
+    for (unsigned int r = 0; r < config->repetitions; ++r) {
+        uint64_t start = NowNs();
+        for (unsigned int i = 0; i < config->runsPerRepetition; ++i) {
+            kernel->run(kernel->context);
+        }
+        repetitionNs[r] = NowNs() - start;
+        totalNs += repetitionNs[r];
+    }
+
+    if (kernel->tearDown != NULL) {
+        kernel->tearDown(kernel->context);
+    }
+
+    Sort(repetitionNs, config->repetitions);
+    unsigned int runs = config->runsPerRepetition;
+    memset(result, 0, sizeof(*result));
+    result->name = kernel->name;
+    result->minNs = repetitionNs[0] / runs;
+    result->medianNs = repetitionNs[config->repetitions / 2] / runs;
+    result->meanNs = totalNs / ((uint64_t)config->repetitions * runs);
+    result->maxNs = repetitionNs[config->repetitions - 1] / runs;
+
+    // Use the total time of the median repetition, which is more precise than the time per run.
+    uint64_t medianRepetitionNs = repetitionNs[config->repetitions / 2];
+    if (kernel->bytesPerRun > 0 && medianRepetitionNs > 0) {
+        uint64_t bytes = (uint64_t)kernel->bytesPerRun * runs;
+        result->kibPerSecond = bytes * 1000000000u / 1024u / medianRepetitionNs;
+    }
+    return 0;
+}
+
+void Benchmark_LogResult(const Benchmark_Result *result)
+{
+    Log_Debug("%-24s %10llu %10llu %10llu %10llu", result->name, (unsigned long long)result->minNs,
+              (unsigned long long)result->medianNs, (unsigned long long)result->meanNs,
+              (unsigned long long)result->maxNs);
+    if (result->kibPerSecond > 0) {
+        Log_Debug(" %10llu", (unsigned long long)result->kibPerSecond);
+    }
+    Log_Debug("\n");
+}
+
+size_t Benchmark_RunAll(const Benchmark_Kernel *kernels, size_t count,
+                        const Benchmark_Config *config)
+{
+    Log_Debug("%-24s %10s %10s %10s %10s %10s\n", "Kernel (ns per run)", "Min", "Median", "Mean",
+              "Max", "KiB/s");
+
+    size_t failures = 0;
+    for (size_t i = 0; i < count; ++i) {
+        Benchmark_Result result;
+        if (Benchmark_Run(&kernels[i], config, &result) != 0) {
+            Log_Debug("ERROR: Could not run %s: %s (%d).\n", kernels[i].name, strerror(errno),
+                      errno);
+            ++failures;
+            continue;
+        }
+        Benchmark_LogResult(&result);
+    }
+    return failures;
+}
@@ -0,0 +1,114 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The benchmark harness times small pieces of code, called kernels, on the device, so that a
+// change to code which is shared between the samples can be measured on real hardware. Each
+// kernel is run a number of times to warm up the caches, and is then timed with CLOCK_MONOTONIC
+// over a number of repetitions, each of which runs the kernel several times. The harness reports
+// the fastest, median, mean and slowest time per run across the repetitions.
+//
+// The harness does not allocate memory, and runs each kernel to completion on the calling thread.
+
+/// <summary>Maximum number of timed repetitions of a kernel.</summary>
+#define BENCHMARK_MAX_REPETITIONS 64
+
+/// <summary>
+///     A piece of code to time.
+/// </summary>
+typedef struct {
+    /// <summary>Name of the kernel, which is shown in the results.</summary>
+    const char *name;
+    /// <summary>Prepares the kernel's input, or NULL. Not timed.</summary>
+    /// <returns>0 on success, or -1 if the kernel cannot be run.</returns>
+    int (*setUp)(void *context);
+    /// <summary>Runs the kernel once.</summary>
+    void (*run)(void *context);
+    /// <summary>Releases what setUp acquired, or NULL. Not timed.</summary>
+    void (*tearDown)(void *context);
+    /// <summary>Number of bytes which one run processes, from which the throughput is
+    /// calculated; or 0 if throughput is not meaningful for the kernel.</summary>
+    size_t bytesPerRun;
+    /// <summary>Context which is passed to the functions.</summary>
+    void *context;
+} Benchmark_Kernel;
+
+/// <summary>
+///     How many times each kernel is run.
+/// </summary>
+typedef struct {
+    /// <summary>Runs before the timing starts.</summary>
+    unsigned int warmUpRuns;
+    /// <summary>Timed repetitions, up to BENCHMARK_MAX_REPETITIONS.</summary>
+    unsigned int repetitions;
+    /// <summary>Runs in each repetition, so that a fast kernel takes long enough to time
+    /// accurately. Must not be zero.</summary>
+    unsigned int runsPerRepetition;
+} Benchmark_Config;
+
+/// <summary>
+///     Default configuration: 100 warm-up runs, then 25 repetitions of 1000 runs.
+/// </summary>
+#define BENCHMARK_DEFAULT_CONFIG                                                \
+    {                                                                           \
+        .warmUpRuns = 100, .repetitions = 25, .runsPerRepetition = 1000         \
+    }
+
+/// <summary>
+///     Statistics of the time which one run of a kernel took, across the repetitions.
+/// </summary>
+typedef struct {
+    /// <summary>Name of the kernel.</summary>
+    const char *name;
+    /// <summary>Fastest repetition, in nanoseconds per run.</summary>
+    uint64_t minNs;
+    /// <summary>Median repetition, in nanoseconds per run.</summary>
+    uint64_t medianNs;
+    /// <summary>Mean of the repetitions, in nanoseconds per run.</summary>
+    uint64_t meanNs;
+    /// <summary>Slowest repetition, in nanoseconds per run.</summary>
+    uint64_t maxNs;
+    /// <summary>Throughput of the median repetition, in KiB per second; or 0 if the kernel
+    /// does not set bytesPerRun.</summary>
+    uint64_t kibPerSecond;
+} Benchmark_Result;
+
+/// <summary>
+///     Runs a kernel as the configuration specifies, and calculates its statistics.
+/// </summary>
+/// <param name="kernel">The kernel.</param>
+/// <param name="config">How many times to run it, or NULL for BENCHMARK_DEFAULT_CONFIG.</param>
+/// <param name="result">Receives the statistics.</param>
+/// <returns>0 on success, or -1 on failure, in which case errno is set: EINVAL if the
+/// configuration is invalid, or the error which the kernel's setUp function set.</returns>
+int Benchmark_Run(const Benchmark_Kernel *kernel, const Benchmark_Config *config,
+                  Benchmark_Result *result);
+
+/// <summary>
+///     Runs each kernel in turn, and logs a line of statistics for each one. A kernel which
+///     cannot be run is logged and skipped.
+/// </summary>
+/// <param name="kernels">The kernels.</param>
+/// <param name="count">Number of kernels.</param>
+/// <param name="config">How many times to run each one, or NULL for
+/// BENCHMARK_DEFAULT_CONFIG.</param>
+/// <returns>Number of kernels which could not be run.</returns>
+size_t Benchmark_RunAll(const Benchmark_Kernel *kernels, size_t count,
+                        const Benchmark_Config *config);
+
+/// <summary>
+///     Logs a kernel's statistics.
+/// </summary>
+/// <param name="result">The statistics.</param>
+void Benchmark_LogResult(const Benchmark_Result *result);
+
+/// <summary>
+///     Keeps a value which a kernel computes, so that the compiler cannot discard the computation
+///     as unused.
+/// </summary>
+/// <param name="value">The value.</param>
+void Benchmark_Consume(uintptr_t value);
@@ -0,0 +1,419 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <applibs/log.h>
+#include <applibs/storage.h>
+
+#include "bulk_log.h"
+
+static const uint32_t headerMagic = ('B' << 24) | ('L' << 16) | ('O' << 8) | 'G';
+
+// The header at the start of the region records how much data is stored after it. It is rewritten
+// after each chunk has been stored, so a chunk which was only partly written is not counted.
+typedef struct {
+    uint32_t magic;
+    uint32_t storedSize;
+    uint32_t crc;
+} Header;
+
+// Longest encoding of a 64-bit variable-length integer.
+#define MAX_VARINT_SIZE 10
+
+// A sample block starts with its tag, the number of samples and the number of values.
+#define BLOCK_HEADER_SIZE 3
+
+// Most samples which a block can hold; its count is one byte.
+#define MAX_BLOCK_SAMPLES 255
+
+static off_t regionOffset = 0;
+static size_t dataCapacity = 0;
+static size_t storedSize = 0;
+static unsigned long droppedChunks = 0;
+static bool opened = false;
+
+static uint8_t chunk[BULK_LOG_CHUNK_SIZE];
+static size_t chunkUsed = 0;
+// CLOCK_MONOTONIC time of the previous record in the chunk, in milliseconds.
+static uint64_t previousRecordMs = 0;
+// Values of the previous samples of each channel in the chunk.
+static int32_t previousValues[BULK_LOG_MAX_CHANNELS][BULK_LOG_MAX_VALUES];
+
+// The sample block which further samples of its channel are appended to. It is always the last
+// record in the chunk, so it is closed when any other record is added.
+static bool blockOpen = false;
+static size_t blockStart = 0;
+static size_t blockBits = 0;
+static unsigned int blockChannel = 0;
+static size_t blockValueCount = 0;
+// Milliseconds between the previous two samples in the block, against which the next interval
+// is encoded.
+static int64_t blockIntervalMs = 0;
+
+static uint8_t readBuffer[BULK_LOG_CHUNK_SIZE];
+
+static uint32_t HeaderCrc(const Header *header)
+{
+    // FNV-1a over the fields which precede the CRC.
+    const uint8_t *bytes = (const uint8_t *)header;
+    uint32_t crc = 2166136261u;
+    for (size_t i = 0; i < offsetof(Header, crc); ++i) {
+        crc ^= bytes[i];
+        crc *= 16777619u;
+    }
+    return crc;
+}
+
+static uint64_t NowMs(clockid_t clock)
+{
+    struct timespec now;
+    clock_gettime(clock, &now);
+    return (uint64_t)now.tv_sec * 1000u + (uint64_t)now.tv_nsec / 1000000u;
+}
+
+static size_t PutVarint(uint8_t *buffer, uint64_t value)
+{
+    size_t size = 0;
+    while (value >= 0x80) {
+        buffer[size++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    buffer[size++] = (uint8_t)value;
+    return size;
+}
+
+static uint64_t Zigzag(int64_t value)
+{
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+// Gets the length of the code of a zigzag-encoded field in a sample block, in bits.
+static size_t CodeBits(uint64_t value)
+{
+    if (value == 0) {
+        return 1;
+    } else if (value < (1u << 7)) {
+        return 2 + 7;
+    } else if (value < (1u << 12)) {
+        return 3 + 12;
+    } else if (value < (1u << 20)) {
+        return 4 + 20;
+    }
+    return 4 + 64;
+}
+
+// Writes the low count bits of value, most significant first, at the end of the open block.
+static void PutBits(uint64_t value, size_t count)
+{
+    while (count-- > 0) {
+        size_t bit = (blockStart + BLOCK_HEADER_SIZE) * 8 + blockBits++;
+        if ((bit & 7) == 0) {
+            chunk[bit >> 3] = 0;
+        }
+        if (((value >> count) & 1) != 0) {
+            chunk[bit >> 3] |= (uint8_t)(0x80 >> (bit & 7));
+        }
+    }
+}
+
+// Writes the code of a zigzag-encoded field: a prefix which selects the width, and the value.
+static void PutCode(uint64_t value)
+{
+    if (value == 0) {
+        PutBits(0x0, 1);
+    } else if (value < (1u << 7)) {
+        PutBits(0x2, 2);
+        PutBits(value, 7);
+    } else if (value < (1u << 12)) {
+        PutBits(0x6, 3);
+        PutBits(value, 12);
+    } else if (value < (1u << 20)) {
+        PutBits(0xE, 4);
+        PutBits(value, 20);
+    } else {
+        PutBits(0xF, 4);
+        PutBits(value, 64);
+    }
+}
+
+static int WriteHeader(int fd, size_t size)
+{
+    Header header = {.magic = headerMagic, .storedSize = (uint32_t)size};
+    header.crc = HeaderCrc(&header);
+    if (lseek(fd, regionOffset, SEEK_SET) == -1 ||
+        write(fd, &header, sizeof(header)) != (ssize_t)sizeof(header)) {
+        return -1;
+    }
+    return 0;
+}
+
+int BulkLog_Open(off_t storageOffset, size_t storageSize)
+{
+    if (storageSize < sizeof(Header) + BULK_LOG_CHUNK_SIZE) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    regionOffset = storageOffset;
+    dataCapacity = storageSize - sizeof(Header);
+    storedSize = 0;
+    droppedChunks = 0;
+    chunkUsed = 0;
+
+    int fd = Storage_OpenMutableFile();
+    if (fd == -1) {
+        Log_Debug("ERROR: Could not open mutable storage: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+
+    Header header;
+    if (lseek(fd, regionOffset, SEEK_SET) != -1 &&
+        read(fd, &header, sizeof(header)) == (ssize_t)sizeof(header) &&
+        header.magic == headerMagic && header.crc == HeaderCrc(&header) &&
+        header.storedSize <= dataCapacity) {
+        storedSize = header.storedSize;
+    }
+    close(fd);
+
+    Log_Debug("INFO: Bulk log holds %zu bytes.\n", storedSize);
+    opened = true;
+    return 0;
+}
+
+// Starts a chunk with a time base record. Chunks can therefore be decoded independently.
+static void StartChunk(void)
+{
+    chunk[0] = BulkLog_RecordKind_TimeBase << 4;
+    chunkUsed = 1 + PutVarint(&chunk[1], NowMs(CLOCK_REALTIME));
+    previousRecordMs = NowMs(CLOCK_MONOTONIC);
+    memset(previousValues, 0, sizeof(previousValues));
+    blockOpen = false;
+}
+
+// Appends a record which has been encoded against the state of the current chunk.
+static void AppendRecord(const uint8_t *record, size_t size, uint64_t nowMs)
+{
+    memcpy(&chunk[chunkUsed], record, size);
+    chunkUsed += size;
+    previousRecordMs = nowMs;
+    blockOpen = false;
+}
+
+// Gets the number of bits which a sample takes in a block, after the previous sample of its
+// channel, and given the interval before the previous sample in the block.
+static size_t SampleBits(unsigned int channel, const int32_t *values, size_t count,
+                         int64_t interval, int64_t previousInterval)
+{
+    size_t bits = CodeBits(Zigzag(interval - previousInterval));
+    for (size_t i = 0; i < count; ++i) {
+        bits += CodeBits(Zigzag((int64_t)values[i] - previousValues[channel][i]));
+    }
+    return bits;
+}
+
+// Appends a sample to the open block, which has room for it.
+static void AppendSample(const int32_t *values, size_t count, uint64_t nowMs)
+{
+    int64_t interval = (int64_t)(nowMs - previousRecordMs);
+    PutCode(Zigzag(interval - blockIntervalMs));
+    for (size_t i = 0; i < count; ++i) {
+        PutCode(Zigzag((int64_t)values[i] - previousValues[blockChannel][i]));
+    }
+
+    ++chunk[blockStart + 1];
+    chunkUsed = blockStart + BLOCK_HEADER_SIZE + (blockBits + 7) / 8;
+    blockIntervalMs = interval;
+    previousRecordMs = nowMs;
+    memcpy(previousValues[blockChannel], values, count * sizeof(values[0]));
+}
+
+// Appends the samples to the open block if it is for the same channel and has room for them, and
+// otherwise starts a block, in a new chunk if this one is full.
+static int AddSampleToBlock(unsigned int channel, const int32_t *values, size_t count,
+                            uint64_t nowMs)
+{
+    int64_t interval = (int64_t)(nowMs - previousRecordMs);
+    if (blockOpen && blockChannel == channel && blockValueCount == count &&
+        chunk[blockStart + 1] < MAX_BLOCK_SAMPLES) {
+        size_t bits = SampleBits(channel, values, count, interval, blockIntervalMs);
+        if (blockStart + BLOCK_HEADER_SIZE + (blockBits + bits + 7) / 8 <= sizeof(chunk)) {
+            AppendSample(values, count, nowMs);
+            return 0;
+        }
+    }
+
+    size_t bits = SampleBits(channel, values, count, interval, 0);
+    if (chunkUsed + BLOCK_HEADER_SIZE + (bits + 7) / 8 > sizeof(chunk)) {
+        // Store the full chunk, and start the block in the new chunk.
+        if (BulkLog_Flush() != 0) {
+            return -1;
+        }
+        StartChunk();
+    }
+
+    blockStart = chunkUsed;
+    chunk[blockStart] = (uint8_t)((BulkLog_RecordKind_SampleBlock << 4) | channel);
+    chunk[blockStart + 1] = 0;
+    chunk[blockStart + 2] = (uint8_t)count;
+    blockBits = 0;
+    blockChannel = channel;
+    blockValueCount = count;
+    blockIntervalMs = 0;
+    blockOpen = true;
+    AppendSample(values, count, nowMs);
+    return 0;
+}
+
+int BulkLog_AddSamples(unsigned int channel, const int32_t *values, size_t count)
+{
+    if (!opened || channel >= BULK_LOG_MAX_CHANNELS || count == 0 ||
+        count > BULK_LOG_MAX_VALUES) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (chunkUsed == 0) {
+        StartChunk();
+    }
+
+    return AddSampleToBlock(channel, values, count, NowMs(CLOCK_MONOTONIC));
+}
+
+int BulkLog_AddText(unsigned int channel, const char *text)
+{
+    if (!opened || channel >= BULK_LOG_MAX_CHANNELS) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // The text must fit in a chunk after its time base record and its own tag, time and length.
+    size_t length = strlen(text);
+    size_t overhead = 1 + MAX_VARINT_SIZE + 1 + 2 * MAX_VARINT_SIZE;
+    if (length > sizeof(chunk) - overhead) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    if (chunkUsed == 0) {
+        StartChunk();
+    }
+
+    uint8_t prefix[1 + 2 * MAX_VARINT_SIZE];
+    uint64_t nowMs = NowMs(CLOCK_MONOTONIC);
+    size_t prefixSize = 1;
+    prefix[0] = (uint8_t)((BulkLog_RecordKind_Text << 4) | channel);
+    prefixSize += PutVarint(&prefix[prefixSize], nowMs - previousRecordMs);
+    prefixSize += PutVarint(&prefix[prefixSize], length);
+    if (chunkUsed + prefixSize + length > sizeof(chunk)) {
+        if (BulkLog_Flush() != 0) {
+            return -1;
+        }
+        StartChunk();
+        prefixSize = 1;
+        prefixSize += PutVarint(&prefix[prefixSize], nowMs - previousRecordMs);
+        prefixSize += PutVarint(&prefix[prefixSize], length);
+    }
+
+    AppendRecord(prefix, prefixSize, nowMs);
+    AppendRecord((const uint8_t *)text, length, nowMs);
+    return 0;
+}
+
+int BulkLog_Flush(void)
+{
+    if (chunkUsed == 0) {
+        return 0;
+    }
+
+    if (storedSize + chunkUsed > dataCapacity) {
+        ++droppedChunks;
+        Log_Debug("WARNING: Bulk log is full; %lu chunk(s) dropped.\n", droppedChunks);
+        chunkUsed = 0;
+        return 0;
+    }
+
+    int fd = Storage_OpenMutableFile();
+    if (fd == -1) {
+        Log_Debug("ERROR: Could not open mutable storage: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+
+    int result = 0;
+    off_t chunkOffset = regionOffset + (off_t)sizeof(Header) + (off_t)storedSize;
+    if (lseek(fd, chunkOffset, SEEK_SET) == -1 ||
+        write(fd, chunk, chunkUsed) != (ssize_t)chunkUsed ||
+        WriteHeader(fd, storedSize + chunkUsed) != 0) {
+        Log_Debug("ERROR: Could not store bulk log chunk: %s (%d).\n", strerror(errno), errno);
+        result = -1;
+    } else {
+        storedSize += chunkUsed;
+        chunkUsed = 0;
+    }
+    close(fd);
+    return result;
+}
+
+size_t BulkLog_GetStoredSize(void)
+{
+    return storedSize;
+}
+
+unsigned long BulkLog_GetDroppedChunks(void)
+{
+    return droppedChunks;
+}
+
+int BulkLog_Read(size_t offset, const uint8_t **data, size_t *size)
+{
+    *data = readBuffer;
+    *size = 0;
+    if (offset >= storedSize) {
+        return 0;
+    }
+
+    size_t partSize = storedSize - offset;
+    if (partSize > sizeof(readBuffer)) {
+        partSize = sizeof(readBuffer);
+    }
+
+    int fd = Storage_OpenMutableFile();
+    if (fd == -1) {
+        Log_Debug("ERROR: Could not open mutable storage: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+
+    int result = 0;
+    off_t partOffset = regionOffset + (off_t)sizeof(Header) + (off_t)offset;
+    if (lseek(fd, partOffset, SEEK_SET) == -1 ||
+        read(fd, readBuffer, partSize) != (ssize_t)partSize) {
+        Log_Debug("ERROR: Could not read bulk log: %s (%d).\n", strerror(errno), errno);
+        result = -1;
+    } else {
+        *size = partSize;
+    }
+    close(fd);
+    return result;
+}
+
+int BulkLog_Clear(void)
+{
+    int fd = Storage_OpenMutableFile();
+    if (fd == -1) {
+        Log_Debug("ERROR: Could not open mutable storage: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+
+    int result = WriteHeader(fd, 0);
+    if (result != 0) {
+        Log_Debug("ERROR: Could not clear bulk log: %s (%d).\n", strerror(errno), errno);
+    } else {
+        storedSize = 0;
+    }
+    close(fd);
+    return result;
+}
@@ -0,0 +1,137 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// The bulk log collects data which is too large or too frequent to send as telemetry, such as
+// high-rate sensor samples, logs and traces, so that it can be uploaded in batches, for example
+// with the IoT Hub's file upload feature. Records are compressed as they are added: consecutive
+// sensor samples of a channel are bit-packed into a block, in which each value is stored as its
+// difference from the previous sample, and each sample's time as the change in the interval
+// between samples, so that a regular, slowly changing reading takes a few bits per value.
+//
+// Records are collected in a chunk of BULK_LOG_CHUNK_SIZE bytes in memory, and each chunk is
+// appended to a region of the application's mutable storage when it is full or when the log is
+// flushed. The stored data is read back a chunk at a time, so that an upload streams it without
+// holding the whole batch in memory, and is cleared once it has been uploaded. When the region is
+// full, further chunks are dropped and counted until it is cleared.
+//
+// The stored data is a sequence of records. Each record starts with a byte which holds its kind in
+// the upper four bits and its channel in the lower four bits, and its fields are unsigned LEB128
+// variable-length integers; signed fields are zigzag encoded first:
+//
+//  - Time base (kind 0): the CLOCK_REALTIME time in milliseconds. Each chunk starts with one, and
+//    the sample differences restart from zero after it.
+//  - Samples (kind 1): milliseconds since the previous record, the number of values, and the
+//    difference of each value from the same value of the previous samples of the channel. Only
+//    written by earlier versions of the log; decoders should still accept it.
+//  - Text (kind 2): milliseconds since the previous record, the length of the text in bytes, and
+//    the text, which is not null-terminated.
+//  - Sample block (kind 3): one byte holding the number of samples, from 1 to 255, one byte
+//    holding the number of values in each sample, and a bit stream, which is padded with zero bits
+//    to a whole byte. The fields of a block are not LEB128 integers.
+//
+// The bit stream of a sample block is read from the most significant bit of each byte. For each
+// sample, it holds the code of the sample's time and then the code of each value. The interval of
+// a sample is the number of milliseconds since the previous record or sample; its time is coded
+// as the difference from the interval of the previous sample in the block, or from 0 for the first
+// sample. Each value is coded as the difference from the same value of the previous samples of the
+// channel, as in a samples record. Each of these differences is zigzag encoded to an unsigned z,
+// and coded with a prefix which selects the number of bits which follow:
+//
+//    '0'                  z = 0
+//    '10'   and 7 bits    z < 2^7
+//    '110'  and 12 bits   z < 2^12
+//    '1110' and 20 bits   z < 2^20
+//    '1111' and 64 bits   any z
+//
+// The log is not thread-safe; it should only be used from the event loop's thread.
+
+/// <summary>Size of a chunk, the unit in which the log is stored and read, in bytes.</summary>
+#define BULK_LOG_CHUNK_SIZE 512
+
+/// <summary>Number of channels, which identify the source of each record.</summary>
+#define BULK_LOG_MAX_CHANNELS 16
+
+/// <summary>Maximum number of values in one samples record.</summary>
+#define BULK_LOG_MAX_VALUES 8
+
+/// <summary>Kinds of record.</summary>
+typedef enum {
+    BulkLog_RecordKind_TimeBase = 0,
+    BulkLog_RecordKind_Samples = 1,
+    BulkLog_RecordKind_Text = 2,
+    BulkLog_RecordKind_SampleBlock = 3
+} BulkLog_RecordKind;
+
+/// <summary>
+///     Opens the log in a region of mutable storage, and restores the data which was stored before
+///     the application last stopped.
+/// </summary>
+/// <param name="storageOffset">Offset of the region within the mutable storage file.</param>
+/// <param name="storageSize">Size of the region, which must hold at least one chunk after the
+/// log's header.</param>
+/// <returns>0 on success, or -1 on failure, in which case errno is set.</returns>
+int BulkLog_Open(off_t storageOffset, size_t storageSize);
+
+/// <summary>
+///     Adds a set of sensor samples, such as one reading of each axis of an accelerometer.
+/// </summary>
+/// <param name="channel">Channel of the samples, less than BULK_LOG_MAX_CHANNELS. The samples of
+/// a channel should always have the same number of values.</param>
+/// <param name="values">The values, scaled to integers.</param>
+/// <param name="count">Number of values, up to BULK_LOG_MAX_VALUES.</param>
+/// <returns>0 on success, or -1 on failure, in which case errno is set: EINVAL if the arguments
+/// are invalid, or the error which storing a full chunk failed with.</returns>
+int BulkLog_AddSamples(unsigned int channel, const int32_t *values, size_t count);
+
+/// <summary>
+///     Adds a line of text, such as a log message or a trace event.
+/// </summary>
+/// <param name="channel">Channel of the text, less than BULK_LOG_MAX_CHANNELS.</param>
+/// <param name="text">The null-terminated text.</param>
+/// <returns>0 on success, or -1 on failure, in which case errno is set: EMSGSIZE if the text does
+/// not fit in a chunk.</returns>
+int BulkLog_AddText(unsigned int channel, const char *text);
+
+/// <summary>
+///     Stores the chunk which is being collected, so that it can be read.
+/// </summary>
+/// <returns>0 on success, or -1 on failure, in which case errno is set.</returns>
+int BulkLog_Flush(void);
+
+/// <summary>
+///     Gets the size of the stored data, which does not include the chunk which is being
+///     collected.
+/// </summary>
+/// <returns>The size of the stored data in bytes.</returns>
+size_t BulkLog_GetStoredSize(void);
+
+/// <summary>
+///     Gets the number of chunks which were dropped because the region was full, since the log
+///     was opened.
+/// </summary>
+/// <returns>The number of dropped chunks.</returns>
+unsigned long BulkLog_GetDroppedChunks(void);
+
+/// <summary>
+///     Reads a part of the stored data, of up to BULK_LOG_CHUNK_SIZE bytes, into a buffer which
+///     the log holds.
+/// </summary>
+/// <param name="offset">Offset of the part within the stored data.</param>
+/// <param name="data">Receives the part, which remains valid until the next call to the
+/// log.</param>
+/// <param name="size">Receives the size of the part, or 0 if the offset is at the end of the
+/// stored data.</param>
+/// <returns>0 on success, or -1 on failure, in which case errno is set.</returns>
+int BulkLog_Read(size_t offset, const uint8_t **data, size_t *size);
+
+/// <summary>
+///     Discards the stored data, once it has been uploaded.
+/// </summary>
+/// <returns>0 on success, or -1 on failure, in which case errno is set.</returns>
+int BulkLog_Clear(void);
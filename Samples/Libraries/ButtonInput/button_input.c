@@ -0,0 +1,257 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include <applibs/log.h>
+#include <applibs/eventloop.h>
+#include <applibs/gpio.h>
+
+#include "button_input.h"
+
+struct Button {
+    int fd;
+    ButtonInput_Handler handler;
+    void *context;
+    // Most recently sampled value, and when it was first sampled.
+    bool rawPressed;
+    uint64_t rawChangedMs;
+    // Debounced value, and when it last changed.
+    bool pressed;
+    uint64_t pressedChangedMs;
+    // Number of presses in the current run, which ends with a click or a long press.
+    unsigned int pressCount;
+    bool longPressReported;
+    // Set while a button which was held when it was added has not yet been released.
+    bool ignoreUntilReleased;
+};
+
+struct ButtonInput {
+    EventLoop *eventLoop;
+    int timerFd;
+    EventRegistration *registration;
+    ButtonInput_Config config;
+    ButtonInput_ErrorHandler errorHandler;
+    void *context;
+    uint32_t currentPeriodMs;
+    size_t buttonCount;
+    struct Button buttons[BUTTON_INPUT_MAX_BUTTONS];
+};
+
+static uint64_t NowMs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + (uint64_t)now.tv_nsec / 1000000;
+}
+
+static int SetSamplePeriod(ButtonInput *input, uint32_t periodMs)
+{
+    if (periodMs == input->currentPeriodMs) {
+        return 0;
+    }
+
+    struct timespec period = {.tv_sec = periodMs / 1000,
+                              .tv_nsec = (long)(periodMs % 1000) * 1000000};
+    struct itimerspec newValue = {.it_value = period, .it_interval = period};
+    if (timerfd_settime(input->timerFd, /* flags */ 0, &newValue, /* old_value */ NULL) == -1) {
+        Log_Debug("ERROR: Could not set timer period: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+
+    input->currentPeriodMs = periodMs;
+    return 0;
+}
+
+// Advances one button's state machine with a new sample, and invokes its handler with any events
+// which result. Returns whether the button still needs to be sampled at the active period.
+static bool UpdateButton(const ButtonInput_Config *config, struct Button *button,
+                         bool rawPressed, uint64_t nowMs)
+{
+    if (rawPressed != button->rawPressed) {
+        button->rawPressed = rawPressed;
+        button->rawChangedMs = nowMs;
+    }
+
+    if (button->rawPressed != button->pressed &&
+        nowMs - button->rawChangedMs >= config->debounceMs) {
+        button->pressed = button->rawPressed;
+        button->pressedChangedMs = nowMs;
+
+        if (button->ignoreUntilReleased) {
+            button->ignoreUntilReleased = button->pressed;
+        } else if (button->pressed) {
+            ++button->pressCount;
+            button->longPressReported = false;
+            button->handler(button->fd, ButtonInput_Event_Pressed, button->pressCount,
+                            button->context);
+        } else {
+            button->handler(button->fd, ButtonInput_Event_Released, button->pressCount,
+                            button->context);
+            if (button->longPressReported) {
+                button->pressCount = 0;
+            }
+        }
+    }
+
+    if (button->ignoreUntilReleased) {
+        return button->rawPressed != button->pressed;
+    }
+
+    if (button->pressed && !button->longPressReported && config->longPressMs > 0 &&
+        nowMs - button->pressedChangedMs >= config->longPressMs) {
+        button->longPressReported = true;
+        button->handler(button->fd, ButtonInput_Event_LongPress, button->pressCount,
+                        button->context);
+    }
+
+    if (!button->pressed && button->pressCount > 0 &&
+        nowMs - button->pressedChangedMs >= config->multiPressMs) {
+        unsigned int count = button->pressCount;
+        button->pressCount = 0;
+        button->handler(button->fd, ButtonInput_Event_Click, count, button->context);
+    }
+
+    return button->rawPressed != button->pressed || button->pressed || button->pressCount > 0;
+}
+
+// This satisfies the EventLoopIoCallback signature.
+static void SampleButtonsCallback(EventLoop *el, int fd, EventLoop_IoEvents events, void *context)
+{
+    ButtonInput *input = (ButtonInput *)context;
+
+    uint64_t timerData = 0;
+    if (read(input->timerFd, &timerData, sizeof(timerData)) == -1) {
+        Log_Debug("ERROR: Could not read timerfd %s (%d).\n", strerror(errno), errno);
+        input->errorHandler(-1, input->context);
+        return;
+    }
+
+    uint64_t nowMs = NowMs();
+    bool active = false;
+    for (size_t i = 0; i < input->buttonCount; ++i) {
+        struct Button *button = &input->buttons[i];
+
+        GPIO_Value_Type value;
+        if (GPIO_GetValue(button->fd, &value) != 0) {
+            Log_Debug("ERROR: Could not read button GPIO: %s (%d).\n", strerror(errno), errno);
+            input->errorHandler(button->fd, input->context);
+            return;
+        }
+
+        if (UpdateButton(&input->config, button, value == GPIO_Value_Low, nowMs)) {
+            active = true;
+        }
+    }
+
+    uint32_t periodMs = active ? input->config.activePeriodMs : input->config.idlePeriodMs;
+    if (SetSamplePeriod(input, periodMs) != 0) {
+        input->errorHandler(-1, input->context);
+    }
+}
+
+ButtonInput *ButtonInput_Create(EventLoop *eventLoop, const ButtonInput_Config *config,
+                                ButtonInput_ErrorHandler errorHandler, void *context)
+{
+    static const ButtonInput_Config defaultConfig = BUTTON_INPUT_DEFAULT_CONFIG;
+    if (config == NULL) {
+        config = &defaultConfig;
+    }
+
+    if (errorHandler == NULL || config->activePeriodMs == 0 || config->idlePeriodMs == 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    ButtonInput *input = malloc(sizeof(ButtonInput));
+    if (input == NULL) {
+        return NULL;
+    }
+
+    input->eventLoop = eventLoop;
+    input->config = *config;
+    input->errorHandler = errorHandler;
+    input->context = context;
+    input->currentPeriodMs = 0;
+    input->buttonCount = 0;
+
+    // Initialize to unused values in case have to clean up partially initialized object.
+    input->registration = NULL;
+
+    // The timer is armed when the first button is added.
+    input->timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (input->timerFd == -1) {
+        Log_Debug("ERROR: Unable to create timer: %s (%d).\n", strerror(errno), errno);
+        goto failed;
+    }
+
+    input->registration = EventLoop_RegisterIo(eventLoop, input->timerFd, EventLoop_Input,
+                                               SampleButtonsCallback, input);
+    if (input->registration == NULL) {
+        Log_Debug("ERROR: Unable to register timer event: %s (%d).\n", strerror(errno), errno);
+        goto failed;
+    }
+
+    return input;
+
+failed:
+    ButtonInput_Dispose(input);
+    return NULL;
+}
+
+int ButtonInput_Add(ButtonInput *input, int gpioFd, ButtonInput_Handler handler, void *context)
+{
+    if (handler == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (input->buttonCount == BUTTON_INPUT_MAX_BUTTONS) {
+        errno = ENOSPC;
+        return -1;
+    }
+
+    GPIO_Value_Type value;
+    if (GPIO_GetValue(gpioFd, &value) != 0) {
+        Log_Debug("ERROR: Could not read button GPIO: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+
+    if (SetSamplePeriod(input, input->config.idlePeriodMs) != 0) {
+        return -1;
+    }
+
+    struct Button *button = &input->buttons[input->buttonCount];
+    memset(button, 0, sizeof(*button));
+    button->fd = gpioFd;
+    button->handler = handler;
+    button->context = context;
+    button->rawPressed = (value == GPIO_Value_Low);
+    button->pressed = button->rawPressed;
+    button->ignoreUntilReleased = button->pressed;
+    ++input->buttonCount;
+
+    return 0;
+}
+
+void ButtonInput_Dispose(ButtonInput *input)
+{
+    if (input == NULL) {
+        return;
+    }
+
+    EventLoop_UnregisterIo(input->eventLoop, input->registration);
+
+    if (input->timerFd != -1) {
+        close(input->timerFd);
+    }
+
+    free(input);
+}
@@ -0,0 +1,115 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <applibs/eventloop.h>
+
+// High-level applications cannot receive GPIO interrupts, so the button input engine samples all
+// of its buttons from a single timer. While every button is released and settled, the timer runs
+// at the idle period; as soon as a button changes, it runs at the active period until the button
+// has been debounced and any long press or multi-press has been reported. Buttons are active low,
+// as on the sample appliances.
+
+/// <summary>Maximum number of buttons which can be added to one engine.</summary>
+#define BUTTON_INPUT_MAX_BUTTONS 8
+
+/// <summary>
+///     Opaque handle. Obtain via <see cref="ButtonInput_Create" /> and dispose of via
+///     <see cref="ButtonInput_Dispose" />.
+/// </summary>
+typedef struct ButtonInput ButtonInput;
+
+/// <summary>Events which are reported for each button.</summary>
+typedef enum {
+    /// <summary>The button was pressed, once the press has been debounced.</summary>
+    ButtonInput_Event_Pressed,
+    /// <summary>The button was released, once the release has been debounced.</summary>
+    ButtonInput_Event_Released,
+    /// <summary>The button has been held for the long-press time. No click is reported for
+    /// this press.</summary>
+    ButtonInput_Event_LongPress,
+    /// <summary>A run of one or more short presses has ended, because the button was not pressed
+    /// again within the multi-press time. The count is the number of presses.</summary>
+    ButtonInput_Event_Click
+} ButtonInput_Event;
+
+/// <summary>Timing which applies to every button of an engine. Times are in
+/// milliseconds.</summary>
+typedef struct {
+    /// <summary>How long an input must hold a new value before the change is reported.</summary>
+    uint32_t debounceMs;
+    /// <summary>How long a button must be held to report a long press, or 0 to never report
+    /// one.</summary>
+    uint32_t longPressMs;
+    /// <summary>How long after a release another press counts towards the same click, or 0 to
+    /// report a click on every release.</summary>
+    uint32_t multiPressMs;
+    /// <summary>Sample period while a button is pressed or changing.</summary>
+    uint32_t activePeriodMs;
+    /// <summary>Sample period while every button is released and settled. This bounds the time
+    /// between a press and its event, so should be shorter than the briefest press.</summary>
+    uint32_t idlePeriodMs;
+} ButtonInput_Config;
+
+/// <summary>Timing which is used when NULL is passed to ButtonInput_Create.</summary>
+#define BUTTON_INPUT_DEFAULT_CONFIG                                                           \
+    {                                                                                         \
+        .debounceMs = 20, .longPressMs = 1000, .multiPressMs = 300, .activePeriodMs = 10,     \
+        .idlePeriodMs = 50                                                                    \
+    }
+
+/// <summary>
+///     Applications implement a function with this signature to be notified of button events.
+///     The handler must not dispose of the engine.
+/// </summary>
+/// <param name="gpioFd">The button.</param>
+/// <param name="event">What happened to the button.</param>
+/// <param name="count">For ButtonInput_Event_Click, the number of presses; for the other
+/// events, the number of presses in the current run, counting this one.</param>
+/// <param name="context">Context which was supplied to <see cref="ButtonInput_Add" />.</param>
+typedef void (*ButtonInput_Handler)(int gpioFd, ButtonInput_Event event, unsigned int count,
+                                    void *context);
+
+/// <summary>
+///     Applications implement a function with this signature to be notified when the engine
+///     cannot sample its buttons. errno contains more information.
+/// </summary>
+/// <param name="gpioFd">The button which could not be read, or -1 if the timer failed.</param>
+/// <param name="context">Context which was supplied to <see cref="ButtonInput_Create" />.</param>
+typedef void (*ButtonInput_ErrorHandler)(int gpioFd, void *context);
+
+/// <summary>
+///     Create a button input engine which is invoked on the event loop.
+/// </summary>
+/// <param name="eventLoop">Event loop to which the engine will be added.</param>
+/// <param name="config">Timing for the buttons, which is copied; or NULL to use
+/// BUTTON_INPUT_DEFAULT_CONFIG.</param>
+/// <param name="errorHandler">Callback to invoke when the buttons cannot be sampled.</param>
+/// <param name="context">Context which is passed to the error handler.</param>
+/// <returns>On success, pointer to new ButtonInput, which should be disposed of with
+/// <see cref="ButtonInput_Dispose" />. On failure, returns NULL, with more information available
+/// in errno.</returns>
+ButtonInput *ButtonInput_Create(EventLoop *eventLoop, const ButtonInput_Config *config,
+                                ButtonInput_ErrorHandler errorHandler, void *context);
+
+/// <summary>
+///     Add a button to an engine. Its current value is read immediately, so a button which is
+///     already held is not reported as pressed until it has been released.
+/// </summary>
+/// <param name="input">Successfully allocated button input engine.</param>
+/// <param name="gpioFd">Input opened with GPIO_OpenAsInput. It is used, but not closed, by the
+/// engine.</param>
+/// <param name="handler">Callback to invoke with the button's events.</param>
+/// <param name="context">Context which is passed to the handler.</param>
+/// <returns>0 on success, -1 on failure, in which case errno contains more information.</returns>
+int ButtonInput_Add(ButtonInput *input, int gpioFd, ButtonInput_Handler handler, void *context);
+
+/// <summary>
+///     Dispose of an engine which was allocated with <see cref="ButtonInput_Create" />.
+///     It is safe to call this function with a NULL pointer.
+/// </summary>
+/// <param name="input">Successfully allocated button input engine, or NULL.</param>
+void ButtonInput_Dispose(ButtonInput *input);
@@ -0,0 +1,316 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <math.h>
+#include <string.h>
+
+#include "cbor_writer.h"
+
+_Static_assert(CBOR_WRITER_MAX_DEPTH < 32, "CBOR_WRITER_MAX_DEPTH must fit in the depth masks");
+
+// Major types, in the top three bits of the initial byte of each data item.
+#define CBOR_MAJOR_UNSIGNED 0x00
+#define CBOR_MAJOR_NEGATIVE 0x20
+#define CBOR_MAJOR_TEXT 0x60
+#define CBOR_MAJOR_ARRAY 0x80
+#define CBOR_MAJOR_MAP 0xA0
+
+// Initial bytes which do not carry an argument.
+#define CBOR_FALSE 0xF4
+#define CBOR_TRUE 0xF5
+#define CBOR_FLOAT16 0xF9
+#define CBOR_FLOAT32 0xFA
+#define CBOR_FLOAT64 0xFB
+#define CBOR_BREAK 0xFF
+
+// Additional information which marks an indefinite-length array or map.
+#define CBOR_INDEFINITE 0x1F
+
+static void Fail(CborWriter *writer)
+{
+    writer->failed = true;
+}
+
+static void AppendBytes(CborWriter *writer, const void *data, size_t length)
+{
+    if (writer->failed) {
+        return;
+    }
+
+    if (length > writer->size - writer->length) {
+        Fail(writer);
+        return;
+    }
+
+    memcpy(&writer->buffer[writer->length], data, length);
+    writer->length += length;
+}
+
+static void AppendByte(CborWriter *writer, uint8_t b)
+{
+    AppendBytes(writer, &b, 1);
+}
+
+// Append the initial byte of a data item and its argument, most significant byte first, using
+// the fewest bytes which hold the argument.
+static void AppendHead(CborWriter *writer, uint8_t majorType, uint64_t argument)
+{
+    uint8_t head[9];
+    size_t argumentLength;
+
+    if (argument < 24) {
+        head[0] = (uint8_t)(majorType | argument);
+        argumentLength = 0;
+    } else if (argument <= UINT8_MAX) {
+        head[0] = majorType | 24;
+        argumentLength = 1;
+    } else if (argument <= UINT16_MAX) {
+        head[0] = majorType | 25;
+        argumentLength = 2;
+    } else if (argument <= UINT32_MAX) {
+        head[0] = majorType | 26;
+        argumentLength = 4;
+    } else {
+        head[0] = majorType | 27;
+        argumentLength = 8;
+    }
+
+    for (size_t i = 0; i < argumentLength; ++i) {
+        head[argumentLength - i] = (uint8_t)(argument >> (8 * i));
+    }
+    AppendBytes(writer, head, argumentLength + 1);
+}
+
+static void AppendText(CborWriter *writer, const char *value)
+{
+    size_t length = strlen(value);
+    AppendHead(writer, CBOR_MAJOR_TEXT, length);
+    AppendBytes(writer, value, length);
+}
+
+static void AppendInt(CborWriter *writer, int64_t value)
+{
+    if (value >= 0) {
+        AppendHead(writer, CBOR_MAJOR_UNSIGNED, (uint64_t)value);
+    } else {
+        // A negative integer n is encoded as -1 - n, which cannot overflow.
+        AppendHead(writer, CBOR_MAJOR_NEGATIVE, (uint64_t)(-1 - value));
+    }
+}
+
+// Convert a finite single-precision value to half precision, if half precision holds it exactly.
+static bool ToFloat16(float value, uint16_t *half)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint16_t sign = (uint16_t)((bits >> 16) & 0x8000);
+    int exponent = (int)((bits >> 23) & 0xFF) - 127;
+    uint32_t mantissa = bits & 0x7FFFFF;
+
+    if ((bits & 0x7FFFFFFF) == 0) {
+        *half = sign;
+        return true;
+    }
+
+    // A normal half has an exponent from -14 to 15 and ten bits of mantissa.
+    if (exponent >= -14 && exponent <= 15) {
+        if ((mantissa & 0x1FFF) != 0) {
+            return false;
+        }
+        *half = (uint16_t)(sign | ((exponent + 15) << 10) | (mantissa >> 13));
+        return true;
+    }
+
+    // A subnormal half is a multiple of 2^-24.
+    if (exponent >= -24 && exponent < -14) {
+        uint32_t significand = 0x800000 | mantissa;
+        int shift = -(exponent + 1);
+        if ((significand & ((1u << shift) - 1)) != 0) {
+            return false;
+        }
+        *half = (uint16_t)(sign | (significand >> shift));
+        return true;
+    }
+
+    return false;
+}
+
+static void AppendFloat16(CborWriter *writer, uint16_t bits)
+{
+    AppendByte(writer, CBOR_FLOAT16);
+    AppendByte(writer, (uint8_t)(bits >> 8));
+    AppendByte(writer, (uint8_t)bits);
+}
+
+static void AppendFloat32(CborWriter *writer, float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    AppendByte(writer, CBOR_FLOAT32);
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        AppendByte(writer, (uint8_t)(bits >> shift));
+    }
+}
+
+static void AppendFloat64(CborWriter *writer, double value)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    AppendByte(writer, CBOR_FLOAT64);
+    for (int shift = 56; shift >= 0; shift -= 8) {
+        AppendByte(writer, (uint8_t)(bits >> shift));
+    }
+}
+
+// Write the member name which precedes a value, and record that the enclosing container now
+// holds a value.
+static void BeginValue(CborWriter *writer, const char *name)
+{
+    if (writer->failed) {
+        return;
+    }
+
+    uint32_t depthBit = 1u << writer->depth;
+    bool inArray = (writer->isArrayMask & depthBit) != 0;
+
+    // Members of an object must be named; array elements and the top-level value must not be.
+    // Only one top-level value may be written.
+    bool inObject = writer->depth > 0 && !inArray;
+    if (inObject != (name != NULL) || (writer->depth == 0 && (writer->hasValueMask & depthBit))) {
+        Fail(writer);
+        return;
+    }
+    writer->hasValueMask |= depthBit;
+
+    if (name != NULL) {
+        AppendText(writer, name);
+    }
+}
+
+static void BeginContainer(CborWriter *writer, const char *name, bool isArray)
+{
+    BeginValue(writer, name);
+    if (writer->failed) {
+        return;
+    }
+
+    if (writer->depth == CBOR_WRITER_MAX_DEPTH) {
+        Fail(writer);
+        return;
+    }
+
+    ++writer->depth;
+    uint32_t depthBit = 1u << writer->depth;
+    writer->hasValueMask &= ~depthBit;
+    if (isArray) {
+        writer->isArrayMask |= depthBit;
+    } else {
+        writer->isArrayMask &= ~depthBit;
+    }
+
+    AppendByte(writer, (isArray ? CBOR_MAJOR_ARRAY : CBOR_MAJOR_MAP) | CBOR_INDEFINITE);
+}
+
+static void EndContainer(CborWriter *writer, bool isArray)
+{
+    if (writer->failed) {
+        return;
+    }
+
+    uint32_t depthBit = 1u << writer->depth;
+    if (writer->depth == 0 || ((writer->isArrayMask & depthBit) != 0) != isArray) {
+        Fail(writer);
+        return;
+    }
+
+    --writer->depth;
+    AppendByte(writer, CBOR_BREAK);
+}
+
+void CborWriter_Init(CborWriter *writer, uint8_t *buffer, size_t size)
+{
+    writer->buffer = buffer;
+    writer->size = size;
+    writer->length = 0;
+    writer->hasValueMask = 0;
+    writer->isArrayMask = 0;
+    writer->depth = 0;
+    writer->failed = false;
+}
+
+void CborWriter_BeginObject(CborWriter *writer, const char *name)
+{
+    BeginContainer(writer, name, false);
+}
+
+void CborWriter_EndObject(CborWriter *writer)
+{
+    EndContainer(writer, false);
+}
+
+void CborWriter_BeginArray(CborWriter *writer, const char *name)
+{
+    BeginContainer(writer, name, true);
+}
+
+void CborWriter_EndArray(CborWriter *writer)
+{
+    EndContainer(writer, true);
+}
+
+void CborWriter_AddInt(CborWriter *writer, const char *name, int64_t value)
+{
+    BeginValue(writer, name);
+    AppendInt(writer, value);
+}
+
+void CborWriter_AddFloat(CborWriter *writer, const char *name, double value,
+                         unsigned int precision)
+{
+    BeginValue(writer, name);
+
+    if (!isfinite(value)) {
+        AppendFloat32(writer, (float)value);
+        return;
+    }
+
+    // The value is always written as a float, even if it is a whole number, so that the type of
+    // a member does not change from one message to the next.
+    double scale = pow(10.0, precision);
+    double rounded = round(value * scale) / scale;
+
+    float narrowed = (float)rounded;
+    if (fabs((double)narrowed - rounded) * scale >= 0.5) {
+        AppendFloat64(writer, rounded);
+        return;
+    }
+
+    uint16_t half;
+    if ((double)narrowed == rounded && ToFloat16(narrowed, &half)) {
+        AppendFloat16(writer, half);
+    } else {
+        AppendFloat32(writer, narrowed);
+    }
+}
+
+void CborWriter_AddBool(CborWriter *writer, const char *name, bool value)
+{
+    BeginValue(writer, name);
+    AppendByte(writer, value ? CBOR_TRUE : CBOR_FALSE);
+}
+
+void CborWriter_AddString(CborWriter *writer, const char *name, const char *value)
+{
+    BeginValue(writer, name);
+    AppendText(writer, value);
+}
+
+const uint8_t *CborWriter_Finish(CborWriter *writer, size_t *length)
+{
+    if (writer->failed || writer->depth != 0 || (writer->hasValueMask & 1u) == 0) {
+        return NULL;
+    }
+
+    *length = writer->length;
+    return writer->buffer;
+}
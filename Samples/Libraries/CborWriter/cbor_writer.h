@@ -0,0 +1,130 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// The CBOR writer serializes a CBOR (RFC 8949) document directly into a caller-supplied buffer as
+// values are appended, in the same way as the JSON writer. Objects and arrays are written as
+// indefinite-length maps and arrays, so the number of members need not be known in advance, and
+// each value is written in the shortest form which represents it. If the document does not fit
+// into the buffer, or the calls are unbalanced, the writer records the failure and ignores further
+// calls; CborWriter_Finish then returns NULL.
+
+/// <summary>
+///     Content type to set on an IoT Hub message whose body was written by the CBOR writer.
+/// </summary>
+#define CBOR_WRITER_CONTENT_TYPE "application/cbor"
+
+/// <summary>
+///     Maximum depth to which objects and arrays may be nested.
+/// </summary>
+#define CBOR_WRITER_MAX_DEPTH 16
+
+/// <summary>
+///     State of a CBOR writer. The fields are private to cbor_writer.c.
+/// </summary>
+typedef struct {
+    uint8_t *buffer;
+    size_t size;
+    size_t length;
+    // Bit n is set if the container at depth n already holds a value.
+    uint32_t hasValueMask;
+    // Bit n is set if the container at depth n is an array rather than an object.
+    uint32_t isArrayMask;
+    uint8_t depth;
+    bool failed;
+} CborWriter;
+
+/// <summary>
+///     Start writing a CBOR document into the given buffer.
+/// </summary>
+/// <param name="writer">The writer to initialize.</param>
+/// <param name="buffer">Buffer to receive the document.</param>
+/// <param name="size">Size of the buffer in bytes.</param>
+void CborWriter_Init(CborWriter *writer, uint8_t *buffer, size_t size);
+
+/// <summary>
+///     Begin an object, which is written as a map with text keys. Every call must be matched by
+///     a call to CborWriter_EndObject.
+/// </summary>
+/// <param name="writer">The writer.</param>
+/// <param name="name">
+///     Name of the member within the enclosing object, or NULL for the top-level value or an
+///     element of an array.
+/// </param>
+void CborWriter_BeginObject(CborWriter *writer, const char *name);
+
+/// <summary>
+///     End the object begun by the most recent unmatched call to CborWriter_BeginObject.
+/// </summary>
+/// <param name="writer">The writer.</param>
+void CborWriter_EndObject(CborWriter *writer);
+
+/// <summary>
+///     Begin an array. Every call must be matched by a call to CborWriter_EndArray.
+/// </summary>
+/// <param name="writer">The writer.</param>
+/// <param name="name">
+///     Name of the member within the enclosing object, or NULL for the top-level value or an
+///     element of an array.
+/// </param>
+void CborWriter_BeginArray(CborWriter *writer, const char *name);
+
+/// <summary>
+///     End the array begun by the most recent unmatched call to CborWriter_BeginArray.
+/// </summary>
+/// <param name="writer">The writer.</param>
+void CborWriter_EndArray(CborWriter *writer);
+
+/// <summary>
+///     Append an integer value.
+/// </summary>
+/// <param name="writer">The writer.</param>
+/// <param name="name">Name of the member, or NULL if the enclosing container is an array.</param>
+/// <param name="value">The value.</param>
+void CborWriter_AddInt(CborWriter *writer, const char *name, int64_t value);
+
+/// <summary>
+///     Append a floating-point value, rounded to a fixed number of digits after the decimal
+///     point. It is always written as a float, even if it is a whole number: as a half-precision
+///     float if that holds the rounded value exactly, as a single-precision float if that holds
+///     it to within the precision, and as a double-precision float if not. Values which are not
+///     finite are written as such.
+/// </summary>
+/// <param name="writer">The writer.</param>
+/// <param name="name">Name of the member, or NULL if the enclosing container is an array.</param>
+/// <param name="value">The value.</param>
+/// <param name="precision">Number of digits to keep after the decimal point.</param>
+void CborWriter_AddFloat(CborWriter *writer, const char *name, double value,
+                         unsigned int precision);
+
+/// <summary>
+///     Append a boolean value.
+/// </summary>
+/// <param name="writer">The writer.</param>
+/// <param name="name">Name of the member, or NULL if the enclosing container is an array.</param>
+/// <param name="value">The value.</param>
+void CborWriter_AddBool(CborWriter *writer, const char *name, bool value);
+
+/// <summary>
+///     Append a string value.
+/// </summary>
+/// <param name="writer">The writer.</param>
+/// <param name="name">Name of the member, or NULL if the enclosing container is an array.</param>
+/// <param name="value">The null-terminated UTF-8 value.</param>
+void CborWriter_AddString(CborWriter *writer, const char *name, const char *value);
+
+/// <summary>
+///     Finish writing the document.
+/// </summary>
+/// <param name="writer">The writer.</param>
+/// <param name="length">Receives the length of the document in bytes.</param>
+/// <returns>
+///     The document, which is held in the buffer passed to CborWriter_Init; or NULL if it did not
+///     fit into the buffer or an object or array was left open.
+/// </returns>
+const uint8_t *CborWriter_Finish(CborWriter *writer, size_t *length);
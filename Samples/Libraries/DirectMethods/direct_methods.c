@@ -0,0 +1,158 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <applibs/log.h>
+
+#include "direct_methods.h"
+
+typedef struct {
+    const char *name;
+    uint32_t hash;
+    DirectMethods_Handler handler;
+    void *context;
+} Method;
+
+struct DirectMethods_Call {
+    bool inUse;
+    // Set if the client which received the call has been destroyed.
+    bool cancelled;
+    void *methodId;
+    const char *name;
+    char response[DIRECT_METHODS_RESPONSE_SIZE];
+};
+
+static Method methods[DIRECT_METHODS_MAX_METHODS];
+static size_t methodCount = 0;
+static DirectMethods_Call calls[DIRECT_METHODS_MAX_PENDING];
+static DirectMethods_ResponseSender responseSender = NULL;
+
+static const char emptyResponse[] = "{}";
+
+// 32-bit FNV-1a hash of a method name.
+static uint32_t HashName(const char *name)
+{
+    uint32_t hash = 2166136261u;
+    while (*name != '\0') {
+        hash ^= (uint8_t)*name++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static const Method *FindMethod(const char *name)
+{
+    uint32_t hash = HashName(name);
+    for (size_t i = 0; i < methodCount; ++i) {
+        if (methods[i].hash == hash && strcmp(methods[i].name, name) == 0) {
+            return &methods[i];
+        }
+    }
+    return NULL;
+}
+
+static void SendResponse(void *methodId, int status, const char *response, size_t responseSize)
+{
+    if (responseSize == 0) {
+        response = emptyResponse;
+        responseSize = sizeof(emptyResponse) - 1;
+    }
+    if (responseSender != NULL) {
+        responseSender(methodId, status, (const unsigned char *)response, responseSize);
+    }
+}
+
+void DirectMethods_Initialize(DirectMethods_ResponseSender sender)
+{
+    responseSender = sender;
+}
+
+int DirectMethods_Register(const char *name, DirectMethods_Handler handler, void *context)
+{
+    if (FindMethod(name) != NULL) {
+        errno = EEXIST;
+        return -1;
+    }
+    if (methodCount == DIRECT_METHODS_MAX_METHODS) {
+        errno = ENOSPC;
+        return -1;
+    }
+
+    methods[methodCount].name = name;
+    methods[methodCount].hash = HashName(name);
+    methods[methodCount].handler = handler;
+    methods[methodCount].context = context;
+    ++methodCount;
+    return 0;
+}
+
+void DirectMethods_Dispatch(const char *name, const unsigned char *payload, size_t payloadSize,
+                            void *methodId)
+{
+    const Method *method = FindMethod(name);
+    if (method == NULL) {
+        Log_Debug("WARNING: Direct method '%s' is not registered.\n", name);
+        SendResponse(methodId, DIRECT_METHODS_STATUS_NOT_FOUND, NULL, 0);
+        return;
+    }
+
+    DirectMethods_Call *call = NULL;
+    for (size_t i = 0; i < DIRECT_METHODS_MAX_PENDING; ++i) {
+        if (!calls[i].inUse) {
+            call = &calls[i];
+            break;
+        }
+    }
+    if (call == NULL) {
+        Log_Debug("WARNING: Too many direct method calls in progress; '%s' rejected.\n", name);
+        SendResponse(methodId, DIRECT_METHODS_STATUS_BUSY, NULL, 0);
+        return;
+    }
+
+    call->inUse = true;
+    call->cancelled = false;
+    call->methodId = methodId;
+    call->name = method->name;
+    method->handler(call, payload, payloadSize, method->context);
+}
+
+char *DirectMethods_GetResponseBuffer(DirectMethods_Call *call, size_t *size)
+{
+    *size = sizeof(call->response);
+    return call->response;
+}
+
+void DirectMethods_Respond(DirectMethods_Call *call, int status, size_t responseSize)
+{
+    if (!call->inUse) {
+        return;
+    }
+    call->inUse = false;
+
+    if (call->cancelled) {
+        Log_Debug("INFO: Response to cancelled direct method '%s' discarded.\n", call->name);
+        return;
+    }
+
+    if (responseSize > sizeof(call->response)) {
+        responseSize = sizeof(call->response);
+    }
+    SendResponse(call->methodId, status, call->response, responseSize);
+}
+
+void DirectMethods_RespondJson(DirectMethods_Call *call, int status, const char *json)
+{
+    size_t length = strnlen(json, sizeof(call->response));
+    memcpy(call->response, json, length);
+    DirectMethods_Respond(call, status, length);
+}
+
+void DirectMethods_CancelAll(void)
+{
+    for (size_t i = 0; i < DIRECT_METHODS_MAX_PENDING; ++i) {
+        calls[i].cancelled = true;
+    }
+}
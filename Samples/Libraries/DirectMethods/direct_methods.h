@@ -0,0 +1,130 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The direct method dispatcher finds the handler of each direct method which the IoT Hub invokes
+// in a table of methods, which the application registers at startup. The method names are hashed
+// when they are registered, so a call is matched by comparing hashes, and its name is only
+// compared with the name of the handler whose hash matches.
+//
+// A handler does not have to respond while the IoT Hub client is calling it: it can start work,
+// for example a request to an MCU, and respond when the work completes. Each call which is in
+// progress has a response buffer of DIRECT_METHODS_RESPONSE_SIZE bytes, which is preallocated, so
+// that handling a call does not allocate memory. The application supplies the function which
+// sends each response to the IoT Hub, so the dispatcher does not depend on the Azure IoT SDK.
+//
+// The dispatcher is not thread-safe; it should only be used from the event loop's thread.
+
+/// <summary>Maximum number of methods which can be registered.</summary>
+#define DIRECT_METHODS_MAX_METHODS 8
+
+/// <summary>Maximum number of calls which can be in progress at once.</summary>
+#define DIRECT_METHODS_MAX_PENDING 4
+
+/// <summary>Size of the response buffer of each call, in bytes.</summary>
+#define DIRECT_METHODS_RESPONSE_SIZE 256
+
+/// <summary>Status with which a successful call is answered.</summary>
+#define DIRECT_METHODS_STATUS_OK 200
+/// <summary>Status with which a handler answers a call whose payload is invalid.</summary>
+#define DIRECT_METHODS_STATUS_BAD_REQUEST 400
+/// <summary>Status with which a call to a method which is not registered is answered.</summary>
+#define DIRECT_METHODS_STATUS_NOT_FOUND 404
+/// <summary>Status with which a handler answers a call whose work failed.</summary>
+#define DIRECT_METHODS_STATUS_ERROR 500
+/// <summary>Status with which a call is answered when DIRECT_METHODS_MAX_PENDING calls are
+/// already in progress.</summary>
+#define DIRECT_METHODS_STATUS_BUSY 503
+
+/// <summary>A call which is in progress.</summary>
+typedef struct DirectMethods_Call DirectMethods_Call;
+
+/// <summary>
+///     Handles a call of a method. The handler must respond to the call exactly once, with
+///     DirectMethods_Respond or DirectMethods_RespondJson, either before it returns or later.
+/// </summary>
+/// <param name="call">The call.</param>
+/// <param name="payload">The JSON payload of the call, which is not null-terminated, and is only
+/// valid for the duration of the call to the handler.</param>
+/// <param name="payloadSize">Size of the payload in bytes.</param>
+/// <param name="context">Context which was supplied when the method was registered.</param>
+typedef void (*DirectMethods_Handler)(DirectMethods_Call *call, const unsigned char *payload,
+                                      size_t payloadSize, void *context);
+
+/// <summary>
+///     Sends the response to a call to the IoT Hub.
+/// </summary>
+/// <param name="methodId">Identifier of the call, which was supplied to
+/// DirectMethods_Dispatch.</param>
+/// <param name="status">Status of the call.</param>
+/// <param name="response">The JSON response.</param>
+/// <param name="responseSize">Size of the response in bytes.</param>
+typedef void (*DirectMethods_ResponseSender)(void *methodId, int status,
+                                             const unsigned char *response, size_t responseSize);
+
+/// <summary>
+///     Sets the function which sends responses. This should be called before the IoT Hub client
+///     is set up.
+/// </summary>
+/// <param name="sender">The function.</param>
+void DirectMethods_Initialize(DirectMethods_ResponseSender sender);
+
+/// <summary>
+///     Registers the handler of a method.
+/// </summary>
+/// <param name="name">Name of the method, which must remain valid.</param>
+/// <param name="handler">The handler.</param>
+/// <param name="context">Context which is passed to the handler.</param>
+/// <returns>0 on success, or -1 on failure, in which case errno is set: EEXIST if a method with
+/// the name is registered, or ENOSPC if DIRECT_METHODS_MAX_METHODS are registered.</returns>
+int DirectMethods_Register(const char *name, DirectMethods_Handler handler, void *context);
+
+/// <summary>
+///     Passes a call which the IoT Hub client has received to the handler of its method. If the
+///     method is not registered, or too many calls are in progress, the call is answered at once
+///     with DIRECT_METHODS_STATUS_NOT_FOUND or DIRECT_METHODS_STATUS_BUSY.
+/// </summary>
+/// <param name="name">Name of the method.</param>
+/// <param name="payload">The JSON payload of the call.</param>
+/// <param name="payloadSize">Size of the payload in bytes.</param>
+/// <param name="methodId">Identifier of the call, which is passed to the response sender.</param>
+void DirectMethods_Dispatch(const char *name, const unsigned char *payload, size_t payloadSize,
+                            void *methodId);
+
+/// <summary>
+///     Gets the response buffer of a call, into which the handler writes its response.
+/// </summary>
+/// <param name="call">The call.</param>
+/// <param name="size">Receives the size of the buffer, DIRECT_METHODS_RESPONSE_SIZE.</param>
+/// <returns>The buffer.</returns>
+char *DirectMethods_GetResponseBuffer(DirectMethods_Call *call, size_t *size);
+
+/// <summary>
+///     Responds to a call with the JSON which the handler wrote into the response buffer, and
+///     ends the call. An empty response is sent as "{}".
+/// </summary>
+/// <param name="call">The call.</param>
+/// <param name="status">Status of the call, such as DIRECT_METHODS_STATUS_OK.</param>
+/// <param name="responseSize">Size of the response in the buffer, in bytes.</param>
+void DirectMethods_Respond(DirectMethods_Call *call, int status, size_t responseSize);
+
+/// <summary>
+///     Responds to a call with a JSON string, which is copied into the response buffer, and ends
+///     the call.
+/// </summary>
+/// <param name="call">The call.</param>
+/// <param name="status">Status of the call.</param>
+/// <param name="json">The null-terminated JSON response, which is truncated to the size of the
+/// response buffer.</param>
+void DirectMethods_RespondJson(DirectMethods_Call *call, int status, const char *json);
+
+/// <summary>
+///     Cancels the calls which are in progress, because the IoT Hub client which received them has
+///     been destroyed. The handlers must still respond to the calls, but the responses are
+///     discarded.
+/// </summary>
+void DirectMethods_CancelAll(void);
@@ -0,0 +1,268 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <applibs/application.h>
+#include <applibs/log.h>
+#include <applibs/storage.h>
+
+#include "event_journal.h"
+
+// Records which acknowledge the events up to the sequence number in their value field.
+#define RECORD_TYPE_ACKNOWLEDGE 0x80
+
+typedef struct {
+    uint32_t sequence;
+    uint8_t type;
+    uint8_t code;
+    uint16_t peakUserModeMemoryKB;
+    // Time since boot in seconds or, for an acknowledgement, the last sequence number which it
+    // acknowledges.
+    uint32_t value;
+    uint32_t crc;
+} Record;
+
+_Static_assert(sizeof(Record) == 16, "Record must be 16 bytes");
+
+static const int crashSignals[] = {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT};
+
+// The descriptor is kept open, so that the crash handler can write without opening the file.
+static volatile int journalFd = -1;
+static off_t regionOffset = 0;
+static size_t slotCount = 0;
+// Slot and sequence number of the latest record; the sequence number is 0 if there is none.
+static size_t latestSlot = 0;
+static uint32_t latestSequence = 0;
+// Sequence number of the latest acknowledged event, or 0 if none has been acknowledged.
+static uint32_t acknowledgedSequence = 0;
+static uint16_t peakMemoryKB = 0;
+
+// Computed without a table, and without library calls, so that it is safe in a signal handler.
+static uint32_t RecordCrc(const Record *record)
+{
+    const uint8_t *bytes = (const uint8_t *)record;
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < offsetof(Record, crc); ++i) {
+        crc ^= bytes[i];
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc >> 1) ^ (0xEDB88320u & -(crc & 1u));
+        }
+    }
+    return ~crc;
+}
+
+// Whether sequence number a is later than b, allowing for the sequence numbers wrapping around.
+static bool IsLater(uint32_t a, uint32_t b)
+{
+    return (int32_t)(a - b) > 0;
+}
+
+static off_t SlotOffset(size_t slot)
+{
+    return regionOffset + (off_t)(slot * sizeof(Record));
+}
+
+static bool ReadSlot(size_t slot, Record *record)
+{
+    return pread(journalFd, record, sizeof(*record), SlotOffset(slot)) == sizeof(*record) &&
+           record->sequence != 0 && record->crc == RecordCrc(record);
+}
+
+static uint32_t UptimeSeconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_BOOTTIME, &now);
+    return (uint32_t)now.tv_sec;
+}
+
+// Appends a record after the latest one. This only uses async-signal-safe functions, so that the
+// crash handler can call it.
+static int AppendRecord(uint8_t type, uint8_t code, uint32_t value)
+{
+    if (journalFd == -1) {
+        errno = EBADF;
+        return -1;
+    }
+
+    Record record;
+    memset(&record, 0, sizeof(record));
+    // Sequence number 0 means that a slot holds no record, so skip it when wrapping around.
+    record.sequence = latestSequence + 1;
+    if (record.sequence == 0) {
+        record.sequence = 1;
+    }
+    record.type = type;
+    record.code = code;
+    record.peakUserModeMemoryKB = peakMemoryKB;
+    record.value = value;
+    record.crc = RecordCrc(&record);
+
+    size_t slot = (latestSequence == 0) ? 0 : (latestSlot + 1) % slotCount;
+    if (pwrite(journalFd, &record, sizeof(record), SlotOffset(slot)) != sizeof(record)) {
+        if (errno == 0) {
+            errno = EIO;
+        }
+        return -1;
+    }
+
+    latestSlot = slot;
+    latestSequence = record.sequence;
+    return 0;
+}
+
+static int AppendEvent(EventJournal_EventType type, uint8_t code)
+{
+    size_t peak = Applications_GetPeakUserModeMemoryUsageInKB();
+    peakMemoryKB = (peak > UINT16_MAX) ? UINT16_MAX : (uint16_t)peak;
+    return AppendRecord((uint8_t)type, code, UptimeSeconds());
+}
+
+int EventJournal_Open(off_t storageOffset, size_t storageSize)
+{
+    if (journalFd != -1 || storageSize < 2 * sizeof(Record)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    int fd = Storage_OpenMutableFile();
+    if (fd == -1) {
+        return -1;
+    }
+
+    journalFd = fd;
+    regionOffset = storageOffset;
+    slotCount = storageSize / sizeof(Record);
+    latestSlot = 0;
+    latestSequence = 0;
+    acknowledgedSequence = 0;
+
+    // Find the latest record; on a new device, the region reads as zeros or is beyond the end of
+    // the file, so holds no valid record.
+    Record record;
+    uint8_t latestType = 0;
+    for (size_t slot = 0; slot < slotCount; ++slot) {
+        if (ReadSlot(slot, &record) &&
+            (latestSequence == 0 || IsLater(record.sequence, latestSequence))) {
+            latestSlot = slot;
+            latestSequence = record.sequence;
+            latestType = record.type;
+        }
+    }
+
+    // Find the latest acknowledgement which is still in the ring.
+    bool acknowledgementFound = false;
+    for (size_t slot = 0; slot < slotCount; ++slot) {
+        if (ReadSlot(slot, &record) && record.type == RECORD_TYPE_ACKNOWLEDGE &&
+            (!acknowledgementFound || IsLater(record.value, acknowledgedSequence))) {
+            acknowledgedSequence = record.value;
+            acknowledgementFound = true;
+        }
+    }
+
+    if (latestType == EventJournal_Start) {
+        AppendEvent(EventJournal_Lost, 0);
+    }
+    if (AppendEvent(EventJournal_Start, 0) == -1) {
+        int error = errno;
+        EventJournal_Close();
+        errno = error;
+        return -1;
+    }
+
+    return 0;
+}
+
+static void CrashHandler(int signalNumber)
+{
+    AppendRecord(EventJournal_Crash, (uint8_t)signalNumber, UptimeSeconds());
+
+    // SA_RESETHAND has restored the default action, so this terminates the application, and the
+    // crash is reported as it would have been without the handler.
+    raise(signalNumber);
+}
+
+int EventJournal_InstallCrashHandler(void)
+{
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = CrashHandler;
+    action.sa_flags = SA_RESETHAND;
+    sigemptyset(&action.sa_mask);
+
+    for (size_t i = 0; i < sizeof(crashSignals) / sizeof(crashSignals[0]); ++i) {
+        if (sigaction(crashSignals[i], &action, NULL) == -1) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int EventJournal_RecordExit(uint8_t exitCode)
+{
+    return AppendEvent(EventJournal_Exit, exitCode);
+}
+
+int EventJournal_ReadBatch(EventJournal_Entry *entries, size_t maxEntries)
+{
+    if (journalFd == -1) {
+        errno = EBADF;
+        return -1;
+    }
+
+    // Walk back from the latest record to the oldest one which has not been acknowledged, then
+    // read forwards from there.
+    size_t unacknowledged = 0;
+    while (unacknowledged < slotCount) {
+        uint32_t sequence = latestSequence - (uint32_t)unacknowledged;
+        if (sequence == 0 || (acknowledgedSequence != 0 &&
+                              !IsLater(sequence, acknowledgedSequence))) {
+            break;
+        }
+        ++unacknowledged;
+    }
+
+    size_t count = 0;
+    for (size_t back = unacknowledged; back > 0 && count < maxEntries; --back) {
+        size_t slot = (latestSlot + slotCount - (back - 1)) % slotCount;
+        Record record;
+        // Skip records which have been overwritten, or were never completely written.
+        if (!ReadSlot(slot, &record) || record.sequence != latestSequence - (uint32_t)(back - 1) ||
+            record.type == RECORD_TYPE_ACKNOWLEDGE) {
+            continue;
+        }
+
+        entries[count].sequence = record.sequence;
+        entries[count].type = (EventJournal_EventType)record.type;
+        entries[count].code = record.code;
+        entries[count].peakUserModeMemoryKB = record.peakUserModeMemoryKB;
+        entries[count].uptimeSeconds = record.value;
+        ++count;
+    }
+
+    return (int)count;
+}
+
+int EventJournal_Acknowledge(uint32_t sequence)
+{
+    if (AppendRecord(RECORD_TYPE_ACKNOWLEDGE, 0, sequence) == -1) {
+        return -1;
+    }
+
+    acknowledgedSequence = sequence;
+    return 0;
+}
+
+void EventJournal_Close(void)
+{
+    if (journalFd != -1) {
+        int fd = journalFd;
+        journalFd = -1;
+        close(fd);
+    }
+}
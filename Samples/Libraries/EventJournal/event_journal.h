@@ -0,0 +1,110 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// The event journal keeps a history of the application's starts, exits and crashes in a region of
+// its mutable storage file, so that a crash loop in the field can be diagnosed from the device
+// afterwards, without a debugger attached.
+//
+// The region is a ring of fixed-size records, each of which has a sequence number and a CRC. Each
+// event is written to the slot after the latest one, so no record is ever rewritten in place, and
+// writes are spread evenly over the region; once the ring is full, the oldest record is
+// overwritten. On opening, the journal finds the latest valid record, so a record which was only
+// partly written when power was lost is ignored.
+//
+// Events are marked as uploaded by appending an acknowledgement, rather than by erasing them, so
+// that an application which is connected can send the journal in batches, and acknowledge each
+// batch once the cloud has received it.
+//
+// The journal is not thread-safe; apart from the crash handler, it should only be used from the
+// event loop's thread.
+
+/// <summary>
+///     Type of an event in the journal.
+/// </summary>
+typedef enum {
+    /// <summary>The application started.</summary>
+    EventJournal_Start = 1,
+    /// <summary>The application exited; the code is its exit code.</summary>
+    EventJournal_Exit = 2,
+    /// <summary>The application crashed; the code is the signal which it received.</summary>
+    EventJournal_Crash = 3,
+    /// <summary>The previous run of the application ended without an exit or crash being
+    /// recorded, for example because it was killed, it ran out of memory or power was lost. This
+    /// is recorded when the next run starts, so its memory usage and uptime are those of that
+    /// run.</summary>
+    EventJournal_Lost = 4
+} EventJournal_EventType;
+
+/// <summary>
+///     An event which has been read from the journal.
+/// </summary>
+typedef struct {
+    /// <summary>Sequence number of the event, which increases by one for each record.</summary>
+    uint32_t sequence;
+    /// <summary>What happened.</summary>
+    EventJournal_EventType type;
+    /// <summary>For <see cref="EventJournal_Exit" />, the exit code; for
+    /// <see cref="EventJournal_Crash" />, the signal number; otherwise 0.</summary>
+    uint8_t code;
+    /// <summary>Peak user-mode memory usage of the application when the event was recorded, in
+    /// KiB.</summary>
+    uint32_t peakUserModeMemoryKB;
+    /// <summary>Time since the device booted when the event was recorded, in seconds.</summary>
+    uint32_t uptimeSeconds;
+} EventJournal_Entry;
+
+/// <summary>
+///     Opens the journal, and records the start of this run of the application. If the previous
+///     run did not record an exit or crash, a <see cref="EventJournal_Lost" /> event is recorded
+///     first.
+/// </summary>
+/// <param name="storageOffset">Offset of the region in the mutable storage file.</param>
+/// <param name="storageSize">Size of the region, in bytes; it holds storageSize / 16
+/// records.</param>
+/// <returns>0 on success, or -1 on failure, in which case errno is set.</returns>
+int EventJournal_Open(off_t storageOffset, size_t storageSize);
+
+/// <summary>
+///     Records a crash in the journal when the application receives SIGSEGV, SIGBUS, SIGFPE,
+///     SIGILL or SIGABRT, then lets the signal terminate the application as it would have done
+///     otherwise. The memory usage which is recorded is the peak when the last event was recorded.
+/// </summary>
+/// <returns>0 on success, or -1 on failure, in which case errno is set.</returns>
+int EventJournal_InstallCrashHandler(void);
+
+/// <summary>
+///     Records that the application is exiting.
+/// </summary>
+/// <param name="exitCode">The application's exit code.</param>
+/// <returns>0 on success, or -1 on failure, in which case errno is set.</returns>
+int EventJournal_RecordExit(uint8_t exitCode);
+
+/// <summary>
+///     Reads the oldest events which have not been acknowledged, in the order in which they
+///     were recorded.
+/// </summary>
+/// <param name="entries">Array which receives the events.</param>
+/// <param name="maxEntries">Number of elements in the array.</param>
+/// <returns>The number of events which were read, which is 0 if every event has been
+/// acknowledged, or -1 on failure, in which case errno is set.</returns>
+int EventJournal_ReadBatch(EventJournal_Entry *entries, size_t maxEntries);
+
+/// <summary>
+///     Acknowledges the events up to and including the supplied one, for example once they have
+///     been uploaded, so that <see cref="EventJournal_ReadBatch" /> no longer returns them.
+/// </summary>
+/// <param name="sequence">Sequence number of the last event to acknowledge.</param>
+/// <returns>0 on success, or -1 on failure, in which case errno is set.</returns>
+int EventJournal_Acknowledge(uint32_t sequence);
+
+/// <summary>
+///     Closes the journal. The crash handler, if it was installed, no longer records crashes.
+/// </summary>
+void EventJournal_Close(void);
@@ -0,0 +1,228 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <applibs/log.h>
+
+// This file calls the event loop functions which the header redirects.
+#define EVENTLOOP_STATS_NO_REDIRECT
+#include "eventloop_stats.h"
+
+#ifdef EVENT_TRACE
+#include "event_trace.h"
+#endif
+
+// An IO callback which has been registered through EventLoopStats_RegisterIo.
+typedef struct IoWrapper {
+    EventLoopIoCallback *callback;
+    void *context;
+    EventLoopStats_Handler *stats;
+    EventRegistration *registration;
+    struct IoWrapper *next;
+} IoWrapper;
+
+static EventLoopStats_Handler handlers[EVENTLOOP_STATS_MAX_HANDLERS];
+static size_t handlerCount = 0;
+static IoWrapper *ioWrappers = NULL;
+
+// The report is produced when the event loop next returns after the period has elapsed, so that
+// the instrumentation does not wake the device itself.
+static EventLoopStats_ReportHandler reportHandler = NULL;
+static void *reportContext = NULL;
+static uint64_t reportPeriodUs = EVENTLOOP_STATS_REPORT_PERIOD_SECONDS * 1000000ULL;
+static uint64_t periodStartUs = 0;
+static uint32_t wakeups = 0;
+
+static uint64_t NowUs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + (uint64_t)now.tv_nsec / 1000;
+}
+
+EventLoopStats_Handler *EventLoopStats_GetHandler(const char *name)
+{
+    // Names which come from "#handler" may be written as "&Handler".
+    while (*name == '&' || *name == ' ' || *name == '(') {
+        ++name;
+    }
+
+    for (size_t i = 0; i < handlerCount; ++i) {
+        if (strcmp(handlers[i].name, name) == 0) {
+            return &handlers[i];
+        }
+    }
+
+    if (handlerCount == EVENTLOOP_STATS_MAX_HANDLERS) {
+        return NULL;
+    }
+
+    EventLoopStats_Handler *handler = &handlers[handlerCount++];
+    memset(handler, 0, sizeof(*handler));
+    handler->name = name;
+    return handler;
+}
+
+uint64_t EventLoopStats_BeginHandler(void)
+{
+    return NowUs();
+}
+
+void EventLoopStats_EndHandler(EventLoopStats_Handler *handler, uint64_t startUs)
+{
+    if (handler == NULL) {
+        return;
+    }
+
+    uint64_t endUs = NowUs();
+#ifdef EVENT_TRACE
+    // Both use CLOCK_MONOTONIC, so the handler's times can be passed to the tracer directly.
+    EventTrace_Complete("eventloop", handler->name, startUs, endUs);
+#endif
+
+    uint64_t elapsedUs = endUs - startUs;
+    ++handler->invocations;
+    handler->totalUs += elapsedUs;
+    if (elapsedUs > handler->maxUs) {
+        handler->maxUs = (elapsedUs < UINT32_MAX) ? (uint32_t)elapsedUs : UINT32_MAX;
+    }
+}
+
+// This satisfies the EventLoopIoCallback signature.
+static void TimedIoCallback(EventLoop *el, int fd, EventLoop_IoEvents events, void *context)
+{
+    IoWrapper *wrapper = context;
+
+    // The callback may unregister itself, which frees the wrapper.
+    EventLoopStats_Handler *stats = wrapper->stats;
+    uint64_t startUs = EventLoopStats_BeginHandler();
+    wrapper->callback(el, fd, events, wrapper->context);
+    EventLoopStats_EndHandler(stats, startUs);
+}
+
+EventRegistration *EventLoopStats_RegisterIo(EventLoop *el, int fd, EventLoop_IoEvents eventBitmask,
+                                             EventLoopIoCallback *callback, void *context,
+                                             const char *name)
+{
+    IoWrapper *wrapper = malloc(sizeof(*wrapper));
+    if (wrapper == NULL) {
+        return NULL;
+    }
+
+    wrapper->callback = callback;
+    wrapper->context = context;
+    wrapper->stats = EventLoopStats_GetHandler(name);
+    wrapper->registration = EventLoop_RegisterIo(el, fd, eventBitmask, TimedIoCallback, wrapper);
+    if (wrapper->registration == NULL) {
+        free(wrapper);
+        return NULL;
+    }
+
+    wrapper->next = ioWrappers;
+    ioWrappers = wrapper;
+    return wrapper->registration;
+}
+
+int EventLoopStats_UnregisterIo(EventLoop *el, EventRegistration *reg)
+{
+    for (IoWrapper **link = &ioWrappers; *link != NULL; link = &(*link)->next) {
+        IoWrapper *wrapper = *link;
+        if (wrapper->registration == reg) {
+            *link = wrapper->next;
+            free(wrapper);
+            break;
+        }
+    }
+
+    return EventLoop_UnregisterIo(el, reg);
+}
+
+static void Report(uint64_t nowUs)
+{
+    uint64_t periodUs = nowUs - periodStartUs;
+    EventLoopStats_Report report = {.periodMs = (uint32_t)(periodUs / 1000),
+                                    .wakeups = wakeups,
+                                    .handlers = handlers,
+                                    .handlerCount = handlerCount};
+    if (periodUs > 0) {
+        report.wakeupsPerSecondX100 = (uint32_t)((uint64_t)wakeups * 100000000 / periodUs);
+    }
+    for (size_t i = 0; i < handlerCount; ++i) {
+        report.handlerUs += handlers[i].totalUs;
+    }
+
+    if (reportHandler != NULL) {
+        reportHandler(&report, reportContext);
+    } else {
+        EventLoopStats_LogReport(&report);
+    }
+
+    for (size_t i = 0; i < handlerCount; ++i) {
+        handlers[i].invocations = 0;
+        handlers[i].totalUs = 0;
+        handlers[i].maxUs = 0;
+    }
+    wakeups = 0;
+    periodStartUs = nowUs;
+}
+
+EventLoop_Run_Result EventLoopStats_Run(EventLoop *el, int durationInMilliseconds,
+                                        bool processOnlyOneEvent)
+{
+    if (periodStartUs == 0) {
+        periodStartUs = NowUs();
+    }
+
+    EventLoop_Run_Result result = EventLoop_Run(el, durationInMilliseconds, processOnlyOneEvent);
+    if (result == EventLoop_Run_Finished) {
+        ++wakeups;
+    }
+
+    uint64_t nowUs = NowUs();
+    if (nowUs - periodStartUs >= reportPeriodUs) {
+        Report(nowUs);
+    }
+
+    return result;
+}
+
+void EventLoopStats_SetReportHandler(EventLoopStats_ReportHandler handler, void *context,
+                                     unsigned int periodSeconds)
+{
+    reportHandler = handler;
+    reportContext = context;
+    reportPeriodUs = (uint64_t)periodSeconds * 1000000;
+}
+
+void EventLoopStats_LogReport(const EventLoopStats_Report *report)
+{
+    Log_Debug("INFO: Event loop: %u wakeups in %u ms (%u.%02u/s); handlers ran for %llu us.\n",
+              report->wakeups, report->periodMs, report->wakeupsPerSecondX100 / 100,
+              report->wakeupsPerSecondX100 % 100, (unsigned long long)report->handlerUs);
+
+    // List the handlers which ran, busiest first, without reordering the caller's array.
+    bool logged[EVENTLOOP_STATS_MAX_HANDLERS] = {false};
+    while (true) {
+        const EventLoopStats_Handler *busiest = NULL;
+        size_t busiestIndex = 0;
+        for (size_t i = 0; i < report->handlerCount; ++i) {
+            const EventLoopStats_Handler *h = &report->handlers[i];
+            if (!logged[i] && h->invocations > 0 &&
+                (busiest == NULL || h->totalUs > busiest->totalUs)) {
+                busiest = h;
+                busiestIndex = i;
+            }
+        }
+        if (busiest == NULL) {
+            break;
+        }
+
+        logged[busiestIndex] = true;
+        Log_Debug("INFO:   %-32s %6u calls, %8llu us total, %6llu us mean, %6u us max\n",
+                  busiest->name, busiest->invocations, (unsigned long long)busiest->totalUs,
+                  (unsigned long long)(busiest->totalUs / busiest->invocations), busiest->maxUs);
+    }
+}
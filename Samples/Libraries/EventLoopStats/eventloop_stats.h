@@ -0,0 +1,136 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <applibs/eventloop.h>
+
+// Event loop instrumentation records how often each event handler runs, and for how long, and how
+// often the event loop wakes up, to find out what keeps a device awake. It is opt-in: when an
+// application is built with EVENTLOOP_STATS defined, the timer utilities time each timer handler,
+// and any file which includes eventloop_timer_utilities.h (or this header) has its calls to
+// EventLoop_RegisterIo, EventLoop_UnregisterIo and EventLoop_Run routed through the wrappers
+// below, so that the application's code does not have to change. Without EVENTLOOP_STATS, nothing
+// is instrumented. The statistics are logged every EVENTLOOP_STATS_REPORT_PERIOD_SECONDS, or
+// passed to a report handler which can send them as telemetry instead.
+//
+// The instrumentation is not thread-safe; it should only be used from the event loop's thread.
+
+/// <summary>Maximum number of handlers which are recorded. Further handlers are not
+/// timed.</summary>
+#define EVENTLOOP_STATS_MAX_HANDLERS 24
+
+/// <summary>Default period at which the statistics are reported.</summary>
+#define EVENTLOOP_STATS_REPORT_PERIOD_SECONDS 60
+
+/// <summary>Statistics about one event handler, which are reset after each report.</summary>
+typedef struct {
+    /// <summary>Name of the handler's function.</summary>
+    const char *name;
+    /// <summary>Number of times the handler was invoked.</summary>
+    uint32_t invocations;
+    /// <summary>Total time for which the handler ran, in microseconds.</summary>
+    uint64_t totalUs;
+    /// <summary>Longest time for which the handler ran, in microseconds.</summary>
+    uint32_t maxUs;
+} EventLoopStats_Handler;
+
+/// <summary>Statistics about the event loop over one report period.</summary>
+typedef struct {
+    /// <summary>Length of the period, in milliseconds.</summary>
+    uint32_t periodMs;
+    /// <summary>Number of times the event loop woke up and processed events.</summary>
+    uint32_t wakeups;
+    /// <summary>Number of wakeups per second, multiplied by 100.</summary>
+    uint32_t wakeupsPerSecondX100;
+    /// <summary>Total time for which the recorded handlers ran, in microseconds.</summary>
+    uint64_t handlerUs;
+    /// <summary>Statistics about each handler which has been recorded. Handlers which did not
+    /// run in the period have no invocations.</summary>
+    const EventLoopStats_Handler *handlers;
+    /// <summary>Number of elements in handlers.</summary>
+    size_t handlerCount;
+} EventLoopStats_Report;
+
+/// <summary>
+///     Invoked with the statistics at the end of each report period, after which they are reset.
+/// </summary>
+/// <param name="report">The statistics, which are only valid until the handler returns.</param>
+/// <param name="context">Context which was supplied to EventLoopStats_SetReportHandler.</param>
+typedef void (*EventLoopStats_ReportHandler)(const EventLoopStats_Report *report, void *context);
+
+/// <summary>
+///     Gets the statistics of a handler by name, adding them if they have not been recorded.
+/// </summary>
+/// <param name="name">Name of the handler, which must remain valid; usually a string
+/// literal.</param>
+/// <returns>The handler's statistics, or NULL if EVENTLOOP_STATS_MAX_HANDLERS handlers are already
+/// recorded.</returns>
+EventLoopStats_Handler *EventLoopStats_GetHandler(const char *name);
+
+/// <summary>
+///     Gets the time at which a handler starts, to pass to EventLoopStats_EndHandler.
+/// </summary>
+/// <returns>The current CLOCK_MONOTONIC time, in microseconds.</returns>
+uint64_t EventLoopStats_BeginHandler(void);
+
+/// <summary>
+///     Records that a handler has finished.
+/// </summary>
+/// <param name="handler">Statistics returned by EventLoopStats_GetHandler, or NULL, in which case
+/// nothing is recorded.</param>
+/// <param name="startUs">Value returned by EventLoopStats_BeginHandler when the handler
+/// started.</param>
+void EventLoopStats_EndHandler(EventLoopStats_Handler *handler, uint64_t startUs);
+
+/// <summary>
+///     Registers an IO callback like EventLoop_RegisterIo, and records how often and for how long
+///     it runs.
+/// </summary>
+/// <param name="name">Name under which the callback is recorded.</param>
+/// <returns>The registration, which should be unregistered with EventLoopStats_UnregisterIo; or
+/// NULL on failure, in which case errno is set.</returns>
+EventRegistration *EventLoopStats_RegisterIo(EventLoop *el, int fd, EventLoop_IoEvents eventBitmask,
+                                             EventLoopIoCallback *callback, void *context,
+                                             const char *name);
+
+/// <summary>
+///     Unregisters an IO callback which was registered with EventLoopStats_RegisterIo, or with
+///     EventLoop_RegisterIo.
+/// </summary>
+int EventLoopStats_UnregisterIo(EventLoop *el, EventRegistration *reg);
+
+/// <summary>
+///     Runs the event loop like EventLoop_Run, and counts its wakeups. The first call starts
+///     reporting the statistics every EVENTLOOP_STATS_REPORT_PERIOD_SECONDS.
+/// </summary>
+EventLoop_Run_Result EventLoopStats_Run(EventLoop *el, int durationInMilliseconds,
+                                        bool processOnlyOneEvent);
+
+/// <summary>
+///     Sets the function which receives the statistics, and the period at which it does so. By
+///     default, the statistics are logged every EVENTLOOP_STATS_REPORT_PERIOD_SECONDS.
+/// </summary>
+/// <param name="handler">Function which receives the statistics, or NULL to log them.</param>
+/// <param name="context">Context which is passed to the handler.</param>
+/// <param name="periodSeconds">Period at which the statistics are reported.</param>
+void EventLoopStats_SetReportHandler(EventLoopStats_ReportHandler handler, void *context,
+                                     unsigned int periodSeconds);
+
+/// <summary>
+///     Logs a report, listing the handlers which ran in the period with the busiest first.
+/// </summary>
+/// <param name="report">The statistics to log.</param>
+void EventLoopStats_LogReport(const EventLoopStats_Report *report);
+
+#if defined(EVENTLOOP_STATS) && !defined(EVENTLOOP_STATS_NO_REDIRECT)
+#define EventLoop_RegisterIo(el, fd, eventBitmask, callback, context) \
+    EventLoopStats_RegisterIo((el), (fd), (eventBitmask), (callback), (context), #callback)
+#define EventLoop_UnregisterIo(el, reg) EventLoopStats_UnregisterIo((el), (reg))
+#define EventLoop_Run(el, durationInMilliseconds, processOnlyOneEvent) \
+    EventLoopStats_Run((el), (durationInMilliseconds), (processOnlyOneEvent))
+#endif
@@ -0,0 +1,206 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <applibs/log.h>
+
+#include "event_trace.h"
+
+typedef enum {
+    EventKind_Complete,
+    EventKind_AsyncSpan,
+    EventKind_Instant
+} EventKind;
+
+// One recorded event. Only pointers to the names are kept, so that recording is cheap.
+typedef struct {
+    const char *category;
+    const char *name;
+    const char *argName;
+    uint64_t startUs;
+    uint32_t durationUs;
+    uint32_t id;
+    int32_t argValue;
+    EventKind kind;
+} Event;
+
+// Longest line which one exported event takes.
+#define MAX_EVENT_JSON_LENGTH 256
+
+static Event events[EVENT_TRACE_MAX_EVENTS];
+// Index of the oldest event, and the number of events which are recorded.
+static size_t head = 0;
+static size_t count = 0;
+// Number of events which were overwritten since the trace was last cleared.
+static uint32_t overwritten = 0;
+
+uint64_t EventTrace_NowUs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + (uint64_t)now.tv_nsec / 1000;
+}
+
+// Returns the record for a new event, overwriting the oldest if the ring is full.
+static Event *AppendEvent(EventKind kind, const char *category, const char *name)
+{
+    Event *event;
+    if (count < EVENT_TRACE_MAX_EVENTS) {
+        event = &events[(head + count) % EVENT_TRACE_MAX_EVENTS];
+        ++count;
+    } else {
+        event = &events[head];
+        head = (head + 1) % EVENT_TRACE_MAX_EVENTS;
+        ++overwritten;
+    }
+
+    event->kind = kind;
+    event->category = category;
+    event->name = name;
+    event->argName = NULL;
+    return event;
+}
+
+static uint32_t ClampDuration(uint64_t startUs, uint64_t endUs)
+{
+    if (endUs < startUs) {
+        return 0;
+    }
+    uint64_t durationUs = endUs - startUs;
+    return (durationUs < UINT32_MAX) ? (uint32_t)durationUs : UINT32_MAX;
+}
+
+void EventTrace_Complete(const char *category, const char *name, uint64_t startUs,
+                         uint64_t endUs)
+{
+    Event *event = AppendEvent(EventKind_Complete, category, name);
+    event->startUs = startUs;
+    event->durationUs = ClampDuration(startUs, endUs);
+}
+
+void EventTrace_AsyncSpan(const char *category, const char *name, uint32_t id, uint64_t startUs,
+                          uint64_t endUs, const char *argName, int32_t argValue)
+{
+    Event *event = AppendEvent(EventKind_AsyncSpan, category, name);
+    event->startUs = startUs;
+    event->durationUs = ClampDuration(startUs, endUs);
+    event->id = id;
+    event->argName = argName;
+    event->argValue = argValue;
+}
+
+void EventTrace_Instant(const char *category, const char *name, const char *argName,
+                        int32_t argValue)
+{
+    Event *event = AppendEvent(EventKind_Instant, category, name);
+    event->startUs = EventTrace_NowUs();
+    event->durationUs = 0;
+    event->argName = argName;
+    event->argValue = argValue;
+}
+
+// Formats the JSON of one trace event. An asynchronous span is exported as two trace events, so
+// this is called for it with end false and then with end true. Returns the length, like
+// snprintf.
+static int FormatEvent(char *buffer, size_t size, const Event *event, bool end)
+{
+    char args[64] = "";
+    if (event->argName != NULL && !end) {
+        snprintf(args, sizeof(args), ",\"args\":{\"%s\":%ld}", event->argName,
+                 (long)event->argValue);
+    }
+
+    unsigned long long startUs = (unsigned long long)event->startUs;
+    switch (event->kind) {
+    case EventKind_Complete:
+        return snprintf(buffer, size,
+                        "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%lu,"
+                        "\"pid\":1,\"tid\":1}",
+                        event->name, event->category, startUs, (unsigned long)event->durationUs);
+    case EventKind_AsyncSpan:
+        return snprintf(buffer, size,
+                        "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%s\",\"id\":\"0x%lx\","
+                        "\"ts\":%llu,\"pid\":1,\"tid\":1%s}",
+                        event->name, event->category, end ? "e" : "b", (unsigned long)event->id,
+                        end ? startUs + event->durationUs : startUs, args);
+    case EventKind_Instant:
+    default:
+        return snprintf(buffer, size,
+                        "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%llu,"
+                        "\"pid\":1,\"tid\":1%s}",
+                        event->name, event->category, startUs, args);
+    }
+}
+
+// Appends text to a buffer like snprintf, tracking the full length once the buffer is full.
+static void Append(char *buffer, size_t size, size_t *length, const char *text)
+{
+    int written = snprintf(*length < size ? buffer + *length : NULL,
+                           *length < size ? size - *length : 0, "%s", text);
+    if (written > 0) {
+        *length += (size_t)written;
+    }
+}
+
+size_t EventTrace_Serialize(char *buffer, size_t size)
+{
+    if (size > 0) {
+        buffer[0] = '\0';
+    }
+
+    size_t length = 0;
+    bool first = true;
+    char line[MAX_EVENT_JSON_LENGTH];
+    Append(buffer, size, &length, "{\"traceEvents\":[");
+    for (size_t i = 0; i < count; ++i) {
+        const Event *event = &events[(head + i) % EVENT_TRACE_MAX_EVENTS];
+        int parts = (event->kind == EventKind_AsyncSpan) ? 2 : 1;
+        for (int part = 0; part < parts; ++part) {
+            if (!first) {
+                Append(buffer, size, &length, ",");
+            }
+            first = false;
+            FormatEvent(line, sizeof(line), event, part == 1);
+            Append(buffer, size, &length, line);
+        }
+    }
+
+    snprintf(line, sizeof(line),
+             "],\"displayTimeUnit\":\"ms\",\"otherData\":{\"overwrittenEvents\":\"%lu\"}}",
+             (unsigned long)overwritten);
+    Append(buffer, size, &length, line);
+    return length;
+}
+
+void EventTrace_Log(void)
+{
+    Log_Debug("INFO: Event trace: %zu events, %lu overwritten. Save the lines between the markers "
+              "as a .json file, and open it in chrome://tracing or Perfetto.\n",
+              count, (unsigned long)overwritten);
+    Log_Debug("--- EVENT TRACE BEGIN ---\n");
+    Log_Debug("[\n");
+    bool first = true;
+    char line[MAX_EVENT_JSON_LENGTH];
+    for (size_t i = 0; i < count; ++i) {
+        const Event *event = &events[(head + i) % EVENT_TRACE_MAX_EVENTS];
+        int parts = (event->kind == EventKind_AsyncSpan) ? 2 : 1;
+        for (int part = 0; part < parts; ++part) {
+            FormatEvent(line, sizeof(line), event, part == 1);
+            // The separator leads each line, so that the array is valid however it ends.
+            Log_Debug("%s%s\n", first ? "" : ",", line);
+            first = false;
+        }
+    }
+    Log_Debug("]\n");
+    Log_Debug("--- EVENT TRACE END ---\n");
+}
+
+void EventTrace_Clear(void)
+{
+    head = 0;
+    count = 0;
+    overwritten = 0;
+}
@@ -0,0 +1,91 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The event tracer records what the application did, and when, into a ring of fixed-size
+// records, and exports them in the Chrome trace event format, so that the timeline of the event
+// handlers, the message protocol's requests, the HTTPS transfers and the DFU states can be
+// viewed in chrome://tracing or Perfetto. Recording an event only stores its time and the
+// pointers to its names; formatting happens when the trace is exported. Once the ring is full,
+// the oldest events are overwritten.
+//
+// It is opt-in: when an application is configured with EVENT_TRACE, the shared libraries which
+// are added after it record their events, and the application defines EVENT_TRACE too.
+// Categories, names and argument names are not copied, so they must remain valid; usually they
+// are string literals. They are not escaped either, so they should not contain quotes or
+// backslashes.
+//
+// The tracer is not thread-safe; it should only be used from the event loop's thread.
+
+/// <summary>Number of events which the ring holds. Each takes 40 bytes.</summary>
+#ifndef EVENT_TRACE_MAX_EVENTS
+#define EVENT_TRACE_MAX_EVENTS 256
+#endif
+
+/// <summary>
+///     Gets the current time, in the clock which the events use.
+/// </summary>
+/// <returns>The current CLOCK_MONOTONIC time, in microseconds.</returns>
+uint64_t EventTrace_NowUs(void);
+
+/// <summary>
+///     Records a span of synchronous work on the event loop's thread, such as an event handler.
+///     Spans which are recorded this way should nest within one another, or not overlap.
+/// </summary>
+/// <param name="category">Category of the span, such as "eventloop".</param>
+/// <param name="name">Name of the span.</param>
+/// <param name="startUs">Time at which the work started, from EventTrace_NowUs.</param>
+/// <param name="endUs">Time at which the work finished, from EventTrace_NowUs.</param>
+void EventTrace_Complete(const char *category, const char *name, uint64_t startUs,
+                         uint64_t endUs);
+
+/// <summary>
+///     Records a span which overlaps the work on the event loop's thread, such as a request
+///     which is waiting for its response. It is recorded when it ends, and exported as a pair
+///     of asynchronous begin and end events, which are shown in their own row.
+/// </summary>
+/// <param name="category">Category of the span, such as "protocol".</param>
+/// <param name="name">Name of the span.</param>
+/// <param name="id">Identifies the span among the overlapping spans with the same category and
+/// name.</param>
+/// <param name="startUs">Time at which the span started, from EventTrace_NowUs.</param>
+/// <param name="endUs">Time at which the span ended, from EventTrace_NowUs.</param>
+/// <param name="argName">Name of an argument to record with the span, or NULL.</param>
+/// <param name="argValue">Value of the argument.</param>
+void EventTrace_AsyncSpan(const char *category, const char *name, uint32_t id, uint64_t startUs,
+                          uint64_t endUs, const char *argName, int32_t argValue);
+
+/// <summary>
+///     Records an event which has no duration, such as a message which has been received.
+/// </summary>
+/// <param name="category">Category of the event.</param>
+/// <param name="name">Name of the event.</param>
+/// <param name="argName">Name of an argument to record with the event, or NULL.</param>
+/// <param name="argValue">Value of the argument.</param>
+void EventTrace_Instant(const char *category, const char *name, const char *argName,
+                        int32_t argValue);
+
+/// <summary>
+///     Writes the recorded events as a JSON document in the Chrome trace event format, for
+///     example to upload it. Like snprintf, the document is truncated if the buffer is too
+///     small, but the full length is still returned.
+/// </summary>
+/// <param name="buffer">Buffer to receive the null-terminated document.</param>
+/// <param name="size">Size of the buffer in bytes.</param>
+/// <returns>The length of the document, excluding the null terminator.</returns>
+size_t EventTrace_Serialize(char *buffer, size_t size);
+
+/// <summary>
+///     Logs the recorded events over the debug connection, one event per line, between two
+///     marker lines. The lines between the markers form a trace in Chrome's JSON array format.
+/// </summary>
+void EventTrace_Log(void);
+
+/// <summary>
+///     Discards the recorded events.
+/// </summary>
+void EventTrace_Clear(void);
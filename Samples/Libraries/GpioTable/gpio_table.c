@@ -0,0 +1,131 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <applibs/gpio.h>
+#include <applibs/log.h>
+
+#include "gpio_table.h"
+
+int GpioTable_Open(const GpioTable_Pin *pins, size_t count, int *fds, size_t *failedPin)
+{
+    for (size_t i = 0; i < count; ++i) {
+        fds[i] = -1;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        const GpioTable_Pin *pin = &pins[i];
+        Log_Debug("Opening %s as %s.\n", pin->name, pin->output ? "output" : "input");
+        fds[i] = pin->output ? GPIO_OpenAsOutput(pin->id, pin->outputMode, pin->initialValue)
+                             : GPIO_OpenAsInput(pin->id);
+        if (fds[i] != -1) {
+            continue;
+        }
+
+        if (pin->optional) {
+            Log_Debug("WARNING: Could not open %s: %s (%d).\n", pin->name, strerror(errno), errno);
+            continue;
+        }
+
+        Log_Debug("ERROR: Could not open %s: %s (%d).\n", pin->name, strerror(errno), errno);
+        if (failedPin != NULL) {
+            *failedPin = i;
+        }
+        int openErrno = errno;
+        GpioTable_Close(pins, i, fds);
+        errno = openErrno;
+        return -1;
+    }
+
+    return 0;
+}
+
+void GpioTable_Close(const GpioTable_Pin *pins, size_t count, int *fds)
+{
+    for (size_t i = 0; i < count; ++i) {
+        if (fds[i] == -1) {
+            continue;
+        }
+
+        if (pins[i].output) {
+            GPIO_SetValue(fds[i], pins[i].closeValue);
+        }
+        if (close(fds[i]) != 0) {
+            Log_Debug("ERROR: Could not close %s: %s (%d).\n", pins[i].name, strerror(errno),
+                      errno);
+        }
+        fds[i] = -1;
+    }
+}
+
+int GpioTable_ReadInputs(const GpioTable_Pin *pins, size_t count, const int *fds,
+                         uint32_t *values)
+{
+    if (count > GPIO_TABLE_MAX_INPUTS) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    uint32_t readValues = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (pins[i].output || fds[i] == -1) {
+            continue;
+        }
+
+        GPIO_Value_Type value;
+        if (GPIO_GetValue(fds[i], &value) != 0) {
+            Log_Debug("ERROR: Could not read %s: %s (%d).\n", pins[i].name, strerror(errno),
+                      errno);
+            return -1;
+        }
+        if (value == GPIO_Value_High) {
+            readValues |= 1u << i;
+        }
+    }
+
+    *values = readValues;
+    return 0;
+}
+
+void GpioTable_InitSnapshot(GpioTable_Snapshot *snapshot)
+{
+    memset(snapshot, 0, sizeof(*snapshot));
+}
+
+int GpioTable_SampleSnapshot(GpioTable_Snapshot *snapshot, const GpioTable_Pin *pins,
+                             size_t count, const int *fds)
+{
+    uint32_t values;
+    if (GpioTable_ReadInputs(pins, count, fds, &values) != 0) {
+        return -1;
+    }
+
+    if (snapshot->sampled) {
+        uint32_t edges = values ^ snapshot->values;
+        for (size_t i = 0; edges != 0; ++i, edges >>= 1) {
+            if ((edges & 1) != 0 && snapshot->edgeCounts[i] < UINT16_MAX) {
+                ++snapshot->edgeCounts[i];
+            }
+        }
+    }
+
+    snapshot->values = values;
+    snapshot->sampled = true;
+    return 0;
+}
+
+bool GpioTable_IsSnapshotChanged(const GpioTable_Snapshot *snapshot)
+{
+    return snapshot->sampled &&
+           (!snapshot->reported || snapshot->values != snapshot->reportedValues);
+}
+
+void GpioTable_MarkSnapshotReported(GpioTable_Snapshot *snapshot)
+{
+    snapshot->reportedValues = snapshot->values;
+    snapshot->reported = true;
+    memset(snapshot->edgeCounts, 0, sizeof(snapshot->edgeCounts));
+}
@@ -0,0 +1,160 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <applibs/gpio.h>
+
+// A GPIO table describes a group of pins which an application opens together, such as the
+// channels of an RGB LED, as a static const array which is built at compile time from the
+// hardware definition's SAMPLE_* identifiers. The whole group is opened and configured in one
+// pass, and closed in one pass, rather than with a block of code and an error path for each pin.
+// The inputs of a table can also be read in one pass into a bitmask, and tracked by a snapshot,
+// so that a group of inputs is reported in one message when any of them changes, rather than in
+// a message for each pin.
+
+/// <summary>
+///     Description of one pin in a GPIO table.
+/// </summary>
+typedef struct {
+    /// <summary>Name of the pin, which is logged.</summary>
+    const char *name;
+    /// <summary>GPIO identifier, from the hardware definition.</summary>
+    GPIO_Id id;
+    /// <summary>true to open the pin as an output; false to open it as an input.</summary>
+    bool output;
+    /// <summary>Output mode of an output.</summary>
+    GPIO_OutputMode_Type outputMode;
+    /// <summary>Value to which an output is set when it is opened.</summary>
+    GPIO_Value_Type initialValue;
+    /// <summary>Value to which an output is set before it is closed.</summary>
+    GPIO_Value_Type closeValue;
+    /// <summary>true if the pin may be missing on some boards. If it cannot be opened, a
+    /// warning is logged and its file descriptor is left at -1, which GPIO_SetValue
+    /// ignores.</summary>
+    bool optional;
+} GpioTable_Pin;
+
+/// <summary>
+///     Describes an input, which is named after its identifier.
+/// </summary>
+#define GPIO_TABLE_INPUT(gpioId)                                                                   \
+    {                                                                                              \
+        .name = #gpioId, .id = (gpioId), .output = false                                           \
+    }
+
+/// <summary>
+///     Describes a push-pull output, which is named after its identifier.
+/// </summary>
+#define GPIO_TABLE_OUTPUT(gpioId, initial, onClose)                                                \
+    {                                                                                              \
+        .name = #gpioId, .id = (gpioId), .output = true,                                           \
+        .outputMode = GPIO_OutputMode_PushPull, .initialValue = (initial),                         \
+        .closeValue = (onClose)                                                                    \
+    }
+
+/// <summary>
+///     Describes a push-pull output which may be missing on some boards.
+/// </summary>
+#define GPIO_TABLE_OPTIONAL_OUTPUT(gpioId, initial, onClose)                                       \
+    {                                                                                              \
+        .name = #gpioId, .id = (gpioId), .output = true,                                           \
+        .outputMode = GPIO_OutputMode_PushPull, .initialValue = (initial),                         \
+        .closeValue = (onClose), .optional = true                                                  \
+    }
+
+/// <summary>
+///     Opens and configures every pin in a table. If a pin which is not optional cannot be
+///     opened, the pins which have been opened are closed again.
+/// </summary>
+/// <param name="pins">The table.</param>
+/// <param name="count">Number of pins in the table.</param>
+/// <param name="fds">Receives the file descriptor of each pin, or -1 for an optional pin which
+/// could not be opened. Must have count elements.</param>
+/// <param name="failedPin">Receives the index of the pin which could not be opened, or NULL.
+/// </param>
+/// <returns>0 on success, or -1 on failure, in which case errno is set.</returns>
+int GpioTable_Open(const GpioTable_Pin *pins, size_t count, int *fds, size_t *failedPin);
+
+/// <summary>
+///     Sets each output in a table to its close value, and closes every pin. Pins whose file
+///     descriptor is -1 are skipped, so this may be called on a table which was not opened if
+///     the file descriptors were initialized to -1.
+/// </summary>
+/// <param name="pins">The table.</param>
+/// <param name="count">Number of pins in the table.</param>
+/// <param name="fds">The file descriptors, which are set to -1.</param>
+void GpioTable_Close(const GpioTable_Pin *pins, size_t count, int *fds);
+
+/// <summary>
+///     Largest number of pins in a table whose inputs can be read into a bitmask.
+/// </summary>
+#define GPIO_TABLE_MAX_INPUTS 32
+
+/// <summary>
+///     Reads every input in a table in one pass.
+/// </summary>
+/// <param name="pins">The table, which has at most GPIO_TABLE_MAX_INPUTS pins.</param>
+/// <param name="count">Number of pins in the table.</param>
+/// <param name="fds">The file descriptors from GpioTable_Open.</param>
+/// <param name="values">Receives a bitmask in which bit n is set if pin n is an input which is
+/// high. The bits of outputs, and of optional pins which could not be opened, are clear.</param>
+/// <returns>0 on success, or -1 on failure, in which case errno is set.</returns>
+int GpioTable_ReadInputs(const GpioTable_Pin *pins, size_t count, const int *fds,
+                         uint32_t *values);
+
+/// <summary>
+///     Tracks the inputs of a table between reports: their values when they were last sampled
+///     and last reported, and the number of edges on each since the last report. Initialize it
+///     with GpioTable_InitSnapshot.
+/// </summary>
+typedef struct {
+    /// <summary>Bitmask of the values when they were last sampled.</summary>
+    uint32_t values;
+    /// <summary>Bitmask of the values when they were last reported.</summary>
+    uint32_t reportedValues;
+    /// <summary>true once the inputs have been sampled.</summary>
+    bool sampled;
+    /// <summary>true once the values have been reported.</summary>
+    bool reported;
+    /// <summary>Number of edges which were seen on each pin since the last report. Only edges
+    /// between samples are seen, so a pulse which is shorter than the sampling period may be
+    /// missed.</summary>
+    uint16_t edgeCounts[GPIO_TABLE_MAX_INPUTS];
+} GpioTable_Snapshot;
+
+/// <summary>
+///     Initializes a snapshot, which has not been sampled or reported.
+/// </summary>
+/// <param name="snapshot">The snapshot.</param>
+void GpioTable_InitSnapshot(GpioTable_Snapshot *snapshot);
+
+/// <summary>
+///     Reads the inputs of a table into a snapshot, and counts the edges since the previous
+///     sample. If they cannot be read, the snapshot is left unchanged.
+/// </summary>
+/// <param name="snapshot">The snapshot.</param>
+/// <param name="pins">The table, which has at most GPIO_TABLE_MAX_INPUTS pins.</param>
+/// <param name="count">Number of pins in the table.</param>
+/// <param name="fds">The file descriptors from GpioTable_Open.</param>
+/// <returns>0 on success, or -1 on failure, in which case errno is set.</returns>
+int GpioTable_SampleSnapshot(GpioTable_Snapshot *snapshot, const GpioTable_Pin *pins,
+                             size_t count, const int *fds);
+
+/// <summary>
+///     Checks whether a snapshot should be reported: it has been sampled, and its values have
+///     not been reported or have changed since they were.
+/// </summary>
+/// <param name="snapshot">The snapshot.</param>
+/// <returns>true if the values should be reported.</returns>
+bool GpioTable_IsSnapshotChanged(const GpioTable_Snapshot *snapshot);
+
+/// <summary>
+///     Records that a snapshot's values have been reported, and clears its edge counts.
+/// </summary>
+/// <param name="snapshot">The snapshot.</param>
+void GpioTable_MarkSnapshotReported(GpioTable_Snapshot *snapshot);
@@ -0,0 +1,315 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#include <applibs/log.h>
+
+#include "https_client.h"
+#include "https_client_backend.h"
+
+#ifdef EVENT_TRACE
+#include "event_trace.h"
+#endif
+
+static const HttpsClient_BackendOps *backend = NULL;
+static HttpsClient_Transfer transfers[HTTPS_CLIENT_MAX_REQUESTS];
+static HttpsClient_Statistics statistics;
+
+int64_t HttpsClient_NowUs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+// Splits an https:// URL into the transfer's host, port and path.
+static int ParseUrl(HttpsClient_Transfer *transfer, const char *url)
+{
+    static const char scheme[] = "https://";
+    if (strncasecmp(url, scheme, sizeof(scheme) - 1) != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    size_t urlLength = strnlen(url, HTTPS_CLIENT_MAX_URL_LENGTH + 1);
+    if (urlLength > HTTPS_CLIENT_MAX_URL_LENGTH) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    memcpy(transfer->url, url, urlLength + 1);
+
+    // The fragment is never sent to the server.
+    char *fragment = strchr(transfer->url, '#');
+    if (fragment != NULL) {
+        *fragment = '\0';
+    }
+
+    const char *authority = transfer->url + sizeof(scheme) - 1;
+    size_t authorityLength = strcspn(authority, "/?");
+    const char *portSeparator = memchr(authority, ':', authorityLength);
+    size_t hostLength =
+        (portSeparator != NULL) ? (size_t)(portSeparator - authority) : authorityLength;
+    if (hostLength == 0 || hostLength > HTTPS_CLIENT_MAX_HOST_LENGTH) {
+        errno = EINVAL;
+        return -1;
+    }
+    memcpy(transfer->host, authority, hostLength);
+    transfer->host[hostLength] = '\0';
+
+    transfer->port = 443;
+    if (portSeparator != NULL) {
+        char *end;
+        unsigned long port = strtoul(portSeparator + 1, &end, 10);
+        if (end != authority + authorityLength || port == 0 || port > UINT16_MAX) {
+            errno = EINVAL;
+            return -1;
+        }
+        transfer->port = (uint16_t)port;
+    }
+
+    transfer->path = authority + authorityLength;
+    return 0;
+}
+
+void HttpsClient_HandleHeaderLine(HttpsClient_Transfer *transfer, const char *line,
+                                  size_t length)
+{
+    while (length > 0 && (line[length - 1] == '\r' || line[length - 1] == '\n')) {
+        --length;
+    }
+
+    // A status line starts each response, including each interim response.
+    if (length >= 5 && strncmp(line, "HTTP/", 5) == 0) {
+        const char *space = memchr(line, ' ', length);
+        int status = 0;
+        if (space != NULL) {
+            for (const char *c = space + 1; c < line + length && *c >= '0' && *c <= '9'; ++c) {
+                status = status * 10 + (*c - '0');
+            }
+        }
+        transfer->metrics.status = status;
+        transfer->interimResponse = status >= 100 && status < 200;
+        return;
+    }
+
+    if (length == 0 || transfer->interimResponse || transfer->request.headerHandler == NULL ||
+        length > HTTPS_CLIENT_MAX_RESPONSE_HEADER_LENGTH) {
+        return;
+    }
+
+    char header[HTTPS_CLIENT_MAX_RESPONSE_HEADER_LENGTH + 1];
+    memcpy(header, line, length);
+    header[length] = '\0';
+
+    char *colon = strchr(header, ':');
+    if (colon == NULL) {
+        return;
+    }
+    *colon = '\0';
+
+    char *value = colon + 1;
+    while (*value == ' ' || *value == '\t') {
+        ++value;
+    }
+    char *valueEnd = header + length;
+    while (valueEnd > value && (valueEnd[-1] == ' ' || valueEnd[-1] == '\t')) {
+        --valueEnd;
+    }
+    *valueEnd = '\0';
+
+    transfer->request.headerHandler(header, value, transfer->request.context);
+}
+
+bool HttpsClient_HandleBody(HttpsClient_Transfer *transfer, const uint8_t *data, size_t size)
+{
+    transfer->metrics.bytesReceived += size;
+    if (transfer->request.bodyHandler != NULL &&
+        !transfer->request.bodyHandler(data, size, transfer->request.context)) {
+        transfer->aborted = true;
+        return false;
+    }
+    return true;
+}
+
+void HttpsClient_CompleteTransfer(HttpsClient_Transfer *transfer, HttpsClient_Result result)
+{
+    static const char *const resultNames[] = {"succeeded", "failed", "timed out", "aborted"};
+
+    if (transfer->aborted) {
+        result = HttpsClient_Result_Aborted;
+    }
+    HttpsClient_Metrics *metrics = &transfer->metrics;
+    int64_t endUs = HttpsClient_NowUs();
+    metrics->totalUs = (uint32_t)(endUs - transfer->startUs);
+#ifdef EVENT_TRACE
+    // The transfer overlaps the event handlers, so it is recorded as an asynchronous span. Its
+    // slot identifies it, since a slot only holds one transfer at a time.
+    EventTrace_AsyncSpan("https", "GET", (uint32_t)transfer->index, (uint64_t)transfer->startUs,
+                         (uint64_t)endUs, "status", (int32_t)metrics->status);
+#endif
+
+    switch (result) {
+    case HttpsClient_Result_Succeeded:
+        ++statistics.succeeded;
+        break;
+    case HttpsClient_Result_Failed:
+        ++statistics.failed;
+        break;
+    case HttpsClient_Result_TimedOut:
+        ++statistics.timedOut;
+        break;
+    case HttpsClient_Result_Aborted:
+        ++statistics.aborted;
+        break;
+    }
+    if (metrics->reusedConnection) {
+        ++statistics.reusedConnections;
+    } else if (metrics->connectUs > 0) {
+        ++statistics.newConnections;
+        if (metrics->resumedSession) {
+            ++statistics.resumedSessions;
+        }
+    }
+    statistics.bytesReceived += metrics->bytesReceived;
+
+    Log_Debug("INFO: %s %s (status %d, %s): DNS %u us, connect %u us, TLS %u us, first byte %u "
+              "us, total %u us; %llu bytes\n",
+              transfer->url, resultNames[result], metrics->status,
+              metrics->reusedConnection
+                  ? "reused connection"
+                  : (metrics->resumedSession ? "resumed session" : "new connection"),
+              metrics->dnsUs, metrics->connectUs, metrics->tlsUs, metrics->firstByteUs,
+              metrics->totalUs, (unsigned long long)metrics->bytesReceived);
+
+    // Free the slot before invoking the handler, so that it can start another request.
+    HttpsClient_Request request = transfer->request;
+    HttpsClient_Metrics completedMetrics = *metrics;
+    transfer->inUse = false;
+    request.completionHandler(result, &completedMetrics, request.context);
+}
+
+int HttpsClient_Init(EventLoop *eventLoop, const HttpsClient_Config *config)
+{
+    if (backend != NULL || config == NULL || config->caCertificatePath == NULL ||
+        config->maxIdleConnections > HTTPS_CLIENT_MAX_IDLE_CONNECTIONS) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    const HttpsClient_BackendOps *ops = NULL;
+    switch (config->backend) {
+#ifdef HTTPS_CLIENT_CURL
+    case HttpsClient_Backend_Curl:
+        ops = &HttpsClient_CurlBackend;
+        break;
+#endif
+#ifdef HTTPS_CLIENT_WOLFSSL
+    case HttpsClient_Backend_WolfSsl:
+        ops = &HttpsClient_WolfSslBackend;
+        break;
+#endif
+    default:
+        break;
+    }
+    if (ops == NULL) {
+        Log_Debug("ERROR: The HTTPS client was built without the requested backend.\n");
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    HttpsClient_Config effectiveConfig = *config;
+    if (effectiveConfig.timeoutSeconds == 0) {
+        effectiveConfig.timeoutSeconds = HTTPS_CLIENT_DEFAULT_TIMEOUT_SECONDS;
+    }
+    if (ops->init(eventLoop, &effectiveConfig) != 0) {
+        return -1;
+    }
+
+    memset(transfers, 0, sizeof(transfers));
+    for (size_t i = 0; i < HTTPS_CLIENT_MAX_REQUESTS; ++i) {
+        transfers[i].index = i;
+    }
+    memset(&statistics, 0, sizeof(statistics));
+    backend = ops;
+    Log_Debug("INFO: HTTPS client using %s.\n", backend->name);
+    return 0;
+}
+
+int HttpsClient_Get(const HttpsClient_Request *request)
+{
+    if (backend == NULL || request == NULL || request->url == NULL ||
+        request->completionHandler == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    HttpsClient_Transfer *transfer = NULL;
+    for (size_t i = 0; i < HTTPS_CLIENT_MAX_REQUESTS; ++i) {
+        if (!transfers[i].inUse) {
+            transfer = &transfers[i];
+            break;
+        }
+    }
+    if (transfer == NULL) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    if (ParseUrl(transfer, request->url) != 0) {
+        return -1;
+    }
+
+    transfer->headersLength = 0;
+    if (request->headers != NULL) {
+        transfer->headersLength =
+            strnlen(request->headers, HTTPS_CLIENT_MAX_REQUEST_HEADERS_LENGTH + 1);
+        if (transfer->headersLength > HTTPS_CLIENT_MAX_REQUEST_HEADERS_LENGTH) {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+    }
+    memcpy(transfer->headers, request->headers != NULL ? request->headers : "",
+           transfer->headersLength + 1);
+
+    transfer->request = *request;
+    transfer->request.url = transfer->url;
+    transfer->request.headers = transfer->headers;
+    transfer->aborted = false;
+    transfer->interimResponse = false;
+    memset(&transfer->metrics, 0, sizeof(transfer->metrics));
+    transfer->startUs = HttpsClient_NowUs();
+
+    if (backend->start(transfer) != 0) {
+        return -1;
+    }
+
+    transfer->inUse = true;
+    return 0;
+}
+
+void HttpsClient_GetStatistics(HttpsClient_Statistics *statisticsOut)
+{
+    *statisticsOut = statistics;
+}
+
+void HttpsClient_Cleanup(void)
+{
+    if (backend == NULL) {
+        return;
+    }
+
+    for (size_t i = 0; i < HTTPS_CLIENT_MAX_REQUESTS; ++i) {
+        if (transfers[i].inUse) {
+            backend->cancel(&transfers[i]);
+            transfers[i].inUse = false;
+        }
+    }
+
+    backend->cleanup();
+    backend = NULL;
+}
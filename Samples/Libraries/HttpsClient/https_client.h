@@ -0,0 +1,237 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <applibs/eventloop.h>
+
+// The HTTPS client downloads resources over HTTPS from the event loop, without blocking it, using
+// either cURL's multi interface or wolfSSL as its backend; an application chooses the backend
+// when it initializes the client, and uses the same request API with either.
+//
+// Both backends keep connections open after a response, so that the next request to the same
+// server reuses the connection instead of making a TCP and TLS handshake, and cache the TLS
+// session of each server, so that a new connection to it resumes the session instead of
+// performing a full handshake. Response bodies are streamed to the application as they arrive,
+// so they need not be held in memory, and the timing of each phase of each request is reported
+// when it completes.
+//
+// Redirects are not followed; a 3xx response is returned to the application like any other. The
+// client is not thread-safe; it should only be used from the event loop's thread.
+
+/// <summary>
+///     Maximum number of requests which may be in progress at once.
+/// </summary>
+#define HTTPS_CLIENT_MAX_REQUESTS 4
+
+/// <summary>
+///     Maximum number of connections which are kept open for reuse while they are idle.
+/// </summary>
+#define HTTPS_CLIENT_MAX_IDLE_CONNECTIONS 4
+
+/// <summary>
+///     Maximum length of a URL, excluding the null terminator.
+/// </summary>
+#define HTTPS_CLIENT_MAX_URL_LENGTH 255
+
+/// <summary>
+///     Maximum length of the additional headers of a request, excluding the null terminator.
+/// </summary>
+#define HTTPS_CLIENT_MAX_REQUEST_HEADERS_LENGTH 511
+
+/// <summary>
+///     Maximum length of a response header line which is passed to a header handler. Longer
+///     lines are not passed to the handler.
+/// </summary>
+#define HTTPS_CLIENT_MAX_RESPONSE_HEADER_LENGTH 511
+
+/// <summary>
+///     Time within which a request must complete if the configuration does not set one, in
+///     seconds.
+/// </summary>
+#define HTTPS_CLIENT_DEFAULT_TIMEOUT_SECONDS 30
+
+/// <summary>
+///     The library which makes the connections.
+/// </summary>
+typedef enum {
+    /// <summary>cURL's multi interface, which also uses HTTP/2 if the server supports
+    /// it.</summary>
+    HttpsClient_Backend_Curl,
+    /// <summary>wolfSSL, with the client's own HTTP/1.1 implementation, which needs less memory
+    /// than cURL.</summary>
+    HttpsClient_Backend_WolfSsl
+} HttpsClient_Backend;
+
+/// <summary>
+///     Invoked to configure the wolfSSL context (WOLFSSL_CTX) of the connections, for example to
+///     present the device's certificate with DeviceAuth_SslCtxFunc for mutual authentication.
+///     The cURL backend invokes it for each new connection; the wolfSSL backend invokes it once,
+///     from HttpsClient_Init.
+/// </summary>
+/// <param name="sslContext">The wolfSSL context.</param>
+/// <returns>true on success; false to fail the connection.</returns>
+typedef bool (*HttpsClient_TlsContextHandler)(void *sslContext);
+
+/// <summary>
+///     The configuration of the client.
+/// </summary>
+typedef struct {
+    /// <summary>The backend which makes the connections.</summary>
+    HttpsClient_Backend backend;
+    /// <summary>Path in the image package of the PEM file of the certificate authorities which
+    /// are trusted to authenticate servers.</summary>
+    const char *caCertificatePath;
+    /// <summary>Value of the User-Agent header, or NULL to send none.</summary>
+    const char *userAgent;
+    /// <summary>Time within which each request must complete, in seconds, or 0 to use
+    /// HTTPS_CLIENT_DEFAULT_TIMEOUT_SECONDS.</summary>
+    unsigned int timeoutSeconds;
+    /// <summary>Number of idle connections which are kept open, up to
+    /// HTTPS_CLIENT_MAX_IDLE_CONNECTIONS; 0 closes each connection after its response.</summary>
+    size_t maxIdleConnections;
+    /// <summary>Function which configures the TLS context, or NULL.</summary>
+    HttpsClient_TlsContextHandler tlsContextHandler;
+} HttpsClient_Config;
+
+/// <summary>
+///     The outcome of a request.
+/// </summary>
+typedef enum {
+    /// <summary>A complete response was received, whatever its status.</summary>
+    HttpsClient_Result_Succeeded,
+    /// <summary>The connection, the TLS handshake or the transfer failed.</summary>
+    HttpsClient_Result_Failed,
+    /// <summary>The request did not complete within the timeout.</summary>
+    HttpsClient_Result_TimedOut,
+    /// <summary>The body handler stopped the transfer.</summary>
+    HttpsClient_Result_Aborted
+} HttpsClient_Result;
+
+/// <summary>
+///     Measurements of a request. The times are in microseconds from the start of the request;
+///     the DNS, connection and TLS times are 0 if an existing connection was reused.
+/// </summary>
+typedef struct {
+    /// <summary>The HTTP status of the response, or 0 if none was received.</summary>
+    int status;
+    /// <summary>Whether the request was sent on a connection which was already open.</summary>
+    bool reusedConnection;
+    /// <summary>Whether a new connection resumed a cached TLS session. cURL does not report
+    /// this, so it is always false with the cURL backend.</summary>
+    bool resumedSession;
+    /// <summary>Time to resolve the host name.</summary>
+    uint32_t dnsUs;
+    /// <summary>Time to make the TCP connection, after resolving the host name.</summary>
+    uint32_t connectUs;
+    /// <summary>Time for the TLS handshake, after the TCP connection was made.</summary>
+    uint32_t tlsUs;
+    /// <summary>Time from sending the request to receiving the first byte of the
+    /// response.</summary>
+    uint32_t firstByteUs;
+    /// <summary>Total time of the request.</summary>
+    uint32_t totalUs;
+    /// <summary>Number of bytes of the body which were received.</summary>
+    uint64_t bytesReceived;
+} HttpsClient_Metrics;
+
+/// <summary>
+///     Counts of the requests which have completed since the client was initialized.
+/// </summary>
+typedef struct {
+    size_t succeeded;
+    size_t failed;
+    size_t timedOut;
+    size_t aborted;
+    /// <summary>Requests which made a new connection.</summary>
+    size_t newConnections;
+    /// <summary>Requests which reused a connection.</summary>
+    size_t reusedConnections;
+    /// <summary>New connections which resumed a cached TLS session.</summary>
+    size_t resumedSessions;
+    uint64_t bytesReceived;
+} HttpsClient_Statistics;
+
+/// <summary>
+///     Invoked with each header of a response. Headers of interim responses, such as 100
+///     Continue, are not passed.
+/// </summary>
+/// <param name="name">The header name, which is only valid until the handler returns.</param>
+/// <param name="value">The header value, without surrounding whitespace, which is only valid
+/// until the handler returns.</param>
+/// <param name="context">Context which was supplied with the request.</param>
+typedef void (*HttpsClient_HeaderHandler)(const char *name, const char *value, void *context);
+
+/// <summary>
+///     Invoked with each part of a response body as it arrives.
+/// </summary>
+/// <param name="data">The data, which is only valid until the handler returns.</param>
+/// <param name="size">The size of the data in bytes.</param>
+/// <param name="context">Context which was supplied with the request.</param>
+/// <returns>true to continue the transfer; false to abort it.</returns>
+typedef bool (*HttpsClient_BodyHandler)(const uint8_t *data, size_t size, void *context);
+
+/// <summary>
+///     Invoked when a request has completed. The handler may start another request.
+/// </summary>
+/// <param name="result">The outcome of the request.</param>
+/// <param name="metrics">Measurements of the request, which are only valid until the handler
+/// returns.</param>
+/// <param name="context">Context which was supplied with the request.</param>
+typedef void (*HttpsClient_CompletionHandler)(HttpsClient_Result result,
+                                              const HttpsClient_Metrics *metrics, void *context);
+
+/// <summary>
+///     A GET request.
+/// </summary>
+typedef struct {
+    /// <summary>The https:// URL of the resource.</summary>
+    const char *url;
+    /// <summary>Additional request headers, each of the form "Name: value\r\n", or
+    /// NULL.</summary>
+    const char *headers;
+    /// <summary>Function which receives the response headers, or NULL.</summary>
+    HttpsClient_HeaderHandler headerHandler;
+    /// <summary>Function which receives the response body, or NULL to discard it.</summary>
+    HttpsClient_BodyHandler bodyHandler;
+    /// <summary>Function which is notified when the request completes.</summary>
+    HttpsClient_CompletionHandler completionHandler;
+    /// <summary>Context which is passed to the handlers.</summary>
+    void *context;
+} HttpsClient_Request;
+
+/// <summary>
+///     Initializes the client.
+/// </summary>
+/// <param name="eventLoop">Event loop which runs the transfers.</param>
+/// <param name="config">The configuration, which is copied; the strings which it points to must
+/// remain valid until HttpsClient_Cleanup is called.</param>
+/// <returns>0 on success, or -1 on failure, in which case errno is set. errno is ENOTSUP if the
+/// library was built without the requested backend.</returns>
+int HttpsClient_Init(EventLoop *eventLoop, const HttpsClient_Config *config);
+
+/// <summary>
+///     Starts a GET request. The handlers are invoked from the event loop, after this function
+///     has returned.
+/// </summary>
+/// <param name="request">The request, which is copied.</param>
+/// <returns>0 on success, or -1 on failure, in which case errno is set: EINVAL if the URL is not
+/// an https:// URL, ENAMETOOLONG if the URL or headers are too long, or EBUSY if
+/// HTTPS_CLIENT_MAX_REQUESTS requests are already in progress.</returns>
+int HttpsClient_Get(const HttpsClient_Request *request);
+
+/// <summary>
+///     Gets the counts of the requests which have completed.
+/// </summary>
+/// <param name="statistics">Receives the counts.</param>
+void HttpsClient_GetStatistics(HttpsClient_Statistics *statistics);
+
+/// <summary>
+///     Cancels the requests in progress, without invoking their handlers, closes the connections
+///     and frees the client's resources. This should be called before the event loop is closed.
+/// </summary>
+void HttpsClient_Cleanup(void);
@@ -0,0 +1,107 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <applibs/eventloop.h>
+
+#include "https_client.h"
+
+// This header is private to the HTTPS client. It defines the interface between the part of the
+// client which is common to the backends, in https_client.c, and each backend.
+
+/// <summary>
+///     Maximum length of a server's host name, excluding the null terminator.
+/// </summary>
+#define HTTPS_CLIENT_MAX_HOST_LENGTH 127
+
+/// <summary>
+///     A request in progress. The common part of the client fills in the request; the backend
+///     fills in the connection and timing fields of the metrics.
+/// </summary>
+typedef struct {
+    /// <summary>Position of the transfer in the common part's table, which is less than
+    /// HTTPS_CLIENT_MAX_REQUESTS, so that a backend can keep its own state for it.</summary>
+    size_t index;
+    char url[HTTPS_CLIENT_MAX_URL_LENGTH + 1];
+    char host[HTTPS_CLIENT_MAX_HOST_LENGTH + 1];
+    uint16_t port;
+    /// <summary>The path and query of the URL, which points into url; it is empty if the URL
+    /// has neither.</summary>
+    const char *path;
+    /// <summary>Additional request headers, each terminated by CRLF.</summary>
+    char headers[HTTPS_CLIENT_MAX_REQUEST_HEADERS_LENGTH + 1];
+    size_t headersLength;
+    /// <summary>Time on the monotonic clock at which the request was started, in
+    /// microseconds.</summary>
+    int64_t startUs;
+    HttpsClient_Metrics metrics;
+
+    // The following are only used by the common part.
+    bool inUse;
+    bool aborted;
+    bool interimResponse;
+    HttpsClient_Request request;
+} HttpsClient_Transfer;
+
+/// <summary>
+///     The operations of a backend.
+/// </summary>
+typedef struct {
+    /// <summary>Name of the backend, which is shown in the log.</summary>
+    const char *name;
+    /// <summary>Allocates the backend's resources. Returns 0 on success, or -1 on failure with
+    /// errno set.</summary>
+    int (*init)(EventLoop *eventLoop, const HttpsClient_Config *config);
+    /// <summary>Starts a transfer. Returns 0 on success, or -1 on failure with errno set, in
+    /// which case the transfer is not completed.</summary>
+    int (*start)(HttpsClient_Transfer *transfer);
+    /// <summary>Stops a transfer without completing it.</summary>
+    void (*cancel)(HttpsClient_Transfer *transfer);
+    /// <summary>Frees the backend's resources, after every transfer has been cancelled.</summary>
+    void (*cleanup)(void);
+} HttpsClient_BackendOps;
+
+#ifdef HTTPS_CLIENT_CURL
+extern const HttpsClient_BackendOps HttpsClient_CurlBackend;
+#endif
+#ifdef HTTPS_CLIENT_WOLFSSL
+extern const HttpsClient_BackendOps HttpsClient_WolfSslBackend;
+#endif
+
+/// <summary>
+///     Called by a backend with each line of the response headers, including the status line of
+///     each response, for example when an interim response precedes the final one.
+/// </summary>
+/// <param name="transfer">The transfer.</param>
+/// <param name="line">The line, which need not be null-terminated.</param>
+/// <param name="length">The length of the line, including any CRLF which terminates it.</param>
+void HttpsClient_HandleHeaderLine(HttpsClient_Transfer *transfer, const char *line,
+                                  size_t length);
+
+/// <summary>
+///     Called by a backend with each part of the response body.
+/// </summary>
+/// <param name="transfer">The transfer.</param>
+/// <param name="data">The data.</param>
+/// <param name="size">The size of the data in bytes.</param>
+/// <returns>true to continue the transfer; false if the application has aborted it, in which
+/// case the backend should complete it with HttpsClient_Result_Aborted.</returns>
+bool HttpsClient_HandleBody(HttpsClient_Transfer *transfer, const uint8_t *data, size_t size);
+
+/// <summary>
+///     Called by a backend when a transfer has completed, once the backend has finished with it.
+///     This must not be called from within HttpsClient_BackendOps.start.
+/// </summary>
+/// <param name="transfer">The transfer.</param>
+/// <param name="result">The outcome.</param>
+void HttpsClient_CompleteTransfer(HttpsClient_Transfer *transfer, HttpsClient_Result result);
+
+/// <summary>
+///     Gets the time on the monotonic clock, in microseconds.
+/// </summary>
+int64_t HttpsClient_NowUs(void);
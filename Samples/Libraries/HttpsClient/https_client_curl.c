@@ -0,0 +1,506 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// The cURL backend runs the transfers with cURL's multi interface, driven by the event loop. The
+// multi handle keeps the connections which are idle for reuse, and lets requests to the same
+// server share one HTTP/2 connection; the DNS cache and the TLS sessions are shared by all the
+// easy handles, so that a new connection to a server which has been visited before resumes its
+// session. The CA bundle is read from the image package once, and passed to each transfer from
+// memory, so that it is not read from storage again for each new connection.
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <curl/curl.h>
+
+#include <applibs/log.h>
+#include <applibs/storage.h>
+
+#include "https_client_backend.h"
+
+static EventLoop *clientEventLoop = NULL;
+static int timerFd = -1;
+static EventRegistration *timerRegistration = NULL;
+static CURLM *curlMulti = NULL;
+static CURLSH *curlShare = NULL;
+static bool curlInitialized = false;
+
+static char *caCertificatePath = NULL;
+static uint8_t *caBundle = NULL;
+static size_t caBundleSize = 0;
+static const char *userAgent = NULL;
+static long timeoutSeconds = 0;
+static bool reuseConnections = true;
+static HttpsClient_TlsContextHandler tlsContextHandler = NULL;
+
+// The easy handle of each transfer slot is kept from one transfer to the next.
+static CURL *easyHandles[HTTPS_CLIENT_MAX_REQUESTS];
+static struct curl_slist *requestHeaders[HTTPS_CLIENT_MAX_REQUESTS];
+static HttpsClient_Transfer *activeTransfers[HTTPS_CLIENT_MAX_REQUESTS];
+
+static void LogCurlEasyError(const char *message, CURLcode code)
+{
+    Log_Debug("ERROR: %s (curl easy err=%d, '%s')\n", message, code, curl_easy_strerror(code));
+}
+
+static void LogCurlMultiError(const char *message, CURLMcode code)
+{
+    Log_Debug("ERROR: %s (curl multi err=%d, '%s')\n", message, code, curl_multi_strerror(code));
+}
+
+static size_t HeaderCallback(char *buffer, size_t size, size_t count, void *userData)
+{
+    HttpsClient_HandleHeaderLine(userData, buffer, size * count);
+    return size * count;
+}
+
+static size_t WriteCallback(char *data, size_t size, size_t count, void *userData)
+{
+    // Returning less than was received makes cURL abandon the transfer.
+    if (!HttpsClient_HandleBody(userData, (const uint8_t *)data, size * count)) {
+        return 0;
+    }
+    return size * count;
+}
+
+// Gets one of cURL's timings of a transfer, in microseconds since the transfer started.
+static curl_off_t GetTransferTime(CURL *easyHandle, CURLINFO info)
+{
+    curl_off_t time = 0;
+    if (curl_easy_getinfo(easyHandle, info, &time) != CURLE_OK) {
+        return 0;
+    }
+    return time;
+}
+
+static void RecordMetrics(HttpsClient_Transfer *transfer, CURL *easyHandle)
+{
+    HttpsClient_Metrics *metrics = &transfer->metrics;
+
+    long newConnections = 0;
+    curl_easy_getinfo(easyHandle, CURLINFO_NUM_CONNECTS, &newConnections);
+    metrics->reusedConnection = newConnections == 0;
+
+    // cURL's timings are cumulative from the start of the transfer.
+    curl_off_t nameLookup = GetTransferTime(easyHandle, CURLINFO_NAMELOOKUP_TIME_T);
+    curl_off_t connect = GetTransferTime(easyHandle, CURLINFO_CONNECT_TIME_T);
+    curl_off_t appConnect = GetTransferTime(easyHandle, CURLINFO_APPCONNECT_TIME_T);
+    curl_off_t preTransfer = GetTransferTime(easyHandle, CURLINFO_PRETRANSFER_TIME_T);
+    curl_off_t startTransfer = GetTransferTime(easyHandle, CURLINFO_STARTTRANSFER_TIME_T);
+
+    if (!metrics->reusedConnection) {
+        metrics->dnsUs = (uint32_t)nameLookup;
+        if (connect >= nameLookup) {
+            metrics->connectUs = (uint32_t)(connect - nameLookup);
+        }
+        if (appConnect >= connect) {
+            metrics->tlsUs = (uint32_t)(appConnect - connect);
+        }
+    }
+    if (startTransfer >= preTransfer) {
+        metrics->firstByteUs = (uint32_t)(startTransfer - preTransfer);
+    }
+}
+
+static void ReleaseSlot(size_t index)
+{
+    CURLMcode code = curl_multi_remove_handle(curlMulti, easyHandles[index]);
+    if (code != CURLM_OK) {
+        LogCurlMultiError("curl_multi_remove_handle", code);
+    }
+    curl_slist_free_all(requestHeaders[index]);
+    requestHeaders[index] = NULL;
+    activeTransfers[index] = NULL;
+}
+
+static void ProcessCompletedTransfers(void)
+{
+    CURLMsg *message;
+    int messagesLeft;
+    while ((message = curl_multi_info_read(curlMulti, &messagesLeft)) != NULL) {
+        if (message->msg != CURLMSG_DONE) {
+            continue;
+        }
+
+        HttpsClient_Transfer *transfer = NULL;
+        curl_easy_getinfo(message->easy_handle, CURLINFO_PRIVATE, (char **)&transfer);
+        if (transfer == NULL || activeTransfers[transfer->index] != transfer) {
+            continue;
+        }
+
+        CURLcode code = message->data.result;
+        HttpsClient_Result result = HttpsClient_Result_Succeeded;
+        if (code == CURLE_OPERATION_TIMEDOUT) {
+            result = HttpsClient_Result_TimedOut;
+        } else if (code != CURLE_OK) {
+            LogCurlEasyError(transfer->url, code);
+            result = HttpsClient_Result_Failed;
+        }
+
+        RecordMetrics(transfer, message->easy_handle);
+
+        // The message is not valid once its handle has been removed.
+        ReleaseSlot(transfer->index);
+        HttpsClient_CompleteTransfer(transfer, result);
+    }
+}
+
+static void SocketAction(curl_socket_t fd)
+{
+    int runningHandles = 0;
+    CURLMcode code = curl_multi_socket_action(curlMulti, fd, 0, &runningHandles);
+    if (code != CURLM_OK) {
+        LogCurlMultiError("curl_multi_socket_action", code);
+        return;
+    }
+    ProcessCompletedTransfers();
+}
+
+// This satisfies the EventLoopIoCallback signature.
+static void TimerCallback(EventLoop *el, int fd, EventLoop_IoEvents events, void *context)
+{
+    uint64_t expirations;
+    if (read(timerFd, &expirations, sizeof(expirations)) == -1) {
+        Log_Debug("ERROR: Could not read timerfd %s (%d).\n", strerror(errno), errno);
+        return;
+    }
+
+    SocketAction(CURL_SOCKET_TIMEOUT);
+}
+
+// This satisfies the EventLoopIoCallback signature.
+static void SocketCallback(EventLoop *el, int fd, EventLoop_IoEvents events, void *context)
+{
+    SocketAction(fd);
+}
+
+// Called by cURL to say which events it waits for on a socket.
+static int CurlSocketFunction(CURL *easy, curl_socket_t fd, int action, void *userData,
+                              void *socketData)
+{
+    EventRegistration *registration = socketData;
+
+    // The socket may already have been closed, in which case the kernel has removed it from the
+    // event set, so EBADF is expected.
+    if (action == CURL_POLL_REMOVE) {
+        if (EventLoop_UnregisterIo(clientEventLoop, registration) == -1 && errno != EBADF) {
+            Log_Debug("ERROR: Could not unregister socket: %s (%d).\n", strerror(errno), errno);
+        }
+        return 0;
+    }
+
+    EventLoop_IoEvents events = EventLoop_None;
+    if (action == CURL_POLL_IN || action == CURL_POLL_INOUT) {
+        events |= EventLoop_Input;
+    }
+    if (action == CURL_POLL_OUT || action == CURL_POLL_INOUT) {
+        events |= EventLoop_Output;
+    }
+
+    if (registration == NULL) {
+        registration =
+            EventLoop_RegisterIo(clientEventLoop, fd, events, SocketCallback, /* context */ NULL);
+        if (registration == NULL) {
+            Log_Debug("ERROR: Could not register socket: %s (%d).\n", strerror(errno), errno);
+            return -1;
+        }
+        curl_multi_assign(curlMulti, fd, registration);
+        return 0;
+    }
+
+    if (EventLoop_ModifyIoEvents(clientEventLoop, registration, events) == -1) {
+        Log_Debug("ERROR: Could not modify socket events: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+    return 0;
+}
+
+// Called by cURL to say when it must next be run, whether or not a socket is ready.
+static int CurlTimerFunction(CURLM *multi, long timeoutMs, void *userData)
+{
+    // A timeout of -1 disarms the timer. cURL must not be called from within its own callbacks,
+    // so a timeout of 0 runs it as soon as the event loop is returned to.
+    struct itimerspec value = {.it_value = {0, 0}, .it_interval = {0, 0}};
+    if (timeoutMs >= 0) {
+        value.it_value.tv_sec = timeoutMs / 1000;
+        value.it_value.tv_nsec = (timeoutMs % 1000) * 1000000 + 1;
+    }
+    if (timerfd_settime(timerFd, /* flags */ 0, &value, /* old_value */ NULL) == -1) {
+        Log_Debug("ERROR: Could not set cURL timer: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+    return 0;
+}
+
+static void CurlCleanup(void)
+{
+    for (size_t i = 0; i < HTTPS_CLIENT_MAX_REQUESTS; ++i) {
+        curl_easy_cleanup(easyHandles[i]);
+        easyHandles[i] = NULL;
+    }
+    if (curlMulti != NULL) {
+        curl_multi_cleanup(curlMulti);
+        curlMulti = NULL;
+    }
+    // The share must be cleaned up after the easy handles which use it.
+    curl_share_cleanup(curlShare);
+    curlShare = NULL;
+    if (curlInitialized) {
+        curl_global_cleanup();
+        curlInitialized = false;
+    }
+
+    EventLoop_UnregisterIo(clientEventLoop, timerRegistration);
+    timerRegistration = NULL;
+    if (timerFd != -1) {
+        close(timerFd);
+        timerFd = -1;
+    }
+    free(caCertificatePath);
+    caCertificatePath = NULL;
+    // cURL does not copy the bundle, so it is freed after the easy handles.
+    free(caBundle);
+    caBundle = NULL;
+    caBundleSize = 0;
+}
+
+// Reads the CA bundle from the image package into caBundle. If it cannot be read, caBundle is left
+// NULL, and cURL reads the file itself.
+static void LoadCaBundle(const char *relativePath)
+{
+    int fd = Storage_OpenFileInImagePackage(relativePath);
+    if (fd == -1) {
+        Log_Debug("WARNING: Could not open the CA bundle: %s (%d).\n", strerror(errno), errno);
+        return;
+    }
+
+    struct stat fileStatus;
+    if (fstat(fd, &fileStatus) == -1 || fileStatus.st_size <= 0) {
+        goto failed;
+    }
+
+    caBundleSize = (size_t)fileStatus.st_size;
+    caBundle = malloc(caBundleSize);
+    if (caBundle == NULL) {
+        goto failed;
+    }
+
+    size_t offset = 0;
+    while (offset < caBundleSize) {
+        ssize_t bytesRead = read(fd, caBundle + offset, caBundleSize - offset);
+        if (bytesRead <= 0) {
+            goto failed;
+        }
+        offset += (size_t)bytesRead;
+    }
+
+    close(fd);
+    return;
+
+failed:
+    Log_Debug("WARNING: Could not read the CA bundle into memory.\n");
+    free(caBundle);
+    caBundle = NULL;
+    caBundleSize = 0;
+    close(fd);
+}
+
+// Sets the CA bundle which verifies the server: from memory, if cURL and its TLS backend support
+// CURLOPT_CAINFO_BLOB, or else from the file.
+static CURLcode SetCaBundle(CURL *easyHandle)
+{
+#if LIBCURL_VERSION_NUM >= 0x074D00
+    if (caBundle != NULL) {
+        struct curl_blob blob = {.data = caBundle, .len = caBundleSize, .flags = CURL_BLOB_NOCOPY};
+        CURLcode res = curl_easy_setopt(easyHandle, CURLOPT_CAINFO_BLOB, &blob);
+        if (res != CURLE_NOT_BUILT_IN && res != CURLE_UNKNOWN_OPTION) {
+            return res;
+        }
+
+        Log_Debug("INFO: cURL cannot take the CA bundle from memory; it reads the file instead.\n");
+        free(caBundle);
+        caBundle = NULL;
+        caBundleSize = 0;
+    }
+#endif
+    return curl_easy_setopt(easyHandle, CURLOPT_CAINFO, caCertificatePath);
+}
+
+static int CurlInit(EventLoop *eventLoop, const HttpsClient_Config *config)
+{
+    clientEventLoop = eventLoop;
+    userAgent = config->userAgent;
+    timeoutSeconds = (long)config->timeoutSeconds;
+    reuseConnections = config->maxIdleConnections > 0;
+    tlsContextHandler = config->tlsContextHandler;
+
+    caCertificatePath = Storage_GetAbsolutePathInImagePackage(config->caCertificatePath);
+    if (caCertificatePath == NULL) {
+        Log_Debug("ERROR: The certificate path could not be resolved: %s (%d).\n",
+                  strerror(errno), errno);
+        return -1;
+    }
+#if LIBCURL_VERSION_NUM >= 0x074D00
+    LoadCaBundle(config->caCertificatePath);
+#endif
+
+    if (curl_global_init(CURL_GLOBAL_ALL) != CURLE_OK) {
+        Log_Debug("ERROR: curl_global_init has failed.\n");
+        goto failed;
+    }
+    curlInitialized = true;
+    Log_Debug("INFO: Using %s\n", curl_version());
+
+    // All the transfers run on the event loop's thread, so the share needs no locking functions.
+    curlShare = curl_share_init();
+    if (curlShare == NULL ||
+        curl_share_setopt(curlShare, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS) != CURLSHE_OK ||
+        curl_share_setopt(curlShare, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION) != CURLSHE_OK) {
+        Log_Debug("ERROR: Could not set up the cURL share.\n");
+        goto failed;
+    }
+
+    curlMulti = curl_multi_init();
+    if (curlMulti == NULL ||
+        curl_multi_setopt(curlMulti, CURLMOPT_SOCKETFUNCTION, CurlSocketFunction) != CURLM_OK ||
+        curl_multi_setopt(curlMulti, CURLMOPT_TIMERFUNCTION, CurlTimerFunction) != CURLM_OK ||
+        curl_multi_setopt(curlMulti, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX) != CURLM_OK ||
+        curl_multi_setopt(curlMulti, CURLMOPT_MAXCONNECTS,
+                          (long)(reuseConnections ? config->maxIdleConnections : 1)) !=
+            CURLM_OK) {
+        Log_Debug("ERROR: Could not set up the cURL multi handle.\n");
+        goto failed;
+    }
+
+    timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (timerFd == -1) {
+        Log_Debug("ERROR: Unable to create timer: %s (%d).\n", strerror(errno), errno);
+        goto failed;
+    }
+    timerRegistration =
+        EventLoop_RegisterIo(clientEventLoop, timerFd, EventLoop_Input, TimerCallback, NULL);
+    if (timerRegistration == NULL) {
+        Log_Debug("ERROR: Unable to register timer event: %s (%d).\n", strerror(errno), errno);
+        goto failed;
+    }
+
+    return 0;
+
+failed:;
+    int error = errno;
+    CurlCleanup();
+    errno = error;
+    return -1;
+}
+
+static CURLcode SslCtxCallback(CURL *easyHandle, void *sslContext, void *userData)
+{
+    return tlsContextHandler(sslContext) ? CURLE_OK : CURLE_SSL_CERTPROBLEM;
+}
+
+// Converts the transfer's header lines into a cURL list.
+static int CreateRequestHeaders(HttpsClient_Transfer *transfer, struct curl_slist **list)
+{
+    char line[HTTPS_CLIENT_MAX_REQUEST_HEADERS_LENGTH + 1];
+    const char *start = transfer->headers;
+    while (*start != '\0') {
+        size_t length = strcspn(start, "\r\n");
+        if (length > 0) {
+            memcpy(line, start, length);
+            line[length] = '\0';
+            struct curl_slist *appended = curl_slist_append(*list, line);
+            if (appended == NULL) {
+                return -1;
+            }
+            *list = appended;
+        }
+        start += length;
+        start += strspn(start, "\r\n");
+    }
+    return 0;
+}
+
+static int CurlStart(HttpsClient_Transfer *transfer)
+{
+    size_t index = transfer->index;
+    CURL *easyHandle = easyHandles[index];
+    if (easyHandle == NULL) {
+        easyHandle = easyHandles[index] = curl_easy_init();
+        if (easyHandle == NULL) {
+            Log_Debug("ERROR: curl_easy_init has failed.\n");
+            errno = ENOMEM;
+            return -1;
+        }
+    } else {
+        // The connections are kept by the multi handle, so resetting the easy handle does not
+        // close them.
+        curl_easy_reset(easyHandle);
+    }
+
+    if (CreateRequestHeaders(transfer, &requestHeaders[index]) != 0) {
+        Log_Debug("ERROR: curl_slist_append has failed.\n");
+        curl_slist_free_all(requestHeaders[index]);
+        requestHeaders[index] = NULL;
+        errno = ENOMEM;
+        return -1;
+    }
+
+    CURLcode res;
+    if ((res = curl_easy_setopt(easyHandle, CURLOPT_URL, transfer->url)) != CURLE_OK ||
+        (res = curl_easy_setopt(easyHandle, CURLOPT_PROTOCOLS, (long)CURLPROTO_HTTPS)) !=
+            CURLE_OK ||
+        (res = SetCaBundle(easyHandle)) != CURLE_OK ||
+        (res = curl_easy_setopt(easyHandle, CURLOPT_SHARE, curlShare)) != CURLE_OK ||
+        (res = curl_easy_setopt(easyHandle, CURLOPT_HTTP_VERSION,
+                                (long)CURL_HTTP_VERSION_2TLS)) != CURLE_OK ||
+        (res = curl_easy_setopt(easyHandle, CURLOPT_FORBID_REUSE, reuseConnections ? 0L : 1L)) !=
+            CURLE_OK ||
+        (res = curl_easy_setopt(easyHandle, CURLOPT_TIMEOUT, timeoutSeconds)) != CURLE_OK ||
+        (res = curl_easy_setopt(easyHandle, CURLOPT_NOSIGNAL, 1L)) != CURLE_OK ||
+        (res = curl_easy_setopt(easyHandle, CURLOPT_HEADERFUNCTION, HeaderCallback)) !=
+            CURLE_OK ||
+        (res = curl_easy_setopt(easyHandle, CURLOPT_HEADERDATA, transfer)) != CURLE_OK ||
+        (res = curl_easy_setopt(easyHandle, CURLOPT_WRITEFUNCTION, WriteCallback)) != CURLE_OK ||
+        (res = curl_easy_setopt(easyHandle, CURLOPT_WRITEDATA, transfer)) != CURLE_OK ||
+        (res = curl_easy_setopt(easyHandle, CURLOPT_PRIVATE, transfer)) != CURLE_OK ||
+        (res = curl_easy_setopt(easyHandle, CURLOPT_HTTPHEADER, requestHeaders[index])) !=
+            CURLE_OK ||
+        (userAgent != NULL &&
+         (res = curl_easy_setopt(easyHandle, CURLOPT_USERAGENT, userAgent)) != CURLE_OK) ||
+        (tlsContextHandler != NULL &&
+         (res = curl_easy_setopt(easyHandle, CURLOPT_SSL_CTX_FUNCTION, SslCtxCallback)) !=
+             CURLE_OK)) {
+        LogCurlEasyError("curl_easy_setopt", res);
+        goto failed;
+    }
+
+    CURLMcode code = curl_multi_add_handle(curlMulti, easyHandle);
+    if (code != CURLM_OK) {
+        LogCurlMultiError("curl_multi_add_handle", code);
+        goto failed;
+    }
+
+    activeTransfers[index] = transfer;
+    return 0;
+
+failed:
+    curl_slist_free_all(requestHeaders[index]);
+    requestHeaders[index] = NULL;
+    errno = EIO;
+    return -1;
+}
+
+static void CurlCancel(HttpsClient_Transfer *transfer)
+{
+    if (activeTransfers[transfer->index] == transfer) {
+        ReleaseSlot(transfer->index);
+    }
+}
+
+const HttpsClient_BackendOps HttpsClient_CurlBackend = {
+    .name = "cURL", .init = CurlInit, .start = CurlStart, .cancel = CurlCancel,
+    .cleanup = CurlCleanup};
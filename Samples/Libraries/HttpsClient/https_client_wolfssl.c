@@ -0,0 +1,1003 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// The wolfSSL backend implements HTTP/1.1 over wolfSSL's TLS connections. Each request is sent on
+// a connection which is idle for the same server, if there is one, or else on a new connection.
+// After a response whose length was delimited, the connection is kept for the next request, while
+// fewer than the configured number of connections are idle; a server which closes an idle
+// connection is noticed by the event loop. If a request fails on a reused connection before any
+// of the response has arrived, because the server had closed the connection just as it was
+// reused, the request is sent again on a new connection.
+//
+// The TLS session of each server, including its session ticket, is kept in memory after each
+// response, so that a new connection to the server resumes the session instead of making a full
+// handshake. That needs wolfSSL to be built with session ticket support and to serialize
+// sessions; otherwise, every new connection makes a full handshake.
+//
+// Host names are resolved with getaddrinfo, which blocks the event loop until the name has been
+// resolved, and the connection is made to the first address.
+
+#include <errno.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <wolfssl/ssl.h>
+
+#include <applibs/log.h>
+#include <applibs/storage.h>
+
+#include "https_client_backend.h"
+
+#if defined(HAVE_SESSION_TICKET) && (defined(OPENSSL_EXTRA) || defined(HAVE_EXT_CACHE))
+#define SESSION_CACHE_SUPPORTED 1
+#else
+#define SESSION_CACHE_SUPPORTED 0
+#endif
+
+// Each request needs its own connection, and an idle connection is closed to make room for a
+// new one, so the table need only hold one connection for each request.
+#define MAX_CONNECTIONS HTTPS_CLIENT_MAX_REQUESTS
+
+// Largest plaintext which a TLS record can carry. Reading into a buffer of this size lets each
+// wolfSSL_read return a whole record.
+#define READ_BUFFER_SIZE 16384
+
+// Space for the request line, the Host and User-Agent headers, and the additional headers.
+#define MAX_REQUEST_LENGTH                                                                         \
+    (HTTPS_CLIENT_MAX_URL_LENGTH + HTTPS_CLIENT_MAX_HOST_LENGTH +                                  \
+     HTTPS_CLIENT_MAX_REQUEST_HEADERS_LENGTH + 256)
+
+// Number of servers whose TLS sessions are kept, and the largest serialized session.
+#define SESSION_CACHE_SIZE 4
+#define MAX_SESSION_SIZE 2048
+
+// wolfSSL's error when the server has closed the connection without a TLS close_notify alert.
+#define SOCKET_PEER_CLOSED_E (-397)
+
+typedef enum {
+    Connection_Closed,
+    Connection_Connecting,
+    Connection_Handshaking,
+    Connection_Sending,
+    Connection_ReceivingHeaders,
+    Connection_ReceivingBody,
+    Connection_Idle,
+    // The connection could not be started; the transfer is completed from the timer, because it
+    // cannot be completed from within HttpsClient_BackendOps.start.
+    Connection_Failed
+} ConnectionState;
+
+typedef enum { Framing_None, Framing_Length, Framing_Chunked, Framing_UntilClose } Framing;
+
+typedef enum { Chunk_Size, Chunk_Data, Chunk_DataEnd, Chunk_Trailer } ChunkState;
+
+typedef struct {
+    ConnectionState state;
+    int fd;
+    EventRegistration *registration;
+    EventLoop_IoEvents events;
+    WOLFSSL *ssl;
+    char host[HTTPS_CLIENT_MAX_HOST_LENGTH + 1];
+    uint16_t port;
+    int64_t lastUsedUs;
+
+    HttpsClient_Transfer *transfer;
+    int64_t phaseStartUs;
+    int64_t deadlineUs;
+    // Whether any of the response has been received, after which the request cannot be retried.
+    bool receivedResponse;
+
+    char request[MAX_REQUEST_LENGTH];
+    size_t requestLength;
+    size_t requestSent;
+
+    // The header or chunk line which is being received, without its CRLF.
+    char line[HTTPS_CLIENT_MAX_RESPONSE_HEADER_LENGTH + 1];
+    size_t lineLength;
+    bool lineTruncated;
+    bool statusLineReceived;
+    bool chunked;
+    bool hasContentLength;
+    uint64_t contentLength;
+    bool keepAlive;
+    Framing framing;
+    ChunkState chunkState;
+    uint64_t remaining;
+} Connection;
+
+typedef struct {
+    char host[HTTPS_CLIENT_MAX_HOST_LENGTH + 1];
+    uint16_t port;
+    uint16_t size;
+    int64_t storedUs;
+    uint8_t session[MAX_SESSION_SIZE];
+} CachedSession;
+
+static EventLoop *clientEventLoop = NULL;
+static int timerFd = -1;
+static EventRegistration *timerRegistration = NULL;
+static bool wolfSslInitialized = false;
+static WOLFSSL_CTX *wolfSslCtx = NULL;
+
+static const char *userAgent = NULL;
+static int64_t timeoutUs = 0;
+static size_t maxIdleConnections = 0;
+
+static Connection connections[MAX_CONNECTIONS];
+static uint8_t readBuffer[READ_BUFFER_SIZE];
+#if SESSION_CACHE_SUPPORTED
+static CachedSession sessionCache[SESSION_CACHE_SIZE];
+#endif
+
+static void StartSending(Connection *connection);
+static void Receive(Connection *connection);
+
+#if SESSION_CACHE_SUPPORTED
+static CachedSession *FindCachedSession(const char *host, uint16_t port)
+{
+    for (size_t i = 0; i < SESSION_CACHE_SIZE; ++i) {
+        if (sessionCache[i].size > 0 && sessionCache[i].port == port &&
+            strcmp(sessionCache[i].host, host) == 0) {
+            return &sessionCache[i];
+        }
+    }
+    return NULL;
+}
+
+static bool LoadSession(WOLFSSL *ssl, const char *host, uint16_t port)
+{
+    CachedSession *cached = FindCachedSession(host, port);
+    if (cached == NULL) {
+        return false;
+    }
+
+    const unsigned char *data = cached->session;
+    WOLFSSL_SESSION *session = wolfSSL_d2i_SSL_SESSION(NULL, &data, cached->size);
+    if (session == NULL) {
+        cached->size = 0;
+        return false;
+    }
+
+    // wolfSSL_set_session copies the session, so it can be freed here.
+    int r = wolfSSL_set_session(ssl, session);
+    wolfSSL_SESSION_free(session);
+    return r == WOLFSSL_SUCCESS;
+}
+
+static void StoreSession(WOLFSSL *ssl, const char *host, uint16_t port)
+{
+    WOLFSSL_SESSION *session = wolfSSL_get_session(ssl);
+    if (session == NULL) {
+        return;
+    }
+    int size = wolfSSL_i2d_SSL_SESSION(session, NULL);
+    if (size <= 0 || size > MAX_SESSION_SIZE) {
+        return;
+    }
+
+    // Replace the server's entry, or else an empty one, or else the oldest.
+    CachedSession *cached = FindCachedSession(host, port);
+    if (cached == NULL) {
+        cached = &sessionCache[0];
+        for (size_t i = 0; i < SESSION_CACHE_SIZE; ++i) {
+            if (sessionCache[i].size == 0) {
+                cached = &sessionCache[i];
+                break;
+            }
+            if (sessionCache[i].storedUs < cached->storedUs) {
+                cached = &sessionCache[i];
+            }
+        }
+    }
+
+    unsigned char *data = cached->session;
+    if (wolfSSL_i2d_SSL_SESSION(session, &data) != size) {
+        cached->size = 0;
+        return;
+    }
+    strcpy(cached->host, host);
+    cached->port = port;
+    cached->size = (uint16_t)size;
+    cached->storedUs = HttpsClient_NowUs();
+}
+#endif // SESSION_CACHE_SUPPORTED
+
+static int SetEvents(Connection *connection, EventLoop_IoEvents events)
+{
+    if (events == connection->events) {
+        return 0;
+    }
+    if (EventLoop_ModifyIoEvents(clientEventLoop, connection->registration, events) != 0) {
+        Log_Debug("ERROR: Could not modify socket events: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+    connection->events = events;
+    return 0;
+}
+
+// Arms the timer for the earliest deadline of the connections which have transfers, or
+// immediately if a transfer has failed to start, or disarms it if there are no transfers.
+static void ScheduleTimer(void)
+{
+    int64_t next = INT64_MAX;
+    for (size_t i = 0; i < MAX_CONNECTIONS; ++i) {
+        if (connections[i].transfer == NULL) {
+            continue;
+        }
+        int64_t deadline =
+            (connections[i].state == Connection_Failed) ? 0 : connections[i].deadlineUs;
+        if (deadline < next) {
+            next = deadline;
+        }
+    }
+
+    struct itimerspec value = {.it_value = {0, 0}, .it_interval = {0, 0}};
+    if (next != INT64_MAX) {
+        int64_t delayUs = next - HttpsClient_NowUs();
+        if (delayUs < 0) {
+            delayUs = 0;
+        }
+        // A zero it_value would disarm the timer, so an immediate expiry is armed for 1 ns.
+        value.it_value.tv_sec = (time_t)(delayUs / 1000000);
+        value.it_value.tv_nsec = (long)(delayUs % 1000000) * 1000 + 1;
+    }
+    if (timerfd_settime(timerFd, /* flags */ 0, &value, /* old_value */ NULL) == -1) {
+        Log_Debug("ERROR: Could not set the request timer: %s (%d).\n", strerror(errno), errno);
+    }
+}
+
+static void CloseConnection(Connection *connection)
+{
+    if (connection->ssl != NULL) {
+        wolfSSL_free(connection->ssl);
+        connection->ssl = NULL;
+    }
+    if (connection->registration != NULL) {
+        EventLoop_UnregisterIo(clientEventLoop, connection->registration);
+        connection->registration = NULL;
+    }
+    if (connection->fd != -1) {
+        close(connection->fd);
+        connection->fd = -1;
+    }
+    connection->state = Connection_Closed;
+    connection->transfer = NULL;
+}
+
+// Detaches the transfer from its connection, closing the connection unless it is to be kept, and
+// completes the transfer. The completion handler may start another request on the connection, so
+// the connection must not be used by the caller afterwards.
+static void Complete(Connection *connection, HttpsClient_Result result, bool close)
+{
+    HttpsClient_Transfer *transfer = connection->transfer;
+    if (close) {
+        CloseConnection(connection);
+    } else {
+        connection->transfer = NULL;
+    }
+    ScheduleTimer();
+    HttpsClient_CompleteTransfer(transfer, result);
+}
+
+static void OpenConnection(Connection *connection, HttpsClient_Transfer *transfer);
+
+static void Fail(Connection *connection, HttpsClient_Result result)
+{
+    HttpsClient_Transfer *transfer = connection->transfer;
+    bool retry = result == HttpsClient_Result_Failed && transfer->metrics.reusedConnection &&
+                 !connection->receivedResponse;
+
+    if (retry) {
+        Log_Debug("INFO: Reused connection to %s was closed; reconnecting.\n", transfer->host);
+        CloseConnection(connection);
+        OpenConnection(connection, transfer);
+        if (connection->state != Connection_Failed) {
+            ScheduleTimer();
+            return;
+        }
+    }
+
+    Complete(connection, result, /* close */ true);
+}
+
+static size_t CountIdleConnections(void)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < MAX_CONNECTIONS; ++i) {
+        if (connections[i].state == Connection_Idle) {
+            ++count;
+        }
+    }
+    return count;
+}
+
+// Completes a transfer whose response has been received in full, and keeps the connection for
+// the next request if it can be reused.
+static void FinishResponse(Connection *connection)
+{
+#if SESSION_CACHE_SUPPORTED
+    // In TLS 1.3 the server sends its session ticket after the handshake, so the session is stored
+    // once the response has been received.
+    StoreSession(connection->ssl, connection->host, connection->port);
+#endif
+
+    bool keep = connection->keepAlive && CountIdleConnections() < maxIdleConnections &&
+                SetEvents(connection, EventLoop_Input) == 0;
+    if (keep) {
+        connection->state = Connection_Idle;
+        connection->lastUsedUs = HttpsClient_NowUs();
+    }
+    Complete(connection, HttpsClient_Result_Succeeded, /* close */ !keep);
+}
+
+// Returns whether a comma-separated header value contains a token, ignoring case.
+static bool HeaderValueContains(const char *value, const char *token)
+{
+    size_t tokenLength = strlen(token);
+    for (const char *c = value; *c != '\0'; ++c) {
+        if (strncasecmp(c, token, tokenLength) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Handles a header line, and returns false if the response is malformed.
+static bool HandleHeaderLine(Connection *connection)
+{
+    const char *line = connection->line;
+    HttpsClient_Transfer *transfer = connection->transfer;
+
+    if (!connection->statusLineReceived) {
+        if (connection->lineTruncated || strncmp(line, "HTTP/1.", 7) != 0) {
+            return false;
+        }
+        connection->statusLineReceived = true;
+        // HTTP/1.0 servers close the connection unless they are asked not to.
+        connection->keepAlive = line[7] != '0';
+        connection->chunked = false;
+        connection->hasContentLength = false;
+        HttpsClient_HandleHeaderLine(transfer, line, connection->lineLength);
+        return true;
+    }
+
+    if (!connection->lineTruncated) {
+        static const char contentLength[] = "Content-Length:";
+        static const char transferEncoding[] = "Transfer-Encoding:";
+        static const char connectionHeader[] = "Connection:";
+        if (strncasecmp(line, contentLength, sizeof(contentLength) - 1) == 0) {
+            connection->contentLength = strtoull(line + sizeof(contentLength) - 1, NULL, 10);
+            connection->hasContentLength = true;
+        } else if (strncasecmp(line, transferEncoding, sizeof(transferEncoding) - 1) == 0) {
+            connection->chunked = HeaderValueContains(line, "chunked");
+        } else if (strncasecmp(line, connectionHeader, sizeof(connectionHeader) - 1) == 0) {
+            if (HeaderValueContains(line, "close")) {
+                connection->keepAlive = false;
+            } else if (HeaderValueContains(line, "keep-alive")) {
+                connection->keepAlive = true;
+            }
+        }
+    }
+
+    HttpsClient_HandleHeaderLine(transfer, line, connection->lineLength);
+    return true;
+}
+
+// Decides how the body is delimited once the headers have been received. Returns false if the
+// response is complete.
+static bool StartBody(Connection *connection)
+{
+    int status = connection->transfer->metrics.status;
+    if (status == 204 || status == 304) {
+        connection->framing = Framing_None;
+    } else if (connection->chunked) {
+        connection->framing = Framing_Chunked;
+        connection->chunkState = Chunk_Size;
+    } else if (connection->hasContentLength) {
+        connection->framing =
+            (connection->contentLength > 0) ? Framing_Length : Framing_None;
+        connection->remaining = connection->contentLength;
+    } else {
+        // The end of the body can only be told from the server closing the connection.
+        connection->framing = Framing_UntilClose;
+        connection->keepAlive = false;
+    }
+
+    connection->state = Connection_ReceivingBody;
+    return connection->framing != Framing_None;
+}
+
+// Takes bytes from the data into the connection's line, and returns true once a whole line has
+// been taken. A line which does not fit is truncated.
+static bool TakeLine(Connection *connection, const uint8_t **data, size_t *size)
+{
+    while (*size > 0) {
+        char c = (char)**data;
+        ++*data;
+        --*size;
+        if (c == '\n') {
+            size_t length = connection->lineLength;
+            if (length > 0 && connection->line[length - 1] == '\r') {
+                --connection->lineLength;
+            }
+            connection->line[connection->lineLength] = '\0';
+            return true;
+        }
+        if (connection->lineLength < sizeof(connection->line) - 1) {
+            connection->line[connection->lineLength++] = c;
+        } else {
+            connection->lineTruncated = true;
+        }
+    }
+    return false;
+}
+
+static void ResetLine(Connection *connection)
+{
+    connection->lineLength = 0;
+    connection->lineTruncated = false;
+}
+
+// Passes part of the body to the application; returns false if the application aborted the
+// transfer, which has then been completed.
+static bool DeliverBody(Connection *connection, const uint8_t *data, size_t size)
+{
+    if (size == 0 || HttpsClient_HandleBody(connection->transfer, data, size)) {
+        return true;
+    }
+
+    // The rest of the body would have to be read before the connection could be reused.
+    Complete(connection, HttpsClient_Result_Aborted, /* close */ true);
+    return false;
+}
+
+// Parses received data. Returns false once the transfer has been completed or failed.
+static bool ParseResponse(Connection *connection, const uint8_t *data, size_t size)
+{
+    while (size > 0) {
+        if (connection->state == Connection_ReceivingHeaders) {
+            if (!TakeLine(connection, &data, &size)) {
+                return true;
+            }
+
+            if (connection->lineLength > 0 || connection->lineTruncated) {
+                bool valid = HandleHeaderLine(connection);
+                ResetLine(connection);
+                if (!valid) {
+                    Log_Debug("ERROR: Malformed response from %s.\n", connection->host);
+                    Fail(connection, HttpsClient_Result_Failed);
+                    return false;
+                }
+                continue;
+            }
+
+            ResetLine(connection);
+            if (!connection->statusLineReceived) {
+                continue;
+            }
+
+            // An interim response is followed by another response.
+            int status = connection->transfer->metrics.status;
+            if (status >= 100 && status < 200) {
+                connection->statusLineReceived = false;
+                continue;
+            }
+
+            if (!StartBody(connection)) {
+                FinishResponse(connection);
+                return false;
+            }
+            continue;
+        }
+
+        switch (connection->framing) {
+        case Framing_Length: {
+            size_t take = (connection->remaining < size) ? (size_t)connection->remaining : size;
+            if (!DeliverBody(connection, data, take)) {
+                return false;
+            }
+            data += take;
+            size -= take;
+            connection->remaining -= take;
+            if (connection->remaining == 0) {
+                FinishResponse(connection);
+                return false;
+            }
+            break;
+        }
+
+        case Framing_UntilClose:
+            return DeliverBody(connection, data, size);
+
+        case Framing_Chunked:
+            if (connection->chunkState == Chunk_Data) {
+                size_t take =
+                    (connection->remaining < size) ? (size_t)connection->remaining : size;
+                if (!DeliverBody(connection, data, take)) {
+                    return false;
+                }
+                data += take;
+                size -= take;
+                connection->remaining -= take;
+                if (connection->remaining == 0) {
+                    connection->chunkState = Chunk_DataEnd;
+                }
+                break;
+            }
+
+            if (!TakeLine(connection, &data, &size)) {
+                return true;
+            }
+
+            if (connection->chunkState == Chunk_Size) {
+                // The size is in hexadecimal, and may be followed by extensions.
+                char *end;
+                connection->remaining = strtoull(connection->line, &end, 16);
+                if (end == connection->line) {
+                    Log_Debug("ERROR: Malformed chunk from %s.\n", connection->host);
+                    Fail(connection, HttpsClient_Result_Failed);
+                    return false;
+                }
+                connection->chunkState =
+                    (connection->remaining > 0) ? Chunk_Data : Chunk_Trailer;
+            } else if (connection->chunkState == Chunk_DataEnd) {
+                connection->chunkState = Chunk_Size;
+            } else if (connection->lineLength == 0 && !connection->lineTruncated) {
+                // The empty line after the trailer ends the body.
+                ResetLine(connection);
+                FinishResponse(connection);
+                return false;
+            }
+            ResetLine(connection);
+            break;
+
+        case Framing_None:
+            FinishResponse(connection);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void Receive(Connection *connection)
+{
+    for (;;) {
+        int bytesRead = wolfSSL_read(connection->ssl, readBuffer, sizeof(readBuffer));
+        if (bytesRead > 0) {
+            if (!connection->receivedResponse) {
+                connection->receivedResponse = true;
+                connection->transfer->metrics.firstByteUs =
+                    (uint32_t)(HttpsClient_NowUs() - connection->phaseStartUs);
+            }
+            if (!ParseResponse(connection, readBuffer, (size_t)bytesRead)) {
+                return;
+            }
+            continue;
+        }
+
+        int error = wolfSSL_get_error(connection->ssl, bytesRead);
+        if (error == WOLFSSL_ERROR_WANT_READ) {
+            if (SetEvents(connection, EventLoop_Input) != 0) {
+                Fail(connection, HttpsClient_Result_Failed);
+            }
+            return;
+        }
+
+        bool closed = error == WOLFSSL_ERROR_ZERO_RETURN || error == SOCKET_PEER_CLOSED_E;
+        if (closed && connection->state == Connection_ReceivingBody &&
+            connection->framing == Framing_UntilClose) {
+            connection->keepAlive = false;
+            FinishResponse(connection);
+            return;
+        }
+
+        Log_Debug("ERROR: wolfSSL_read from %s: %d\n", connection->host, error);
+        Fail(connection, HttpsClient_Result_Failed);
+        return;
+    }
+}
+
+static void Send(Connection *connection)
+{
+    while (connection->requestSent < connection->requestLength) {
+        int bytesWritten =
+            wolfSSL_write(connection->ssl, connection->request + connection->requestSent,
+                          (int)(connection->requestLength - connection->requestSent));
+        if (bytesWritten <= 0) {
+            int error = wolfSSL_get_error(connection->ssl, bytesWritten);
+            if (error == WOLFSSL_ERROR_WANT_WRITE) {
+                if (SetEvents(connection, EventLoop_Output) != 0) {
+                    Fail(connection, HttpsClient_Result_Failed);
+                }
+                return;
+            }
+            Log_Debug("ERROR: wolfSSL_write to %s: %d\n", connection->host, error);
+            Fail(connection, HttpsClient_Result_Failed);
+            return;
+        }
+        connection->requestSent += (size_t)bytesWritten;
+    }
+
+    connection->state = Connection_ReceivingHeaders;
+    connection->phaseStartUs = HttpsClient_NowUs();
+    Receive(connection);
+}
+
+static void Handshake(Connection *connection)
+{
+    int r = wolfSSL_connect(connection->ssl);
+    if (r != WOLFSSL_SUCCESS) {
+        int error = wolfSSL_get_error(connection->ssl, r);
+        if (error == WOLFSSL_ERROR_WANT_READ || error == WOLFSSL_ERROR_WANT_WRITE) {
+            if (SetEvents(connection, (error == WOLFSSL_ERROR_WANT_READ) ? EventLoop_Input
+                                                                         : EventLoop_Output) !=
+                0) {
+                Fail(connection, HttpsClient_Result_Failed);
+            }
+            return;
+        }
+        Log_Debug("ERROR: wolfSSL_connect to %s: %d\n", connection->host, error);
+        Fail(connection, HttpsClient_Result_Failed);
+        return;
+    }
+
+    HttpsClient_Metrics *metrics = &connection->transfer->metrics;
+    metrics->tlsUs = (uint32_t)(HttpsClient_NowUs() - connection->phaseStartUs);
+    metrics->resumedSession = wolfSSL_session_reused(connection->ssl) != 0;
+    StartSending(connection);
+}
+
+static void ConnectionCompleted(Connection *connection)
+{
+    int error = 0;
+    socklen_t errorLength = sizeof(error);
+    if (getsockopt(connection->fd, SOL_SOCKET, SO_ERROR, &error, &errorLength) != 0 ||
+        error != 0) {
+        Log_Debug("ERROR: Could not connect to %s: %s (%d).\n", connection->host,
+                  strerror(error), error);
+        Fail(connection, HttpsClient_Result_Failed);
+        return;
+    }
+
+    int64_t now = HttpsClient_NowUs();
+    connection->transfer->metrics.connectUs = (uint32_t)(now - connection->phaseStartUs);
+    connection->phaseStartUs = now;
+
+    connection->ssl = wolfSSL_new(wolfSslCtx);
+    if (connection->ssl == NULL || wolfSSL_set_fd(connection->ssl, connection->fd) !=
+                                       WOLFSSL_SUCCESS ||
+        wolfSSL_check_domain_name(connection->ssl, connection->host) != WOLFSSL_SUCCESS) {
+        Log_Debug("ERROR: Could not set up the TLS session for %s.\n", connection->host);
+        Fail(connection, HttpsClient_Result_Failed);
+        return;
+    }
+#ifdef HAVE_SNI
+    wolfSSL_UseSNI(connection->ssl, WOLFSSL_SNI_HOST_NAME, connection->host,
+                   (unsigned short)strlen(connection->host));
+#endif
+#if SESSION_CACHE_SUPPORTED
+    LoadSession(connection->ssl, connection->host, connection->port);
+#endif
+
+    connection->state = Connection_Handshaking;
+    Handshake(connection);
+}
+
+// This satisfies the EventLoopIoCallback signature.
+static void ConnectionEventHandler(EventLoop *el, int fd, EventLoop_IoEvents events, void *context)
+{
+    Connection *connection = context;
+    switch (connection->state) {
+    case Connection_Connecting:
+        ConnectionCompleted(connection);
+        break;
+    case Connection_Handshaking:
+        Handshake(connection);
+        break;
+    case Connection_Sending:
+        Send(connection);
+        break;
+    case Connection_ReceivingHeaders:
+    case Connection_ReceivingBody:
+        Receive(connection);
+        break;
+    case Connection_Idle: {
+        // Unless this was a message which wolfSSL handles itself, such as a session ticket, the
+        // server has closed the connection, or sent data which was not asked for.
+        int r = wolfSSL_read(connection->ssl, readBuffer, sizeof(readBuffer));
+        if (r > 0 || wolfSSL_get_error(connection->ssl, r) != WOLFSSL_ERROR_WANT_READ) {
+            CloseConnection(connection);
+        }
+        break;
+    }
+    case Connection_Closed:
+    case Connection_Failed:
+        break;
+    }
+}
+
+// Waits for the connection to be writable before sending the request, so that a reused
+// connection is not written to, and the transfer is not completed, from within
+// HttpsClient_BackendOps.start.
+static void StartSending(Connection *connection)
+{
+    connection->state = Connection_Sending;
+    connection->requestSent = 0;
+    connection->receivedResponse = false;
+    connection->statusLineReceived = false;
+    ResetLine(connection);
+
+    if (SetEvents(connection, EventLoop_Output) != 0) {
+        connection->state = Connection_Failed;
+        ScheduleTimer();
+    }
+}
+
+static int FormatRequest(Connection *connection, HttpsClient_Transfer *transfer)
+{
+    char port[8] = "";
+    if (transfer->port != 443) {
+        snprintf(port, sizeof(port), ":%u", transfer->port);
+    }
+    int length = snprintf(connection->request, sizeof(connection->request),
+                          "GET %s%s HTTP/1.1\r\nHost: %s%s\r\n%s%s%s%s\r\n",
+                          (transfer->path[0] == '/') ? "" : "/", transfer->path, transfer->host,
+                          port, (userAgent != NULL) ? "User-Agent: " : "",
+                          (userAgent != NULL) ? userAgent : "", (userAgent != NULL) ? "\r\n" : "",
+                          transfer->headers);
+    if (length < 0 || (size_t)length >= sizeof(connection->request)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    connection->requestLength = (size_t)length;
+    return 0;
+}
+
+// Starts a new connection for a transfer. If it cannot be started, the connection is left in the
+// failed state, so that the transfer is failed from the timer.
+static void OpenConnection(Connection *connection, HttpsClient_Transfer *transfer)
+{
+    connection->transfer = transfer;
+    connection->state = Connection_Failed;
+    strcpy(connection->host, transfer->host);
+    connection->port = transfer->port;
+    transfer->metrics.reusedConnection = false;
+    connection->events = EventLoop_Output;
+
+    int64_t start = HttpsClient_NowUs();
+    struct addrinfo hints = {.ai_family = AF_INET, .ai_socktype = SOCK_STREAM};
+    struct addrinfo *addresses = NULL;
+    char service[6];
+    snprintf(service, sizeof(service), "%u", transfer->port);
+    int r = getaddrinfo(transfer->host, service, &hints, &addresses);
+    int64_t now = HttpsClient_NowUs();
+    transfer->metrics.dnsUs = (uint32_t)(now - start);
+    connection->phaseStartUs = now;
+    if (r != 0) {
+        Log_Debug("ERROR: Could not resolve %s: %d\n", transfer->host, r);
+        return;
+    }
+
+    connection->fd = socket(addresses->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (connection->fd == -1 ||
+        (connect(connection->fd, addresses->ai_addr, addresses->ai_addrlen) != 0 &&
+         errno != EINPROGRESS)) {
+        Log_Debug("ERROR: Could not connect to %s: %s (%d).\n", transfer->host, strerror(errno),
+                  errno);
+        freeaddrinfo(addresses);
+        return;
+    }
+    freeaddrinfo(addresses);
+
+    connection->registration = EventLoop_RegisterIo(clientEventLoop, connection->fd,
+                                                    EventLoop_Output, ConnectionEventHandler,
+                                                    connection);
+    if (connection->registration == NULL) {
+        Log_Debug("ERROR: Could not register socket: %s (%d).\n", strerror(errno), errno);
+        return;
+    }
+
+    connection->state = Connection_Connecting;
+}
+
+// Finds a connection for a new transfer: an idle connection to the same server, or else a closed
+// one, or else the least recently used idle one, which is closed.
+static Connection *FindConnection(const HttpsClient_Transfer *transfer, bool *reuse)
+{
+    Connection *closed = NULL;
+    Connection *oldestIdle = NULL;
+    for (size_t i = 0; i < MAX_CONNECTIONS; ++i) {
+        Connection *connection = &connections[i];
+        if (connection->state == Connection_Idle) {
+            if (connection->port == transfer->port &&
+                strcmp(connection->host, transfer->host) == 0) {
+                *reuse = true;
+                return connection;
+            }
+            if (oldestIdle == NULL || connection->lastUsedUs < oldestIdle->lastUsedUs) {
+                oldestIdle = connection;
+            }
+        } else if (connection->state == Connection_Closed && closed == NULL) {
+            closed = connection;
+        }
+    }
+
+    *reuse = false;
+    if (closed != NULL) {
+        return closed;
+    }
+    if (oldestIdle != NULL) {
+        CloseConnection(oldestIdle);
+    }
+    return oldestIdle;
+}
+
+static int WolfSslStart(HttpsClient_Transfer *transfer)
+{
+    bool reuse;
+    Connection *connection = FindConnection(transfer, &reuse);
+    if (connection == NULL) {
+        errno = EBUSY;
+        return -1;
+    }
+    if (FormatRequest(connection, transfer) != 0) {
+        return -1;
+    }
+
+    connection->deadlineUs = transfer->startUs + timeoutUs;
+    if (reuse) {
+        connection->transfer = transfer;
+        transfer->metrics.reusedConnection = true;
+        StartSending(connection);
+    } else {
+        OpenConnection(connection, transfer);
+    }
+
+    ScheduleTimer();
+    return 0;
+}
+
+// This satisfies the EventLoopIoCallback signature.
+static void TimerCallback(EventLoop *el, int fd, EventLoop_IoEvents events, void *context)
+{
+    uint64_t expirations;
+    if (read(timerFd, &expirations, sizeof(expirations)) == -1) {
+        Log_Debug("ERROR: Could not read timerfd %s (%d).\n", strerror(errno), errno);
+        return;
+    }
+
+    int64_t now = HttpsClient_NowUs();
+    for (size_t i = 0; i < MAX_CONNECTIONS; ++i) {
+        Connection *connection = &connections[i];
+        if (connection->transfer == NULL) {
+            continue;
+        }
+        if (connection->state == Connection_Failed) {
+            Complete(connection, HttpsClient_Result_Failed, /* close */ true);
+        } else if (now >= connection->deadlineUs) {
+            Log_Debug("ERROR: Request to %s timed out.\n", connection->host);
+            Complete(connection, HttpsClient_Result_TimedOut, /* close */ true);
+        }
+    }
+
+    ScheduleTimer();
+}
+
+static void WolfSslCancel(HttpsClient_Transfer *transfer)
+{
+    for (size_t i = 0; i < MAX_CONNECTIONS; ++i) {
+        if (connections[i].transfer == transfer) {
+            CloseConnection(&connections[i]);
+        }
+    }
+}
+
+static void WolfSslCleanup(void)
+{
+    for (size_t i = 0; i < MAX_CONNECTIONS; ++i) {
+        CloseConnection(&connections[i]);
+    }
+    if (wolfSslCtx != NULL) {
+        wolfSSL_CTX_free(wolfSslCtx);
+        wolfSslCtx = NULL;
+    }
+    if (wolfSslInitialized) {
+        wolfSSL_Cleanup();
+        wolfSslInitialized = false;
+    }
+    EventLoop_UnregisterIo(clientEventLoop, timerRegistration);
+    timerRegistration = NULL;
+    if (timerFd != -1) {
+        close(timerFd);
+        timerFd = -1;
+    }
+}
+
+static int WolfSslInit(EventLoop *eventLoop, const HttpsClient_Config *config)
+{
+    clientEventLoop = eventLoop;
+    userAgent = config->userAgent;
+    timeoutUs = (int64_t)config->timeoutSeconds * 1000000;
+    maxIdleConnections = config->maxIdleConnections;
+    for (size_t i = 0; i < MAX_CONNECTIONS; ++i) {
+        memset(&connections[i], 0, sizeof(connections[i]));
+        connections[i].fd = -1;
+    }
+#if SESSION_CACHE_SUPPORTED
+    memset(sessionCache, 0, sizeof(sessionCache));
+#endif
+
+    if (wolfSSL_Init() != WOLFSSL_SUCCESS) {
+        Log_Debug("ERROR: wolfSSL_Init has failed.\n");
+        errno = EIO;
+        return -1;
+    }
+    wolfSslInitialized = true;
+
+    char *certificatePath = NULL;
+    wolfSslCtx = wolfSSL_CTX_new(wolfSSLv23_client_method());
+    if (wolfSslCtx == NULL) {
+        Log_Debug("ERROR: wolfSSL_CTX_new has failed.\n");
+        errno = ENOMEM;
+        goto failed;
+    }
+
+    certificatePath = Storage_GetAbsolutePathInImagePackage(config->caCertificatePath);
+    if (certificatePath == NULL) {
+        Log_Debug("ERROR: The certificate path could not be resolved: %s (%d).\n",
+                  strerror(errno), errno);
+        goto failed;
+    }
+    int r = wolfSSL_CTX_load_verify_locations(wolfSslCtx, certificatePath, NULL);
+    free(certificatePath);
+    if (r != WOLFSSL_SUCCESS) {
+        Log_Debug("ERROR: wolfSSL_CTX_load_verify_locations %d\n", r);
+        errno = EINVAL;
+        goto failed;
+    }
+    wolfSSL_CTX_set_verify(wolfSslCtx, WOLFSSL_VERIFY_PEER, NULL);
+
+    if (config->tlsContextHandler != NULL && !config->tlsContextHandler(wolfSslCtx)) {
+        Log_Debug("ERROR: The TLS context handler has failed.\n");
+        errno = EIO;
+        goto failed;
+    }
+
+#if SESSION_CACHE_SUPPORTED
+    // Ask servers for session tickets, which new connections use to resume their sessions.
+    if (wolfSSL_CTX_UseSessionTicket(wolfSslCtx) != WOLFSSL_SUCCESS) {
+        Log_Debug("WARNING: wolfSSL_CTX_UseSessionTicket has failed.\n");
+    }
+#endif
+
+    timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (timerFd == -1) {
+        Log_Debug("ERROR: Unable to create timer: %s (%d).\n", strerror(errno), errno);
+        goto failed;
+    }
+    timerRegistration =
+        EventLoop_RegisterIo(clientEventLoop, timerFd, EventLoop_Input, TimerCallback, NULL);
+    if (timerRegistration == NULL) {
+        Log_Debug("ERROR: Unable to register timer event: %s (%d).\n", strerror(errno), errno);
+        goto failed;
+    }
+
+    return 0;
+
+failed:;
+    int error = errno;
+    WolfSslCleanup();
+    errno = error;
+    return -1;
+}
+
+const HttpsClient_BackendOps HttpsClient_WolfSslBackend = {
+    .name = "wolfSSL", .init = WolfSslInit, .start = WolfSslStart, .cancel = WolfSslCancel,
+    .cleanup = WolfSslCleanup};
@@ -0,0 +1,101 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <applibs/log.h>
+#include <applibs/storage.h>
+
+#include "image_asset.h"
+
+int ImageAsset_Open(ImageAsset *asset, const char *path)
+{
+    asset->data = NULL;
+    asset->size = 0;
+    asset->fd = Storage_OpenFileInImagePackage(path);
+    if (asset->fd == -1) {
+        return -1;
+    }
+
+    struct stat status;
+    if (fstat(asset->fd, &status) == -1) {
+        int error = errno;
+        ImageAsset_Close(asset);
+        errno = error;
+        return -1;
+    }
+    asset->size = status.st_size;
+
+    // An empty file cannot be mapped, and needs no buffer to read it.
+    if (asset->size == 0) {
+        return 0;
+    }
+
+    void *data = mmap(NULL, (size_t)asset->size, PROT_READ, MAP_PRIVATE, asset->fd, 0);
+    if (data == MAP_FAILED) {
+        Log_Debug("INFO: %s cannot be mapped (errno=%d); reading it instead.\n", path, errno);
+        return 0;
+    }
+
+    // The mapping remains valid once the descriptor is closed.
+    asset->data = data;
+    close(asset->fd);
+    asset->fd = -1;
+    return 0;
+}
+
+void ImageAsset_Close(ImageAsset *asset)
+{
+    if (asset->data != NULL) {
+        munmap((void *)asset->data, (size_t)asset->size);
+        asset->data = NULL;
+    }
+
+    if (asset->fd != -1) {
+        close(asset->fd);
+        asset->fd = -1;
+    }
+
+    asset->size = 0;
+}
+
+const uint8_t *ImageAsset_View(const ImageAsset *asset, off_t offset, size_t size,
+                               uint8_t *buffer)
+{
+    if (offset < 0 || offset > asset->size || size > (size_t)(asset->size - offset)) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if (asset->data != NULL) {
+        return asset->data + offset;
+    }
+
+    if (asset->fd == -1) {
+        errno = EBADF;
+        return NULL;
+    }
+
+    size_t bytesSoFar = 0;
+    while (bytesSoFar < size) {
+        ssize_t bytesRead =
+            pread(asset->fd, buffer + bytesSoFar, size - bytesSoFar, offset + (off_t)bytesSoFar);
+        if (bytesRead == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return NULL;
+        }
+        if (bytesRead == 0) {
+            // The file is shorter than it was when it was opened.
+            errno = EIO;
+            return NULL;
+        }
+        bytesSoFar += (size_t)bytesRead;
+    }
+
+    return buffer;
+}
@@ -0,0 +1,67 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// An image asset gives read-only access to a file in the application's image package. The file is
+// mapped into memory where the platform allows, so that its contents can be used in place, without
+// copying them into a buffer; otherwise it is read on demand. The image package cannot change
+// while the application is running, so a mapping stays valid until the asset is closed.
+
+/// <summary>
+///     A file in the image package, which is opened with <see cref="ImageAsset_Open" />.
+/// </summary>
+typedef struct {
+    /// <summary>Descriptor for the file, or -1 if the file is mapped or the asset is
+    /// closed.</summary>
+    int fd;
+    /// <summary>Start of the file's mapping, or NULL if it is not mapped.</summary>
+    const uint8_t *data;
+    /// <summary>Size of the file in bytes.</summary>
+    off_t size;
+} ImageAsset;
+
+/// <summary>
+///     Opens a file in the image package, and maps it into memory if possible.
+/// </summary>
+/// <param name="asset">The asset to initialize.</param>
+/// <param name="path">Path of the file, relative to the root of the image package.</param>
+/// <returns>0 on success, or -1 on failure with errno set, in which case the asset is closed.
+/// </returns>
+int ImageAsset_Open(ImageAsset *asset, const char *path);
+
+/// <summary>
+///     Closes an asset which was opened with <see cref="ImageAsset_Open" />. Pointers which were
+///     returned by <see cref="ImageAsset_View" /> are no longer valid. It is safe to call this
+///     function with an asset which is already closed.
+/// </summary>
+/// <param name="asset">The asset.</param>
+void ImageAsset_Close(ImageAsset *asset);
+
+/// <summary>
+///     Gets whether the asset is mapped into memory, in which case <see cref="ImageAsset_View" />
+///     never copies it.
+/// </summary>
+/// <param name="asset">The asset.</param>
+static inline bool ImageAsset_IsMapped(const ImageAsset *asset)
+{
+    return asset->data != NULL;
+}
+
+/// <summary>
+///     Gets a pointer to part of the asset. If the asset is mapped, the pointer is into the
+///     mapping; otherwise the part is read into the supplied buffer.
+/// </summary>
+/// <param name="asset">The asset.</param>
+/// <param name="offset">Offset of the part in the file.</param>
+/// <param name="size">Size of the part, which must not extend beyond the end of the file.</param>
+/// <param name="buffer">Buffer of at least size bytes, which is only used if the asset is not
+/// mapped. It may be NULL if the asset is mapped.</param>
+/// <returns>Pointer to the part, or NULL on failure with errno set.</returns>
+const uint8_t *ImageAsset_View(const ImageAsset *asset, off_t offset, size_t size,
+                               uint8_t *buffer);
@@ -0,0 +1,706 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "json_reader.h"
+
+// Name of an object member on the path to the value being read. Elements of arrays have a NULL
+// name, so that no path matches them.
+typedef struct {
+    const char *name;
+    size_t length;
+} PathSegment;
+
+// Number of slots in the hash index of the requested paths, a power of two. The index holds an
+// entry for each path and for each distinct prefix of a path, at most half of the slots.
+#define INDEX_SLOTS 128u
+#define MAX_INDEX_ENTRIES (INDEX_SLOTS / 2)
+
+// Index of the entry of a prefix of a requested path, rather than of a path.
+#define PREFIX_ENTRY (-1)
+
+typedef struct {
+    // 32-bit FNV-1a hash of the path or prefix, including the '.' separators.
+    uint32_t hash;
+    // Index of the requested path, or PREFIX_ENTRY.
+    int16_t pathIndex;
+    bool used;
+} IndexSlot;
+
+// Hash index of the requested paths, which is built when more than JSON_READER_INDEX_THRESHOLD
+// paths are requested. A value is then matched by looking up the hash of its path, rather than by
+// comparing its path with every requested path, and the members of an object none of whose
+// requested paths start with its path are not matched at all.
+typedef struct {
+    IndexSlot slots[INDEX_SLOTS];
+    size_t entryCount;
+} PathIndex;
+
+typedef struct {
+    const char *cursor;
+    const char *end;
+    const char *const *paths;
+    size_t pathCount;
+    JsonReader_Value *values;
+    PathSegment path[JSON_READER_MAX_DEPTH];
+    size_t depth;
+    // The index, or NULL if the requested paths are compared one by one.
+    const PathIndex *index;
+    // Hash of the path to the value at each depth, if an index is used.
+    uint32_t pathHash[JSON_READER_MAX_DEPTH + 1];
+    // Whether the value being read may hold a requested path; false in the subtree of a value
+    // which is not on any requested path, if an index is used.
+    bool searching;
+} Reader;
+
+static const uint32_t hashOffsetBasis = 2166136261u;
+static const uint32_t hashPrime = 16777619u;
+
+static bool ReadValue(Reader *reader, JsonReader_Value *value);
+
+static void SkipWhitespace(Reader *reader)
+{
+    while (reader->cursor < reader->end &&
+           (*reader->cursor == ' ' || *reader->cursor == '\t' || *reader->cursor == '\n' ||
+            *reader->cursor == '\r')) {
+        ++reader->cursor;
+    }
+}
+
+static bool ConsumeChar(Reader *reader, char c)
+{
+    SkipWhitespace(reader);
+    if (reader->cursor < reader->end && *reader->cursor == c) {
+        ++reader->cursor;
+        return true;
+    }
+    return false;
+}
+
+static bool ConsumeLiteral(Reader *reader, const char *literal)
+{
+    size_t length = strlen(literal);
+    if ((size_t)(reader->end - reader->cursor) < length ||
+        memcmp(reader->cursor, literal, length) != 0) {
+        return false;
+    }
+    reader->cursor += length;
+    return true;
+}
+
+static bool IsDigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+static bool ConsumeDigits(Reader *reader)
+{
+    const char *start = reader->cursor;
+    while (reader->cursor < reader->end && IsDigit(*reader->cursor)) {
+        ++reader->cursor;
+    }
+    return reader->cursor != start;
+}
+
+// Find the first quote, backslash or control character in a string, or the end of the span.
+static const char *FindSpecialStringByte(const char *p, const char *end)
+{
+#if defined(__ARM_NEON)
+    // Compare 16 bytes at a time. The comparison sets each byte of the mask which is special; the
+    // mask is narrowed to four bits per byte, so that the first one can be found in a 64-bit word.
+    const uint8x16_t quote = vdupq_n_u8('"');
+    const uint8x16_t backslash = vdupq_n_u8('\\');
+    const uint8x16_t space = vdupq_n_u8(0x20);
+    for (; end - p >= 16; p += 16) {
+        uint8x16_t bytes = vld1q_u8((const uint8_t *)p);
+        uint8x16_t special = vorrq_u8(vorrq_u8(vceqq_u8(bytes, quote), vceqq_u8(bytes, backslash)),
+                                      vcltq_u8(bytes, space));
+        uint64_t nibbles = vget_lane_u64(
+            vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(special), 4)), 0);
+        if (nibbles != 0) {
+            return p + (__builtin_ctzll(nibbles) >> 2);
+        }
+    }
+#endif
+
+    // Check any remaining bytes one at a time.
+    for (; p < end; ++p) {
+        unsigned char c = (unsigned char)*p;
+        if (c == '"' || c == '\\' || c < 0x20) {
+            break;
+        }
+    }
+    return p;
+}
+
+// Read a string; the cursor must be at the opening quote. On success, the span excludes the quotes.
+static bool ReadString(Reader *reader, const char **start, size_t *length)
+{
+    ++reader->cursor;
+    *start = reader->cursor;
+    for (;;) {
+        reader->cursor = FindSpecialStringByte(reader->cursor, reader->end);
+        if (reader->cursor == reader->end) {
+            return false;
+        }
+
+        char c = *reader->cursor++;
+        if (c == '"') {
+            *length = (size_t)(reader->cursor - 1 - *start);
+            return true;
+        }
+        if ((unsigned char)c < 0x20) {
+            return false;
+        }
+
+        // The escape sequence itself is validated when the string is decoded.
+        if (reader->cursor == reader->end) {
+            return false;
+        }
+        ++reader->cursor;
+    }
+}
+
+static bool ReadNumber(Reader *reader)
+{
+    if (reader->cursor < reader->end && *reader->cursor == '-') {
+        ++reader->cursor;
+    }
+    // RFC 8259 does not allow leading zeros, so a zero integer part is a single digit.
+    const char *integerStart = reader->cursor;
+    if (!ConsumeDigits(reader) || (*integerStart == '0' && reader->cursor - integerStart > 1)) {
+        return false;
+    }
+    if (reader->cursor < reader->end && *reader->cursor == '.') {
+        ++reader->cursor;
+        if (!ConsumeDigits(reader)) {
+            return false;
+        }
+    }
+    if (reader->cursor < reader->end && (*reader->cursor == 'e' || *reader->cursor == 'E')) {
+        ++reader->cursor;
+        if (reader->cursor < reader->end && (*reader->cursor == '+' || *reader->cursor == '-')) {
+            ++reader->cursor;
+        }
+        if (!ConsumeDigits(reader)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool PathEquals(const char *path, const PathSegment *segments, size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        if (segments[i].name == NULL || strncmp(path, segments[i].name, segments[i].length) != 0) {
+            return false;
+        }
+        path += segments[i].length;
+        if (i + 1 < count) {
+            if (*path != '.') {
+                return false;
+            }
+            ++path;
+        }
+    }
+    return *path == '\0';
+}
+
+static uint32_t HashBytes(uint32_t hash, const char *bytes, size_t length)
+{
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= (uint8_t)bytes[i];
+        hash *= hashPrime;
+    }
+    return hash;
+}
+
+static bool AddIndexEntry(PathIndex *index, uint32_t hash, int16_t pathIndex)
+{
+    size_t slot = hash & (INDEX_SLOTS - 1);
+    while (index->slots[slot].used) {
+        // A prefix needs only one entry, whichever path or prefix has the same hash.
+        if (pathIndex == PREFIX_ENTRY && index->slots[slot].hash == hash) {
+            return true;
+        }
+        slot = (slot + 1) & (INDEX_SLOTS - 1);
+    }
+
+    if (index->entryCount == MAX_INDEX_ENTRIES) {
+        return false;
+    }
+    index->slots[slot].hash = hash;
+    index->slots[slot].pathIndex = pathIndex;
+    index->slots[slot].used = true;
+    ++index->entryCount;
+    return true;
+}
+
+// Build the index of the requested paths; returns false if they have too many prefixes.
+static bool BuildIndex(PathIndex *index, const char *const *paths, size_t pathCount)
+{
+    memset(index, 0, sizeof(*index));
+    for (size_t i = 0; i < pathCount; ++i) {
+        uint32_t hash = hashOffsetBasis;
+        for (const char *p = paths[i]; *p != '\0'; ++p) {
+            if (*p == '.' && !AddIndexEntry(index, hash, PREFIX_ENTRY)) {
+                return false;
+            }
+            hash = HashBytes(hash, p, 1);
+        }
+        if (!AddIndexEntry(index, hash, (int16_t)i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Whether any requested path is, or starts with, a path which has the given hash.
+static bool IndexContains(const PathIndex *index, uint32_t hash)
+{
+    size_t slot = hash & (INDEX_SLOTS - 1);
+    while (index->slots[slot].used) {
+        if (index->slots[slot].hash == hash) {
+            return true;
+        }
+        slot = (slot + 1) & (INDEX_SLOTS - 1);
+    }
+    return false;
+}
+
+// Record the value just read if the path to it is one of those requested.
+static void MatchPath(Reader *reader, const JsonReader_Value *value)
+{
+    for (size_t i = 0; i < reader->pathCount; ++i) {
+        if (PathEquals(reader->paths[i], reader->path, reader->depth)) {
+            reader->values[i] = *value;
+        }
+    }
+}
+
+// Record the value just read if the path to it is one of those in the index. Hashes can collide,
+// so a path whose hash matches is also compared.
+static void MatchIndexedPath(Reader *reader, const JsonReader_Value *value)
+{
+    uint32_t hash = reader->pathHash[reader->depth];
+    size_t slot = hash & (INDEX_SLOTS - 1);
+    while (reader->index->slots[slot].used) {
+        const IndexSlot *entry = &reader->index->slots[slot];
+        if (entry->hash == hash && entry->pathIndex != PREFIX_ENTRY &&
+            PathEquals(reader->paths[entry->pathIndex], reader->path, reader->depth)) {
+            reader->values[entry->pathIndex] = *value;
+        }
+        slot = (slot + 1) & (INDEX_SLOTS - 1);
+    }
+}
+
+static bool ReadObject(Reader *reader)
+{
+    if (reader->depth == JSON_READER_MAX_DEPTH) {
+        return false;
+    }
+
+    ++reader->cursor;
+    if (ConsumeChar(reader, '}')) {
+        return true;
+    }
+
+    do {
+        SkipWhitespace(reader);
+        if (reader->cursor == reader->end || *reader->cursor != '"') {
+            return false;
+        }
+
+        PathSegment *segment = &reader->path[reader->depth];
+        if (!ReadString(reader, &segment->name, &segment->length) || !ConsumeChar(reader, ':')) {
+            return false;
+        }
+
+        bool searching = reader->searching;
+        if (searching && reader->index != NULL) {
+            uint32_t hash = reader->pathHash[reader->depth];
+            if (reader->depth > 0) {
+                hash = HashBytes(hash, ".", 1);
+            }
+            hash = HashBytes(hash, segment->name, segment->length);
+            reader->pathHash[reader->depth + 1] = hash;
+            reader->searching = IndexContains(reader->index, hash);
+        }
+
+        ++reader->depth;
+        JsonReader_Value value;
+        bool valid = ReadValue(reader, &value);
+        if (valid && reader->searching) {
+            if (reader->index != NULL) {
+                MatchIndexedPath(reader, &value);
+            } else {
+                MatchPath(reader, &value);
+            }
+        }
+        --reader->depth;
+        reader->searching = searching;
+
+        if (!valid) {
+            return false;
+        }
+    } while (ConsumeChar(reader, ','));
+
+    return ConsumeChar(reader, '}');
+}
+
+static bool ReadArray(Reader *reader)
+{
+    if (reader->depth == JSON_READER_MAX_DEPTH) {
+        return false;
+    }
+
+    ++reader->cursor;
+    if (ConsumeChar(reader, ']')) {
+        return true;
+    }
+
+    reader->path[reader->depth].name = NULL;
+    reader->path[reader->depth].length = 0;
+    ++reader->depth;
+
+    // No path matches an element of an array, or a value within one.
+    bool searching = reader->searching;
+    reader->searching = reader->index == NULL;
+
+    bool valid;
+    do {
+        JsonReader_Value value;
+        valid = ReadValue(reader, &value);
+    } while (valid && ConsumeChar(reader, ','));
+
+    reader->searching = searching;
+    --reader->depth;
+
+    return valid && ConsumeChar(reader, ']');
+}
+
+static bool ReadValue(Reader *reader, JsonReader_Value *value)
+{
+    SkipWhitespace(reader);
+    if (reader->cursor == reader->end) {
+        return false;
+    }
+
+    value->start = reader->cursor;
+
+    bool valid;
+    switch (*reader->cursor) {
+    case '{':
+        value->type = JsonReader_Type_Object;
+        valid = ReadObject(reader);
+        break;
+    case '[':
+        value->type = JsonReader_Type_Array;
+        valid = ReadArray(reader);
+        break;
+    case '"':
+        value->type = JsonReader_Type_String;
+        return ReadString(reader, &value->start, &value->length);
+    case 't':
+        value->type = JsonReader_Type_Bool;
+        valid = ConsumeLiteral(reader, "true");
+        break;
+    case 'f':
+        value->type = JsonReader_Type_Bool;
+        valid = ConsumeLiteral(reader, "false");
+        break;
+    case 'n':
+        value->type = JsonReader_Type_Null;
+        valid = ConsumeLiteral(reader, "null");
+        break;
+    default:
+        value->type = JsonReader_Type_Number;
+        valid = ReadNumber(reader);
+        break;
+    }
+
+    value->length = (size_t)(reader->cursor - value->start);
+    return valid;
+}
+
+bool JsonReader_FindProperties(const char *json, size_t length, const char *const *paths,
+                               size_t pathCount, JsonReader_Value *values)
+{
+    Reader reader = {.cursor = json,
+                     .end = json + length,
+                     .paths = paths,
+                     .pathCount = pathCount,
+                     .values = values,
+                     .depth = 0,
+                     .index = NULL,
+                     .pathHash = {hashOffsetBasis},
+                     .searching = true};
+
+    PathIndex index;
+    if (pathCount > JSON_READER_INDEX_THRESHOLD && BuildIndex(&index, paths, pathCount)) {
+        reader.index = &index;
+    }
+
+    for (size_t i = 0; i < pathCount; ++i) {
+        values[i].type = JsonReader_Type_Missing;
+        values[i].start = NULL;
+        values[i].length = 0;
+    }
+
+    JsonReader_Value root;
+    if (!ReadValue(&reader, &root)) {
+        return false;
+    }
+
+    SkipWhitespace(&reader);
+    return reader.cursor == reader.end;
+}
+
+bool JsonReader_GetBool(const JsonReader_Value *value, bool *result)
+{
+    if (value->type != JsonReader_Type_Bool) {
+        return false;
+    }
+
+    *result = value->start[0] == 't';
+    return true;
+}
+
+bool JsonReader_GetInt64(const JsonReader_Value *value, int64_t *result)
+{
+    if (value->type != JsonReader_Type_Number) {
+        return false;
+    }
+
+    const char *p = value->start;
+    const char *end = value->start + value->length;
+    bool negative = *p == '-';
+    if (negative) {
+        ++p;
+    }
+
+    // Accumulate the magnitude as a negative number, which can hold INT64_MIN.
+    int64_t accumulator = 0;
+    for (; p < end; ++p) {
+        if (!IsDigit(*p)) {
+            return false;
+        }
+        int digit = *p - '0';
+        if (accumulator < (INT64_MIN + digit) / 10) {
+            return false;
+        }
+        accumulator = accumulator * 10 - digit;
+    }
+
+    if (!negative) {
+        if (accumulator == INT64_MIN) {
+            return false;
+        }
+        accumulator = -accumulator;
+    }
+
+    *result = accumulator;
+    return true;
+}
+
+bool JsonReader_GetDouble(const JsonReader_Value *value, double *result)
+{
+    // Powers of ten which a double holds exactly.
+    static const double exactPowersOfTen[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+                                              1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+                                              1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+    static const int maxExactPower = sizeof(exactPowersOfTen) / sizeof(exactPowersOfTen[0]) - 1;
+
+    if (value->type != JsonReader_Type_Number || value->length > JSON_READER_MAX_NUMBER_LENGTH) {
+        return false;
+    }
+
+    const char *p = value->start;
+    const char *end = value->start + value->length;
+    bool negative = *p == '-';
+    if (negative) {
+        ++p;
+    }
+
+    // Accumulate the significant digits, and the power of ten by which they are scaled. The
+    // reader has already checked the syntax of the number.
+    uint64_t mantissa = 0;
+    int digitCount = 0;
+    int exponent = 0;
+    bool inFraction = false;
+    for (; p < end && *p != 'e' && *p != 'E'; ++p) {
+        if (*p == '.') {
+            inFraction = true;
+            continue;
+        }
+        if (mantissa != 0 || *p != '0') {
+            ++digitCount;
+        }
+        if (digitCount <= 19) {
+            mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+            exponent -= inFraction ? 1 : 0;
+        } else if (!inFraction) {
+            ++exponent;
+        }
+    }
+
+    if (p < end) {
+        ++p;
+        bool negativeExponent = *p == '-';
+        if (*p == '-' || *p == '+') {
+            ++p;
+        }
+        int explicitExponent = 0;
+        for (; p < end && explicitExponent < 10000; ++p) {
+            explicitExponent = explicitExponent * 10 + (*p - '0');
+        }
+        exponent += negativeExponent ? -explicitExponent : explicitExponent;
+    }
+
+    // A mantissa of at most 53 bits and a power of ten which are both exact need only one
+    // correctly rounded multiplication or division (Clinger's fast path).
+    if (digitCount <= 19 && mantissa <= (UINT64_C(1) << 53) && exponent >= -maxExactPower &&
+        exponent <= maxExactPower) {
+        double magnitude = (double)mantissa;
+        magnitude = exponent < 0 ? magnitude / exactPowersOfTen[-exponent]
+                                 : magnitude * exactPowersOfTen[exponent];
+        *result = negative ? -magnitude : magnitude;
+        return true;
+    }
+
+    // Otherwise let strtod round the number; it needs a null-terminated copy.
+    char number[JSON_READER_MAX_NUMBER_LENGTH + 1];
+    memcpy(number, value->start, value->length);
+    number[value->length] = '\0';
+    *result = strtod(number, NULL);
+    return true;
+}
+
+static bool ReadHexQuad(const char *p, const char *end, uint32_t *result)
+{
+    if (end - p < 4) {
+        return false;
+    }
+
+    *result = 0;
+    for (int i = 0; i < 4; ++i) {
+        char c = p[i];
+        uint32_t digit;
+        if (IsDigit(c)) {
+            digit = (uint32_t)(c - '0');
+        } else if (c >= 'a' && c <= 'f') {
+            digit = (uint32_t)(c - 'a' + 10);
+        } else if (c >= 'A' && c <= 'F') {
+            digit = (uint32_t)(c - 'A' + 10);
+        } else {
+            return false;
+        }
+        *result = (*result << 4) | digit;
+    }
+    return true;
+}
+
+bool JsonReader_GetString(const JsonReader_Value *value, char *buffer, size_t size)
+{
+    if (value->type != JsonReader_Type_String || size == 0) {
+        return false;
+    }
+
+    const char *p = value->start;
+    const char *end = value->start + value->length;
+    size_t used = 0;
+
+    while (p < end) {
+        // Decode one character into at most four bytes of UTF-8.
+        char encoded[4];
+        size_t encodedLength = 1;
+
+        if (*p != '\\') {
+            encoded[0] = *p++;
+        } else {
+            ++p;
+            char escape = *p++;
+            switch (escape) {
+            case '"':
+            case '\\':
+            case '/':
+                encoded[0] = escape;
+                break;
+            case 'b':
+                encoded[0] = '\b';
+                break;
+            case 'f':
+                encoded[0] = '\f';
+                break;
+            case 'n':
+                encoded[0] = '\n';
+                break;
+            case 'r':
+                encoded[0] = '\r';
+                break;
+            case 't':
+                encoded[0] = '\t';
+                break;
+            case 'u': {
+                uint32_t codePoint;
+                if (!ReadHexQuad(p, end, &codePoint)) {
+                    return false;
+                }
+                p += 4;
+
+                // Characters outside the Basic Multilingual Plane are escaped as surrogate pairs.
+                if (codePoint >= 0xD800 && codePoint <= 0xDBFF) {
+                    uint32_t lowSurrogate;
+                    if (end - p < 6 || p[0] != '\\' || p[1] != 'u' ||
+                        !ReadHexQuad(p + 2, end, &lowSurrogate) || lowSurrogate < 0xDC00 ||
+                        lowSurrogate > 0xDFFF) {
+                        return false;
+                    }
+                    p += 6;
+                    codePoint = 0x10000 + ((codePoint - 0xD800) << 10) + (lowSurrogate - 0xDC00);
+                } else if (codePoint >= 0xDC00 && codePoint <= 0xDFFF) {
+                    return false;
+                }
+
+                if (codePoint < 0x80) {
+                    encoded[0] = (char)codePoint;
+                } else if (codePoint < 0x800) {
+                    encoded[0] = (char)(0xC0 | (codePoint >> 6));
+                    encoded[1] = (char)(0x80 | (codePoint & 0x3F));
+                    encodedLength = 2;
+                } else if (codePoint < 0x10000) {
+                    encoded[0] = (char)(0xE0 | (codePoint >> 12));
+                    encoded[1] = (char)(0x80 | ((codePoint >> 6) & 0x3F));
+                    encoded[2] = (char)(0x80 | (codePoint & 0x3F));
+                    encodedLength = 3;
+                } else {
+                    encoded[0] = (char)(0xF0 | (codePoint >> 18));
+                    encoded[1] = (char)(0x80 | ((codePoint >> 12) & 0x3F));
+                    encoded[2] = (char)(0x80 | ((codePoint >> 6) & 0x3F));
+                    encoded[3] = (char)(0x80 | (codePoint & 0x3F));
+                    encodedLength = 4;
+                }
+                break;
+            }
+            default:
+                return false;
+            }
+        }
+
+        // Always leave room for the null terminator.
+        if (encodedLength >= size - used) {
+            return false;
+        }
+        memcpy(&buffer[used], encoded, encodedLength);
+        used += encodedLength;
+    }
+
+    buffer[used] = '\0';
+    return true;
+}
@@ -0,0 +1,129 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// The JSON reader extracts the values of a fixed set of properties from a JSON document in a single
+// pass. It reads the document in place, so the document need not be null-terminated and is never
+// copied; it builds no tree of values, and never allocates memory. Each value found is returned as
+// a span of the document, which can then be converted with the JsonReader_Get functions.
+
+/// <summary>
+///     Maximum depth to which objects and arrays may be nested in a document which is read.
+/// </summary>
+#define JSON_READER_MAX_DEPTH 16
+
+/// <summary>
+///     Number of paths above which JsonReader_FindProperties builds a hash index of the paths,
+///     rather than comparing the path to each value in the document with every path.
+/// </summary>
+#define JSON_READER_INDEX_THRESHOLD 8
+
+/// <summary>
+///     Type of a value found in a JSON document.
+/// </summary>
+typedef enum {
+    /// <summary>The property was not found in the document.</summary>
+    JsonReader_Type_Missing,
+    JsonReader_Type_Null,
+    JsonReader_Type_Bool,
+    JsonReader_Type_Number,
+    JsonReader_Type_String,
+    JsonReader_Type_Object,
+    JsonReader_Type_Array
+} JsonReader_Type;
+
+/// <summary>
+///     A value found in a JSON document.
+/// </summary>
+typedef struct {
+    /// <summary>The type of the value.</summary>
+    JsonReader_Type type;
+    /// <summary>
+    ///     Start of the value's text within the document. For a string this is the first character
+    ///     after the opening quote.
+    /// </summary>
+    const char *start;
+    /// <summary>
+    ///     Length of the value's text. For a string this excludes the quotes, and escape sequences
+    ///     have not been decoded.
+    /// </summary>
+    size_t length;
+} JsonReader_Value;
+
+/// <summary>
+///     Find the values of the given properties in a JSON document.
+/// </summary>
+/// <param name="json">The document; this need not be null-terminated.</param>
+/// <param name="length">Length of the document in bytes.</param>
+/// <param name="paths">
+///     Paths of the properties to find. Each is a sequence of member names separated by '.',
+///     starting from the top-level object; for example "desired.NextFlavor.Name". Names are
+///     compared with the document without decoding escape sequences, and members of arrays cannot
+///     be found.
+/// </param>
+/// <param name="pathCount">The number of paths.</param>
+/// <param name="values">
+///     Array of pathCount values, which receives the value found for each path. The type of a
+///     value is JsonReader_Type_Missing if its property was not found.
+/// </param>
+/// <returns>true if the document was read; false if it is not valid JSON.</returns>
+/// <remarks>
+///     If more than JSON_READER_INDEX_THRESHOLD paths are given, they are indexed by the hash of
+///     each path and of each of its prefixes, in about 1KB of stack, so that each value is
+///     matched in constant time and the members of an object which is not on any path are
+///     skipped. The paths are compared one by one if they have more than 64 paths and prefixes in
+///     total.
+/// </remarks>
+bool JsonReader_FindProperties(const char *json, size_t length, const char *const *paths,
+                               size_t pathCount, JsonReader_Value *values);
+
+/// <summary>
+///     Get the value of a boolean.
+/// </summary>
+/// <param name="value">The value found in the document.</param>
+/// <param name="result">Receives the boolean.</param>
+/// <returns>true if the value is a boolean; false otherwise.</returns>
+bool JsonReader_GetBool(const JsonReader_Value *value, bool *result);
+
+/// <summary>
+///     Maximum length of a number which JsonReader_GetDouble converts.
+/// </summary>
+#define JSON_READER_MAX_NUMBER_LENGTH 63
+
+/// <summary>
+///     Get the value of an integer.
+/// </summary>
+/// <param name="value">The value found in the document.</param>
+/// <param name="result">Receives the integer.</param>
+/// <returns>
+///     true if the value is a number without a fraction or exponent which fits in an int64_t;
+///     false otherwise.
+/// </returns>
+bool JsonReader_GetInt64(const JsonReader_Value *value, int64_t *result);
+
+/// <summary>
+///     Get the value of a number as a double, correctly rounded. Numbers of up to 15 significant
+///     digits with a small exponent, such as those in device twins, are converted without
+///     strtod.
+/// </summary>
+/// <param name="value">The value found in the document.</param>
+/// <param name="result">Receives the number.</param>
+/// <returns>
+///     true if the value is a number of at most JSON_READER_MAX_NUMBER_LENGTH characters; false
+///     otherwise.
+/// </returns>
+bool JsonReader_GetDouble(const JsonReader_Value *value, double *result);
+
+/// <summary>
+///     Get the value of a string, decoding its escape sequences.
+/// </summary>
+/// <param name="value">The value found in the document.</param>
+/// <param name="buffer">Buffer to receive the null-terminated string.</param>
+/// <param name="size">Size of the buffer in bytes, including space for the null terminator.</param>
+/// <returns>true if the value is a string which fits in the buffer; false otherwise.</returns>
+bool JsonReader_GetString(const JsonReader_Value *value, char *buffer, size_t size);
@@ -0,0 +1,386 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "json_writer.h"
+
+_Static_assert(JSON_WRITER_MAX_DEPTH < 32, "JSON_WRITER_MAX_DEPTH must fit in the depth masks");
+
+static void Fail(JsonWriter *writer)
+{
+    writer->failed = true;
+    if (writer->size > 0) {
+        writer->buffer[0] = '\0';
+    }
+}
+
+// Record that the document does not fit. Later values are measured but not written.
+static void Overflow(JsonWriter *writer)
+{
+    writer->overflowed = true;
+    if (writer->size > 0) {
+        writer->buffer[0] = '\0';
+    }
+}
+
+static void AppendBytes(JsonWriter *writer, const char *data, size_t length)
+{
+    if (writer->failed) {
+        return;
+    }
+
+    // Always leave room for the null terminator.
+    if (!writer->overflowed && length >= writer->size - writer->length) {
+        Overflow(writer);
+    }
+
+    if (!writer->overflowed) {
+        memcpy(&writer->buffer[writer->length], data, length);
+        writer->buffer[writer->length + length] = '\0';
+    }
+    writer->length += length;
+}
+
+static void AppendChar(JsonWriter *writer, char c)
+{
+    AppendBytes(writer, &c, 1);
+}
+
+// Find the first quote, backslash or control character in a string, or the end of the string.
+static const char *FindEscapedByte(const char *p, const char *end)
+{
+#if defined(__ARM_NEON)
+    // Compare 16 bytes at a time. The comparison sets each byte of the mask which must be escaped;
+    // the mask is narrowed to four bits per byte, so that the first one can be found in a word.
+    const uint8x16_t quote = vdupq_n_u8('"');
+    const uint8x16_t backslash = vdupq_n_u8('\\');
+    const uint8x16_t space = vdupq_n_u8(0x20);
+    for (; end - p >= 16; p += 16) {
+        uint8x16_t bytes = vld1q_u8((const uint8_t *)p);
+        uint8x16_t escaped = vorrq_u8(vorrq_u8(vceqq_u8(bytes, quote), vceqq_u8(bytes, backslash)),
+                                      vcltq_u8(bytes, space));
+        uint64_t nibbles = vget_lane_u64(
+            vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(escaped), 4)), 0);
+        if (nibbles != 0) {
+            return p + (__builtin_ctzll(nibbles) >> 2);
+        }
+    }
+#endif
+
+    // Check any remaining characters one at a time.
+    for (; p < end; ++p) {
+        unsigned char c = (unsigned char)*p;
+        if (c == '"' || c == '\\' || c < 0x20) {
+            break;
+        }
+    }
+    return p;
+}
+
+static void AppendEscapedString(JsonWriter *writer, const char *value)
+{
+    static const char hexDigits[] = "0123456789abcdef";
+
+    AppendChar(writer, '"');
+
+    // The length is found first, so that the string can be scanned in blocks without reading
+    // past its end.
+    const char *end = value + strlen(value);
+    const char *run = value;
+    for (const char *p = FindEscapedByte(value, end); p < end; p = FindEscapedByte(run, end)) {
+        unsigned char c = (unsigned char)*p;
+
+        // Copy the characters which need no escaping in one go.
+        AppendBytes(writer, run, (size_t)(p - run));
+        run = p + 1;
+
+        switch (c) {
+        case '"':
+            AppendBytes(writer, "\\\"", 2);
+            break;
+        case '\\':
+            AppendBytes(writer, "\\\\", 2);
+            break;
+        case '\n':
+            AppendBytes(writer, "\\n", 2);
+            break;
+        case '\r':
+            AppendBytes(writer, "\\r", 2);
+            break;
+        case '\t':
+            AppendBytes(writer, "\\t", 2);
+            break;
+        default: {
+            char escape[6] = {'\\', 'u', '0', '0', hexDigits[c >> 4], hexDigits[c & 0xF]};
+            AppendBytes(writer, escape, sizeof(escape));
+            break;
+        }
+        }
+    }
+    AppendBytes(writer, run, (size_t)(end - run));
+
+    AppendChar(writer, '"');
+}
+
+// Write the separator and member name which precede a value, and record that the enclosing
+// container now holds a value.
+static void BeginValue(JsonWriter *writer, const char *name)
+{
+    if (writer->failed) {
+        return;
+    }
+
+    uint32_t depthBit = 1u << writer->depth;
+    bool inArray = (writer->isArrayMask & depthBit) != 0;
+
+    // Members of an object must be named; array elements and the top-level value must not be.
+    // Only one top-level value may be written.
+    bool inObject = writer->depth > 0 && !inArray;
+    if (inObject != (name != NULL) || (writer->depth == 0 && (writer->hasValueMask & depthBit))) {
+        Fail(writer);
+        return;
+    }
+
+    if (writer->hasValueMask & depthBit) {
+        AppendChar(writer, ',');
+    }
+    writer->hasValueMask |= depthBit;
+
+    if (name != NULL) {
+        AppendEscapedString(writer, name);
+        AppendChar(writer, ':');
+    }
+}
+
+static void BeginContainer(JsonWriter *writer, const char *name, bool isArray)
+{
+    BeginValue(writer, name);
+    if (writer->failed) {
+        return;
+    }
+
+    if (writer->depth == JSON_WRITER_MAX_DEPTH) {
+        Fail(writer);
+        return;
+    }
+
+    ++writer->depth;
+    uint32_t depthBit = 1u << writer->depth;
+    writer->hasValueMask &= ~depthBit;
+    if (isArray) {
+        writer->isArrayMask |= depthBit;
+    } else {
+        writer->isArrayMask &= ~depthBit;
+    }
+
+    AppendChar(writer, isArray ? '[' : '{');
+}
+
+static void EndContainer(JsonWriter *writer, bool isArray)
+{
+    if (writer->failed) {
+        return;
+    }
+
+    uint32_t depthBit = 1u << writer->depth;
+    if (writer->depth == 0 || ((writer->isArrayMask & depthBit) != 0) != isArray) {
+        Fail(writer);
+        return;
+    }
+
+    --writer->depth;
+    AppendChar(writer, isArray ? ']' : '}');
+}
+
+// Append formatted text, which snprintf writes directly into the remaining space in the buffer.
+// Once the buffer has overflowed, snprintf only measures the text.
+static void AppendFormatted(JsonWriter *writer, const char *format, ...)
+{
+    char *dest = writer->overflowed ? NULL : &writer->buffer[writer->length];
+    size_t space = writer->overflowed ? 0 : writer->size - writer->length;
+
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(dest, space, format, args);
+    va_end(args);
+
+    if (length < 0) {
+        Fail(writer);
+        return;
+    }
+
+    if (!writer->overflowed && (size_t)length >= space) {
+        Overflow(writer);
+    }
+    writer->length += (size_t)length;
+}
+
+// Format a value with a fixed number of digits after the decimal point, without printf, if its
+// scaled value is small enough that every multiple of a half is exact in a double. The result is
+// the same as printf's: the value is scaled by a power of ten which is exact, and fma recovers the
+// rounding error of that product, which decides the digits when the product is close to halfway.
+// Returns the number of characters written to text, or 0 if the value must be formatted by printf.
+static size_t FormatFixed(char text[32], double value, unsigned int precision)
+{
+    static const double powersOfTen[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9};
+    static const double maxScaled = 4503599627370496.0; // 2^52
+
+    if (precision >= sizeof(powersOfTen) / sizeof(powersOfTen[0])) {
+        return 0;
+    }
+
+    // printf writes a minus sign for negative values which round to zero, and for -0.0.
+    bool negative = signbit(value);
+    double magnitude = fabs(value);
+    double scaled = magnitude * powersOfTen[precision];
+    if (!(scaled < maxScaled)) {
+        return 0;
+    }
+
+    // The exact product is scaled + error. Below 2^52, the distance from the product to the
+    // halfway point is a multiple of the product's ulp, so it outweighs the error unless it is 0.
+    double error = fma(magnitude, powersOfTen[precision], -scaled);
+    double whole = floor(scaled);
+    double aboveHalf = (scaled - whole) - 0.5;
+    uint64_t digits = (uint64_t)whole;
+    if (aboveHalf > 0 || (aboveHalf == 0 && (error > 0 || (error == 0 && (digits & 1) != 0)))) {
+        ++digits;
+    }
+
+    // Write the digits backwards from the end of the text, then move them to the start.
+    char reversed[32];
+    size_t length = 0;
+    for (unsigned int i = 0; i < precision; ++i) {
+        reversed[length++] = (char)('0' + digits % 10);
+        digits /= 10;
+    }
+    if (precision > 0) {
+        reversed[length++] = '.';
+    }
+    do {
+        reversed[length++] = (char)('0' + digits % 10);
+        digits /= 10;
+    } while (digits != 0);
+    if (negative) {
+        reversed[length++] = '-';
+    }
+
+    for (size_t i = 0; i < length; ++i) {
+        text[i] = reversed[length - 1 - i];
+    }
+    return length;
+}
+
+void JsonWriter_Init(JsonWriter *writer, char *buffer, size_t size)
+{
+    writer->buffer = buffer;
+    writer->size = size;
+    writer->length = 0;
+    writer->hasValueMask = 0;
+    writer->isArrayMask = 0;
+    writer->depth = 0;
+    writer->failed = false;
+    writer->overflowed = false;
+
+    if (size == 0) {
+        writer->overflowed = true;
+    } else {
+        buffer[0] = '\0';
+    }
+}
+
+void JsonWriter_BeginObject(JsonWriter *writer, const char *name)
+{
+    BeginContainer(writer, name, false);
+}
+
+void JsonWriter_EndObject(JsonWriter *writer)
+{
+    EndContainer(writer, false);
+}
+
+void JsonWriter_BeginArray(JsonWriter *writer, const char *name)
+{
+    BeginContainer(writer, name, true);
+}
+
+void JsonWriter_EndArray(JsonWriter *writer)
+{
+    EndContainer(writer, true);
+}
+
+void JsonWriter_AddInt(JsonWriter *writer, const char *name, int64_t value)
+{
+    BeginValue(writer, name);
+    if (writer->failed) {
+        return;
+    }
+
+    AppendFormatted(writer, "%lld", (long long)value);
+}
+
+void JsonWriter_AddFloat(JsonWriter *writer, const char *name, double value,
+                         unsigned int precision)
+{
+    BeginValue(writer, name);
+    if (writer->failed) {
+        return;
+    }
+
+    if (!isfinite(value)) {
+        AppendBytes(writer, "null", 4);
+        return;
+    }
+
+    char text[32];
+    size_t length = FormatFixed(text, value, precision);
+    if (length > 0) {
+        AppendBytes(writer, text, length);
+        return;
+    }
+
+    AppendFormatted(writer, "%.*f", (int)precision, value);
+}
+
+void JsonWriter_AddBool(JsonWriter *writer, const char *name, bool value)
+{
+    BeginValue(writer, name);
+    if (value) {
+        AppendBytes(writer, "true", 4);
+    } else {
+        AppendBytes(writer, "false", 5);
+    }
+}
+
+void JsonWriter_AddString(JsonWriter *writer, const char *name, const char *value)
+{
+    BeginValue(writer, name);
+    AppendEscapedString(writer, value);
+}
+
+const char *JsonWriter_Finish(JsonWriter *writer)
+{
+    if (writer->failed || writer->overflowed || writer->depth != 0 ||
+        (writer->hasValueMask & 1u) == 0) {
+        return NULL;
+    }
+
+    return writer->buffer;
+}
+
+size_t JsonWriter_GetRequiredSize(const JsonWriter *writer)
+{
+    if (writer->failed) {
+        return 0;
+    }
+
+    return writer->length + 1;
+}
@@ -0,0 +1,136 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// The JSON writer serializes a JSON document directly into a caller-supplied buffer as values are
+// appended, without building a tree of values first, so the document is only serialized once. It
+// never allocates memory. If the calls are unbalanced, the writer records the failure and ignores
+// further calls. If the document does not fit into the buffer, the writer stops writing but goes
+// on measuring, so that JsonWriter_GetRequiredSize can report the size of buffer it needs. In both
+// cases JsonWriter_Finish returns NULL.
+
+/// <summary>
+///     Maximum depth to which objects and arrays may be nested.
+/// </summary>
+#define JSON_WRITER_MAX_DEPTH 16
+
+/// <summary>
+///     State of a JSON writer. The fields are private to json_writer.c.
+/// </summary>
+typedef struct {
+    char *buffer;
+    size_t size;
+    // Length of the document so far, which may exceed the buffer size once it has overflowed.
+    size_t length;
+    // Bit n is set if the container at depth n already holds a value, so the next needs a comma.
+    uint32_t hasValueMask;
+    // Bit n is set if the container at depth n is an array rather than an object.
+    uint32_t isArrayMask;
+    uint8_t depth;
+    bool failed;
+    bool overflowed;
+} JsonWriter;
+
+/// <summary>
+///     Start writing a JSON document into the given buffer.
+/// </summary>
+/// <param name="writer">The writer to initialize.</param>
+/// <param name="buffer">Buffer to receive the null-terminated document.</param>
+/// <param name="size">Size of the buffer in bytes, including space for the null terminator.</param>
+void JsonWriter_Init(JsonWriter *writer, char *buffer, size_t size);
+
+/// <summary>
+///     Begin an object. Every call must be matched by a call to JsonWriter_EndObject.
+/// </summary>
+/// <param name="writer">The writer.</param>
+/// <param name="name">
+///     Name of the member within the enclosing object, or NULL for the top-level value or an
+///     element of an array.
+/// </param>
+void JsonWriter_BeginObject(JsonWriter *writer, const char *name);
+
+/// <summary>
+///     End the object begun by the most recent unmatched call to JsonWriter_BeginObject.
+/// </summary>
+/// <param name="writer">The writer.</param>
+void JsonWriter_EndObject(JsonWriter *writer);
+
+/// <summary>
+///     Begin an array. Every call must be matched by a call to JsonWriter_EndArray.
+/// </summary>
+/// <param name="writer">The writer.</param>
+/// <param name="name">
+///     Name of the member within the enclosing object, or NULL for the top-level value or an
+///     element of an array.
+/// </param>
+void JsonWriter_BeginArray(JsonWriter *writer, const char *name);
+
+/// <summary>
+///     End the array begun by the most recent unmatched call to JsonWriter_BeginArray.
+/// </summary>
+/// <param name="writer">The writer.</param>
+void JsonWriter_EndArray(JsonWriter *writer);
+
+/// <summary>
+///     Append an integer value.
+/// </summary>
+/// <param name="writer">The writer.</param>
+/// <param name="name">Name of the member, or NULL if the enclosing container is an array.</param>
+/// <param name="value">The value.</param>
+void JsonWriter_AddInt(JsonWriter *writer, const char *name, int64_t value);
+
+/// <summary>
+///     Append a floating-point value with a fixed number of digits after the decimal point.
+///     Values which are not finite are written as null, since JSON cannot represent them. Values
+///     of the size found in telemetry, with a precision of up to 9, are formatted without
+///     printf.
+/// </summary>
+/// <param name="writer">The writer.</param>
+/// <param name="name">Name of the member, or NULL if the enclosing container is an array.</param>
+/// <param name="value">The value.</param>
+/// <param name="precision">Number of digits to write after the decimal point.</param>
+void JsonWriter_AddFloat(JsonWriter *writer, const char *name, double value,
+                         unsigned int precision);
+
+/// <summary>
+///     Append a boolean value.
+/// </summary>
+/// <param name="writer">The writer.</param>
+/// <param name="name">Name of the member, or NULL if the enclosing container is an array.</param>
+/// <param name="value">The value.</param>
+void JsonWriter_AddBool(JsonWriter *writer, const char *name, bool value);
+
+/// <summary>
+///     Append a string value, escaping it as required by JSON.
+/// </summary>
+/// <param name="writer">The writer.</param>
+/// <param name="name">Name of the member, or NULL if the enclosing container is an array.</param>
+/// <param name="value">The null-terminated value.</param>
+void JsonWriter_AddString(JsonWriter *writer, const char *name, const char *value);
+
+/// <summary>
+///     Finish writing the document.
+/// </summary>
+/// <param name="writer">The writer.</param>
+/// <returns>
+///     The null-terminated document, which is held in the buffer passed to JsonWriter_Init; or
+///     NULL if it did not fit into the buffer or an object or array was left open.
+/// </returns>
+const char *JsonWriter_Finish(JsonWriter *writer);
+
+/// <summary>
+///     Get the size of buffer which the document needs. This is only known without a second
+///     serialization pass when JsonWriter_Finish returns NULL because the buffer was too small;
+///     the caller can then provide a buffer of this size and write the document again.
+/// </summary>
+/// <param name="writer">The writer.</param>
+/// <returns>
+///     The size in bytes, including the null terminator, of the document written so far; or 0 if
+///     the calls were invalid, in which case no buffer is large enough.
+/// </returns>
+size_t JsonWriter_GetRequiredSize(const JsonWriter *writer);
@@ -0,0 +1,739 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include <applibs/log.h>
+#include <applibs/storage.h>
+
+#include "key_value_store.h"
+#include "worker_pool.h"
+
+static const uint32_t segmentMagic = ('K' << 24) | ('V' << 16) | ('S' << 8) | 'G';
+
+// Each segment starts with a header, which is written after the segment's records, so that a
+// segment is only used once it is complete. The segment with the higher generation is active.
+typedef struct {
+    uint32_t magic;
+    uint32_t generation;
+    uint32_t crc;
+} SegmentHeader;
+
+// Each record is followed by its key, without a null terminator, and its value, padded to a
+// multiple of four bytes. The CRC also covers the generation of the segment, so that records which
+// were left in a segment by an earlier generation are not mistaken for current ones.
+typedef struct {
+    uint32_t crc;
+    uint8_t keyLength;
+    uint8_t flags;
+    uint16_t valueSize;
+} RecordHeader;
+
+// The record deletes its key.
+#define RECORD_FLAG_DELETED 0x01
+// The record is the last of a commit.
+#define RECORD_FLAG_COMMIT 0x02
+
+#define RECORD_SIZE(keyLength, valueSize) \
+    ((sizeof(RecordHeader) + (keyLength) + (valueSize) + 3) & ~(size_t)3)
+#define MAX_RECORD_SIZE RECORD_SIZE(KEY_VALUE_STORE_MAX_KEY_LENGTH, KEY_VALUE_STORE_MAX_VALUE_SIZE)
+
+typedef struct {
+    bool inUse;
+    /// <summary>The entry has changed since the last commit.</summary>
+    bool dirty;
+    /// <summary>The key has been deleted; the entry is freed once the deletion is
+    /// committed.</summary>
+    bool deleted;
+    /// <summary>The change is in the commit which is being written.</summary>
+    bool committing;
+    uint8_t keyLength;
+    uint16_t valueSize;
+    char key[KEY_VALUE_STORE_MAX_KEY_LENGTH + 1];
+    uint8_t value[KEY_VALUE_STORE_MAX_VALUE_SIZE];
+} Entry;
+
+static bool isOpen = false;
+static Entry entries[KEY_VALUE_STORE_MAX_KEYS];
+static off_t regionOffset = 0;
+static size_t segmentSize = 0;
+// The active segment, or -1 if neither segment holds a valid store.
+static int activeSegment = -1;
+static uint32_t generation = 0;
+// Offset in the active segment after the last record of the last complete commit.
+static size_t logEnd = 0;
+static KeyValueStore_Statistics statistics;
+
+// A commit is encoded here and written with one write, so that it needs no more than one flash
+// write, however many values it changes.
+static uint8_t commitBuffer[KEY_VALUE_STORE_MAX_KEYS * MAX_RECORD_SIZE];
+
+// A commit which has been encoded into commitBuffer. It is written by WriteCommit, on a worker
+// thread if the worker pool is running, so it holds everything which the write needs; only the
+// event loop's thread touches the entries and the segment state.
+typedef struct {
+    WorkerPool_Job job;
+    /// <summary>The commit has been encoded and has not been finished by FinishCommit.</summary>
+    bool inFlight;
+    /// <summary>The write has finished; set under writeLock.</summary>
+    bool written;
+    bool compaction;
+    size_t size;
+    off_t recordsPosition;
+    // For a compaction, the header which makes the segment at headerPosition active.
+    int nextSegment;
+    SegmentHeader header;
+    off_t headerPosition;
+    // 0 on success, or the errno value; set under writeLock.
+    int error;
+    uint64_t bytesWritten;
+} PendingCommit;
+
+static void WriteCommit(void *context);
+static void CommitWritten(void *context);
+
+static PendingCommit pendingCommit = {
+    .job = {.work = WriteCommit, .complete = CommitWritten, .context = &pendingCommit}};
+static pthread_mutex_t writeLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writeFinished = PTHREAD_COND_INITIALIZER;
+// The job has been submitted and its completion function has not yet run, so it must not be
+// submitted again.
+static bool jobSubmitted = false;
+// A commit was requested while one was being written; it starts when that one has finished, and
+// holds every change which was made in the meantime.
+static bool commitAfterWrite = false;
+static KeyValueStore_CommitCallback commitCallback = NULL;
+static void *commitCallbackContext = NULL;
+
+static EventLoop *storeEventLoop = NULL;
+static unsigned int commitDelay = 0;
+static int timerFd = -1;
+static EventRegistration *timerRegistration = NULL;
+static bool commitScheduled = false;
+
+static uint32_t Crc32(uint32_t crc, const void *data, size_t length)
+{
+    const uint8_t *bytes = data;
+    while (length-- > 0) {
+        crc ^= *bytes++;
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc >> 1) ^ (0xEDB88320u & -(crc & 1u));
+        }
+    }
+    return crc;
+}
+
+static uint32_t SegmentCrc(const SegmentHeader *header)
+{
+    return ~Crc32(0xFFFFFFFFu, header, offsetof(SegmentHeader, crc));
+}
+
+static uint32_t RecordCrc(const uint8_t *record, size_t size, uint32_t recordGeneration)
+{
+    uint32_t crc = Crc32(0xFFFFFFFFu, &recordGeneration, sizeof(recordGeneration));
+    crc = Crc32(crc, record + sizeof(uint32_t), size - sizeof(uint32_t));
+    return ~crc;
+}
+
+static off_t SegmentOffset(int segment)
+{
+    return regionOffset + (off_t)((size_t)segment * segmentSize);
+}
+
+static Entry *FindEntry(const char *key, size_t keyLength)
+{
+    for (size_t i = 0; i < KEY_VALUE_STORE_MAX_KEYS; ++i) {
+        if (entries[i].inUse && entries[i].keyLength == keyLength &&
+            memcmp(entries[i].key, key, keyLength) == 0) {
+            return &entries[i];
+        }
+    }
+    return NULL;
+}
+
+static Entry *AllocateEntry(const char *key, size_t keyLength)
+{
+    for (size_t i = 0; i < KEY_VALUE_STORE_MAX_KEYS; ++i) {
+        if (!entries[i].inUse) {
+            Entry *entry = &entries[i];
+            memset(entry, 0, sizeof(*entry));
+            entry->inUse = true;
+            entry->keyLength = (uint8_t)keyLength;
+            memcpy(entry->key, key, keyLength);
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+// Applies a record which was read from storage to the entries.
+static void ApplyRecord(const RecordHeader *header, const uint8_t *body)
+{
+    const char *key = (const char *)body;
+    Entry *entry = FindEntry(key, header->keyLength);
+
+    if ((header->flags & RECORD_FLAG_DELETED) != 0) {
+        if (entry != NULL) {
+            entry->inUse = false;
+        }
+        return;
+    }
+
+    if (entry == NULL) {
+        entry = AllocateEntry(key, header->keyLength);
+        if (entry == NULL) {
+            Log_Debug("WARNING: The key-value store holds more than %d keys.\n",
+                      KEY_VALUE_STORE_MAX_KEYS);
+            return;
+        }
+    }
+    entry->valueSize = header->valueSize;
+    memcpy(entry->value, body + header->keyLength, header->valueSize);
+}
+
+// Reads the records of the active segment, up to limit, and returns the offset after the last
+// record of the last complete commit. If apply is true, the records are applied to the entries.
+static size_t ReadRecords(int fd, size_t limit, bool apply)
+{
+    uint8_t record[MAX_RECORD_SIZE];
+    size_t offset = sizeof(SegmentHeader);
+    size_t committedEnd = offset;
+
+    while (offset + sizeof(RecordHeader) <= limit) {
+        off_t position = SegmentOffset(activeSegment) + (off_t)offset;
+        RecordHeader header;
+        if (pread(fd, record, sizeof(header), position) != (ssize_t)sizeof(header)) {
+            break;
+        }
+        memcpy(&header, record, sizeof(header));
+        if (header.keyLength == 0 || header.keyLength > KEY_VALUE_STORE_MAX_KEY_LENGTH ||
+            header.valueSize > KEY_VALUE_STORE_MAX_VALUE_SIZE) {
+            break;
+        }
+
+        size_t size = RECORD_SIZE(header.keyLength, header.valueSize);
+        size_t bodySize = size - sizeof(header);
+        if (offset + size > limit ||
+            pread(fd, record + sizeof(header), bodySize, position + (off_t)sizeof(header)) !=
+                (ssize_t)bodySize ||
+            header.crc != RecordCrc(record, size, generation)) {
+            break;
+        }
+
+        offset += size;
+        if (apply) {
+            ApplyRecord(&header, record + sizeof(header));
+        }
+        if ((header.flags & RECORD_FLAG_COMMIT) != 0) {
+            committedEnd = offset;
+        }
+    }
+
+    return committedEnd;
+}
+
+// Encodes the record of an entry, without its CRC, and returns its size.
+static size_t EncodeRecord(uint8_t *record, const Entry *entry)
+{
+    size_t valueSize = entry->deleted ? 0 : entry->valueSize;
+    size_t size = RECORD_SIZE(entry->keyLength, valueSize);
+    memset(record, 0, size);
+
+    RecordHeader header = {.crc = 0,
+                           .keyLength = entry->keyLength,
+                           .flags = entry->deleted ? RECORD_FLAG_DELETED : 0,
+                           .valueSize = (uint16_t)valueSize};
+    memcpy(record, &header, sizeof(header));
+    memcpy(record + sizeof(header), entry->key, entry->keyLength);
+    memcpy(record + sizeof(header) + entry->keyLength, entry->value, valueSize);
+    return size;
+}
+
+// Marks the record at the given offset of the commit buffer as the last of its commit, and
+// computes the CRCs of all the records in the buffer.
+static void SealCommit(size_t size, size_t lastRecordOffset, uint32_t recordGeneration)
+{
+    commitBuffer[lastRecordOffset + offsetof(RecordHeader, flags)] |= RECORD_FLAG_COMMIT;
+
+    size_t offset = 0;
+    while (offset < size) {
+        RecordHeader header;
+        memcpy(&header, commitBuffer + offset, sizeof(header));
+        size_t recordSize = RECORD_SIZE(header.keyLength, header.valueSize);
+        header.crc = RecordCrc(commitBuffer + offset, recordSize, recordGeneration);
+        memcpy(commitBuffer + offset, &header, sizeof(header));
+        offset += recordSize;
+    }
+}
+
+static int WriteAll(int fd, const void *data, size_t size, off_t position,
+                    uint64_t *bytesWritten)
+{
+    ssize_t written = pwrite(fd, data, size, position);
+    if (written == -1) {
+        // If the file has reached the maximum size specified in the application manifest,
+        // then errno is EDQUOT.
+        return -1;
+    }
+    *bytesWritten += (uint64_t)written;
+    if ((size_t)written < size) {
+        errno = EIO;
+        return -1;
+    }
+    return 0;
+}
+
+// Encodes the changed values into commitBuffer, and marks their entries as committing. If they do
+// not fit in the active segment, the commit is a compaction, which writes the current values,
+// without the deleted keys, to the inactive segment, and then makes it the active segment.
+// Returns false if nothing has changed.
+static bool EncodeCommit(void)
+{
+    PendingCommit *commit = &pendingCommit;
+    size_t size = 0;
+    size_t lastRecordOffset = 0;
+    for (size_t i = 0; i < KEY_VALUE_STORE_MAX_KEYS; ++i) {
+        if (entries[i].inUse && entries[i].dirty) {
+            lastRecordOffset = size;
+            size += EncodeRecord(commitBuffer + size, &entries[i]);
+        }
+    }
+    if (size == 0) {
+        return false;
+    }
+
+    commit->compaction = activeSegment == -1 || logEnd + size > segmentSize;
+    if (commit->compaction) {
+        commit->nextSegment = (activeSegment == 0) ? 1 : 0;
+        uint32_t nextGeneration = generation + 1;
+
+        size = 0;
+        for (size_t i = 0; i < KEY_VALUE_STORE_MAX_KEYS; ++i) {
+            if (entries[i].inUse && !entries[i].deleted) {
+                lastRecordOffset = size;
+                size += EncodeRecord(commitBuffer + size, &entries[i]);
+            }
+        }
+        if (size > 0) {
+            SealCommit(size, lastRecordOffset, nextGeneration);
+        }
+
+        commit->header =
+            (SegmentHeader){.magic = segmentMagic, .generation = nextGeneration, .crc = 0};
+        commit->header.crc = SegmentCrc(&commit->header);
+        commit->headerPosition = SegmentOffset(commit->nextSegment);
+        commit->recordsPosition = commit->headerPosition + (off_t)sizeof(SegmentHeader);
+    } else {
+        SealCommit(size, lastRecordOffset, generation);
+        commit->recordsPosition = SegmentOffset(activeSegment) + (off_t)logEnd;
+    }
+    commit->size = size;
+
+    for (size_t i = 0; i < KEY_VALUE_STORE_MAX_KEYS; ++i) {
+        if (entries[i].inUse && entries[i].dirty) {
+            entries[i].committing = true;
+            entries[i].dirty = false;
+        }
+    }
+
+    commit->inFlight = true;
+    commit->written = false;
+    commit->error = 0;
+    commit->bytesWritten = 0;
+    return true;
+}
+
+// Writes the encoded commit. Runs on a worker thread, unless the commit could not be submitted to
+// the worker pool, so it only touches the commit and commitBuffer.
+static void WriteCommit(void *context)
+{
+    PendingCommit *commit = context;
+    uint64_t bytesWritten = 0;
+    int error = 0;
+
+    int fd = Storage_OpenMutableFile();
+    if (fd == -1) {
+        error = errno;
+    } else {
+        // A compaction writes the segment's header last, so that the old segment remains valid
+        // until the new one is complete.
+        if ((commit->size > 0 && WriteAll(fd, commitBuffer, commit->size, commit->recordsPosition,
+                                          &bytesWritten) != 0) ||
+            (commit->compaction && WriteAll(fd, &commit->header, sizeof(commit->header),
+                                            commit->headerPosition, &bytesWritten) != 0)) {
+            error = errno;
+        }
+        close(fd);
+    }
+
+    pthread_mutex_lock(&writeLock);
+    commit->error = error;
+    commit->bytesWritten = bytesWritten;
+    commit->written = true;
+    pthread_cond_signal(&writeFinished);
+    pthread_mutex_unlock(&writeLock);
+}
+
+// Applies the result of the written commit to the segment state and the entries. If the write
+// failed, the changes are marked to be committed again.
+static void FinishCommit(void)
+{
+    PendingCommit *commit = &pendingCommit;
+    commit->inFlight = false;
+    statistics.bytesWritten += commit->bytesWritten;
+
+    if (commit->error != 0) {
+        Log_Debug("ERROR: Could not commit the key-value store: %s (%d).\n",
+                  strerror(commit->error), commit->error);
+        for (size_t i = 0; i < KEY_VALUE_STORE_MAX_KEYS; ++i) {
+            if (entries[i].committing) {
+                entries[i].committing = false;
+                entries[i].dirty = true;
+            }
+        }
+    } else {
+        if (commit->compaction) {
+            activeSegment = commit->nextSegment;
+            generation = commit->header.generation;
+            logEnd = sizeof(SegmentHeader) + commit->size;
+            ++statistics.compactions;
+            Log_Debug(
+                "INFO: Compacted the key-value store into segment %d (generation %u, %zu bytes).\n",
+                activeSegment, generation, logEnd);
+        } else {
+            logEnd += commit->size;
+        }
+
+        // A key which was set again while its deletion was being written is not freed.
+        for (size_t i = 0; i < KEY_VALUE_STORE_MAX_KEYS; ++i) {
+            if (entries[i].committing && entries[i].deleted && !entries[i].dirty) {
+                entries[i].inUse = false;
+            }
+            entries[i].committing = false;
+        }
+        ++statistics.commits;
+    }
+
+    if (commitCallback != NULL) {
+        commitCallback(commit->error, commitCallbackContext);
+    }
+}
+
+// Waits for the commit which is being written on a worker thread, if there is one, and finishes
+// it.
+static void WaitForCommit(void)
+{
+    if (!pendingCommit.inFlight) {
+        return;
+    }
+
+    pthread_mutex_lock(&writeLock);
+    while (!pendingCommit.written) {
+        pthread_cond_wait(&writeFinished, &writeLock);
+    }
+    pthread_mutex_unlock(&writeLock);
+    FinishCommit();
+}
+
+// Commits the changes in the background: the write runs on a worker thread if the worker pool is
+// running, or on this thread if it is not. If a commit is already being written, this one starts
+// when it has finished.
+static void StartCommit(void)
+{
+    if (pendingCommit.inFlight || jobSubmitted) {
+        commitAfterWrite = true;
+        return;
+    }
+    if (!EncodeCommit()) {
+        return;
+    }
+
+    if (WorkerPool_Submit(&pendingCommit.job) == 0) {
+        jobSubmitted = true;
+        return;
+    }
+    WriteCommit(&pendingCommit);
+    FinishCommit();
+}
+
+// Completion function of the commit job, which runs on the event loop's thread. The commit may
+// already have been finished by WaitForCommit.
+static void CommitWritten(void *context)
+{
+    jobSubmitted = false;
+    if (pendingCommit.inFlight) {
+        FinishCommit();
+    }
+    // A failed commit is retried with the next change.
+    if (commitAfterWrite && isOpen) {
+        commitAfterWrite = false;
+        StartCommit();
+    }
+}
+
+int KeyValueStore_Commit(void)
+{
+    if (!isOpen) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (commitScheduled) {
+        static const struct itimerspec disarm = {{0, 0}, {0, 0}};
+        timerfd_settime(timerFd, 0, &disarm, NULL);
+        commitScheduled = false;
+    }
+
+    // The commit which is being written is finished first, so that the commits are written in
+    // order, and this one includes every change which is not yet in storage.
+    WaitForCommit();
+    commitAfterWrite = false;
+    if (!EncodeCommit()) {
+        return 0;
+    }
+
+    WriteCommit(&pendingCommit);
+    FinishCommit();
+    if (pendingCommit.error != 0) {
+        errno = pendingCommit.error;
+        return -1;
+    }
+    return 0;
+}
+
+static void CommitTimerCallback(EventLoop *el, int fd, EventLoop_IoEvents events, void *context)
+{
+    uint64_t expirations;
+    if (read(timerFd, &expirations, sizeof(expirations)) == -1) {
+        Log_Debug("ERROR: Could not read timerfd %s (%d).\n", strerror(errno), errno);
+        return;
+    }
+
+    commitScheduled = false;
+    // A failed commit is retried with the next change.
+    StartCommit();
+}
+
+// Commits the changes after the commit delay, unless a commit is already scheduled, so that the
+// changes which are made during the delay are written together.
+static void ScheduleCommit(void)
+{
+    if (commitDelay == 0) {
+        StartCommit();
+        return;
+    }
+    if (storeEventLoop == NULL || commitScheduled) {
+        return;
+    }
+
+    struct itimerspec delay = {.it_interval = {0, 0},
+                               .it_value = {.tv_sec = commitDelay / 1000,
+                                            .tv_nsec = (long)(commitDelay % 1000) * 1000000}};
+    if (timerfd_settime(timerFd, 0, &delay, NULL) == -1) {
+        Log_Debug("ERROR: Could not schedule the commit: %s (%d).\n", strerror(errno), errno);
+        return;
+    }
+    commitScheduled = true;
+}
+
+static bool GetKeyLength(const char *key, size_t *keyLength)
+{
+    if (key == NULL) {
+        return false;
+    }
+    *keyLength = strnlen(key, KEY_VALUE_STORE_MAX_KEY_LENGTH + 1);
+    return *keyLength > 0 && *keyLength <= KEY_VALUE_STORE_MAX_KEY_LENGTH;
+}
+
+int KeyValueStore_Get(const char *key, void *value, size_t size)
+{
+    size_t keyLength;
+    if (!isOpen || !GetKeyLength(key, &keyLength)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    const Entry *entry = FindEntry(key, keyLength);
+    if (entry == NULL || entry->deleted) {
+        errno = ENOENT;
+        return -1;
+    }
+    if (entry->valueSize > size) {
+        errno = ERANGE;
+        return -1;
+    }
+
+    memcpy(value, entry->value, entry->valueSize);
+    return entry->valueSize;
+}
+
+int KeyValueStore_Set(const char *key, const void *value, size_t size)
+{
+    size_t keyLength;
+    if (!isOpen || !GetKeyLength(key, &keyLength) || size > KEY_VALUE_STORE_MAX_VALUE_SIZE ||
+        (value == NULL && size > 0)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    Entry *entry = FindEntry(key, keyLength);
+    if (entry != NULL && !entry->deleted && entry->valueSize == size &&
+        memcmp(entry->value, value, size) == 0) {
+        return 0;
+    }
+
+    // The current values must fit in a segment, so that they can always be compacted.
+    size_t compactedSize = sizeof(SegmentHeader) + RECORD_SIZE(keyLength, size);
+    for (size_t i = 0; i < KEY_VALUE_STORE_MAX_KEYS; ++i) {
+        if (entries[i].inUse && !entries[i].deleted && &entries[i] != entry) {
+            compactedSize += RECORD_SIZE(entries[i].keyLength, entries[i].valueSize);
+        }
+    }
+    if (compactedSize > segmentSize) {
+        errno = ENOSPC;
+        return -1;
+    }
+
+    if (entry == NULL) {
+        entry = AllocateEntry(key, keyLength);
+        if (entry == NULL) {
+            errno = ENOSPC;
+            return -1;
+        }
+    }
+    entry->deleted = false;
+    entry->dirty = true;
+    entry->valueSize = (uint16_t)size;
+    memcpy(entry->value, value, size);
+
+    ScheduleCommit();
+    return 0;
+}
+
+int KeyValueStore_Delete(const char *key)
+{
+    size_t keyLength;
+    if (!isOpen || !GetKeyLength(key, &keyLength)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    Entry *entry = FindEntry(key, keyLength);
+    if (entry == NULL || entry->deleted) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    entry->deleted = true;
+    entry->dirty = true;
+    ScheduleCommit();
+    return 0;
+}
+
+void KeyValueStore_SetCommitCallback(KeyValueStore_CommitCallback callback, void *context)
+{
+    commitCallback = callback;
+    commitCallbackContext = context;
+}
+
+void KeyValueStore_GetStatistics(KeyValueStore_Statistics *statisticsOut)
+{
+    *statisticsOut = statistics;
+}
+
+static void CloseTimer(void)
+{
+    if (timerRegistration != NULL) {
+        EventLoop_UnregisterIo(storeEventLoop, timerRegistration);
+        timerRegistration = NULL;
+    }
+    if (timerFd != -1) {
+        close(timerFd);
+        timerFd = -1;
+    }
+    commitScheduled = false;
+}
+
+int KeyValueStore_Open(EventLoop *eventLoop, off_t storageOffset, size_t storageSize,
+                       unsigned int commitDelayMs)
+{
+    if (isOpen || storageSize / 2 < sizeof(SegmentHeader) + MAX_RECORD_SIZE) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    memset(entries, 0, sizeof(entries));
+    memset(&statistics, 0, sizeof(statistics));
+    regionOffset = storageOffset;
+    segmentSize = storageSize / 2;
+    activeSegment = -1;
+    generation = 0;
+    logEnd = 0;
+
+    int fd = Storage_OpenMutableFile();
+    if (fd == -1) {
+        Log_Debug("ERROR: Could not open mutable storage: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+
+    for (int segment = 0; segment < 2; ++segment) {
+        SegmentHeader header;
+        ssize_t bytesRead = pread(fd, &header, sizeof(header), SegmentOffset(segment));
+        if (bytesRead == (ssize_t)sizeof(header) && header.magic == segmentMagic &&
+            header.crc == SegmentCrc(&header) &&
+            (activeSegment == -1 || header.generation > generation)) {
+            activeSegment = segment;
+            generation = header.generation;
+        }
+    }
+
+    if (activeSegment != -1) {
+        // The first pass finds the end of the last complete commit, so that the records of an
+        // incomplete commit are not applied.
+        logEnd = ReadRecords(fd, segmentSize, false);
+        ReadRecords(fd, logEnd, true);
+    }
+    close(fd);
+
+    storeEventLoop = eventLoop;
+    commitDelay = commitDelayMs;
+    if (storeEventLoop != NULL) {
+        timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+        if (timerFd == -1) {
+            Log_Debug("ERROR: Unable to create timer: %s (%d).\n", strerror(errno), errno);
+            return -1;
+        }
+        timerRegistration = EventLoop_RegisterIo(storeEventLoop, timerFd, EventLoop_Input,
+                                                 CommitTimerCallback, NULL);
+        if (timerRegistration == NULL) {
+            Log_Debug("ERROR: Unable to register timer event: %s (%d).\n", strerror(errno),
+                      errno);
+            int error = errno;
+            CloseTimer();
+            errno = error;
+            return -1;
+        }
+    }
+
+    isOpen = true;
+    return 0;
+}
+
+void KeyValueStore_Close(void)
+{
+    if (!isOpen) {
+        return;
+    }
+
+    KeyValueStore_Commit();
+    CloseTimer();
+    storeEventLoop = NULL;
+    commitCallback = NULL;
+    commitCallbackContext = NULL;
+    isOpen = false;
+}
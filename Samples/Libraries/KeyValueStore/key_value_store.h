@@ -0,0 +1,134 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <applibs/eventloop.h>
+
+// The key-value store keeps small named values in a region of the application's mutable storage
+// file, so that several modules can persist their state without each of them owning the file.
+//
+// The region is split into two segments, which are logs of records. Each record holds one value,
+// or the deletion of one, and is protected by a CRC. Changes are made in memory, and committed
+// together after a delay, so that a burst of changes is written with a single write; each commit
+// appends the changed values to the active segment and marks its last record, and on opening the
+// store, only the records up to the last complete commit are applied, so a commit which was
+// interrupted, for example by a power loss, is ignored as a whole. When the active segment is
+// full, the current values are written to the other segment, whose header is written last, so
+// that the old segment remains valid until the new one is complete.
+//
+// If the worker pool is running, commits are written on a worker thread, so that a slow flash
+// write does not delay the event loop. Changes which are made while a commit is being written are
+// held for the next commit, which starts when that one has finished, so commits are written in
+// order. KeyValueStore_Commit waits for the commit which is being written.
+//
+// The store is not thread-safe; it should only be used from the event loop's thread.
+
+/// <summary>Maximum number of keys in the store.</summary>
+#define KEY_VALUE_STORE_MAX_KEYS 16
+
+/// <summary>Maximum length of a key, excluding the null terminator.</summary>
+#define KEY_VALUE_STORE_MAX_KEY_LENGTH 31
+
+/// <summary>Maximum size of a value, in bytes.</summary>
+#define KEY_VALUE_STORE_MAX_VALUE_SIZE 128
+
+/// <summary>
+///     Counts of the writes which the store has made since it was opened.
+/// </summary>
+typedef struct {
+    /// <summary>Commits which have been written, including compactions.</summary>
+    size_t commits;
+    /// <summary>Commits which have rewritten the current values to the other segment.</summary>
+    size_t compactions;
+    /// <summary>Bytes written to mutable storage.</summary>
+    uint64_t bytesWritten;
+} KeyValueStore_Statistics;
+
+/// <summary>
+///     Function which is called on the event loop's thread when a commit has been written, or
+///     has failed.
+/// </summary>
+/// <param name="error">0 if the commit was written, or the errno value if it failed, in which
+/// case its changes remain to be committed.</param>
+/// <param name="context">Context which was supplied to KeyValueStore_SetCommitCallback.</param>
+typedef void (*KeyValueStore_CommitCallback)(int error, void *context);
+
+/// <summary>
+///     Opens the store and reads its values into memory. If the region does not hold a valid
+///     store, the store is empty.
+/// </summary>
+/// <param name="eventLoop">Event loop which runs the delayed commits, or NULL to commit only when
+/// KeyValueStore_Commit or KeyValueStore_Close is called, unless commitDelayMs is 0.</param>
+/// <param name="storageOffset">Offset of the region in the mutable storage file.</param>
+/// <param name="storageSize">Size of the region, in bytes, which is split into two
+/// segments.</param>
+/// <param name="commitDelayMs">Time from the first change after a commit until the changes
+/// are committed, in milliseconds; 0 starts a commit on each change. If the worker pool is
+/// running, these commits are written in the background.</param>
+/// <returns>0 on success, or -1 on failure, in which case errno is set.</returns>
+int KeyValueStore_Open(EventLoop *eventLoop, off_t storageOffset, size_t storageSize,
+                       unsigned int commitDelayMs);
+
+/// <summary>
+///     Gets a value.
+/// </summary>
+/// <param name="key">The key.</param>
+/// <param name="value">Buffer which receives the value.</param>
+/// <param name="size">Size of the buffer, in bytes.</param>
+/// <returns>The size of the value on success, or -1 on failure, in which case errno is set:
+/// ENOENT if the key is not in the store, or ERANGE if the buffer is too small.</returns>
+int KeyValueStore_Get(const char *key, void *value, size_t size);
+
+/// <summary>
+///     Sets a value, which is committed with the next commit. Setting a key to the value which it
+///     already has does not cause a write.
+/// </summary>
+/// <param name="key">The key, of up to KEY_VALUE_STORE_MAX_KEY_LENGTH characters.</param>
+/// <param name="value">The value, which is copied.</param>
+/// <param name="size">Size of the value, up to KEY_VALUE_STORE_MAX_VALUE_SIZE bytes.</param>
+/// <returns>0 on success, or -1 on failure, in which case errno is set: EINVAL if the key or value
+/// is too large, or ENOSPC if the store has no room for the value.</returns>
+int KeyValueStore_Set(const char *key, const void *value, size_t size);
+
+/// <summary>
+///     Deletes a value, with the next commit.
+/// </summary>
+/// <param name="key">The key.</param>
+/// <returns>0 on success, or -1 on failure, in which case errno is set: ENOENT if the key is not
+/// in the store.</returns>
+int KeyValueStore_Delete(const char *key);
+
+/// <summary>
+///     Commits the changes at once, for example before the application powers down. This waits
+///     for the commit which is being written in the background, if there is one, and then writes
+///     the remaining changes on this thread, so when it returns, every change is in storage.
+/// </summary>
+/// <returns>0 on success, or if there were no changes; -1 on failure, in which case errno is set
+/// and the changes remain to be committed.</returns>
+int KeyValueStore_Commit(void);
+
+/// <summary>
+///     Sets the function which is called when each commit has been written or has failed. The
+///     store is opened without one.
+/// </summary>
+/// <param name="callback">The function, or NULL.</param>
+/// <param name="context">Context which is passed to the function.</param>
+void KeyValueStore_SetCommitCallback(KeyValueStore_CommitCallback callback, void *context);
+
+/// <summary>
+///     Gets the counts of the writes which the store has made.
+/// </summary>
+/// <param name="statistics">Receives the counts.</param>
+void KeyValueStore_GetStatistics(KeyValueStore_Statistics *statistics);
+
+/// <summary>
+///     Commits any changes and closes the store. This should be called before the event loop is
+///     closed.
+/// </summary>
+void KeyValueStore_Close(void);
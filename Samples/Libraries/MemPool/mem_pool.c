@@ -0,0 +1,346 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <applibs/log.h>
+
+#include "mem_pool.h"
+
+// A free block holds the link to the next free block in its class.
+typedef struct FreeBlock {
+    struct FreeBlock *next;
+} FreeBlock;
+
+typedef struct {
+    uint8_t *start;
+    uint8_t *end;
+    // Index in subsystems of the subsystem which holds each block.
+    uint8_t *owners;
+    FreeBlock *freeList;
+    MemPool_ClassStats stats;
+} SizeClass;
+
+static SizeClass classes[MEM_POOL_MAX_CLASSES];
+static size_t classCount = 0;
+static uint8_t *arenaStart = NULL;
+static uint8_t *arenaEnd = NULL;
+static size_t blockBytes = 0;
+static size_t bytesInUse = 0;
+static size_t bytesHighWaterMark = 0;
+static uint32_t failures = 0;
+
+static MemPool_Subsystem otherSubsystem = MEM_POOL_SUBSYSTEM("Other");
+static MemPool_Subsystem *subsystems[MEM_POOL_MAX_SUBSYSTEMS] = {&otherSubsystem};
+static size_t subsystemCount = 1;
+
+static size_t RoundUp(size_t size)
+{
+    return ((size + MEM_POOL_ALIGNMENT - 1) / MEM_POOL_ALIGNMENT) * MEM_POOL_ALIGNMENT;
+}
+
+int MemPool_Initialize(void *arena, size_t arenaSize, const MemPool_SizeClass *sizeClasses,
+                       size_t sizeClassCount)
+{
+    if (classCount != 0 || sizeClassCount == 0 || sizeClassCount > MEM_POOL_MAX_CLASSES ||
+        ((uintptr_t)arena % MEM_POOL_ALIGNMENT) != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    size_t required = 0;
+    for (size_t i = 0; i < sizeClassCount; ++i) {
+        size_t blockSize = RoundUp(sizeClasses[i].blockSize);
+        if (blockSize < sizeof(FreeBlock) ||
+            (i > 0 && blockSize <= RoundUp(sizeClasses[i - 1].blockSize))) {
+            errno = EINVAL;
+            return -1;
+        }
+        required += MEM_POOL_CLASS_SIZE(blockSize, sizeClasses[i].blockCount);
+    }
+
+    if (required > arenaSize) {
+        Log_Debug("ERROR: The memory pool needs an arena of %zu bytes, but it has %zu.\n",
+                  required, arenaSize);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    // Lay out the blocks of each class contiguously, followed by the bytes which record their
+    // owners, so that a block's class and index are given by its address; and thread each
+    // class's blocks onto its free list in address order.
+    uint8_t *next = arena;
+    blockBytes = 0;
+    for (size_t i = 0; i < sizeClassCount; ++i) {
+        SizeClass *sizeClass = &classes[i];
+        memset(sizeClass, 0, sizeof(*sizeClass));
+        sizeClass->stats.blockSize = RoundUp(sizeClasses[i].blockSize);
+        sizeClass->stats.blockCount = sizeClasses[i].blockCount;
+        sizeClass->start = next;
+        sizeClass->end = next + sizeClass->stats.blockSize * sizeClass->stats.blockCount;
+        sizeClass->owners = sizeClass->end;
+        blockBytes += sizeClass->stats.blockSize * sizeClass->stats.blockCount;
+
+        FreeBlock **link = &sizeClass->freeList;
+        for (uint8_t *block = sizeClass->start; block < sizeClass->end;
+             block += sizeClass->stats.blockSize) {
+            *link = (FreeBlock *)block;
+            link = &(*link)->next;
+        }
+        *link = NULL;
+
+        next = sizeClass->owners + RoundUp(sizeClass->stats.blockCount);
+    }
+
+    arenaStart = arena;
+    arenaEnd = next;
+    classCount = sizeClassCount;
+    bytesInUse = 0;
+    bytesHighWaterMark = 0;
+    failures = 0;
+    return 0;
+}
+
+// Gets the class which holds a block, or NULL if the block is not in the arena.
+static SizeClass *FindClass(const void *ptr)
+{
+    const uint8_t *block = ptr;
+    if (block < arenaStart || block >= arenaEnd) {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < classCount; ++i) {
+        if (block < classes[i].end) {
+            assert(block >= classes[i].start &&
+                   (size_t)(block - classes[i].start) % classes[i].stats.blockSize == 0);
+            return &classes[i];
+        }
+    }
+
+    return NULL;
+}
+
+// Adds a subsystem to the pool when it first allocates. If there are already as many as there can
+// be, its allocations are charged to the "Other" subsystem instead.
+static MemPool_Subsystem *AddSubsystem(MemPool_Subsystem *subsystem)
+{
+    if (subsystem == NULL) {
+        return &otherSubsystem;
+    }
+
+    if (subsystem->index == 0 && subsystem != &otherSubsystem) {
+        if (subsystemCount == MEM_POOL_MAX_SUBSYSTEMS) {
+            return &otherSubsystem;
+        }
+        subsystem->index = (uint8_t)subsystemCount;
+        subsystems[subsystemCount++] = subsystem;
+    }
+
+    return subsystem;
+}
+
+void *MemPool_AllocFor(MemPool_Subsystem *subsystem, size_t size)
+{
+    if (classCount == 0) {
+        return malloc(size);
+    }
+
+    subsystem = AddSubsystem(subsystem);
+
+    size_t target = 0;
+    while (target < classCount && classes[target].stats.blockSize < size) {
+        ++target;
+    }
+
+    if (target == classCount) {
+        Log_Debug("ERROR: The memory pool has no blocks of %zu bytes for %s.\n", size,
+                  subsystem->name);
+        ++subsystem->failures;
+        ++failures;
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    for (size_t i = target; i < classCount; ++i) {
+        SizeClass *sizeClass = &classes[i];
+        FreeBlock *block = sizeClass->freeList;
+        if (block == NULL) {
+            continue;
+        }
+
+        sizeClass->freeList = block->next;
+        sizeClass->owners[((uint8_t *)block - sizeClass->start) / sizeClass->stats.blockSize] =
+            subsystem->index;
+        if (++sizeClass->stats.inUse > sizeClass->stats.highWaterMark) {
+            sizeClass->stats.highWaterMark = sizeClass->stats.inUse;
+        }
+        if (i != target) {
+            ++classes[target].stats.overflows;
+        }
+
+        bytesInUse += sizeClass->stats.blockSize;
+        if (bytesInUse > bytesHighWaterMark) {
+            bytesHighWaterMark = bytesInUse;
+        }
+
+        ++subsystem->allocations;
+        ++subsystem->blocksInUse;
+        subsystem->bytesInUse += sizeClass->stats.blockSize;
+        if (subsystem->bytesInUse > subsystem->bytesHighWaterMark) {
+            subsystem->bytesHighWaterMark = subsystem->bytesInUse;
+        }
+        return block;
+    }
+
+    ++classes[target].stats.failures;
+    ++subsystem->failures;
+    ++failures;
+    errno = ENOMEM;
+    return NULL;
+}
+
+void *MemPool_Alloc(size_t size)
+{
+    return MemPool_AllocFor(NULL, size);
+}
+
+void *MemPool_CallocFor(MemPool_Subsystem *subsystem, size_t count, size_t size)
+{
+    if (classCount == 0) {
+        return calloc(count, size);
+    }
+
+    if (size != 0 && count > SIZE_MAX / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    void *block = MemPool_AllocFor(subsystem, count * size);
+    if (block != NULL) {
+        memset(block, 0, count * size);
+    }
+    return block;
+}
+
+void *MemPool_Calloc(size_t count, size_t size)
+{
+    return MemPool_CallocFor(NULL, count, size);
+}
+
+void *MemPool_ReallocFor(MemPool_Subsystem *subsystem, void *ptr, size_t size)
+{
+    if (ptr == NULL) {
+        return MemPool_AllocFor(subsystem, size);
+    }
+
+    SizeClass *sizeClass = FindClass(ptr);
+    if (sizeClass == NULL) {
+        return realloc(ptr, size);
+    }
+
+    if (size <= sizeClass->stats.blockSize) {
+        return ptr;
+    }
+
+    void *block = MemPool_AllocFor(subsystem, size);
+    if (block == NULL) {
+        return NULL;
+    }
+
+    memcpy(block, ptr, sizeClass->stats.blockSize);
+    MemPool_Free(ptr);
+    return block;
+}
+
+void *MemPool_Realloc(void *ptr, size_t size)
+{
+    return MemPool_ReallocFor(NULL, ptr, size);
+}
+
+void MemPool_Free(void *ptr)
+{
+    if (ptr == NULL) {
+        return;
+    }
+
+    SizeClass *sizeClass = FindClass(ptr);
+    if (sizeClass == NULL) {
+        free(ptr);
+        return;
+    }
+
+    assert(sizeClass->stats.inUse > 0);
+    size_t index = ((uint8_t *)ptr - sizeClass->start) / sizeClass->stats.blockSize;
+    MemPool_Subsystem *subsystem = subsystems[sizeClass->owners[index]];
+    --subsystem->blocksInUse;
+    subsystem->bytesInUse -= sizeClass->stats.blockSize;
+
+    FreeBlock *block = ptr;
+    block->next = sizeClass->freeList;
+    sizeClass->freeList = block;
+    --sizeClass->stats.inUse;
+    bytesInUse -= sizeClass->stats.blockSize;
+}
+
+size_t MemPool_GetClassCount(void)
+{
+    return classCount;
+}
+
+int MemPool_GetStats(size_t classIndex, MemPool_ClassStats *stats)
+{
+    if (classIndex >= classCount) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    *stats = classes[classIndex].stats;
+    return 0;
+}
+
+void MemPool_GetUsage(MemPool_Usage *usage)
+{
+    usage->arenaSize = blockBytes;
+    usage->bytesInUse = bytesInUse;
+    usage->bytesHighWaterMark = bytesHighWaterMark;
+    usage->failures = failures;
+}
+
+size_t MemPool_GetSubsystemCount(void)
+{
+    return subsystemCount;
+}
+
+const MemPool_Subsystem *MemPool_GetSubsystem(size_t index)
+{
+    return (index < subsystemCount) ? subsystems[index] : NULL;
+}
+
+void MemPool_LogStats(void)
+{
+    if (classCount == 0) {
+        Log_Debug("INFO: The memory pool is not initialized.\n");
+        return;
+    }
+
+    Log_Debug("INFO: Memory pool: %zu of %zu bytes in use, high-water mark %zu bytes.\n",
+              bytesInUse, blockBytes, bytesHighWaterMark);
+    for (size_t i = 0; i < classCount; ++i) {
+        const MemPool_ClassStats *stats = &classes[i].stats;
+        Log_Debug("INFO:   %5zu-byte blocks: %3zu of %3zu in use, high-water mark %3zu, "
+                  "%lu overflowed, %lu failed.\n",
+                  stats->blockSize, stats->inUse, stats->blockCount, stats->highWaterMark,
+                  (unsigned long)stats->overflows, (unsigned long)stats->failures);
+    }
+    for (size_t i = 0; i < subsystemCount; ++i) {
+        const MemPool_Subsystem *subsystem = subsystems[i];
+        Log_Debug("INFO:   %-16s %6zu bytes in %3zu blocks, high-water mark %6zu bytes, "
+                  "%lu failed.\n",
+                  subsystem->name, subsystem->bytesInUse, subsystem->blocksInUse,
+                  subsystem->bytesHighWaterMark, (unsigned long)subsystem->failures);
+    }
+}
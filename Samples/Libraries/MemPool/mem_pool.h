@@ -0,0 +1,208 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The memory pool replaces the C heap for an application's own allocations with fixed-size blocks
+// which are carved out of a static arena when the application starts. Each request is served from
+// the smallest size class whose blocks are large enough, or from a larger class if that one is
+// exhausted, and fails if no suitable block is free. Because a block is never split or merged, the
+// pool cannot fragment, however long the application runs, and its memory use is fixed by the
+// size classes the application chooses. The pool records the high-water mark of each class, so
+// the classes can be sized from what the application actually uses.
+//
+// Until MemPool_Initialize is called, and for memory which was not allocated from the arena, the
+// functions pass the request on to the C heap, so modules can be moved onto the pool one at a
+// time. The pool is not thread-safe; it should only be used from the event loop's thread.
+//
+// Each block is charged to the subsystem which allocated it, so that the memory which each part of
+// an application holds can be reported, and a leak traced to the subsystem which causes it.
+// Memory which is allocated without naming a subsystem is charged to the "Other" subsystem.
+
+/// <summary>Maximum number of size classes.</summary>
+#define MEM_POOL_MAX_CLASSES 8
+
+/// <summary>Maximum number of subsystems, including the "Other" subsystem. Allocations by further
+/// subsystems are charged to the "Other" subsystem.</summary>
+#define MEM_POOL_MAX_SUBSYSTEMS 16
+
+/// <summary>Alignment of every block, and the granularity of block sizes.</summary>
+#define MEM_POOL_ALIGNMENT 8
+
+/// <summary>
+///     Number of bytes of arena which a size class uses, to size the arena at compile time. This
+///     includes one byte per block which records the subsystem which allocated it.
+/// </summary>
+#define MEM_POOL_CLASS_SIZE(blockSize, blockCount)                                            \
+    ((((blockSize) + MEM_POOL_ALIGNMENT - 1) / MEM_POOL_ALIGNMENT) * MEM_POOL_ALIGNMENT *    \
+         (blockCount) +                                                                       \
+     (((blockCount) + MEM_POOL_ALIGNMENT - 1) / MEM_POOL_ALIGNMENT) * MEM_POOL_ALIGNMENT)
+
+/// <summary>Describes one size class.</summary>
+typedef struct {
+    /// <summary>Size of each block in bytes, which is rounded up to MEM_POOL_ALIGNMENT.</summary>
+    size_t blockSize;
+    /// <summary>Number of blocks in the class.</summary>
+    size_t blockCount;
+} MemPool_SizeClass;
+
+/// <summary>Statistics about one size class, since the pool was initialized.</summary>
+typedef struct {
+    /// <summary>Size of each block in bytes.</summary>
+    size_t blockSize;
+    /// <summary>Number of blocks in the class.</summary>
+    size_t blockCount;
+    /// <summary>Number of blocks which are allocated.</summary>
+    size_t inUse;
+    /// <summary>Largest number of blocks which have been allocated at once.</summary>
+    size_t highWaterMark;
+    /// <summary>Number of requests which this class should have served, but which were served
+    /// by a larger class because this one was exhausted.</summary>
+    uint32_t overflows;
+    /// <summary>Number of requests which this class should have served, but which failed because
+    /// no block was free in this or any larger class.</summary>
+    uint32_t failures;
+} MemPool_ClassStats;
+
+/// <summary>
+///     A part of an application which allocates from the pool, and the memory which it holds.
+///     Declare one with static storage for each subsystem, and initialize it with
+///     MEM_POOL_SUBSYSTEM; it is added to the pool when it first allocates.
+/// </summary>
+typedef struct {
+    /// <summary>Name of the subsystem.</summary>
+    const char *name;
+    /// <summary>Index of the subsystem in the pool, or zero if it has not yet been
+    /// added.</summary>
+    uint8_t index;
+    /// <summary>Number of blocks which the subsystem has allocated.</summary>
+    uint32_t allocations;
+    /// <summary>Number of blocks which the subsystem holds.</summary>
+    size_t blocksInUse;
+    /// <summary>Number of bytes of blocks which the subsystem holds.</summary>
+    size_t bytesInUse;
+    /// <summary>Largest number of bytes of blocks which the subsystem has held at once.</summary>
+    size_t bytesHighWaterMark;
+    /// <summary>Number of allocations by the subsystem which failed.</summary>
+    uint32_t failures;
+} MemPool_Subsystem;
+
+/// <summary>Initializer for a MemPool_Subsystem.</summary>
+#define MEM_POOL_SUBSYSTEM(subsystemName) {.name = (subsystemName)}
+
+/// <summary>Usage of the whole arena.</summary>
+typedef struct {
+    /// <summary>Number of bytes of blocks in the arena.</summary>
+    size_t arenaSize;
+    /// <summary>Number of bytes of blocks which are allocated.</summary>
+    size_t bytesInUse;
+    /// <summary>Largest number of bytes of blocks which have been allocated at once.</summary>
+    size_t bytesHighWaterMark;
+    /// <summary>Number of allocations which have failed.</summary>
+    uint32_t failures;
+} MemPool_Usage;
+
+/// <summary>
+///     Divides an arena into the blocks of the supplied size classes. This should be called once,
+///     before anything is allocated from the pool.
+/// </summary>
+/// <param name="arena">Memory for the blocks, aligned to MEM_POOL_ALIGNMENT, which must remain
+/// valid while the pool is used; usually a static array of uint64_t.</param>
+/// <param name="arenaSize">Size of the arena in bytes, which must be at least the sum of
+/// MEM_POOL_CLASS_SIZE for each class.</param>
+/// <param name="classes">The size classes, in increasing order of block size.</param>
+/// <param name="classCount">Number of size classes, at most MEM_POOL_MAX_CLASSES.</param>
+/// <returns>0 on success, or -1 on failure, in which case errno is set.</returns>
+int MemPool_Initialize(void *arena, size_t arenaSize, const MemPool_SizeClass *classes,
+                       size_t classCount);
+
+/// <summary>
+///     Allocates a block of at least the supplied size, like malloc.
+/// </summary>
+/// <returns>The block, which is not cleared; or NULL if no block is free, in which case errno is
+/// set to ENOMEM.</returns>
+void *MemPool_Alloc(size_t size);
+
+/// <summary>
+///     Allocates a block like MemPool_Alloc, and charges it to a subsystem.
+/// </summary>
+/// <param name="subsystem">The subsystem which holds the block.</param>
+/// <param name="size">Size which is required in bytes.</param>
+void *MemPool_AllocFor(MemPool_Subsystem *subsystem, size_t size);
+
+/// <summary>
+///     Allocates a cleared block for an array, like calloc.
+/// </summary>
+/// <returns>The block; or NULL if no block is free, in which case errno is set to
+/// ENOMEM.</returns>
+void *MemPool_Calloc(size_t count, size_t size);
+
+/// <summary>
+///     Allocates a cleared block like MemPool_Calloc, and charges it to a subsystem.
+/// </summary>
+void *MemPool_CallocFor(MemPool_Subsystem *subsystem, size_t count, size_t size);
+
+/// <summary>
+///     Changes the size of a block, like realloc. If the block is already large enough, it is
+///     returned unchanged; otherwise its contents are moved to a larger block.
+/// </summary>
+/// <param name="ptr">Block returned by the pool, or NULL to allocate a new block.</param>
+/// <param name="size">Size which is required in bytes.</param>
+/// <returns>The block; or NULL if no block is free, in which case errno is set to ENOMEM, and the
+/// original block is unchanged.</returns>
+void *MemPool_Realloc(void *ptr, size_t size);
+
+/// <summary>
+///     Changes the size of a block like MemPool_Realloc. A new block is charged to the subsystem.
+/// </summary>
+void *MemPool_ReallocFor(MemPool_Subsystem *subsystem, void *ptr, size_t size);
+
+/// <summary>
+///     Returns a block to the pool, like free.
+/// </summary>
+/// <param name="ptr">Block returned by the pool, or NULL.</param>
+void MemPool_Free(void *ptr);
+
+/// <summary>
+///     Gets the number of size classes.
+/// </summary>
+/// <returns>The number of size classes, which is zero until the pool is initialized.</returns>
+size_t MemPool_GetClassCount(void);
+
+/// <summary>
+///     Gets the statistics of a size class.
+/// </summary>
+/// <param name="classIndex">Index of the size class, in increasing order of block size.</param>
+/// <param name="stats">Receives the statistics.</param>
+/// <returns>0 on success, or -1 if there is no such class, in which case errno is set to
+/// EINVAL.</returns>
+int MemPool_GetStats(size_t classIndex, MemPool_ClassStats *stats);
+
+/// <summary>
+///     Gets the usage of the whole arena.
+/// </summary>
+/// <param name="usage">Receives the usage, which is all zero until the pool is
+/// initialized.</param>
+void MemPool_GetUsage(MemPool_Usage *usage);
+
+/// <summary>
+///     Gets the number of subsystems which have allocated from the pool, including the "Other"
+///     subsystem.
+/// </summary>
+size_t MemPool_GetSubsystemCount(void);
+
+/// <summary>
+///     Gets a subsystem which has allocated from the pool.
+/// </summary>
+/// <param name="index">Index of the subsystem, less than MemPool_GetSubsystemCount.</param>
+/// <returns>The subsystem, or NULL if there is no such subsystem.</returns>
+const MemPool_Subsystem *MemPool_GetSubsystem(size_t index);
+
+/// <summary>
+///     Logs the statistics of every size class and every subsystem, and the high-water mark of the
+///     whole arena.
+/// </summary>
+void MemPool_LogStats(void);
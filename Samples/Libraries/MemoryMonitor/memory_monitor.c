@@ -0,0 +1,216 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include <applibs/application.h>
+#include <applibs/eventloop.h>
+#include <applibs/log.h>
+
+#include "mem_pool.h"
+#include "memory_monitor.h"
+
+static EventLoop *monitorEventLoop = NULL;
+static int timerFd = -1;
+static EventRegistration *timerRegistration = NULL;
+static MemoryMonitor_ReportHandler reportHandler = NULL;
+static void *reportContext = NULL;
+static unsigned int samplesPerPeriod = 0;
+static struct timespec startTime;
+
+// Summary of the current period.
+static MemoryMonitor_Report current;
+static unsigned int samplesInPeriod = 0;
+
+// Lowest user-mode usage of the first period, and of the previous period.
+static bool haveBaseline = false;
+static uint32_t baselineKB = 0;
+static uint32_t previousMinKB = 0;
+
+void MemoryMonitor_GetSample(MemoryMonitor_Sample *sample)
+{
+    sample->totalKB = (uint32_t)Applications_GetTotalMemoryUsageInKB();
+    sample->userModeKB = (uint32_t)Applications_GetUserModeMemoryUsageInKB();
+    sample->peakUserModeKB = (uint32_t)Applications_GetPeakUserModeMemoryUsageInKB();
+}
+
+static void EndPeriod(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    current.uptimeSeconds = (uint32_t)(now.tv_sec - startTime.tv_sec);
+
+    if (!haveBaseline) {
+        haveBaseline = true;
+        baselineKB = current.minUserModeKB;
+        current.risingPeriods = 0;
+    } else if (current.minUserModeKB > previousMinKB) {
+        ++current.risingPeriods;
+    } else {
+        current.risingPeriods = 0;
+    }
+    previousMinKB = current.minUserModeKB;
+    current.growthKB = (int32_t)current.minUserModeKB - (int32_t)baselineKB;
+    current.leakSuspected = current.risingPeriods >= MEMORY_MONITOR_LEAK_PERIODS;
+
+    if (reportHandler != NULL) {
+        reportHandler(&current, reportContext);
+    } else {
+        MemoryMonitor_LogReport(&current);
+    }
+
+    samplesInPeriod = 0;
+}
+
+static void TakeSample(void)
+{
+    MemoryMonitor_Sample sample;
+    MemoryMonitor_GetSample(&sample);
+
+    if (samplesInPeriod == 0) {
+        current.minUserModeKB = sample.userModeKB;
+        current.maxUserModeKB = sample.userModeKB;
+        current.maxTotalKB = sample.totalKB;
+    } else {
+        if (sample.userModeKB < current.minUserModeKB) {
+            current.minUserModeKB = sample.userModeKB;
+        }
+        if (sample.userModeKB > current.maxUserModeKB) {
+            current.maxUserModeKB = sample.userModeKB;
+        }
+        if (sample.totalKB > current.maxTotalKB) {
+            current.maxTotalKB = sample.totalKB;
+        }
+    }
+    current.latest = sample;
+
+    if (++samplesInPeriod == samplesPerPeriod) {
+        EndPeriod();
+    }
+}
+
+// This satisfies the EventLoopIoCallback signature.
+static void SampleTimerCallback(EventLoop *el, int fd, EventLoop_IoEvents events, void *context)
+{
+    uint64_t expirations;
+    if (read(timerFd, &expirations, sizeof(expirations)) == -1) {
+        Log_Debug("ERROR: Could not read timerfd %s (%d).\n", strerror(errno), errno);
+        return;
+    }
+
+    TakeSample();
+}
+
+int MemoryMonitor_Start(EventLoop *eventLoop, unsigned int samplePeriodSeconds,
+                        unsigned int samplesPerReport, MemoryMonitor_ReportHandler handler,
+                        void *context)
+{
+    if (timerFd != -1 || samplePeriodSeconds == 0 || samplesPerReport == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (timerFd == -1) {
+        Log_Debug("ERROR: Unable to create timer: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+
+    struct timespec period = {.tv_sec = samplePeriodSeconds, .tv_nsec = 0};
+    struct itimerspec newValue = {.it_value = period, .it_interval = period};
+    if (timerfd_settime(timerFd, /* flags */ 0, &newValue, /* old_value */ NULL) == -1) {
+        Log_Debug("ERROR: Could not set timer period: %s (%d).\n", strerror(errno), errno);
+        goto failed;
+    }
+
+    timerRegistration =
+        EventLoop_RegisterIo(eventLoop, timerFd, EventLoop_Input, SampleTimerCallback, NULL);
+    if (timerRegistration == NULL) {
+        Log_Debug("ERROR: Unable to register timer event: %s (%d).\n", strerror(errno), errno);
+        goto failed;
+    }
+
+    monitorEventLoop = eventLoop;
+    reportHandler = handler;
+    reportContext = context;
+    samplesPerPeriod = samplesPerReport;
+    samplesInPeriod = 0;
+    haveBaseline = false;
+    memset(&current, 0, sizeof(current));
+    clock_gettime(CLOCK_MONOTONIC, &startTime);
+
+    TakeSample();
+    return 0;
+
+failed:
+    MemoryMonitor_Stop();
+    return -1;
+}
+
+void MemoryMonitor_Stop(void)
+{
+    if (timerRegistration != NULL) {
+        EventLoop_UnregisterIo(monitorEventLoop, timerRegistration);
+        timerRegistration = NULL;
+    }
+    if (timerFd != -1) {
+        close(timerFd);
+        timerFd = -1;
+    }
+}
+
+void MemoryMonitor_LogReport(const MemoryMonitor_Report *report)
+{
+    Log_Debug("INFO: Memory after %lu s: %lu KiB total, %lu KiB user mode (%lu-%lu KiB in the "
+              "period, %+ld KiB since the first), peak %lu KiB.\n",
+              (unsigned long)report->uptimeSeconds, (unsigned long)report->latest.totalKB,
+              (unsigned long)report->latest.userModeKB, (unsigned long)report->minUserModeKB,
+              (unsigned long)report->maxUserModeKB, (long)report->growthKB,
+              (unsigned long)report->latest.peakUserModeKB);
+    if (report->leakSuspected) {
+        Log_Debug("WARNING: Memory use has risen for %lu consecutive periods; suspected leak.\n",
+                  (unsigned long)report->risingPeriods);
+    }
+
+    if (MemPool_GetClassCount() > 0) {
+        MemPool_LogStats();
+    }
+}
+
+void MemoryMonitor_WriteJson(const MemoryMonitor_Report *report, JsonWriter *writer)
+{
+    JsonWriter_AddInt(writer, "UptimeSeconds", report->uptimeSeconds);
+    JsonWriter_AddInt(writer, "TotalMemoryKB", report->latest.totalKB);
+    JsonWriter_AddInt(writer, "MaxTotalMemoryKB", report->maxTotalKB);
+    JsonWriter_AddInt(writer, "UserModeMemoryKB", report->latest.userModeKB);
+    JsonWriter_AddInt(writer, "MinUserModeMemoryKB", report->minUserModeKB);
+    JsonWriter_AddInt(writer, "PeakUserModeMemoryKB", report->latest.peakUserModeKB);
+    JsonWriter_AddInt(writer, "MemoryGrowthKB", report->growthKB);
+    JsonWriter_AddBool(writer, "MemoryLeakSuspected", report->leakSuspected);
+
+    if (MemPool_GetClassCount() == 0) {
+        return;
+    }
+
+    MemPool_Usage usage;
+    MemPool_GetUsage(&usage);
+    JsonWriter_BeginObject(writer, "MemoryPool");
+    JsonWriter_AddInt(writer, "Size", (int64_t)usage.arenaSize);
+    JsonWriter_AddInt(writer, "InUse", (int64_t)usage.bytesInUse);
+    JsonWriter_AddInt(writer, "HighWaterMark", (int64_t)usage.bytesHighWaterMark);
+    JsonWriter_AddInt(writer, "Failures", usage.failures);
+    // The bytes which each subsystem holds.
+    JsonWriter_BeginObject(writer, "Subsystems");
+    for (size_t i = 0; i < MemPool_GetSubsystemCount(); ++i) {
+        const MemPool_Subsystem *subsystem = MemPool_GetSubsystem(i);
+        JsonWriter_AddInt(writer, subsystem->name, (int64_t)subsystem->bytesInUse);
+    }
+    JsonWriter_EndObject(writer);
+    JsonWriter_EndObject(writer);
+}
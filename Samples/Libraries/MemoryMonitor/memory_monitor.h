@@ -0,0 +1,107 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <applibs/eventloop.h>
+
+#include "json_writer.h"
+
+// The memory monitor samples the application's memory usage periodically, and summarizes each
+// report period's samples together with the usage of the memory pool, so that an application
+// which runs for months can report how its memory use changes, for example as telemetry.
+//
+// Within a period, usage rises and falls as transient work such as a TLS handshake allocates and
+// frees memory, so the monitor tracks the lowest user-mode usage of each period, which only rises
+// if memory is not returned. A leak is suspected when that floor has risen for
+// MEMORY_MONITOR_LEAK_PERIODS consecutive periods. The memory pool's per-subsystem usage then
+// shows which part of the application holds the memory.
+//
+// The monitor is not thread-safe; it should only be used from the event loop's thread.
+
+/// <summary>Number of consecutive periods whose lowest usage rose, after which a leak is
+/// suspected.</summary>
+#define MEMORY_MONITOR_LEAK_PERIODS 4
+
+/// <summary>The application's memory usage at one time.</summary>
+typedef struct {
+    /// <summary>Total memory usage in KiB, including kernel memory which the application
+    /// uses, such as its sockets.</summary>
+    uint32_t totalKB;
+    /// <summary>User-mode memory usage in KiB.</summary>
+    uint32_t userModeKB;
+    /// <summary>Highest user-mode memory usage in KiB since the application started.</summary>
+    uint32_t peakUserModeKB;
+} MemoryMonitor_Sample;
+
+/// <summary>Summary of the samples which were taken during one report period.</summary>
+typedef struct {
+    /// <summary>Seconds since the monitor was started.</summary>
+    uint32_t uptimeSeconds;
+    /// <summary>The last sample of the period.</summary>
+    MemoryMonitor_Sample latest;
+    /// <summary>Lowest user-mode memory usage in the period, in KiB.</summary>
+    uint32_t minUserModeKB;
+    /// <summary>Highest user-mode memory usage in the period, in KiB.</summary>
+    uint32_t maxUserModeKB;
+    /// <summary>Highest total memory usage in the period, in KiB.</summary>
+    uint32_t maxTotalKB;
+    /// <summary>Change in the lowest user-mode memory usage since the first period, in
+    /// KiB.</summary>
+    int32_t growthKB;
+    /// <summary>Number of consecutive periods, up to and including this one, whose lowest
+    /// user-mode memory usage was higher than that of the period before.</summary>
+    uint32_t risingPeriods;
+    /// <summary>Whether risingPeriods has reached MEMORY_MONITOR_LEAK_PERIODS.</summary>
+    bool leakSuspected;
+} MemoryMonitor_Report;
+
+/// <summary>
+///     Invoked at the end of each report period.
+/// </summary>
+/// <param name="report">The summary of the period, which is only valid until the handler
+/// returns.</param>
+/// <param name="context">Context which was supplied to MemoryMonitor_Start.</param>
+typedef void (*MemoryMonitor_ReportHandler)(const MemoryMonitor_Report *report, void *context);
+
+/// <summary>
+///     Starts sampling the application's memory usage. The first sample is taken immediately.
+/// </summary>
+/// <param name="eventLoop">Event loop which runs the sampling timer.</param>
+/// <param name="samplePeriodSeconds">Period at which the usage is sampled.</param>
+/// <param name="samplesPerReport">Number of samples in each report period.</param>
+/// <param name="handler">Function which receives each report, or NULL to log it.</param>
+/// <param name="context">Context which is passed to the handler.</param>
+/// <returns>0 on success, or -1 on failure, in which case errno is set.</returns>
+int MemoryMonitor_Start(EventLoop *eventLoop, unsigned int samplePeriodSeconds,
+                        unsigned int samplesPerReport, MemoryMonitor_ReportHandler handler,
+                        void *context);
+
+/// <summary>
+///     Stops sampling the application's memory usage. This should be called before the event
+///     loop is closed.
+/// </summary>
+void MemoryMonitor_Stop(void);
+
+/// <summary>
+///     Gets the application's current memory usage.
+/// </summary>
+/// <param name="sample">Receives the usage.</param>
+void MemoryMonitor_GetSample(MemoryMonitor_Sample *sample);
+
+/// <summary>
+///     Logs a report, followed by the statistics of the memory pool.
+/// </summary>
+/// <param name="report">The report to log.</param>
+void MemoryMonitor_LogReport(const MemoryMonitor_Report *report);
+
+/// <summary>
+///     Adds the properties of a report, and the usage of the memory pool by each subsystem, to the
+///     object which a JSON writer is writing.
+/// </summary>
+/// <param name="report">The report to write.</param>
+/// <param name="writer">Writer which is inside an object.</param>
+void MemoryMonitor_WriteJson(const MemoryMonitor_Report *report, JsonWriter *writer);
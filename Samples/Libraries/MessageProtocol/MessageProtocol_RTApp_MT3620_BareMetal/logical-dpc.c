@@ -0,0 +1,103 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include "logical-dpc.h"
+
+// Pending DPCs at one priority level, in the order in which they were enqueued.
+typedef struct {
+    CallbackNode *head;
+    CallbackNode *tail;
+} DpcList;
+
+// Each list is only modified with IRQs blocked, and each bit in readyMask is set if the
+// corresponding list is not empty. Every IRQ-blocked section takes constant time, however
+// many DPCs are pending.
+static DpcList readyLists[DpcPriority_Count];
+static volatile uint32_t readyMask = 0;
+
+static uint32_t HighestPriority(uint32_t mask);
+
+// Returns the highest priority whose bit is set in the supplied non-zero mask.
+static uint32_t HighestPriority(uint32_t mask)
+{
+    return 31 - (uint32_t)__builtin_clz(mask);
+}
+
+void EnqueueDeferredProc(CallbackNode *node)
+{
+    uint32_t priority = node->priority;
+    if (priority >= DpcPriority_Count) {
+        priority = DpcPriority_Count - 1;
+    }
+
+    uint32_t prevBasePri = BlockIrqs();
+    if (!node->enqueued) {
+        DpcList *list = &readyLists[priority];
+        node->enqueued = true;
+        node->next = NULL;
+        if (list->tail) {
+            list->tail->next = node;
+        } else {
+            list->head = node;
+        }
+        list->tail = node;
+        readyMask |= 1U << priority;
+    }
+    RestoreIrqs(prevBasePri);
+}
+
+void InvokeDeferredProcs(void)
+{
+    for (;;) {
+        // Take every pending DPC at the highest pending priority in a single IRQ-blocked
+        // section, rather than blocking IRQs once per callback.
+        uint32_t prevBasePri = BlockIrqs();
+        uint32_t mask = readyMask;
+        if (mask == 0) {
+            RestoreIrqs(prevBasePri);
+            return;
+        }
+
+        uint32_t priority = HighestPriority(mask);
+        DpcList *list = &readyLists[priority];
+        CallbackNode *node = list->head;
+        CallbackNode *batchTail = list->tail;
+        list->head = list->tail = NULL;
+        readyMask = mask & ~(1U << priority);
+        RestoreIrqs(prevBasePri);
+
+        while (node) {
+            // Read the next node before the flag is cleared, because once it is clear an ISR can
+            // enqueue this node again and overwrite its next pointer.
+            CallbackNode *next = node->next;
+            __atomic_store_n(&node->enqueued, false, __ATOMIC_RELEASE);
+            (*node->cb)();
+            node = next;
+
+            // If a higher-priority DPC was enqueued by the callback or by an ISR, put the rest of
+            // the batch back at the front of its list, so it still runs in order, and start again.
+            if (node && (readyMask >> (priority + 1)) != 0) {
+                prevBasePri = BlockIrqs();
+                batchTail->next = list->head;
+                if (!list->head) {
+                    list->tail = batchTail;
+                }
+                list->head = node;
+                readyMask |= 1U << priority;
+                RestoreIrqs(prevBasePri);
+                break;
+            }
+        }
+    }
+}
+
+void WaitForDeferredProcs(void)
+{
+    // With PRIMASK set, an interrupt which becomes pending after readyMask is checked still
+    // wakes the core from WFI, and is then taken when PRIMASK is cleared.
+    __asm__ volatile("cpsid i" : : : "memory");
+    if (readyMask == 0) {
+        __asm__ volatile("dsb\n\twfi" : : : "memory");
+    }
+    __asm__ volatile("cpsie i" : : : "memory");
+}
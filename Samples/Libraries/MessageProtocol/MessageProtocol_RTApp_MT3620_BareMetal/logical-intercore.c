@@ -0,0 +1,537 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <stdbool.h>
+
+#include "logical-dpc.h"
+#include "logical-intercore.h"
+#include "logical-timer.h"
+
+#include "mt3620-baremetal.h"
+#include "mt3620-intercore.h"
+
+/// <summary>
+///     The inbound and outbound buffers track how much data has been written
+///     written to, and read from, each shared buffer.
+/// </summary>
+struct BufferHeaderImpl {
+    /// <summary>
+    ///     <para>
+    ///         <see cref="IntercoreSend" /> uses this value to store the last position written to
+    ///         by the real-time capable application.
+    ///     </para>
+    ///     <para>
+    ///         <see cref="IntercoreRecv" /> uses this value to find the last position
+    ///         written to by the high-level application.
+    ///     </para>
+    /// </summary>
+    uint32_t writePosition;
+    /// <summary>
+    ///     <para>
+    ///         <see cref="IntercoreSend" /> uses this value to find the last position read from by
+    ///         the high-level application.
+    ///     </para>
+    ///     <para>
+    ///         <see cref="IntercoreRecv" /> uses this value to store the last position read from by
+    ///         the real-time capable application.
+    ///     </para>
+    /// </summary>
+    uint32_t readPosition;
+    /// <summary>
+    ///     Align up to 64 bytes, to match high-level L2 cache line. Each header is written
+    ///     by only one core - the inbound header by the high-level application, and the
+    ///     outbound header by this application - so the two cores never write the same line.
+    /// </summary>
+    uint32_t reserved[14];
+};
+
+_Static_assert(sizeof(BufferHeader) == INTERCORE_CACHE_LINE_SIZE,
+               "BufferHeader must fill one cache line");
+
+static uint32_t GetBufferSize(uint32_t bufferBase);
+static BufferHeader *GetBufferHeader(uint32_t bufferBase);
+
+static uint8_t *DataAreaOffset8(BufferHeader *header, uint32_t offset);
+static uint32_t RoundUp(uint32_t value, uint32_t alignment);
+
+static uint32_t ReadInboundCircular(const IntercoreComm *icc, uint32_t startPos, void *dest,
+                                    size_t len);
+static uint32_t WriteOutboundCircular(const IntercoreComm *icc, uint32_t startPos, const void *src,
+                                      size_t size);
+static void GetCircularSpans(BufferHeader *header, uint32_t bufSize, uint32_t startPos,
+                             size_t size, IntercoreSpans *spans);
+static uint32_t AdvanceCircular(uint32_t pos, size_t size, uint32_t bufSize);
+static void CopyFromSpans(void *dest, const IntercoreSpans *spans, size_t size);
+static void CopyToSpans(const IntercoreSpans *spans, const void *src, size_t size);
+static uint32_t LocalWritePosition(const IntercoreComm *icc);
+static void HandleBatchTimerIrq(void);
+static void HandleBatchTimerDeferred(void);
+
+// The batch latency timer callbacks do not take an argument, so the handle whose batch
+// they flush is stored here.
+static IntercoreComm *batchIcc = NULL;
+static CallbackNode batchFlushCbNode = {
+    .enqueued = false, .cb = HandleBatchTimerDeferred, .priority = DpcPriority_High};
+
+// If intercore debugging is enabled and the application detects a corrupt buffer,
+// it will spin forever in the Assert function. The user can then use a debugger
+// to see the type of corruption was detected.
+
+#define DEBUG_INTERCORE
+#ifdef DEBUG_INTERCORE
+
+static void Assert(bool cond)
+{
+    if (cond) {
+        return;
+    }
+
+    for (;;) {
+        // empty.
+    }
+}
+
+#define INTERCORE_ASSERT(c) Assert(c)
+
+#else
+
+#define INTERCORE_ASSERT(c)
+
+#endif
+
+// The buffer size is encoded as a power of two in the bottom five bits.
+static uint32_t GetBufferSize(uint32_t bufferBase)
+{
+    return (UINT32_C(1) << (bufferBase & 0x1F));
+}
+
+// The buffer header is a pointer is a 32-byte aligned pointer which is
+// stored in the top 27 bits.
+static BufferHeader *GetBufferHeader(uint32_t bufferBase)
+{
+    return (BufferHeader *)(bufferBase & ~0x1F);
+}
+
+IntercoreResult SetupIntercoreComm(IntercoreComm *icc, Callback recvCallback)
+{
+    uint32_t inboundBase, outboundBase;
+    MT3620_SetupIntercoreComm(&inboundBase, &outboundBase, recvCallback);
+
+    uint32_t totalInboundBufSize = GetBufferSize(inboundBase);
+    uint32_t totalOutboundBufSize = GetBufferSize(outboundBase);
+
+    INTERCORE_ASSERT(totalInboundBufSize > sizeof(BufferHeader));
+    INTERCORE_ASSERT(totalOutboundBufSize > sizeof(BufferHeader));
+
+    // Reduce buffer sizes to exclude headers.
+    icc->inboundBufSize = totalInboundBufSize - sizeof(BufferHeader);
+    icc->outboundBufSize = totalOutboundBufSize - sizeof(BufferHeader);
+
+    icc->inbound = GetBufferHeader(inboundBase);
+    icc->outbound = GetBufferHeader(outboundBase);
+
+    icc->sendReserved = false;
+    icc->recvPeeked = false;
+    icc->batchThreshold = 0;
+    icc->batchLatencyUs = 0;
+    icc->batchTimer.next = NULL;
+    icc->batchTimer.active = false;
+    icc->batchTimer.cb = HandleBatchTimerIrq;
+    icc->pendingCount = 0;
+    __builtin_memset(&icc->stats, 0, sizeof(icc->stats));
+
+    return Intercore_OK;
+}
+
+// Converts offset into shared buffer into a memory pointer.
+static uint8_t *DataAreaOffset8(BufferHeader *header, uint32_t offset)
+{
+    // Data storage area following header in buffer.
+    uint8_t *dataStart = (uint8_t *)(header + 1);
+
+    // Offset within data storage area.
+    return dataStart + offset;
+}
+
+static uint32_t RoundUp(uint32_t value, uint32_t alignment)
+{
+    // alignment must be a power of two.
+    return (value + (alignment - 1)) & ~(alignment - 1);
+}
+
+// Helper function for IntercoreRecv. Reads data from the inbound buffer,
+// and wraps around to start of buffer if required. Returns updated read position.
+static uint32_t ReadInboundCircular(const IntercoreComm *icc, uint32_t startPos, void *dest,
+                                    size_t size)
+{
+    uint32_t availToEnd = icc->inboundBufSize - startPos;
+
+    uint32_t readFromEnd = size;
+    // If the available data wraps around the end of the buffer then only read
+    // availToEnd bytes before subsequently reading from the start of the buffer.
+    if (size > availToEnd) {
+        readFromEnd = availToEnd;
+    }
+
+    uint8_t *dest8 = (uint8_t *)dest;
+    const uint8_t *src8 = DataAreaOffset8(icc->inbound, startPos);
+    __builtin_memcpy(dest, src8, readFromEnd);
+
+    // If block wrapped around the end of the buffer, then read remainder from start.
+    __builtin_memcpy(dest8 + readFromEnd, DataAreaOffset8(icc->inbound, 0), size - readFromEnd);
+
+    uint32_t finalPos = startPos + size;
+    if (finalPos > icc->inboundBufSize) {
+        finalPos -= icc->inboundBufSize;
+    }
+    return finalPos;
+}
+
+// Describes size bytes of a shared buffer, starting at startPos, which wrap
+// around to the start of the buffer if required.
+static void GetCircularSpans(BufferHeader *header, uint32_t bufSize, uint32_t startPos,
+                             size_t size, IntercoreSpans *spans)
+{
+    if (startPos >= bufSize) {
+        startPos -= bufSize;
+    }
+
+    uint32_t spaceToEnd = bufSize - startPos;
+    spans->first = DataAreaOffset8(header, startPos);
+    spans->firstSize = (size > spaceToEnd) ? spaceToEnd : size;
+    spans->second = DataAreaOffset8(header, 0);
+    spans->secondSize = size - spans->firstSize;
+}
+
+// Returns the position size bytes after pos, wrapping around to the start of the buffer.
+static uint32_t AdvanceCircular(uint32_t pos, size_t size, uint32_t bufSize)
+{
+    uint32_t finalPos = pos + size;
+    if (finalPos >= bufSize) {
+        finalPos -= bufSize;
+    }
+    return finalPos;
+}
+
+// Copies the first size bytes of the supplied spans to dest.
+static void CopyFromSpans(void *dest, const IntercoreSpans *spans, size_t size)
+{
+    size_t fromFirst = (size > spans->firstSize) ? spans->firstSize : size;
+    __builtin_memcpy(dest, spans->first, fromFirst);
+    __builtin_memcpy((uint8_t *)dest + fromFirst, spans->second, size - fromFirst);
+}
+
+// Copies size bytes from src to the start of the supplied spans.
+static void CopyToSpans(const IntercoreSpans *spans, const void *src, size_t size)
+{
+    size_t toFirst = (size > spans->firstSize) ? spans->firstSize : size;
+    __builtin_memcpy(spans->first, src, toFirst);
+    __builtin_memcpy(spans->second, (const uint8_t *)src + toFirst, size - toFirst);
+}
+
+IntercoreResult IntercorePeek(IntercoreComm *icc, ComponentId *srcAppId, IntercoreSpans *payload)
+{
+    // Don't read message content until have seen that remote write position has been updated.
+    // Corresponding release occurs on high-level core.
+    uint32_t remoteWritePosition;
+    __atomic_load(&icc->inbound->writePosition, &remoteWritePosition, __ATOMIC_ACQUIRE);
+    // Last position read from by this RTApp.
+    uint32_t localReadPosition = icc->outbound->readPosition;
+
+    // sanity check read and write positions
+    INTERCORE_ASSERT(remoteWritePosition < icc->inboundBufSize);
+    INTERCORE_ASSERT((remoteWritePosition % RINGBUFFER_ALIGNMENT) == 0);
+    INTERCORE_ASSERT(localReadPosition < icc->inboundBufSize);
+    INTERCORE_ASSERT((localReadPosition % RINGBUFFER_ALIGNMENT) == 0);
+
+    // Get the maximum amount of available data. The actual block size may be
+    // smaller than this.
+
+    uint32_t availData;
+    // If data is contiguous in buffer then difference between write and read positions...
+    if (remoteWritePosition >= localReadPosition) {
+        availData = remoteWritePosition - localReadPosition;
+    }
+    // ...else data wraps around end and resumes at start of buffer
+    else {
+        availData = remoteWritePosition - localReadPosition + icc->inboundBufSize;
+    }
+
+    // The amount of available data must be at least enough to hold the block size.
+    // If not, caller will assume that no message was available.
+    const size_t blockSizeSize = sizeof(uint32_t);
+    if (availData < blockSizeSize) {
+        ++icc->stats.recvNoBlockSize;
+        return Intercore_Recv_NoBlockSize;
+    }
+
+    // The block size must be stored in four contiguous bytes before wraparound.
+    uint32_t dataToEnd = icc->inboundBufSize - localReadPosition;
+    INTERCORE_ASSERT(blockSizeSize <= dataToEnd);
+
+    // The block size followed by the actual block can be no longer than the available data.
+    uint32_t blockSize;
+    localReadPosition = ReadInboundCircular(icc, localReadPosition, &blockSize, sizeof(blockSize));
+    uint32_t totalBlockSize;
+    // clang-tidy fails with "error: use of unknown builtin '__builtin_add_overflow_p'"
+#ifndef __clang_analyzer__
+    INTERCORE_ASSERT(!__builtin_add_overflow_p(blockSizeSize, blockSize, totalBlockSize));
+#endif
+    totalBlockSize = blockSizeSize + blockSize;
+    INTERCORE_ASSERT(totalBlockSize <= availData);
+
+    // The payload contains a sender ID (16 bytes) followed by a reserved word
+    // (4 bytes) followed by the sender-supplied data.
+    const uint32_t senderComponentIdSize = sizeof(*srcAppId);
+    const uint32_t reservedWordSize = sizeof(uint32_t);
+    const uint32_t minReqBlockSize = senderComponentIdSize + reservedWordSize;
+    INTERCORE_ASSERT(blockSize >= minReqBlockSize);
+    size_t senderPayloadSize = blockSize - minReqBlockSize;
+
+    // Read the sender component ID and skip the reserved word. This may wraparound to the
+    // start of the buffer. The app-specific payload is left in place.
+    localReadPosition = ReadInboundCircular(icc, localReadPosition, srcAppId, sizeof(*srcAppId));
+    localReadPosition = AdvanceCircular(localReadPosition, reservedWordSize, icc->inboundBufSize);
+    GetCircularSpans(icc->inbound, icc->inboundBufSize, localReadPosition, senderPayloadSize,
+                     payload);
+    localReadPosition = AdvanceCircular(localReadPosition, senderPayloadSize, icc->inboundBufSize);
+
+    // Align read position to next possible location for next buffer. This may wrap around.
+    localReadPosition = RoundUp(localReadPosition, RINGBUFFER_ALIGNMENT);
+    if (localReadPosition >= icc->inboundBufSize) {
+        localReadPosition -= icc->inboundBufSize;
+    }
+
+    // The read position is not updated until the caller has finished with the payload.
+    icc->recvNextPosition = localReadPosition;
+    icc->recvPeeked = true;
+
+    ++icc->stats.messagesReceived;
+    icc->stats.bytesReceived += senderPayloadSize;
+
+    return Intercore_OK;
+}
+
+void IntercoreRelease(IntercoreComm *icc)
+{
+    INTERCORE_ASSERT(icc->recvPeeked);
+    icc->recvPeeked = false;
+
+    // The message content must have been retrieved before the high-level core sees the read
+    // position has been updated. Corresponding acquire occurs on high-level core.
+    __atomic_store(&icc->outbound->readPosition, &icc->recvNextPosition, __ATOMIC_RELEASE);
+
+    MT3620_SignalHLCoreMessageReceived();
+}
+
+IntercoreResult IntercoreRecv(IntercoreComm *icc, ComponentId *srcAppId, void *dest, size_t *size)
+{
+    ComponentId sender;
+    IntercoreSpans payload;
+    IntercoreResult icr = IntercorePeek(icc, &sender, &payload);
+    if (icr != Intercore_OK) {
+        return icr;
+    }
+
+    // The caller-supplied buffer must be large enough to contain the payload in the buffer,
+    // excluding component ID and reserved word. If it is not, the message is left in the buffer.
+    size_t senderPayloadSize = payload.firstSize + payload.secondSize;
+    if (senderPayloadSize > *size) {
+        return Intercore_Recv_BufferTooSmall;
+    }
+
+    // Tell the caller the sender and the actual block size.
+    *srcAppId = sender;
+    *size = senderPayloadSize;
+    CopyFromSpans(dest, &payload, senderPayloadSize);
+
+    IntercoreRelease(icc);
+
+    return Intercore_OK;
+}
+
+// Helper function for IntercoreSend. Writes data to the outbound buffer,
+// and wraps around to start of buffer if required. Returns updated write position.
+static uint32_t WriteOutboundCircular(const IntercoreComm *icc, uint32_t startPos, const void *src,
+                                      size_t size)
+{
+    uint32_t spaceToEnd = icc->outboundBufSize - startPos;
+
+    uint32_t writeToEnd = size;
+    // If the new data would wrap around the end of the buffer then only write
+    // spaceToEnd bytes before subsequently writing to the start of the buffer.
+    if (size > spaceToEnd) {
+        writeToEnd = spaceToEnd;
+    }
+
+    const uint8_t *src8 = (const uint8_t *)src;
+    uint8_t *dest8 = DataAreaOffset8(icc->outbound, startPos);
+    __builtin_memcpy(dest8, src8, writeToEnd);
+    // If not enough space to write all data before end of buffer, then write remainder at start.
+    __builtin_memcpy(DataAreaOffset8(icc->outbound, 0), src8 + writeToEnd, size - writeToEnd);
+
+    uint32_t finalPos = startPos + size;
+    if (finalPos > icc->outboundBufSize) {
+        finalPos -= icc->outboundBufSize;
+    }
+    return finalPos;
+}
+
+IntercoreResult IntercoreReserve(IntercoreComm *icc, const ComponentId *destAppId, size_t size,
+                                 IntercoreSpans *payload)
+{
+    INTERCORE_ASSERT(!icc->sendReserved);
+
+    if (size > INTERCORE_MAX_PAYLOAD_LEN) {
+        ++icc->stats.sendMessageTooLarge;
+        return Intercore_Send_MessageTooLarge;
+    }
+
+    // Last position read by HLApp. Corresponding release occurs on high-level core.
+    uint32_t remoteReadPosition;
+    __atomic_load(&icc->inbound->readPosition, &remoteReadPosition, __ATOMIC_ACQUIRE);
+    // Last position written to by RTApp, including messages which have not been published.
+    uint32_t localWritePosition = LocalWritePosition(icc);
+
+    // Sanity check read and write positions.
+    INTERCORE_ASSERT(remoteReadPosition < icc->outboundBufSize);
+    INTERCORE_ASSERT((remoteReadPosition % RINGBUFFER_ALIGNMENT) == 0);
+    INTERCORE_ASSERT(localWritePosition < icc->outboundBufSize);
+    INTERCORE_ASSERT((localWritePosition % RINGBUFFER_ALIGNMENT) == 0);
+
+    // If the read pointer is behind the write pointer, then the free space
+    // wraps around, and the used space doesn't.
+    uint32_t availSpace;
+    if (remoteReadPosition <= localWritePosition) {
+        availSpace = remoteReadPosition - localWritePosition + icc->outboundBufSize;
+    } else {
+        availSpace = remoteReadPosition - localWritePosition;
+    }
+
+    // Check whether there is enough space to enqueue the next block.
+    uint32_t reqBlockSize = INTERCORE_BLOCK_OVERHEAD + size;
+
+    if (availSpace < reqBlockSize + RINGBUFFER_ALIGNMENT) {
+        ++icc->stats.sendNotEnoughBufferSpace;
+        return Intercore_Send_NotEnoughBufferSpace;
+    }
+
+    // The block size field is written when the message is committed, because the
+    // payload size is not known until then.
+    uint32_t headerPosition =
+        AdvanceCircular(localWritePosition, sizeof(uint32_t), icc->outboundBufSize);
+    headerPosition = WriteOutboundCircular(icc, headerPosition, destAppId, sizeof(*destAppId));
+    uint32_t reservedWord = 0;
+    headerPosition =
+        WriteOutboundCircular(icc, headerPosition, &reservedWord, sizeof(reservedWord));
+    GetCircularSpans(icc->outbound, icc->outboundBufSize, headerPosition, size, payload);
+
+    icc->sendReservedPosition = localWritePosition;
+    icc->sendReservedSize = size;
+    icc->sendReserved = true;
+
+    return Intercore_OK;
+}
+
+void IntercoreCommit(IntercoreComm *icc, size_t size)
+{
+    INTERCORE_ASSERT(icc->sendReserved);
+    INTERCORE_ASSERT(size <= icc->sendReservedSize);
+    icc->sendReserved = false;
+
+    // The value in the block size field does not include the space taken by the
+    // block size field itself.
+    uint32_t blockSizeExcSizeField = sizeof(ComponentId) + sizeof(uint32_t) + size;
+    uint32_t localWritePosition =
+        WriteOutboundCircular(icc, icc->sendReservedPosition, &blockSizeExcSizeField,
+                              sizeof(blockSizeExcSizeField));
+    localWritePosition =
+        AdvanceCircular(localWritePosition, blockSizeExcSizeField, icc->outboundBufSize);
+
+    // Advance write position to start of next possible block.
+    localWritePosition = RoundUp(localWritePosition, RINGBUFFER_ALIGNMENT);
+    if (localWritePosition >= icc->outboundBufSize) {
+        localWritePosition -= icc->outboundBufSize;
+    }
+
+    icc->pendingWritePosition = localWritePosition;
+    ++icc->pendingCount;
+
+    ++icc->stats.messagesSent;
+    icc->stats.bytesSent += size;
+
+    // Publish the message now unless it is batched. The first message in a batch starts
+    // the latency deadline.
+    if (icc->pendingCount >= icc->batchThreshold) {
+        IntercoreFlush(icc);
+    } else if (icc->pendingCount == 1 && icc->batchLatencyUs != 0) {
+        StartSoftTimer(&icc->batchTimer, icc->batchLatencyUs, 0);
+    }
+}
+
+void IntercoreFlush(IntercoreComm *icc)
+{
+    if (icc->pendingCount == 0) {
+        return;
+    }
+    icc->pendingCount = 0;
+    StopSoftTimer(&icc->batchTimer);
+
+    // Ensure write position update is seen after new content has been written.
+    // Corresponding acquire is on high-level core.
+    __atomic_store(&icc->outbound->writePosition, &icc->pendingWritePosition, __ATOMIC_RELEASE);
+
+    MT3620_SignalHLCoreMessageSent();
+}
+
+void IntercoreSetBatching(IntercoreComm *icc, uint32_t flushThreshold, uint32_t maxLatencyUs)
+{
+    IntercoreFlush(icc);
+
+    icc->batchThreshold = flushThreshold;
+    icc->batchLatencyUs = maxLatencyUs;
+    batchIcc = icc;
+}
+
+// Returns the position after the last message which was committed, whether or not
+// it has been published.
+static uint32_t LocalWritePosition(const IntercoreComm *icc)
+{
+    return (icc->pendingCount != 0) ? icc->pendingWritePosition : icc->outbound->writePosition;
+}
+
+// Runs in IRQ context when the batch latency deadline expires, and schedules
+// HandleBatchTimerDeferred to flush the batch.
+static void HandleBatchTimerIrq(void)
+{
+    EnqueueDeferredProc(&batchFlushCbNode);
+}
+
+// Queued by HandleBatchTimerIrq. If the batch was already published because it reached the
+// threshold, then there is nothing to flush.
+static void HandleBatchTimerDeferred(void)
+{
+    if (batchIcc != NULL) {
+        IntercoreFlush(batchIcc);
+    }
+}
+
+IntercoreResult IntercoreSend(IntercoreComm *icc, const ComponentId *destAppId, const void *data,
+                              size_t size)
+{
+    IntercoreSpans payload;
+    IntercoreResult icr = IntercoreReserve(icc, destAppId, size, &payload);
+    if (icr != Intercore_OK) {
+        return icr;
+    }
+
+    CopyToSpans(&payload, data, size);
+    IntercoreCommit(icc, size);
+
+    return Intercore_OK;
+}
+
+const IntercoreStats *IntercoreGetStats(const IntercoreComm *icc)
+{
+    return &icc->stats;
+}
@@ -0,0 +1,313 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "logical-mcu-link.h"
+#include "logical-dpc.h"
+#include "logical-timer.h"
+
+#include "message_protocol_utilities.h"
+
+#include "mt3620-isu-uart.h"
+#include "mt3620-timer.h"
+
+// A request with a CRC trailer which can be retransmitted if the MCU reports a CRC error.
+typedef struct {
+    bool inUse;
+    uint8_t retransmits;
+    uint32_t storedOrder;
+    size_t size;
+    MessageProtocol_RequestMessage message;
+} PendingRequest;
+
+static void HandleUartRxIrq(void);
+static void HandleUartTxIrq(void);
+static void HandleUartRxDeferred(void);
+static void HandlePartialTimerIrq(void);
+static void HandlePartialTimerDeferred(void);
+static void AddReceivedByte(uint8_t byte);
+static void DiscardPartialMessage(void);
+static void HandleMcuMessage(void);
+static PendingRequest *FindPendingRequest(MessageProtocol_Address address,
+                                          MessageProtocol_SequenceNumber sequenceNumber);
+static void StorePendingRequest(const uint8_t *message, size_t size);
+
+// The largest message which either side sends is a request with all of its data.
+#define MAX_MESSAGE_SIZE sizeof(MessageProtocol_RequestMessage)
+
+// The smallest message has a type and an address after its header.
+#define MIN_MESSAGE_LENGTH \
+    (sizeof(MessageProtocol_MessageHeaderWithType) - sizeof(MessageProtocol_MessageHeader))
+
+// The timer and DPC callbacks do not take an argument, so the link state is held here.
+static IntercoreComm *linkIcc = NULL;
+static const ComponentId *linkHlAppId = NULL;
+static McuLinkStats stats;
+
+static CallbackNode rxCbNode = {
+    .enqueued = false, .cb = HandleUartRxDeferred, .priority = DpcPriority_High};
+static CallbackNode txCbNode = {
+    .enqueued = false, .cb = McuLink_HandleIntercoreMessages, .priority = DpcPriority_Normal};
+static CallbackNode partialCbNode = {
+    .enqueued = false, .cb = HandlePartialTimerDeferred, .priority = DpcPriority_Normal};
+static SoftTimer partialTimer = {.next = NULL, .active = false, .cb = HandlePartialTimerIrq};
+
+// The message which is being received from the MCU. It is aligned so that its header can be
+// read in place.
+static uint8_t rxMessage[MAX_MESSAGE_SIZE] __attribute__((aligned(4)));
+static size_t rxCount = 0;
+static size_t rxExpected = 0;
+static uint32_t lastRxUs = 0;
+
+// The message which is being written to the MCU.
+static uint8_t txMessage[MAX_MESSAGE_SIZE] __attribute__((aligned(4)));
+
+static PendingRequest pendingRequests[MCU_LINK_MAX_PENDING_REQUESTS];
+static uint32_t nextStoredOrder = 0;
+
+// Runs in IRQ context.
+static void HandleUartRxIrq(void)
+{
+    EnqueueDeferredProc(&rxCbNode);
+}
+
+// Runs in IRQ context when the UART has sent every queued byte, so a message which was held
+// back for lack of space can now be written.
+static void HandleUartTxIrq(void)
+{
+    EnqueueDeferredProc(&txCbNode);
+}
+
+// Queued by HandleUartRxIrq. Reads every received byte, and passes on each complete message.
+static void HandleUartRxDeferred(void)
+{
+    uint8_t chunk[64];
+    size_t size;
+    while ((size = IsuUart_Read(chunk, sizeof(chunk))) != 0) {
+        for (size_t i = 0; i < size; ++i) {
+            AddReceivedByte(chunk[i]);
+        }
+    }
+
+    // The timer is restarted after each chunk, so it expires once the MCU has been silent for
+    // the timeout.
+    if (rxCount != 0) {
+        lastRxUs = MT3620_Gpt_ReadMicroseconds();
+        StartSoftTimer(&partialTimer, MCU_LINK_PARTIAL_TIMEOUT_US, 0);
+    } else {
+        StopSoftTimer(&partialTimer);
+    }
+}
+
+// Runs in IRQ context.
+static void HandlePartialTimerIrq(void)
+{
+    EnqueueDeferredProc(&partialCbNode);
+}
+
+// Queued by HandlePartialTimerIrq. The receive DPC runs first if bytes arrived after the timer
+// expired, so the partial message is only discarded if it has not grown since.
+static void HandlePartialTimerDeferred(void)
+{
+    if (rxCount == 0 ||
+        MT3620_Gpt_ReadMicroseconds() - lastRxUs < MCU_LINK_PARTIAL_TIMEOUT_US) {
+        return;
+    }
+
+    ++stats.partialTimeouts;
+    DiscardPartialMessage();
+}
+
+// Adds a byte from the MCU to the message which is being received. Bytes before a preamble,
+// and messages with lengths which cannot be valid, are discarded.
+static void AddReceivedByte(uint8_t byte)
+{
+    if (rxCount < sizeof(MessageProtocol_MessagePreamble)) {
+        if (byte != MessageProtocol_MessagePreamble[rxCount]) {
+            DiscardPartialMessage();
+            // No suffix of the preamble is also a prefix of it, so this byte can only start
+            // a new preamble.
+            if (byte != MessageProtocol_MessagePreamble[0]) {
+                ++stats.discardedBytes;
+                return;
+            }
+        }
+        rxMessage[rxCount++] = byte;
+        return;
+    }
+
+    rxMessage[rxCount++] = byte;
+
+    if (rxCount == sizeof(MessageProtocol_MessageHeader)) {
+        const MessageProtocol_MessageHeader *header =
+            (const MessageProtocol_MessageHeader *)rxMessage;
+        rxExpected = sizeof(MessageProtocol_MessageHeader) + header->length;
+        if (header->length < MIN_MESSAGE_LENGTH || rxExpected > sizeof(rxMessage)) {
+            DiscardPartialMessage();
+        }
+        return;
+    }
+
+    if (rxCount == rxExpected) {
+        HandleMcuMessage();
+        rxCount = 0;
+    }
+}
+
+static void DiscardPartialMessage(void)
+{
+    stats.discardedBytes += rxCount;
+    rxCount = 0;
+}
+
+// Checks a complete message from the MCU, retransmits a request which the MCU reports was
+// corrupted, and passes on every other valid message to the high-level application.
+static void HandleMcuMessage(void)
+{
+    const MessageProtocol_MessageHeaderWithType *headerWithType =
+        (const MessageProtocol_MessageHeaderWithType *)rxMessage;
+
+    if (headerWithType->type == MessageProtocol_ResponseMessageType &&
+        rxCount >= sizeof(MessageProtocol_ResponseHeader)) {
+        const MessageProtocol_ResponseHeader *header =
+            (const MessageProtocol_ResponseHeader *)rxMessage;
+
+        if ((header->flags & MessageProtocol_Flag_Crc) != 0 &&
+            !MessageProtocol_IsCrcValid(rxMessage)) {
+            // The high-level application times out the request, and retries it.
+            ++stats.crcErrors;
+            stats.discardedBytes += rxCount;
+            return;
+        }
+
+        PendingRequest *request =
+            FindPendingRequest(headerWithType->address, header->sequenceNumber);
+        if (request != NULL) {
+            if (header->responseResult == MessageProtocol_ResponseResult_CrcError &&
+                request->retransmits < MCU_LINK_MAX_RETRANSMITS &&
+                IsuUart_Write((const uint8_t *)&request->message, request->size)) {
+                ++request->retransmits;
+                ++stats.retransmits;
+                return;
+            }
+            request->inUse = false;
+        }
+    }
+
+    IntercoreResult icr = IntercoreSend(linkIcc, linkHlAppId, rxMessage, rxCount);
+    if (icr != Intercore_OK) {
+        ++stats.forwardFailures;
+        return;
+    }
+    ++stats.messagesFromMcu;
+}
+
+static PendingRequest *FindPendingRequest(MessageProtocol_Address address,
+                                          MessageProtocol_SequenceNumber sequenceNumber)
+{
+    for (size_t i = 0; i < MCU_LINK_MAX_PENDING_REQUESTS; ++i) {
+        PendingRequest *request = &pendingRequests[i];
+        const MessageProtocol_RequestHeader *header = &request->message.requestHeader;
+        if (request->inUse && header->messageHeaderWithType.address == address &&
+            header->sequenceNumber == sequenceNumber) {
+            return request;
+        }
+    }
+    return NULL;
+}
+
+// Stores a request so that it can be retransmitted. If every slot is in use, the oldest request
+// is replaced; it has most likely been timed out by the high-level application.
+static void StorePendingRequest(const uint8_t *message, size_t size)
+{
+    const MessageProtocol_RequestHeader *header = (const MessageProtocol_RequestHeader *)message;
+
+    PendingRequest *request =
+        FindPendingRequest(header->messageHeaderWithType.address, header->sequenceNumber);
+    for (size_t i = 0; request == NULL && i < MCU_LINK_MAX_PENDING_REQUESTS; ++i) {
+        if (!pendingRequests[i].inUse) {
+            request = &pendingRequests[i];
+        }
+    }
+    if (request == NULL) {
+        request = &pendingRequests[0];
+        for (size_t i = 1; i < MCU_LINK_MAX_PENDING_REQUESTS; ++i) {
+            if (nextStoredOrder - pendingRequests[i].storedOrder >
+                nextStoredOrder - request->storedOrder) {
+                request = &pendingRequests[i];
+            }
+        }
+    }
+
+    request->inUse = true;
+    request->retransmits = 0;
+    request->storedOrder = nextStoredOrder++;
+    request->size = size;
+    __builtin_memcpy(&request->message, message, size);
+}
+
+void McuLink_HandleIntercoreMessages(void)
+{
+    for (;;) {
+        ComponentId sender;
+        IntercoreSpans payload;
+
+        IntercoreResult icr = IntercorePeek(linkIcc, &sender, &payload);
+        if (icr != Intercore_OK) {
+            return;
+        }
+
+        size_t size = payload.firstSize + payload.secondSize;
+        if (size > sizeof(txMessage) || size < sizeof(MessageProtocol_MessageHeaderWithType)) {
+            ++stats.invalidMessages;
+            IntercoreRelease(linkIcc);
+            continue;
+        }
+
+        // Leave the message in the inbound buffer until the UART has room for all of it.
+        // HandleUartTxIrq runs this function again when the UART has drained.
+        if (IsuUart_GetTxSpace() < size) {
+            return;
+        }
+
+        __builtin_memcpy(txMessage, payload.first, payload.firstSize);
+        __builtin_memcpy(txMessage + payload.firstSize, payload.second, payload.secondSize);
+        IntercoreRelease(linkIcc);
+
+        const MessageProtocol_MessageHeaderWithType *headerWithType =
+            (const MessageProtocol_MessageHeaderWithType *)txMessage;
+        if (__builtin_memcmp(txMessage, MessageProtocol_MessagePreamble,
+                             sizeof(MessageProtocol_MessagePreamble)) != 0 ||
+            sizeof(MessageProtocol_MessageHeader) + headerWithType->messageHeader.length != size) {
+            ++stats.invalidMessages;
+            continue;
+        }
+
+        if (headerWithType->type == MessageProtocol_RequestMessageType &&
+            size >= sizeof(MessageProtocol_RequestHeader) &&
+            (((const MessageProtocol_RequestHeader *)txMessage)->flags &
+             MessageProtocol_Flag_Crc) != 0) {
+            StorePendingRequest(txMessage, size);
+        }
+
+        IsuUart_Write(txMessage, size);
+        ++stats.messagesToMcu;
+    }
+}
+
+void McuLink_Start(IntercoreComm *icc, const ComponentId *hlAppId)
+{
+    linkIcc = icc;
+    linkHlAppId = hlAppId;
+    IsuUart_Init(HandleUartRxIrq, HandleUartTxIrq);
+
+    // Messages which the high-level application sent before the link started are written now.
+    EnqueueDeferredProc(&txCbNode);
+}
+
+const McuLinkStats *McuLink_GetStats(void)
+{
+    return &stats;
+}
@@ -0,0 +1,87 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "logical-intercore.h"
+
+// The MCU link owns the UART which connects to an external MCU, and handles the serial side of
+// the message protocol, so that the high-level application only handles complete messages:
+//
+//  - It finds the preamble of each message from the MCU, collects the message, and discards data
+//    which is not part of a valid message, including a partial message after which the MCU has
+//    been silent for longer than MCU_LINK_PARTIAL_TIMEOUT_US.
+//  - It checks the CRC trailer of each response which has one, and discards a corrupted one.
+//  - When the MCU answers a request with MessageProtocol_ResponseResult_CrcError, it retransmits
+//    the request, up to MCU_LINK_MAX_RETRANSMITS times, before it passes the error on.
+//  - It passes each other message to the high-level application as one intercore message, and
+//    writes each message from the high-level application to the UART as it is.
+//
+// The high-level application still matches responses to requests and times out requests, so it
+// uses the message protocol library with the intercore transport in place of the UART transport.
+
+/// <summary>
+///     Time in microseconds after the last byte of a partial message at which it is discarded.
+/// </summary>
+#define MCU_LINK_PARTIAL_TIMEOUT_US (10 * 1000)
+
+/// <summary>
+///     Number of times a request is retransmitted when the MCU reports that it was corrupted.
+/// </summary>
+#define MCU_LINK_MAX_RETRANSMITS 3
+
+/// <summary>
+///     Number of requests with a CRC trailer which are kept so that they can be retransmitted.
+///     This should be at least the high-level application's MAX_OUTSTANDING_REQUESTS.
+/// </summary>
+#define MCU_LINK_MAX_PENDING_REQUESTS 4
+
+/// <summary>Counters of the traffic on the MCU link.</summary>
+typedef struct {
+    /// <summary>Messages from the MCU which were passed to the high-level application.</summary>
+    uint32_t messagesFromMcu;
+    /// <summary>Messages from the high-level application which were written to the UART.</summary>
+    uint32_t messagesToMcu;
+    /// <summary>Bytes from the MCU which were discarded because they were not part of a valid
+    /// message.</summary>
+    uint32_t discardedBytes;
+    /// <summary>Partial messages which were discarded because the MCU fell silent.</summary>
+    uint32_t partialTimeouts;
+    /// <summary>Responses which were discarded because their CRC was wrong.</summary>
+    uint32_t crcErrors;
+    /// <summary>Requests which were retransmitted because the MCU reported a CRC error.</summary>
+    uint32_t retransmits;
+    /// <summary>Messages from the MCU which were lost because the outbound intercore buffer was
+    /// full.</summary>
+    uint32_t forwardFailures;
+    /// <summary>Messages from the high-level application which were discarded because they were
+    /// not valid.</summary>
+    uint32_t invalidMessages;
+} McuLinkStats;
+
+/// <summary>
+///     <para>Initializes the UART and starts exchanging messages between it and the high-level
+///     application.</para>
+///     <para>The application must call <see cref="InitSoftTimers" /> first, must pass
+///     <see cref="McuLink_HandleIntercoreMessages" /> to <see cref="SetupIntercoreComm" />, and
+///     must call <see cref="InvokeDeferredProcs" />.</para>
+/// </summary>
+/// <param name="icc">Handle which was initialized by <see cref="SetupIntercoreComm" />.</param>
+/// <param name="hlAppId">Component ID of the high-level application. This object must exist
+/// while the link is running.</param>
+void McuLink_Start(IntercoreComm *icc, const ComponentId *hlAppId);
+
+/// <summary>
+///     Writes the messages from the high-level application to the UART. Pass this function to
+///     <see cref="SetupIntercoreComm" />. It runs in a DPC. A message is left in the inbound
+///     buffer until there is room for it in the UART's transmit buffer.
+/// </summary>
+void McuLink_HandleIntercoreMessages(void);
+
+/// <summary>
+///     Gets the counters of the traffic on the link.
+/// </summary>
+/// <returns>Counters which remain owned by the link.</returns>
+const McuLinkStats *McuLink_GetStats(void);
@@ -0,0 +1,145 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include "logical-timer.h"
+
+// Hardware timer which is programmed to expire at the earliest deadline.
+static TimerGpt hardwareTimer = TimerGpt0;
+
+// Running timers, sorted by deadline. Only modified with IRQs blocked.
+static SoftTimer *timers = NULL;
+
+static bool IsBefore(uint32_t a, uint32_t b);
+static void InsertTimer(SoftTimer *timer);
+static void RemoveTimer(SoftTimer *timer);
+static void ArmHardwareTimer(void);
+static void HandleHardwareTimerIrq(void);
+
+// Deadlines wrap around, so they are compared by their signed difference. This is correct
+// while every deadline is less than 2^31 microseconds from the current time.
+static bool IsBefore(uint32_t a, uint32_t b)
+{
+    return (int32_t)(a - b) < 0;
+}
+
+// Inserts a timer after any which have the same deadline, so they expire in the order in which
+// they were started. Must be called with IRQs blocked.
+static void InsertTimer(SoftTimer *timer)
+{
+    SoftTimer **link = &timers;
+    while (*link && !IsBefore(timer->deadlineUs, (*link)->deadlineUs)) {
+        link = &(*link)->next;
+    }
+
+    timer->next = *link;
+    *link = timer;
+    timer->active = true;
+}
+
+// Must be called with IRQs blocked.
+static void RemoveTimer(SoftTimer *timer)
+{
+    if (!timer->active) {
+        return;
+    }
+
+    for (SoftTimer **link = &timers; *link; link = &(*link)->next) {
+        if (*link == timer) {
+            *link = timer->next;
+            break;
+        }
+    }
+
+    timer->next = NULL;
+    timer->active = false;
+}
+
+// Programs the hardware timer to expire at the earliest deadline. If no timers are running,
+// the hardware timer is left alone; if it expires, the interrupt handler finds nothing to do.
+// Must be called with IRQs blocked.
+static void ArmHardwareTimer(void)
+{
+    if (!timers) {
+        return;
+    }
+
+    int32_t remainingUs = (int32_t)(timers->deadlineUs - MT3620_Gpt_ReadMicroseconds());
+
+    // Round up, so the hardware timer does not expire before the deadline.
+    uint32_t ticks = 1;
+    if (remainingUs > 0) {
+        ticks = (uint32_t)(((uint64_t)remainingUs * TIMER_GPT_32K_HZ + 999999) / 1000000);
+    }
+
+    MT3620_Gpt_LaunchTimer32k(hardwareTimer, ticks, HandleHardwareTimerIrq);
+}
+
+// Runs in IRQ context when the hardware timer expires. Invokes the callback of each timer whose
+// deadline has passed, with IRQs unblocked so the callbacks can start and stop timers.
+static void HandleHardwareTimerIrq(void)
+{
+    for (;;) {
+        uint32_t prevBasePri = BlockIrqs();
+        SoftTimer *timer = timers;
+        uint32_t nowUs = MT3620_Gpt_ReadMicroseconds();
+        if (!timer || IsBefore(nowUs, timer->deadlineUs)) {
+            ArmHardwareTimer();
+            RestoreIrqs(prevBasePri);
+            return;
+        }
+
+        timers = timer->next;
+        timer->next = NULL;
+        timer->active = false;
+
+        // A periodic timer keeps its phase, unless it has fallen more than a period behind,
+        // in which case the missed expirations are skipped rather than invoked back-to-back.
+        if (timer->periodUs != 0) {
+            timer->deadlineUs += timer->periodUs;
+            if (IsBefore(timer->deadlineUs, nowUs)) {
+                timer->deadlineUs = nowUs + timer->periodUs;
+            }
+            InsertTimer(timer);
+        }
+
+        Callback cb = timer->cb;
+        RestoreIrqs(prevBasePri);
+
+        cb();
+    }
+}
+
+void InitSoftTimers(TimerGpt gpt)
+{
+    hardwareTimer = gpt;
+    timers = NULL;
+}
+
+void StartSoftTimer(SoftTimer *timer, uint32_t delayUs, uint32_t periodUs)
+{
+    if (delayUs > SOFT_TIMER_MAX_US) {
+        delayUs = SOFT_TIMER_MAX_US;
+    }
+    if (periodUs > SOFT_TIMER_MAX_US) {
+        periodUs = SOFT_TIMER_MAX_US;
+    }
+
+    uint32_t prevBasePri = BlockIrqs();
+    RemoveTimer(timer);
+    timer->deadlineUs = MT3620_Gpt_ReadMicroseconds() + delayUs;
+    timer->periodUs = periodUs;
+    InsertTimer(timer);
+
+    // Only an earlier deadline requires the hardware timer to be reprogrammed.
+    if (timers == timer) {
+        ArmHardwareTimer();
+    }
+    RestoreIrqs(prevBasePri);
+}
+
+void StopSoftTimer(SoftTimer *timer)
+{
+    uint32_t prevBasePri = BlockIrqs();
+    RemoveTimer(timer);
+    RestoreIrqs(prevBasePri);
+}
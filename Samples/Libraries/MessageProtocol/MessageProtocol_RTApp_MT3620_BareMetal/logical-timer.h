@@ -0,0 +1,79 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "mt3620-baremetal.h" // for Callback
+#include "mt3620-timer.h"     // for TimerGpt
+
+/// <summary>
+///     <para>
+///         A software timer. Any number of software timers can run at once, all driven by a
+///         single hardware timer which <see cref="InitSoftTimers" /> reserves for them.
+///     </para>
+///     <para>The application should not modify this object after it has been initialized.</para>
+/// </summary>
+typedef struct SoftTimer {
+    /// <summary>Internal use. Initialize to NULL.</summary>
+    struct SoftTimer *next;
+    /// <summary>Internal use. Initialize to false.</summary>
+    bool active;
+    /// <summary>Internal use. Time in microseconds at which the timer next expires.</summary>
+    uint32_t deadlineUs;
+    /// <summary>Internal use. Period in microseconds, or 0 for a one-shot timer.</summary>
+    uint32_t periodUs;
+    /// <summary>
+    ///     Initialize to callback function which is invoked in interrupt context when
+    ///     the timer expires.
+    /// </summary>
+    Callback cb;
+} SoftTimer;
+
+/// <summary>Longest delay or period, in microseconds, which a software timer supports.</summary>
+#define SOFT_TIMER_MAX_US (UINT32_C(1) << 30)
+
+/// <summary>
+///     <para>
+///         Reserves a hardware timer to drive the software timers. The application must not use
+///         that hardware timer for anything else. Call this once, after
+///         <see cref="MT3620_Gpt_Init" />, and before any software timer is started.
+///     </para>
+///     <para>
+///         Time is measured with the free-running microsecond counter, and the hardware timer
+///         is programmed with its 32kHz clock, so a timer expires within about 30 microseconds
+///         of its deadline, plus any time for which interrupts are blocked.
+///     </para>
+/// </summary>
+/// <param name="gpt">Hardware timer to use.</param>
+void InitSoftTimers(TimerGpt gpt);
+
+/// <summary>
+///     <para>
+///         Starts a software timer, or restarts it if it is already running. The callback runs
+///         in interrupt context, so it will typically enqueue a DPC with
+///         <see cref="EnqueueDeferredProc" />.
+///     </para>
+///     <para>This function can be called from the main application thread, from a DPC, or from
+///     interrupt context, including from a software timer callback.</para>
+/// </summary>
+/// <param name="timer">
+///     Timer to start. This object must exist until the timer has expired or been stopped.
+/// </param>
+/// <param name="delayUs">
+///     Microseconds until the timer first expires, at most SOFT_TIMER_MAX_US.
+/// </param>
+/// <param name="periodUs">
+///     Microseconds between subsequent expirations, at most SOFT_TIMER_MAX_US; or 0 if the
+///     timer expires only once.
+/// </param>
+void StartSoftTimer(SoftTimer *timer, uint32_t delayUs, uint32_t periodUs);
+
+/// <summary>
+///     Stops a software timer. If it is not running, this function has no effect. The callback
+///     will not be invoked after this function returns, unless the timer is started again.
+/// </summary>
+/// <param name="timer">Timer to stop.</param>
+void StopSoftTimer(SoftTimer *timer);
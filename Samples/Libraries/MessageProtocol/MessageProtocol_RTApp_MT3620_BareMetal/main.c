@@ -0,0 +1,167 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// This sample C application for the real-time core owns the UART which connects to an external
+// MCU, and exchanges message protocol messages between it and a high-level application, which
+// uses the intercore transport of the message protocol library. It finds the preamble of each
+// message from the MCU, checks its CRC, retransmits requests which the MCU reports as corrupted,
+// and passes each complete message on, so that the high-level application is not woken for
+// every burst of bytes on the UART.
+//
+// It demonstrates the following hardware
+// - ISU0 UART (used to communicate with the external MCU)
+// - UART (used to write the link statistics via the built-in UART)
+// - mailbox (used to report buffer sizes and send / receive events)
+// - timer (used to time out partial messages and to report the statistics)
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "logical-dpc.h"
+#include "logical-intercore.h"
+#include "logical-mcu-link.h"
+#include "logical-timer.h"
+
+#include "mt3620-baremetal.h"
+#include "mt3620-isu-uart.h"
+#include "mt3620-uart.h"
+#include "mt3620-intercore.h"
+#include "mt3620-timer.h"
+
+extern uint32_t StackTop; // &StackTop == end of TCM
+
+static IntercoreComm icc;
+
+// The component ID for the ExternalMcuLowPower sample's high-level application. To use the link
+// from another application, set its component ID here and in app_manifest.json, and add this
+// application's component ID to its AllowedApplicationConnections.
+static const ComponentId hlAppId = {.data1 = 0x55286fbe,
+                                    .data2 = 0x3ec7,
+                                    .data3 = 0x4a16,
+                                    .data4 = {0xf9, 0x97, 0x6e, 0x06, 0x70, 0xfc, 0x97, 0xe2}};
+
+// The link statistics are written to the debug UART this often.
+static const uint32_t statsPeriodUs = 10 * 1000 * 1000;
+
+static _Noreturn void DefaultExceptionHandler(void);
+static void HandleStatsTimerIrq(void);
+static void HandleStatsTimerDeferred(void);
+static void WriteCounter(const char *name, uint32_t value);
+static _Noreturn void RTCoreMain(void);
+
+static SoftTimer statsTimer = {.next = NULL, .active = false, .cb = HandleStatsTimerIrq};
+static CallbackNode statsCbNode = {
+    .enqueued = false, .cb = HandleStatsTimerDeferred, .priority = DpcPriority_Low};
+
+// ARM DDI0403E.d SB1.5.2-3
+// From SB1.5.3, "The Vector table must be naturally aligned to a power of two whose alignment
+// value is greater than or equal to (Number of Exceptions supported x 4), with a minimum alignment
+// of 128 bytes.". The array is aligned in linker.ld, using the dedicated section ".vector_table".
+
+// The exception vector table contains a stack pointer, 15 exception handlers, and an entry for
+// each interrupt.
+#define INTERRUPT_COUNT 100 // from datasheet
+#define EXCEPTION_COUNT (16 + INTERRUPT_COUNT)
+#define INT_TO_EXC(i_) (16 + (i_))
+const uintptr_t ExceptionVectorTable[EXCEPTION_COUNT] __attribute__((section(".vector_table")))
+__attribute__((used)) = {
+    [0] = (uintptr_t)&StackTop,                // Main Stack Pointer (MSP)
+    [1] = (uintptr_t)RTCoreMain,               // Reset
+    [2] = (uintptr_t)DefaultExceptionHandler,  // NMI
+    [3] = (uintptr_t)DefaultExceptionHandler,  // HardFault
+    [4] = (uintptr_t)DefaultExceptionHandler,  // MPU Fault
+    [5] = (uintptr_t)DefaultExceptionHandler,  // Bus Fault
+    [6] = (uintptr_t)DefaultExceptionHandler,  // Usage Fault
+    [11] = (uintptr_t)DefaultExceptionHandler, // SVCall
+    [12] = (uintptr_t)DefaultExceptionHandler, // Debug monitor
+    [14] = (uintptr_t)DefaultExceptionHandler, // PendSV
+    [15] = (uintptr_t)DefaultExceptionHandler, // SysTick
+
+    [INT_TO_EXC(0)] = (uintptr_t)DefaultExceptionHandler,
+    [INT_TO_EXC(1)] = (uintptr_t)MT3620_Gpt_HandleIrq1,
+    [INT_TO_EXC(2)... INT_TO_EXC(3)] = (uintptr_t)DefaultExceptionHandler,
+    [INT_TO_EXC(4)] = (uintptr_t)Uart_HandleIrq4,
+    [INT_TO_EXC(5)... INT_TO_EXC(10)] = (uintptr_t)DefaultExceptionHandler,
+    [INT_TO_EXC(11)] = (uintptr_t)MT3620_HandleMailboxIrq11,
+    [INT_TO_EXC(12)... INT_TO_EXC(46)] = (uintptr_t)DefaultExceptionHandler,
+    [INT_TO_EXC(47)] = (uintptr_t)IsuUart_HandleIrq47,
+    [INT_TO_EXC(48)... INT_TO_EXC(INTERRUPT_COUNT - 1)] = (uintptr_t)DefaultExceptionHandler};
+
+// If the applications end up in this function then an unexpected exception has occurred.
+static _Noreturn void DefaultExceptionHandler(void)
+{
+    for (;;) {
+        // empty.
+    }
+}
+
+// Runs in IRQ context.
+static void HandleStatsTimerIrq(void)
+{
+    EnqueueDeferredProc(&statsCbNode);
+}
+
+// Queued by HandleStatsTimerIrq. Writing to the debug UART is slow, so this runs at low
+// priority, after the link's own DPCs.
+static void HandleStatsTimerDeferred(void)
+{
+    const McuLinkStats *stats = McuLink_GetStats();
+
+    Uart_WriteString("MCU link:");
+    WriteCounter("from MCU", stats->messagesFromMcu);
+    WriteCounter("to MCU", stats->messagesToMcu);
+    WriteCounter("discarded bytes", stats->discardedBytes);
+    WriteCounter("partial timeouts", stats->partialTimeouts);
+    WriteCounter("CRC errors", stats->crcErrors);
+    WriteCounter("retransmits", stats->retransmits);
+    WriteCounter("forward failures", stats->forwardFailures);
+    WriteCounter("invalid", stats->invalidMessages);
+    WriteCounter("UART overruns", IsuUart_GetRxOverrunCount());
+    Uart_WriteString("\r\n");
+}
+
+static void WriteCounter(const char *name, uint32_t value)
+{
+    Uart_WriteString(" ");
+    Uart_WriteString(name);
+    Uart_WriteString("=");
+    Uart_WriteInteger((int)value);
+}
+
+static _Noreturn void RTCoreMain(void)
+{
+    // The debugger will not connect until shortly after the application has started running.
+    // To use the debugger with code which runs at application startup, change the initial value
+    // of b from true to false, run the app, break into the app with a debugger, and set b to true.
+    volatile bool b = true;
+    while (!b) {
+        // empty.
+    }
+
+    // SCB->VTOR = ExceptionVectorTable
+    WriteReg32(SCB_BASE, 0x08, (uint32_t)ExceptionVectorTable);
+
+    Uart_Init();
+    Uart_WriteString("--------------------------------\r\n");
+    Uart_WriteString("MessageProtocol_RTApp_MT3620_BareMetal\r\n");
+    Uart_WriteString("App built on: " __DATE__ ", " __TIME__ "\r\n");
+
+    MT3620_Gpt_Init();
+    InitSoftTimers(TimerGpt0);
+
+    IntercoreResult icr = SetupIntercoreComm(&icc, McuLink_HandleIntercoreMessages);
+    if (icr != Intercore_OK) {
+        Uart_WriteString("SetupIntercoreComm: ");
+        Uart_WriteInteger(icr);
+        Uart_WriteString("\r\n");
+    } else {
+        McuLink_Start(&icc, &hlAppId);
+        StartSoftTimer(&statsTimer, statsPeriodUs, statsPeriodUs);
+    }
+
+    for (;;) {
+        InvokeDeferredProcs();
+        WaitForDeferredProcs();
+    }
+}
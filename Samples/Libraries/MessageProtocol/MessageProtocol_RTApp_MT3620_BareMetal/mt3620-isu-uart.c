@@ -0,0 +1,173 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <stdbool.h>
+
+#include "mt3620-baremetal.h"
+#include "mt3620-isu-uart.h"
+
+// The ISU0 UART has the same registers as the debug UART.
+static const uintptr_t UART_BASE = 0x38070500;
+
+// The ISU0 UART interrupt.
+static const int UART_IRQ = 47;
+
+// Register offsets.
+static const size_t UART_RBR = 0x00; // read
+static const size_t UART_THR = 0x00; // write
+static const size_t UART_IER = 0x04;
+static const size_t UART_IIR = 0x08; // read
+static const size_t UART_FCR = 0x08; // write
+static const size_t UART_LSR = 0x14;
+
+// IER[0] enables the interrupt which fires when data has been received, and IER[1] the one which
+// fires when the transmit FIFO is empty.
+static const uint32_t UART_IER_ERBFI = 1U << 0;
+static const uint32_t UART_IER_ETBEI = 1U << 1;
+// LSR[0] is set while the receive FIFO holds data, LSR[1] when it has overflowed, and LSR[5]
+// when the transmit FIFO is empty.
+static const uint32_t UART_LSR_DR = 1U << 0;
+static const uint32_t UART_LSR_OE = 1U << 1;
+static const uint32_t UART_LSR_THRE = 1U << 5;
+// Number of bytes which can be written to the empty transmit FIFO.
+static const uint32_t UART_TX_FIFO_DEPTH = 16;
+
+_Static_assert((ISU_UART_RX_BUFFER_SIZE & (ISU_UART_RX_BUFFER_SIZE - 1)) == 0,
+               "ISU_UART_RX_BUFFER_SIZE must be a power of two");
+_Static_assert((ISU_UART_TX_BUFFER_SIZE & (ISU_UART_TX_BUFFER_SIZE - 1)) == 0,
+               "ISU_UART_TX_BUFFER_SIZE must be a power of two");
+
+// The positions increase without bound and are reduced modulo the buffer size when used, so
+// the number of queued bytes is always the write position less the read position. Each
+// position is only written by one side: the interrupt handler or the application.
+static uint8_t rxBuffer[ISU_UART_RX_BUFFER_SIZE];
+static volatile uint32_t rxWritePosition = 0;
+static volatile uint32_t rxReadPosition = 0;
+static volatile uint32_t rxOverrunCount = 0;
+
+static uint8_t txBuffer[ISU_UART_TX_BUFFER_SIZE];
+static volatile uint32_t txWritePosition = 0;
+static volatile uint32_t txReadPosition = 0;
+
+static Callback rxCallback = NULL;
+static Callback txCallback = NULL;
+
+void IsuUart_Init(Callback rxCb, Callback txCb)
+{
+    rxCallback = rxCb;
+    txCallback = txCb;
+    rxWritePosition = 0;
+    rxReadPosition = 0;
+    rxOverrunCount = 0;
+    txWritePosition = 0;
+    txReadPosition = 0;
+
+    // Configure UART to use 115200-8-N-1, with the same clock settings as the debug UART.
+    WriteReg32(UART_BASE, 0x0C, 0x80); // LCR (enable DLL, DLM)
+    WriteReg32(UART_BASE, 0x24, 0x3);  // HIGHSPEED
+    WriteReg32(UART_BASE, 0x04, 0);    // Divisor Latch (MS)
+    WriteReg32(UART_BASE, 0x00, 1);    // Divisor Latch (LS)
+    WriteReg32(UART_BASE, 0x28, 224);  // SAMPLE_COUNT
+    WriteReg32(UART_BASE, 0x2C, 110);  // SAMPLE_POINT
+    WriteReg32(UART_BASE, 0x58, 0);    // FRACDIV_M
+    WriteReg32(UART_BASE, 0x54, 223);  // FRACDIV_L
+    WriteReg32(UART_BASE, 0x0C, 0x03); // LCR (8-bit word length)
+
+    // Enable and clear the FIFOs, and enable the receive interrupt. The transmit interrupt is
+    // left disabled until there is something to send.
+    WriteReg32(UART_BASE, UART_FCR, 0x07);
+    WriteReg32(UART_BASE, UART_IER, UART_IER_ERBFI);
+
+    SetNvicPriority(UART_IRQ, ISU_UART_PRIORITY);
+    EnableNvicInterrupt(UART_IRQ);
+}
+
+size_t IsuUart_Read(uint8_t *buffer, size_t size)
+{
+    uint32_t readPosition = rxReadPosition;
+    uint32_t available = rxWritePosition - readPosition;
+    size_t count = (available < size) ? available : size;
+    for (size_t i = 0; i < count; ++i) {
+        buffer[i] = rxBuffer[readPosition++ % ISU_UART_RX_BUFFER_SIZE];
+    }
+    rxReadPosition = readPosition;
+    return count;
+}
+
+size_t IsuUart_GetTxSpace(void)
+{
+    return ISU_UART_TX_BUFFER_SIZE - (txWritePosition - txReadPosition);
+}
+
+bool IsuUart_Write(const uint8_t *data, size_t size)
+{
+    if (size > IsuUart_GetTxSpace()) {
+        return false;
+    }
+
+    uint32_t writePosition = txWritePosition;
+    for (size_t i = 0; i < size; ++i) {
+        txBuffer[writePosition++ % ISU_UART_TX_BUFFER_SIZE] = data[i];
+    }
+    txWritePosition = writePosition;
+
+    // The interrupt handler clears ETBEI, so block it while the bit is set.
+    uint32_t prevBasePri = BlockIrqs();
+    SetReg32(UART_BASE, UART_IER, UART_IER_ETBEI);
+    RestoreIrqs(prevBasePri);
+    return true;
+}
+
+uint32_t IsuUart_GetRxOverrunCount(void)
+{
+    return rxOverrunCount;
+}
+
+void IsuUart_HandleIrq47(void)
+{
+    // Reading IIR acknowledges the interrupt. The receive FIFO is drained and the transmit FIFO
+    // refilled each time, so there is no need to distinguish the cause.
+    (void)ReadReg32(UART_BASE, UART_IIR);
+
+    bool received = false;
+    uint32_t lsr;
+    while ((lsr = ReadReg32(UART_BASE, UART_LSR)) & UART_LSR_DR) {
+        if (lsr & UART_LSR_OE) {
+            ++rxOverrunCount;
+        }
+
+        uint8_t b = (uint8_t)ReadReg32(UART_BASE, UART_RBR);
+        uint32_t writePosition = rxWritePosition;
+        if (writePosition - rxReadPosition == ISU_UART_RX_BUFFER_SIZE) {
+            ++rxOverrunCount;
+            continue;
+        }
+        rxBuffer[writePosition % ISU_UART_RX_BUFFER_SIZE] = b;
+        rxWritePosition = writePosition + 1;
+        received = true;
+    }
+
+    if (received && rxCallback != NULL) {
+        rxCallback();
+    }
+
+    if (!(lsr & UART_LSR_THRE) || !(ReadReg32(UART_BASE, UART_IER) & UART_IER_ETBEI)) {
+        return;
+    }
+
+    uint32_t readPosition = txReadPosition;
+    uint32_t writePosition = txWritePosition;
+    for (uint32_t i = 0; i < UART_TX_FIFO_DEPTH && readPosition != writePosition; ++i) {
+        WriteReg32(UART_BASE, UART_THR, txBuffer[readPosition++ % ISU_UART_TX_BUFFER_SIZE]);
+    }
+    txReadPosition = readPosition;
+
+    // Stop the interrupt when there is nothing left to send. It is enabled again by
+    // IsuUart_Write.
+    if (readPosition == writePosition) {
+        ClearReg32(UART_BASE, UART_IER, UART_IER_ETBEI);
+        if (txCallback != NULL) {
+            txCallback();
+        }
+    }
+}
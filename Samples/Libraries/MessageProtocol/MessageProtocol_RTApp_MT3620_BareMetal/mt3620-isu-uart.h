@@ -0,0 +1,74 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mt3620-baremetal.h" // for Callback
+
+/// <summary>
+///     Number of received bytes which can wait to be read. When the buffer is full, further
+///     bytes are discarded. Must be a power of two.
+/// </summary>
+#define ISU_UART_RX_BUFFER_SIZE 1024
+
+/// <summary>
+///     Number of bytes which can wait to be transmitted. Must be a power of two.
+/// </summary>
+#define ISU_UART_TX_BUFFER_SIZE 1024
+
+/// <summary>The ISU0 UART interrupt runs at this priority level.</summary>
+static const uint32_t ISU_UART_PRIORITY = 2;
+
+/// <summary>
+///     <para>Initialize the ISU0 UART with 115200-8-N-1 and no flow control, and enable its
+///     interrupt. The application manifest must list ISU0 in its Uart capability.</para>
+///     <para>The callbacks run in interrupt context, so they will typically enqueue a DPC with
+///     <see cref="EnqueueDeferredProc" />.</para>
+/// </summary>
+/// <param name="rxCallback">Called when bytes have been received.</param>
+/// <param name="txCallback">Called when every queued byte has been written to the UART's
+/// FIFO, so that more can be queued.</param>
+void IsuUart_Init(Callback rxCallback, Callback txCallback);
+
+/// <summary>
+///     Read bytes which have been received. Call this from the main application thread or
+///     from a DPC.
+/// </summary>
+/// <param name="buffer">Receives the bytes.</param>
+/// <param name="size">Size of the buffer in bytes.</param>
+/// <returns>Number of bytes which were read.</returns>
+size_t IsuUart_Read(uint8_t *buffer, size_t size);
+
+/// <summary>
+///     Get the number of bytes which can be queued with <see cref="IsuUart_Write" />.
+/// </summary>
+/// <returns>The free space in the transmit buffer in bytes.</returns>
+size_t IsuUart_GetTxSpace(void);
+
+/// <summary>
+///     Queue bytes to be written to the UART, if they all fit in the transmit buffer. This
+///     function does not wait for them to be transmitted; the UART interrupt sends them in the
+///     background. Call this from the main application thread or from a DPC.
+/// </summary>
+/// <param name="data">The bytes.</param>
+/// <param name="size">Number of bytes.</param>
+/// <returns>true if the bytes were queued; false if they did not fit, in which case nothing is
+/// queued.</returns>
+bool IsuUart_Write(const uint8_t *data, size_t size);
+
+/// <summary>
+///     Get the number of received bytes which were discarded because the receive buffer or
+///     the UART's FIFO was full.
+/// </summary>
+/// <returns>Number of discarded bytes since the UART was initialized.</returns>
+uint32_t IsuUart_GetRxOverrunCount(void);
+
+/// <summary>
+///     Install this function as the INT47 handler in the exception table. Applications should
+///     not call this function directly.
+/// </summary>
+void IsuUart_HandleIrq47(void);
@@ -0,0 +1,105 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <stdbool.h>
+
+#include "mt3620-baremetal.h"
+#include "mt3620-timer.h"
+
+static const uintptr_t GPT_BASE = 0x21030000;
+
+// GPT3 is a free-running counter. GPT3_CTRL[21:16] is the number of oscillator cycles in one
+// microsecond, less one, so with the 26MHz crystal the counter increments once a microsecond.
+static const size_t GPT3_CTRL = 0x50;
+static const size_t GPT3_CNT = 0x58;
+static const uint32_t GPT3_OSC_CNT_1US = 26 - 1;
+
+// GPTx_CTRL values which start a one-shot timer that is automatically cleared when it expires.
+static const uint32_t GPT_CTRL_ONE_SHOT_1KHZ = 0x9;
+static const uint32_t GPT_CTRL_ONE_SHOT_32KHZ = 0x1;
+
+static void LaunchTimer(TimerGpt gpt, uint32_t count, uint32_t ctrl, Callback callback);
+
+static volatile Callback timerCallbacks[TIMER_GPT_COUNT] = {[TimerGpt0] = NULL, [TimerGpt1] = NULL};
+
+typedef struct {
+    size_t ctrlRegOffset;
+    size_t icntRegOffset;
+} GptInfo;
+
+static const GptInfo gptRegOffsets[TIMER_GPT_COUNT] = {
+    [TimerGpt0] = {.ctrlRegOffset = 0x10, .icntRegOffset = 0x14},
+    [TimerGpt1] = {.ctrlRegOffset = 0x20, .icntRegOffset = 0x24}};
+
+void MT3620_Gpt_Init(void)
+{
+    // Enable INT1 in the NVIC. This allows the processor to receive an interrupt
+    // from GPT0 or GPT1. The interrupt for the specific timer is enabled in Gpt_LaunchTimerMs.
+
+    // IO CM4 GPT0 timer and GPT1 timer interrupt both use INT1.
+    SetNvicPriority(1, GPT_PRIORITY);
+    EnableNvicInterrupt(1);
+
+    // Start the free-running microsecond counter.
+    WriteReg32(GPT_BASE, GPT3_CTRL, (GPT3_OSC_CNT_1US << 16) | 0x01);
+}
+
+void MT3620_Gpt_HandleIrq1(void)
+{
+    // GPT_ISR -> read, clear interrupts.
+    uint32_t activeIrqs = ReadReg32(GPT_BASE, 0x00);
+    WriteReg32(GPT_BASE, 0x00, activeIrqs);
+
+    // Do not need to disable interrupts or timer because only used in one-shot mode.
+    for (int gpt = 0; gpt < TIMER_GPT_COUNT; ++gpt) {
+        uint32_t mask = UINT32_C(1) << gpt;
+        if ((activeIrqs & mask) == 0) {
+            continue;
+        }
+
+        timerCallbacks[gpt]();
+    }
+}
+
+void MT3620_Gpt_LaunchTimerMs(TimerGpt gpt, uint32_t periodMs, Callback callback)
+{
+    // GPTx_ICNT = delay in milliseconds (assuming 1KHz clock in GPTx_CTRL).
+    // Note 1KHz is approximate - the precise value depends on the clock source,
+    // but it will be 0.99kHz to 2 decimal places.
+    LaunchTimer(gpt, periodMs, GPT_CTRL_ONE_SHOT_1KHZ, callback);
+}
+
+void MT3620_Gpt_LaunchTimer32k(TimerGpt gpt, uint32_t ticks, Callback callback)
+{
+    LaunchTimer(gpt, ticks, GPT_CTRL_ONE_SHOT_32KHZ, callback);
+}
+
+uint32_t MT3620_Gpt_ReadMicroseconds(void)
+{
+    return ReadReg32(GPT_BASE, GPT3_CNT);
+}
+
+static void LaunchTimer(TimerGpt gpt, uint32_t count, uint32_t ctrl, Callback callback)
+{
+    timerCallbacks[gpt] = callback;
+
+    uint32_t mask = UINT32_C(1) << gpt;
+
+    // GPTx_CTRL[0] = 0 -> disable if already enabled.
+    ClearReg32(GPT_BASE, gptRegOffsets[gpt].ctrlRegOffset, 0x01);
+
+    // The interrupt enable bits for both timers are in the same register. Therefore,
+    // block timer ISRs to prevent an ISR from enabling a timer which is then disabled
+    // because this function writes a zero to that bit in the IER register.
+
+    uint32_t prevBasePri = BlockIrqs();
+    // GPT_IER[gpt] = 1 -> enable interrupt.
+    SetReg32(GPT_BASE, 0x04, mask);
+    RestoreIrqs(prevBasePri);
+
+    // GPTx_ICNT = delay in ticks of the clock which is selected in GPTx_CTRL.
+    WriteReg32(GPT_BASE, gptRegOffsets[gpt].icntRegOffset, count);
+
+    // GPTx_CTRL -> auto clear; clock speed, one shot, enable timer.
+    WriteReg32(GPT_BASE, gptRegOffsets[gpt].ctrlRegOffset, ctrl);
+}
@@ -0,0 +1,149 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+
+#include <applibs/application.h>
+#include <applibs/log.h>
+
+#include "intercore_transport.h"
+#include "message_protocol_private.h"
+
+// Largest message which is exchanged with the RTApp: a response, which is the largest type of
+// message.
+#define MAX_MESSAGE_SIZE sizeof(MessageProtocol_ResponseMessage)
+
+static EventLoop *eventLoopRef = NULL;
+static int sockFd = -1;
+static EventRegistration *sockEventRegistration = NULL;
+static IntercoreTransport_DataReadyCallback dataReadyCallback = NULL;
+
+// The message which was last received, and how much of it has been read.
+static uint8_t receivedMessage[MAX_MESSAGE_SIZE];
+static size_t receivedMessageLength = 0;
+static size_t receivedMessageRead = 0;
+
+static void SocketEventHandler(EventLoop *el, int fd, EventLoop_IoEvents events, void *context);
+
+/// <summary>
+/// Handle events from the socket. The callback is called again while part of a message remains to
+/// be read, because the socket does not signal that data.
+/// </summary>
+static void SocketEventHandler(EventLoop *el, int fd, EventLoop_IoEvents events, void *context)
+{
+    size_t remaining;
+    do {
+        remaining = receivedMessageLength - receivedMessageRead;
+        dataReadyCallback();
+    } while (receivedMessageRead < receivedMessageLength &&
+             receivedMessageLength - receivedMessageRead < remaining);
+}
+
+int IntercoreTransport_Initialize(EventLoop *eventLoop, const char *rtAppComponentId,
+                                  IntercoreTransport_DataReadyCallback receivedDataCallback)
+{
+    if (sockFd != -1) {
+        errno = EALREADY;
+        return -1;
+    }
+
+    eventLoopRef = eventLoop;
+    dataReadyCallback = receivedDataCallback;
+    receivedMessageLength = 0;
+    receivedMessageRead = 0;
+
+    sockFd = Application_Connect(rtAppComponentId);
+    if (sockFd == -1) {
+        Log_Debug("ERROR: Could not connect to the MCU RTApp: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+
+    sockEventRegistration =
+        EventLoop_RegisterIo(eventLoopRef, sockFd, EventLoop_Input, SocketEventHandler, NULL);
+    if (sockEventRegistration == NULL) {
+        Log_Debug("ERROR: Could not register the MCU RTApp socket event: %s (%d).\n",
+                  strerror(errno), errno);
+        int error = errno;
+        IntercoreTransport_Cleanup();
+        errno = error;
+        return -1;
+    }
+
+    return 0;
+}
+
+void IntercoreTransport_Cleanup(void)
+{
+    if (sockEventRegistration != NULL) {
+        EventLoop_UnregisterIo(eventLoopRef, sockEventRegistration);
+        sockEventRegistration = NULL;
+    }
+
+    if (sockFd != -1) {
+        close(sockFd);
+        sockFd = -1;
+    }
+}
+
+ssize_t IntercoreTransport_SendV(const struct iovec *iov, int iovcnt)
+{
+    if (sockFd == -1) {
+        return 0;
+    }
+
+    // The RTApp receives each message as a whole, so it is gathered into one buffer.
+    uint8_t message[MAX_MESSAGE_SIZE];
+    size_t length = 0;
+    for (int i = 0; i < iovcnt; ++i) {
+        if (iov[i].iov_len > sizeof(message) - length) {
+            Log_Debug("ERROR: Message for the MCU RTApp is too large.\n");
+            return 0;
+        }
+        memcpy(message + length, iov[i].iov_base, iov[i].iov_len);
+        length += iov[i].iov_len;
+    }
+
+    if (length == 0) {
+        return 0;
+    }
+
+    ssize_t bytesSent = send(sockFd, message, length, MSG_DONTWAIT);
+    if (bytesSent == -1) {
+        Log_Debug("ERROR: Could not send to the MCU RTApp: %s (%d).\n", strerror(errno), errno);
+        return 0;
+    }
+
+    return (ssize_t)length;
+}
+
+ssize_t IntercoreTransport_Read(char *buffer, size_t amount)
+{
+    if (receivedMessageRead == receivedMessageLength) {
+        ssize_t bytesReceived =
+            recv(sockFd, receivedMessage, sizeof(receivedMessage), MSG_DONTWAIT | MSG_TRUNC);
+        if (bytesReceived == -1) {
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        }
+
+        // The RTApp only sends complete messages, so one which is too large is not valid; the
+        // message protocol discards what is kept of it.
+        receivedMessageLength = ((size_t)bytesReceived > sizeof(receivedMessage))
+                                    ? sizeof(receivedMessage)
+                                    : (size_t)bytesReceived;
+        receivedMessageRead = 0;
+    }
+
+    size_t length = receivedMessageLength - receivedMessageRead;
+    if (length > amount) {
+        length = amount;
+    }
+    memcpy(buffer, receivedMessage + receivedMessageRead, length);
+    receivedMessageRead += length;
+    return (ssize_t)length;
+}
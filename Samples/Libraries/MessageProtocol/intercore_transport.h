@@ -0,0 +1,61 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <applibs/eventloop.h>
+
+// The intercore transport exchanges messages with an external MCU through a real-time capable
+// application, MessageProtocol_RTApp_MT3620_BareMetal, which owns the MCU's UART. The RTApp finds
+// the preamble of each message, checks its CRC, retransmits requests which the MCU reports as
+// corrupted, and passes only complete messages to this application, one message per intercore
+// message. The high-level application is therefore woken once per message, rather than for each
+// burst of bytes on the UART. It can be used in place of the UART transport, and has the same
+// read and write functions.
+
+typedef void (*IntercoreTransport_DataReadyCallback)(void);
+
+/// <summary>
+///     Connect to the RTApp which owns the MCU's UART. The application manifest must list the
+///     RTApp's component ID in AllowedApplicationConnections, and must not list the UART.
+/// </summary>
+/// <param name="eventLoop">Pointer to the main application EventLoop.</param>
+/// <param name="rtAppComponentId">Component ID of the RTApp.</param>
+/// <param name="receivedDataCallback">
+///     Function to call when a message is ready to be read.
+/// </param>
+/// <returns>0 on success, or -1 on failure, in which case errno is set to the error.</returns>
+int IntercoreTransport_Initialize(EventLoop *eventLoop, const char *rtAppComponentId,
+                                  IntercoreTransport_DataReadyCallback receivedDataCallback);
+
+/// <summary>
+///     Close the connection to the RTApp, and de-register its events from the EventLoop.
+/// </summary>
+void IntercoreTransport_Cleanup(void);
+
+/// <summary>
+///     Send a message, which is gathered from several buffers, to the RTApp, which writes it to
+///     the UART. The buffers may be reused as soon as this function returns.
+/// </summary>
+/// <param name="iov">The buffers holding the message, in order.</param>
+/// <param name="iovcnt">Number of entries in <paramref name="iov" />.</param>
+/// <returns>
+///     0 if the transport is not initialized, if there is no data, if the message is too large,
+///     or if the RTApp cannot accept it; otherwise, the total length of the message.
+/// </returns>
+ssize_t IntercoreTransport_SendV(const struct iovec *iov, int iovcnt);
+
+/// <summary>
+///     Read data which the RTApp has received from the MCU. This should be called upon receipt of
+///     a <see cref="IntercoreTransport_DataReadyCallback" />. If a message does not fit in the
+///     buffer, the rest of it is returned by the following calls, which the transport makes by
+///     calling the callback again.
+/// </summary>
+/// <param name="buffer">Buffer into which the data should be written.</param>
+/// <param name="amount">Amount of data to attempt to read.</param>
+/// <returns>The amount of data read, or -1 if the operation failed.</returns>
+ssize_t IntercoreTransport_Read(char *buffer, size_t amount);
@@ -0,0 +1,147 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Generates functions which encode the body of a message from a struct, and decode it into one,
+// field by field, so that the bytes on the wire do not depend on how a compiler lays out the
+// struct. Multi-byte integers are little-endian, and no padding is sent, so the Azure Sphere device
+// and the MCU firmware agree on the bytes whatever their compilers. This header has no
+// dependencies other than the C library, so the MCU firmware can include it.
+//
+// A message's fields are listed in a schema macro, which takes the macro to apply to each field,
+// and the struct type, and which is usually written with one field per line:
+//
+//     #define MY_MESSAGE_FIELDS(X, T) X(T, U32, tick, , 1) X(T, U8, button, , 1)
+//
+//     MESSAGE_CODEC_DEFINE(MyMessage, MyMessageStruct, MY_MESSAGE_FIELDS)
+//
+// Each field is X(T, kind, member, codec, version):
+// - kind is U8, I8, U16, I16 or U32 for integers; BYTES for an array of bytes, which is sent as
+//   it is; RESERVED for a member which is sent as zeros and ignored when it is received; NESTED for
+//   a member which is itself a struct with a codec; or NESTED_ARRAY for an array of such structs.
+// - codec names the codec of a NESTED or NESTED_ARRAY member, and is otherwise empty.
+// - version is the version of the message which added the field; the fields of the first version
+//   are 1.
+//
+// Fields may only be added at the end of a schema, with a higher version. Decode accepts a body
+// which is shorter than the current one, from a sender which has an older version, if it has all
+// the fields of version 1; the fields which it lacks are set to zero. It ignores bytes after the
+// last field which it knows, from a sender which has a newer version.
+//
+// MESSAGE_CODEC_DEFINE(Name, Type, FIELDS) generates:
+// - Name_EncodedSize, the number of bytes which Name_Encode writes;
+// - size_t Name_Encode(const Type *s, uint8_t *buffer), which writes Name_EncodedSize bytes to
+//   the buffer and returns that number;
+// - bool Name_Decode(Type *s, const uint8_t *data, size_t size), which returns false if the body
+//   is too short.
+
+/// <summary>Writes a 16-bit value, little-endian.</summary>
+static inline void MessageCodec_PutU16(uint8_t *p, uint16_t value)
+{
+    p[0] = (uint8_t)value;
+    p[1] = (uint8_t)(value >> 8);
+}
+
+/// <summary>Writes a 32-bit value, little-endian.</summary>
+static inline void MessageCodec_PutU32(uint8_t *p, uint32_t value)
+{
+    p[0] = (uint8_t)value;
+    p[1] = (uint8_t)(value >> 8);
+    p[2] = (uint8_t)(value >> 16);
+    p[3] = (uint8_t)(value >> 24);
+}
+
+/// <summary>Reads a 16-bit value, little-endian.</summary>
+static inline uint16_t MessageCodec_GetU16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+/// <summary>Reads a 32-bit value, little-endian.</summary>
+static inline uint32_t MessageCodec_GetU32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+           ((uint32_t)p[3] << 24);
+}
+
+// Number of bytes which each kind of field takes on the wire.
+#define MESSAGE_CODEC_SIZE_U8(T, m, codec) 1
+#define MESSAGE_CODEC_SIZE_I8(T, m, codec) 1
+#define MESSAGE_CODEC_SIZE_U16(T, m, codec) 2
+#define MESSAGE_CODEC_SIZE_I16(T, m, codec) 2
+#define MESSAGE_CODEC_SIZE_U32(T, m, codec) 4
+#define MESSAGE_CODEC_SIZE_BYTES(T, m, codec) sizeof(((T *)0)->m)
+#define MESSAGE_CODEC_SIZE_RESERVED(T, m, codec) sizeof(((T *)0)->m)
+#define MESSAGE_CODEC_SIZE_NESTED(T, m, codec) codec##_EncodedSize
+#define MESSAGE_CODEC_SIZE_NESTED_ARRAY(T, m, codec) \
+    (codec##_EncodedSize * (sizeof(((T *)0)->m) / sizeof(((T *)0)->m[0])))
+
+// Writes a field at p.
+#define MESSAGE_CODEC_PUT_U8(p, v, codec) *(p) = (uint8_t)(v)
+#define MESSAGE_CODEC_PUT_I8(p, v, codec) *(p) = (uint8_t)(v)
+#define MESSAGE_CODEC_PUT_U16(p, v, codec) MessageCodec_PutU16((p), (uint16_t)(v))
+#define MESSAGE_CODEC_PUT_I16(p, v, codec) MessageCodec_PutU16((p), (uint16_t)(v))
+#define MESSAGE_CODEC_PUT_U32(p, v, codec) MessageCodec_PutU32((p), (uint32_t)(v))
+#define MESSAGE_CODEC_PUT_BYTES(p, v, codec) memcpy((p), (v), sizeof(v))
+#define MESSAGE_CODEC_PUT_RESERVED(p, v, codec) memset((p), 0, sizeof(v))
+#define MESSAGE_CODEC_PUT_NESTED(p, v, codec) codec##_Encode(&(v), (p))
+#define MESSAGE_CODEC_PUT_NESTED_ARRAY(p, v, codec)                       \
+    for (size_t i_ = 0; i_ < sizeof(v) / sizeof((v)[0]); ++i_) {          \
+        codec##_Encode(&(v)[i_], (p) + i_ * codec##_EncodedSize);         \
+    }
+
+// Reads a field from p, which holds at least the field's size.
+#define MESSAGE_CODEC_GET_U8(p, v, codec) (v) = *(p)
+#define MESSAGE_CODEC_GET_I8(p, v, codec) (v) = (int8_t)*(p)
+#define MESSAGE_CODEC_GET_U16(p, v, codec) (v) = MessageCodec_GetU16(p)
+#define MESSAGE_CODEC_GET_I16(p, v, codec) (v) = (int16_t)MessageCodec_GetU16(p)
+#define MESSAGE_CODEC_GET_U32(p, v, codec) (v) = MessageCodec_GetU32(p)
+#define MESSAGE_CODEC_GET_BYTES(p, v, codec) memcpy((v), (p), sizeof(v))
+#define MESSAGE_CODEC_GET_RESERVED(p, v, codec) (void)0
+#define MESSAGE_CODEC_GET_NESTED(p, v, codec) codec##_Decode(&(v), (p), codec##_EncodedSize)
+#define MESSAGE_CODEC_GET_NESTED_ARRAY(p, v, codec)                                   \
+    for (size_t i_ = 0; i_ < sizeof(v) / sizeof((v)[0]); ++i_) {                      \
+        codec##_Decode(&(v)[i_], (p) + i_ * codec##_EncodedSize, codec##_EncodedSize); \
+    }
+
+#define MESSAGE_CODEC_FIELD_SIZE(T, kind, m, codec, version) +MESSAGE_CODEC_SIZE_##kind(T, m, codec)
+
+#define MESSAGE_CODEC_FIELD_ENCODE(T, kind, m, codec, version) \
+    MESSAGE_CODEC_PUT_##kind(p, s->m, codec);                  \
+    p += MESSAGE_CODEC_SIZE_##kind(T, m, codec);
+
+// A field which is missing fails the decode if it is in the first version; otherwise the sender
+// has an older version, and this and the later fields are left zero.
+#define MESSAGE_CODEC_FIELD_DECODE(T, kind, m, codec, version)  \
+    if (size < MESSAGE_CODEC_SIZE_##kind(T, m, codec)) {        \
+        return (version) > 1;                                   \
+    }                                                           \
+    MESSAGE_CODEC_GET_##kind(data, s->m, codec);                \
+    data += MESSAGE_CODEC_SIZE_##kind(T, m, codec);             \
+    size -= MESSAGE_CODEC_SIZE_##kind(T, m, codec);
+
+/// <summary>
+///     Generates Name_EncodedSize, Name_Encode and Name_Decode for the struct Type, whose fields
+///     are listed by FIELDS; see the top of this file.
+/// </summary>
+#define MESSAGE_CODEC_DEFINE(Name, Type, FIELDS)                                      \
+    enum { Name##_EncodedSize = 0 FIELDS(MESSAGE_CODEC_FIELD_SIZE, Type) };           \
+                                                                                      \
+    static inline size_t Name##_Encode(const Type *s, uint8_t *buffer)                \
+    {                                                                                 \
+        uint8_t *p = buffer;                                                          \
+        FIELDS(MESSAGE_CODEC_FIELD_ENCODE, Type)                                      \
+        return (size_t)(p - buffer);                                                  \
+    }                                                                                 \
+                                                                                      \
+    static inline bool Name##_Decode(Type *s, const uint8_t *data, size_t size)       \
+    {                                                                                 \
+        memset(s, 0, sizeof(*s));                                                     \
+        FIELDS(MESSAGE_CODEC_FIELD_DECODE, Type)                                      \
+        return true;                                                                  \
+    }
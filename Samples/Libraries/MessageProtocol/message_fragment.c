@@ -0,0 +1,401 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+
+#include <applibs/log.h>
+
+#include "message_fragment.h"
+#include "message_fragment_private.h"
+#include "message_protocol.h"
+
+// Most fragments which are in flight at once. The message protocol also limits the number of
+// requests which are outstanding, to MAX_OUTSTANDING_REQUESTS.
+#ifndef FRAGMENT_WINDOW
+#define FRAGMENT_WINDOW 4u
+#endif
+
+// Number of times a fragment is sent before the transfer fails.
+#ifndef FRAGMENT_MAX_ATTEMPTS
+#define FRAGMENT_MAX_ATTEMPTS 3u
+#endif
+
+// The slot is the low byte of the request ID.
+_Static_assert(FRAGMENT_WINDOW > 0 && FRAGMENT_WINDOW <= 256u,
+               "FRAGMENT_WINDOW must fit in the slot bits of the request ID");
+
+// A window slot, which carries one fragment at a time. The response handler of the message
+// protocol has no context, so the slot is encoded in the request ID, which every response and
+// timeout reports.
+typedef struct {
+    // Whether a request from this slot is awaiting its response or timeout. This outlives an
+    // abandoned transfer, so that the slot is not reused until the stale request has finished.
+    bool inFlight;
+    // Whether the slot holds a fragment of the current transfer. A fragment which is not in
+    // flight is sent when the protocol can take another request.
+    bool inUse;
+    uint32_t offset;
+    size_t length;
+    unsigned int attempts;
+} Slot;
+
+static Slot slots[FRAGMENT_WINDOW];
+
+static struct {
+    bool active;
+    bool isRead;
+    MessageProtocol_Address address;
+    uint16_t channel;
+    uint16_t transferId;
+    const uint8_t *writeData;
+    uint8_t *readBuffer;
+    size_t bufferSize;
+    // Size of the payload. For a read, this is only known once the first fragment has arrived.
+    size_t totalSize;
+    bool sizeKnown;
+    // Offset of the first data which has not yet been put in a slot.
+    size_t nextOffset;
+    size_t completedBytes;
+    // Whether the fragment which commits a write has been put in a slot.
+    bool committing;
+    MessageFragment_CompleteHandler handler;
+    void *context;
+    struct timespec startTime;
+} transfer;
+
+// Transfer IDs start from a different value after each restart, so that the MCU does not take the
+// first transfer for a retransmission of the last one before the restart.
+static uint16_t nextTransferId = 0;
+
+static size_t MinSize(size_t a, size_t b)
+{
+    return (a < b) ? a : b;
+}
+
+static void FinishTransfer(bool succeeded)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t elapsedMs = (uint64_t)((now.tv_sec - transfer.startTime.tv_sec) * 1000 +
+                                    (now.tv_nsec - transfer.startTime.tv_nsec) / 1000000);
+    size_t size = transfer.isRead ? transfer.completedBytes : transfer.totalSize;
+    if (succeeded) {
+        Log_Debug("INFO: Fragmented %s of %zu bytes on channel %u took %llu ms.\n",
+                  transfer.isRead ? "read" : "write", size, transfer.channel,
+                  (unsigned long long)elapsedMs);
+    }
+
+    transfer.active = false;
+    for (size_t i = 0; i < FRAGMENT_WINDOW; ++i) {
+        slots[i].inUse = false;
+    }
+
+    if (transfer.handler != NULL) {
+        transfer.handler(succeeded, succeeded ? size : transfer.completedBytes, transfer.context);
+    }
+}
+
+// Puts the next part of the payload in a free slot; returns false if there is nothing to put in
+// it yet.
+static bool AssignFragment(Slot *slot)
+{
+    if (transfer.isRead) {
+        // Until the first fragment has arrived, the size of the payload is not known.
+        if (!transfer.sizeKnown && transfer.nextOffset > 0) {
+            return false;
+        }
+        size_t end = transfer.sizeKnown ? transfer.totalSize : MESSAGE_FRAGMENT_MAX_READ_DATA;
+        if (transfer.nextOffset >= end) {
+            return false;
+        }
+        slot->length = MinSize(MESSAGE_FRAGMENT_MAX_READ_DATA, end - transfer.nextOffset);
+    } else if (transfer.nextOffset < transfer.totalSize) {
+        slot->length =
+            MinSize(MESSAGE_FRAGMENT_MAX_WRITE_DATA, transfer.totalSize - transfer.nextOffset);
+    } else if (!transfer.committing && transfer.completedBytes == transfer.totalSize) {
+        // Every fragment has been acknowledged, so commit the transfer.
+        transfer.committing = true;
+        slot->length = 0;
+    } else {
+        return false;
+    }
+
+    slot->inUse = true;
+    slot->offset = (uint32_t)transfer.nextOffset;
+    slot->attempts = 0;
+    transfer.nextOffset += slot->length;
+    return true;
+}
+
+static void HandleResponse(MessageProtocol_CategoryId categoryId,
+                           MessageProtocol_RequestId requestId, const uint8_t *data,
+                           size_t dataSize, MessageProtocol_ResponseResult result, bool timedOut);
+
+static void SendFragment(size_t index)
+{
+    Slot *slot = &slots[index];
+    uint8_t body[MAX_REQUEST_DATA_SIZE];
+    size_t bodyLength;
+    MessageProtocol_RequestId requestId;
+
+    if (transfer.isRead) {
+        const MessageProtocol_Fragment_ReadRequest request = {.channel = transfer.channel,
+                                                              .transferId = transfer.transferId,
+                                                              .offset = slot->offset,
+                                                              .maxLength = (uint16_t)slot->length,
+                                                              .reserved = 0};
+        memcpy(body, &request, sizeof(request));
+        bodyLength = sizeof(request);
+        requestId = MessageProtocol_Fragment_Read;
+    } else {
+        const MessageProtocol_Fragment_WriteHeader header = {
+            .channel = transfer.channel,
+            .transferId = transfer.transferId,
+            .totalSize = (uint32_t)transfer.totalSize,
+            .offset = slot->offset};
+        memcpy(body, &header, sizeof(header));
+        if (slot->length > 0) {
+            memcpy(body + sizeof(header), transfer.writeData + slot->offset, slot->length);
+        }
+        bodyLength = sizeof(header) + slot->length;
+        requestId = MessageProtocol_Fragment_Write;
+    }
+
+    slot->inFlight = true;
+    ++slot->attempts;
+    MessageProtocol_SendRequestTo(transfer.address, MessageProtocol_Fragment_CategoryId,
+                                  (MessageProtocol_RequestId)(requestId | index), body, bodyLength,
+                                  HandleResponse);
+}
+
+// Sends fragments until the window or the message protocol is full. This is also the idle
+// handler, which the message protocol calls whenever a response or timeout makes room.
+static void SendFragments(void)
+{
+    for (size_t i = 0; i < FRAGMENT_WINDOW && transfer.active; ++i) {
+        if (!MessageProtocol_CanSendRequest()) {
+            return;
+        }
+        Slot *slot = &slots[i];
+        if (slot->inFlight || (!slot->inUse && !AssignFragment(slot))) {
+            continue;
+        }
+        SendFragment(i);
+    }
+}
+
+static void HandleWriteAck(Slot *slot, const uint8_t *data, size_t dataSize)
+{
+    MessageProtocol_Fragment_WriteAck ack;
+    if (dataSize < sizeof(ack)) {
+        Log_Debug("ERROR: Fragment acknowledgement is too short.\n");
+        FinishTransfer(false);
+        return;
+    }
+    memcpy(&ack, data, sizeof(ack));
+    if (ack.transferId != transfer.transferId || ack.offset != slot->offset) {
+        Log_Debug("ERROR: Fragment acknowledgement is for transfer %u at %lu, not %u at %lu.\n",
+                  ack.transferId, (unsigned long)ack.offset, transfer.transferId,
+                  (unsigned long)slot->offset);
+        FinishTransfer(false);
+        return;
+    }
+
+    slot->inUse = false;
+    if (slot->length == 0) {
+        FinishTransfer(true);
+        return;
+    }
+    transfer.completedBytes += slot->length;
+}
+
+static void HandleReadData(Slot *slot, const uint8_t *data, size_t dataSize)
+{
+    MessageProtocol_Fragment_ReadHeader header;
+    if (dataSize < sizeof(header)) {
+        Log_Debug("ERROR: Fragment is too short.\n");
+        FinishTransfer(false);
+        return;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (header.transferId != transfer.transferId || header.offset != slot->offset) {
+        Log_Debug("ERROR: Fragment is for transfer %u at %lu, not %u at %lu.\n", header.transferId,
+                  (unsigned long)header.offset, transfer.transferId, (unsigned long)slot->offset);
+        FinishTransfer(false);
+        return;
+    }
+
+    if (!transfer.sizeKnown) {
+        if (header.totalSize > transfer.bufferSize) {
+            Log_Debug("ERROR: Payload of %lu bytes on channel %u does not fit in %zu bytes.\n",
+                      (unsigned long)header.totalSize, transfer.channel, transfer.bufferSize);
+            FinishTransfer(false);
+            return;
+        }
+        transfer.totalSize = header.totalSize;
+        transfer.sizeKnown = true;
+    } else if (header.totalSize != transfer.totalSize) {
+        Log_Debug("ERROR: Payload on channel %u changed size during the transfer.\n",
+                  transfer.channel);
+        FinishTransfer(false);
+        return;
+    }
+
+    size_t received = dataSize - sizeof(header);
+    size_t expected = 0;
+    if (slot->offset < transfer.totalSize) {
+        expected = MinSize(slot->length, transfer.totalSize - slot->offset);
+    }
+    if (received > expected || (received == 0 && expected > 0)) {
+        Log_Debug("ERROR: Fragment at %lu has %zu bytes, not %zu.\n", (unsigned long)slot->offset,
+                  received, expected);
+        FinishTransfer(false);
+        return;
+    }
+
+    memcpy(transfer.readBuffer + slot->offset, data + sizeof(header), received);
+    transfer.completedBytes += received;
+    if (received < expected) {
+        // The MCU sent less than was asked for, so the rest is asked for again.
+        slot->offset += (uint32_t)received;
+        slot->length = expected - received;
+        slot->attempts = 0;
+    } else {
+        slot->inUse = false;
+    }
+
+    if (transfer.completedBytes == transfer.totalSize) {
+        FinishTransfer(true);
+    }
+}
+
+static void HandleResponse(MessageProtocol_CategoryId categoryId,
+                           MessageProtocol_RequestId requestId, const uint8_t *data,
+                           size_t dataSize, MessageProtocol_ResponseResult result, bool timedOut)
+{
+    size_t index = requestId & MessageProtocol_Fragment_SlotMask;
+    if (categoryId != MessageProtocol_Fragment_CategoryId || index >= FRAGMENT_WINDOW) {
+        return;
+    }
+
+    Slot *slot = &slots[index];
+    slot->inFlight = false;
+    if (!transfer.active || !slot->inUse) {
+        // The response is to a fragment of a transfer which has been abandoned.
+        return;
+    }
+
+    if (timedOut) {
+        if (slot->attempts >= FRAGMENT_MAX_ATTEMPTS) {
+            Log_Debug("ERROR: Fragment at %lu on channel %u timed out %u times.\n",
+                      (unsigned long)slot->offset, transfer.channel, slot->attempts);
+            FinishTransfer(false);
+        }
+        // Otherwise the fragment is sent again once the message protocol calls the idle handler.
+        return;
+    }
+
+    if (result != 0) {
+        Log_Debug("ERROR: MCU rejected the fragment at %lu on channel %u: %u.\n",
+                  (unsigned long)slot->offset, transfer.channel, result);
+        FinishTransfer(false);
+        return;
+    }
+
+    if (transfer.isRead) {
+        HandleReadData(slot, data, dataSize);
+    } else {
+        HandleWriteAck(slot, data, dataSize);
+    }
+}
+
+// Resets the transfer, and starts it if the message protocol can take a request now.
+static int StartTransfer(bool isRead, MessageProtocol_Address address, uint16_t channel,
+                         MessageFragment_CompleteHandler handler, void *context)
+{
+    if (transfer.active) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    transfer.active = true;
+    transfer.isRead = isRead;
+    transfer.address = address;
+    transfer.channel = channel;
+    transfer.transferId = nextTransferId++;
+    transfer.nextOffset = 0;
+    transfer.completedBytes = 0;
+    transfer.committing = false;
+    transfer.handler = handler;
+    transfer.context = context;
+    clock_gettime(CLOCK_MONOTONIC, &transfer.startTime);
+
+    SendFragments();
+    return 0;
+}
+
+void MessageFragment_Initialize(void)
+{
+    // The message protocol discards its outstanding requests when it is initialized, so no slot
+    // is in flight.
+    memset(slots, 0, sizeof(slots));
+    memset(&transfer, 0, sizeof(transfer));
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    nextTransferId = (uint16_t)(now.tv_nsec ^ now.tv_sec);
+
+    MessageProtocol_RegisterIdleHandler(SendFragments);
+}
+
+int MessageFragment_Write(MessageProtocol_Address address, uint16_t channel, const uint8_t *data,
+                          size_t size, MessageFragment_CompleteHandler handler, void *context)
+{
+    if ((uint64_t)size > UINT32_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (transfer.active) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    transfer.writeData = data;
+    transfer.readBuffer = NULL;
+    transfer.totalSize = size;
+    transfer.sizeKnown = true;
+    return StartTransfer(/* isRead */ false, address, channel, handler, context);
+}
+
+int MessageFragment_Read(MessageProtocol_Address address, uint16_t channel, uint8_t *buffer,
+                         size_t bufferSize, MessageFragment_CompleteHandler handler,
+                         void *context)
+{
+    if (transfer.active) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    transfer.writeData = NULL;
+    transfer.readBuffer = buffer;
+    transfer.bufferSize = bufferSize;
+    transfer.totalSize = 0;
+    transfer.sizeKnown = false;
+    return StartTransfer(/* isRead */ true, address, channel, handler, context);
+}
+
+bool MessageFragment_IsBusy(void)
+{
+    return transfer.active;
+}
+
+void MessageFragment_Cancel(void)
+{
+    transfer.active = false;
+    for (size_t i = 0; i < FRAGMENT_WINDOW; ++i) {
+        slots[i].inUse = false;
+    }
+}
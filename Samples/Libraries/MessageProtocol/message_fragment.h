@@ -0,0 +1,80 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "message_protocol_public.h"
+
+// The fragment layer sends payloads which are larger than one message, such as configuration
+// tables, event logs or waveforms, to the MCU, and reads them from it, as a sequence of requests,
+// so that each feature does not have to split its data itself. Up to FRAGMENT_WINDOW (4)
+// fragments are in flight at once, as far as the message protocol allows, so the link stays busy
+// rather than waiting for each response. A fragment which times out is sent again, up to
+// FRAGMENT_MAX_ATTEMPTS (3) times in all.
+//
+// The wire format is described in message_fragment_private.h; the MCU firmware must answer it.
+// Only one transfer can be in progress at a time. The layer is not thread-safe; it should only be
+// used from the event loop's thread.
+
+/// <summary>
+///     Invoked when a transfer has completed or failed.
+/// </summary>
+/// <param name="succeeded">Whether the whole payload was transferred.</param>
+/// <param name="size">For a read, the size of the payload which was read into the buffer;
+/// for a write, the size which was written.</param>
+/// <param name="context">Context which was supplied when the transfer was started.</param>
+typedef void (*MessageFragment_CompleteHandler)(bool succeeded, size_t size, void *context);
+
+/// <summary>
+///     Initialize the fragment layer. This registers an idle handler with the message protocol,
+///     so it must be called after <see cref="MessageProtocol_Initialize" />.
+/// </summary>
+void MessageFragment_Initialize(void);
+
+/// <summary>
+///     Start writing a payload to an MCU. The handler is invoked once the MCU has acknowledged
+///     the whole payload, or when the transfer fails.
+/// </summary>
+/// <param name="address">Address of the MCU.</param>
+/// <param name="channel">Which payload this is; the meaning is defined by the application.</param>
+/// <param name="data">The payload, which must remain valid until the handler is invoked.</param>
+/// <param name="size">Size of the payload in bytes.</param>
+/// <param name="handler">Function which is invoked when the transfer completes.</param>
+/// <param name="context">Context which is passed to the handler.</param>
+/// <returns>0 on success; -1 on failure, in which case errno is set to EBUSY if a transfer is in
+/// progress, or to EINVAL if the payload is too large.</returns>
+int MessageFragment_Write(MessageProtocol_Address address, uint16_t channel, const uint8_t *data,
+                          size_t size, MessageFragment_CompleteHandler handler, void *context);
+
+/// <summary>
+///     Start reading a payload from an MCU into a buffer. The handler is invoked once the whole
+///     payload has been read, or when the transfer fails, for example because the payload does
+///     not fit in the buffer.
+/// </summary>
+/// <param name="address">Address of the MCU.</param>
+/// <param name="channel">Which payload to read; the meaning is defined by the application.</param>
+/// <param name="buffer">Buffer which receives the payload, and must remain valid until the
+/// handler is invoked.</param>
+/// <param name="bufferSize">Size of the buffer in bytes.</param>
+/// <param name="handler">Function which is invoked when the transfer completes.</param>
+/// <param name="context">Context which is passed to the handler.</param>
+/// <returns>0 on success; -1 on failure, in which case errno is set to EBUSY if a transfer is in
+/// progress.</returns>
+int MessageFragment_Read(MessageProtocol_Address address, uint16_t channel, uint8_t *buffer,
+                         size_t bufferSize, MessageFragment_CompleteHandler handler,
+                         void *context);
+
+/// <summary>
+///     Query whether a transfer is in progress.
+/// </summary>
+/// <returns>true if a transfer has been started and its handler has not yet been invoked.</returns>
+bool MessageFragment_IsBusy(void);
+
+/// <summary>
+///     Abandon the transfer which is in progress, if there is one, without invoking its handler.
+///     Responses to fragments which are still in flight are ignored.
+/// </summary>
+void MessageFragment_Cancel(void);
@@ -0,0 +1,102 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include "message_protocol_private.h"
+
+// Wire format of fragmented transfers, which carry payloads larger than one message between the
+// Azure Sphere device and the MCU as a sequence of ordinary requests. This is shared with the MCU
+// firmware.
+//
+// A write sends the payload to the MCU in fragments, each of which says where in the payload it
+// belongs, so the MCU can place it even if it arrives again after a retransmission. Once every
+// fragment has been acknowledged, a fragment with no data at the end of the payload commits the
+// transfer; the MCU answers it with result 0 only if it has the whole payload. A read asks the MCU
+// for the payload at an offset; each response says how large the whole payload is, and carries as
+// much of it from the offset as fits.
+//
+// The low byte of the request ID of a fragment is the window slot which sent it, which the MCU
+// echoes in the response, as it does every request ID.
+
+/// <summary>Category of fragment requests. Applications must not use it for requests of their own.
+/// </summary>
+static const MessageProtocol_CategoryId MessageProtocol_Fragment_CategoryId = 0xFFF0;
+
+/// <summary>Request ID of a write fragment, ORed with the window slot.</summary>
+static const MessageProtocol_RequestId MessageProtocol_Fragment_Write = 0x0100;
+
+/// <summary>Request ID of a read fragment, ORed with the window slot.</summary>
+static const MessageProtocol_RequestId MessageProtocol_Fragment_Read = 0x0200;
+
+/// <summary>Mask of the window slot in the request ID of a fragment.</summary>
+static const MessageProtocol_RequestId MessageProtocol_Fragment_SlotMask = 0x00FF;
+
+/// <summary>
+///     Body of a write fragment request, which is followed by the fragment's data.
+/// </summary>
+typedef struct {
+    /// <summary>Which payload this is; the meaning is defined by the application.</summary>
+    uint16_t channel;
+    /// <summary>Changes with each transfer, so that the MCU can tell a new transfer from a
+    /// retransmitted fragment of the previous one.</summary>
+    uint16_t transferId;
+    /// <summary>Size of the whole payload, in bytes.</summary>
+    uint32_t totalSize;
+    /// <summary>Offset of the fragment's data in the payload. A fragment with no data at
+    /// totalSize commits the transfer.</summary>
+    uint32_t offset;
+} MessageProtocol_Fragment_WriteHeader;
+
+/// <summary>
+///     Body of the response to a write fragment. A result other than 0 fails the transfer.
+/// </summary>
+typedef struct {
+    /// <summary>transferId of the request.</summary>
+    uint16_t transferId;
+    /// <summary>Reserved - must be 0.</summary>
+    uint16_t reserved;
+    /// <summary>offset of the request.</summary>
+    uint32_t offset;
+} MessageProtocol_Fragment_WriteAck;
+
+/// <summary>
+///     Body of a read fragment request.
+/// </summary>
+typedef struct {
+    /// <summary>Which payload to read; the meaning is defined by the application.</summary>
+    uint16_t channel;
+    /// <summary>Changes with each transfer, so that the MCU can keep the payload unchanged for
+    /// the whole of a transfer.</summary>
+    uint16_t transferId;
+    /// <summary>Offset of the requested data in the payload.</summary>
+    uint32_t offset;
+    /// <summary>Most data which the response may carry, in bytes.</summary>
+    uint16_t maxLength;
+    /// <summary>Reserved - must be 0.</summary>
+    uint16_t reserved;
+} MessageProtocol_Fragment_ReadRequest;
+
+/// <summary>
+///     Body of the response to a read fragment, which is followed by the data from the offset,
+///     up to maxLength bytes and the end of the payload. A result other than 0 fails the transfer.
+/// </summary>
+typedef struct {
+    /// <summary>transferId of the request.</summary>
+    uint16_t transferId;
+    /// <summary>Reserved - must be 0.</summary>
+    uint16_t reserved;
+    /// <summary>Size of the whole payload, in bytes.</summary>
+    uint32_t totalSize;
+    /// <summary>offset of the request.</summary>
+    uint32_t offset;
+} MessageProtocol_Fragment_ReadHeader;
+
+/// <summary>Most data in a write fragment, leaving room for a CRC trailer.</summary>
+#define MESSAGE_FRAGMENT_MAX_WRITE_DATA                                                           \
+    (MAX_REQUEST_DATA_SIZE - sizeof(MessageProtocol_Fragment_WriteHeader) -                        \
+     MESSAGE_PROTOCOL_CRC_SIZE)
+
+/// <summary>Most data in the response to a read fragment, leaving room for a CRC trailer.</summary>
+#define MESSAGE_FRAGMENT_MAX_READ_DATA                                                            \
+    (MAX_RESPONSE_DATA_SIZE - sizeof(MessageProtocol_Fragment_ReadHeader) -                        \
+     MESSAGE_PROTOCOL_CRC_SIZE)
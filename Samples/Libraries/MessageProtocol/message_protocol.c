@@ -0,0 +1,974 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
+
+#include <applibs/log.h>
+#include <applibs/eventloop.h>
+
+#include "message_protocol.h"
+#include "message_protocol_private.h"
+#include "message_protocol_utilities.h"
+
+#ifdef EVENT_TRACE
+#include "event_trace.h"
+#endif
+
+// Time to wait for the response to a request, in seconds. This is also the longest adaptive
+// timeout.
+#ifndef REQUEST_TIMEOUT
+#define REQUEST_TIMEOUT 5u
+#endif
+
+// Shortest adaptive timeout, in milliseconds.
+#ifndef MIN_ADAPTIVE_TIMEOUT_MS
+#define MIN_ADAPTIVE_TIMEOUT_MS 200u
+#endif
+
+// Maximum number of request types whose timeout can be set.
+#ifndef MAX_REQUEST_TIMEOUTS
+#define MAX_REQUEST_TIMEOUTS 8u
+#endif
+
+// Maximum number of requests that may be awaiting a response at the same time. Set this to 1 to
+// get the original stop-and-wait behaviour.
+#ifndef MAX_OUTSTANDING_REQUESTS
+#define MAX_OUTSTANDING_REQUESTS 4u
+#endif
+
+#ifndef RECEIVED_BUFFER_SIZE
+#define RECEIVED_BUFFER_SIZE 1024u
+#endif
+
+// Number of times a request is retransmitted when the MCU reports that it arrived corrupted,
+// before it fails as if it had timed out.
+#ifndef MAX_RETRANSMITS
+#define MAX_RETRANSMITS 3u
+#endif
+
+static EventLoop *eventLoopRef = NULL;
+
+// A single timer is used for all request timeouts; it is always armed for the earliest deadline
+// of any outstanding request.
+static int requestTimeoutTimerFd = -1;
+static EventRegistration *requestTimeoutEventReg = NULL;
+
+static Transport_ReadFunctionType transportReadFunction = NULL;
+static Transport_WriteFunctionType transportWriteFunction = NULL;
+
+// Largest message that can be received; anything claiming to be longer is treated as noise. This
+// excludes the padding at the end of MessageProtocol_ResponseMessage, which would otherwise let a
+// response carry one byte more than MAX_RESPONSE_DATA_SIZE.
+#define MAX_RECEIVED_MESSAGE_SIZE (sizeof(MessageProtocol_ResponseHeader) + MAX_RESPONSE_DATA_SIZE)
+
+_Static_assert((RECEIVED_BUFFER_SIZE & (RECEIVED_BUFFER_SIZE - 1)) == 0,
+               "RECEIVED_BUFFER_SIZE must be a power of two");
+_Static_assert(RECEIVED_BUFFER_SIZE >= MAX_RECEIVED_MESSAGE_SIZE,
+               "RECEIVED_BUFFER_SIZE must be able to hold the largest message");
+
+// Circular buffer for data received via transport. Unconsumed data starts at receiveHead and is
+// receiveCount bytes long; messages are parsed in place and consumed by advancing receiveHead.
+static uint8_t receiveBuffer[RECEIVED_BUFFER_SIZE];
+static size_t receiveHead = 0;
+static size_t receiveCount = 0;
+
+// Messages which wrap around the end of receiveBuffer, or which are not suitably aligned, are
+// copied here before being passed to their handler.
+static uint8_t _Alignas(MessageProtocol_ResponseMessage)
+    linearMessageBuffer[MAX_RECEIVED_MESSAGE_SIZE];
+
+// A request which has been sent and is awaiting a response. Responses are matched to their
+// request using the sequence number, and each request has its own timeout deadline. When CRCs
+// are enabled, the body is kept, so that the request can be retransmitted if the MCU reports that
+// it arrived corrupted.
+typedef struct {
+    bool inUse;
+    MessageProtocol_RequestHeader header;
+    uint8_t body[MAX_REQUEST_DATA_SIZE];
+    size_t bodyLength;
+    uint8_t crc[MESSAGE_PROTOCOL_CRC_SIZE];
+    unsigned int retransmits;
+    MessageProtocol_ResponseHandlerType responseHandler;
+    // Time at which the request was last sent, from which its round trip is measured.
+    struct timespec sentTime;
+    struct timespec deadline;
+    uint32_t timeoutMs;
+    // Set if the request's type has a timeout of its own; its round trip is not measured.
+    bool fixedTimeout;
+} PendingRequest;
+
+static PendingRequest pendingRequests[MAX_OUTSTANDING_REQUESTS];
+
+// Number of entries in pendingRequests which are currently in use.
+static size_t pendingRequestCount = 0;
+
+// Request sequence number
+static uint16_t currentSequenceNumber = 0;
+
+// Whether requests are sent with a CRC trailer.
+static bool crcEnabled = false;
+
+// Request types which have a timeout of their own, such as requests which take the MCU a long time.
+typedef struct {
+    MessageProtocol_CategoryId categoryId;
+    MessageProtocol_RequestId requestId;
+    uint32_t timeoutMs;
+} RequestTimeoutEntry;
+static RequestTimeoutEntry requestTimeouts[MAX_REQUEST_TIMEOUTS];
+static size_t requestTimeoutCount = 0;
+
+// The round trips of requests are measured, and, in the adaptive mode, the timeout of the other
+// requests is set from the smoothed round-trip time and its variation, as TCP's retransmission
+// timeout is by RFC 6298.
+static bool adaptiveTimeoutEnabled = false;
+static MessageProtocol_LatencyStats latencyStats;
+
+// Number of slots in the event handler dispatch table; must be a power of two, and larger than
+// the number of event handlers the application registers.
+#ifndef EVENT_HANDLER_TABLE_SIZE
+#define EVENT_HANDLER_TABLE_SIZE 16u
+#endif
+
+// Maximum number of idle handlers that can be registered.
+#ifndef MAX_IDLE_HANDLERS
+#define MAX_IDLE_HANDLERS 4u
+#endif
+
+_Static_assert((EVENT_HANDLER_TABLE_SIZE & (EVENT_HANDLER_TABLE_SIZE - 1)) == 0,
+               "EVENT_HANDLER_TABLE_SIZE must be a power of two");
+
+// Event handler dispatch table. This is an open-addressed hash table keyed by (categoryId,
+// eventId); a slot is free if its handler is NULL.
+typedef struct {
+    MessageProtocol_CategoryId categoryId;
+    MessageProtocol_EventId eventId;
+    MessageProtocol_EventHandlerType handler;
+} EventHandlerEntry;
+static EventHandlerEntry eventHandlerTable[EVENT_HANDLER_TABLE_SIZE];
+
+// Idle handlers, in order of registration; CallIdleHandlers calls the most recent first.
+static MessageProtocol_IdleHandlerType idleHandlers[MAX_IDLE_HANDLERS];
+static size_t idleHandlerCount = 0;
+
+// Told whether each message arrived intact, so that the transport can change its settings if the
+// link is unreliable.
+static MessageProtocol_LinkQualityHandlerType linkQualityHandler = NULL;
+
+static void ReportLinkQuality(bool messageValid)
+{
+    if (linkQualityHandler != NULL) {
+        linkQualityHandler(messageValid);
+    }
+}
+
+static inline size_t ReceiveIndex(size_t offset)
+{
+    return (receiveHead + offset) & (RECEIVED_BUFFER_SIZE - 1);
+}
+
+static inline uint8_t PeekReceivedByte(size_t offset)
+{
+    return receiveBuffer[ReceiveIndex(offset)];
+}
+
+static void ConsumeReceivedBytes(size_t count)
+{
+    receiveHead = ReceiveIndex(count);
+    receiveCount -= count;
+    if (receiveCount == 0) {
+        // Restart at the beginning of the buffer, so the next read gets the most contiguous space.
+        receiveHead = 0;
+    }
+}
+
+/// <summary>
+///     Discard received bytes until the unconsumed data starts with a complete or partial
+///     preamble, or is empty. Candidate positions are located with memchr on the first preamble
+///     byte, and only then are the remaining preamble bytes checked.
+/// </summary>
+/// <returns>The number of bytes which were discarded.</returns>
+static size_t RemoveInvalidBytesBeforePreamble(void)
+{
+    const size_t preambleSize = sizeof(MessageProtocol_MessagePreamble);
+    size_t discarded = 0;
+
+    while (receiveCount > 0) {
+        // Search the contiguous run of data starting at receiveHead for the first preamble byte.
+        size_t runLength = RECEIVED_BUFFER_SIZE - receiveHead;
+        if (runLength > receiveCount) {
+            runLength = receiveCount;
+        }
+        const uint8_t *found =
+            memchr(receiveBuffer + receiveHead, MessageProtocol_MessagePreamble[0], runLength);
+        if (found == NULL) {
+            // Skip the whole run; if the data wraps, the loop continues from the buffer start.
+            ConsumeReceivedBytes(runLength);
+            discarded += runLength;
+            continue;
+        }
+        size_t skipped = (size_t)(found - (receiveBuffer + receiveHead));
+        ConsumeReceivedBytes(skipped);
+        discarded += skipped;
+
+        // Verify the rest of the preamble, as far as it has been received.
+        size_t checkSize = (receiveCount >= preambleSize) ? preambleSize : receiveCount;
+        size_t pos = 1;
+        while (pos < checkSize && PeekReceivedByte(pos) == MessageProtocol_MessagePreamble[pos]) {
+            ++pos;
+        }
+        if (pos == checkSize) {
+            return discarded;
+        }
+
+        // False match; drop the candidate byte and keep searching.
+        ConsumeReceivedBytes(1);
+        ++discarded;
+    }
+
+    return discarded;
+}
+
+// Discards any bytes before the next preamble; bytes between messages mean that data was corrupted.
+static void ResynchronizeOnPreamble(void)
+{
+    if (RemoveInvalidBytesBeforePreamble() > 0) {
+        ReportLinkQuality(false);
+    }
+}
+
+/// <summary>
+///     Get the length of the complete message at the start of the unconsumed data.
+/// </summary>
+/// <returns>
+///     The total message length including the header; 0 if the message is not yet complete.
+/// </returns>
+static size_t GetCompleteMessageLength(void)
+{
+    if (receiveCount <= sizeof(MessageProtocol_MessageHeader)) {
+        return 0;
+    }
+
+    // The length field follows the preamble and is little-endian.
+    size_t lengthOffset = offsetof(MessageProtocol_MessageHeader, length);
+    size_t bodyLength =
+        (size_t)PeekReceivedByte(lengthOffset) | ((size_t)PeekReceivedByte(lengthOffset + 1) << 8);
+    size_t messageLength = bodyLength + sizeof(MessageProtocol_MessageHeader);
+
+    if (messageLength > MAX_RECEIVED_MESSAGE_SIZE) {
+        // Not a real message; drop the preamble so that the data can be resynchronized.
+        Log_Debug("ERROR: Skipping message: invalid length %zu.\n", bodyLength);
+        ReportLinkQuality(false);
+        ConsumeReceivedBytes(1);
+        RemoveInvalidBytesBeforePreamble();
+        return GetCompleteMessageLength();
+    }
+
+    return (receiveCount >= messageLength) ? messageLength : 0;
+}
+
+/// <summary>
+///     Get a contiguous, aligned view of the first <paramref name="messageLength" /> unconsumed
+///     bytes. The message is used in place where possible, and copied otherwise.
+/// </summary>
+static uint8_t *GetMessage(size_t messageLength)
+{
+    uint8_t *message = receiveBuffer + receiveHead;
+    if (receiveHead + messageLength <= RECEIVED_BUFFER_SIZE &&
+        ((uintptr_t)message % _Alignof(MessageProtocol_ResponseMessage)) == 0) {
+        return message;
+    }
+
+    size_t firstPartLength = RECEIVED_BUFFER_SIZE - receiveHead;
+    if (firstPartLength >= messageLength) {
+        memcpy(linearMessageBuffer, message, messageLength);
+    } else {
+        memcpy(linearMessageBuffer, message, firstPartLength);
+        memcpy(linearMessageBuffer + firstPartLength, receiveBuffer,
+               messageLength - firstPartLength);
+    }
+    return linearMessageBuffer;
+}
+
+static MessageProtocol_EventInfo *GetEventInfo(uint8_t *message, uint16_t messageLength)
+{
+    MessageProtocol_MessageHeader *messageHeader = (MessageProtocol_MessageHeader *)message;
+    if (messageLength <
+            sizeof(MessageProtocol_MessageHeaderWithType) + sizeof(MessageProtocol_EventInfo) ||
+        messageHeader->length + sizeof(MessageProtocol_MessageHeader) !=
+            sizeof(MessageProtocol_MessageHeaderWithType) + sizeof(MessageProtocol_EventInfo)) {
+        Log_Debug("ERROR: Received invalid event message - incorrect length.\n");
+        return NULL;
+    }
+    MessageProtocol_EventMessage *eventMessage = (MessageProtocol_EventMessage *)(message);
+    return &(eventMessage->eventInfo);
+}
+
+static size_t EventHandlerTableIndex(MessageProtocol_CategoryId categoryId,
+                                     MessageProtocol_EventId eventId)
+{
+    // Fibonacci hashing of the combined key; the top bits are well mixed.
+    uint32_t key = ((uint32_t)categoryId << 16) | eventId;
+    return (size_t)((key * 2654435761u) >> 16) & (EVENT_HANDLER_TABLE_SIZE - 1);
+}
+
+/// <summary>
+///     Find the dispatch table slot for (categoryId, eventId). Returns the slot holding that
+///     key if there is one, otherwise the free slot where it would be inserted, or NULL if the
+///     table is full.
+/// </summary>
+static EventHandlerEntry *FindEventHandlerEntry(MessageProtocol_CategoryId categoryId,
+                                                MessageProtocol_EventId eventId)
+{
+    size_t index = EventHandlerTableIndex(categoryId, eventId);
+    for (size_t probe = 0; probe < EVENT_HANDLER_TABLE_SIZE; ++probe) {
+        EventHandlerEntry *entry = &eventHandlerTable[index];
+        if (entry->handler == NULL ||
+            (entry->categoryId == categoryId && entry->eventId == eventId)) {
+            return entry;
+        }
+        index = (index + 1) & (EVENT_HANDLER_TABLE_SIZE - 1);
+    }
+    return NULL;
+}
+
+// With EVENT_TRACE, the requests, and the handlers which the protocol calls, are recorded by the
+// event tracer; otherwise these functions do nothing.
+static uint64_t TraceStart(void)
+{
+#ifdef EVENT_TRACE
+    return EventTrace_NowUs();
+#else
+    return 0;
+#endif
+}
+
+static void TraceHandler(const char *name, uint64_t startUs)
+{
+#ifdef EVENT_TRACE
+    EventTrace_Complete("protocol", name, startUs, EventTrace_NowUs());
+#endif
+}
+
+// Records a request from the time at which it was last sent until now. Its argument holds the
+// category ID in its upper 16 bits, and the request ID in its lower 16 bits.
+static void TraceRequest(const PendingRequest *request, const char *name)
+{
+#ifdef EVENT_TRACE
+    uint64_t sentUs =
+        (uint64_t)request->sentTime.tv_sec * 1000000 + (uint64_t)request->sentTime.tv_nsec / 1000;
+    EventTrace_AsyncSpan("protocol", name, request->header.sequenceNumber, sentUs,
+                         EventTrace_NowUs(), "request",
+                         (int32_t)(((uint32_t)request->header.categoryId << 16) |
+                                   request->header.requestId));
+#endif
+}
+
+static void CallIdleHandlers(void)
+{
+    // Call the registered idle handlers as long as there is room for another request, so that
+    // requests which are waiting can be pipelined rather than sent one response at a time.
+    // Handlers registered most recently are called first.
+    for (size_t i = idleHandlerCount; i > 0 && MessageProtocol_CanSendRequest(); --i) {
+        idleHandlers[i - 1]();
+    }
+}
+
+static void CallEventHandler(uint8_t *message, size_t messageLength)
+{
+    MessageProtocol_EventInfo *eventInfo = GetEventInfo(message, (uint16_t)messageLength);
+    if (eventInfo == NULL) {
+        Log_Debug("ERROR: Received malformed event message.\n");
+        return;
+    }
+
+    EventHandlerEntry *entry = FindEventHandlerEntry(eventInfo->categoryId, eventInfo->eventId);
+    if (entry != NULL && entry->handler != NULL) {
+        uint64_t startUs = TraceStart();
+        entry->handler(entry->categoryId, entry->eventId);
+        TraceHandler("EventHandler", startUs);
+        return;
+    }
+    Log_Debug("ERROR: Received event message with unknown Category ID and Event ID: 0x%x, 0x%x.\n",
+              eventInfo->categoryId, eventInfo->eventId);
+}
+
+static PendingRequest *FindPendingRequestBySequenceNumber(
+    MessageProtocol_SequenceNumber sequenceNumber)
+{
+    for (size_t i = 0; i < MAX_OUTSTANDING_REQUESTS; ++i) {
+        if (pendingRequests[i].inUse &&
+            pendingRequests[i].header.sequenceNumber == sequenceNumber) {
+            return &pendingRequests[i];
+        }
+    }
+    return NULL;
+}
+
+static bool IsDeadlineBefore(const struct timespec *a, const struct timespec *b)
+{
+    return (a->tv_sec < b->tv_sec) || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+static PendingRequest *FindPendingRequestWithEarliestDeadline(void)
+{
+    PendingRequest *earliest = NULL;
+    for (size_t i = 0; i < MAX_OUTSTANDING_REQUESTS; ++i) {
+        if (pendingRequests[i].inUse &&
+            (earliest == NULL ||
+             IsDeadlineBefore(&pendingRequests[i].deadline, &earliest->deadline))) {
+            earliest = &pendingRequests[i];
+        }
+    }
+    return earliest;
+}
+
+// Arm the timeout timer for the earliest outstanding deadline, or disarm it if no requests are
+// outstanding.
+static void UpdateRequestTimeoutTimer(void)
+{
+    struct itimerspec timerSpec = {{0, 0}, {0, 0}};
+    PendingRequest *earliest = FindPendingRequestWithEarliestDeadline();
+    if (earliest != NULL) {
+        timerSpec.it_value = earliest->deadline;
+    }
+
+    if (timerfd_settime(requestTimeoutTimerFd, TFD_TIMER_ABSTIME, &timerSpec, NULL) == -1) {
+        Log_Debug("ERROR: Could not set request timeout timer: %s (%d).\n", strerror(errno),
+                  errno);
+    }
+}
+
+static PendingRequest *AllocatePendingRequest(void)
+{
+    for (size_t i = 0; i < MAX_OUTSTANDING_REQUESTS; ++i) {
+        if (!pendingRequests[i].inUse) {
+            return &pendingRequests[i];
+        }
+    }
+    return NULL;
+}
+
+static void ReleasePendingRequest(PendingRequest *request)
+{
+    request->inUse = false;
+    request->responseHandler = NULL;
+    --pendingRequestCount;
+    UpdateRequestTimeoutTimer();
+}
+
+// Releases a request and calls its response handler to inform it that the request has timed out.
+static void FailPendingRequest(PendingRequest *request)
+{
+    MessageProtocol_CategoryId categoryId = request->header.categoryId;
+    MessageProtocol_RequestId requestId = request->header.requestId;
+    MessageProtocol_ResponseHandlerType handler = request->responseHandler;
+    TraceRequest(request, "FailedRequest");
+    ReleasePendingRequest(request);
+
+    if (handler != NULL) {
+        uint64_t startUs = TraceStart();
+        handler(categoryId, requestId, NULL, 0, 0, true);
+        TraceHandler("ResponseHandler", startUs);
+    }
+}
+
+static void SetRequestDeadline(PendingRequest *request)
+{
+    clock_gettime(CLOCK_MONOTONIC, &request->sentTime);
+    request->deadline = request->sentTime;
+    request->deadline.tv_sec += (time_t)(request->timeoutMs / 1000u);
+    request->deadline.tv_nsec += (long)(request->timeoutMs % 1000u) * 1000000;
+    if (request->deadline.tv_nsec >= 1000000000) {
+        request->deadline.tv_nsec -= 1000000000;
+        ++request->deadline.tv_sec;
+    }
+    UpdateRequestTimeoutTimer();
+}
+
+static void ResetLatencyStats(void)
+{
+    memset(&latencyStats, 0, sizeof(latencyStats));
+    latencyStats.adaptiveTimeoutMs = REQUEST_TIMEOUT * 1000u;
+}
+
+// Gets the timeout of a request: the timeout of its type if it has one, and otherwise the adaptive
+// timeout or REQUEST_TIMEOUT.
+static uint32_t GetRequestTimeoutMs(MessageProtocol_CategoryId categoryId,
+                                    MessageProtocol_RequestId requestId, bool *fixedTimeout)
+{
+    for (size_t i = 0; i < requestTimeoutCount; ++i) {
+        if (requestTimeouts[i].categoryId == categoryId &&
+            requestTimeouts[i].requestId == requestId) {
+            *fixedTimeout = true;
+            return requestTimeouts[i].timeoutMs;
+        }
+    }
+    *fixedTimeout = false;
+    return adaptiveTimeoutEnabled ? latencyStats.adaptiveTimeoutMs : REQUEST_TIMEOUT * 1000u;
+}
+
+static void ClampAdaptiveTimeout(uint64_t timeoutMs)
+{
+    if (timeoutMs < MIN_ADAPTIVE_TIMEOUT_MS) {
+        timeoutMs = MIN_ADAPTIVE_TIMEOUT_MS;
+    } else if (timeoutMs > REQUEST_TIMEOUT * 1000u) {
+        timeoutMs = REQUEST_TIMEOUT * 1000u;
+    }
+    latencyStats.adaptiveTimeoutMs = (uint32_t)timeoutMs;
+}
+
+// Adds a round trip to the statistics. Only requests which were sent once, and whose type does not
+// have a timeout of its own, are measured, so that a response to an earlier transmission, or a
+// request which is slow by design, does not skew the adaptive timeout.
+static void MeasureRoundTrip(const PendingRequest *request)
+{
+    if (request->retransmits > 0 || request->fixedTimeout) {
+        return;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t elapsedUs = (int64_t)(now.tv_sec - request->sentTime.tv_sec) * 1000000 +
+                        (now.tv_nsec - request->sentTime.tv_nsec) / 1000;
+    uint32_t rttUs = UINT32_MAX;
+    if (elapsedUs < 0) {
+        rttUs = 0;
+    } else if (elapsedUs < UINT32_MAX) {
+        rttUs = (uint32_t)elapsedUs;
+    }
+
+    if (latencyStats.samples == 0) {
+        latencyStats.minRttUs = rttUs;
+        latencyStats.maxRttUs = rttUs;
+        latencyStats.smoothedRttUs = rttUs;
+        latencyStats.rttVariationUs = rttUs / 2;
+    } else {
+        if (rttUs < latencyStats.minRttUs) {
+            latencyStats.minRttUs = rttUs;
+        }
+        if (rttUs > latencyStats.maxRttUs) {
+            latencyStats.maxRttUs = rttUs;
+        }
+        uint32_t deviation = (rttUs > latencyStats.smoothedRttUs)
+                                 ? rttUs - latencyStats.smoothedRttUs
+                                 : latencyStats.smoothedRttUs - rttUs;
+        latencyStats.rttVariationUs =
+            (uint32_t)(((uint64_t)latencyStats.rttVariationUs * 3 + deviation) / 4);
+        latencyStats.smoothedRttUs =
+            (uint32_t)(((uint64_t)latencyStats.smoothedRttUs * 7 + rttUs) / 8);
+    }
+    ++latencyStats.samples;
+
+    uint64_t timeoutUs =
+        (uint64_t)latencyStats.smoothedRttUs + 4 * (uint64_t)latencyStats.rttVariationUs;
+    ClampAdaptiveTimeout((timeoutUs + 999) / 1000);
+}
+
+// Sends the header of a request, its body and its CRC trailer, if it has one, without assembling
+// them into one buffer first.
+static void TransmitRequest(const PendingRequest *request, const uint8_t *body)
+{
+    struct iovec iov[3];
+    int iovcnt = 0;
+    iov[iovcnt++] =
+        (struct iovec){.iov_base = (void *)&request->header, .iov_len = sizeof(request->header)};
+    if (request->bodyLength > 0) {
+        iov[iovcnt++] = (struct iovec){.iov_base = (void *)body, .iov_len = request->bodyLength};
+    }
+    if ((request->header.flags & MessageProtocol_Flag_Crc) != 0) {
+        iov[iovcnt++] =
+            (struct iovec){.iov_base = (void *)request->crc, .iov_len = sizeof(request->crc)};
+    }
+    transportWriteFunction(iov, iovcnt);
+}
+
+static void CallResponseHandler(uint8_t *message, size_t messageLength)
+{
+    MessageProtocol_ResponseMessage *responseMessage = (MessageProtocol_ResponseMessage *)(message);
+    bool hasCrc = (responseMessage->responseHeader.flags & MessageProtocol_Flag_Crc) != 0;
+    size_t trailerLength = hasCrc ? MESSAGE_PROTOCOL_CRC_SIZE : 0;
+
+    if (messageLength < sizeof(MessageProtocol_ResponseHeader) + trailerLength ||
+        responseMessage->responseHeader.messageHeaderWithType.messageHeader.length +
+                sizeof(MessageProtocol_MessageHeader) <
+            sizeof(MessageProtocol_ResponseHeader) + trailerLength) {
+        Log_Debug("ERROR: Received invalid response message - too short.\n");
+        ReportLinkQuality(false);
+        return;
+    }
+
+    if (hasCrc && !MessageProtocol_IsCrcValid(message)) {
+        // The request is left to time out: the MCU may have acted on it, so it is not repeated.
+        Log_Debug("ERROR: Received response message with invalid CRC.\n");
+        ReportLinkQuality(false);
+        return;
+    }
+
+    // A response which reports that the MCU received its request corrupted means the link is
+    // losing data, although the response itself arrived intact.
+    bool crcError = hasCrc && responseMessage->responseHeader.responseResult ==
+                                  MessageProtocol_ResponseResult_CrcError;
+    ReportLinkQuality(!crcError);
+
+    if (pendingRequestCount == 0) {
+        Log_Debug("ERROR: Received a response when not expecting one\n");
+        return;
+    }
+
+    PendingRequest *request =
+        FindPendingRequestBySequenceNumber(responseMessage->responseHeader.sequenceNumber);
+    if (request == NULL) {
+        Log_Debug("ERROR: Received a response with invalid sequence number: %x.\n",
+                  responseMessage->responseHeader.sequenceNumber);
+        return;
+    }
+
+    if (responseMessage->responseHeader.messageHeaderWithType.address !=
+        request->header.messageHeaderWithType.address) {
+        Log_Debug("ERROR: Received a response from address %u to a request to address %u.\n",
+                  responseMessage->responseHeader.messageHeaderWithType.address,
+                  request->header.messageHeaderWithType.address);
+        return;
+    }
+
+    if (crcError) {
+        // The MCU did not act on the request, so it is sent again straight away rather than
+        // after it has timed out.
+        if (request->retransmits < MAX_RETRANSMITS) {
+            Log_Debug("INFO: Retransmitting corrupted request: %x, %x.\n",
+                      request->header.categoryId, request->header.requestId);
+            ++request->retransmits;
+            ++latencyStats.retransmits;
+            SetRequestDeadline(request);
+            TransmitRequest(request, request->body);
+            return;
+        }
+        Log_Debug("ERROR: Request %x, %x was corrupted %u times; giving up.\n",
+                  request->header.categoryId, request->header.requestId, MAX_RETRANSMITS + 1);
+        FailPendingRequest(request);
+        CallIdleHandlers();
+        return;
+    }
+
+    MeasureRoundTrip(request);
+    TraceRequest(request, "Request");
+
+    MessageProtocol_ResponseHandlerType handler = request->responseHandler;
+    ReleasePendingRequest(request);
+
+    if (handler != NULL) {
+        size_t dataLength =
+            responseMessage->responseHeader.messageHeaderWithType.messageHeader.length +
+            sizeof(MessageProtocol_MessageHeader) - sizeof(MessageProtocol_RequestHeader) -
+            trailerLength;
+        uint64_t startUs = TraceStart();
+        handler(responseMessage->responseHeader.categoryId,
+                responseMessage->responseHeader.requestId, responseMessage->data, dataLength,
+                responseMessage->responseHeader.responseResult, false);
+        TraceHandler("ResponseHandler", startUs);
+    }
+
+    CallIdleHandlers();
+}
+
+void MessageProtocol_HandleReceivedMessage(void)
+{
+    // Read into the contiguous free space following the unconsumed data.
+    size_t tail = ReceiveIndex(receiveCount);
+    size_t freeSpace = RECEIVED_BUFFER_SIZE - receiveCount;
+    size_t readSize = (tail + freeSpace > RECEIVED_BUFFER_SIZE) ? RECEIVED_BUFFER_SIZE - tail
+                                                                : freeSpace;
+
+    // Attempt to read message from UART.
+    ssize_t bytesRead = transportReadFunction((char *)(receiveBuffer + tail), readSize);
+    if (bytesRead == -1) {
+        Log_Debug("ERROR: Could not read from UART: %s (%d).\n", strerror(errno), errno);
+        return;
+    }
+
+    if (bytesRead > 0) {
+        receiveCount += (size_t)bytesRead;
+        // Messages in the receive buffer should always start with a preamble, so remove all invalid
+        // bytes before the preamble.
+        ResynchronizeOnPreamble();
+        size_t messageLength;
+        while ((messageLength = GetCompleteMessageLength()) != 0) {
+            // We received a complete message, call its handler.
+            uint8_t *message = GetMessage(messageLength);
+            MessageProtocol_MessageHeaderWithType *messageHeader =
+                (MessageProtocol_MessageHeaderWithType *)message;
+            if (messageHeader->type == MessageProtocol_EventMessageType) {
+                ReportLinkQuality(true);
+                CallEventHandler(message, messageLength);
+            } else if (messageHeader->type == MessageProtocol_ResponseMessageType) {
+                // The response handler reports the link quality once it has checked the CRC.
+                CallResponseHandler(message, messageLength);
+            } else {
+                Log_Debug("ERROR: Skipping message: unknown or invalid message type.\n");
+                ReportLinkQuality(false);
+            }
+            // We have finished with this message now, so consume it and move on to the next one.
+            ConsumeReceivedBytes(messageLength);
+            ResynchronizeOnPreamble();
+        }
+    }
+}
+
+static void RequestTimeoutEventHandler(EventLoop *el, int fd, EventLoop_IoEvents events,
+                                       void *context)
+{
+    uint64_t expirations;
+    if (read(fd, &expirations, sizeof(expirations)) == -1) {
+        Log_Debug("ERROR: Could not consume request timeout timer event: %s (%d).\n",
+                  strerror(errno), errno);
+        return;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    // Timed out waiting for the response messages: release each expired request and call its
+    // response handler to inform it that the request has timed out.
+    PendingRequest *request;
+    while ((request = FindPendingRequestWithEarliestDeadline()) != NULL &&
+           !IsDeadlineBefore(&now, &request->deadline)) {
+        // A request which was lost, or whose response was lost, counts against the link.
+        ReportLinkQuality(false);
+
+        // The link may have become slower, so the adaptive timeout is doubled until the next
+        // round trip has been measured.
+        ++latencyStats.timeouts;
+        if (!request->fixedTimeout) {
+            ClampAdaptiveTimeout((uint64_t)latencyStats.adaptiveTimeoutMs * 2);
+        }
+
+        FailPendingRequest(request);
+    }
+
+    UpdateRequestTimeoutTimer();
+
+    // If nothing else is outstanding we are idle now, so call the idle handlers.
+    CallIdleHandlers();
+}
+
+int MessageProtocol_Initialize(EventLoop *el, Transport_ReadFunctionType readFunction,
+                               Transport_WriteFunctionType writeFunction)
+{
+    eventLoopRef = el;
+    transportReadFunction = readFunction;
+    transportWriteFunction = writeFunction;
+
+    for (size_t i = 0; i < MAX_OUTSTANDING_REQUESTS; ++i) {
+        pendingRequests[i].inUse = false;
+        pendingRequests[i].responseHandler = NULL;
+    }
+
+    requestTimeoutTimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (requestTimeoutTimerFd == -1) {
+        Log_Debug("ERROR: Could not create request timeout timer: %s (%d).\n", strerror(errno),
+                  errno);
+        return -1;
+    }
+
+    requestTimeoutEventReg =
+        EventLoop_RegisterIo(eventLoopRef, requestTimeoutTimerFd, EventLoop_Input,
+                             RequestTimeoutEventHandler, NULL);
+    if (requestTimeoutEventReg == NULL) {
+        Log_Debug("ERROR: Could not register request timeout timer: %s (%d).\n", strerror(errno),
+                  errno);
+        return -1;
+    }
+
+    pendingRequestCount = 0;
+    memset(eventHandlerTable, 0, sizeof(eventHandlerTable));
+    idleHandlerCount = 0;
+    crcEnabled = false;
+    requestTimeoutCount = 0;
+    adaptiveTimeoutEnabled = false;
+    ResetLatencyStats();
+    return 0;
+}
+
+void MessageProtocol_Cleanup(void)
+{
+    if (requestTimeoutEventReg != NULL) {
+        EventLoop_UnregisterIo(eventLoopRef, requestTimeoutEventReg);
+        requestTimeoutEventReg = NULL;
+    }
+
+    if (requestTimeoutTimerFd != -1) {
+        close(requestTimeoutTimerFd);
+        requestTimeoutTimerFd = -1;
+    }
+
+    for (size_t i = 0; i < MAX_OUTSTANDING_REQUESTS; ++i) {
+        pendingRequests[i].inUse = false;
+    }
+    pendingRequestCount = 0;
+    eventLoopRef = NULL;
+    transportReadFunction = NULL;
+    transportWriteFunction = NULL;
+
+    // Clear all registered event and idle handlers.
+    memset(eventHandlerTable, 0, sizeof(eventHandlerTable));
+    idleHandlerCount = 0;
+    linkQualityHandler = NULL;
+    crcEnabled = false;
+    requestTimeoutCount = 0;
+    adaptiveTimeoutEnabled = false;
+}
+
+void MessageProtocol_RegisterEventHandler(MessageProtocol_CategoryId categoryId,
+                                          MessageProtocol_EventId eventId,
+                                          MessageProtocol_EventHandlerType handler)
+{
+    EventHandlerEntry *entry = FindEventHandlerEntry(categoryId, eventId);
+    if (entry == NULL) {
+        Log_Debug("ERROR: Event handler table full, can't register handler for: %x, %x.\n",
+                  categoryId, eventId);
+        return;
+    }
+    entry->categoryId = categoryId;
+    entry->eventId = eventId;
+    entry->handler = handler;
+}
+
+void MessageProtocol_RegisterIdleHandler(MessageProtocol_IdleHandlerType handler)
+{
+    if (idleHandlerCount >= MAX_IDLE_HANDLERS) {
+        Log_Debug("ERROR: Too many idle handlers registered.\n");
+        return;
+    }
+    idleHandlers[idleHandlerCount++] = handler;
+}
+
+void MessageProtocol_RegisterLinkQualityHandler(MessageProtocol_LinkQualityHandlerType handler)
+{
+    linkQualityHandler = handler;
+}
+
+void MessageProtocol_EnableCrc(bool enable)
+{
+    crcEnabled = enable;
+}
+
+void MessageProtocol_SetRequestTimeout(MessageProtocol_CategoryId categoryId,
+                                       MessageProtocol_RequestId requestId, uint32_t timeoutMs)
+{
+    for (size_t i = 0; i < requestTimeoutCount; ++i) {
+        if (requestTimeouts[i].categoryId == categoryId &&
+            requestTimeouts[i].requestId == requestId) {
+            if (timeoutMs == 0) {
+                requestTimeouts[i] = requestTimeouts[--requestTimeoutCount];
+            } else {
+                requestTimeouts[i].timeoutMs = timeoutMs;
+            }
+            return;
+        }
+    }
+
+    if (timeoutMs == 0) {
+        return;
+    }
+    if (requestTimeoutCount >= MAX_REQUEST_TIMEOUTS) {
+        Log_Debug("ERROR: Too many request timeouts set, can't set timeout for: %x, %x.\n",
+                  categoryId, requestId);
+        return;
+    }
+    requestTimeouts[requestTimeoutCount++] =
+        (RequestTimeoutEntry){.categoryId = categoryId, .requestId = requestId,
+                              .timeoutMs = timeoutMs};
+}
+
+void MessageProtocol_EnableAdaptiveTimeout(bool enable)
+{
+    adaptiveTimeoutEnabled = enable;
+}
+
+void MessageProtocol_GetLatencyStats(MessageProtocol_LatencyStats *stats)
+{
+    *stats = latencyStats;
+}
+
+void MessageProtocol_SendRequest(MessageProtocol_CategoryId categoryId,
+                                 MessageProtocol_RequestId requestId, const uint8_t *body,
+                                 size_t bodyLength,
+                                 MessageProtocol_ResponseHandlerType responseHandler)
+{
+    MessageProtocol_SendRequestTo(MessageProtocol_DefaultAddress, categoryId, requestId, body,
+                                  bodyLength, responseHandler);
+}
+
+void MessageProtocol_SendRequestTo(MessageProtocol_Address address,
+                                   MessageProtocol_CategoryId categoryId,
+                                   MessageProtocol_RequestId requestId, const uint8_t *body,
+                                   size_t bodyLength,
+                                   MessageProtocol_ResponseHandlerType responseHandler)
+{
+    PendingRequest *request = AllocatePendingRequest();
+    if (request == NULL) {
+        Log_Debug("INFO: Protocol busy, can't send request: %x, %x.\n", categoryId, requestId);
+        return;
+    }
+
+    // Check the body, and the CRC trailer if there is one, fit within the maximum request size.
+    size_t trailerLength = crcEnabled ? MESSAGE_PROTOCOL_CRC_SIZE : 0;
+    if (bodyLength + trailerLength > MAX_REQUEST_DATA_SIZE) {
+        Log_Debug("ERROR: Request body length (%zu) exceeds maximum request size.\n", bodyLength);
+        return;
+    }
+
+    MessageProtocol_RequestHeader *requestHeader = &request->header;
+    memcpy(requestHeader->messageHeaderWithType.messageHeader.preamble,
+           MessageProtocol_MessagePreamble, sizeof(MessageProtocol_MessagePreamble));
+    requestHeader->messageHeaderWithType.messageHeader.length =
+        (uint16_t)(sizeof(MessageProtocol_RequestHeader) - sizeof(MessageProtocol_MessageHeader) +
+                   bodyLength + trailerLength);
+    requestHeader->messageHeaderWithType.type = MessageProtocol_RequestMessageType;
+    requestHeader->messageHeaderWithType.address = address;
+    requestHeader->categoryId = categoryId;
+    requestHeader->requestId = requestId;
+    requestHeader->sequenceNumber = ++currentSequenceNumber;
+    requestHeader->flags = crcEnabled ? MessageProtocol_Flag_Crc : 0;
+    requestHeader->reserved = 0;
+
+    if (crcEnabled) {
+        uint16_t crc = MessageProtocol_Crc16(
+            MESSAGE_PROTOCOL_CRC_INITIAL, (const uint8_t *)requestHeader, sizeof(*requestHeader));
+        crc = MessageProtocol_Crc16(crc, body, bodyLength);
+        request->crc[0] = (uint8_t)crc;
+        request->crc[1] = (uint8_t)(crc >> 8);
+        // Keep the body in case the request has to be retransmitted. Otherwise the transport
+        // sends the caller's body directly.
+        if (bodyLength > 0) {
+            memcpy(request->body, body, bodyLength);
+        }
+    }
+
+    request->inUse = true;
+    request->bodyLength = bodyLength;
+    request->retransmits = 0;
+    request->responseHandler = responseHandler;
+    request->timeoutMs = GetRequestTimeoutMs(categoryId, requestId, &request->fixedTimeout);
+    ++pendingRequestCount;
+
+    SetRequestDeadline(request);
+    TransmitRequest(request, body);
+}
+
+bool MessageProtocol_IsIdle(void)
+{
+    return (pendingRequestCount == 0);
+}
+
+bool MessageProtocol_CanSendRequest(void)
+{
+    return (pendingRequestCount < MAX_OUTSTANDING_REQUESTS);
+}
\ No newline at end of file
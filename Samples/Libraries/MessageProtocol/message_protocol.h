@@ -0,0 +1,201 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <stdbool.h>
+
+#include <applibs/eventloop.h>
+
+#include "message_protocol_public.h"
+
+typedef ssize_t (*Transport_ReadFunctionType)(char *buffer, size_t amount);
+
+/// <summary>
+///     Transport write function. The message is described by a list of buffers, which the
+///     transport should send in order as one contiguous message; the buffers are only valid for
+///     the duration of the call.
+/// </summary>
+typedef ssize_t (*Transport_WriteFunctionType)(const struct iovec *iov, int iovcnt);
+
+/// <summary>
+///     Initialize the message protocol and UART.
+/// </summary>
+/// <param name="el">EventLoop to use for the request timeout timer.</param>
+/// <param name="readFunction">Function to call to read data from the transport.</param>
+/// <param name="writeFunction">Function to call to write data to the transport.</param>
+/// <returns>0 on success, or -1 on failure, in which case errno is set to the error.</returns>
+int MessageProtocol_Initialize(EventLoop *el, Transport_ReadFunctionType readFunction,
+                               Transport_WriteFunctionType writeFunction);
+
+/// <summary>
+///     Clean up the message protocol callback handlers.
+/// </summary>
+void MessageProtocol_Cleanup(void);
+
+/// <summary>
+///     Call this function to cause the message protocol to attempt to read a message from the
+///     transport (and call the relevant handlers)
+/// </summary>
+void MessageProtocol_HandleReceivedMessage(void);
+
+typedef void (*MessageProtocol_EventHandlerType)(MessageProtocol_CategoryId categoryId,
+                                                 MessageProtocol_EventId eventId);
+
+/// <summary>
+///     Register a callback handler for incoming message protocol event messages.
+/// </summary>
+/// <param name="categoryId">The message protocol category ID.</param>
+/// <param name="eventId">The message protocol event ID.</param>
+/// <param name="handler">The callback handler to register.</param>
+void MessageProtocol_RegisterEventHandler(MessageProtocol_CategoryId categoryId,
+                                          MessageProtocol_EventId eventId,
+                                          MessageProtocol_EventHandlerType handler);
+
+typedef void (*MessageProtocol_IdleHandlerType)(void);
+
+/// <summary>
+///     Register a callback handler for the idle event. Idle handlers are called whenever a
+///     response or a timeout leaves room for another request, and may send requests until
+///     MessageProtocol_CanSendRequest returns false. The handler registered most recently is
+///     called first.
+/// </summary>
+/// <param name="handler">The callback handler to register.</param>
+void MessageProtocol_RegisterIdleHandler(MessageProtocol_IdleHandlerType handler);
+
+/// <summary>
+///     Handler which is told whether each message arrived intact.
+/// </summary>
+/// <param name="messageValid">true when a complete message has been received; false when
+/// corrupt data has been discarded, or a request has timed out.</param>
+typedef void (*MessageProtocol_LinkQualityHandlerType)(bool messageValid);
+
+/// <summary>
+///     Register a handler which is told whether each message arrived intact. The UART transport
+///     provides <see cref="UartTransport_NotifyLinkQuality" />, which falls back to slower UART
+///     settings when too many messages in a row are lost.
+/// </summary>
+/// <param name="handler">The handler, or NULL to remove it.</param>
+void MessageProtocol_RegisterLinkQualityHandler(MessageProtocol_LinkQualityHandlerType handler);
+
+/// <summary>
+///     Enable or disable the CRC trailer of requests. The MCU checks the CRC of each request,
+///     answers a corrupted request at once with
+///     <see cref="MessageProtocol_ResponseResult_CrcError" />, and adds a CRC to its responses. A
+///     corrupted request is then retransmitted straight away, up to MAX_RETRANSMITS times, rather
+///     than waiting for it to time out; a corrupted response is discarded. The body of a request
+///     may be at most MESSAGE_PROTOCOL_CRC_SIZE bytes less than MAX_REQUEST_DATA_SIZE. Only
+///     enable this if the MCU firmware supports it. It is disabled by
+///     <see cref="MessageProtocol_Initialize" /> and <see cref="MessageProtocol_Cleanup" />.
+/// </summary>
+/// <param name="enable">true to send requests with a CRC trailer.</param>
+void MessageProtocol_EnableCrc(bool enable);
+
+/// <summary>
+///     Set the timeout of a type of request, such as one which takes the MCU longer than
+///     REQUEST_TIMEOUT to answer, in place of REQUEST_TIMEOUT or the adaptive timeout. Up to
+///     MAX_REQUEST_TIMEOUTS types can have a timeout of their own. The timeouts are cleared by
+///     <see cref="MessageProtocol_Initialize" /> and <see cref="MessageProtocol_Cleanup" />.
+/// </summary>
+/// <param name="categoryId">The message protocol category ID.</param>
+/// <param name="requestId">The message protocol request ID.</param>
+/// <param name="timeoutMs">The timeout in milliseconds, or 0 to remove it.</param>
+void MessageProtocol_SetRequestTimeout(MessageProtocol_CategoryId categoryId,
+                                       MessageProtocol_RequestId requestId, uint32_t timeoutMs);
+
+/// <summary>
+///     Enable or disable the adaptive timeout. When it is enabled, the timeout of each request
+///     whose type does not have one of its own is the smoothed round-trip time plus four times
+///     its variation, between MIN_ADAPTIVE_TIMEOUT_MS and REQUEST_TIMEOUT, so that a lost
+///     response is noticed soon after it is due. Each timeout doubles it until the next round
+///     trip is measured. Until a round trip has been measured, it is REQUEST_TIMEOUT. It is
+///     disabled by <see cref="MessageProtocol_Initialize" /> and
+///     <see cref="MessageProtocol_Cleanup" />.
+/// </summary>
+/// <param name="enable">true to enable the adaptive timeout.</param>
+void MessageProtocol_EnableAdaptiveTimeout(bool enable);
+
+/// <summary>
+///     Latency statistics of the requests which have been sent since the message protocol was
+///     initialized. Only requests which were sent once, and whose type does not have a timeout
+///     of its own, are measured.
+/// </summary>
+typedef struct {
+    /// <summary>Number of round trips which have been measured.</summary>
+    uint32_t samples;
+    /// <summary>Shortest measured round trip, in microseconds.</summary>
+    uint32_t minRttUs;
+    /// <summary>Longest measured round trip, in microseconds.</summary>
+    uint32_t maxRttUs;
+    /// <summary>Smoothed round-trip time, in microseconds.</summary>
+    uint32_t smoothedRttUs;
+    /// <summary>Smoothed mean deviation of the round-trip time, in microseconds.</summary>
+    uint32_t rttVariationUs;
+    /// <summary>Timeout which the adaptive mode applies, in milliseconds.</summary>
+    uint32_t adaptiveTimeoutMs;
+    /// <summary>Number of requests which have timed out.</summary>
+    uint32_t timeouts;
+    /// <summary>Number of requests which have been retransmitted because of a CRC error.</summary>
+    uint32_t retransmits;
+} MessageProtocol_LatencyStats;
+
+/// <summary>
+///     Get the latency statistics.
+/// </summary>
+/// <param name="stats">Receives the statistics.</param>
+void MessageProtocol_GetLatencyStats(MessageProtocol_LatencyStats *stats);
+
+typedef void (*MessageProtocol_ResponseHandlerType)(MessageProtocol_CategoryId categoryId,
+                                                    MessageProtocol_RequestId requestId,
+                                                    const uint8_t *data, size_t dataSize,
+                                                    MessageProtocol_ResponseResult result,
+                                                    bool timedOut);
+
+/// <summary>
+///     Send a request using the message protocol. Several requests may be outstanding at once;
+///     each response is matched to its request by sequence number and passed to that request's
+///     response handler. If the maximum number of outstanding requests has been reached, the
+///     request is dropped.
+/// </summary>
+/// <param name="categoryId">The message protocol category ID.</param>
+/// <param name="requestId">The message protocol request ID.</param>
+/// <param name="body">The body of the message.</param>
+/// <param name="bodyLength">The length of the message body in bytes.</param>
+/// <param name="responseHandler">The callback handler for the response message.</param>
+void MessageProtocol_SendRequest(MessageProtocol_CategoryId categoryId,
+                                 MessageProtocol_RequestId requestId, const uint8_t *body,
+                                 size_t bodyLength,
+                                 MessageProtocol_ResponseHandlerType responseHandler);
+
+/// <summary>
+///     Send a request to one of several MCUs which share a bus, such as RS-485. Every MCU receives
+///     the request, but only the MCU with the address responds, and a response is only matched to
+///     the request if it comes from that address. On a half-duplex bus, the responses of different
+///     MCUs would collide, so the caller should wait for each response before sending the next
+///     request. <see cref="MessageProtocol_SendRequest" /> sends to
+///     <see cref="MessageProtocol_DefaultAddress" />.
+/// </summary>
+/// <param name="address">Address of the MCU.</param>
+/// <param name="categoryId">The message protocol category ID.</param>
+/// <param name="requestId">The message protocol request ID.</param>
+/// <param name="body">The body of the message.</param>
+/// <param name="bodyLength">The length of the message body in bytes.</param>
+/// <param name="responseHandler">The callback handler for the response message.</param>
+void MessageProtocol_SendRequestTo(MessageProtocol_Address address,
+                                   MessageProtocol_CategoryId categoryId,
+                                   MessageProtocol_RequestId requestId, const uint8_t *body,
+                                   size_t bodyLength,
+                                   MessageProtocol_ResponseHandlerType responseHandler);
+
+/// <summary>
+///     Query whether the message protocol is currently idle.
+/// </summary>
+/// <returns>True if no requests are awaiting a response; false otherwise.</returns>
+bool MessageProtocol_IsIdle(void);
+
+/// <summary>
+///     Query whether another request can be sent without waiting for an outstanding response.
+/// </summary>
+/// <returns>True if a request can be sent now; false if the request pipeline is full.</returns>
+bool MessageProtocol_CanSendRequest(void);
@@ -35,6 +35,25 @@ static const MessageProtocol_MessageType MessageProtocol_ResponseMessageType = 0
 /// <summary>Message type for an event message.</summary>
 static const MessageProtocol_MessageType MessageProtocol_EventMessageType = 0x03;
 
+/// <summary>
+///     Flag of a request or response which ends with a CRC trailer: the CRC-16/CCITT-FALSE of the
+///     message from its preamble to the end of its body, least significant byte first. The
+///     trailer is counted in the message length, so the body and the trailer together must fit
+///     in MAX_REQUEST_DATA_SIZE or MAX_RESPONSE_DATA_SIZE. An MCU answers a request which has a
+///     trailer with a response which has one.
+/// </summary>
+static const uint8_t MessageProtocol_Flag_Crc = 0x01;
+
+/// <summary>Size of the CRC trailer, in bytes.</summary>
+#define MESSAGE_PROTOCOL_CRC_SIZE 2u
+
+/// <summary>
+///     Result of the response with which an MCU answers a request whose CRC is invalid, without
+///     acting on it. The response has no data and has a CRC trailer. The request's sequence number
+///     is echoed, so that the sender can retransmit it at once.
+/// </summary>
+static const MessageProtocol_ResponseResult MessageProtocol_ResponseResult_CrcError = 0xFF;
+
 /// <summary>
 ///     Data structure for a message protocol message header.
 ///     All messages should begin with this header. It is not intended for use directly, but instead
@@ -58,8 +77,12 @@ typedef struct {
     MessageProtocol_MessageHeader messageHeader;
     /// <summary>The message type; see <see cref="MessageProtocol_MessageType" />.</summary>
     MessageProtocol_MessageType type;
-    /// <summary>Reserved; must be 0.</summary>
-    uint8_t reserved;
+    /// <summary>
+    ///     Address of the MCU on a bus shared by several MCUs, such as RS-485: the MCU to which a
+    ///     request is sent, or the MCU which sent a response or event. It is
+    ///     <see cref="MessageProtocol_DefaultAddress" /> for the only MCU on a point-to-point link.
+    /// </summary>
+    uint8_t address;
 } MessageProtocol_MessageHeaderWithType;
 
 /// <summary>
@@ -104,8 +127,10 @@ typedef struct {
     ///     The response message to this request must have the same sequence number.
     /// </summary>
     MessageProtocol_SequenceNumber sequenceNumber;
-    /// <summary>Reserved - must all be 0.</summary>
-    uint8_t reserved[2];
+    /// <summary>Flags, such as <see cref="MessageProtocol_Flag_Crc" />; otherwise 0.</summary>
+    uint8_t flags;
+    /// <summary>Reserved - must be 0.</summary>
+    uint8_t reserved;
 } MessageProtocol_RequestHeader;
 
 /// <summary>
@@ -143,8 +168,8 @@ typedef struct {
     MessageProtocol_SequenceNumber sequenceNumber;
     /// <summary>Response result - see <see cref="MessageProtocol_ResponseResult" />.</summary>
     MessageProtocol_ResponseResult responseResult;
-    /// <summary>Reserved - must be 0.</summary>
-    uint8_t reserved;
+    /// <summary>Flags, such as <see cref="MessageProtocol_Flag_Crc" />; otherwise 0.</summary>
+    uint8_t flags;
 } MessageProtocol_ResponseHeader;
 
 /// <summary>
@@ -15,3 +15,9 @@ typedef uint16_t MessageProtocol_EventId;
 
 /// <summary>Specifies the type of a message protocol response result.</summary>
 typedef uint8_t MessageProtocol_ResponseResult;
+
+/// <summary>Specifies the type of the address of an MCU on a shared bus.</summary>
+typedef uint8_t MessageProtocol_Address;
+
+/// <summary>Address of the only MCU on a point-to-point link.</summary>
+static const MessageProtocol_Address MessageProtocol_DefaultAddress = 0x00;
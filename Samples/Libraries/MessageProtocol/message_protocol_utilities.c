@@ -0,0 +1,57 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include "message_protocol_utilities.h"
+#include <string.h>
+
+bool MessageProtocol_IsMessageComplete(uint8_t *message, uint8_t messageLength)
+{
+    // Check the message has the minimum required length and starts with Preamble bytes
+    if (messageLength > sizeof(MessageProtocol_MessageHeader) &&
+        memcmp(MessageProtocol_MessagePreamble, message, sizeof(MessageProtocol_MessagePreamble)) ==
+            0) {
+        // Check whether the overall length is equal or greater than message header size + length
+        MessageProtocol_MessageHeader *messageHeader = (MessageProtocol_MessageHeader *)message;
+        return (messageLength >= messageHeader->length + sizeof(MessageProtocol_MessageHeader));
+    }
+    return false;
+}
+
+uint16_t MessageProtocol_Crc16(uint16_t crc, const uint8_t *data, size_t size)
+{
+    // Four bits are processed at a time, so that the table stays small enough for the MCU.
+    static const uint16_t table[16] = {0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5,
+                                       0x60C6, 0x70E7, 0x8108, 0x9129, 0xA14A, 0xB16B,
+                                       0xC18C, 0xD1AD, 0xE1CE, 0xF1EF};
+    for (size_t i = 0; i < size; ++i) {
+        crc = (uint16_t)((crc << 4) ^ table[(crc >> 12) ^ (data[i] >> 4)]);
+        crc = (uint16_t)((crc << 4) ^ table[(crc >> 12) ^ (data[i] & 0x0F)]);
+    }
+    return crc;
+}
+
+bool MessageProtocol_IsCrcValid(const uint8_t *message)
+{
+    const MessageProtocol_MessageHeader *messageHeader =
+        (const MessageProtocol_MessageHeader *)message;
+    if (messageHeader->length < MESSAGE_PROTOCOL_CRC_SIZE) {
+        return false;
+    }
+
+    size_t crcOffset =
+        sizeof(MessageProtocol_MessageHeader) + messageHeader->length - MESSAGE_PROTOCOL_CRC_SIZE;
+    uint16_t crc = MessageProtocol_Crc16(MESSAGE_PROTOCOL_CRC_INITIAL, message, crcOffset);
+    return message[crcOffset] == (uint8_t)crc && message[crcOffset + 1] == (uint8_t)(crc >> 8);
+}
+
+size_t MessageProtocol_AppendCrc(uint8_t *message)
+{
+    MessageProtocol_MessageHeader *messageHeader = (MessageProtocol_MessageHeader *)message;
+    size_t crcOffset = sizeof(MessageProtocol_MessageHeader) + messageHeader->length;
+    messageHeader->length = (uint16_t)(messageHeader->length + MESSAGE_PROTOCOL_CRC_SIZE);
+
+    uint16_t crc = MessageProtocol_Crc16(MESSAGE_PROTOCOL_CRC_INITIAL, message, crcOffset);
+    message[crcOffset] = (uint8_t)crc;
+    message[crcOffset + 1] = (uint8_t)(crc >> 8);
+    return crcOffset + MESSAGE_PROTOCOL_CRC_SIZE;
+}
@@ -0,0 +1,44 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include "message_protocol_private.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/// <summary>
+///     Check if the provided message data is complete.
+/// </summary>
+/// <param name="message">The message to check.</param>
+/// <param name="messageLength">The size of the message in bytes.</param>
+/// <returns>true if the message is complete, false otherwise.</returns>
+bool MessageProtocol_IsMessageComplete(uint8_t *message, uint8_t messageLength);
+
+/// <summary>Initial value of a CRC which is computed with MessageProtocol_Crc16.</summary>
+#define MESSAGE_PROTOCOL_CRC_INITIAL 0xFFFFu
+
+/// <summary>
+///     Add data to a CRC-16/CCITT-FALSE, the CRC of the trailer of a message which has
+///     <see cref="MessageProtocol_Flag_Crc" />.
+/// </summary>
+/// <param name="crc">The CRC of the preceding data, or MESSAGE_PROTOCOL_CRC_INITIAL.</param>
+/// <param name="data">The data.</param>
+/// <param name="size">The size of the data in bytes.</param>
+/// <returns>The CRC of the preceding data and this data.</returns>
+uint16_t MessageProtocol_Crc16(uint16_t crc, const uint8_t *data, size_t size);
+
+/// <summary>
+///     Check the CRC trailer of a complete message which has
+///     <see cref="MessageProtocol_Flag_Crc" />.
+/// </summary>
+/// <param name="message">The message, whose length field counts the trailer.</param>
+/// <returns>true if the trailer matches the message; false otherwise.</returns>
+bool MessageProtocol_IsCrcValid(const uint8_t *message);
+
+/// <summary>
+///     Append a CRC trailer to a message, and count it in the message's length field. The caller
+///     sets <see cref="MessageProtocol_Flag_Crc" />, and its buffer must have room for the trailer.
+/// </summary>
+/// <param name="message">The message.</param>
+/// <returns>The size of the message, including the trailer, in bytes.</returns>
+size_t MessageProtocol_AppendCrc(uint8_t *message);
@@ -0,0 +1,352 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+
+#define UART_STRUCTS_VERSION 1
+#include <applibs/eventloop.h>
+#include <applibs/uart.h>
+#include <applibs/log.h>
+
+#include "uart_transport.h"
+
+// Capacity of the queue that holds data the UART could not accept immediately; several messages
+// may be queued at once.
+#ifndef UART_SEND_BUFFER_SIZE
+#define UART_SEND_BUFFER_SIZE 1024u
+#endif
+
+// Number of messages in a row which may be lost before the UART falls back to the next profile.
+#ifndef UART_FALLBACK_ERRORS
+#define UART_FALLBACK_ERRORS 3u
+#endif
+
+static EventLoop *eventLoopRef = NULL;
+static int messageUartFd = -1;
+
+// The profiles with which the UART may be opened, fastest first, and the one which is in use.
+static UART_Id uartIdRef;
+static const UartTransport_Profile *uartProfiles = NULL;
+static size_t uartProfileCount = 0;
+static size_t uartProfileIndex = 0;
+
+// Number of messages which have been lost since one was last received intact.
+static unsigned int consecutiveLinkErrors = 0;
+
+static const UartTransport_Profile defaultProfiles[] = {
+    {.baudRate = 115200, .flowControl = UART_FlowControl_None},
+    {.baudRate = 115200, .flowControl = UART_FlowControl_RTSCTS},
+    {.baudRate = 115200, .flowControl = UART_FlowControl_XONXOFF}};
+
+static UartTransport_DataReadyCallback dataReadyCallback = NULL;
+
+// True if the UART event is registered for EventLoop_Output; false if EventLoop_Input
+static bool uartEventOutputEnabled = false;
+
+// Queue of data waiting to be written via UART. Data is only copied here when the UART cannot
+// accept it straight away.
+static uint8_t sendBuffer[UART_SEND_BUFFER_SIZE];
+
+// Total amount of data in sendBuffer.
+static size_t sendBufferDataLength = 0;
+
+// Amount of data so far written to the UART.
+static size_t sendBufferDataSent = 0;
+
+static EventRegistration *uartEventRegistration = NULL;
+
+static void UartEventHandler(EventLoop *el, int fd, EventLoop_IoEvents events, void *context);
+static void SendUartMessage(void);
+
+/// <summary>
+/// Handle events from the UART fd.
+/// </summary>
+static void UartEventHandler(EventLoop *el, int fd, EventLoop_IoEvents events, void *context)
+{
+    switch (events) {
+    case EventLoop_Input:
+        dataReadyCallback();
+        break;
+
+    case EventLoop_Output:
+        SendUartMessage();
+        break;
+
+    default:
+        Log_Debug("ERROR: Unexpected UART IO event %u\n", events);
+        break;
+    }
+}
+
+/// <summary>
+/// Attempt to send the data in <see cref="sendBuffer" /> over the UART. If this fails because the
+/// device is busy (as indicated by EAGAIN), then we modify the UART event registration to wait for
+/// EventLoop_Output, indicating the device is ready again and we should retry writing.
+/// </summary>
+static void SendUartMessage(void)
+{
+    if (uartEventOutputEnabled) {
+        EventLoop_ModifyIoEvents(eventLoopRef, uartEventRegistration, EventLoop_Input);
+        uartEventOutputEnabled = false;
+    }
+
+    while (sendBufferDataSent < sendBufferDataLength) {
+        // Send as much of the remaining data as possible.
+        size_t bytesLeftToSend = (size_t)(sendBufferDataLength - sendBufferDataSent);
+        const uint8_t *remainingMessageToSend = sendBuffer + sendBufferDataSent;
+        ssize_t bytesSent = write(messageUartFd, remainingMessageToSend, bytesLeftToSend);
+        if (bytesSent == -1) {
+            if (errno != EAGAIN) {
+                Log_Debug("ERROR: Failed to write to UART: %s (%d).\n", strerror(errno), errno);
+            } else {
+                // Register an output event to send the rest
+                EventLoop_ModifyIoEvents(eventLoopRef, uartEventRegistration, EventLoop_Output);
+                uartEventOutputEnabled = true;
+            }
+            return;
+        }
+        sendBufferDataSent += (size_t)bytesSent;
+    }
+}
+
+ssize_t UartTransport_Read(char *buffer, size_t amount)
+{
+    return read(messageUartFd, (void *)buffer, amount);
+}
+
+/// <summary>
+/// Append the data described by <paramref name="iov" /> to <see cref="sendBuffer" />, skipping the
+/// first <paramref name="skip" /> bytes, which have already been written.
+/// </summary>
+static void QueueUnsentData(const struct iovec *iov, int iovcnt, size_t skip)
+{
+    // Move any data still waiting to be sent to the front of the queue.
+    size_t pendingLength = sendBufferDataLength - sendBufferDataSent;
+    if (pendingLength > 0 && sendBufferDataSent > 0) {
+        memmove(sendBuffer, sendBuffer + sendBufferDataSent, pendingLength);
+    }
+    sendBufferDataLength = pendingLength;
+    sendBufferDataSent = 0;
+
+    for (int i = 0; i < iovcnt; ++i) {
+        if (skip >= iov[i].iov_len) {
+            skip -= iov[i].iov_len;
+            continue;
+        }
+        size_t length = iov[i].iov_len - skip;
+        memcpy(sendBuffer + sendBufferDataLength, (const uint8_t *)iov[i].iov_base + skip, length);
+        sendBufferDataLength += length;
+        skip = 0;
+    }
+}
+
+ssize_t UartTransport_SendV(const struct iovec *iov, int iovcnt)
+{
+    if (messageUartFd == -1) {
+        return 0;
+    }
+
+    size_t length = 0;
+    for (int i = 0; i < iovcnt; ++i) {
+        length += iov[i].iov_len;
+    }
+
+    size_t pendingLength = sendBufferDataLength - sendBufferDataSent;
+    if (length == 0 || pendingLength + length > UART_SEND_BUFFER_SIZE) {
+        return 0;
+    }
+
+    // If earlier data is still queued, the new data must go after it to preserve ordering; the
+    // queue will be drained when the UART is ready for output again.
+    if (pendingLength > 0) {
+        QueueUnsentData(iov, iovcnt, 0);
+        if (!uartEventOutputEnabled) {
+            SendUartMessage();
+        }
+        return (ssize_t)length;
+    }
+
+    // Otherwise write straight from the caller's buffers, and only copy whatever the UART could
+    // not accept.
+    ssize_t bytesSent = writev(messageUartFd, iov, iovcnt);
+    if (bytesSent == -1) {
+        if (errno != EAGAIN) {
+            Log_Debug("ERROR: Failed to write to UART: %s (%d).\n", strerror(errno), errno);
+            return (ssize_t)length;
+        }
+        bytesSent = 0;
+    }
+
+    if ((size_t)bytesSent < length) {
+        QueueUnsentData(iov, iovcnt, (size_t)bytesSent);
+        SendUartMessage();
+    }
+
+    return (ssize_t)length;
+}
+
+ssize_t UartTransport_Send(const char *buffer, size_t length)
+{
+    const struct iovec iov = {.iov_base = (void *)buffer, .iov_len = length};
+    return UartTransport_SendV(&iov, 1);
+}
+
+static const char *FlowControlName(UART_FlowControl_Type flowControl)
+{
+    switch (flowControl) {
+    case UART_FlowControl_RTSCTS:
+        return "RTS/CTS";
+    case UART_FlowControl_XONXOFF:
+        return "XON/XOFF";
+    default:
+        return "no";
+    }
+}
+
+// Opens the UART with the profile at uartProfileIndex, or if the UART does not support it, with
+// the first supported profile after it, and registers the UART with the event loop.
+static int OpenUart(void)
+{
+    for (; uartProfileIndex < uartProfileCount; ++uartProfileIndex) {
+        const UartTransport_Profile *profile = &uartProfiles[uartProfileIndex];
+
+        UART_Config config;
+        UART_InitConfig(&config);
+        config.baudRate = profile->baudRate;
+        config.dataBits = 8;
+        config.parity = UART_Parity_None;
+        config.stopBits = 1;
+        config.flowControl = profile->flowControl;
+
+        messageUartFd = UART_Open(uartIdRef, &config);
+        if (messageUartFd != -1) {
+            break;
+        }
+        Log_Debug("WARNING: Failed to open UART at %u baud: %s (%d)\n", profile->baudRate,
+                  strerror(errno), errno);
+    }
+    if (messageUartFd == -1) {
+        Log_Debug("ERROR: Failed to open UART with any profile.\n");
+        return -1;
+    }
+
+    uartEventRegistration =
+        EventLoop_RegisterIo(eventLoopRef, messageUartFd, EventLoop_Input, UartEventHandler, NULL);
+    if (uartEventRegistration == NULL) {
+        Log_Debug("ERROR: Failed to register UART fd to event loop: %s (%d)", strerror(errno),
+                  errno);
+        return -1;
+    }
+    uartEventOutputEnabled = false;
+
+    const UartTransport_Profile *profile = &uartProfiles[uartProfileIndex];
+    Log_Debug("INFO: Opened UART at %u baud, with %s flow control.\n", profile->baudRate,
+              FlowControlName(profile->flowControl));
+    return 0;
+}
+
+static void CloseUart(void)
+{
+    if (uartEventRegistration != NULL) {
+        int result = EventLoop_UnregisterIo(eventLoopRef, uartEventRegistration);
+        if (result == -1) {
+            Log_Debug("ERROR: Failed to unregister UART from event loop: %s (%d)", strerror(errno),
+                      errno);
+        }
+        uartEventRegistration = NULL;
+    }
+
+    if (messageUartFd != -1) {
+        int result = close(messageUartFd);
+        if (result == -1) {
+            Log_Debug("ERROR: Failed to close UART fd: %s (%d)", strerror(errno), errno);
+        }
+        messageUartFd = -1;
+    }
+
+    // Data which was queued for the old settings would be garbled by the new ones.
+    sendBufferDataLength = 0;
+    sendBufferDataSent = 0;
+}
+
+void UartTransport_NotifyLinkQuality(bool messageValid)
+{
+    if (messageValid) {
+        consecutiveLinkErrors = 0;
+        return;
+    }
+
+    if (++consecutiveLinkErrors < UART_FALLBACK_ERRORS ||
+        uartProfileIndex + 1 >= uartProfileCount || eventLoopRef == NULL) {
+        return;
+    }
+
+    Log_Debug("WARNING: Lost %u messages in a row at %u baud; falling back to %u baud.\n",
+              consecutiveLinkErrors, uartProfiles[uartProfileIndex].baudRate,
+              uartProfiles[uartProfileIndex + 1].baudRate);
+    consecutiveLinkErrors = 0;
+
+    CloseUart();
+    ++uartProfileIndex;
+    if (OpenUart() != 0) {
+        // Leave the transport closed; sends will be dropped until it is initialized again.
+        CloseUart();
+    }
+}
+
+const UartTransport_Profile *UartTransport_GetProfile(void)
+{
+    return (messageUartFd != -1) ? &uartProfiles[uartProfileIndex] : NULL;
+}
+
+int UartTransport_InitializeWithProfiles(EventLoop *eventLoop, UART_Id uartId,
+                                         const UartTransport_Profile *profiles,
+                                         size_t profileCount,
+                                         UartTransport_DataReadyCallback uartDataReadyCallback)
+{
+    if (profiles == NULL || profileCount == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    eventLoopRef = eventLoop;
+    uartIdRef = uartId;
+    uartProfiles = profiles;
+    uartProfileCount = profileCount;
+    uartProfileIndex = 0;
+    consecutiveLinkErrors = 0;
+    dataReadyCallback = uartDataReadyCallback;
+
+    return OpenUart();
+}
+
+int UartTransport_Initialize(EventLoop *eventLoop, UART_Id uartId, UART_FlowControl_Type flowControl,
+                             UartTransport_DataReadyCallback uartDataReadyCallback)
+{
+    for (size_t i = 0; i < sizeof(defaultProfiles) / sizeof(defaultProfiles[0]); ++i) {
+        if (defaultProfiles[i].flowControl == flowControl) {
+            return UartTransport_InitializeWithProfiles(eventLoop, uartId, &defaultProfiles[i], 1,
+                                                        uartDataReadyCallback);
+        }
+    }
+
+    errno = EINVAL;
+    return -1;
+}
+
+void UartTransport_Cleanup(void)
+{
+    CloseUart();
+
+    eventLoopRef = NULL;
+    dataReadyCallback = NULL;
+    uartProfiles = NULL;
+    uartProfileCount = 0;
+}
@@ -0,0 +1,110 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <sys/uio.h>
+
+#define UART_STRUCTS_VERSION 1
+#include <applibs/eventloop.h>
+#include <applibs/uart.h>
+
+typedef void (*UartTransport_DataReadyCallback)(void);
+
+/// <summary>
+///     Settings with which the UART can be opened. The UART is always opened with 8N1 framing.
+///     The hardware definitions list the profiles for each external MCU in hw/uart_profiles.h.
+/// </summary>
+typedef struct {
+    UART_BaudRate_Type baudRate;
+    UART_FlowControl_Type flowControl;
+} UartTransport_Profile;
+
+/// <summary>
+///     Initialize the UART transport at 115200 baud.
+/// </summary>
+/// <param name="eventLoop">Pointer to the main application EventLoop.</param>
+/// <param name="uartId">ID of the UART to open.</param>
+/// <param name="flowControl">Flow control to use.</param>
+/// <param name="receivedDataCallback">
+///     Function to call when data is ready to be read from the UART.
+/// </param>
+/// <returns>0 on success, or -1 on failure, in which case errno is set to the error.</returns>
+int UartTransport_Initialize(EventLoop *eventLoop, UART_Id uartId, UART_FlowControl_Type flowControl,
+                             UartTransport_DataReadyCallback receivedDataCallback);
+
+/// <summary>
+///     Initialize the UART transport with a list of profiles, fastest first. The UART is opened
+///     with the first profile which it supports. If the link then loses too many messages in a
+///     row, as reported by <see cref="UartTransport_NotifyLinkQuality" />, the UART is reopened
+///     with the next profile. The last profile is kept however many messages are lost.
+/// </summary>
+/// <param name="eventLoop">Pointer to the main application EventLoop.</param>
+/// <param name="uartId">ID of the UART to open.</param>
+/// <param name="profiles">The profiles. Not copied, so the array must remain valid until
+/// <see cref="UartTransport_Cleanup" /> is called.</param>
+/// <param name="profileCount">Number of profiles, which must not be zero.</param>
+/// <param name="receivedDataCallback">
+///     Function to call when data is ready to be read from the UART.
+/// </param>
+/// <returns>0 on success, or -1 on failure, in which case errno is set to the error.</returns>
+int UartTransport_InitializeWithProfiles(EventLoop *eventLoop, UART_Id uartId,
+                                         const UartTransport_Profile *profiles,
+                                         size_t profileCount,
+                                         UartTransport_DataReadyCallback receivedDataCallback);
+
+/// <summary>
+///     Tell the transport whether a message arrived intact. This has the signature of a
+///     MessageProtocol_LinkQualityHandlerType, so it can be passed to
+///     MessageProtocol_RegisterLinkQualityHandler.
+/// </summary>
+/// <param name="messageValid">true if a message was received intact; false if data was
+/// corrupted or lost.</param>
+void UartTransport_NotifyLinkQuality(bool messageValid);
+
+/// <summary>
+///     Get the profile with which the UART is open.
+/// </summary>
+/// <returns>The profile, or NULL if the UART is not open.</returns>
+const UartTransport_Profile *UartTransport_GetProfile(void);
+
+/// <summary>
+///     Close the UART transport - closes the device and de-registers any events from the EventLoop.
+/// </summary>
+void UartTransport_Cleanup(void);
+
+/// <summary>
+///     Queue data to be sent over the UART. This function will return immediately, but the
+///     transfer may occur asynchronously, completing after the function returns.
+/// </summary>
+/// <param name="buffer">The data to be sent over the UART.</param>
+/// <param name="length">Length of the data to be sent - must not be zero.</param>
+/// <returns>
+///     0 if the UART is not initialized or if the data does not fit alongside any data still
+///     waiting to be sent; otherwise, the length of the queued data.
+/// </returns>
+ssize_t UartTransport_Send(const char *buffer, size_t length);
+
+/// <summary>
+///     Queue data gathered from several buffers to be sent over the UART as one contiguous
+///     message. The data is written directly from the supplied buffers where possible, and is
+///     only copied if the UART cannot accept all of it immediately, so the buffers may be reused
+///     as soon as this function returns.
+/// </summary>
+/// <param name="iov">The buffers holding the data to be sent, in order.</param>
+/// <param name="iovcnt">Number of entries in <paramref name="iov" />.</param>
+/// <returns>
+///     0 if the UART is not initialized, if there is no data, or if the data does not fit
+///     alongside any data still waiting to be sent; otherwise, the total length of the data.
+/// </returns>
+ssize_t UartTransport_SendV(const struct iovec *iov, int iovcnt);
+
+/// <summary>
+///     Attempt to read data from the UART. This should be called upon receipt of a
+///     <see cref="UartTransport_DataReadyCallBack" />.
+/// </summary>
+/// <param name="buffer">Buffer into which data read from the UART should be written.</param>
+/// <param name="amount">Amount of data to attempt to read.</param>
+/// <returns>The amount of data read, or -1 if the operation failed.</returns>
+ssize_t UartTransport_Read(char *buffer, size_t amount);
\ No newline at end of file
@@ -0,0 +1,419 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include <applibs/log.h>
+#include <applibs/storage.h>
+
+#include "metrics.h"
+
+typedef enum { MetricType_Counter = 1, MetricType_Gauge = 2, MetricType_Histogram = 3 } MetricType;
+
+typedef struct {
+    const char *name;
+    MetricType type;
+    size_t bucketCount;
+    int64_t bounds[METRICS_MAX_BUCKETS - 1];
+    // The counter's total, the gauge's value, or the sum of the histogram's values.
+    int64_t value;
+    uint32_t count;
+    uint32_t buckets[METRICS_MAX_BUCKETS];
+} Metric;
+
+// A metric is restored only into one with the same name, type and number of buckets.
+typedef struct {
+    uint32_t nameHash;
+    uint32_t form;
+    int64_t value;
+    uint32_t count;
+    uint32_t buckets[METRICS_MAX_BUCKETS];
+} StoredMetric;
+
+static const uint32_t storeMagic = ('M' << 24) | ('T' << 16) | ('R' << 8) | 'C';
+
+// The store is written in one operation, and its CRC covers all its other fields, so that a store
+// which was only partly written is ignored.
+typedef struct {
+    uint32_t magic;
+    uint32_t count;
+    uint32_t starts;
+    int32_t exitCode;
+    StoredMetric metrics[METRICS_MAX_METRICS];
+    uint32_t crc;
+} Store;
+
+_Static_assert(sizeof(Store) <= METRICS_STORAGE_SIZE, "Store is larger than its storage");
+
+static Metric metrics[METRICS_MAX_METRICS];
+static size_t metricCount = 0;
+
+static EventLoop *metricsEventLoop = NULL;
+static int timerFd = -1;
+static EventRegistration *timerRegistration = NULL;
+static Metrics_ReportHandler reportHandler = NULL;
+static void *reportContext = NULL;
+static bool started = false;
+
+static off_t storeOffset = 0;
+static uint32_t starts = 0;
+// The exit code of the previous run, if there was one, and the one to keep for the next run.
+static bool havePreviousExitCode = false;
+static int previousExitCode = METRICS_EXIT_CODE_UNKNOWN;
+static int nextExitCode = METRICS_EXIT_CODE_UNKNOWN;
+// Whether anything which is kept in mutable storage has changed since it was last written.
+static bool dirty = false;
+
+static uint32_t Crc32(const void *data, size_t length)
+{
+    const uint8_t *bytes = data;
+    uint32_t crc = 0xFFFFFFFFu;
+    while (length-- > 0) {
+        crc ^= *bytes++;
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc >> 1) ^ (0xEDB88320u & -(crc & 1u));
+        }
+    }
+    return ~crc;
+}
+
+static uint32_t StoreCrc(const Store *s)
+{
+    return Crc32(s, offsetof(Store, crc));
+}
+
+// FNV-1a, which identifies a stored metric without keeping its name.
+static uint32_t NameHash(const char *name)
+{
+    uint32_t hash = 2166136261u;
+    while (*name != '\0') {
+        hash = (hash ^ (uint8_t)*name++) * 16777619u;
+    }
+    return hash;
+}
+
+static uint32_t MetricForm(const Metric *metric)
+{
+    return (uint32_t)metric->type | ((uint32_t)metric->bucketCount << 8);
+}
+
+static Metrics_Id Register(const char *name, MetricType type)
+{
+    if (started) {
+        errno = EBUSY;
+        return -1;
+    }
+    if (name == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (metricCount == METRICS_MAX_METRICS) {
+        errno = ENOSPC;
+        return -1;
+    }
+
+    Metric *metric = &metrics[metricCount];
+    memset(metric, 0, sizeof(*metric));
+    metric->name = name;
+    metric->type = type;
+    return (Metrics_Id)metricCount++;
+}
+
+static Metric *GetMetric(Metrics_Id id, MetricType type)
+{
+    if (id < 0 || (size_t)id >= metricCount || metrics[id].type != type) {
+        return NULL;
+    }
+    return &metrics[id];
+}
+
+Metrics_Id Metrics_RegisterCounter(const char *name)
+{
+    return Register(name, MetricType_Counter);
+}
+
+Metrics_Id Metrics_RegisterGauge(const char *name)
+{
+    return Register(name, MetricType_Gauge);
+}
+
+Metrics_Id Metrics_RegisterHistogram(const char *name, const int64_t *bounds, size_t boundCount)
+{
+    if (boundCount >= METRICS_MAX_BUCKETS || (boundCount > 0 && bounds == NULL)) {
+        errno = EINVAL;
+        return -1;
+    }
+    for (size_t i = 1; i < boundCount; ++i) {
+        if (bounds[i] <= bounds[i - 1]) {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+
+    Metrics_Id id = Register(name, MetricType_Histogram);
+    if (id >= 0) {
+        metrics[id].bucketCount = boundCount + 1;
+        memcpy(metrics[id].bounds, bounds, boundCount * sizeof(bounds[0]));
+    }
+    return id;
+}
+
+void Metrics_Add(Metrics_Id id, int64_t delta)
+{
+    Metric *metric = GetMetric(id, MetricType_Counter);
+    if (metric != NULL && delta != 0) {
+        metric->value += delta;
+        dirty = true;
+    }
+}
+
+void Metrics_Set(Metrics_Id id, int64_t value)
+{
+    Metric *metric = GetMetric(id, MetricType_Gauge);
+    if (metric != NULL) {
+        metric->value = value;
+    }
+}
+
+void Metrics_Observe(Metrics_Id id, int64_t value)
+{
+    Metric *metric = GetMetric(id, MetricType_Histogram);
+    if (metric == NULL) {
+        return;
+    }
+
+    size_t bucket = 0;
+    while (bucket < metric->bucketCount - 1 && value > metric->bounds[bucket]) {
+        ++bucket;
+    }
+    ++metric->buckets[bucket];
+    ++metric->count;
+    metric->value += value;
+    dirty = true;
+}
+
+// Restores the counters and histograms, and returns whether a valid store was found.
+static bool ReadStore(void)
+{
+    int fd = Storage_OpenMutableFile();
+    if (fd == -1) {
+        Log_Debug("ERROR: Could not open mutable storage: %s (%d).\n", strerror(errno), errno);
+        return false;
+    }
+
+    Store store;
+    bool valid = lseek(fd, storeOffset, SEEK_SET) != -1 &&
+                 read(fd, &store, sizeof(store)) == (ssize_t)sizeof(store) &&
+                 store.magic == storeMagic && store.crc == StoreCrc(&store) &&
+                 store.count <= METRICS_MAX_METRICS;
+    close(fd);
+
+    if (!valid) {
+        return false;
+    }
+
+    starts = store.starts;
+    previousExitCode = store.exitCode;
+    for (size_t i = 0; i < store.count; ++i) {
+        const StoredMetric *stored = &store.metrics[i];
+        for (size_t j = 0; j < metricCount; ++j) {
+            Metric *metric = &metrics[j];
+            if (metric->type != MetricType_Gauge && stored->form == MetricForm(metric) &&
+                stored->nameHash == NameHash(metric->name)) {
+                metric->value = stored->value;
+                metric->count = stored->count;
+                memcpy(metric->buckets, stored->buckets, sizeof(metric->buckets));
+                break;
+            }
+        }
+    }
+    return true;
+}
+
+void Metrics_Persist(void)
+{
+    if (!started || !dirty) {
+        return;
+    }
+
+    // Zero the store so that the CRC does not depend on padding or on unused metrics.
+    Store store;
+    memset(&store, 0, sizeof(store));
+    store.magic = storeMagic;
+    store.starts = starts;
+    store.exitCode = nextExitCode;
+    for (size_t i = 0; i < metricCount; ++i) {
+        const Metric *metric = &metrics[i];
+        if (metric->type == MetricType_Gauge) {
+            continue;
+        }
+        StoredMetric *stored = &store.metrics[store.count++];
+        stored->nameHash = NameHash(metric->name);
+        stored->form = MetricForm(metric);
+        stored->value = metric->value;
+        stored->count = metric->count;
+        memcpy(stored->buckets, metric->buckets, sizeof(stored->buckets));
+    }
+    store.crc = StoreCrc(&store);
+
+    int fd = Storage_OpenMutableFile();
+    if (fd == -1) {
+        Log_Debug("ERROR: Could not open mutable storage: %s (%d).\n", strerror(errno), errno);
+        return;
+    }
+    if (lseek(fd, storeOffset, SEEK_SET) == -1 ||
+        write(fd, &store, sizeof(store)) != (ssize_t)sizeof(store)) {
+        Log_Debug("ERROR: Could not write metrics: %s (%d).\n", strerror(errno), errno);
+    } else {
+        dirty = false;
+    }
+    close(fd);
+}
+
+// This satisfies the EventLoopIoCallback signature.
+static void ReportTimerCallback(EventLoop *el, int fd, EventLoop_IoEvents events, void *context)
+{
+    uint64_t expirations;
+    if (read(timerFd, &expirations, sizeof(expirations)) == -1) {
+        Log_Debug("ERROR: Could not read timerfd %s (%d).\n", strerror(errno), errno);
+        return;
+    }
+
+    if (reportHandler != NULL) {
+        reportHandler(reportContext);
+    } else {
+        Metrics_Log();
+    }
+    Metrics_Persist();
+}
+
+int Metrics_Start(EventLoop *eventLoop, off_t storageOffset, unsigned int reportPeriodSeconds,
+                  Metrics_ReportHandler handler, void *context)
+{
+    if (started || reportPeriodSeconds == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (timerFd == -1) {
+        Log_Debug("ERROR: Unable to create timer: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+
+    struct timespec period = {.tv_sec = reportPeriodSeconds, .tv_nsec = 0};
+    struct itimerspec newValue = {.it_value = period, .it_interval = period};
+    if (timerfd_settime(timerFd, /* flags */ 0, &newValue, /* old_value */ NULL) == -1) {
+        Log_Debug("ERROR: Could not set timer period: %s (%d).\n", strerror(errno), errno);
+        goto failed;
+    }
+
+    timerRegistration =
+        EventLoop_RegisterIo(eventLoop, timerFd, EventLoop_Input, ReportTimerCallback, NULL);
+    if (timerRegistration == NULL) {
+        Log_Debug("ERROR: Unable to register timer event: %s (%d).\n", strerror(errno), errno);
+        goto failed;
+    }
+
+    metricsEventLoop = eventLoop;
+    reportHandler = handler;
+    reportContext = context;
+    storeOffset = storageOffset;
+    starts = 0;
+    havePreviousExitCode = ReadStore();
+
+    // Until the application records its exit code, a crash is recorded.
+    ++starts;
+    nextExitCode = METRICS_EXIT_CODE_UNKNOWN;
+    started = true;
+    dirty = true;
+    Metrics_Persist();
+    return 0;
+
+failed:
+    Metrics_Stop();
+    return -1;
+}
+
+void Metrics_RecordExitCode(int exitCode)
+{
+    if (exitCode != nextExitCode) {
+        nextExitCode = exitCode;
+        dirty = true;
+    }
+}
+
+void Metrics_Log(void)
+{
+    Log_Debug("INFO: Metrics: started %lu times", (unsigned long)starts);
+    if (havePreviousExitCode) {
+        Log_Debug(", last exit code %d", previousExitCode);
+    }
+    Log_Debug(".\n");
+
+    for (size_t i = 0; i < metricCount; ++i) {
+        const Metric *metric = &metrics[i];
+        if (metric->type != MetricType_Histogram) {
+            Log_Debug("INFO:   %s: %lld\n", metric->name, (long long)metric->value);
+            continue;
+        }
+
+        Log_Debug("INFO:   %s: %lu values, sum %lld\n", metric->name,
+                  (unsigned long)metric->count, (long long)metric->value);
+        for (size_t b = 0; b < metric->bucketCount; ++b) {
+            if (b < metric->bucketCount - 1) {
+                Log_Debug("INFO:     <= %lld: %lu\n", (long long)metric->bounds[b],
+                          (unsigned long)metric->buckets[b]);
+            } else if (b > 0) {
+                Log_Debug("INFO:     > %lld: %lu\n", (long long)metric->bounds[b - 1],
+                          (unsigned long)metric->buckets[b]);
+            }
+        }
+    }
+}
+
+void Metrics_WriteJson(JsonWriter *writer)
+{
+    JsonWriter_AddInt(writer, "Starts", starts);
+    if (havePreviousExitCode) {
+        JsonWriter_AddInt(writer, "LastExitCode", previousExitCode);
+    }
+
+    for (size_t i = 0; i < metricCount; ++i) {
+        const Metric *metric = &metrics[i];
+        if (metric->type != MetricType_Histogram) {
+            JsonWriter_AddInt(writer, metric->name, metric->value);
+            continue;
+        }
+
+        JsonWriter_BeginObject(writer, metric->name);
+        JsonWriter_AddInt(writer, "Count", metric->count);
+        JsonWriter_AddInt(writer, "Sum", metric->value);
+        JsonWriter_BeginArray(writer, "Buckets");
+        for (size_t b = 0; b < metric->bucketCount; ++b) {
+            JsonWriter_AddInt(writer, NULL, metric->buckets[b]);
+        }
+        JsonWriter_EndArray(writer);
+        JsonWriter_EndObject(writer);
+    }
+}
+
+void Metrics_Stop(void)
+{
+    if (timerRegistration != NULL) {
+        EventLoop_UnregisterIo(metricsEventLoop, timerRegistration);
+        timerRegistration = NULL;
+    }
+    if (timerFd != -1) {
+        close(timerFd);
+        timerFd = -1;
+    }
+
+    Metrics_Persist();
+    started = false;
+}
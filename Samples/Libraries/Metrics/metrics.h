@@ -0,0 +1,145 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <applibs/eventloop.h>
+
+#include "json_writer.h"
+
+// The metrics registry holds an application's named counters, gauges and histograms in a fixed
+// array, so that every application which is derived from the samples reports its performance in
+// the same form. The metrics are registered at startup, updated as the application runs, and
+// reported periodically, for example as one telemetry message.
+//
+// Counters and histograms accumulate over the life of the device: they are kept in the
+// application's mutable storage after each report and when the registry is stopped, and restored
+// when it is started again. Gauges hold a current value, and are not kept. The registry also
+// counts the times that the application has started, and keeps the exit code with which it last
+// stopped, which each sample defines in its own ExitCode enum.
+//
+// The registry is not thread-safe; it should only be used from the event loop's thread.
+
+/// <summary>Maximum number of metrics, excluding those which the registry itself keeps.</summary>
+#define METRICS_MAX_METRICS 16
+
+/// <summary>Maximum number of buckets in a histogram, including the bucket for values above the
+/// highest bound.</summary>
+#define METRICS_MAX_BUCKETS 8
+
+/// <summary>Number of bytes of mutable storage which the registry uses.</summary>
+#define METRICS_STORAGE_SIZE 1024
+
+/// <summary>Exit code which is reported when the application stopped without recording
+/// one, for example because it crashed.</summary>
+#define METRICS_EXIT_CODE_UNKNOWN (-1)
+
+/// <summary>Identifier of a metric; negative if the metric could not be registered.</summary>
+typedef int Metrics_Id;
+
+/// <summary>
+///     Invoked at the end of each report period, before the metrics are kept in mutable storage.
+///     The handler typically writes the metrics with Metrics_WriteJson and sends them.
+/// </summary>
+/// <param name="context">Context which was supplied to Metrics_Start.</param>
+typedef void (*Metrics_ReportHandler)(void *context);
+
+/// <summary>
+///     Registers a counter, which accumulates the values which are added to it.
+/// </summary>
+/// <param name="name">Name of the metric, which must remain valid.</param>
+/// <returns>The identifier of the metric, or -1 on failure, in which case errno is set: ENOSPC if
+/// METRICS_MAX_METRICS are registered, or EBUSY if the registry has been started.</returns>
+Metrics_Id Metrics_RegisterCounter(const char *name);
+
+/// <summary>
+///     Registers a gauge, which holds the value which was last set.
+/// </summary>
+/// <param name="name">Name of the metric, which must remain valid.</param>
+/// <returns>The identifier of the metric, or -1 on failure, in which case errno is set.</returns>
+Metrics_Id Metrics_RegisterGauge(const char *name);
+
+/// <summary>
+///     Registers a histogram, which counts the values which are observed in buckets.
+/// </summary>
+/// <param name="name">Name of the metric, which must remain valid.</param>
+/// <param name="bounds">Upper bounds of the buckets, in increasing order, which are copied. A
+/// value falls into the first bucket whose bound it does not exceed, or into the last bucket if
+/// it exceeds every bound.</param>
+/// <param name="boundCount">Number of bounds, less than METRICS_MAX_BUCKETS.</param>
+/// <returns>The identifier of the metric, or -1 on failure, in which case errno is set.</returns>
+Metrics_Id Metrics_RegisterHistogram(const char *name, const int64_t *bounds, size_t boundCount);
+
+/// <summary>
+///     Adds to a counter. The call is ignored if the identifier is not that of a counter.
+/// </summary>
+/// <param name="id">Identifier of the counter.</param>
+/// <param name="delta">Value to add.</param>
+void Metrics_Add(Metrics_Id id, int64_t delta);
+
+/// <summary>
+///     Sets a gauge. The call is ignored if the identifier is not that of a gauge.
+/// </summary>
+/// <param name="id">Identifier of the gauge.</param>
+/// <param name="value">The current value.</param>
+void Metrics_Set(Metrics_Id id, int64_t value);
+
+/// <summary>
+///     Records a value in a histogram. The call is ignored if the identifier is not that of a
+///     histogram.
+/// </summary>
+/// <param name="id">Identifier of the histogram.</param>
+/// <param name="value">The value.</param>
+void Metrics_Observe(Metrics_Id id, int64_t value);
+
+/// <summary>
+///     Starts the registry once the metrics are registered. The counters and histograms which
+///     were kept in mutable storage under the same name and form are restored, the start is
+///     counted, and reports begin.
+/// </summary>
+/// <param name="eventLoop">Event loop which runs the report timer.</param>
+/// <param name="storageOffset">Offset within the mutable storage file of the
+/// METRICS_STORAGE_SIZE bytes which the registry uses.</param>
+/// <param name="reportPeriodSeconds">Period at which the metrics are reported.</param>
+/// <param name="handler">Function which is invoked to report the metrics, or NULL to log
+/// them.</param>
+/// <param name="context">Context which is passed to the handler.</param>
+/// <returns>0 on success, or -1 on failure, in which case errno is set.</returns>
+int Metrics_Start(EventLoop *eventLoop, off_t storageOffset, unsigned int reportPeriodSeconds,
+                  Metrics_ReportHandler handler, void *context);
+
+/// <summary>
+///     Records the code with which the application is exiting, to be reported after it next
+///     starts. Call this before Metrics_Stop.
+/// </summary>
+/// <param name="exitCode">The application's exit code.</param>
+void Metrics_RecordExitCode(int exitCode);
+
+/// <summary>
+///     Keeps the counters and histograms in mutable storage, if they have changed since they were
+///     last kept.
+/// </summary>
+void Metrics_Persist(void);
+
+/// <summary>
+///     Logs every metric.
+/// </summary>
+void Metrics_Log(void);
+
+/// <summary>
+///     Adds every metric to the object which a JSON writer is writing. Counters and gauges are
+///     numbers, and histograms are objects with the count and sum of the values, and an array of
+///     the counts in each bucket. The registry adds "Starts" and "LastExitCode".
+/// </summary>
+/// <param name="writer">Writer which is inside an object.</param>
+void Metrics_WriteJson(JsonWriter *writer);
+
+/// <summary>
+///     Stops the reports and keeps the metrics in mutable storage. This should be called before
+///     the event loop is closed. The metrics remain registered.
+/// </summary>
+void Metrics_Stop(void);
@@ -0,0 +1,187 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include <applibs/eventloop.h>
+#include <applibs/log.h>
+#include <applibs/networking.h>
+
+#include "network_state.h"
+
+typedef struct {
+    NetworkState_ChangedHandler handler;
+    void *context;
+} Subscriber;
+
+static EventLoop *stateEventLoop = NULL;
+static const char *stateInterface = NULL;
+static int timerFd = -1;
+static EventRegistration *timerRegistration = NULL;
+static NetworkState_ErrorHandler errorHandler = NULL;
+static void *errorContext = NULL;
+
+static Subscriber subscribers[NETWORK_STATE_MAX_SUBSCRIBERS];
+static size_t subscriberCount = 0;
+
+// Status from the last poll, and whether there has been a poll since the service started.
+static Networking_InterfaceConnectionStatus currentStatus = 0;
+static bool haveStatus = false;
+static unsigned int currentPeriodMs = 0;
+
+static int ArmTimer(unsigned int delayMs, unsigned int periodMs)
+{
+    // A zero it_value would disarm the timer, so an immediate poll is armed for 1 ns.
+    struct itimerspec newValue = {
+        .it_value = {.tv_sec = delayMs / 1000, .tv_nsec = (delayMs % 1000) * 1000000 + 1},
+        .it_interval = {.tv_sec = periodMs / 1000, .tv_nsec = (periodMs % 1000) * 1000000}};
+    if (timerfd_settime(timerFd, /* flags */ 0, &newValue, /* old_value */ NULL) == -1) {
+        Log_Debug("ERROR: Could not set network poll period: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+
+    currentPeriodMs = periodMs;
+    return 0;
+}
+
+static void Poll(void)
+{
+    Networking_InterfaceConnectionStatus status;
+    if (Networking_GetInterfaceConnectionStatus(stateInterface, &status) != 0) {
+        if (errno != EAGAIN) {
+            Log_Debug("ERROR: Networking_GetInterfaceConnectionStatus: %d (%s)\n", errno,
+                      strerror(errno));
+            if (errorHandler != NULL) {
+                errorHandler(errorContext);
+            }
+            return;
+        }
+        // The networking stack isn't ready yet.
+        status = 0;
+    }
+
+    bool connected = (status & Networking_InterfaceConnectionStatus_ConnectedToInternet) != 0;
+    unsigned int periodMs =
+        connected ? NETWORK_STATE_CONNECTED_POLL_PERIOD_MS : NETWORK_STATE_WAITING_POLL_PERIOD_MS;
+    if (periodMs != currentPeriodMs) {
+        ArmTimer(periodMs, periodMs);
+    }
+
+    if (haveStatus && status == currentStatus) {
+        return;
+    }
+
+    Log_Debug("INFO: Network interface %s status: 0x%02x%s\n", stateInterface, status,
+              connected ? ", connected to the internet" : "");
+    haveStatus = true;
+    currentStatus = status;
+
+    for (size_t i = 0; i < subscriberCount; ++i) {
+        subscribers[i].handler(status, subscribers[i].context);
+        // A subscriber may have stopped the service.
+        if (timerFd == -1) {
+            return;
+        }
+    }
+}
+
+// This satisfies the EventLoopIoCallback signature.
+static void PollTimerCallback(EventLoop *el, int fd, EventLoop_IoEvents events, void *context)
+{
+    uint64_t expirations;
+    if (read(timerFd, &expirations, sizeof(expirations)) == -1) {
+        Log_Debug("ERROR: Could not read timerfd %s (%d).\n", strerror(errno), errno);
+        return;
+    }
+
+    Poll();
+}
+
+int NetworkState_Start(EventLoop *eventLoop, const char *interfaceName,
+                       NetworkState_ErrorHandler handler, void *context)
+{
+    if (timerFd != -1 || interfaceName == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (timerFd == -1) {
+        Log_Debug("ERROR: Unable to create timer: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+
+    // Poll as soon as the event loop runs, and then quickly until the interface is connected.
+    if (ArmTimer(0, NETWORK_STATE_WAITING_POLL_PERIOD_MS) == -1) {
+        goto failed;
+    }
+
+    timerRegistration =
+        EventLoop_RegisterIo(eventLoop, timerFd, EventLoop_Input, PollTimerCallback, NULL);
+    if (timerRegistration == NULL) {
+        Log_Debug("ERROR: Unable to register timer event: %s (%d).\n", strerror(errno), errno);
+        goto failed;
+    }
+
+    stateEventLoop = eventLoop;
+    stateInterface = interfaceName;
+    errorHandler = handler;
+    errorContext = context;
+    currentStatus = 0;
+    haveStatus = false;
+    return 0;
+
+failed:
+    NetworkState_Stop();
+    return -1;
+}
+
+void NetworkState_Stop(void)
+{
+    if (timerRegistration != NULL) {
+        EventLoop_UnregisterIo(stateEventLoop, timerRegistration);
+        timerRegistration = NULL;
+    }
+    if (timerFd != -1) {
+        close(timerFd);
+        timerFd = -1;
+    }
+    subscriberCount = 0;
+    currentPeriodMs = 0;
+}
+
+int NetworkState_Subscribe(NetworkState_ChangedHandler handler, void *context)
+{
+    if (subscriberCount == NETWORK_STATE_MAX_SUBSCRIBERS) {
+        errno = ENOSPC;
+        return -1;
+    }
+
+    subscribers[subscriberCount].handler = handler;
+    subscribers[subscriberCount].context = context;
+    ++subscriberCount;
+    return 0;
+}
+
+void NetworkState_Refresh(void)
+{
+    if (timerFd != -1) {
+        Poll();
+    }
+}
+
+Networking_InterfaceConnectionStatus NetworkState_GetStatus(void)
+{
+    return currentStatus;
+}
+
+bool NetworkState_IsConnectedToInternet(void)
+{
+    return (currentStatus & Networking_InterfaceConnectionStatus_ConnectedToInternet) != 0;
+}
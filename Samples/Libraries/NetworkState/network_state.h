@@ -0,0 +1,92 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+
+#include <applibs/eventloop.h>
+#include <applibs/networking.h>
+
+// The network state service polls the connection status of one network interface on behalf of
+// every part of an application, caches it, and notifies subscribers when it changes, so that each
+// part does not have to poll the interface on its own timer. The application libraries do not
+// notify an application when the connection status changes, so the service polls quickly until the
+// interface is connected to the internet, and then slowly, to notice when the connection is lost.
+//
+// The service is not thread-safe; it should only be used from the event loop's thread.
+
+/// <summary>Maximum number of subscribers.</summary>
+#define NETWORK_STATE_MAX_SUBSCRIBERS 4
+
+/// <summary>Poll period while the interface is not connected to the internet.</summary>
+#define NETWORK_STATE_WAITING_POLL_PERIOD_MS 1000
+
+/// <summary>Poll period while the interface is connected to the internet.</summary>
+#define NETWORK_STATE_CONNECTED_POLL_PERIOD_MS 10000
+
+/// <summary>
+///     Applications implement a function with this signature to be notified when the connection
+///     status of the interface changes. Every subscriber is notified of the first status, shortly
+///     after the service starts.
+/// </summary>
+/// <param name="status">The new status, which is zero while the networking stack is not
+/// ready.</param>
+/// <param name="context">Context which was supplied to <see cref="NetworkState_Subscribe" />.
+/// </param>
+typedef void (*NetworkState_ChangedHandler)(Networking_InterfaceConnectionStatus status,
+                                            void *context);
+
+/// <summary>
+///     Applications implement a function with this signature to be notified when the connection
+///     status cannot be read, other than because the networking stack is not ready yet. errno
+///     contains more information. The service continues to poll.
+/// </summary>
+/// <param name="context">Context which was supplied to <see cref="NetworkState_Start" />.</param>
+typedef void (*NetworkState_ErrorHandler)(void *context);
+
+/// <summary>
+///     Starts polling the connection status of a network interface. The first poll happens on the
+///     event loop's next iteration, so subscribers which are added after this call, as the
+///     application initializes, are notified of the first status.
+/// </summary>
+/// <param name="eventLoop">Event loop which runs the poll timer.</param>
+/// <param name="interfaceName">Name of the interface, such as "wlan0", which must remain valid
+/// until the service is stopped.</param>
+/// <param name="errorHandler">Callback to invoke when the status cannot be read, or NULL.</param>
+/// <param name="context">Context which is passed to the error handler.</param>
+/// <returns>0 on success, or -1 on failure, in which case errno is set.</returns>
+int NetworkState_Start(EventLoop *eventLoop, const char *interfaceName,
+                       NetworkState_ErrorHandler errorHandler, void *context);
+
+/// <summary>
+///     Stops polling, and removes every subscriber. This should be called before the event loop
+///     is closed.
+/// </summary>
+void NetworkState_Stop(void);
+
+/// <summary>
+///     Adds a subscriber which is notified when the connection status changes.
+/// </summary>
+/// <param name="handler">Callback to invoke with the new status.</param>
+/// <param name="context">Context which is passed to the handler.</param>
+/// <returns>0 on success, or -1 if there are already NETWORK_STATE_MAX_SUBSCRIBERS subscribers,
+/// in which case errno is set to ENOSPC.</returns>
+int NetworkState_Subscribe(NetworkState_ChangedHandler handler, void *context);
+
+/// <summary>
+///     Polls the interface now, rather than at the next poll, for example when a connection to a
+///     server has just failed. Subscribers are notified if the status has changed.
+/// </summary>
+void NetworkState_Refresh(void);
+
+/// <summary>
+///     Gets the connection status from the last poll.
+/// </summary>
+/// <returns>The status, which is zero until the networking stack is ready.</returns>
+Networking_InterfaceConnectionStatus NetworkState_GetStatus(void);
+
+/// <summary>
+///     Gets whether the last poll found the interface connected to the internet.
+/// </summary>
+bool NetworkState_IsConnectedToInternet(void);
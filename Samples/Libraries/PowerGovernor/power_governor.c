@@ -0,0 +1,185 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include <applibs/eventloop.h>
+#include <applibs/log.h>
+#include <applibs/powermanagement.h>
+
+#include "power_governor.h"
+
+static const char *const profileNames[POWER_GOVERNOR_PROFILE_COUNT] = {
+    "power-saver", "balanced", "high-performance"};
+
+static EventLoop *governorEventLoop = NULL;
+static int timerFd = -1;
+static EventRegistration *timerRegistration = NULL;
+
+// Bit mask of the active phases.
+static unsigned int activePhases = 0;
+// Set once the profile could not be set, after which it is left alone.
+static bool unsupported = false;
+
+static PowerManagement_System_PowerProfile currentProfile = PowerManagement_Balanced;
+static struct timespec profileStartTime;
+static PowerGovernor_Stats stats;
+
+static uint64_t MillisecondsSince(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)((now.tv_sec - start->tv_sec) * 1000 +
+                      (now.tv_nsec - start->tv_nsec) / 1000000);
+}
+
+// Adds the time since the last change to the current profile's total, and returns it.
+static uint64_t AccountProfileTime(void)
+{
+    uint64_t elapsedMs = MillisecondsSince(&profileStartTime);
+    stats.profileMs[currentProfile] += elapsedMs;
+    clock_gettime(CLOCK_MONOTONIC, &profileStartTime);
+    return elapsedMs;
+}
+
+static void SetProfile(PowerManagement_System_PowerProfile profile)
+{
+    if (unsupported || profile == currentProfile) {
+        return;
+    }
+
+    if (PowerManagement_SetSystemPowerProfile(profile) == -1) {
+        Log_Debug("ERROR: Could not set the %s power profile: %s (%d); leaving it as it is.\n",
+                  profileNames[profile], strerror(errno), errno);
+        unsupported = true;
+        return;
+    }
+
+    uint64_t elapsedMs = AccountProfileTime();
+    Log_Debug("INFO: Power profile %s, after %llu ms at %s.\n", profileNames[profile],
+              (unsigned long long)elapsedMs, profileNames[currentProfile]);
+    currentProfile = profile;
+    ++stats.switches;
+}
+
+// Arms the idle timer, or disarms it if delayMs is 0.
+static void ArmIdleTimer(unsigned int delayMs)
+{
+    struct itimerspec newValue = {
+        .it_value = {.tv_sec = delayMs / 1000, .tv_nsec = (delayMs % 1000) * 1000000},
+        .it_interval = {.tv_sec = 0, .tv_nsec = 0}};
+    if (timerfd_settime(timerFd, /* flags */ 0, &newValue, /* old_value */ NULL) == -1) {
+        Log_Debug("ERROR: Could not set the power idle timer: %s (%d).\n", strerror(errno),
+                  errno);
+    }
+}
+
+// This satisfies the EventLoopIoCallback signature.
+static void IdleTimerCallback(EventLoop *el, int fd, EventLoop_IoEvents events, void *context)
+{
+    uint64_t expirations;
+    if (read(timerFd, &expirations, sizeof(expirations)) == -1) {
+        Log_Debug("ERROR: Could not read timerfd %s (%d).\n", strerror(errno), errno);
+        return;
+    }
+
+    if (activePhases == 0) {
+        SetProfile(PowerManagement_PowerSaver);
+    }
+}
+
+int PowerGovernor_Start(EventLoop *eventLoop)
+{
+    if (timerFd != -1) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (timerFd == -1) {
+        Log_Debug("ERROR: Unable to create timer: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+
+    timerRegistration =
+        EventLoop_RegisterIo(eventLoop, timerFd, EventLoop_Input, IdleTimerCallback, NULL);
+    if (timerRegistration == NULL) {
+        Log_Debug("ERROR: Unable to register timer event: %s (%d).\n", strerror(errno), errno);
+        close(timerFd);
+        timerFd = -1;
+        return -1;
+    }
+
+    // The profile is assumed to be the system's default until the governor first sets it.
+    governorEventLoop = eventLoop;
+    activePhases = 0;
+    unsupported = false;
+    currentProfile = PowerManagement_Balanced;
+    memset(&stats, 0, sizeof(stats));
+    clock_gettime(CLOCK_MONOTONIC, &profileStartTime);
+    SetProfile(PowerManagement_PowerSaver);
+    return 0;
+}
+
+void PowerGovernor_Stop(void)
+{
+    if (timerRegistration != NULL) {
+        EventLoop_UnregisterIo(governorEventLoop, timerRegistration);
+        timerRegistration = NULL;
+    }
+    if (timerFd == -1) {
+        return;
+    }
+    close(timerFd);
+    timerFd = -1;
+
+    // Leave the system at its default profile for whatever runs next.
+    SetProfile(PowerManagement_Balanced);
+    AccountProfileTime();
+    Log_Debug("INFO: Time at each power profile: %s %llu ms, %s %llu ms, %s %llu ms; %lu "
+              "switches.\n",
+              profileNames[0], (unsigned long long)stats.profileMs[0], profileNames[1],
+              (unsigned long long)stats.profileMs[1], profileNames[2],
+              (unsigned long long)stats.profileMs[2], (unsigned long)stats.switches);
+    activePhases = 0;
+}
+
+void PowerGovernor_BeginPhase(PowerGovernor_Phase phase)
+{
+    unsigned int bit = 1u << phase;
+    if (timerFd == -1 || (activePhases & bit) != 0) {
+        return;
+    }
+
+    activePhases |= bit;
+    ++stats.phaseCounts[phase];
+    ArmIdleTimer(0);
+    SetProfile(PowerManagement_HighPerformance);
+}
+
+void PowerGovernor_EndPhase(PowerGovernor_Phase phase)
+{
+    unsigned int bit = 1u << phase;
+    if (timerFd == -1 || (activePhases & bit) == 0) {
+        return;
+    }
+
+    activePhases &= ~bit;
+    if (activePhases == 0) {
+        ArmIdleTimer(POWER_GOVERNOR_IDLE_DELAY_MS);
+    }
+}
+
+void PowerGovernor_GetStats(PowerGovernor_Stats *result)
+{
+    if (timerFd != -1) {
+        AccountProfileTime();
+    }
+    *result = stats;
+}
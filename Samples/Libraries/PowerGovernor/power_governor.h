@@ -0,0 +1,89 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <applibs/eventloop.h>
+#include <applibs/powermanagement.h>
+
+// The power governor sets the system power profile from what the application is doing. The
+// application marks the start and end of each heavy phase, such as a firmware transfer, a TLS
+// handshake or an upload; while any phase is active, the device runs at the high-performance
+// profile, so the work finishes sooner, and otherwise at the power-saver profile. The profile
+// rises as soon as a phase begins, but only falls once no phase has been active for
+// POWER_GOVERNOR_IDLE_DELAY_MS, so that a sequence of short phases does not switch the profile
+// back and forth. The time spent at each profile is recorded.
+//
+// The application manifest must include "PowerControls": [ "SetPowerProfile" ]. If the profile
+// cannot be set, the governor logs the error once and stops switching.
+//
+// The governor is not thread-safe; it should only be used from the event loop's thread.
+
+/// <summary>Time without an active phase after which the profile falls to power-saver.</summary>
+#define POWER_GOVERNOR_IDLE_DELAY_MS 2000
+
+/// <summary>Heavy phases. Each is either active or not, so beginning one twice is the same as
+/// beginning it once.</summary>
+typedef enum {
+    /// <summary>Transferring and checking a firmware image.</summary>
+    PowerGovernor_Phase_Transfer = 0,
+    /// <summary>Connecting to a server, including the TLS handshake.</summary>
+    PowerGovernor_Phase_Handshake = 1,
+    /// <summary>Uploading bulk data.</summary>
+    PowerGovernor_Phase_Upload = 2,
+    /// <summary>Processing data, such as parsing or encoding a large message.</summary>
+    PowerGovernor_Phase_Processing = 3,
+
+    PowerGovernor_Phase_Count
+} PowerGovernor_Phase;
+
+/// <summary>Number of profiles which are recorded, from PowerManagement_PowerSaver to
+/// PowerManagement_HighPerformance.</summary>
+#define POWER_GOVERNOR_PROFILE_COUNT 3
+
+/// <summary>Time spent at each profile since the governor started.</summary>
+typedef struct {
+    /// <summary>Milliseconds at each profile, indexed by PowerManagement_System_PowerProfile.
+    /// </summary>
+    uint64_t profileMs[POWER_GOVERNOR_PROFILE_COUNT];
+    /// <summary>Number of times the profile was changed.</summary>
+    uint32_t switches;
+    /// <summary>Number of times each phase began while it was not already active.</summary>
+    uint32_t phaseCounts[PowerGovernor_Phase_Count];
+} PowerGovernor_Stats;
+
+/// <summary>
+///     Starts the governor, which sets the power-saver profile until a phase begins.
+/// </summary>
+/// <param name="eventLoop">Event loop which runs the idle timer.</param>
+/// <returns>0 on success, or -1 on failure, in which case errno is set. Failing to set the
+/// profile is not a failure to start.</returns>
+int PowerGovernor_Start(EventLoop *eventLoop);
+
+/// <summary>
+///     Stops the governor, logs the time spent at each profile, and returns the system to the
+///     balanced profile. This should be called before the event loop is closed.
+/// </summary>
+void PowerGovernor_Stop(void);
+
+/// <summary>
+///     Marks the start of a heavy phase, which raises the profile to high-performance at once.
+/// </summary>
+/// <param name="phase">The phase.</param>
+void PowerGovernor_BeginPhase(PowerGovernor_Phase phase);
+
+/// <summary>
+///     Marks the end of a heavy phase. Once no phase has been active for
+///     POWER_GOVERNOR_IDLE_DELAY_MS, the profile falls to power-saver. Ending a phase which is
+///     not active has no effect.
+/// </summary>
+/// <param name="phase">The phase.</param>
+void PowerGovernor_EndPhase(PowerGovernor_Phase phase);
+
+/// <summary>
+///     Gets the time spent at each profile, up to now.
+/// </summary>
+/// <param name="stats">Receives the statistics.</param>
+void PowerGovernor_GetStats(PowerGovernor_Stats *stats);
@@ -0,0 +1,388 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <applibs/log.h>
+
+#include "priority_dispatch.h"
+
+struct PriorityDispatch_Registration {
+    EventRegistration *registration;
+    int fd;
+    PriorityDispatch_Priority priority;
+    EventLoopIoCallback *callback;
+    void *context;
+    // Events which the client watches for.
+    EventLoop_IoEvents events;
+    // Events which the event loop has reported, and which have not been passed to the callback.
+    // While there are any, the descriptor is not watched, and the registration is queued.
+    EventLoop_IoEvents readyEvents;
+    uint64_t readyUs;
+    struct PriorityDispatch_Registration *nextReady;
+    struct PriorityDispatch_Registration *next;
+};
+
+// Registrations whose events have been reported, oldest first.
+typedef struct {
+    PriorityDispatch_Registration *head;
+    PriorityDispatch_Registration *tail;
+} ReadyQueue;
+
+static EventLoop *dispatchEventLoop = NULL;
+static uint32_t lowBudget = PRIORITY_DISPATCH_DEFAULT_LOW_BUDGET_US;
+static PriorityDispatch_Registration *registrations = NULL;
+static ReadyQueue readyQueues[PRIORITY_DISPATCH_PRIORITY_COUNT];
+static PriorityDispatch_Work *workHead = NULL;
+static PriorityDispatch_Work *workTail = NULL;
+// Low-priority callbacks and work take turns, so that neither starves the other.
+static bool workTurn = false;
+// Work whose slice is running, and whether the slice cancelled it.
+static PriorityDispatch_Work *runningWork = NULL;
+static bool runningWorkCancelled = false;
+static PriorityDispatch_Stats stats;
+
+static uint64_t NowUs(void);
+static void IoCallback(EventLoop *el, int fd, EventLoop_IoEvents events, void *context);
+static void Enqueue(PriorityDispatch_Registration *reg);
+static void RemoveFromQueue(PriorityDispatch_Registration *reg);
+static void RecordDispatch(PriorityDispatch_Priority priority, uint64_t readyUs, uint64_t startUs);
+static void DispatchIo(ReadyQueue *queue);
+static void RunWorkSlice(void);
+static void RunQueue(PriorityDispatch_Priority priority);
+static bool HasLowPriority(void);
+static bool Poll(void);
+
+static uint64_t NowUs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + (uint64_t)now.tv_nsec / 1000;
+}
+
+void PriorityDispatch_Initialize(EventLoop *eventLoop, uint32_t lowBudgetUs)
+{
+    dispatchEventLoop = eventLoop;
+    lowBudget = lowBudgetUs;
+    memset(readyQueues, 0, sizeof(readyQueues));
+    memset(&stats, 0, sizeof(stats));
+    workHead = NULL;
+    workTail = NULL;
+}
+
+PriorityDispatch_Registration *PriorityDispatch_RegisterIo(int fd, EventLoop_IoEvents eventBitmask,
+                                                           PriorityDispatch_Priority priority,
+                                                           EventLoopIoCallback *callback,
+                                                           void *context)
+{
+    if ((unsigned)priority >= PRIORITY_DISPATCH_PRIORITY_COUNT || callback == NULL) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    PriorityDispatch_Registration *reg = malloc(sizeof(*reg));
+    if (reg == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    memset(reg, 0, sizeof(*reg));
+    reg->fd = fd;
+    reg->priority = priority;
+    reg->callback = callback;
+    reg->context = context;
+    reg->events = eventBitmask;
+    reg->registration =
+        EventLoop_RegisterIo(dispatchEventLoop, fd, eventBitmask, IoCallback, reg);
+    if (reg->registration == NULL) {
+        int error = errno;
+        free(reg);
+        errno = error;
+        return NULL;
+    }
+
+    reg->next = registrations;
+    registrations = reg;
+    return reg;
+}
+
+int PriorityDispatch_ModifyIoEvents(PriorityDispatch_Registration *reg,
+                                    EventLoop_IoEvents eventBitmask)
+{
+    reg->events = eventBitmask;
+
+    // A queued registration is watched again with the new events when its callback runs.
+    if (reg->readyEvents != EventLoop_None) {
+        return 0;
+    }
+    return EventLoop_ModifyIoEvents(dispatchEventLoop, reg->registration, eventBitmask);
+}
+
+int PriorityDispatch_UnregisterIo(PriorityDispatch_Registration *reg)
+{
+    if (reg == NULL) {
+        return 0;
+    }
+
+    if (reg->readyEvents != EventLoop_None) {
+        RemoveFromQueue(reg);
+    }
+
+    PriorityDispatch_Registration **link = &registrations;
+    while (*link != reg) {
+        link = &(*link)->next;
+    }
+    *link = reg->next;
+
+    int result = EventLoop_UnregisterIo(dispatchEventLoop, reg->registration);
+    int error = errno;
+    free(reg);
+    errno = error;
+    return result;
+}
+
+// Records the events which the event loop reported, queues the registration, and stops watching
+// the descriptor until the callback has run, so that the event loop does not report the same
+// events again while they wait.
+static void IoCallback(EventLoop *el, int fd, EventLoop_IoEvents events, void *context)
+{
+    PriorityDispatch_Registration *reg = context;
+    if (reg->readyEvents == EventLoop_None) {
+        reg->readyUs = NowUs();
+        Enqueue(reg);
+    }
+    reg->readyEvents |= events;
+
+    if (EventLoop_ModifyIoEvents(el, reg->registration, EventLoop_None) == -1) {
+        Log_Debug("ERROR: Could not pause IO events: %d (%s)\n", errno, strerror(errno));
+    }
+}
+
+static void Enqueue(PriorityDispatch_Registration *reg)
+{
+    ReadyQueue *queue = &readyQueues[reg->priority];
+    reg->nextReady = NULL;
+    if (queue->tail == NULL) {
+        queue->head = reg;
+    } else {
+        queue->tail->nextReady = reg;
+    }
+    queue->tail = reg;
+}
+
+static void RemoveFromQueue(PriorityDispatch_Registration *reg)
+{
+    ReadyQueue *queue = &readyQueues[reg->priority];
+    PriorityDispatch_Registration *previous = NULL;
+    for (PriorityDispatch_Registration *r = queue->head; r != NULL; r = r->nextReady) {
+        if (r == reg) {
+            if (previous == NULL) {
+                queue->head = r->nextReady;
+            } else {
+                previous->nextReady = r->nextReady;
+            }
+            if (queue->tail == r) {
+                queue->tail = previous;
+            }
+            return;
+        }
+        previous = r;
+    }
+}
+
+static void RecordDispatch(PriorityDispatch_Priority priority, uint64_t readyUs, uint64_t startUs)
+{
+    PriorityDispatch_PriorityStats *priorityStats = &stats.priorities[priority];
+    uint64_t endUs = NowUs();
+    uint64_t delayUs = startUs - readyUs;
+    uint64_t runUs = endUs - startUs;
+
+    ++priorityStats->dispatched;
+    if (delayUs > priorityStats->maxDelayUs) {
+        priorityStats->maxDelayUs = (delayUs < UINT32_MAX) ? (uint32_t)delayUs : UINT32_MAX;
+    }
+    if (runUs > priorityStats->maxRunUs) {
+        priorityStats->maxRunUs = (runUs < UINT32_MAX) ? (uint32_t)runUs : UINT32_MAX;
+    }
+}
+
+// Runs the callback of the oldest registration in a queue. The callback may unregister any
+// registration, including its own, so the registration is not used after it returns.
+static void DispatchIo(ReadyQueue *queue)
+{
+    PriorityDispatch_Registration *reg = queue->head;
+    queue->head = reg->nextReady;
+    if (queue->head == NULL) {
+        queue->tail = NULL;
+    }
+
+    EventLoop_IoEvents events = reg->readyEvents & reg->events;
+    reg->readyEvents = EventLoop_None;
+    if (EventLoop_ModifyIoEvents(dispatchEventLoop, reg->registration, reg->events) == -1) {
+        Log_Debug("ERROR: Could not resume IO events: %d (%s)\n", errno, strerror(errno));
+    }
+
+    if (events == EventLoop_None) {
+        return;
+    }
+
+    PriorityDispatch_Priority priority = reg->priority;
+    uint64_t readyUs = reg->readyUs;
+    uint64_t startUs = NowUs();
+    reg->callback(dispatchEventLoop, reg->fd, events, reg->context);
+    RecordDispatch(priority, readyUs, startUs);
+}
+
+// Runs one slice of the oldest posted work, which goes to the back of the queue if more remains.
+static void RunWorkSlice(void)
+{
+    PriorityDispatch_Work *work = workHead;
+    workHead = work->next;
+    if (workHead == NULL) {
+        workTail = NULL;
+    }
+    work->posted = false;
+
+    uint64_t postedUs = work->postedUs;
+    uint64_t startUs = NowUs();
+    runningWork = work;
+    runningWorkCancelled = false;
+    bool more = work->work(work->context);
+    runningWork = NULL;
+    RecordDispatch(PriorityDispatch_Priority_Low, postedUs, startUs);
+
+    // The slice may have posted the work again itself, or cancelled it.
+    if (more && !work->posted && !runningWorkCancelled) {
+        PriorityDispatch_PostWork(work);
+    }
+}
+
+void PriorityDispatch_PostWork(PriorityDispatch_Work *work)
+{
+    if (work->posted) {
+        return;
+    }
+
+    work->posted = true;
+    work->postedUs = NowUs();
+    work->next = NULL;
+    if (workTail == NULL) {
+        workHead = work;
+    } else {
+        workTail->next = work;
+    }
+    workTail = work;
+}
+
+void PriorityDispatch_CancelWork(PriorityDispatch_Work *work)
+{
+    if (work == runningWork) {
+        runningWorkCancelled = true;
+    }
+
+    if (!work->posted) {
+        return;
+    }
+
+    PriorityDispatch_Work *previous = NULL;
+    for (PriorityDispatch_Work *w = workHead; w != NULL; w = w->next) {
+        if (w == work) {
+            if (previous == NULL) {
+                workHead = w->next;
+            } else {
+                previous->next = w->next;
+            }
+            if (workTail == w) {
+                workTail = previous;
+            }
+            break;
+        }
+        previous = w;
+    }
+    work->posted = false;
+}
+
+// Runs every callback which is queued with a priority, including those which their predecessors
+// make ready.
+static void RunQueue(PriorityDispatch_Priority priority)
+{
+    while (readyQueues[priority].head != NULL) {
+        DispatchIo(&readyQueues[priority]);
+    }
+}
+
+static bool HasLowPriority(void)
+{
+    return readyQueues[PriorityDispatch_Priority_Low].head != NULL || workHead != NULL;
+}
+
+// Processes the events which are ready without waiting. Returns false if the event loop failed.
+static bool Poll(void)
+{
+    EventLoop_Run_Result result = EventLoop_Run(dispatchEventLoop, 0, false);
+    return result != EventLoop_Run_Failed || errno == EINTR;
+}
+
+EventLoop_Run_Result PriorityDispatch_Run(int durationInMilliseconds)
+{
+    bool waiting = HasLowPriority() || readyQueues[PriorityDispatch_Priority_High].head != NULL ||
+                   readyQueues[PriorityDispatch_Priority_Normal].head != NULL;
+    EventLoop_Run_Result result =
+        EventLoop_Run(dispatchEventLoop, waiting ? 0 : durationInMilliseconds, true);
+    if (result == EventLoop_Run_Failed) {
+        return result;
+    }
+
+    // The other events which are ready are collected, so they are ordered with the first.
+    if (!Poll()) {
+        return EventLoop_Run_Failed;
+    }
+
+    RunQueue(PriorityDispatch_Priority_High);
+    RunQueue(PriorityDispatch_Priority_Normal);
+
+    uint64_t startUs = NowUs();
+    while (HasLowPriority()) {
+        bool runWork = readyQueues[PriorityDispatch_Priority_Low].head == NULL ||
+                       (workTurn && workHead != NULL);
+        if (runWork) {
+            RunWorkSlice();
+        } else {
+            DispatchIo(&readyQueues[PriorityDispatch_Priority_Low]);
+        }
+        workTurn = !runWork;
+
+        if (!Poll()) {
+            return EventLoop_Run_Failed;
+        }
+        RunQueue(PriorityDispatch_Priority_High);
+
+        if (NowUs() - startUs >= lowBudget) {
+            if (HasLowPriority()) {
+                ++stats.budgetExhausted;
+            }
+            break;
+        }
+    }
+
+    return result;
+}
+
+const PriorityDispatch_Stats *PriorityDispatch_GetStats(void)
+{
+    return &stats;
+}
+
+void PriorityDispatch_Cleanup(void)
+{
+    while (registrations != NULL) {
+        PriorityDispatch_UnregisterIo(registrations);
+    }
+
+    while (workHead != NULL) {
+        PriorityDispatch_CancelWork(workHead);
+    }
+}
@@ -0,0 +1,171 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <applibs/eventloop.h>
+
+// The priority dispatcher runs IO callbacks in order of priority, rather than in the order in
+// which the event loop happens to report them, and splits low-priority work into slices, so that
+// a burst of sockets or a long formatter does not delay a latency-critical handler.
+//
+// A callback which is registered with PriorityDispatch_RegisterIo does not run when the event
+// loop reports its events. Instead, PriorityDispatch_Run records the events, stops watching the
+// descriptor until the callback has run, and then runs the ready callbacks: every high-priority
+// one, then every normal one, and then low-priority callbacks and work slices, one at a time,
+// until PriorityDispatch_Initialize's budget for the iteration is spent. The rest wait for the
+// next iteration, which does not block. Between low-priority slices the event loop is polled,
+// and any high-priority callbacks which have become ready run at once, so a high-priority
+// callback waits for at most one normal callback or one low-priority slice.
+//
+// Callbacks which are registered directly with EventLoop_RegisterIo, such as the timer
+// utilities' and the other libraries', still run as soon as the event loop reports them, which
+// includes each poll between low-priority slices; they should be short, or post work.
+//
+// The dispatcher is not thread-safe; it should only be used from the event loop's thread.
+
+/// <summary>Priority of a registration or of work.</summary>
+typedef enum {
+    /// <summary>Latency-critical callbacks, which run first, and also between low-priority
+    /// slices.</summary>
+    PriorityDispatch_Priority_High = 0,
+    /// <summary>Callbacks which run once per iteration, after the high-priority ones.</summary>
+    PriorityDispatch_Priority_Normal = 1,
+    /// <summary>Callbacks and work which run within the iteration's budget.</summary>
+    PriorityDispatch_Priority_Low = 2
+} PriorityDispatch_Priority;
+
+/// <summary>Number of values of PriorityDispatch_Priority.</summary>
+#define PRIORITY_DISPATCH_PRIORITY_COUNT 3
+
+/// <summary>
+///     Default time for which low-priority callbacks and work run in each iteration, in
+///     microseconds.
+/// </summary>
+#define PRIORITY_DISPATCH_DEFAULT_LOW_BUDGET_US 5000
+
+/// <summary>Opaque registration of an IO callback with the dispatcher.</summary>
+typedef struct PriorityDispatch_Registration PriorityDispatch_Registration;
+
+/// <summary>
+///     Function which does one slice of low-priority work.
+/// </summary>
+/// <param name="context">Context which was supplied with the work.</param>
+/// <returns>true if more work remains, in which case another slice runs after the other ready
+/// low-priority callbacks and work; false if the work is finished.</returns>
+typedef bool (*PriorityDispatch_WorkFunction)(void *context);
+
+/// <summary>
+///     Low-priority work, which runs in slices. The client sets work and context; the work must
+///     remain valid while it is posted.
+/// </summary>
+typedef struct PriorityDispatch_Work {
+    PriorityDispatch_WorkFunction work;
+    void *context;
+    // Used by the dispatcher while the work is posted; the client should not access these.
+    bool posted;
+    uint64_t postedUs;
+    struct PriorityDispatch_Work *next;
+} PriorityDispatch_Work;
+
+/// <summary>Counters which describe the dispatch of one priority.</summary>
+typedef struct {
+    /// <summary>Number of callbacks, or work slices, which ran.</summary>
+    uint32_t dispatched;
+    /// <summary>Longest time from the event loop reporting an event, or work being posted, to
+    /// the callback or slice starting, in microseconds.</summary>
+    uint32_t maxDelayUs;
+    /// <summary>Longest time for which one callback or slice ran, in microseconds.</summary>
+    uint32_t maxRunUs;
+} PriorityDispatch_PriorityStats;
+
+/// <summary>Counters which describe the dispatcher since it was initialized.</summary>
+typedef struct {
+    /// <summary>Counters for each priority.</summary>
+    PriorityDispatch_PriorityStats priorities[PRIORITY_DISPATCH_PRIORITY_COUNT];
+    /// <summary>Number of iterations which spent their low-priority budget with low-priority
+    /// callbacks or work still waiting.</summary>
+    uint32_t budgetExhausted;
+} PriorityDispatch_Stats;
+
+/// <summary>
+///     Initializes the dispatcher.
+/// </summary>
+/// <param name="eventLoop">Event loop which reports the events.</param>
+/// <param name="lowBudgetUs">Time for which low-priority callbacks and work run in each
+/// iteration, in microseconds; usually PRIORITY_DISPATCH_DEFAULT_LOW_BUDGET_US. At least one
+/// runs in each iteration, however long it takes.</param>
+void PriorityDispatch_Initialize(EventLoop *eventLoop, uint32_t lowBudgetUs);
+
+/// <summary>
+///     Registers an IO callback like EventLoop_RegisterIo, which runs in order of its priority.
+/// </summary>
+/// <param name="fd">Descriptor to watch.</param>
+/// <param name="eventBitmask">Events to watch for.</param>
+/// <param name="priority">Priority of the callback.</param>
+/// <param name="callback">Function to invoke with the events, which are accumulated from the
+/// time which the event loop first reported them.</param>
+/// <param name="context">Context which is passed to the callback.</param>
+/// <returns>The registration, which should be unregistered with
+/// PriorityDispatch_UnregisterIo; or NULL on failure, in which case errno is set.</returns>
+PriorityDispatch_Registration *PriorityDispatch_RegisterIo(int fd, EventLoop_IoEvents eventBitmask,
+                                                           PriorityDispatch_Priority priority,
+                                                           EventLoopIoCallback *callback,
+                                                           void *context);
+
+/// <summary>
+///     Changes the events which a registration watches for, like EventLoop_ModifyIoEvents. Ready
+///     events which are no longer watched for are not passed to the callback.
+/// </summary>
+/// <param name="registration">Registration returned by PriorityDispatch_RegisterIo.</param>
+/// <param name="eventBitmask">Events to watch for.</param>
+/// <returns>0 on success, or -1 on failure, in which case errno is set.</returns>
+int PriorityDispatch_ModifyIoEvents(PriorityDispatch_Registration *registration,
+                                    EventLoop_IoEvents eventBitmask);
+
+/// <summary>
+///     Unregisters and frees a registration, whose callback does not run again. This may be
+///     called from any callback.
+/// </summary>
+/// <param name="registration">Registration returned by PriorityDispatch_RegisterIo, or
+/// NULL.</param>
+/// <returns>0 on success, or -1 on failure, in which case errno is set.</returns>
+int PriorityDispatch_UnregisterIo(PriorityDispatch_Registration *registration);
+
+/// <summary>
+///     Posts low-priority work, which runs in slices from the next iteration. Posting work
+///     which is already posted does nothing.
+/// </summary>
+/// <param name="work">The work.</param>
+void PriorityDispatch_PostWork(PriorityDispatch_Work *work);
+
+/// <summary>
+///     Cancels work which has been posted, if it has not finished. This may be called from any
+///     callback, including the work's own slice.
+/// </summary>
+/// <param name="work">The work.</param>
+void PriorityDispatch_CancelWork(PriorityDispatch_Work *work);
+
+/// <summary>
+///     Runs one iteration: waits for events like EventLoop_Run with processOnlyOneEvent set, and
+///     then runs the ready callbacks and work in order of priority. It does not wait if
+///     callbacks or work are already waiting to run.
+/// </summary>
+/// <param name="durationInMilliseconds">Longest time to wait for an event, or -1 to wait
+/// until one arrives.</param>
+/// <returns>The result of waiting for events.</returns>
+EventLoop_Run_Result PriorityDispatch_Run(int durationInMilliseconds);
+
+/// <summary>
+///     Gets the counters.
+/// </summary>
+/// <returns>The counters, which remain owned by the dispatcher.</returns>
+const PriorityDispatch_Stats *PriorityDispatch_GetStats(void);
+
+/// <summary>
+///     Unregisters every registration and cancels every work which is posted.
+/// </summary>
+void PriorityDispatch_Cleanup(void);
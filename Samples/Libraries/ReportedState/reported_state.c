@@ -0,0 +1,367 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include <applibs/log.h>
+
+#include "json_writer.h"
+#include "reported_state.h"
+
+typedef enum { ValueKind_None, ValueKind_Bool, ValueKind_Int, ValueKind_String } ValueKind;
+
+typedef struct {
+    ValueKind kind;
+    bool boolValue;
+    int64_t intValue;
+    char stringValue[REPORTED_STATE_MAX_STRING_LENGTH + 1];
+} Value;
+
+typedef struct {
+    const char *name;
+    Value current;
+    // The value which the IoT Hub last acknowledged; ValueKind_None if it has acknowledged none.
+    Value acknowledged;
+    // The value in the update which is in progress, if inReport is set.
+    Value reporting;
+    bool inReport;
+} Property;
+
+// Maximum length of the name of an object which holds properties, excluding the null terminator.
+#define MAX_OBJECT_NAME_LENGTH 31
+
+static Property properties[REPORTED_STATE_MAX_PROPERTIES];
+static size_t propertyCount = 0;
+
+static EventLoop *reportEventLoop = NULL;
+static int timerFd = -1;
+static EventRegistration *timerRegistration = NULL;
+static unsigned int coalesceMs = 0;
+static bool timerArmed = false;
+static bool reportInProgress = false;
+
+static ReportedState_Sender reportSender = NULL;
+static void *senderContext = NULL;
+
+static char reportBuffer[REPORTED_STATE_MAX_REPORT_SIZE];
+
+static bool ValuesEqual(const Value *a, const Value *b)
+{
+    if (a->kind != b->kind) {
+        return false;
+    }
+    switch (a->kind) {
+    case ValueKind_Bool:
+        return a->boolValue == b->boolValue;
+    case ValueKind_Int:
+        return a->intValue == b->intValue;
+    case ValueKind_String:
+        return strcmp(a->stringValue, b->stringValue) == 0;
+    default:
+        return true;
+    }
+}
+
+// A property is reported if its value differs from the value which is being reported, or
+// otherwise from the value which was acknowledged.
+static bool NeedsReport(const Property *property)
+{
+    const Value *baseline = property->inReport ? &property->reporting : &property->acknowledged;
+    return !ValuesEqual(&property->current, baseline);
+}
+
+static bool AnyNeedsReport(void)
+{
+    for (size_t i = 0; i < propertyCount; ++i) {
+        if (NeedsReport(&properties[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void SetTimer(unsigned int delayMs)
+{
+    struct itimerspec newValue = {.it_value = {.tv_sec = delayMs / 1000,
+                                               .tv_nsec = (long)(delayMs % 1000) * 1000000}};
+    if (timerfd_settime(timerFd, /* flags */ 0, &newValue, /* old_value */ NULL) == -1) {
+        Log_Debug("ERROR: Could not set reported state timer: %s (%d).\n", strerror(errno),
+                  errno);
+        return;
+    }
+    timerArmed = delayMs != 0;
+}
+
+// The coalescing period starts at the first change, and is not extended by later changes, so a
+// property which changes continually is still reported.
+static void ScheduleReport(void)
+{
+    if (!timerArmed && !reportInProgress && timerFd != -1) {
+        SetTimer(coalesceMs);
+    }
+}
+
+static void WriteValue(JsonWriter *writer, const char *name, const Value *value)
+{
+    switch (value->kind) {
+    case ValueKind_Bool:
+        JsonWriter_AddBool(writer, name, value->boolValue);
+        break;
+    case ValueKind_Int:
+        JsonWriter_AddInt(writer, name, value->intValue);
+        break;
+    case ValueKind_String:
+        JsonWriter_AddString(writer, name, value->stringValue);
+        break;
+    default:
+        break;
+    }
+}
+
+/// <summary>
+///     Writes the properties which need to be reported, grouping the members of each object, and
+///     marks them as being reported.
+/// </summary>
+/// <returns>The number of properties written, or -1 if the update did not fit.</returns>
+static int WriteReport(JsonWriter *writer)
+{
+    bool written[REPORTED_STATE_MAX_PROPERTIES] = {false};
+    int count = 0;
+
+    JsonWriter_BeginObject(writer, NULL);
+    for (size_t i = 0; i < propertyCount; ++i) {
+        if (written[i] || !NeedsReport(&properties[i])) {
+            continue;
+        }
+
+        const char *separator = strchr(properties[i].name, '.');
+        if (separator == NULL) {
+            WriteValue(writer, properties[i].name, &properties[i].current);
+            written[i] = true;
+            ++count;
+            continue;
+        }
+
+        // Write this member, and the other members of its object which need to be reported.
+        char objectName[MAX_OBJECT_NAME_LENGTH + 1];
+        size_t objectNameLength = (size_t)(separator - properties[i].name);
+        if (objectNameLength > MAX_OBJECT_NAME_LENGTH) {
+            objectNameLength = MAX_OBJECT_NAME_LENGTH;
+        }
+        memcpy(objectName, properties[i].name, objectNameLength);
+        objectName[objectNameLength] = '\0';
+
+        JsonWriter_BeginObject(writer, objectName);
+        for (size_t j = i; j < propertyCount; ++j) {
+            const char *name = properties[j].name;
+            if (!written[j] && strncmp(name, objectName, objectNameLength) == 0 &&
+                name[objectNameLength] == '.' && NeedsReport(&properties[j])) {
+                WriteValue(writer, &name[objectNameLength + 1], &properties[j].current);
+                written[j] = true;
+                ++count;
+            }
+        }
+        JsonWriter_EndObject(writer);
+    }
+    JsonWriter_EndObject(writer);
+
+    if (JsonWriter_Finish(writer) == NULL) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < propertyCount; ++i) {
+        if (written[i]) {
+            properties[i].reporting = properties[i].current;
+            properties[i].inReport = true;
+        }
+    }
+    return count;
+}
+
+static void SendReport(void)
+{
+    if (reportInProgress || reportSender == NULL) {
+        return;
+    }
+
+    JsonWriter writer;
+    JsonWriter_Init(&writer, reportBuffer, sizeof(reportBuffer));
+    int count = WriteReport(&writer);
+    if (count < 0) {
+        Log_Debug("ERROR: Reported properties need %zu bytes, but the buffer holds %zu.\n",
+                  JsonWriter_GetRequiredSize(&writer), sizeof(reportBuffer));
+        return;
+    }
+    if (count == 0) {
+        return;
+    }
+
+    // The sender may complete the update before it returns.
+    reportInProgress = true;
+    if (!reportSender(reportBuffer, strlen(reportBuffer), senderContext) && reportInProgress) {
+        Log_Debug("INFO: Reported properties not sent; they will be sent again later.\n");
+        ReportedState_OnReportComplete(false);
+    }
+}
+
+// This satisfies the EventLoopIoCallback signature.
+static void TimerCallback(EventLoop *el, int fd, EventLoop_IoEvents events, void *context)
+{
+    uint64_t expirations;
+    if (read(timerFd, &expirations, sizeof(expirations)) == -1) {
+        Log_Debug("ERROR: Could not read timerfd %s (%d).\n", strerror(errno), errno);
+        return;
+    }
+
+    timerArmed = false;
+    SendReport();
+}
+
+int ReportedState_Start(EventLoop *eventLoop, unsigned int coalescePeriodMs,
+                        ReportedState_Sender sender, void *context)
+{
+    if (timerFd != -1 || coalescePeriodMs == 0 || sender == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (timerFd == -1) {
+        Log_Debug("ERROR: Unable to create timer: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+
+    timerRegistration =
+        EventLoop_RegisterIo(eventLoop, timerFd, EventLoop_Input, TimerCallback, NULL);
+    if (timerRegistration == NULL) {
+        Log_Debug("ERROR: Unable to register timer event: %s (%d).\n", strerror(errno), errno);
+        ReportedState_Stop();
+        return -1;
+    }
+
+    reportEventLoop = eventLoop;
+    coalesceMs = coalescePeriodMs;
+    reportSender = sender;
+    senderContext = context;
+    propertyCount = 0;
+    timerArmed = false;
+    reportInProgress = false;
+    return 0;
+}
+
+void ReportedState_Stop(void)
+{
+    if (timerRegistration != NULL) {
+        EventLoop_UnregisterIo(reportEventLoop, timerRegistration);
+        timerRegistration = NULL;
+    }
+    if (timerFd != -1) {
+        close(timerFd);
+        timerFd = -1;
+    }
+    reportSender = NULL;
+    propertyCount = 0;
+    timerArmed = false;
+    reportInProgress = false;
+}
+
+static int SetValue(const char *name, const Value *value)
+{
+    Property *property = NULL;
+    for (size_t i = 0; i < propertyCount; ++i) {
+        if (strcmp(properties[i].name, name) == 0) {
+            property = &properties[i];
+            break;
+        }
+    }
+
+    if (property == NULL) {
+        if (propertyCount == REPORTED_STATE_MAX_PROPERTIES) {
+            errno = ENOSPC;
+            return -1;
+        }
+        property = &properties[propertyCount++];
+        memset(property, 0, sizeof(*property));
+        property->name = name;
+    }
+
+    property->current = *value;
+    if (!NeedsReport(property)) {
+        return 0;
+    }
+    ScheduleReport();
+    return 1;
+}
+
+int ReportedState_SetBool(const char *name, bool value)
+{
+    Value newValue = {.kind = ValueKind_Bool, .boolValue = value};
+    return SetValue(name, &newValue);
+}
+
+int ReportedState_SetInt(const char *name, int64_t value)
+{
+    Value newValue = {.kind = ValueKind_Int, .intValue = value};
+    return SetValue(name, &newValue);
+}
+
+int ReportedState_SetString(const char *name, const char *value)
+{
+    Value newValue = {.kind = ValueKind_String};
+    size_t length = strlen(value);
+    if (length > REPORTED_STATE_MAX_STRING_LENGTH) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    memcpy(newValue.stringValue, value, length + 1);
+    return SetValue(name, &newValue);
+}
+
+void ReportedState_Flush(void)
+{
+    if (timerArmed) {
+        SetTimer(0);
+    }
+    SendReport();
+}
+
+void ReportedState_OnReportComplete(bool success)
+{
+    if (!reportInProgress) {
+        return;
+    }
+    reportInProgress = false;
+
+    for (size_t i = 0; i < propertyCount; ++i) {
+        if (properties[i].inReport) {
+            if (success) {
+                properties[i].acknowledged = properties[i].reporting;
+            }
+            properties[i].inReport = false;
+        }
+    }
+
+    // Report the properties which changed meanwhile. After a failure, wait for the next change or
+    // flush, as the failure is likely to repeat until the connection is re-established.
+    if (success && AnyNeedsReport()) {
+        ScheduleReport();
+    }
+}
+
+void ReportedState_Invalidate(void)
+{
+    for (size_t i = 0; i < propertyCount; ++i) {
+        properties[i].acknowledged.kind = ValueKind_None;
+    }
+    if (AnyNeedsReport()) {
+        ScheduleReport();
+    }
+}
+
+bool ReportedState_IsReportPending(void)
+{
+    return reportInProgress || timerArmed;
+}
@@ -0,0 +1,119 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <applibs/eventloop.h>
+
+// The reported state cache holds the device twin properties which an application reports, and
+// the values which the IoT Hub last acknowledged. When a property is set, it is only reported if
+// its value differs from the acknowledged value, and the properties which change within the
+// coalescing period are reported together in one update, which holds only the changed
+// properties. Each update counts against the hub's quota of twin writes, so this avoids the
+// updates which repeat an unchanged value, or which report one property each.
+//
+// One update is in progress at a time. Properties which change while it is in progress are
+// reported once it completes. If an update fails, its properties are reported again by the next
+// update, which is sent when another property changes or when the application calls
+// ReportedState_Flush, for example once the connection has been re-established.
+//
+// A property name may hold one '.', which separates the name of an object from the name of its
+// member, for example "NextFlavor.Name". The members of an object which have changed are reported
+// in the object; the IoT Hub merges them with the members which are already reported.
+//
+// The cache is not thread-safe; it should only be used from the event loop's thread.
+
+/// <summary>Maximum number of properties.</summary>
+#define REPORTED_STATE_MAX_PROPERTIES 16
+
+/// <summary>Maximum length of a string value, excluding the null terminator.</summary>
+#define REPORTED_STATE_MAX_STRING_LENGTH 63
+
+/// <summary>Size of the buffer into which an update is written, in bytes.</summary>
+#define REPORTED_STATE_MAX_REPORT_SIZE 512
+
+/// <summary>
+///     Sends an update of the reported properties to the IoT Hub. If the update is accepted, the
+///     application must call ReportedState_OnReportComplete once the IoT Hub has processed it.
+/// </summary>
+/// <param name="report">The null-terminated JSON update.</param>
+/// <param name="size">Length of the update in bytes, excluding the null terminator.</param>
+/// <param name="context">Context which was supplied to ReportedState_Start.</param>
+/// <returns>true if the update was accepted, or false if it could not be sent, for example
+/// because the client is not connected.</returns>
+typedef bool (*ReportedState_Sender)(const char *report, size_t size, void *context);
+
+/// <summary>
+///     Starts the cache.
+/// </summary>
+/// <param name="eventLoop">Event loop on which the coalescing timer runs.</param>
+/// <param name="coalescePeriodMs">Time from the first change of a property to the update which
+/// reports it and any others which change meanwhile, in milliseconds; at least 1.</param>
+/// <param name="sender">The function which sends each update.</param>
+/// <param name="context">Context which is passed to the sender.</param>
+/// <returns>0 on success, or -1 on failure, in which case errno is set.</returns>
+int ReportedState_Start(EventLoop *eventLoop, unsigned int coalescePeriodMs,
+                        ReportedState_Sender sender, void *context);
+
+/// <summary>
+///     Stops the cache, and discards the properties.
+/// </summary>
+void ReportedState_Stop(void);
+
+/// <summary>
+///     Sets a Boolean property.
+/// </summary>
+/// <param name="name">Name of the property, which must remain valid.</param>
+/// <param name="value">The value.</param>
+/// <returns>1 if the value is to be reported, 0 if it has already been reported or is being
+/// reported, or -1 on failure, in which case errno is set: ENOSPC if
+/// REPORTED_STATE_MAX_PROPERTIES properties are set.</returns>
+int ReportedState_SetBool(const char *name, bool value);
+
+/// <summary>
+///     Sets an integer property.
+/// </summary>
+/// <param name="name">Name of the property, which must remain valid.</param>
+/// <param name="value">The value.</param>
+/// <returns>1 if the value is to be reported, 0 if it has already been reported or is being
+/// reported, or -1 on failure, in which case errno is set.</returns>
+int ReportedState_SetInt(const char *name, int64_t value);
+
+/// <summary>
+///     Sets a string property.
+/// </summary>
+/// <param name="name">Name of the property, which must remain valid.</param>
+/// <param name="value">The null-terminated value, which is copied.</param>
+/// <returns>1 if the value is to be reported, 0 if it has already been reported or is being
+/// reported, or -1 on failure, in which case errno is set: EMSGSIZE if the value is longer than
+/// REPORTED_STATE_MAX_STRING_LENGTH.</returns>
+int ReportedState_SetString(const char *name, const char *value);
+
+/// <summary>
+///     Reports the properties which have changed now, rather than at the end of the coalescing
+///     period, unless an update is in progress. This also sends the properties of an update which
+///     failed again.
+/// </summary>
+void ReportedState_Flush(void);
+
+/// <summary>
+///     Records the result of the update which is in progress.
+/// </summary>
+/// <param name="success">Whether the IoT Hub accepted the update.</param>
+void ReportedState_OnReportComplete(bool success);
+
+/// <summary>
+///     Forgets the acknowledged values, so that every property is reported again, for example
+///     because the device has been assigned to another IoT Hub.
+/// </summary>
+void ReportedState_Invalidate(void);
+
+/// <summary>
+///     Gets whether an update is in progress or waiting for the coalescing period to end.
+/// </summary>
+/// <returns>true if an update is in progress or waiting.</returns>
+bool ReportedState_IsReportPending(void);
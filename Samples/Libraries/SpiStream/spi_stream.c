@@ -0,0 +1,237 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include <applibs/log.h>
+
+#include "spi_stream.h"
+
+static bool IsConfigValid(const SpiStream_Config *config, size_t *frameSize)
+{
+    if (config->segments == NULL || config->segmentCount == 0 || config->framesPerTransfer == 0 ||
+        config->segmentCount * config->framesPerTransfer > SPI_STREAM_MAX_TRANSFERS ||
+        config->framesPerBuffer == 0 || config->framesPerBuffer % config->framesPerTransfer != 0) {
+        return false;
+    }
+
+    for (size_t i = 0; i < SPI_STREAM_BUFFER_COUNT; ++i) {
+        if (config->buffers[i] == NULL) {
+            return false;
+        }
+    }
+
+    *frameSize = 0;
+    for (size_t i = 0; i < config->segmentCount; ++i) {
+        const SpiStream_Segment *segment = &config->segments[i];
+        if (segment->length == 0) {
+            return false;
+        }
+        if (segment->flags == SPI_TransferFlags_Read) {
+            *frameSize += segment->length;
+        } else if (segment->flags != SPI_TransferFlags_Write || segment->writeData == NULL) {
+            return false;
+        }
+    }
+    return *frameSize > 0;
+}
+
+static int64_t ElapsedNs(const struct timespec *start, const struct timespec *end)
+{
+    return (int64_t)(end->tv_sec - start->tv_sec) * 1000000000 + (end->tv_nsec - start->tv_nsec);
+}
+
+// Passes the full buffer to the handler, and starts filling the other one if it is free.
+static void PublishBuffer(SpiStream *stream)
+{
+    int index = stream->fillingBuffer;
+    size_t frameCount = stream->framesInBuffer;
+    stream->released[index] = false;
+    stream->framesInBuffer = 0;
+
+    int next = (index + 1) % SPI_STREAM_BUFFER_COUNT;
+    stream->fillingBuffer = stream->released[next] ? next : -1;
+
+    ++stream->stats.buffers;
+    stream->handler(stream, stream->config.buffers[index], frameCount, stream->context);
+}
+
+int SpiStream_Trigger(SpiStream *stream)
+{
+    size_t frames = stream->config.framesPerTransfer;
+    if (stream->fillingBuffer < 0) {
+        stream->stats.overrunFrames += (uint32_t)frames;
+        return 0;
+    }
+
+    // The read segments of each frame read consecutively into its place in the buffer, so only
+    // their pointers change from one transfer to the next.
+    uint8_t *frame = (uint8_t *)stream->config.buffers[stream->fillingBuffer] +
+                     stream->framesInBuffer * stream->frameSize;
+    size_t transferCount = stream->config.segmentCount * frames;
+    for (size_t i = 0; i < transferCount; ++i) {
+        if (stream->transfers[i].flags == SPI_TransferFlags_Read) {
+            stream->transfers[i].readData = frame;
+            frame += stream->transfers[i].length;
+        }
+    }
+
+    ssize_t expectedBytes = 0;
+    for (size_t i = 0; i < transferCount; ++i) {
+        expectedBytes += (ssize_t)stream->transfers[i].length;
+    }
+
+    ssize_t transferredBytes =
+        SPIMaster_TransferSequential(stream->spiFd, stream->transfers, transferCount);
+    if (transferredBytes != expectedBytes) {
+        if (transferredBytes >= 0) {
+            errno = EIO;
+        }
+        ++stream->stats.transferErrors;
+        return -1;
+    }
+
+    stream->stats.frames += frames;
+    stream->framesInBuffer += frames;
+    if (stream->framesInBuffer == stream->config.framesPerBuffer) {
+        PublishBuffer(stream);
+    }
+    return 0;
+}
+
+// This satisfies the EventLoopIoCallback signature.
+static void TimerCallback(EventLoop *el, int fd, EventLoop_IoEvents events, void *context)
+{
+    SpiStream *stream = context;
+    uint64_t expirations;
+    if (read(stream->timerFd, &expirations, sizeof(expirations)) == -1) {
+        Log_Debug("ERROR: Could not read timerfd %s (%d).\n", strerror(errno), errno);
+        return;
+    }
+
+    // The timer counts the periods which elapsed while the event loop was busy, but only one
+    // transfer is started, so that a late stream does not delay the event loop further.
+    if (expirations > 1) {
+        stream->stats.missedFrames +=
+            (uint32_t)((expirations - 1) * stream->config.framesPerTransfer);
+    }
+
+    if (SpiStream_Trigger(stream) != 0) {
+        Log_Debug("ERROR: SPI stream transfer failed: %s (%d).\n", strerror(errno), errno);
+    }
+}
+
+int SpiStream_Init(SpiStream *stream, EventLoop *eventLoop, int spiFd,
+                   const SpiStream_Config *config, SpiStream_BufferHandler handler, void *context)
+{
+    size_t frameSize;
+    if (handler == NULL || !IsConfigValid(config, &frameSize)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    memset(stream, 0, sizeof(*stream));
+    stream->spiFd = spiFd;
+    stream->config = *config;
+    stream->frameSize = frameSize;
+    stream->handler = handler;
+    stream->context = context;
+    stream->eventLoop = eventLoop;
+    stream->timerFd = -1;
+    for (size_t i = 0; i < SPI_STREAM_BUFFER_COUNT; ++i) {
+        stream->released[i] = true;
+    }
+    stream->fillingBuffer = 0;
+
+    // The segments of every frame in a transfer are the same, so the transfers are built once.
+    size_t transferCount = config->segmentCount * config->framesPerTransfer;
+    if (SPIMaster_InitTransfers(stream->transfers, transferCount) != 0) {
+        return -1;
+    }
+    for (size_t i = 0; i < transferCount; ++i) {
+        const SpiStream_Segment *segment = &config->segments[i % config->segmentCount];
+        stream->transfers[i].flags = segment->flags;
+        stream->transfers[i].length = segment->length;
+        if (segment->flags == SPI_TransferFlags_Write) {
+            stream->transfers[i].writeData = segment->writeData;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &stream->rateStart);
+
+    if (config->period.tv_sec == 0 && config->period.tv_nsec == 0) {
+        return 0;
+    }
+
+    stream->timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (stream->timerFd == -1) {
+        Log_Debug("ERROR: Unable to create timer: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+
+    struct itimerspec newValue = {.it_value = config->period, .it_interval = config->period};
+    if (timerfd_settime(stream->timerFd, /* flags */ 0, &newValue, /* old_value */ NULL) == -1) {
+        Log_Debug("ERROR: Could not set timer period: %s (%d).\n", strerror(errno), errno);
+        goto failed;
+    }
+
+    stream->timerRegistration =
+        EventLoop_RegisterIo(eventLoop, stream->timerFd, EventLoop_Input, TimerCallback, stream);
+    if (stream->timerRegistration == NULL) {
+        Log_Debug("ERROR: Unable to register timer event: %s (%d).\n", strerror(errno), errno);
+        goto failed;
+    }
+
+    return 0;
+
+failed:
+    SpiStream_Cleanup(stream);
+    return -1;
+}
+
+void SpiStream_ReleaseBuffer(SpiStream *stream, const void *buffer)
+{
+    for (int i = 0; i < SPI_STREAM_BUFFER_COUNT; ++i) {
+        if (stream->config.buffers[i] == buffer && !stream->released[i]) {
+            stream->released[i] = true;
+            if (stream->fillingBuffer < 0) {
+                stream->fillingBuffer = i;
+            }
+            return;
+        }
+    }
+}
+
+void SpiStream_GetStats(SpiStream *stream, SpiStream_Stats *stats)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t elapsedNs = ElapsedNs(&stream->rateStart, &now);
+    stream->stats.framesPerSecond =
+        elapsedNs > 0 ? (float)(stream->stats.frames - stream->rateFrames) * 1e9f / elapsedNs
+                      : 0.0f;
+    stream->rateFrames = stream->stats.frames;
+    stream->rateStart = now;
+
+    *stats = stream->stats;
+}
+
+void SpiStream_Cleanup(SpiStream *stream)
+{
+    if (stream->timerRegistration != NULL) {
+        EventLoop_UnregisterIo(stream->eventLoop, stream->timerRegistration);
+        stream->timerRegistration = NULL;
+    }
+
+    if (stream->timerFd != -1) {
+        close(stream->timerFd);
+        stream->timerFd = -1;
+    }
+}
@@ -0,0 +1,162 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#define SPI_STRUCTS_VERSION 1
+#include <applibs/eventloop.h>
+#include <applibs/spi.h>
+
+// The SPI stream samples an SPI device, such as an external ADC, continuously. It acquires frames
+// at a fixed pace with SPIMaster_TransferSequential, each frame being a sequence of segments such
+// as a command followed by the read of a conversion, and reads them straight into one of two
+// buffers which the application supplies. Once a buffer is full, the application's handler
+// receives it, without it being copied, while the other buffer fills. The handler, or whatever it
+// hands the buffer to, returns it with SpiStream_ReleaseBuffer. If neither buffer is free when a
+// frame is due, the frame is not acquired, and it is counted as an overrun.
+//
+// Transfers are paced by a timer, or by the application calling SpiStream_Trigger, for example
+// when a message from a real-time application reports that the device has a conversion ready.
+// Each transfer acquires framesPerTransfer frames in one call, with chip select asserted
+// throughout, which reduces the cost of each frame for devices which accept that. The stream
+// never allocates memory, and should only be used from the event loop's thread.
+
+/// <summary>Number of buffers which the stream fills in turn.</summary>
+#define SPI_STREAM_BUFFER_COUNT 2
+
+/// <summary>Maximum number of segments in one transfer, for all of its frames.</summary>
+#define SPI_STREAM_MAX_TRANSFERS 32
+
+/// <summary>One segment of the transfer which acquires a frame.</summary>
+typedef struct {
+    /// <summary>SPI_TransferFlags_Write or SPI_TransferFlags_Read.</summary>
+    SPI_TransferFlags flags;
+    /// <summary>For a write segment, the data to write, which must remain valid. A read segment
+    /// reads into the frame, after the data which the frame's earlier read segments
+    /// read.</summary>
+    const void *writeData;
+    /// <summary>Number of bytes to write or read.</summary>
+    size_t length;
+} SpiStream_Segment;
+
+/// <summary>Configuration of a stream.</summary>
+typedef struct {
+    /// <summary>Segments of the transfer which acquires one frame. The size of a frame is the
+    /// total length of its read segments.</summary>
+    const SpiStream_Segment *segments;
+    size_t segmentCount;
+    /// <summary>Number of frames which each transfer acquires. segmentCount * framesPerTransfer
+    /// must not exceed SPI_STREAM_MAX_TRANSFERS.</summary>
+    size_t framesPerTransfer;
+    /// <summary>Number of frames in each buffer; a multiple of framesPerTransfer.</summary>
+    size_t framesPerBuffer;
+    /// <summary>The buffers, each of framesPerBuffer frames, which must remain valid until the
+    /// stream is cleaned up.</summary>
+    void *buffers[SPI_STREAM_BUFFER_COUNT];
+    /// <summary>Period of the timer which starts each transfer, or zero if the application paces
+    /// the transfers with SpiStream_Trigger.</summary>
+    struct timespec period;
+} SpiStream_Config;
+
+/// <summary>Counters of a stream, since it was initialized.</summary>
+typedef struct {
+    /// <summary>Number of frames which were acquired.</summary>
+    uint64_t frames;
+    /// <summary>Number of buffers which were passed to the handler.</summary>
+    uint32_t buffers;
+    /// <summary>Number of frames which were not acquired because neither buffer was
+    /// free.</summary>
+    uint32_t overrunFrames;
+    /// <summary>Number of timer periods which passed without a transfer, because the event loop
+    /// was busy, multiplied by framesPerTransfer.</summary>
+    uint32_t missedFrames;
+    /// <summary>Number of transfers which failed. Their frames are not counted as
+    /// acquired.</summary>
+    uint32_t transferErrors;
+    /// <summary>Frames acquired per second, since the previous call to SpiStream_GetStats, or
+    /// since the stream was initialized.</summary>
+    float framesPerSecond;
+} SpiStream_Stats;
+
+typedef struct SpiStream SpiStream;
+
+/// <summary>
+///     Called when a buffer is full. The buffer remains the application's until it is passed to
+///     SpiStream_ReleaseBuffer, which may be called from the handler or later.
+/// </summary>
+/// <param name="stream">The stream.</param>
+/// <param name="buffer">The buffer, which holds frameCount frames.</param>
+/// <param name="frameCount">Number of frames in the buffer.</param>
+/// <param name="context">The context which was passed to SpiStream_Init.</param>
+typedef void (*SpiStream_BufferHandler)(SpiStream *stream, void *buffer, size_t frameCount,
+                                        void *context);
+
+/// <summary>State of a stream. Its members should only be used by the stream.</summary>
+struct SpiStream {
+    int spiFd;
+    SpiStream_Config config;
+    size_t frameSize;
+    SpiStream_BufferHandler handler;
+    void *context;
+    EventLoop *eventLoop;
+    int timerFd;
+    EventRegistration *timerRegistration;
+    SPIMaster_Transfer transfers[SPI_STREAM_MAX_TRANSFERS];
+    bool released[SPI_STREAM_BUFFER_COUNT];
+    // Index of the buffer which is filling, or -1 if neither buffer is free.
+    int fillingBuffer;
+    size_t framesInBuffer;
+    SpiStream_Stats stats;
+    uint64_t rateFrames;
+    struct timespec rateStart;
+};
+
+/// <summary>
+///     Initialize a stream, and start its timer if it has a period.
+/// </summary>
+/// <param name="stream">The stream to initialize.</param>
+/// <param name="eventLoop">The event loop which runs the timer.</param>
+/// <param name="spiFd">The SPI master interface, which the application has opened and
+/// configured.</param>
+/// <param name="config">The configuration, which is copied.</param>
+/// <param name="handler">Called with each full buffer.</param>
+/// <param name="context">Passed to the handler.</param>
+/// <returns>0 on success, or -1 with errno set on failure; EINVAL if the configuration is not
+/// valid.</returns>
+int SpiStream_Init(SpiStream *stream, EventLoop *eventLoop, int spiFd,
+                   const SpiStream_Config *config, SpiStream_BufferHandler handler,
+                   void *context);
+
+/// <summary>
+///     Start one transfer now, which is how a stream without a period is paced.
+/// </summary>
+/// <param name="stream">The stream.</param>
+/// <returns>0 if the frames were acquired or counted as an overrun, or -1 with errno set if the
+/// transfer failed.</returns>
+int SpiStream_Trigger(SpiStream *stream);
+
+/// <summary>
+///     Return a buffer which was passed to the handler, so that it can be filled again.
+/// </summary>
+/// <param name="stream">The stream.</param>
+/// <param name="buffer">The buffer.</param>
+void SpiStream_ReleaseBuffer(SpiStream *stream, const void *buffer);
+
+/// <summary>
+///     Get the counters of a stream, and the rate at which it has acquired frames since this was
+///     last called.
+/// </summary>
+/// <param name="stream">The stream.</param>
+/// <param name="stats">Receives the counters.</param>
+void SpiStream_GetStats(SpiStream *stream, SpiStream_Stats *stats);
+
+/// <summary>
+///     Stop a stream's timer. The SPI master interface is not closed.
+/// </summary>
+/// <param name="stream">The stream.</param>
+void SpiStream_Cleanup(SpiStream *stream);
@@ -0,0 +1,219 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include <applibs/eventloop.h>
+#include <applibs/log.h>
+
+#include "staged_startup.h"
+
+typedef enum { StageState_Pending, StageState_Succeeded, StageState_Failed } StageState;
+
+static EventLoop *startupEventLoop = NULL;
+static int timerFd = -1;
+static EventRegistration *timerRegistration = NULL;
+static const StagedStartup_Stage *stageTable = NULL;
+static size_t stageTableCount = 0;
+static StageState stageStates[STAGED_STARTUP_MAX_STAGES];
+static size_t nextStage = 0;
+// Whether the timer is running the remaining stages, rather than waiting for the deadline.
+static bool runningRemainingStages = false;
+static StagedStartup_FailureHandler failureCallback = NULL;
+static void *failureContext = NULL;
+static struct timespec startTime;
+static bool firstEventMarked = false;
+
+static int64_t ElapsedMs(clockid_t clock, const struct timespec *since)
+{
+    struct timespec now;
+    clock_gettime(clock, &now);
+    return (int64_t)(now.tv_sec - since->tv_sec) * 1000 +
+           (now.tv_nsec - since->tv_nsec) / 1000000;
+}
+
+// Arms the timer to fire once after the given interval.
+static int ArmTimer(const struct timespec *delay)
+{
+    struct itimerspec newValue = {.it_value = *delay, .it_interval = {0, 0}};
+    if (timerfd_settime(timerFd, /* flags */ 0, &newValue, /* old_value */ NULL) == -1) {
+        Log_Debug("ERROR: Could not set the startup timer: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+    return 0;
+}
+
+// Arms the timer to fire at the next event loop iteration.
+static void ScheduleNextStage(void)
+{
+    static const struct timespec now = {.tv_sec = 0, .tv_nsec = 1};
+    if (ArmTimer(&now) != 0 && failureCallback != NULL) {
+        failureCallback(stageTableCount, failureContext);
+    }
+}
+
+static void RunStage(size_t index)
+{
+    const StagedStartup_Stage *stage = &stageTable[index];
+    struct timespec stageStart;
+    clock_gettime(CLOCK_MONOTONIC, &stageStart);
+
+    bool succeeded = stage->handler(stage->context) == 0;
+    stageStates[index] = succeeded ? StageState_Succeeded : StageState_Failed;
+
+    Log_Debug("INFO: Deferred startup stage \"%s\" %s after %lld ms, taking %lld ms.\n",
+              stage->name, succeeded ? "succeeded" : "failed",
+              (long long)ElapsedMs(CLOCK_MONOTONIC, &startTime),
+              (long long)ElapsedMs(CLOCK_MONOTONIC, &stageStart));
+    if (!succeeded && failureCallback != NULL) {
+        failureCallback(index, failureContext);
+    }
+}
+
+// Skips the stages which have already been run by StagedStartup_Require.
+static void SkipCompletedStages(void)
+{
+    while (nextStage < stageTableCount && stageStates[nextStage] != StageState_Pending) {
+        ++nextStage;
+    }
+}
+
+// This satisfies the EventLoopIoCallback signature. The timer first fires at the deadline, then
+// once for each stage after StagedStartup_Complete or the deadline.
+static void StartupTimerCallback(EventLoop *el, int fd, EventLoop_IoEvents events, void *context)
+{
+    uint64_t expirations;
+    if (read(timerFd, &expirations, sizeof(expirations)) == -1) {
+        Log_Debug("ERROR: Could not read timerfd %s (%d).\n", strerror(errno), errno);
+        return;
+    }
+
+    runningRemainingStages = true;
+    SkipCompletedStages();
+    if (nextStage < stageTableCount) {
+        RunStage(nextStage++);
+        SkipCompletedStages();
+    }
+
+    if (nextStage < stageTableCount) {
+        ScheduleNextStage();
+    } else {
+        Log_Debug("INFO: Startup completed after %lld ms.\n",
+                  (long long)ElapsedMs(CLOCK_MONOTONIC, &startTime));
+    }
+}
+
+int StagedStartup_Start(EventLoop *eventLoop, const StagedStartup_Stage *stages, size_t stageCount,
+                        unsigned int deadlineSeconds, StagedStartup_FailureHandler failureHandler,
+                        void *context)
+{
+    if (timerFd != -1 || stageCount > STAGED_STARTUP_MAX_STAGES || deadlineSeconds == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &startTime);
+    stageTable = stages;
+    stageTableCount = stageCount;
+    for (size_t i = 0; i < stageCount; ++i) {
+        stageStates[i] = StageState_Pending;
+    }
+    nextStage = 0;
+    runningRemainingStages = false;
+    failureCallback = failureHandler;
+    failureContext = context;
+    firstEventMarked = false;
+
+    timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (timerFd == -1) {
+        Log_Debug("ERROR: Unable to create timer: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+
+    struct timespec deadline = {.tv_sec = deadlineSeconds, .tv_nsec = 0};
+    if (ArmTimer(&deadline) != 0) {
+        goto failed;
+    }
+
+    timerRegistration =
+        EventLoop_RegisterIo(eventLoop, timerFd, EventLoop_Input, StartupTimerCallback, NULL);
+    if (timerRegistration == NULL) {
+        Log_Debug("ERROR: Unable to register timer event: %s (%d).\n", strerror(errno), errno);
+        goto failed;
+    }
+
+    startupEventLoop = eventLoop;
+    return 0;
+
+failed:
+    StagedStartup_Stop();
+    return -1;
+}
+
+bool StagedStartup_Require(size_t stageIndex)
+{
+    if (stageIndex >= stageTableCount) {
+        return false;
+    }
+
+    if (stageStates[stageIndex] == StageState_Pending) {
+        RunStage(stageIndex);
+    }
+    return stageStates[stageIndex] == StageState_Succeeded;
+}
+
+void StagedStartup_Complete(void)
+{
+    // Once the deadline has passed, or this has been called, the timer is already running the
+    // remaining stages.
+    if (timerFd == -1 || runningRemainingStages) {
+        return;
+    }
+
+    runningRemainingStages = true;
+    SkipCompletedStages();
+    if (nextStage < stageTableCount) {
+        ScheduleNextStage();
+    }
+}
+
+bool StagedStartup_IsComplete(void)
+{
+    for (size_t i = 0; i < stageTableCount; ++i) {
+        if (stageStates[i] == StageState_Pending) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void StagedStartup_MarkFirstEvent(const char *description)
+{
+    if (firstEventMarked) {
+        return;
+    }
+    firstEventMarked = true;
+
+    static const struct timespec boot = {.tv_sec = 0, .tv_nsec = 0};
+    Log_Debug("INFO: First %s after %lld ms, %lld ms after the device booted.\n", description,
+              (long long)ElapsedMs(CLOCK_MONOTONIC, &startTime),
+              (long long)ElapsedMs(CLOCK_BOOTTIME, &boot));
+}
+
+void StagedStartup_Stop(void)
+{
+    if (timerRegistration != NULL) {
+        EventLoop_UnregisterIo(startupEventLoop, timerRegistration);
+        timerRegistration = NULL;
+    }
+    if (timerFd != -1) {
+        close(timerFd);
+        timerFd = -1;
+    }
+}
@@ -0,0 +1,105 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <applibs/eventloop.h>
+
+// Staged startup lets an application open only the resources which its first useful work needs
+// before it enters the event loop, and defer the rest, so that a device which is power-cycled
+// starts doing that work sooner after it boots.
+//
+// The application opens its critical resources itself, then passes a table of deferred stages to
+// StagedStartup_Start. Each stage runs exactly once, at the earliest of:
+// - StagedStartup_Require, which the application calls before it first uses the stage's
+//   resources, and which runs the stage at once;
+// - StagedStartup_Complete, which the application calls once its first useful work is done, for
+//   example when the first telemetry message has been sent; the remaining stages then run one per
+//   event loop iteration, so that events are still handled promptly in between;
+// - the deadline passed to StagedStartup_Start, after which the remaining stages run as if
+//   StagedStartup_Complete had been called, so that they run even if the first useful work never
+//   completes.
+//
+// StagedStartup_MarkFirstEvent logs the time to the application's first useful event, both since
+// StagedStartup_Start and since the device booted.
+//
+// The library is not thread-safe; it should only be used from the event loop's thread.
+
+/// <summary>Maximum number of deferred stages.</summary>
+#define STAGED_STARTUP_MAX_STAGES 16
+
+/// <summary>
+///     Opens the resources of a deferred stage.
+/// </summary>
+/// <param name="context">The context which was given in the stage.</param>
+/// <returns>0 on success, or -1 on failure.</returns>
+typedef int (*StagedStartup_StageHandler)(void *context);
+
+/// <summary>
+///     A stage of startup which can be deferred.
+/// </summary>
+typedef struct {
+    /// <summary>Name of the stage, which is shown in the log.</summary>
+    const char *name;
+    StagedStartup_StageHandler handler;
+    void *context;
+} StagedStartup_Stage;
+
+/// <summary>
+///     Called when a deferred stage fails, or when the deferred stages cannot be scheduled.
+/// </summary>
+/// <param name="stageIndex">Index of the stage in the table, or the number of stages if they
+/// could not be scheduled.</param>
+/// <param name="context">The context which was passed to StagedStartup_Start.</param>
+typedef void (*StagedStartup_FailureHandler)(size_t stageIndex, void *context);
+
+/// <summary>
+///     Starts the timer which runs the deferred stages. No stage is run by this call.
+/// </summary>
+/// <param name="eventLoop">The event loop which runs the stages.</param>
+/// <param name="stages">The deferred stages, in the order in which they run. The table must
+/// remain valid until StagedStartup_Stop is called.</param>
+/// <param name="stageCount">Number of stages, which is at most
+/// STAGED_STARTUP_MAX_STAGES.</param>
+/// <param name="deadlineSeconds">Time after which the remaining stages run even if
+/// StagedStartup_Complete has not been called.</param>
+/// <param name="failureHandler">Called when a stage fails.</param>
+/// <param name="context">Passed to the failure handler.</param>
+/// <returns>0 on success, or -1 on failure, in which case errno is set.</returns>
+int StagedStartup_Start(EventLoop *eventLoop, const StagedStartup_Stage *stages, size_t stageCount,
+                        unsigned int deadlineSeconds, StagedStartup_FailureHandler failureHandler,
+                        void *context);
+
+/// <summary>
+///     Runs a stage now if it has not run yet. Call this before the stage's resources are first
+///     used.
+/// </summary>
+/// <param name="stageIndex">Index of the stage in the table.</param>
+/// <returns>true if the stage has succeeded, now or before; false if it failed, now or before,
+/// or if the index is not valid.</returns>
+bool StagedStartup_Require(size_t stageIndex);
+
+/// <summary>
+///     Runs the remaining stages, one per event loop iteration. Call this once the application's
+///     first useful work is done; later calls have no effect.
+/// </summary>
+void StagedStartup_Complete(void);
+
+/// <summary>
+///     Gets whether every stage has run.
+/// </summary>
+bool StagedStartup_IsComplete(void);
+
+/// <summary>
+///     Logs the time to the application's first useful event. Only the first call has an effect.
+/// </summary>
+/// <param name="description">What happened, for example "telemetry sent".</param>
+void StagedStartup_MarkFirstEvent(const char *description);
+
+/// <summary>
+///     Stops the timer. Any stage which has not run is not run.
+/// </summary>
+void StagedStartup_Stop(void);
@@ -0,0 +1,388 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <string.h>
+
+#include <applibs/log.h>
+
+#include "cbor_writer.h"
+#include "json_writer.h"
+#include "telemetry_pipeline.h"
+
+static void ResetWindow(TelemetryPipeline_Window *window);
+static void AggregateReading(TelemetryPipeline *pipeline, const float *values);
+static void PushWindow(TelemetryPipeline *pipeline);
+static bool ShouldReportWindow(TelemetryPipeline *pipeline, const TelemetryPipeline_Window *window,
+                               bool *changed);
+static bool IsBatchReady(const TelemetryPipeline *pipeline);
+static const TelemetryPipeline_Window *GetWindow(const TelemetryPipeline *pipeline, size_t index);
+static bool EncodeJsonBatch(TelemetryPipeline *pipeline, size_t count, size_t *size);
+static bool EncodeCborBatch(TelemetryPipeline *pipeline, size_t count, size_t *size);
+static void PopWindows(TelemetryPipeline *pipeline, size_t count);
+
+int TelemetryPipeline_Init(TelemetryPipeline *pipeline, const TelemetryPipeline_Channel *channels,
+                           size_t channelCount, uint32_t readingsPerWindow,
+                           size_t windowsPerMessage, time_t maxBatchAgeSeconds,
+                           unsigned int maxMessagesInFlight,
+                           TelemetryPipeline_SendHandler sendHandler, void *context)
+{
+    if (channelCount == 0 || channelCount > TELEMETRY_PIPELINE_MAX_CHANNELS ||
+        readingsPerWindow == 0 || windowsPerMessage == 0 ||
+        windowsPerMessage > TELEMETRY_PIPELINE_MAX_WINDOWS || maxMessagesInFlight == 0 ||
+        sendHandler == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    memset(pipeline, 0, sizeof(*pipeline));
+    pipeline->channels = channels;
+    pipeline->channelCount = channelCount;
+    pipeline->readingsPerWindow = readingsPerWindow;
+    pipeline->windowsPerMessage = windowsPerMessage;
+    pipeline->maxBatchAgeSeconds = maxBatchAgeSeconds;
+    pipeline->maxMessagesInFlight = maxMessagesInFlight;
+    pipeline->sendHandler = sendHandler;
+    pipeline->context = context;
+    pipeline->encoding = TelemetryPipeline_Encoding_Json;
+    ResetWindow(&pipeline->current);
+
+    return 0;
+}
+
+void TelemetryPipeline_SetEncoding(TelemetryPipeline *pipeline, TelemetryPipeline_Encoding encoding)
+{
+    pipeline->encoding = encoding;
+}
+
+int TelemetryPipeline_SetReportingPolicy(TelemetryPipeline *pipeline,
+                                         const TelemetryPipeline_ReportingPolicy *policy)
+{
+    if (policy == NULL) {
+        pipeline->hasPolicy = false;
+        pipeline->flushRequested = false;
+        return 0;
+    }
+
+    if (policy->minIntervalSeconds < 0 || policy->maxIntervalSeconds < 0 ||
+        (policy->heartbeatOnly && policy->maxIntervalSeconds == 0)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    pipeline->policy = *policy;
+    pipeline->hasPolicy = true;
+    pipeline->hasReported = false;
+    return 0;
+}
+
+void TelemetryPipeline_AddReading(TelemetryPipeline *pipeline, const float *values)
+{
+    ++pipeline->stats.readingsAdded;
+
+    if (pipeline->readingCount == TELEMETRY_PIPELINE_MAX_READINGS) {
+        pipeline->readingHead = (pipeline->readingHead + 1) % TELEMETRY_PIPELINE_MAX_READINGS;
+        --pipeline->readingCount;
+        ++pipeline->stats.readingsDropped;
+    }
+
+    size_t tail =
+        (pipeline->readingHead + pipeline->readingCount) % TELEMETRY_PIPELINE_MAX_READINGS;
+    memcpy(pipeline->readings[tail], values, pipeline->channelCount * sizeof(float));
+    ++pipeline->readingCount;
+}
+
+static void ResetWindow(TelemetryPipeline_Window *window)
+{
+    memset(window, 0, sizeof(*window));
+}
+
+static void AggregateReading(TelemetryPipeline *pipeline, const float *values)
+{
+    TelemetryPipeline_Window *window = &pipeline->current;
+
+    for (size_t i = 0; i < pipeline->channelCount; ++i) {
+        TelemetryPipeline_ChannelStats *stats = &window->channels[i];
+        if (window->count == 0 || values[i] < stats->min) {
+            stats->min = values[i];
+        }
+        if (window->count == 0 || values[i] > stats->max) {
+            stats->max = values[i];
+        }
+        stats->sum += values[i];
+    }
+
+    if (++window->count == pipeline->readingsPerWindow) {
+        PushWindow(pipeline);
+    }
+}
+
+// Applies the reporting policy to a completed window. If it is reported, it becomes the window
+// against which later ones are compared, and changed is set if it was reported because it changed.
+static bool ShouldReportWindow(TelemetryPipeline *pipeline, const TelemetryPipeline_Window *window,
+                               bool *changed)
+{
+    const TelemetryPipeline_ReportingPolicy *policy = &pipeline->policy;
+    time_t now = window->completedTime.tv_sec;
+    float means[TELEMETRY_PIPELINE_MAX_CHANNELS];
+    for (size_t i = 0; i < pipeline->channelCount; ++i) {
+        means[i] = (float)(window->channels[i].sum / window->count);
+    }
+
+    *changed = !pipeline->hasReported;
+    bool report = *changed;
+    time_t elapsed = now - pipeline->lastReportTime;
+    if (!report && policy->maxIntervalSeconds > 0 && elapsed >= policy->maxIntervalSeconds) {
+        report = true;
+    }
+    if (!report && !policy->heartbeatOnly && elapsed >= policy->minIntervalSeconds) {
+        for (size_t i = 0; i < pipeline->channelCount; ++i) {
+            float change = means[i] - pipeline->lastReportedMeans[i];
+            float deadband = pipeline->channels[i].deadband;
+            if (change > deadband || change < -deadband) {
+                *changed = true;
+                report = true;
+                break;
+            }
+        }
+    }
+
+    if (report) {
+        pipeline->hasReported = true;
+        pipeline->lastReportTime = now;
+        memcpy(pipeline->lastReportedMeans, means, pipeline->channelCount * sizeof(float));
+    }
+    return report;
+}
+
+// Moves the current window to the queue of windows which are waiting to be sent, unless the
+// reporting policy suppresses it. If the queue is full, the oldest window is dropped to make room.
+static void PushWindow(TelemetryPipeline *pipeline)
+{
+    clock_gettime(CLOCK_MONOTONIC, &pipeline->current.completedTime);
+
+    if (pipeline->hasPolicy) {
+        bool changed;
+        if (!ShouldReportWindow(pipeline, &pipeline->current, &changed)) {
+            ++pipeline->stats.windowsSuppressed;
+            ResetWindow(&pipeline->current);
+            return;
+        }
+        if (changed) {
+            pipeline->flushRequested = true;
+        }
+    }
+
+    if (pipeline->windowCount == TELEMETRY_PIPELINE_MAX_WINDOWS) {
+        PopWindows(pipeline, 1);
+        ++pipeline->stats.windowsDropped;
+    }
+
+    size_t tail = (pipeline->windowHead + pipeline->windowCount) % TELEMETRY_PIPELINE_MAX_WINDOWS;
+    pipeline->windows[tail] = pipeline->current;
+    ++pipeline->windowCount;
+
+    ResetWindow(&pipeline->current);
+}
+
+static void PopWindows(TelemetryPipeline *pipeline, size_t count)
+{
+    pipeline->windowHead = (pipeline->windowHead + count) % TELEMETRY_PIPELINE_MAX_WINDOWS;
+    pipeline->windowCount -= count;
+    if (pipeline->windowCount == 0) {
+        pipeline->flushRequested = false;
+    }
+}
+
+// A batch is sent when it is full, when a window has changed by more than a deadband, or when its
+// oldest window has waited long enough.
+static bool IsBatchReady(const TelemetryPipeline *pipeline)
+{
+    if (pipeline->windowCount == 0) {
+        return false;
+    }
+
+    if (pipeline->windowCount >= pipeline->windowsPerMessage || pipeline->flushRequested) {
+        return true;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    const TelemetryPipeline_Window *oldest = &pipeline->windows[pipeline->windowHead];
+    return now.tv_sec - oldest->completedTime.tv_sec >= pipeline->maxBatchAgeSeconds;
+}
+
+// Gets a queued window; 0 is the oldest.
+static const TelemetryPipeline_Window *GetWindow(const TelemetryPipeline *pipeline, size_t index)
+{
+    return &pipeline->windows[(pipeline->windowHead + index) % TELEMETRY_PIPELINE_MAX_WINDOWS];
+}
+
+// Encodes the oldest windows into the message buffer as JSON. Returns false if they do not fit.
+static bool EncodeJsonBatch(TelemetryPipeline *pipeline, size_t count, size_t *size)
+{
+    JsonWriter writer;
+    JsonWriter_Init(&writer, (char *)pipeline->message, sizeof(pipeline->message));
+    bool isArray = count > 1;
+
+    if (isArray) {
+        JsonWriter_BeginArray(&writer, NULL);
+    }
+
+    for (size_t w = 0; w < count; ++w) {
+        const TelemetryPipeline_Window *window = GetWindow(pipeline, w);
+
+        JsonWriter_BeginObject(&writer, NULL);
+        for (size_t i = 0; i < pipeline->channelCount; ++i) {
+            const TelemetryPipeline_Channel *channel = &pipeline->channels[i];
+            const TelemetryPipeline_ChannelStats *stats = &window->channels[i];
+
+            JsonWriter_AddFloat(&writer, channel->name, stats->sum / window->count,
+                                channel->precision);
+            if (channel->minName != NULL) {
+                JsonWriter_AddFloat(&writer, channel->minName, stats->min, channel->precision);
+            }
+            if (channel->maxName != NULL) {
+                JsonWriter_AddFloat(&writer, channel->maxName, stats->max, channel->precision);
+            }
+        }
+        JsonWriter_EndObject(&writer);
+    }
+
+    if (isArray) {
+        JsonWriter_EndArray(&writer);
+    }
+
+    const char *message = JsonWriter_Finish(&writer);
+    if (message == NULL) {
+        return false;
+    }
+
+    *size = strlen(message);
+    return true;
+}
+
+// Encodes the oldest windows into the message buffer as CBOR, with the same structure as the JSON
+// encoding. Returns false if they do not fit.
+static bool EncodeCborBatch(TelemetryPipeline *pipeline, size_t count, size_t *size)
+{
+    CborWriter writer;
+    CborWriter_Init(&writer, pipeline->message, sizeof(pipeline->message));
+    bool isArray = count > 1;
+
+    if (isArray) {
+        CborWriter_BeginArray(&writer, NULL);
+    }
+
+    for (size_t w = 0; w < count; ++w) {
+        const TelemetryPipeline_Window *window = GetWindow(pipeline, w);
+
+        CborWriter_BeginObject(&writer, NULL);
+        for (size_t i = 0; i < pipeline->channelCount; ++i) {
+            const TelemetryPipeline_Channel *channel = &pipeline->channels[i];
+            const TelemetryPipeline_ChannelStats *stats = &window->channels[i];
+
+            CborWriter_AddFloat(&writer, channel->name, stats->sum / window->count,
+                                channel->precision);
+            if (channel->minName != NULL) {
+                CborWriter_AddFloat(&writer, channel->minName, stats->min, channel->precision);
+            }
+            if (channel->maxName != NULL) {
+                CborWriter_AddFloat(&writer, channel->maxName, stats->max, channel->precision);
+            }
+        }
+        CborWriter_EndObject(&writer);
+    }
+
+    if (isArray) {
+        CborWriter_EndArray(&writer);
+    }
+
+    return CborWriter_Finish(&writer, size) != NULL;
+}
+
+void TelemetryPipeline_Process(TelemetryPipeline *pipeline)
+{
+    // Aggregate all the queued readings.
+    while (pipeline->readingCount > 0) {
+        AggregateReading(pipeline, pipeline->readings[pipeline->readingHead]);
+        pipeline->readingHead = (pipeline->readingHead + 1) % TELEMETRY_PIPELINE_MAX_READINGS;
+        --pipeline->readingCount;
+    }
+
+    // Send batches until there are no more, or the sender pushes back.
+    while (IsBatchReady(pipeline)) {
+        if (pipeline->messagesInFlight >= pipeline->maxMessagesInFlight) {
+            ++pipeline->stats.sendsDeferred;
+            return;
+        }
+
+        size_t count = pipeline->windowCount;
+        if (count > pipeline->windowsPerMessage) {
+            count = pipeline->windowsPerMessage;
+        }
+
+        size_t size = 0;
+        bool encoded = pipeline->encoding == TelemetryPipeline_Encoding_Cbor
+                           ? EncodeCborBatch(pipeline, count, &size)
+                           : EncodeJsonBatch(pipeline, count, &size);
+        if (!encoded) {
+            Log_Debug("ERROR: Cannot write telemetry to buffer.\n");
+            PopWindows(pipeline, count);
+            pipeline->stats.windowsDropped += (uint32_t)count;
+            continue;
+        }
+
+        if (!pipeline->sendHandler(pipeline->message, size, pipeline->context)) {
+            ++pipeline->stats.sendsDeferred;
+            return;
+        }
+
+        ++pipeline->messagesInFlight;
+        ++pipeline->stats.messagesSent;
+        PopWindows(pipeline, count);
+    }
+}
+
+void TelemetryPipeline_OnSendComplete(TelemetryPipeline *pipeline, bool delivered)
+{
+    if (pipeline->messagesInFlight > 0) {
+        --pipeline->messagesInFlight;
+    }
+
+    if (!delivered) {
+        ++pipeline->stats.messagesFailed;
+    }
+}
+
+bool TelemetryPipeline_GetSecondsUntilBatch(const TelemetryPipeline *pipeline, time_t *seconds)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    time_t due;
+    if (pipeline->windowCount > 0) {
+        if (pipeline->windowCount >= pipeline->windowsPerMessage || pipeline->flushRequested) {
+            *seconds = 0;
+            return true;
+        }
+        due = GetWindow(pipeline, 0)->completedTime.tv_sec + pipeline->maxBatchAgeSeconds;
+    } else if (pipeline->hasPolicy && pipeline->hasReported &&
+               pipeline->policy.maxIntervalSeconds > 0) {
+        // The heartbeat is batched as usual, so unless it fills a batch, it waits for its age.
+        due = pipeline->lastReportTime + pipeline->policy.maxIntervalSeconds;
+        if (pipeline->windowsPerMessage > 1) {
+            due += pipeline->maxBatchAgeSeconds;
+        }
+    } else {
+        return false;
+    }
+
+    *seconds = due > now.tv_sec ? due - now.tv_sec : 0;
+    return true;
+}
+
+const TelemetryPipeline_Stats *TelemetryPipeline_GetStats(const TelemetryPipeline *pipeline)
+{
+    return &pipeline->stats;
+}
@@ -0,0 +1,255 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+// The telemetry pipeline turns a stream of sensor readings into a small number of IoT Hub
+// messages. Readings are queued in a ring buffer as they are taken; TelemetryPipeline_Process
+// aggregates them into windows which hold the mean, minimum, and maximum of each channel; and
+// windows are encoded into one JSON or CBOR message per batch. A message is only handed to the
+// sender while fewer than the configured number of messages are in flight, and while the sender
+// accepts it, so windows queue up while the device is disconnected. If they are not drained in
+// time, the oldest are dropped and counted. An optional reporting policy suppresses windows in
+// which no channel has changed by more than its deadband, and sends a change at once.
+
+/// <summary>Maximum number of values in each reading.</summary>
+#define TELEMETRY_PIPELINE_MAX_CHANNELS 4
+
+/// <summary>Number of readings which can be queued before they are aggregated.</summary>
+#define TELEMETRY_PIPELINE_MAX_READINGS 32
+
+/// <summary>Number of windows which can be waiting to be sent.</summary>
+#define TELEMETRY_PIPELINE_MAX_WINDOWS 16
+
+/// <summary>Size of the buffer into which each message is encoded.</summary>
+#define TELEMETRY_PIPELINE_MESSAGE_SIZE 1024
+
+/// <summary>Format in which batches are encoded.</summary>
+typedef enum {
+    /// <summary>JSON text, which is null-terminated.</summary>
+    TelemetryPipeline_Encoding_Json,
+    /// <summary>CBOR, which is binary and typically around half the size of the JSON.</summary>
+    TelemetryPipeline_Encoding_Cbor
+} TelemetryPipeline_Encoding;
+
+/// <summary>
+///     Describes one value in each reading, and the properties into which its statistics are
+///     encoded.
+/// </summary>
+typedef struct {
+    /// <summary>Property which holds the mean of the window.</summary>
+    const char *name;
+    /// <summary>Property which holds the minimum of the window, or NULL to omit it.</summary>
+    const char *minName;
+    /// <summary>Property which holds the maximum of the window, or NULL to omit it.</summary>
+    const char *maxName;
+    /// <summary>Number of digits to write after the decimal point.</summary>
+    unsigned int precision;
+    /// <summary>If a reporting policy is set, a window is reported at once when the mean of this
+    /// channel differs by more than this from that of the last reported window. 0 reports any
+    /// change.</summary>
+    float deadband;
+} TelemetryPipeline_Channel;
+
+/// <summary>
+///     Decides which windows are reported, so that unchanged readings are not sent. See
+///     <see cref="TelemetryPipeline_SetReportingPolicy" />.
+/// </summary>
+typedef struct {
+    /// <summary>Windows which change by more than a deadband are not reported more often than
+    /// this; 0 for no limit.</summary>
+    time_t minIntervalSeconds;
+    /// <summary>A window is reported at least this often, even if nothing has changed, as a
+    /// heartbeat; 0 for no heartbeat.</summary>
+    time_t maxIntervalSeconds;
+    /// <summary>Ignore the deadbands, and only report a window every maxIntervalSeconds.</summary>
+    bool heartbeatOnly;
+} TelemetryPipeline_ReportingPolicy;
+
+/// <summary>
+///     <para>Invoked to send an encoded message. If the sender accepts the message, it must
+///     later call <see cref="TelemetryPipeline_OnSendComplete" /> exactly once.</para>
+///     <param name="message">Encoded message, which is only valid during the call.</param>
+///     <param name="size">Size of the message in bytes, excluding the null terminator of a JSON
+///     message.</param>
+///     <param name="context">Context which was supplied to TelemetryPipeline_Init.</param>
+///     <returns>true if the message was accepted for delivery; false if it could not be sent
+///     now, in which case it is offered again later.</returns>
+/// </summary>
+typedef bool (*TelemetryPipeline_SendHandler)(const void *message, size_t size, void *context);
+
+/// <summary>Counters which describe the pipeline since it was initialized.</summary>
+typedef struct {
+    /// <summary>Number of readings which were added.</summary>
+    uint32_t readingsAdded;
+    /// <summary>Number of readings which were dropped because the ring buffer was full.</summary>
+    uint32_t readingsDropped;
+    /// <summary>Number of windows which were dropped because too many were waiting.</summary>
+    uint32_t windowsDropped;
+    /// <summary>Number of messages which were accepted by the sender.</summary>
+    uint32_t messagesSent;
+    /// <summary>Number of accepted messages which were not delivered.</summary>
+    uint32_t messagesFailed;
+    /// <summary>Number of times a message was not sent because of back-pressure.</summary>
+    uint32_t sendsDeferred;
+    /// <summary>Number of windows which the reporting policy did not report.</summary>
+    uint32_t windowsSuppressed;
+} TelemetryPipeline_Stats;
+
+/// <summary>Statistics of one channel over a window. Private to telemetry_pipeline.c.</summary>
+typedef struct {
+    double sum;
+    float min;
+    float max;
+} TelemetryPipeline_ChannelStats;
+
+/// <summary>Aggregated readings. Private to telemetry_pipeline.c.</summary>
+typedef struct {
+    uint32_t count;
+    struct timespec completedTime;
+    TelemetryPipeline_ChannelStats channels[TELEMETRY_PIPELINE_MAX_CHANNELS];
+} TelemetryPipeline_Window;
+
+/// <summary>
+///     State of a telemetry pipeline. The client should not directly modify member variables.
+/// </summary>
+typedef struct {
+    const TelemetryPipeline_Channel *channels;
+    size_t channelCount;
+    uint32_t readingsPerWindow;
+    size_t windowsPerMessage;
+    time_t maxBatchAgeSeconds;
+    unsigned int maxMessagesInFlight;
+    TelemetryPipeline_SendHandler sendHandler;
+    void *context;
+    TelemetryPipeline_Encoding encoding;
+
+    // Reporting policy, and the last window which it reported.
+    bool hasPolicy;
+    TelemetryPipeline_ReportingPolicy policy;
+    bool hasReported;
+    time_t lastReportTime;
+    float lastReportedMeans[TELEMETRY_PIPELINE_MAX_CHANNELS];
+    // A window changed by more than a deadband, so the queued windows are sent without waiting
+    // for a full batch.
+    bool flushRequested;
+
+    // Ring buffer of readings which have not been aggregated.
+    float readings[TELEMETRY_PIPELINE_MAX_READINGS][TELEMETRY_PIPELINE_MAX_CHANNELS];
+    size_t readingHead;
+    size_t readingCount;
+
+    // Window which is being aggregated.
+    TelemetryPipeline_Window current;
+
+    // Ring buffer of complete windows which have not been sent.
+    TelemetryPipeline_Window windows[TELEMETRY_PIPELINE_MAX_WINDOWS];
+    size_t windowHead;
+    size_t windowCount;
+
+    unsigned int messagesInFlight;
+    TelemetryPipeline_Stats stats;
+    uint8_t message[TELEMETRY_PIPELINE_MESSAGE_SIZE];
+} TelemetryPipeline;
+
+/// <summary>
+///     <para>Initializes a pipeline.</para>
+///     <param name="pipeline">Pipeline to initialize.</param>
+///     <param name="channels">Description of each value in a reading. Not copied, so it must
+///     remain valid while the pipeline is used.</param>
+///     <param name="channelCount">Number of channels, at most
+///     TELEMETRY_PIPELINE_MAX_CHANNELS.</param>
+///     <param name="readingsPerWindow">Number of readings which are aggregated into each
+///     window.</param>
+///     <param name="windowsPerMessage">Number of windows which are sent in each message, at
+///     most TELEMETRY_PIPELINE_MAX_WINDOWS. One window is sent as a JSON object; more are sent
+///     as a JSON array of objects.</param>
+///     <param name="maxBatchAgeSeconds">A batch which is not full is sent once its oldest
+///     window is this old.</param>
+///     <param name="maxMessagesInFlight">Maximum number of messages which may have been
+///     accepted by the sender without having completed.</param>
+///     <param name="sendHandler">Function which sends each message.</param>
+///     <param name="context">Context which is passed to the send handler.</param>
+///     <returns>0 on success, or -1 if an argument was invalid.</returns>
+/// </summary>
+int TelemetryPipeline_Init(TelemetryPipeline *pipeline, const TelemetryPipeline_Channel *channels,
+                           size_t channelCount, uint32_t readingsPerWindow,
+                           size_t windowsPerMessage, time_t maxBatchAgeSeconds,
+                           unsigned int maxMessagesInFlight,
+                           TelemetryPipeline_SendHandler sendHandler, void *context);
+
+/// <summary>
+///     Sets the format in which subsequent batches are encoded. Batches are encoded as JSON
+///     unless this is called.
+///     <param name="pipeline">Pipeline initialized with TelemetryPipeline_Init.</param>
+///     <param name="encoding">The format.</param>
+/// </summary>
+void TelemetryPipeline_SetEncoding(TelemetryPipeline *pipeline,
+                                   TelemetryPipeline_Encoding encoding);
+
+/// <summary>
+///     <para>Sets the policy which decides which windows are reported. Without one, every window
+///     is reported.</para>
+///     <para>With a policy, a completed window is reported if it is the first, if it completes
+///     maxIntervalSeconds or more after the last reported window, or, unless heartbeatOnly is set,
+///     if the mean of any channel differs from that of the last reported window by more than the
+///     channel's deadband and minIntervalSeconds have passed. Other windows are dropped and
+///     counted. A window which is reported because it changed is sent at once, with any windows
+///     which are waiting, rather than when the batch is full.</para>
+///     <param name="pipeline">Pipeline initialized with TelemetryPipeline_Init.</param>
+///     <param name="policy">The policy, which is copied, or NULL to report every window.</param>
+///     <returns>0 on success, or -1 if the policy was invalid, in which case errno is set to
+///     EINVAL.</returns>
+/// </summary>
+int TelemetryPipeline_SetReportingPolicy(TelemetryPipeline *pipeline,
+                                         const TelemetryPipeline_ReportingPolicy *policy);
+
+/// <summary>
+///     Queues a reading. It is not aggregated until TelemetryPipeline_Process is called. If the
+///     ring buffer is full, the oldest reading is dropped.
+///     <param name="pipeline">Pipeline initialized with TelemetryPipeline_Init.</param>
+///     <param name="values">One value for each channel.</param>
+/// </summary>
+void TelemetryPipeline_AddReading(TelemetryPipeline *pipeline, const float *values);
+
+/// <summary>
+///     Aggregates the queued readings, and sends as many complete batches as the sender and the
+///     in-flight limit allow. This should be called periodically, such as whenever readings
+///     have been taken.
+///     <param name="pipeline">Pipeline initialized with TelemetryPipeline_Init.</param>
+/// </summary>
+void TelemetryPipeline_Process(TelemetryPipeline *pipeline);
+
+/// <summary>
+///     Reports that a message which the sender accepted has completed.
+///     <param name="pipeline">Pipeline initialized with TelemetryPipeline_Init.</param>
+///     <param name="delivered">Whether the message was delivered.</param>
+/// </summary>
+void TelemetryPipeline_OnSendComplete(TelemetryPipeline *pipeline, bool delivered);
+
+/// <summary>
+///     <para>Predicts how long it is until the next batch is sent, so that an application can
+///     turn off its radio until shortly before then. A batch is due once the queued windows fill
+///     it or one has changed, or once the oldest is maxBatchAgeSeconds old. If no window is
+///     queued, the next batch is predicted from the reporting policy's heartbeat.</para>
+///     <para>A window which changes by more than a deadband cannot be predicted, so the
+///     application should call this again after each TelemetryPipeline_Process.</para>
+///     <param name="pipeline">Pipeline initialized with TelemetryPipeline_Init.</param>
+///     <param name="seconds">Receives the number of seconds, which is 0 if a batch is due
+///     now.</param>
+///     <returns>true on success; false if the time cannot be predicted, because no window is
+///     queued and there is no heartbeat.</returns>
+/// </summary>
+bool TelemetryPipeline_GetSecondsUntilBatch(const TelemetryPipeline *pipeline, time_t *seconds);
+
+/// <summary>
+///     Gets the counters of a pipeline.
+///     <param name="pipeline">Pipeline initialized with TelemetryPipeline_Init.</param>
+///     <returns>Counters which remain owned by the pipeline.</returns>
+/// </summary>
+const TelemetryPipeline_Stats *TelemetryPipeline_GetStats(const TelemetryPipeline *pipeline);
@@ -0,0 +1,350 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include <applibs/eventloop.h>
+#include <applibs/log.h>
+#include <applibs/networking.h>
+#include <applibs/rtc.h>
+
+#include "key_value_store.h"
+#include "time_keeper.h"
+
+// Error of the time just after a synchronization or after it was read from the RTC, in seconds.
+#define BASE_ERROR_SECONDS 1
+
+// Assumed drift of an RTC whose drift has not been measured, and the uncertainty of a measured
+// drift, in parts per million.
+#define UNKNOWN_DRIFT_PPM 100
+#define MEASURED_DRIFT_UNCERTAINTY_PPM 10
+
+// The drift is only measured over at least an hour, so that the error of the synchronization
+// itself is small compared with the drift. A measurement beyond the limit is taken to mean that
+// the RTC was set by something other than the time keeper, and is ignored.
+#define MIN_DRIFT_INTERVAL_SECONDS (60 * 60)
+#define MAX_DRIFT_PPB (500 * 1000)
+
+// A correction of less than this is not applied.
+#define MIN_CORRECTION_MS 100
+
+// The state which is kept in the key-value store.
+typedef struct {
+    // System time of the last synchronization, when the RTC was written, in seconds.
+    int64_t lastSyncTime;
+    // Clock base, as returned by GetClockBaseMs, of the boot in which the drift correction was
+    // applied, so that it is not applied again when the application restarts; 0 if none.
+    int64_t correctedBaseMs;
+    // The correction which was applied in that boot, in milliseconds.
+    int32_t correctionMs;
+    // Estimated rate at which the RTC gains time, in parts per billion; negative if it loses
+    // time.
+    int32_t driftPpb;
+    // Whether driftPpb has been measured.
+    uint8_t driftValid;
+    // Whether the clock has been set to a time which is not known to be accurate since the last
+    // synchronization, which may then have been written to the RTC.
+    uint8_t rtcUntrusted;
+    uint8_t reserved[6];
+} StoredState;
+
+static EventLoop *keeperEventLoop = NULL;
+static int timerFd = -1;
+static EventRegistration *timerRegistration = NULL;
+static TimeKeeper_Config keeperConfig;
+static TimeKeeper_ConfidenceChangedHandler confidenceChangedHandler = NULL;
+static void *confidenceChangedContext = NULL;
+
+static StoredState state;
+static bool haveState = false;
+// Whether the system time since the last synchronization has come from the RTC, so that its
+// error at the next synchronization shows the drift.
+static bool rtcTrusted = false;
+static bool synced = false;
+static TimeKeeper_Confidence reportedConfidence = TimeKeeper_Confidence_None;
+static int64_t lastClockBaseMs = 0;
+
+static int64_t ToMs(const struct timespec *ts)
+{
+    return (int64_t)ts->tv_sec * 1000 + ts->tv_nsec / 1000000;
+}
+
+// Gets the system time at which the device booted, in milliseconds, which only changes when the
+// system time is set.
+static int64_t GetClockBaseMs(void)
+{
+    struct timespec realTime, bootTime;
+    clock_gettime(CLOCK_REALTIME, &realTime);
+    clock_gettime(CLOCK_BOOTTIME, &bootTime);
+    return ToMs(&realTime) - ToMs(&bootTime);
+}
+
+static void StoreState(void)
+{
+    if (keeperConfig.storageKey == NULL) {
+        return;
+    }
+    if (KeyValueStore_Set(keeperConfig.storageKey, &state, sizeof(state)) == -1) {
+        Log_Debug("ERROR: Could not store the time keeper state: %s (%d).\n", strerror(errno),
+                  errno);
+    }
+}
+
+// Calls the handler if the confidence has changed.
+static void UpdateConfidence(void)
+{
+    TimeKeeper_Confidence confidence = TimeKeeper_GetConfidence();
+    if (confidence == reportedConfidence) {
+        return;
+    }
+    reportedConfidence = confidence;
+    if (confidenceChangedHandler != NULL) {
+        confidenceChangedHandler(confidence, confidenceChangedContext);
+    }
+}
+
+// Moves the system time by the given number of milliseconds.
+static int AdjustClock(int64_t adjustmentMs)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    int64_t adjustedNs = (int64_t)now.tv_sec * 1000000000 + now.tv_nsec + adjustmentMs * 1000000;
+    now.tv_sec = (time_t)(adjustedNs / 1000000000);
+    now.tv_nsec = (long)(adjustedNs % 1000000000);
+    if (clock_settime(CLOCK_REALTIME, &now) == -1) {
+        Log_Debug("ERROR: Could not set the system time: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+    return 0;
+}
+
+// Marks the time from the RTC as untrusted until the next synchronization.
+static void DistrustRtc(void)
+{
+    rtcTrusted = false;
+    synced = false;
+    if (haveState && !state.rtcUntrusted) {
+        state.rtcUntrusted = true;
+        StoreState();
+    }
+    UpdateConfidence();
+}
+
+// Corrects the time which the OS read from the RTC at boot, using the stored state.
+static void SeedFromRtc(void)
+{
+    if (state.rtcUntrusted) {
+        Log_Debug("INFO: The clock was set since the last synchronization; it is not trusted.\n");
+        return;
+    }
+
+    time_t now = time(NULL);
+    if (now < (time_t)state.lastSyncTime) {
+        // The RTC has gone backwards, so it lost its power. The last synchronization is the
+        // closest time which is known.
+        Log_Debug("WARNING: The RTC is earlier than the last synchronization; it lost power.\n");
+        struct timespec lastSync = {.tv_sec = (time_t)state.lastSyncTime, .tv_nsec = 0};
+        if (clock_settime(CLOCK_REALTIME, &lastSync) == -1) {
+            Log_Debug("ERROR: Could not set the system time: %s (%d).\n", strerror(errno),
+                      errno);
+        }
+        DistrustRtc();
+        return;
+    }
+
+    rtcTrusted = true;
+    int64_t clockBaseMs = GetClockBaseMs();
+    if (!state.driftValid || llabs(clockBaseMs - state.correctedBaseMs) < 1000) {
+        return;
+    }
+
+    int64_t elapsedSeconds = (int64_t)now - state.lastSyncTime;
+    int64_t correctionMs = elapsedSeconds * state.driftPpb / 1000000;
+    if (llabs(correctionMs) < MIN_CORRECTION_MS || AdjustClock(-correctionMs) != 0) {
+        return;
+    }
+
+    Log_Debug("INFO: Corrected the time from the RTC by %lld ms for its drift of %ld ppb.\n",
+              (long long)-correctionMs, (long)state.driftPpb);
+    state.correctedBaseMs = GetClockBaseMs();
+    state.correctionMs = (int32_t)correctionMs;
+    StoreState();
+}
+
+// Records a synchronization which moved the clock by stepMs, writes the time to the RTC, and
+// measures the drift of the RTC if it provided the time since the last synchronization.
+static void HandleSync(int64_t stepMs, bool measureDrift)
+{
+    time_t now = time(NULL);
+    int64_t elapsedSeconds = (int64_t)now - state.lastSyncTime;
+    if (measureDrift && haveState && rtcTrusted && elapsedSeconds >= MIN_DRIFT_INTERVAL_SECONDS) {
+        // The RTC read correctionMs ahead of the time which the clock was set to, and the
+        // clock was stepMs behind the synchronized time.
+        bool corrected = llabs(lastClockBaseMs - stepMs - state.correctedBaseMs) < 1000;
+        int64_t rtcErrorMs = (corrected ? state.correctionMs : 0) - stepMs;
+        int64_t driftPpb = rtcErrorMs * 1000000 / elapsedSeconds;
+        if (llabs(driftPpb) <= MAX_DRIFT_PPB) {
+            state.driftPpb =
+                state.driftValid ? (int32_t)((3 * (int64_t)state.driftPpb + driftPpb) / 4)
+                                 : (int32_t)driftPpb;
+            state.driftValid = true;
+            Log_Debug("INFO: The RTC was %lld ms off after %lld s; estimated drift %ld ppb.\n",
+                      (long long)rtcErrorMs, (long long)elapsedSeconds, (long)state.driftPpb);
+        }
+    }
+
+    if (clock_systohc() == -1) {
+        Log_Debug("ERROR: Could not write the time to the RTC: %s (%d).\n", strerror(errno),
+                  errno);
+        rtcTrusted = false;
+    } else {
+        rtcTrusted = true;
+    }
+
+    state.lastSyncTime = (int64_t)now;
+    state.correctedBaseMs = 0;
+    state.correctionMs = 0;
+    state.rtcUntrusted = false;
+    haveState = true;
+    synced = true;
+    StoreState();
+    UpdateConfidence();
+}
+
+// This satisfies the EventLoopIoCallback signature.
+static void PollTimerCallback(EventLoop *el, int fd, EventLoop_IoEvents events, void *context)
+{
+    uint64_t expirations;
+    if (read(timerFd, &expirations, sizeof(expirations)) == -1) {
+        Log_Debug("ERROR: Could not read timerfd %s (%d).\n", strerror(errno), errno);
+        return;
+    }
+
+    int64_t clockBaseMs = GetClockBaseMs();
+    int64_t stepMs = clockBaseMs - lastClockBaseMs;
+    if (llabs(stepMs) < TIME_KEEPER_STEP_THRESHOLD_MS) {
+        // The error bound grows with the time since the last synchronization.
+        UpdateConfidence();
+        return;
+    }
+    lastClockBaseMs = clockBaseMs;
+
+    bool isTimeSyncEnabled = false;
+    if (Networking_TimeSync_GetEnabled(&isTimeSyncEnabled) == -1 || !isTimeSyncEnabled) {
+        // Something other than NTP set the clock, so the time is not known.
+        Log_Debug("INFO: The system time was set by %lld ms.\n", (long long)stepMs);
+        DistrustRtc();
+        return;
+    }
+
+    Log_Debug("INFO: The system time was synchronized, by %lld ms.\n", (long long)stepMs);
+    HandleSync(stepMs, true);
+}
+
+int TimeKeeper_Start(EventLoop *eventLoop, const TimeKeeper_Config *config,
+                     TimeKeeper_ConfidenceChangedHandler handler, void *context)
+{
+    if (timerFd != -1 || config == NULL || config->pollPeriodSeconds == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    keeperConfig = *config;
+    confidenceChangedHandler = handler;
+    confidenceChangedContext = context;
+    synced = false;
+    rtcTrusted = false;
+    memset(&state, 0, sizeof(state));
+    haveState = config->storageKey != NULL &&
+                KeyValueStore_Get(config->storageKey, &state, sizeof(state)) == sizeof(state);
+    if (!haveState) {
+        memset(&state, 0, sizeof(state));
+        Log_Debug("INFO: The time has not been synchronized before; it is not trusted.\n");
+    } else {
+        SeedFromRtc();
+    }
+    lastClockBaseMs = GetClockBaseMs();
+    reportedConfidence = TimeKeeper_GetConfidence();
+
+    timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (timerFd == -1) {
+        Log_Debug("ERROR: Unable to create timer: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+
+    struct timespec period = {.tv_sec = config->pollPeriodSeconds, .tv_nsec = 0};
+    struct itimerspec newValue = {.it_value = period, .it_interval = period};
+    if (timerfd_settime(timerFd, /* flags */ 0, &newValue, /* old_value */ NULL) == -1) {
+        Log_Debug("ERROR: Could not set timer period: %s (%d).\n", strerror(errno), errno);
+        goto failed;
+    }
+
+    timerRegistration =
+        EventLoop_RegisterIo(eventLoop, timerFd, EventLoop_Input, PollTimerCallback, NULL);
+    if (timerRegistration == NULL) {
+        Log_Debug("ERROR: Unable to register timer event: %s (%d).\n", strerror(errno), errno);
+        goto failed;
+    }
+
+    keeperEventLoop = eventLoop;
+    return 0;
+
+failed:
+    TimeKeeper_Stop();
+    return -1;
+}
+
+TimeKeeper_Confidence TimeKeeper_GetConfidence(void)
+{
+    if (synced) {
+        return TimeKeeper_Confidence_Synced;
+    }
+    return TimeKeeper_GetErrorBoundSeconds() <= keeperConfig.maxErrorSeconds
+               ? TimeKeeper_Confidence_Rtc
+               : TimeKeeper_Confidence_None;
+}
+
+uint32_t TimeKeeper_GetErrorBoundSeconds(void)
+{
+    if (synced) {
+        return BASE_ERROR_SECONDS;
+    }
+    if (!haveState || !rtcTrusted) {
+        return UINT32_MAX;
+    }
+
+    int64_t elapsedSeconds = (int64_t)time(NULL) - state.lastSyncTime;
+    int64_t driftPpm = state.driftValid ? MEASURED_DRIFT_UNCERTAINTY_PPM : UNKNOWN_DRIFT_PPM;
+    int64_t bound = BASE_ERROR_SECONDS + elapsedSeconds * driftPpm / 1000000;
+    return bound < UINT32_MAX ? (uint32_t)bound : UINT32_MAX;
+}
+
+void TimeKeeper_NotifyClockSet(bool synchronized)
+{
+    lastClockBaseMs = GetClockBaseMs();
+    if (synchronized) {
+        HandleSync(0, false);
+        return;
+    }
+
+    DistrustRtc();
+}
+
+void TimeKeeper_Stop(void)
+{
+    if (timerRegistration != NULL) {
+        EventLoop_UnregisterIo(keeperEventLoop, timerRegistration);
+        timerRegistration = NULL;
+    }
+    if (timerFd != -1) {
+        close(timerFd);
+        timerFd = -1;
+    }
+}
@@ -0,0 +1,111 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <applibs/eventloop.h>
+
+// The time keeper tracks how far the system time can be trusted, so that an application can
+// time-stamp telemetry and validate certificates as soon as it starts, rather than waiting for
+// the device to synchronize its clock with NTP after it connects.
+//
+// At boot, the OS sets the system time from the hardware real-time clock (RTC). Each time NTP
+// synchronizes the clock, the time keeper writes the synchronized time to the RTC, and stores the
+// time of the synchronization, together with an estimate of how fast or slow the RTC runs, in the
+// key-value store. When the application next starts, the time keeper corrects the system time for
+// the estimated drift of the RTC since then, and bounds its error by the time since the
+// synchronization. If the RTC lost its power, the system time is earlier than the stored
+// synchronization, so the time keeper sets the clock to that time, as the closest time which is
+// known, and marks it as untrusted until the next synchronization.
+//
+// The application libraries do not report when NTP synchronizes the clock, so the time keeper
+// polls the difference between the system time and the time since boot, which only changes when
+// the clock is set. A synchronization which moves the clock by less than
+// TIME_KEEPER_STEP_THRESHOLD_MS is not noticed, but then the clock was already accurate.
+//
+// The application needs the SystemTime capability, and the MutableStorage capability if the
+// state is stored. The time keeper is not thread-safe; it should only be used from the event
+// loop's thread.
+
+/// <summary>Change of the system time, in milliseconds, which is taken as a synchronization
+/// when the device's time-sync service is enabled.</summary>
+#define TIME_KEEPER_STEP_THRESHOLD_MS 50
+
+/// <summary>
+///     How far the system time can be trusted.
+/// </summary>
+typedef enum {
+    /// <summary>The time is not known to within the configured maximum error, for example
+    /// because the clock has never been synchronized, the RTC lost its power, or the application
+    /// set the clock.</summary>
+    TimeKeeper_Confidence_None = 0,
+    /// <summary>The time comes from the RTC, corrected for its drift, and is within the
+    /// configured maximum error.</summary>
+    TimeKeeper_Confidence_Rtc = 1,
+    /// <summary>The clock has been synchronized since the time keeper was started.</summary>
+    TimeKeeper_Confidence_Synced = 2
+} TimeKeeper_Confidence;
+
+/// <summary>
+///     Configuration of the time keeper.
+/// </summary>
+typedef struct {
+    /// <summary>Key under which the state is kept in the key-value store, which must be open,
+    /// or NULL not to store it. Without the stored state, the time is only trusted once it has
+    /// been synchronized.</summary>
+    const char *storageKey;
+    /// <summary>How often to check whether the clock has been synchronized, in seconds.</summary>
+    unsigned int pollPeriodSeconds;
+    /// <summary>Largest error of the time from the RTC, in seconds, for which it is
+    /// trusted.</summary>
+    unsigned int maxErrorSeconds;
+} TimeKeeper_Config;
+
+/// <summary>
+///     Called when the confidence in the system time changes.
+/// </summary>
+/// <param name="confidence">The new confidence.</param>
+/// <param name="context">The context which was passed to TimeKeeper_Start.</param>
+typedef void (*TimeKeeper_ConfidenceChangedHandler)(TimeKeeper_Confidence confidence,
+                                                     void *context);
+
+/// <summary>
+///     Reads the stored state, corrects the system time if the RTC has drifted or lost its
+///     power, and starts checking for synchronizations.
+/// </summary>
+/// <param name="eventLoop">The event loop which runs the checks.</param>
+/// <param name="config">The configuration, which is copied.</param>
+/// <param name="handler">Called when the confidence changes, or NULL.</param>
+/// <param name="context">Passed to the handler.</param>
+/// <returns>0 on success, or -1 on failure, in which case errno is set.</returns>
+int TimeKeeper_Start(EventLoop *eventLoop, const TimeKeeper_Config *config,
+                     TimeKeeper_ConfidenceChangedHandler handler, void *context);
+
+/// <summary>
+///     Gets how far the system time can be trusted.
+/// </summary>
+TimeKeeper_Confidence TimeKeeper_GetConfidence(void);
+
+/// <summary>
+///     Gets the largest error which the system time is expected to have, in seconds, or
+///     UINT32_MAX if it is not known.
+/// </summary>
+uint32_t TimeKeeper_GetErrorBoundSeconds(void);
+
+/// <summary>
+///     Tells the time keeper that the application has set the system time itself, so that the
+///     change is not taken as a synchronization.
+/// </summary>
+/// <param name="synchronized">Whether the new time is known to be accurate, for example because
+/// it came from a trusted server; if so, it is written to the RTC and stored as a
+/// synchronization. Otherwise, neither the time nor the RTC is trusted until the next
+/// synchronization.</param>
+void TimeKeeper_NotifyClockSet(bool synchronized);
+
+/// <summary>
+///     Stops checking for synchronizations.
+/// </summary>
+void TimeKeeper_Stop(void);
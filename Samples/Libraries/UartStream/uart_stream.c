@@ -0,0 +1,460 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/uio.h>
+
+#include <applibs/log.h>
+
+#include "uart_stream.h"
+
+// SLIP special characters, from RFC 1055.
+#define SLIP_END 0xC0
+#define SLIP_ESC 0xDB
+#define SLIP_ESC_END 0xDC
+#define SLIP_ESC_ESC 0xDD
+
+// The largest frame which can be described by a length prefix.
+#define MAX_PREFIXED_LENGTH 0xFFFF
+
+struct UartStream {
+    EventLoop *eventLoop;
+    int uartFd;
+    EventRegistration *registration;
+    UartStream_Config config;
+    UartStream_FrameHandler frameHandler;
+    UartStream_ErrorHandler errorHandler;
+    void *context;
+
+    // The transmit ring. Bytes are queued at txHead, and written from txHead - txCount.
+    uint8_t *txBuffer;
+    size_t txHead;
+    size_t txCount;
+    bool waitingForOutput;
+    int64_t stallStartMs;
+
+    // The frame which is being received.
+    uint8_t *rxFrame;
+    size_t rxLength;
+    // The frame is too long or malformed, and is being skipped until it ends.
+    bool rxDiscarding;
+    // The previous byte was SLIP_ESC.
+    bool rxEscaped;
+    // For length-prefixed frames, the number of prefix bytes which have been received, and the
+    // length of the frame once both have been.
+    size_t rxPrefixBytes;
+    size_t rxExpectedLength;
+
+    UartStream_Statistics statistics;
+    int64_t createdMs;
+};
+
+static int64_t NowMs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static void SetOutputEvents(UartStream *stream, bool wantOutput)
+{
+    if (stream->waitingForOutput == wantOutput) {
+        return;
+    }
+
+    EventLoop_IoEvents events = wantOutput ? (EventLoop_Input | EventLoop_Output) : EventLoop_Input;
+    if (EventLoop_ModifyIoEvents(stream->eventLoop, stream->registration, events) != 0) {
+        Log_Debug("ERROR: Unable to modify UART events: %s (%d).\n", strerror(errno), errno);
+        stream->errorHandler(errno, stream->context);
+        return;
+    }
+
+    int64_t now = NowMs();
+    if (wantOutput) {
+        stream->stallStartMs = now;
+    } else if (now - stream->stallStartMs > stream->statistics.maxTxStallMs) {
+        stream->statistics.maxTxStallMs = (uint32_t)(now - stream->stallStartMs);
+    }
+    stream->waitingForOutput = wantOutput;
+}
+
+// Writes as much of the transmit ring as the UART will accept, and waits for EventLoop_Output if
+// any remains.
+static void FlushTransmitBuffer(UartStream *stream)
+{
+    size_t size = stream->config.txBufferSize;
+    while (stream->txCount > 0) {
+        size_t tail = (stream->txHead + size - stream->txCount) % size;
+        size_t firstLength = size - tail;
+        if (firstLength > stream->txCount) {
+            firstLength = stream->txCount;
+        }
+
+        struct iovec segments[2] = {
+            {.iov_base = stream->txBuffer + tail, .iov_len = firstLength},
+            {.iov_base = stream->txBuffer, .iov_len = stream->txCount - firstLength}};
+        ssize_t written = writev(stream->uartFd, segments, segments[1].iov_len > 0 ? 2 : 1);
+        if (written == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                SetOutputEvents(stream, true);
+                return;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            Log_Debug("ERROR: Unable to write to UART: %s (%d).\n", strerror(errno), errno);
+            stream->errorHandler(errno, stream->context);
+            return;
+        }
+
+        stream->txCount -= (size_t)written;
+        stream->statistics.bytesSent += (uint64_t)written;
+    }
+
+    SetOutputEvents(stream, false);
+}
+
+static void QueueByte(UartStream *stream, uint8_t byte)
+{
+    stream->txBuffer[stream->txHead] = byte;
+    stream->txHead = (stream->txHead + 1) % stream->config.txBufferSize;
+    ++stream->txCount;
+}
+
+static void QueueBytes(UartStream *stream, const uint8_t *data, size_t length)
+{
+    while (length > 0) {
+        size_t chunk = stream->config.txBufferSize - stream->txHead;
+        if (chunk > length) {
+            chunk = length;
+        }
+        memcpy(stream->txBuffer + stream->txHead, data, chunk);
+        stream->txHead = (stream->txHead + chunk) % stream->config.txBufferSize;
+        stream->txCount += chunk;
+        data += chunk;
+        length -= chunk;
+    }
+}
+
+int UartStream_Send(UartStream *stream, const void *data, size_t length)
+{
+    const uint8_t *bytes = data;
+
+    size_t framedLength = length;
+    switch (stream->config.framing) {
+    case UartStream_Framing_None:
+        break;
+    case UartStream_Framing_Delimiter:
+        if (memchr(bytes, stream->config.delimiter, length) != NULL) {
+            errno = EINVAL;
+            return -1;
+        }
+        framedLength += 1;
+        break;
+    case UartStream_Framing_LengthPrefix:
+        if (length > MAX_PREFIXED_LENGTH) {
+            errno = EINVAL;
+            return -1;
+        }
+        framedLength += 2;
+        break;
+    case UartStream_Framing_Slip:
+        // A leading END flushes any noise which the receiver has accumulated.
+        framedLength += 2;
+        for (size_t i = 0; i < length; ++i) {
+            if (bytes[i] == SLIP_END || bytes[i] == SLIP_ESC) {
+                ++framedLength;
+            }
+        }
+        break;
+    }
+
+    if (framedLength > stream->config.txBufferSize - stream->txCount) {
+        ++stream->statistics.txOverruns;
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    switch (stream->config.framing) {
+    case UartStream_Framing_None:
+        QueueBytes(stream, bytes, length);
+        break;
+    case UartStream_Framing_Delimiter:
+        QueueBytes(stream, bytes, length);
+        QueueByte(stream, stream->config.delimiter);
+        break;
+    case UartStream_Framing_LengthPrefix:
+        QueueByte(stream, (uint8_t)(length >> 8));
+        QueueByte(stream, (uint8_t)length);
+        QueueBytes(stream, bytes, length);
+        break;
+    case UartStream_Framing_Slip:
+        QueueByte(stream, SLIP_END);
+        for (size_t i = 0; i < length; ++i) {
+            if (bytes[i] == SLIP_END) {
+                QueueByte(stream, SLIP_ESC);
+                QueueByte(stream, SLIP_ESC_END);
+            } else if (bytes[i] == SLIP_ESC) {
+                QueueByte(stream, SLIP_ESC);
+                QueueByte(stream, SLIP_ESC_ESC);
+            } else {
+                QueueByte(stream, bytes[i]);
+            }
+        }
+        QueueByte(stream, SLIP_END);
+        break;
+    }
+    ++stream->statistics.framesSent;
+
+    // If already waiting, the UART is full and the event loop will resume writing.
+    if (!stream->waitingForOutput) {
+        FlushTransmitBuffer(stream);
+    }
+    return 0;
+}
+
+static void DeliverFrame(UartStream *stream)
+{
+    ++stream->statistics.framesReceived;
+    stream->frameHandler(stream->rxFrame, stream->rxLength, stream->context);
+    stream->rxLength = 0;
+}
+
+// Appends a byte to the frame which is being received, or starts discarding the frame if it is
+// too long.
+static void AppendByte(UartStream *stream, uint8_t byte)
+{
+    if (stream->rxDiscarding) {
+        return;
+    }
+    if (stream->rxLength == stream->config.maxFrameSize) {
+        ++stream->statistics.rxOverruns;
+        stream->rxDiscarding = true;
+        stream->rxLength = 0;
+        return;
+    }
+    stream->rxFrame[stream->rxLength++] = byte;
+}
+
+static void DecodeDelimited(UartStream *stream, const uint8_t *data, size_t length)
+{
+    for (size_t i = 0; i < length; ++i) {
+        if (data[i] != stream->config.delimiter) {
+            AppendByte(stream, data[i]);
+        } else if (stream->rxDiscarding) {
+            stream->rxDiscarding = false;
+        } else if (stream->rxLength > 0) {
+            DeliverFrame(stream);
+        }
+    }
+}
+
+static void DecodeLengthPrefixed(UartStream *stream, const uint8_t *data, size_t length)
+{
+    for (size_t i = 0; i < length; ++i) {
+        if (stream->rxPrefixBytes < 2) {
+            stream->rxExpectedLength = (stream->rxExpectedLength << 8) | data[i];
+            if (++stream->rxPrefixBytes < 2) {
+                continue;
+            }
+            stream->rxLength = 0;
+            stream->rxDiscarding = stream->rxExpectedLength > stream->config.maxFrameSize;
+            if (stream->rxDiscarding) {
+                ++stream->statistics.rxOverruns;
+            }
+        } else {
+            // The length of a discarded frame is counted in rxLength, but its bytes are not
+            // stored.
+            if (!stream->rxDiscarding) {
+                stream->rxFrame[stream->rxLength] = data[i];
+            }
+            ++stream->rxLength;
+        }
+
+        if (stream->rxLength == stream->rxExpectedLength) {
+            if (stream->rxDiscarding) {
+                stream->rxLength = 0;
+            } else {
+                DeliverFrame(stream);
+            }
+            stream->rxPrefixBytes = 0;
+            stream->rxExpectedLength = 0;
+        }
+    }
+}
+
+static void DecodeSlip(UartStream *stream, const uint8_t *data, size_t length)
+{
+    for (size_t i = 0; i < length; ++i) {
+        uint8_t byte = data[i];
+        if (byte == SLIP_END) {
+            if (!stream->rxDiscarding && stream->rxLength > 0) {
+                DeliverFrame(stream);
+            }
+            stream->rxLength = 0;
+            stream->rxDiscarding = false;
+            stream->rxEscaped = false;
+        } else if (stream->rxEscaped) {
+            stream->rxEscaped = false;
+            if (byte == SLIP_ESC_END) {
+                AppendByte(stream, SLIP_END);
+            } else if (byte == SLIP_ESC_ESC) {
+                AppendByte(stream, SLIP_ESC);
+            } else if (!stream->rxDiscarding) {
+                ++stream->statistics.framingErrors;
+                stream->rxDiscarding = true;
+                stream->rxLength = 0;
+            }
+        } else if (byte == SLIP_ESC) {
+            stream->rxEscaped = true;
+        } else {
+            AppendByte(stream, byte);
+        }
+    }
+}
+
+static void DecodeReceivedData(UartStream *stream, const uint8_t *data, size_t length)
+{
+    switch (stream->config.framing) {
+    case UartStream_Framing_None:
+        ++stream->statistics.framesReceived;
+        stream->frameHandler(data, length, stream->context);
+        break;
+    case UartStream_Framing_Delimiter:
+        DecodeDelimited(stream, data, length);
+        break;
+    case UartStream_Framing_LengthPrefix:
+        DecodeLengthPrefixed(stream, data, length);
+        break;
+    case UartStream_Framing_Slip:
+        DecodeSlip(stream, data, length);
+        break;
+    }
+}
+
+// Reads until the UART has no more data, so that one event empties the UART's receive FIFO
+// however much has arrived since the last one.
+static void DrainReceivedData(UartStream *stream)
+{
+    uint8_t chunk[256];
+    for (;;) {
+        ssize_t bytesRead = read(stream->uartFd, chunk, sizeof(chunk));
+        if (bytesRead == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                Log_Debug("ERROR: Unable to read UART: %s (%d).\n", strerror(errno), errno);
+                stream->errorHandler(errno, stream->context);
+            }
+            return;
+        }
+        if (bytesRead == 0) {
+            return;
+        }
+
+        stream->statistics.bytesReceived += (uint64_t)bytesRead;
+        DecodeReceivedData(stream, chunk, (size_t)bytesRead);
+    }
+}
+
+static void UartEventCallback(EventLoop *el, int fd, EventLoop_IoEvents events, void *context)
+{
+    UartStream *stream = context;
+
+    if ((events & EventLoop_Output) != 0) {
+        FlushTransmitBuffer(stream);
+    }
+    if ((events & EventLoop_Input) != 0) {
+        DrainReceivedData(stream);
+    }
+}
+
+UartStream *UartStream_Create(EventLoop *eventLoop, int uartFd, const UartStream_Config *config,
+                              UartStream_FrameHandler frameHandler,
+                              UartStream_ErrorHandler errorHandler, void *context)
+{
+    static const UartStream_Config defaultConfig = UART_STREAM_DEFAULT_CONFIG;
+    if (config == NULL) {
+        config = &defaultConfig;
+    }
+
+    if (uartFd < 0 || frameHandler == NULL || errorHandler == NULL || config->txBufferSize == 0 ||
+        config->maxFrameSize == 0 || config->framing > UartStream_Framing_Slip) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    // The stream and its buffers are allocated together.
+    UartStream *stream = malloc(sizeof(UartStream) + config->txBufferSize + config->maxFrameSize);
+    if (stream == NULL) {
+        return NULL;
+    }
+    memset(stream, 0, sizeof(UartStream));
+
+    stream->eventLoop = eventLoop;
+    stream->uartFd = uartFd;
+    stream->config = *config;
+    stream->frameHandler = frameHandler;
+    stream->errorHandler = errorHandler;
+    stream->context = context;
+    stream->txBuffer = (uint8_t *)(stream + 1);
+    stream->rxFrame = stream->txBuffer + config->txBufferSize;
+    stream->createdMs = NowMs();
+
+    stream->registration =
+        EventLoop_RegisterIo(eventLoop, uartFd, EventLoop_Input, UartEventCallback, stream);
+    if (stream->registration == NULL) {
+        Log_Debug("ERROR: Unable to register UART event: %s (%d).\n", strerror(errno), errno);
+        free(stream);
+        return NULL;
+    }
+
+    return stream;
+}
+
+size_t UartStream_GetPendingBytes(const UartStream *stream)
+{
+    return stream->txCount;
+}
+
+void UartStream_GetStatistics(const UartStream *stream, UartStream_Statistics *statistics)
+{
+    *statistics = stream->statistics;
+}
+
+void UartStream_LogStatistics(const UartStream *stream)
+{
+    const UartStream_Statistics *s = &stream->statistics;
+    int64_t elapsedMs = NowMs() - stream->createdMs;
+    if (elapsedMs <= 0) {
+        elapsedMs = 1;
+    }
+
+    Log_Debug("INFO: UART sent %llu bytes (%llu B/s) in %u frames; received %llu bytes "
+              "(%llu B/s) in %u frames.\n",
+              (unsigned long long)s->bytesSent,
+              (unsigned long long)(s->bytesSent * 1000 / (uint64_t)elapsedMs), s->framesSent,
+              (unsigned long long)s->bytesReceived,
+              (unsigned long long)(s->bytesReceived * 1000 / (uint64_t)elapsedMs),
+              s->framesReceived);
+    Log_Debug("INFO: UART overruns: %u transmit, %u receive; %u framing errors; longest transmit "
+              "stall %u ms.\n",
+              s->txOverruns, s->rxOverruns, s->framingErrors, s->maxTxStallMs);
+}
+
+void UartStream_Dispose(UartStream *stream)
+{
+    if (stream == NULL) {
+        return;
+    }
+
+    EventLoop_UnregisterIo(stream->eventLoop, stream->registration);
+    free(stream);
+}
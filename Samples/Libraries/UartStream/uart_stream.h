@@ -0,0 +1,157 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <applibs/eventloop.h>
+
+/// <summary>
+///     Opaque UART stream, which buffers data which is sent and received over a UART and splits
+///     the received data into frames. It is allocated with <see cref="UartStream_Create" /> and
+///     freed with <see cref="UartStream_Dispose" />.
+/// </summary>
+typedef struct UartStream UartStream;
+
+/// <summary>
+///     How the bytes on the UART are divided into frames.
+/// </summary>
+typedef enum {
+    /// <summary>No framing. Data is sent as it is, and each handler call receives the bytes
+    /// which were read by one call to read().</summary>
+    UartStream_Framing_None = 0,
+    /// <summary>Each frame is followed by UartStream_Config.delimiter, which is not passed to
+    /// the frame handler. A frame which is sent must not contain the delimiter.</summary>
+    UartStream_Framing_Delimiter = 1,
+    /// <summary>Each frame is preceded by its length, as two bytes in big-endian order.</summary>
+    UartStream_Framing_LengthPrefix = 2,
+    /// <summary>SLIP, as described in RFC 1055. Frames may contain any byte.</summary>
+    UartStream_Framing_Slip = 3
+} UartStream_Framing;
+
+/// <summary>
+///     Configuration for a UART stream.
+/// </summary>
+typedef struct {
+    /// <summary>How the data is divided into frames.</summary>
+    UartStream_Framing framing;
+    /// <summary>The byte which ends each frame, for UartStream_Framing_Delimiter.</summary>
+    uint8_t delimiter;
+    /// <summary>Size of the transmit buffer in bytes. Sends which do not fit in the free space
+    /// are rejected.</summary>
+    size_t txBufferSize;
+    /// <summary>Largest frame which can be received, in bytes. Longer frames are
+    /// discarded.</summary>
+    size_t maxFrameSize;
+} UartStream_Config;
+
+/// <summary>
+///     Default configuration, which divides lines of up to 256 bytes on '\n'.
+/// </summary>
+#define UART_STREAM_DEFAULT_CONFIG                                          \
+    {                                                                       \
+        .framing = UartStream_Framing_Delimiter, .delimiter = '\n',         \
+        .txBufferSize = 1024, .maxFrameSize = 256                           \
+    }
+
+/// <summary>
+///     Counters which are maintained by a UART stream.
+/// </summary>
+typedef struct {
+    /// <summary>Bytes written to the UART, including framing.</summary>
+    uint64_t bytesSent;
+    /// <summary>Bytes read from the UART, including framing.</summary>
+    uint64_t bytesReceived;
+    /// <summary>Frames which were queued by <see cref="UartStream_Send" />.</summary>
+    uint32_t framesSent;
+    /// <summary>Frames which were passed to the frame handler.</summary>
+    uint32_t framesReceived;
+    /// <summary>Sends which were rejected because the transmit buffer was full.</summary>
+    uint32_t txOverruns;
+    /// <summary>Received frames which were discarded because they were longer than
+    /// UartStream_Config.maxFrameSize.</summary>
+    uint32_t rxOverruns;
+    /// <summary>Received frames which were discarded because they were malformed, such as a
+    /// SLIP escape which is followed by an unexpected byte.</summary>
+    uint32_t framingErrors;
+    /// <summary>The longest time for which data waited in the transmit buffer for the UART, in
+    /// milliseconds.</summary>
+    uint32_t maxTxStallMs;
+} UartStream_Statistics;
+
+/// <summary>
+///     Callback which is invoked with each frame which is received.
+/// </summary>
+/// <param name="frame">The frame, without its framing. It is only valid during the
+/// callback.</param>
+/// <param name="length">Length of the frame in bytes.</param>
+/// <param name="context">Context which was supplied to <see cref="UartStream_Create" />.</param>
+typedef void (*UartStream_FrameHandler)(const uint8_t *frame, size_t length, void *context);
+
+/// <summary>
+///     Callback which is invoked when the UART cannot be read or written.
+/// </summary>
+/// <param name="error">The errno value which was returned by read() or write().</param>
+/// <param name="context">Context which was supplied to <see cref="UartStream_Create" />.</param>
+typedef void (*UartStream_ErrorHandler)(int error, void *context);
+
+/// <summary>
+///     Create a UART stream which reads and writes a UART from the event loop.
+/// </summary>
+/// <param name="eventLoop">Event loop to which the stream will be added.</param>
+/// <param name="uartFd">UART which was opened with UART_Open. It is used, but not closed, by the
+/// stream.</param>
+/// <param name="config">Configuration, which is copied; or NULL to use
+/// UART_STREAM_DEFAULT_CONFIG.</param>
+/// <param name="frameHandler">Callback to invoke with each frame which is received.</param>
+/// <param name="errorHandler">Callback to invoke when the UART cannot be read or written.</param>
+/// <param name="context">Context which is passed to the handlers.</param>
+/// <returns>On success, pointer to new UartStream, which should be disposed of with
+/// <see cref="UartStream_Dispose" />. On failure, returns NULL, with more information available
+/// in errno.</returns>
+UartStream *UartStream_Create(EventLoop *eventLoop, int uartFd, const UartStream_Config *config,
+                              UartStream_FrameHandler frameHandler,
+                              UartStream_ErrorHandler errorHandler, void *context);
+
+/// <summary>
+///     Frame some data and queue it for the UART. As much as possible is written immediately, and
+///     the remainder is written from the event loop when the UART is ready. The call never
+///     blocks.
+/// </summary>
+/// <param name="stream">Successfully allocated UART stream.</param>
+/// <param name="data">Data to send. It is copied.</param>
+/// <param name="length">Length of the data in bytes.</param>
+/// <returns>0 on success, -1 on failure, in which case errno contains more information. ENOBUFS
+/// means that the framed data does not fit in the free space in the transmit buffer, in which
+/// case none of it is queued. EINVAL means that the data cannot be framed, because it contains
+/// the delimiter or is too long for a length prefix.</returns>
+int UartStream_Send(UartStream *stream, const void *data, size_t length);
+
+/// <summary>
+///     Get the number of bytes which are waiting to be written to the UART.
+/// </summary>
+/// <param name="stream">Successfully allocated UART stream.</param>
+size_t UartStream_GetPendingBytes(const UartStream *stream);
+
+/// <summary>
+///     Get the stream's counters.
+/// </summary>
+/// <param name="stream">Successfully allocated UART stream.</param>
+/// <param name="statistics">Receives the counters.</param>
+void UartStream_GetStatistics(const UartStream *stream, UartStream_Statistics *statistics);
+
+/// <summary>
+///     Log the stream's counters, and its throughput since it was created.
+/// </summary>
+/// <param name="stream">Successfully allocated UART stream.</param>
+void UartStream_LogStatistics(const UartStream *stream);
+
+/// <summary>
+///     Dispose of a stream which was allocated with <see cref="UartStream_Create" />. Any data
+///     which has not been written to the UART is discarded. It is safe to call this function with
+///     a NULL pointer.
+/// </summary>
+/// <param name="stream">Successfully allocated UART stream, or NULL.</param>
+void UartStream_Dispose(UartStream *stream);
@@ -0,0 +1,236 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/timerfd.h>
+
+#include <applibs/log.h>
+
+#include "update_policy.h"
+
+static EventLoop *policyEventLoop = NULL;
+static int timerFd = -1;
+static EventRegistration *timerRegistration = NULL;
+
+static UpdatePolicy_Config policyConfig;
+static UpdatePolicy_Source policySources[UPDATE_POLICY_MAX_SOURCES];
+static size_t policySourceCount = 0;
+static UpdatePolicy_DecisionHandler decisionHandler = NULL;
+static void *decisionContext = NULL;
+
+// Time at which a source was last found busy, or at which the policy was started.
+static int64_t lastBusyMs = 0;
+// The busy source which was found by the last sample, or NULL if every source was idle.
+static const UpdatePolicy_Source *busySource = NULL;
+
+// Whether an update has been deferred, and the time after which it must be let through.
+static bool updateDeferred = false;
+static int64_t installDeadlineMs = 0;
+
+static int64_t NowMs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static void TakeSample(int64_t nowMs)
+{
+    busySource = NULL;
+    for (size_t i = 0; i < policySourceCount; ++i) {
+        const UpdatePolicy_Source *source = &policySources[i];
+        if (source->getActivity(source->context) > source->idleLevel) {
+            busySource = source;
+            lastBusyMs = nowMs;
+            break;
+        }
+    }
+}
+
+static bool IsQuiet(int64_t nowMs)
+{
+    int64_t quietMs = (int64_t)policyConfig.quietPeriodSeconds * 1000;
+    return busySource == NULL && nowMs - lastBusyMs >= quietMs;
+}
+
+static void NotifyDecision(bool install, const char *reason)
+{
+    Log_Debug("INFO: Update %s: %s.\n", install ? "allowed" : "deferred", reason);
+    if (decisionHandler != NULL) {
+        decisionHandler(install, reason, decisionContext);
+    }
+}
+
+static int AllowUpdate(const char *reason)
+{
+    updateDeferred = false;
+    NotifyDecision(true, reason);
+    if (SysEvent_ResumeEvent(SysEvent_Events_UpdateReadyForInstall) == -1) {
+        Log_Debug("ERROR: SysEvent_ResumeEvent: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+    return 0;
+}
+
+// Lets a deferred update through if the sources have been quiet for long enough, or if it cannot
+// be deferred any longer.
+static void CheckDeferredUpdate(int64_t nowMs)
+{
+    if (!updateDeferred) {
+        return;
+    }
+
+    if (IsQuiet(nowMs)) {
+        AllowUpdate("activity is quiet");
+    } else if (nowMs >= installDeadlineMs) {
+        AllowUpdate("deferral limit reached");
+    }
+}
+
+// This satisfies the EventLoopIoCallback signature.
+static void SampleTimerCallback(EventLoop *el, int fd, EventLoop_IoEvents events, void *context)
+{
+    uint64_t expirations;
+    if (read(timerFd, &expirations, sizeof(expirations)) == -1) {
+        Log_Debug("ERROR: Could not read timerfd %s (%d).\n", strerror(errno), errno);
+        return;
+    }
+
+    int64_t nowMs = NowMs();
+    TakeSample(nowMs);
+    CheckDeferredUpdate(nowMs);
+}
+
+int UpdatePolicy_Start(EventLoop *eventLoop, const UpdatePolicy_Config *config,
+                       const UpdatePolicy_Source *sources, size_t sourceCount,
+                       UpdatePolicy_DecisionHandler handler, void *context)
+{
+    static const UpdatePolicy_Config defaultConfig = UPDATE_POLICY_DEFAULT_CONFIG;
+    if (config == NULL) {
+        config = &defaultConfig;
+    }
+
+    if (timerFd != -1 || config->samplePeriodSeconds == 0 || config->deferMinutes == 0 ||
+        sourceCount > UPDATE_POLICY_MAX_SOURCES || (sourceCount > 0 && sources == NULL)) {
+        errno = EINVAL;
+        return -1;
+    }
+    for (size_t i = 0; i < sourceCount; ++i) {
+        if (sources[i].name == NULL || sources[i].getActivity == NULL) {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+
+    timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (timerFd == -1) {
+        Log_Debug("ERROR: Unable to create timer: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+
+    struct timespec period = {.tv_sec = config->samplePeriodSeconds, .tv_nsec = 0};
+    struct itimerspec newValue = {.it_value = period, .it_interval = period};
+    if (timerfd_settime(timerFd, /* flags */ 0, &newValue, /* old_value */ NULL) == -1) {
+        Log_Debug("ERROR: Could not set timer period: %s (%d).\n", strerror(errno), errno);
+        goto failed;
+    }
+
+    timerRegistration =
+        EventLoop_RegisterIo(eventLoop, timerFd, EventLoop_Input, SampleTimerCallback, NULL);
+    if (timerRegistration == NULL) {
+        Log_Debug("ERROR: Unable to register timer event: %s (%d).\n", strerror(errno), errno);
+        goto failed;
+    }
+
+    policyEventLoop = eventLoop;
+    policyConfig = *config;
+    memcpy(policySources, sources, sourceCount * sizeof(UpdatePolicy_Source));
+    policySourceCount = sourceCount;
+    decisionHandler = handler;
+    decisionContext = context;
+    updateDeferred = false;
+
+    // Nothing is known about the activity before the policy started, so the quiet period is
+    // measured from now.
+    lastBusyMs = NowMs();
+    TakeSample(lastBusyMs);
+    return 0;
+
+failed:
+    UpdatePolicy_Stop();
+    return -1;
+}
+
+int UpdatePolicy_HandlePendingUpdate(const SysEvent_Info *info)
+{
+    SysEvent_Info_UpdateData data;
+    if (SysEvent_Info_GetUpdateData(info, &data) == -1) {
+        Log_Debug("ERROR: SysEvent_Info_GetUpdateData failed: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+
+    int64_t nowMs = NowMs();
+    TakeSample(nowMs);
+
+    if (timerFd == -1) {
+        return AllowUpdate("no update policy is running");
+    }
+    if (data.max_deferral_time_in_minutes <= policyConfig.marginMinutes) {
+        return AllowUpdate("deferral limit reached");
+    }
+    if (IsQuiet(nowMs)) {
+        return AllowUpdate("activity is quiet");
+    }
+
+    // Don't defer into the margin. When the deferral ends, the OS reports the update again.
+    unsigned int minutes = data.max_deferral_time_in_minutes - policyConfig.marginMinutes;
+    if (minutes > policyConfig.deferMinutes) {
+        minutes = policyConfig.deferMinutes;
+    }
+    Log_Debug("INFO: Max deferral time: %u minutes; deferring update for %u minutes.\n",
+              data.max_deferral_time_in_minutes, minutes);
+    if (SysEvent_DeferEvent(SysEvent_Events_UpdateReadyForInstall, minutes) == -1) {
+        Log_Debug("ERROR: SysEvent_DeferEvent: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+
+    updateDeferred = true;
+    installDeadlineMs =
+        nowMs + ((int64_t)data.max_deferral_time_in_minutes - policyConfig.marginMinutes) * 60000;
+    NotifyDecision(false, busySource != NULL ? busySource->name : "activity was recently busy");
+    return 0;
+}
+
+void UpdatePolicy_Evaluate(void)
+{
+    if (timerFd == -1) {
+        return;
+    }
+
+    int64_t nowMs = NowMs();
+    TakeSample(nowMs);
+    CheckDeferredUpdate(nowMs);
+}
+
+bool UpdatePolicy_IsUpdateDeferred(void)
+{
+    return updateDeferred;
+}
+
+void UpdatePolicy_Stop(void)
+{
+    if (timerRegistration != NULL) {
+        EventLoop_UnregisterIo(policyEventLoop, timerRegistration);
+        timerRegistration = NULL;
+    }
+    if (timerFd != -1) {
+        close(timerFd);
+        timerFd = -1;
+    }
+    updateDeferred = false;
+}
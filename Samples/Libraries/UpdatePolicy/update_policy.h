@@ -0,0 +1,123 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <applibs/eventloop.h>
+#include <applibs/sysevent.h>
+
+// The update policy decides when an application or OS update which is ready to install may
+// interrupt the application. The application describes its work as activity sources, such as the
+// depth of a telemetry queue, the number of open client connections, or whether an external MCU
+// is being updated. The policy samples the sources periodically, and defers a pending update
+// while any of them is busy. Once every source has been idle for the quiet period, it lets the
+// update install. An update is never deferred beyond the limit which the OS reports, less a
+// margin, so the application is not stopped without warning.
+//
+// The policy is not thread-safe; it should only be used from the event loop's thread.
+
+/// <summary>Largest number of activity sources.</summary>
+#define UPDATE_POLICY_MAX_SOURCES 8
+
+/// <summary>
+///     Gets a source's current activity, such as the number of messages which are queued.
+/// </summary>
+/// <param name="context">Context which was supplied in the UpdatePolicy_Source.</param>
+/// <returns>The source's activity; the source is idle while this is at most its idle
+/// level.</returns>
+typedef unsigned int (*UpdatePolicy_ActivityCallback)(void *context);
+
+/// <summary>Work which an update should not interrupt.</summary>
+typedef struct {
+    /// <summary>Name of the source, which is shown in the log.</summary>
+    const char *name;
+    /// <summary>Gets the source's current activity.</summary>
+    UpdatePolicy_ActivityCallback getActivity;
+    /// <summary>Highest activity at which the source counts as idle.</summary>
+    unsigned int idleLevel;
+    /// <summary>Context which is passed to getActivity.</summary>
+    void *context;
+} UpdatePolicy_Source;
+
+/// <summary>Timing of the policy.</summary>
+typedef struct {
+    /// <summary>Period at which the sources are sampled, in seconds. Must not be zero.</summary>
+    unsigned int samplePeriodSeconds;
+    /// <summary>Time for which every source must be idle before an update may install, in
+    /// seconds. If zero, an update may install as soon as a sample finds every source
+    /// idle.</summary>
+    unsigned int quietPeriodSeconds;
+    /// <summary>Time for which each deferral lasts, in minutes. The update is let through
+    /// earlier if a quiet period is measured first.</summary>
+    unsigned int deferMinutes;
+    /// <summary>The update is let through once the OS allows at most this many more minutes of
+    /// deferral, however busy the sources are.</summary>
+    unsigned int marginMinutes;
+} UpdatePolicy_Config;
+
+/// <summary>
+///     Default timing: sample every 5 seconds, require a minute of quiet, defer 10 minutes at a
+///     time, and stop deferring 2 minutes before the OS limit.
+/// </summary>
+#define UPDATE_POLICY_DEFAULT_CONFIG                                                  \
+    {                                                                                  \
+        .samplePeriodSeconds = 5, .quietPeriodSeconds = 60, .deferMinutes = 10,        \
+        .marginMinutes = 2                                                             \
+    }
+
+/// <summary>
+///     Invoked when the policy defers a pending update, or lets it install.
+/// </summary>
+/// <param name="install">true if the update has been let through; false if it has been
+/// deferred.</param>
+/// <param name="reason">Why: the name of a busy source, or a description of why the update was
+/// let through. Only valid until the handler returns.</param>
+/// <param name="context">Context which was supplied to UpdatePolicy_Start.</param>
+typedef void (*UpdatePolicy_DecisionHandler)(bool install, const char *reason, void *context);
+
+/// <summary>
+///     Starts sampling the activity sources. The first sample is taken immediately, but the
+///     quiet period is measured from this call.
+/// </summary>
+/// <param name="eventLoop">Event loop which runs the sampling timer.</param>
+/// <param name="config">Timing, which is copied; or NULL to use
+/// UPDATE_POLICY_DEFAULT_CONFIG.</param>
+/// <param name="sources">Activity sources, which are copied.</param>
+/// <param name="sourceCount">Number of sources, at most UPDATE_POLICY_MAX_SOURCES.</param>
+/// <param name="handler">Function which is told of each decision, or NULL.</param>
+/// <param name="context">Context which is passed to the handler.</param>
+/// <returns>0 on success, or -1 on failure, in which case errno is set.</returns>
+int UpdatePolicy_Start(EventLoop *eventLoop, const UpdatePolicy_Config *config,
+                       const UpdatePolicy_Source *sources, size_t sourceCount,
+                       UpdatePolicy_DecisionHandler handler, void *context);
+
+/// <summary>
+///     Decides what to do with an update which is ready to install. Call this from the
+///     application's SysEvent callback when SysEvent_Events_UpdateReadyForInstall is received
+///     with SysEvent_Status_Pending. The update is either let through with SysEvent_ResumeEvent,
+///     or deferred with SysEvent_DeferEvent and let through when a quiet period is measured.
+/// </summary>
+/// <param name="info">The information which was passed to the callback.</param>
+/// <returns>0 on success, or -1 on failure, in which case errno is set.</returns>
+int UpdatePolicy_HandlePendingUpdate(const SysEvent_Info *info);
+
+/// <summary>
+///     Samples the activity sources immediately, rather than at the next sample period. Call
+///     this when the application finishes some work, so that a pending update is let through
+///     without waiting for the timer.
+/// </summary>
+void UpdatePolicy_Evaluate(void);
+
+/// <summary>
+///     Whether an update is waiting for the sources to become idle.
+/// </summary>
+bool UpdatePolicy_IsUpdateDeferred(void);
+
+/// <summary>
+///     Stops sampling the activity sources. This should be called before the event loop is
+///     closed.
+/// </summary>
+void UpdatePolicy_Stop(void);
@@ -0,0 +1,184 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <applibs/log.h>
+#include <applibs/storage.h>
+
+#include "wake_trace.h"
+
+static const uint32_t storeMagic = ('W' << 24) | ('T' << 16) | ('R' << 8) | 'C';
+
+// The store is written in one operation, and its CRC covers all its other fields, so that a store
+// which was only partly written is ignored.
+typedef struct {
+    uint32_t magic;
+    uint32_t nextCycle;
+    uint32_t count;
+    WakeTrace_Record records[WAKE_TRACE_MAX_STORED];
+    uint32_t crc;
+} Store;
+
+_Static_assert(sizeof(Store) <= WAKE_TRACE_STORAGE_SIZE, "Store is larger than its storage");
+
+static const char *const phaseNames[WakeTrace_Phase_Count] = {
+    "BootMs",           "NetworkReadyMs",    "IoTConnectedMs",
+    "TelemetryAckedMs", "UpdateCheckDoneMs", "PowerdownRequestedMs"};
+
+static off_t storeOffset = 0;
+static Store store;
+static WakeTrace_Record current;
+static bool persisted = false;
+
+static uint32_t Crc32(const void *data, size_t length)
+{
+    const uint8_t *bytes = data;
+    uint32_t crc = 0xFFFFFFFFu;
+    while (length-- > 0) {
+        crc ^= *bytes++;
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc >> 1) ^ (0xEDB88320u & -(crc & 1u));
+        }
+    }
+    return ~crc;
+}
+
+static uint32_t StoreCrc(const Store *s)
+{
+    return Crc32(s, offsetof(Store, crc));
+}
+
+static uint32_t NowMs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t ms = (uint64_t)now.tv_sec * 1000 + (uint64_t)now.tv_nsec / 1000000;
+    return ms < WAKE_TRACE_NOT_REACHED ? (uint32_t)ms : WAKE_TRACE_NOT_REACHED - 1;
+}
+
+static void ReadStore(void)
+{
+    int fd = Storage_OpenMutableFile();
+    if (fd == -1) {
+        Log_Debug("ERROR: Could not open mutable storage: %s (%d).\n", strerror(errno), errno);
+        return;
+    }
+
+    bool valid = lseek(fd, storeOffset, SEEK_SET) != -1 &&
+                 read(fd, &store, sizeof(store)) == (ssize_t)sizeof(store) &&
+                 store.magic == storeMagic && store.crc == StoreCrc(&store) &&
+                 store.count <= WAKE_TRACE_MAX_STORED;
+    close(fd);
+
+    if (!valid) {
+        memset(&store, 0, sizeof(store));
+    }
+}
+
+static void WriteStore(void)
+{
+    store.magic = storeMagic;
+    store.crc = StoreCrc(&store);
+
+    int fd = Storage_OpenMutableFile();
+    if (fd == -1) {
+        Log_Debug("ERROR: Could not open mutable storage: %s (%d).\n", strerror(errno), errno);
+        return;
+    }
+
+    if (lseek(fd, storeOffset, SEEK_SET) == -1 ||
+        write(fd, &store, sizeof(store)) != (ssize_t)sizeof(store)) {
+        Log_Debug("ERROR: Could not write wake traces: %s (%d).\n", strerror(errno), errno);
+    }
+    close(fd);
+}
+
+void WakeTrace_Initialize(off_t storageOffset)
+{
+    storeOffset = storageOffset;
+    persisted = false;
+
+    for (size_t i = 0; i < WakeTrace_Phase_Count; ++i) {
+        current.phaseMs[i] = WAKE_TRACE_NOT_REACHED;
+    }
+    current.phaseMs[WakeTrace_Phase_Boot] = NowMs();
+
+    // Zero the whole store, so that the CRC does not depend on unused records.
+    memset(&store, 0, sizeof(store));
+    ReadStore();
+    current.cycle = store.nextCycle;
+}
+
+void WakeTrace_Mark(WakeTrace_Phase phase)
+{
+    if (phase < WakeTrace_Phase_Count && current.phaseMs[phase] == WAKE_TRACE_NOT_REACHED) {
+        current.phaseMs[phase] = NowMs();
+    }
+}
+
+const WakeTrace_Record *WakeTrace_GetCurrent(void)
+{
+    return &current;
+}
+
+size_t WakeTrace_GetStored(const WakeTrace_Record **records)
+{
+    *records = store.records;
+    return store.count;
+}
+
+void WakeTrace_ClearStored(void)
+{
+    if (store.count == 0) {
+        return;
+    }
+
+    memset(store.records, 0, sizeof(store.records));
+    store.count = 0;
+    WriteStore();
+}
+
+void WakeTrace_Persist(void)
+{
+    if (persisted) {
+        return;
+    }
+    persisted = true;
+
+    if (store.count == WAKE_TRACE_MAX_STORED) {
+        memmove(&store.records[0], &store.records[1],
+                (WAKE_TRACE_MAX_STORED - 1) * sizeof(store.records[0]));
+        --store.count;
+    }
+
+    store.records[store.count++] = current;
+    store.nextCycle = current.cycle + 1;
+    WriteStore();
+}
+
+const char *WakeTrace_GetPhaseName(WakeTrace_Phase phase)
+{
+    return phase < WakeTrace_Phase_Count ? phaseNames[phase] : "UnknownMs";
+}
+
+void WakeTrace_Log(const WakeTrace_Record *record)
+{
+    Log_Debug("INFO: Wake cycle %u:\n", record->cycle);
+
+    uint32_t previousMs = 0;
+    for (size_t i = 0; i < WakeTrace_Phase_Count; ++i) {
+        uint32_t ms = record->phaseMs[i];
+        if (ms == WAKE_TRACE_NOT_REACHED) {
+            Log_Debug("INFO:   %-20s not reached\n", phaseNames[i]);
+            continue;
+        }
+
+        Log_Debug("INFO:   %-20s %6u (+%u)\n", phaseNames[i], ms, ms - previousMs);
+        previousMs = ms;
+    }
+}
@@ -0,0 +1,111 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// The wake tracer records when an application which powers down between cycles of work reaches
+// each phase of a wake cycle. Each timestamp is the CLOCK_MONOTONIC time in milliseconds, which
+// starts when the device boots or wakes from power-down, so the boot phase records how long the OS
+// took to start the application. Before the application powers down, it persists the trace of the
+// cycle in its mutable storage, where the traces of recent cycles are kept until the application
+// has uploaded them, for example as telemetry on the next cycle.
+
+/// <summary>Number of traces which are kept in mutable storage.</summary>
+#define WAKE_TRACE_MAX_STORED 4
+
+/// <summary>Number of bytes of mutable storage which the tracer uses.</summary>
+#define WAKE_TRACE_STORAGE_SIZE 128
+
+/// <summary>Timestamp of a phase which was not reached during the cycle.</summary>
+#define WAKE_TRACE_NOT_REACHED UINT32_MAX
+
+/// <summary>Phases of a wake cycle.</summary>
+typedef enum {
+    /// <summary>The application started. Recorded by WakeTrace_Initialize.</summary>
+    WakeTrace_Phase_Boot,
+    /// <summary>The network interface was connected to the internet.</summary>
+    WakeTrace_Phase_NetworkReady,
+    /// <summary>The IoT hub authenticated the device.</summary>
+    WakeTrace_Phase_IoTConnected,
+    /// <summary>The cycle's telemetry was acknowledged.</summary>
+    WakeTrace_Phase_TelemetryAcked,
+    /// <summary>The check for updates completed.</summary>
+    WakeTrace_Phase_UpdateCheckDone,
+    /// <summary>The application requested power-down.</summary>
+    WakeTrace_Phase_PowerdownRequested,
+    /// <summary>Number of phases.</summary>
+    WakeTrace_Phase_Count
+} WakeTrace_Phase;
+
+/// <summary>The trace of one wake cycle.</summary>
+typedef struct {
+    /// <summary>Number of the cycle, which increases by one each time a trace is
+    /// persisted.</summary>
+    uint32_t cycle;
+    /// <summary>When each phase was first reached, in milliseconds since boot; or
+    /// WAKE_TRACE_NOT_REACHED.</summary>
+    uint32_t phaseMs[WakeTrace_Phase_Count];
+} WakeTrace_Record;
+
+/// <summary>
+///     Starts the trace of this cycle, records the boot phase, and reads the traces of earlier
+///     cycles from mutable storage.
+/// </summary>
+/// <param name="storageOffset">
+///     Offset within the mutable storage file of the WAKE_TRACE_STORAGE_SIZE bytes which the
+///     tracer uses.
+/// </param>
+void WakeTrace_Initialize(off_t storageOffset);
+
+/// <summary>
+///     Records that a phase has been reached. Only the first time it is reached is recorded.
+/// </summary>
+/// <param name="phase">The phase.</param>
+void WakeTrace_Mark(WakeTrace_Phase phase);
+
+/// <summary>
+///     Gets the trace of this cycle so far.
+/// </summary>
+/// <returns>The trace, which remains owned by the tracer.</returns>
+const WakeTrace_Record *WakeTrace_GetCurrent(void);
+
+/// <summary>
+///     Gets the traces of earlier cycles which were in mutable storage when the tracer was
+///     initialized, and have not been cleared.
+/// </summary>
+/// <param name="records">Receives the traces, oldest first, which remain owned by the
+/// tracer.</param>
+/// <returns>Number of traces.</returns>
+size_t WakeTrace_GetStored(const WakeTrace_Record **records);
+
+/// <summary>
+///     Removes the traces returned by WakeTrace_GetStored from mutable storage, once they have
+///     been uploaded.
+/// </summary>
+void WakeTrace_ClearStored(void);
+
+/// <summary>
+///     Appends the trace of this cycle to mutable storage, replacing the oldest trace if
+///     WAKE_TRACE_MAX_STORED are already stored. Should be called once, just before the
+///     application powers down or reboots.
+/// </summary>
+void WakeTrace_Persist(void);
+
+/// <summary>
+///     Gets a name for a phase which is suitable for a telemetry property, such as
+///     "NetworkReadyMs".
+/// </summary>
+/// <param name="phase">The phase.</param>
+/// <returns>The name.</returns>
+const char *WakeTrace_GetPhaseName(WakeTrace_Phase phase);
+
+/// <summary>
+///     Logs a trace, with the time at which each phase was reached and the time since the previous
+///     phase.
+/// </summary>
+/// <param name="record">The trace.</param>
+void WakeTrace_Log(const WakeTrace_Record *record);
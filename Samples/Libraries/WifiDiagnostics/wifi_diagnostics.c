@@ -0,0 +1,344 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#define WIFICONFIG_STRUCTS_VERSION 1
+#include <applibs/eventloop.h>
+#include <applibs/log.h>
+#include <applibs/wificonfig.h>
+
+#include "wifi_diagnostics.h"
+
+static EventLoop *diagnosticsEventLoop = NULL;
+static int timerFd = -1;
+static EventRegistration *timerRegistration = NULL;
+static WifiDiagnostics_ReportHandler reportHandler = NULL;
+static void *reportContext = NULL;
+static unsigned int reportPeriod = 0;
+static unsigned int samplePeriod = WIFI_DIAGNOSTICS_FAST_PERIOD_SECONDS;
+static struct timespec startTime;
+
+// The most recent samples, of which historyCount are valid; the oldest is at historyNext when the
+// ring is full.
+static WifiDiagnostics_Sample history[WIFI_DIAGNOSTICS_HISTORY_LENGTH];
+static size_t historyNext = 0;
+static size_t historyCount = 0;
+
+// Summary of the current period.
+static WifiDiagnostics_Report current;
+static uint32_t periodStartSeconds = 0;
+static int32_t rssiSum = 0;
+static bool havePreviousMean = false;
+static int8_t previousMeanRssi = 0;
+
+// The time of the last connection failure which has been seen for each network ID.
+static time_t failureTimes[WIFI_DIAGNOSTICS_MAX_NETWORKS];
+static bool haveFailureTimes = false;
+
+static uint32_t UptimeSeconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t)(now.tv_sec - startTime.tv_sec);
+}
+
+static void GetSample(WifiDiagnostics_Sample *sample)
+{
+    memset(sample, 0, sizeof(*sample));
+    sample->uptimeSeconds = UptimeSeconds();
+
+    WifiConfig_ConnectedNetwork network;
+    if (WifiConfig_GetCurrentNetwork(&network) == 0) {
+        sample->connected = true;
+        sample->signalRssi = network.signalRssi;
+        sample->frequencyMHz = (uint16_t)network.frequencyMHz;
+    } else if (errno != ENODATA) {
+        Log_Debug("ERROR: WifiConfig_GetCurrentNetwork failed: %s (%d).\n", strerror(errno),
+                  errno);
+    }
+}
+
+// Counts the connection failures which have been reported since the last sample. The failures
+// which had been reported before the collector started are not counted, but the last of them is
+// reported as the last failure.
+static unsigned int CountNewFailures(void)
+{
+    ssize_t networkCount = WifiConfig_GetStoredNetworkCount();
+    if (networkCount == -1) {
+        Log_Debug("ERROR: WifiConfig_GetStoredNetworkCount failed: %s (%d).\n", strerror(errno),
+                  errno);
+        return 0;
+    }
+    if (networkCount > WIFI_DIAGNOSTICS_MAX_NETWORKS) {
+        networkCount = WIFI_DIAGNOSTICS_MAX_NETWORKS;
+    }
+
+    unsigned int newFailures = 0;
+    for (int networkId = 0; networkId < networkCount; ++networkId) {
+        WifiConfig_NetworkDiagnostics diagnostics;
+        if (WifiConfig_GetNetworkDiagnostics(networkId, &diagnostics) == -1) {
+            // ENODEV: nothing has been reported for this network.
+            continue;
+        }
+        if (diagnostics.error == 0 || diagnostics.timestamp == failureTimes[networkId]) {
+            continue;
+        }
+
+        failureTimes[networkId] = diagnostics.timestamp;
+        if (haveFailureTimes) {
+            ++newFailures;
+        }
+        if ((int64_t)diagnostics.timestamp >= current.lastFailureTime) {
+            current.lastFailureError = diagnostics.error;
+            current.lastFailureTime = (int64_t)diagnostics.timestamp;
+        }
+    }
+
+    haveFailureTimes = true;
+    return newFailures;
+}
+
+static void EndPeriod(void)
+{
+    current.uptimeSeconds = current.latest.uptimeSeconds;
+    if (current.connectedSampleCount > 0) {
+        current.meanRssi = (int8_t)(rssiSum / (int32_t)current.connectedSampleCount);
+        current.rssiTrend = havePreviousMean ? (int8_t)(current.meanRssi - previousMeanRssi) : 0;
+        previousMeanRssi = current.meanRssi;
+        havePreviousMean = true;
+    }
+
+    if (reportHandler != NULL) {
+        reportHandler(&current, reportContext);
+    } else {
+        WifiDiagnostics_LogReport(&current);
+    }
+
+    // The last failure carries over from one period to the next.
+    int32_t lastFailureError = current.lastFailureError;
+    int64_t lastFailureTime = current.lastFailureTime;
+    WifiDiagnostics_Sample latest = current.latest;
+    memset(&current, 0, sizeof(current));
+    current.lastFailureError = lastFailureError;
+    current.lastFailureTime = lastFailureTime;
+    current.latest = latest;
+    periodStartSeconds = latest.uptimeSeconds;
+    rssiSum = 0;
+}
+
+// Chooses the interval until the next sample: the fast period while there is something to watch,
+// and otherwise twice the previous period, up to the slow period.
+static unsigned int NextSamplePeriod(const WifiDiagnostics_Sample *sample,
+                                     const WifiDiagnostics_Sample *previous,
+                                     unsigned int newFailures)
+{
+    bool unsettled = !sample->connected || sample->signalRssi < WIFI_DIAGNOSTICS_WEAK_RSSI ||
+                     newFailures > 0;
+    if (previous != NULL) {
+        unsettled = unsettled || previous->connected != sample->connected ||
+                    previous->frequencyMHz != sample->frequencyMHz ||
+                    abs(previous->signalRssi - sample->signalRssi) >= WIFI_DIAGNOSTICS_RSSI_CHANGE;
+    }
+
+    if (unsettled) {
+        return WIFI_DIAGNOSTICS_FAST_PERIOD_SECONDS;
+    }
+    return (samplePeriod * 2 < WIFI_DIAGNOSTICS_SLOW_PERIOD_SECONDS)
+               ? samplePeriod * 2
+               : WIFI_DIAGNOSTICS_SLOW_PERIOD_SECONDS;
+}
+
+static void ArmTimer(unsigned int seconds)
+{
+    struct itimerspec newValue = {.it_value = {.tv_sec = seconds, .tv_nsec = 0},
+                                  .it_interval = {0, 0}};
+    if (timerfd_settime(timerFd, /* flags */ 0, &newValue, /* old_value */ NULL) == -1) {
+        Log_Debug("ERROR: Could not set timer period: %s (%d).\n", strerror(errno), errno);
+    }
+}
+
+static void TakeSample(void)
+{
+    WifiDiagnostics_Sample sample;
+    GetSample(&sample);
+    unsigned int newFailures = CountNewFailures();
+
+    const WifiDiagnostics_Sample *previous = NULL;
+    if (historyCount > 0) {
+        previous = &history[(historyNext + WIFI_DIAGNOSTICS_HISTORY_LENGTH - 1) %
+                            WIFI_DIAGNOSTICS_HISTORY_LENGTH];
+    }
+
+    if (sample.connected) {
+        if (current.connectedSampleCount == 0) {
+            current.minRssi = sample.signalRssi;
+            current.maxRssi = sample.signalRssi;
+        } else {
+            if (sample.signalRssi < current.minRssi) {
+                current.minRssi = sample.signalRssi;
+            }
+            if (sample.signalRssi > current.maxRssi) {
+                current.maxRssi = sample.signalRssi;
+            }
+        }
+        ++current.connectedSampleCount;
+        rssiSum += sample.signalRssi;
+    }
+    if (previous != NULL) {
+        if (previous->connected && !sample.connected) {
+            ++current.disconnections;
+        }
+        if (previous->connected && sample.connected &&
+            previous->frequencyMHz != sample.frequencyMHz) {
+            ++current.frequencyChanges;
+        }
+    }
+    current.connectionFailures += newFailures;
+    ++current.sampleCount;
+    current.latest = sample;
+
+    samplePeriod = NextSamplePeriod(&sample, previous, newFailures);
+
+    history[historyNext] = sample;
+    historyNext = (historyNext + 1) % WIFI_DIAGNOSTICS_HISTORY_LENGTH;
+    if (historyCount < WIFI_DIAGNOSTICS_HISTORY_LENGTH) {
+        ++historyCount;
+    }
+
+    if (sample.uptimeSeconds - periodStartSeconds >= reportPeriod) {
+        EndPeriod();
+    }
+
+    ArmTimer(samplePeriod);
+}
+
+// This satisfies the EventLoopIoCallback signature.
+static void SampleTimerCallback(EventLoop *el, int fd, EventLoop_IoEvents events, void *context)
+{
+    uint64_t expirations;
+    if (read(timerFd, &expirations, sizeof(expirations)) == -1) {
+        Log_Debug("ERROR: Could not read timerfd %s (%d).\n", strerror(errno), errno);
+        return;
+    }
+
+    TakeSample();
+}
+
+int WifiDiagnostics_Start(EventLoop *eventLoop, unsigned int reportPeriodSeconds,
+                          WifiDiagnostics_ReportHandler handler, void *context)
+{
+    if (timerFd != -1 || reportPeriodSeconds == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (timerFd == -1) {
+        Log_Debug("ERROR: Unable to create timer: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+
+    timerRegistration =
+        EventLoop_RegisterIo(eventLoop, timerFd, EventLoop_Input, SampleTimerCallback, NULL);
+    if (timerRegistration == NULL) {
+        Log_Debug("ERROR: Unable to register timer event: %s (%d).\n", strerror(errno), errno);
+        WifiDiagnostics_Stop();
+        return -1;
+    }
+
+    diagnosticsEventLoop = eventLoop;
+    reportHandler = handler;
+    reportContext = context;
+    reportPeriod = reportPeriodSeconds;
+    samplePeriod = WIFI_DIAGNOSTICS_FAST_PERIOD_SECONDS;
+    historyNext = 0;
+    historyCount = 0;
+    memset(&current, 0, sizeof(current));
+    periodStartSeconds = 0;
+    rssiSum = 0;
+    havePreviousMean = false;
+    memset(failureTimes, 0, sizeof(failureTimes));
+    haveFailureTimes = false;
+    clock_gettime(CLOCK_MONOTONIC, &startTime);
+
+    TakeSample();
+    return 0;
+}
+
+void WifiDiagnostics_Stop(void)
+{
+    if (timerRegistration != NULL) {
+        EventLoop_UnregisterIo(diagnosticsEventLoop, timerRegistration);
+        timerRegistration = NULL;
+    }
+    if (timerFd != -1) {
+        close(timerFd);
+        timerFd = -1;
+    }
+}
+
+size_t WifiDiagnostics_GetHistory(WifiDiagnostics_Sample *samples, size_t maxSamples)
+{
+    size_t count = (historyCount < maxSamples) ? historyCount : maxSamples;
+    // Copy the most recent samples, starting with the oldest of them.
+    size_t first = (historyNext + WIFI_DIAGNOSTICS_HISTORY_LENGTH - count) %
+                   WIFI_DIAGNOSTICS_HISTORY_LENGTH;
+    for (size_t i = 0; i < count; ++i) {
+        samples[i] = history[(first + i) % WIFI_DIAGNOSTICS_HISTORY_LENGTH];
+    }
+    return count;
+}
+
+void WifiDiagnostics_LogReport(const WifiDiagnostics_Report *report)
+{
+    Log_Debug("INFO: Wi-Fi after %lu s: connected for %lu of %lu samples, %lu disconnections, "
+              "%lu frequency changes, %lu connection failures.\n",
+              (unsigned long)report->uptimeSeconds, (unsigned long)report->connectedSampleCount,
+              (unsigned long)report->sampleCount, (unsigned long)report->disconnections,
+              (unsigned long)report->frequencyChanges, (unsigned long)report->connectionFailures);
+    if (report->connectedSampleCount > 0) {
+        Log_Debug("INFO: Wi-Fi signal %d dB (%d to %d dB, %+d dB since the previous period), "
+                  "latest %d dB at %u MHz.\n",
+                  report->meanRssi, report->minRssi, report->maxRssi, report->rssiTrend,
+                  report->latest.signalRssi, report->latest.frequencyMHz);
+    }
+    if (report->lastFailureTime != 0) {
+        Log_Debug("INFO: The last Wi-Fi connection failure was error %ld. Check 'wificonfig.h' to "
+                  "identify the reason of the error.\n",
+                  (long)report->lastFailureError);
+    }
+}
+
+void WifiDiagnostics_WriteJson(const WifiDiagnostics_Report *report, JsonWriter *writer)
+{
+    JsonWriter_BeginObject(writer, "WiFi");
+    JsonWriter_AddInt(writer, "UptimeSeconds", report->uptimeSeconds);
+    JsonWriter_AddInt(writer, "Samples", report->sampleCount);
+    JsonWriter_AddInt(writer, "ConnectedSamples", report->connectedSampleCount);
+    if (report->connectedSampleCount > 0) {
+        JsonWriter_AddInt(writer, "MeanRssi", report->meanRssi);
+        JsonWriter_AddInt(writer, "MinRssi", report->minRssi);
+        JsonWriter_AddInt(writer, "MaxRssi", report->maxRssi);
+        JsonWriter_AddInt(writer, "RssiTrend", report->rssiTrend);
+    }
+    JsonWriter_AddBool(writer, "Connected", report->latest.connected);
+    if (report->latest.connected) {
+        JsonWriter_AddInt(writer, "FrequencyMHz", report->latest.frequencyMHz);
+    }
+    JsonWriter_AddInt(writer, "FrequencyChanges", report->frequencyChanges);
+    JsonWriter_AddInt(writer, "Disconnections", report->disconnections);
+    JsonWriter_AddInt(writer, "ConnectionFailures", report->connectionFailures);
+    if (report->lastFailureTime != 0) {
+        JsonWriter_AddInt(writer, "LastFailureError", report->lastFailureError);
+        JsonWriter_AddInt(writer, "LastFailureTime", report->lastFailureTime);
+    }
+    JsonWriter_EndObject(writer);
+}
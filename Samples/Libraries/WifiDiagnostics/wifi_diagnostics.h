@@ -0,0 +1,141 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <applibs/eventloop.h>
+
+#include "json_writer.h"
+
+// The Wi-Fi diagnostics collector samples the signal strength and frequency of the current Wi-Fi
+// connection, and the connection failures which WifiConfig_GetNetworkDiagnostics reports for each
+// stored network, in the background. It keeps the most recent samples in a compact ring, and
+// summarizes each report period, so that an application can report how the quality of its Wi-Fi
+// connection changes, for example as telemetry which can be compared with its other telemetry.
+//
+// The sample interval adapts to the connection: while the device is not connected, the signal is
+// weak or changing, or a connection has just failed, it samples every
+// WIFI_DIAGNOSTICS_FAST_PERIOD_SECONDS; while the connection is steady, the interval doubles after
+// each sample, up to WIFI_DIAGNOSTICS_SLOW_PERIOD_SECONDS.
+//
+// The application must have the WifiConfig capability. The collector is not thread-safe; it should
+// only be used from the event loop's thread.
+
+/// <summary>Shortest interval between samples, in seconds.</summary>
+#define WIFI_DIAGNOSTICS_FAST_PERIOD_SECONDS 5
+
+/// <summary>Longest interval between samples, in seconds.</summary>
+#define WIFI_DIAGNOSTICS_SLOW_PERIOD_SECONDS 60
+
+/// <summary>RSSI below which the signal is considered weak, and is sampled quickly.</summary>
+#define WIFI_DIAGNOSTICS_WEAK_RSSI -75
+
+/// <summary>Change in RSSI between samples which is considered a change in the signal.</summary>
+#define WIFI_DIAGNOSTICS_RSSI_CHANGE 6
+
+/// <summary>Number of samples which are kept in the ring.</summary>
+#define WIFI_DIAGNOSTICS_HISTORY_LENGTH 64
+
+/// <summary>Maximum number of stored networks whose connection failures are tracked.</summary>
+#define WIFI_DIAGNOSTICS_MAX_NETWORKS 10
+
+/// <summary>The state of the Wi-Fi connection at one time.</summary>
+typedef struct {
+    /// <summary>Seconds since the collector was started.</summary>
+    uint32_t uptimeSeconds;
+    /// <summary>The RSSI, or 0 if the device was not connected.</summary>
+    int8_t signalRssi;
+    /// <summary>Whether the device was connected to a Wi-Fi network.</summary>
+    bool connected;
+    /// <summary>The frequency of the connection in MHz, or 0 if the device was not
+    /// connected.</summary>
+    uint16_t frequencyMHz;
+} WifiDiagnostics_Sample;
+
+/// <summary>Summary of the samples which were taken during one report period.</summary>
+typedef struct {
+    /// <summary>Seconds since the collector was started.</summary>
+    uint32_t uptimeSeconds;
+    /// <summary>The last sample of the period.</summary>
+    WifiDiagnostics_Sample latest;
+    /// <summary>Number of samples in the period.</summary>
+    uint32_t sampleCount;
+    /// <summary>Number of samples in the period during which the device was connected.</summary>
+    uint32_t connectedSampleCount;
+    /// <summary>Lowest RSSI while connected in the period, or 0 if it was never
+    /// connected.</summary>
+    int8_t minRssi;
+    /// <summary>Highest RSSI while connected in the period, or 0 if it was never
+    /// connected.</summary>
+    int8_t maxRssi;
+    /// <summary>Mean RSSI while connected in the period, or 0 if it was never connected.</summary>
+    int8_t meanRssi;
+    /// <summary>Change in the mean RSSI since the previous period in which the device was
+    /// connected.</summary>
+    int8_t rssiTrend;
+    /// <summary>Number of times the frequency of the connection changed in the period, which
+    /// includes roaming between bands and reconnecting on another channel.</summary>
+    uint32_t frequencyChanges;
+    /// <summary>Number of times the device disconnected in the period.</summary>
+    uint32_t disconnections;
+    /// <summary>Number of connection failures which were reported in the period.</summary>
+    uint32_t connectionFailures;
+    /// <summary>The error code of the last connection failure which has been reported, as
+    /// defined in applibs/wificonfig.h, or 0 if none has.</summary>
+    int32_t lastFailureError;
+    /// <summary>Seconds since the epoch when the last reported connection failure happened, or
+    /// 0 if none has.</summary>
+    int64_t lastFailureTime;
+} WifiDiagnostics_Report;
+
+/// <summary>
+///     Invoked at the end of each report period.
+/// </summary>
+/// <param name="report">The summary of the period, which is only valid until the handler
+/// returns.</param>
+/// <param name="context">Context which was supplied to WifiDiagnostics_Start.</param>
+typedef void (*WifiDiagnostics_ReportHandler)(const WifiDiagnostics_Report *report,
+                                              void *context);
+
+/// <summary>
+///     Starts sampling the Wi-Fi connection. The first sample is taken immediately.
+/// </summary>
+/// <param name="eventLoop">Event loop which runs the sampling timer.</param>
+/// <param name="reportPeriodSeconds">Length of each report period. A period ends with the first
+/// sample which is taken after it has elapsed.</param>
+/// <param name="handler">Function which receives each report, or NULL to log it.</param>
+/// <param name="context">Context which is passed to the handler.</param>
+/// <returns>0 on success, or -1 on failure, in which case errno is set.</returns>
+int WifiDiagnostics_Start(EventLoop *eventLoop, unsigned int reportPeriodSeconds,
+                          WifiDiagnostics_ReportHandler handler, void *context);
+
+/// <summary>
+///     Stops sampling the Wi-Fi connection. This should be called before the event loop is
+///     closed.
+/// </summary>
+void WifiDiagnostics_Stop(void);
+
+/// <summary>
+///     Gets the most recent samples, oldest first.
+/// </summary>
+/// <param name="samples">Receives the samples.</param>
+/// <param name="maxSamples">The number of samples which fit in the buffer.</param>
+/// <returns>The number of samples which were copied.</returns>
+size_t WifiDiagnostics_GetHistory(WifiDiagnostics_Sample *samples, size_t maxSamples);
+
+/// <summary>
+///     Logs a report.
+/// </summary>
+/// <param name="report">The report to log.</param>
+void WifiDiagnostics_LogReport(const WifiDiagnostics_Report *report);
+
+/// <summary>
+///     Adds the properties of a report to the object which a JSON writer is writing.
+/// </summary>
+/// <param name="report">The report to write.</param>
+/// <param name="writer">Writer which is inside an object.</param>
+void WifiDiagnostics_WriteJson(const WifiDiagnostics_Report *report, JsonWriter *writer);
@@ -0,0 +1,158 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <applibs/log.h>
+
+#include "wifi_scan_results.h"
+
+// Open-addressing hash table of indices of distinct networks, keyed on SSID and security type. Its
+// size is a power of two, and at least twice the number of networks, so probe sequences stay
+// short.
+#define HASH_TABLE_SIZE 256
+#define HASH_EMPTY 0xFF
+static uint8_t hashTable[HASH_TABLE_SIZE];
+_Static_assert(HASH_TABLE_SIZE >= 2 * WIFI_SCAN_RESULTS_MAX_NETWORKS &&
+                   (HASH_TABLE_SIZE & (HASH_TABLE_SIZE - 1)) == 0,
+               "The hash table must be a power of two, and at most half full.");
+_Static_assert(WIFI_SCAN_RESULTS_MAX_NETWORKS <= HASH_EMPTY,
+               "Every network index must fit in the hash table.");
+
+bool WifiScanResults_IsSameNetwork(const WifiConfig_ScannedNetwork *network1,
+                                   const WifiConfig_ScannedNetwork *network2)
+{
+    return network1->security == network2->security &&
+           network1->ssidLength == network2->ssidLength &&
+           memcmp(network1->ssid, network2->ssid, network1->ssidLength) == 0;
+}
+
+// FNV-1a hash of the SSID and security type of a scanned network.
+static uint32_t HashNetwork(const WifiConfig_ScannedNetwork *network)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < network->ssidLength; ++i) {
+        hash = (hash ^ network->ssid[i]) * 16777619u;
+    }
+    return (hash ^ network->security) * 16777619u;
+}
+
+size_t WifiScanResults_Deduplicate(WifiConfig_ScannedNetwork *networks, size_t count)
+{
+    if (count > WIFI_SCAN_RESULTS_MAX_NETWORKS) {
+        count = WIFI_SCAN_RESULTS_MAX_NETWORKS;
+    }
+
+    memset(hashTable, HASH_EMPTY, sizeof(hashTable));
+    size_t distinctCount = 0;
+
+    for (size_t i = 0; i < count; ++i) {
+        // Probe from the network's hash until the same network, or an empty slot, is found.
+        size_t slot = HashNetwork(&networks[i]) & (HASH_TABLE_SIZE - 1);
+        while (hashTable[slot] != HASH_EMPTY &&
+               !WifiScanResults_IsSameNetwork(&networks[hashTable[slot]], &networks[i])) {
+            slot = (slot + 1) & (HASH_TABLE_SIZE - 1);
+        }
+
+        if (hashTable[slot] == HASH_EMPTY) {
+            hashTable[slot] = (uint8_t)distinctCount;
+            networks[distinctCount++] = networks[i];
+        } else if (networks[hashTable[slot]].signalRssi < networks[i].signalRssi) {
+            networks[hashTable[slot]] = networks[i];
+        }
+    }
+
+    return distinctCount;
+}
+
+ssize_t WifiScanResults_Scan(WifiConfig_ScannedNetwork *networks, size_t capacity,
+                             size_t *scannedCount)
+{
+    ssize_t result = WifiConfig_TriggerScanAndGetScannedNetworkCount();
+    if (result == -1) {
+        return -1;
+    }
+
+    size_t count = (size_t)result;
+    if (scannedCount != NULL) {
+        *scannedCount = count;
+    }
+
+    if (capacity > WIFI_SCAN_RESULTS_MAX_NETWORKS) {
+        capacity = WIFI_SCAN_RESULTS_MAX_NETWORKS;
+    }
+    if (count > capacity) {
+        Log_Debug("INFO: Reading only %zu of the %zu networks found by scan.\n", capacity, count);
+        count = capacity;
+    }
+    if (count == 0) {
+        return 0;
+    }
+
+    result = WifiConfig_GetScannedNetworks(networks, count);
+    if (result == -1) {
+        return -1;
+    }
+
+    return (ssize_t)WifiScanResults_Deduplicate(networks, (size_t)result);
+}
+
+static void Swap(WifiConfig_ScannedNetwork *network1, WifiConfig_ScannedNetwork *network2)
+{
+    WifiConfig_ScannedNetwork temp = *network1;
+    *network1 = *network2;
+    *network2 = temp;
+}
+
+// Restores the min-heap, ordered by signal strength, of the first count networks, after the
+// network at index has been replaced.
+static void SiftDown(WifiConfig_ScannedNetwork *heap, size_t count, size_t index)
+{
+    for (;;) {
+        size_t weakest = index;
+        size_t left = 2 * index + 1;
+        size_t right = left + 1;
+        if (left < count && heap[left].signalRssi < heap[weakest].signalRssi) {
+            weakest = left;
+        }
+        if (right < count && heap[right].signalRssi < heap[weakest].signalRssi) {
+            weakest = right;
+        }
+        if (weakest == index) {
+            return;
+        }
+        Swap(&heap[index], &heap[weakest]);
+        index = weakest;
+    }
+}
+
+size_t WifiScanResults_SelectStrongest(WifiConfig_ScannedNetwork *networks, size_t count,
+                                       size_t maxSelected)
+{
+    size_t selected = (count < maxSelected) ? count : maxSelected;
+    if (selected == 0) {
+        return 0;
+    }
+
+    // Keep the strongest networks seen so far in a min-heap at the start of the array, so that the
+    // weakest of them is at its root, and is replaced by any stronger network which follows.
+    for (size_t i = selected / 2; i-- > 0;) {
+        SiftDown(networks, selected, i);
+    }
+    for (size_t i = selected; i < count; ++i) {
+        if (networks[i].signalRssi > networks[0].signalRssi) {
+            Swap(&networks[0], &networks[i]);
+            SiftDown(networks, selected, 0);
+        }
+    }
+
+    // Sort the selected networks, strongest first, by repeatedly moving the weakest to the end.
+    for (size_t end = selected - 1; end > 0; --end) {
+        Swap(&networks[0], &networks[end]);
+        SiftDown(networks, end, 0);
+    }
+
+    return selected;
+}
@@ -0,0 +1,67 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#define WIFICONFIG_STRUCTS_VERSION 1
+#include <applibs/wificonfig.h>
+
+// Reads the results of a Wi-Fi scan into a buffer which the application supplies, usually a
+// static array, so that a scan does not allocate however many networks it finds. A scan reports
+// each BSSID separately, so the same network is often listed several times; the results are
+// deduplicated in a single pass over a hash table which is keyed on the SSID and security type,
+// keeping the BSSID with the strongest signal. The strongest networks can then be selected with a
+// partial heap, which is cheaper than sorting every network when only a few are shown.
+//
+// The library is not thread-safe; it should only be used from one thread.
+
+/// <summary>Maximum number of scanned networks which are read and deduplicated.</summary>
+#define WIFI_SCAN_RESULTS_MAX_NETWORKS 128
+
+/// <summary>
+///     Checks whether two scanned networks have the same SSID and security type.
+/// </summary>
+/// <returns>True if they are the same network, false otherwise.</returns>
+bool WifiScanResults_IsSameNetwork(const WifiConfig_ScannedNetwork *network1,
+                                   const WifiConfig_ScannedNetwork *network2);
+
+/// <summary>
+///     Triggers a Wi-Fi scan, which blocks until it completes, then reads its results and
+///     deduplicates them with WifiScanResults_Deduplicate.
+/// </summary>
+/// <param name="networks">Buffer which receives the networks.</param>
+/// <param name="capacity">Number of networks which fit in the buffer. At most
+/// WIFI_SCAN_RESULTS_MAX_NETWORKS networks are read.</param>
+/// <param name="scannedCount">If not NULL, receives the number of networks, including duplicates,
+/// which the scan found, which may be more than were read.</param>
+/// <returns>The number of distinct networks which were read, or -1 on failure, in which case errno
+/// is set.</returns>
+ssize_t WifiScanResults_Scan(WifiConfig_ScannedNetwork *networks, size_t capacity,
+                             size_t *scannedCount);
+
+/// <summary>
+///     Removes duplicate networks in place, keeping the BSSID with the strongest signal for each
+///     distinct SSID and security type. The networks keep the order in which each was first
+///     scanned.
+/// </summary>
+/// <param name="networks">The scanned networks.</param>
+/// <param name="count">Number of networks. Networks beyond WIFI_SCAN_RESULTS_MAX_NETWORKS are
+/// discarded.</param>
+/// <returns>The number of distinct networks, which are at the start of the array.</returns>
+size_t WifiScanResults_Deduplicate(WifiConfig_ScannedNetwork *networks, size_t count);
+
+/// <summary>
+///     Moves the networks with the strongest signals to the start of the array, strongest first.
+///     The order of the other networks is unspecified.
+/// </summary>
+/// <param name="networks">The networks, usually already deduplicated.</param>
+/// <param name="count">Number of networks.</param>
+/// <param name="maxSelected">Maximum number of networks to select.</param>
+/// <returns>The number of networks which were selected, which is the smaller of count and
+/// maxSelected.</returns>
+size_t WifiScanResults_SelectStrongest(WifiConfig_ScannedNetwork *networks, size_t count,
+                                       size_t maxSelected);
@@ -0,0 +1,294 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include <applibs/log.h>
+
+#include "worker_pool.h"
+
+_Static_assert((WORKER_POOL_QUEUE_SIZE & (WORKER_POOL_QUEUE_SIZE - 1)) == 0,
+               "WORKER_POOL_QUEUE_SIZE must be a power of two");
+
+// A cell of the submission queue, which is a bounded lock-free ring. The sequence of the cell at
+// position p equals p when the cell is free for the job at that position, and p + 1 when it holds
+// that job; taking the job sets it to p + WORKER_POOL_QUEUE_SIZE, for the next lap of the ring.
+typedef struct {
+    atomic_size_t sequence;
+    WorkerPool_Job *job;
+} QueueCell;
+
+static QueueCell queue[WORKER_POOL_QUEUE_SIZE];
+static atomic_size_t enqueuePosition;
+static atomic_size_t dequeuePosition;
+
+// Jobs whose work is done, most recent first.
+static _Atomic(WorkerPool_Job *) completedJobs = NULL;
+
+static atomic_bool stopping = false;
+
+static pthread_t threads[WORKER_POOL_MAX_THREADS];
+static unsigned int threadCount = 0;
+
+// Each job which is submitted writes a token to workFd, and each worker takes one token before it
+// takes a job. A token without a job tells a worker to stop.
+static int workFd = -1;
+static int completionFd = -1;
+static EventLoop *poolEventLoop = NULL;
+static EventRegistration *completionRegistration = NULL;
+
+static bool Enqueue(WorkerPool_Job *job)
+{
+    size_t position = atomic_load_explicit(&enqueuePosition, memory_order_relaxed);
+    for (;;) {
+        QueueCell *cell = &queue[position & (WORKER_POOL_QUEUE_SIZE - 1)];
+        size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+        if (difference == 0) {
+            if (atomic_compare_exchange_weak_explicit(&enqueuePosition, &position, position + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                cell->job = job;
+                atomic_store_explicit(&cell->sequence, position + 1, memory_order_release);
+                return true;
+            }
+        } else if (difference < 0) {
+            // The cell still holds the job from the previous lap, so the queue is full.
+            return false;
+        } else {
+            position = atomic_load_explicit(&enqueuePosition, memory_order_relaxed);
+        }
+    }
+}
+
+static WorkerPool_Job *Dequeue(void)
+{
+    size_t position = atomic_load_explicit(&dequeuePosition, memory_order_relaxed);
+    for (;;) {
+        QueueCell *cell = &queue[position & (WORKER_POOL_QUEUE_SIZE - 1)];
+        size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t difference = (intptr_t)sequence - (intptr_t)(position + 1);
+        if (difference == 0) {
+            if (atomic_compare_exchange_weak_explicit(&dequeuePosition, &position, position + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                WorkerPool_Job *job = cell->job;
+                atomic_store_explicit(&cell->sequence, position + WORKER_POOL_QUEUE_SIZE,
+                                      memory_order_release);
+                return job;
+            }
+        } else if (difference < 0) {
+            // The cell does not hold a job yet, so the queue is empty.
+            return NULL;
+        } else {
+            position = atomic_load_explicit(&dequeuePosition, memory_order_relaxed);
+        }
+    }
+}
+
+static void PushCompletedJob(WorkerPool_Job *job)
+{
+    job->next = atomic_load_explicit(&completedJobs, memory_order_relaxed);
+    while (!atomic_compare_exchange_weak_explicit(&completedJobs, &job->next, job,
+                                                  memory_order_release, memory_order_relaxed)) {
+        // job->next has been updated to the current head.
+    }
+}
+
+// Runs on a worker thread.
+static void *WorkerThread(void *unused)
+{
+    for (;;) {
+        uint64_t token;
+        if (read(workFd, &token, sizeof(token)) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            Log_Debug("ERROR: Worker could not read its eventfd: %s (%d).\n", strerror(errno),
+                      errno);
+            return NULL;
+        }
+
+        WorkerPool_Job *job = Dequeue();
+        if (job == NULL) {
+            if (atomic_load(&stopping)) {
+                return NULL;
+            }
+            continue;
+        }
+
+        job->work(job->context);
+        PushCompletedJob(job);
+
+        uint64_t increment = 1;
+        if (write(completionFd, &increment, sizeof(increment)) == -1) {
+            Log_Debug("ERROR: Worker could not signal a completion: %s (%d).\n", strerror(errno),
+                      errno);
+        }
+    }
+}
+
+// Runs the completion functions of the finished jobs, in the order in which they finished.
+static void RunCompletions(void)
+{
+    WorkerPool_Job *job = atomic_exchange_explicit(&completedJobs, NULL, memory_order_acquire);
+
+    WorkerPool_Job *oldestFirst = NULL;
+    while (job != NULL) {
+        WorkerPool_Job *next = job->next;
+        job->next = oldestFirst;
+        oldestFirst = job;
+        job = next;
+    }
+
+    while (oldestFirst != NULL) {
+        // The completion function may submit the job again, which reuses next.
+        WorkerPool_Job *next = oldestFirst->next;
+        oldestFirst->complete(oldestFirst->context);
+        oldestFirst = next;
+    }
+}
+
+// This satisfies the EventLoopIoCallback signature.
+static void CompletionEventHandler(EventLoop *el, int fd, EventLoop_IoEvents events, void *context)
+{
+    uint64_t count;
+    if (read(completionFd, &count, sizeof(count)) == -1 && errno != EAGAIN) {
+        Log_Debug("ERROR: Could not read the completion eventfd: %s (%d).\n", strerror(errno),
+                  errno);
+    }
+
+    RunCompletions();
+}
+
+// Stops the first count worker threads, after they have run the jobs which are waiting.
+static void StopThreads(unsigned int count)
+{
+    atomic_store(&stopping, true);
+
+    uint64_t tokens = count;
+    if (count > 0 && write(workFd, &tokens, sizeof(tokens)) == -1) {
+        Log_Debug("ERROR: Could not stop the workers: %s (%d).\n", strerror(errno), errno);
+        return;
+    }
+
+    for (unsigned int i = 0; i < count; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+// Closes the eventfds, preserving errno for the caller.
+static void CloseResources(void)
+{
+    int savedErrno = errno;
+
+    if (completionRegistration != NULL) {
+        EventLoop_UnregisterIo(poolEventLoop, completionRegistration);
+        completionRegistration = NULL;
+    }
+    poolEventLoop = NULL;
+
+    if (workFd != -1) {
+        close(workFd);
+        workFd = -1;
+    }
+    if (completionFd != -1) {
+        close(completionFd);
+        completionFd = -1;
+    }
+
+    errno = savedErrno;
+}
+
+int WorkerPool_Initialize(EventLoop *eventLoop, unsigned int count)
+{
+    if (threadCount != 0 || count == 0 || count > WORKER_POOL_MAX_THREADS) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    for (size_t i = 0; i < WORKER_POOL_QUEUE_SIZE; ++i) {
+        atomic_init(&queue[i].sequence, i);
+        queue[i].job = NULL;
+    }
+    atomic_init(&enqueuePosition, 0);
+    atomic_init(&dequeuePosition, 0);
+    atomic_store(&completedJobs, NULL);
+    atomic_store(&stopping, false);
+
+    workFd = eventfd(0, EFD_SEMAPHORE | EFD_CLOEXEC);
+    completionFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (workFd == -1 || completionFd == -1) {
+        Log_Debug("ERROR: Could not create the worker pool's eventfds: %s (%d).\n",
+                  strerror(errno), errno);
+        goto failed;
+    }
+
+    poolEventLoop = eventLoop;
+    completionRegistration = EventLoop_RegisterIo(eventLoop, completionFd, EventLoop_Input,
+                                                  CompletionEventHandler, NULL);
+    if (completionRegistration == NULL) {
+        Log_Debug("ERROR: Unable to register the worker pool's event: %s (%d).\n",
+                  strerror(errno), errno);
+        goto failed;
+    }
+
+    for (unsigned int i = 0; i < count; ++i) {
+        int result = pthread_create(&threads[i], NULL, WorkerThread, NULL);
+        if (result != 0) {
+            Log_Debug("ERROR: Could not create a worker thread: %s (%d).\n", strerror(result),
+                      result);
+            StopThreads(i);
+            errno = result;
+            goto failed;
+        }
+    }
+
+    threadCount = count;
+    return 0;
+
+failed:
+    CloseResources();
+    return -1;
+}
+
+void WorkerPool_Cleanup(void)
+{
+    if (threadCount == 0) {
+        return;
+    }
+
+    StopThreads(threadCount);
+    threadCount = 0;
+
+    // Every job has finished, so its owner can release its resources.
+    RunCompletions();
+    CloseResources();
+}
+
+int WorkerPool_Submit(WorkerPool_Job *job)
+{
+    if (threadCount == 0 || atomic_load(&stopping)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (!Enqueue(job)) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    uint64_t token = 1;
+    if (write(workFd, &token, sizeof(token)) == -1) {
+        // Only an overflowing counter can make this fail, after 2^64 - 2 jobs.
+        Log_Debug("ERROR: Could not wake a worker: %s (%d).\n", strerror(errno), errno);
+    }
+    return 0;
+}
@@ -0,0 +1,81 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <applibs/eventloop.h>
+
+// The worker pool runs long computations, such as a checksum over a firmware image, on worker
+// threads, so that they do not delay the event handlers on the event loop's thread. A job is
+// submitted from the event loop's thread; its work function runs on a worker thread, and then
+// its completion function runs on the event loop's thread.
+//
+// Jobs are held in a lock-free queue and woken workers take them with a semaphore eventfd. Each
+// finished job is pushed onto a lock-free list, and an eventfd which is registered with the event
+// loop runs the completion functions. The pool never allocates memory; each job is supplied by
+// the caller.
+//
+// The work function runs concurrently with the event loop, so it must only use data which the
+// event loop's thread does not touch until the completion function has run, and must not call
+// EventLoop functions or other libraries which are not thread-safe.
+
+/// <summary>Maximum number of worker threads.</summary>
+#define WORKER_POOL_MAX_THREADS 4
+
+/// <summary>Maximum number of jobs which can wait for a worker. A power of two.</summary>
+#define WORKER_POOL_QUEUE_SIZE 32
+
+/// <summary>
+///     Function which does the work of a job, on a worker thread.
+/// </summary>
+/// <param name="context">Context which was supplied with the job.</param>
+typedef void (*WorkerPool_WorkFunction)(void *context);
+
+/// <summary>
+///     Function which is called on the event loop's thread after a job's work function has
+///     returned. It may submit the job again.
+/// </summary>
+/// <param name="context">Context which was supplied with the job.</param>
+typedef void (*WorkerPool_CompletionFunction)(void *context);
+
+/// <summary>
+///     A job. The client sets work, complete and context; the job must remain valid until its
+///     completion function is called.
+/// </summary>
+typedef struct WorkerPool_Job {
+    WorkerPool_WorkFunction work;
+    WorkerPool_CompletionFunction complete;
+    void *context;
+    // Used by the pool while the job waits for its completion function; the client should not
+    // access it.
+    struct WorkerPool_Job *next;
+} WorkerPool_Job;
+
+/// <summary>
+///     Starts the worker threads.
+/// </summary>
+/// <param name="eventLoop">Event loop which runs the completion functions.</param>
+/// <param name="threadCount">
+///     Number of worker threads, from 1 to WORKER_POOL_MAX_THREADS. The MT3620 has one core for
+///     applications, so a single thread suffices to keep long jobs off the event loop's thread.
+/// </param>
+/// <returns>0 on success, or -1 on failure, in which case errno is set.</returns>
+int WorkerPool_Initialize(EventLoop *eventLoop, unsigned int threadCount);
+
+/// <summary>
+///     Waits for the worker threads to finish every job which has been submitted, runs the
+///     completion functions, and stops the threads. Should be called before the event loop is
+///     closed.
+/// </summary>
+void WorkerPool_Cleanup(void);
+
+/// <summary>
+///     Submits a job. Must be called from the event loop's thread.
+/// </summary>
+/// <param name="job">The job, which must not already be submitted.</param>
+/// <returns>
+///     0 on success, or -1 on failure, in which case errno is set to EAGAIN if
+///     WORKER_POOL_QUEUE_SIZE jobs are already waiting, or to EINVAL if the pool is not running.
+///     The caller can then run the job itself.
+/// </returns>
+int WorkerPool_Submit(WorkerPool_Job *job);
@@ -2,6 +2,8 @@
    Licensed under the MIT License. */
 
 // This sample C application for Azure Sphere illustrates how to use mutable storage.
+// It keeps a counter in the shared key-value store, which commits changes to the mutable storage
+// file in batches, and protects each commit with CRCs so that an interrupted write is ignored.
 //
 // It uses the API for the following Azure Sphere application libraries:
 // - log (messages shown in Visual Studio's Device Output window during debugging)
@@ -38,7 +40,9 @@
 // See https://aka.ms/AzureSphereHardwareDefinitions for more details.
 #include <hw/sample_appliance.h>
 
-#include "eventloop_timer_utilities.h"
+#include "button_input.h"
+#include "key_value_store.h"
+#include "worker_pool.h"
 
 /// <summary>
 /// Exit codes for this application. These are used for the
@@ -50,23 +54,28 @@ typedef enum {
 
     ExitCode_TermHandler_SigTerm = 1,
 
-    ExitCode_WriteFile_OpenMutableFile = 2,
-    ExitCode_WriteFile_Write = 3,
+    ExitCode_WriteValue_Set = 2,
+    ExitCode_DeleteValue_Commit = 3,
 
-    ExitCode_ReadFile_OpenMutableFile = 4,
-    ExitCode_ReadFile_Read = 5,
+    ExitCode_ReadValue_Get = 4,
+    ExitCode_Init_KeyValueStore = 5,
 
-    ExitCode_IsButtonPressed_GetValue = 6,
+    ExitCode_Buttons_GetValue = 6,
 
-    ExitCode_ButtonTimer_Consume = 7,
+    ExitCode_Buttons_Timer = 7,
 
     ExitCode_Init_EventLoop = 8,
     ExitCode_Init_OpenUpdateButton = 9,
     ExitCode_Init_OpenDeleteButton = 10,
     ExitCode_Init_OpenLed = 11,
-    ExitCode_Init_ButtonTimer = 12,
+    ExitCode_Init_Buttons = 12,
 
-    ExitCode_Main_EventLoopFail = 13
+    ExitCode_Main_EventLoopFail = 13,
+
+    ExitCode_Init_AddUpdateButton = 14,
+    ExitCode_Init_AddDeleteButton = 15,
+
+    ExitCode_Init_WorkerPool = 16
 } ExitCode;
 
 // File descriptors - initialized to invalid value
@@ -77,27 +86,32 @@ static int triggerDeleteButtonGpioFd = -1;
 // LEDs
 static int appRunningLedFd = -1;
 
-// Timer / polling
+// Event loop and button presses
 static EventLoop *eventLoop = NULL;
-static EventLoopTimer *buttonPollTimer = NULL;
-
-// Button state variables
-static GPIO_Value_Type triggerUpdateButtonState = GPIO_Value_High;
-static GPIO_Value_Type triggerDeleteButtonState = GPIO_Value_High;
+static ButtonInput *buttons = NULL;
 
 static void TerminationHandler(int signalNumber);
-static void WriteToMutableFile(int value);
-static int ReadMutableFile(void);
-static bool IsButtonPressed(int fd, GPIO_Value_Type *oldState);
-static void UpdateButtonHandler(void);
-static void DeleteButtonHandler(void);
-static void ButtonPollTimerEventHandler(EventLoopTimer *timer);
+static void WriteValue(int value);
+static int ReadValue(void);
+static void UpdateButtonHandler(int gpioFd, ButtonInput_Event event, unsigned int count,
+                                void *context);
+static void DeleteButtonHandler(int gpioFd, ButtonInput_Event event, unsigned int count,
+                                void *context);
+static void ButtonsErrorHandler(int gpioFd, void *context);
 static ExitCode InitPeripheralsAndHandlers(void);
 static void CloseFdAndPrintError(int fd, const char *fdName);
 static void ClosePeripheralsAndHandlers(void);
 
 static volatile sig_atomic_t exitCode = ExitCode_Success;
 
+// The key-value store uses the start of the mutable storage file. Changes are committed two
+// seconds after the first of them, so that several button presses in quick succession are written
+// together.
+static const off_t keyValueStoreOffset = 0;
+static const size_t keyValueStoreSize = 2048;
+static const unsigned int keyValueStoreCommitDelayMs = 2000;
+static const char counterKey[] = "counter";
+
 /// <summary>
 ///     Signal handler for termination requests. This handler must be async-signal-safe.
 /// </summary>
@@ -108,135 +122,94 @@ static void TerminationHandler(int signalNumber)
 }
 
 /// <summary>
-/// Write an integer to this application's persistent data file
+/// Write an integer to this application's key-value store
 /// </summary>
-static void WriteToMutableFile(int value)
+static void WriteValue(int value)
 {
-    int fd = Storage_OpenMutableFile();
-    if (fd == -1) {
-        Log_Debug("ERROR: Could not open mutable file:  %s (%d).\n", strerror(errno), errno);
-        exitCode = ExitCode_WriteFile_OpenMutableFile;
-        return;
+    if (KeyValueStore_Set(counterKey, &value, sizeof(value)) == -1) {
+        Log_Debug("ERROR: Could not set the value: %s (%d).\n", strerror(errno), errno);
+        exitCode = ExitCode_WriteValue_Set;
     }
-    ssize_t ret = write(fd, &value, sizeof(value));
-    if (ret == -1) {
-        // If the file has reached the maximum size specified in the application manifest,
-        // then -1 will be returned with errno EDQUOT (122)
-        Log_Debug("ERROR: An error occurred while writing to mutable file:  %s (%d).\n",
-                  strerror(errno), errno);
-        exitCode = ExitCode_WriteFile_Write;
-    } else if (ret < sizeof(value)) {
-        // For simplicity, this sample logs an error here. In the general case, this should be
-        // handled by retrying the write with the remaining data until all the data has been
-        // written.
-        Log_Debug("ERROR: Only wrote %d of %d bytes requested\n", ret, (int)sizeof(value));
-    }
-    close(fd);
 }
 
 /// <summary>
-/// Read an integer from this application's persistent data file
+/// Read an integer from this application's key-value store
 /// </summary>
 /// <returns>
-/// The integer that was read from the file.  If the file is empty, this returns 0.  If the storage
-/// API fails, this returns -1.
+/// The integer that was read from the store.  If the store has no value, this returns 0.  If the
+/// value cannot be read, this returns -1.
 /// </returns>
-static int ReadMutableFile(void)
+static int ReadValue(void)
 {
-    int fd = Storage_OpenMutableFile();
-    if (fd == -1) {
-        Log_Debug("ERROR: Could not open mutable file:  %s (%d).\n", strerror(errno), errno);
-        exitCode = ExitCode_ReadFile_OpenMutableFile;
-        return -1;
-    }
     int value = 0;
-    ssize_t ret = read(fd, &value, sizeof(value));
-    if (ret == -1) {
-        Log_Debug("ERROR: An error occurred while reading file:  %s (%d).\n", strerror(errno),
-                  errno);
-        exitCode = ExitCode_ReadFile_Read;
-    }
-    close(fd);
-
-    if (ret < sizeof(value)) {
-        return 0;
+    if (KeyValueStore_Get(counterKey, &value, sizeof(value)) == -1) {
+        if (errno == ENOENT) {
+            return 0;
+        }
+        Log_Debug("ERROR: Could not get the value: %s (%d).\n", strerror(errno), errno);
+        exitCode = ExitCode_ReadValue_Get;
+        return -1;
     }
 
     return value;
 }
 
 /// <summary>
-///     Check whether a given button has just been pressed.
+/// Pressing SAMPLE_BUTTON_1 will:
+///		- Read from this application's key-value store
+///		- If there is a value in the store, read it and increment
+///		- Write the integer to the store, which commits it to the mutable file shortly afterwards
 /// </summary>
-/// <param name="fd">The button file descriptor</param>
-/// <param name="oldState">Old state of the button (pressed or released)</param>
-/// <returns>true if pressed, false otherwise</returns>
-static bool IsButtonPressed(int fd, GPIO_Value_Type *oldState)
+static void UpdateButtonHandler(int gpioFd, ButtonInput_Event event, unsigned int count,
+                                void *context)
 {
-    bool isButtonPressed = false;
-    GPIO_Value_Type newState;
-    int result = GPIO_GetValue(fd, &newState);
-    if (result != 0) {
-        Log_Debug("ERROR: Could not read button GPIO: %s (%d).\n", strerror(errno), errno);
-        exitCode = ExitCode_IsButtonPressed_GetValue;
+    if (event != ButtonInput_Event_Pressed) {
+        return;
+    }
+
+    int readFromStore = ReadValue();
+    int writeToStore = readFromStore + 1;
+
+    if (readFromStore <= 0) {
+        Log_Debug("Writing %d to the key-value store\n", writeToStore);
     } else {
-        // Button is pressed if it is low and different than last known state.
-        isButtonPressed = (newState != *oldState) && (newState == GPIO_Value_Low);
-        *oldState = newState;
+        Log_Debug("Read %d from the key-value store, updating to %d\n", readFromStore,
+                  writeToStore);
     }
 
-    return isButtonPressed;
+    WriteValue(writeToStore);
 }
 
 /// <summary>
-/// Pressing SAMPLE_BUTTON_1 will:
-///		- Read from this application's file
-///		- If there is data in this file, read it and increment
-///		- Write the integer to file
+/// Pressing SAMPLE_BUTTON_2 will delete the value, and commit the deletion at once
 /// </summary>
-static void UpdateButtonHandler(void)
+static void DeleteButtonHandler(int gpioFd, ButtonInput_Event event, unsigned int count,
+                                void *context)
 {
-    if (IsButtonPressed(triggerUpdateButtonGpioFd, &triggerUpdateButtonState)) {
-        int readFromFile = ReadMutableFile();
-        int writeToFile = readFromFile + 1;
-
-        if (readFromFile <= 0) {
-            Log_Debug("Writing %d to the mutable file\n", writeToFile);
-        } else {
-            Log_Debug("Read %d from the mutable file, updating to %d\n", readFromFile, writeToFile);
-        }
+    if (event != ButtonInput_Event_Pressed) {
+        return;
+    }
 
-        WriteToMutableFile(writeToFile);
+    if (KeyValueStore_Delete(counterKey) == -1) {
+        Log_Debug("There is no value to delete.\n");
+        return;
     }
-}
 
-/// <summary>
-/// Pressing SAMPLE_BUTTON_2 will delete the user file
-/// </summary>
-static void DeleteButtonHandler(void)
-{
-    if (IsButtonPressed(triggerDeleteButtonGpioFd, &triggerDeleteButtonState)) {
-        int ret = Storage_DeleteMutableFile();
-        if (ret == -1) {
-            Log_Debug("An error occurred while deleting the mutable file: %s (%d).\n",
-                      strerror(errno), errno);
-        } else {
-            Log_Debug("Successfully deleted the mutable file!\n");
-        }
+    if (KeyValueStore_Commit() == -1) {
+        Log_Debug("An error occurred while deleting the value: %s (%d).\n", strerror(errno),
+                  errno);
+        exitCode = ExitCode_DeleteValue_Commit;
+    } else {
+        Log_Debug("Successfully deleted the value!\n");
     }
 }
 
 /// <summary>
-/// Button timer event:  Check the status of the buttons.
+/// The buttons could not be sampled.
 /// </summary>
-static void ButtonPollTimerEventHandler(EventLoopTimer *timer)
+static void ButtonsErrorHandler(int gpioFd, void *context)
 {
-    if (ConsumeEventLoopTimerEvent(timer) != 0) {
-        exitCode = ExitCode_ButtonTimer_Consume;
-        return;
-    }
-    UpdateButtonHandler();
-    DeleteButtonHandler();
+    exitCode = (gpioFd == -1) ? ExitCode_Buttons_Timer : ExitCode_Buttons_GetValue;
 }
 
 /// <summary>
@@ -259,6 +232,18 @@ static ExitCode InitPeripheralsAndHandlers(void)
         return ExitCode_Init_EventLoop;
     }
 
+    // The store writes its delayed commits on the worker pool's thread.
+    if (WorkerPool_Initialize(eventLoop, 1) != 0) {
+        Log_Debug("ERROR: Could not start the worker pool: %s (%d).\n", strerror(errno), errno);
+        return ExitCode_Init_WorkerPool;
+    }
+
+    if (KeyValueStore_Open(eventLoop, keyValueStoreOffset, keyValueStoreSize,
+                           keyValueStoreCommitDelayMs) == -1) {
+        Log_Debug("ERROR: Could not open the key-value store: %s (%d).\n", strerror(errno), errno);
+        return ExitCode_Init_KeyValueStore;
+    }
+
     // Open SAMPLE_BUTTON_1 GPIO as input
     Log_Debug("Opening SAMPLE_BUTTON_1 as input\n");
     triggerUpdateButtonGpioFd = GPIO_OpenAsInput(SAMPLE_BUTTON_1);
@@ -285,13 +270,22 @@ static ExitCode InitPeripheralsAndHandlers(void)
         return ExitCode_Init_OpenLed;
     }
 
-    // Set up a timer to poll for button events.
-    static const struct timespec buttonPressCheckPeriod100Ms = {.tv_sec = 0,
-                                                                .tv_nsec = 100 * 1000 * 1000};
-    buttonPollTimer = CreateEventLoopPeriodicTimer(eventLoop, &ButtonPollTimerEventHandler,
-                                                   &buttonPressCheckPeriod100Ms);
-    if (buttonPollTimer == NULL) {
-        return ExitCode_Init_ButtonTimer;
+    // Be notified when either button is pressed. Both buttons are debounced and sampled on one
+    // timer, which runs every 100ms while they are idle, as the buttons were sampled before.
+    static const ButtonInput_Config buttonConfig = {.debounceMs = 20,
+                                                    .longPressMs = 0,
+                                                    .multiPressMs = 0,
+                                                    .activePeriodMs = 10,
+                                                    .idlePeriodMs = 100};
+    buttons = ButtonInput_Create(eventLoop, &buttonConfig, &ButtonsErrorHandler, NULL);
+    if (buttons == NULL) {
+        return ExitCode_Init_Buttons;
+    }
+    if (ButtonInput_Add(buttons, triggerUpdateButtonGpioFd, &UpdateButtonHandler, NULL) != 0) {
+        return ExitCode_Init_AddUpdateButton;
+    }
+    if (ButtonInput_Add(buttons, triggerDeleteButtonGpioFd, &DeleteButtonHandler, NULL) != 0) {
+        return ExitCode_Init_AddDeleteButton;
     }
 
     return ExitCode_Success;
@@ -317,7 +311,10 @@ static void CloseFdAndPrintError(int fd, const char *fdName)
 /// </summary>
 static void ClosePeripheralsAndHandlers(void)
 {
-    DisposeEventLoopTimer(buttonPollTimer);
+    ButtonInput_Dispose(buttons);
+    // Commits any changes which are waiting for the commit delay.
+    KeyValueStore_Close();
+    WorkerPool_Cleanup();
     EventLoop_Close(eventLoop);
 
     Log_Debug("Closing file descriptors\n");
@@ -338,7 +335,8 @@ static void ClosePeripheralsAndHandlers(void)
 int main(int argc, char *argv[])
 {
     Log_Debug("Mutable storage application starting\n");
-    Log_Debug("Press SAMPLE_BUTTON_1 to write to file, and SAMPLE_BUTTON_2 to delete the file\n");
+    Log_Debug(
+        "Press SAMPLE_BUTTON_1 to write to the store, and SAMPLE_BUTTON_2 to delete the value\n");
 
     exitCode = InitPeripheralsAndHandlers();
 
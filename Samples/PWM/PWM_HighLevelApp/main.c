@@ -4,7 +4,7 @@
 // This sample C application for Azure Sphere demonstrates how to use Pulse Width
 // Modulation (PWM).
 // The sample opens a PWM controller. Adjusting the duty cycle will change the
-// brightness of an LED.
+// brightness of an LED, which is faded in and out by playing a table of duty cycles.
 //
 // It uses the API for the following Azure Sphere application libraries:
 // - pwm (Pulse Width Modulation)
@@ -16,6 +16,7 @@
 #include <string.h>
 #include <time.h>
 #include <signal.h>
+#include <unistd.h>
 
 #include <applibs/log.h>
 #include <applibs/pwm.h>
@@ -36,7 +37,7 @@
 #include <hw/sample_appliance.h>
 
 // This sample uses a single-thread event loop pattern.
-#include "eventloop_timer_utilities.h"
+#include "pwm_sequencer.h"
 
 /// <summary>
 /// Exit codes for this application. These are used for the
@@ -47,10 +48,10 @@ typedef enum {
     ExitCode_Success = 0,
     ExitCode_TermHandler_SigTerm = 1,
     ExitCode_TurnOffChannel_Apply = 2,
-    ExitCode_StepTimerHandler_Consume = 3,
-    ExitCode_StepTimerHandler_Apply = 4,
+    ExitCode_Sequencer_Failed = 3,
+    ExitCode_Init_PlaySequence = 4,
     ExitCode_Init_EventLoop = 5,
-    ExitCode_Init_StepTimer = 6,
+    ExitCode_Init_Sequencer = 6,
     ExitCode_Init_PwmOpen = 7,
     ExitCode_Main_EventLoopFail = 8
 } ExitCode;
@@ -59,16 +60,20 @@ typedef enum {
 static int pwmFd = -1;
 
 static EventLoop *eventLoop = NULL;
-static EventLoopTimer *stepTimer = NULL;
+static PwmSequencer *sequencer = NULL;
 
-// Each time the step timer fires (every stepInterval100Ms), we increase the current duty cycle
-// (dutyCycleNs) by the step increment (stepIncrement), until the full duty cycle
-// (fullCycleNs) is reached, at which point the current duty cycle is reset to 0.
+// The LED breathes: it fades in over FADE_STEPS steps of FADE_STEP_MS each, holds at full
+// brightness for HOLD_ON_MS, fades out, and stays off for HOLD_OFF_MS. The duty cycle follows a
+// quadratic curve, because perceived brightness is roughly the square root of the duty cycle.
+// The whole table is handed to the sequencer once, which wakes only when the duty cycle changes.
 // Supported PWM periods and duty cycles will vary depending on the hardware used;
 // consult your specific device’s datasheet for details.
 static const unsigned int fullCycleNs = 20 * 1000;
-static const unsigned int stepIncrementNs = 1000;
-static unsigned int dutyCycleNs = 0;
+#define FADE_STEPS 10
+#define FADE_STEP_MS 50
+#define HOLD_ON_MS 500
+#define HOLD_OFF_MS 1000
+static PwmStep breathingSteps[2 * FADE_STEPS];
 
 // The polarity is inverted because LEDs are driven low
 static PwmState ledPwmState = {.period_nsec = fullCycleNs,
@@ -76,15 +81,13 @@ static PwmState ledPwmState = {.period_nsec = fullCycleNs,
                                .dutyCycle_nsec = 0,
                                .enabled = true};
 
-// Timer state variables
-static const struct timespec stepInterval100Ms = {.tv_sec = 0, .tv_nsec = 100 * 1000 * 1000};
-
 // Termination state
 static volatile sig_atomic_t exitCode = ExitCode_Success;
 
 static void TerminationHandler(int signalNumber);
 static ExitCode TurnAllChannelsOff(void);
-static void StepTimerEventHandler(EventLoopTimer *timer);
+static void BuildBreathingSteps(void);
+static void SequencerErrorHandler(void *context);
 static ExitCode InitPeripheralsAndHandlers(void);
 static void ClosePeripheralsAndHandlers(void);
 
@@ -120,31 +123,29 @@ static ExitCode TurnAllChannelsOff(void)
 }
 
 /// <summary>
-///     Handle LED timer event: change LED brightness.
+///     Fill in the table of steps which fade the LED in and out.
 /// </summary>
-static void StepTimerEventHandler(EventLoopTimer *timer)
+static void BuildBreathingSteps(void)
 {
-    if (ConsumeEventLoopTimerEvent(timer) != 0) {
-        exitCode = ExitCode_StepTimerHandler_Consume;
-        return;
+    size_t n = 0;
+    for (unsigned int i = 1; i <= FADE_STEPS; ++i) {
+        breathingSteps[n++] = (PwmStep){
+            .dutyCycleNs = fullCycleNs * i * i / (FADE_STEPS * FADE_STEPS),
+            .durationMs = (i == FADE_STEPS) ? HOLD_ON_MS : FADE_STEP_MS};
     }
-
-    // The step interval has elapsed, so increment the duty cycle.
-    if (dutyCycleNs < fullCycleNs) {
-        dutyCycleNs += stepIncrementNs;
-    } else {
-        dutyCycleNs = 0;
+    for (unsigned int i = FADE_STEPS; i-- > 0;) {
+        breathingSteps[n++] =
+            (PwmStep){.dutyCycleNs = fullCycleNs * i * i / (FADE_STEPS * FADE_STEPS),
+                      .durationMs = (i == 0) ? HOLD_OFF_MS : FADE_STEP_MS};
     }
+}
 
-    ledPwmState.dutyCycle_nsec = dutyCycleNs;
-
-    int result = PWM_Apply(pwmFd, SAMPLE_LED_PWM_CHANNEL, &ledPwmState);
-    if (result != 0) {
-        Log_Debug("PWM_Apply failed: result = %d, errno: %s (%d)\n", result, strerror(errno),
-                  errno);
-        exitCode = ExitCode_StepTimerHandler_Apply;
-        return;
-    }
+/// <summary>
+///     Handle a failure of the sequencer to change the LED brightness.
+/// </summary>
+static void SequencerErrorHandler(void *context)
+{
+    exitCode = ExitCode_Sequencer_Failed;
 }
 
 /// <summary>
@@ -167,11 +168,6 @@ static ExitCode InitPeripheralsAndHandlers(void)
         return ExitCode_Init_EventLoop;
     }
 
-    stepTimer = CreateEventLoopPeriodicTimer(eventLoop, &StepTimerEventHandler, &stepInterval100Ms);
-    if (stepTimer == NULL) {
-        return ExitCode_Init_StepTimer;
-    }
-
     pwmFd = PWM_Open(SAMPLE_LED_PWM_CONTROLLER);
     if (pwmFd == -1) {
         Log_Debug(
@@ -186,6 +182,18 @@ static ExitCode InitPeripheralsAndHandlers(void)
         return localExitCode;
     }
 
+    sequencer = CreatePwmSequencer(eventLoop, pwmFd, SAMPLE_LED_PWM_CHANNEL, &ledPwmState,
+                                   SequencerErrorHandler, NULL);
+    if (sequencer == NULL) {
+        return ExitCode_Init_Sequencer;
+    }
+
+    BuildBreathingSteps();
+    if (PlayPwmSequence(sequencer, breathingSteps,
+                        sizeof(breathingSteps) / sizeof(breathingSteps[0]), true) != 0) {
+        return ExitCode_Init_PlaySequence;
+    }
+
     return ExitCode_Success;
 }
 
@@ -209,7 +217,7 @@ static void CloseFdAndPrintError(int fd, const char *fdName)
 /// </summary>
 static void ClosePeripheralsAndHandlers(void)
 {
-    DisposeEventLoopTimer(stepTimer);
+    DisposePwmSequencer(sequencer);
     EventLoop_Close(eventLoop);
 
     Log_Debug("Closing file descriptors.\n");
@@ -0,0 +1,199 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include <applibs/log.h>
+#include <applibs/eventloop.h>
+#include <applibs/pwm.h>
+
+#include "pwm_sequencer.h"
+
+struct PwmSequencer {
+    EventLoop *eventLoop;
+    int timerFd;
+    EventRegistration *registration;
+    int pwmFd;
+    PWM_ChannelId channel;
+    PwmState state;
+    PwmSequencerErrorHandler errorHandler;
+    void *context;
+    const PwmStep *steps;
+    size_t count;
+    size_t next;
+    bool repeat;
+};
+
+static int ArmTimer(PwmSequencer *sequencer, unsigned int durationMs)
+{
+    // A zero it_value would disarm the timer, so round a zero duration up.
+    if (durationMs == 0) {
+        durationMs = 1;
+    }
+
+    struct itimerspec newValue = {
+        .it_value = {.tv_sec = durationMs / 1000, .tv_nsec = (durationMs % 1000) * 1000 * 1000},
+        .it_interval = {0, 0}};
+    if (timerfd_settime(sequencer->timerFd, /* flags */ 0, &newValue, /* old_value */ NULL) ==
+        -1) {
+        Log_Debug("ERROR: Could not set timer: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void DisarmTimer(PwmSequencer *sequencer)
+{
+    static const struct itimerspec disarmed = {{0, 0}, {0, 0}};
+    timerfd_settime(sequencer->timerFd, /* flags */ 0, &disarmed, /* old_value */ NULL);
+}
+
+// Applies the next step, merged with any following steps which have the same duty cycle, and
+// arms the timer for their combined duration. PWM_Apply is skipped if the duty cycle has not
+// changed, unless force is set. Once the last step of a table which does not repeat has
+// elapsed, the timer is not armed again.
+static int ApplyNextStep(PwmSequencer *sequencer, bool force)
+{
+    if (sequencer->next == sequencer->count) {
+        if (!sequencer->repeat) {
+            sequencer->steps = NULL;
+            return 0;
+        }
+        sequencer->next = 0;
+    }
+
+    const PwmStep *step = &sequencer->steps[sequencer->next++];
+    unsigned int durationMs = step->durationMs;
+    while (sequencer->next < sequencer->count &&
+           sequencer->steps[sequencer->next].dutyCycleNs == step->dutyCycleNs) {
+        durationMs += sequencer->steps[sequencer->next++].durationMs;
+    }
+
+    if (force || step->dutyCycleNs != sequencer->state.dutyCycle_nsec) {
+        sequencer->state.dutyCycle_nsec = step->dutyCycleNs;
+        if (PWM_Apply(sequencer->pwmFd, sequencer->channel, &sequencer->state) != 0) {
+            Log_Debug("ERROR: PWM_Apply failed: %s (%d).\n", strerror(errno), errno);
+            return -1;
+        }
+    }
+
+    return ArmTimer(sequencer, durationMs);
+}
+
+// This satisfies the EventLoopIoCallback signature.
+static void StepElapsedCallback(EventLoop *el, int fd, EventLoop_IoEvents events, void *context)
+{
+    PwmSequencer *sequencer = (PwmSequencer *)context;
+
+    uint64_t timerData = 0;
+    if (read(sequencer->timerFd, &timerData, sizeof(timerData)) == -1) {
+        // The timer may have been rearmed or disarmed since it expired.
+        if (errno == EAGAIN) {
+            return;
+        }
+        Log_Debug("ERROR: Could not read timerfd %s (%d).\n", strerror(errno), errno);
+        sequencer->errorHandler(sequencer->context);
+        return;
+    }
+
+    if (sequencer->steps != NULL && ApplyNextStep(sequencer, false) != 0) {
+        StopPwmSequence(sequencer);
+        sequencer->errorHandler(sequencer->context);
+    }
+}
+
+PwmSequencer *CreatePwmSequencer(EventLoop *eventLoop, int pwmFd, PWM_ChannelId channel,
+                                 const PwmState *state, PwmSequencerErrorHandler errorHandler,
+                                 void *context)
+{
+    if (state == NULL || errorHandler == NULL) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    PwmSequencer *sequencer = malloc(sizeof(PwmSequencer));
+    if (sequencer == NULL) {
+        return NULL;
+    }
+
+    memset(sequencer, 0, sizeof(*sequencer));
+    sequencer->eventLoop = eventLoop;
+    sequencer->pwmFd = pwmFd;
+    sequencer->channel = channel;
+    sequencer->state = *state;
+    sequencer->errorHandler = errorHandler;
+    sequencer->context = context;
+
+    // Initialize to unused values in case have to clean up partially initialized object.
+    sequencer->registration = NULL;
+
+    // The timer is armed while a table is playing.
+    sequencer->timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (sequencer->timerFd == -1) {
+        Log_Debug("ERROR: Unable to create timer: %s (%d).\n", strerror(errno), errno);
+        goto failed;
+    }
+
+    sequencer->registration = EventLoop_RegisterIo(eventLoop, sequencer->timerFd,
+                                                   EventLoop_Input, StepElapsedCallback, sequencer);
+    if (sequencer->registration == NULL) {
+        Log_Debug("ERROR: Unable to register timer event: %s (%d).\n", strerror(errno), errno);
+        goto failed;
+    }
+
+    return sequencer;
+
+failed:
+    DisposePwmSequencer(sequencer);
+    return NULL;
+}
+
+int PlayPwmSequence(PwmSequencer *sequencer, const PwmStep *steps, size_t count, bool repeat)
+{
+    if (steps == NULL || count == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    sequencer->steps = steps;
+    sequencer->count = count;
+    sequencer->next = 0;
+    sequencer->repeat = repeat;
+
+    // Apply the first step even if the channel already has its duty cycle, since the state
+    // which the sequencer last applied may have been overwritten.
+    if (ApplyNextStep(sequencer, true) != 0) {
+        StopPwmSequence(sequencer);
+        return -1;
+    }
+
+    return 0;
+}
+
+void StopPwmSequence(PwmSequencer *sequencer)
+{
+    sequencer->steps = NULL;
+    DisarmTimer(sequencer);
+}
+
+void DisposePwmSequencer(PwmSequencer *sequencer)
+{
+    if (sequencer == NULL) {
+        return;
+    }
+
+    EventLoop_UnregisterIo(sequencer->eventLoop, sequencer->registration);
+
+    if (sequencer->timerFd != -1) {
+        close(sequencer->timerFd);
+    }
+
+    free(sequencer);
+}
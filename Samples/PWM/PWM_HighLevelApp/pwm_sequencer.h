@@ -0,0 +1,80 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <applibs/eventloop.h>
+#include <applibs/pwm.h>
+
+// A PWM sequencer plays a table of steps on one PWM channel. Each step holds a duty cycle for a
+// duration, so the sequencer wakes only when the output changes: a blink pattern costs two
+// wakeups per period, however long it is, and consecutive steps with the same duty cycle are
+// merged into one PWM_Apply. The timer is armed only while a table is playing.
+
+/// <summary>One step of a waveform.</summary>
+typedef struct {
+    /// <summary>Duty cycle for this step, in nanoseconds.</summary>
+    unsigned int dutyCycleNs;
+    /// <summary>How long the duty cycle is held, in milliseconds.</summary>
+    unsigned int durationMs;
+} PwmStep;
+
+/// <summary>
+/// Opaque handle. Obtain via <see cref="CreatePwmSequencer" /> and dispose of via
+/// <see cref="DisposePwmSequencer" />.
+/// </summary>
+typedef struct PwmSequencer PwmSequencer;
+
+/// <summary>
+/// Applications implement a function with this signature to be notified when the sequencer
+/// cannot apply a step. errno contains more information. Playback stops.
+/// </summary>
+/// <param name="context">Context which was supplied to <see cref="CreatePwmSequencer" />.</param>
+typedef void (*PwmSequencerErrorHandler)(void *context);
+
+/// <summary>
+/// Create a PWM sequencer which is invoked on the event loop.
+/// </summary>
+/// <param name="eventLoop">Event loop to which the sequencer will be added.</param>
+/// <param name="pwmFd">PWM controller opened with PWM_Open. It is used, but not closed, by the
+/// sequencer.</param>
+/// <param name="channel">Channel on which to play.</param>
+/// <param name="state">Period, polarity and enable state to use for every step. The duty cycle
+/// is replaced by that of each step.</param>
+/// <param name="errorHandler">Callback to invoke when a step cannot be applied.</param>
+/// <param name="context">Context which is passed to the error handler.</param>
+/// <returns>On success, pointer to new PwmSequencer, which should be disposed of
+/// with <see cref="DisposePwmSequencer" />. On failure, returns NULL, with more
+/// information available in errno.</returns>
+PwmSequencer *CreatePwmSequencer(EventLoop *eventLoop, int pwmFd, PWM_ChannelId channel,
+                                 const PwmState *state, PwmSequencerErrorHandler errorHandler,
+                                 void *context);
+
+/// <summary>
+/// Start playing a table of steps from its first step, replacing any table which is playing.
+/// The first step is applied immediately.
+/// </summary>
+/// <param name="sequencer">Successfully allocated PWM sequencer.</param>
+/// <param name="steps">Steps to play. Not copied, so the table must remain valid while it is
+/// playing.</param>
+/// <param name="count">Number of steps, which must be at least one.</param>
+/// <param name="repeat">Whether to start again from the first step after the last. If false,
+/// the duty cycle of the last step is held once it has elapsed.</param>
+/// <returns>0 on success, -1 on failure, in which case errno contains more information.</returns>
+int PlayPwmSequence(PwmSequencer *sequencer, const PwmStep *steps, size_t count, bool repeat);
+
+/// <summary>
+/// Stop playing, leaving the current duty cycle applied.
+/// </summary>
+/// <param name="sequencer">Successfully allocated PWM sequencer.</param>
+void StopPwmSequence(PwmSequencer *sequencer);
+
+/// <summary>
+/// Dispose of a sequencer which was allocated with <see cref="CreatePwmSequencer" />.
+/// It is safe to call this function with a NULL pointer.
+/// </summary>
+/// <param name="sequencer">Successfully allocated PWM sequencer, or NULL.</param>
+void DisposePwmSequencer(PwmSequencer *sequencer);
@@ -44,6 +44,11 @@
 #include <hw/sample_appliance.h>
 
 #include "eventloop_timer_utilities.h"
+#include "wake_trace.h"
+#include "network_state.h"
+#include "key_value_store.h"
+#include "time_keeper.h"
+#include "worker_pool.h"
 
 /// <summary>
 /// Exit codes for this application. These are used for the
@@ -55,9 +60,9 @@ typedef enum {
 
     ExitCode_TermHandler_SigTerm = 1,
 
-    ExitCode_WriteProgramStateToMutableFile_OpenFile = 2,
+    ExitCode_WriteProgramState_Commit = 2,
 
-    ExitCode_ReadProgramStateFromMutableFile_OpenFile = 3,
+    ExitCode_ReadProgramState_OpenStore = 3,
 
     ExitCode_ComputeTimeDifference_Fail = 4,
 
@@ -101,7 +106,13 @@ typedef enum {
 
     ExitCode_InterfaceConnectionStatus_Failed = 32,
 
-    ExitCode_BusinessLogicTimer_SetValue = 33
+    ExitCode_BusinessLogicTimer_SetValue = 33,
+
+    ExitCode_Init_NetworkState = 34,
+
+    ExitCode_Init_TimeKeeper = 35,
+
+    ExitCode_Init_WorkerPool = 36
 } ExitCode;
 
 static volatile sig_atomic_t exitCode = ExitCode_Success;
@@ -116,7 +127,7 @@ SysEvent_Events currentUpdateState = SysEvent_Events_None;
 static void UpdateCallback(SysEvent_Events event, SysEvent_Status status, const SysEvent_Info *info,
                            void *context);
 
-// Value read from MutableStorage
+// Value read from the key-value store
 static time_t lastUpdateTimestamp;
 
 // Current system time: the clock must be synchronized
@@ -126,11 +137,32 @@ static time_t currentTimestamp;
 static const double updateCheckIntervalInSeconds = 120.0;
 
 static void UpdateTime(time_t *outputCurrentTime);
-static void ReadProgramStateFromMutableFile(void);
-static void WriteProgramStateToMutableFile(void);
+static void ReadProgramState(void);
+static void WriteProgramState(void);
+static void ProgramStateCommitted(int error, void *context);
 
 static const char networkInterface[] = "wlan0";
 
+// The wake traces are kept near the start of the mutable storage file. This app has no cloud
+// connection, so it logs the traces of earlier cycles when it starts, instead of uploading them.
+static const off_t wakeTraceStorageOffset = 64;
+
+// The key-value store, which holds lastUpdateTimestamp, follows the wake traces. The timestamp is
+// only written just before the device powers down or reboots, so each change is committed at once,
+// on the worker pool's thread; KeyValueStore_Close waits for the commit before the device powers
+// down.
+static const off_t keyValueStoreOffset = 256;
+static const size_t keyValueStoreSize = 2048;
+static const char lastUpdateKey[] = "lastUpdate";
+
+// The time keeper keeps the time of the last time sync in the key-value store as well, so that the
+// time from the RTC can be trusted as soon as the device wakes, before it has synchronized.
+static const TimeKeeper_Config timeKeeperConfig = {
+    .storageKey = "timeKeeper", .pollPeriodSeconds = 5, .maxErrorSeconds = 60};
+static void NetworkStateChangedHandler(Networking_InterfaceConnectionStatus status, void *context);
+static void NetworkStateErrorHandler(void *context);
+static void LogAndClearStoredWakeTraces(void);
+
 // SAMPLE_RGBLED_RED will blink for 60 seconds and then the application will power down, unless it
 // needs to wait for update-related processing.
 static EventLoopTimer *businessLogicCompleteTimer = NULL;
@@ -142,7 +174,7 @@ static void BusinessLogicTimerEventHandler(EventLoopTimer *timer);
 static EventLoopTimer *waitForUpdatesCheckTimer = NULL;
 static const struct timespec waitForUpdatesCheckTimerInterval = {.tv_sec = 120, .tv_nsec = 0};
 
-static ExitCode CheckNetworkIfConnectedToInternet(void);
+static void CheckNetworkIfConnectedToInternet(void);
 static void WaitForUpdatesCheckTimerEventHandler(EventLoopTimer *timer);
 
 // Wait extra time for the download to finish
@@ -203,61 +235,58 @@ static void UpdateTime(time_t *outputCurrentTime)
 }
 
 /// <summary>
-///     Write lastUpdateTimestamp to the persistent data file.
+///     Write lastUpdateTimestamp to the key-value store. The commit is written in the background,
+///     and <see cref="ProgramStateCommitted" /> reports its result.
 /// </summary>
-static void WriteProgramStateToMutableFile(void)
+static void WriteProgramState(void)
 {
-    int fd = Storage_OpenMutableFile();
-    if (fd < 0) {
-        Log_Debug("ERROR: Could not open mutable file:  %s (%d).\n", strerror(errno), errno);
-        exitCode = ExitCode_WriteProgramStateToMutableFile_OpenFile;
-        return;
-    }
-
-    ssize_t ret = write(fd, &lastUpdateTimestamp, sizeof(lastUpdateTimestamp));
-    Log_Debug("INFO: Wrote lastUpdateTimestamp = %li\n", lastUpdateTimestamp);
-    if (ret == -1) {
-        // If the file has reached the maximum size specified in the application manifest,
-        // then -1 will be returned with errno EDQUOT (122)
-        Log_Debug("ERROR: An error occurred while writing to mutable file:  %s (%d).\n",
+    if (KeyValueStore_Set(lastUpdateKey, &lastUpdateTimestamp, sizeof(lastUpdateTimestamp)) ==
+        -1) {
+        Log_Debug("ERROR: An error occurred while writing lastUpdateTimestamp:  %s (%d).\n",
                   strerror(errno), errno);
-    } else if (ret < sizeof(lastUpdateTimestamp)) {
-        // For simplicity, this sample logs an error here. In the general case, this should be
-        // handled by retrying the write with the remaining data until all the data has been
-        // written.
-        Log_Debug("ERROR: Only wrote %zd of %zu bytes requested\n", ret,
-                  sizeof(lastUpdateTimestamp));
+        exitCode = ExitCode_WriteProgramState_Commit;
     }
-
-    close(fd);
 }
 
 /// <summary>
-///     Read lastUpdateTimestamp from the persistent data file. If the file doesn't
-///     exist, set lastUpdateTimestamp to 0.
+///     Called when the commit of lastUpdateTimestamp has been written, or has failed.
+///     See <see cref="KeyValueStore_CommitCallback" /> for information about arguments.
 /// </summary>
-static void ReadProgramStateFromMutableFile(void)
+static void ProgramStateCommitted(int error, void *context)
 {
-    int fd = Storage_OpenMutableFile();
-    if (fd == -1) {
-        Log_Debug("ERROR: Could not open mutable file:  %s (%d).\n", strerror(errno), errno);
-        exitCode = ExitCode_ReadProgramStateFromMutableFile_OpenFile;
+    if (error != 0) {
+        // If the file has reached the maximum size specified in the application manifest,
+        // then errno is EDQUOT (122)
+        Log_Debug("ERROR: An error occurred while writing lastUpdateTimestamp:  %s (%d).\n",
+                  strerror(error), error);
+        exitCode = ExitCode_WriteProgramState_Commit;
         return;
     }
 
-    lastUpdateTimestamp = 0;
-    ssize_t ret = read(fd, &lastUpdateTimestamp, sizeof(lastUpdateTimestamp));
+    Log_Debug("INFO: Wrote lastUpdateTimestamp = %li\n", lastUpdateTimestamp);
+}
 
-    Log_Debug("INFO: Read lastUpdateTimestamp = %li\n", lastUpdateTimestamp);
-    if (ret == -1) {
-        Log_Debug("ERROR: An error occurred while reading lastUpdateTimestamp:  %s (%d).\n",
-                  strerror(errno), errno);
+/// <summary>
+///     Open the key-value store and read lastUpdateTimestamp from it. If the store has no
+///     timestamp, set lastUpdateTimestamp to 0.
+/// </summary>
+static void ReadProgramState(void)
+{
+    lastUpdateTimestamp = 0;
+    if (KeyValueStore_Open(eventLoop, keyValueStoreOffset, keyValueStoreSize,
+                           /* commitDelayMs */ 0) == -1) {
+        Log_Debug("ERROR: Could not open the key-value store:  %s (%d).\n", strerror(errno),
+                  errno);
+        exitCode = ExitCode_ReadProgramState_OpenStore;
+        return;
     }
-    close(fd);
+    KeyValueStore_SetCommitCallback(ProgramStateCommitted, NULL);
 
-    if (ret < sizeof(lastUpdateTimestamp)) {
+    if (KeyValueStore_Get(lastUpdateKey, &lastUpdateTimestamp, sizeof(lastUpdateTimestamp)) !=
+        sizeof(lastUpdateTimestamp)) {
         lastUpdateTimestamp = 0;
     }
+    Log_Debug("INFO: Read lastUpdateTimestamp = %li\n", lastUpdateTimestamp);
 
     char timeBuf[64];
     struct tm *tm = gmtime(&lastUpdateTimestamp);
@@ -282,41 +311,29 @@ static void WaitForUpdatesDownloadTimerEventHandler(EventLoopTimer *timer)
 }
 
 /// <summary>
-///     Check that the device is connected to the internet.
+///     Log whether the device was connected to the internet when the wait for an update check
+///     timed out.
 /// </summary>
-/// <returns>
-///     ExitCode_Success if checking the network status was successful; otherwise another
-///     ExitCode value which indicates the specific failure.
-/// </returns>
-static ExitCode CheckNetworkIfConnectedToInternet(void)
+static void CheckNetworkIfConnectedToInternet(void)
 {
-    // Check whether the device is connected to the internet.
-    Networking_InterfaceConnectionStatus status;
-    if (Networking_GetInterfaceConnectionStatus(networkInterface, &status) != 0) {
-        if (errno != EAGAIN) {
-            Log_Debug("ERROR: Networking_GetInterfaceConnectionStatus: %d (%s)\n", errno,
-                      strerror(errno));
-            return ExitCode_InterfaceConnectionStatus_Failed;
-        }
+    Networking_InterfaceConnectionStatus status = NetworkState_GetStatus();
+    if (status == 0) {
         Log_Debug(
             "WARNING: Wait for update check timed out, and there is no update download "
             "in progress. The networking stack isn't ready yet. Powering down.\n");
-        return ExitCode_Success;
+        return;
     }
 
     if ((status & Networking_InterfaceConnectionStatus_ConnectedToInternet) == 0) {
         Log_Debug(
             "WARNING: Wait for update check timed out, and there is no update download "
             "in progress. The device does not have internet connectivity. Powering down.\n");
-
-        return ExitCode_Success;
+        return;
     }
 
     Log_Debug(
         "INFO: Wait for update check timed out, and no update download in progress. Powering "
         "down.\n");
-
-    return ExitCode_Success;
 }
 
 /// <summary>
@@ -333,11 +350,7 @@ static void WaitForUpdatesCheckTimerEventHandler(EventLoopTimer *timer)
         return;
     }
 
-    exitCode = CheckNetworkIfConnectedToInternet();
-    if (exitCode != ExitCode_Success) {
-        return;
-    }
-
+    CheckNetworkIfConnectedToInternet();
     exitCode = ExitCode_TriggerPowerdown_Success;
 }
 
@@ -366,10 +379,11 @@ static void BusinessLogicTimerEventHandler(EventLoopTimer *timer)
     double checkUpdateIntervalSec = difftime(currentTimestamp, lastUpdateTimestamp);
 
     // the device should wait for an update if the `checkUpdateIntervalSec` interval
-    // has passed or if there is an inconsistency between the currentTimestamp and
-    // the lastUpdateTimestamp
+    // has passed, if there is an inconsistency between the currentTimestamp and
+    // the lastUpdateTimestamp, or if the current time cannot be trusted
     bool shouldWaitForUpdate = false;
-    if (checkUpdateIntervalSec > updateCheckIntervalInSeconds || checkUpdateIntervalSec < 0) {
+    if (checkUpdateIntervalSec > updateCheckIntervalInSeconds || checkUpdateIntervalSec < 0 ||
+        TimeKeeper_GetConfidence() == TimeKeeper_Confidence_None) {
         shouldWaitForUpdate = true;
     }
 
@@ -400,6 +414,44 @@ static void BlinkingLedTimerEventHandler(EventLoopTimer *timer)
         exitCode = ExitCode_BlinkingTimer_SetValue;
         return;
     }
+
+    // Until the device is online, refresh the network state on every blink, so that the wake
+    // trace records when it came online to within a blink rather than a network poll.
+    if (!NetworkState_IsConnectedToInternet()) {
+        NetworkState_Refresh();
+    }
+}
+
+/// <summary>
+///     Record in the wake trace when the device first connects to the internet.
+/// </summary>
+static void NetworkStateChangedHandler(Networking_InterfaceConnectionStatus status, void *context)
+{
+    if ((status & Networking_InterfaceConnectionStatus_ConnectedToInternet) != 0 &&
+        WakeTrace_GetCurrent()->phaseMs[WakeTrace_Phase_NetworkReady] == WAKE_TRACE_NOT_REACHED) {
+        WakeTrace_Mark(WakeTrace_Phase_NetworkReady);
+    }
+}
+
+/// <summary>
+///     Called when the connection status of the interface cannot be read.
+/// </summary>
+static void NetworkStateErrorHandler(void *context)
+{
+    exitCode = ExitCode_InterfaceConnectionStatus_Failed;
+}
+
+/// <summary>
+///     Log the traces of earlier wake cycles, and remove them from the mutable storage file.
+/// </summary>
+static void LogAndClearStoredWakeTraces(void)
+{
+    const WakeTrace_Record *records;
+    size_t count = WakeTrace_GetStored(&records);
+    for (size_t i = 0; i < count; ++i) {
+        WakeTrace_Log(&records[i]);
+    }
+    WakeTrace_ClearStored();
 }
 
 /// <summary>
@@ -416,9 +468,10 @@ static void UpdateCallback(SysEvent_Events event, SysEvent_Status status, const
     switch (event) {
     case SysEvent_Events_NoUpdateAvailable: {
         Log_Debug("INFO: Update check finished. No updates available\n");
+        WakeTrace_Mark(WakeTrace_Phase_UpdateCheckDone);
 
         UpdateTime(&lastUpdateTimestamp);
-        WriteProgramStateToMutableFile();
+        WriteProgramState();
 
         if (isBusinessLogicComplete) {
             exitCode = ExitCode_TriggerPowerdown_Success;
@@ -439,6 +492,7 @@ static void UpdateCallback(SysEvent_Events event, SysEvent_Status status, const
     // Updates are ready for install
     case SysEvent_Events_UpdateReadyForInstall: {
         Log_Debug("INFO: Update download finished and is ready for install.\n");
+        WakeTrace_Mark(WakeTrace_Phase_UpdateCheckDone);
 
         // Stop LED blinking, and switch on the green LED, to indicate this event has occured.
         DisarmEventLoopTimer(blinkTimer);
@@ -464,7 +518,7 @@ static void UpdateCallback(SysEvent_Events event, SysEvent_Status status, const
             Log_Debug("INFO: Application update. The device will powerdown.\n");
 
             UpdateTime(&lastUpdateTimestamp);
-            WriteProgramStateToMutableFile();
+            WriteProgramState();
 
             exitCode = ExitCode_TriggerPowerdown_Success;
         } else if (data.update_type == SysEvent_UpdateType_System) {
@@ -492,6 +546,9 @@ static void UpdateCallback(SysEvent_Events event, SysEvent_Status status, const
 /// </summary>
 static void TriggerReboot(void)
 {
+    WakeTrace_Log(WakeTrace_GetCurrent());
+    WakeTrace_Persist();
+
     // Reboot the system
     int result = PowerManagement_ForceSystemReboot();
     if (result != 0) {
@@ -505,6 +562,10 @@ static void TriggerReboot(void)
 /// </summary>
 static void TriggerPowerdown(void)
 {
+    WakeTrace_Mark(WakeTrace_Phase_PowerdownRequested);
+    WakeTrace_Log(WakeTrace_GetCurrent());
+    WakeTrace_Persist();
+
     // Put the device in the powerdown mode
     int result = PowerManagement_ForceSystemPowerDown(powerdownResidencyTime);
     if (result != 0) {
@@ -525,12 +586,6 @@ static ExitCode InitPeripheralsAndHandlers(void)
     struct sigaction action = {.sa_handler = TerminationHandler};
     sigaction(SIGTERM, &action, NULL);
 
-    // Read the current time
-    UpdateTime(&currentTimestamp);
-
-    // Read the last update time
-    ReadProgramStateFromMutableFile();
-
     // Open LEDs for accept mode status.
     blinkingLedRedFd =
         GPIO_OpenAsOutput(SAMPLE_RGBLED_RED, GPIO_OutputMode_PushPull, GPIO_Value_High);
@@ -553,6 +608,23 @@ static ExitCode InitPeripheralsAndHandlers(void)
         return ExitCode_Init_EventLoop;
     }
 
+    if (WorkerPool_Initialize(eventLoop, 1) != 0) {
+        Log_Debug("ERROR: Could not start the worker pool: %s (%d).\n", strerror(errno), errno);
+        return ExitCode_Init_WorkerPool;
+    }
+
+    // Read the last update time
+    ReadProgramState();
+    if (exitCode != ExitCode_Success) {
+        return exitCode;
+    }
+
+    // Read the current time, once the time keeper has corrected the time from the RTC
+    if (TimeKeeper_Start(eventLoop, &timeKeeperConfig, NULL, NULL) != 0) {
+        return ExitCode_Init_TimeKeeper;
+    }
+    UpdateTime(&currentTimestamp);
+
     updateEventReg = SysEvent_RegisterForEventNotifications(eventLoop, SysEvent_Events_Mask,
                                                             UpdateCallback, NULL);
     if (updateEventReg == NULL) {
@@ -560,6 +632,11 @@ static ExitCode InitPeripheralsAndHandlers(void)
         return ExitCode_Init_RegisterEvent;
     }
 
+    if (NetworkState_Start(eventLoop, networkInterface, NetworkStateErrorHandler, NULL) != 0 ||
+        NetworkState_Subscribe(NetworkStateChangedHandler, NULL) != 0) {
+        return ExitCode_Init_NetworkState;
+    }
+
     blinkTimer = CreateEventLoopPeriodicTimer(eventLoop, &BlinkingLedTimerEventHandler,
                                               &blinkIntervalBusinessLogic);
     if (blinkTimer == NULL) {
@@ -644,6 +721,12 @@ static void ClosePeripheralsAndHandlers(void)
     DisposeEventLoopTimer(waitForUpdatesCheckTimer);
     DisposeEventLoopTimer(waitForUpdatesToDownloadTimer);
     SysEvent_UnregisterForEventNotifications(updateEventReg);
+    NetworkState_Stop();
+    TimeKeeper_Stop();
+    // Waits for the commit of lastUpdateTimestamp, so that it is in storage before the device
+    // powers down or reboots.
+    KeyValueStore_Close();
+    WorkerPool_Cleanup();
     EventLoop_Close(eventLoop);
 
     CloseFdAndPrintError(blinkingLedRedFd, "SAMPLE_RGBLED_RED");
@@ -655,7 +738,9 @@ static void ClosePeripheralsAndHandlers(void)
 /// </summary>
 int main(void)
 {
+    WakeTrace_Initialize(wakeTraceStorageOffset);
     Log_Debug("INFO: Powerdown application starting...\n");
+    LogAndClearStoredWakeTraces();
 
     exitCode = InitPeripheralsAndHandlers();
 
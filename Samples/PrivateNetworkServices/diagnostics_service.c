@@ -0,0 +1,243 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <applibs/log.h>
+
+#include "diagnostics_service.h"
+#include "tcp_service_protocols.h"
+
+// Size of a bulk data request: its offset and size.
+#define BULK_REQUEST_SIZE 6
+
+static const char metricsPath[] = "/metrics";
+static const char jsonContentType[] = "application/json";
+static const char textContentType[] = "text/plain";
+
+static const TcpService_ServerState *services[DIAGNOSTICS_SERVICE_MAX_SERVICES];
+static size_t serviceCount = 0;
+
+static ssize_t HandleHttpRequest(TcpService_Connection *connection, const uint8_t *request,
+                                 size_t requestSize, uint8_t *response, size_t responseSize,
+                                 void *context);
+static ssize_t HandleBulkRequest(TcpService_Connection *connection, const uint8_t *request,
+                                 size_t requestSize, uint8_t *response, size_t responseSize,
+                                 void *context);
+
+const TcpService_Protocol DiagnosticsService_HttpProtocol = {
+    .name = "diagnostics",
+    .findRequest = TcpService_FindHttpRequest,
+    .handleRequest = HandleHttpRequest,
+    .maxResponseSize = TCP_SERVICE_TX_BUFFER_SIZE};
+
+const TcpService_Protocol DiagnosticsService_BulkProtocol = {
+    .name = "bulk",
+    .findRequest = TcpService_FindLengthPrefixed,
+    .handleRequest = HandleBulkRequest,
+    .maxResponseSize = TCP_SERVICE_LENGTH_PREFIX_SIZE + DIAGNOSTICS_SERVICE_MAX_CHUNK_SIZE};
+
+int DiagnosticsService_AddService(const TcpService_ServerState *service)
+{
+    if (serviceCount == DIAGNOSTICS_SERVICE_MAX_SERVICES) {
+        return -1;
+    }
+    services[serviceCount++] = service;
+    return 0;
+}
+
+void DiagnosticsService_RemoveServices(void)
+{
+    serviceCount = 0;
+}
+
+/// <summary>
+///     Text which is being formatted into a fixed buffer.
+/// </summary>
+typedef struct {
+    char *buffer;
+    size_t capacity;
+    size_t length;
+    // Set if the text did not fit in the buffer.
+    bool overflowed;
+} Text;
+
+static void AppendText(Text *text, const char *format, ...)
+{
+    if (text->overflowed) {
+        return;
+    }
+
+    va_list args;
+    va_start(args, format);
+    int result =
+        vsnprintf(&text->buffer[text->length], text->capacity - text->length, format, args);
+    va_end(args);
+
+    if (result < 0 || (size_t)result >= text->capacity - text->length) {
+        text->overflowed = true;
+        return;
+    }
+    text->length += (size_t)result;
+}
+
+static uint64_t PerSecond(uint64_t count, const struct timespec *since, const struct timespec *now)
+{
+    time_t seconds = now->tv_sec - since->tv_sec;
+    return (seconds > 0) ? count / (uint64_t)seconds : count;
+}
+
+static void AppendServiceMetrics(Text *text, const TcpService_ServerState *service,
+                                 const struct timespec *now, bool includeConnections)
+{
+    TcpService_Metrics metrics;
+    TcpService_GetMetrics(service, &metrics);
+
+    AppendText(text,
+               "{\"name\":\"%s\",\"uptimeSeconds\":%ld,\"connectionsAccepted\":%u,"
+               "\"connectionsOpen\":%u,\"requests\":%u,\"invalidRequests\":%u,"
+               "\"bytesReceived\":%llu,\"bytesSent\":%llu,\"bytesReceivedPerSecond\":%llu,"
+               "\"bytesSentPerSecond\":%llu",
+               service->protocol->name, (long)(now->tv_sec - metrics.startedAt.tv_sec),
+               metrics.connectionsAccepted, metrics.connectionsOpen, metrics.requests,
+               metrics.invalidRequests, (unsigned long long)metrics.bytesReceived,
+               (unsigned long long)metrics.bytesSent,
+               (unsigned long long)PerSecond(metrics.bytesReceived, &metrics.startedAt, now),
+               (unsigned long long)PerSecond(metrics.bytesSent, &metrics.startedAt, now));
+
+    if (includeConnections) {
+        AppendText(text, ",\"connections\":[");
+        bool first = true;
+        for (size_t i = 0; i < TCP_SERVICE_MAX_CONNECTIONS; ++i) {
+            TcpService_ConnectionMetrics connection;
+            if (!TcpService_GetConnectionMetrics(service, i, &connection)) {
+                continue;
+            }
+            AppendText(text,
+                       "%s{\"ageSeconds\":%ld,\"requests\":%u,\"bytesReceived\":%llu,"
+                       "\"bytesSent\":%llu}",
+                       first ? "" : ",", (long)(now->tv_sec - connection.connectedAt.tv_sec),
+                       connection.requests, (unsigned long long)connection.bytesReceived,
+                       (unsigned long long)connection.bytesSent);
+            first = false;
+        }
+        AppendText(text, "]");
+    }
+
+    AppendText(text, "}");
+}
+
+/// <summary>
+///     Formats the metrics of the services, or of the service whose name follows "/metrics/".
+/// </summary>
+/// <returns>true if the metrics were formatted; false if there is no such service.</returns>
+static bool FormatMetrics(Text *text, const TcpService_HttpRequest *httpRequest)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    if (TcpService_IsHttpPath(httpRequest, metricsPath)) {
+        AppendText(text, "{\"services\":[");
+        for (size_t i = 0; i < serviceCount; ++i) {
+            if (i > 0) {
+                AppendText(text, ",");
+            }
+            AppendServiceMetrics(text, services[i], &now, false);
+        }
+        AppendText(text, "]}");
+        return true;
+    }
+
+    char path[sizeof(metricsPath) + 32];
+    for (size_t i = 0; i < serviceCount; ++i) {
+        snprintf(path, sizeof(path), "%s/%s", metricsPath, services[i]->protocol->name);
+        if (TcpService_IsHttpPath(httpRequest, path)) {
+            AppendServiceMetrics(text, services[i], &now, true);
+            return true;
+        }
+    }
+    return false;
+}
+
+/// <summary>
+///     Answers an HTTP request for metrics. The body is formatted in the response buffer after the
+///     space reserved for the headers.
+/// </summary>
+static ssize_t HandleHttpRequest(TcpService_Connection *connection, const uint8_t *request,
+                                 size_t requestSize, uint8_t *response, size_t responseSize,
+                                 void *context)
+{
+    TcpService_HttpRequest httpRequest;
+    if (TcpService_ParseHttpRequest(request, requestSize, &httpRequest) != 0) {
+        static const char badRequest[] = "Bad request\n";
+        TcpService_CloseAfterResponses(connection);
+        return TcpService_FormatHttpResponse(response, responseSize, 400, textContentType,
+                                             badRequest, sizeof(badRequest) - 1, false);
+    }
+    if (!httpRequest.keepAlive) {
+        TcpService_CloseAfterResponses(connection);
+    }
+
+    if (httpRequest.methodLength != 3 || strncmp(httpRequest.method, "GET", 3) != 0) {
+        static const char notAllowed[] = "Only GET is supported\n";
+        return TcpService_FormatHttpResponse(response, responseSize, 405, textContentType,
+                                             notAllowed, sizeof(notAllowed) - 1,
+                                             httpRequest.keepAlive);
+    }
+
+    Text body = {.buffer = (char *)&response[TCP_SERVICE_HTTP_HEADER_RESERVE],
+                 .capacity = responseSize - TCP_SERVICE_HTTP_HEADER_RESERVE,
+                 .length = 0,
+                 .overflowed = false};
+    if (!FormatMetrics(&body, &httpRequest)) {
+        static const char notFound[] = "Not found\n";
+        return TcpService_FormatHttpResponse(response, responseSize, 404, textContentType,
+                                             notFound, sizeof(notFound) - 1,
+                                             httpRequest.keepAlive);
+    }
+    if (body.overflowed) {
+        static const char tooLarge[] = "Metrics do not fit in the response\n";
+        Log_Debug("ERROR: Diagnostics: Metrics do not fit in %zu bytes.\n", body.capacity);
+        return TcpService_FormatHttpResponse(response, responseSize, 500, textContentType,
+                                             tooLarge, sizeof(tooLarge) - 1,
+                                             httpRequest.keepAlive);
+    }
+
+    return TcpService_FormatHttpResponse(response, responseSize, 200, jsonContentType,
+                                         body.buffer, body.length, httpRequest.keepAlive);
+}
+
+/// <summary>
+///     Answers a request for a chunk of bulk data, reading the chunk directly into the response
+///     buffer.
+/// </summary>
+static ssize_t HandleBulkRequest(TcpService_Connection *connection, const uint8_t *request,
+                                 size_t requestSize, uint8_t *response, size_t responseSize,
+                                 void *context)
+{
+    const DiagnosticsService_BulkSource *source = context;
+
+    size_t payloadSize;
+    const uint8_t *payload = TcpService_GetLengthPrefixedPayload(request, &payloadSize);
+    if (payloadSize != BULK_REQUEST_SIZE) {
+        Log_Debug("ERROR: Diagnostics: Bulk request of %zu bytes is invalid.\n", payloadSize);
+        return -1;
+    }
+
+    uint32_t offset = ((uint32_t)payload[0] << 24) | ((uint32_t)payload[1] << 16) |
+                      ((uint32_t)payload[2] << 8) | payload[3];
+    size_t size = ((size_t)payload[4] << 8) | payload[5];
+    if (size > DIAGNOSTICS_SERVICE_MAX_CHUNK_SIZE) {
+        size = DIAGNOSTICS_SERVICE_MAX_CHUNK_SIZE;
+    }
+
+    ssize_t chunkSize = source->read(offset, &response[TCP_SERVICE_LENGTH_PREFIX_SIZE], size);
+    if (chunkSize < 0) {
+        return -1;
+    }
+    return TcpService_CompleteLengthPrefixed(response, (size_t)chunkSize);
+}
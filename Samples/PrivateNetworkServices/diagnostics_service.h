@@ -0,0 +1,62 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tcp_service.h"
+
+// Services which let a computer on the private network inspect the device:
+//
+//  - An HTTP/1.1 service, which serves the throughput metrics of the registered TCP services as
+//    JSON. "GET /metrics" returns the totals of each service, and "GET /metrics/<name>" returns
+//    the totals and the open connections of the service with that protocol name.
+//  - A length-prefixed binary service, which serves bulk data in chunks. Each request holds the
+//    32-bit big-endian offset and 16-bit big-endian size of the chunk, and each response holds
+//    the chunk, which is shorter than requested at the end of the data.
+
+/// <summary>Maximum number of services whose metrics can be served.</summary>
+#define DIAGNOSTICS_SERVICE_MAX_SERVICES 4
+
+/// <summary>Maximum size of a chunk of bulk data, in bytes.</summary>
+#define DIAGNOSTICS_SERVICE_MAX_CHUNK_SIZE 500
+
+/// <summary>
+///     Reads a chunk of bulk data.
+/// </summary>
+/// <param name="offset">Offset of the chunk within the data.</param>
+/// <param name="buffer">Buffer into which the chunk is read.</param>
+/// <param name="size">Size of the chunk, at most DIAGNOSTICS_SERVICE_MAX_CHUNK_SIZE.</param>
+/// <returns>
+///     The number of bytes read, which is less than size at the end of the data; or -1 if the
+///     data could not be read, in which case the connection is closed.
+/// </returns>
+typedef ssize_t (*DiagnosticsService_BulkReader)(uint32_t offset, uint8_t *buffer, size_t size);
+
+/// <summary>Source of the bulk data which the binary service serves.</summary>
+typedef struct {
+    /// <summary>Reads a chunk of the data.</summary>
+    DiagnosticsService_BulkReader read;
+} DiagnosticsService_BulkSource;
+
+/// <summary>HTTP protocol which serves metrics. Its context is unused.</summary>
+extern const TcpService_Protocol DiagnosticsService_HttpProtocol;
+
+/// <summary>
+/// Binary protocol which serves bulk data. Its context is the DiagnosticsService_BulkSource.
+/// </summary>
+extern const TcpService_Protocol DiagnosticsService_BulkProtocol;
+
+/// <summary>
+///     Adds a service to those whose metrics are served.
+/// </summary>
+/// <param name="service">The service, which must be removed before it is shut down.</param>
+/// <returns>0 on success, or -1 if DIAGNOSTICS_SERVICE_MAX_SERVICES are registered.</returns>
+int DiagnosticsService_AddService(const TcpService_ServerState *service);
+
+/// <summary>
+///     Removes all the services whose metrics are served.
+/// </summary>
+void DiagnosticsService_RemoveServices(void);
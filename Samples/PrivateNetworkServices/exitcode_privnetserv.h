@@ -30,9 +30,23 @@ typedef enum {
 
     ExitCode_Main_EventLoopFail = 12,
 
-    ExitCode_EchoStart_Listen = 13,
+    ExitCode_TcpServiceStart_Listen = 13,
+    ExitCode_TcpServiceStart_MaxConnections = 17,
+    ExitCode_TcpServiceStart_IdleTimer = 18,
+    ExitCode_TcpServiceStart_MaxResponseSize = 20,
 
     ExitCode_OpenIpV4_Socket = 14,
     ExitCode_OpenIpV4_SetSockOpt = 15,
-    ExitCode_OpenIpV4_Bind = 16
+    ExitCode_OpenIpV4_Bind = 16,
+
+    ExitCode_InitLaunch_AsyncLog = 19,
+
+    ExitCode_UdpPublisherStart_Socket = 21,
+    ExitCode_UdpPublisherStart_Bind = 22,
+    ExitCode_UdpPublisherStart_SetSockOpt = 23,
+    ExitCode_UdpPublisherStart_Timer = 24,
+
+    ExitCode_StartPublishing_Timer = 25,
+
+    ExitCode_BringUp_Timer = 26
 } ExitCode;
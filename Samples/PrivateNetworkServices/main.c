@@ -4,7 +4,9 @@
 // This sample C application shows how to set up services on a private Ethernet network. It
 // configures the network with a static IP address, starts the DHCP service allowing dynamically
 // assigning IP address and network configuration parameters, enables the SNTP service allowing
-// other devices to synchronize time via this device, and sets up a TCP server.
+// other devices to synchronize time via this device, and sets up TCP services: an echo server, an
+// HTTP server of diagnostics and a server of bulk data. It also multicasts simulated sensor
+// samples and telemetry over UDP to consumers on the private network.
 //
 // It uses the API for the following Azure Sphere application libraries:
 // - log (messages shown in Visual Studio's Device Output window during debugging)
@@ -13,6 +15,7 @@
 #include <errno.h>
 #include <signal.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
@@ -40,25 +43,50 @@
 // See https://aka.ms/AzureSphereHardwareDefinitions for more details.
 #include <hw/sample_appliance.h>
 
+#include "async_log.h"
+#include "diagnostics_service.h"
 #include "echo_tcp_server.h"
 #include "exitcode_privnetserv.h"
+#include "udp_publisher.h"
 
 static void TerminationHandler(int signalNumber);
-static void ServerStoppedHandler(EchoServer_StopReason reason);
+static void ServerStoppedHandler(TcpService_StopReason reason);
+static ssize_t ReadTestPattern(uint32_t offset, uint8_t *buffer, size_t size);
 static void ShutDownServerAndCleanup(void);
-static ExitCode CheckNetworkStatus(void);
+static ExitCode EnableNetworkInterface(bool *isNetworkStackReady);
+static ExitCode DisplayNetworkInterfaces(void);
 static ExitCode ConfigureNetworkInterfaceWithStaticIp(const char *interfaceName);
 static ExitCode StartSntpServer(const char *interfaceName);
 static ExitCode ConfigureAndStartDhcpSever(const char *interfaceName);
-static ExitCode CheckNetworkStackStatusAndLaunchServers(void);
-static void CheckStatusTimerEventHandler(EventLoopTimer *timer);
+static void SensorTimerEventHandler(EventLoopTimer *timer);
+static ExitCode StartPublishing(void);
+static ExitCode StartServices(void);
+static void LogBringUpTime(const char *milestone);
+static ExitCode AdvanceBringUp(void);
+static void BringUpTimerEventHandler(EventLoopTimer *timer);
 static ExitCode InitializeAndLaunchServers(void);
 
 static EventLoop *eventLoop = NULL;
-static EventLoopTimer *checkStatusTimer = NULL;
-
-static bool isNetworkStackReady = false;
-EchoServer_ServerState *serverState = NULL;
+static EventLoopTimer *bringUpTimer = NULL;
+static EventLoopTimer *sensorTimer = NULL;
+
+// Steps of the bring-up of the private network, each of which depends on the previous one.
+typedef enum {
+    BringUpStep_EnableInterface,
+    BringUpStep_ConfigureIp,
+    BringUpStep_StartServices,
+    BringUpStep_Serving
+} BringUpStep;
+
+static BringUpStep bringUpStep = BringUpStep_EnableInterface;
+// Delay before the networking stack is checked again, which doubles up to the maximum.
+static struct timespec bringUpRetryDelay = {.tv_sec = 0, .tv_nsec = 10 * 1000 * 1000};
+static const struct timespec maxBringUpRetryDelay = {.tv_sec = 0, .tv_nsec = 500 * 1000 * 1000};
+// When the application started, on the CLOCK_MONOTONIC clock.
+static struct timespec applicationStartTime;
+static TcpService_ServerState *echoServerState = NULL;
+static TcpService_ServerState *diagnosticsServerState = NULL;
+static TcpService_ServerState *bulkServerState = NULL;
 
 // Termination state
 static volatile sig_atomic_t exitCode = ExitCode_Success;
@@ -68,9 +96,31 @@ static struct in_addr localServerIpAddress;
 static struct in_addr subnetMask;
 static struct in_addr gatewayIpAddress;
 static const uint16_t LocalTcpServerPort = 11000;
+static const uint16_t LocalDiagnosticsServerPort = 8080;
+static const uint16_t LocalBulkServerPort = 11001;
 static int serverBacklogSize = 3;
+static const size_t serverMaxConnections = 4;
+static const size_t diagnosticsMaxConnections = 2;
+static const unsigned int serverIdleTimeoutSeconds = 300;
 static const char NetworkInterface[] = "eth0";
 
+// Size of the test pattern which the bulk data server serves.
+static const uint32_t testPatternSize = 1024 * 1024;
+static DiagnosticsService_BulkSource testPatternSource = {.read = ReadTestPattern};
+
+// UDP publisher settings. Frames are multicast to an administratively scoped group, which
+// consumers on the private network join.
+static const char publisherGroupAddress[] = "239.255.42.1";
+static const uint16_t publisherPort = 12000;
+static const unsigned int publisherFramesPerSecond = 200;
+static const unsigned int publisherPacingPeriodMs = 10;
+
+// Simulated sensor samples are published at this period, and telemetry once per this many
+// samples.
+static const struct timespec sensorPeriod = {.tv_sec = 0, .tv_nsec = 10 * 1000 * 1000};
+static const unsigned int samplesPerTelemetry = 100;
+static uint32_t sampleCount = 0;
+
 /// <summary>
 ///     Signal handler for termination requests. This handler must be async-signal-safe.
 /// </summary>
@@ -81,17 +131,13 @@ static void TerminationHandler(int signalNumber)
 }
 
 /// <summary>
-///     Called when the TCP server stops processing messages from clients.
+///     Called when a TCP server stops processing messages from clients.
 /// </summary>
-static void ServerStoppedHandler(EchoServer_StopReason reason)
+static void ServerStoppedHandler(TcpService_StopReason reason)
 {
     const char *reasonText;
     switch (reason) {
-    case EchoServer_StopReason_ClientClosed:
-        reasonText = "client closed the connection.";
-        break;
-
-    case EchoServer_StopReason_Error:
+    case TcpService_StopReason_Error:
         reasonText = "an error occurred. See previous log output for more information.";
         break;
 
@@ -105,30 +151,74 @@ static void ServerStoppedHandler(EchoServer_StopReason reason)
 }
 
 /// <summary>
-///     Shut down TCP server and close event handler.
+///     Reads a chunk of the test pattern which the bulk data server serves, in which each byte
+///     holds the low eight bits of its offset, so that a client can check the data it receives.
+/// </summary>
+static ssize_t ReadTestPattern(uint32_t offset, uint8_t *buffer, size_t size)
+{
+    if (offset >= testPatternSize) {
+        return 0;
+    }
+    if (size > testPatternSize - offset) {
+        size = testPatternSize - offset;
+    }
+    for (size_t i = 0; i < size; ++i) {
+        buffer[i] = (uint8_t)(offset + i);
+    }
+    return (ssize_t)size;
+}
+
+/// <summary>
+///     Shut down TCP servers and close event handler.
 /// </summary>
 static void ShutDownServerAndCleanup(void)
 {
-    EchoServer_ShutDown(serverState);
+    DisposeEventLoopTimer(sensorTimer);
+    UdpPublisher_Stop();
+
+    DiagnosticsService_RemoveServices();
+    TcpService_ShutDown(bulkServerState);
+    TcpService_ShutDown(diagnosticsServerState);
+    TcpService_ShutDown(echoServerState);
 
-    DisposeEventLoopTimer(checkStatusTimer);
+    DisposeEventLoopTimer(bringUpTimer);
+    AsyncLog_Cleanup();
     EventLoop_Close(eventLoop);
 }
 
 /// <summary>
-///     Check network status and display information about all available network interfaces.
+///     Log the time at which a step of the bring-up of the private network completed, since the
+///     device booted and since the application started.
+/// </summary>
+static void LogBringUpTime(const char *milestone)
+{
+    struct timespec now;
+    struct timespec sinceBoot;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    clock_gettime(CLOCK_BOOTTIME, &sinceBoot);
+    long sinceStartMs = (long)(now.tv_sec - applicationStartTime.tv_sec) * 1000 +
+                        (now.tv_nsec - applicationStartTime.tv_nsec) / 1000000;
+    Log_Debug("INFO: Bring-up: %s %ld ms after application start, %ld ms after boot.\n",
+              milestone, sinceStartMs,
+              (long)sinceBoot.tv_sec * 1000 + sinceBoot.tv_nsec / 1000000);
+}
+
+/// <summary>
+///     Ensure the network interface is enabled.
 /// </summary>
+/// <param name="isNetworkStackReady">
+///     Set to whether the networking stack was ready, so that the interface could be enabled.
+/// </param>
 /// <returns>
-///     ExitCode_Success on success; otherwise another ExitCode value which indicates
-///     the specific failure.
+///     ExitCode_Success on success, including if the networking stack is not ready yet;
+///     otherwise another ExitCode value which indicates the specific failure.
 /// </returns>
-static ExitCode CheckNetworkStatus(void)
+static ExitCode EnableNetworkInterface(bool *isNetworkStackReady)
 {
-    // Ensure the necessary network interface is enabled.
     int result = Networking_SetInterfaceState(NetworkInterface, true);
     if (result != 0) {
         if (errno == EAGAIN) {
-            Log_Debug("INFO: The networking stack isn't ready yet, will try again later.\n");
+            *isNetworkStackReady = false;
             return ExitCode_Success;
         } else {
             Log_Debug(
@@ -137,8 +227,19 @@ static ExitCode CheckNetworkStatus(void)
             return ExitCode_CheckStatus_SetInterfaceState;
         }
     }
-    isNetworkStackReady = true;
+    *isNetworkStackReady = true;
+    return ExitCode_Success;
+}
 
+/// <summary>
+///     Display information about all available network interfaces.
+/// </summary>
+/// <returns>
+///     ExitCode_Success on success; otherwise another ExitCode value which indicates
+///     the specific failure.
+/// </returns>
+static ExitCode DisplayNetworkInterfaces(void)
+{
     // Display total number of network interfaces.
     ssize_t count = Networking_GetInterfaceCount();
     if (count == -1) {
@@ -211,6 +312,7 @@ static ExitCode CheckNetworkStatus(void)
         if (result != 0) {
             Log_Debug("ERROR: Networking_GetInterfaceConnectionStatus: errno=%d (%s)\n", errno,
                       strerror(errno));
+            free(interfaces);
             return ExitCode_CheckStatus_GetInterfaceConnectionStatus;
         }
         Log_Debug("INFO:   interfaceStatus=0x%02x\n", status);
@@ -309,66 +411,211 @@ static ExitCode ConfigureAndStartDhcpSever(const char *interfaceName)
 }
 
 /// <summary>
-///     Configure network interface, start SNTP server and TCP server.
+///     Publishes a simulated sensor sample and, once per samplesPerTelemetry samples, telemetry
+///     about the TCP servers and the publisher.
+/// </summary>
+static void SensorTimerEventHandler(EventLoopTimer *timer)
+{
+    if (ConsumeEventLoopTimerEvent(timer) != 0) {
+        exitCode = ExitCode_TimerHandler_Consume;
+        return;
+    }
+
+    // The sample holds its index and three channels of triangle waves of different periods,
+    // each as a big-endian 16-bit value.
+    uint8_t sample[10];
+    uint32_t index = sampleCount++;
+    sample[0] = (uint8_t)(index >> 24);
+    sample[1] = (uint8_t)(index >> 16);
+    sample[2] = (uint8_t)(index >> 8);
+    sample[3] = (uint8_t)index;
+    for (unsigned int channel = 0; channel < 3; ++channel) {
+        uint32_t period = 100u << channel;
+        uint32_t phase = index % period;
+        uint16_t value = (uint16_t)(((phase < period / 2) ? phase : period - phase) * 65535u /
+                                    (period / 2));
+        sample[4 + 2 * channel] = (uint8_t)(value >> 8);
+        sample[5 + 2 * channel] = (uint8_t)value;
+    }
+    UdpPublisher_Publish(UdpPublisher_FrameType_Sensor, sample, sizeof(sample));
+
+    if (index % samplesPerTelemetry == 0) {
+        TcpService_Metrics echoMetrics;
+        TcpService_GetMetrics(echoServerState, &echoMetrics);
+        UdpPublisher_Stats stats;
+        UdpPublisher_GetStats(&stats);
+
+        char telemetry[UDP_PUBLISHER_MAX_PAYLOAD_SIZE];
+        int length = snprintf(telemetry, sizeof(telemetry),
+                              "{\"echoConnections\":%u,\"echoRequests\":%u,\"framesSent\":%u,"
+                              "\"framesDropped\":%u,\"framesFailed\":%u}",
+                              echoMetrics.connectionsOpen, echoMetrics.requests, stats.sent,
+                              stats.dropped, stats.failed);
+        if (length > 0 && (size_t)length < sizeof(telemetry)) {
+            UdpPublisher_Publish(UdpPublisher_FrameType_Telemetry, telemetry, (size_t)length);
+        }
+    }
+}
+
+/// <summary>
+///     Start the UDP publisher on the private network interface, and the timer which publishes
+///     simulated sensor samples.
 /// </summary>
 /// <returns>
 ///     ExitCode_Success on success; otherwise another ExitCode value which indicates
 ///     the specific failure.
 /// </returns>
-static ExitCode CheckNetworkStackStatusAndLaunchServers(void)
+static ExitCode StartPublishing(void)
 {
-    // Check the network stack readiness and display available interfaces when it's ready.
-    ExitCode localExitCode = CheckNetworkStatus();
+    struct in_addr groupAddress;
+    inet_aton(publisherGroupAddress, &groupAddress);
+
+    UdpPublisher_Settings settings = {.localAddress = localServerIpAddress.s_addr,
+                                      .destinationAddress = groupAddress.s_addr,
+                                      .port = publisherPort,
+                                      .framesPerSecond = publisherFramesPerSecond,
+                                      .pacingPeriodMs = publisherPacingPeriodMs};
+    ExitCode localExitCode = UdpPublisher_Start(eventLoop, &settings);
     if (localExitCode != ExitCode_Success) {
         return localExitCode;
     }
 
-    // The network stack is ready, so unregister the timer event handler and launch servers.
-    if (isNetworkStackReady) {
-        DisarmEventLoopTimer(checkStatusTimer);
+    sensorTimer = CreateEventLoopPeriodicTimer(eventLoop, SensorTimerEventHandler, &sensorPeriod);
+    if (sensorTimer == NULL) {
+        return ExitCode_StartPublishing_Timer;
+    }
+    return ExitCode_Success;
+}
 
-        // Use static IP addressing to configure network interface.
-        localExitCode = ConfigureNetworkInterfaceWithStaticIp(NetworkInterface);
-        if (localExitCode == ExitCode_Success) {
-            localExitCode = StartSntpServer(NetworkInterface);
-        }
+/// <summary>
+///     Start the services on the private network, which all depend on its static IP address.
+///     The DHCP server is started first, so that attached equipment can obtain its address as
+///     soon as possible.
+/// </summary>
+/// <returns>
+///     ExitCode_Success on success; otherwise another ExitCode value which indicates
+///     the specific failure.
+/// </returns>
+static ExitCode StartServices(void)
+{
+    ExitCode localExitCode = ConfigureAndStartDhcpSever(NetworkInterface);
+    if (localExitCode != ExitCode_Success) {
+        return localExitCode;
+    }
+    LogBringUpTime("DHCP server started");
 
-        if (localExitCode == ExitCode_Success) {
-            localExitCode = ConfigureAndStartDhcpSever(NetworkInterface);
-        }
+    localExitCode = StartSntpServer(NetworkInterface);
+    if (localExitCode != ExitCode_Success) {
+        return localExitCode;
+    }
+
+    // Start the TCP servers.
+    echoServerState = TcpService_Start(eventLoop, localServerIpAddress.s_addr, LocalTcpServerPort,
+                                       serverBacklogSize, serverMaxConnections,
+                                       serverIdleTimeoutSeconds, &EchoServer_Protocol, NULL,
+                                       ServerStoppedHandler, &localExitCode);
+    if (echoServerState == NULL) {
+        return localExitCode;
+    }
+
+    diagnosticsServerState = TcpService_Start(
+        eventLoop, localServerIpAddress.s_addr, LocalDiagnosticsServerPort, serverBacklogSize,
+        diagnosticsMaxConnections, serverIdleTimeoutSeconds, &DiagnosticsService_HttpProtocol,
+        NULL, ServerStoppedHandler, &localExitCode);
+    if (diagnosticsServerState == NULL) {
+        return localExitCode;
+    }
+
+    bulkServerState = TcpService_Start(
+        eventLoop, localServerIpAddress.s_addr, LocalBulkServerPort, serverBacklogSize,
+        diagnosticsMaxConnections, serverIdleTimeoutSeconds, &DiagnosticsService_BulkProtocol,
+        &testPatternSource, ServerStoppedHandler, &localExitCode);
+    if (bulkServerState == NULL) {
+        return localExitCode;
+    }
+
+    DiagnosticsService_AddService(echoServerState);
+    DiagnosticsService_AddService(diagnosticsServerState);
+    DiagnosticsService_AddService(bulkServerState);
 
-        if (localExitCode != ExitCode_Success) {
-            return localExitCode;
+    return StartPublishing();
+}
+
+/// <summary>
+///     Advance the bring-up of the private network through each step whose dependency is
+///     satisfied. Only the first step waits, for the networking stack to become ready; while it
+///     does, it is retried by bringUpTimer with an increasing delay.
+/// </summary>
+/// <returns>
+///     ExitCode_Success on success, including while the networking stack is not ready;
+///     otherwise another ExitCode value which indicates the specific failure.
+/// </returns>
+static ExitCode AdvanceBringUp(void)
+{
+    ExitCode localExitCode = ExitCode_Success;
+
+    while (localExitCode == ExitCode_Success && bringUpStep != BringUpStep_Serving) {
+        switch (bringUpStep) {
+        case BringUpStep_EnableInterface: {
+            bool isNetworkStackReady = false;
+            localExitCode = EnableNetworkInterface(&isNetworkStackReady);
+            if (localExitCode == ExitCode_Success && !isNetworkStackReady) {
+                if (SetEventLoopTimerOneShot(bringUpTimer, &bringUpRetryDelay) != 0) {
+                    return ExitCode_BringUp_Timer;
+                }
+                bringUpRetryDelay.tv_nsec *= 2;
+                if (bringUpRetryDelay.tv_nsec > maxBringUpRetryDelay.tv_nsec) {
+                    bringUpRetryDelay = maxBringUpRetryDelay;
+                }
+                return ExitCode_Success;
+            }
+            LogBringUpTime("networking stack ready");
+            bringUpStep = BringUpStep_ConfigureIp;
+            break;
         }
 
-        // Start the TCP server.
-        serverState = EchoServer_Start(eventLoop, localServerIpAddress.s_addr, LocalTcpServerPort,
-                                       serverBacklogSize, ServerStoppedHandler, &localExitCode);
-        if (serverState == NULL) {
-            return localExitCode;
+        case BringUpStep_ConfigureIp:
+            // Use static IP addressing to configure network interface.
+            localExitCode = ConfigureNetworkInterfaceWithStaticIp(NetworkInterface);
+            if (localExitCode == ExitCode_Success) {
+                LogBringUpTime("static IP address set");
+                bringUpStep = BringUpStep_StartServices;
+            }
+            break;
+
+        case BringUpStep_StartServices:
+            localExitCode = StartServices();
+            if (localExitCode == ExitCode_Success) {
+                LogBringUpTime("serving the private network");
+                bringUpStep = BringUpStep_Serving;
+
+                // The interfaces are only displayed for information, so this is done last.
+                localExitCode = DisplayNetworkInterfaces();
+            }
+            break;
+
+        case BringUpStep_Serving:
+            break;
         }
     }
 
-    return ExitCode_Success;
+    return localExitCode;
 }
 
 /// <summary>
-///     The timer event handler.
+///     The bring-up timer event handler, which retries the bring-up while the networking stack
+///     is not ready.
 /// </summary>
-static void CheckStatusTimerEventHandler(EventLoopTimer *timer)
+static void BringUpTimerEventHandler(EventLoopTimer *timer)
 {
     if (ConsumeEventLoopTimerEvent(timer) != 0) {
         exitCode = ExitCode_TimerHandler_Consume;
         return;
     }
 
-    // Check whether the network stack is ready.
-    if (!isNetworkStackReady) {
-        ExitCode localExitCode = CheckNetworkStackStatusAndLaunchServers();
-        if (localExitCode != ExitCode_Success) {
-            exitCode = localExitCode;
-            return;
-        }
+    ExitCode localExitCode = AdvanceBringUp();
+    if (localExitCode != ExitCode_Success) {
+        exitCode = localExitCode;
     }
 }
 
@@ -392,15 +639,19 @@ static ExitCode InitializeAndLaunchServers(void)
         return ExitCode_InitLaunch_EventLoop;
     }
 
-    // Check network interface status at the specified period until it is ready.
-    static const struct timespec checkInterval = {.tv_sec = 1, .tv_nsec = 0};
-    checkStatusTimer =
-        CreateEventLoopPeriodicTimer(eventLoop, CheckStatusTimerEventHandler, &checkInterval);
-    if (checkStatusTimer == NULL) {
+    // Messages from the client handlers are written from the event loop.
+    if (AsyncLog_Initialize(eventLoop) != 0) {
+        return ExitCode_InitLaunch_AsyncLog;
+    }
+
+    // Bring up the private network, retrying with this timer while the networking stack is not
+    // ready.
+    bringUpTimer = CreateEventLoopDisarmedTimer(eventLoop, BringUpTimerEventHandler);
+    if (bringUpTimer == NULL) {
         return ExitCode_InitLaunch_Timer;
     }
 
-    return ExitCode_Success;
+    return AdvanceBringUp();
 }
 
 /// <summary>
@@ -408,6 +659,7 @@ static ExitCode InitializeAndLaunchServers(void)
 /// </summary>
 int main(int argc, char *argv[])
 {
+    clock_gettime(CLOCK_MONOTONIC, &applicationStartTime);
     Log_Debug("INFO: Private Ethernet TCP server application starting.\n");
     exitCode = InitializeAndLaunchServers();
 
@@ -0,0 +1,681 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#define _GNU_SOURCE // required for accept4
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <stddef.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+
+#include <applibs/log.h>
+
+#include "tcp_service.h"
+
+// Period at which connections are checked for being idle.
+static const struct timespec idleCheckPeriod = {.tv_sec = 1, .tv_nsec = 0};
+
+// Support functions.
+static void HandleListenEvent(EventLoop *el, int fd, EventLoop_IoEvents events, void *context);
+static void UpdateAccepting(TcpService_ServerState *serverState);
+static void LaunchRead(TcpService_Connection *connection);
+static void HandleClientEvent(EventLoop *el, int fd, EventLoop_IoEvents events, void *context);
+static void ServiceClient(TcpService_Connection *connection);
+static bool ReadRequestFromClient(TcpService_Connection *connection, size_t *requestSize);
+static bool HasRoomForResponse(TcpService_Connection *connection);
+static bool LaunchWrite(TcpService_Connection *connection, size_t requestSize);
+static bool WritePayloadToClient(TcpService_Connection *connection);
+static void CloseConnection(TcpService_Connection *connection);
+static void HandleIdleTimerEvent(EventLoop *el, int fd, EventLoop_IoEvents events, void *context);
+static void SetIdleTimerArmed(TcpService_ServerState *serverState, bool armed);
+static int OpenIpV4Socket(in_addr_t ipAddr, uint16_t port, int sockType, ExitCode *callerExitCode);
+static void ReportError(const char *desc);
+static void StopServer(TcpService_ServerState *serverState, TcpService_StopReason reason);
+
+TcpService_ServerState *TcpService_Start(EventLoop *eventLoopInstance, in_addr_t ipAddr,
+                                         uint16_t port, int backlogSize, size_t maxConnections,
+                                         unsigned int idleTimeoutSeconds,
+                                         const TcpService_Protocol *protocol, void *context,
+                                         void (*shutdownCallback)(TcpService_StopReason),
+                                         ExitCode *callerExitCode)
+{
+    if (protocol->maxResponseSize == 0 ||
+        protocol->maxResponseSize > TCP_SERVICE_TX_BUFFER_SIZE) {
+        Log_Debug("ERROR: TCP server (%s): Maximum response size must be between 1 and %d.\n",
+                  protocol->name, TCP_SERVICE_TX_BUFFER_SIZE);
+        *callerExitCode = ExitCode_TcpServiceStart_MaxResponseSize;
+        return NULL;
+    }
+
+    if (maxConnections == 0 || maxConnections > TCP_SERVICE_MAX_CONNECTIONS) {
+        Log_Debug("ERROR: TCP server: Maximum connections must be between 1 and %d.\n",
+                  TCP_SERVICE_MAX_CONNECTIONS);
+        *callerExitCode = ExitCode_TcpServiceStart_MaxConnections;
+        return NULL;
+    }
+
+    TcpService_ServerState *serverState = malloc(sizeof(*serverState));
+    if (!serverState) {
+        abort();
+    }
+
+    // Set TcpService_ServerState state to unused values so it can be safely cleaned up if only a
+    // subset of the resources are successfully allocated.
+    serverState->eventLoop = eventLoopInstance;
+    serverState->protocol = protocol;
+    serverState->context = context;
+    serverState->listenFd = -1;
+    serverState->listenEventReg = NULL;
+    serverState->accepting = true;
+    for (size_t i = 0; i < TCP_SERVICE_MAX_CONNECTIONS; ++i) {
+        serverState->connections[i].server = serverState;
+        serverState->connections[i].clientFd = -1;
+        serverState->connections[i].clientEventReg = NULL;
+    }
+    serverState->maxConnections = maxConnections;
+    serverState->connectionCount = 0;
+    serverState->idleTimeoutSeconds = idleTimeoutSeconds;
+    serverState->idleTimerFd = -1;
+    serverState->idleTimerEventReg = NULL;
+    memset(&serverState->metrics, 0, sizeof(serverState->metrics));
+    clock_gettime(CLOCK_MONOTONIC, &serverState->metrics.startedAt);
+    serverState->shutdownCallback = shutdownCallback;
+
+    int sockType = SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK;
+    serverState->listenFd = OpenIpV4Socket(ipAddr, port, sockType, callerExitCode);
+    if (serverState->listenFd == -1) {
+        ReportError("open socket");
+        goto fail;
+    }
+
+    // Be notified asynchronously when a client connects.
+    serverState->listenEventReg = EventLoop_RegisterIo(
+        eventLoopInstance, serverState->listenFd, EventLoop_Input, HandleListenEvent, serverState);
+    if (serverState->listenEventReg == NULL) {
+        ReportError("register listen event");
+        goto fail;
+    }
+
+    // Check periodically for idle connections while there are any.
+    if (idleTimeoutSeconds > 0) {
+        serverState->idleTimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (serverState->idleTimerFd == -1) {
+            ReportError("timerfd_create");
+            *callerExitCode = ExitCode_TcpServiceStart_IdleTimer;
+            goto fail;
+        }
+
+        serverState->idleTimerEventReg =
+            EventLoop_RegisterIo(eventLoopInstance, serverState->idleTimerFd, EventLoop_Input,
+                                 HandleIdleTimerEvent, serverState);
+        if (serverState->idleTimerEventReg == NULL) {
+            ReportError("register idle timer event");
+            *callerExitCode = ExitCode_TcpServiceStart_IdleTimer;
+            goto fail;
+        }
+    }
+
+    int result = listen(serverState->listenFd, backlogSize);
+    if (result != 0) {
+        ReportError("listen");
+        *callerExitCode = ExitCode_TcpServiceStart_Listen;
+        goto fail;
+    }
+
+    Log_Debug("INFO: TCP server (%s): Listening on port %u for up to %zu client connections "
+              "(fd %d).\n",
+              protocol->name, port, maxConnections, serverState->listenFd);
+
+    return serverState;
+
+fail:
+    TcpService_ShutDown(serverState);
+    return NULL;
+}
+
+static void CloseFdAndPrintError(int fd, const char *fdName)
+{
+    if (fd >= 0) {
+        int result = close(fd);
+        if (result != 0) {
+            Log_Debug("ERROR: Could not close fd %s: %s (%d).\n", fdName, strerror(errno), errno);
+        }
+    }
+}
+
+void TcpService_ShutDown(TcpService_ServerState *serverState)
+{
+    if (!serverState) {
+        return;
+    }
+
+    for (size_t i = 0; i < TCP_SERVICE_MAX_CONNECTIONS; ++i) {
+        TcpService_Connection *connection = &serverState->connections[i];
+        EventLoop_UnregisterIo(serverState->eventLoop, connection->clientEventReg);
+        CloseFdAndPrintError(connection->clientFd, "clientFd");
+    }
+
+    EventLoop_UnregisterIo(serverState->eventLoop, serverState->idleTimerEventReg);
+    CloseFdAndPrintError(serverState->idleTimerFd, "idleTimerFd");
+
+    EventLoop_UnregisterIo(serverState->eventLoop, serverState->listenEventReg);
+    CloseFdAndPrintError(serverState->listenFd, "listenFd");
+
+    free(serverState);
+}
+
+static void HandleListenEvent(EventLoop *el, int fd, EventLoop_IoEvents events, void *context)
+{
+    TcpService_ServerState *serverState = (TcpService_ServerState *)context;
+
+    // Accept all the pending connections for which there is room.
+    while (serverState->connectionCount < serverState->maxConnections) {
+        // Create a new accepted socket to connect to the client.
+        // The newly-accepted sockets should be opened in non-blocking mode.
+        struct sockaddr in_addr;
+        socklen_t sockLen = sizeof(in_addr);
+        int localFd =
+            accept4(serverState->listenFd, &in_addr, &sockLen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (localFd == -1) {
+            if (errno != EAGAIN) {
+                ReportError("accept");
+            }
+            break;
+        }
+
+        // Find an unused connection; there is one, because the pool is not full.
+        TcpService_Connection *connection = NULL;
+        for (size_t i = 0; i < serverState->maxConnections; ++i) {
+            if (serverState->connections[i].clientFd == -1) {
+                connection = &serverState->connections[i];
+                break;
+            }
+        }
+
+        connection->clientEventReg = EventLoop_RegisterIo(serverState->eventLoop, localFd, 0x0,
+                                                          HandleClientEvent, connection);
+        if (connection->clientEventReg == NULL) {
+            ReportError("register client event");
+            close(localFd);
+            break;
+        }
+
+        // Socket opened successfully, so transfer ownership to the connection.
+        connection->clientFd = localFd;
+        ++serverState->connectionCount;
+        ++serverState->metrics.connectionsAccepted;
+        if (serverState->connectionCount == 1) {
+            SetIdleTimerArmed(serverState, true);
+        }
+
+        Log_Debug("INFO: TCP server (%s): Accepted client connection (fd %d); %zu of %zu in "
+                  "use.\n",
+                  serverState->protocol->name, localFd, serverState->connectionCount,
+                  serverState->maxConnections);
+
+        LaunchRead(connection);
+    }
+
+    UpdateAccepting(serverState);
+}
+
+/// <summary>
+///     Stops accepting connections while all the connections are in use, and resumes when one
+///     becomes free. Clients which connect meanwhile wait in the listen backlog.
+/// </summary>
+static void UpdateAccepting(TcpService_ServerState *serverState)
+{
+    bool accepting = serverState->connectionCount < serverState->maxConnections;
+    if (accepting == serverState->accepting) {
+        return;
+    }
+
+    serverState->accepting = accepting;
+    if (!accepting) {
+        Log_Debug("INFO: TCP server: All connections in use; not accepting more clients.\n");
+    }
+    EventLoop_ModifyIoEvents(serverState->eventLoop, serverState->listenEventReg,
+                             accepting ? EventLoop_Input : EventLoop_None);
+}
+
+static void LaunchRead(TcpService_Connection *connection)
+{
+    connection->closeAfterResponses = false;
+    connection->rxStart = 0;
+    connection->rxEnd = 0;
+    connection->txPayloadSize = 0;
+    connection->txBytesSent = 0;
+    clock_gettime(CLOCK_MONOTONIC, &connection->lastActivity);
+    memset(&connection->metrics, 0, sizeof(connection->metrics));
+    connection->metrics.connectedAt = connection->lastActivity;
+
+    ServiceClient(connection);
+}
+
+static void HandleClientEvent(EventLoop *el, int fd, EventLoop_IoEvents events, void *context)
+{
+    TcpService_Connection *connection = context;
+
+    // Both EventLoop_Input and EventLoop_Output are requested while responses are being written
+    // and there is room to queue more, so that either can make progress.
+    if (events & (EventLoop_Input | EventLoop_Output)) {
+        ServiceClient(connection);
+    }
+}
+
+/// <summary>
+///     <para>
+///         Reads requests from the client and writes responses to them, until the connection
+///         must wait for the client socket or it is closed. Requests which are already buffered
+///         are handled in turn without waiting for another event, and further requests are read
+///         while earlier responses are still being written, until the response buffer is full.
+///     </para>
+///     <param name="connection">The connection to the client which should be serviced.</param>
+/// </summary>
+static void ServiceClient(TcpService_Connection *connection)
+{
+    bool waitForInput = false;
+
+    while (true) {
+        if (!WritePayloadToClient(connection)) {
+            return;
+        }
+
+        if (connection->closeAfterResponses) {
+            if (connection->txPayloadSize == 0) {
+                CloseConnection(connection);
+                return;
+            }
+            break;
+        }
+
+        // If the client is not reading its responses then stop reading its requests.
+        if (!HasRoomForResponse(connection)) {
+            break;
+        }
+
+        size_t requestSize;
+        if (!ReadRequestFromClient(connection, &requestSize)) {
+            if (connection->clientFd == -1) {
+                return;
+            }
+            waitForInput = true;
+            break;
+        }
+
+        if (!LaunchWrite(connection, requestSize)) {
+            return;
+        }
+    }
+
+    EventLoop_IoEvents events = waitForInput ? EventLoop_Input : EventLoop_None;
+    if (connection->txBytesSent < connection->txPayloadSize) {
+        events |= EventLoop_Output;
+    }
+    EventLoop_ModifyIoEvents(connection->server->eventLoop, connection->clientEventReg, events);
+}
+
+/// <summary>
+///     <para>
+///         Finds the next request from the client. Input is received in bulk into rxBuffer, in
+///         which the protocol finds where the request ends; any bytes after the request are kept
+///         for the next request.
+///     </para>
+///     <param name="connection">The connection to the client which should be read.</param>
+///     <param name="requestSize">Receives the size of the request, which starts at rxStart.</param>
+///     <returns>
+///         true if a complete request is in the receive buffer; false if the connection is
+///         waiting for more input, in which case it should wait for EventLoop_Input, or it has
+///         been closed.
+///     </returns>
+/// </summary>
+static bool ReadRequestFromClient(TcpService_Connection *connection, size_t *requestSize)
+{
+    TcpService_ServerState *serverState = connection->server;
+
+    // Continue until have a complete request, no immediately available input or an error occurs.
+    while (true) {
+        if (connection->rxStart < connection->rxEnd) {
+            ssize_t result =
+                serverState->protocol->findRequest(&connection->rxBuffer[connection->rxStart],
+                                                   connection->rxEnd - connection->rxStart);
+            if (result > 0) {
+                *requestSize = (size_t)result;
+                return true;
+            }
+            if (result < 0) {
+                Log_Debug("ERROR: TCP server (%s): Invalid request (fd %d).\n",
+                          serverState->protocol->name, connection->clientFd);
+                ++serverState->metrics.invalidRequests;
+                CloseConnection(connection);
+                return false;
+            }
+        }
+
+        // Move the start of an incomplete request to the start of the buffer, to make room for
+        // the rest of it.
+        size_t pendingBytes = connection->rxEnd - connection->rxStart;
+        if (connection->rxStart > 0) {
+            memmove(connection->rxBuffer, &connection->rxBuffer[connection->rxStart],
+                    pendingBytes);
+            connection->rxStart = 0;
+            connection->rxEnd = pendingBytes;
+        }
+        if (pendingBytes == sizeof(connection->rxBuffer)) {
+            Log_Debug("ERROR: TCP server (%s): Request is larger than %zu bytes (fd %d).\n",
+                      serverState->protocol->name, sizeof(connection->rxBuffer),
+                      connection->clientFd);
+            ++serverState->metrics.invalidRequests;
+            CloseConnection(connection);
+            return false;
+        }
+
+        // Receive as much as is available.
+        ssize_t bytesReadOneSysCall =
+            recv(connection->clientFd, &connection->rxBuffer[pendingBytes],
+                 sizeof(connection->rxBuffer) - pendingBytes, /* flags */ 0);
+
+        if (bytesReadOneSysCall > 0) {
+            connection->rxEnd += (size_t)bytesReadOneSysCall;
+            connection->metrics.bytesReceived += (size_t)bytesReadOneSysCall;
+            serverState->metrics.bytesReceived += (size_t)bytesReadOneSysCall;
+            clock_gettime(CLOCK_MONOTONIC, &connection->lastActivity);
+        }
+
+        // If client has shut down cleanly then close the connection.
+        else if (bytesReadOneSysCall == 0) {
+            Log_Debug("INFO: TCP server (%s): Client has closed connection (fd %d).\n",
+                      serverState->protocol->name, connection->clientFd);
+            CloseConnection(connection);
+            return false;
+        }
+
+        // If receive buffer is empty then wait for EventLoop_Input event.
+        else if (errno == EAGAIN) {
+            return false;
+        }
+
+        // Another error occured so close the connection.
+        else {
+            ReportError("recv");
+            CloseConnection(connection);
+            return false;
+        }
+    }
+}
+
+/// <summary>
+///     Checks whether the largest response fits after the responses which are still being
+///     written, moving those to the start of the buffer if that makes room.
+/// </summary>
+static bool HasRoomForResponse(TcpService_Connection *connection)
+{
+    size_t maxResponseSize = connection->server->protocol->maxResponseSize;
+    if (sizeof(connection->txPayload) - connection->txPayloadSize >= maxResponseSize) {
+        return true;
+    }
+
+    size_t unsentBytes = connection->txPayloadSize - connection->txBytesSent;
+    if (sizeof(connection->txPayload) - unsentBytes < maxResponseSize) {
+        return false;
+    }
+    memmove(connection->txPayload, &connection->txPayload[connection->txBytesSent], unsentBytes);
+    connection->txPayloadSize = unsentBytes;
+    connection->txBytesSent = 0;
+    return true;
+}
+
+/// <summary>
+///     <para>
+///         Handles the request which has been received from the client, formatting its response
+///         after the responses which are still being written. There must be room for it.
+///     </para>
+///     <param name="connection">The connection to the client to send the response to.</param>
+///     <param name="requestSize">Size of the request, which starts at rxStart.</param>
+///     <returns>
+///         true if the request has been handled; false if the connection has been closed.
+///     </returns>
+/// </summary>
+static bool LaunchWrite(TcpService_Connection *connection, size_t requestSize)
+{
+    TcpService_ServerState *serverState = connection->server;
+
+    const uint8_t *request = &connection->rxBuffer[connection->rxStart];
+    connection->rxStart += requestSize;
+    ++connection->metrics.requests;
+    ++serverState->metrics.requests;
+
+    ssize_t responseSize = serverState->protocol->handleRequest(
+        connection, request, requestSize, &connection->txPayload[connection->txPayloadSize],
+        sizeof(connection->txPayload) - connection->txPayloadSize, serverState->context);
+    if (responseSize < 0) {
+        CloseConnection(connection);
+        return false;
+    }
+
+    connection->txPayloadSize += (size_t)responseSize;
+    return true;
+}
+/// <summary>
+///     <para>
+///         Called to write the queued responses, or to continue writing them when the client
+///         socket receives a write event.
+///     </para>
+///     <param name="connection">
+///         The connection to the client which should be sent the message.
+///     </param>
+///     <returns>
+///         true if the responses have been written, or the connection is waiting for the socket
+///         to become writable; false if the connection has been closed.
+///     </returns>
+/// </summary>
+static bool WritePayloadToClient(TcpService_Connection *connection)
+{
+    // Continue until have written entire response, error occurs, or OS TX buffer is full.
+    while (connection->txBytesSent < connection->txPayloadSize) {
+        size_t remainingBytes = connection->txPayloadSize - connection->txBytesSent;
+        const uint8_t *data = &connection->txPayload[connection->txBytesSent];
+        ssize_t bytesSentOneSysCall =
+            send(connection->clientFd, data, remainingBytes, /* flags */ 0);
+
+        // If successfully sent data then stay in loop and try to send more data.
+        if (bytesSentOneSysCall > 0) {
+            connection->txBytesSent += (size_t)bytesSentOneSysCall;
+            connection->metrics.bytesSent += (size_t)bytesSentOneSysCall;
+            connection->server->metrics.bytesSent += (size_t)bytesSentOneSysCall;
+            clock_gettime(CLOCK_MONOTONIC, &connection->lastActivity);
+        }
+
+        // If OS TX buffer is full then wait for next EventLoop_Output.
+        else if (bytesSentOneSysCall < 0 && errno == EAGAIN) {
+            return true;
+        }
+
+        // Another error occurred so close the connection.
+        else {
+            ReportError("send");
+            CloseConnection(connection);
+            return false;
+        }
+    }
+
+    // If reached here then successfully sent entire payload.
+    connection->txPayloadSize = 0;
+    connection->txBytesSent = 0;
+    return true;
+}
+
+/// <summary>
+///     Closes a connection to a client, and returns it to the pool.
+/// </summary>
+static void CloseConnection(TcpService_Connection *connection)
+{
+    TcpService_ServerState *serverState = connection->server;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    Log_Debug("INFO: TCP server (%s): Closing connection (fd %d) after %ld s: %u requests, "
+              "%llu bytes received, %llu bytes sent.\n",
+              serverState->protocol->name, connection->clientFd,
+              (long)(now.tv_sec - connection->metrics.connectedAt.tv_sec),
+              connection->metrics.requests, (unsigned long long)connection->metrics.bytesReceived,
+              (unsigned long long)connection->metrics.bytesSent);
+
+    EventLoop_UnregisterIo(serverState->eventLoop, connection->clientEventReg);
+    connection->clientEventReg = NULL;
+    CloseFdAndPrintError(connection->clientFd, "clientFd");
+    connection->clientFd = -1;
+
+    --serverState->connectionCount;
+    if (serverState->connectionCount == 0) {
+        SetIdleTimerArmed(serverState, false);
+    }
+
+    UpdateAccepting(serverState);
+}
+
+/// <summary>
+///     Closes the connections to clients from which no data has been received, and to which no
+///     data has been sent, for the idle timeout.
+/// </summary>
+static void HandleIdleTimerEvent(EventLoop *el, int fd, EventLoop_IoEvents events, void *context)
+{
+    TcpService_ServerState *serverState = context;
+
+    uint64_t expirations;
+    if (read(fd, &expirations, sizeof(expirations)) == -1) {
+        ReportError("read idle timer");
+        StopServer(serverState, TcpService_StopReason_Error);
+        return;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    for (size_t i = 0; i < serverState->maxConnections; ++i) {
+        TcpService_Connection *connection = &serverState->connections[i];
+        if (connection->clientFd != -1 &&
+            now.tv_sec - connection->lastActivity.tv_sec >= serverState->idleTimeoutSeconds) {
+            Log_Debug("INFO: TCP server: Closing idle client connection (fd %d).\n",
+                      connection->clientFd);
+            CloseConnection(connection);
+        }
+    }
+}
+
+/// <summary>
+///     Starts or stops the periodic check for idle connections.
+/// </summary>
+static void SetIdleTimerArmed(TcpService_ServerState *serverState, bool armed)
+{
+    if (serverState->idleTimerFd == -1) {
+        return;
+    }
+
+    struct itimerspec timerSpec;
+    memset(&timerSpec, 0, sizeof(timerSpec));
+    if (armed) {
+        timerSpec.it_value = idleCheckPeriod;
+        timerSpec.it_interval = idleCheckPeriod;
+    }
+
+    if (timerfd_settime(serverState->idleTimerFd, /* flags */ 0, &timerSpec, NULL) != 0) {
+        ReportError("timerfd_settime");
+    }
+}
+
+static int OpenIpV4Socket(in_addr_t ipAddr, uint16_t port, int sockType, ExitCode *callerExitCode)
+{
+    int localFd = -1;
+    int retFd = -1;
+
+    do {
+        // Create a TCP / IPv4 socket. This will form the listen socket.
+        localFd = socket(AF_INET, sockType, /* protocol */ 0);
+        if (localFd == -1) {
+            ReportError("socket");
+            *callerExitCode = ExitCode_OpenIpV4_Socket;
+            break;
+        }
+
+        // Enable rebinding soon after a socket has been closed.
+        int enableReuseAddr = 1;
+        int r = setsockopt(localFd, SOL_SOCKET, SO_REUSEADDR, &enableReuseAddr,
+                           sizeof(enableReuseAddr));
+        if (r != 0) {
+            ReportError("setsockopt/SO_REUSEADDR");
+            *callerExitCode = ExitCode_OpenIpV4_SetSockOpt;
+            break;
+        }
+
+        // Bind to a well-known IP address.
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = ipAddr;
+        addr.sin_port = htons(port);
+
+        r = bind(localFd, (const struct sockaddr *)&addr, sizeof(addr));
+        if (r != 0) {
+            ReportError("bind");
+            *callerExitCode = ExitCode_OpenIpV4_Bind;
+            break;
+        }
+
+        // Port opened successfully.
+        retFd = localFd;
+        localFd = -1;
+    } while (0);
+
+    close(localFd);
+
+    return retFd;
+}
+
+static void ReportError(const char *desc)
+{
+    Log_Debug("ERROR: TCP server: \"%s\", errno=%d (%s)\n", desc, errno, strerror(errno));
+}
+
+static void StopServer(TcpService_ServerState *serverState, TcpService_StopReason reason)
+{
+    for (size_t i = 0; i < TCP_SERVICE_MAX_CONNECTIONS; ++i) {
+        TcpService_Connection *connection = &serverState->connections[i];
+        if (connection->clientEventReg != NULL) {
+            EventLoop_ModifyIoEvents(serverState->eventLoop, connection->clientEventReg,
+                                     EventLoop_None);
+        }
+    }
+
+    if (serverState->listenEventReg != NULL) {
+        EventLoop_ModifyIoEvents(serverState->eventLoop, serverState->listenEventReg,
+                                 EventLoop_None);
+    }
+
+    serverState->shutdownCallback(reason);
+}
+
+void TcpService_CloseAfterResponses(TcpService_Connection *connection)
+{
+    connection->closeAfterResponses = true;
+}
+
+void TcpService_GetMetrics(const TcpService_ServerState *serverState, TcpService_Metrics *metrics)
+{
+    *metrics = serverState->metrics;
+    metrics->connectionsOpen = (uint32_t)serverState->connectionCount;
+}
+
+bool TcpService_GetConnectionMetrics(const TcpService_ServerState *serverState, size_t index,
+                                     TcpService_ConnectionMetrics *metrics)
+{
+    if (index >= TCP_SERVICE_MAX_CONNECTIONS || serverState->connections[index].clientFd == -1) {
+        return false;
+    }
+    *metrics = serverState->connections[index].metrics;
+    return true;
+}
@@ -0,0 +1,270 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "netinet/in.h"
+
+#include "eventloop_timer_utilities.h"
+#include "exitcode_privnetserv.h"
+
+// A TCP service accepts connections from clients on the private network, and answers each request
+// which a client sends with a response. The service handles the connections, their buffering and
+// their metrics; its protocol finds where each request ends in the bytes received from a client,
+// and handles it by formatting the response. tcp_service_protocols.h provides the framing of
+// line-based, length-prefixed binary and minimal HTTP/1.1 protocols.
+//
+// Each connection has fixed receive and transmit buffers. A client may send further requests
+// before it has read the responses to earlier ones: they are handled while the earlier responses
+// are still being sent, until the transmit buffer has no room for another response.
+
+/// <summary>Maximum number of clients which a service can hold connections to at once.</summary>
+#define TCP_SERVICE_MAX_CONNECTIONS 8
+
+/// <summary>
+/// Size of the receive buffer of each connection, in bytes, which limits the size of a request.
+/// </summary>
+#define TCP_SERVICE_RX_BUFFER_SIZE 512
+
+/// <summary>
+/// Size of the transmit buffer of each connection, in bytes, which limits the size of a response.
+/// </summary>
+#define TCP_SERVICE_TX_BUFFER_SIZE 1024
+
+/// <summary>Reason why a TCP service stopped.</summary>
+typedef enum {
+    /// <summary>The service stopped because an error occurred.</summary>
+    TcpService_StopReason_Error
+} TcpService_StopReason;
+
+struct TcpService_ServerState;
+struct TcpService_Connection;
+
+/// <summary>
+/// How a service frames and answers requests. The functions are called from the event loop.
+/// </summary>
+typedef struct {
+    /// <summary>Name of the protocol, which identifies the service in log messages.</summary>
+    const char *name;
+    /// <summary>
+    ///     <para>Finds where the first request in the bytes received from a client ends.</para>
+    ///     <param name="data">The bytes which have been received and not yet handled.</param>
+    ///     <param name="size">Number of bytes; at least one.</param>
+    ///     <returns>
+    ///         The size of the request, if it is complete; 0 if more bytes are needed; or -1 if
+    ///         the bytes are not a valid request, in which case the connection is closed.
+    ///     </returns>
+    /// </summary>
+    ssize_t (*findRequest)(const uint8_t *data, size_t size);
+    /// <summary>
+    ///     <para>Handles a complete request by formatting its response.</para>
+    ///     <param name="connection">The connection which received the request.</param>
+    ///     <param name="request">The request, as found by findRequest.</param>
+    ///     <param name="requestSize">Size of the request in bytes.</param>
+    ///     <param name="response">Buffer into which the response is written.</param>
+    ///     <param name="responseSize">
+    ///         Size of the buffer; at least maxResponseSize bytes.
+    ///     </param>
+    ///     <param name="context">Context which the service was started with.</param>
+    ///     <returns>
+    ///         The size of the response, which may be 0 if the request has no response; or -1 if
+    ///         the connection should be closed.
+    ///     </returns>
+    /// </summary>
+    ssize_t (*handleRequest)(struct TcpService_Connection *connection, const uint8_t *request,
+                             size_t requestSize, uint8_t *response, size_t responseSize,
+                             void *context);
+    /// <summary>
+    ///     Size of the largest response, in bytes; at most TCP_SERVICE_TX_BUFFER_SIZE. A request
+    ///     is only handled once there is this much room in the transmit buffer.
+    /// </summary>
+    size_t maxResponseSize;
+} TcpService_Protocol;
+
+/// <summary>Throughput metrics of one connection.</summary>
+typedef struct {
+    /// <summary>When the connection was accepted.</summary>
+    struct timespec connectedAt;
+    /// <summary>Number of bytes received from the client.</summary>
+    uint64_t bytesReceived;
+    /// <summary>Number of bytes sent to the client.</summary>
+    uint64_t bytesSent;
+    /// <summary>Number of requests which have been handled.</summary>
+    uint32_t requests;
+} TcpService_ConnectionMetrics;
+
+/// <summary>Throughput metrics of a service, since it was started.</summary>
+typedef struct {
+    /// <summary>When the service was started.</summary>
+    struct timespec startedAt;
+    /// <summary>Number of connections which have been accepted.</summary>
+    uint32_t connectionsAccepted;
+    /// <summary>Number of connections which are open.</summary>
+    uint32_t connectionsOpen;
+    /// <summary>Number of bytes received from all clients.</summary>
+    uint64_t bytesReceived;
+    /// <summary>Number of bytes sent to all clients.</summary>
+    uint64_t bytesSent;
+    /// <summary>Number of requests which have been handled.</summary>
+    uint32_t requests;
+    /// <summary>Number of requests which were invalid, and whose connections were closed.</summary>
+    uint32_t invalidRequests;
+} TcpService_Metrics;
+
+/// <summary>
+/// State about one connection to a client. Each connection has its own buffers, so that clients
+/// are served independently of each other.
+/// </summary>
+typedef struct TcpService_Connection {
+    /// <summary>Service which accepted the connection.</summary>
+    struct TcpService_ServerState *server;
+    /// <summary>Accept socket, or -1 if this connection is not in use.</summary>
+    int clientFd;
+    /// <summary>
+    ///     Invoked when server receives data from or sends data to the client.
+    /// </summary>
+    EventRegistration *clientEventReg;
+    /// <summary>When data was last received from or sent to the client.</summary>
+    struct timespec lastActivity;
+    /// <summary>
+    ///     Whether the connection is closed once the responses have been sent, in which case no
+    ///     further requests are read.
+    /// </summary>
+    bool closeAfterResponses;
+    /// <summary>
+    ///     Bytes received from the client in bulk, which have not yet been handled. Bytes which
+    ///     follow the end of one request are kept here for the next request.
+    /// </summary>
+    uint8_t rxBuffer[TCP_SERVICE_RX_BUFFER_SIZE];
+    /// <summary>Offset of the first byte in rxBuffer which has not been handled.</summary>
+    size_t rxStart;
+    /// <summary>Offset after the last byte received into rxBuffer.</summary>
+    size_t rxEnd;
+    /// <summary>
+    ///     Responses to write to client. Each response is formatted directly after those which
+    ///     are still being written, so that further requests are read while earlier responses
+    ///     drain.
+    /// </summary>
+    uint8_t txPayload[TCP_SERVICE_TX_BUFFER_SIZE];
+    /// <summary>Number of bytes to write to client; zero if there is no response.</summary>
+    size_t txPayloadSize;
+    /// <summary>Number of characters from paylod which have been written to client so
+    /// far.</summary>
+    size_t txBytesSent;
+    /// <summary>Throughput of the connection.</summary>
+    TcpService_ConnectionMetrics metrics;
+} TcpService_Connection;
+
+/// <summary>
+/// Bundles together state about an active TCP service.
+/// This should be allocated with <see cref="TcpService_Start" /> and freed with
+/// <see cref="TcpService_ShutDown" />. The client should not directly modify member variables.
+/// </summary>
+typedef struct TcpService_ServerState {
+    /// <summary>Used to respond asynchronously to incoming connections.</summary>
+    EventLoop *eventLoop;
+    /// <summary>How requests are framed and answered.</summary>
+    const TcpService_Protocol *protocol;
+    /// <summary>Context which is passed to the protocol's request handler.</summary>
+    void *context;
+    /// <summary>Socket which listens for incoming connections.</summary>
+    int listenFd;
+    /// <summary>Invoked when a new connection is received.</summary>
+    EventRegistration *listenEventReg;
+    /// <summary>
+    ///     Whether new connections are being accepted. While all the connections are in use, the
+    ///     server stops accepting, so that further clients wait in the listen backlog.
+    /// </summary>
+    bool accepting;
+    /// <summary>Pool of connections to clients.</summary>
+    TcpService_Connection connections[TCP_SERVICE_MAX_CONNECTIONS];
+    /// <summary>Number of connections which may be in use at once.</summary>
+    size_t maxConnections;
+    /// <summary>Number of connections in use.</summary>
+    size_t connectionCount;
+    /// <summary>Connections idle for this many seconds are closed; 0 if they are never.</summary>
+    unsigned int idleTimeoutSeconds;
+    /// <summary>Timer file descriptor used to check periodically for idle connections.</summary>
+    int idleTimerFd;
+    /// <summary>Invoked when the idle connection check is due.</summary>
+    EventRegistration *idleTimerEventReg;
+    /// <summary>Throughput of the service.</summary>
+    TcpService_Metrics metrics;
+    /// <summary>
+    ///     <para>Callback to invoke when the server stops processing connections.</para>
+    ///     <para>
+    ///         When this callback is invoked, the owner should clean up the server with
+    ///         <see cref="TcpService_ShutDown" />.
+    ///     </para>
+    ///     <param name="reason">Why the server stopped.</param>
+    /// </summary>
+    void (*shutdownCallback)(TcpService_StopReason reason);
+} TcpService_ServerState;
+
+/// <summary>
+///     <para>Open a non-blocking TCP listening socket on the supplied IP address and port.</para>
+///     <param name="eventLoopInstance">Event loop which will invoke IO callbacks.</param>
+///     <param name="ipAddr">IP address to which the listen socket is bound.</param>
+///     <param name="port">TCP port to which the socket is bound.</param>
+///     <param name="backlogSize">Listening socket queue length.</param>
+///     <param name="maxConnections">
+///         Maximum number of clients to serve at once; at most TCP_SERVICE_MAX_CONNECTIONS.
+///     </param>
+///     <param name="idleTimeoutSeconds">
+///         Time after which a connection is closed if no data has been received from or sent to
+///         the client; 0 if connections are never closed for being idle.
+///     </param>
+///     <param name="protocol">How requests are framed and answered; must remain valid.</param>
+///     <param name="context">Context which is passed to the protocol's request handler.</param>
+///     <param name="shutdownCallback">Callback to invoke when server shuts down.</param>
+///     <param name="callerExitCode">
+///         On failure, set to specific failure code. Undefined on success.
+///     </param>
+///     <returns>
+///         Server state which is used to manage the server's resources, NULL on failure.
+///         Should be disposed of with <see cref="TcpService_ShutDown" />.
+///     </returns>
+/// </summary>
+TcpService_ServerState *TcpService_Start(EventLoop *eventLoopInstance, in_addr_t ipAddr,
+                                         uint16_t port, int backlogSize, size_t maxConnections,
+                                         unsigned int idleTimeoutSeconds,
+                                         const TcpService_Protocol *protocol, void *context,
+                                         void (*shutdownCallback)(TcpService_StopReason),
+                                         ExitCode *callerExitCode);
+
+/// <summary>
+/// <para>Closes any resources which were allocated by the supplied server. This includes
+/// closing listen and accepted sockets, and freeing any heap memory that was allocated.</para>
+/// <param name="serverState">Server state allocated with <see cref="TcpService_Start" />.</param>
+/// </summary>
+void TcpService_ShutDown(TcpService_ServerState *serverState);
+
+/// <summary>
+///     Closes a connection once the responses to the requests which have been handled have been
+///     sent, such as after an HTTP response with "Connection: close". No further requests are
+///     read from it.
+/// </summary>
+/// <param name="connection">The connection, as passed to the request handler.</param>
+void TcpService_CloseAfterResponses(TcpService_Connection *connection);
+
+/// <summary>
+///     Gets the throughput metrics of a service.
+/// </summary>
+/// <param name="serverState">The service.</param>
+/// <param name="metrics">Receives the metrics.</param>
+void TcpService_GetMetrics(const TcpService_ServerState *serverState, TcpService_Metrics *metrics);
+
+/// <summary>
+///     Gets the throughput metrics of one of the connections of a service.
+/// </summary>
+/// <param name="serverState">The service.</param>
+/// <param name="index">Index of the connection, less than TCP_SERVICE_MAX_CONNECTIONS.</param>
+/// <param name="metrics">Receives the metrics, if the connection is in use.</param>
+/// <returns>true if the connection is in use; false otherwise.</returns>
+bool TcpService_GetConnectionMetrics(const TcpService_ServerState *serverState, size_t index,
+                                     TcpService_ConnectionMetrics *metrics);
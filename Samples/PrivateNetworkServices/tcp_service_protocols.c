@@ -0,0 +1,249 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#define _GNU_SOURCE // required for memmem
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "tcp_service.h"
+#include "tcp_service_protocols.h"
+
+static const char httpHeaderEnd[] = "\r\n\r\n";
+
+ssize_t TcpService_FindLine(const uint8_t *data, size_t size)
+{
+    const uint8_t *end = memchr(data, '\n', size);
+    return (end != NULL) ? (ssize_t)(end - data + 1) : 0;
+}
+
+size_t TcpService_GetLineLength(const uint8_t *line, size_t size)
+{
+    size_t length = size - 1;
+    if (length > 0 && line[length - 1] == '\r') {
+        --length;
+    }
+    return length;
+}
+
+ssize_t TcpService_FindLengthPrefixed(const uint8_t *data, size_t size)
+{
+    if (size < TCP_SERVICE_LENGTH_PREFIX_SIZE) {
+        return 0;
+    }
+
+    size_t requestSize = TCP_SERVICE_LENGTH_PREFIX_SIZE + (((size_t)data[0] << 8) | data[1]);
+    if (requestSize > TCP_SERVICE_RX_BUFFER_SIZE) {
+        return -1;
+    }
+    return (size >= requestSize) ? (ssize_t)requestSize : 0;
+}
+
+const uint8_t *TcpService_GetLengthPrefixedPayload(const uint8_t *request, size_t *payloadSize)
+{
+    *payloadSize = ((size_t)request[0] << 8) | request[1];
+    return &request[TCP_SERVICE_LENGTH_PREFIX_SIZE];
+}
+
+ssize_t TcpService_CompleteLengthPrefixed(uint8_t *response, size_t payloadSize)
+{
+    response[0] = (uint8_t)(payloadSize >> 8);
+    response[1] = (uint8_t)payloadSize;
+    return (ssize_t)(TCP_SERVICE_LENGTH_PREFIX_SIZE + payloadSize);
+}
+
+/// <summary>
+///     Finds the value of a header, with the whitespace around it removed.
+/// </summary>
+/// <param name="headers">The header lines, each ended by "\r\n".</param>
+/// <param name="size">Size of the header lines.</param>
+/// <param name="name">The null-terminated name of the header, which is matched ignoring
+/// case.</param>
+/// <param name="valueLength">Receives the length of the value.</param>
+/// <returns>The value, which is not null-terminated, or NULL if there is no such header.</returns>
+static const char *FindHttpHeader(const char *headers, size_t size, const char *name,
+                                  size_t *valueLength)
+{
+    size_t nameLength = strlen(name);
+    const char *end = headers + size;
+
+    for (const char *line = headers; line < end;) {
+        const char *lineEnd = memmem(line, (size_t)(end - line), "\r\n", 2);
+        if (lineEnd == NULL) {
+            lineEnd = end;
+        }
+
+        if ((size_t)(lineEnd - line) > nameLength && line[nameLength] == ':' &&
+            strncasecmp(line, name, nameLength) == 0) {
+            const char *value = line + nameLength + 1;
+            while (value < lineEnd && (*value == ' ' || *value == '\t')) {
+                ++value;
+            }
+            const char *valueEnd = lineEnd;
+            while (valueEnd > value && (valueEnd[-1] == ' ' || valueEnd[-1] == '\t')) {
+                --valueEnd;
+            }
+            *valueLength = (size_t)(valueEnd - value);
+            return value;
+        }
+
+        line = lineEnd + 2;
+    }
+    return NULL;
+}
+
+/// <summary>
+///     Gets the header lines of a request, which follow its request line.
+/// </summary>
+static const char *GetHttpHeaders(const char *request, size_t headerEnd, size_t *size)
+{
+    const char *requestLineEnd = memmem(request, headerEnd, "\r\n", 2);
+    if (requestLineEnd == NULL) {
+        *size = 0;
+        return request + headerEnd;
+    }
+    const char *headers = requestLineEnd + 2;
+    *size = (size_t)(request + headerEnd - headers);
+    return headers;
+}
+
+ssize_t TcpService_FindHttpRequest(const uint8_t *data, size_t size)
+{
+    const char *request = (const char *)data;
+    const char *end = memmem(request, size, httpHeaderEnd, sizeof(httpHeaderEnd) - 1);
+    if (end == NULL) {
+        return 0;
+    }
+
+    // The header lines include the "\r\n" of the last one.
+    size_t headerEnd = (size_t)(end - request) + 2;
+    size_t headersSize;
+    const char *headers = GetHttpHeaders(request, headerEnd, &headersSize);
+
+    size_t valueLength;
+    if (FindHttpHeader(headers, headersSize, "Transfer-Encoding", &valueLength) != NULL) {
+        return -1;
+    }
+
+    size_t bodySize = 0;
+    const char *value = FindHttpHeader(headers, headersSize, "Content-Length", &valueLength);
+    if (value != NULL) {
+        for (size_t i = 0; i < valueLength; ++i) {
+            if (!isdigit((unsigned char)value[i]) || bodySize > TCP_SERVICE_RX_BUFFER_SIZE) {
+                return -1;
+            }
+            bodySize = bodySize * 10 + (size_t)(value[i] - '0');
+        }
+    }
+
+    size_t requestSize = headerEnd + 2 + bodySize;
+    if (requestSize > TCP_SERVICE_RX_BUFFER_SIZE) {
+        return -1;
+    }
+    return (size >= requestSize) ? (ssize_t)requestSize : 0;
+}
+
+int TcpService_ParseHttpRequest(const uint8_t *request, size_t size,
+                                TcpService_HttpRequest *httpRequest)
+{
+    const char *text = (const char *)request;
+    const char *end = memmem(text, size, httpHeaderEnd, sizeof(httpHeaderEnd) - 1);
+    const char *requestLineEnd = memmem(text, size, "\r\n", 2);
+    if (end == NULL || requestLineEnd == NULL) {
+        return -1;
+    }
+
+    // The request line is "<method> <path> <version>".
+    const char *methodEnd = memchr(text, ' ', (size_t)(requestLineEnd - text));
+    if (methodEnd == NULL || methodEnd == text) {
+        return -1;
+    }
+    const char *path = methodEnd + 1;
+    const char *pathEnd = memchr(path, ' ', (size_t)(requestLineEnd - path));
+    if (pathEnd == NULL || pathEnd == path) {
+        return -1;
+    }
+    const char *version = pathEnd + 1;
+    size_t versionLength = (size_t)(requestLineEnd - version);
+    if (versionLength < 5 || strncmp(version, "HTTP/", 5) != 0) {
+        return -1;
+    }
+
+    httpRequest->method = text;
+    httpRequest->methodLength = (size_t)(methodEnd - text);
+    httpRequest->path = path;
+    httpRequest->pathLength = (size_t)(pathEnd - path);
+
+    size_t headerEnd = (size_t)(end - text) + 2;
+    httpRequest->body = &request[headerEnd + 2];
+    httpRequest->bodySize = size - (headerEnd + 2);
+
+    // HTTP/1.1 connections are persistent unless either side closes them.
+    httpRequest->keepAlive = versionLength == 8 && strncmp(version, "HTTP/1.1", 8) == 0;
+    size_t headersSize;
+    const char *headers = GetHttpHeaders(text, headerEnd, &headersSize);
+    size_t valueLength;
+    const char *connection = FindHttpHeader(headers, headersSize, "Connection", &valueLength);
+    if (connection != NULL) {
+        if (valueLength == 5 && strncasecmp(connection, "close", 5) == 0) {
+            httpRequest->keepAlive = false;
+        } else if (valueLength == 10 && strncasecmp(connection, "keep-alive", 10) == 0) {
+            httpRequest->keepAlive = true;
+        }
+    }
+    return 0;
+}
+
+bool TcpService_IsHttpPath(const TcpService_HttpRequest *httpRequest, const char *path)
+{
+    const char *query = memchr(httpRequest->path, '?', httpRequest->pathLength);
+    size_t length =
+        (query != NULL) ? (size_t)(query - httpRequest->path) : httpRequest->pathLength;
+    return length == strlen(path) && strncmp(httpRequest->path, path, length) == 0;
+}
+
+static const char *GetHttpReason(int status)
+{
+    switch (status) {
+    case 200:
+        return "OK";
+    case 400:
+        return "Bad Request";
+    case 404:
+        return "Not Found";
+    case 405:
+        return "Method Not Allowed";
+    case 500:
+        return "Internal Server Error";
+    case 503:
+        return "Service Unavailable";
+    default:
+        return "Unknown";
+    }
+}
+
+ssize_t TcpService_FormatHttpResponse(uint8_t *response, size_t responseSize, int status,
+                                      const char *contentType, const void *body, size_t bodySize,
+                                      bool keepAlive)
+{
+    char headers[TCP_SERVICE_HTTP_HEADER_RESERVE];
+    int headersLength = snprintf(headers, sizeof(headers),
+                                 "HTTP/1.1 %d %s\r\n"
+                                 "Content-Type: %s\r\n"
+                                 "Content-Length: %zu\r\n"
+                                 "Connection: %s\r\n"
+                                 "\r\n",
+                                 status, GetHttpReason(status), contentType, bodySize,
+                                 keepAlive ? "keep-alive" : "close");
+    if (headersLength < 0 || (size_t)headersLength >= sizeof(headers) ||
+        (size_t)headersLength + bodySize > responseSize) {
+        return -1;
+    }
+
+    // The body may be in the response buffer, after the space reserved for the headers.
+    memmove(&response[headersLength], body, bodySize);
+    memcpy(response, headers, (size_t)headersLength);
+    return (ssize_t)((size_t)headersLength + bodySize);
+}
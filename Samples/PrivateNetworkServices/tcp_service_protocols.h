@@ -0,0 +1,135 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Framing of the requests and responses of common protocols, for use by the protocols of TCP
+// services. Each protocol's findRequest function can be used directly as the findRequest member
+// of a TcpService_Protocol, and its other functions help the request handler to parse a request
+// and to format its response in place in the response buffer.
+//
+//  - Line-based: each request is a line of text ended by "\n" or "\r\n".
+//  - Length-prefixed binary: each request and response is a payload preceded by its size, as a
+//    16-bit big-endian integer.
+//  - Minimal HTTP/1.1: each request has a request line, headers and an optional body whose size
+//    is given by Content-Length. Chunked bodies are not supported. Connections are kept open
+//    unless the client asks for them to be closed or uses HTTP/1.0.
+
+/// <summary>
+///     Finds the end of a line.
+/// </summary>
+/// <param name="data">The received bytes.</param>
+/// <param name="size">Number of bytes.</param>
+/// <returns>The size of the line including its ending, or 0 if the line is not complete.</returns>
+ssize_t TcpService_FindLine(const uint8_t *data, size_t size);
+
+/// <summary>
+///     Gets the length of a line which has been found, not including its ending.
+/// </summary>
+/// <param name="line">The line.</param>
+/// <param name="size">Size of the line including its ending.</param>
+/// <returns>The length of the text of the line.</returns>
+size_t TcpService_GetLineLength(const uint8_t *line, size_t size);
+
+/// <summary>Size of the length prefix of a binary request or response, in bytes.</summary>
+#define TCP_SERVICE_LENGTH_PREFIX_SIZE 2
+
+/// <summary>
+///     Finds the end of a length-prefixed request.
+/// </summary>
+/// <param name="data">The received bytes.</param>
+/// <param name="size">Number of bytes.</param>
+/// <returns>
+///     The size of the request including its prefix; 0 if the request is not complete; or -1 if
+///     it does not fit in the receive buffer.
+/// </returns>
+ssize_t TcpService_FindLengthPrefixed(const uint8_t *data, size_t size);
+
+/// <summary>
+///     Gets the payload of a length-prefixed request which has been found.
+/// </summary>
+/// <param name="request">The request.</param>
+/// <param name="payloadSize">Receives the size of the payload.</param>
+/// <returns>The payload, which follows the prefix.</returns>
+const uint8_t *TcpService_GetLengthPrefixedPayload(const uint8_t *request, size_t *payloadSize);
+
+/// <summary>
+///     Completes a length-prefixed response whose payload has been written into the response
+///     buffer after TCP_SERVICE_LENGTH_PREFIX_SIZE bytes.
+/// </summary>
+/// <param name="response">The response buffer.</param>
+/// <param name="payloadSize">Size of the payload, which must fit in 16 bits.</param>
+/// <returns>The size of the response including its prefix.</returns>
+ssize_t TcpService_CompleteLengthPrefixed(uint8_t *response, size_t payloadSize);
+
+/// <summary>
+/// Space to leave before the body of an HTTP response in the response buffer, so that the headers
+/// can be written before it without moving it to another buffer.
+/// </summary>
+#define TCP_SERVICE_HTTP_HEADER_RESERVE 160
+
+/// <summary>Parts of an HTTP request, which point into the request.</summary>
+typedef struct {
+    /// <summary>Method, such as "GET"; not null-terminated.</summary>
+    const char *method;
+    size_t methodLength;
+    /// <summary>Path, including any query; not null-terminated.</summary>
+    const char *path;
+    size_t pathLength;
+    /// <summary>Body, whose size is given by Content-Length.</summary>
+    const uint8_t *body;
+    size_t bodySize;
+    /// <summary>Whether the connection should be kept open after the response.</summary>
+    bool keepAlive;
+} TcpService_HttpRequest;
+
+/// <summary>
+///     Finds the end of an HTTP request, including its body.
+/// </summary>
+/// <param name="data">The received bytes.</param>
+/// <param name="size">Number of bytes.</param>
+/// <returns>
+///     The size of the request; 0 if the request is not complete; or -1 if it is not valid.
+/// </returns>
+ssize_t TcpService_FindHttpRequest(const uint8_t *data, size_t size);
+
+/// <summary>
+///     Parses an HTTP request which has been found.
+/// </summary>
+/// <param name="request">The request.</param>
+/// <param name="size">Size of the request.</param>
+/// <param name="httpRequest">Receives the parts of the request.</param>
+/// <returns>0 on success, or -1 if the request line is not valid.</returns>
+int TcpService_ParseHttpRequest(const uint8_t *request, size_t size,
+                                TcpService_HttpRequest *httpRequest);
+
+/// <summary>
+///     Checks whether the path of a request, without its query, is the given path.
+/// </summary>
+/// <param name="httpRequest">The parsed request.</param>
+/// <param name="path">The null-terminated path, such as "/metrics".</param>
+/// <returns>true if the paths match.</returns>
+bool TcpService_IsHttpPath(const TcpService_HttpRequest *httpRequest, const char *path);
+
+/// <summary>
+///     Formats an HTTP response with its headers and body.
+/// </summary>
+/// <param name="response">The response buffer.</param>
+/// <param name="responseSize">Size of the response buffer.</param>
+/// <param name="status">Status code, such as 200.</param>
+/// <param name="contentType">Value of the Content-Type header.</param>
+/// <param name="body">
+///     The body. It may be in the response buffer at TCP_SERVICE_HTTP_HEADER_RESERVE, in which
+///     case it is moved to follow the headers.
+/// </param>
+/// <param name="bodySize">Size of the body in bytes.</param>
+/// <param name="keepAlive">Whether the connection is kept open after the response.</param>
+/// <returns>The size of the response, or -1 if it does not fit in the buffer.</returns>
+ssize_t TcpService_FormatHttpResponse(uint8_t *response, size_t responseSize, int status,
+                                      const char *contentType, const void *body, size_t bodySize,
+                                      bool keepAlive);
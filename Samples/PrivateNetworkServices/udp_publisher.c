@@ -0,0 +1,254 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#define _GNU_SOURCE // required for sendmmsg
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <applibs/log.h>
+
+#include "udp_publisher.h"
+
+// Time to live of multicast datagrams, which keeps them on the private network.
+#define MULTICAST_TTL 1
+
+typedef struct {
+    size_t size;
+    uint8_t data[UDP_PUBLISHER_HEADER_SIZE + UDP_PUBLISHER_MAX_PAYLOAD_SIZE];
+} Frame;
+
+// Queue of frames which have been published and not yet sent, oldest first.
+static Frame queue[UDP_PUBLISHER_QUEUE_SIZE];
+static size_t queueStart = 0;
+static size_t queueCount = 0;
+
+static int socketFd = -1;
+static EventLoopTimer *pacingTimer = NULL;
+static struct sockaddr_in destination;
+static unsigned int framesPerSecond = 0;
+static uint32_t nextSequenceNumber = 0;
+static UdpPublisher_Stats stats;
+
+// Frames which may be sent now. Whole frames are added at the pacing rate, and the remainder is
+// kept in thousandths of a frame so that slow rates are paced accurately.
+static unsigned int tokens = 0;
+static unsigned int tokenRemainder = 0;
+static uint64_t lastRefillMs = 0;
+
+static uint64_t NowMs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000u + (uint64_t)now.tv_nsec / 1000000u;
+}
+
+static void PutUint16(uint8_t *buffer, uint16_t value)
+{
+    buffer[0] = (uint8_t)(value >> 8);
+    buffer[1] = (uint8_t)value;
+}
+
+static void PutUint32(uint8_t *buffer, uint32_t value)
+{
+    PutUint16(buffer, (uint16_t)(value >> 16));
+    PutUint16(&buffer[2], (uint16_t)value);
+}
+
+static void PutUint64(uint8_t *buffer, uint64_t value)
+{
+    PutUint32(buffer, (uint32_t)(value >> 32));
+    PutUint32(&buffer[4], (uint32_t)value);
+}
+
+/// <summary>
+///     Adds the frames which may be sent since the last refill, up to one batch.
+/// </summary>
+static void RefillTokens(void)
+{
+    uint64_t nowMs = NowMs();
+    uint64_t added = (nowMs - lastRefillMs) * framesPerSecond + tokenRemainder;
+    lastRefillMs = nowMs;
+
+    tokenRemainder = (unsigned int)(added % 1000u);
+    added /= 1000u;
+    tokens = (tokens + added > UDP_PUBLISHER_MAX_BATCH) ? UDP_PUBLISHER_MAX_BATCH
+                                                        : tokens + (unsigned int)added;
+}
+
+/// <summary>
+///     Sends a batch of the oldest queued frames, as many as the pacing allows.
+/// </summary>
+static void SendBatch(void)
+{
+    RefillTokens();
+
+    size_t count = queueCount < tokens ? queueCount : tokens;
+    if (count == 0) {
+        return;
+    }
+
+    struct mmsghdr messages[UDP_PUBLISHER_MAX_BATCH];
+    struct iovec iovecs[UDP_PUBLISHER_MAX_BATCH];
+    memset(messages, 0, sizeof(messages));
+    for (size_t i = 0; i < count; ++i) {
+        Frame *frame = &queue[(queueStart + i) % UDP_PUBLISHER_QUEUE_SIZE];
+        iovecs[i].iov_base = frame->data;
+        iovecs[i].iov_len = frame->size;
+        messages[i].msg_hdr.msg_name = &destination;
+        messages[i].msg_hdr.msg_namelen = sizeof(destination);
+        messages[i].msg_hdr.msg_iov = &iovecs[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    int sent = sendmmsg(socketFd, messages, (unsigned int)count, /* flags */ 0);
+    if (sent < 0) {
+        if (errno == EAGAIN) {
+            // The socket's send buffer is full; try again at the next pacing period.
+            return;
+        }
+
+        // Drop the first frame, so that a frame which cannot be sent does not block the others.
+        Log_Debug("ERROR: UDP publisher: Could not send frames: %s (%d).\n", strerror(errno),
+                  errno);
+        sent = 1;
+        ++stats.failed;
+    } else {
+        stats.sent += (uint32_t)sent;
+        ++stats.batches;
+    }
+
+    tokens -= (unsigned int)sent;
+    queueStart = (queueStart + (size_t)sent) % UDP_PUBLISHER_QUEUE_SIZE;
+    queueCount -= (size_t)sent;
+}
+
+static void PacingTimerEventHandler(EventLoopTimer *timer)
+{
+    if (ConsumeEventLoopTimerEvent(timer) != 0) {
+        Log_Debug("ERROR: Could not consume UDP publisher timer event\n");
+        return;
+    }
+    SendBatch();
+}
+
+ExitCode UdpPublisher_Start(EventLoop *eventLoop, const UdpPublisher_Settings *settings)
+{
+    ExitCode result = ExitCode_Success;
+
+    queueStart = 0;
+    queueCount = 0;
+    nextSequenceNumber = 0;
+    memset(&stats, 0, sizeof(stats));
+    framesPerSecond = settings->framesPerSecond;
+    tokens = 0;
+    tokenRemainder = 0;
+    lastRefillMs = NowMs();
+
+    memset(&destination, 0, sizeof(destination));
+    destination.sin_family = AF_INET;
+    destination.sin_addr.s_addr = settings->destinationAddress;
+    destination.sin_port = htons(settings->port);
+
+    socketFd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, /* protocol */ 0);
+    if (socketFd == -1) {
+        Log_Debug("ERROR: UDP publisher: Could not create socket: %s (%d).\n", strerror(errno),
+                  errno);
+        result = ExitCode_UdpPublisherStart_Socket;
+        goto fail;
+    }
+
+    // Bind to the private network interface, so that frames are only sent on it.
+    struct sockaddr_in local;
+    memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = settings->localAddress;
+    if (bind(socketFd, (const struct sockaddr *)&local, sizeof(local)) != 0) {
+        Log_Debug("ERROR: UDP publisher: Could not bind socket: %s (%d).\n", strerror(errno),
+                  errno);
+        result = ExitCode_UdpPublisherStart_Bind;
+        goto fail;
+    }
+
+    if (IN_MULTICAST(ntohl(settings->destinationAddress))) {
+        struct in_addr interfaceAddress = {.s_addr = settings->localAddress};
+        unsigned char ttl = MULTICAST_TTL;
+        if (setsockopt(socketFd, IPPROTO_IP, IP_MULTICAST_IF, &interfaceAddress,
+                       sizeof(interfaceAddress)) != 0 ||
+            setsockopt(socketFd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) != 0) {
+            Log_Debug("ERROR: UDP publisher: Could not set multicast options: %s (%d).\n",
+                      strerror(errno), errno);
+            result = ExitCode_UdpPublisherStart_SetSockOpt;
+            goto fail;
+        }
+    }
+
+    struct timespec period = {.tv_sec = (time_t)(settings->pacingPeriodMs / 1000),
+                              .tv_nsec = (long)(settings->pacingPeriodMs % 1000) * 1000000};
+    pacingTimer = CreateEventLoopPeriodicTimer(eventLoop, &PacingTimerEventHandler, &period);
+    if (pacingTimer == NULL) {
+        result = ExitCode_UdpPublisherStart_Timer;
+        goto fail;
+    }
+
+    Log_Debug("INFO: UDP publisher: Sending up to %u frames per second to port %u.\n",
+              framesPerSecond, settings->port);
+    return ExitCode_Success;
+
+fail:
+    UdpPublisher_Stop();
+    return result;
+}
+
+void UdpPublisher_Stop(void)
+{
+    DisposeEventLoopTimer(pacingTimer);
+    pacingTimer = NULL;
+    if (socketFd != -1) {
+        close(socketFd);
+        socketFd = -1;
+    }
+    queueCount = 0;
+}
+
+int UdpPublisher_Publish(UdpPublisher_FrameType type, const void *payload, size_t size)
+{
+    if (socketFd == -1 || size > UDP_PUBLISHER_MAX_PAYLOAD_SIZE) {
+        return -1;
+    }
+
+    // Drop the oldest frame if the queue is full.
+    if (queueCount == UDP_PUBLISHER_QUEUE_SIZE) {
+        queueStart = (queueStart + 1) % UDP_PUBLISHER_QUEUE_SIZE;
+        --queueCount;
+        ++stats.dropped;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    uint64_t timestampUs = (uint64_t)now.tv_sec * 1000000u + (uint64_t)now.tv_nsec / 1000u;
+
+    Frame *frame = &queue[(queueStart + queueCount) % UDP_PUBLISHER_QUEUE_SIZE];
+    frame->data[0] = 'S';
+    frame->data[1] = 'P';
+    frame->data[2] = UDP_PUBLISHER_VERSION;
+    frame->data[3] = (uint8_t)type;
+    PutUint32(&frame->data[4], nextSequenceNumber++);
+    PutUint64(&frame->data[8], timestampUs);
+    PutUint16(&frame->data[16], (uint16_t)size);
+    memcpy(&frame->data[UDP_PUBLISHER_HEADER_SIZE], payload, size);
+    frame->size = UDP_PUBLISHER_HEADER_SIZE + size;
+
+    ++queueCount;
+    ++stats.published;
+    return 0;
+}
+
+void UdpPublisher_GetStats(UdpPublisher_Stats *result)
+{
+    *result = stats;
+}
@@ -0,0 +1,112 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "netinet/in.h"
+
+#include "eventloop_timer_utilities.h"
+#include "exitcode_privnetserv.h"
+
+// The UDP publisher sends sensor and telemetry frames to consumers on the private network, such as
+// PLCs and dashboards, as UDP datagrams to a multicast group. Frames are queued when they are
+// published, and sent at a paced rate in batches, with one sendmmsg call per batch. When the queue
+// is full, the oldest frame is dropped, so that consumers receive the newest data.
+//
+// Each datagram holds one frame, which starts with this header; its fields are big-endian:
+//
+//  - Magic (2 bytes): 'S', 'P'.
+//  - Version (1 byte): UDP_PUBLISHER_VERSION.
+//  - Type (1 byte): a UdpPublisher_FrameType.
+//  - Sequence number (4 bytes): incremented for each frame which is published, so that consumers
+//    can detect frames which were lost or dropped.
+//  - Timestamp (8 bytes): CLOCK_REALTIME time at which the frame was published, in microseconds.
+//  - Payload size (2 bytes).
+//
+// The publisher is not thread-safe; it should only be used from the event loop's thread.
+
+/// <summary>Version of the frame format.</summary>
+#define UDP_PUBLISHER_VERSION 1
+
+/// <summary>Size of the header of a frame, in bytes.</summary>
+#define UDP_PUBLISHER_HEADER_SIZE 18
+
+/// <summary>Maximum size of the payload of a frame, in bytes.</summary>
+#define UDP_PUBLISHER_MAX_PAYLOAD_SIZE 256
+
+/// <summary>Number of frames which can be queued.</summary>
+#define UDP_PUBLISHER_QUEUE_SIZE 64
+
+/// <summary>Maximum number of frames which are sent with one system call.</summary>
+#define UDP_PUBLISHER_MAX_BATCH 16
+
+/// <summary>Types of frame.</summary>
+typedef enum {
+    /// <summary>Samples of a sensor.</summary>
+    UdpPublisher_FrameType_Sensor = 1,
+    /// <summary>Telemetry about the device.</summary>
+    UdpPublisher_FrameType_Telemetry = 2
+} UdpPublisher_FrameType;
+
+/// <summary>Settings of the publisher.</summary>
+typedef struct {
+    /// <summary>Address of the private network interface, from which frames are sent.</summary>
+    in_addr_t localAddress;
+    /// <summary>Multicast group, or the address of a single consumer, to send frames to.</summary>
+    in_addr_t destinationAddress;
+    /// <summary>UDP port to send frames to.</summary>
+    uint16_t port;
+    /// <summary>Maximum number of frames sent per second.</summary>
+    unsigned int framesPerSecond;
+    /// <summary>Period of the pacing timer, in milliseconds, at which batches are sent.</summary>
+    unsigned int pacingPeriodMs;
+} UdpPublisher_Settings;
+
+/// <summary>Counts of the frames which have been handled since the publisher started.</summary>
+typedef struct {
+    /// <summary>Number of frames which have been published.</summary>
+    uint32_t published;
+    /// <summary>Number of frames which have been sent.</summary>
+    uint32_t sent;
+    /// <summary>Number of frames which were dropped because the queue was full.</summary>
+    uint32_t dropped;
+    /// <summary>Number of frames which could not be sent.</summary>
+    uint32_t failed;
+    /// <summary>Number of batches which have been sent.</summary>
+    uint32_t batches;
+} UdpPublisher_Stats;
+
+/// <summary>
+///     Opens the socket to which frames are sent, and starts the pacing timer.
+/// </summary>
+/// <param name="eventLoop">Event loop which runs the pacing timer.</param>
+/// <param name="settings">Settings of the publisher.</param>
+/// <returns>
+///     ExitCode_Success on success; otherwise another ExitCode value which indicates the specific
+///     failure.
+/// </returns>
+ExitCode UdpPublisher_Start(EventLoop *eventLoop, const UdpPublisher_Settings *settings);
+
+/// <summary>
+///     Stops the publisher and closes its socket. Frames which are queued are discarded.
+/// </summary>
+void UdpPublisher_Stop(void);
+
+/// <summary>
+///     Queues a frame to be sent.
+/// </summary>
+/// <param name="type">Type of the frame.</param>
+/// <param name="payload">The payload of the frame.</param>
+/// <param name="size">Size of the payload, at most UDP_PUBLISHER_MAX_PAYLOAD_SIZE bytes.</param>
+/// <returns>0 on success, or -1 if the publisher is not started or the payload is too
+/// large.</returns>
+int UdpPublisher_Publish(UdpPublisher_FrameType type, const void *payload, size_t size);
+
+/// <summary>
+///     Gets the counts of the frames which have been handled.
+/// </summary>
+/// <param name="stats">Receives the counts.</param>
+void UdpPublisher_GetStats(UdpPublisher_Stats *stats);
@@ -0,0 +1,74 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "accel_filter.h"
+
+void AccelFilter_ConvertToMilliG(int16_t *samples, size_t count, int32_t scaleQ16)
+{
+    size_t i = 0;
+
+#if defined(__ARM_NEON)
+    // Widen eight samples, multiply them by the scale, and narrow them again with rounding.
+    const int16x4_t scale = vdup_n_s16((int16_t)scaleQ16);
+    for (; i + 8 <= count; i += 8) {
+        int16x8_t raw = vld1q_s16(&samples[i]);
+        int32x4_t low = vmull_s16(vget_low_s16(raw), scale);
+        int32x4_t high = vmull_s16(vget_high_s16(raw), scale);
+        vst1q_s16(&samples[i], vcombine_s16(vrshrn_n_s32(low, 16), vrshrn_n_s32(high, 16)));
+    }
+#endif
+
+    // Convert any remaining samples in the same way, rounding to nearest.
+    for (; i < count; ++i) {
+        samples[i] = (int16_t)((samples[i] * scaleQ16 + 0x8000) >> 16);
+    }
+}
+
+void AccelFilter_Init(AccelFilter *filter, unsigned int iirShift, unsigned int decimation)
+{
+    filter->iirShift = iirShift;
+    filter->decimation = (decimation == 0) ? 1 : decimation;
+    filter->count = 0;
+    filter->primed = false;
+    for (size_t axis = 0; axis < ACCEL_AXES; ++axis) {
+        filter->state[axis] = 0;
+        filter->sums[axis] = 0;
+    }
+}
+
+size_t AccelFilter_Process(AccelFilter *filter, const AccelFrame *input, size_t inputCount,
+                           AccelFrame *output)
+{
+    size_t outputCount = 0;
+
+    for (size_t i = 0; i < inputCount; ++i) {
+        for (size_t axis = 0; axis < ACCEL_AXES; ++axis) {
+            int32_t value = (int32_t)input[i].axis[axis] * 256;
+            if (!filter->primed) {
+                filter->state[axis] = value;
+            } else {
+                filter->state[axis] += (value - filter->state[axis]) >> filter->iirShift;
+            }
+            filter->sums[axis] += (filter->state[axis] + 128) >> 8;
+        }
+        filter->primed = true;
+
+        if (++filter->count < filter->decimation) {
+            continue;
+        }
+
+        for (size_t axis = 0; axis < ACCEL_AXES; ++axis) {
+            output[outputCount].axis[axis] =
+                (int16_t)(filter->sums[axis] / (int32_t)filter->decimation);
+            filter->sums[axis] = 0;
+        }
+        filter->count = 0;
+        ++outputCount;
+    }
+
+    return outputCount;
+}
@@ -0,0 +1,81 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// <summary>Number of axes in each accelerometer frame.</summary>
+#define ACCEL_AXES 3
+
+/// <summary>
+///     Scale which converts raw LSM6DS3 samples to milli-g when FS = +/-4g, as a Q16 fixed-point
+///     value. DocID026899 Rev 10, S4.1, Mechanical characteristics; LA_So = 0.122 mg/LSB.
+/// </summary>
+#define ACCEL_MILLI_G_PER_LSB_Q16_FS4G 7995
+
+/// <summary>
+///     One sample of all three axes, in the order X, Y, Z. This matches the layout in which the
+///     LSM6DS3 FIFO returns them, so a burst read can be stored directly in an array of frames.
+/// </summary>
+typedef struct {
+    int16_t axis[ACCEL_AXES];
+} AccelFrame;
+
+_Static_assert(sizeof(AccelFrame) == ACCEL_AXES * sizeof(int16_t), "AccelFrame must be packed");
+
+/// <summary>
+///     State of a low-pass filter and decimator. The client should not directly modify member
+///     variables.
+/// </summary>
+typedef struct {
+    /// <summary>Each input moves the filter 1/2^iirShift of the way towards it; 0 disables
+    /// the filter.</summary>
+    unsigned int iirShift;
+    /// <summary>Number of filtered frames which are averaged into each output frame.</summary>
+    unsigned int decimation;
+    /// <summary>Filtered value of each axis, in Q8 fixed point.</summary>
+    int32_t state[ACCEL_AXES];
+    /// <summary>Sum of the filtered frames since the last output frame.</summary>
+    int32_t sums[ACCEL_AXES];
+    /// <summary>Number of filtered frames in sums.</summary>
+    unsigned int count;
+    /// <summary>Whether state holds a value. The first frame initializes it.</summary>
+    bool primed;
+} AccelFilter;
+
+/// <summary>
+///     <para>Converts raw samples to milli-g in place, using fixed-point arithmetic. Where NEON
+///     is available, eight samples are converted per instruction.</para>
+///     <param name="samples">Samples to convert, which may be any number of frames.</param>
+///     <param name="count">Number of samples, which is the number of frames times
+///     ACCEL_AXES.</param>
+///     <param name="scaleQ16">Milli-g per LSB, as a Q16 fixed-point value, such as
+///     ACCEL_MILLI_G_PER_LSB_Q16_FS4G. It must be less than 32768.</param>
+/// </summary>
+void AccelFilter_ConvertToMilliG(int16_t *samples, size_t count, int32_t scaleQ16);
+
+/// <summary>
+///     Initializes a filter.
+///     <param name="filter">Filter to initialize.</param>
+///     <param name="iirShift">Shift of the first-order IIR low-pass filter, which has a time
+///     constant of about 2^iirShift input frames; 0 disables it.</param>
+///     <param name="decimation">Number of frames which are averaged into each output frame.
+///     1 outputs every filtered frame.</param>
+/// </summary>
+void AccelFilter_Init(AccelFilter *filter, unsigned int iirShift, unsigned int decimation);
+
+/// <summary>
+///     <para>Filters and decimates a batch of frames. Frames which do not complete an output
+///     frame are remembered, and contribute to the next one.</para>
+///     <param name="filter">Filter initialized with AccelFilter_Init.</param>
+///     <param name="input">Frames to filter, typically in milli-g.</param>
+///     <param name="inputCount">Number of frames in input.</param>
+///     <param name="output">Receives the output frames. It must have space for
+///     inputCount / decimation + 1 frames.</param>
+///     <returns>Number of output frames which were written.</returns>
+/// </summary>
+size_t AccelFilter_Process(AccelFilter *filter, const AccelFrame *input, size_t inputCount,
+                           AccelFrame *output);
@@ -8,6 +8,10 @@
 
 #include <applibs/eventloop.h>
 
+// All the timers on an event loop share a single timerfd and event loop registration. Timers
+// which expire at the same time are dispatched in the same wakeup. These functions should only be
+// called from the thread which runs the event loop.
+
 /// <summary>
 /// Opaque handle. Obtain via <see cref="CreateEventLoopPeriodicTimer" />
 /// or <see cref="CreateEventLoopDisarmedTimer" /> and dispose of via
@@ -58,7 +62,9 @@ EventLoopTimer *CreateEventLoopDisarmedTimer(EventLoop *eventLoop, EventLoopTime
 void DisposeEventLoopTimer(EventLoopTimer *timer);
 
 /// <summary>
-/// The timer callback should call this function to consume the timer event.
+/// The timer callback should call this function to consume the timer event. The shared timerfd
+/// has already been read when the callback is invoked, so this always succeeds; it is kept so
+/// that existing callbacks do not have to change.
 /// </summary>
 /// <param name="timer">Successfully allocated timer.</param>
 /// <returns>0 on success, -1 on failure, in which case errno contains more information.</returns>
@@ -100,3 +106,27 @@ int SetEventLoopTimerOneShot(EventLoopTimer *timer, const struct timespec *delay
 /// <seealso cref="SetEventLoopTimerOneShot" />
 /// <seealso cref="SetEventLoopTimerPeriod" />
 int DisarmEventLoopTimer(EventLoopTimer *timer);
+
+#ifdef EVENTLOOP_STATS
+#include "eventloop_stats.h"
+
+/// <summary>
+/// Create a timer like <see cref="CreateEventLoopPeriodicTimer" />, and record how often and for
+/// how long its handler runs under a name. When EVENTLOOP_STATS is defined, the other creation
+/// functions call this, with the name of the handler.
+/// </summary>
+/// <param name="eventLoop">Event loop to which the timer will be added.</param>
+/// <param name="handler">Callback to invoke when the timer expires.</param>
+/// <param name="period">Timer period, or NULL to create a disarmed timer.</param>
+/// <param name="name">Name under which the handler is recorded.</param>
+/// <returns>On success, pointer to new EventLoopTimer, which should be disposed of
+/// with <see cref="DisposeEventLoopTimer" />. On failure, returns NULL, with more
+/// information available in errno.</returns>.
+EventLoopTimer *CreateNamedEventLoopTimer(EventLoop *eventLoop, EventLoopTimerHandler handler,
+                                          const struct timespec *period, const char *name);
+
+#define CreateEventLoopPeriodicTimer(eventLoop, handler, period) \
+    CreateNamedEventLoopTimer((eventLoop), (handler), (period), #handler)
+#define CreateEventLoopDisarmedTimer(eventLoop, handler) \
+    CreateNamedEventLoopTimer((eventLoop), (handler), NULL, #handler)
+#endif
@@ -38,7 +38,13 @@
 // See https://aka.ms/AzureSphereHardwareDefinitions for more details.
 #include <hw/sample_appliance.h>
 
+#include "accel_filter.h"
+#include "anomaly_detector.h"
+#include "async_log.h"
 #include "eventloop_timer_utilities.h"
+#ifdef SPI_STREAM
+#include "spi_stream.h"
+#endif
 
 /// <summary>
 /// Termination codes for this application. These are used for the
@@ -51,8 +57,8 @@ typedef enum {
     ExitCode_TermHandler_SigTerm = 1,
 
     ExitCode_AccelTimerHandler_Consume = 2,
-    ExitCode_AccelTimerHandler_ReadStatus = 3,
-    ExitCode_AccelTimerHandler_ReadZAcceleration = 4,
+    ExitCode_AccelTimerHandler_ReadFifoStatus = 3,
+    ExitCode_AccelTimerHandler_ReadFifoData = 4,
 
     ExitCode_ReadWhoAmI_WriteThenRead = 5,
     ExitCode_ReadWhoAmI_WriteThenReadWrongWhoAmI = 6,
@@ -71,14 +77,27 @@ typedef enum {
     ExitCode_Init_SetBusSpeed = 17,
     ExitCode_Init_SetMode = 18,
 
-    ExitCode_Main_EventLoopFail = 19
+    ExitCode_Main_EventLoopFail = 19,
+
+    ExitCode_Reset_TransferSequentialSetFifo = 20,
+
+    ExitCode_Init_AsyncLog = 21,
+
+    ExitCode_Init_AnomalyDetector = 22,
+
+    ExitCode_Init_SpiStream = 23
 } ExitCode;
 
 // Support functions.
 static void TerminationHandler(int signalNumber);
+#ifndef SPI_STREAM
 static void AccelTimerEventHandler(EventLoopTimer *timer);
+#endif
 static ExitCode ReadWhoAmI(void);
 static bool CheckTransferSize(const char *desc, size_t expectedBytes, ssize_t actualBytes);
+#ifndef SPI_STREAM
+static bool ReadRegisters(const char *desc, uint8_t regId, void *data, size_t size);
+#endif
 static ExitCode InitPeripheralsAndHandlers(void);
 static void CloseFdAndPrintError(int fd, const char *fdName);
 static void ClosePeripheralsAndHandlers(void);
@@ -89,6 +108,56 @@ static int spiFd = -1;
 static EventLoop *eventLoop = NULL;
 static EventLoopTimer *accelTimer = NULL;
 
+// The accelerometer queues samples in its FIFO at this rate, and the app drains them once a
+// second. DocID026899 Rev 10, S9.6, FIFO_CTRL5 (0Ah); ODR_FIFO = 0100 selects 104Hz.
+#define ACCEL_SAMPLE_RATE_HZ 104
+
+// Each sample in the FIFO is three 16-bit words, for the X, Y, and Z axes in that order.
+#define FIFO_WORDS_PER_SAMPLE ACCEL_AXES
+
+// The FIFO watermark flag is set when at least this many samples are queued. The timer only
+// drains the FIFO when the flag is set, so each drain reads at least this many samples.
+#define FIFO_WATERMARK_SAMPLES (ACCEL_SAMPLE_RATE_HZ / 2)
+#define FIFO_WATERMARK_WORDS (FIFO_WATERMARK_SAMPLES * FIFO_WORDS_PER_SAMPLE)
+
+// Maximum number of samples which are read from the FIFO in one SPI transfer. This is large
+// enough to hold the samples which arrive in one timer period.
+#define FIFO_MAX_SAMPLES_PER_READ 128
+
+// The samples are low-pass filtered with a time constant of 2^ACCEL_FILTER_IIR_SHIFT samples,
+// and then decimated to 8Hz.
+#define ACCEL_FILTER_IIR_SHIFT 2
+#define ACCEL_FILTER_DECIMATION 13
+
+static AccelFilter accelFilter;
+
+// The unfiltered samples are also checked for anomalies, such as a shock. A summary of every ten
+// seconds is logged, and the samples from half a second before to a second after each anomaly
+// are captured at the full rate; a connected device would upload these instead of the stream.
+static const AnomalyDetector_Config anomalyConfig = {.method = AnomalyDetector_Method_ZScore,
+                                                     .threshold = 8.0f,
+                                                     .minDeviation = 20.0f,
+                                                     .framesPerWindow = ACCEL_SAMPLE_RATE_HZ * 10,
+                                                     .preTriggerFrames = ACCEL_SAMPLE_RATE_HZ / 2,
+                                                     .postTriggerFrames = ACCEL_SAMPLE_RATE_HZ,
+                                                     .holdoffFrames = ACCEL_SAMPLE_RATE_HZ * 10};
+
+static AnomalyDetector anomalyDetector;
+
+#ifdef SPI_STREAM
+// Instead of draining the FIFO once a second, the stream reads each sample from the output
+// registers as it is produced, into one of two buffers of a second of samples, which are
+// processed in turn. DocID026899 Rev 10, S9.27-S9.32, OUTX_L_XL-OUTZ_H_XL (28h-2Dh)
+static const uint8_t outxLXlReadCmd = 0x28 | 0x80;
+static const SpiStream_Segment accelStreamSegments[] = {
+    {.flags = SPI_TransferFlags_Write, .writeData = &outxLXlReadCmd, .length = 1},
+    {.flags = SPI_TransferFlags_Read, .length = sizeof(AccelFrame)}};
+
+static AccelFrame accelStreamBuffers[SPI_STREAM_BUFFER_COUNT][ACCEL_SAMPLE_RATE_HZ];
+static SpiStream accelStream;
+static bool accelStreamStarted = false;
+#endif
+
 // Termination state
 static volatile sig_atomic_t exitCode = ExitCode_Success;
 
@@ -101,6 +170,30 @@ static void TerminationHandler(int signalNumber)
     exitCode = ExitCode_TermHandler_SigTerm;
 }
 
+/// <summary>
+///     Logs the summary of a window of accelerometer samples.
+/// </summary>
+static void AnomalySummaryHandler(const AnomalyDetector_Summary *summary, void *context)
+{
+    ASYNC_LOG_INFO("INFO: %u samples; mean x=%dmg y=%dmg z=%dmg; %u anomalous, peak score %d\n",
+                   summary->frameCount, (int)summary->channels[0].mean,
+                   (int)summary->channels[1].mean, (int)summary->channels[2].mean,
+                   summary->anomalousFrames, (int)summary->peakScore);
+}
+
+/// <summary>
+///     Logs a captured anomaly. A connected device would upload capture->frames here.
+/// </summary>
+static void AnomalyCaptureHandler(const AnomalyDetector_Capture *capture, void *context)
+{
+    const int16_t *trigger = &capture->frames[capture->triggerIndex * ACCEL_AXES];
+    ASYNC_LOG_WARNING(
+        "WARNING: Anomaly on axis %zu, score %d: x=%dmg y=%dmg z=%dmg; captured %zu samples.\n",
+        capture->triggerChannel, (int)capture->score, trigger[0], trigger[1], trigger[2],
+        capture->frameCount);
+}
+
+#ifndef SPI_STREAM
 /// <summary>
 ///     Print latest data from accelerometer.
 /// </summary>
@@ -113,45 +206,141 @@ static void AccelTimerEventHandler(EventLoopTimer *timer)
         return;
     }
 
-    // Status register describes whether accelerometer is available.
-    // DocID026899 Rev 10, S9.26, STATUS_REG (1Eh); [0] = XLDA
-    // Set bit 7 to instruct the accelerometer that this is a read
-    // from register 0x1E.
-    static const uint8_t statusRegIdReadCmd = (0x1E | 0x80);
-    uint8_t status;
-    ssize_t transferredBytes = SPIMaster_WriteThenRead(
-        spiFd, &statusRegIdReadCmd, sizeof(statusRegIdReadCmd), &status, sizeof(status));
-    if (!CheckTransferSize("SPIMaster_WriteThenRead (STATUS_REG)",
-                           sizeof(statusRegIdReadCmd) + sizeof(status), transferredBytes)) {
-        exitCode = ExitCode_AccelTimerHandler_ReadStatus;
+    // Read the number of unread words, the flags, and which axis the next word holds,
+    // in one burst. DocID026899 Rev 10, S9.41-S9.44, FIFO_STATUS1-4 (3Ah-3Dh)
+    uint8_t fifoStatus[4];
+    if (!ReadRegisters("FIFO_STATUS1", 0x3A, fifoStatus, sizeof(fifoStatus))) {
+        exitCode = ExitCode_AccelTimerHandler_ReadFifoStatus;
+        return;
+    }
+
+    size_t unreadWords = fifoStatus[0] | ((fifoStatus[1] & 0x0F) << 8);
+    size_t pattern = fifoStatus[2] | ((fifoStatus[3] & 0x03) << 8);
+
+    // FIFO_STATUS2; [6] = OVER_RUN
+    if ((fifoStatus[1] & 0x40) != 0) {
+        ASYNC_LOG_WARNING("WARNING: %d: Accelerometer FIFO overran, so samples were lost.\n", iter);
+    }
+
+    // FIFO_STATUS2; [7] = WaterM
+    if ((fifoStatus[1] & 0x80) == 0) {
+        ASYNC_LOG_INFO("INFO: %d: No accelerometer data.\n", iter);
+        ++iter;
         return;
     }
 
-    if ((status & 0x1) == 0) {
-        Log_Debug("INFO: %d: No accelerometer data.\n", iter);
-    } else {
-        // Read two-byte Z-axis output register.
-        // DocID026899 Rev 10, S9.38, OUTZ_L_XL (2Ch)
-        // Set bit 7 to instruct the accelerometer that this is a read
-        // from register 0x2C.
-        static const uint8_t outZLXlReadCmd = (0x2C | 0x80);
-        int16_t zRaw;
-        transferredBytes = SPIMaster_WriteThenRead(spiFd, &outZLXlReadCmd, sizeof(outZLXlReadCmd),
-                                                   (uint8_t *)&zRaw, sizeof(zRaw));
-        if (!CheckTransferSize("SPIMaster_WriteThenRead (OUTZ_L_XL)",
-                               sizeof(outZLXlReadCmd) + sizeof(zRaw), transferredBytes)) {
-            exitCode = ExitCode_AccelTimerHandler_ReadZAcceleration;
+    // If the next word is not an X axis, discard the words up to the start of the next sample.
+    // Reading FIFO_DATA_OUT_H (3Fh) rolls the register address back to FIFO_DATA_OUT_L (3Eh),
+    // so consecutive words are read in one burst.
+    // DocID026899 Rev 10, S9.45, FIFO_DATA_OUT_L (3Eh)
+    static const uint8_t fifoDataOutLRegId = 0x3E;
+    AccelFrame samples[FIFO_MAX_SAMPLES_PER_READ];
+    size_t skipWords = (FIFO_WORDS_PER_SAMPLE - pattern) % FIFO_WORDS_PER_SAMPLE;
+    if (skipWords > unreadWords) {
+        skipWords = unreadWords;
+    }
+    if (skipWords > 0 && !ReadRegisters("FIFO_DATA_OUT_L", fifoDataOutLRegId, samples,
+                                        skipWords * sizeof(int16_t))) {
+        exitCode = ExitCode_AccelTimerHandler_ReadFifoData;
+        return;
+    }
+
+    // Drain the queued samples in as few bursts as possible.
+    size_t remainingSamples = (unreadWords - skipWords) / FIFO_WORDS_PER_SAMPLE;
+    size_t sampleCount = 0;
+    size_t filteredCount = 0;
+    AccelFrame filtered[FIFO_MAX_SAMPLES_PER_READ / ACCEL_FILTER_DECIMATION + 1];
+    AccelFrame latest = {{0, 0, 0}};
+    while (remainingSamples > 0) {
+        size_t count = remainingSamples;
+        if (count > FIFO_MAX_SAMPLES_PER_READ) {
+            count = FIFO_MAX_SAMPLES_PER_READ;
+        }
+
+        if (!ReadRegisters("FIFO_DATA_OUT_L", fifoDataOutLRegId, samples,
+                           count * sizeof(samples[0]))) {
+            exitCode = ExitCode_AccelTimerHandler_ReadFifoData;
             return;
         }
 
-        // DocID026899 Rev 10, S4.1, Mechanical characteristics
-        // These constants are specific to LA_So where FS = +/-4g, as set in CTRL1_X.
-        double g = (zRaw * 0.122) / 1000.0;
-        Log_Debug("INFO: %d: vertical acceleration: %.2lfg\n", iter, g);
+        // Convert the whole burst to milli-g, and then filter and decimate it.
+        AccelFilter_ConvertToMilliG((int16_t *)samples, count * ACCEL_AXES,
+                                    ACCEL_MILLI_G_PER_LSB_Q16_FS4G);
+        AnomalyDetector_AddFrames(&anomalyDetector, (const int16_t *)samples, count);
+        size_t outputCount = AccelFilter_Process(&accelFilter, samples, count, filtered);
+        if (outputCount > 0) {
+            latest = filtered[outputCount - 1];
+        }
+
+        sampleCount += count;
+        filteredCount += outputCount;
+        remainingSamples -= count;
+    }
+
+    if (filteredCount > 0) {
+        ASYNC_LOG_INFO(
+            "INFO: %d: %zu samples filtered to %zu; acceleration: x=%dmg y=%dmg z=%dmg\n", iter,
+            sampleCount, filteredCount, latest.axis[0], latest.axis[1], latest.axis[2]);
     }
 
     ++iter;
 }
+#else
+/// <summary>
+///     Processes a second of samples from the stream, and logs the stream's counters.
+/// </summary>
+static void AccelStreamHandler(SpiStream *stream, void *buffer, size_t frameCount, void *context)
+{
+    AccelFrame *samples = buffer;
+    AccelFilter_ConvertToMilliG((int16_t *)samples, frameCount * ACCEL_AXES,
+                                ACCEL_MILLI_G_PER_LSB_Q16_FS4G);
+    AnomalyDetector_AddFrames(&anomalyDetector, (const int16_t *)samples, frameCount);
+
+    AccelFrame filtered[ACCEL_SAMPLE_RATE_HZ / ACCEL_FILTER_DECIMATION + 1];
+    size_t filteredCount = AccelFilter_Process(&accelFilter, samples, frameCount, filtered);
+    if (filteredCount > 0) {
+        const AccelFrame *latest = &filtered[filteredCount - 1];
+        ASYNC_LOG_INFO("INFO: %zu samples filtered to %zu; acceleration: x=%dmg y=%dmg z=%dmg\n",
+                       frameCount, filteredCount, latest->axis[0], latest->axis[1],
+                       latest->axis[2]);
+    }
+
+    SpiStream_Stats stats;
+    SpiStream_GetStats(stream, &stats);
+    ASYNC_LOG_INFO("INFO: SPI stream: %.1f samples/s; %u overrun, %u missed, %u failed transfers\n",
+                   (double)stats.framesPerSecond, stats.overrunFrames, stats.missedFrames,
+                   stats.transferErrors);
+
+    SpiStream_ReleaseBuffer(stream, buffer);
+}
+
+/// <summary>
+///     Starts reading the samples at the accelerometer's output rate.
+/// </summary>
+/// <returns>
+///     ExitCode_Success on success; otherwise ExitCode_Init_SpiStream.
+/// </returns>
+static ExitCode StartAccelStream(void)
+{
+    SpiStream_Config streamConfig = {
+        .segments = accelStreamSegments,
+        .segmentCount = sizeof(accelStreamSegments) / sizeof(accelStreamSegments[0]),
+        // Chip select stays asserted for the whole of a transfer, which the accelerometer would
+        // take as a longer read, so each transfer reads one sample.
+        .framesPerTransfer = 1,
+        .framesPerBuffer = ACCEL_SAMPLE_RATE_HZ,
+        .buffers = {accelStreamBuffers[0], accelStreamBuffers[1]},
+        .period = {.tv_sec = 0, .tv_nsec = 1000000000 / ACCEL_SAMPLE_RATE_HZ}};
+    if (SpiStream_Init(&accelStream, eventLoop, spiFd, &streamConfig, AccelStreamHandler, NULL) !=
+        0) {
+        Log_Debug("ERROR: SpiStream_Init: errno=%d (%s)\n", errno, strerror(errno));
+        return ExitCode_Init_SpiStream;
+    }
+
+    accelStreamStarted = true;
+    return ExitCode_Success;
+}
+#endif
 
 /// <summary>
 ///     Demonstrates two ways of reading data from the attached device.
@@ -244,8 +433,48 @@ static bool CheckTransferSize(const char *desc, size_t expectedBytes, ssize_t ac
     return true;
 }
 
+#ifndef SPI_STREAM
+/// <summary>
+///     Reads consecutive registers from the accelerometer in one SPI transfer.
+/// </summary>
+/// <param name="desc">Name of the first register, which is used in error messages.</param>
+/// <param name="regId">Address of the first register.</param>
+/// <param name="data">Receives the register values.</param>
+/// <param name="size">Number of bytes to read.</param>
+/// <returns>true on success, or false on failure</returns>
+static bool ReadRegisters(const char *desc, uint8_t regId, void *data, size_t size)
+{
+    static const size_t transferCount = 2;
+    SPIMaster_Transfer transfers[transferCount];
+
+    int result = SPIMaster_InitTransfers(transfers, transferCount);
+    if (result != 0) {
+        Log_Debug("ERROR: SPIMaster_InitTransfers: errno=%d (%s)\n", errno, strerror(errno));
+        return false;
+    }
+
+    // Set bit 7 to instruct the accelerometer that this is a read.
+    const uint8_t readCmd = (uint8_t)(regId | 0x80);
+    transfers[0].flags = SPI_TransferFlags_Write;
+    transfers[0].writeData = &readCmd;
+    transfers[0].length = sizeof(readCmd);
+
+    transfers[1].flags = SPI_TransferFlags_Read;
+    transfers[1].readData = data;
+    transfers[1].length = size;
+
+    ssize_t transferredBytes = SPIMaster_TransferSequential(spiFd, transfers, transferCount);
+    if (!CheckTransferSize(desc, sizeof(readCmd) + size, transferredBytes)) {
+        return false;
+    }
+
+    return true;
+}
+#endif
+
 /// <summary>
-///     Resets the accelerometer and samples the vertical acceleration.
+///     Resets the accelerometer, sets the sample range, and configures its FIFO to queue
+///     samples of all three axes until they are read.
 /// </summary>
 /// <returns>
 ///     ExitCode_Success on success; otherwise another ExitCode value which indicates
@@ -288,9 +517,9 @@ static ExitCode ResetAndSetSampleRange(void)
     } while (!(transferredBytes == (sizeof(ctrl3cRegIdReadCmd) + sizeof(ctrl3c)) &&
                (ctrl3c & 0x1) == 0));
 
-    // Use sample range +/- 4g, with 12.5Hz frequency.
+    // Use sample range +/- 4g, with 104Hz frequency.
     // DocID026899 Rev 10, S9.12, CTRL1_XL (10h)
-    static const uint8_t setCtrl1XlCommand[] = {0x10, 0x18};
+    static const uint8_t setCtrl1XlCommand[] = {0x10, 0x48};
 
     transfer.flags = SPI_TransferFlags_Write;
     transfer.writeData = setCtrl1XlCommand;
@@ -302,6 +531,32 @@ static ExitCode ResetAndSetSampleRange(void)
         return ExitCode_Reset_TransferSequentialSetRange;
     }
 
+    // The filter starts again along with the FIFO.
+    AccelFilter_Init(&accelFilter, ACCEL_FILTER_IIR_SHIFT, ACCEL_FILTER_DECIMATION);
+
+    // Configure the FIFO in one burst, starting at FIFO_CTRL1 (06h).
+    // DocID026899 Rev 10, S9.2-S9.6, FIFO_CTRL1-5 (06h-0Ah)
+    // FIFO_CTRL1, FIFO_CTRL2 [3:0] = FTH; watermark, in words
+    // FIFO_CTRL3 [2:0] = DEC_FIFO_XL; 001 queues every accelerometer sample, and no gyroscope
+    // FIFO_CTRL4 = 0; no third or fourth data set
+    // FIFO_CTRL5 [6:3] = ODR_FIFO; 0100 = 104Hz, [2:0] = FIFO_MODE; 110 = continuous
+    static const uint8_t setFifoCtrlCommand[] = {0x06,
+                                                 FIFO_WATERMARK_WORDS & 0xFF,
+                                                 (FIFO_WATERMARK_WORDS >> 8) & 0x0F,
+                                                 0x01,
+                                                 0x00,
+                                                 0x26};
+
+    transfer.flags = SPI_TransferFlags_Write;
+    transfer.writeData = setFifoCtrlCommand;
+    transfer.length = sizeof(setFifoCtrlCommand);
+
+    transferredBytes = SPIMaster_TransferSequential(spiFd, &transfer, transferCount);
+    if (!CheckTransferSize("SPIMaster_TransferSequential (FIFO_CTRL1)", transfer.length,
+                           transferredBytes)) {
+        return ExitCode_Reset_TransferSequentialSetFifo;
+    }
+
     return 0;
 }
 
@@ -325,12 +580,25 @@ static ExitCode InitPeripheralsAndHandlers(void)
         return ExitCode_Init_EventLoop;
     }
 
-    // Print accelerometer data every second.
+    // Messages from the accelerometer handler are written from the event loop.
+    if (AsyncLog_Initialize(eventLoop) != 0) {
+        return ExitCode_Init_AsyncLog;
+    }
+
+    if (AnomalyDetector_Init(&anomalyDetector, ACCEL_AXES, &anomalyConfig, AnomalySummaryHandler,
+                             AnomalyCaptureHandler, NULL) != 0) {
+        Log_Debug("ERROR: Invalid anomaly detector configuration.\n");
+        return ExitCode_Init_AnomalyDetector;
+    }
+
+#ifndef SPI_STREAM
+    // Drain the accelerometer FIFO and print a summary of the samples every second.
     struct timespec accelReadPeriod = {.tv_sec = 1, .tv_nsec = 0};
     accelTimer = CreateEventLoopPeriodicTimer(eventLoop, &AccelTimerEventHandler, &accelReadPeriod);
     if (accelTimer == NULL) {
         return ExitCode_Init_AccelTimer;
     }
+#endif
 
     SPIMaster_Config config;
     int ret = SPIMaster_InitConfig(&config);
@@ -362,6 +630,11 @@ static ExitCode InitPeripheralsAndHandlers(void)
     if (localExitCode == ExitCode_Success) {
         localExitCode = ResetAndSetSampleRange();
     }
+#ifdef SPI_STREAM
+    if (localExitCode == ExitCode_Success) {
+        localExitCode = StartAccelStream();
+    }
+#endif
 
     return localExitCode;
 }
@@ -387,6 +660,12 @@ static void CloseFdAndPrintError(int fd, const char *fdName)
 static void ClosePeripheralsAndHandlers(void)
 {
     DisposeEventLoopTimer(accelTimer);
+#ifdef SPI_STREAM
+    if (accelStreamStarted) {
+        SpiStream_Cleanup(&accelStream);
+    }
+#endif
+    AsyncLog_Cleanup();
     EventLoop_Close(eventLoop);
 
     Log_Debug("Closing file descriptors.\n");
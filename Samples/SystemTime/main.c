@@ -11,6 +11,7 @@
 // - rtc (synchronizes the hardware RTC to the current system time)
 // - wificonfig (functions that retrieve the Wi-Fi network configurations on a device)
 // - eventloop (system invokes handlers for timer events)
+// - storage (mutable storage, which holds the time of the last time sync and the drift of the RTC)
 
 #include <errno.h>
 #include <signal.h>
@@ -41,7 +42,9 @@
 // See https://aka.ms/AzureSphereHardwareDefinitions for more details.
 #include <hw/sample_appliance.h>
 
-#include "eventloop_timer_utilities.h"
+#include "button_input.h"
+#include "key_value_store.h"
+#include "time_keeper.h"
 
 /// <summary>
 /// Exit codes for this application. These are used for the
@@ -57,20 +60,25 @@ typedef enum {
     ExitCode_PrintTime_UtcTimeR = 3,
     ExitCode_PrintTime_LocalTimeR = 4,
 
-    ExitCode_IsButtonPressed_GetValue = 5,
+    ExitCode_Buttons_GetValue = 5,
 
-    ExitCode_ButtonTimer_Consume = 6,
-    ExitCode_ButtonTimer_GetTime = 7,
-    ExitCode_ButtonTimer_SetTime = 8,
-    ExitCode_ButtonTimer_SysToHc = 9,
+    ExitCode_Buttons_Timer = 6,
+    ExitCode_IncrementTime_GetTime = 7,
+    ExitCode_IncrementTime_SetTime = 8,
+    ExitCode_WriteToRtc_SysToHc = 9,
 
     ExitCode_Init_EventLoop = 10,
     ExitCode_Init_Button1Open = 11,
     ExitCode_Init_Button2Open = 12,
-    ExitCode_Init_ButtonTimer = 13,
+    ExitCode_Init_Buttons = 13,
 
     ExitCode_Main_SetEnv = 14,
-    ExitCode_Main_EventLoopFail = 15
+    ExitCode_Main_EventLoopFail = 15,
+
+    ExitCode_Init_AddButton1 = 16,
+    ExitCode_Init_AddButton2 = 17,
+    ExitCode_Init_OpenStore = 18,
+    ExitCode_Init_TimeKeeper = 19
 } ExitCode;
 
 // File descriptors - initialized to invalid value
@@ -78,15 +86,27 @@ static int incrementTimeButtonGpioFd = -1;
 static int writeToRtcButtonGpioFd = -1;
 
 static EventLoop *eventLoop = NULL;
-static EventLoopTimer *buttonPollTimer = NULL;
+static ButtonInput *buttons = NULL;
 
 // Termination state
 static volatile sig_atomic_t exitCode = ExitCode_Success;
 
+// The time keeper stores the time of the last time sync, and the drift of the RTC, in the
+// key-value store, so that the time from the RTC can be trusted at boot without waiting for NTP.
+static const off_t keyValueStoreOffset = 0;
+static const size_t keyValueStoreSize = 2048;
+static const unsigned int keyValueStoreCommitDelayMs = 1000;
+static const TimeKeeper_Config timeKeeperConfig = {
+    .storageKey = "timeKeeper", .pollPeriodSeconds = 10, .maxErrorSeconds = 60};
+
 static void TerminationHandler(int signalNumber);
 static void PrintTime(void);
-static bool IsButtonPressed(int fd, GPIO_Value_Type *oldState);
-static void ButtonPollTimerEventHandler(EventLoopTimer *timer);
+static void IncrementTimeButtonHandler(int gpioFd, ButtonInput_Event event, unsigned int count,
+                                      void *context);
+static void WriteToRtcButtonHandler(int gpioFd, ButtonInput_Event event, unsigned int count,
+                                    void *context);
+static void ButtonsErrorHandler(int gpioFd, void *context);
+static void TimeConfidenceChangedHandler(TimeKeeper_Confidence confidence, void *context);
 static ExitCode InitPeripheralsAndHandlers(void);
 static void CloseFdAndPrintError(int fd, const char *fdName);
 static void ClosePeripheralsAndHandlers(void);
@@ -139,77 +159,82 @@ static void PrintTime(void)
 }
 
 /// <summary>
-///     Check whether a given button has just been pressed.
+///     Handle SAMPLE_BUTTON_1 events: when it is pressed, the current time will be incremented by
+///     3 hours. The changes will not be synchronized with the hardware RTC until SAMPLE_BUTTON_2
+///     is pressed.
 /// </summary>
-/// <param name="fd">The button file descriptor</param>
-/// <param name="oldState">Old state of the button (pressed or released)</param>
-/// <returns>True if pressed, false otherwise</returns>
-static bool IsButtonPressed(int fd, GPIO_Value_Type *oldState)
+static void IncrementTimeButtonHandler(int gpioFd, ButtonInput_Event event, unsigned int count,
+                                       void *context)
 {
-    bool isButtonPressed = false;
-    GPIO_Value_Type newState;
-    int result = GPIO_GetValue(fd, &newState);
-    if (result != 0) {
-        Log_Debug("ERROR: Could not read button GPIO: %s (%d).\n", strerror(errno), errno);
-        exitCode = ExitCode_IsButtonPressed_GetValue;
-    } else {
-        // Button is pressed if it is low and different than last known state.
-        isButtonPressed = (newState != *oldState) && (newState == GPIO_Value_Low);
-        *oldState = newState;
+    if (event != ButtonInput_Event_Pressed) {
+        return;
+    }
+
+    Log_Debug(
+        "\nSAMPLE_BUTTON_1 was pressed: the current system time will be incremented by 3 hours."
+        "To synchronize the time with the hardware RTC, press SAMPLE_BUTTON_2.\n");
+    struct timespec currentTime;
+    if (clock_gettime(CLOCK_REALTIME, &currentTime) == -1) {
+        Log_Debug("ERROR: clock_gettime failed with error code: %s (%d).\n", strerror(errno),
+                  errno);
+        exitCode = ExitCode_IncrementTime_GetTime;
+        return;
     }
 
-    return isButtonPressed;
+    // Add three hours to the current time
+    currentTime.tv_sec += 10800;
+    if (clock_settime(CLOCK_REALTIME, &currentTime) == -1) {
+        Log_Debug("ERROR: clock_settime failed with error code: %s (%d).\n", strerror(errno),
+                  errno);
+        exitCode = ExitCode_IncrementTime_SetTime;
+        return;
+    }
+    TimeKeeper_NotifyClockSet(/* synchronized */ false);
+    PrintTime();
 }
 
 /// <summary>
-///     Handle button timer event: if SAMPLE_BUTTON_1 is pressed, then the current time will be
-///     incremented by 3 hours. If SAMPLE_BUTTON_2 is pressed, then the current time will be
+///     Handle SAMPLE_BUTTON_2 events: when it is pressed, the current system time will be
 ///     synchronized with the hardware RTC.
 /// </summary>
-static void ButtonPollTimerEventHandler(EventLoopTimer *timer)
+static void WriteToRtcButtonHandler(int gpioFd, ButtonInput_Event event, unsigned int count,
+                                    void *context)
 {
-    if (ConsumeEventLoopTimerEvent(timer) != 0) {
-        exitCode = ExitCode_ButtonTimer_Consume;
+    if (event != ButtonInput_Event_Pressed) {
         return;
     }
 
-    // Check for advance-clock button press; the changes will not be synchronized with the hardware
-    // RTC until the other button is pressed
-    static GPIO_Value_Type incrementTimeButtonState;
-    if (IsButtonPressed(incrementTimeButtonGpioFd, &incrementTimeButtonState)) {
-        Log_Debug(
-            "\nSAMPLE_BUTTON_1 was pressed: the current system time will be incremented by 3 hours."
-            "To synchronize the time with the hardware RTC, press SAMPLE_BUTTON_2.\n");
-        struct timespec currentTime;
-        if (clock_gettime(CLOCK_REALTIME, &currentTime) == -1) {
-            Log_Debug("ERROR: clock_gettime failed with error code: %s (%d).\n", strerror(errno),
-                      errno);
-            exitCode = ExitCode_ButtonTimer_GetTime;
-            return;
-        }
-
-        // Add three hours to the current time
-        currentTime.tv_sec += 10800;
-        if (clock_settime(CLOCK_REALTIME, &currentTime) == -1) {
-            Log_Debug("ERROR: clock_settime failed with error code: %s (%d).\n", strerror(errno),
-                      errno);
-            exitCode = ExitCode_ButtonTimer_SetTime;
-            return;
-        }
-        PrintTime();
+    Log_Debug(
+        "\nSAMPLE_BUTTON_2 was pressed: the current system time will be synchronized to the "
+        "hardware RTC.\n");
+    if (clock_systohc() == -1) {
+        Log_Debug("ERROR: clock_systohc failed with error code: %s (%d).\n", strerror(errno),
+                  errno);
+        exitCode = ExitCode_WriteToRtc_SysToHc;
     }
+}
 
-    // Check for SAMPLE_BUTTON_2 press: the changes will be synchronized with the hardware RTC
-    static GPIO_Value_Type writeToRtcButtonState;
-    if (IsButtonPressed(writeToRtcButtonGpioFd, &writeToRtcButtonState)) {
-        Log_Debug(
-            "\nSAMPLE_BUTTON_2 was pressed: the current system time will be synchronized to the "
-            "hardware RTC.\n");
-        if (clock_systohc() == -1) {
-            Log_Debug("ERROR: clock_systohc failed with error code: %s (%d).\n", strerror(errno),
-                      errno);
-            exitCode = ExitCode_ButtonTimer_SysToHc;
-        }
+/// <summary>
+///     Handle a failure to sample the buttons.
+/// </summary>
+static void ButtonsErrorHandler(int gpioFd, void *context)
+{
+    exitCode = (gpioFd == -1) ? ExitCode_Buttons_Timer : ExitCode_Buttons_GetValue;
+}
+
+/// <summary>
+///     Log how far the system time can be trusted, when it changes.
+/// </summary>
+static void TimeConfidenceChangedHandler(TimeKeeper_Confidence confidence, void *context)
+{
+    static const char *const confidenceNames[] = {"not trusted", "from the RTC",
+                                                  "synchronized"};
+    uint32_t errorBound = TimeKeeper_GetErrorBoundSeconds();
+    if (errorBound == UINT32_MAX) {
+        Log_Debug("INFO: The system time is %s.\n", confidenceNames[confidence]);
+    } else {
+        Log_Debug("INFO: The system time is %s, to within %lu s.\n", confidenceNames[confidence],
+                  (unsigned long)errorBound);
     }
 }
 
@@ -231,6 +256,17 @@ static ExitCode InitPeripheralsAndHandlers(void)
         return ExitCode_Init_EventLoop;
     }
 
+    if (KeyValueStore_Open(eventLoop, keyValueStoreOffset, keyValueStoreSize,
+                           keyValueStoreCommitDelayMs) == -1) {
+        Log_Debug("ERROR: Could not open the key-value store: %s (%d).\n", strerror(errno), errno);
+        return ExitCode_Init_OpenStore;
+    }
+
+    // This corrects the time which the OS read from the RTC at boot, before it is printed.
+    if (TimeKeeper_Start(eventLoop, &timeKeeperConfig, TimeConfidenceChangedHandler, NULL) != 0) {
+        return ExitCode_Init_TimeKeeper;
+    }
+
     // Open SAMPLE_BUTTON_1 GPIO as input
     Log_Debug("Opening SAMPLE_BUTTON_1 as input.\n");
     incrementTimeButtonGpioFd = GPIO_OpenAsInput(SAMPLE_BUTTON_1);
@@ -247,12 +283,19 @@ static ExitCode InitPeripheralsAndHandlers(void)
         return ExitCode_Init_Button2Open;
     }
 
-    // Set up a timer to poll the buttons
-    static const struct timespec buttonPressCheckPeriod = {.tv_sec = 0, .tv_nsec = 1000000};
-    buttonPollTimer = CreateEventLoopPeriodicTimer(eventLoop, &ButtonPollTimerEventHandler,
-                                                   &buttonPressCheckPeriod);
-    if (buttonPollTimer == NULL) {
-        return ExitCode_Init_ButtonTimer;
+    // Sample both buttons from one adaptive timer, rather than polling them every 1ms
+    buttons = ButtonInput_Create(eventLoop, NULL, ButtonsErrorHandler, NULL);
+    if (buttons == NULL) {
+        return ExitCode_Init_Buttons;
+    }
+
+    if (ButtonInput_Add(buttons, incrementTimeButtonGpioFd, IncrementTimeButtonHandler, NULL) !=
+        0) {
+        return ExitCode_Init_AddButton1;
+    }
+
+    if (ButtonInput_Add(buttons, writeToRtcButtonGpioFd, WriteToRtcButtonHandler, NULL) != 0) {
+        return ExitCode_Init_AddButton2;
     }
 
     return ExitCode_Success;
@@ -278,7 +321,9 @@ static void CloseFdAndPrintError(int fd, const char *fdName)
 /// </summary>
 static void ClosePeripheralsAndHandlers(void)
 {
-    DisposeEventLoopTimer(buttonPollTimer);
+    ButtonInput_Dispose(buttons);
+    TimeKeeper_Stop();
+    KeyValueStore_Close();
     EventLoop_Close(eventLoop);
 
     Log_Debug("Closing file descriptors.\n");
@@ -323,6 +368,7 @@ int main(int argc, char *argv[])
 
     if (exitCode == ExitCode_Success) {
         CheckTimeSyncState();
+        TimeConfidenceChangedHandler(TimeKeeper_GetConfidence(), NULL);
         Log_Debug("\nTime before setting time zone:\n");
         PrintTime();
         // Note that the offset is positive if the local time zone is west of the Prime Meridian and
@@ -4,7 +4,8 @@
 // This sample C application for Azure Sphere demonstrates how to use a UART (serial port).
 // The sample opens a UART with a baud rate of 115200. Pressing a button causes characters
 // to be sent from the device over the UART; data received by the device from the UART is echoed to
-// the Visual Studio Output Window.
+// the Visual Studio Output Window. The UART is driven by a UART stream, which queues data to send
+// without blocking and splits the received data into lines.
 //
 // It uses the API for the following Azure Sphere application libraries:
 // - UART (serial port)
@@ -41,7 +42,9 @@
 // See https://aka.ms/AzureSphereHardwareDefinitions for more details.
 #include <hw/sample_appliance.h>
 
+#include "async_log.h"
 #include "eventloop_timer_utilities.h"
+#include "uart_stream.h"
 
 /// <summary>
 /// Exit codes for this application. These are used for the
@@ -51,16 +54,17 @@
 typedef enum {
     ExitCode_Success = 0,
     ExitCode_TermHandler_SigTerm = 1,
-    ExitCode_SendMessage_Write = 2,
+    ExitCode_UartStream_Error = 2,
     ExitCode_ButtonTimer_Consume = 3,
     ExitCode_ButtonTimer_GetValue = 4,
-    ExitCode_UartEvent_Read = 5,
+    ExitCode_SendMessage_Queue = 5,
     ExitCode_Init_EventLoop = 6,
     ExitCode_Init_UartOpen = 7,
-    ExitCode_Init_RegisterIo = 8,
+    ExitCode_Init_UartStream = 8,
     ExitCode_Init_OpenButton = 9,
     ExitCode_Init_ButtonPollTimer = 10,
-    ExitCode_Main_EventLoopFail = 11
+    ExitCode_Main_EventLoopFail = 11,
+    ExitCode_Init_AsyncLog = 12
 } ExitCode;
 
 // File descriptors - initialized to invalid value
@@ -68,7 +72,7 @@ static int uartFd = -1;
 static int gpioButtonFd = -1;
 
 EventLoop *eventLoop = NULL;
-EventRegistration *uartEventReg = NULL;
+UartStream *uartStream = NULL;
 EventLoopTimer *buttonPollTimer = NULL;
 
 // State variables
@@ -78,9 +82,10 @@ static GPIO_Value_Type buttonState = GPIO_Value_High;
 static volatile sig_atomic_t exitCode = ExitCode_Success;
 
 static void TerminationHandler(int signalNumber);
-static void SendUartMessage(int uartFd, const char *dataToSend);
+static void SendUartMessage(const char *dataToSend);
 static void ButtonTimerEventHandler(EventLoopTimer *timer);
-static void UartEventHandler(EventLoop *el, int fd, EventLoop_IoEvents events, void *context);
+static void UartFrameHandler(const uint8_t *frame, size_t length, void *context);
+static void UartErrorHandler(int error, void *context);
 static ExitCode InitPeripheralsAndHandlers(void);
 static void CloseFdAndPrintError(int fd, const char *fdName);
 static void ClosePeripheralsAndHandlers(void);
@@ -95,32 +100,26 @@ static void TerminationHandler(int signalNumber)
 }
 
 /// <summary>
-///     Helper function to send a fixed message via the given UART.
+///     Helper function to queue a line to send over the UART. The UART stream appends the newline
+///     and writes the line from the event loop if the UART cannot accept all of it immediately.
 /// </summary>
-/// <param name="uartFd">The open file descriptor of the UART to write to</param>
-/// <param name="dataToSend">The data to send over the UART</param>
-static void SendUartMessage(int uartFd, const char *dataToSend)
+/// <param name="dataToSend">The line to send over the UART, without a newline</param>
+static void SendUartMessage(const char *dataToSend)
 {
-    size_t totalBytesSent = 0;
-    size_t totalBytesToSend = strlen(dataToSend);
-    int sendIterations = 0;
-    while (totalBytesSent < totalBytesToSend) {
-        sendIterations++;
-
-        // Send as much of the remaining data as possible
-        size_t bytesLeftToSend = totalBytesToSend - totalBytesSent;
-        const char *remainingMessageToSend = dataToSend + totalBytesSent;
-        ssize_t bytesSent = write(uartFd, remainingMessageToSend, bytesLeftToSend);
-        if (bytesSent == -1) {
-            Log_Debug("ERROR: Could not write to UART: %s (%d).\n", strerror(errno), errno);
-            exitCode = ExitCode_SendMessage_Write;
+    size_t length = strlen(dataToSend);
+    if (UartStream_Send(uartStream, dataToSend, length) != 0) {
+        // A full transmit buffer only loses this message, so it is not fatal.
+        if (errno == ENOBUFS) {
+            ASYNC_LOG_ERROR("ERROR: UART transmit buffer is full; message dropped.\n");
             return;
         }
-
-        totalBytesSent += (size_t)bytesSent;
+        ASYNC_LOG_ERROR("ERROR: Could not send over UART: %s (%d).\n", strerror(errno), errno);
+        exitCode = ExitCode_SendMessage_Queue;
+        return;
     }
 
-    Log_Debug("Sent %zu bytes over UART in %d calls.\n", totalBytesSent, sendIterations);
+    ASYNC_LOG_INFO("Queued %zu bytes for UART; %zu bytes waiting.\n", length + 1,
+                   UartStream_GetPendingBytes(uartStream));
 }
 
 /// <summary>
@@ -146,36 +145,29 @@ static void ButtonTimerEventHandler(EventLoopTimer *timer)
     // The button has GPIO_Value_Low when pressed and GPIO_Value_High when released
     if (newButtonState != buttonState) {
         if (newButtonState == GPIO_Value_Low) {
-            SendUartMessage(uartFd, "Hello world!\n");
+            SendUartMessage("Hello world!");
         }
         buttonState = newButtonState;
     }
 }
 
 /// <summary>
-///     Handle UART event: if there is incoming data, print it.
-///     This satisfies the EventLoopIoCallback signature.
+///     Handle a line which was received over the UART by printing it.
+///     This satisfies the UartStream_FrameHandler signature.
 /// </summary>
-static void UartEventHandler(EventLoop *el, int fd, EventLoop_IoEvents events, void *context)
+static void UartFrameHandler(const uint8_t *frame, size_t length, void *context)
 {
-    const size_t receiveBufferSize = 256;
-    uint8_t receiveBuffer[receiveBufferSize + 1]; // allow extra byte for string termination
-    ssize_t bytesRead;
-
-    // Read incoming UART data. It is expected behavior that messages may be received in multiple
-    // partial chunks.
-    bytesRead = read(uartFd, receiveBuffer, receiveBufferSize);
-    if (bytesRead == -1) {
-        Log_Debug("ERROR: Could not read UART: %s (%d).\n", strerror(errno), errno);
-        exitCode = ExitCode_UartEvent_Read;
-        return;
-    }
+    ASYNC_LOG_INFO("UART received %zu bytes: '%.*s'.\n", length, (int)length, (const char *)frame);
+}
 
-    if (bytesRead > 0) {
-        // Null terminate the buffer to make it a valid string, and print it
-        receiveBuffer[bytesRead] = 0;
-        Log_Debug("UART received %d bytes: '%s'.\n", bytesRead, (char *)receiveBuffer);
-    }
+/// <summary>
+///     Handle a failure to read or write the UART.
+///     This satisfies the UartStream_ErrorHandler signature.
+/// </summary>
+static void UartErrorHandler(int error, void *context)
+{
+    ASYNC_LOG_ERROR("ERROR: UART failed: %s (%d).\n", strerror(error), error);
+    exitCode = ExitCode_UartStream_Error;
 }
 
 /// <summary>
@@ -198,7 +190,12 @@ static ExitCode InitPeripheralsAndHandlers(void)
         return ExitCode_Init_EventLoop;
     }
 
-    // Create a UART_Config object, open the UART and set up UART event handler
+    // Messages from the UART and button handlers are written from the event loop.
+    if (AsyncLog_Initialize(eventLoop) != 0) {
+        return ExitCode_Init_AsyncLog;
+    }
+
+    // Create a UART_Config object, open the UART and set up a UART stream to drive it
     UART_Config uartConfig;
     UART_InitConfig(&uartConfig);
     uartConfig.baudRate = 115200;
@@ -208,9 +205,13 @@ static ExitCode InitPeripheralsAndHandlers(void)
         Log_Debug("ERROR: Could not open UART: %s (%d).\n", strerror(errno), errno);
         return ExitCode_Init_UartOpen;
     }
-    uartEventReg = EventLoop_RegisterIo(eventLoop, uartFd, EventLoop_Input, UartEventHandler, NULL);
-    if (uartEventReg == NULL) {
-        return ExitCode_Init_RegisterIo;
+    // Received data is split into lines on '\n'.
+    static const UartStream_Config streamConfig = UART_STREAM_DEFAULT_CONFIG;
+    uartStream = UartStream_Create(eventLoop, uartFd, &streamConfig, UartFrameHandler,
+                                   UartErrorHandler, NULL);
+    if (uartStream == NULL) {
+        Log_Debug("ERROR: Could not create UART stream: %s (%d).\n", strerror(errno), errno);
+        return ExitCode_Init_UartStream;
     }
 
     // Open SAMPLE_BUTTON_1 GPIO as input, and set up a timer to poll it
@@ -251,7 +252,11 @@ static void CloseFdAndPrintError(int fd, const char *fdName)
 static void ClosePeripheralsAndHandlers(void)
 {
     DisposeEventLoopTimer(buttonPollTimer);
-    EventLoop_UnregisterIo(eventLoop, uartEventReg);
+    if (uartStream != NULL) {
+        UartStream_LogStatistics(uartStream);
+    }
+    UartStream_Dispose(uartStream);
+    AsyncLog_Cleanup();
     EventLoop_Close(eventLoop);
 
     Log_Debug("Closing file descriptors.\n");
@@ -0,0 +1,198 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <applibs/log.h>
+#include <applibs/storage.h>
+
+#include "connection_history.h"
+
+// Offset of the history within the mutable storage file. The history must fit within the
+// MutableStorage size declared in app_manifest.json.
+#define HISTORY_OFFSET 0
+
+static const uint32_t historyMagic = ('W' << 24) | ('F' << 16) | ('C' << 8) | 'H';
+
+// The history is written in one operation, and its CRC covers all its other fields, so that a
+// history which was only partly written is ignored.
+typedef struct {
+    uint32_t magic;
+    uint32_t networkCount;
+    uint32_t nextConnectionSequence;
+    ConnectionHistory_Network networks[CONNECTION_HISTORY_MAX_NETWORKS];
+    uint32_t crc;
+} History;
+
+static History history;
+
+static uint32_t Crc32(const void *data, size_t length)
+{
+    const uint8_t *bytes = data;
+    uint32_t crc = 0xFFFFFFFFu;
+    while (length-- > 0) {
+        crc ^= *bytes++;
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc >> 1) ^ (0xEDB88320u & -(crc & 1u));
+        }
+    }
+    return ~crc;
+}
+
+static uint32_t HistoryCrc(const History *h)
+{
+    return Crc32(h, offsetof(History, crc));
+}
+
+static void ClearHistory(void)
+{
+    // Zero the history so that the CRC does not depend on padding or on unused entries.
+    memset(&history, 0, sizeof(history));
+    history.magic = historyMagic;
+}
+
+void ConnectionHistory_Load(void)
+{
+    int fd = Storage_OpenMutableFile();
+    if (fd == -1) {
+        Log_Debug("ERROR: Could not open mutable storage: %s (%d).\n", strerror(errno), errno);
+        ClearHistory();
+        return;
+    }
+
+    bool valid = lseek(fd, HISTORY_OFFSET, SEEK_SET) != -1 &&
+                 read(fd, &history, sizeof(history)) == (ssize_t)sizeof(history) &&
+                 history.magic == historyMagic && history.crc == HistoryCrc(&history) &&
+                 history.networkCount <= CONNECTION_HISTORY_MAX_NETWORKS;
+    close(fd);
+
+    if (!valid) {
+        Log_Debug("INFO: No Wi-Fi connection history is stored.\n");
+        ClearHistory();
+    }
+}
+
+static bool WriteHistory(void)
+{
+    int fd = Storage_OpenMutableFile();
+    if (fd == -1) {
+        Log_Debug("ERROR: Could not open mutable storage: %s (%d).\n", strerror(errno), errno);
+        return false;
+    }
+
+    history.crc = HistoryCrc(&history);
+    bool written = lseek(fd, HISTORY_OFFSET, SEEK_SET) != -1 &&
+                   write(fd, &history, sizeof(history)) == (ssize_t)sizeof(history);
+    if (!written) {
+        Log_Debug("ERROR: Could not write the Wi-Fi connection history: %s (%d).\n",
+                  strerror(errno), errno);
+    }
+
+    close(fd);
+    return written;
+}
+
+static ConnectionHistory_Network *FindNetwork(const uint8_t *ssid, size_t ssidLength,
+                                              WifiConfig_Security_Type security)
+{
+    for (size_t i = 0; i < history.networkCount; ++i) {
+        ConnectionHistory_Network *network = &history.networks[i];
+        if (network->ssidLength == ssidLength && network->security == security &&
+            memcmp(network->ssid, ssid, ssidLength) == 0) {
+            return network;
+        }
+    }
+    return NULL;
+}
+
+const ConnectionHistory_Network *ConnectionHistory_Find(const uint8_t *ssid, size_t ssidLength,
+                                                        WifiConfig_Security_Type security)
+{
+    return FindNetwork(ssid, ssidLength, security);
+}
+
+bool ConnectionHistory_RecordConnection(const WifiConfig_ConnectedNetwork *connectedNetwork,
+                                        uint32_t timeToConnectMs)
+{
+    ConnectionHistory_Network *network = FindNetwork(
+        connectedNetwork->ssid, connectedNetwork->ssidLength, connectedNetwork->security);
+    if (network == NULL) {
+        if (history.networkCount < CONNECTION_HISTORY_MAX_NETWORKS) {
+            network = &history.networks[history.networkCount++];
+        } else {
+            // Replace the network which was connected least recently.
+            network = &history.networks[0];
+            for (size_t i = 1; i < history.networkCount; ++i) {
+                if (history.networks[i].connectionSequence < network->connectionSequence) {
+                    network = &history.networks[i];
+                }
+            }
+        }
+        memset(network, 0, sizeof(*network));
+        memcpy(network->ssid, connectedNetwork->ssid, connectedNetwork->ssidLength);
+        network->ssidLength = connectedNetwork->ssidLength;
+        network->security = (uint8_t)connectedNetwork->security;
+    }
+
+    network->signalRssi = connectedNetwork->signalRssi;
+    network->connectionSequence = ++history.nextConnectionSequence;
+    network->timeToConnectMs = timeToConnectMs;
+    network->lastConnectedTime = (int64_t)time(NULL);
+    return WriteHistory();
+}
+
+// Whether network a is preferred to network b.
+static bool IsPreferred(const ConnectionHistory_Network *a, const ConnectionHistory_Network *b)
+{
+    if (b == NULL) {
+        return a != NULL;
+    }
+    if (a == NULL) {
+        return false;
+    }
+    if (a->connectionSequence == history.nextConnectionSequence) {
+        return true;
+    }
+    if (b->connectionSequence == history.nextConnectionSequence) {
+        return false;
+    }
+    return a->signalRssi > b->signalRssi;
+}
+
+size_t ConnectionHistory_RankStoredNetworks(const WifiConfig_StoredNetwork *networks, size_t count,
+                                            int *networkIds)
+{
+    if (count == 0) {
+        return 0;
+    }
+
+    const ConnectionHistory_Network *known[count];
+    size_t enabledCount = 0;
+
+    // Insert each enabled network after those which are preferred to it, so that networks which
+    // are equally preferred keep the order in which they are stored.
+    for (size_t i = 0; i < count; ++i) {
+        if (!networks[i].isEnabled) {
+            continue;
+        }
+
+        const ConnectionHistory_Network *network =
+            FindNetwork(networks[i].ssid, networks[i].ssidLength, networks[i].security);
+        size_t position = enabledCount;
+        while (position > 0 && IsPreferred(network, known[position - 1])) {
+            known[position] = known[position - 1];
+            networkIds[position] = networkIds[position - 1];
+            --position;
+        }
+        known[position] = network;
+        networkIds[position] = (int)i;
+        ++enabledCount;
+    }
+
+    return enabledCount;
+}
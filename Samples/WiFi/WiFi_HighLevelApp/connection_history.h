@@ -0,0 +1,91 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// applibs_versions.h defines the API struct versions to use for applibs APIs.
+#include "applibs_versions.h"
+#include <applibs/wificonfig.h>
+
+// The connection history records in the application's mutable storage, for each Wi-Fi network to
+// which the device has connected, the signal strength at its last connection, when that was, and
+// how long the connection took after the application started. After a restart, the stored networks
+// can then be tried in order of preference: the network to which the device last connected first,
+// followed by the others, strongest first, so that the device does not spend its first seconds
+// trying networks which are weak or out of range.
+//
+// The history is not thread-safe; it should only be used from the event loop's thread.
+
+/// <summary>
+///     Maximum number of networks in the history. When it is full, the network which was connected
+///     least recently is replaced.
+/// </summary>
+#define CONNECTION_HISTORY_MAX_NETWORKS 10
+
+/// <summary>
+///     The history of one network, which is identified by its SSID and security type.
+/// </summary>
+typedef struct {
+    /// <summary>The SSID of the network.</summary>
+    uint8_t ssid[WIFICONFIG_SSID_MAX_LENGTH];
+    /// <summary>The length of the SSID, in bytes.</summary>
+    uint8_t ssidLength;
+    /// <summary>The security type of the network, as a WifiConfig_Security_Type.</summary>
+    uint8_t security;
+    /// <summary>The RSSI when the device last connected to the network.</summary>
+    int8_t signalRssi;
+    /// <summary>Reserved; must be 0.</summary>
+    uint8_t reserved;
+    /// <summary>Orders the connections; the most recent connection has the highest.</summary>
+    uint32_t connectionSequence;
+    /// <summary>Milliseconds from the application starting to its last connection to the
+    /// network, or 0 if it connected after the application had been running for a while.</summary>
+    uint32_t timeToConnectMs;
+    /// <summary>Seconds since the epoch when the device last connected to the network, which may
+    /// be wrong if the clock had not yet been set.</summary>
+    int64_t lastConnectedTime;
+} ConnectionHistory_Network;
+
+/// <summary>
+///     Reads the history from mutable storage. The history is empty if none has been stored, or if
+///     it is corrupt.
+/// </summary>
+void ConnectionHistory_Load(void);
+
+/// <summary>
+///     Records a connection to a network, and writes the history to mutable storage.
+/// </summary>
+/// <param name="network">The network to which the device is connected.</param>
+/// <param name="timeToConnectMs">Milliseconds from the application starting to the connection,
+/// or 0 if that is not known.</param>
+/// <returns>true on success; false if the history could not be written.</returns>
+bool ConnectionHistory_RecordConnection(const WifiConfig_ConnectedNetwork *network,
+                                        uint32_t timeToConnectMs);
+
+/// <summary>
+///     Gets the history of a network.
+/// </summary>
+/// <param name="ssid">The SSID of the network.</param>
+/// <param name="ssidLength">The length of the SSID, in bytes.</param>
+/// <param name="security">The security type of the network.</param>
+/// <returns>The history of the network, or NULL if the device has not connected to it.</returns>
+const ConnectionHistory_Network *ConnectionHistory_Find(const uint8_t *ssid, size_t ssidLength,
+                                                        WifiConfig_Security_Type security);
+
+/// <summary>
+///     Orders the enabled stored networks by preference: the network to which the device last
+///     connected, then the others to which it has connected, strongest first, then those to which
+///     it has not connected, in the order in which they are stored. Disabled networks are left
+///     out.
+/// </summary>
+/// <param name="networks">The stored networks, whose indices are their network IDs.</param>
+/// <param name="count">The number of stored networks.</param>
+/// <param name="networkIds">Receives the IDs of the enabled networks, most preferred first; it
+/// must have room for count IDs.</param>
+/// <returns>The number of IDs in networkIds.</returns>
+size_t ConnectionHistory_RankStoredNetworks(const WifiConfig_StoredNetwork *networks, size_t count,
+                                            int *networkIds);
@@ -46,7 +46,11 @@
 #include <hw/sample_appliance.h>
 
 // This sample uses a single-thread event loop pattern.
+#include "button_input.h"
+#include "connection_history.h"
 #include "eventloop_timer_utilities.h"
+#include "wifi_diagnostics.h"
+#include "wifi_scan_results.h"
 
 /// <summary>
 /// Exit codes for this application. These are used for the
@@ -78,17 +82,16 @@ typedef enum {
 
     ExitCode_OutputStored_RetrieveNetworks = 15,
 
-    ExitCode_OutputScanned_TriggerScan = 16,
-    ExitCode_OutputScanned_GetScanned = 17,
+    ExitCode_OutputScanned_Scan = 16,
 
-    ExitCode_IsButtonPressed_GetValue = 19,
+    ExitCode_Buttons_GetValue = 19,
 
-    ExitCode_ButtonTimerHandler_Consume = 20,
+    ExitCode_Buttons_Timer = 20,
 
     ExitCode_Init_EventLoop = 21,
     ExitCode_Init_SampleButton = 22,
     ExitCode_Init_StatusButton = 23,
-    ExitCode_Init_ButtonTimer = 24,
+    ExitCode_Init_Buttons = 24,
 
     ExitCode_Main_EventLoopFail = 25,
 
@@ -104,12 +107,23 @@ typedef enum {
     ExitCode_EapTlsNetworkInformation_GetConnectedNetworkId = 34,
     ExitCode_EapTlsNetworkInformation_GetClientIdentity = 35,
     ExitCode_EapTlsNetworkInformation_GetClientCertStoreIdentifier = 36,
-    ExitCode_EapTlsNetworkInformation_GetRootCACertStoreIdentifier = 37
+    ExitCode_EapTlsNetworkInformation_GetRootCACertStoreIdentifier = 37,
+    ExitCode_Init_AddSampleButton = 38,
+    ExitCode_Init_AddStatusButton = 39,
+    ExitCode_Init_ConnectionPollTimer = 40,
+    ExitCode_FastReconnect_RetrieveNetworks = 41,
+    ExitCode_ConnectionPoll_Consume = 42,
+    ExitCode_Init_WifiDiagnostics = 43
 
 } ExitCode;
 
 // The MT3620 currently handles a maximum of 10 stored wifi networks.
-static const unsigned int MAX_NUMBER_STORED_NETWORKS = 10;
+#define MAX_NUMBER_STORED_NETWORKS 10
+
+// Scanned networks are read into a static buffer, so that a large scan cannot overflow the stack,
+// and only the strongest of them are shown.
+static WifiConfig_ScannedNetwork scannedNetworks[WIFI_SCAN_RESULTS_MAX_NETWORKS];
+#define MAX_NUMBER_SHOWN_SCANNED_NETWORKS 16
 
 // Network configuration: Configure the variables with the appropriate settings for your network
 static const uint8_t sampleNetworkSsid[] = "WIFI_NETWORK_SSID";
@@ -146,32 +160,54 @@ static int showNetworkStatusButtonGpioFd = -1;
 static const char networkInterface[] = "wlan0";
 
 static EventLoop *eventLoop = NULL;
-static EventLoopTimer *buttonPollTimer = NULL;
 
-// Button state variables
-static GPIO_Value_Type changeNetworkConfigButtonState = GPIO_Value_High;
-static GPIO_Value_Type showNetworkStatusButtonState = GPIO_Value_High;
+// The Wi-Fi connection is sampled in the background, and summarized every five minutes; the
+// most recent samples are shown with the network status.
+#define WIFI_DIAGNOSTICS_REPORT_PERIOD_SECONDS (5 * 60)
+#define MAX_NUMBER_SHOWN_WIFI_SAMPLES 8
+static ButtonInput *buttons = NULL;
+
+// After the application starts, only the most preferred of the enabled stored networks is left
+// enabled, with targeted scanning, so that the device connects to it without first trying networks
+// which are weak or out of range; if it has not connected within FAST_RECONNECT_ATTEMPT_MS, the
+// next network is tried in the same way. Once the device connects, or every network has been
+// tried, all the networks are enabled again. None of these changes is persisted.
+#define FAST_RECONNECT_ATTEMPT_MS 8000
+static const struct timespec connectingPollPeriod = {.tv_sec = 0, .tv_nsec = 250 * 1000 * 1000};
+static const struct timespec connectedPollPeriod = {.tv_sec = 10, .tv_nsec = 0};
+static EventLoopTimer *connectionPollTimer = NULL;
+static int preferredNetworkIds[MAX_NUMBER_STORED_NETWORKS];
+static size_t preferredNetworkCount = 0;
+static size_t preferredNetworkIndex = 0;
+static bool fastReconnectActive = false;
+static struct timespec appStartTime;
+static struct timespec attemptStartTime;
+// Whether the application started before the device connected, so the time it took is known.
+static bool timeToConnectKnown = false;
+// Whether the current connection has been recorded in the connection history.
+static bool connectionRecorded = false;
 
 static void TerminationHandler(int signalNumber);
 static void StateStatusOutputHelper(const char *currentStateMessage, const char *nextStateMessage,
                                     bool statusIsSuccessful);
-static bool IsSameScannedWifiNetwork(const WifiConfig_ScannedNetwork *target,
-                                     const WifiConfig_ScannedNetwork *source);
 static ExitCode WifiRetrieveStoredNetworks(ssize_t *numberOfNetworksStored,
                                            WifiConfig_StoredNetwork *storedNetworksArray);
 
-int CompareSsid(const void *network1, const void *network2);
-static void SortAndDeduplicateAvailableNetworks(
-    const WifiConfig_ScannedNetwork *scannedNetworksArray, size_t numberOfScannedNetworks);
+static void OutputAvailableNetworks(size_t numberOfNetworks);
 static ExitCode CheckNetworkIfConnectedToInternet(void);
 static ExitCode CheckCurrentWifiNetworkStatus(void);
 static ExitCode OutputStoredWifiNetworks(void);
 static ExitCode RetrieveNetworkDiagnostics(void);
 static ExitCode OutputScannedWifiNetworks(void);
 static ExitCode OutputEapTlsInformation(void);
+static void OutputRecentWifiSamples(void);
 static void ShowDeviceNetworkStatus(void);
-static bool IsButtonPressed(int fd, GPIO_Value_Type *oldState);
-static void ButtonEventTimeHandler(EventLoopTimer *timer);
+static ExitCode StartFastReconnect(void);
+static void EndFastReconnect(void);
+static void ConnectionPollTimerEventHandler(EventLoopTimer *timer);
+static void ButtonEventHandler(int gpioFd, ButtonInput_Event event, unsigned int count,
+                               void *context);
+static void ButtonsErrorHandler(int gpioFd, void *context);
 static ExitCode InitPeripheralsAndHandlers(void);
 static void CloseFdAndPrintError(int fd, const char *fdName);
 static void ClosePeripheralsAndHandlers(void);
@@ -227,22 +263,6 @@ static void StateStatusOutputHelper(const char *currentStateMessage, const char
         currentStateMessage, nextStateMessage);
 }
 
-/// <summary>
-///     Checks if the given scanned network is the same as the one specified in the configuration
-///     above.
-/// </summary>
-/// <param name="target">Target network used for comparison</param>
-/// <param name="source">Source network used for comparison</param>
-/// <returns>True if is the same access point, false otherwise</returns>
-static bool IsSameScannedWifiNetwork(const WifiConfig_ScannedNetwork *target,
-                                     const WifiConfig_ScannedNetwork *source)
-{
-    if (target->security == source->security && target->ssidLength == source->ssidLength) {
-        return 0 == memcmp(target->ssid, source->ssid, target->ssidLength);
-    }
-    return false;
-}
-
 /// <summary>
 ///     Retrieves the stored networks on the device.
 /// </summary>
@@ -633,66 +653,30 @@ static void WifiNetworkDeleteState(void)
 }
 
 /// <summary>
-///     Comparison function used to sort available networks based on SSID.
-/// </summary>
-/// <param name="network1">The first scanned network to compare</param>
-/// <param name="network2">The second scanned network to compare</param>
-int CompareSsid(const void *network1, const void *network2)
-{
-    const WifiConfig_ScannedNetwork *scannedNetwork1 = (const WifiConfig_ScannedNetwork *)network1;
-    const WifiConfig_ScannedNetwork *scannedNetwork2 = (const WifiConfig_ScannedNetwork *)network2;
-    size_t minSsidLength = 0;
-    if (scannedNetwork1->ssidLength > scannedNetwork2->ssidLength) {
-        minSsidLength = scannedNetwork2->ssidLength;
-    } else {
-        minSsidLength = scannedNetwork1->ssidLength;
-    }
-
-    return memcmp(scannedNetwork1->ssid, scannedNetwork2->ssid, minSsidLength);
-}
-
-/// <summary>
-///     Sorts the available scanned networks based on their RSSI signals and outputs the SSID and
-///     the RSSI signal.
+///     Outputs the SSID, security type and RSSI signal of the strongest available networks,
+///     strongest first.
 /// </summary>
-/// <param name="scannedNetworksArray">An array which contains the scanned networks</param>
-/// <param name="numberOfScannedNetworks">The size of the array</param>
-static void SortAndDeduplicateAvailableNetworks(
-    const WifiConfig_ScannedNetwork *scannedNetworksArray, size_t numberOfScannedNetworks)
+/// <param name="numberOfNetworks">The number of deduplicated networks in scannedNetworks</param>
+static void OutputAvailableNetworks(size_t numberOfNetworks)
 {
-    // sort the array based on the SSID
-    qsort((void *)scannedNetworksArray, numberOfScannedNetworks, sizeof(WifiConfig_ScannedNetwork),
-          CompareSsid);
-
-    WifiConfig_ScannedNetwork deduplicatedScannedNetworks[numberOfScannedNetworks];
-    deduplicatedScannedNetworks[0] = scannedNetworksArray[0];
-    size_t j = 0;
-    size_t i = 1;
-
-    // iterate over the array and keep the SSID with the highest RSSI signal
-    for (i = 1; i < numberOfScannedNetworks; ++i) {
-        if (!IsSameScannedWifiNetwork(&deduplicatedScannedNetworks[j], &scannedNetworksArray[i])) {
-            j++;
-            deduplicatedScannedNetworks[j] = scannedNetworksArray[i];
-        } else if (deduplicatedScannedNetworks[j].signalRssi < scannedNetworksArray[i].signalRssi) {
-            deduplicatedScannedNetworks[j] = scannedNetworksArray[i];
-        }
-    }
-    size_t numberOfDeduplicatedNetworks = j + 1;
+    size_t numberOfShownNetworks = WifiScanResults_SelectStrongest(
+        scannedNetworks, numberOfNetworks, MAX_NUMBER_SHOWN_SCANNED_NETWORKS);
 
     Log_Debug("INFO: Available Wi-Fi networks:\n");
-    for (i = 0; i < numberOfDeduplicatedNetworks; ++i) {
-        for (j = 0; j < deduplicatedScannedNetworks[i].ssidLength; ++j) {
-            Log_Debug("%c", isprint(deduplicatedScannedNetworks[i].ssid[j])
-                                ? deduplicatedScannedNetworks[i].ssid[j]
-                                : '.');
+    for (size_t i = 0; i < numberOfShownNetworks; ++i) {
+        for (size_t j = 0; j < scannedNetworks[i].ssidLength; ++j) {
+            Log_Debug("%c", isprint(scannedNetworks[i].ssid[j]) ? scannedNetworks[i].ssid[j] : '.');
         }
-        assert(deduplicatedScannedNetworks[i].security == WifiConfig_Security_Open ||
-               deduplicatedScannedNetworks[i].security == WifiConfig_Security_Wpa2_Psk ||
-               deduplicatedScannedNetworks[i].security == WifiConfig_Security_Wpa2_EAP_TLS ||
-               deduplicatedScannedNetworks[i].security == WifiConfig_Security_Unknown);
-        Log_Debug(" : %s : %d dB\n", securityTypeToString[deduplicatedScannedNetworks[i].security],
-                  deduplicatedScannedNetworks[i].signalRssi);
+        assert(scannedNetworks[i].security == WifiConfig_Security_Open ||
+               scannedNetworks[i].security == WifiConfig_Security_Wpa2_Psk ||
+               scannedNetworks[i].security == WifiConfig_Security_Wpa2_EAP_TLS ||
+               scannedNetworks[i].security == WifiConfig_Security_Unknown);
+        Log_Debug(" : %s : %d dB\n", securityTypeToString[scannedNetworks[i].security],
+                  scannedNetworks[i].signalRssi);
+    }
+    if (numberOfNetworks > numberOfShownNetworks) {
+        Log_Debug("INFO: %zu weaker networks are not shown.\n",
+                  numberOfNetworks - numberOfShownNetworks);
     }
 }
 
@@ -857,7 +841,7 @@ static ExitCode OutputStoredWifiNetworks(void)
 
 /// <summary>
 ///     Triggers a Wi-Fi network scan, stores the available networks, deduplicates them and outputs
-///     the SSID of the available networks sorted and deduplicated based on their SSID.
+///     the SSID of the strongest available networks, sorted by their RSSI signal.
 /// </summary>
 /// <returns>
 ///     ExitCode_Success on success; otherwise another ExitCode value which indicates
@@ -866,11 +850,11 @@ static ExitCode OutputStoredWifiNetworks(void)
 static ExitCode OutputScannedWifiNetworks(void)
 {
     // Check the available Wi-Fi networks
-    ssize_t numberOfNetworks = WifiConfig_TriggerScanAndGetScannedNetworkCount();
+    ssize_t numberOfNetworks =
+        WifiScanResults_Scan(scannedNetworks, WIFI_SCAN_RESULTS_MAX_NETWORKS, NULL);
     if (numberOfNetworks == -1) {
-        Log_Debug("ERROR: WifiConfig_TriggerScanAndGetScannedNetworkCount failed: %s (%d).\n",
-                  strerror(errno), errno);
-        return ExitCode_OutputScanned_TriggerScan;
+        Log_Debug("ERROR: Wi-Fi scan failed: %s (%d).\n", strerror(errno), errno);
+        return ExitCode_OutputScanned_Scan;
     }
 
     if (numberOfNetworks == 0) {
@@ -878,16 +862,7 @@ static ExitCode OutputScannedWifiNetworks(void)
         return ExitCode_Success;
     }
 
-    WifiConfig_ScannedNetwork scannedNetworksArray[numberOfNetworks];
-    ssize_t numberOfScannedNetworks =
-        WifiConfig_GetScannedNetworks(scannedNetworksArray, (size_t)numberOfNetworks);
-    if (numberOfScannedNetworks == -1) {
-        Log_Debug("ERROR: WifiConfig_GetScannedNetworks failed: %s (%d).\n", strerror(errno),
-                  errno);
-        return ExitCode_OutputScanned_GetScanned;
-    }
-
-    SortAndDeduplicateAvailableNetworks(scannedNetworksArray, (size_t)numberOfScannedNetworks);
+    OutputAvailableNetworks((size_t)numberOfNetworks);
 
     return ExitCode_Success;
 }
@@ -961,6 +936,26 @@ static ExitCode RetrieveNetworkDiagnostics(void)
     return ExitCode_Success;
 }
 
+/// <summary>
+///     Outputs the most recent samples of the Wi-Fi connection which were taken in the
+///     background, oldest first.
+/// </summary>
+static void OutputRecentWifiSamples(void)
+{
+    WifiDiagnostics_Sample samples[MAX_NUMBER_SHOWN_WIFI_SAMPLES];
+    size_t sampleCount = WifiDiagnostics_GetHistory(samples, MAX_NUMBER_SHOWN_WIFI_SAMPLES);
+
+    Log_Debug("INFO: Recent Wi-Fi samples:\n");
+    for (size_t i = 0; i < sampleCount; ++i) {
+        if (samples[i].connected) {
+            Log_Debug("INFO:   %6lu s : %d dB : %u MHz\n", (unsigned long)samples[i].uptimeSeconds,
+                      samples[i].signalRssi, samples[i].frequencyMHz);
+        } else {
+            Log_Debug("INFO:   %6lu s : not connected\n", (unsigned long)samples[i].uptimeSeconds);
+        }
+    }
+}
+
 /// <summary>
 ///     Checks if the device is connected to any Wi-Fi networks. Outputs the stored Wi-Fi networks.
 ///     Triggers a Wi-Fi network scan, and outputs the available Wi-Fi networks.
@@ -975,6 +970,7 @@ static void ShowDeviceNetworkStatus(void)
 
     if (localExitCode == ExitCode_Success) {
         localExitCode = RetrieveNetworkDiagnostics();
+        OutputRecentWifiSamples();
     }
 
     if (localExitCode == ExitCode_Success) {
@@ -989,53 +985,198 @@ static void ShowDeviceNetworkStatus(void)
 }
 
 /// <summary>
-///     Check whether a given button has just been pressed.
+///     Gets the number of milliseconds since a time.
+/// </summary>
+/// <param name="start">The time, from CLOCK_MONOTONIC.</param>
+/// <returns>The number of milliseconds which have elapsed since the time.</returns>
+static uint32_t MillisecondsSince(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t)((now.tv_sec - start->tv_sec) * 1000 +
+                      (now.tv_nsec - start->tv_nsec) / 1000000);
+}
+
+/// <summary>
+///     Leaves only one of the preferred networks enabled, with targeted scanning, and disables
+///     the others. The changes are not persisted.
+/// </summary>
+/// <param name="index">The index in preferredNetworkIds of the network to try.</param>
+/// <returns>true on success; false if the networks could not be changed.</returns>
+static bool TryPreferredNetwork(size_t index)
+{
+    for (size_t i = 0; i < preferredNetworkCount; ++i) {
+        bool tried = (i == index);
+        if (WifiConfig_SetNetworkEnabled(preferredNetworkIds[i], tried) == -1 ||
+            WifiConfig_SetTargetedScanEnabled(preferredNetworkIds[i], tried) == -1) {
+            Log_Debug("ERROR: Could not change network %d for fast reconnect: %s (%d).\n",
+                      preferredNetworkIds[i], strerror(errno), errno);
+            return false;
+        }
+    }
+
+    Log_Debug("INFO: Trying stored network %d (preference %zu of %zu).\n",
+              preferredNetworkIds[index], index + 1, preferredNetworkCount);
+    preferredNetworkIndex = index;
+    clock_gettime(CLOCK_MONOTONIC, &attemptStartTime);
+    return true;
+}
+
+/// <summary>
+///     Orders the enabled stored networks by their connection history, and tries the most
+///     preferred one first, if there is more than one. This is called as the application starts.
+/// </summary>
+/// <returns>
+///     ExitCode_Success on success; otherwise another ExitCode value which indicates
+///     the specific failure.
+/// </returns>
+static ExitCode StartFastReconnect(void)
+{
+    clock_gettime(CLOCK_MONOTONIC, &appStartTime);
+    ConnectionHistory_Load();
+
+    connectionPollTimer = CreateEventLoopPeriodicTimer(eventLoop, &ConnectionPollTimerEventHandler,
+                                                       &connectingPollPeriod);
+    if (connectionPollTimer == NULL) {
+        return ExitCode_Init_ConnectionPollTimer;
+    }
+
+    // If the device is already connected, for example because the application was restarted,
+    // there is nothing to speed up.
+    WifiConfig_ConnectedNetwork connectedNetwork;
+    if (WifiConfig_GetCurrentNetwork(&connectedNetwork) == 0) {
+        return ExitCode_Success;
+    }
+    timeToConnectKnown = true;
+
+    ssize_t numberOfNetworksStored;
+    WifiConfig_StoredNetwork storedNetworksArray[MAX_NUMBER_STORED_NETWORKS];
+    if (WifiRetrieveStoredNetworks(&numberOfNetworksStored, storedNetworksArray) !=
+        ExitCode_Success) {
+        return ExitCode_FastReconnect_RetrieveNetworks;
+    }
+
+    preferredNetworkCount = ConnectionHistory_RankStoredNetworks(
+        storedNetworksArray, (size_t)numberOfNetworksStored, preferredNetworkIds);
+    for (size_t i = 0; i < preferredNetworkCount; ++i) {
+        const WifiConfig_StoredNetwork *network = &storedNetworksArray[preferredNetworkIds[i]];
+        const ConnectionHistory_Network *history =
+            ConnectionHistory_Find(network->ssid, network->ssidLength, network->security);
+        if (history != NULL) {
+            Log_Debug("INFO: Stored network %d last connected at %d dB, after %lu ms.\n",
+                      preferredNetworkIds[i], history->signalRssi,
+                      (unsigned long)history->timeToConnectMs);
+        }
+    }
+
+    // With a single enabled network there is no choice to make, so leave the configuration alone.
+    if (preferredNetworkCount < 2) {
+        return ExitCode_Success;
+    }
+
+    fastReconnectActive = true;
+    if (!TryPreferredNetwork(0)) {
+        EndFastReconnect();
+    }
+
+    return ExitCode_Success;
+}
+
+/// <summary>
+///     Enables all the preferred networks again without targeted scanning, so that the device can
+///     connect to any of them. The changes are not persisted.
 /// </summary>
-/// <param name="fd">The button file descriptor</param>
-/// <param name="oldState">Old state of the button (pressed or released)</param>
-/// <returns>True if pressed, false otherwise</returns>
-static bool IsButtonPressed(int fd, GPIO_Value_Type *oldState)
+static void EndFastReconnect(void)
 {
-    bool isButtonPressed = false;
-    GPIO_Value_Type newState;
-    int result = GPIO_GetValue(fd, &newState);
-    if (result != 0) {
-        Log_Debug("ERROR: Could not read button GPIO: %s (%d).\n", strerror(errno), errno);
-        exitCode = ExitCode_IsButtonPressed_GetValue;
-    } else {
-        // Button is pressed if it is low and different than last known state.
-        isButtonPressed = (newState != *oldState) && (newState == GPIO_Value_Low);
-        *oldState = newState;
-    }
-
-    return isButtonPressed;
+    if (!fastReconnectActive) {
+        return;
+    }
+
+    fastReconnectActive = false;
+    for (size_t i = 0; i < preferredNetworkCount; ++i) {
+        if (WifiConfig_SetNetworkEnabled(preferredNetworkIds[i], true) == -1 ||
+            WifiConfig_SetTargetedScanEnabled(preferredNetworkIds[i], false) == -1) {
+            Log_Debug("ERROR: Could not restore network %d after fast reconnect: %s (%d).\n",
+                      preferredNetworkIds[i], strerror(errno), errno);
+        }
+    }
 }
 
 /// <summary>
-/// Button timer event:  Check the status of the buttons.
+///     Connection poll timer event: records each new connection in the connection history, and
+///     moves on to the next preferred network if the device has not connected to the current one
+///     in time.
 /// </summary>
-/// <param name="timer">Timer which has fired.</param>
-static void ButtonEventTimeHandler(EventLoopTimer *timer)
+static void ConnectionPollTimerEventHandler(EventLoopTimer *timer)
 {
     if (ConsumeEventLoopTimerEvent(timer) != 0) {
-        exitCode = ExitCode_ButtonTimerHandler_Consume;
+        exitCode = ExitCode_ConnectionPoll_Consume;
         return;
     }
 
-    // Check if BUTTON_1 was pressed
-    bool isButtonPressed =
-        IsButtonPressed(changeNetworkConfigButtonGpioFd, &changeNetworkConfigButtonState);
-    if (isButtonPressed) {
-        nextStateFunction();
+    WifiConfig_ConnectedNetwork connectedNetwork;
+    if (WifiConfig_GetCurrentNetwork(&connectedNetwork) != 0) {
+        connectionRecorded = false;
+        if (fastReconnectActive &&
+            MillisecondsSince(&attemptStartTime) >= FAST_RECONNECT_ATTEMPT_MS) {
+            if (preferredNetworkIndex + 1 >= preferredNetworkCount ||
+                !TryPreferredNetwork(preferredNetworkIndex + 1)) {
+                Log_Debug("INFO: Fast reconnect failed; trying all stored networks.\n");
+                EndFastReconnect();
+            }
+        }
+        return;
     }
 
-    // Check if BUTTON_2 was pressed
-    isButtonPressed = IsButtonPressed(showNetworkStatusButtonGpioFd, &showNetworkStatusButtonState);
-    if (isButtonPressed) {
+    if (connectionRecorded) {
+        return;
+    }
+
+    uint32_t timeToConnectMs = 0;
+    if (timeToConnectKnown) {
+        timeToConnectMs = MillisecondsSince(&appStartTime);
+        timeToConnectKnown = false;
+        Log_Debug("INFO: Connected to Wi-Fi %lu ms after the application started.\n",
+                  (unsigned long)timeToConnectMs);
+    }
+    connectionRecorded = ConnectionHistory_RecordConnection(&connectedNetwork, timeToConnectMs);
+    EndFastReconnect();
+    SetEventLoopTimerPeriod(connectionPollTimer, &connectedPollPeriod);
+}
+
+/// <summary>
+/// Button event: SAMPLE_BUTTON_1 advances the state, and SAMPLE_BUTTON_2 shows the status.
+/// </summary>
+/// <param name="gpioFd">The button which was pressed.</param>
+/// <param name="event">What happened to the button.</param>
+/// <param name="count">Number of presses in the current run.</param>
+/// <param name="context">Unused.</param>
+static void ButtonEventHandler(int gpioFd, ButtonInput_Event event, unsigned int count,
+                               void *context)
+{
+    if (event != ButtonInput_Event_Pressed) {
+        return;
+    }
+
+    if (gpioFd == changeNetworkConfigButtonGpioFd) {
+        // The state machine changes which networks are enabled, so stop changing them here.
+        EndFastReconnect();
+        nextStateFunction();
+    } else if (gpioFd == showNetworkStatusButtonGpioFd) {
         ShowDeviceNetworkStatus();
     }
 }
 
+/// <summary>
+/// Handle a failure to sample the buttons.
+/// </summary>
+/// <param name="gpioFd">The button which could not be read, or -1 if the timer failed.</param>
+/// <param name="context">Unused.</param>
+static void ButtonsErrorHandler(int gpioFd, void *context)
+{
+    exitCode = (gpioFd == -1) ? ExitCode_Buttons_Timer : ExitCode_Buttons_GetValue;
+}
+
 /// <summary>
 ///     Set up SIGTERM termination handler, initialize peripherals, and set up event handlers.
 /// </summary>
@@ -1056,7 +1197,7 @@ static ExitCode InitPeripheralsAndHandlers(void)
         return ExitCode_Init_EventLoop;
     }
 
-    // Open SAMPLE_BUTTON_1 GPIO as input, and set up a timer to poll it
+    // Open SAMPLE_BUTTON_1 GPIO as input
     Log_Debug("Opening SAMPLE_BUTTON_1 as input.\n");
     changeNetworkConfigButtonGpioFd = GPIO_OpenAsInput(SAMPLE_BUTTON_1);
     if (changeNetworkConfigButtonGpioFd == -1) {
@@ -1074,15 +1215,26 @@ static ExitCode InitPeripheralsAndHandlers(void)
         return ExitCode_Init_StatusButton;
     }
 
-    static const struct timespec buttonPressCheckPeriod100Ms = {.tv_sec = 0,
-                                                                .tv_nsec = 100 * 1000 * 1000};
-    buttonPollTimer = CreateEventLoopPeriodicTimer(eventLoop, &ButtonEventTimeHandler,
-                                                   &buttonPressCheckPeriod100Ms);
-    if (buttonPollTimer == NULL) {
-        return ExitCode_Init_ButtonTimer;
+    // Both buttons are sampled from one timer, which runs quickly only while a button changes
+    buttons = ButtonInput_Create(eventLoop, NULL, ButtonsErrorHandler, NULL);
+    if (buttons == NULL) {
+        return ExitCode_Init_Buttons;
     }
 
-    return ExitCode_Success;
+    if (ButtonInput_Add(buttons, changeNetworkConfigButtonGpioFd, ButtonEventHandler, NULL) != 0) {
+        return ExitCode_Init_AddSampleButton;
+    }
+
+    if (ButtonInput_Add(buttons, showNetworkStatusButtonGpioFd, ButtonEventHandler, NULL) != 0) {
+        return ExitCode_Init_AddStatusButton;
+    }
+
+    // Sample the Wi-Fi connection in the background, and log a summary of each report period.
+    if (WifiDiagnostics_Start(eventLoop, WIFI_DIAGNOSTICS_REPORT_PERIOD_SECONDS, NULL, NULL) != 0) {
+        return ExitCode_Init_WifiDiagnostics;
+    }
+
+    return StartFastReconnect();
 }
 
 /// <summary>
@@ -1105,7 +1257,10 @@ static void CloseFdAndPrintError(int fd, const char *fdName)
 /// </summary>
 static void ClosePeripheralsAndHandlers(void)
 {
-    DisposeEventLoopTimer(buttonPollTimer);
+    EndFastReconnect();
+    DisposeEventLoopTimer(connectionPollTimer);
+    WifiDiagnostics_Stop();
+    ButtonInput_Dispose(buttons);
     EventLoop_Close(eventLoop);
 
     Log_Debug("\nClosing file descriptors.\n");
@@ -3,6 +3,7 @@
 
 #include "blecontrol_message_protocol.h"
 #include "blecontrol_message_protocol_defs.h"
+#include "blecontrol_message_protocol_codec.h"
 #include "message_protocol.h"
 #include "epoll_timerfd_utilities.h"
 #include <applibs/log.h>
@@ -25,6 +26,11 @@ static int bleAdvertiseToAllTimerFd = -1;
 
 static BleControlMessageProtocol_BleAdvertisingMode currentAdvertisingMode;
 static BleControlMessageProtocol_BleAdvertisingMode desiredAdvertisingMode;
+// The mode of the last "Change BLE Mode" request which has been sent, and the number of those
+// requests which have not yet been answered, so that a mode which has already been requested is
+// not requested again while its response is outstanding.
+static BleControlMessageProtocol_BleAdvertisingMode requestedAdvertisingMode;
+static unsigned int changeBleAdvertisingModeRequestsOutstanding;
 static BleControlMessageProtocolState blePublicState;
 
 static void GenerateRandomBleDeviceName(void)
@@ -75,16 +81,18 @@ static void SetPasskeyResponseHandler(MessageProtocol_CategoryId categoryId,
 
 static void SendSetPasskeyRequest(void)
 {
-    if (MessageProtocol_IsIdle()) {
+    if (MessageProtocol_CanSendRequest()) {
         BleControlMessageProtocol_SetPasskeyStruct passkey;
         memset(&passkey, 0, sizeof(passkey));
         GenerateRandomBlePasskey();
         memcpy(passkey.passkey, blePasskey, BLE_PASSKEY_LEN);
+        uint8_t body[BleControl_SetPasskey_EncodedSize];
+        size_t bodySize = BleControl_SetPasskey_Encode(&passkey, body);
 
         Log_Debug("INFO: Sending \"Set Passkey\" request.\n");
-        MessageProtocol_SendRequest(
-            MessageProtocol_BleControlCategoryId, BleControlMessageProtocol_SetPasskeyRequestId,
-            (const uint8_t *)&passkey, sizeof(passkey), &SetPasskeyResponseHandler);
+        MessageProtocol_SendRequest(MessageProtocol_BleControlCategoryId,
+                                    BleControlMessageProtocol_SetPasskeyRequestId, body, bodySize,
+                                    &SetPasskeyResponseHandler);
         setPasskeyRequired = false;
     } else {
         setPasskeyRequired = true;
@@ -125,6 +133,10 @@ static void ChangeBleAdvertisingModeResponseHandler(MessageProtocol_CategoryId c
                                                     MessageProtocol_ResponseResult result,
                                                     bool timedOut)
 {
+    if (changeBleAdvertisingModeRequestsOutstanding > 0) {
+        --changeBleAdvertisingModeRequestsOutstanding;
+    }
+
     if (timedOut) {
         Log_Debug("ERROR: Timed out waiting for \"Change BLE Mode\" response.\n");
         ChangeBleProtocolState(BleControlMessageProtocolState_Error);
@@ -137,17 +149,16 @@ static void ChangeBleAdvertisingModeResponseHandler(MessageProtocol_CategoryId c
         return;
     }
 
-    if (dataSize != sizeof(BleControlMessageProtocol_ChangeBleAdvertisingModeStruct)) {
+    BleControlMessageProtocol_ChangeBleAdvertisingModeStruct newBleAdvertisingModeData;
+    if (!BleControl_ChangeBleAdvertisingMode_Decode(&newBleAdvertisingModeData, data, dataSize)) {
         Log_Debug("ERROR: \"Change BLE Mode\" response is invalid.\n");
         ChangeBleProtocolState(BleControlMessageProtocolState_Error);
         return;
     }
 
-    BleControlMessageProtocol_ChangeBleAdvertisingModeStruct *newBleAdvertisingModeData =
-        (BleControlMessageProtocol_ChangeBleAdvertisingModeStruct *)data;
     BleControlMessageProtocolState newState;
-    currentAdvertisingMode = newBleAdvertisingModeData->mode;
-    switch (newBleAdvertisingModeData->mode) {
+    currentAdvertisingMode = newBleAdvertisingModeData.mode;
+    switch (newBleAdvertisingModeData.mode) {
     case BleControlMessageProtocol_AdvertisingToBondedDevicesMode:
         newState = BleControlMessageProtocolState_AdvertiseToBondedDevices;
         break;
@@ -182,17 +193,18 @@ static void SendDeleteAllBondsResponseHandler(MessageProtocol_CategoryId categor
 
 static void SendInitializeBleDeviceRequest(void)
 {
-    if (MessageProtocol_IsIdle()) {
+    if (MessageProtocol_CanSendRequest()) {
         BleControlMessageProtocol_InitializeBleDeviceStruct initStruct;
         memset(&initStruct, 0, sizeof(initStruct));
         memcpy(initStruct.deviceName, bleDeviceName, bleDeviceNameLength);
         initStruct.deviceNameLength = bleDeviceNameLength;
+        uint8_t body[BleControl_InitializeBleDevice_EncodedSize];
+        size_t bodySize = BleControl_InitializeBleDevice_Encode(&initStruct, body);
         Log_Debug("INFO: Sending \"Initialize BLE device\" request with device name set to: %s.\n",
                   initStruct.deviceName);
         MessageProtocol_SendRequest(MessageProtocol_BleControlCategoryId,
-                                    BleControlMessageProtocol_InitializeDeviceRequestId,
-                                    (const uint8_t *)&initStruct, sizeof(initStruct),
-                                    InitializeBleDeviceResponseHandler);
+                                    BleControlMessageProtocol_InitializeDeviceRequestId, body,
+                                    bodySize, InitializeBleDeviceResponseHandler);
         initializeDeviceRequired = false;
     } else {
         initializeDeviceRequired = true;
@@ -202,17 +214,23 @@ static void SendInitializeBleDeviceRequest(void)
 static void SendChangeBleAdvertisingModeRequest(
     BleControlMessageProtocol_BleAdvertisingMode newMode)
 {
-    if (currentAdvertisingMode != newMode) {
-        if (MessageProtocol_IsIdle()) {
+    BleControlMessageProtocol_BleAdvertisingMode expectedMode =
+        changeBleAdvertisingModeRequestsOutstanding > 0 ? requestedAdvertisingMode
+                                                        : currentAdvertisingMode;
+    if (expectedMode != newMode) {
+        if (MessageProtocol_CanSendRequest()) {
             BleControlMessageProtocol_ChangeBleAdvertisingModeStruct bleAdvertisingMode;
             memset(&bleAdvertisingMode, 0, sizeof(bleAdvertisingMode));
             bleAdvertisingMode.mode = newMode;
+            uint8_t body[BleControl_ChangeBleAdvertisingMode_EncodedSize];
+            size_t bodySize = BleControl_ChangeBleAdvertisingMode_Encode(&bleAdvertisingMode, body);
             Log_Debug("INFO: Sending \"Change BLE mode\" request mode set to: %d.\n", newMode);
             MessageProtocol_SendRequest(MessageProtocol_BleControlCategoryId,
                                         BleControlMessageProtocol_ChangeBleAdvertisingModeRequestId,
-                                        (const uint8_t *)&bleAdvertisingMode,
-                                        sizeof(bleAdvertisingMode),
+                                        body, bodySize,
                                         ChangeBleAdvertisingModeResponseHandler);
+            requestedAdvertisingMode = newMode;
+            ++changeBleAdvertisingModeRequestsOutstanding;
             changeBleAdvertisingModeRequired = false;
         } else {
             desiredAdvertisingMode = newMode;
@@ -225,7 +243,7 @@ static void SendChangeBleAdvertisingModeRequest(
 
 static void SendDeleteAllBondsRequest(void)
 {
-    if (MessageProtocol_IsIdle()) {
+    if (MessageProtocol_CanSendRequest()) {
         Log_Debug("INFO: Sending \"Delete all BLE bonds\" request.\n");
         MessageProtocol_SendRequest(MessageProtocol_BleControlCategoryId,
                                     BleControlMessageProtocol_DeleteAllBleBondsRequestId, NULL, 0,
@@ -244,6 +262,7 @@ static void BleDeviceUpEventHandler(MessageProtocol_CategoryId categoryId,
     initializeDeviceRequired = false;
     setPasskeyRequired = false;
     changeBleAdvertisingModeRequired = false;
+    changeBleAdvertisingModeRequestsOutstanding = 0;
     deleteAllBleBondsDeviceRequired = false;
     struct timespec disabled = {0, 0};
     SetTimerFdToPeriod(bleAdvertiseToAllTimerFd, &disabled);
@@ -364,6 +383,7 @@ int BleControlMessageProtocol_Init(BleControlMessageProtocol_StateChangeHandlerT
     initializeDeviceRequired = false;
     setPasskeyRequired = false;
     changeBleAdvertisingModeRequired = false;
+    changeBleAdvertisingModeRequestsOutstanding = 0;
     deleteAllBleBondsDeviceRequired = false;
     currentAdvertisingMode = BleControlMessageProtocol_NotAdvertisingMode;
     blePublicState = BleControlMessageProtocolState_Uninitialized;
@@ -78,7 +78,7 @@ static void DesiredLedStatusAvailableEventHandler(MessageProtocol_CategoryId cat
                                                   MessageProtocol_EventId eventId)
 {
     Log_Debug("INFO: Handling event: \"Desired LED Status Available\".\n");
-    if (MessageProtocol_IsIdle()) {
+    if (MessageProtocol_CanSendRequest()) {
         SendGetDesiredLedStatusRequest();
     } else {
         getDesiredLedStatusRequestNeeded = true;
@@ -104,7 +104,7 @@ static void SendReportLedStatusRequest(void)
 
 static void ReportLedStatus(void)
 {
-    if (MessageProtocol_IsIdle()) {
+    if (MessageProtocol_CanSendRequest()) {
         SendReportLedStatusRequest();
     } else {
         reportLedStatusRequestNeeded = true;
@@ -120,13 +120,12 @@ static void LedStatusNeededEventHandler(MessageProtocol_CategoryId categoryId,
 
 static void IdleHandler(void)
 {
-    if (getDesiredLedStatusRequestNeeded) {
+    // Several requests can be outstanding, so send each one which is waiting while there is room.
+    if (getDesiredLedStatusRequestNeeded && MessageProtocol_CanSendRequest()) {
         SendGetDesiredLedStatusRequest();
-        return;
     }
-    if (reportLedStatusRequestNeeded) {
+    if (reportLedStatusRequestNeeded && MessageProtocol_CanSendRequest()) {
         SendReportLedStatusRequest();
-        return;
     }
 }
 
@@ -2,7 +2,7 @@
    Licensed under the MIT License. */
 
 #pragma once
-#include "message_protocol_public.h"
+#include "message_protocol_categories.h"
 #include <stdint.h>
 
 /// <summary>Request ID for a Get Desired LED Status request message.</summary>
@@ -30,6 +30,9 @@ typedef enum {
 
     ExitCode_Main_EventCall = 15,
 
-    ExitCode_MsgProtoInit_UartHandler = 16,
-    ExitCode_MsgProtoInit_Timer = 17
+    ExitCode_Init_EventLoop = 16,
+    ExitCode_MsgProtoInit = 17,
+    ExitCode_Init_MemoryMonitor = 18,
+    ExitCode_Init_WifiConfig = 19,
+    ExitCode_Init_WorkerPool = 20
 } ExitCode;
@@ -24,6 +24,7 @@
 // - GPIO (digital inputs and outputs)
 // - log (messages shown in Visual Studio's Device Output window during debugging)
 // - wificonfig (configure Wi-Fi settings)
+// - eventloop (system invokes handlers for IO events)
 
 #include <errno.h>
 #include <signal.h>
@@ -37,6 +38,7 @@
 #include <applibs/gpio.h>
 #include <applibs/uart.h>
 #include <applibs/log.h>
+#include <applibs/eventloop.h>
 #include <applibs/wificonfig.h>
 
 // The following #include imports a "sample appliance" definition. This app comes with multiple
@@ -52,15 +54,19 @@
 //
 // See https://aka.ms/AzureSphereHardwareDefinitions for more details.
 #include <hw/sample_appliance.h>
+#include <hw/uart_profiles.h>
 
 // This sample uses a single-thread event loop pattern, based on epoll and timerfd
 #include "epoll_timerfd_utilities.h"
 
 #include "message_protocol.h"
+#include "uart_transport.h"
 #include "blecontrol_message_protocol.h"
 #include "wificonfig_message_protocol.h"
 #include "devicecontrol_message_protocol.h"
 #include "exitcode_wifible.h"
+#include "memory_monitor.h"
+#include "worker_pool.h"
 
 // File descriptors - initialized to invalid value
 static int buttonTimerFd = -1;
@@ -69,8 +75,11 @@ static int bleAdvertiseToAllDevicesLedGpioFd = -1;
 static int bleConnectedLedGpioFd = -1;
 static int deviceControlLedGpioFd = -1;
 static int epollFd = -1;
-static int uartFd = -1;
 static int bleDeviceResetPinGpioFd = -1;
+
+// The message protocol library uses an EventLoop, which is serviced from epoll via its wait
+// descriptor.
+static EventLoop *eventLoop = NULL;
 static struct timespec bleAdvertiseToAllTimeoutPeriod = {60u, 0};
 static GPIO_Value_Type deviceStatusLedGpioFd = GPIO_Value_High;
 
@@ -196,6 +205,8 @@ static void UpdateBleLedStatus(BleControlMessageProtocolState state)
 static void BleStateChangeHandler(BleControlMessageProtocolState state)
 {
     UpdateBleLedStatus(state);
+    WifiConfigMessageProtocol_SetDeviceConnected(state ==
+                                                 BleControlMessageProtocolState_DeviceConnected);
     switch (state) {
     case BleControlMessageProtocolState_Error:
         Log_Debug("INFO: BLE device is in an error state, resetting it...\n");
@@ -298,8 +309,19 @@ static void ButtonTimerEventHandler(EventData *eventData)
     // No actions are defined for other events.
 }
 
+/// <summary>
+///     Handle events on the EventLoop used by the message protocol and UART transport.
+/// </summary>
+static void EventLoopEventHandler(EventData *eventData)
+{
+    if (EventLoop_Run(eventLoop, 0, true) == EventLoop_Run_Failed) {
+        exitCode = ExitCode_Main_EventCall;
+    }
+}
+
 // event handler data structures. Only the event handler field needs to be populated.
 static EventData buttonsEventData = {.eventHandler = &ButtonTimerEventHandler};
+static EventData eventLoopEventData = {.eventHandler = &EventLoopEventHandler};
 
 /// <summary>
 ///     Set up SIGTERM termination handler, initialize peripherals, and set up event handlers.
@@ -328,24 +350,44 @@ static ExitCode InitPeripheralsAndHandlers(void)
         return ExitCode_Init_Epoll;
     }
 
-    // Open the UART and set up UART event handler.
-    UART_Config uartConfig;
-    UART_InitConfig(&uartConfig);
-    uartConfig.baudRate = 115200;
-    uartConfig.flowControl = UART_FlowControl_RTSCTS;
-    uartFd = UART_Open(SAMPLE_NRF52_UART, &uartConfig);
-    if (uartFd == -1) {
-        Log_Debug("ERROR: Could not open UART: %s (%d).\n", strerror(errno), errno);
-        return ExitCode_Init_Uart;
+    eventLoop = EventLoop_Create();
+    if (eventLoop == NULL ||
+        RegisterEventHandlerToEpoll(epollFd, EventLoop_GetWaitDescriptor(eventLoop),
+                                    &eventLoopEventData, EPOLLIN) != 0) {
+        Log_Debug("ERROR: Could not set up event loop: %s (%d).\n", strerror(errno), errno);
+        return ExitCode_Init_EventLoop;
+    }
+
+    // This app runs for months, so log its memory usage every hour to show how it changes.
+    if (MemoryMonitor_Start(eventLoop, /* samplePeriodSeconds */ 60, /* samplesPerReport */ 60,
+                            /* handler */ NULL, /* context */ NULL) != 0) {
+        return ExitCode_Init_MemoryMonitor;
     }
 
-    ExitCode localExitCode = MessageProtocol_Init(epollFd, uartFd);
-    if (localExitCode != ExitCode_Success) {
-        return localExitCode;
+    // Wi-Fi scans, which block for several seconds, run on a worker thread.
+    if (WorkerPool_Initialize(eventLoop, 1) != 0) {
+        return ExitCode_Init_WorkerPool;
     }
 
+    if (MessageProtocol_Initialize(eventLoop, UartTransport_Read, UartTransport_SendV) != 0) {
+        return ExitCode_MsgProtoInit;
+    }
+
+    // Open the UART and set up UART event handler. If messages are lost, the UART falls back to
+    // the next profile.
+    static const UartTransport_Profile nrf52UartProfiles[] = SAMPLE_NRF52_UART_PROFILES;
+    if (UartTransport_InitializeWithProfiles(
+            eventLoop, SAMPLE_NRF52_UART, nrf52UartProfiles,
+            sizeof(nrf52UartProfiles) / sizeof(nrf52UartProfiles[0]),
+            MessageProtocol_HandleReceivedMessage) != 0) {
+        return ExitCode_Init_Uart;
+    }
+    MessageProtocol_RegisterLinkQualityHandler(UartTransport_NotifyLinkQuality);
+
     BleControlMessageProtocol_Init(BleStateChangeHandler, epollFd);
-    WifiConfigMessageProtocol_Init();
+    if (WifiConfigMessageProtocol_Init(epollFd) != 0) {
+        return ExitCode_Init_WifiConfig;
+    }
     DeviceControlMessageProtocol_Init(SetDeviceControlLedStatusHandler,
                                       GetDeviceControlLedStatusHandler);
 
@@ -443,12 +485,18 @@ static void ClosePeripheralsAndHandlers(void)
     CloseFdAndPrintError(bleAdvertiseToBondedDevicesLedGpioFd, "BleAdvertiseToBondedDevicesLed");
     CloseFdAndPrintError(bleAdvertiseToAllDevicesLedGpioFd, "BleAdvertiseToAllDevicesLed");
     CloseFdAndPrintError(bleConnectedLedGpioFd, "BleConnectedLed");
-    CloseFdAndPrintError(epollFd, "Epoll");
-    CloseFdAndPrintError(uartFd, "Uart");
     DeviceControlMessageProtocol_Cleanup();
+    // Wait for a scan which is in progress before the Wi-Fi configuration is cleaned up.
+    WorkerPool_Cleanup();
     WifiConfigMessageProtocol_Cleanup();
     BleControlMessageProtocol_Cleanup();
     MessageProtocol_Cleanup();
+    UartTransport_Cleanup();
+    MemoryMonitor_Stop();
+    if (eventLoop != NULL) {
+        EventLoop_Close(eventLoop);
+    }
+    CloseFdAndPrintError(epollFd, "Epoll");
 }
 
 /// <summary>
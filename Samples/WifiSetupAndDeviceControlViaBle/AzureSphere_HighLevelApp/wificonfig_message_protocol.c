@@ -5,7 +5,12 @@
 
 #include "wificonfig_message_protocol.h"
 #include "wificonfig_message_protocol_defs.h"
+#include "wificonfig_message_protocol_codec.h"
 #include "message_protocol.h"
+#include "message_protocol_private.h"
+#include "wifi_scan_results.h"
+#include "worker_pool.h"
+#include "epoll_timerfd_utilities.h"
 #include "applibs_versions.h"
 #include <applibs/wificonfig.h>
 #include <applibs/networking.h>
@@ -13,6 +18,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <time.h>
 #include <unistd.h>
 
 static bool newWiFiDetailsAvailableRequestNeeded;
@@ -23,9 +29,48 @@ static bool setWifiScanResultsSummaryRequestNeeded;
 static WifiConfigureMessageProtocol_WifiScanResultRequestStruct
     foundAPs[MAX_AP_COUNT_FOUND_BY_SCAN];
 static uint8_t foundAccessPointsCount = 0;
+
+// A scan blocks for several seconds, so it runs on a worker thread, and the strongest networks
+// which it finds are cached with the time of the scan. A "Wi-Fi Scan Needed" event is answered at
+// once from a scan which is younger than this; otherwise a new scan is started, and the event is
+// answered when it completes.
+#define WIFI_SCAN_CACHE_MAX_AGE_SECONDS 30
+// Scanned networks are read into a static buffer, so that a scan does not allocate. Only the
+// worker thread uses it while a scan is in progress.
+static WifiConfig_ScannedNetwork scannedNetworks[WIFI_SCAN_RESULTS_MAX_NETWORKS];
+static ssize_t scanResultCount = 0;
+static int scanErrno = 0;
+static WorkerPool_Job scanJob;
+static bool scanInProgress = false;
+// The strongest networks from the last successful scan, and when it completed.
+static WifiConfigureMessageProtocol_WifiScanResultRequestStruct
+    cachedAPs[MAX_AP_COUNT_FOUND_BY_SCAN];
+static uint8_t cachedAccessPointsCount = 0;
+static bool scanCacheValid = false;
+static struct timespec scanCacheTime;
+// Whether the companion app is waiting for the scan which is in progress.
+static bool scanAnswerPending = false;
 static uint8_t currentAccessPointIndex = 0;
+// Whether the companion app accepts several scan results per request.
+static bool bulkScanResultsSupported = false;
+// Whether the companion app has accepted the current scan's summary, so its results can be sent.
+static bool scanResultsAccepted = false;
 static const char wifiInterface[] = "wlan0";
 
+// The Wi-Fi status is refreshed in the background, so that a "Wi-Fi Status Needed" event is
+// answered from memory, and the companion app is only sent the status again when it changes.
+#define WIFI_STATUS_REFRESH_PERIOD_SECONDS 5
+// Signal level changes smaller than this are not reported, as the RSSI varies from one reading to
+// the next.
+#define WIFI_STATUS_SIGNAL_LEVEL_CHANGE 5
+static WifiConfigureMessageProtocol_WifiStatusRequestStruct currentWifiStatus;
+static bool currentWifiStatusValid = false;
+// The status which was last sent to the companion app.
+static WifiConfigureMessageProtocol_WifiStatusRequestStruct sentWifiStatus;
+// Whether the connected companion app has asked for the status, so should be sent its changes.
+static bool wifiStatusChangesNeeded = false;
+static int wifiStatusRefreshTimerFd = -1;
+
 // Wi-Fi response handlers
 static void SetWifiOperationResultResponseHandler(MessageProtocol_CategoryId categoryId,
                                                   MessageProtocol_RequestId requestId,
@@ -62,14 +107,14 @@ static void GetNewWifiDetailsResponseHandler(MessageProtocol_CategoryId category
         return;
     }
 
-    if (dataSize != sizeof(WifiConfigureMessageProtocol_NewWifiDetailsStruct)) {
+    WifiConfigureMessageProtocol_NewWifiDetailsStruct details;
+    if (!WifiConfig_NewWifiDetails_Decode(&details, data, dataSize)) {
         Log_Debug("INFO: \"Get New Wi-Fi Details\" response is invalid.\n");
         return;
     }
     Log_Debug("INFO: \"Get New Wi-Fi Details\" succeeded.\n");
 
-    WifiConfigureMessageProtocol_NewWifiDetailsStruct *newWifiDetails =
-        (WifiConfigureMessageProtocol_NewWifiDetailsStruct *)data;
+    const WifiConfigureMessageProtocol_NewWifiDetailsStruct *newWifiDetails = &details;
 
     // Store the new Wi-Fi network
     int networkId = WifiConfig_AddNetwork();
@@ -131,14 +176,36 @@ static void GetNewWifiDetailsResponseHandler(MessageProtocol_CategoryId category
 
     // Send "Set Wi-Fi Operation Result" message
     uint32_t resultCode = (configResult == 0) ? 0 : (uint32_t)errno;
+    uint8_t body[sizeof(resultCode)];
+    MessageCodec_PutU32(body, resultCode);
     Log_Debug("INFO: Sending request: \"Set Wi-Fi Operation Result\".\n");
     MessageProtocol_SendRequest(MessageProtocol_WifiConfigCategoryId,
                                 WifiConfigureMessageProtocol_SetWifiOperationResultRequestId,
-                                (const uint8_t *)&resultCode, sizeof(resultCode),
+                                body, sizeof(body),
                                 &SetWifiOperationResultResponseHandler);
 }
 
+_Static_assert(WifiConfig_WifiScanResults_EncodedSize <=
+                   MAX_REQUEST_DATA_SIZE,
+               "Too many scan results per request for the message protocol.");
+
 static void SendSetNextWiFiScanResultRequest(void);
+static void SendSetWiFiScanResultsRequest(void);
+
+// Sends the scan results which have yet to be sent, without waiting for the response to each
+// before sending the next, for as long as the message protocol has room for another request. The
+// companion app places each result by its index, so the responses may arrive in any order.
+static void SendPendingScanResults(void)
+{
+    while (scanResultsAccepted && currentAccessPointIndex < foundAccessPointsCount &&
+           MessageProtocol_CanSendRequest()) {
+        if (bulkScanResultsSupported) {
+            SendSetWiFiScanResultsRequest();
+        } else {
+            SendSetNextWiFiScanResultRequest();
+        }
+    }
+}
 
 static void SetWifiScanResultsSummaryResponseHandler(MessageProtocol_CategoryId categoryId,
                                                      MessageProtocol_RequestId requestId,
@@ -149,6 +216,7 @@ static void SetWifiScanResultsSummaryResponseHandler(MessageProtocol_CategoryId
     if (timedOut) {
         Log_Debug("ERROR: Timed out waiting for \"Set Wi-Fi Scan Results Summary\" response.\n");
         foundAccessPointsCount = 0;
+        scanResultsAccepted = false;
         return;
     }
 
@@ -160,9 +228,14 @@ static void SetWifiScanResultsSummaryResponseHandler(MessageProtocol_CategoryId
     }
     Log_Debug("INFO: \"Set Wi-Fi Scan Results Summary\" succeeded.\n");
 
-    if (foundAccessPointsCount > 0) {
-        SendSetNextWiFiScanResultRequest();
-    }
+    // A companion app which can receive several results per request says so in the response.
+    WifiConfigureMessageProtocol_WifiScanResultsSummaryResponseStruct summaryResponse;
+    bulkScanResultsSupported =
+        WifiConfig_WifiScanResultsSummaryResponse_Decode(&summaryResponse, data, dataSize) &&
+        (summaryResponse.flags & WifiConfigureMessageProtocol_ScanResultsBulkSupported) != 0;
+
+    scanResultsAccepted = true;
+    SendPendingScanResults();
 }
 
 static void SetWifiStatusResponseHandler(MessageProtocol_CategoryId categoryId,
@@ -193,6 +266,7 @@ static void SetNextWifiScanResultResponseHandler(MessageProtocol_CategoryId cate
         Log_Debug("ERROR: Timed out waiting for \"Set Next Wi-Fi Scan Result\" response.\n");
         foundAccessPointsCount = 0;
         currentAccessPointIndex = 0;
+        scanResultsAccepted = false;
         return;
     }
 
@@ -202,9 +276,29 @@ static void SetNextWifiScanResultResponseHandler(MessageProtocol_CategoryId cate
         return;
     }
     Log_Debug("INFO: \"Set Next Wi-Fi Scan Result\" succeeded.\n");
-    if (foundAccessPointsCount > 0 && currentAccessPointIndex < foundAccessPointsCount) {
-        SendSetNextWiFiScanResultRequest();
+    SendPendingScanResults();
+}
+
+static void SetWifiScanResultsResponseHandler(MessageProtocol_CategoryId categoryId,
+                                              MessageProtocol_RequestId requestId,
+                                              const uint8_t *data, size_t dataSize,
+                                              MessageProtocol_ResponseResult result, bool timedOut)
+{
+    if (timedOut) {
+        Log_Debug("ERROR: Timed out waiting for \"Set Wi-Fi Scan Results\" response.\n");
+        foundAccessPointsCount = 0;
+        currentAccessPointIndex = 0;
+        scanResultsAccepted = false;
+        return;
     }
+
+    // This response contains no data, so check its result to see whether the request was successful
+    if (result != 0) {
+        Log_Debug("ERROR: \"Set Wi-Fi Scan Results\" failed with error code: %d.\n", result);
+        return;
+    }
+    Log_Debug("INFO: \"Set Wi-Fi Scan Results\" succeeded.\n");
+    SendPendingScanResults();
 }
 
 static void SendNewWifiDetailsRequest(void)
@@ -220,18 +314,15 @@ static void SendNewWifiDetailsRequest(void)
 static void NewWifiDetailsAvailableEventHandler(MessageProtocol_CategoryId categoryId,
                                                 MessageProtocol_EventId eventId)
 {
-    if (MessageProtocol_IsIdle()) {
+    if (MessageProtocol_CanSendRequest()) {
         SendNewWifiDetailsRequest();
     } else {
         newWiFiDetailsAvailableRequestNeeded = true;
     }
 }
 
-static void SendSetWifiStatusRequest(void)
+static void RefreshWifiStatus(void)
 {
-    Log_Debug("INFO: Handling event: \"Wi-Fi Status Needed\".\n");
-    setWifiStatusRequestNeeded = false;
-
     // Get the current Wi-Fi status
     WifiConfigureMessageProtocol_WifiStatusRequestStruct wifiStatus;
     memset(&wifiStatus, 0, sizeof(wifiStatus));
@@ -267,31 +358,67 @@ static void SendSetWifiStatusRequest(void)
         wifiStatus.connectionStatus = WifiConfigureMessageProtocol_NoConnection;
     }
 
-    // Finally, send a "Set Wi-Fi Status" request
+    currentWifiStatus = wifiStatus;
+    currentWifiStatusValid = true;
+}
+
+static bool HasWifiStatusChanged(const WifiConfigureMessageProtocol_WifiStatusRequestStruct *a,
+                                 const WifiConfigureMessageProtocol_WifiStatusRequestStruct *b)
+{
+    int signalLevelChange = a->signalLevel - b->signalLevel;
+    return a->connectionStatus != b->connectionStatus || a->securityType != b->securityType ||
+           a->ssidLength != b->ssidLength || memcmp(a->ssid, b->ssid, a->ssidLength) != 0 ||
+           a->frequency != b->frequency ||
+           memcmp(a->bssid, b->bssid, WIFICONFIG_BSSID_BUFFER_SIZE) != 0 ||
+           abs(signalLevelChange) >= WIFI_STATUS_SIGNAL_LEVEL_CHANGE;
+}
+
+static void SendSetWifiStatusRequest(void)
+{
+    setWifiStatusRequestNeeded = false;
+
+    // Send the latest status, which may have changed since the request was needed
+    sentWifiStatus = currentWifiStatus;
+    uint8_t body[WifiConfig_WifiStatus_EncodedSize];
+    size_t bodySize = WifiConfig_WifiStatus_Encode(&sentWifiStatus, body);
     Log_Debug("INFO: Sending request: \"Set Wi-Fi Status\".\n");
-    MessageProtocol_SendRequest(
-        MessageProtocol_WifiConfigCategoryId, WifiConfigureMessageProtocol_SetWifiStatusRequestId,
-        (const uint8_t *)&wifiStatus, sizeof(wifiStatus), &SetWifiStatusResponseHandler);
+    MessageProtocol_SendRequest(MessageProtocol_WifiConfigCategoryId,
+                                WifiConfigureMessageProtocol_SetWifiStatusRequestId, body,
+                                bodySize, &SetWifiStatusResponseHandler);
 }
 
-static void WifiStatusNeededEventHandler(MessageProtocol_CategoryId categoryId,
-                                         MessageProtocol_EventId eventId)
+static void SendOrQueueSetWifiStatusRequest(void)
 {
-    if (MessageProtocol_IsIdle()) {
+    if (MessageProtocol_CanSendRequest()) {
         SendSetWifiStatusRequest();
     } else {
         setWifiStatusRequestNeeded = true;
     }
 }
 
-static bool IsSameAccessPoint(
-    const WifiConfigureMessageProtocol_WifiScanResultRequestStruct *target,
-    const WifiConfig_ScannedNetwork *source)
+static void WifiStatusNeededEventHandler(MessageProtocol_CategoryId categoryId,
+                                         MessageProtocol_EventId eventId)
 {
-    if (target->securityType == source->security && target->ssidLength == source->ssidLength) {
-        return 0 == memcmp(target->ssid, source->ssid, target->ssidLength);
+    Log_Debug("INFO: Handling event: \"Wi-Fi Status Needed\".\n");
+    if (!currentWifiStatusValid) {
+        RefreshWifiStatus();
+    }
+    wifiStatusChangesNeeded = true;
+    SendOrQueueSetWifiStatusRequest();
+}
+
+static void WifiStatusRefreshTimerEventHandler(EventData *eventData)
+{
+    if (ConsumeTimerFdEvent(wifiStatusRefreshTimerFd) != 0) {
+        return;
+    }
+
+    RefreshWifiStatus();
+    if (wifiStatusChangesNeeded && !setWifiStatusRequestNeeded &&
+        HasWifiStatusChanged(&currentWifiStatus, &sentWifiStatus)) {
+        Log_Debug("INFO: Wi-Fi status has changed.\n");
+        SendOrQueueSetWifiStatusRequest();
     }
-    return false;
 }
 
 static void SetScannedNetwork(WifiConfigureMessageProtocol_WifiScanResultRequestStruct *target,
@@ -303,91 +430,135 @@ static void SetScannedNetwork(WifiConfigureMessageProtocol_WifiScanResultRequest
     memcpy(target->ssid, source->ssid, target->ssidLength);
 }
 
-static uint8_t CollapseNetworks(const WifiConfig_ScannedNetwork *target, size_t count)
+static void SendSetWifiScanResultsSummaryRequestNeeded(void);
+
+/// <summary>
+///     Runs on a worker thread: scans, and reads and deduplicates the results into
+///     scannedNetworks.
+/// </summary>
+static void ScanWork(void *context)
 {
-    uint8_t scannedNetworksCount = 0;
-    for (size_t i = 0; i < count; ++i) {
-        bool found = false;
-        for (size_t j = 0; j < scannedNetworksCount; ++j) {
-            if (IsSameAccessPoint(foundAPs + j, target + i)) {
-                if (foundAPs[j].signalRssi < target[i].signalRssi) {
-                    foundAPs[j].signalRssi = target[i].signalRssi;
-                }
-                found = true;
-                break;
-            }
+    scanResultCount = WifiScanResults_Scan(scannedNetworks, WIFI_SCAN_RESULTS_MAX_NETWORKS, NULL);
+    scanErrno = (scanResultCount == -1) ? errno : 0;
+}
+
+/// <summary>
+///     Runs on the event loop's thread when a scan has completed: caches the strongest networks,
+///     and answers the companion app if it is waiting for them.
+/// </summary>
+static void ScanComplete(void *context)
+{
+    scanInProgress = false;
+    if (scanResultCount == -1) {
+        Log_Debug("ERROR: Wi-Fi scan failed with error: %s (%d).\n", strerror(scanErrno),
+                  scanErrno);
+        scanCacheValid = false;
+    } else {
+        // The scanned networks are already collapsed to access points based on SSID and Security
+        // Type; keep the strongest of them.
+        cachedAccessPointsCount = (uint8_t)WifiScanResults_SelectStrongest(
+            scannedNetworks, (size_t)scanResultCount, MAX_AP_COUNT_FOUND_BY_SCAN);
+        for (uint8_t i = 0; i < cachedAccessPointsCount; ++i) {
+            SetScannedNetwork(&cachedAPs[i], &scannedNetworks[i]);
         }
-        if (!found) {
-            if (scannedNetworksCount >= MAX_AP_COUNT_FOUND_BY_SCAN) {
-                Log_Debug("INFO: Returning only the first %d networks found by scan.\n",
-                          MAX_AP_COUNT_FOUND_BY_SCAN);
-                break;
-            }
-            SetScannedNetwork(foundAPs + scannedNetworksCount, target + i);
-            ++scannedNetworksCount;
+        Log_Debug("INFO: Scan found %zd Wi-Fi networks, keeping %d.\n", scanResultCount,
+                  cachedAccessPointsCount);
+        clock_gettime(CLOCK_MONOTONIC, &scanCacheTime);
+        scanCacheValid = true;
+    }
+
+    if (scanAnswerPending) {
+        scanAnswerPending = false;
+        if (MessageProtocol_CanSendRequest()) {
+            SendSetWifiScanResultsSummaryRequestNeeded();
+        } else {
+            setWifiScanResultsSummaryRequestNeeded = true;
         }
     }
-    return scannedNetworksCount;
 }
 
+/// <summary>
+///     Starts a scan in the background, unless one is already in progress.
+/// </summary>
+static void StartBackgroundScan(void)
+{
+    if (scanInProgress) {
+        return;
+    }
+
+    scanInProgress = true;
+    scanJob.work = ScanWork;
+    scanJob.complete = ScanComplete;
+    scanJob.context = NULL;
+    if (WorkerPool_Submit(&scanJob) != 0) {
+        // The pool is not running, so the scan blocks the event loop as it used to.
+        ScanWork(NULL);
+        ScanComplete(NULL);
+    }
+}
+
+/// <summary>
+///     Checks whether the cached scan is recent enough to answer the companion app.
+/// </summary>
+static bool IsScanCacheFresh(void)
+{
+    if (!scanCacheValid) {
+        return false;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec - scanCacheTime.tv_sec < WIFI_SCAN_CACHE_MAX_AGE_SECONDS;
+}
+
+/// <summary>
+///     Sends the summary of the cached scan, or a failure if there is none, and snapshots the
+///     cached networks so that a later scan does not change the results which are being sent.
+/// </summary>
 static void SendSetWifiScanResultsSummaryRequestNeeded(void)
 {
     setWifiScanResultsSummaryRequestNeeded = false;
 
-    // Get Wi-Fi scan results count and populate found access points
-    Log_Debug("INFO: Handle received event message: \"Wi-Fi Scan Needed\".\n");
     WifiConfigureMessageProtocol_WifiScanResultsSummaryRequestStruct scanSummary;
     uint8_t scanResult = 0;
     foundAccessPointsCount = 0;
     currentAccessPointIndex = 0;
-    ssize_t result = WifiConfig_TriggerScanAndGetScannedNetworkCount();
-    if (result == -1) {
+    scanResultsAccepted = false;
+    if (!scanCacheValid) {
         scanResult = 1;
-        Log_Debug("ERROR: Get scanned network count failed with error: %s (%d).\n", strerror(errno),
-                  errno);
-    } else if (result == 0) {
-        Log_Debug("INFO: Scan found no Wi-Fi networks.\n");
     } else {
-        size_t networkCount = (size_t)result;
-        WifiConfig_ScannedNetwork *networks =
-            (WifiConfig_ScannedNetwork *)malloc(sizeof(WifiConfig_ScannedNetwork) * networkCount);
-        ssize_t getScannedNetworksResult = WifiConfig_GetScannedNetworks(networks, networkCount);
-        if (getScannedNetworksResult == -1) {
-            scanResult = 2;
-            Log_Debug("ERROR: Get scanned networks failed with error: %s (%d).\n", strerror(errno),
-                      errno);
-        } else {
-            // Collapse all the found networks to access points based on SSID and Security Type
-            foundAccessPointsCount = CollapseNetworks(networks, (size_t)getScannedNetworksResult);
-            Log_Debug("Scan found %d Wi-Fi networks.\n", foundAccessPointsCount);
-        }
-        free(networks);
+        foundAccessPointsCount = cachedAccessPointsCount;
+        memcpy(foundAPs, cachedAPs, cachedAccessPointsCount * sizeof(foundAPs[0]));
+        Log_Debug("INFO: Reporting %d Wi-Fi networks.\n", foundAccessPointsCount);
     }
 
     // Populate the scan summary response struct
     scanSummary.scanResult = scanResult;
     scanSummary.totalNetworkCount = foundAccessPointsCount;
-    scanSummary.totalResultsSize = foundAccessPointsCount * sizeof(scanSummary);
+    memset(scanSummary.reserved, 0, sizeof(scanSummary.reserved));
+    scanSummary.totalResultsSize =
+        (uint32_t)foundAccessPointsCount * WifiConfig_WifiScanResult_EncodedSize;
+    uint8_t body[WifiConfig_WifiScanResultsSummary_EncodedSize];
+    size_t bodySize = WifiConfig_WifiScanResultsSummary_Encode(&scanSummary, body);
 
     // Send "Set Wi-Fi Scan Results Summary" request
     Log_Debug("INFO: Sending request: \"Set Wi-Fi Scan Results Summary\".\n");
     MessageProtocol_SendRequest(MessageProtocol_WifiConfigCategoryId,
                                 WifiConfigureMessageProtocol_SetWifiScanResultsSummaryRequestId,
-                                (const uint8_t *)&scanSummary, sizeof(scanSummary),
-                                &SetWifiScanResultsSummaryResponseHandler);
+                                body, bodySize, &SetWifiScanResultsSummaryResponseHandler);
 }
 
 static void SendSetNextWiFiScanResultRequest(void)
 {
     if (currentAccessPointIndex < foundAccessPointsCount) {
+        uint8_t body[WifiConfig_WifiScanResult_EncodedSize];
+        size_t bodySize =
+            WifiConfig_WifiScanResult_Encode(&foundAPs[currentAccessPointIndex], body);
         Log_Debug("INFO: Sending request: \"Set Next Wi-Fi Scan Result\" (%d).\n",
                   currentAccessPointIndex);
-        MessageProtocol_SendRequest(
-            MessageProtocol_WifiConfigCategoryId,
-            WifiConfigureMessageProtocol_SetNextWiFiScanResultRequestId,
-            (const uint8_t *)&foundAPs[currentAccessPointIndex],
-            sizeof(WifiConfigureMessageProtocol_WifiScanResultRequestStruct),
-            &SetNextWifiScanResultResponseHandler);
+        MessageProtocol_SendRequest(MessageProtocol_WifiConfigCategoryId,
+                                    WifiConfigureMessageProtocol_SetNextWiFiScanResultRequestId,
+                                    body, bodySize, &SetNextWifiScanResultResponseHandler);
         ++currentAccessPointIndex;
     } else {
         Log_Debug("ERROR: Invalid index (%d) for scanned network result.\n",
@@ -396,10 +567,45 @@ static void SendSetNextWiFiScanResultRequest(void)
     }
 }
 
+static void SendSetWiFiScanResultsRequest(void)
+{
+    // Send as many of the remaining results as fit in one request. The companion app learns
+    // where they belong in the scan from firstIndex.
+    WifiConfigureMessageProtocol_WifiScanResultsRequestStruct scanResults;
+    memset(&scanResults, 0, sizeof(scanResults));
+    uint8_t remaining = (uint8_t)(foundAccessPointsCount - currentAccessPointIndex);
+    scanResults.firstIndex = currentAccessPointIndex;
+    scanResults.resultCount = (remaining < WIFICONFIG_MAX_SCAN_RESULTS_PER_REQUEST)
+                                  ? remaining
+                                  : WIFICONFIG_MAX_SCAN_RESULTS_PER_REQUEST;
+    scanResults.totalNetworkCount = foundAccessPointsCount;
+    memcpy(scanResults.results, &foundAPs[currentAccessPointIndex],
+           scanResults.resultCount * sizeof(scanResults.results[0]));
+
+    // Only the results which are used are sent.
+    uint8_t body[WifiConfig_WifiScanResults_EncodedSize];
+    WifiConfig_WifiScanResults_Encode(&scanResults, body);
+
+    Log_Debug("INFO: Sending request: \"Set Wi-Fi Scan Results\" (%d-%d).\n",
+              scanResults.firstIndex, scanResults.firstIndex + scanResults.resultCount - 1);
+    MessageProtocol_SendRequest(MessageProtocol_WifiConfigCategoryId,
+                                WifiConfigureMessageProtocol_SetWiFiScanResultsRequestId, body,
+                                WifiConfig_WifiScanResultsSize(scanResults.resultCount),
+                                &SetWifiScanResultsResponseHandler);
+    currentAccessPointIndex = (uint8_t)(currentAccessPointIndex + scanResults.resultCount);
+}
+
 static void WifiScanNeededEventHandler(MessageProtocol_CategoryId categoryId,
                                        MessageProtocol_EventId eventId)
 {
-    if (MessageProtocol_IsIdle()) {
+    Log_Debug("INFO: Handle received event message: \"Wi-Fi Scan Needed\".\n");
+    if (!IsScanCacheFresh()) {
+        scanAnswerPending = true;
+        StartBackgroundScan();
+        return;
+    }
+
+    if (MessageProtocol_CanSendRequest()) {
         SendSetWifiScanResultsSummaryRequestNeeded();
     } else {
         setWifiScanResultsSummaryRequestNeeded = true;
@@ -408,22 +614,33 @@ static void WifiScanNeededEventHandler(MessageProtocol_CategoryId categoryId,
 
 static void IdleHandler(void)
 {
-    if (newWiFiDetailsAvailableRequestNeeded) {
+    // Several requests can be outstanding, so send each one which is waiting while there is room,
+    // then use any room which is left for the scan results which have yet to be sent.
+    if (newWiFiDetailsAvailableRequestNeeded && MessageProtocol_CanSendRequest()) {
         SendNewWifiDetailsRequest();
-        return;
     }
-    if (setWifiStatusRequestNeeded) {
+    if (setWifiStatusRequestNeeded && MessageProtocol_CanSendRequest()) {
         SendSetWifiStatusRequest();
-        return;
     }
-    if (setWifiScanResultsSummaryRequestNeeded) {
+    if (setWifiScanResultsSummaryRequestNeeded && MessageProtocol_CanSendRequest()) {
         SendSetWifiScanResultsSummaryRequestNeeded();
-        return;
     }
+    SendPendingScanResults();
 }
 
-void WifiConfigMessageProtocol_Init(void)
+int WifiConfigMessageProtocol_Init(int epollFd)
 {
+    // Set up the timer which refreshes the Wi-Fi status.
+    struct timespec refreshPeriod = {WIFI_STATUS_REFRESH_PERIOD_SECONDS, 0};
+    static EventData wifiStatusRefreshTimerEventData = {
+        .eventHandler = &WifiStatusRefreshTimerEventHandler};
+    wifiStatusRefreshTimerFd = CreateTimerFdAndAddToEpoll(
+        epollFd, &refreshPeriod, &wifiStatusRefreshTimerEventData, EPOLLIN);
+    if (wifiStatusRefreshTimerFd == -1) {
+        return -1;
+    }
+    RefreshWifiStatus();
+
     // Register event handlers
     MessageProtocol_RegisterEventHandler(
         MessageProtocol_WifiConfigCategoryId,
@@ -443,6 +660,27 @@ void WifiConfigMessageProtocol_Init(void)
     newWiFiDetailsAvailableRequestNeeded = false;
     setWifiStatusRequestNeeded = false;
     setWifiScanResultsSummaryRequestNeeded = false;
+    return 0;
+}
+
+void WifiConfigMessageProtocol_SetDeviceConnected(bool connected)
+{
+    // A companion app which connects later asks for the status again before it is sent changes.
+    if (!connected) {
+        wifiStatusChangesNeeded = false;
+        scanAnswerPending = false;
+        setWifiScanResultsSummaryRequestNeeded = false;
+        return;
+    }
+
+    // A companion app usually asks for a scan soon after it connects, so one is started now, and
+    // the request can be answered from its results at once.
+    if (!IsScanCacheFresh()) {
+        StartBackgroundScan();
+    }
 }
 
-void WifiConfigMessageProtocol_Cleanup(void) {}
+void WifiConfigMessageProtocol_Cleanup(void)
+{
+    CloseFdAndPrintError(wifiStatusRefreshTimerFd, "WifiStatusRefreshTimer");
+}
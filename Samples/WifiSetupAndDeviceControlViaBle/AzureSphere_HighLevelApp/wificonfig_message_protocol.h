@@ -2,13 +2,25 @@
    Licensed under the MIT License. */
 
 #pragma once
+#include <stdbool.h>
 #include "message_protocol_public.h"
 
 /// <summary>
 ///     Initialize the Wi-Fi configuration message protocol by registering callback handlers
-///     and setting up internal state.
+///     and setting up internal state. The Wi-Fi status is refreshed periodically, so that it can
+///     be reported without delay, and changes to it are sent to a companion app which has asked
+///     for it.
 /// </summary>
-void WifiConfigMessageProtocol_Init(void);
+/// <param name="epollFd">epoll file descriptor to use for event polling.</param>
+/// <returns>0 on success, or -1 on failure.</returns>
+int WifiConfigMessageProtocol_Init(int epollFd);
+
+/// <summary>
+///     Notify the Wi-Fi configuration message protocol whether a companion app is connected over
+///     BLE. Changes to the Wi-Fi status are not sent once it has disconnected.
+/// </summary>
+/// <param name="connected">Whether a companion app is connected.</param>
+void WifiConfigMessageProtocol_SetDeviceConnected(bool connected);
 
 /// <summary>
 ///     Clean up the Wi-Fi configuration message protocol callback handlers and internal state.
@@ -2,6 +2,7 @@
    Licensed under the MIT License. */
 
 #include "blecontrol_message_protocol.h"
+#include "blecontrol_message_protocol_codec.h"
 #include "message_protocol.h"
 
 #include "nrf_log.h"
@@ -18,17 +19,16 @@ static void ble_control_initialize_device_request_handler(uint8_t *p_data, uint1
                                                           uint16_t sequence_number)
 {
     // process request data and send response
-    if (data_size != sizeof(BleControlMessageProtocol_InitializeBleDeviceStruct)) {
+    BleControlMessageProtocol_InitializeBleDeviceStruct init_struct;
+    if (!BleControl_InitializeBleDevice_Decode(&init_struct, p_data, data_size)) {
         NRF_LOG_INFO(
             "INFO: BLE control \"Initialize BLE device\" request message has invalid size: %d.\n",
             data_size);
         return;
     }
 
-    BleControlMessageProtocol_InitializeBleDeviceStruct *init_struct =
-        (BleControlMessageProtocol_InitializeBleDeviceStruct *)p_data;
     uint8_t result =
-        m_init_ble_device_handler(init_struct->deviceName, init_struct->deviceNameLength);
+        m_init_ble_device_handler(init_struct.deviceName, init_struct.deviceNameLength);
     message_protocol_send_response(MessageProtocol_BleControlCategoryId,
                                    BleControlMessageProtocol_InitializeDeviceRequestId,
                                    sequence_number, NULL, 0, result);
@@ -38,16 +38,15 @@ static void ble_control_set_passkey_request_handler(uint8_t *p_data, uint16_t da
                                                           uint16_t sequence_number)
 {
     // process request data and send response
-    if (data_size != sizeof(BleControlMessageProtocol_SetPasskeyStruct)) {
+    BleControlMessageProtocol_SetPasskeyStruct passkey_struct;
+    if (!BleControl_SetPasskey_Decode(&passkey_struct, p_data, data_size)) {
         NRF_LOG_INFO(
             "INFO: BLE control \"Set Passkey\" request message has invalid size: %d.\n",
             data_size);
         return;
     }
 
-    BleControlMessageProtocol_SetPasskeyStruct *passkey_struct =
-        (BleControlMessageProtocol_SetPasskeyStruct *)p_data;
-    uint8_t result = m_set_passkey_handler(passkey_struct->passkey);
+    uint8_t result = m_set_passkey_handler(passkey_struct.passkey);
     message_protocol_send_response(MessageProtocol_BleControlCategoryId,
                                    BleControlMessageProtocol_SetPasskeyRequestId,
                                    sequence_number, NULL, 0, result);
@@ -57,32 +56,31 @@ static void ble_control_change_ble_mod_request_handler(uint8_t *p_data, uint16_t
                                                           uint16_t sequence_number)
 {
     // process request data and send response
-    if (data_size != sizeof(BleControlMessageProtocol_ChangeBleAdvertisingModeStruct)) {
+    BleControlMessageProtocol_ChangeBleAdvertisingModeStruct mode_struct;
+    if (!BleControl_ChangeBleAdvertisingMode_Decode(&mode_struct, p_data, data_size)) {
         NRF_LOG_INFO(
             "INFO: BLE control \"Change BLE Mode\" request message has invalid size: %d.\n",
             data_size);
         return;
     }
 
-    BleControlMessageProtocol_ChangeBleAdvertisingModeStruct *mode_struct =
-        (BleControlMessageProtocol_ChangeBleAdvertisingModeStruct *)p_data;
-
     uint8_t result;
-    if(mode_struct->mode != BleControlMessageProtocol_AdvertisingToBondedDevicesMode
-        && mode_struct->mode != BleControlMessageProtocol_AdvertisingToAllMode)
+    if(mode_struct.mode != BleControlMessageProtocol_AdvertisingToBondedDevicesMode
+        && mode_struct.mode != BleControlMessageProtocol_AdvertisingToAllMode)
     {
         NRF_LOG_INFO(
             "ERROR: BLE control \"Change BLE Mode\" request message has invalid mode: %d.\n",
-            mode_struct->mode);
+            mode_struct.mode);
         result = 1;
     } else {
         result = m_start_advertising_handler(
-            mode_struct->mode == BleControlMessageProtocol_AdvertisingToBondedDevicesMode);
+            mode_struct.mode == BleControlMessageProtocol_AdvertisingToBondedDevicesMode);
     }
+    uint8_t body[BleControl_ChangeBleAdvertisingMode_EncodedSize];
+    size_t body_size = BleControl_ChangeBleAdvertisingMode_Encode(&mode_struct, body);
     message_protocol_send_response(MessageProtocol_BleControlCategoryId,
                                    BleControlMessageProtocol_ChangeBleAdvertisingModeRequestId,
-                                   sequence_number, p_data, 
-                                   sizeof(BleControlMessageProtocol_ChangeBleAdvertisingModeStruct), result);
+                                   sequence_number, body, (uint16_t)body_size, result);
 }
 
 static void ble_control_delete_all_bonds_request_handler(uint8_t *p_data, uint16_t data_size,
@@ -4,6 +4,7 @@
 #include "message_protocol.h"
 #include "message_protocol_private.h"
 #include "message_protocol_utilities.h"
+#include "message_protocol_categories.h"
 #include "uart_utilities.h"
 
 #include "nrf_delay.h"
@@ -125,7 +126,7 @@ void received_uart_data_handler(uint8_t *p_received_data, uint8_t *p_received_da
                 // Send received UART data over BLE NUS
                 err_code = m_send_data_to_ble_nus_handler(p_received_data, length);
                 if ((err_code != NRF_ERROR_INVALID_STATE) && (err_code != NRF_ERROR_BUSY) &&
-                    (err_code != NRF_ERROR_NOT_FOUND)) {
+                    (err_code != NRF_ERROR_NOT_FOUND) && (err_code != NRF_ERROR_RESOURCES)) {
                     APP_ERROR_CHECK(err_code);
                 }
             } while (err_code == NRF_ERROR_BUSY);
@@ -154,11 +155,11 @@ void message_protocol_send_response(MessageProtocol_CategoryId category_id,
         sizeof(MessageProtocol_ResponseHeader) - sizeof(MessageProtocol_MessageHeader) + data_size;
     response_message.responseHeader.messageHeaderWithType.type =
         MessageProtocol_ResponseMessageType;
-    response_message.responseHeader.messageHeaderWithType.reserved = 0x00;
+    response_message.responseHeader.messageHeaderWithType.address = 0x00;
     response_message.responseHeader.categoryId = category_id;
     response_message.responseHeader.requestId = request_id;
     response_message.responseHeader.sequenceNumber = sequence_number;
-    response_message.responseHeader.reserved = 0x00;
+    response_message.responseHeader.flags = 0x00;
     response_message.responseHeader.responseResult = response_result;
     if (p_data != NULL && data_size > 0) {
         memcpy(response_message.data, p_data, data_size);
@@ -177,7 +178,7 @@ void message_protocol_send_event(MessageProtocol_CategoryId category_id,
     event_message.messageHeaderWithType.messageHeader.length =
         sizeof(event_message) - sizeof(MessageProtocol_MessageHeader);
     event_message.messageHeaderWithType.type = MessageProtocol_EventMessageType;
-    event_message.messageHeaderWithType.reserved = 0x00;
+    event_message.messageHeaderWithType.address = 0x00;
     event_message.eventInfo.categoryId = category_id;
     event_message.eventInfo.eventId = event_id;
 
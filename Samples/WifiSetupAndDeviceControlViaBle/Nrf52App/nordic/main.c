@@ -95,6 +95,7 @@
 #include "nrf_log_default_backends.h"
 
 #include "message_protocol.h"
+#include "message_protocol_utilities.h"
 #include "blecontrol_message_protocol.h"
 
 #define APP_BLE_CONN_CFG_TAG            1                                           /**< A tag identifying the SoftDevice BLE configuration. */
@@ -103,12 +104,19 @@
 
 #define APP_BLE_OBSERVER_PRIO           3                                           /**< Application's BLE observer priority. You shouldn't need to modify this value. */
 
-#define APP_ADV_INTERVAL                64                                          /**< The advertising interval (in units of 0.625 ms. This value corresponds to 40 ms). */
+#define APP_ADV_INTERVAL                64                                          /**< The fast advertising interval (in units of 0.625 ms. This value corresponds to 40 ms). */
 
-#define APP_ADV_DURATION                BLE_GAP_ADV_TIMEOUT_GENERAL_UNLIMITED       /**< The advertising duration in units of 10 milliseconds (0 means forever). */
+#define APP_ADV_DURATION                3000                                        /**< The fast advertising duration in units of 10 milliseconds (30 seconds), after advertising is started or restarted, before it slows down. */
 
-#define MIN_CONN_INTERVAL               MSEC_TO_UNITS(20, UNIT_1_25_MS)             /**< Minimum acceptable connection interval (20 ms), Connection interval uses 1.25 ms units. */
-#define MAX_CONN_INTERVAL               MSEC_TO_UNITS(75, UNIT_1_25_MS)             /**< Maximum acceptable connection interval (75 ms), Connection interval uses 1.25 ms units. */
+#define APP_ADV_SLOW_INTERVAL           1636                                        /**< The slow advertising interval (in units of 0.625 ms. This value corresponds to 1022.5 ms, one of the intervals which Apple's guidelines recommend). */
+
+#define APP_ADV_SLOW_DURATION           BLE_GAP_ADV_TIMEOUT_GENERAL_UNLIMITED       /**< The slow advertising duration in units of 10 milliseconds (0 means forever). */
+
+#define MIN_CONN_INTERVAL               MSEC_TO_UNITS(15, UNIT_1_25_MS)             /**< Minimum acceptable connection interval while data is being transferred (15 ms), Connection interval uses 1.25 ms units. */
+#define MAX_CONN_INTERVAL               MSEC_TO_UNITS(45, UNIT_1_25_MS)             /**< Maximum acceptable connection interval while data is being transferred (45 ms), Connection interval uses 1.25 ms units. */
+#define IDLE_MIN_CONN_INTERVAL          MSEC_TO_UNITS(100, UNIT_1_25_MS)            /**< Minimum acceptable connection interval while the connection is idle (100 ms). */
+#define IDLE_MAX_CONN_INTERVAL          MSEC_TO_UNITS(400, UNIT_1_25_MS)            /**< Maximum acceptable connection interval while the connection is idle (400 ms). */
+#define CONN_IDLE_TIMEOUT               APP_TIMER_TICKS(10000)                      /**< Time without data in either direction after which the connection is considered idle (10 seconds). */
 #define SLAVE_LATENCY                   0                                           /**< Slave latency. */
 #define CONN_SUP_TIMEOUT                MSEC_TO_UNITS(4000, UNIT_10_MS)             /**< Connection supervisory timeout (4 seconds), Supervision Timeout uses 10 ms units. */
 #define FIRST_CONN_PARAMS_UPDATE_DELAY  APP_TIMER_TICKS(5000)                       /**< Time from initiating event (connect or start of notification) to first time sd_ble_gap_conn_param_update is called (5 seconds). */
@@ -126,12 +134,16 @@
 
 #define PASSKEY_LENGTH                  6                                           /**< Length of pass-key received by the stack for display. */
 
+#define NUS_RX_BUFFER_SIZE              256                                         /**< Size of the buffer in which data received over BLE is coalesced into whole messages before it is written on UART. */
+#define NUS_TX_QUEUE_SIZE               1024                                        /**< Size of the queue of data which is waiting to be sent over BLE, because the SoftDevice's transmit queue is full. */
+
 #define DEAD_BEEF                       0xDEADBEEF                                  /**< Value used as error code on stack dump, can be used to identify stack location on stack unwind. */
 
 BLE_NUS_DEF(m_nus, NRF_SDH_BLE_TOTAL_LINK_COUNT);                                   /**< BLE NUS service instance. */
 NRF_BLE_GATT_DEF(m_gatt);                                                           /**< GATT module instance. */
 NRF_BLE_QWR_DEF(m_qwr);                                                             /**< Context for the Queued Write module.*/
 BLE_ADVERTISING_DEF(m_advertising);                                                 /**< Advertising module instance. */
+APP_TIMER_DEF(m_conn_idle_timer);                                                   /**< Timer which expires when the connection has been idle for CONN_IDLE_TIMEOUT. */
 
 static uint16_t     m_conn_handle          = BLE_CONN_HANDLE_INVALID;               /**< Handle of the current connection. */
 static pm_peer_id_t m_peer_id;                                                      /**< Device reference handle to the current bonded central. */
@@ -141,9 +153,33 @@ static ble_uuid_t   m_adv_uuids[]          =
     {BLE_UUID_NUS_SERVICE, NUS_SERVICE_UUID_TYPE}
 };
 
+static uint8_t      m_nus_rx_buffer[NUS_RX_BUFFER_SIZE];                         /**< Data received over BLE which has not yet been written on UART. */
+static uint16_t     m_nus_rx_length        = 0;                                     /**< Number of bytes in m_nus_rx_buffer. */
+static uint8_t      m_nus_tx_queue[NUS_TX_QUEUE_SIZE];                              /**< Ring of whole messages, back to back, which are waiting to be sent over BLE. */
+static uint16_t     m_nus_tx_head          = 0;                                     /**< Position in m_nus_tx_queue of the first byte which has not been sent. */
+static uint16_t     m_nus_tx_length        = 0;                                     /**< Number of bytes in m_nus_tx_queue. */
+static bool         m_conn_idle            = false;                                 /**< Whether the idle connection parameters have been requested for the current connection. */
+
 static bool m_initialization_completed = false;
 static bool m_advertising_with_whitelist = true;
 
+/**@brief Advertising which the advertising module has most recently reported as started. */
+typedef enum
+{
+    ADVERTISING_STATE_STOPPED,                                                      /**< Not advertising, or advertising is being restarted. */
+    ADVERTISING_STATE_ALL,                                                          /**< Advertising to all devices, without the whitelist. */
+    ADVERTISING_STATE_BONDED                                                        /**< Advertising to bonded devices only, with the whitelist. */
+} advertising_state_t;
+
+static advertising_state_t    m_advertising_state = ADVERTISING_STATE_STOPPED;     /**< Advertising which is currently running. */
+static pm_peer_id_t           m_whitelist_peer_ids[BLE_GAP_WHITELIST_ADDR_MAX_COUNT]; /**< Peers in the whitelist which was last given to the Peer Manager. */
+static uint32_t               m_whitelist_peer_cnt = 0;                             /**< Number of peers in m_whitelist_peer_ids. */
+static bool                   m_whitelist_valid = false;                            /**< Whether m_whitelist_peer_ids follows the bonds. */
+static bool                   m_whitelist_changed = true;                           /**< Whether the whitelist has changed since advertising last requested it. */
+static pm_peer_id_list_skip_t m_identities_skip;                                    /**< Filter of the device identities list which was last set. */
+static bool                   m_identities_valid = false;                           /**< Whether the device identities list follows the bonds. */
+static bool                   m_bonds_delete_pending = false;                       /**< Whether the Peer Manager is deleting all bonds. */
+
 #define BLE_DEVICE_ALREADY_INITIALIZED 1
 
 /**@brief Function for assert macro callback.
@@ -162,27 +198,121 @@ void assert_nrf_callback(uint16_t line_num, const uint8_t * p_file_name)
     app_error_handler(DEAD_BEEF, line_num, p_file_name);
 }
 
-/**@brief Function for setting filtered whitelist.
- *
- * @param[in] skip  Filter passed to @ref pm_peer_id_list.
+/**@brief Function for giving the whitelist to the Peer Manager.
  */
-static void whitelist_set(pm_peer_id_list_skip_t skip)
+static void whitelist_apply(void)
 {
-    pm_peer_id_t peer_ids[BLE_GAP_WHITELIST_ADDR_MAX_COUNT];
-    uint32_t     peer_id_count = BLE_GAP_WHITELIST_ADDR_MAX_COUNT;
+    NRF_LOG_INFO("\tm_whitelist_peer_cnt %d, MAX_PEERS_WLIST %d",
+                   m_whitelist_peer_cnt,
+                   BLE_GAP_WHITELIST_ADDR_MAX_COUNT);
 
-    ret_code_t err_code = pm_peer_id_list(peer_ids, &peer_id_count, PM_PEER_ID_INVALID, skip);
+    ret_code_t err_code = pm_whitelist_set(m_whitelist_peer_cnt > 0 ? m_whitelist_peer_ids : NULL,
+                                           m_whitelist_peer_cnt);
     APP_ERROR_CHECK(err_code);
+    m_whitelist_changed = true;
+}
 
-    NRF_LOG_INFO("\tm_whitelist_peer_cnt %d, MAX_PEERS_WLIST %d",
-                   peer_id_count,
-                   BLE_GAP_WHITELIST_ADDR_MAX_COUNT);
+/**@brief Function for setting the whitelist to the bonded peers which have an identity address.
+ *
+ * @details The bonds are only listed again after they have changed in a way which
+ *          @ref whitelist_add and @ref whitelist_remove could not follow, so that advertising can
+ *          be restarted without reading every bond from flash.
+ */
+static void whitelist_set(void)
+{
+    if (m_whitelist_valid)
+    {
+        return;
+    }
 
-    err_code = pm_whitelist_set(peer_ids, peer_id_count);
+    m_whitelist_peer_cnt = BLE_GAP_WHITELIST_ADDR_MAX_COUNT;
+    ret_code_t err_code = pm_peer_id_list(m_whitelist_peer_ids, &m_whitelist_peer_cnt,
+                                          PM_PEER_ID_INVALID, PM_PEER_ID_LIST_SKIP_NO_ID_ADDR);
     APP_ERROR_CHECK(err_code);
+    m_whitelist_valid = true;
+    whitelist_apply();
+}
+
+/**@brief Function for adding a newly bonded peer to the whitelist.
+ *
+ * @param[in] peer_id  The peer which has bonded.
+ */
+static void whitelist_add(pm_peer_id_t peer_id)
+{
+    pm_peer_data_bonding_t bonding_data;
+
+    m_identities_valid = false;
+    if (!m_whitelist_valid)
+    {
+        whitelist_set();
+        return;
+    }
+
+    for (uint32_t i = 0; i < m_whitelist_peer_cnt; i++)
+    {
+        if (m_whitelist_peer_ids[i] == peer_id)
+        {
+            return;
+        }
+    }
+
+    // Like PM_PEER_ID_LIST_SKIP_NO_ID_ADDR, leave out peers which have not given an identity
+    // address; if the whitelist is full, list the bonds again, as pm_peer_id_list orders them.
+    ret_code_t err_code = pm_peer_data_bonding_load(peer_id, &bonding_data);
+    if (err_code != NRF_SUCCESS || m_whitelist_peer_cnt == BLE_GAP_WHITELIST_ADDR_MAX_COUNT)
+    {
+        m_whitelist_valid = false;
+        whitelist_set();
+        return;
+    }
+    if (   bonding_data.peer_ble_id.id_addr_info.addr_type != BLE_GAP_ADDR_TYPE_PUBLIC
+        && bonding_data.peer_ble_id.id_addr_info.addr_type != BLE_GAP_ADDR_TYPE_RANDOM_STATIC)
+    {
+        return;
+    }
+
+    m_whitelist_peer_ids[m_whitelist_peer_cnt++] = peer_id;
+    whitelist_apply();
+}
+
+/**@brief Function for removing a deleted peer from the whitelist.
+ *
+ * @param[in] peer_id  The peer which has been deleted.
+ */
+static void whitelist_remove(pm_peer_id_t peer_id)
+{
+    m_identities_valid = false;
+    if (!m_whitelist_valid)
+    {
+        return;
+    }
+
+    for (uint32_t i = 0; i < m_whitelist_peer_cnt; i++)
+    {
+        if (m_whitelist_peer_ids[i] == peer_id)
+        {
+            memmove(&m_whitelist_peer_ids[i], &m_whitelist_peer_ids[i + 1],
+                    (m_whitelist_peer_cnt - i - 1) * sizeof(m_whitelist_peer_ids[0]));
+            m_whitelist_peer_cnt--;
+            whitelist_apply();
+            return;
+        }
+    }
+}
+
+/**@brief Function for clearing the whitelist after all bonds have been deleted.
+ */
+static void whitelist_clear(void)
+{
+    m_identities_valid = false;
+    m_whitelist_peer_cnt = 0;
+    m_whitelist_valid = true;
+    whitelist_apply();
 }
 
 /**@brief Function for setting filtered device identities.
+ *
+ * @details The list is only set again after the bonds or the filter have changed.
  *
  * @param[in] skip  Filter passed to @ref pm_peer_id_list.
  */
@@ -191,11 +321,18 @@ static void identities_set(pm_peer_id_list_skip_t skip)
     pm_peer_id_t peer_ids[BLE_GAP_DEVICE_IDENTITIES_MAX_COUNT];
     uint32_t     peer_id_count = BLE_GAP_DEVICE_IDENTITIES_MAX_COUNT;
 
+    if (m_identities_valid && m_identities_skip == skip)
+    {
+        return;
+    }
+
     ret_code_t err_code = pm_peer_id_list(peer_ids, &peer_id_count, PM_PEER_ID_INVALID, skip);
     APP_ERROR_CHECK(err_code);
 
     err_code = pm_device_identities_list_set(peer_ids, peer_id_count);
     APP_ERROR_CHECK(err_code);
+    m_identities_skip  = skip;
+    m_identities_valid = true;
 }
 
 static int ble_start_advertising_handler(bool use_whitelist)
@@ -215,19 +352,46 @@ static int ble_start_advertising_handler(bool use_whitelist)
                 return ret;
             }
         }
+    }
+
+    // While the bonds are being deleted, only the mode is recorded; advertising is restarted once,
+    // in the mode which was requested last, when they have been deleted.
+    if(m_bonds_delete_pending)
+    {
+        return 0;
+    }
+
+    // Advertising is fast for APP_ADV_DURATION after it starts, then slow. A request for
+    // advertising which has slowed down, for example after a button press on the Azure Sphere
+    // device, restarts it fast.
+    bool advertising_fast = (m_advertising.adv_mode_current == BLE_ADV_MODE_FAST);
+    if(!use_whitelist)
+    {
+        if(m_advertising_state == ADVERTISING_STATE_ALL && advertising_fast)
+        {
+            return 0;
+        }
+        m_advertising_state = ADVERTISING_STATE_STOPPED;
         m_advertising.adv_mode_current = BLE_ADV_MODE_FAST;
         ret = ble_advertising_restart_without_whitelist(&m_advertising);
     }
     else
     {
+        // Advertising which already uses the current whitelist need not be restarted.
+        whitelist_set();
+        if(m_advertising_state == ADVERTISING_STATE_BONDED && !m_whitelist_changed && advertising_fast)
+        {
+            return 0;
+        }
+
         // Start advertising to bonded devices only, if there is at least one bonded device and no device is currently connected.
         if(m_advertising.adv_mode_current != BLE_ADV_MODE_IDLE)
         {
             (void) sd_ble_gap_adv_stop(m_advertising.adv_handle);
         }
+        m_advertising_state = ADVERTISING_STATE_STOPPED;
         if(pm_peer_count() > 0 && m_conn_handle == BLE_CONN_HANDLE_INVALID)
         {
-            whitelist_set(PM_PEER_ID_LIST_SKIP_NO_ID_ADDR);
             m_advertising.whitelist_temporarily_disabled = false;
             m_advertising.whitelist_in_use               = true;
             ret = ble_advertising_start(&m_advertising, BLE_ADV_MODE_FAST);
@@ -260,7 +424,15 @@ static int delete_bonds(void)
             NRF_LOG_INFO("ERROR: Fail to erase bonds with error: %d.\n", ret);
             return ret;
         }
-        return ble_start_advertising_handler(m_advertising_with_whitelist);
+        // Advertising is restarted when the bonds have been deleted, so that a mode change which
+        // follows this request does not restart it again.
+        m_bonds_delete_pending = true;
+        if(m_advertising_state != ADVERTISING_STATE_STOPPED)
+        {
+            (void) sd_ble_gap_adv_stop(m_advertising.adv_handle);
+            m_advertising_state = ADVERTISING_STATE_STOPPED;
+        }
+        return 0;
     }
     NRF_LOG_INFO("No bonds to erase!");
     return 0;
@@ -277,7 +449,21 @@ static void pm_evt_handler(pm_evt_t const * p_evt)
 
     switch (p_evt->evt_id)
     {
+        case PM_EVT_PEER_DELETE_SUCCEEDED:
+            whitelist_remove(p_evt->peer_id);
+            break;
+
         case PM_EVT_PEERS_DELETE_SUCCEEDED:
+            whitelist_clear();
+            m_bonds_delete_pending = false;
+            ble_start_advertising_handler(m_advertising_with_whitelist);
+            break;
+
+        case PM_EVT_PEERS_DELETE_FAILED:
+            // Some bonds may remain, so list them again.
+            m_whitelist_valid  = false;
+            m_identities_valid = false;
+            m_bonds_delete_pending = false;
             ble_start_advertising_handler(m_advertising_with_whitelist);
             break;
 
@@ -288,7 +474,7 @@ static void pm_evt_handler(pm_evt_t const * p_evt)
                 NRF_LOG_INFO("New Bond, add the peer to the whitelist if possible");
                 // Note: You should check on what kind of white list policy your application should use.
 
-                whitelist_set(PM_PEER_ID_LIST_SKIP_NO_ID_ADDR);
+                whitelist_add(p_evt->peer_id);
             }
             break;
 
@@ -299,10 +485,73 @@ static void pm_evt_handler(pm_evt_t const * p_evt)
 
 /**@brief Function for initializing the timer module.
  */
+static void conn_idle_timeout_handler(void * p_context);
+
 static void timers_init(void)
 {
     ret_code_t err_code = app_timer_init();
     APP_ERROR_CHECK(err_code);
+
+    err_code = app_timer_create(&m_conn_idle_timer, APP_TIMER_MODE_SINGLE_SHOT,
+                                conn_idle_timeout_handler);
+    APP_ERROR_CHECK(err_code);
+}
+
+/**@brief Function for requesting the connection parameters for an active or an idle connection.
+ *
+ * @details A short connection interval makes provisioning transfers, which take many round trips,
+ *          quick, but costs power in every connection event; a long one suits a connection which
+ *          is only kept open.
+ *
+ * @param[in] idle  Whether to request the idle parameters.
+ */
+static void conn_params_request(bool idle)
+{
+    ble_gap_conn_params_t conn_params =
+    {
+        .min_conn_interval = idle ? IDLE_MIN_CONN_INTERVAL : MIN_CONN_INTERVAL,
+        .max_conn_interval = idle ? IDLE_MAX_CONN_INTERVAL : MAX_CONN_INTERVAL,
+        .slave_latency     = SLAVE_LATENCY,
+        .conn_sup_timeout  = CONN_SUP_TIMEOUT,
+    };
+
+    ret_code_t err_code = ble_conn_params_change_conn_params(m_conn_handle, &conn_params);
+    if (err_code != NRF_SUCCESS)
+    {
+        NRF_LOG_WARNING("Connection parameters update request failed: 0x%x.", err_code);
+        return;
+    }
+    NRF_LOG_INFO("Requested %s connection parameters.", idle ? "idle" : "active");
+    m_conn_idle = idle;
+}
+
+/**@brief Function for handling the connection having been idle for CONN_IDLE_TIMEOUT.
+ */
+static void conn_idle_timeout_handler(void * p_context)
+{
+    UNUSED_PARAMETER(p_context);
+    if (m_conn_handle != BLE_CONN_HANDLE_INVALID && !m_conn_idle)
+    {
+        conn_params_request(true);
+    }
+}
+
+/**@brief Function for noting that data is being transferred over the connection, which asks for
+ *        short connection intervals again if the connection was idle.
+ */
+static void conn_activity(void)
+{
+    if (m_conn_handle == BLE_CONN_HANDLE_INVALID)
+    {
+        return;
+    }
+
+    UNUSED_RETURN_VALUE(app_timer_stop(m_conn_idle_timer));
+    UNUSED_RETURN_VALUE(app_timer_start(m_conn_idle_timer, CONN_IDLE_TIMEOUT, NULL));
+    if (m_conn_idle)
+    {
+        conn_params_request(false);
+    }
 }
 
 /**@brief Function for handling Queued Write Module errors.
@@ -317,27 +566,120 @@ static void nrf_qwr_error_handler(uint32_t nrf_error)
     APP_ERROR_HANDLER(nrf_error);
 }
 
+/**@brief Function for writing the data which has been received over BLE on UART.
+ */
+/**@brief Function for sending as much of the transmit queue as the SoftDevice accepts.
+ *
+ * @details Each notification carries as much of the queue as the negotiated ATT MTU allows, so
+ *          that several small messages which have queued up while the SoftDevice was busy take
+ *          one notification, and a large message takes as few as possible. Sending stops when
+ *          the SoftDevice's transmit queue is full, and resumes when it reports that a
+ *          notification has been transmitted. This is called both from the UART handler and
+ *          from BLE events, so the queue is only changed in a critical region.
+ */
+static void nus_tx_queue_drain(void)
+{
+    uint8_t chunk[BLE_NUS_MAX_DATA_LEN];
+
+    CRITICAL_REGION_ENTER();
+    while (m_nus_tx_length > 0)
+    {
+        uint16_t chunk_length =
+            (uint16_t)MIN(MIN(m_nus_tx_length, m_ble_nus_max_data_len), sizeof(chunk));
+        for (uint16_t i = 0; i < chunk_length; ++i)
+        {
+            chunk[i] = m_nus_tx_queue[(m_nus_tx_head + i) % NUS_TX_QUEUE_SIZE];
+        }
+
+        uint32_t err_code = ble_nus_data_send(&m_nus, chunk, &chunk_length, m_conn_handle);
+        if (err_code == NRF_ERROR_NOT_FOUND)
+        {
+            // Disconnected; the peer will ask again after it reconnects.
+            m_nus_tx_length = 0;
+            break;
+        }
+        if (err_code != NRF_SUCCESS)
+        {
+            // The SoftDevice's queue is full, or the peer has not yet enabled notifications.
+            if (err_code != NRF_ERROR_RESOURCES && err_code != NRF_ERROR_INVALID_STATE)
+            {
+                NRF_LOG_WARNING("Failed to send data over BLE NUS: 0x%x.", err_code);
+            }
+            break;
+        }
+
+        m_nus_tx_head    = (uint16_t)((m_nus_tx_head + chunk_length) % NUS_TX_QUEUE_SIZE);
+        m_nus_tx_length -= chunk_length;
+    }
+    CRITICAL_REGION_EXIT();
+}
+
+static void nus_rx_buffer_flush(void)
+{
+    if (m_nus_rx_length == 0)
+    {
+        return;
+    }
+
+    int result = message_protocol_send_data_via_uart(m_nus_rx_buffer, m_nus_rx_length);
+    if (result != 0)
+    {
+        NRF_LOG_ERROR("Failed to send UART data.");
+    }
+    m_nus_rx_length = 0;
+}
+
 /**@brief Function for handling the data from the Nordic UART Service.
  *
  * @details This function will process the data received from the Nordic UART BLE Service and send
- *          it to the UART module.
+ *          it to the UART module. A message which the peer writes in several fragments is
+ *          coalesced, and written on UART once it is complete, rather than one fragment at a
+ *          time. Data which is not the start of a message is written on UART as it arrives.
  *
  * @param[in] p_evt       Nordic UART Service event.
  */
 /**@snippet [Handling the data received over BLE] */
 static void nus_data_handler(ble_nus_evt_t * p_evt)
 {
+    if (p_evt->type == BLE_NUS_EVT_TX_RDY || p_evt->type == BLE_NUS_EVT_COMM_STARTED)
+    {
+        // A notification has been transmitted, or the peer has enabled them.
+        nus_tx_queue_drain();
+        return;
+    }
 
     if (p_evt->type == BLE_NUS_EVT_RX_DATA)
     {
-        NRF_LOG_DEBUG("Received data from BLE NUS. Writing data on UART.");
-        NRF_LOG_HEXDUMP_DEBUG(p_evt->params.rx_data.p_data, p_evt->params.rx_data.length);
-        int result = message_protocol_send_data_via_uart(p_evt->params.rx_data.p_data, 
-                                                         p_evt->params.rx_data.length);
+        uint8_t const * p_data = p_evt->params.rx_data.p_data;
+        uint16_t        length = p_evt->params.rx_data.length;
+
+        NRF_LOG_DEBUG("Received data from BLE NUS.");
+        NRF_LOG_HEXDUMP_DEBUG(p_data, length);
+        conn_activity();
 
-        if(result != 0)
+        if (m_nus_rx_length + length > sizeof(m_nus_rx_buffer))
         {
-            NRF_LOG_ERROR("Failed to send UART data.");
+            nus_rx_buffer_flush();
+        }
+        if (length > sizeof(m_nus_rx_buffer))
+        {
+            if (message_protocol_send_data_via_uart(p_data, length) != 0)
+            {
+                NRF_LOG_ERROR("Failed to send UART data.");
+            }
+            return;
+        }
+
+        memcpy(m_nus_rx_buffer + m_nus_rx_length, p_data, length);
+        m_nus_rx_length += length;
+
+        // Hold the data back only while it is the start of a message which is not yet complete.
+        size_t preamble_length = MIN(m_nus_rx_length, sizeof(MessageProtocol_MessagePreamble));
+        if (memcmp(m_nus_rx_buffer, MessageProtocol_MessagePreamble, preamble_length) != 0 ||
+            MessageProtocol_IsMessageComplete(m_nus_rx_buffer, (uint8_t)MIN(m_nus_rx_length, UINT8_MAX)))
+        {
+            NRF_LOG_DEBUG("Writing data on UART.");
+            nus_rx_buffer_flush();
         }
     }
 
@@ -421,18 +763,21 @@ static void on_adv_evt(ble_adv_evt_t ble_adv_evt)
             NRF_LOG_INFO("High Duty Directed advertising.");
             err_code = bsp_indication_set(BSP_INDICATE_ADVERTISING_DIRECTED);
             APP_ERROR_CHECK(err_code);
+            m_advertising_state = ADVERTISING_STATE_STOPPED;
             break;
 
         case BLE_ADV_EVT_DIRECTED:
             NRF_LOG_INFO("Directed advertising.");
             err_code = bsp_indication_set(BSP_INDICATE_ADVERTISING_DIRECTED);
             APP_ERROR_CHECK(err_code);
+            m_advertising_state = ADVERTISING_STATE_STOPPED;
             break;
 
         case BLE_ADV_EVT_FAST:
             NRF_LOG_INFO("Fast advertising.");
             err_code = bsp_indication_set(BSP_INDICATE_ADVERTISING);
             APP_ERROR_CHECK(err_code);
+            m_advertising_state = ADVERTISING_STATE_ALL;
             if(m_advertising_with_whitelist)
             {
                 NRF_LOG_INFO("Stop advertising, start fast advertising with whitelist");
@@ -444,12 +789,14 @@ static void on_adv_evt(ble_adv_evt_t ble_adv_evt)
             NRF_LOG_INFO("Slow advertising.");
             err_code = bsp_indication_set(BSP_INDICATE_ADVERTISING_SLOW);
             APP_ERROR_CHECK(err_code);
+            m_advertising_state = ADVERTISING_STATE_ALL;
             break;
 
         case BLE_ADV_EVT_FAST_WHITELIST:
             NRF_LOG_INFO("Fast advertising with whitelist.");
             err_code = bsp_indication_set(BSP_INDICATE_ADVERTISING_WHITELIST);
             APP_ERROR_CHECK(err_code);
+            m_advertising_state = ADVERTISING_STATE_BONDED;
             if(!m_advertising_with_whitelist)
             {
                 NRF_LOG_INFO("Stop advertising, start fast advertising without whitelist");
@@ -458,6 +805,7 @@ static void on_adv_evt(ble_adv_evt_t ble_adv_evt)
             else if(pm_peer_count() == 0 && m_advertising.adv_mode_current != BLE_ADV_MODE_IDLE)
             {
                 (void) sd_ble_gap_adv_stop(m_advertising.adv_handle);
+                m_advertising_state = ADVERTISING_STATE_STOPPED;
             }
             break;
 
@@ -465,9 +813,11 @@ static void on_adv_evt(ble_adv_evt_t ble_adv_evt)
             NRF_LOG_INFO("Slow advertising with whitelist.");
             err_code = bsp_indication_set(BSP_INDICATE_ADVERTISING_WHITELIST);
             APP_ERROR_CHECK(err_code);
+            m_advertising_state = ADVERTISING_STATE_BONDED;
             break;
 
         case BLE_ADV_EVT_IDLE:
+            m_advertising_state = ADVERTISING_STATE_STOPPED;
             sleep_mode_enter();
             break;
 
@@ -480,6 +830,7 @@ static void on_adv_evt(ble_adv_evt_t ble_adv_evt)
 
             err_code = pm_whitelist_get(whitelist_addrs, &addr_cnt,
                                         whitelist_irks,  &irk_cnt);
+            m_whitelist_changed = false;
             if(err_code != NRF_ERROR_NOT_FOUND && err_code != NRF_SUCCESS)
             {
                 APP_ERROR_CHECK(err_code);
@@ -545,6 +896,26 @@ static void ble_evt_handler(ble_evt_t const * p_ble_evt, void * p_context)
             err_code = nrf_ble_qwr_conn_handle_assign(&m_qwr, m_conn_handle);
             APP_ERROR_CHECK(err_code);
             m_advertising_with_whitelist = true;
+            m_advertising_state = ADVERTISING_STATE_STOPPED;
+            m_nus_rx_length = 0;
+            // Provisioning starts as soon as the central connects, so the connection starts
+            // with the active parameters, which the Connection Parameters module negotiates.
+            m_conn_idle = false;
+            conn_activity();
+            {
+                // Ask for the 2 Mbps PHY, which the SoftDevice falls back from if the central
+                // does not support it.
+                ble_gap_phys_t const phys =
+                {
+                    .rx_phys = BLE_GAP_PHY_2MBPS | BLE_GAP_PHY_1MBPS,
+                    .tx_phys = BLE_GAP_PHY_2MBPS | BLE_GAP_PHY_1MBPS,
+                };
+                err_code = sd_ble_gap_phy_update(m_conn_handle, &phys);
+                if (err_code != NRF_SUCCESS)
+                {
+                    NRF_LOG_WARNING("PHY update request failed: 0x%x.", err_code);
+                }
+            }
             ble_control_message_protocol_send_connected_event();
             break;
 
@@ -552,6 +923,14 @@ static void ble_evt_handler(ble_evt_t const * p_ble_evt, void * p_context)
             NRF_LOG_INFO("Disconnected");
             // LED indication will be changed when advertising starts.
             m_conn_handle = BLE_CONN_HANDLE_INVALID;
+            m_ble_nus_max_data_len = BLE_GATT_ATT_MTU_DEFAULT - 3;
+            // Drop any partial message; the peer will send it again after it reconnects.
+            m_nus_rx_length = 0;
+            UNUSED_RETURN_VALUE(app_timer_stop(m_conn_idle_timer));
+            m_conn_idle = false;
+            CRITICAL_REGION_ENTER();
+            m_nus_tx_length = 0;
+            CRITICAL_REGION_EXIT();
             ble_control_message_protocol_send_disconnected_event();
             break;
 
@@ -567,6 +946,12 @@ static void ble_evt_handler(ble_evt_t const * p_ble_evt, void * p_context)
             APP_ERROR_CHECK(err_code);
         } break;
 
+        case BLE_GAP_EVT_PHY_UPDATE:
+            NRF_LOG_INFO("PHY updated: tx 0x%x, rx 0x%x.",
+                         p_ble_evt->evt.gap_evt.params.phy_update.tx_phy,
+                         p_ble_evt->evt.gap_evt.params.phy_update.rx_phy);
+            break;
+
         case BLE_GATTS_EVT_SYS_ATTR_MISSING:
             // No system attributes have been stored.
             err_code = sd_ble_gatts_sys_attr_set(m_conn_handle, NULL, 0, 0);
@@ -633,6 +1018,10 @@ void gatt_evt_handler(nrf_ble_gatt_t * p_gatt, nrf_ble_gatt_evt_t const * p_evt)
         m_ble_nus_max_data_len = p_evt->params.att_mtu_effective - OPCODE_LENGTH - HANDLE_LENGTH;
         NRF_LOG_INFO("Data len is set to 0x%X(%d)", m_ble_nus_max_data_len, m_ble_nus_max_data_len);
     }
+    if ((m_conn_handle == p_evt->conn_handle) && (p_evt->evt_id == NRF_BLE_GATT_EVT_DATA_LENGTH_UPDATED))
+    {
+        NRF_LOG_INFO("Link layer data length is set to %d", p_evt->params.data_length);
+    }
     NRF_LOG_DEBUG("ATT MTU exchange completed. central 0x%x peripheral 0x%x",
                   p_gatt->att_mtu_desired_central,
                   p_gatt->att_mtu_desired_periph);
@@ -714,9 +1103,53 @@ static void idle_state_handle(void)
     nrf_pwr_mgmt_run();
 }
 
+/**@brief Function for sending data to the peer over the Nordic UART Service.
+ *
+ * @details The data is added to the transmit queue, and sent from it as the SoftDevice accepts
+ *          notifications; see nus_tx_queue_drain. A message is queued whole or not at all, so
+ *          that the peer never receives part of one.
+ *
+ * @param[in] data    The data to send.
+ * @param[in] length  The size of the data in bytes.
+ *
+ * @retval NRF_SUCCESS          The data has been queued.
+ * @retval NRF_ERROR_NOT_FOUND  There is no connection, and the data has been dropped.
+ * @retval NRF_ERROR_RESOURCES  The queue has no room for the data, which has been dropped.
+ */
 static uint32_t send_data_to_ble_nus(uint8_t *data, uint16_t length)
 {
-    return ble_nus_data_send(&m_nus, data, &length, m_conn_handle);
+    uint32_t err_code = NRF_SUCCESS;
+
+    CRITICAL_REGION_ENTER();
+    if (m_conn_handle == BLE_CONN_HANDLE_INVALID)
+    {
+        err_code = NRF_ERROR_NOT_FOUND;
+    }
+    else if (length > NUS_TX_QUEUE_SIZE - m_nus_tx_length)
+    {
+        err_code = NRF_ERROR_RESOURCES;
+    }
+    else
+    {
+        for (uint16_t i = 0; i < length; ++i)
+        {
+            m_nus_tx_queue[(m_nus_tx_head + m_nus_tx_length + i) % NUS_TX_QUEUE_SIZE] = data[i];
+        }
+        m_nus_tx_length += length;
+    }
+    CRITICAL_REGION_EXIT();
+
+    if (err_code == NRF_ERROR_RESOURCES)
+    {
+        NRF_LOG_WARNING("BLE NUS transmit queue is full; dropping %u bytes.", length);
+    }
+    if (err_code != NRF_ERROR_NOT_FOUND)
+    {
+        conn_activity();
+    }
+
+    nus_tx_queue_drain();
+    return err_code;
 }
 
 /**@brief Function for the SoftDevice initialization.
@@ -740,6 +1173,14 @@ static void ble_stack_init(void)
     err_code = nrf_sdh_ble_enable(&ram_start);
     APP_ERROR_CHECK(err_code);
 
+    // Let a connection event run on while there are packets to send, so that a message which is
+    // split across several packets is sent in one connection interval.
+    ble_opt_t opt;
+    memset(&opt, 0, sizeof(opt));
+    opt.common_opt.conn_evt_ext.enable = 1;
+    err_code = sd_ble_opt_set(BLE_COMMON_OPT_CONN_EVT_EXT, &opt);
+    APP_ERROR_CHECK(err_code);
+
     // Register a handler for BLE events.
     NRF_SDH_BLE_OBSERVER(m_ble_observer, APP_BLE_OBSERVER_PRIO, ble_evt_handler, NULL);
 }
@@ -792,8 +1233,14 @@ void gatt_init(void)
     err_code = nrf_ble_gatt_init(&m_gatt, gatt_evt_handler);
     APP_ERROR_CHECK(err_code);
 
+    // Ask for the largest ATT MTU and link layer data length, so that a whole message fits in
+    // one notification, and one packet, instead of being split into 20-byte fragments.
     err_code = nrf_ble_gatt_att_mtu_periph_set(&m_gatt, NRF_SDH_BLE_GATT_MAX_MTU_SIZE);
     APP_ERROR_CHECK(err_code);
+
+    err_code = nrf_ble_gatt_data_length_set(&m_gatt, BLE_CONN_HANDLE_INVALID,
+                                            NRF_SDH_BLE_GAP_DATA_LENGTH);
+    APP_ERROR_CHECK(err_code);
 }
 
 /**@snippet [Handling the data received over BLE] */
@@ -846,6 +1293,9 @@ static void advertising_init(void)
     init.config.ble_adv_fast_enabled  = true;
     init.config.ble_adv_fast_interval = APP_ADV_INTERVAL;
     init.config.ble_adv_fast_timeout  = APP_ADV_DURATION;
+    init.config.ble_adv_slow_enabled  = true;
+    init.config.ble_adv_slow_interval = APP_ADV_SLOW_INTERVAL;
+    init.config.ble_adv_slow_timeout  = APP_ADV_SLOW_DURATION;
     init.evt_handler = on_adv_evt;
 
     err_code = ble_advertising_init(&m_advertising, &init);
@@ -936,11 +1386,11 @@ static int init_ble_stack(const uint8_t *name, uint8_t length)
 int main(void)
 
  {
-    // Initialize.
-    message_protocol_init(send_data_to_ble_nus);
-    ble_control_message_protocol_init(init_ble_stack, set_ble_passkey, ble_start_advertising_handler, delete_bonds);
+    // Initialize. The UART transport uses a timer, so the timer module is initialized first.
     log_init();
     timers_init();
+    message_protocol_init(send_data_to_ble_nus);
+    ble_control_message_protocol_init(init_ble_stack, set_ble_passkey, ble_start_advertising_handler, delete_bonds);
     buttons_leds_init();
     power_management_init();
     ble_control_message_protocol_send_device_up_event();
@@ -49,73 +49,220 @@
  */
 #include "uart_utilities.h"
 
-#include "ble_nus.h"
-#include "app_uart.h"
-#include "bsp_btn_ble.h"
+#include <string.h>
 
-#if defined(UART_PRESENT)
-#include "nrf_uart.h"
-#endif
-#if defined(UARTE_PRESENT)
-#include "nrf_uarte.h"
-#endif
+#include "app_error.h"
+#include "app_timer.h"
+#include "app_util_platform.h"
+#include "boards.h"
+#include "nrf_drv_uart.h"
+
+#include "message_protocol_private.h"
 
 #include "nrf_log.h"
 #include "nrf_log_ctrl.h"
 #include "nrf_log_default_backends.h"
 
-#define UART_TX_BUF_SIZE 256 /**< UART TX buffer size. */
-#define UART_RX_BUF_SIZE 256 /**< UART RX buffer size. */
+// The UART is driven by EasyDMA: a frame's header is received with one transfer, and its body,
+// whose length the header gives, with a second, so the CPU is interrupted twice per frame rather
+// than once per byte, and can sleep while a frame arrives. Only while it is looking for the
+// preamble of a frame, after a corrupt or incomplete one, does the transport receive a byte at a
+// time. Frames are received alternately into two buffers, so the next frame's header is already
+// being received while the previous frame is handled.
+#define UART_DMA_MAX_LENGTH 255 /**< Largest transfer which the UARTE's EasyDMA can make. */
+#define UART_RX_BUF_SIZE 255    /**< UART RX buffer size, which is the largest frame. */
+#define UART_TX_BUF_SIZE 1024   /**< UART TX ring buffer size. */
+#define UART_RX_TIMEOUT_MS 100  /**< Time within which a frame's body must follow its header. */
+
+#define FRAME_HEADER_SIZE sizeof(MessageProtocol_MessageHeader)
+
+static nrf_drv_uart_t m_uart = NRF_DRV_UART_INSTANCE(0);
+APP_TIMER_DEF(m_rx_timeout_timer);
 
 static received_uart_data_handler_t m_received_uart_data_handler;
 
+// Frames are received alternately into each of these buffers.
+static uint8_t m_rx_buffers[2][UART_RX_BUF_SIZE];
+static uint8_t m_rx_buffer_index = 0;
+// Number of bytes of the current frame which have been received.
+static uint8_t m_rx_length = 0;
+static bool    m_rx_timed_out = false;
+
+// Data which is waiting to be sent, from m_tx_tail; the transfer in progress, if any, is the first
+// m_tx_in_progress bytes.
+static uint8_t  m_tx_buffer[UART_TX_BUF_SIZE];
+static uint16_t m_tx_head = 0;
+static uint16_t m_tx_tail = 0;
+static uint16_t m_tx_count = 0;
+static uint16_t m_tx_in_progress = 0;
+
+/**@brief Function for starting the transfer of the next contiguous block of data to send.
+ *
+ * @details This function must be called with interrupts disabled, or from the UART interrupt.
+ */
+static void tx_start_next(void)
+{
+    if (m_tx_in_progress != 0 || m_tx_count == 0) {
+        return;
+    }
+
+    uint16_t length = MIN(m_tx_count, UART_TX_BUF_SIZE - m_tx_tail);
+    length = MIN(length, UART_DMA_MAX_LENGTH);
+    m_tx_in_progress = length;
+    ret_code_t err_code = nrf_drv_uart_tx(&m_uart, &m_tx_buffer[m_tx_tail], (uint8_t)length);
+    if (err_code != NRF_SUCCESS) {
+        NRF_LOG_ERROR("Failed sending UART data. Error 0x%x. ", err_code);
+        m_tx_in_progress = 0;
+    }
+}
+
 /**@brief Function for sending data via UART.
  *
- * @details This function will send data to the UART module.
+ * @details This function will copy the data to the transmit buffer, from which it is sent by
+ *          EasyDMA, and return without waiting for it to be sent.
  *
  * @param[in] p_data_to_send       The data to send.
  * @param[in] total_bytes_to_send  The size of the data in bytes.
  */
 void send_data_via_uart(uint8_t const *p_data_to_send, uint32_t total_bytes_to_send)
 {
-    uint32_t err_code;
     NRF_LOG_INFO("Writing data on UART.");
-    for (uint32_t i = 0; i < total_bytes_to_send; i++) {
-        do {
-            err_code = app_uart_put(p_data_to_send[i]);
-            if ((err_code != NRF_SUCCESS) && (err_code != NRF_ERROR_BUSY)) {
-                NRF_LOG_ERROR("Failed sending UART data. Error 0x%x. ", err_code);
-                APP_ERROR_CHECK(err_code);
-            }
-        } while (err_code == NRF_ERROR_BUSY);
+
+    CRITICAL_REGION_ENTER();
+    if (total_bytes_to_send > UART_TX_BUF_SIZE - m_tx_count) {
+        NRF_LOG_ERROR("UART transmit buffer is full; dropping %d bytes.", total_bytes_to_send);
+    } else {
+        for (uint32_t i = 0; i < total_bytes_to_send; i++) {
+            m_tx_buffer[m_tx_head] = p_data_to_send[i];
+            m_tx_head = (uint16_t)((m_tx_head + 1) % UART_TX_BUF_SIZE);
+        }
+        m_tx_count = (uint16_t)(m_tx_count + total_bytes_to_send);
+        tx_start_next();
+    }
+    CRITICAL_REGION_EXIT();
+}
+
+/**@brief Function for receiving the given number of bytes, following those already received,
+ *        into the current frame's buffer.
+ */
+static void rx_receive(uint8_t length)
+{
+    ret_code_t err_code =
+        nrf_drv_uart_rx(&m_uart, &m_rx_buffers[m_rx_buffer_index][m_rx_length], length);
+    APP_ERROR_CHECK(err_code);
+}
+
+/**@brief Function for starting to receive a new frame, into the other buffer.
+ */
+static void rx_start_frame(void)
+{
+    m_rx_buffer_index ^= 1;
+    m_rx_length = 0;
+    rx_receive(FRAME_HEADER_SIZE);
+}
+
+/**@brief Function for handling the bytes which have been received into the current frame.
+ *
+ * @details Once the header has been received, the rest of the frame is received in one
+ *          transfer. If the received bytes do not start with the preamble, they are discarded
+ *          one by one until they do.
+ */
+static void rx_process(void)
+{
+    uint8_t *p_frame = m_rx_buffers[m_rx_buffer_index];
+
+    // Discard bytes up to the next possible start of a preamble.
+    uint8_t skipped = 0;
+    while (skipped < m_rx_length &&
+           memcmp(&p_frame[skipped], MessageProtocol_MessagePreamble,
+                  MIN(m_rx_length - skipped, sizeof(MessageProtocol_MessagePreamble))) != 0) {
+        skipped++;
+    }
+    if (skipped > 0) {
+        NRF_LOG_DEBUG("Discarding %d bytes received on UART outside a frame.", skipped);
+        m_rx_length = (uint8_t)(m_rx_length - skipped);
+        memmove(p_frame, &p_frame[skipped], m_rx_length);
+    }
+
+    if (m_rx_length < FRAME_HEADER_SIZE) {
+        rx_receive((uint8_t)(FRAME_HEADER_SIZE - m_rx_length));
+        return;
+    }
+
+    MessageProtocol_MessageHeader const *p_header = (MessageProtocol_MessageHeader const *)p_frame;
+    if (p_header->length > UART_DMA_MAX_LENGTH - FRAME_HEADER_SIZE) {
+        NRF_LOG_ERROR("Discarding UART frame which is too long: %d bytes.", p_header->length);
+        // Look for a preamble after this one.
+        m_rx_length = (uint8_t)(m_rx_length - 1);
+        memmove(p_frame, &p_frame[1], m_rx_length);
+        rx_process();
+        return;
+    }
+
+    uint8_t frame_length = (uint8_t)(FRAME_HEADER_SIZE + p_header->length);
+    if (m_rx_length < frame_length) {
+        if (m_rx_length == FRAME_HEADER_SIZE) {
+            ret_code_t err_code = app_timer_start(
+                m_rx_timeout_timer, APP_TIMER_TICKS(UART_RX_TIMEOUT_MS), NULL);
+            APP_ERROR_CHECK(err_code);
+        }
+        rx_receive((uint8_t)(frame_length - m_rx_length));
+        return;
     }
+
+    UNUSED_RETURN_VALUE(app_timer_stop(m_rx_timeout_timer));
+
+    // Start receiving the next frame before this one is handled, so that it is not held up.
+    uint8_t length = m_rx_length;
+    rx_start_frame();
+    m_received_uart_data_handler(p_frame, &length);
+}
+
+/**@brief Function for handling the expiry of the timer which limits how long a frame's body
+ *        takes to arrive.
+ */
+static void rx_timeout_handler(void *p_context)
+{
+    NRF_LOG_ERROR("Timed out receiving UART frame; discarding it.");
+    m_rx_timed_out = true;
+    nrf_drv_uart_rx_abort(&m_uart);
 }
 
-/**@brief   Function for handling app_uart events.
+/**@brief   Function for handling UART driver events.
  *
- * @details This function will receive a single character from the app_uart module and append it to
- *          a buffer. If the event type is APP_UART_DATA_READY, the received UART data handle is
- *          called each time to process the data.
+ * @details This function is called when an EasyDMA transfer completes. Received data is appended
+ *          to the current frame, and the received UART data handler is called once the frame is
+ *          complete.
  */
 /**@snippet [Handling the data received over UART] */
-static void uart_event_handle(app_uart_evt_t *p_event)
+static void uart_event_handle(nrf_drv_uart_event_t *p_event, void *p_context)
 {
-    static uint8_t data_array[BLE_NUS_MAX_DATA_LEN];
-    static uint8_t index = 0;
-
-    switch (p_event->evt_type) {
-    case APP_UART_DATA_READY:
-        UNUSED_VARIABLE(app_uart_get(&data_array[index]));
-        index++;
-        m_received_uart_data_handler(data_array, &index);
+    switch (p_event->type) {
+    case NRF_DRV_UART_EVT_RX_DONE:
+        if (m_rx_timed_out) {
+            m_rx_timed_out = false;
+            m_rx_length = 0;
+            rx_receive(FRAME_HEADER_SIZE);
+            break;
+        }
+        m_rx_length = (uint8_t)(m_rx_length + p_event->data.rxtx.bytes);
+        rx_process();
         break;
 
-    case APP_UART_COMMUNICATION_ERROR:
-        APP_ERROR_HANDLER(p_event->data.error_communication);
+    case NRF_DRV_UART_EVT_TX_DONE:
+        m_tx_tail = (uint16_t)((m_tx_tail + m_tx_in_progress) % UART_TX_BUF_SIZE);
+        m_tx_count = (uint16_t)(m_tx_count - m_tx_in_progress);
+        m_tx_in_progress = 0;
+        tx_start_next();
         break;
 
-    case APP_UART_FIFO_ERROR:
-        APP_ERROR_HANDLER(p_event->data.error_code);
+    case NRF_DRV_UART_EVT_ERROR:
+        // Discard the frame which was being received, and look for the start of the next one.
+        NRF_LOG_ERROR("UART receive error 0x%x; discarding frame.",
+                      p_event->data.error.error_mask);
+        UNUSED_RETURN_VALUE(app_timer_stop(m_rx_timeout_timer));
+        m_rx_length = 0;
+        rx_receive(FRAME_HEADER_SIZE);
         break;
 
     default:
@@ -132,22 +279,24 @@ void uart_init(received_uart_data_handler_t received_uart_data_handler)
 {
     m_received_uart_data_handler = received_uart_data_handler;
 
-    uint32_t err_code;
-    app_uart_comm_params_t const comm_params = {
-        .rx_pin_no = RX_PIN_NUMBER,
-        .tx_pin_no = TX_PIN_NUMBER,
-        .rts_pin_no = RTS_PIN_NUMBER,
-        .cts_pin_no = CTS_PIN_NUMBER,
-        .flow_control = APP_UART_FLOW_CONTROL_ENABLED,
-        .use_parity = false,
-#if defined(UART_PRESENT)
-        .baud_rate = NRF_UART_BAUDRATE_115200
-#else
-        .baud_rate = NRF_UARTE_BAUDRATE_115200
-#endif
-    };
-
-    APP_UART_FIFO_INIT(&comm_params, UART_RX_BUF_SIZE, UART_TX_BUF_SIZE, uart_event_handle,
-                       APP_IRQ_PRIORITY_LOWEST, err_code);
+    ret_code_t err_code =
+        app_timer_create(&m_rx_timeout_timer, APP_TIMER_MODE_SINGLE_SHOT, rx_timeout_handler);
+    APP_ERROR_CHECK(err_code);
+
+    nrf_drv_uart_config_t config = NRF_DRV_UART_DEFAULT_CONFIG;
+    config.pselrxd = RX_PIN_NUMBER;
+    config.pseltxd = TX_PIN_NUMBER;
+    config.pselrts = RTS_PIN_NUMBER;
+    config.pselcts = CTS_PIN_NUMBER;
+    config.hwfc = NRF_UART_HWFC_ENABLED;
+    config.parity = NRF_UART_PARITY_EXCLUDED;
+    config.baudrate = NRF_UART_BAUDRATE_115200;
+    config.interrupt_priority = APP_IRQ_PRIORITY_LOWEST;
+    config.use_easy_dma = true;
+
+    err_code = nrf_drv_uart_init(&m_uart, &config, uart_event_handle);
     APP_ERROR_CHECK(err_code);
-}
\ No newline at end of file
+
+    m_rx_length = 0;
+    rx_receive(FRAME_HEADER_SIZE);
+}
@@ -23,8 +23,15 @@ namespace Microsoft.Azure.Sphere.Samples.WifiSetupAndDeviceControlViaBle.Message
         private static readonly int E_BLUETOOTH_ATT_INVALID_PDU = unchecked((int)0x80650004);
         private static readonly int E_ACCESSDENIED = unchecked((int)0x80070005);
 
+        // The device sends messages back to back, so a notification may carry several of them, or
+        // part of one. Each message starts with a preamble and a 16-bit length, which counts the
+        // bytes after this header.
+        private static readonly byte[] MessagePreamble = { 0x22, 0xB5, 0x58, 0xB9 };
+        private const int MessageHeaderLength = 6;
+
         private GattCharacteristic notificationCharacteristic;
         private bool isListening = false;
+        private readonly List<byte> receivedData = new List<byte>();
 
         public event NotifyEventHandler NotificationReceived;
 
@@ -107,6 +114,7 @@ namespace Microsoft.Azure.Sphere.Samples.WifiSetupAndDeviceControlViaBle.Message
 
             notificationCharacteristic.ValueChanged -= Characteristic_ValueChanged;
             isListening = false;
+            receivedData.Clear();
         }
 
         private void Characteristic_ValueChanged(GattCharacteristic sender, GattValueChangedEventArgs args)
@@ -114,8 +122,43 @@ namespace Microsoft.Azure.Sphere.Samples.WifiSetupAndDeviceControlViaBle.Message
             if (sender == notificationCharacteristic)
             {
                 Debug.WriteLine($"Received notification of data to Bluetooth LE characteristic.");
-                NotificationReceived?.Invoke(this, new NotifyEventArgs(args.CharacteristicValue.ToArray()));
+                receivedData.AddRange(args.CharacteristicValue.ToArray());
+
+                byte[] message;
+                while ((message = TakeReceivedMessage()) != null)
+                {
+                    NotificationReceived?.Invoke(this, new NotifyEventArgs(message));
+                }
+            }
+        }
+
+        // Removes the first complete message from the received data, and returns it, or returns null
+        // if no message is complete yet. Data before a preamble is discarded.
+        private byte[] TakeReceivedMessage()
+        {
+            int start = 0;
+            while (start + MessagePreamble.Length <= receivedData.Count &&
+                   !MessagePreamble.SequenceEqual(receivedData.GetRange(start, MessagePreamble.Length)))
+            {
+                start++;
+            }
+
+            // Keep the bytes which may be the start of a preamble.
+            receivedData.RemoveRange(0, start);
+            if (receivedData.Count < MessageHeaderLength)
+            {
+                return null;
             }
+
+            int length = MessageHeaderLength + (receivedData[4] | (receivedData[5] << 8));
+            if (receivedData.Count < length)
+            {
+                return null;
+            }
+
+            byte[] message = receivedData.GetRange(0, length).ToArray();
+            receivedData.RemoveRange(0, length);
+            return message;
         }
 
         private static async Task<GattCharacteristic> GetCharacteristicAsync(GattDeviceService service, Guid characteristicId)
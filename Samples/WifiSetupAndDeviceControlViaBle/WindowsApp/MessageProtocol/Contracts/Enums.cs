@@ -35,7 +35,8 @@ namespace Microsoft.Azure.Sphere.Samples.WifiSetupAndDeviceControlViaBle.Message
         SetWifiScanResultsSummary = 0x0002,
         SetWifiStatus             = 0x0003,
         SetWifiOperationResult    = 0x0004,
-        SetNextWifiScanResult     = 0x0005
+        SetNextWifiScanResult     = 0x0005,
+        SetWifiScanResults        = 0x0006
     }
 
     public enum DeviceControlRequestId : ushort
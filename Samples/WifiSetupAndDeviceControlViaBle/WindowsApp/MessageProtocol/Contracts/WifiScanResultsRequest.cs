@@ -0,0 +1,50 @@
+﻿// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+namespace Microsoft.Azure.Sphere.Samples.WifiSetupAndDeviceControlViaBle.MessageProtocol.Contracts
+{
+    using System.Collections.Generic;
+
+    public sealed class WifiScanResultsRequest : RequestBase
+    {
+        private const uint HeaderLength = 4;
+        private const uint ResultLength = 36;
+
+        internal WifiScanResultsRequest(WifiRequestId wifiRequestType, uint sequenceId, byte[] payload)
+            : base(CategoryIdType.WifiControl, (ushort)wifiRequestType, sequenceId, payload, GetExpectedPayloadLength(payload))
+        {
+            /* Data format:
+             * 
+             * - 00 [  1 ] Index of the first network in the whole scan
+             * - 01 [  1 ] Result count - the number of networks in this request
+             * - 02 [  1 ] Total network count
+             * - 03 [  1 ] Reserved
+             * - 04 [ 36 ] Networks, each in the format of a Set Next Wi-Fi Scan Result request
+             */
+
+            FirstIndex   = payload[0];
+            NetworkCount = payload[2];
+
+            var networks = new List<WifiScanResultRequest>();
+            for (uint i = 0; i < payload[1]; i++)
+            {
+                byte[] network = ByteArrayHelper.ReadBytes(payload, HeaderLength + i * ResultLength, ResultLength);
+                networks.Add(new WifiScanResultRequest(wifiRequestType, sequenceId, network));
+            }
+            Networks = networks;
+        }
+
+        public uint FirstIndex { get; }
+
+        public uint NetworkCount { get; }
+
+        public IReadOnlyList<WifiScanResultRequest> Networks { get; }
+
+        private static int GetExpectedPayloadLength(byte[] payload)
+        {
+            // The length depends on the result count, so a payload which is too short to hold
+            // the count is checked against the shortest valid length.
+            return (payload == null || payload.Length < HeaderLength) ? (int)HeaderLength : (int)(HeaderLength + payload[1] * ResultLength);
+        }
+    }
+}
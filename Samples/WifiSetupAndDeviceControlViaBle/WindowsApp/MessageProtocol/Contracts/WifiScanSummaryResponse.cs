@@ -0,0 +1,30 @@
+﻿// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+namespace Microsoft.Azure.Sphere.Samples.WifiSetupAndDeviceControlViaBle.MessageProtocol.Contracts
+{
+    public sealed class WifiScanSummaryResponse : ResponseBase
+    {
+        public WifiScanSummaryResponse(bool bulkScanResultsSupported)
+        {
+            BulkScanResultsSupported = bulkScanResultsSupported;
+        }
+
+        public bool BulkScanResultsSupported { get; }
+
+        internal override byte[] GetPayload()
+        {
+            /* Data format:
+             * 
+             * - 00 [  1 ] Flags - 0x01 if Set Wi-Fi Scan Results requests are accepted
+             * - 01 [  3 ] Reserved
+             */
+
+            byte[] payload = new byte[4];
+
+            payload[0] = (byte)(BulkScanResultsSupported ? 0x01 : 0x00);
+
+            return payload;
+        }
+    }
+}
@@ -199,14 +199,16 @@ namespace Microsoft.Azure.Sphere.Samples.WifiSetupAndDeviceControlViaBle.Message
                     actualWifiNetworkCount = 0;
                     expectedWifiNetworkCount = wifiScanSummaryRequest.NetworkCount;
 
-                    await SendResponseAsync(currentService, wifiScanSummaryRequest, wifiScanSummaryRequest.ErrorCode);
+                    // Ask the device to send several networks in each request.
+                    await SendResponseAsync(currentService, wifiScanSummaryRequest, wifiScanSummaryRequest.ErrorCode, new WifiScanSummaryResponse(true));
                 }
             }
         }
 
         private async void WifiScanResultRequest_NotificationReceived(object sender, NotifyEventArgs e)
         {
-            if (MessageProtocolFactory.ReadRequestMessagePayload(e.Data) is WifiScanResultRequest wifiScanResultRequest)
+            RequestBase request = MessageProtocolFactory.ReadRequestMessagePayload(e.Data);
+            if (request is WifiScanResultRequest wifiScanResultRequest)
             {
                 Debug.WriteLine($"Received Wi-Fi config message protocol request: '{wifiScanResultRequest.RequestType}'");
 
@@ -214,11 +216,27 @@ namespace Microsoft.Azure.Sphere.Samples.WifiSetupAndDeviceControlViaBle.Message
                 WifiNetworkScanReceived?.Invoke(this, new WifiScanRequestEventArgs(wifiScanResultRequest, actualWifiNetworkCount, expectedWifiNetworkCount));
 
                 await SendResponseAsync(currentService, wifiScanResultRequest, 0x00);
+            }
+            else if (request is WifiScanResultsRequest wifiScanResultsRequest)
+            {
+                Debug.WriteLine($"Received Wi-Fi config message protocol request: '{wifiScanResultsRequest.RequestType}' ({wifiScanResultsRequest.FirstIndex})");
 
-                if (actualWifiNetworkCount == expectedWifiNetworkCount)
+                foreach (WifiScanResultRequest network in wifiScanResultsRequest.Networks)
                 {
-                    bluetoothLeHelper.NotificationReceived -= WifiScanResultRequest_NotificationReceived;
+                    actualWifiNetworkCount++;
+                    WifiNetworkScanReceived?.Invoke(this, new WifiScanRequestEventArgs(network, actualWifiNetworkCount, expectedWifiNetworkCount));
                 }
+
+                await SendResponseAsync(currentService, wifiScanResultsRequest, 0x00);
+            }
+            else
+            {
+                return;
+            }
+
+            if (actualWifiNetworkCount >= expectedWifiNetworkCount)
+            {
+                bluetoothLeHelper.NotificationReceived -= WifiScanResultRequest_NotificationReceived;
             }
         }
 
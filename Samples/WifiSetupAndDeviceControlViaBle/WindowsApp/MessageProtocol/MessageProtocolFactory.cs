@@ -142,6 +142,9 @@ namespace Microsoft.Azure.Sphere.Samples.WifiSetupAndDeviceControlViaBle.Message
                         case WifiRequestId.SetNextWifiScanResult:
                             return new WifiScanResultRequest(wifiRequestId, sequenceId, payload);
 
+                        case WifiRequestId.SetWifiScanResults:
+                            return new WifiScanResultsRequest(wifiRequestId, sequenceId, payload);
+
                         case WifiRequestId.GetNewWifiDetails:
                             // This request doesn't have a payload
                             return new WifiGetNewDetailsRequest(wifiRequestId, sequenceId);
@@ -0,0 +1,37 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include "blecontrol_message_protocol_defs.h"
+#include "message_codec.h"
+
+// Codecs for the bodies of the messages in blecontrol_message_protocol_defs.h, which are shared
+// by the high-level app and the nRF52 firmware. The schemas keep the reserved bytes of the
+// structs, so the bytes on the wire are the same as those of earlier firmware. New fields must be
+// added at the end of a schema, with a higher version; see message_codec.h.
+
+#define BLECONTROL_INITIALIZE_BLE_DEVICE_FIELDS(X, T) \
+    X(T, U8, deviceNameLength, , 1)                   \
+    X(T, RESERVED, reserved1, , 1)                    \
+    X(T, BYTES, deviceName, , 1)                      \
+    X(T, RESERVED, reserved2, , 1)
+
+MESSAGE_CODEC_DEFINE(BleControl_InitializeBleDevice,
+                     BleControlMessageProtocol_InitializeBleDeviceStruct,
+                     BLECONTROL_INITIALIZE_BLE_DEVICE_FIELDS)
+
+#define BLECONTROL_SET_PASSKEY_FIELDS(X, T) \
+    X(T, BYTES, passkey, , 1)               \
+    X(T, RESERVED, reserved, , 1)
+
+MESSAGE_CODEC_DEFINE(BleControl_SetPasskey, BleControlMessageProtocol_SetPasskeyStruct,
+                     BLECONTROL_SET_PASSKEY_FIELDS)
+
+#define BLECONTROL_CHANGE_BLE_ADVERTISING_MODE_FIELDS(X, T) \
+    X(T, U8, mode, , 1)                                     \
+    X(T, RESERVED, reserved, , 1)
+
+MESSAGE_CODEC_DEFINE(BleControl_ChangeBleAdvertisingMode,
+                     BleControlMessageProtocol_ChangeBleAdvertisingModeStruct,
+                     BLECONTROL_CHANGE_BLE_ADVERTISING_MODE_FIELDS)
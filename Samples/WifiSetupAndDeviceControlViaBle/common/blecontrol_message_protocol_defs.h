@@ -3,6 +3,7 @@
 
 #pragma once
 #include <stdint.h>
+#include "message_protocol_categories.h"
 
 /// <summary>
 ///     Request ID for Initialize Device Request message.
@@ -2,19 +2,7 @@
    Licensed under the MIT License. */
 
 #pragma once
-#include <stdint.h>
-
-/// <summary>Specifies the type of a message protocol message category ID.</summary>
-typedef uint16_t MessageProtocol_CategoryId;
-
-/// <summary>Specifies the type of a message protocol request ID.</summary>
-typedef uint16_t MessageProtocol_RequestId;
-
-/// <summary>Specifies the type of a message protocol event ID.</summary>
-typedef uint16_t MessageProtocol_EventId;
-
-/// <summary>Specifies the type of a message protocol response result.</summary>
-typedef uint8_t MessageProtocol_ResponseResult;
+#include "message_protocol_public.h"
 
 /// <summary>Category ID for a BLE control message.</summary>
 static const MessageProtocol_CategoryId MessageProtocol_BleControlCategoryId = 0x0001;
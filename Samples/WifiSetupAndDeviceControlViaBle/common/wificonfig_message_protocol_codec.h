@@ -0,0 +1,91 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include "message_codec.h"
+#include "wificonfig_message_protocol_defs.h"
+
+// Codecs for the bodies of the messages in wificonfig_message_protocol_defs.h. The nRF52 passes
+// these bodies to and from the BLE central unchanged, so the schemas keep the reserved bytes of
+// the structs, and the bytes on the wire are the same as those of earlier versions. New fields
+// must be added at the end of a schema, with a higher version; see message_codec.h.
+
+#define WIFICONFIG_NEW_WIFI_DETAILS_FIELDS(X, T) \
+    X(T, U8, securityType, , 1)                  \
+    X(T, U8, ssidLength, , 1)                    \
+    X(T, RESERVED, reserved1, , 1)               \
+    X(T, BYTES, ssid, , 1)                       \
+    X(T, U8, pskLength, , 1)                     \
+    X(T, RESERVED, reserved2, , 1)               \
+    X(T, BYTES, psk, , 1)                        \
+    X(T, U8, targetedScan, , 1)                  \
+    X(T, RESERVED, reserved3, , 1)
+
+MESSAGE_CODEC_DEFINE(WifiConfig_NewWifiDetails, WifiConfigureMessageProtocol_NewWifiDetailsStruct,
+                     WIFICONFIG_NEW_WIFI_DETAILS_FIELDS)
+
+#define WIFICONFIG_WIFI_STATUS_FIELDS(X, T) \
+    X(T, U8, connectionStatus, , 1)         \
+    X(T, I8, signalLevel, , 1)              \
+    X(T, U8, securityType, , 1)             \
+    X(T, U8, ssidLength, , 1)               \
+    X(T, BYTES, ssid, , 1)                  \
+    X(T, U32, frequency, , 1)               \
+    X(T, BYTES, bssid, , 1)                 \
+    X(T, RESERVED, reserved, , 1)
+
+MESSAGE_CODEC_DEFINE(WifiConfig_WifiStatus, WifiConfigureMessageProtocol_WifiStatusRequestStruct,
+                     WIFICONFIG_WIFI_STATUS_FIELDS)
+
+#define WIFICONFIG_WIFI_SCAN_RESULTS_SUMMARY_FIELDS(X, T) \
+    X(T, U8, scanResult, , 1)                             \
+    X(T, U8, totalNetworkCount, , 1)                      \
+    X(T, RESERVED, reserved, , 1)                         \
+    X(T, U32, totalResultsSize, , 1)
+
+MESSAGE_CODEC_DEFINE(WifiConfig_WifiScanResultsSummary,
+                     WifiConfigureMessageProtocol_WifiScanResultsSummaryRequestStruct,
+                     WIFICONFIG_WIFI_SCAN_RESULTS_SUMMARY_FIELDS)
+
+#define WIFICONFIG_WIFI_SCAN_RESULT_FIELDS(X, T) \
+    X(T, U8, securityType, , 1)                  \
+    X(T, I8, signalRssi, , 1)                    \
+    X(T, U8, ssidLength, , 1)                    \
+    X(T, RESERVED, reserved, , 1)                \
+    X(T, BYTES, ssid, , 1)
+
+MESSAGE_CODEC_DEFINE(WifiConfig_WifiScanResult,
+                     WifiConfigureMessageProtocol_WifiScanResultRequestStruct,
+                     WIFICONFIG_WIFI_SCAN_RESULT_FIELDS)
+
+#define WIFICONFIG_WIFI_SCAN_RESULTS_SUMMARY_RESPONSE_FIELDS(X, T) \
+    X(T, U8, flags, , 1)                                           \
+    X(T, RESERVED, reserved, , 1)
+
+MESSAGE_CODEC_DEFINE(WifiConfig_WifiScanResultsSummaryResponse,
+                     WifiConfigureMessageProtocol_WifiScanResultsSummaryResponseStruct,
+                     WIFICONFIG_WIFI_SCAN_RESULTS_SUMMARY_RESPONSE_FIELDS)
+
+// Only the first resultCount results are sent; see WifiConfig_WifiScanResultsSize.
+#define WIFICONFIG_WIFI_SCAN_RESULTS_FIELDS(X, T) \
+    X(T, U8, firstIndex, , 1)                     \
+    X(T, U8, resultCount, , 1)                    \
+    X(T, U8, totalNetworkCount, , 1)              \
+    X(T, RESERVED, reserved, , 1)                 \
+    X(T, NESTED_ARRAY, results, WifiConfig_WifiScanResult, 1)
+
+MESSAGE_CODEC_DEFINE(WifiConfig_WifiScanResults,
+                     WifiConfigureMessageProtocol_WifiScanResultsRequestStruct,
+                     WIFICONFIG_WIFI_SCAN_RESULTS_FIELDS)
+
+/// <summary>
+///     Number of bytes of an encoded SetWiFiScanResults body which carries the given number of
+///     results, and which are sent.
+/// </summary>
+static inline size_t WifiConfig_WifiScanResultsSize(uint8_t resultCount)
+{
+    return WifiConfig_WifiScanResults_EncodedSize -
+           (WIFICONFIG_MAX_SCAN_RESULTS_PER_REQUEST - resultCount) *
+               WifiConfig_WifiScanResult_EncodedSize;
+}
@@ -3,6 +3,7 @@
 
 #pragma once
 #include <inttypes.h>
+#include "message_protocol_categories.h"
 
 /// <summary>Request ID for a Get New Wi-Fi Details request message.</summary>
 static const MessageProtocol_RequestId WifiConfigureMessageProtocol_GetNewWifiDetailsRequestId =
@@ -23,6 +24,10 @@ static const MessageProtocol_RequestId
 static const MessageProtocol_RequestId WifiConfigureMessageProtocol_SetNextWiFiScanResultRequestId =
     0x0005;
 
+/// <summary>Request ID for a Set Wi-Fi Scan Results request message.</summary>
+static const MessageProtocol_RequestId WifiConfigureMessageProtocol_SetWiFiScanResultsRequestId =
+    0x0006;
+
 /// <summary>Event ID for a New Wi-Fi Details Available event message.</summary>
 static const MessageProtocol_EventId WifiConfigureMessageProtocol_NewWiFiDetailsAvailableEventId =
     0x0001;
@@ -53,6 +58,19 @@ static const uint8_t WifiConfigureMessageProtocol_InternetConnected = 0x01 << 1;
 /// </summary>
 static const uint8_t WifiConfigureMessageProtocol_IpAddressAvailable = 0x01 << 2;
 
+/// <summary>
+///     A scan results summary response flag indicating that the companion app accepts
+///     <see cref="WifiConfigureMessageProtocol_SetWiFiScanResultsRequestId" /> requests.
+/// </summary>
+static const uint8_t WifiConfigureMessageProtocol_ScanResultsBulkSupported = 0x01 << 0;
+
+/// <summary>
+///     Maximum number of scan results in a
+///     <see cref="WifiConfigureMessageProtocol_SetWiFiScanResultsRequestId" /> request, so that
+///     the request fits in the largest request body of the message protocol.
+/// </summary>
+#define WIFICONFIG_MAX_SCAN_RESULTS_PER_REQUEST 6
+
 /// <summary>
 ///     Data structure for the body of a
 ///     <see cref="WifiConfigureMessageProtocol_GetNewWifiDetailsRequestId" /> response message.
@@ -154,3 +172,38 @@ typedef struct {
     /// <summary>The SSID for this network, as a fixed-length array of bytes.</summary>
     uint8_t ssid[32];
 } WifiConfigureMessageProtocol_WifiScanResultRequestStruct;
+
+/// <summary>
+///     Data structure for the body of a
+///     <see cref="WifiConfigureMessageProtocol_SetWifiScanResultsSummaryRequestId"/> response
+///     message. A companion app which does not know this structure sends an empty response, which
+///     is treated as all flags being clear.
+/// </summary>
+typedef struct {
+    /// <summary>
+    ///     Flags; <see cref="WifiConfigureMessageProtocol_ScanResultsBulkSupported" /> or 0.
+    /// </summary>
+    uint8_t flags;
+    /// <summary>Reserved; must all be 0.</summary>
+    uint8_t reserved[3];
+} WifiConfigureMessageProtocol_WifiScanResultsSummaryResponseStruct;
+
+/// <summary>
+///     Data structure for the body of a
+///     <see cref="WifiConfigureMessageProtocol_SetWiFiScanResultsRequestId"/> request message.
+///     This structure carries several consecutive networks found during a network scan; only the
+///     first resultCount entries of results are sent.
+/// </summary>
+typedef struct {
+    /// <summary>Index in the whole scan of the first network in this request.</summary>
+    uint8_t firstIndex;
+    /// <summary>Number of networks in this request.</summary>
+    uint8_t resultCount;
+    /// <summary>The number of networks found during the scan.</summary>
+    uint8_t totalNetworkCount;
+    /// <summary>Reserved; must be 0.</summary>
+    uint8_t reserved;
+    /// <summary>The networks.</summary>
+    WifiConfigureMessageProtocol_WifiScanResultRequestStruct
+        results[WIFICONFIG_MAX_SCAN_RESULTS_PER_REQUEST];
+} WifiConfigureMessageProtocol_WifiScanResultsRequestStruct;
@@ -0,0 +1,307 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <netinet/in.h>
+
+#include <applibs/log.h>
+
+#include "connector.h"
+#include "eventloop_timer_utilities.h"
+
+typedef struct {
+    int fd;
+    EventRegistration *registration;
+} Attempt;
+
+// Resolved addresses of the last server which was connected to.
+static struct {
+    char host[CONNECTOR_MAX_HOST_LENGTH + 1];
+    uint16_t port;
+    size_t count;
+    struct sockaddr_in addresses[CONNECTOR_MAX_ADDRESSES];
+    time_t expiry; // CLOCK_MONOTONIC seconds after which the addresses are resolved again.
+} dnsCache;
+
+static EventLoop *eventLoop = NULL;
+static EventLoopTimer *attemptTimer = NULL;
+static EventLoopTimer *timeoutTimer = NULL;
+
+static bool connecting = false;
+static Connector_ConnectedHandler connectedHandler = NULL;
+static void *connectedHandlerContext = NULL;
+static Attempt attempts[CONNECTOR_MAX_ADDRESSES];
+static size_t nextAddress = 0;
+
+static time_t MonotonicSeconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec;
+}
+
+static int Resolve(const char *host, uint16_t port)
+{
+    if (dnsCache.count > 0 && dnsCache.port == port && strcmp(dnsCache.host, host) == 0 &&
+        MonotonicSeconds() < dnsCache.expiry) {
+        return 0;
+    }
+
+    if (strnlen(host, CONNECTOR_MAX_HOST_LENGTH + 1) > CONNECTOR_MAX_HOST_LENGTH) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    struct addrinfo hints = {.ai_family = AF_INET, .ai_socktype = SOCK_STREAM};
+    struct addrinfo *results;
+    int r = getaddrinfo(host, NULL, &hints, &results);
+    if (r != 0) {
+        Log_Debug("ERROR: Could not resolve %s: %s (%d)\n", host, gai_strerror(r), r);
+        errno = EHOSTUNREACH;
+        return -1;
+    }
+
+    dnsCache.count = 0;
+    for (struct addrinfo *result = results;
+         result != NULL && dnsCache.count < CONNECTOR_MAX_ADDRESSES; result = result->ai_next) {
+        struct sockaddr_in address = *(const struct sockaddr_in *)result->ai_addr;
+        address.sin_port = htons(port);
+
+        bool duplicate = false;
+        for (size_t i = 0; i < dnsCache.count; ++i) {
+            duplicate |= dnsCache.addresses[i].sin_addr.s_addr == address.sin_addr.s_addr;
+        }
+        if (!duplicate) {
+            dnsCache.addresses[dnsCache.count++] = address;
+        }
+    }
+    freeaddrinfo(results);
+
+    if (dnsCache.count == 0) {
+        errno = EHOSTUNREACH;
+        return -1;
+    }
+
+    strcpy(dnsCache.host, host);
+    dnsCache.port = port;
+    dnsCache.expiry = MonotonicSeconds() + CONNECTOR_DNS_TTL_SECONDS;
+    return 0;
+}
+
+static void CloseAttempt(Attempt *attempt)
+{
+    if (attempt->registration != NULL) {
+        EventLoop_UnregisterIo(eventLoop, attempt->registration);
+        attempt->registration = NULL;
+    }
+    if (attempt->fd != -1) {
+        close(attempt->fd);
+        attempt->fd = -1;
+    }
+}
+
+static bool HasPendingAttempts(void)
+{
+    for (size_t i = 0; i < CONNECTOR_MAX_ADDRESSES; ++i) {
+        if (attempts[i].fd != -1) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void StopConnecting(void)
+{
+    for (size_t i = 0; i < CONNECTOR_MAX_ADDRESSES; ++i) {
+        CloseAttempt(&attempts[i]);
+    }
+    DisarmEventLoopTimer(attemptTimer);
+    DisarmEventLoopTimer(timeoutTimer);
+    connecting = false;
+}
+
+static void Succeed(Attempt *attempt)
+{
+    size_t index = (size_t)(attempt - attempts);
+    int fd = attempt->fd;
+    EventLoop_UnregisterIo(eventLoop, attempt->registration);
+    attempt->registration = NULL;
+    attempt->fd = -1;
+    StopConnecting();
+
+    // Try the address which connected first next time.
+    struct sockaddr_in address = dnsCache.addresses[index];
+    memmove(&dnsCache.addresses[1], &dnsCache.addresses[0], index * sizeof(address));
+    dnsCache.addresses[0] = address;
+
+    connectedHandler(fd, connectedHandlerContext);
+}
+
+static void Fail(int error)
+{
+    StopConnecting();
+    dnsCache.count = 0;
+    errno = error;
+    connectedHandler(-1, connectedHandlerContext);
+}
+
+static void AttemptEventHandler(EventLoop *el, int fd, EventLoop_IoEvents events, void *context);
+
+// Starts an attempt to connect to the next address which has not been tried. Returns whether one
+// was started.
+static bool StartNextAttempt(void)
+{
+    while (nextAddress < dnsCache.count) {
+        size_t index = nextAddress++;
+        Attempt *attempt = &attempts[index];
+
+        attempt->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        if (attempt->fd == -1) {
+            Log_Debug("ERROR: Could not create socket: %s (%d)\n", strerror(errno), errno);
+            continue;
+        }
+
+        // The socket becomes writable when the connection completes, even if connect completed
+        // immediately, so the outcome is always handled from the event loop.
+        int r = connect(attempt->fd, (const struct sockaddr *)&dnsCache.addresses[index],
+                        sizeof(dnsCache.addresses[index]));
+        if (r != 0 && errno != EINPROGRESS) {
+            Log_Debug("ERROR: Could not connect: %s (%d)\n", strerror(errno), errno);
+            CloseAttempt(attempt);
+            continue;
+        }
+
+        attempt->registration = EventLoop_RegisterIo(eventLoop, attempt->fd, EventLoop_Output,
+                                                     AttemptEventHandler, attempt);
+        if (attempt->registration == NULL) {
+            Log_Debug("ERROR: Could not register socket: %s (%d)\n", strerror(errno), errno);
+            CloseAttempt(attempt);
+            continue;
+        }
+
+        if (nextAddress < dnsCache.count) {
+            static const struct timespec attemptDelay = {
+                .tv_sec = CONNECTOR_ATTEMPT_DELAY_MS / 1000,
+                .tv_nsec = (CONNECTOR_ATTEMPT_DELAY_MS % 1000) * 1000000};
+            SetEventLoopTimerOneShot(attemptTimer, &attemptDelay);
+        }
+        return true;
+    }
+
+    return false;
+}
+
+static void AttemptEventHandler(EventLoop *el, int fd, EventLoop_IoEvents events, void *context)
+{
+    Attempt *attempt = context;
+
+    int error;
+    socklen_t errorSize = sizeof(error);
+    int r = getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &errorSize);
+    if (r == 0 && error == 0) {
+        Succeed(attempt);
+        return;
+    }
+
+    if (r != 0) {
+        error = errno;
+    }
+    Log_Debug("INFO: Connection attempt failed: %s (%d)\n", strerror(error), error);
+    CloseAttempt(attempt);
+
+    // Try the next address now rather than waiting for the delay.
+    if (!StartNextAttempt() && !HasPendingAttempts()) {
+        Fail(error);
+    }
+}
+
+static void AttemptTimerEventHandler(EventLoopTimer *timer)
+{
+    if (ConsumeEventLoopTimerEvent(timer) != 0) {
+        return;
+    }
+
+    StartNextAttempt();
+}
+
+static void TimeoutTimerEventHandler(EventLoopTimer *timer)
+{
+    if (ConsumeEventLoopTimerEvent(timer) != 0) {
+        return;
+    }
+
+    Log_Debug("ERROR: Timed out connecting to %s.\n", dnsCache.host);
+    Fail(ETIMEDOUT);
+}
+
+int Connector_Init(EventLoop *el)
+{
+    eventLoop = el;
+    for (size_t i = 0; i < CONNECTOR_MAX_ADDRESSES; ++i) {
+        attempts[i].fd = -1;
+        attempts[i].registration = NULL;
+    }
+
+    attemptTimer = CreateEventLoopDisarmedTimer(eventLoop, AttemptTimerEventHandler);
+    timeoutTimer = CreateEventLoopDisarmedTimer(eventLoop, TimeoutTimerEventHandler);
+    if (attemptTimer == NULL || timeoutTimer == NULL) {
+        return -1;
+    }
+
+    return 0;
+}
+
+int Connector_Start(const char *host, uint16_t port, Connector_ConnectedHandler handler,
+                    void *context)
+{
+    if (connecting) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    if (Resolve(host, port) != 0) {
+        return -1;
+    }
+
+    connectedHandler = handler;
+    connectedHandlerContext = context;
+    nextAddress = 0;
+    if (!StartNextAttempt()) {
+        int error = errno;
+        StopConnecting();
+        errno = error;
+        return -1;
+    }
+
+    connecting = true;
+    static const struct timespec timeout = {.tv_sec = CONNECTOR_TIMEOUT_SECONDS, .tv_nsec = 0};
+    SetEventLoopTimerOneShot(timeoutTimer, &timeout);
+    return 0;
+}
+
+bool Connector_IsConnecting(void)
+{
+    return connecting;
+}
+
+void Connector_Cancel(void)
+{
+    if (connecting) {
+        StopConnecting();
+    }
+}
+
+void Connector_Cleanup(void)
+{
+    Connector_Cancel();
+    DisposeEventLoopTimer(attemptTimer);
+    attemptTimer = NULL;
+    DisposeEventLoopTimer(timeoutTimer);
+    timeoutTimer = NULL;
+}
@@ -0,0 +1,94 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <applibs/eventloop.h>
+
+// The connector opens a TCP connection to a server which may resolve to several addresses. Rather
+// than waiting for the connection to one address to time out before trying the next, it starts a
+// connection to the first address, then another to the next address every
+// CONNECTOR_ATTEMPT_DELAY_MS while none has completed, or as soon as an attempt fails, and keeps
+// the first connection which completes, as Happy Eyeballs (RFC 8305) does. The address which
+// connected is tried first next time.
+//
+// The addresses of the server are cached for CONNECTOR_DNS_TTL_SECONDS, so that reconnecting to it
+// does not wait for name resolution. getaddrinfo does not report the TTLs of the records which it
+// resolves, so a fixed lifetime is used; the cache is also cleared when no address can be
+// connected to, so that a server which has moved is resolved again.
+//
+// Only one connection can be made at a time. The connector is not thread-safe; it should only be
+// used from the event loop's thread.
+
+/// <summary>
+///     Maximum number of addresses of a server which are tried.
+/// </summary>
+#define CONNECTOR_MAX_ADDRESSES 4
+
+/// <summary>
+///     Delay after starting a connection attempt before the next one is started, in milliseconds.
+/// </summary>
+#define CONNECTOR_ATTEMPT_DELAY_MS 250
+
+/// <summary>
+///     Time after the first attempt was started by which a connection must have completed, in
+///     seconds.
+/// </summary>
+#define CONNECTOR_TIMEOUT_SECONDS 30
+
+/// <summary>
+///     How long the resolved addresses of a server are used, in seconds.
+/// </summary>
+#define CONNECTOR_DNS_TTL_SECONDS 300
+
+/// <summary>
+///     Maximum length of a server's host name, excluding the null terminator.
+/// </summary>
+#define CONNECTOR_MAX_HOST_LENGTH 127
+
+/// <summary>
+///     Invoked when a connection has completed, or when every attempt has failed.
+/// </summary>
+/// <param name="fd">The connected non-blocking socket, which the handler owns, or -1 if no
+/// connection could be made, in which case errno is set.</param>
+/// <param name="context">Context which was supplied to Connector_Start.</param>
+typedef void (*Connector_ConnectedHandler)(int fd, void *context);
+
+/// <summary>
+///     Initializes the connector.
+/// </summary>
+/// <param name="eventLoop">Event loop which is used to wait for the connections.</param>
+/// <returns>0 on success, or -1 on failure, in which case errno is set.</returns>
+int Connector_Init(EventLoop *eventLoop);
+
+/// <summary>
+///     Starts connecting to a server. The handler is invoked from the event loop, after this
+///     function has returned.
+/// </summary>
+/// <param name="host">The host name of the server.</param>
+/// <param name="port">The TCP port of the server.</param>
+/// <param name="handler">Function which receives the connection.</param>
+/// <param name="context">Context which is passed to the handler.</param>
+/// <returns>0 on success, or -1 if the connection could not be started, in which case errno is
+/// set.</returns>
+int Connector_Start(const char *host, uint16_t port, Connector_ConnectedHandler handler,
+                    void *context);
+
+/// <summary>
+///     Whether a connection has been started and its handler has not yet been invoked.
+/// </summary>
+bool Connector_IsConnecting(void);
+
+/// <summary>
+///     Stops connecting, if a connection has been started, without invoking its handler.
+/// </summary>
+void Connector_Cancel(void);
+
+/// <summary>
+///     Cancels any connection, and frees the connector's resources. This should be called before
+///     the event loop is closed.
+/// </summary>
+void Connector_Cleanup(void);
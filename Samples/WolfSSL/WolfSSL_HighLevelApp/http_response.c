@@ -0,0 +1,279 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "http_response.h"
+
+static void ResetLine(HttpResponse_Parser *parser)
+{
+    parser->lineLength = 0;
+    parser->lineTruncated = false;
+}
+
+// Prepares the parser for the next response on the connection.
+static void ResetResponse(HttpResponse_Parser *parser)
+{
+    parser->receivingBody = false;
+    parser->statusLineReceived = false;
+    ResetLine(parser);
+}
+
+static void FinishResponse(HttpResponse_Parser *parser)
+{
+    int status = parser->status;
+    bool keepAlive = parser->keepAlive;
+    ResetResponse(parser);
+    parser->handler(status, keepAlive, parser->context);
+}
+
+// Returns whether a comma-separated header value contains a token, ignoring case.
+static bool HeaderValueContains(const char *value, const char *token)
+{
+    size_t tokenLength = strlen(token);
+    for (const char *c = value; *c != '\0'; ++c) {
+        if (strncasecmp(c, token, tokenLength) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Handles a status or header line, and returns false if the response is malformed.
+static bool HandleHeaderLine(HttpResponse_Parser *parser)
+{
+    const char *line = parser->line;
+
+    if (!parser->statusLineReceived) {
+        // "HTTP/1.1 200 OK"
+        if (parser->lineTruncated || strncmp(line, "HTTP/1.", 7) != 0 || line[8] != ' ') {
+            return false;
+        }
+        char *end;
+        long status = strtol(line + 9, &end, 10);
+        if (end != line + 12 || status < 100 || status > 999) {
+            return false;
+        }
+        parser->statusLineReceived = true;
+        parser->status = (int)status;
+        // HTTP/1.0 servers close the connection unless they are asked not to.
+        parser->keepAlive = line[7] != '0';
+        parser->chunked = false;
+        parser->hasContentLength = false;
+        return true;
+    }
+
+    if (parser->lineTruncated) {
+        return true;
+    }
+
+    static const char contentLength[] = "Content-Length:";
+    static const char transferEncoding[] = "Transfer-Encoding:";
+    static const char connectionHeader[] = "Connection:";
+    if (strncasecmp(line, contentLength, sizeof(contentLength) - 1) == 0) {
+        char *end;
+        parser->contentLength = strtoull(line + sizeof(contentLength) - 1, &end, 10);
+        if (end == line + sizeof(contentLength) - 1) {
+            return false;
+        }
+        parser->hasContentLength = true;
+    } else if (strncasecmp(line, transferEncoding, sizeof(transferEncoding) - 1) == 0) {
+        parser->chunked = HeaderValueContains(line, "chunked");
+    } else if (strncasecmp(line, connectionHeader, sizeof(connectionHeader) - 1) == 0) {
+        if (HeaderValueContains(line, "close")) {
+            parser->keepAlive = false;
+        } else if (HeaderValueContains(line, "keep-alive")) {
+            parser->keepAlive = true;
+        }
+    }
+    return true;
+}
+
+// Decides how the body is delimited once the headers have been received.
+static void StartBody(HttpResponse_Parser *parser)
+{
+    if (parser->status == 204 || parser->status == 304) {
+        parser->framing = HttpResponse_Framing_None;
+    } else if (parser->chunked) {
+        // A chunked encoding takes precedence over a Content-Length.
+        parser->framing = HttpResponse_Framing_Chunked;
+        parser->chunkState = HttpResponse_Chunk_Size;
+    } else if (parser->hasContentLength) {
+        parser->framing =
+            (parser->contentLength > 0) ? HttpResponse_Framing_Length : HttpResponse_Framing_None;
+        parser->remaining = parser->contentLength;
+    } else {
+        // The end of the body can only be told from the server closing the connection.
+        parser->framing = HttpResponse_Framing_UntilClose;
+        parser->keepAlive = false;
+    }
+
+    parser->receivingBody = true;
+}
+
+// Takes bytes from the data into the parser's line, and returns true once a whole line has been
+// taken. A line which does not fit is truncated.
+static bool TakeLine(HttpResponse_Parser *parser, const uint8_t **data, size_t *size)
+{
+    while (*size > 0) {
+        char c = (char)**data;
+        ++*data;
+        --*size;
+        if (c == '\n') {
+            if (parser->lineLength > 0 && parser->line[parser->lineLength - 1] == '\r') {
+                --parser->lineLength;
+            }
+            parser->line[parser->lineLength] = '\0';
+            return true;
+        }
+        if (parser->lineLength < HTTP_RESPONSE_MAX_LINE_LENGTH) {
+            parser->line[parser->lineLength++] = c;
+        } else {
+            parser->lineTruncated = true;
+        }
+    }
+    return false;
+}
+
+// Skips up to size bytes of the body or of the current chunk, and returns how many were skipped.
+static size_t SkipBody(HttpResponse_Parser *parser, size_t size)
+{
+    size_t take = (parser->remaining < size) ? (size_t)parser->remaining : size;
+    parser->remaining -= take;
+    return take;
+}
+
+// Parses a line of a chunked body, and returns false if it is malformed.
+static bool HandleChunkLine(HttpResponse_Parser *parser)
+{
+    switch (parser->chunkState) {
+    case HttpResponse_Chunk_Size: {
+        // The size is in hexadecimal, and may be followed by extensions.
+        char *end;
+        parser->remaining = strtoull(parser->line, &end, 16);
+        if (end == parser->line) {
+            return false;
+        }
+        parser->chunkState =
+            (parser->remaining > 0) ? HttpResponse_Chunk_Data : HttpResponse_Chunk_Trailer;
+        break;
+    }
+
+    case HttpResponse_Chunk_DataEnd:
+        parser->chunkState = HttpResponse_Chunk_Size;
+        break;
+
+    case HttpResponse_Chunk_Trailer:
+        // The empty line after the trailer ends the body.
+        if (parser->lineLength == 0 && !parser->lineTruncated) {
+            FinishResponse(parser);
+            return true;
+        }
+        break;
+
+    case HttpResponse_Chunk_Data:
+        break;
+    }
+
+    ResetLine(parser);
+    return true;
+}
+
+void HttpResponse_Init(HttpResponse_Parser *parser, HttpResponse_CompleteHandler handler,
+                       void *context)
+{
+    memset(parser, 0, sizeof(*parser));
+    parser->handler = handler;
+    parser->context = context;
+}
+
+int HttpResponse_Feed(HttpResponse_Parser *parser, const uint8_t *data, size_t size)
+{
+    while (size > 0) {
+        if (!parser->receivingBody) {
+            if (!TakeLine(parser, &data, &size)) {
+                return 0;
+            }
+
+            if (parser->lineLength > 0 || parser->lineTruncated) {
+                bool valid = HandleHeaderLine(parser);
+                ResetLine(parser);
+                if (!valid) {
+                    return -1;
+                }
+                continue;
+            }
+
+            // An empty line ends the headers, but is ignored before a status line.
+            ResetLine(parser);
+            if (!parser->statusLineReceived) {
+                continue;
+            }
+
+            // An interim response is followed by another response.
+            if (parser->status < 200) {
+                parser->statusLineReceived = false;
+                continue;
+            }
+
+            StartBody(parser);
+            if (parser->framing == HttpResponse_Framing_None) {
+                FinishResponse(parser);
+            }
+            continue;
+        }
+
+        switch (parser->framing) {
+        case HttpResponse_Framing_Length: {
+            size_t skipped = SkipBody(parser, size);
+            data += skipped;
+            size -= skipped;
+            if (parser->remaining == 0) {
+                FinishResponse(parser);
+            }
+            break;
+        }
+
+        case HttpResponse_Framing_Chunked:
+            if (parser->chunkState == HttpResponse_Chunk_Data) {
+                size_t skipped = SkipBody(parser, size);
+                data += skipped;
+                size -= skipped;
+                if (parser->remaining == 0) {
+                    parser->chunkState = HttpResponse_Chunk_DataEnd;
+                }
+                break;
+            }
+
+            if (!TakeLine(parser, &data, &size)) {
+                return 0;
+            }
+            if (!HandleChunkLine(parser)) {
+                return -1;
+            }
+            break;
+
+        case HttpResponse_Framing_UntilClose:
+            return 0;
+
+        case HttpResponse_Framing_None:
+            FinishResponse(parser);
+            break;
+        }
+    }
+
+    return 0;
+}
+
+bool HttpResponse_Close(HttpResponse_Parser *parser)
+{
+    if (parser->receivingBody && parser->framing == HttpResponse_Framing_UntilClose) {
+        FinishResponse(parser);
+        return true;
+    }
+
+    return !parser->receivingBody && !parser->statusLineReceived && parser->lineLength == 0 &&
+           !parser->lineTruncated;
+}
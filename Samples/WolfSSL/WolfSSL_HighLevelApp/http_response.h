@@ -0,0 +1,101 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// The response parser finds where each HTTP/1.1 response ends in the data which a server sends on
+// a persistent connection, so that several requests can be sent over one TLS session, and their
+// responses, which arrive back to back in the order of the requests, can be told apart. The end of
+// a body is found from its Content-Length header or its chunked encoding; a response which has
+// neither ends when the server closes the connection. Interim (1xx) responses are skipped, and
+// 204 and 304 responses have no body.
+//
+// The parser only reads the framing of the responses; the data is passed on to the application
+// unchanged. It assumes that every request was a GET, since the response to a HEAD request has
+// headers which describe a body which is not sent.
+
+/// <summary>
+///     Longest status or header line which is parsed, excluding the line ending. The rest of a
+///     longer line is ignored.
+/// </summary>
+#define HTTP_RESPONSE_MAX_LINE_LENGTH 255
+
+/// <summary>
+///     Invoked when a response has been received in full.
+/// </summary>
+/// <param name="status">The status code of the response.</param>
+/// <param name="keepAlive">Whether the server keeps the connection open after the response, for
+/// the responses to later requests.</param>
+/// <param name="context">Context which was supplied to HttpResponse_Init.</param>
+typedef void (*HttpResponse_CompleteHandler)(int status, bool keepAlive, void *context);
+
+/// <summary>
+///     State of a parser. The client should not directly modify member variables.
+/// </summary>
+typedef struct {
+    HttpResponse_CompleteHandler handler;
+    void *context;
+
+    /// <summary>Whether the headers of the current response have been received.</summary>
+    bool receivingBody;
+    bool statusLineReceived;
+    int status;
+    bool keepAlive;
+    bool chunked;
+    bool hasContentLength;
+    uint64_t contentLength;
+
+    /// <summary>How the end of the body is found.</summary>
+    enum {
+        HttpResponse_Framing_None,
+        HttpResponse_Framing_Length,
+        HttpResponse_Framing_Chunked,
+        HttpResponse_Framing_UntilClose
+    } framing;
+    /// <summary>Which part of a chunked body is expected next.</summary>
+    enum {
+        HttpResponse_Chunk_Size,
+        HttpResponse_Chunk_Data,
+        HttpResponse_Chunk_DataEnd,
+        HttpResponse_Chunk_Trailer
+    } chunkState;
+    /// <summary>Bytes of the body, or of the current chunk, which are still to arrive.</summary>
+    uint64_t remaining;
+
+    char line[HTTP_RESPONSE_MAX_LINE_LENGTH + 1];
+    size_t lineLength;
+    bool lineTruncated;
+} HttpResponse_Parser;
+
+/// <summary>
+///     Initializes a parser, which expects the start of a response.
+/// </summary>
+/// <param name="parser">Parser to initialize.</param>
+/// <param name="handler">Function which is called as each response completes.</param>
+/// <param name="context">Context which is passed to the handler.</param>
+void HttpResponse_Init(HttpResponse_Parser *parser, HttpResponse_CompleteHandler handler,
+                       void *context);
+
+/// <summary>
+///     Parses data which has been received from the server, which may complete any number of
+///     responses, and calls the handler for each of them before it returns.
+/// </summary>
+/// <param name="parser">Parser initialized with HttpResponse_Init.</param>
+/// <param name="data">The received data.</param>
+/// <param name="size">The number of bytes of data.</param>
+/// <returns>0 on success; -1 if the data is not a valid response, after which the parser should
+/// not be used.</returns>
+int HttpResponse_Feed(HttpResponse_Parser *parser, const uint8_t *data, size_t size);
+
+/// <summary>
+///     Tells the parser that the server has closed the connection, which completes a response
+///     whose body is delimited by the close, and calls the handler for it.
+/// </summary>
+/// <param name="parser">Parser initialized with HttpResponse_Init.</param>
+/// <returns>true if the connection closed between responses, or completed one; false if a
+/// response was cut short.</returns>
+bool HttpResponse_Close(HttpResponse_Parser *parser);
@@ -1,7 +1,10 @@
 ﻿/* Copyright (c) Microsoft Corporation. All rights reserved.
    Licensed under the MIT License. */
 
-// This sample uses the wolfSSL APIs to read a web page over HTTPS.
+// This sample uses the wolfSSL APIs to read web pages over HTTPS. The requests for all the pages
+// are pipelined over one persistent connection. The TLS session is stored in mutable storage, so
+// that the next time the application runs, it can resume the session instead of performing a full
+// handshake.
 //
 // It uses the following Azure Sphere application libraries:
 // - log (messages shown in Visual Studio's Device Output window during debugging)
@@ -11,9 +14,6 @@
 // - wolfssl (handles TLS handshake)
 
 #include <unistd.h>
-#include <sys/socket.h>
-#include <netdb.h>
-#include <netinet/in.h>
 
 #include <stdbool.h>
 #include <signal.h>
@@ -21,6 +21,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <time.h>
 
 #include <wolfssl/ssl.h>
 
@@ -29,7 +30,13 @@
 #include <applibs/storage.h>
 #include <applibs/eventloop.h>
 
+#include "connector.h"
 #include "eventloop_timer_utilities.h"
+#include "http_response.h"
+#include "image_asset.h"
+#include "network_state.h"
+#include "session_cache.h"
+#include "tls_profile.h"
 
 /// <summary>
 ///     Exit codes for this application. These are used for the
@@ -41,47 +48,49 @@ typedef enum {
 
     ExitCode_IsConnToInternet_ConnStatus = 1,
 
-    ExitCode_InetCheckHandler_Consume = 2,
-
-    ExitCode_ConnectRaw_GetHostByName = 3,
-    ExitCode_ConnectRaw_Socket = 4,
+    ExitCode_ConnectRaw_Start = 3,
     ExitCode_ConnectRaw_EventReg = 5,
-    ExitCode_ConnectRaw_Connect = 6,
 
     ExitCode_HandleConnection_Failed = 7,
-    ExitCode_HandleConnection_Init = 8,
-    ExitCode_HandleConnection_Method = 9,
-    ExitCode_HandleConnection_Context = 10,
-    ExitCode_HandleConnection_CertPath = 11,
-    ExitCode_HandleConnection_VerifyLocations = 12,
+    ExitCode_InitTls_Init = 8,
+    ExitCode_InitTls_Method = 9,
+    ExitCode_InitTls_Context = 10,
+    ExitCode_InitTls_CertPath = 11,
+    ExitCode_InitTls_VerifyLocations = 12,
     ExitCode_HandleConnection_Session = 13,
     ExitCode_HandleConnection_SetFd = 14,
 
     ExitCode_SslHandshake_ModifyEvents = 15,
     ExitCode_SslHandshake_Fail = 16,
 
-    ExitCode_WriteData_ModifyEventsNone = 17,
     ExitCode_WriteData_ModifyEventsOutput = 18,
     ExitCode_WriteData_Write = 19,
 
-    ExitCode_ReadData_ModifyEventsNone = 20,
     ExitCode_ReadData_Read = 21,
     ExitCode_ReadData_Finished = 22,
     ExitCode_ReadData_ModifyEventsInput = 23,
 
     ExitCode_Init_EventLoop = 24,
-    ExitCode_Init_InternetCheckTimer = 25,
+    ExitCode_Init_NetworkState = 25,
+
+    ExitCode_Main_EventLoopFail = 26,
+
+    ExitCode_Benchmark_Finished = 27,
 
-    ExitCode_Main_EventLoopFail = 26
+    ExitCode_Init_Connector = 28,
+
+    ExitCode_ReadData_Response = 29,
+    ExitCode_ReadData_Closed = 30,
+    ExitCode_WriteData_Request = 31
 } ExitCode;
 
 static volatile ExitCode exitCode = ExitCode_Success;
 _Static_assert(sizeof(ExitCode) <= sizeof(sig_atomic_t), "ExitCode is larger than sig_atomic_t.");
 
-// Notifications for internet check timer and IO events.
+// Notifications for network state changes and IO events.
 static EventLoop *eventLoop = NULL;
-static EventLoopTimer *internetCheckTimer = NULL;
 static EventRegistration *sockReg = NULL;
+static EventLoop_IoEvents sockEvents = EventLoop_None;
 
 // Function to run the next time an IO event occurs.
 static void (*nextHandler)(void);
@@ -89,92 +98,114 @@ static void (*nextHandler)(void);
 // Interface which is used to access the internet.
 static const char networkInterface[] = "wlan0";
 
-// Server which hosts the required web page. This is a macro rather than a const char*
-// to simplify constructing the HTTP/1.1 request, which must have a Connection header.
-// The host name must appear in the AllowedConnections capability in app_manifest.json.
+// Server which hosts the required web pages. The host name must appear in the AllowedConnections
+// capability in app_manifest.json.
 #define SERVER_NAME "example.com"
 static const uint16_t PORT_NUM = 443;
 static const char certPath[] = "certs/DigiCertGlobalRootCA.pem";
 
+// Pages which are downloaded. The requests for all of them are written at once, and the server
+// sends the responses back to back, in the same order, over the same connection, so each page
+// after the first costs no more than the time to transfer it.
+static const char *const requestPaths[] = {"/", "/index.html"};
+#define REQUEST_COUNT (sizeof(requestPaths) / sizeof(requestPaths[0]))
+
+// Index in requestPaths of the first request which was sent on the current connection, and the
+// number of responses which have been received on all connections. If the server closes the
+// connection before it has answered every request, the rest are sent again on a new connection.
+static size_t firstRequestOnConnection = 0;
+static size_t responsesReceived = 0;
+static HttpResponse_Parser responseParser;
+static struct timespec requestsWrittenTime;
+
 static bool wolfSslInitialized = false;
 static WOLFSSL_CTX *wolfSslCtx = NULL;
 static WOLFSSL *wolfSslSession = NULL;
 static int sockFd = -1;
 
+// Index in TlsProfiles of the cipher suite and key exchange group preference which is offered to
+// the server. See tls_profile.c for the profiles, and build with -DTLS_BENCHMARK=ON to measure the
+// handshake time of each of them with the server.
+static size_t tlsProfileIndex = 0;
+static struct timespec handshakeStartTime;
+
+#ifdef TLS_BENCHMARK
+// Number of full handshakes which are timed for each profile.
+#define BENCHMARK_HANDSHAKES_PER_PROFILE 5
+
+static unsigned int benchmarkHandshakes = 0;
+static unsigned int benchmarkFailures = 0;
+static double benchmarkTotalMs = 0.0;
+static double benchmarkMinMs = 0.0;
+static double benchmarkMaxMs = 0.0;
+#endif
+
+// Each request is under 100 bytes, so this holds the requests for all the pages.
+static char requestBuffer[1024];
 static const uint8_t *writePayload = NULL;
 static int writePayloadLen = 0;
 static int totalBytesWritten = 0;
-static uint8_t readPayload[16];
 static int totalBytesRead = 0;
 
-static bool IsNetworkInterfaceConnectedToInternet(void);
-static void InternetCheckTimerEventHandler(EventLoopTimer *timer);
+// Largest plaintext which a TLS record can carry. Reading into a buffer of this size lets each
+// wolfSSL_read return a whole record.
+#define TLS_MAX_RECORD_SIZE 16384
+static uint8_t readPayload[TLS_MAX_RECORD_SIZE];
+
+/// <summary>
+///     Handles data which has been read from the server.
+/// </summary>
+/// <param name="data">The data, which is only valid until the consumer returns.</param>
+/// <param name="length">The number of bytes of data.</param>
+typedef void (*DataConsumer)(const uint8_t *data, size_t length);
+
+static void PrintData(const uint8_t *data, size_t length);
+
+// Function which receives the response from the server.
+static DataConsumer dataConsumer = PrintData;
+
+static void NetworkStateChangedHandler(Networking_InterfaceConnectionStatus status, void *context);
+static void NetworkStateErrorHandler(void *context);
 static void HandleSockEvent(EventLoop *el, int fd, EventLoop_IoEvents events, void *context);
+static int SetSockEvents(EventLoop_IoEvents events);
+static ExitCode InitializeTls(void);
 static ExitCode ConnectRawSocketToServer(void);
-static void HandleConnection(void);
+static void HandleConnection(int fd, void *context);
 static void HandleTlsHandshake(void);
+static int BuildRequests(void);
 static void WriteData(void);
 static void ReadData(void);
+static void HandleResponseComplete(int status, bool keepAlive, void *context);
+static void HandlePeerClosed(void);
+static void CloseConnection(void);
+#ifdef TLS_BENCHMARK
+static void EndBenchmarkHandshake(bool succeeded, double handshakeMs);
+#endif
 static ExitCode InitializeResources(void);
 static void FreeResources(void);
 
 /// <summary>
-///     Checks whether the interface is connected to the internet.
-///     If a fatal error occurs, sets exitCode and returns false.
+///     Called when the connection status of the interface changes. The download starts the first
+///     time that the interface is connected to the internet.
 /// </summary>
-/// <returns>true if connected to the internet; false otherwise.</returns>
-static bool IsNetworkInterfaceConnectedToInternet(void)
+static void NetworkStateChangedHandler(Networking_InterfaceConnectionStatus status, void *context)
 {
-    Networking_InterfaceConnectionStatus status;
-    if (Networking_GetInterfaceConnectionStatus(networkInterface, &status) != 0) {
-        // EAGAIN means the network stack isn't ready so try again later...
-        if (errno == EAGAIN) {
-            Log_Debug("ERROR: Networking_GetInterfaceConnectionStatus: %d (%s)\n", errno,
-                      strerror(errno));
-        }
-        // ...any other code is a fatal error.
-        else {
-            Log_Debug(
-                "WARNING: Not doing download because the networking stack isn't ready yet.\n");
-            exitCode = ExitCode_IsConnToInternet_ConnStatus;
-        }
-        return false;
-    }
-
-    // If network stack is ready but not currently connected to internet, try again later.
     if ((status & Networking_InterfaceConnectionStatus_ConnectedToInternet) == 0) {
         Log_Debug("WARNING: Not doing download because there is no internet connectivity.\n");
-        return false;
+        return;
     }
 
-    // Networking stack is up, and connected to internet.
-    return true;
+    if (sockFd == -1 && !Connector_IsConnecting()) {
+        exitCode = ConnectRawSocketToServer();
+    }
 }
 
 /// <summary>
-///     <para>
-///         This handler is called periodically when the program starts
-///         to check whether connected to the internet. Once connected,
-///         the timer is disarmed.  If a fatal error occurs, sets exitCode
-///         to the appropriate value.
-///     </para>
-///     <para>
-///         See <see cref="EventLoopTimerHandler" /> for more information
-///         and a description of the argument.
-///     </para>
+///     Called when the connection status of the interface cannot be read.
 /// </summary>
-static void InternetCheckTimerEventHandler(EventLoopTimer *timer)
+static void NetworkStateErrorHandler(void *context)
 {
-    if (ConsumeEventLoopTimerEvent(timer) != 0) {
-        exitCode = ExitCode_InetCheckHandler_Consume;
-        return;
-    }
-
-    bool internetReady = IsNetworkInterfaceConnectedToInternet();
-    if (internetReady) {
-        DisarmEventLoopTimer(timer);
-        exitCode = ConnectRawSocketToServer();
-    }
+    exitCode = ExitCode_IsConnToInternet_ConnStatus;
 }
 
 /// <summary>
@@ -192,44 +223,109 @@ static void HandleSockEvent(EventLoop *el, int fd, EventLoop_IoEvents events, vo
 }
 
 /// <summary>
-///     <para>
-///         Open an AF_INET socket and starts an asynchronous connection
-///         to the server's HTTPS port.
-///     </para>
-///     <para>
-///         <see cref="HandleConnection" /> is called when the connection completes,
-///         succesfully or otherwise.
-///     </para>
+///     Changes the events for which the event loop calls <see cref="HandleSockEvent" />, if they
+///     are not already the requested events, to avoid a system call each time a handler runs.
+/// </summary>
+/// <param name="events">The events to wait for.</param>
+/// <returns>0 on success; -1 on failure, in which case errno is set.</returns>
+static int SetSockEvents(EventLoop_IoEvents events)
+{
+    if (events == sockEvents) {
+        return 0;
+    }
+
+    int r = EventLoop_ModifyIoEvents(eventLoop, sockReg, events);
+    if (r == 0) {
+        sockEvents = events;
+    }
+    return r;
+}
+
+/// <summary>
+///     Writes data which has been read from the server to the debug log.
+/// </summary>
+static void PrintData(const uint8_t *data, size_t length)
+{
+    Log_Debug("%.*s", (int)length, data);
+}
+
+/// <summary>
+///     Initialize wolfSSL and create the client context, which is used for every connection, and
+///     load the root certificate which is used to validate the server into it.
 /// </summary>
 /// <returns>ExitCode_Success on success; another ExitCode on failure.</returns>
-static ExitCode ConnectRawSocketToServer(void)
+static ExitCode InitializeTls(void)
 {
-    struct hostent *hent = gethostbyname(SERVER_NAME);
-    if (hent == NULL) {
-        return ExitCode_ConnectRaw_GetHostByName;
+    int r = wolfSSL_Init();
+    if (r != WOLFSSL_SUCCESS) {
+        return ExitCode_InitTls_Init;
     }
+    wolfSslInitialized = true;
 
-    sockFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
-    if (sockFd == -1) {
-        return ExitCode_ConnectRaw_Socket;
+    WOLFSSL_METHOD *wolfSslMethod = wolfTLSv1_3_client_method();
+    if (wolfSslMethod == NULL) {
+        return ExitCode_InitTls_Method;
     }
 
-    sockReg = EventLoop_RegisterIo(eventLoop, sockFd, EventLoop_Output, HandleSockEvent,
-                                   /* context */ NULL);
-    if (sockReg == NULL) {
-        return ExitCode_ConnectRaw_EventReg;
+    wolfSslCtx = wolfSSL_CTX_new(wolfSslMethod);
+    if (wolfSslCtx == NULL) {
+        return ExitCode_InitTls_Context;
     }
 
-    struct sockaddr_in host = {.sin_family = AF_INET,
-                               .sin_port = htons(PORT_NUM),
-                               .sin_addr = *((struct in_addr *)hent->h_addr)};
+    // Specify the root certificate which is used to validate the server. If it can be mapped
+    // from the image package, wolfSSL parses it in place, rather than reading it into a buffer.
+    ImageAsset certAsset;
+    if (ImageAsset_Open(&certAsset, certPath) == 0 && ImageAsset_IsMapped(&certAsset)) {
+        r = wolfSSL_CTX_load_verify_buffer(wolfSslCtx, certAsset.data, (long)certAsset.size,
+                                           WOLFSSL_FILETYPE_PEM);
+        ImageAsset_Close(&certAsset);
+    } else {
+        ImageAsset_Close(&certAsset);
 
-    int r = connect(sockFd, (const struct sockaddr *)&host, sizeof(host));
-    if (r != 0 && errno != EINPROGRESS) {
-        return ExitCode_ConnectRaw_Connect;
+        char *certPathAbs = Storage_GetAbsolutePathInImagePackage(certPath);
+        if (certPathAbs == NULL) {
+            return ExitCode_InitTls_CertPath;
+        }
+
+        r = wolfSSL_CTX_load_verify_locations(wolfSslCtx, certPathAbs, NULL);
+        free(certPathAbs);
+    }
+    if (r != WOLFSSL_SUCCESS) {
+        Log_Debug("ERROR: Could not load the root certificate %d\n", r);
+        return ExitCode_InitTls_VerifyLocations;
+    }
+
+#if SESSION_CACHE_SUPPORTED
+    // Ask the server for a session ticket, which the next connection can use to resume the
+    // session.
+    r = wolfSSL_CTX_UseSessionTicket(wolfSslCtx);
+    if (r != WOLFSSL_SUCCESS) {
+        Log_Debug("WARNING: wolfSSL_CTX_UseSessionTicket %d\n", r);
+    }
+#endif
+
+    return ExitCode_Success;
+}
+
+/// <summary>
+///     <para>
+///         Starts connecting to the server's HTTPS port. If the server has several
+///         addresses, connections to them are raced, and the first to complete is used.
+///     </para>
+///     <para>
+///         <see cref="HandleConnection" /> is called when the connection completes,
+///         succesfully or otherwise.
+///     </para>
+/// </summary>
+/// <returns>ExitCode_Success on success; another ExitCode on failure.</returns>
+static ExitCode ConnectRawSocketToServer(void)
+{
+    if (Connector_Start(SERVER_NAME, PORT_NUM, HandleConnection, /* context */ NULL) != 0) {
+        Log_Debug("ERROR: Could not connect to %s: %s (%d)\n", SERVER_NAME, strerror(errno),
+                  errno);
+        return ExitCode_ConnectRaw_Start;
     }
 
-    nextHandler = HandleConnection;
     return ExitCode_Success;
 }
 
@@ -237,63 +333,57 @@ static ExitCode ConnectRawSocketToServer(void)
 ///     <para>
 ///         Called from the event loop when socket connection has completed,
 ///         successfully or otherwise. If the connection was successful, then
-///         uses wolfSSL to start the SSL handshake. Otherwise, set exitCode to
-///         the appropriate value.
+///         uses wolfSSL to start the SSL handshake, resuming the stored session if
+///         there is one. Otherwise, set exitCode to the appropriate value.
+///     </para>
+///     <para>
+///         See <see cref="Connector_ConnectedHandler" /> for a description of the arguments.
 ///     </para>
 /// </summary>
-static void HandleConnection(void)
+static void HandleConnection(int fd, void *context)
 {
-    // Check whether the connection succeeded.
-    int error;
-    socklen_t errSize = sizeof(error);
-    int r = getsockopt(sockFd, SOL_SOCKET, SO_ERROR, &error, &errSize);
-    if (!(r == 0 && error == 0)) {
+    if (fd == -1) {
         exitCode = ExitCode_HandleConnection_Failed;
         return;
     }
 
-    // Connection was made successfully, so allocate wolfSSL session and context.
-    r = wolfSSL_Init();
-    if (r != WOLFSSL_SUCCESS) {
-        exitCode = ExitCode_HandleConnection_Init;
-        return;
-    }
-    wolfSslInitialized = true;
-
-    WOLFSSL_METHOD *wolfSslMethod = wolfTLSv1_3_client_method();
-    if (wolfSslMethod == NULL) {
-        exitCode = ExitCode_HandleConnection_Method;
+    sockFd = fd;
+    sockReg = EventLoop_RegisterIo(eventLoop, sockFd, EventLoop_Input | EventLoop_Output,
+                                   HandleSockEvent, /* context */ NULL);
+    if (sockReg == NULL) {
+        exitCode = ExitCode_ConnectRaw_EventReg;
         return;
     }
+    sockEvents = EventLoop_Input | EventLoop_Output;
 
-    wolfSslCtx = wolfSSL_CTX_new(wolfSslMethod);
-    if (wolfSslCtx == NULL) {
-        exitCode = ExitCode_HandleConnection_Context;
+    // Connection was made successfully, so allocate wolfSSL session.
+    wolfSslSession = wolfSSL_new(wolfSslCtx);
+    if (wolfSslSession == NULL) {
+        exitCode = ExitCode_HandleConnection_Session;
         return;
     }
 
-    // Specify the root certificate which is used to validate the server.
-    char *certPathAbs = Storage_GetAbsolutePathInImagePackage(certPath);
-    if (certPathAbs == NULL) {
-        exitCode = ExitCode_HandleConnection_CertPath;
+    const TlsProfile *profile = &TlsProfiles[tlsProfileIndex];
+    if (TlsProfile_Apply(wolfSslSession, profile) != 0) {
+#ifdef TLS_BENCHMARK
+        EndBenchmarkHandshake(false, 0.0);
         return;
+#else
+        Log_Debug("WARNING: TLS profile \"%s\" is not supported.\n", profile->name);
+#endif
     }
 
-    r = wolfSSL_CTX_load_verify_locations(wolfSslCtx, certPathAbs, NULL);
-    free(certPathAbs);
-    if (r != WOLFSSL_SUCCESS) {
-        Log_Debug("ERROR: wolfSSL_CTX_load_verify_locations %d\n", r);
-        exitCode = ExitCode_HandleConnection_VerifyLocations;
-    }
-
-    wolfSslSession = wolfSSL_new(wolfSslCtx);
-    if (wolfSslSession == NULL) {
-        exitCode = ExitCode_HandleConnection_Session;
-        return;
+#ifndef TLS_BENCHMARK
+    // Offer the session from the last connection to the server, if one is stored. If the server
+    // does not accept it, then a full handshake is performed. The benchmark only times full
+    // handshakes.
+    if (SessionCache_Load(wolfSslSession, SERVER_NAME, PORT_NUM)) {
+        Log_Debug("INFO: Trying to resume the stored TLS session.\n");
     }
+#endif
 
     // Associate socket with wolfSSL session.
-    r = wolfSSL_set_fd(wolfSslSession, sockFd);
+    int r = wolfSSL_set_fd(wolfSslSession, sockFd);
     if (r != WOLFSSL_SUCCESS) {
         Log_Debug("ERROR: wolfSSL_set_fd %d\n", r);
         exitCode = ExitCode_HandleConnection_SetFd;
@@ -301,6 +391,7 @@ static void HandleConnection(void)
     }
 
     // Perform TLS handshake.
+    clock_gettime(CLOCK_MONOTONIC, &handshakeStartTime);
     // Asynchronous handshakes require repeated calls to wolfSSL_connect, so jump to the
     // handler to avoid repeating code.
     HandleTlsHandshake();
@@ -313,12 +404,12 @@ static void HandleConnection(void)
 ///     </para>
 ///     <para>
 ///         If the handshake completes successfully, this function begins writing the
-///         HTTP GET request. If a fatal error occurs, sets exitCode to the appropriate value.
+///         HTTP GET requests. If a fatal error occurs, sets exitCode to the appropriate value.
 ///     </para>
 /// </summary>
 static void HandleTlsHandshake(void)
 {
-    int r = EventLoop_ModifyIoEvents(eventLoop, sockReg, EventLoop_Input | EventLoop_Output);
+    int r = SetSockEvents(EventLoop_Input | EventLoop_Output);
     if (r != 0) {
         exitCode = ExitCode_SslHandshake_ModifyEvents;
         return;
@@ -335,44 +426,80 @@ static void HandleTlsHandshake(void)
 
         // Unexpected error, so terminate.
         Log_Debug("ERROR: wolfSSL_connect %d\n", uniqueError);
+#ifdef TLS_BENCHMARK
+        EndBenchmarkHandshake(false, 0.0);
+#else
         exitCode = ExitCode_SslHandshake_Fail;
+#endif
         return;
     }
 
-    // "Connection: close" instructs the server to close the connection after the
-    // web page has been transferred, so this client knows when to stop reading data.
-    writePayload =
-        "GET / HTTP/1.1\r\n"
-        "Host: " SERVER_NAME
-        "\r\n"
-        "Connection: close\r\n"
-        "Accept: */*\r\n"
-        "\r\n";
-    writePayloadLen = (int)strlen(writePayload);
-    totalBytesWritten = 0;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double handshakeMs = (double)(now.tv_sec - handshakeStartTime.tv_sec) * 1000.0 +
+                         (double)(now.tv_nsec - handshakeStartTime.tv_nsec) / 1000000.0;
+    Log_Debug("INFO: TLS handshake completed in %.1f ms (%s, %s, profile \"%s\").\n", handshakeMs,
+              wolfSSL_session_reused(wolfSslSession) ? "session resumed" : "full handshake",
+              wolfSSL_get_cipher_name(wolfSslSession), TlsProfiles[tlsProfileIndex].name);
+
+#ifdef TLS_BENCHMARK
+    EndBenchmarkHandshake(true, handshakeMs);
+    return;
+#endif
+
+    if (BuildRequests() != 0) {
+        exitCode = ExitCode_WriteData_Request;
+        return;
+    }
+    HttpResponse_Init(&responseParser, HandleResponseComplete, /* context */ NULL);
 
     WriteData();
 }
 
+/// <summary>
+///     Puts the requests for every page which has not yet been received, one after another, into
+///     requestBuffer, so that they are written together. All but the last keep the connection
+///     open; "Connection: close" on the last asks the server to close it once it has answered.
+/// </summary>
+/// <returns>0 on success; -1 if the requests do not fit in the buffer.</returns>
+static int BuildRequests(void)
+{
+    size_t length = 0;
+    firstRequestOnConnection = responsesReceived;
+    for (size_t i = firstRequestOnConnection; i < REQUEST_COUNT; ++i) {
+        int n = snprintf(&requestBuffer[length], sizeof(requestBuffer) - length,
+                         "GET %s HTTP/1.1\r\n"
+                         "Host: " SERVER_NAME "\r\n"
+                         "Connection: %s\r\n"
+                         "Accept: */*\r\n"
+                         "\r\n",
+                         requestPaths[i], (i == REQUEST_COUNT - 1) ? "close" : "keep-alive");
+        if (n < 0 || (size_t)n >= sizeof(requestBuffer) - length) {
+            Log_Debug("ERROR: The requests do not fit in the request buffer.\n");
+            return -1;
+        }
+        length += (size_t)n;
+    }
+
+    writePayload = (const uint8_t *)requestBuffer;
+    writePayloadLen = (int)length;
+    totalBytesWritten = 0;
+    return 0;
+}
+
 /// <summary>
 ///     <para>
-///         Called to start writing the HTTP GET request. If the entire request
-///         could not be written in one write operation, this function is called again
-///         from the event loop to write the next chunk of data.
+///         Called to start writing the HTTP GET requests. If all of them could not be
+///         written in one write operation, this function is called again from the event
+///         loop to write the next chunk of data.
 ///     </para>
 ///     <para>
-///         Once the whole request has been written, this function starts reading the
-///         response. If a fatal error occurs, sets exitCode to the appropriate value.
+///         Once every request has been written, this function starts reading the
+///         responses. If a fatal error occurs, sets exitCode to the appropriate value.
 ///     </para>
 /// </summary>
 static void WriteData(void)
 {
-    int r = EventLoop_ModifyIoEvents(eventLoop, sockReg, EventLoop_None);
-    if (r != 0) {
-        exitCode = ExitCode_WriteData_ModifyEventsNone;
-        return;
-    }
-
     while (totalBytesWritten < writePayloadLen) {
         int bytesRemaining = writePayloadLen - totalBytesWritten;
         int bytesWritten =
@@ -383,7 +510,7 @@ static void WriteData(void)
             const int uniqueError = wolfSSL_get_error(wolfSslSession, bytesWritten);
 
             if (wasFatalError && uniqueError == WOLFSSL_ERROR_WANT_WRITE) {
-                r = EventLoop_ModifyIoEvents(eventLoop, sockReg, EventLoop_Output);
+                int r = SetSockEvents(EventLoop_Output);
                 if (r != 0) {
                     exitCode = ExitCode_WriteData_ModifyEventsOutput;
                 } else {
@@ -402,61 +529,67 @@ static void WriteData(void)
         totalBytesWritten += bytesWritten;
     }
 
-    // Full payload has been written, so read response.
-    totalBytesRead = 0;
+    // Full payload has been written, so read the responses.
+    clock_gettime(CLOCK_MONOTONIC, &requestsWrittenTime);
     return ReadData();
 }
 
 /// <summary>
 ///     <para>
-///         Called to start reading a response from the server. If the entire response
-///         could not be read in one operation, this function is called again from the
-///         event loop to read the next chunk of data.
+///         Called to start reading the responses from the server, and again from the event
+///         loop when more of them has arrived. Each call reads whole records into a buffer
+///         which can hold the largest record, and passes them to dataConsumer, until
+///         wolfSSL has no more decrypted data and the socket has no more to read, so that the
+///         event loop is only returned to when there is nothing left to read. The data is also
+///         parsed to find where each response ends.
 ///     </para>
 ///     <para>
-///         Once the entire response has been read, or when an error occurs, exitCode is
+///         Once every response has been read, or when an error occurs, exitCode is
 ///         set to the appropriate value, which causes control to return to the main function.
 ///     </para>
 /// </summary>
 static void ReadData(void)
 {
-    int r = EventLoop_ModifyIoEvents(eventLoop, sockReg, EventLoop_None);
-    if (r != 0) {
-        exitCode = ExitCode_ReadData_ModifyEventsNone;
-        return;
-    }
+    for (;;) {
+        int bytesRead = wolfSSL_read(wolfSslSession, readPayload, sizeof(readPayload));
+
+        // If error occurred then abort.
+        if (bytesRead <= 0) {
+            bool wasFatalError = (bytesRead == WOLFSSL_FATAL_ERROR);
+            const int uniqueError = wolfSSL_get_error(wolfSslSession, bytesRead);
 
-    int bytesRead = wolfSSL_read(wolfSslSession, readPayload, sizeof(readPayload));
+            if (wasFatalError && uniqueError == WOLFSSL_ERROR_WANT_READ) {
+                break;
+            }
 
-    // If error occurred then abort.
-    if (bytesRead <= 0) {
-        bool wasFatalError = (bytesRead == WOLFSSL_FATAL_ERROR);
-        const int uniqueError = wolfSSL_get_error(wolfSslSession, bytesRead);
+            static const int SOCKET_PEER_CLOSED_E = -397;
+            if (bytesRead == 0 &&
+                (uniqueError == SOCKET_PEER_CLOSED_E || uniqueError == WOLFSSL_ERROR_ZERO_RETURN)) {
+                HandlePeerClosed();
+                return;
+            }
 
-        if (wasFatalError && uniqueError == WOLFSSL_ERROR_WANT_READ) {
-            goto read_more_data;
+            Log_Debug("ERROR: wolfSSL_read %d\n", uniqueError);
+            exitCode = ExitCode_ReadData_Read;
+            return;
         }
 
-        // HTTPS connection was opened with "Connection: close" so expect the
-        // server to close the connection when the transfer has completed.
+        dataConsumer(readPayload, (size_t)bytesRead);
+        totalBytesRead += bytesRead;
 
-        static const int SOCKET_PEER_CLOSED_E = -397;
-        if (bytesRead == 0 &&
-            (uniqueError == SOCKET_PEER_CLOSED_E || uniqueError == WOLFSSL_ERROR_ZERO_RETURN)) {
-            exitCode = ExitCode_ReadData_Finished;
+        if (HttpResponse_Feed(&responseParser, readPayload, (size_t)bytesRead) != 0) {
+            Log_Debug("ERROR: Malformed response from the server.\n");
+            exitCode = ExitCode_ReadData_Response;
+            return;
+        }
+        // The last response has been received.
+        if (exitCode != ExitCode_Success) {
             return;
         }
-
-        Log_Debug("ERROR: wolfSSL_read %d\n", uniqueError);
-        exitCode = ExitCode_ReadData_Read;
-        return;
     }
 
-    Log_Debug("%.*s", bytesRead, readPayload);
-    totalBytesRead += bytesRead;
-
-read_more_data:
-    r = EventLoop_ModifyIoEvents(eventLoop, sockReg, EventLoop_Input);
+    // wolfSSL has consumed everything which the socket had received, so wait for more.
+    int r = SetSockEvents(EventLoop_Input);
     if (r != 0) {
         exitCode = ExitCode_ReadData_ModifyEventsInput;
     } else {
@@ -464,9 +597,128 @@ read_more_data:
     }
 }
 
+/// <summary>
+///     Called by the response parser when a response has been received in full. Once the last
+///     response has arrived, the session is stored and exitCode is set to
+///     ExitCode_ReadData_Finished, without waiting for the server to close the connection.
+/// </summary>
+static void HandleResponseComplete(int status, bool keepAlive, void *context)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double elapsedMs = (double)(now.tv_sec - requestsWrittenTime.tv_sec) * 1000.0 +
+                       (double)(now.tv_nsec - requestsWrittenTime.tv_nsec) / 1000000.0;
+    Log_Debug("\nINFO: Response to GET %s: status %d, %.1f ms after the requests were sent.\n",
+              requestPaths[responsesReceived], status, elapsedMs);
+
+    if (++responsesReceived < REQUEST_COUNT) {
+        if (!keepAlive) {
+            Log_Debug("INFO: The server will close the connection; the remaining requests will "
+                      "be sent again.\n");
+        }
+        return;
+    }
+
+    // The session ticket arrives after the handshake, so store the session now.
+    SessionCache_Store(wolfSslSession, SERVER_NAME, PORT_NUM);
+    exitCode = ExitCode_ReadData_Finished;
+}
+
+/// <summary>
+///     Called when the server has closed the connection. If it answered at least one request
+///     on the connection before closing it, the requests which it did not answer are sent again
+///     on a new connection, which resumes the session; otherwise, exitCode is set to
+///     ExitCode_ReadData_Closed.
+/// </summary>
+static void HandlePeerClosed(void)
+{
+    bool betweenResponses = HttpResponse_Close(&responseParser);
+    if (exitCode != ExitCode_Success) {
+        // The close ended the last response.
+        return;
+    }
+
+    if (!betweenResponses || responsesReceived == firstRequestOnConnection) {
+        Log_Debug("ERROR: The server closed the connection after %zu of %zu responses.\n",
+                  responsesReceived, REQUEST_COUNT);
+        exitCode = ExitCode_ReadData_Closed;
+        return;
+    }
+
+    SessionCache_Store(wolfSslSession, SERVER_NAME, PORT_NUM);
+    CloseConnection();
+    Log_Debug("INFO: Reconnecting for the remaining %zu requests.\n",
+              REQUEST_COUNT - responsesReceived);
+    exitCode = ConnectRawSocketToServer();
+}
+
+/// <summary>
+///     Frees the wolfSSL session and closes the socket, so that another connection can be made.
+/// </summary>
+static void CloseConnection(void)
+{
+    wolfSSL_free(wolfSslSession);
+    wolfSslSession = NULL;
+    EventLoop_UnregisterIo(eventLoop, sockReg);
+    sockReg = NULL;
+    sockEvents = EventLoop_None;
+    close(sockFd);
+    sockFd = -1;
+}
+
+#ifdef TLS_BENCHMARK
+/// <summary>
+///     Closes the connection which the benchmark has just timed, and connects again with the same
+///     profile, or with the next profile once enough handshakes have been timed. Once all the
+///     profiles have been timed, sets exitCode to ExitCode_Benchmark_Finished.
+/// </summary>
+/// <param name="succeeded">Whether the handshake succeeded.</param>
+/// <param name="handshakeMs">Duration of the handshake, if it succeeded.</param>
+static void EndBenchmarkHandshake(bool succeeded, double handshakeMs)
+{
+    CloseConnection();
+
+    if (succeeded) {
+        unsigned int timed = benchmarkHandshakes - benchmarkFailures;
+        if (timed == 0 || handshakeMs < benchmarkMinMs) {
+            benchmarkMinMs = handshakeMs;
+        }
+        if (timed == 0 || handshakeMs > benchmarkMaxMs) {
+            benchmarkMaxMs = handshakeMs;
+        }
+        benchmarkTotalMs += handshakeMs;
+    } else {
+        ++benchmarkFailures;
+    }
+
+    if (++benchmarkHandshakes == BENCHMARK_HANDSHAKES_PER_PROFILE) {
+        unsigned int timed = benchmarkHandshakes - benchmarkFailures;
+        if (timed == 0) {
+            Log_Debug("BENCHMARK: profile \"%s\": all %u handshakes failed.\n",
+                      TlsProfiles[tlsProfileIndex].name, benchmarkHandshakes);
+        } else {
+            Log_Debug("BENCHMARK: profile \"%s\": mean %.1f ms, min %.1f ms, max %.1f ms, "
+                      "%u of %u handshakes failed.\n",
+                      TlsProfiles[tlsProfileIndex].name, benchmarkTotalMs / timed, benchmarkMinMs,
+                      benchmarkMaxMs, benchmarkFailures, benchmarkHandshakes);
+        }
+
+        benchmarkHandshakes = 0;
+        benchmarkFailures = 0;
+        benchmarkTotalMs = 0.0;
+        if (++tlsProfileIndex == TlsProfileCount) {
+            exitCode = ExitCode_Benchmark_Finished;
+            return;
+        }
+    }
+
+    exitCode = ConnectRawSocketToServer();
+}
+#endif
+
 /// <summary>
 ///     Allocate resources which are needed at startup, namely the
-///     event loop and the startup timer.
+///     event loop, the wolfSSL context, the connector and the network state service.
 /// </summary>
 /// <returns>
 ///     ExitCode_Success on success; or another ExitCode value on failure.
@@ -478,12 +730,19 @@ static ExitCode InitializeResources(void)
         return ExitCode_Init_EventLoop;
     }
 
-    // Check for an internet connection every 10 seconds.
-    static const struct timespec tenSeconds = {.tv_sec = 10, .tv_nsec = 0};
-    internetCheckTimer =
-        CreateEventLoopPeriodicTimer(eventLoop, &InternetCheckTimerEventHandler, &tenSeconds);
-    if (internetCheckTimer == NULL) {
-        return ExitCode_Init_InternetCheckTimer;
+    ExitCode tlsExitCode = InitializeTls();
+    if (tlsExitCode != ExitCode_Success) {
+        return tlsExitCode;
+    }
+
+    if (Connector_Init(eventLoop) != 0) {
+        return ExitCode_Init_Connector;
+    }
+
+    // Start the download as soon as the interface is connected to the internet.
+    if (NetworkState_Start(eventLoop, networkInterface, NetworkStateErrorHandler, NULL) != 0 ||
+        NetworkState_Subscribe(NetworkStateChangedHandler, NULL) != 0) {
+        return ExitCode_Init_NetworkState;
     }
 
     return ExitCode_Success;
@@ -492,7 +751,8 @@ static ExitCode InitializeResources(void)
 /// <summary>
 ///     <para>
 ///         Free any resources which were successfully allocated by the program.
-///         This includes the event loop, startup timer, wolfSSL resources, and socket.
+///         This includes the event loop, network state service, connector, wolfSSL resources,
+///         and socket.
 ///     </para>
 /// </summary>
 static void FreeResources(void)
@@ -513,7 +773,8 @@ static void FreeResources(void)
         close(sockFd);
     }
 
-    DisposeEventLoopTimer(internetCheckTimer);
+    NetworkState_Stop();
+    Connector_Cleanup();
     EventLoop_UnregisterIo(eventLoop, sockReg);
     EventLoop_Close(eventLoop);
 }
@@ -536,7 +797,11 @@ int main(void)
     FreeResources();
 
     if (exitCode == ExitCode_ReadData_Finished) {
-        Log_Debug("\nDownloaded content (%d bytes).\n", totalBytesRead);
+        Log_Debug("\nDownloaded %zu pages (%d bytes).\n", REQUEST_COUNT, totalBytesRead);
+        exitCode = ExitCode_Success;
+    }
+
+    if (exitCode == ExitCode_Benchmark_Finished) {
         exitCode = ExitCode_Success;
     }
 
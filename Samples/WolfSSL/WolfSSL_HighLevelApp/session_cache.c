@@ -0,0 +1,194 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <applibs/log.h>
+#include <applibs/storage.h>
+
+#include "session_cache.h"
+
+#if SESSION_CACHE_SUPPORTED
+
+// Offset of the entry within the mutable storage file. The entry must fit within the
+// MutableStorage size declared in app_manifest.json.
+#define ENTRY_OFFSET 0
+
+static const uint32_t entryMagic = ('T' << 24) | ('L' << 16) | ('S' << 8) | 'C';
+
+// The entry is written in one operation, and its CRC covers all its other fields, so that an entry
+// which was only partly written is ignored.
+typedef struct {
+    uint32_t magic;
+    int64_t storedTime; // Seconds since the epoch when the entry was stored.
+    char serverName[SESSION_CACHE_MAX_SERVER_NAME_LENGTH + 1];
+    uint16_t port;
+    uint16_t sessionSize;
+    uint8_t session[SESSION_CACHE_MAX_SESSION_SIZE];
+    uint32_t crc;
+} Entry;
+
+static uint32_t Crc32(const void *data, size_t length)
+{
+    const uint8_t *bytes = data;
+    uint32_t crc = 0xFFFFFFFFu;
+    while (length-- > 0) {
+        crc ^= *bytes++;
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc >> 1) ^ (0xEDB88320u & -(crc & 1u));
+        }
+    }
+    return ~crc;
+}
+
+static uint32_t EntryCrc(const Entry *entry)
+{
+    return Crc32(entry, offsetof(Entry, crc));
+}
+
+static int OpenStorage(void)
+{
+    int fd = Storage_OpenMutableFile();
+    if (fd == -1) {
+        Log_Debug("ERROR: Could not open mutable storage: errno=%d (%s)\n", errno,
+                  strerror(errno));
+    }
+    return fd;
+}
+
+static void CloseStorage(int fd)
+{
+    if (close(fd) != 0) {
+        Log_Debug("ERROR: Could not close mutable storage: errno=%d (%s)\n", errno,
+                  strerror(errno));
+    }
+}
+
+// Reads the entry for a server, if a valid one is stored.
+static bool ReadEntry(const char *serverName, uint16_t port, Entry *entry)
+{
+    int fd = OpenStorage();
+    if (fd == -1) {
+        return false;
+    }
+
+    bool valid = lseek(fd, ENTRY_OFFSET, SEEK_SET) != -1 &&
+                 read(fd, entry, sizeof(*entry)) == (ssize_t)sizeof(*entry) &&
+                 entry->magic == entryMagic && entry->crc == EntryCrc(entry) &&
+                 entry->serverName[SESSION_CACHE_MAX_SERVER_NAME_LENGTH] == '\0' &&
+                 entry->sessionSize <= SESSION_CACHE_MAX_SESSION_SIZE &&
+                 strcmp(entry->serverName, serverName) == 0 && entry->port == port;
+    CloseStorage(fd);
+    return valid;
+}
+
+static bool WriteEntry(const Entry *entry)
+{
+    int fd = OpenStorage();
+    if (fd == -1) {
+        return false;
+    }
+
+    bool written = lseek(fd, ENTRY_OFFSET, SEEK_SET) != -1 &&
+                   write(fd, entry, sizeof(*entry)) == (ssize_t)sizeof(*entry);
+    if (!written) {
+        Log_Debug("ERROR: Could not write the TLS session cache: errno=%d (%s)\n", errno,
+                  strerror(errno));
+    }
+
+    CloseStorage(fd);
+    return written;
+}
+
+bool SessionCache_Load(WOLFSSL *ssl, const char *serverName, uint16_t port)
+{
+    Entry entry;
+    if (!ReadEntry(serverName, port, &entry)) {
+        return false;
+    }
+
+    // The clock may not have been set yet after a cold start, in which case it is earlier than
+    // when the entry was stored. The session is still offered; if its ticket has expired, the
+    // server performs a full handshake instead.
+    int64_t age = (int64_t)time(NULL) - entry.storedTime;
+    if (age > SESSION_CACHE_VALIDITY_SECONDS) {
+        Log_Debug("INFO: The cached TLS session has expired\n");
+        return false;
+    }
+
+    const unsigned char *data = entry.session;
+    WOLFSSL_SESSION *session = wolfSSL_d2i_SSL_SESSION(NULL, &data, entry.sessionSize);
+    if (session == NULL) {
+        Log_Debug("ERROR: Could not parse the cached TLS session\n");
+        return false;
+    }
+
+    // wolfSSL_set_session copies the session, so it can be freed here.
+    int r = wolfSSL_set_session(ssl, session);
+    wolfSSL_SESSION_free(session);
+    if (r != WOLFSSL_SUCCESS) {
+        Log_Debug("ERROR: wolfSSL_set_session %d\n", r);
+        return false;
+    }
+
+    return true;
+}
+
+bool SessionCache_Store(WOLFSSL *ssl, const char *serverName, uint16_t port)
+{
+    WOLFSSL_SESSION *session = wolfSSL_get_session(ssl);
+    if (session == NULL) {
+        return false;
+    }
+
+    int size = wolfSSL_i2d_SSL_SESSION(session, NULL);
+    if (size <= 0 || size > SESSION_CACHE_MAX_SESSION_SIZE ||
+        strnlen(serverName, SESSION_CACHE_MAX_SERVER_NAME_LENGTH + 1) >
+            SESSION_CACHE_MAX_SERVER_NAME_LENGTH) {
+        Log_Debug("INFO: TLS session too large to cache\n");
+        return false;
+    }
+
+    // Zero the entry so that the CRC does not depend on padding or on bytes after the session.
+    Entry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.magic = entryMagic;
+    entry.storedTime = (int64_t)time(NULL);
+    strcpy(entry.serverName, serverName);
+    entry.port = port;
+    entry.sessionSize = (uint16_t)size;
+    unsigned char *data = entry.session;
+    if (wolfSSL_i2d_SSL_SESSION(session, &data) != size) {
+        Log_Debug("ERROR: Could not serialize the TLS session\n");
+        return false;
+    }
+
+    // Avoid wearing the flash when the server has not issued a new ticket.
+    Entry stored;
+    if (ReadEntry(serverName, port, &stored) && stored.sessionSize == entry.sessionSize &&
+        memcmp(stored.session, entry.session, entry.sessionSize) == 0) {
+        return true;
+    }
+
+    entry.crc = EntryCrc(&entry);
+    return WriteEntry(&entry);
+}
+
+#else // !SESSION_CACHE_SUPPORTED
+
+bool SessionCache_Load(WOLFSSL *ssl, const char *serverName, uint16_t port)
+{
+    return false;
+}
+
+bool SessionCache_Store(WOLFSSL *ssl, const char *serverName, uint16_t port)
+{
+    return false;
+}
+
+#endif // SESSION_CACHE_SUPPORTED
@@ -0,0 +1,64 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <wolfssl/ssl.h>
+
+// The session cache stores in the application's mutable storage the TLS session, including the
+// session ticket, which a server issued at the end of the last connection to it, so that after a
+// restart the next connection to the same server can resume the session instead of performing a
+// full handshake. An entry is bound to the server name and port it was issued for, and is used for
+// SESSION_CACHE_VALIDITY_SECONDS after it was stored, which is the longest lifetime which TLS 1.3
+// allows a ticket. A server which no longer accepts the ticket performs a full handshake instead,
+// and issues a new one.
+//
+// Sessions can only be stored if the wolfSSL library was built with session ticket support and
+// can serialize sessions; otherwise, every connection performs a full handshake.
+
+#if defined(HAVE_SESSION_TICKET) && (defined(OPENSSL_EXTRA) || defined(HAVE_EXT_CACHE))
+#define SESSION_CACHE_SUPPORTED 1
+#else
+#define SESSION_CACHE_SUPPORTED 0
+#endif
+
+/// <summary>
+///     Maximum length of a server name, excluding the null terminator.
+/// </summary>
+#define SESSION_CACHE_MAX_SERVER_NAME_LENGTH 127
+
+/// <summary>
+///     Maximum size of a serialized session, in bytes.
+/// </summary>
+#define SESSION_CACHE_MAX_SESSION_SIZE 2048
+
+/// <summary>
+///     How long after it was stored an entry is used, in seconds.
+/// </summary>
+#define SESSION_CACHE_VALIDITY_SECONDS (7 * 24 * 60 * 60)
+
+/// <summary>
+///     Sets the cached session for a server on a wolfSSL session which has not yet connected, so
+///     that the connection tries to resume it.
+/// </summary>
+/// <param name="ssl">The wolfSSL session which will connect to the server.</param>
+/// <param name="serverName">The host name of the server.</param>
+/// <param name="port">The port of the server.</param>
+/// <returns>
+///     true if a valid session for the server was cached and set; false otherwise.
+/// </returns>
+bool SessionCache_Load(WOLFSSL *ssl, const char *serverName, uint16_t port);
+
+/// <summary>
+///     Stores the session of a connection to a server, replacing any cached session. The session
+///     is not written again if it is unchanged. In TLS 1.3 the server sends its session ticket
+///     after the handshake, so this should be called once data has been read from the server.
+/// </summary>
+/// <param name="ssl">The wolfSSL session which is connected to the server.</param>
+/// <param name="serverName">The host name of the server.</param>
+/// <param name="port">The port of the server.</param>
+/// <returns>true on success; false if the session could not be stored.</returns>
+bool SessionCache_Store(WOLFSSL *ssl, const char *serverName, uint16_t port);
@@ -0,0 +1,55 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <applibs/log.h>
+
+#include "tls_profile.h"
+
+const TlsProfile TlsProfiles[] = {
+    // Fastest in software on the A7.
+    {.name = "constrained",
+     .cipherList = "TLS13-CHACHA20-POLY1305-SHA256:TLS13-AES128-GCM-SHA256",
+     .groupCount = 2,
+     .groups = {WOLFSSL_ECC_X25519, WOLFSSL_ECC_SECP256R1}},
+    // For servers which only support the NIST curves.
+    {.name = "p256",
+     .cipherList = "TLS13-AES128-GCM-SHA256:TLS13-CHACHA20-POLY1305-SHA256",
+     .groupCount = 1,
+     .groups = {WOLFSSL_ECC_SECP256R1}},
+    {.name = "p384",
+     .cipherList = "TLS13-AES256-GCM-SHA384",
+     .groupCount = 1,
+     .groups = {WOLFSSL_ECC_SECP384R1}},
+    // wolfSSL's own ordering, for comparison.
+    {.name = "library default", .cipherList = NULL, .groupCount = 0},
+};
+
+const size_t TlsProfileCount = sizeof(TlsProfiles) / sizeof(TlsProfiles[0]);
+
+int TlsProfile_Apply(WOLFSSL *ssl, const TlsProfile *profile)
+{
+    if (profile->cipherList != NULL) {
+        int r = wolfSSL_set_cipher_list(ssl, profile->cipherList);
+        if (r != WOLFSSL_SUCCESS) {
+            Log_Debug("ERROR: wolfSSL_set_cipher_list \"%s\" %d\n", profile->name, r);
+            return -1;
+        }
+    }
+
+    if (profile->groupCount > 0) {
+        int r = wolfSSL_set_groups(ssl, (int *)profile->groups, (int)profile->groupCount);
+        if (r != WOLFSSL_SUCCESS) {
+            Log_Debug("ERROR: wolfSSL_set_groups \"%s\" %d\n", profile->name, r);
+            return -1;
+        }
+
+        // Only compute a key share for the most preferred group.
+        r = wolfSSL_UseKeyShare(ssl, (word16)profile->groups[0]);
+        if (r != WOLFSSL_SUCCESS) {
+            Log_Debug("ERROR: wolfSSL_UseKeyShare \"%s\" %d\n", profile->name, r);
+            return -1;
+        }
+    }
+
+    return 0;
+}
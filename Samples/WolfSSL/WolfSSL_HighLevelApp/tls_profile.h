@@ -0,0 +1,58 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stddef.h>
+
+#include <wolfssl/ssl.h>
+
+// A TLS profile is an ordered preference of TLS 1.3 cipher suites and key exchange groups. The
+// Cortex-A7 on the MT3620 runs wolfSSL's cryptography in software, so the cost of a handshake
+// depends on which suite and group are negotiated: ChaCha20-Poly1305 is faster than AES-GCM
+// without AES instructions, and X25519 is faster than the NIST curves. The client offers a key
+// share only for its most preferred group, so that it does not compute key pairs for groups which
+// the server does not pick; a server which does not support that group asks for another one, at
+// the cost of an extra round trip.
+//
+// The signature of the server's certificate is chosen by the server, so its verification cost,
+// which is high for RSA, cannot be changed by the profile.
+
+/// <summary>
+///     Maximum number of key exchange groups in a profile.
+/// </summary>
+#define TLS_PROFILE_MAX_GROUPS 4
+
+/// <summary>
+///     A preference of cipher suites and key exchange groups.
+/// </summary>
+typedef struct {
+    /// <summary>Name of the profile, which is shown in the log.</summary>
+    const char *name;
+    /// <summary>Colon-separated wolfSSL cipher suite names, most preferred first, or NULL to use
+    /// the library's default.</summary>
+    const char *cipherList;
+    /// <summary>Number of groups in <see cref="groups" />, or 0 to use the library's
+    /// default.</summary>
+    size_t groupCount;
+    /// <summary>Key exchange groups (WOLFSSL_ECC_*), most preferred first.</summary>
+    int groups[TLS_PROFILE_MAX_GROUPS];
+} TlsProfile;
+
+/// <summary>
+///     The profiles, the one which is used by default first.
+/// </summary>
+extern const TlsProfile TlsProfiles[];
+
+/// <summary>
+///     The number of profiles in <see cref="TlsProfiles" />.
+/// </summary>
+extern const size_t TlsProfileCount;
+
+/// <summary>
+///     Applies a profile to a wolfSSL session which has not yet connected.
+/// </summary>
+/// <param name="ssl">The wolfSSL session.</param>
+/// <param name="profile">The profile.</param>
+/// <returns>0 on success; -1 if the wolfSSL library does not support the profile.</returns>
+int TlsProfile_Apply(WOLFSSL *ssl, const TlsProfile *profile);
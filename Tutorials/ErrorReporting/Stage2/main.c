@@ -11,6 +11,7 @@
 // - gpio (digital input for button, digital output for LED)
 // - log (messages shown in Visual Studio's and VS Code's Device Output window during debugging)
 // - eventloop (system invokes handlers for IO events)
+// - storage (mutable storage, which holds a journal of the application's starts, exits and crashes)
 
 #include <errno.h>
 #include <signal.h>
@@ -39,6 +40,9 @@
 // This tutorial uses a single-thread event loop pattern.
 #include "eventloop_timer_utilities.h"
 
+// The event journal is shared with other samples.
+#include "event_journal.h"
+
 /// <summary>
 /// Termination codes for this application. These are used for the
 /// application exit code. They must all be between zero and 255,
@@ -86,12 +90,20 @@ static bool buttonToggle = true;
 // Termination state
 static volatile sig_atomic_t exitCode = ExitCode_Success;
 
+// The event journal is kept in the first 1KB of mutable storage, which holds 64 events.
+static const off_t eventJournalOffset = 0;
+static const size_t eventJournalSize = 1024;
+// Number of events which are read from the journal at once.
+#define EVENT_JOURNAL_BATCH_SIZE 8
+
 static void TerminationHandler(int signalNumber);
 static void BlinkingLedTimerEventHandler(EventLoopTimer *timer);
 static void ButtonTimerEventHandler(EventLoopTimer *timer);
 static void CheckButtonA(void);
 static void CheckButtonB(void);
 static bool IsButtonPressed(int fd, GPIO_Value_Type *oldState);
+static void OpenEventJournal(void);
+static void ReportEventJournal(void);
 static ExitCode InitPeripheralsAndHandlers(void);
 static void CloseFdAndPrintError(int fd, const char *fdName);
 static void ClosePeripheralsAndHandlers(void);
@@ -198,6 +210,51 @@ static bool IsButtonPressed(int fd, GPIO_Value_Type *oldState)
     return isButtonPressed;
 }
 
+/// <summary>
+///     Open the event journal, which records this start, and record crashes in it. Failures are
+///     logged, but do not stop the application.
+/// </summary>
+static void OpenEventJournal(void)
+{
+    if (EventJournal_Open(eventJournalOffset, eventJournalSize) == -1) {
+        Log_Debug("WARNING: Could not open the event journal: %s (%d).\n", strerror(errno), errno);
+        return;
+    }
+
+    if (EventJournal_InstallCrashHandler() == -1) {
+        Log_Debug("WARNING: Could not record crashes in the event journal: %s (%d).\n",
+                  strerror(errno), errno);
+    }
+
+    ReportEventJournal();
+}
+
+/// <summary>
+///     Logs the events which have been recorded since they were last reported, in batches, and
+///     acknowledges each batch. An application which is connected would upload each batch
+///     instead, and acknowledge it once the upload has been received.
+/// </summary>
+static void ReportEventJournal(void)
+{
+    static const char *const typeNames[] = {"", "start", "exit", "crash", "lost"};
+
+    EventJournal_Entry entries[EVENT_JOURNAL_BATCH_SIZE];
+    int count;
+    while ((count = EventJournal_ReadBatch(entries, EVENT_JOURNAL_BATCH_SIZE)) > 0) {
+        for (int i = 0; i < count; ++i) {
+            Log_Debug("INFO: Event %u: %s, code %u, uptime %u s, peak memory %u KB.\n",
+                      entries[i].sequence, typeNames[entries[i].type], entries[i].code,
+                      entries[i].uptimeSeconds, entries[i].peakUserModeMemoryKB);
+        }
+
+        if (EventJournal_Acknowledge(entries[count - 1].sequence) == -1) {
+            Log_Debug("WARNING: Could not acknowledge events: %s (%d).\n", strerror(errno),
+                      errno);
+            break;
+        }
+    }
+}
+
 /// <summary>
 ///     Set up SIGTERM termination handler, initialize peripherals, and set up event handlers.
 /// </summary>
@@ -318,6 +375,7 @@ static void ClosePeripheralsAndHandlers(void)
 int main(int argc, char *argv[])
 {
     Log_Debug("Error Reporting application starting.\n");
+    OpenEventJournal();
     exitCode = InitPeripheralsAndHandlers();
 
     // Use event loop to wait for events and trigger handlers, until an error or SIGTERM happens
@@ -334,6 +392,8 @@ int main(int argc, char *argv[])
     }
 
     ClosePeripheralsAndHandlers();
+    EventJournal_RecordExit((uint8_t)exitCode);
+    EventJournal_Close();
     Log_Debug("Application exiting.\n");
     return exitCode;
 }
\ No newline at end of file